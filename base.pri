@@ -8,7 +8,7 @@ CONFIG -= app_bundle
 #### QT STUFF ##################################################################
 
 TEMPLATE = app
-QT = core gui svg
+QT = core gui svg network
 
 ##### INCLUDE PATH #############################################################
 
@@ -17,12 +17,58 @@ INCLUDEPATH += $$PWD/src $$VCGPATH $$VCGPATH/eigenlib
 DEFINES += EIGEN_DONT_ALIGN_STATICALLY
 DEFINES += EIGEN_MAX_STATIC_ALIGN_BYTES=0
 
+#### LOGGING ##################################################################
+
+# Release builds compile out the debug messages (qmake LOG_MAX_LEVEL=0 also
+# removes the verbose ones), debug builds (qmake -after CONFIG+=debug) keep all
+# levels
+
+CONFIG(debug, debug|release) {
+    LOG_MAX_LEVEL = 2
+} else:isEmpty(LOG_MAX_LEVEL) {
+    LOG_MAX_LEVEL = 1
+}
+DEFINES += LOG_MAX_LEVEL=$$LOG_MAX_LEVEL
+
+#### OPENGL ERRORS ############################################################
+
+# The OpenGL errors are reported asynchronously by the debug output of the
+# contexts. qmake GL_STRICT_ERRORS=1 (and debug builds) also checks glGetError
+# after the calls, which stalls the driver, and requests debug contexts
+
+CONFIG(debug, debug|release)|equals(GL_STRICT_ERRORS, 1) {
+    DEFINES += GL_STRICT_ERRORS
+}
+
+#### TEXTURE COORDINATES ######################################################
+
+# qmake FLOAT_TEXCOORDS=1 stores the texture coordinates of the meshes in single
+# precision, the computations on them are still carried out in double
+
+equals(FLOAT_TEXCOORDS, 1) {
+    DEFINES += FLOAT_TEXCOORDS
+}
+
+#### INSTRUCTION SET ##########################################################
+
+# By default the code is compiled for the instruction set of the build machine
+# (-march=native). qmake CPU_DISPATCH=1 builds portable binaries: the code
+# targets the baseline of the architecture, and the SIMD kernels (see
+# cpu_features.h) are compiled for several instruction sets and selected at
+# startup (x86-64 Linux builds with GCC or Clang)
+
+equals(CPU_DISPATCH, 1) {
+    DEFINES += CPU_DISPATCH
+}
+
 #### PLATFORM SPECIFIC #########################################################
 
 unix|mingw-g++ {
     # For GCC and Clang on Unix-like systems (including MinGW-g++)
     QMAKE_CXXFLAGS += -fopenmp
-    QMAKE_CXXFLAGS += -march=native
+    !equals(CPU_DISPATCH, 1) {
+        QMAKE_CXXFLAGS += -march=native
+    }
     LIBS += -fopenmp
     QMAKE_CXXFLAGS_RELEASE -= -O
     QMAKE_CXXFLAGS_RELEASE -= -O1
@@ -41,6 +87,11 @@ unix {
   LIBS += -lGLU
 }
 
+# shm_open (the shared memory sheet sink) is in librt before glibc 2.34
+linux {
+  LIBS += -lrt
+}
+
 win32 {
   LIBS += -lopengl32
   DEFINES += NOMINMAX
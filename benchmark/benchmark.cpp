@@ -0,0 +1,274 @@
+/*******************************************************************************
+    Copyright (c) 2021, Andrea Maggiordomo, Paolo Cignoni and Marco Tarini
+
+    This file is part of TextureDefrag, a reference implementation for
+    the paper ``Texture Defragmentation for Photo-Reconstructed 3D Models''
+    by Andrea Maggiordomo, Paolo Cignoni and Marco Tarini.
+
+    TextureDefrag is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    TextureDefrag is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with TextureDefrag. If not, see <https://www.gnu.org/licenses/>.
+*******************************************************************************/
+
+
+#include "benchmark.h"
+#include "logging.h"
+#include "run_report.h"
+#include "utils.h"
+
+#include <iostream>
+#include <cstdio>
+#include <cstdlib>
+#include <algorithm>
+
+#include <omp.h>
+
+#include <QCoreApplication>
+
+/* Runs the microbenchmarks of the core kernels of the pipeline. The cases are
+ * defined in kernels.cpp, the ones that work on real data use the charts of the
+ * mesh given on the command line and are skipped without it */
+
+struct Args {
+    std::string infile = "";
+    std::string f = ""; // only run the cases whose name contains this string
+    double t = 0.5; // minimum timed seconds of each case
+    int n = 0; // number of OpenMP threads (0 for the default)
+    std::string S = ""; // JSON report output file
+    int l = -1;
+};
+
+namespace bench {
+
+struct Case {
+    std::string name;
+    Function fn;
+    int64_t arg;
+};
+
+static std::vector<Case>& Cases()
+{
+    static std::vector<Case> cases;
+    return cases;
+}
+
+static std::string meshFile;
+
+State::State(int64_t arg, int64_t maxIterations)
+    : arg{arg},
+      maxIterations{maxIterations},
+      iterations{0},
+      elapsed{Clock::duration::zero()},
+      paused{true},
+      itemsProcessed{0}
+{
+}
+
+bool State::KeepRunning()
+{
+    if (iterations == 0 && maxIterations > 0) {
+        paused = false;
+        start = Clock::now();
+    }
+    if (iterations < maxIterations) {
+        iterations++;
+        return true;
+    }
+    if (!paused)
+        PauseTiming();
+    return false;
+}
+
+void State::PauseTiming()
+{
+    ensure(!paused);
+    elapsed += Clock::now() - start;
+    paused = true;
+}
+
+void State::ResumeTiming()
+{
+    ensure(paused);
+    start = Clock::now();
+    paused = false;
+}
+
+int Register(const char *name, Function fn, const std::vector<int64_t>& args)
+{
+    if (args.empty()) {
+        Cases().push_back(Case{name, fn, 0});
+    } else {
+        for (int64_t arg : args)
+            Cases().push_back(Case{std::string(name) + "/" + std::to_string(arg), fn, arg});
+    }
+    return 0;
+}
+
+const std::string& MeshFile()
+{
+    return meshFile;
+}
+
+} // namespace bench
+
+void PrintArgsUsage(const char *binary);
+bool ParseOption(const std::string& option, const std::string& argument, Args *args);
+Args ParseArgs(int argc, char *argv[]);
+
+/* Runs the case with a growing number of iterations until the timed part of
+ * the loop takes at least minSeconds, returns the state of the last run */
+static bench::State RunCase(const bench::Case& c, double minSeconds)
+{
+    const int64_t MAX_ITERATIONS = 1000000000;
+    int64_t iterations = 1;
+    while (true) {
+        bench::State state(c.arg, iterations);
+        c.fn(state);
+        if (!state.Error().empty() || state.Seconds() >= minSeconds || iterations >= MAX_ITERATIONS)
+            return state;
+        // aim 40% past the minimum time, growing at most 10x per run
+        double growth = std::min(10.0, 1.4 * minSeconds / std::max(state.Seconds(), 1e-9));
+        iterations = std::min(MAX_ITERATIONS, std::max(iterations + 1, (int64_t) (iterations * growth)));
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    Args args = ParseArgs(argc, argv);
+
+    LOG_INIT(args.l);
+    LOG_SET_ASYNC(false);
+
+    // the application object sets up the image format plugins used to load the textures
+    QCoreApplication app(argc, argv);
+
+    if (args.n > 0)
+        omp_set_num_threads(args.n);
+
+    bench::meshFile = args.infile;
+
+    std::printf("%-40s %14s %12s %14s  %s\n", "Benchmark", "Time/iter", "Iterations", "Items/s", "Label");
+    std::printf("%s\n", std::string(96, '-').c_str());
+
+    int numRun = 0;
+    for (const auto& c : bench::Cases()) {
+        if (args.f != "" && c.name.find(args.f) == std::string::npos)
+            continue;
+
+        bench::State state = RunCase(c, args.t);
+        numRun++;
+
+        std::string section = "benchmarks/" + c.name;
+        if (!state.Error().empty()) {
+            std::printf("%-40s %s\n", c.name.c_str(), ("skipped: " + state.Error()).c_str());
+            ReportValue(section, "skipped", state.Error());
+            continue;
+        }
+
+        double nsPerIteration = state.Seconds() * 1e9 / state.Iterations();
+        double itemsPerSecond = state.ItemsProcessed() / state.Seconds();
+
+        char timeString[32];
+        if (nsPerIteration < 1e4)
+            std::snprintf(timeString, sizeof(timeString), "%.1f ns", nsPerIteration);
+        else if (nsPerIteration < 1e7)
+            std::snprintf(timeString, sizeof(timeString), "%.1f us", nsPerIteration / 1e3);
+        else
+            std::snprintf(timeString, sizeof(timeString), "%.1f ms", nsPerIteration / 1e6);
+
+        char itemsString[32] = "";
+        if (state.ItemsProcessed() > 0)
+            std::snprintf(itemsString, sizeof(itemsString), "%.4gM", itemsPerSecond / 1e6);
+
+        std::printf("%-40s %14s %12lld %14s  %s\n", c.name.c_str(), timeString, (long long) state.Iterations(), itemsString, state.Label().c_str());
+        std::fflush(stdout);
+
+        ReportValue(section, "iterations", (double) state.Iterations());
+        ReportValue(section, "ns_per_iteration", nsPerIteration);
+        if (state.ItemsProcessed() > 0)
+            ReportValue(section, "items_per_second", itemsPerSecond);
+        if (!state.Label().empty())
+            ReportValue(section, "label", state.Label());
+    }
+
+    if (numRun == 0)
+        std::cerr << "No benchmark matches the filter " << args.f << std::endl;
+
+    if (args.S != "")
+        WriteReport(args.S);
+
+    return 0;
+}
+
+void PrintArgsUsage(const char *binary) {
+    Args def;
+    std::cout << "Usage: " << binary << " [MESHFILE] [-ftnSl]" << std::endl;
+    std::cout << std::endl;
+    std::cout << "MESHFILE specifies the mesh whose charts are used by the cases on real data (skipped if not given)" << std::endl;
+    std::cout << std::endl;
+    std::cout << "-f  <val>      " << "Only run the benchmarks whose name contains the given string." << std::endl;
+    std::cout << "-t  <val>      " << "Minimum timed seconds of each benchmark." << " (default: " << def.t << ")" << std::endl;
+    std::cout << "-n  <val>      " << "Number of OpenMP threads, 0 for the default." << " (default: " << def.n << ")" << std::endl;
+    std::cout << "-S  <val>      " << "Write the results as JSON to the given file." << std::endl;
+    std::cout << "-l  <val>      " << "Logging level, -1 to only log the warnings and the errors." << " (default: " << def.l << ")" << std::endl;
+    std::cout << std::endl;
+}
+
+bool ParseOption(const std::string& option, const std::string& argument, Args *args)
+{
+    ensure(option.size() == 2);
+    try {
+        switch (option[1]) {
+            case 'f' : args->f = argument; break;
+            case 't' : args->t = std::stod(argument); break;
+            case 'n' : args->n = std::stoi(argument); break;
+            case 'S' : args->S = argument; break;
+            case 'l' : args->l = std::stoi(argument); break;
+            default:
+                std::cerr << "Unrecognized option " << option << std::endl << std::endl;
+                return false;
+        }
+    } catch (std::exception&) {
+        std::cerr << "Error while parsing option `" << option << " " << argument << "`" << std::endl << std::endl;
+        return false;
+    }
+    return true;
+}
+
+Args ParseArgs(int argc, char *argv[])
+{
+    Args args;
+
+    for (int i = 1; i < argc; ++i) {
+        std::string argi(argv[i]);
+        if (argi == "-h" || argi == "--help") {
+            PrintArgsUsage(argv[0]);
+            std::exit(0);
+        } else if (argi[0] == '-' && argi.size() == 2) {
+            i++;
+            if (i >= argc) {
+                std::cerr << "Missing argument for option " << argi << std::endl << std::endl;
+                PrintArgsUsage(argv[0]);
+                std::exit(-1);
+            } else {
+                if (!ParseOption(argi, std::string(argv[i]), &args)) {
+                    PrintArgsUsage(argv[0]);
+                    std::exit(-1);
+                }
+            }
+        } else {
+            args.infile = argi;
+        }
+    }
+
+    return args;
+}
@@ -0,0 +1,112 @@
+/*******************************************************************************
+    Copyright (c) 2021, Andrea Maggiordomo, Paolo Cignoni and Marco Tarini
+
+    This file is part of TextureDefrag, a reference implementation for
+    the paper ``Texture Defragmentation for Photo-Reconstructed 3D Models''
+    by Andrea Maggiordomo, Paolo Cignoni and Marco Tarini.
+
+    TextureDefrag is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    TextureDefrag is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with TextureDefrag. If not, see <https://www.gnu.org/licenses/>.
+*******************************************************************************/
+
+
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+#include <string>
+#include <vector>
+#include <chrono>
+#include <cstdint>
+
+/* Minimal harness for the microbenchmarks, modeled on Google Benchmark. A case
+ * is a function that runs the measured code in a `while (state.KeepRunning())`
+ * loop, and is registered with the arguments it is run with. The harness grows
+ * the number of iterations until the timed part of the loop runs for at least
+ * the minimum time, and reports the time per iteration of the last run. The
+ * setup of each iteration can be excluded with PauseTiming()/ResumeTiming() */
+
+namespace bench {
+
+class State {
+
+    typedef std::chrono::steady_clock Clock;
+
+    int64_t arg;
+    int64_t maxIterations;
+    int64_t iterations;
+
+    Clock::time_point start;
+    Clock::duration elapsed;
+    bool paused;
+
+    int64_t itemsProcessed;
+    std::string label;
+    std::string error;
+
+public:
+
+    State(int64_t arg, int64_t maxIterations);
+
+    /* Returns true while the loop has iterations left to run, the timer is
+     * started by the first call and stopped by the last one */
+    bool KeepRunning();
+
+    int64_t range() const { return arg; }
+    int64_t Iterations() const { return iterations; }
+
+    void PauseTiming();
+    void ResumeTiming();
+
+    void SetItemsProcessed(int64_t n) { itemsProcessed = n; }
+    void SetLabel(const std::string& s) { label = s; }
+
+    /* Marks the case as skipped, the loop must not be entered afterwards */
+    void SkipWithError(const std::string& s) { error = s; maxIterations = 0; }
+
+    double Seconds() const { return std::chrono::duration<double>(elapsed).count(); }
+    int64_t ItemsProcessed() const { return itemsProcessed; }
+    const std::string& Label() const { return label; }
+    const std::string& Error() const { return error; }
+};
+
+typedef void (*Function)(State&);
+
+/* Registers the case fn, run once for each of the arguments (or once with
+ * argument 0 if args is empty). Returns a dummy value to allow the registration
+ * from static initializers */
+int Register(const char *name, Function fn, const std::vector<int64_t>& args);
+
+/* Mesh file used by the cases that work on real data (empty if not given) */
+const std::string& MeshFile();
+
+/* Prevents the compiler from optimizing away the computation of value */
+template <typename T>
+inline void DoNotOptimize(const T& value)
+{
+#ifdef _MSC_VER
+    static const void * volatile sink;
+    sink = &value;
+#else
+    asm volatile("" : : "r,m"(value) : "memory");
+#endif
+}
+
+} // namespace bench
+
+#define BENCHMARK_CONCAT_(a, b) a ## b
+#define BENCHMARK_CONCAT(a, b) BENCHMARK_CONCAT_(a, b)
+
+#define BENCHMARK(fn, ...) \
+    static int BENCHMARK_CONCAT(bench_registration_, __LINE__) = bench::Register(#fn, fn, {__VA_ARGS__})
+
+#endif // BENCHMARK_H
@@ -0,0 +1,13 @@
+include(../base.pri)
+include(../sources.pri)
+
+TARGET = texture-defrag-bench
+
+SOURCES += \
+    ../src/synthetic_atlas.cpp \
+    benchmark.cpp \
+    kernels.cpp
+
+HEADERS += \
+    ../src/synthetic_atlas.h \
+    benchmark.h
@@ -0,0 +1,13 @@
+include(../../base.pri)
+
+TARGET = texture-defrag-cachesim
+
+SOURCES += \
+    ../../src/logging.cpp \
+    ../../src/texture_access_trace.cpp \
+    main.cpp
+
+HEADERS += \
+    ../../src/logging.h \
+    ../../src/utils.h \
+    ../../src/texture_access_trace.h
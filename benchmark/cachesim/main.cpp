@@ -0,0 +1,226 @@
+/*******************************************************************************
+    Copyright (c) 2021, Andrea Maggiordomo, Paolo Cignoni and Marco Tarini
+
+    This file is part of TextureDefrag, a reference implementation for
+    the paper ``Texture Defragmentation for Photo-Reconstructed 3D Models''
+    by Andrea Maggiordomo, Paolo Cignoni and Marco Tarini.
+
+    TextureDefrag is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    TextureDefrag is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with TextureDefrag. If not, see <https://www.gnu.org/licenses/>.
+*******************************************************************************/
+
+
+#include "texture_access_trace.h"
+#include "logging.h"
+#include "utils.h"
+
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+
+#include <QCoreApplication>
+
+/* Replays the texture access traces recorded by texture-defrag (-J textures=file) against
+ * the eviction policies of the texture cache at several budgets, and prints the hit
+ * rate and the uploaded bytes of each combination, to choose the cache budget (-c)
+ * without rendering the inputs again */
+
+struct Args {
+    std::string infile = "";
+    std::string b = "0.25,0.5,1,2,4,8"; // budgets in GB
+    std::string p = "lru,cost,planned"; // policies
+    int l = 0;
+};
+
+void PrintArgsUsage(const char *binary);
+bool ParseOption(const std::string& option, const std::string& argument, Args *args);
+Args ParseArgs(int argc, char *argv[]);
+
+static std::vector<std::string> SplitList(const std::string& list)
+{
+    std::vector<std::string> items;
+    std::size_t begin = 0;
+    while (begin <= list.size()) {
+        std::size_t end = list.find(',', begin);
+        if (end == std::string::npos)
+            end = list.size();
+        if (end > begin)
+            items.push_back(list.substr(begin, end - begin));
+        begin = end + 1;
+    }
+    return items;
+}
+
+static bool ParsePolicy(const std::string& name, TextureCachePolicy *policy)
+{
+    for (TextureCachePolicy p : {TextureCachePolicy::LRU, TextureCachePolicy::CostAware, TextureCachePolicy::Planned}) {
+        if (name == TextureCachePolicyName(p)) {
+            *policy = p;
+            return true;
+        }
+    }
+    return false;
+}
+
+int main(int argc, char *argv[])
+{
+    Args args = ParseArgs(argc, argv);
+
+    LOG_INIT(args.l);
+    LOG_SET_ASYNC(false);
+
+    QCoreApplication app(argc, argv);
+
+    std::vector<TextureAccess> trace;
+    if (!ReadTextureAccessTrace(args.infile, trace)) {
+        LOG_ERR << "Unable to read the texture access trace " << args.infile;
+        return -1;
+    }
+
+    // the working set of each job is the size of the distinct textures it binds, a
+    // budget that holds it only misses the first use of each texture
+    std::map<int, std::map<int, uint64_t>> jobTextures;
+    for (const TextureAccess& a : trace)
+        jobTextures[a.job][a.texture] = std::max(jobTextures[a.job][a.texture], a.bytes);
+    uint64_t maxWorkingSet = 0;
+    for (const auto& job : jobTextures) {
+        uint64_t workingSet = 0;
+        for (const auto& t : job.second)
+            workingSet += t.second;
+        maxWorkingSet = std::max(maxWorkingSet, workingSet);
+    }
+
+    const double GB = 1024.0 * 1024.0 * 1024.0;
+    LOG_INFO << "Read " << trace.size() << " accesses of " << jobTextures.size() << " jobs, largest working set "
+             << maxWorkingSet / GB << " GB";
+
+    std::vector<TextureCachePolicy> policies;
+    for (const std::string& name : SplitList(args.p)) {
+        TextureCachePolicy policy;
+        if (!ParsePolicy(name, &policy)) {
+            LOG_ERR << "Unrecognized policy " << name;
+            return -1;
+        }
+        policies.push_back(policy);
+    }
+
+    std::cout << std::left << std::setw(10) << "policy" << std::right << std::setw(12) << "budget_gb" << std::setw(12) << "hit_rate"
+              << std::setw(12) << "misses" << std::setw(12) << "evictions" << std::setw(14) << "upload_gb" << std::endl;
+    std::cout << std::fixed;
+    for (const std::string& item : SplitList(args.b)) {
+        double budgetGB = std::stod(item);
+        uint64_t budgetBytes = uint64_t(budgetGB * GB);
+        for (TextureCachePolicy policy : policies) {
+            TextureCacheReplay replay = ReplayTextureAccessTrace(trace, policy, budgetBytes);
+            std::cout << std::left << std::setw(10) << TextureCachePolicyName(policy) << std::right
+                      << std::setw(12) << std::setprecision(3) << budgetGB
+                      << std::setw(12) << std::setprecision(4) << replay.HitRate()
+                      << std::setw(12) << replay.misses
+                      << std::setw(12) << replay.evictions
+                      << std::setw(14) << std::setprecision(3) << replay.uploadBytes / GB << std::endl;
+        }
+    }
+
+    return 0;
+}
+
+void PrintArgsUsage(const char *binary) {
+    Args def;
+    std::cout << "Usage: " << binary << " TRACEFILE [-bpl]" << std::endl;
+    std::cout << std::endl;
+    std::cout << "TRACEFILE specifies the texture access trace, recorded by texture-defrag with -J textures=TRACEFILE" << std::endl;
+    std::cout << std::endl;
+    std::cout << "-b  <val>      " << "Comma separated list of the cache budgets in GB, 0 for an unlimited cache." << " (default: " << def.b << ")" << std::endl;
+    std::cout << "-p  <val>      " << "Comma separated list of the eviction policies: lru (as texture-defrag without an access plan), "
+              << "cost (GreedyDual-Size-Frequency, keeps the textures used often and expensive to upload per byte) and planned "
+              << "(evicts the texture used again farthest in the future, the bound of any planned order)." << " (default: " << def.p << ")" << std::endl;
+    std::cout << "-l  <val>      " << "Logging level. 0 for minimal verbosity, 1 for verbose output, 2 for debug output." << " (default: " << def.l << ")" << std::endl;
+}
+
+bool ParseOption(const std::string& option, const std::string& argument, Args *args)
+{
+    ensure(option.size() == 2);
+    try {
+        switch (option[1]) {
+            case 'b' :
+                for (const std::string& item : SplitList(argument))
+                    if (std::stod(item) < 0)
+                        throw std::invalid_argument("negative budget");
+                args->b = argument;
+                break;
+            case 'p' : {
+                TextureCachePolicy policy;
+                for (const std::string& item : SplitList(argument)) {
+                    if (!ParsePolicy(item, &policy)) {
+                        std::cerr << "Unrecognized policy " << item << std::endl << std::endl;
+                        return false;
+                    }
+                }
+                args->p = argument;
+                break;
+            }
+            case 'l' : args->l = std::stoi(argument); break;
+            default:
+                std::cerr << "Unrecognized option " << option << std::endl << std::endl;
+                return false;
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "Error while parsing option `" << option << " " << argument << "`: " << e.what() << std::endl << std::endl;
+        return false;
+    }
+    if (SplitList(args->b).empty() || SplitList(args->p).empty()) {
+        std::cerr << "Invalid value of option " << option << std::endl << std::endl;
+        return false;
+    }
+    return true;
+}
+
+Args ParseArgs(int argc, char *argv[])
+{
+    if (argc < 2) {
+        PrintArgsUsage(argv[0]);
+        std::exit(-1);
+    }
+
+    Args args;
+
+    for (int i = 1; i < argc; ++i) {
+        std::string argi(argv[i]);
+        if (argi[0] == '-' && argi.size() == 2) {
+            i++;
+            if (i >= argc) {
+                std::cerr << "Missing argument for option " << argi << std::endl << std::endl;
+                PrintArgsUsage(argv[0]);
+                std::exit(-1);
+            } else {
+                if (!ParseOption(argi, std::string(argv[i]), &args)) {
+                    PrintArgsUsage(argv[0]);
+                    std::exit(-1);
+                }
+            }
+        } else {
+            args.infile = argi;
+        }
+    }
+
+    if (args.infile == "") {
+        std::cerr << "Missing trace file argument" << std::endl << std::endl;
+        PrintArgsUsage(argv[0]);
+        std::exit(-1);
+    }
+
+    return args;
+}
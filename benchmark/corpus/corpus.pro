@@ -0,0 +1,11 @@
+include(../../base.pri)
+include(../../sources.pri)
+
+TARGET = texture-defrag-corpus
+
+SOURCES += \
+    ../../src/synthetic_atlas.cpp \
+    main.cpp
+
+HEADERS += \
+    ../../src/synthetic_atlas.h
@@ -0,0 +1,498 @@
+/*******************************************************************************
+    Copyright (c) 2021, Andrea Maggiordomo, Paolo Cignoni and Marco Tarini
+
+    This file is part of TextureDefrag, a reference implementation for
+    the paper ``Texture Defragmentation for Photo-Reconstructed 3D Models''
+    by Andrea Maggiordomo, Paolo Cignoni and Marco Tarini.
+
+    TextureDefrag is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    TextureDefrag is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with TextureDefrag. If not, see <https://www.gnu.org/licenses/>.
+*******************************************************************************/
+
+
+#include "synthetic_atlas.h"
+#include "logging.h"
+#include "utils.h"
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <cstdio>
+#include <cmath>
+#include <algorithm>
+#include <map>
+#include <vector>
+#include <string>
+
+#include <QCoreApplication>
+#include <QProcess>
+#include <QFile>
+#include <QFileInfo>
+#include <QDir>
+#include <QJsonDocument>
+#include <QJsonObject>
+
+/* Runs texture-defrag on a corpus of meshes and compares the per-phase wall
+ * times and the output statistics (read from the run reports) against a
+ * baseline written by a previous run of the corpus.
+ *
+ * Each line of the corpus file is a case: a name, the input mesh and the
+ * options passed to texture-defrag. The input can also be a synthetic atlas,
+ * generated in the work directory the first time it is used
+ *
+ *   # name        input                                              options
+ *   merlin        meshes/merlin_textured.obj                         -r 4
+ *   terrain-1m    synthetic:faces=1000000,charts=5000,textures=4     -s 4
+ *
+ * Relative input paths are resolved against the directory of the corpus file.
+ * The synthetic parameters are shape (terrain or sphere), faces, charts, spread
+ * (of the chart areas), textures, size (of the texture images) and seed, see
+ * SyntheticAtlasParameters */
+
+struct Args {
+    std::string corpus = "";
+    std::string b = ""; // texture-defrag executable
+    std::string o = "corpus-work"; // work directory
+    std::string i = "auto"; // texture sheet renderer of the runs
+    int n = 1; // runs of each case
+    std::string B = ""; // baseline file
+    std::string W = ""; // results output file
+    double t = 0.15; // tolerance on the phase times
+    double q = 0.02; // tolerance on the output statistics
+    double m = 0.5; // phases shorter than this (in the baseline) are not checked
+    std::string f = ""; // only run the cases whose name contains this string
+    int l = 0;
+};
+
+struct CorpusCase {
+    std::string name;
+    std::string input;
+    QStringList options;
+};
+
+struct CaseResult {
+    bool ok = false;
+    std::map<std::string, double> phases; // median wall seconds of each phase
+    double total = 0;
+    double outputCharts = 0;
+    double outputMP = 0;
+    double peakRSS = 0;
+};
+
+void PrintArgsUsage(const char *binary);
+bool ParseOption(const std::string& option, const std::string& argument, Args *args);
+Args ParseArgs(int argc, char *argv[]);
+
+static bool ReadCorpus(const std::string& fileName, std::vector<CorpusCase>& cases);
+static bool ParseSyntheticSpec(const std::string& spec, SyntheticAtlasParameters& params);
+static std::string PrepareInput(const CorpusCase& c, const QDir& caseDir);
+static CaseResult RunCase(const CorpusCase& c, const std::string& input, const QDir& caseDir, const Args& args);
+static QJsonObject ToJson(const CaseResult& result);
+static int Compare(const CaseResult& result, const QJsonObject& baseline, const Args& args);
+
+int main(int argc, char *argv[])
+{
+    Args args = ParseArgs(argc, argv);
+
+    LOG_INIT(args.l);
+    LOG_SET_ASYNC(false);
+
+    QCoreApplication app(argc, argv);
+
+    if (args.b == "")
+        args.b = QDir(QCoreApplication::applicationDirPath()).absoluteFilePath("texture-defrag").toStdString();
+
+    std::vector<CorpusCase> cases;
+    if (!ReadCorpus(args.corpus, cases))
+        return -1;
+
+    QJsonObject baseline;
+    if (args.B != "") {
+        QFile file(QString::fromStdString(args.B));
+        QJsonParseError err;
+        QJsonDocument doc;
+        if (file.open(QIODevice::ReadOnly))
+            doc = QJsonDocument::fromJson(file.readAll(), &err);
+        if (!doc.isObject()) {
+            LOG_ERR << "Unable to read the baseline " << args.B;
+            return -1;
+        }
+        baseline = doc.object().value("cases").toObject();
+    }
+
+    QDir workDir(QString::fromStdString(args.o));
+    if (!workDir.mkpath(".")) {
+        LOG_ERR << "Unable to create the work directory " << args.o;
+        return -1;
+    }
+
+    QJsonObject results;
+    int failures = 0;
+    int regressions = 0;
+    for (const auto& c : cases) {
+        if (args.f != "" && c.name.find(args.f) == std::string::npos)
+            continue;
+
+        std::printf("== %s\n", c.name.c_str());
+        std::fflush(stdout);
+
+        QDir caseDir(workDir.absoluteFilePath(QString::fromStdString(c.name)));
+        caseDir.mkpath(".");
+
+        std::string input = PrepareInput(c, caseDir);
+        CaseResult result;
+        if (input != "")
+            result = RunCase(c, input, caseDir, args);
+
+        if (!result.ok) {
+            std::printf("   FAILED (see the logs in %s)\n", caseDir.absolutePath().toStdString().c_str());
+            failures++;
+            continue;
+        }
+
+        results.insert(QString::fromStdString(c.name), ToJson(result));
+        QJsonObject caseBaseline = baseline.value(QString::fromStdString(c.name)).toObject();
+        if (args.B != "" && caseBaseline.isEmpty())
+            std::printf("   (no baseline)\n");
+        regressions += Compare(result, caseBaseline, args);
+    }
+
+    if (args.W != "") {
+        QJsonObject root;
+        root.insert("renderer", QString::fromStdString(args.i));
+        root.insert("runs", args.n);
+        root.insert("cases", results);
+        QFile file(QString::fromStdString(args.W));
+        if (file.open(QIODevice::WriteOnly | QIODevice::Truncate) && file.write(QJsonDocument(root).toJson()) > 0)
+            LOG_INFO << "Saved the results to " << args.W;
+        else
+            LOG_ERR << "Unable to write the results to " << args.W;
+    }
+
+    std::printf("%d failures, %d regressions\n", failures, regressions);
+
+    return (failures > 0 || regressions > 0) ? 1 : 0;
+}
+
+void PrintArgsUsage(const char *binary) {
+    Args def;
+    std::cout << "Usage: " << binary << " CORPUSFILE [-boinBWtqmfl]" << std::endl;
+    std::cout << std::endl;
+    std::cout << "CORPUSFILE lists the cases, one per line: name, input mesh (or synthetic:shape=S,faces=N,charts=N,spread=X,textures=N,size=N,seed=N) and texture-defrag options" << std::endl;
+    std::cout << std::endl;
+    std::cout << "-b  <val>      " << "texture-defrag executable. (default: texture-defrag in the directory of this executable)" << std::endl;
+    std::cout << "-o  <val>      " << "Work directory, with the synthetic inputs, the outputs, the logs and the reports of each case." << " (default: " << def.o << ")" << std::endl;
+    std::cout << "-i  <val>      " << "Texture sheet renderer of the runs (gpu, cpu, auto or none). Use none to only time the CPU phases." << " (default: " << def.i << ")" << std::endl;
+    std::cout << "-n  <val>      " << "Number of runs of each case, the median phase times are compared." << " (default: " << def.n << ")" << std::endl;
+    std::cout << "-B  <val>      " << "Baseline file the results are compared against." << std::endl;
+    std::cout << "-W  <val>      " << "Results output file, that can be used as baseline of later runs." << std::endl;
+    std::cout << "-t  <val>      " << "Relative tolerance on the phase times, slower phases are regressions." << " (default: " << def.t << ")" << std::endl;
+    std::cout << "-q  <val>      " << "Relative tolerance on the number of output charts and on the output megapixels, larger values are regressions." << " (default: " << def.q << ")" << std::endl;
+    std::cout << "-m  <val>      " << "Minimum time in seconds of the baseline phases that are checked." << " (default: " << def.m << ")" << std::endl;
+    std::cout << "-f  <val>      " << "Only run the cases whose name contains the given string." << std::endl;
+    std::cout << "-l  <val>      " << "Logging level. 0 for minimal verbosity, 1 for verbose output, 2 for debug output." << " (default: " << def.l << ")" << std::endl;
+}
+
+bool ParseOption(const std::string& option, const std::string& argument, Args *args)
+{
+    ensure(option.size() == 2);
+    try {
+        switch (option[1]) {
+            case 'b' : args->b = argument; break;
+            case 'o' : args->o = argument; break;
+            case 'i' : args->i = argument; break;
+            case 'n' : args->n = std::max(1, std::stoi(argument)); break;
+            case 'B' : args->B = argument; break;
+            case 'W' : args->W = argument; break;
+            case 't' : args->t = std::stod(argument); break;
+            case 'q' : args->q = std::stod(argument); break;
+            case 'm' : args->m = std::stod(argument); break;
+            case 'f' : args->f = argument; break;
+            case 'l' : args->l = std::stoi(argument); break;
+            default:
+                std::cerr << "Unrecognized option " << option << std::endl << std::endl;
+                return false;
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "Error while parsing option `" << option << " " << argument << "`: " << e.what() << std::endl << std::endl;
+        return false;
+    }
+    return true;
+}
+
+Args ParseArgs(int argc, char *argv[])
+{
+    if (argc < 2) {
+        PrintArgsUsage(argv[0]);
+        std::exit(-1);
+    }
+
+    Args args;
+
+    for (int i = 1; i < argc; ++i) {
+        std::string argi(argv[i]);
+        if (argi[0] == '-' && argi.size() == 2) {
+            i++;
+            if (i >= argc) {
+                std::cerr << "Missing argument for option " << argi << std::endl << std::endl;
+                PrintArgsUsage(argv[0]);
+                std::exit(-1);
+            } else {
+                if (!ParseOption(argi, std::string(argv[i]), &args)) {
+                    PrintArgsUsage(argv[0]);
+                    std::exit(-1);
+                }
+            }
+        } else {
+            args.corpus = argi;
+        }
+    }
+
+    if (args.corpus == "") {
+        std::cerr << "Missing corpus file argument" << std::endl << std::endl;
+        PrintArgsUsage(argv[0]);
+        std::exit(-1);
+    }
+
+    return args;
+}
+
+
+// -- static functions ---------------------------------------------------------
+
+static bool ReadCorpus(const std::string& fileName, std::vector<CorpusCase>& cases)
+{
+    std::ifstream in(fileName);
+    if (!in) {
+        LOG_ERR << "Unable to read the corpus file " << fileName;
+        return false;
+    }
+
+    QDir corpusDir = QFileInfo(QString::fromStdString(fileName)).absoluteDir();
+
+    std::string line;
+    int lineNumber = 0;
+    while (std::getline(in, line)) {
+        lineNumber++;
+        line = line.substr(0, line.find('#'));
+        std::istringstream ls(line);
+        CorpusCase c;
+        if (!(ls >> c.name))
+            continue;
+        if (!(ls >> c.input)) {
+            LOG_ERR << fileName << ":" << lineNumber << ": missing input of case " << c.name;
+            return false;
+        }
+        if (c.input.compare(0, 10, "synthetic:") != 0)
+            c.input = corpusDir.absoluteFilePath(QString::fromStdString(c.input)).toStdString();
+        std::string option;
+        while (ls >> option)
+            c.options.append(QString::fromStdString(option));
+        for (const auto& other : cases) {
+            if (other.name == c.name) {
+                LOG_ERR << fileName << ":" << lineNumber << ": duplicate case " << c.name;
+                return false;
+            }
+        }
+        cases.push_back(c);
+    }
+    return true;
+}
+
+static bool ParseSyntheticSpec(const std::string& spec, SyntheticAtlasParameters& params)
+{
+    std::istringstream ss(spec.substr(10));
+    std::string item;
+    try {
+        while (std::getline(ss, item, ',')) {
+            std::size_t eq = item.find('=');
+            if (eq == std::string::npos)
+                return false;
+            std::string key = item.substr(0, eq);
+            std::string value = item.substr(eq + 1);
+            if (key == "shape" && (value == "terrain" || value == "sphere"))
+                params.shape = (value == "sphere") ? SyntheticShape::Sphere : SyntheticShape::Terrain;
+            else if (key == "faces")    params.faces = std::stoi(value);
+            else if (key == "charts")   params.charts = std::stoi(value);
+            else if (key == "spread")   params.spread = std::stod(value);
+            else if (key == "textures") params.textures = std::stoi(value);
+            else if (key == "size")     params.textureSize = std::stoi(value);
+            else if (key == "seed")     params.seed = (unsigned) std::stoul(value);
+            else return false;
+        }
+    } catch (const std::exception&) {
+        return false;
+    }
+    return params.faces > 0 && params.charts > 0 && params.textures > 0 && params.textureSize > 0 && params.spread >= 0;
+}
+
+/* Returns the input mesh of the case, generating the synthetic atlases that are
+ * not in the case directory (or that were generated with a different spec).
+ * Returns an empty string on failure */
+static std::string PrepareInput(const CorpusCase& c, const QDir& caseDir)
+{
+    if (c.input.compare(0, 10, "synthetic:") != 0)
+        return c.input;
+
+    SyntheticAtlasParameters params;
+    if (!ParseSyntheticSpec(c.input, params)) {
+        LOG_ERR << "Invalid synthetic input " << c.input;
+        return "";
+    }
+
+    QDir inputDir(caseDir.absoluteFilePath("input"));
+    inputDir.mkpath(".");
+    std::string meshFile = inputDir.absoluteFilePath("synthetic.obj").toStdString();
+
+    QFile specFile(inputDir.absoluteFilePath("spec.txt"));
+    if (QFileInfo(QString::fromStdString(meshFile)).exists() && specFile.open(QIODevice::ReadOnly)) {
+        if (specFile.readAll().toStdString() == c.input)
+            return meshFile;
+        specFile.close();
+    }
+
+    LOG_INFO << "Generating " << c.input;
+    if (!SaveSyntheticAtlas(meshFile.c_str(), params)) {
+        LOG_ERR << "Unable to generate " << c.input;
+        return "";
+    }
+    if (specFile.open(QIODevice::WriteOnly | QIODevice::Truncate))
+        specFile.write(c.input.c_str());
+    return meshFile;
+}
+
+static double Median(std::vector<double> v)
+{
+    ensure(!v.empty());
+    std::sort(v.begin(), v.end());
+    std::size_t k = v.size() / 2;
+    return (v.size() % 2 == 1) ? v[k] : 0.5 * (v[k - 1] + v[k]);
+}
+
+/* Runs texture-defrag args.n times on the case, the log and the report of each
+ * run are written in the case directory */
+static CaseResult RunCase(const CorpusCase& c, const std::string& input, const QDir& caseDir, const Args& args)
+{
+    CaseResult result;
+
+    std::map<std::string, std::vector<double>> phases;
+    std::vector<double> total;
+    std::vector<double> peakRSS;
+    for (int k = 0; k < args.n; ++k) {
+        QString reportFile = caseDir.absoluteFilePath(QString("report_%1.json").arg(k));
+        QString logFile = caseDir.absoluteFilePath(QString("run_%1.log").arg(k));
+        QFile::remove(reportFile);
+
+        QStringList arguments;
+        arguments << QString::fromStdString(input)
+                  << "-o" << caseDir.absoluteFilePath("out.obj")
+                  << "-S" << reportFile
+                  << "-i" << QString::fromStdString(args.i)
+                  << c.options;
+
+        QProcess process;
+        process.setProcessChannelMode(QProcess::MergedChannels);
+        process.setStandardOutputFile(logFile);
+        process.start(QString::fromStdString(args.b), arguments);
+        if (!process.waitForStarted(-1)) {
+            LOG_ERR << "Unable to start " << args.b;
+            return result;
+        }
+        process.waitForFinished(-1);
+        if (process.exitStatus() != QProcess::NormalExit || process.exitCode() != 0) {
+            LOG_ERR << c.name << ": run " << k << " exited with code " << process.exitCode();
+            return result;
+        }
+
+        QFile file(reportFile);
+        QJsonDocument doc;
+        if (file.open(QIODevice::ReadOnly))
+            doc = QJsonDocument::fromJson(file.readAll());
+        if (!doc.isObject()) {
+            LOG_ERR << c.name << ": unable to read the report " << reportFile.toStdString();
+            return result;
+        }
+
+        QJsonObject report = doc.object();
+        QJsonObject reportPhases = report.value("phases").toObject();
+        for (auto it = reportPhases.begin(); it != reportPhases.end(); ++it)
+            phases[it.key().toStdString()].push_back(it.value().toObject().value("wall_s").toDouble());
+        total.push_back(report.value("run").toObject().value("total_s").toDouble());
+        peakRSS.push_back(report.value("memory").toObject().value("peak_rss_bytes").toDouble());
+
+        // the output statistics do not depend on the run
+        QJsonObject stats = report.value("result").toObject();
+        result.outputCharts = stats.value("OutputCharts").toDouble();
+        result.outputMP = stats.value("OutputMP").toDouble();
+    }
+
+    for (const auto& entry : phases)
+        result.phases[entry.first] = Median(entry.second);
+    result.total = Median(total);
+    result.peakRSS = *std::max_element(peakRSS.begin(), peakRSS.end());
+    result.ok = true;
+    return result;
+}
+
+static QJsonObject ToJson(const CaseResult& result)
+{
+    QJsonObject phases;
+    for (const auto& entry : result.phases)
+        phases.insert(QString::fromStdString(entry.first), entry.second);
+
+    QJsonObject obj;
+    obj.insert("total_s", result.total);
+    obj.insert("phases", phases);
+    obj.insert("OutputCharts", result.outputCharts);
+    obj.insert("OutputMP", result.outputMP);
+    obj.insert("peak_rss_bytes", result.peakRSS);
+    return obj;
+}
+
+/* Prints the results of the case next to the baseline values (if any), and
+ * returns the number of values out of the tolerance band. Times above the
+ * baseline by more than args.t and output statistics above the baseline by
+ * more than args.q are regressions, the peak memory is not checked */
+static int Compare(const CaseResult& result, const QJsonObject& baseline, const Args& args)
+{
+    int regressions = 0;
+
+    auto Row = [&] (const std::string& label, double value, const QJsonValue& base, double tolerance, bool isTime) {
+        if (isTime)
+            std::printf("   %-42s %12.3f s", label.c_str(), value);
+        else
+            std::printf("   %-42s %12.6g  ", label.c_str(), value);
+        if (base.isDouble()) {
+            double b = base.toDouble();
+            double change = (b != 0) ? (value - b) / b : 0;
+            bool checked = tolerance >= 0 && (!isTime || b >= args.m);
+            bool regression = checked && value > b * (1 + tolerance);
+            std::printf("   base %12.6g   %+7.1f%%%s", b, 100.0 * change, regression ? "   REGRESSION" : "");
+            if (regression)
+                regressions++;
+        }
+        std::printf("\n");
+    };
+
+    QJsonObject basePhases = baseline.value("phases").toObject();
+    for (const auto& entry : result.phases)
+        Row(entry.first, entry.second, basePhases.value(QString::fromStdString(entry.first)), args.t, true);
+    Row("Total", result.total, baseline.value("total_s"), args.t, true);
+    Row("OutputCharts", result.outputCharts, baseline.value("OutputCharts"), args.q, false);
+    Row("OutputMP", result.outputMP, baseline.value("OutputMP"), args.q, false);
+    Row("Peak RSS (MB)", result.peakRSS / (1024.0 * 1024.0), baseline.value("peak_rss_bytes").isDouble()
+        ? QJsonValue(baseline.value("peak_rss_bytes").toDouble() / (1024.0 * 1024.0)) : QJsonValue(), -1, false);
+    std::fflush(stdout);
+
+    return regressions;
+}
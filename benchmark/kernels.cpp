@@ -0,0 +1,647 @@
+/*******************************************************************************
+    Copyright (c) 2021, Andrea Maggiordomo, Paolo Cignoni and Marco Tarini
+
+    This file is part of TextureDefrag, a reference implementation for
+    the paper ``Texture Defragmentation for Photo-Reconstructed 3D Models''
+    by Andrea Maggiordomo, Paolo Cignoni and Marco Tarini.
+
+    TextureDefrag is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    TextureDefrag is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with TextureDefrag. If not, see <https://www.gnu.org/licenses/>.
+*******************************************************************************/
+
+
+#include "benchmark.h"
+
+#include "mesh.h"
+#include "mesh_graph.h"
+#include "mesh_attribute.h"
+#include "seam_remover.h"
+#include "arap.h"
+#include "shell.h"
+#include "intersection.h"
+#include "matching.h"
+#include "packing.h"
+#include "pushpull.h"
+#include "texture_object.h"
+#include "logging.h"
+#include "utils.h"
+
+#include <vector>
+#include <random>
+#include <memory>
+#include <algorithm>
+#include <cmath>
+
+#include <vcg/complex/algorithms/update/topology.h>
+#include <vcg/complex/algorithms/update/normal.h>
+#include <vcg/complex/algorithms/update/flag.h>
+#include <vcg/space/rasterized_outline2_packer.h>
+#include <wrap/qt/outline2_rasterizer.h>
+
+#include <QImage>
+#include <QPainter>
+
+/* The cases use fixed seeds, so that the synthetic inputs are the same across
+ * runs, and the ones on real data use the charts of the mesh given on the
+ * command line, prepared as in the main pipeline */
+
+typedef vcg::RasterizedOutline2Packer<float, QtOutline2Rasterizer> RasterizationBasedPacker;
+
+
+// -- data ---------------------------------------------------------------------
+
+struct MeshData {
+    Mesh m;
+    TextureObjectHandle textureObject;
+    GraphHandle graph;
+    std::vector<ChartHandle> charts; // by decreasing number of faces
+};
+
+/* Loads and prepares the mesh given on the command line the first time it is
+ * requested, returns nullptr if there is no mesh */
+static MeshData *GetMeshData(bench::State& state)
+{
+    static std::unique_ptr<MeshData> data;
+    static bool loaded = false;
+
+    if (!loaded) {
+        loaded = true;
+        if (bench::MeshFile() != "") {
+            std::unique_ptr<MeshData> md(new MeshData);
+            int loadMask;
+            if (LoadMesh(bench::MeshFile().c_str(), md->m, md->textureObject, loadMask) && (loadMask & tri::io::Mask::IOM_WEDGTEXCOORD)) {
+                tri::UpdateTopology<Mesh>::FaceFace(md->m);
+                tri::UpdateNormal<Mesh>::PerFaceNormalized(md->m);
+                tri::UpdateNormal<Mesh>::PerVertexNormalized(md->m);
+                ScaleTextureCoordinatesToImage(md->m, md->textureObject);
+                int vndup;
+                PrepareMesh(md->m, &vndup);
+                ComputeWedgeTexCoordStorageAttribute(md->m);
+                md->graph = ComputeGraph(md->m, md->textureObject);
+                for (auto& entry : md->graph->charts)
+                    md->charts.push_back(entry.second);
+                std::stable_sort(md->charts.begin(), md->charts.end(), [](const ChartHandle& c1, const ChartHandle& c2) {
+                    return c1->FN() > c2->FN();
+                });
+                data = std::move(md);
+            } else {
+                LOG_ERR << "Failed to load mesh " << bench::MeshFile() << " with wedge tex coords";
+            }
+        }
+    }
+
+    if (!data)
+        state.SkipWithError(bench::MeshFile() == "" ? "no mesh given" : "mesh not loaded");
+    return data.get();
+}
+
+static bool IsChartBorder(const MeshFace& f, int i)
+{
+    return face::IsBorder(f, i) || f.cFFp(i)->id != f.id;
+}
+
+static std::vector<HalfEdge> ChartBorder(const FaceGroup& chart)
+{
+    std::vector<HalfEdge> hvec;
+    for (auto fptr : chart.fpVec)
+        for (int i = 0; i < 3; ++i)
+            if (IsChartBorder(*fptr, i))
+                hvec.push_back(HalfEdge{fptr, i});
+    return hvec;
+}
+
+/* Builds a regular grid of side x side quads over a height field, with the tex
+ * coords perturbed by a random jitter. The target shape of each face is its 3D
+ * shape, so that ARAP has to undo the jitter and unfold the height field */
+static void BuildGridShell(Mesh& shell, int side, std::mt19937& gen)
+{
+    std::uniform_real_distribution<double> jitter(-0.2, 0.2);
+
+    tri::Allocator<Mesh>::AddVertices(shell, (side + 1) * (side + 1));
+    for (int j = 0; j <= side; ++j) {
+        for (int i = 0; i <= side; ++i) {
+            auto& v = shell.vert[j * (side + 1) + i];
+            v.P() = vcg::Point3d(i, j, 2.0 * std::sin(i * 0.3) * std::cos(j * 0.2));
+            v.T().P() = vcg::Point2d(i + jitter(gen), j + jitter(gen));
+        }
+    }
+
+    tri::Allocator<Mesh>::AddFaces(shell, 2 * side * side);
+    auto tsa = GetTargetShapeAttribute(shell);
+    for (int j = 0; j < side; ++j) {
+        for (int i = 0; i < side; ++i) {
+            int v0 = j * (side + 1) + i;
+            int corners[2][3] = {{v0, v0 + 1, v0 + side + 2}, {v0, v0 + side + 2, v0 + side + 1}};
+            for (int k = 0; k < 2; ++k) {
+                auto& f = shell.face[2 * (j * side + i) + k];
+                for (int h = 0; h < 3; ++h) {
+                    f.V(h) = &shell.vert[corners[k][h]];
+                    f.WT(h) = f.V(h)->T();
+                    tsa[f].P[h] = f.P(h);
+                }
+            }
+        }
+    }
+
+    tri::UpdateTopology<Mesh>::FaceFace(shell);
+    tri::UpdateTopology<Mesh>::VertexFace(shell);
+    tri::UpdateFlags<Mesh>::VertexBorderFromFaceAdj(shell);
+}
+
+/* Runs ARAP on the shell, restoring its initial tex coords before each solve.
+ * Two vertices of the first face are fixed, as in the optimization of the
+ * shells when no other vertex is constrained */
+static void SolveShell(bench::State& state, Mesh& shell, ARAPSolverBackend backend)
+{
+    std::vector<vcg::Point2d> initialTexCoords;
+    for (auto& v : shell.vert)
+        initialTexCoords.push_back(v.T().P());
+
+    int iterations = 0;
+    while (state.KeepRunning()) {
+        state.PauseTiming();
+        for (unsigned i = 0; i < shell.vert.size(); ++i)
+            shell.vert[i].T().P() = initialTexCoords[i];
+        for (auto& f : shell.face)
+            for (int i = 0; i < 3; ++i)
+                f.WT(i).P() = f.V(i)->T().P();
+        ARAP arap(shell);
+        arap.SetMaxIterations(100);
+        arap.SetSolverBackend(backend);
+        arap.FixVertex(shell.face[0].V(0), shell.face[0].V(0)->T().P());
+        arap.FixVertex(shell.face[0].V(1), shell.face[0].V(1)->T().P());
+        state.ResumeTiming();
+
+        ARAPSolveInfo si = arap.Solve();
+        iterations += si.iterations;
+    }
+    state.SetItemsProcessed((int64_t) state.Iterations() * shell.FN());
+    state.SetLabel(std::to_string(shell.FN()) + " faces, " + std::to_string(iterations / std::max<int64_t>(1, state.Iterations())) + " iterations");
+}
+
+/* Generates closed boundary loops of 64 segments, jittered circles spread over
+ * a square such that neighboring loops overlap. Each segment is the edge 0 of a
+ * degenerate face, as the intersection tests only read the tex coords of the
+ * edge endpoints */
+static void BuildBoundaryLoops(Mesh& m, int numSegments, std::mt19937& gen)
+{
+    const int LOOP_SEGMENTS = 64;
+    const double RADIUS = 1.0;
+    int numLoops = std::max(1, numSegments / LOOP_SEGMENTS);
+    double extent = 1.6 * RADIUS * std::sqrt((double) numLoops);
+
+    std::uniform_real_distribution<double> center(0, extent);
+    std::uniform_real_distribution<double> noise(0.85, 1.15);
+
+    tri::Allocator<Mesh>::AddVertices(m, numLoops * LOOP_SEGMENTS);
+    tri::Allocator<Mesh>::AddFaces(m, numLoops * LOOP_SEGMENTS);
+    for (int l = 0; l < numLoops; ++l) {
+        vcg::Point2d c(center(gen), center(gen));
+        for (int i = 0; i < LOOP_SEGMENTS; ++i) {
+            double a = 2.0 * M_PI * i / LOOP_SEGMENTS;
+            double r = RADIUS * noise(gen);
+            m.vert[l * LOOP_SEGMENTS + i].T().P() = c + vcg::Point2d(r * std::cos(a), r * std::sin(a));
+        }
+        for (int i = 0; i < LOOP_SEGMENTS; ++i) {
+            auto& f = m.face[l * LOOP_SEGMENTS + i];
+            f.V(0) = &m.vert[l * LOOP_SEGMENTS + i];
+            f.V(1) = &m.vert[l * LOOP_SEGMENTS + (i + 1) % LOOP_SEGMENTS];
+            f.V(2) = f.V(1);
+        }
+    }
+}
+
+static void RandomPointPairs(int n, std::mt19937& gen, std::vector<vcg::Point2d>& target, std::vector<vcg::Point2d>& matching)
+{
+    std::uniform_real_distribution<double> coord(0, 1000);
+    std::normal_distribution<double> noise(0, 0.5);
+    const double angle = 0.7;
+    const vcg::Point2d t(120, -35);
+
+    target.clear();
+    matching.clear();
+    for (int i = 0; i < n; ++i) {
+        vcg::Point2d p(coord(gen), coord(gen));
+        target.push_back(p);
+        matching.push_back(vcg::Point2d(std::cos(angle) * p.X() - std::sin(angle) * p.Y(), std::sin(angle) * p.X() + std::cos(angle) * p.Y())
+                           + t + vcg::Point2d(noise(gen), noise(gen)));
+    }
+}
+
+/* Star shaped outline of nv vertices with a radius between 0.6 and 1 times
+ * the given one */
+static Outline2f RandomOutline(int nv, float radius, std::mt19937& gen)
+{
+    std::uniform_real_distribution<float> r(0.6f, 1.0f);
+    Outline2f outline;
+    for (int i = 0; i < nv; ++i) {
+        float a = 2.0f * float(M_PI) * i / nv;
+        float ri = radius * r(gen);
+        outline.push_back(vcg::Point2f(ri * std::cos(a), ri * std::sin(a)));
+    }
+    return outline;
+}
+
+static RasterizationBasedPacker::Parameters PackingParameters()
+{
+    // same parameters used by Pack()
+    RasterizationBasedPacker::Parameters rpack_params;
+    rpack_params.costFunction = RasterizationBasedPacker::Parameters::LowestHorizon;
+    rpack_params.doubleHorizon = false;
+    rpack_params.innerHorizon = false;
+    rpack_params.permutations = false;
+    rpack_params.rotationNum = 4;
+    rpack_params.gutterWidth = 4;
+    rpack_params.minmax = false;
+    rpack_params.rasterizationLookAhead = 2;
+    return rpack_params;
+}
+
+/* Packs the outlines, clearing the rasterizer cache before each run so that
+ * every iteration rasterizes the outlines */
+static void PackOutlines(bench::State& state, const std::vector<Outline2f>& outlines, vcg::Point2i container, float scale)
+{
+    RasterizationBasedPacker::Parameters rpack_params = PackingParameters();
+    int packed = 0;
+    while (state.KeepRunning()) {
+        state.PauseTiming();
+        QtOutline2Rasterizer::clearCache();
+        std::vector<Outline2f> outlineVec = outlines;
+        std::vector<vcg::Similarity2f> trVec;
+        std::vector<int> polyToContainer;
+        state.ResumeTiming();
+
+        packed = RasterizationBasedPacker::PackBestEffortAtScale(outlineVec, {container}, trVec, polyToContainer, rpack_params, scale);
+    }
+    state.SetItemsProcessed((int64_t) state.Iterations() * outlines.size());
+    state.SetLabel(std::to_string(packed) + "/" + std::to_string(outlines.size()) + " packed");
+}
+
+/* Image of the given side with opaque random rectangles over a background of
+ * the color that PullPush() fills, covering about half of the image */
+static QImage RandomChartImage(int side, std::mt19937& gen)
+{
+    QImage img(side, side, QImage::Format_ARGB32);
+    img.fill(qRgba(0, 0, 0, 255));
+
+    std::uniform_int_distribution<int> pos(0, side - 1);
+    std::uniform_int_distribution<int> size(side / 64 + 1, side / 8 + 1);
+    std::uniform_int_distribution<int> channel(1, 255);
+
+    QPainter painter(&img);
+    long long covered = 0;
+    while (covered < (long long) side * side / 2) {
+        int w = size(gen);
+        int h = size(gen);
+        painter.fillRect(pos(gen), pos(gen), w, h, QColor(channel(gen), channel(gen), channel(gen)));
+        covered += (long long) w * h;
+    }
+    painter.end();
+    return img;
+}
+
+
+// -- ARAP ---------------------------------------------------------------------
+
+static void ARAPSolveGrid(bench::State& state)
+{
+    std::mt19937 gen(state.range());
+    Mesh shell;
+    BuildGridShell(shell, (int) state.range(), gen);
+    SolveShell(state, shell, SIMPLICIAL_LDLT);
+}
+BENCHMARK(ARAPSolveGrid, 8, 16, 32, 64, 128);
+
+static void ARAPSolveGridBiCGSTAB(bench::State& state)
+{
+    std::mt19937 gen(state.range());
+    Mesh shell;
+    BuildGridShell(shell, (int) state.range(), gen);
+    SolveShell(state, shell, BICGSTAB_ILUT);
+}
+BENCHMARK(ARAPSolveGridBiCGSTAB, 8, 32, 128);
+
+static void ARAPSolveGridDense(bench::State& state)
+{
+    std::mt19937 gen(state.range());
+    Mesh shell;
+    BuildGridShell(shell, (int) state.range(), gen);
+    SolveShell(state, shell, DENSE_LLT);
+}
+BENCHMARK(ARAPSolveGridDense, 2, 4, 8);
+
+/* Shell of the range-th largest chart of the mesh, built as in the local
+ * optimization of the greedy loop */
+static void ARAPSolveChart(bench::State& state)
+{
+    MeshData *md = GetMeshData(state);
+    if (!md)
+        return;
+    if (state.range() >= (int64_t) md->charts.size()) {
+        state.SkipWithError("not enough charts");
+        return;
+    }
+
+    FaceGroup& chart = *md->charts[state.range()];
+    Mesh shell;
+    BuildShellWithTargetsFromUV(shell, chart, 1.0);
+    for (unsigned i = 0; i < chart.FN(); ++i) {
+        for (int j = 0; j < 3; ++j) {
+            shell.face[i].WT(j) = chart.fpVec[i]->V(j)->T();
+            shell.face[i].V(j)->T() = shell.face[i].WT(j);
+        }
+    }
+    SyncShellWithUV(shell);
+    SolveShell(state, shell, SIMPLICIAL_LDLT);
+}
+BENCHMARK(ARAPSolveChart, 0, 10, 100);
+
+
+// -- Intersection -------------------------------------------------------------
+
+static void IntersectionLoops(bench::State& state)
+{
+    std::mt19937 gen(state.range());
+    Mesh m;
+    BuildBoundaryLoops(m, (int) state.range(), gen);
+
+    std::vector<HalfEdge> hvec;
+    for (auto& f : m.face)
+        hvec.push_back(HalfEdge{&f, 0});
+
+    std::size_t n = 0;
+    while (state.KeepRunning()) {
+        std::vector<HalfEdgePair> pairs = Intersection(hvec);
+        n = pairs.size();
+        bench::DoNotOptimize(pairs.data());
+    }
+    state.SetItemsProcessed((int64_t) state.Iterations() * hvec.size());
+    state.SetLabel(std::to_string(n) + " intersections");
+}
+BENCHMARK(IntersectionLoops, 1024, 16384, 131072);
+
+static void CrossIntersectionLoops(bench::State& state)
+{
+    std::mt19937 gen(state.range());
+    Mesh m;
+    BuildBoundaryLoops(m, (int) state.range(), gen);
+
+    // the even loops against the odd ones
+    std::vector<HalfEdge> hvec1;
+    std::vector<HalfEdge> hvec2;
+    for (unsigned i = 0; i < m.face.size(); ++i)
+        ((i / 64) % 2 == 0 ? hvec1 : hvec2).push_back(HalfEdge{&m.face[i], 0});
+
+    std::size_t n = 0;
+    while (state.KeepRunning()) {
+        std::vector<HalfEdgePair> pairs = CrossIntersection(hvec1, hvec2);
+        n = pairs.size();
+        bench::DoNotOptimize(pairs.data());
+    }
+    state.SetItemsProcessed((int64_t) state.Iterations() * m.face.size());
+    state.SetLabel(std::to_string(n) + " intersections");
+}
+BENCHMARK(CrossIntersectionLoops, 1024, 16384, 131072);
+
+static void IntersectionAtlas(bench::State& state)
+{
+    MeshData *md = GetMeshData(state);
+    if (!md)
+        return;
+
+    std::vector<HalfEdge> hvec;
+    for (auto c : md->charts) {
+        std::vector<HalfEdge> border = ChartBorder(*c);
+        hvec.insert(hvec.end(), border.begin(), border.end());
+    }
+
+    std::size_t n = 0;
+    while (state.KeepRunning()) {
+        std::vector<HalfEdgePair> pairs = Intersection(hvec);
+        n = pairs.size();
+        bench::DoNotOptimize(pairs.data());
+    }
+    state.SetItemsProcessed((int64_t) state.Iterations() * hvec.size());
+    state.SetLabel(std::to_string(hvec.size()) + " half-edges, " + std::to_string(n) + " intersections");
+}
+BENCHMARK(IntersectionAtlas);
+
+/* Borders of the largest chart and of its largest neighbor, that meet along
+ * their shared seam as in the evaluation of a merge */
+static void CrossIntersectionCharts(bench::State& state)
+{
+    MeshData *md = GetMeshData(state);
+    if (!md)
+        return;
+
+    ChartHandle a = md->charts.front();
+    if (a->adj.empty()) {
+        state.SkipWithError("the largest chart has no neighbors");
+        return;
+    }
+    ChartHandle b = *std::max_element(a->adj.begin(), a->adj.end(), [](const ChartHandle& c1, const ChartHandle& c2) {
+        return c1->FN() < c2->FN();
+    });
+
+    std::vector<HalfEdge> hvec1 = ChartBorder(*a);
+    std::vector<HalfEdge> hvec2 = ChartBorder(*b);
+
+    std::size_t n = 0;
+    while (state.KeepRunning()) {
+        std::vector<HalfEdgePair> pairs = CrossIntersection(hvec1, hvec2);
+        n = pairs.size();
+        bench::DoNotOptimize(pairs.data());
+    }
+    state.SetItemsProcessed((int64_t) state.Iterations() * (hvec1.size() + hvec2.size()));
+    state.SetLabel(std::to_string(hvec1.size()) + "+" + std::to_string(hvec2.size()) + " half-edges, " + std::to_string(n) + " intersections");
+}
+BENCHMARK(CrossIntersectionCharts);
+
+
+// -- Matching -----------------------------------------------------------------
+
+static void MatchingRigidVector(bench::State& state)
+{
+    std::mt19937 gen(state.range());
+    std::vector<vcg::Point2d> target;
+    std::vector<vcg::Point2d> matching;
+    RandomPointPairs((int) state.range(), gen, target, matching);
+
+    while (state.KeepRunning()) {
+        MatchingTransform mt = ComputeMatchingRigidMatrix(target, matching);
+        bench::DoNotOptimize(mt);
+    }
+    state.SetItemsProcessed(state.Iterations() * state.range());
+}
+BENCHMARK(MatchingRigidVector, 64, 1024, 16384);
+
+static void MatchingRigidPointSet(bench::State& state)
+{
+    std::mt19937 gen(state.range());
+    std::vector<vcg::Point2d> target;
+    std::vector<vcg::Point2d> matching;
+    RandomPointPairs((int) state.range(), gen, target, matching);
+    MatchingPointSet points;
+    for (unsigned i = 0; i < target.size(); ++i)
+        points.push_back(target[i], matching[i]);
+
+    while (state.KeepRunning()) {
+        MatchingTransform mt = ComputeMatchingRigidMatrix(points);
+        bench::DoNotOptimize(mt);
+    }
+    state.SetItemsProcessed(state.Iterations() * state.range());
+}
+BENCHMARK(MatchingRigidPointSet, 64, 1024, 16384);
+
+static void MatchingErrorVector(bench::State& state)
+{
+    std::mt19937 gen(state.range());
+    std::vector<vcg::Point2d> target;
+    std::vector<vcg::Point2d> matching;
+    RandomPointPairs((int) state.range(), gen, target, matching);
+    MatchingTransform mt = ComputeMatchingRigidMatrix(target, matching);
+
+    while (state.KeepRunning()) {
+        double err = MatchingErrorTotal(mt, target, matching);
+        bench::DoNotOptimize(err);
+    }
+    state.SetItemsProcessed(state.Iterations() * state.range());
+}
+BENCHMARK(MatchingErrorVector, 64, 1024, 16384);
+
+static void MatchingErrorPointSet(bench::State& state)
+{
+    std::mt19937 gen(state.range());
+    std::vector<vcg::Point2d> target;
+    std::vector<vcg::Point2d> matching;
+    RandomPointPairs((int) state.range(), gen, target, matching);
+    MatchingPointSet points;
+    for (unsigned i = 0; i < target.size(); ++i)
+        points.push_back(target[i], matching[i]);
+    MatchingTransform mt = ComputeMatchingRigidMatrix(points);
+
+    while (state.KeepRunning()) {
+        double err = MatchingErrorTotal(mt, points);
+        bench::DoNotOptimize(err);
+    }
+    state.SetItemsProcessed(state.Iterations() * state.range());
+}
+BENCHMARK(MatchingErrorPointSet, 64, 1024, 16384);
+
+
+// -- Packing ------------------------------------------------------------------
+
+/* Rasterization of the 4 rotations of a 64-vertex outline with the given
+ * radius in pixels */
+static void Rasterize(bench::State& state)
+{
+    std::mt19937 gen(state.range());
+    vcg::RasterizedOutline2 poly;
+    poly.setPoints(RandomOutline(64, (float) state.range(), gen));
+
+    while (state.KeepRunning()) {
+        state.PauseTiming();
+        QtOutline2Rasterizer::clearCache();
+        poly.resetState(4);
+        state.ResumeTiming();
+
+        QtOutline2Rasterizer::rasterize(poly, 1.0f, 0, 4, 4);
+    }
+    state.SetItemsProcessed(state.Iterations() * 4);
+}
+BENCHMARK(Rasterize, 32, 128, 512);
+
+/* Outlines of log-uniform radius between 8 and 128 pixels, in a square
+ * container with about 50% more area than the outlines bounding boxes */
+static void PackSynthetic(bench::State& state)
+{
+    std::mt19937 gen(state.range());
+    std::uniform_real_distribution<float> logRadius(std::log(8.0f), std::log(128.0f));
+    std::uniform_int_distribution<int> vertices(8, 64);
+
+    std::vector<Outline2f> outlines;
+    double area = 0;
+    for (int i = 0; i < state.range(); ++i) {
+        float radius = std::exp(logRadius(gen));
+        outlines.push_back(RandomOutline(vertices(gen), radius, gen));
+        area += 4.0 * radius * radius;
+    }
+    int side = (int) std::sqrt(1.5 * area);
+    PackOutlines(state, outlines, vcg::Point2i(side, side), 1.0f);
+}
+BENCHMARK(PackSynthetic, 64, 512, 2048);
+
+/* Outlines of the charts of the mesh, in a 4096x4096 container with twice the
+ * area of the charts */
+static void PackAtlas(bench::State& state)
+{
+    MeshData *md = GetMeshData(state);
+    if (!md)
+        return;
+
+    std::vector<Outline2f> outlines;
+    double area = 0;
+    for (auto c : md->charts) {
+        outlines.push_back(ExtractOutline2f(*c));
+        area += c->AreaUV();
+    }
+    const int SIDE = 4096;
+    float scale = (float) std::sqrt(SIDE * SIDE / (2.0 * area));
+    PackOutlines(state, outlines, vcg::Point2i(SIDE, SIDE), scale);
+}
+BENCHMARK(PackAtlas);
+
+
+// -- Images -------------------------------------------------------------------
+
+static void PullPushImage(bench::State& state)
+{
+    std::mt19937 gen(state.range());
+    QImage source = RandomChartImage((int) state.range(), gen);
+
+    while (state.KeepRunning()) {
+        state.PauseTiming();
+        QImage img = source.copy();
+        state.ResumeTiming();
+
+        vcg::PullPush(img, qRgba(0, 0, 0, 255));
+    }
+    state.SetItemsProcessed(state.Iterations() * state.range() * state.range());
+}
+BENCHMARK(PullPushImage, 512, 2048, 8192);
+
+static void MirrorImage(bench::State& state)
+{
+    std::mt19937 gen(state.range());
+    QImage img = RandomChartImage((int) state.range(), gen);
+
+    while (state.KeepRunning()) {
+        Mirror(img);
+    }
+    state.SetItemsProcessed(state.Iterations() * state.range() * state.range());
+}
+BENCHMARK(MirrorImage, 1024, 4096, 8192);
+
+/* Conversion of a decoded jpeg (RGB888) to the upload layout */
+static void ConvertImage(bench::State& state)
+{
+    std::mt19937 gen(state.range());
+    QImage img = RandomChartImage((int) state.range(), gen).convertToFormat(QImage::Format_RGB888);
+    std::vector<unsigned char> dst(std::size_t(img.width()) * img.height() * 4);
+
+    while (state.KeepRunning()) {
+        CopyImageARGB32(img, dst.data(), false);
+    }
+    state.SetItemsProcessed(state.Iterations() * state.range() * state.range());
+}
+BENCHMARK(ConvertImage, 1024, 4096, 8192);
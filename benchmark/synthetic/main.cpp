@@ -0,0 +1,164 @@
+/*******************************************************************************
+    Copyright (c) 2021, Andrea Maggiordomo, Paolo Cignoni and Marco Tarini
+
+    This file is part of TextureDefrag, a reference implementation for
+    the paper ``Texture Defragmentation for Photo-Reconstructed 3D Models''
+    by Andrea Maggiordomo, Paolo Cignoni and Marco Tarini.
+
+    TextureDefrag is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    TextureDefrag is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with TextureDefrag. If not, see <https://www.gnu.org/licenses/>.
+*******************************************************************************/
+
+
+#include "synthetic_atlas.h"
+#include "logging.h"
+#include "utils.h"
+
+#include <iostream>
+#include <string>
+
+#include <QCoreApplication>
+
+/* Generates a synthetic fragmented atlas (see GenerateSyntheticAtlas()) and saves
+ * it with its textures, to test how the phases of the pipeline scale with the
+ * number of faces, charts and textures */
+
+struct Args {
+    std::string outfile = "";
+    std::string g = "terrain"; // shape
+    int f = 100000; // faces
+    int c = 1000; // charts
+    double s = 0.0; // chart area spread
+    int t = 1; // textures
+    int z = 4096; // texture size
+    int r = 0; // seed
+    int l = 0;
+};
+
+void PrintArgsUsage(const char *binary);
+bool ParseOption(const std::string& option, const std::string& argument, Args *args);
+Args ParseArgs(int argc, char *argv[]);
+
+int main(int argc, char *argv[])
+{
+    Args args = ParseArgs(argc, argv);
+
+    LOG_INIT(args.l);
+    LOG_SET_ASYNC(false);
+
+    QCoreApplication app(argc, argv);
+
+    SyntheticAtlasParameters params;
+    params.shape = (args.g == "sphere") ? SyntheticShape::Sphere : SyntheticShape::Terrain;
+    params.faces = args.f;
+    params.charts = args.c;
+    params.spread = args.s;
+    params.textures = args.t;
+    params.textureSize = args.z;
+    params.seed = (unsigned) args.r;
+
+    if (!SaveSyntheticAtlas(args.outfile.c_str(), params)) {
+        LOG_ERR << "Unable to generate " << args.outfile;
+        return -1;
+    }
+
+    LOG_INFO << "Saved " << args.outfile;
+    return 0;
+}
+
+void PrintArgsUsage(const char *binary) {
+    Args def;
+    std::cout << "Usage: " << binary << " OUTFILE [-gfcstzrl]" << std::endl;
+    std::cout << std::endl;
+    std::cout << "OUTFILE specifies the output mesh file (obj, ply or glb), the textures are saved as png images in the same directory" << std::endl;
+    std::cout << std::endl;
+    std::cout << "-g  <val>      " << "Shape: terrain (height field) or sphere." << " (default: " << def.g << ")" << std::endl;
+    std::cout << "-f  <val>      " << "Approximate number of faces." << " (default: " << def.f << ")" << std::endl;
+    std::cout << "-c  <val>      " << "Approximate number of charts." << " (default: " << def.c << ")" << std::endl;
+    std::cout << "-s  <val>      " << "Standard deviation of the log of the chart areas, 0 for charts of similar size." << " (default: " << def.s << ")" << std::endl;
+    std::cout << "-t  <val>      " << "Number of textures." << " (default: " << def.t << ")" << std::endl;
+    std::cout << "-z  <val>      " << "Side of the textures in pixels." << " (default: " << def.z << ")" << std::endl;
+    std::cout << "-r  <val>      " << "Random seed." << " (default: " << def.r << ")" << std::endl;
+    std::cout << "-l  <val>      " << "Logging level. 0 for minimal verbosity, 1 for verbose output, 2 for debug output." << " (default: " << def.l << ")" << std::endl;
+}
+
+bool ParseOption(const std::string& option, const std::string& argument, Args *args)
+{
+    ensure(option.size() == 2);
+    try {
+        switch (option[1]) {
+            case 'g' :
+                if (argument != "terrain" && argument != "sphere") {
+                    std::cerr << "Unrecognized shape " << argument << std::endl << std::endl;
+                    return false;
+                }
+                args->g = argument;
+                break;
+            case 'f' : args->f = std::stoi(argument); break;
+            case 'c' : args->c = std::stoi(argument); break;
+            case 's' : args->s = std::stod(argument); break;
+            case 't' : args->t = std::stoi(argument); break;
+            case 'z' : args->z = std::stoi(argument); break;
+            case 'r' : args->r = std::stoi(argument); break;
+            case 'l' : args->l = std::stoi(argument); break;
+            default:
+                std::cerr << "Unrecognized option " << option << std::endl << std::endl;
+                return false;
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "Error while parsing option `" << option << " " << argument << "`: " << e.what() << std::endl << std::endl;
+        return false;
+    }
+    if (args->f <= 0 || args->c <= 0 || args->t <= 0 || args->z <= 0 || args->s < 0) {
+        std::cerr << "Invalid value of option " << option << std::endl << std::endl;
+        return false;
+    }
+    return true;
+}
+
+Args ParseArgs(int argc, char *argv[])
+{
+    if (argc < 2) {
+        PrintArgsUsage(argv[0]);
+        std::exit(-1);
+    }
+
+    Args args;
+
+    for (int i = 1; i < argc; ++i) {
+        std::string argi(argv[i]);
+        if (argi[0] == '-' && argi.size() == 2) {
+            i++;
+            if (i >= argc) {
+                std::cerr << "Missing argument for option " << argi << std::endl << std::endl;
+                PrintArgsUsage(argv[0]);
+                std::exit(-1);
+            } else {
+                if (!ParseOption(argi, std::string(argv[i]), &args)) {
+                    PrintArgsUsage(argv[0]);
+                    std::exit(-1);
+                }
+            }
+        } else {
+            args.outfile = argi;
+        }
+    }
+
+    if (args.outfile == "") {
+        std::cerr << "Missing output mesh argument" << std::endl << std::endl;
+        PrintArgsUsage(argv[0]);
+        std::exit(-1);
+    }
+
+    return args;
+}
@@ -0,0 +1,130 @@
+# Sources of the defragmentation shared by the application, the library and the
+# tools (benchmark/), included after base.pri. The projects add their own main
+# and the modules only they use (defrag.cpp, synthetic_atlas.cpp)
+
+SOURCES += \
+    $$PWD/src/intersection.cpp \
+    $$PWD/src/mesh_attribute.cpp \
+    $$PWD/src/packing.cpp \
+    $$PWD/src/seam_remover.cpp \
+    $$PWD/src/seams.cpp \
+    $$PWD/src/texture_optimization.cpp \
+    $$PWD/src/mesh_graph.cpp \
+    $$PWD/src/gl_utils.cpp \
+    $$PWD/src/mesh.cpp \
+    $$PWD/src/texture_rendering.cpp \
+    $$PWD/src/logging.cpp \
+    $$PWD/src/matching.cpp \
+    $$PWD/src/arap.cpp \
+    $$PWD/src/shell.cpp \
+    $$PWD/src/texture_object.cpp \
+    $$PWD/src/png_writer.cpp \
+    $$PWD/src/image_writers.cpp \
+    $$PWD/src/virtual_texture.cpp \
+    $$PWD/src/software_rendering.cpp \
+    $$PWD/src/texture_array.cpp \
+    $$PWD/src/obj_loader.cpp \
+    $$PWD/src/mesh_cache.cpp \
+    $$PWD/src/mesh_writer.cpp \
+    $$PWD/src/float_format.cpp \
+    $$PWD/src/element_set.cpp \
+    $$PWD/src/checkpoint.cpp \
+    $$PWD/src/tiling.cpp \
+    $$PWD/src/memory_budget.cpp \
+    $$PWD/src/deadline.cpp \
+    $$PWD/src/cpu_features.cpp \
+    $$PWD/src/numa_placement.cpp \
+    $$PWD/src/huge_pages.cpp \
+    $$PWD/src/mapped_image.cpp \
+    $$PWD/src/raster_overlap.cpp \
+    $$PWD/src/perf_counters.cpp \
+    $$PWD/src/parallel_threshold.cpp \
+    $$PWD/src/texture_predecode.cpp \
+    $$PWD/src/tiff_writer.cpp \
+    $$PWD/src/distributed.cpp \
+    $$PWD/src/result_cache.cpp \
+    $$PWD/src/gltf_loader.cpp \
+    $$PWD/src/remote_input.cpp \
+    $$PWD/src/async_io.cpp \
+    $$PWD/src/incremental.cpp \
+    $$PWD/src/derived_data.cpp \
+    $$PWD/src/gpu_placement.cpp \
+    $$PWD/src/validation.cpp \
+    $$PWD/src/texture_access_trace.cpp \
+    $$PWD/src/sheet_sink.cpp \
+    $$PWD/src/gpu_arap.cpp \
+    $$PWD/src/trace.cpp \
+    $$PWD/src/run_report.cpp \
+    $$PWD/src/metrics.cpp
+
+SOURCES += \
+    $$VCGPATH/wrap/openfbx/src/ofbx.cpp \
+    $$VCGPATH/wrap/openfbx/src/miniz.c \
+    $$VCGPATH/wrap/ply/plylib.cpp \
+    $$VCGPATH/wrap/qt/outline2_rasterizer.cpp
+
+HEADERS += \
+    $$PWD/src/intersection.h \
+    $$PWD/src/indexed_heap.h \
+    $$PWD/src/mesh.h \
+    $$PWD/src/packing.h \
+    $$PWD/src/seam_remover.h \
+    $$PWD/src/seams.h \
+    $$PWD/src/timer.h \
+    $$PWD/src/types.h \
+    $$PWD/src/mesh_graph.h \
+    $$PWD/src/texture_rendering.h \
+    $$PWD/src/math_utils.h \
+    $$PWD/src/texture_optimization.h \
+    $$PWD/src/pushpull.h \
+    $$PWD/src/gl_utils.h \
+    $$PWD/src/mesh_attribute.h \
+    $$PWD/src/logging.h \
+    $$PWD/src/utils.h \
+    $$PWD/src/matching.h \
+    $$PWD/src/arap.h \
+    $$PWD/src/shell.h \
+    $$PWD/src/texture_object.h \
+    $$PWD/src/png_writer.h \
+    $$PWD/src/image_writers.h \
+    $$PWD/src/virtual_texture.h \
+    $$PWD/src/software_rendering.h \
+    $$PWD/src/texture_array.h \
+    $$PWD/src/obj_loader.h \
+    $$PWD/src/mesh_cache.h \
+    $$PWD/src/mesh_writer.h \
+    $$PWD/src/float_format.h \
+    $$PWD/src/element_set.h \
+    $$PWD/src/disjoint_set.h \
+    $$PWD/src/pool_ptr.h \
+    $$PWD/src/latency_histogram.h \
+    $$PWD/src/checkpoint.h \
+    $$PWD/src/tiling.h \
+    $$PWD/src/memory_budget.h \
+    $$PWD/src/deadline.h \
+    $$PWD/src/cpu_features.h \
+    $$PWD/src/numa_placement.h \
+    $$PWD/src/huge_pages.h \
+    $$PWD/src/mapped_image.h \
+    $$PWD/src/raster_overlap.h \
+    $$PWD/src/perf_counters.h \
+    $$PWD/src/parallel_threshold.h \
+    $$PWD/src/texture_predecode.h \
+    $$PWD/src/tiff_writer.h \
+    $$PWD/src/distributed.h \
+    $$PWD/src/result_cache.h \
+    $$PWD/src/gltf_loader.h \
+    $$PWD/src/remote_input.h \
+    $$PWD/src/async_io.h \
+    $$PWD/src/incremental.h \
+    $$PWD/src/derived_data.h \
+    $$PWD/src/gpu_placement.h \
+    $$PWD/src/validation.h \
+    $$PWD/src/texture_access_trace.h \
+    $$PWD/src/sheet_sink.h \
+    $$PWD/src/gpu_arap.h \
+    $$PWD/src/dense_index_map.h \
+    $$PWD/src/thread_count.h \
+    $$PWD/src/trace.h \
+    $$PWD/src/run_report.h \
+    $$PWD/src/metrics.h
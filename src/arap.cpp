@@ -24,16 +24,92 @@
 #include "mesh_attribute.h"
 #include "logging.h"
 #include "math_utils.h"
+#include "cpu_features.h"
+#include "numa_placement.h"
+#include "parallel_threshold.h"
+#include "gpu_arap.h"
 
 #include <Eigen/IterativeLinearSolvers>
 #include <iomanip>
+#include <algorithm>
 #include <unordered_set>
 #include <omp.h>
 
 
+// maximum number of double precision refinement steps of a single precision solve
+constexpr int MAX_REFINEMENT_STEPS = 10;
+
+/* ARAP energy of the 2x2 Jacobian [j00 j01; j10 j11], the singular values are
+ * computed in closed form as the sum and the difference of the norms of its
+ * conformal and anticonformal parts */
+static inline double JacobianEnergy(double j00, double j01, double j10, double j11)
+{
+    double q = 0.5 * std::sqrt((j00 + j11) * (j00 + j11) + (j10 - j01) * (j10 - j01));
+    double r = 0.5 * std::sqrt((j00 - j11) * (j00 - j11) + (j10 + j01) * (j10 + j01));
+    double sigma0 = q + r;
+    double sigma1 = std::abs(q - r);
+    return (sigma0 - 1.0) * (sigma0 - 1.0) + (sigma1 - 1.0) * (sigma1 - 1.0);
+}
+
+/* Kernel of the local step on the faces [begin, end) of the SoA buffers, writes
+ * the closest rotations and returns the area weighted energy of the faces */
+SIMD_DISPATCH static double RotationKernel(int begin, int end,
+                                           const double *u10x, const double *u10y, const double *u20x, const double *u20y,
+                                           const double *fi00, const double *fi01, const double *fi10, const double *fi11,
+                                           const double *area, double *rc, double *rs)
+{
+    double e = 0;
+    for (int fi = begin; fi < end; ++fi) {
+        double j00 = u10x[fi] * fi00[fi] + u20x[fi] * fi10[fi];
+        double j01 = u10x[fi] * fi01[fi] + u20x[fi] * fi11[fi];
+        double j10 = u10y[fi] * fi00[fi] + u20y[fi] * fi10[fi];
+        double j11 = u10y[fi] * fi01[fi] + u20y[fi] * fi11[fi];
+        double c = j00 + j11;
+        double s = j10 - j01;
+        double n = std::sqrt(c * c + s * s);
+        double ninv = (n > 0) ? (1.0 / n) : 0.0;
+        rc[fi] = (n > 0) ? (c * ninv) : 1.0;
+        rs[fi] = s * ninv;
+        e += area[fi] * JacobianEnergy(j00, j01, j10, j11);
+    }
+    return e;
+}
+const char *ARAPSolverBackendName(ARAPSolverBackend backend)
+{
+    switch (backend) {
+        case BICGSTAB_ILUT: return "bicgstab";
+        case SIMPLICIAL_LDLT: return "ldlt";
+        case SIMPLICIAL_LDLT_MIXED: return "ldlt-mixed";
+        case CG_ICHOL: return "cg";
+        case DENSE_LLT: return "dense";
+        case GPU_JACOBI_CG: return "gpu";
+    }
+    return "unknown";
+}
+
+bool ParseARAPSolverBackend(const std::string& name, ARAPSolverBackend *backend)
+{
+    for (ARAPSolverBackend b : {SIMPLICIAL_LDLT, SIMPLICIAL_LDLT_MIXED, CG_ICHOL, BICGSTAB_ILUT}) {
+        if (name == ARAPSolverBackendName(b)) {
+            *backend = b;
+            return true;
+        }
+    }
+    return false;
+}
+
 ARAP::ARAP(Mesh& mesh)
     : m{mesh},
-      max_iter{100}
+      precomputed{false},
+      max_iter{100},
+      solver_tol{0},
+      backend{SIMPLICIAL_LDLT},
+      cache{nullptr},
+      multilevel_faces{0},
+      multilevel_fine_iter{20},
+      anderson_window{0},
+      dense_faces{0},
+      gpu_faces{0}
 {
 }
 
@@ -97,13 +173,77 @@ void ARAP::SetMaxIterations(int n)
     max_iter = n;
 }
 
+/* Sets the tolerance on the relative residual of the iterative solver, and of
+ * the refined solutions of the mixed precision solver. If not positive, the
+ * default tolerance of the solver is used */
+void ARAP::SetSolverTolerance(double tol)
+{
+    solver_tol = tol;
+}
+
+void ARAP::SetSolverBackend(ARAPSolverBackend solverBackend)
+{
+    backend = solverBackend;
+}
+
+void ARAP::SetFactorizationCache(std::shared_ptr<ARAPFactorizationCache> factorizationCache)
+{
+    cache = factorizationCache;
+}
+
+/* Enables the coarse-to-fine solve on meshes with at least minFaces faces: the
+ * problem is first solved on coarser levels of the mesh, and the solution is
+ * used as the starting point of at most fineIterations iterations on the mesh.
+ * If minFaces is not positive, the problem is always solved on the mesh only */
+void ARAP::SetMultilevel(int minFaces, int fineIterations)
+{
+    multilevel_faces = minFaces;
+    multilevel_fine_iter = fineIterations;
+}
+
+/* Enables the Anderson acceleration of the local/global iterations: each iterate
+ * is the combination of the last window global steps that minimizes the norm of
+ * their combined residuals, and the plain global step is taken instead if the
+ * combination does not decrease the energy. If window is not positive, the plain
+ * iterations are used */
+void ARAP::SetAndersonAcceleration(int window)
+{
+    anderson_window = window;
+}
+
+/* Solves the meshes with at most maxFaces faces with a dense Cholesky
+ * factorization of the symmetric system, in place of the symmetric backends.
+ * On small shells the fill-reducing ordering and the bookkeeping of the sparse
+ * factorizations cost more than the dense one. BICGSTAB_ILUT is never replaced.
+ * If maxFaces is not positive, the requested backend is always used */
+void ARAP::SetDenseThreshold(int maxFaces)
+{
+    dense_faces = maxFaces;
+}
+
+/* Solves the meshes with at least minFaces faces with compute shaders on the
+ * OpenGL context current on the calling thread, in place of the symmetric
+ * backends. The requested backend is used if there is no context or if it has
+ * no compute shaders, and it is the fallback if the solve fails on the GPU. If
+ * minFaces is not positive the GPU is never used */
+void ARAP::SetGPUThreshold(int minFaces)
+{
+    gpu_faces = minFaces;
+}
+
+/* The callback is not invoked by the solves of the coarse levels */
+void ARAP::SetIterationCallback(ARAPIterationCallback callback)
+{
+    iteration_callback = callback;
+}
+
 static std::vector<ARAP::Cot> ComputeCotangentVector(Mesh& m)
 {
     std::vector<ARAP::Cot> cotan;
     cotan.resize(m.FN());
     auto tsa = GetTargetShapeAttribute(m);
     double eps = std::numeric_limits<double>::epsilon();
-    #pragma omp parallel for
+    #pragma omp parallel for if (m.FN() >= ParallelMinFaces())
     for (int fi = 0; fi < m.FN(); ++fi) {
         auto& f = m.face[fi];
         ARAP::Cot c;
@@ -118,173 +258,386 @@ static std::vector<ARAP::Cot> ComputeCotangentVector(Mesh& m)
     return cotan;
 }
 
-void ARAP::ComputeSystemMatrix(Mesh& m, const std::vector<Cot>& cotan, Eigen::SparseMatrix<double, Eigen::RowMajor>& L)
+/* Computes the compressed row sparsity pattern of the system matrix, and for
+ * each face corner the slots of the three coefficients it contributes to. The
+ * matrix rows are then assembled by gathering the contributions of the corners
+ * incident to each vertex, which requires neither synchronization nor a
+ * triplet sort. The connectivity of the mesh does not change during Solve(),
+ * so the pattern is computed only once */
+void ARAP::ComputeSystemPattern()
 {
-    using Td = Eigen::Triplet<double>;
+    const int vn = m.VN();
+    const int fn = m.FN();
 
-    L.resize(m.VN(), m.VN());
-    L.setZero();
-    std::vector<Td> tri;
-    auto Idx = [&m](const Mesh::VertexPointer vp) { return (int) tri::Index(m, vp); };
+    pattern.cornerPtr.assign(vn + 1, 0);
+    for (auto& f : m.face)
+        for (int i = 0; i < 3; ++i)
+            pattern.cornerPtr[tri::Index(m, f.V(i)) + 1]++;
+    for (int vi = 0; vi < vn; ++vi)
+        pattern.cornerPtr[vi + 1] += pattern.cornerPtr[vi];
 
-    #pragma omp parallel
+    pattern.corners.resize(3 * fn);
     {
-        std::vector<Td> tri_private;
-        #pragma omp for nowait
-        for (int fi = 0; fi < m.FN(); ++fi) {
-            auto &f = m.face[fi];
-            for (int i = 0; i < 3; ++i) {
-                if (std::find(fixed_i.begin(), fixed_i.end(), (int) tri::Index(m, f.V(i))) == fixed_i.end()) {
-                    Mesh::VertexPointer vi = f.V0(i);
-                    int j = (i+1)%3;
-                    Mesh::VertexPointer vj = f.V1(i);
-                    int k = (i+2)%3;
-                    Mesh::VertexPointer vk = f.V2(i);
+        std::vector<int> fill(pattern.cornerPtr.begin(), pattern.cornerPtr.end() - 1);
+        for (int fi = 0; fi < fn; ++fi)
+            for (int i = 0; i < 3; ++i)
+                pattern.corners[fill[tri::Index(m, m.face[fi].V(i))]++] = 3 * fi + i;
+    }
+
+    std::vector<std::vector<int>> rowCols(vn);
+    #pragma omp parallel for if (m.FN() >= ParallelMinFaces())
+    for (int vi = 0; vi < vn; ++vi) {
+        std::vector<int>& cols = rowCols[vi];
+        cols.push_back(vi);
+        for (int c = pattern.cornerPtr[vi]; c < pattern.cornerPtr[vi + 1]; ++c) {
+            const auto& f = m.face[pattern.corners[c] / 3];
+            int i = pattern.corners[c] % 3;
+            cols.push_back((int) tri::Index(m, f.cV1(i)));
+            cols.push_back((int) tri::Index(m, f.cV2(i)));
+        }
+        std::sort(cols.begin(), cols.end());
+        cols.erase(std::unique(cols.begin(), cols.end()), cols.end());
+    }
+
+    pattern.rowPtr.assign(vn + 1, 0);
+    for (int vi = 0; vi < vn; ++vi)
+        pattern.rowPtr[vi + 1] = pattern.rowPtr[vi] + (int) rowCols[vi].size();
+
+    pattern.colIdx.resize(pattern.rowPtr[vn]);
+    pattern.diagSlot.resize(vn);
+    pattern.cornerSlot.resize(3 * fn);
+
+    #pragma omp parallel for if (m.FN() >= ParallelMinFaces())
+    for (int vi = 0; vi < vn; ++vi) {
+        std::copy(rowCols[vi].begin(), rowCols[vi].end(), pattern.colIdx.begin() + pattern.rowPtr[vi]);
+        auto rowBegin = pattern.colIdx.begin() + pattern.rowPtr[vi];
+        auto rowEnd = pattern.colIdx.begin() + pattern.rowPtr[vi + 1];
+        auto Slot = [&] (int col) { return (int) (std::lower_bound(rowBegin, rowEnd, col) - pattern.colIdx.begin()); };
+        pattern.diagSlot[vi] = Slot(vi);
+        for (int c = pattern.cornerPtr[vi]; c < pattern.cornerPtr[vi + 1]; ++c) {
+            int corner = pattern.corners[c];
+            const auto& f = m.face[corner / 3];
+            int i = corner % 3;
+            pattern.cornerSlot[corner][0] = pattern.diagSlot[vi];
+            pattern.cornerSlot[corner][1] = Slot((int) tri::Index(m, f.cV1(i)));
+            pattern.cornerSlot[corner][2] = Slot((int) tri::Index(m, f.cV2(i)));
+        }
+    }
+}
 
-                    ensure(Idx(vi) >= 0); ensure(Idx(vi) < m.VN());
-                    ensure(Idx(vj) >= 0); ensure(Idx(vj) < m.VN());
-                    ensure(Idx(vk) >= 0); ensure(Idx(vk) < m.VN());
+/* Gathers the cotangent weights of the corners incident to each row. The rows
+ * of the fixed vertices are set to the identity */
+void ARAP::AssembleSystemValues(const std::vector<Cot>& cotan, std::vector<double>& values)
+{
+    values.assign(pattern.colIdx.size(), 0);
+
+    #pragma omp parallel for if (m.FN() >= ParallelMinFaces())
+    for (int vi = 0; vi < m.VN(); ++vi) {
+        if (fixed_slot[vi] != -1) {
+            values[pattern.diagSlot[vi]] = 1;
+            continue;
+        }
+        for (int c = pattern.cornerPtr[vi]; c < pattern.cornerPtr[vi + 1]; ++c) {
+            int corner = pattern.corners[c];
+            int fi = corner / 3;
+            int i = corner % 3;
+            int j = (i+1)%3;
+            int k = (i+2)%3;
 
-                    double weight_ij = cotan[fi].v[k];
-                    double weight_ik = cotan[fi].v[j];
+            double weight_ij = cotan[fi].v[k];
+            double weight_ik = cotan[fi].v[j];
 
-                    if (!std::isfinite(weight_ij))
-                        weight_ij = 1e-8;
+            if (!std::isfinite(weight_ij))
+                weight_ij = 1e-8;
 
-                    if (!std::isfinite(weight_ik))
-                        weight_ik = 1e-8;
+            if (!std::isfinite(weight_ik))
+                weight_ik = 1e-8;
 
-                    tri_private.push_back(Td(Idx(vi), Idx(vj), -weight_ij));
-                    tri_private.push_back(Td(Idx(vi), Idx(vk), -weight_ik));
-                    tri_private.push_back(Td(Idx(vi), Idx(vi), (weight_ij + weight_ik)));
+            values[pattern.cornerSlot[corner][0]] += (weight_ij + weight_ik);
+            values[pattern.cornerSlot[corner][1]] -= weight_ij;
+            values[pattern.cornerSlot[corner][2]] -= weight_ik;
+        }
+    }
+}
+
+void ARAP::ComputeSystemMatrix(Mesh& m, const std::vector<Cot>& cotan, Eigen::SparseMatrix<double, Eigen::RowMajor>& L)
+{
+    std::vector<double> values;
+    AssembleSystemValues(cotan, values);
+
+    L = Eigen::Map<Eigen::SparseMatrix<double, Eigen::RowMajor>>(m.VN(), m.VN(), (int) values.size(),
+                                                                 pattern.rowPtr.data(), pattern.colIdx.data(), values.data());
+}
+
+/* Assembles the symmetric version of the system, where the fixed vertices are
+ * eliminated by moving their contribution to the right hand side (bu_fixed and
+ * bv_fixed, to be added to the rhs of each iteration). Rows and columns of the
+ * fixed vertices are replaced by the identity, but the entries are kept as
+ * explicit zeros so that the sparsity pattern is independent of the fixed set */
+void ARAP::ComputeSymmetricSystemMatrix(Mesh& m, const std::vector<Cot>& cotan, Eigen::SparseMatrix<double>& L, Eigen::VectorXd& bu_fixed, Eigen::VectorXd& bv_fixed)
+{
+    std::vector<double> values;
+    AssembleSystemValues(cotan, values);
+
+    bu_fixed = Eigen::VectorXd::Zero(m.VN());
+    bv_fixed = Eigen::VectorXd::Zero(m.VN());
+
+    #pragma omp parallel for if (m.FN() >= ParallelMinFaces())
+    for (int vi = 0; vi < m.VN(); ++vi) {
+        for (int s = pattern.rowPtr[vi]; s < pattern.rowPtr[vi + 1]; ++s) {
+            int col = pattern.colIdx[s];
+            if (col != vi && fixed_slot[col] != -1) {
+                if (fixed_slot[vi] == -1) {
+                    bu_fixed(vi) -= values[s] * fixed_pos[fixed_slot[col]].X();
+                    bv_fixed(vi) -= values[s] * fixed_pos[fixed_slot[col]].Y();
                 }
+                values[s] = 0;
             }
         }
-        #pragma omp critical
-        tri.insert(tri.end(), tri_private.begin(), tri_private.end());
     }
 
-    for (auto vi : fixed_i) {
-        tri.push_back(Td(vi, vi, 1));
+    // the matrix is symmetric, so the compressed rows are also its compressed columns
+    L = Eigen::Map<Eigen::SparseMatrix<double>>(m.VN(), m.VN(), (int) values.size(),
+                                                pattern.rowPtr.data(), pattern.colIdx.data(), values.data());
+}
+bool ARAP::FactorizeSymmetricSystem(const Eigen::SparseMatrix<double>& L, bool singlePrecision)
+{
+    ARAPFactorizationCache& c = *cache;
+
+    Eigen::SparseMatrix<float> Lf;
+    if (singlePrecision)
+        Lf = L.cast<float>();
+
+    bool samePattern = c.analyzed
+            && !c.dense
+            && c.singlePrecision == singlePrecision
+            && c.outerIndex.size() == (std::size_t) (L.outerSize() + 1)
+            && c.innerIndex.size() == (std::size_t) L.nonZeros()
+            && std::equal(c.outerIndex.begin(), c.outerIndex.end(), L.outerIndexPtr())
+            && std::equal(c.innerIndex.begin(), c.innerIndex.end(), L.innerIndexPtr());
+
+    if (!samePattern) {
+        if (singlePrecision)
+            c.solverf.analyzePattern(Lf);
+        else
+            c.solver.analyzePattern(L);
+        c.singlePrecision = singlePrecision;
+        c.dense = false;
+        c.outerIndex.assign(L.outerIndexPtr(), L.outerIndexPtr() + L.outerSize() + 1);
+        c.innerIndex.assign(L.innerIndexPtr(), L.innerIndexPtr() + L.nonZeros());
+        c.analyzed = true;
+        c.factorized = false;
+    } else {
+        LOG_DEBUG << "ARAP: reusing symbolic factorization";
     }
-    L.setFromTriplets(tri.begin(), tri.end());
-    L.makeCompressed();
+
+    bool sameValues = c.factorized && std::equal(c.values.begin(), c.values.end(), L.valuePtr());
+
+    if (!sameValues) {
+        if (singlePrecision) {
+            c.solverf.factorize(Lf);
+            c.factorized = (c.solverf.info() == Eigen::Success);
+        } else {
+            c.solver.factorize(L);
+            c.factorized = (c.solver.info() == Eigen::Success);
+        }
+        c.values.assign(L.valuePtr(), L.valuePtr() + L.nonZeros());
+    } else {
+        LOG_DEBUG << "ARAP: reusing numeric factorization";
+    }
+
+    return c.factorized;
 }
 
-static std::vector<Eigen::Matrix2d> ComputeRotations(Mesh& m)
+/* Dense counterpart of FactorizeSymmetricSystem(), the inverse of the matrix is
+ * stored since on the small systems a matrix-vector product is faster than the
+ * two triangular solves. The inverse is reused if the matrix is unchanged */
+bool ARAP::FactorizeDenseSystem(const Eigen::SparseMatrix<double>& L)
 {
-    auto tsa = GetTargetShapeAttribute(m);
-    std::vector<Eigen::Matrix2d> rotations;
-    rotations.resize(m.FN());
-    #pragma omp parallel for
-    for (int fi = 0; fi < m.FN(); ++fi) {
-        auto& f = m.face[fi];
-        vcg::Point2d x10, x20;
-        LocalIsometry(tsa[f].P[1] - tsa[f].P[0], tsa[f].P[2] - tsa[f].P[0], x10, x20);
-        Eigen::Matrix2d Jf = ComputeTransformationMatrix(x10, x20, f.WT(1).P() - f.WT(0).P(), f.WT(2).P() - f.WT(0).P());
-        Eigen::Matrix2d U, V;
-        Eigen::Vector2d sigma;
-        Eigen::JacobiSVD<Eigen::Matrix2d> svd;
-        svd.compute(Jf, Eigen::ComputeFullU | Eigen::ComputeFullV);
-        U = svd.matrixU(); V = svd.matrixV(); sigma = svd.singularValues();
-        Eigen::MatrixXd R = U * V.transpose();
-        if (R.determinant() < 0) {
-            U.col(U.cols() - 1) *= -1;
-            R = U * V.transpose();
-        }
+    ARAPFactorizationCache& c = *cache;
+
+    bool sameMatrix = c.dense && c.factorized
+            && c.outerIndex.size() == (std::size_t) (L.outerSize() + 1)
+            && c.innerIndex.size() == (std::size_t) L.nonZeros()
+            && std::equal(c.outerIndex.begin(), c.outerIndex.end(), L.outerIndexPtr())
+            && std::equal(c.innerIndex.begin(), c.innerIndex.end(), L.innerIndexPtr())
+            && std::equal(c.values.begin(), c.values.end(), L.valuePtr());
+
+    if (sameMatrix) {
+        LOG_DEBUG << "ARAP: reusing dense factorization";
+        return true;
+    }
+
+    Eigen::LLT<Eigen::MatrixXd> llt(L.toDense());
+    c.factorized = (llt.info() == Eigen::Success);
+    if (c.factorized)
+        c.denseInverse = llt.solve(Eigen::MatrixXd::Identity(L.rows(), L.cols()));
+    c.dense = true;
+    c.analyzed = false;
+    c.outerIndex.assign(L.outerIndexPtr(), L.outerIndexPtr() + L.outerSize() + 1);
+    c.innerIndex.assign(L.innerIndexPtr(), L.innerIndexPtr() + L.nonZeros());
+    c.values.assign(L.valuePtr(), L.valuePtr() + L.nonZeros());
+
+    return c.factorized;
+}
 
-        rotations[fi] = R;
+/* Solves L x = b with the single precision factorization of the cache, and
+ * refines the solution in double precision by solving for the correction of
+ * the residual until its norm is below the solver tolerance (relative to the
+ * norm of b). Returns false if the refinement does not converge. The rows of
+ * the fixed vertices are the identity, so their entries are set to the exact
+ * values of b */
+bool ARAP::SolveRefined(const Eigen::SparseMatrix<double>& L, const Eigen::VectorXd& b, Eigen::VectorXd& x)
+{
+    ARAPFactorizationCache& c = *cache;
+
+    double tol = (solver_tol > 0) ? solver_tol : 1e-10;
+    double bnorm = b.norm();
+
+    x = c.solverf.solve(b.cast<float>()).cast<double>();
+    for (int fi : fixed_i)
+        x(fi) = b(fi);
+
+    Eigen::VectorXd r = b - L * x;
+    double rnorm = r.norm();
+    for (int step = 0; step < MAX_REFINEMENT_STEPS && rnorm > tol * bnorm; ++step) {
+        x += c.solverf.solve(r.cast<float>()).cast<double>();
+        for (int fi : fixed_i)
+            x(fi) = b(fi);
+        r = b - L * x;
+        double rnorm_next = r.norm();
+        if (!(rnorm_next < rnorm))
+            break;
+        rnorm = rnorm_next;
     }
 
-    return rotations;
+    return c.solverf.info() == Eigen::Success && x.allFinite() && rnorm <= tol * bnorm;
 }
 
-void ARAP::ComputeRHS(Mesh& m, const std::vector<Eigen::Matrix2d>& rotations, const std::vector<Cot>& cotan, Eigen::VectorXd& bu, Eigen::VectorXd& bv)
+/* Local step: computes the rotation closest to the Jacobian of each face. For
+ * a 2x2 matrix J the closest rotation (with positive determinant) has the closed
+ * form R = [c -s; s c], where (c, s) is the normalized vector (J00 + J11, J10 - J01),
+ * so no SVD is needed. The data is stored in SoA buffers owned by the object,
+ * so that the kernel loop is vectorized by the compiler and no memory is
+ * allocated at each iteration. Since the Jacobians are at hand, the energy of
+ * the current tex coords (the value of CurrentEnergy()) is also computed and
+ * returned */
+double ARAP::ComputeRotations()
 {
-    auto Idx = [&m](const Mesh::VertexPointer vp) { return (int) tri::Index(m, vp); };
-    bu.setZero();
-    bv.setZero();
-    auto tsa = GetTargetShapeAttribute(m);
+    const int fn = m.FN();
+
+    #pragma omp parallel for if (m.FN() >= ParallelMinFaces())
+    for (int fi = 0; fi < fn; ++fi) {
+        const auto& f = m.face[fi];
+        vcg::Point2d u10 = f.cWT(1).P() - f.cWT(0).P();
+        vcg::Point2d u20 = f.cWT(2).P() - f.cWT(0).P();
+        uv_edges[0][fi] = u10.X();
+        uv_edges[1][fi] = u10.Y();
+        uv_edges[2][fi] = u20.X();
+        uv_edges[3][fi] = u20.Y();
+    }
 
-    #pragma omp parallel
-    {
-        Eigen::VectorXd bu_private = Eigen::VectorXd::Zero(m.VN());
-        Eigen::VectorXd bv_private = Eigen::VectorXd::Zero(m.VN());
-        #pragma omp for nowait
-        for (int fi = 0; fi < m.FN(); ++fi) {
-            auto &f = m.face[fi];
-            const Eigen::Matrix2d& Rf = rotations[fi];
+    const double *u10x = uv_edges[0].data();
+    const double *u10y = uv_edges[1].data();
+    const double *u20x = uv_edges[2].data();
+    const double *u20y = uv_edges[3].data();
+    const double *fi00 = frame_inv[0].data();
+    const double *fi01 = frame_inv[1].data();
+    const double *fi10 = frame_inv[2].data();
+    const double *fi11 = frame_inv[3].data();
+    const double *area = frame_area.data();
+    double *rc = rot_cos.data();
+    double *rs = rot_sin.data();
+
+    // the kernel runs on fixed blocks of faces, so the energy does not depend on
+    // the number of threads
+    auto e = OrderedSum<1>(fn, m.FN() >= ParallelMinFaces(), [&](int begin, int end, double *partial) {
+        partial[0] += RotationKernel(begin, end, u10x, u10y, u20x, u20y, fi00, fi01, fi10, fi11, area, rc, rs);
+    });
+    return e[0] / total_frame_area;
+}
+
+void ARAP::ComputeRHS(Mesh& m, const std::vector<Cot>& cotan, Eigen::VectorXd& bu, Eigen::VectorXd& bv)
+{
+    corner_rhs.resize(3 * m.FN());
 
-            const auto& t = local_frame_coords[fi];
+    #pragma omp parallel for if (m.FN() >= ParallelMinFaces())
+    for (int fi = 0; fi < m.FN(); ++fi) {
+        Eigen::Matrix2d Rf;
+        Rf << rot_cos[fi], -rot_sin[fi],
+              rot_sin[fi],  rot_cos[fi];
 
-            for (int i = 0; i < 3; ++i) {
-                Mesh::VertexPointer vi = f.V0(i);
-                int j = (i+1)%3;
-                int k = (i+2)%3;
+        const auto& t = local_frame_coords[fi];
+
+        for (int i = 0; i < 3; ++i) {
+            int j = (i+1)%3;
+            int k = (i+2)%3;
 
-                double weight_ij = cotan[fi].v[k];
-                double weight_ik = cotan[fi].v[j];
+            double weight_ij = cotan[fi].v[k];
+            double weight_ik = cotan[fi].v[j];
 
-                if (!std::isfinite(weight_ij))
-                    weight_ij = 1e-8;
+            if (!std::isfinite(weight_ij))
+                weight_ij = 1e-8;
 
-                if (!std::isfinite(weight_ik))
-                    weight_ik = 1e-8;
+            if (!std::isfinite(weight_ik))
+                weight_ik = 1e-8;
 
-                Eigen::Vector2d x_ij = t[i] - t[j];
-                Eigen::Vector2d x_ik = t[i] - t[k];
+            Eigen::Vector2d x_ij = t[i] - t[j];
+            Eigen::Vector2d x_ik = t[i] - t[k];
 
-                Eigen::Vector2d rhs = (weight_ij * Rf) * x_ij + (weight_ik * Rf) * x_ik;
-                bu_private(Idx(vi)) += rhs.x();
-                bv_private(Idx(vi)) += rhs.y();
-            }
-        }
-        #pragma omp critical
-        {
-            bu += bu_private;
-            bv += bv_private;
+            corner_rhs[3 * fi + i] = (weight_ij * Rf) * x_ij + (weight_ik * Rf) * x_ik;
         }
     }
 
+    // gather the corner contributions of each vertex
+    #pragma omp parallel for if (m.FN() >= ParallelMinFaces())
+    for (int vi = 0; vi < m.VN(); ++vi) {
+        Eigen::Vector2d rhs = Eigen::Vector2d::Zero();
+        for (int c = pattern.cornerPtr[vi]; c < pattern.cornerPtr[vi + 1]; ++c)
+            rhs += corner_rhs[pattern.corners[c]];
+        bu(vi) = rhs.x();
+        bv(vi) = rhs.y();
+    }
+
     for (unsigned i = 0; i < fixed_i.size(); ++i) {
         bu(fixed_i[i]) = fixed_pos[i].X();
         bv(fixed_i[i]) = fixed_pos[i].Y();
     }
 }
-
 double ARAP::ComputeEnergy(const vcg::Point2d& x10, const vcg::Point2d& x20,
                            const vcg::Point2d& u10, const vcg::Point2d& u20,
                            double *area)
 {
     *area = std::abs(x10 ^ x20);
     Eigen::Matrix2d Jf = ComputeTransformationMatrix(x10, x20, u10, u20);
-    Eigen::Matrix2d U, V;
-    Eigen::Vector2d sigma;
-    Eigen::JacobiSVD<Eigen::Matrix2d> svd;
-    svd.compute(Jf, Eigen::ComputeFullU | Eigen::ComputeFullV);
-    U = svd.matrixU(); V = svd.matrixV(); sigma = svd.singularValues();
-    return std::pow(sigma[0] - 1.0, 2.0) + std::pow(sigma[1] - 1.0, 2.0);
+    return JacobianEnergy(Jf(0, 0), Jf(0, 1), Jf(1, 0), Jf(1, 1));
 }
 
-double ARAP::ComputeEnergyFromStoredWedgeTC(const std::vector<Mesh::FacePointer>& fpVec, Mesh& m, double *num, double *denom)
+double ARAP::ComputeEnergyFromStoredWedgeTC(const std::vector<Mesh::FacePointer>& fpVec, Mesh& m, double *num, double *denom, std::vector<double> *faceNum)
 {
-    double n = 0;
-    double d = 0;
+    if (faceNum)
+        faceNum->assign(fpVec.size(), 0);
     auto tsa = GetWedgeTexCoordStorageAttribute(m);
-    #pragma omp parallel for reduction(+:n, d)
-    for (std::size_t i = 0; i < fpVec.size(); ++i) {
-        auto fptr = fpVec[i];
-        vcg::Point2d x10 = tsa[fptr].tc[1].P() - tsa[fptr].tc[0].P();
-        vcg::Point2d x20 = tsa[fptr].tc[2].P() - tsa[fptr].tc[0].P();
-        vcg::Point2d u10 = fptr->WT(1).P() - fptr->WT(0).P();
-        vcg::Point2d u20 = fptr->WT(2).P() - fptr->WT(0).P();
-        double area;
-        double energy = ComputeEnergy(x10, x20, u10, u20, &area);
-        if (area > 0) {
-            n += (area * energy);
-            d += area;
+    const int fn = (int) fpVec.size();
+    auto sum = OrderedSum<2>(fn, fn >= ParallelMinFaces(), [&](int begin, int end, double *partial) {
+        for (int i = begin; i < end; ++i) {
+            auto fptr = fpVec[i];
+            vcg::Point2d x10 = tsa[fptr].tc[1].P() - tsa[fptr].tc[0].P();
+            vcg::Point2d x20 = tsa[fptr].tc[2].P() - tsa[fptr].tc[0].P();
+            vcg::Point2d u10 = fptr->WT(1).P() - fptr->WT(0).P();
+            vcg::Point2d u20 = fptr->WT(2).P() - fptr->WT(0).P();
+            double area;
+            double energy = ComputeEnergy(x10, x20, u10, u20, &area);
+            if (area > 0) {
+                partial[0] += (area * energy);
+                partial[1] += area;
+                if (faceNum)
+                    (*faceNum)[i] = area * energy;
+            }
         }
-    }
+    });
+    double n = sum[0];
+    double d = sum[1];
     if (num)
         *num = n;
     if (denom)
@@ -292,28 +645,29 @@ double ARAP::ComputeEnergyFromStoredWedgeTC(const std::vector<Mesh::FacePointer>
     return n / d;
 }
 
-double ARAP::ComputeEnergyFromStoredWedgeTC(Mesh& m, double *num, double *denom)
+double ARAP::ComputeEnergyFromStoredWedgeTC(Mesh& m, double *num, double *denom, std::vector<double> *faceNum)
 {
-    double e = 0;
-    double total_area = 0;
+    if (faceNum)
+        faceNum->assign(m.FN(), 0);
     auto tsa = GetWedgeTexCoordStorageAttribute(m);
-    #pragma omp parallel for reduction(+:e, total_area)
-    for (int fi = 0; fi < m.FN(); ++fi) {
-        auto& f = m.face[fi];
-        vcg::Point2d x10 = tsa[f].tc[1].P() - tsa[f].tc[0].P();
-        vcg::Point2d x20 = tsa[f].tc[2].P() - tsa[f].tc[0].P();
-        double area_f = std::abs(x10 ^ x20);
-        if (area_f > 0) {
-            Eigen::Matrix2d Jf = ComputeTransformationMatrix(x10, x20, f.WT(1).P() - f.WT(0).P(), f.WT(2).P() - f.WT(0).P());
-            Eigen::Matrix2d U, V;
-            Eigen::Vector2d sigma;
-            Eigen::JacobiSVD<Eigen::Matrix2d> svd;
-            svd.compute(Jf, Eigen::ComputeFullU | Eigen::ComputeFullV);
-            U = svd.matrixU(); V = svd.matrixV(); sigma = svd.singularValues();
-            total_area += area_f;
-            e += area_f * (std::pow(sigma[0] - 1.0, 2.0) + std::pow(sigma[1] - 1.0, 2.0));
+    auto sum = OrderedSum<2>(m.FN(), m.FN() >= ParallelMinFaces(), [&](int begin, int end, double *partial) {
+        for (int fi = begin; fi < end; ++fi) {
+            auto& f = m.face[fi];
+            vcg::Point2d x10 = tsa[f].tc[1].P() - tsa[f].tc[0].P();
+            vcg::Point2d x20 = tsa[f].tc[2].P() - tsa[f].tc[0].P();
+            double area_f = std::abs(x10 ^ x20);
+            if (area_f > 0) {
+                Eigen::Matrix2d Jf = ComputeTransformationMatrix(x10, x20, f.WT(1).P() - f.WT(0).P(), f.WT(2).P() - f.WT(0).P());
+                double e_f = area_f * JacobianEnergy(Jf(0, 0), Jf(0, 1), Jf(1, 0), Jf(1, 1));
+                partial[0] += e_f;
+                partial[1] += area_f;
+                if (faceNum)
+                    (*faceNum)[fi] = e_f;
+            }
         }
-    }
+    });
+    double e = sum[0];
+    double total_area = sum[1];
     if (num)
         *num = e;
     if (denom)
@@ -323,100 +677,692 @@ double ARAP::ComputeEnergyFromStoredWedgeTC(Mesh& m, double *num, double *denom)
 
 double ARAP::CurrentEnergy()
 {
-    double e = 0;
-    double total_area = 0;
     auto tsa = GetTargetShapeAttribute(m);
-    #pragma omp parallel for reduction(+:e, total_area)
-    for (int fi = 0; fi < m.FN(); ++fi) {
-        auto& f = m.face[fi];
+    auto sum = OrderedSum<2>(m.FN(), m.FN() >= ParallelMinFaces(), [&](int begin, int end, double *partial) {
+        for (int fi = begin; fi < end; ++fi) {
+            auto& f = m.face[fi];
+            vcg::Point2d x10, x20;
+            LocalIsometry(tsa[f].P[1] - tsa[f].P[0], tsa[f].P[2] - tsa[f].P[0], x10, x20);
+            Eigen::Matrix2d Jf = ComputeTransformationMatrix(x10, x20, f.WT(1).P() - f.WT(0).P(), f.WT(2).P() - f.WT(0).P());
+            double area_f = 0.5 * ((tsa[f].P[1] - tsa[f].P[0]) ^ (tsa[f].P[2] - tsa[f].P[0])).Norm();
+            partial[0] += area_f * JacobianEnergy(Jf(0, 0), Jf(0, 1), Jf(1, 0), Jf(1, 1));
+            partial[1] += area_f;
+        }
+    });
+    return sum[0] / sum[1];
+}
+
+/* Coarse level of the multilevel solve. The coarse mesh is obtained with half-edge
+ * collapses of the free interior vertices, so the coarse vertices are a subset of
+ * the mesh vertices and retain their tex coords. Each removed vertex is expressed
+ * in barycentric coordinates of a coarse face, in the initial parameterization */
+struct ARAPCoarseLevel {
+    Mesh mesh;
+    std::vector<int> coarseIndex; // index of each vertex in the coarse mesh, -1 if removed
+    std::vector<int> coarseFace;  // coarse face of each removed vertex
+    std::vector<vcg::Point3d> bary;
+};
+
+// twice the signed area over the sum of the squared edge lengths, normalized to 1 for equilateral triangles
+static double TriangleQuality(const vcg::Point2d& p0, const vcg::Point2d& p1, const vcg::Point2d& p2)
+{
+    double a = (p1 - p0) ^ (p2 - p0);
+    double l = (p1 - p0).SquaredNorm() + (p2 - p1).SquaredNorm() + (p0 - p2).SquaredNorm();
+    return (l > 0) ? (2.0 * std::sqrt(3.0) * a / l) : 0;
+}
+
+static vcg::Point3d Barycentric(const vcg::Point2d& p, const vcg::Point2d& p0, const vcg::Point2d& p1, const vcg::Point2d& p2)
+{
+    double a = (p1 - p0) ^ (p2 - p0);
+    if (a == 0)
+        return vcg::Point3d(-1, -1, -1);
+    double b1 = ((p - p0) ^ (p2 - p0)) / a;
+    double b2 = ((p1 - p0) ^ (p - p0)) / a;
+    return vcg::Point3d(1.0 - b1 - b2, b1, b2);
+}
+
+/* Builds the coarse level of the mesh by collapsing, at each pass, an independent
+ * set of the shortest edges whose collapse does not violate the link condition
+ * and does not produce inverted or badly shaped faces in the parameter space. The
+ * locked vertices, and the vertices of the boundary and non-manifold edges, are
+ * never removed. The coarse faces are assigned the target metric averaged over
+ * the faces whose centroid they contain. Returns false if the mesh cannot be
+ * reduced enough to make the coarse solve worthwhile */
+static bool BuildCoarseLevel(Mesh& m, std::vector<bool> locked, ARAPCoarseLevel& level)
+{
+    constexpr double MIN_QUALITY = 0.05;
+
+    const int vn = m.VN();
+    const int fn = m.FN();
+
+    std::vector<vcg::Point2d> uv(vn);
+    for (int vi = 0; vi < vn; ++vi)
+        uv[vi] = m.vert[vi].T().P();
+
+    std::vector<std::array<int, 3>> F(fn);
+    std::vector<double> orientation(fn);
+    std::vector<std::vector<int>> vf(vn);
+    std::vector<std::pair<int, int>> edges;
+    edges.reserve(3 * fn);
+    for (int fi = 0; fi < fn; ++fi) {
+        for (int i = 0; i < 3; ++i) {
+            F[fi][i] = tri::Index(m, m.face[fi].V(i));
+            vf[F[fi][i]].push_back(fi);
+        }
+        for (int i = 0; i < 3; ++i) {
+            int v0 = F[fi][i];
+            int v1 = F[fi][(i+1)%3];
+            edges.push_back(std::make_pair(std::min(v0, v1), std::max(v0, v1)));
+        }
+        double q = TriangleQuality(uv[F[fi][0]], uv[F[fi][1]], uv[F[fi][2]]);
+        orientation[fi] = (q < 0) ? -1 : 1;
+        if (std::abs(q) < MIN_QUALITY) {
+            // the collapse checks are unreliable around degenerate faces
+            for (int i = 0; i < 3; ++i)
+                locked[F[fi][i]] = true;
+        }
+    }
+    const std::vector<std::array<int, 3>> inputFaces = F;
+
+    std::sort(edges.begin(), edges.end());
+    for (unsigned i = 0; i < edges.size(); ) {
+        unsigned j = i;
+        while (j < edges.size() && edges[j] == edges[i])
+            j++;
+        if (j - i != 2) {
+            locked[edges[i].first] = true;
+            locked[edges[i].second] = true;
+        }
+        i = j;
+    }
+
+    std::vector<char> faceAlive(fn, 1);
+    std::vector<int> parent(vn);
+    for (int vi = 0; vi < vn; ++vi)
+        parent[vi] = vi;
+
+    std::vector<int> mark(vn, 0);
+    int stamp = 0;
+
+    auto Contains = [&] (int fi, int vi) { return F[fi][0] == vi || F[fi][1] == vi || F[fi][2] == vi; };
+
+    // collapses u into v
+    auto Collapse = [&] (int u, int v) -> bool {
+        // link condition, the only vertices adjacent to both u and v are the two
+        // opposite to the edge
+        stamp++;
+        for (int fi : vf[u])
+            if (faceAlive[fi])
+                for (int k = 0; k < 3; ++k)
+                    mark[F[fi][k]] = stamp;
+        int common = 0;
+        int shared = 0;
+        for (int fi : vf[v]) {
+            if (faceAlive[fi]) {
+                if (Contains(fi, u))
+                    shared++;
+                for (int k = 0; k < 3; ++k) {
+                    int w = F[fi][k];
+                    if (w != u && w != v && mark[w] == stamp) {
+                        common++;
+                        mark[w] = 0;
+                    }
+                }
+            }
+        }
+        if (shared != 2 || common != 2)
+            return false;
+
+        for (int fi : vf[u]) {
+            if (faceAlive[fi] && !Contains(fi, v)) {
+                vcg::Point2d p[3];
+                for (int k = 0; k < 3; ++k)
+                    p[k] = (F[fi][k] == u) ? uv[v] : uv[F[fi][k]];
+                if (orientation[fi] * TriangleQuality(p[0], p[1], p[2]) < MIN_QUALITY)
+                    return false;
+            }
+        }
+
+        for (int fi : vf[u]) {
+            if (faceAlive[fi]) {
+                if (Contains(fi, v)) {
+                    faceAlive[fi] = 0;
+                } else {
+                    for (int k = 0; k < 3; ++k)
+                        if (F[fi][k] == u)
+                            F[fi][k] = v;
+                    vf[v].push_back(fi);
+                }
+            }
+        }
+        vf[u].clear();
+        parent[u] = v;
+        return true;
+    };
+
+    int alive = vn;
+    const int target = vn / 4;
+    std::vector<char> touched(vn);
+    std::vector<std::pair<double, std::pair<int, int>>> candidates;
+    while (alive > target) {
+        candidates.clear();
+        for (int fi = 0; fi < fn; ++fi) {
+            if (faceAlive[fi]) {
+                for (int i = 0; i < 3; ++i) {
+                    int v0 = F[fi][i];
+                    int v1 = F[fi][(i+1)%3];
+                    double d = (uv[v0] - uv[v1]).SquaredNorm();
+                    if (!locked[v0])
+                        candidates.push_back(std::make_pair(d, std::make_pair(v0, v1)));
+                    if (!locked[v1])
+                        candidates.push_back(std::make_pair(d, std::make_pair(v1, v0)));
+                }
+            }
+        }
+        std::sort(candidates.begin(), candidates.end());
+
+        std::fill(touched.begin(), touched.end(), 0);
+        int collapsed = 0;
+        for (auto& c : candidates) {
+            int u = c.second.first;
+            int v = c.second.second;
+            if (!touched[u] && !touched[v] && Collapse(u, v)) {
+                touched[u] = 1;
+                touched[v] = 1;
+                collapsed++;
+            }
+        }
+        alive -= collapsed;
+        if (collapsed < alive / 20)
+            break;
+    }
+
+    if (alive > (3 * vn) / 4)
+        return false;
+
+    // build the coarse mesh
+    auto Find = [&] (int vi) {
+        while (parent[vi] != vi)
+            vi = parent[vi];
+        return vi;
+    };
+
+    level.coarseIndex.assign(vn, -1);
+    int nc = 0;
+    for (int vi = 0; vi < vn; ++vi)
+        if (parent[vi] == vi)
+            level.coarseIndex[vi] = nc++;
+
+    std::vector<int> coarseFaceIndex(fn, -1);
+    int nfc = 0;
+    for (int fi = 0; fi < fn; ++fi)
+        if (faceAlive[fi])
+            coarseFaceIndex[fi] = nfc++;
+
+    Mesh& cm = level.mesh;
+    tri::Allocator<Mesh>::AddVertices(cm, nc);
+    tri::Allocator<Mesh>::AddFaces(cm, nfc);
+    for (int vi = 0; vi < vn; ++vi) {
+        if (level.coarseIndex[vi] >= 0) {
+            auto& cv = cm.vert[level.coarseIndex[vi]];
+            cv.P() = vcg::Point3d(uv[vi].X(), uv[vi].Y(), 0);
+            cv.T().P() = uv[vi];
+        }
+    }
+    for (int fi = 0; fi < fn; ++fi) {
+        if (faceAlive[fi]) {
+            auto& cf = cm.face[coarseFaceIndex[fi]];
+            for (int i = 0; i < 3; ++i) {
+                cf.V(i) = &cm.vert[level.coarseIndex[F[fi][i]]];
+                cf.WT(i) = cf.V(i)->T();
+            }
+        }
+    }
+
+    // locates a point in the coarse faces within two rings of the vertex r, choosing
+    // the face where the barycentric coords are the least negative
+    auto Locate = [&] (const vcg::Point2d& p, int r, vcg::Point3d& bary) {
+        int cfi = -1;
+        double best = -std::numeric_limits<double>::max();
+        for (int fr : vf[r]) {
+            if (!faceAlive[fr])
+                continue;
+            for (int k = 0; k < 3; ++k) {
+                for (int fi : vf[F[fr][k]]) {
+                    if (faceAlive[fi]) {
+                        vcg::Point3d b = Barycentric(p, uv[F[fi][0]], uv[F[fi][1]], uv[F[fi][2]]);
+                        double minb = std::min(b[0], std::min(b[1], b[2]));
+                        if (minb > best) {
+                            best = minb;
+                            cfi = coarseFaceIndex[fi];
+                            bary = b;
+                        }
+                    }
+                }
+            }
+        }
+        ensure(cfi != -1);
+        return cfi;
+    };
+
+    level.coarseFace.assign(vn, -1);
+    level.bary.assign(vn, vcg::Point3d(0, 0, 0));
+    for (int vi = 0; vi < vn; ++vi)
+        if (level.coarseIndex[vi] == -1)
+            level.coarseFace[vi] = Locate(uv[vi], Find(vi), level.bary[vi]);
+
+    // accumulate the parameter space metric of the target shapes on the coarse
+    // faces that contain the centroids of the faces
+    auto tsa = GetTargetShapeAttribute(m);
+    std::vector<Eigen::Matrix2d> metric(nfc, Eigen::Matrix2d::Zero());
+    std::vector<double> weight(nfc, 0);
+    for (int fi = 0; fi < fn; ++fi) {
         vcg::Point2d x10, x20;
-        LocalIsometry(tsa[f].P[1] - tsa[f].P[0], tsa[f].P[2] - tsa[f].P[0], x10, x20);
-        Eigen::Matrix2d Jf = ComputeTransformationMatrix(x10, x20, f.WT(1).P() - f.WT(0).P(), f.WT(2).P() - f.WT(0).P());
-        Eigen::Matrix2d U, V;
-        Eigen::Vector2d sigma;
-        Eigen::JacobiSVD<Eigen::Matrix2d> svd;
-        svd.compute(Jf, Eigen::ComputeFullU | Eigen::ComputeFullV);
-        U = svd.matrixU(); V = svd.matrixV(); sigma = svd.singularValues();
-        double area_f = 0.5 * ((tsa[f].P[1] - tsa[f].P[0]) ^ (tsa[f].P[2] - tsa[f].P[0])).Norm();
-        total_area += area_f;
-        e += area_f * (std::pow(sigma[0] - 1.0, 2.0) + std::pow(sigma[1] - 1.0, 2.0));
+        LocalIsometry(tsa[m.face[fi]].P[1] - tsa[m.face[fi]].P[0], tsa[m.face[fi]].P[2] - tsa[m.face[fi]].P[0], x10, x20);
+        vcg::Point2d u10 = uv[inputFaces[fi][1]] - uv[inputFaces[fi][0]];
+        vcg::Point2d u20 = uv[inputFaces[fi][2]] - uv[inputFaces[fi][0]];
+        double area = std::abs(u10 ^ u20) / 2.0;
+        if (area > 0) {
+            Eigen::Matrix2d X, U;
+            X << x10.X(), x20.X(), x10.Y(), x20.Y();
+            U << u10.X(), u20.X(), u10.Y(), u20.Y();
+            Eigen::Matrix2d M = X * U.inverse();
+            Eigen::Matrix2d G = M.transpose() * M;
+            int cfi = coarseFaceIndex[fi];
+            if (cfi == -1) {
+                vcg::Point2d centroid = (uv[inputFaces[fi][0]] + uv[inputFaces[fi][1]] + uv[inputFaces[fi][2]]) / 3.0;
+                vcg::Point3d b;
+                cfi = Locate(centroid, Find(inputFaces[fi][0]), b);
+            }
+            metric[cfi] += area * G;
+            weight[cfi] += area;
+        }
     }
-    return e / total_area;
+
+    // the target shape of each coarse face is its parameter space shape measured with the metric
+    auto ctsa = GetTargetShapeAttribute(cm);
+    for (auto& cf : cm.face) {
+        int cfi = tri::Index(cm, cf);
+        Eigen::Matrix2d L = Eigen::Matrix2d::Identity();
+        if (weight[cfi] > 0) {
+            Eigen::LLT<Eigen::Matrix2d> llt(metric[cfi] / weight[cfi]);
+            if (llt.info() == Eigen::Success)
+                L = llt.matrixL();
+        }
+        vcg::Point2d c10 = cf.V(1)->T().P() - cf.V(0)->T().P();
+        vcg::Point2d c20 = cf.V(2)->T().P() - cf.V(0)->T().P();
+        Eigen::Vector2d t10 = L.transpose() * Eigen::Vector2d(c10.X(), c10.Y());
+        Eigen::Vector2d t20 = L.transpose() * Eigen::Vector2d(c20.X(), c20.Y());
+        ctsa[cf].P[0] = vcg::Point3d(0, 0, 0);
+        ctsa[cf].P[1] = vcg::Point3d(t10.x(), t10.y(), 0);
+        ctsa[cf].P[2] = vcg::Point3d(t20.x(), t20.y(), 0);
+    }
+
+    LOG_DEBUG << "ARAP: coarse level has " << nc << " vertices and " << nfc << " faces (" << vn << " and " << fn << " in the input)";
+
+    return true;
+}
+
+/* Solves the problem on a coarse level of the mesh, and prolongates the coarse
+ * solution to the mesh tex coords. The coarse problem is solved with the same
+ * settings, so in turn it can be solved on a coarser level. The prolongated
+ * solution is kept only if it lowers the energy of the current tex coords.
+ * Returns true if the tex coords were updated */
+bool ARAP::SolveCoarseLevel()
+{
+    std::vector<bool> locked(m.VN(), false);
+    for (int vi : fixed_i)
+        locked[vi] = true;
+
+    ARAPCoarseLevel level;
+    if (!BuildCoarseLevel(m, locked, level))
+        return false;
+
+    ARAP coarse(level.mesh);
+    for (unsigned i = 0; i < fixed_i.size(); ++i)
+        coarse.FixVertex(&level.mesh.vert[level.coarseIndex[fixed_i[i]]], fixed_pos[i]);
+    coarse.SetMaxIterations(max_iter);
+    coarse.SetSolverTolerance(solver_tol);
+    coarse.SetSolverBackend(backend);
+    coarse.SetMultilevel(multilevel_faces, multilevel_fine_iter);
+    coarse.SetAndersonAcceleration(anderson_window);
+    coarse.SetDenseThreshold(dense_faces);
+    coarse.SetGPUThreshold(gpu_faces);
+    ARAPSolveInfo csi = coarse.Solve();
+    if (csi.numericalError)
+        return false;
+
+    double e = CurrentEnergy();
+
+    std::vector<vcg::Point2d> tc(m.VN());
+    for (int vi = 0; vi < m.VN(); ++vi) {
+        tc[vi] = m.vert[vi].T().P();
+        if (level.coarseIndex[vi] >= 0) {
+            m.vert[vi].T().P() = level.mesh.vert[level.coarseIndex[vi]].T().P();
+        } else {
+            const auto& cf = level.mesh.face[level.coarseFace[vi]];
+            const vcg::Point3d& b = level.bary[vi];
+            m.vert[vi].T().P() = cf.cV(0)->T().P() * b[0] + cf.cV(1)->T().P() * b[1] + cf.cV(2)->T().P() * b[2];
+        }
+    }
+    for (auto& f : m.face)
+        for (int i = 0; i < 3; ++i)
+            f.WT(i).P() = f.cV(i)->T().P();
+
+    double e_prolongated = CurrentEnergy();
+    LOG_DEBUG << "ARAP: coarse solve took " << csi.iterations << " iterations, energy " << e << " -> " << e_prolongated;
+
+    if (!(e_prolongated < e)) {
+        for (int vi = 0; vi < m.VN(); ++vi)
+            m.vert[vi].T().P() = tc[vi];
+        for (auto& f : m.face)
+            for (int i = 0; i < 3; ++i)
+                f.WT(i).P() = f.cV(i)->T().P();
+        return false;
+    }
+
+    return true;
 }
 
 ARAPSolveInfo ARAP::Solve()
 {
-    ARAPSolveInfo si = {0, 0, 0, false};
-    std::vector<Cot> cotan = ComputeCotangentVector(m);
+    ARAPSolveInfo si = {0, 0, 0, false, 0, backend, false, false};
+
+    // the sparse backend that replaces the dense and the GPU ones when they fail
+    const ARAPSolverBackend sparse_backend = (backend == DENSE_LLT || backend == GPU_JACOBI_CG) ? SIMPLICIAL_LDLT : backend;
+
+    if (dense_faces > 0 && m.FN() <= dense_faces && backend != BICGSTAB_ILUT)
+        si.backend = DENSE_LLT;
+    else if (gpu_faces > 0 && m.FN() >= gpu_faces && backend != BICGSTAB_ILUT && GetGPUARAPSolver())
+        si.backend = GPU_JACOBI_CG;
+    else if (backend == GPU_JACOBI_CG && !GetGPUARAPSolver()) {
+        LOG_DEBUG << "ARAP: no GPU solver on this thread, falling back to " << ARAPSolverBackendName(sparse_backend);
+        si.backend = sparse_backend;
+        si.fallback = true;
+    }
 
-    PrecomputeData();
+    // starting from the prolongated coarse solution, only a few iterations are
+    // needed to recover the details of the mesh
+    int iter_limit = max_iter;
+    if (multilevel_faces > 0 && m.FN() >= multilevel_faces && SolveCoarseLevel())
+        iter_limit = std::min(max_iter, multilevel_fine_iter);
 
-    Eigen::SparseMatrix<double, Eigen::RowMajor> A;
-    ComputeSystemMatrix(m, cotan, A);
+    if (!precomputed) {
+        cotan = ComputeCotangentVector(m);
+        PrecomputeData();
+        precomputed = true;
+    }
 
-    Eigen::VectorXd xu = Eigen::VectorXd::Constant(m.VN(), 0);
-    Eigen::VectorXd xv = Eigen::VectorXd::Constant(m.VN(), 0);
+    fixed_slot.assign(m.VN(), -1);
+    for (unsigned i = 0; i < fixed_i.size(); ++i)
+        fixed_slot[fixed_i[i]] = i;
 
-    double e = CurrentEnergy();
+    if (!cache)
+        cache = std::make_shared<ARAPFactorizationCache>();
 
-    // The system matrix is not symmetric - using preconditioned BiCGSTAB
-    Eigen::BiCGSTAB<Eigen::SparseMatrix<double, Eigen::RowMajor>, Eigen::IncompleteLUT<double>> solver;
+    if (si.backend == GPU_JACOBI_CG) {
+        if (SolveGPU(si, iter_limit)) {
+            RestoreFixedVertices();
+            return si;
+        }
+        si.backend = sparse_backend;
+        LOG_DEBUG << "ARAP: GPU solve failed, falling back to " << ARAPSolverBackendName(si.backend);
+        si.fallback = true;
+        si.solverIterations = 0;
+    }
 
-    solver.compute(A);
+    Eigen::SparseMatrix<double> As;
+    Eigen::VectorXd bu_fixed;
+    Eigen::VectorXd bv_fixed;
 
-    if (solver.info() != Eigen::Success) {
-        LOG_WARN << "Cotan matrix factorization failed: " << solver.info();
-        si.numericalError = true;
-        return si;
+    if (si.backend == DENSE_LLT) {
+        ComputeSymmetricSystemMatrix(m, cotan, As, bu_fixed, bv_fixed);
+        if (!FactorizeDenseSystem(As)) {
+            si.backend = sparse_backend;
+            LOG_DEBUG << "ARAP: dense Cholesky factorization failed, falling back to " << ARAPSolverBackendName(si.backend);
+            si.fallback = true;
+        }
     }
 
-    si.initialEnergy = CurrentEnergy();
-    LOG_DEBUG << "ARAP: Starting energy is " << si.initialEnergy;
+    if (si.backend == SIMPLICIAL_LDLT_MIXED) {
+        ComputeSymmetricSystemMatrix(m, cotan, As, bu_fixed, bv_fixed);
+        if (!FactorizeSymmetricSystem(As, true)) {
+            LOG_DEBUG << "ARAP: single precision LDLT factorization failed, falling back to double precision";
+            si.backend = SIMPLICIAL_LDLT;
+            si.fallback = true;
+        }
+    }
 
-    bool converged = false;
-    int iter = 0;
-    while (!converged && iter < max_iter) {
+    if (si.backend == SIMPLICIAL_LDLT) {
+        if (As.size() == 0)
+            ComputeSymmetricSystemMatrix(m, cotan, As, bu_fixed, bv_fixed);
+        if (!FactorizeSymmetricSystem(As, false)) {
+            LOG_DEBUG << "ARAP: LDLT factorization failed, falling back to BiCGSTAB";
+            si.backend = BICGSTAB_ILUT;
+            si.fallback = true;
+        }
+    }
 
-        std::vector<Eigen::Matrix2d> rotations = ComputeRotations(m);
-        Eigen::VectorXd bu(m.VN());
-        Eigen::VectorXd bv(m.VN());
-        ComputeRHS(m, rotations, cotan, bu, bv);
+    // The symmetric system (with the fixed vertices eliminated) is positive definite,
+    // so it can be solved with preconditioned conjugate gradients
+    Eigen::ConjugateGradient<Eigen::SparseMatrix<double>, Eigen::Lower | Eigen::Upper, Eigen::IncompleteCholesky<double>> cg;
 
-        Eigen::VectorXd xu_iter = solver.solve(bu);
+    if (si.backend == CG_ICHOL) {
+        ComputeSymmetricSystemMatrix(m, cotan, As, bu_fixed, bv_fixed);
+        if (solver_tol > 0)
+            cg.setTolerance(solver_tol);
+        cg.compute(As);
 
-        if (!(solver.info() == Eigen::Success)) {
-            LOG_WARN << "ARAP solve failed";
-            si.numericalError = true;
-            return si;
+        if (cg.info() != Eigen::Success) {
+            LOG_DEBUG << "ARAP: incomplete Cholesky factorization failed, falling back to BiCGSTAB";
+            si.backend = BICGSTAB_ILUT;
+            si.fallback = true;
         }
+    }
+
+    Eigen::SparseMatrix<double, Eigen::RowMajor> A;
 
-        LOG_DEBUG << "ARAP solve (u) converged in " << solver.iterations() << " iterations with error " << solver.error();
+    // The system matrix with identity rows for the fixed vertices is not symmetric - using preconditioned BiCGSTAB
+    Eigen::BiCGSTAB<Eigen::SparseMatrix<double, Eigen::RowMajor>, Eigen::IncompleteLUT<double>> solver;
 
-        Eigen::VectorXd xv_iter = solver.solve(bv);
+    if (si.backend == BICGSTAB_ILUT) {
+        ComputeSystemMatrix(m, cotan, A);
+        if (solver_tol > 0)
+            solver.setTolerance(solver_tol);
+        solver.compute(A);
 
-        if (!(solver.info() == Eigen::Success)) {
-            LOG_WARN << "ARAP solve failed";
+        if (solver.info() != Eigen::Success) {
+            LOG_WARN << "Cotan matrix factorization failed: " << solver.info();
             si.numericalError = true;
             return si;
         }
+    }
+
+    // the current texture coordinates are the initial guess of the iterative solver
+    Eigen::VectorXd xu(m.VN());
+    Eigen::VectorXd xv(m.VN());
+    for (int vi = 0; vi < m.VN(); ++vi) {
+        xu(vi) = m.vert[vi].T().P().X();
+        xv(vi) = m.vert[vi].T().P().Y();
+    }
+
+    // the energy of the initial tex coords is computed with the first rotations
+    double e = ComputeRotations();
 
-        LOG_DEBUG << "ARAP solve (v) converged in " << solver.iterations() << " iterations with error " << solver.error();
+    si.initialEnergy = e;
+    LOG_DEBUG << "ARAP: Starting energy is " << si.initialEnergy;
+
+    Eigen::VectorXd bu(m.VN());
+    Eigen::VectorXd bv(m.VN());
+    Eigen::VectorXd xu_iter(m.VN());
+    Eigen::VectorXd xv_iter(m.VN());
+
+    // Anderson acceleration over the stacked u and v coordinates. The global step is a
+    // fixed point map G, and the differences of the last residuals f = G(x) - x and of
+    // the last values of G are kept in circular buffers of anderson_window columns
+    const int vn = m.VN();
+    Eigen::MatrixXd aa_df;
+    Eigen::MatrixXd aa_dg;
+    Eigen::VectorXd aa_f_prev;
+    Eigen::VectorXd aa_g_prev;
+    int aa_cols = 0;
+    int aa_next = 0;
+    int aa_accepted = 0;
+    if (anderson_window > 0) {
+        aa_df.resize(2 * vn, anderson_window);
+        aa_dg.resize(2 * vn, anderson_window);
+    }
 
-        #pragma omp parallel for
-        for (int vi = 0; vi < m.VN(); ++vi) {
-            m.vert[vi].T().P().X() = xu_iter(vi);
-            m.vert[vi].T().P().Y() = xv_iter(vi);
+    auto SetTexCoords = [&](const Eigen::VectorXd& u, const Eigen::VectorXd& v) {
+        #pragma omp parallel for if (m.FN() >= ParallelMinFaces())
+        for (int vi = 0; vi < vn; ++vi) {
+            m.vert[vi].T().P().X() = u(vi);
+            m.vert[vi].T().P().Y() = v(vi);
         }
 
-        #pragma omp parallel for
+        #pragma omp parallel for if (m.FN() >= ParallelMinFaces())
         for (int fi = 0; fi < m.FN(); ++fi) {
             auto& f = m.face[fi];
             for (int i = 0; i < 3; ++i) {
                 f.WT(i).P() = f.V(i)->T().P();
             }
         }
+    };
+
+    bool converged = false;
+    int iter = 0;
+    while (!converged && iter < iter_limit) {
+
+        ComputeRHS(m, cotan, bu, bv);
+
+        if (si.backend == SIMPLICIAL_LDLT_MIXED) {
+            if (!SolveRefined(As, bu + bu_fixed, xu_iter) || !SolveRefined(As, bv + bv_fixed, xv_iter)) {
+                LOG_DEBUG << "ARAP: mixed precision refinement did not converge, falling back to double precision";
+                si.backend = SIMPLICIAL_LDLT;
+                si.fallback = true;
+                if (!FactorizeSymmetricSystem(As, false)) {
+                    LOG_WARN << "ARAP solve failed";
+                    si.numericalError = true;
+                    return si;
+                }
+            }
+        }
+
+        if (si.backend == DENSE_LLT) {
+            xu_iter.noalias() = cache->denseInverse * (bu + bu_fixed);
+            xv_iter.noalias() = cache->denseInverse * (bv + bv_fixed);
+
+            if (!xu_iter.allFinite() || !xv_iter.allFinite()) {
+                LOG_WARN << "ARAP solve failed";
+                si.numericalError = true;
+                return si;
+            }
+        } else if (si.backend == SIMPLICIAL_LDLT) {
+            xu_iter = cache->solver.solve(bu + bu_fixed);
+            xv_iter = cache->solver.solve(bv + bv_fixed);
+
+            if (!(cache->solver.info() == Eigen::Success) || !xu_iter.allFinite() || !xv_iter.allFinite()) {
+                LOG_WARN << "ARAP solve failed";
+                si.numericalError = true;
+                return si;
+            }
+        } else if (si.backend == CG_ICHOL) {
+            xu_iter = cg.solveWithGuess(bu + bu_fixed, xu);
+
+            if (!(cg.info() == Eigen::Success)) {
+                LOG_WARN << "ARAP solve failed";
+                si.numericalError = true;
+                return si;
+            }
+
+            LOG_DEBUG << "ARAP solve (u) converged in " << cg.iterations() << " iterations with error " << cg.error();
+            si.solverIterations += cg.iterations();
+
+            xv_iter = cg.solveWithGuess(bv + bv_fixed, xv);
+
+            if (!(cg.info() == Eigen::Success)) {
+                LOG_WARN << "ARAP solve failed";
+                si.numericalError = true;
+                return si;
+            }
+
+            LOG_DEBUG << "ARAP solve (v) converged in " << cg.iterations() << " iterations with error " << cg.error();
+            si.solverIterations += cg.iterations();
+        } else if (si.backend == BICGSTAB_ILUT) {
+            xu_iter = solver.solveWithGuess(bu, xu);
+
+            if (!(solver.info() == Eigen::Success)) {
+                LOG_WARN << "ARAP solve failed";
+                si.numericalError = true;
+                return si;
+            }
+
+            LOG_DEBUG << "ARAP solve (u) converged in " << solver.iterations() << " iterations with error " << solver.error();
+            si.solverIterations += solver.iterations();
+
+            xv_iter = solver.solveWithGuess(bv, xv);
+
+            if (!(solver.info() == Eigen::Success)) {
+                LOG_WARN << "ARAP solve failed";
+                si.numericalError = true;
+                return si;
+            }
+
+            LOG_DEBUG << "ARAP solve (v) converged in " << solver.iterations() << " iterations with error " << solver.error();
+            si.solverIterations += solver.iterations();
+        }
+
+        bool accelerated = false;
+        if (anderson_window > 0) {
+            Eigen::VectorXd g(2 * vn);
+            g << xu_iter, xv_iter;
+            Eigen::VectorXd f(2 * vn);
+            f << xu_iter - xu, xv_iter - xv;
+            if (aa_f_prev.size() > 0) {
+                aa_df.col(aa_next) = f - aa_f_prev;
+                aa_dg.col(aa_next) = g - aa_g_prev;
+                aa_next = (aa_next + 1) % anderson_window;
+                aa_cols = std::min(aa_cols + 1, anderson_window);
+            }
+            aa_f_prev = f;
+            aa_g_prev = g;
+
+            if (aa_cols > 0) {
+                // coefficients that minimize |f - df * gamma|
+                Eigen::VectorXd gamma = aa_df.leftCols(aa_cols).colPivHouseholderQr().solve(f);
+                if (gamma.allFinite()) {
+                    Eigen::VectorXd x_aa = g - aa_dg.leftCols(aa_cols) * gamma;
+                    if (x_aa.allFinite()) {
+                        SetTexCoords(x_aa.head(vn), x_aa.tail(vn));
+                        accelerated = true;
+                    }
+                }
+            }
+        }
+
+        if (!accelerated)
+            SetTexCoords(xu_iter, xv_iter);
+
+        // rotations for the next iteration, and energy of the updated tex coords
+        double e_curr = ComputeRotations();
+
+        if (accelerated) {
+            if (e_curr < e) {
+                for (int vi = 0; vi < vn; ++vi) {
+                    xu_iter(vi) = m.vert[vi].T().P().X();
+                    xv_iter(vi) = m.vert[vi].T().P().Y();
+                }
+                aa_accepted++;
+            } else {
+                // the combination did not decrease the energy, take the plain step
+                // (which does) and restart the history from it
+                SetTexCoords(xu_iter, xv_iter);
+                e_curr = ComputeRotations();
+                aa_cols = 0;
+                aa_next = 0;
+            }
+        }
 
-        double e_curr = CurrentEnergy();
         si.finalEnergy = e_curr;
 
         double delta_e = e - e_curr;
@@ -430,17 +1376,174 @@ ARAPSolveInfo ARAP::Solve()
         e = e_curr;
 
         iter++;
+
+        if (!converged && iteration_callback && !iteration_callback(iter, iter_limit)) {
+            LOG_DEBUG << "ARAP: solve stopped by the iteration callback";
+            si.stopped = true;
+            break;
+        }
     }
 
     si.iterations = iter;
 
-    if (iter == max_iter) {
+    if (iter == iter_limit) {
+        LOG_DEBUG << "ARAP: iteration limit reached";
+    }
+
+    LOG_DEBUG << "ARAP: Energy after optimization is " << si.finalEnergy << " (" << iter << " iterations)";
+    if (anderson_window > 0)
+        LOG_DEBUG << "ARAP: " << aa_accepted << " accelerated iterations";
+
+    RestoreFixedVertices();
+
+    return si;
+}
+
+/* The iterations of Solve() with the GPU solver of the calling thread. The
+ * solver keeps the tex coords, which are read back for the iteration callback
+ * and at the end of the solve. Returns false, with the initial tex coords
+ * restored, if there is no solver or if the conjugate gradient fails */
+bool ARAP::SolveGPU(ARAPSolveInfo& si, int iterLimit)
+{
+    GPUARAPSolver *solver = GetGPUARAPSolver();
+    if (!solver)
+        return false;
+
+    const int vn = m.VN();
+    const int fn = m.FN();
+
+    Eigen::SparseMatrix<double> As;
+    Eigen::VectorXd bu_fixed;
+    Eigen::VectorXd bv_fixed;
+    ComputeSymmetricSystemMatrix(m, cotan, As, bu_fixed, bv_fixed);
+
+    GPUARAPProblem problem;
+    problem.vn = vn;
+    problem.fn = fn;
+    problem.faceVertex.resize(3 * fn);
+    problem.frameInv.resize(4 * fn);
+    problem.frameArea = frame_area;
+    problem.cornerTarget.resize(6 * fn);
+    for (int fi = 0; fi < fn; ++fi) {
+        const auto& t = local_frame_coords[fi];
+        for (int i = 0; i < 3; ++i) {
+            int j = (i+1)%3;
+            int k = (i+2)%3;
+
+            double weight_ij = cotan[fi].v[k];
+            double weight_ik = cotan[fi].v[j];
+
+            if (!std::isfinite(weight_ij))
+                weight_ij = 1e-8;
+
+            if (!std::isfinite(weight_ik))
+                weight_ik = 1e-8;
+
+            Eigen::Vector2d target = weight_ij * (t[i] - t[j]) + weight_ik * (t[i] - t[k]);
+            problem.faceVertex[3 * fi + i] = (int) tri::Index(m, m.face[fi].cV(i));
+            problem.cornerTarget[6 * fi + 2 * i] = target.x();
+            problem.cornerTarget[6 * fi + 2 * i + 1] = target.y();
+        }
+        for (int k = 0; k < 4; ++k)
+            problem.frameInv[4 * fi + k] = frame_inv[k][fi];
+    }
+    problem.cornerPtr = pattern.cornerPtr;
+    problem.corners = pattern.corners;
+    problem.rowPtr.assign(As.outerIndexPtr(), As.outerIndexPtr() + vn + 1);
+    problem.colIdx.assign(As.innerIndexPtr(), As.innerIndexPtr() + As.nonZeros());
+    problem.values.assign(As.valuePtr(), As.valuePtr() + As.nonZeros());
+    problem.vertexTerm.assign(4 * vn, 0);
+    for (int vi = 0; vi < vn; ++vi) {
+        problem.vertexTerm[4 * vi] = bu_fixed(vi);
+        problem.vertexTerm[4 * vi + 1] = bv_fixed(vi);
+    }
+    for (unsigned i = 0; i < fixed_i.size(); ++i) {
+        problem.vertexTerm[4 * fixed_i[i]] = fixed_pos[i].X();
+        problem.vertexTerm[4 * fixed_i[i] + 1] = fixed_pos[i].Y();
+        problem.vertexTerm[4 * fixed_i[i] + 2] = 1;
+    }
+
+    std::vector<double> initialTexCoords(2 * vn);
+    for (int vi = 0; vi < vn; ++vi) {
+        initialTexCoords[2 * vi] = m.vert[vi].T().P().X();
+        initialTexCoords[2 * vi + 1] = m.vert[vi].T().P().Y();
+    }
+
+    if (!solver->Load(problem, initialTexCoords))
+        return false;
+
+    std::vector<double> texCoords;
+    auto SetTexCoords = [&](const std::vector<double>& tc) {
+        for (int vi = 0; vi < vn; ++vi)
+            m.vert[vi].T().P() = vcg::Point2d(tc[2 * vi], tc[2 * vi + 1]);
+        for (auto& f : m.face)
+            for (int i = 0; i < 3; ++i)
+                f.WT(i).P() = f.cV(i)->T().P();
+    };
+
+    // the systems of consecutive iterations differ only by the rotations, so the
+    // conjugate gradient starts from the current tex coords
+    const double tol = (solver_tol > 0) ? solver_tol : 1e-10;
+    const int maxSolverIterations = std::max(2 * vn, 100);
+
+    double e = solver->Rotations() / total_frame_area;
+    si.initialEnergy = e;
+    LOG_DEBUG << "ARAP: Starting energy is " << si.initialEnergy << " (GPU)";
+
+    bool converged = false;
+    int iter = 0;
+    while (!converged && iter < iterLimit) {
+        int solverIterations = 0;
+        bool solved = solver->GlobalStep(tol, maxSolverIterations, &solverIterations);
+        si.solverIterations += solverIterations;
+        if (!solved) {
+            LOG_DEBUG << "ARAP: GPU conjugate gradient did not converge";
+            SetTexCoords(initialTexCoords);
+            return false;
+        }
+
+        double e_curr = solver->Rotations() / total_frame_area;
+        if (!std::isfinite(e_curr)) {
+            SetTexCoords(initialTexCoords);
+            return false;
+        }
+        si.finalEnergy = e_curr;
+
+        if (e - e_curr < 1e-8) {
+            LOG_DEBUG << "ARAP: convergence reached (change in the energy value is too small)";
+            converged = true;
+        }
+        e = e_curr;
+
+        iter++;
+
+        if (!converged && iteration_callback) {
+            solver->ReadTexCoords(texCoords);
+            SetTexCoords(texCoords);
+            if (!iteration_callback(iter, iterLimit)) {
+                LOG_DEBUG << "ARAP: solve stopped by the iteration callback";
+                si.stopped = true;
+                break;
+            }
+        }
+    }
+
+    solver->ReadTexCoords(texCoords);
+    SetTexCoords(texCoords);
+
+    si.iterations = iter;
+    if (iter == iterLimit) {
         LOG_DEBUG << "ARAP: iteration limit reached";
     }
+    LOG_DEBUG << "ARAP: Energy after optimization is " << si.finalEnergy << " (" << iter << " iterations, "
+              << si.solverIterations << " conjugate gradient iterations on the GPU)";
 
-    LOG_DEBUG << "ARAP: Energy after optimization is " << CurrentEnergy() << " (" << iter << " iterations)";
+    return true;
+}
 
-    // Extra step to ensure the fixed vertices do not move at all
+/* Extra step to ensure the fixed vertices do not move at all */
+void ARAP::RestoreFixedVertices()
+{
     for (unsigned i = 0; i < fixed_i.size(); ++i) {
         m.vert[fixed_i[i]].T().P() = fixed_pos[i];
     }
@@ -449,15 +1552,15 @@ ARAPSolveInfo ARAP::Solve()
             f.WT(i).P() = f.cV(i)->T().P();
         }
     }
-
-    return si;
 }
 
 void ARAP::PrecomputeData()
 {
+    ComputeSystemPattern();
+
     local_frame_coords.resize(m.FN());
     auto tsa = GetTargetShapeAttribute(m);
-    #pragma omp parallel for
+    #pragma omp parallel for if (m.FN() >= ParallelMinFaces())
     for (int fi = 0; fi < m.FN(); ++fi) {
         auto& f = m.face[fi];
         Eigen::Vector2d x_10, x_20;
@@ -466,6 +1569,43 @@ void ARAP::PrecomputeData()
         local_frame_coords[fi][1] = x_10;
         local_frame_coords[fi][2] = x_20;
     }
+
+    for (int k = 0; k < 4; ++k) {
+        frame_inv[k].resize(m.FN());
+        uv_edges[k].resize(m.FN());
+    }
+    rot_cos.resize(m.FN());
+    rot_sin.resize(m.FN());
+    frame_area.resize(m.FN());
+
+    // the buffers are read by the parallel loops of every iteration
+    if (m.FN() >= ParallelMinFaces()) {
+        DistributeStatic(local_frame_coords);
+        for (int k = 0; k < 4; ++k) {
+            DistributeStatic(frame_inv[k]);
+            DistributeStatic(uv_edges[k]);
+        }
+        DistributeStatic(rot_cos);
+        DistributeStatic(rot_sin);
+        DistributeStatic(frame_area);
+    }
+
+    // inverse of the matrix whose columns are the edge vectors in the local frame
+    #pragma omp parallel for if (m.FN() >= ParallelMinFaces())
+    for (int fi = 0; fi < m.FN(); ++fi) {
+        const Eigen::Vector2d& x10 = local_frame_coords[fi][1];
+        const Eigen::Vector2d& x20 = local_frame_coords[fi][2];
+        double det = x10.x() * x20.y() - x20.x() * x10.y();
+        frame_inv[0][fi] =  x20.y() / det;
+        frame_inv[1][fi] = -x20.x() / det;
+        frame_inv[2][fi] = -x10.y() / det;
+        frame_inv[3][fi] =  x10.x() / det;
+        frame_area[fi] = 0.5 * std::abs(det);
+    }
+
+    total_frame_area = 0;
+    for (int fi = 0; fi < m.FN(); ++fi)
+        total_frame_area += frame_area[fi];
 }
 
 
@@ -26,15 +26,64 @@
 
 #include <Eigen/Core>
 #include <Eigen/Sparse>
+#include <Eigen/SparseCholesky>
 #include <vector>
 #include <array>
+#include <memory>
+#include <functional>
+#include <string>
+
+
+enum ARAPSolverBackend {
+    BICGSTAB_ILUT = 0, // preconditioned BiCGSTAB on the system with identity rows for the fixed vertices
+    SIMPLICIAL_LDLT,   // sparse LDLT of the symmetric system, factored once and reused by every iteration
+    SIMPLICIAL_LDLT_MIXED, // sparse LDLT of the symmetric system in single precision, with the solutions refined in double precision
+    CG_ICHOL,          // conjugate gradient with incomplete Cholesky preconditioning on the symmetric system
+    DENSE_LLT,         // dense Cholesky of the symmetric system, replaces the other symmetric backends on the shells below the dense threshold
+    GPU_JACOBI_CG      // local steps and Jacobi preconditioned conjugate gradient with compute shaders, replaces the other symmetric backends on the shells above the GPU threshold
+};
+
+/* Name of the backend, as accepted by the options that select it */
+const char *ARAPSolverBackendName(ARAPSolverBackend backend);
 
+/* Parses the name of a backend of the sparse solves (ldlt, ldlt-mixed, cg or
+ * bicgstab). The dense and GPU backends are selected by the size of the shells
+ * and are not accepted. Returns false if the name is not recognized */
+bool ParseARAPSolverBackend(const std::string& name, ARAPSolverBackend *backend);
 
 struct ARAPSolveInfo {
     double initialEnergy;
     double finalEnergy;
     int iterations;
     bool numericalError;
+    int solverIterations; // total number of iterations of the linear solver (0 for direct solvers)
+    ARAPSolverBackend backend; // backend that solved the system
+    bool stopped; // the iteration callback stopped the solve
+    bool fallback; // the requested backend (or the dense or GPU one selected for the size of the shell) failed
+};
+
+/* Called after each iteration of the solve with the number of iterations done
+ * and the iteration limit, the vertex tex coords hold the current solution.
+ * Returning false stops the solve */
+typedef std::function<bool(int iterations, int iterationLimit)> ARAPIterationCallback;
+
+/* Factorization of the symmetric ARAP system, can be shared by successive
+ * solves on shells with the same connectivity (such as the retry passes of the
+ * overlap-fixing loop, that only add fixed vertices). The fixed vertices are
+ * eliminated without changing the sparsity pattern, so the symbolic analysis
+ * is always reused, and the numeric factorization is reused if the matrix
+ * coefficients are also unchanged. */
+struct ARAPFactorizationCache {
+    Eigen::SimplicialLDLT<Eigen::SparseMatrix<double>> solver;
+    Eigen::SimplicialLDLT<Eigen::SparseMatrix<float>> solverf;
+    Eigen::MatrixXd denseInverse; // inverse of the matrix, from its dense Cholesky factorization
+    std::vector<int> outerIndex;
+    std::vector<int> innerIndex;
+    std::vector<double> values;
+    bool singlePrecision = false; // the factorization is stored in solverf
+    bool dense = false; // the factorization is stored in denseInverse
+    bool analyzed = false;
+    bool factorized = false;
 };
 
 class ARAP {
@@ -54,11 +103,67 @@ private:
 
     std::vector<std::array<Eigen::Vector2d, 3>> local_frame_coords;
 
+    /* Compressed row sparsity pattern of the system matrix. The corners of the
+     * faces (indexed as 3 * fi + i) are listed by incident vertex, and each
+     * corner stores the slots of the (i,i), (i,j) and (i,k) coefficients */
+    struct SystemPattern {
+        std::vector<int> rowPtr;
+        std::vector<int> colIdx;
+        std::vector<int> diagSlot;
+        std::vector<int> cornerPtr;
+        std::vector<int> corners;
+        std::vector<std::array<int, 3>> cornerSlot;
+    };
+
+    SystemPattern pattern;
+    std::vector<int> fixed_slot; // index in fixed_i of each vertex, -1 if the vertex is free
+    std::vector<Cot> cotan;
+
+    /* The cotangent weights, the sparsity pattern and the local frames only
+     * depend on the mesh and on its target shapes, so they are computed by the
+     * first Solve() and reused by the following ones (the fixed vertices can
+     * change between the solves) */
+    bool precomputed;
+    std::vector<Eigen::Vector2d> corner_rhs;
+
+    // per-face buffers of the local step (SoA layout)
+    std::vector<double> frame_inv[4];
+    std::vector<double> uv_edges[4];
+    std::vector<double> rot_cos;
+    std::vector<double> rot_sin;
+    std::vector<double> frame_area;
+    double total_frame_area;
+
     int max_iter;
+    double solver_tol;
 
+    ARAPSolverBackend backend;
+    std::shared_ptr<ARAPFactorizationCache> cache;
+
+    int multilevel_faces;
+    int multilevel_fine_iter;
+
+    int anderson_window;
+
+    int dense_faces;
+
+    int gpu_faces;
+
+    ARAPIterationCallback iteration_callback;
+
+    void ComputeSystemPattern();
+    void AssembleSystemValues(const std::vector<Cot>& cotan, std::vector<double>& values);
     void ComputeSystemMatrix(Mesh& m, const std::vector<Cot>& cotan, Eigen::SparseMatrix<double, Eigen::RowMajor>& L);
-    void ComputeRHS(Mesh& m, const std::vector<Eigen::Matrix2d>& rotations, const std::vector<Cot>& cotan, Eigen::VectorXd& bu, Eigen::VectorXd& bv);
+    void ComputeSymmetricSystemMatrix(Mesh& m, const std::vector<Cot>& cotan, Eigen::SparseMatrix<double>& L, Eigen::VectorXd& bu_fixed, Eigen::VectorXd& bv_fixed);
+    bool FactorizeSymmetricSystem(const Eigen::SparseMatrix<double>& L, bool singlePrecision);
+    bool FactorizeDenseSystem(const Eigen::SparseMatrix<double>& L);
+    bool SolveRefined(const Eigen::SparseMatrix<double>& L, const Eigen::VectorXd& b, Eigen::VectorXd& x);
+    double ComputeRotations();
+    void ComputeRHS(Mesh& m, const std::vector<Cot>& cotan, Eigen::VectorXd& bu, Eigen::VectorXd& bv);
     void PrecomputeData();
+    bool SolveCoarseLevel();
+    bool SolveGPU(ARAPSolveInfo& si, int iterLimit);
+    void RestoreFixedVertices();
 
 public:
 
@@ -70,11 +175,24 @@ public:
     int FixSelectedVertices();
     int FixRandomEdgeWithinTolerance(double tol);
     void SetMaxIterations(int n);
-
+    void SetSolverTolerance(double tol);
+    void SetSolverBackend(ARAPSolverBackend solverBackend);
+    void SetFactorizationCache(std::shared_ptr<ARAPFactorizationCache> factorizationCache);
+    void SetMultilevel(int minFaces, int fineIterations);
+    void SetAndersonAcceleration(int window);
+    void SetDenseThreshold(int maxFaces);
+    void SetGPUThreshold(int minFaces);
+    void SetIterationCallback(ARAPIterationCallback callback);
+
+    /* Can be called more than once, for example after fixing more vertices. The
+     * connectivity and the target shapes of the mesh must not change between
+     * the calls */
     ARAPSolveInfo Solve();
 
-    static double ComputeEnergyFromStoredWedgeTC(Mesh& m, double *num, double *denom);
-    static double ComputeEnergyFromStoredWedgeTC(const std::vector<Mesh::FacePointer>& fpVec, Mesh& m, double *num, double *denom);
+    /* The energy of the faces with respect to the stored wedge tex coords. If
+     * faceNum is not null it receives the contribution of each face to num */
+    static double ComputeEnergyFromStoredWedgeTC(Mesh& m, double *num, double *denom, std::vector<double> *faceNum = nullptr);
+    static double ComputeEnergyFromStoredWedgeTC(const std::vector<Mesh::FacePointer>& fpVec, Mesh& m, double *num, double *denom, std::vector<double> *faceNum = nullptr);
     static double ComputeEnergy(const vcg::Point2d& x10, const vcg::Point2d& x20,
                                 const vcg::Point2d& u10, const vcg::Point2d& u20,
                                 double *area);
@@ -0,0 +1,641 @@
+/*******************************************************************************
+    Copyright (c) 2021, Andrea Maggiordomo, Paolo Cignoni and Marco Tarini
+
+    This file is part of TextureDefrag, a reference implementation for
+    the paper ``Texture Defragmentation for Photo-Reconstructed 3D Models''
+    by Andrea Maggiordomo, Paolo Cignoni and Marco Tarini.
+
+    TextureDefrag is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    TextureDefrag is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with TextureDefrag. If not, see <https://www.gnu.org/licenses/>.
+*******************************************************************************/
+
+#include "async_io.h"
+#include "logging.h"
+
+#include <atomic>
+#include <cstring>
+#include <algorithm>
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define HAVE_IO_URING
+#endif
+#endif
+
+#ifdef __linux__
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#else
+#include <QFile>
+#include <QString>
+#endif
+
+#ifdef HAVE_IO_URING
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#ifndef __NR_io_uring_setup
+#define __NR_io_uring_setup 425
+#endif
+#ifndef __NR_io_uring_enter
+#define __NR_io_uring_enter 426
+#endif
+#ifndef __NR_io_uring_register
+#define __NR_io_uring_register 427
+#endif
+#endif
+
+
+// size of the requests, and of the buffers of the writers
+constexpr std::size_t CHUNK_BYTES = 1 << 20;
+
+// largest buffer that can be registered with io_uring
+constexpr uint64_t MAX_REGISTERED_BYTES = 1ull << 30;
+
+static std::atomic<int> ioDepth(0);
+
+#ifdef HAVE_IO_URING
+
+/* An io_uring instance used by a single thread at a time, with the submission and
+ * completion rings mapped as described in io_uring(7) */
+struct IoRing {
+
+    int fd = -1;
+    unsigned entries = 0;
+    unsigned tail = 0;              // next submission entry
+    unsigned pending = 0;           // entries filled and not submitted
+    unsigned inFlight = 0;          // requests not completed
+    bool registered = false;        // the buffers of the requests are registered
+
+    unsigned *sqHead = nullptr;
+    unsigned *sqTail = nullptr;
+    unsigned *sqMask = nullptr;
+    unsigned *sqArray = nullptr;
+    unsigned *cqHead = nullptr;
+    unsigned *cqTail = nullptr;
+    unsigned *cqMask = nullptr;
+    io_uring_sqe *sqes = nullptr;
+    io_uring_cqe *cqes = nullptr;
+
+    void *sqRing = MAP_FAILED;
+    void *cqRing = MAP_FAILED;
+    std::size_t sqRingBytes = 0;
+    std::size_t cqRingBytes = 0;
+    std::size_t sqesBytes = 0;
+
+    IoRing() = default;
+    IoRing(const IoRing&) = delete;
+    IoRing& operator=(const IoRing&) = delete;
+    ~IoRing();
+
+    bool Init(unsigned depth);
+    bool RegisterBuffers(const std::vector<iovec>& buffers);
+    io_uring_sqe *Next();
+    bool Submit(unsigned waitFor);
+    bool Pop(io_uring_cqe *cqe);
+    void Drain();
+};
+
+static bool TransferChunks(IoRing& ring, int fd, char *buffer, uint64_t size, bool write);
+static void QueueRequest(IoRing& ring, int fd, char *data, uint64_t offset, uint32_t bytes, bool write,
+                         unsigned bufferIndex, iovec *iov, uint64_t userData);
+
+#endif
+
+#ifdef __linux__
+static bool TransferFile(int fd, char *buffer, uint64_t size, bool write);
+static bool TransferBlocking(int fd, char *buffer, uint64_t size, uint64_t offset, bool write);
+#endif
+
+
+bool SetAsyncIODepth(int depth)
+{
+    ioDepth = 0;
+    if (depth <= 0)
+        return true;
+#ifdef HAVE_IO_URING
+    IoRing ring;
+    if (ring.Init(depth)) {
+        ioDepth = depth;
+        LOG_INFO << "Asynchronous I/O enabled (io_uring, " << ring.entries << " requests in flight)";
+        return true;
+    }
+    LOG_WARN << "io_uring is not available (" << std::strerror(errno) << "), the files are read and written with blocking calls";
+#else
+    LOG_WARN << "Asynchronous I/O is not supported on this system, the files are read and written with blocking calls";
+#endif
+    return false;
+}
+
+int AsyncIODepth()
+{
+    return ioDepth;
+}
+
+bool ReadFileData(const std::string& path, std::vector<char>& data)
+{
+#ifdef __linux__
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return false;
+    struct stat st;
+    bool ok = fstat(fd, &st) == 0;
+    if (ok) {
+        data.resize(st.st_size);
+        ok = TransferFile(fd, data.data(), data.size(), false);
+    }
+    close(fd);
+    return ok;
+#else
+    QFile file(QString::fromStdString(path));
+    if (!file.open(QIODevice::ReadOnly))
+        return false;
+    data.resize(file.size());
+    return file.read(data.data(), data.size()) == qint64(data.size());
+#endif
+}
+
+bool WriteFileData(const std::string& path, const void *data, std::size_t size)
+{
+#ifdef __linux__
+    int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+    if (fd < 0)
+        return false;
+    // the buffer is only read by the kernel
+    bool ok = TransferFile(fd, const_cast<char *>(static_cast<const char *>(data)), size, true);
+    return (close(fd) == 0) && ok;
+#else
+    QFile file(QString::fromStdString(path));
+    return file.open(QIODevice::WriteOnly) && file.write(static_cast<const char *>(data), size) == qint64(size);
+#endif
+}
+
+
+// -- AsyncFileWriter ----------------------------------------------------------
+
+struct AsyncFileWriter::State {
+    bool ok = true;
+    uint64_t offset = 0;                    // end of the data written or in flight
+    std::vector<std::vector<char>> chunks;  // the first is filled while the file fits in it
+    std::vector<unsigned> freeChunks;
+    int current = 0;                        // chunk being filled, -1 if none
+    std::size_t currentBytes = 0;
+#ifdef __linux__
+    int fd = -1;
+#ifdef HAVE_IO_URING
+    std::unique_ptr<IoRing> ring;           // created once the file exceeds a chunk
+    bool ringTried = false;
+    struct Request {
+        uint64_t offset;
+        uint32_t bytes;
+        uint32_t done;
+        iovec iov;
+    };
+    std::vector<Request> requests;          // by chunk
+#endif
+#else
+    QFile file;
+#endif
+
+    bool FlushChunk();
+    bool WriteChunk(unsigned chunk, std::size_t bytes);
+#ifdef HAVE_IO_URING
+    void StartRing();
+    void Complete(bool wait);
+#endif
+};
+
+AsyncFileWriter::AsyncFileWriter()
+    : state(new State)
+{
+    state->ok = false;  // until opened
+}
+
+AsyncFileWriter::~AsyncFileWriter()
+{
+    Close();
+}
+
+bool AsyncFileWriter::Open(const std::string& path)
+{
+    Close();
+    state.reset(new State);
+    state->chunks.emplace_back(CHUNK_BYTES);
+#ifdef __linux__
+    state->fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+    state->ok = state->fd >= 0;
+#else
+    state->file.setFileName(QString::fromStdString(path));
+    state->ok = state->file.open(QIODevice::WriteOnly);
+#endif
+    return state->ok;
+}
+
+bool AsyncFileWriter::Write(const void *data, std::size_t size)
+{
+    State& s = *state;
+    const char *p = static_cast<const char *>(data);
+    while (size > 0 && s.ok) {
+#ifdef HAVE_IO_URING
+        // the chunks are written in the background, wait for one to be free
+        while (s.current < 0 && s.ok) {
+            s.Complete(s.freeChunks.empty());
+            if (!s.freeChunks.empty()) {
+                s.current = s.freeChunks.back();
+                s.freeChunks.pop_back();
+            }
+        }
+        if (!s.ok)
+            break;
+#endif
+        std::size_t n = std::min(size, CHUNK_BYTES - s.currentBytes);
+        std::memcpy(s.chunks[s.current].data() + s.currentBytes, p, n);
+        s.currentBytes += n;
+        p += n;
+        size -= n;
+        if (s.currentBytes == CHUNK_BYTES)
+            s.FlushChunk();
+    }
+    return s.ok;
+}
+
+bool AsyncFileWriter::WriteAt(uint64_t offset, const void *data, std::size_t size)
+{
+    State& s = *state;
+    s.FlushChunk();
+#ifdef HAVE_IO_URING
+    while (s.ring && s.ring->inFlight > 0)
+        s.Complete(true);
+#endif
+#ifdef __linux__
+    s.ok = s.ok && TransferBlocking(s.fd, const_cast<char *>(static_cast<const char *>(data)), size, offset, true);
+#else
+    s.ok = s.ok && s.file.seek(offset) && s.file.write(static_cast<const char *>(data), size) == qint64(size) && s.file.seek(s.offset);
+#endif
+    return s.ok;
+}
+
+bool AsyncFileWriter::Close()
+{
+    State& s = *state;
+#ifdef __linux__
+    if (s.fd < 0)
+        return s.ok;
+    s.FlushChunk();
+#ifdef HAVE_IO_URING
+    while (s.ring && s.ring->inFlight > 0)
+        s.Complete(true);
+    s.ring.reset();
+#endif
+    s.ok = (close(s.fd) == 0) && s.ok;
+    s.fd = -1;
+#else
+    if (!s.file.isOpen())
+        return s.ok;
+    s.FlushChunk();
+    s.file.close();
+#endif
+    return s.ok;
+}
+
+/* Writes the data of the current chunk, in the background if the ring is in use */
+bool AsyncFileWriter::State::FlushChunk()
+{
+    if (current < 0 || currentBytes == 0 || !ok)
+        return ok;
+#ifdef HAVE_IO_URING
+    if (!ringTried)
+        StartRing();
+    if (ring) {
+        Request& r = requests[current];
+        r.offset = offset;
+        r.bytes = uint32_t(currentBytes);
+        r.done = 0;
+        QueueRequest(*ring, fd, chunks[current].data(), r.offset, r.bytes, true, current, &r.iov, current);
+        ok = ring->Submit(0);
+        offset += currentBytes;
+        current = -1;
+        currentBytes = 0;
+        return ok;
+    }
+#endif
+    ok = WriteChunk(current, currentBytes);
+    offset += currentBytes;
+    currentBytes = 0;
+    return ok;
+}
+
+bool AsyncFileWriter::State::WriteChunk(unsigned chunk, std::size_t bytes)
+{
+#ifdef __linux__
+    return TransferBlocking(fd, chunks[chunk].data(), bytes, offset, true);
+#else
+    return file.write(chunks[chunk].data(), bytes) == qint64(bytes);
+#endif
+}
+
+#ifdef HAVE_IO_URING
+
+/* Creates the ring and the other chunks once the file exceeds the first one, the
+ * chunks stay unregistered if the memory cannot be locked */
+void AsyncFileWriter::State::StartRing()
+{
+    ringTried = true;
+    const int depth = ioDepth;
+    if (depth <= 0)
+        return;
+    std::unique_ptr<IoRing> r(new IoRing);
+    if (!r->Init(depth))
+        return;
+    while (chunks.size() < r->entries)
+        chunks.emplace_back(CHUNK_BYTES);
+    std::vector<iovec> buffers(chunks.size());
+    for (unsigned i = 0; i < chunks.size(); ++i) {
+        buffers[i].iov_base = chunks[i].data();
+        buffers[i].iov_len = CHUNK_BYTES;
+        if (int(i) != current)
+            freeChunks.push_back(i);
+    }
+    r->RegisterBuffers(buffers);
+    requests.resize(chunks.size());
+    ring = std::move(r);
+}
+
+/* Handles the completed writes, waiting for one if wait is true. The chunks written
+ * in part are queued again with the rest of their data */
+void AsyncFileWriter::State::Complete(bool wait)
+{
+    if (wait && !ring->Submit(1)) {
+        ok = false;
+        ring->Drain();
+    }
+    io_uring_cqe cqe;
+    while (ring->Pop(&cqe)) {
+        const unsigned chunk = unsigned(cqe.user_data);
+        Request& r = requests[chunk];
+        if (cqe.res <= 0) {
+            ok = false;
+            freeChunks.push_back(chunk);
+        } else if (uint32_t(cqe.res) < r.bytes - r.done) {
+            r.done += cqe.res;
+            QueueRequest(*ring, fd, chunks[chunk].data() + r.done, r.offset + r.done, r.bytes - r.done, true, chunk, &r.iov, chunk);
+            ok = ring->Submit(0) && ok;
+        } else {
+            freeChunks.push_back(chunk);
+        }
+    }
+}
+
+#endif
+
+
+// -- static functions ---------------------------------------------------------
+
+#ifdef __linux__
+
+/* Reads or writes size bytes of the buffer at the start of the file, with the ring
+ * if the asynchronous I/O is enabled and the file exceeds a chunk */
+static bool TransferFile(int fd, char *buffer, uint64_t size, bool write)
+{
+#ifdef HAVE_IO_URING
+    const int depth = ioDepth;
+    if (depth > 0 && size > CHUNK_BYTES) {
+        IoRing ring;
+        if (ring.Init(depth)) {
+            // the requests go through the page cache of the kernel if the buffer
+            // cannot be registered (locked memory limit)
+            std::vector<iovec> buffers;
+            for (uint64_t offset = 0; offset < size; offset += MAX_REGISTERED_BYTES) {
+                iovec iov;
+                iov.iov_base = buffer + offset;
+                iov.iov_len = std::min(MAX_REGISTERED_BYTES, size - offset);
+                buffers.push_back(iov);
+            }
+            ring.RegisterBuffers(buffers);
+            return TransferChunks(ring, fd, buffer, size, write);
+        }
+    }
+#endif
+    return TransferBlocking(fd, buffer, size, 0, write);
+}
+
+static bool TransferBlocking(int fd, char *buffer, uint64_t size, uint64_t offset, bool write)
+{
+    for (uint64_t done = 0; done < size; ) {
+        const std::size_t n = std::min<uint64_t>(size - done, 1ull << 30);
+        ssize_t r = write ? pwrite(fd, buffer + done, n, offset + done) : pread(fd, buffer + done, n, offset + done);
+        if (r < 0 && errno == EINTR)
+            continue;
+        if (r <= 0)
+            return false;
+        done += r;
+    }
+    return true;
+}
+
+#endif
+
+#ifdef HAVE_IO_URING
+
+IoRing::~IoRing()
+{
+    Drain();
+    if (sqes != nullptr)
+        munmap(sqes, sqesBytes);
+    if (cqRing != MAP_FAILED && cqRing != sqRing)
+        munmap(cqRing, cqRingBytes);
+    if (sqRing != MAP_FAILED)
+        munmap(sqRing, sqRingBytes);
+    if (fd >= 0)
+        close(fd);
+}
+
+bool IoRing::Init(unsigned depth)
+{
+    io_uring_params p;
+    std::memset(&p, 0, sizeof(p));
+    fd = int(syscall(__NR_io_uring_setup, depth, &p));
+    if (fd < 0)
+        return false;
+    entries = p.sq_entries;
+
+    sqRingBytes = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    cqRingBytes = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+    bool singleMap = false;
+#ifdef IORING_FEAT_SINGLE_MMAP
+    singleMap = (p.features & IORING_FEAT_SINGLE_MMAP) != 0;
+#endif
+    if (singleMap)
+        sqRingBytes = cqRingBytes = std::max(sqRingBytes, cqRingBytes);
+
+    sqRing = mmap(nullptr, sqRingBytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if (sqRing == MAP_FAILED)
+        return false;
+    cqRing = singleMap ? sqRing : mmap(nullptr, cqRingBytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+    if (cqRing == MAP_FAILED)
+        return false;
+    sqesBytes = p.sq_entries * sizeof(io_uring_sqe);
+    void *sqesMap = mmap(nullptr, sqesBytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (sqesMap == MAP_FAILED)
+        return false;
+    sqes = static_cast<io_uring_sqe *>(sqesMap);
+
+    char *sq = static_cast<char *>(sqRing);
+    sqHead = reinterpret_cast<unsigned *>(sq + p.sq_off.head);
+    sqTail = reinterpret_cast<unsigned *>(sq + p.sq_off.tail);
+    sqMask = reinterpret_cast<unsigned *>(sq + p.sq_off.ring_mask);
+    sqArray = reinterpret_cast<unsigned *>(sq + p.sq_off.array);
+    char *cq = static_cast<char *>(cqRing);
+    cqHead = reinterpret_cast<unsigned *>(cq + p.cq_off.head);
+    cqTail = reinterpret_cast<unsigned *>(cq + p.cq_off.tail);
+    cqMask = reinterpret_cast<unsigned *>(cq + p.cq_off.ring_mask);
+    cqes = reinterpret_cast<io_uring_cqe *>(cq + p.cq_off.cqes);
+    tail = *sqTail;
+    return true;
+}
+
+bool IoRing::RegisterBuffers(const std::vector<iovec>& buffers)
+{
+    registered = !buffers.empty()
+            && syscall(__NR_io_uring_register, fd, IORING_REGISTER_BUFFERS, buffers.data(), unsigned(buffers.size())) == 0;
+    return registered;
+}
+
+/* Returns a cleared submission entry, null if the ring is full */
+io_uring_sqe *IoRing::Next()
+{
+    if (tail - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE) >= entries)
+        return nullptr;
+    const unsigned index = tail & *sqMask;
+    io_uring_sqe *sqe = &sqes[index];
+    std::memset(sqe, 0, sizeof(*sqe));
+    sqArray[index] = index;
+    tail++;
+    pending++;
+    inFlight++;
+    return sqe;
+}
+
+/* Submits the pending entries and waits for waitFor completions */
+bool IoRing::Submit(unsigned waitFor)
+{
+    __atomic_store_n(sqTail, tail, __ATOMIC_RELEASE);
+    do {
+        int r = int(syscall(__NR_io_uring_enter, fd, pending, waitFor, waitFor > 0 ? IORING_ENTER_GETEVENTS : 0, nullptr, 0));
+        if (r < 0 && errno == EINTR)
+            continue;
+        if (r < 0)
+            return false;
+        pending -= std::min(pending, unsigned(r));
+    } while (pending > 0);
+    return true;
+}
+
+bool IoRing::Pop(io_uring_cqe *cqe)
+{
+    const unsigned head = *cqHead;
+    if (head == __atomic_load_n(cqTail, __ATOMIC_ACQUIRE))
+        return false;
+    *cqe = cqes[head & *cqMask];
+    __atomic_store_n(cqHead, head + 1, __ATOMIC_RELEASE);
+    inFlight--;
+    return true;
+}
+
+/* Waits for the requests in flight, whose buffers are still in use by the kernel */
+void IoRing::Drain()
+{
+    io_uring_cqe cqe;
+    while (inFlight > 0 && fd >= 0 && Submit(1))
+        while (Pop(&cqe)) {}
+}
+
+/* Reads or writes the buffer at the start of the file in chunks, with up to the
+ * entries of the ring in flight */
+static bool TransferChunks(IoRing& ring, int fd, char *buffer, uint64_t size, bool write)
+{
+    struct Request {
+        uint64_t offset;
+        uint32_t bytes;
+        iovec iov;
+    };
+    std::vector<Request> requests(ring.entries);
+    std::vector<unsigned> freeRequests;
+    for (unsigned i = 0; i < ring.entries; ++i)
+        freeRequests.push_back(i);
+
+    bool ok = true;
+    uint64_t next = 0;
+    while (ok && (next < size || ring.inFlight > 0)) {
+        while (next < size && !freeRequests.empty()) {
+            const unsigned i = freeRequests.back();
+            freeRequests.pop_back();
+            requests[i].offset = next;
+            requests[i].bytes = uint32_t(std::min<uint64_t>(CHUNK_BYTES, size - next));
+            QueueRequest(ring, fd, buffer + next, next, requests[i].bytes, write, unsigned(next / MAX_REGISTERED_BYTES), &requests[i].iov, i);
+            next += requests[i].bytes;
+        }
+        if (!ring.Submit(1)) {
+            ok = false;
+            break;
+        }
+        io_uring_cqe cqe;
+        while (ring.Pop(&cqe)) {
+            const unsigned i = unsigned(cqe.user_data);
+            Request& r = requests[i];
+            if (cqe.res <= 0) {
+                ok = false;
+            } else if (uint32_t(cqe.res) < r.bytes) {
+                // short transfer, the rest is queued again
+                r.offset += cqe.res;
+                r.bytes -= cqe.res;
+                QueueRequest(ring, fd, buffer + r.offset, r.offset, r.bytes, write, unsigned(r.offset / MAX_REGISTERED_BYTES), &r.iov, i);
+            } else {
+                freeRequests.push_back(i);
+            }
+        }
+    }
+    // the buffer must outlive the requests in flight
+    ring.Drain();
+    return ok;
+}
+
+/* Fills a submission entry, the ring has room for it since each request is queued
+ * at most once at a time. Without registered buffers the iovec must stay valid until
+ * the request completes */
+static void QueueRequest(IoRing& ring, int fd, char *data, uint64_t offset, uint32_t bytes, bool write,
+                         unsigned bufferIndex, iovec *iov, uint64_t userData)
+{
+    io_uring_sqe *sqe = ring.Next();
+    sqe->fd = fd;
+    sqe->off = offset;
+    sqe->user_data = userData;
+    if (ring.registered) {
+        sqe->opcode = write ? IORING_OP_WRITE_FIXED : IORING_OP_READ_FIXED;
+        sqe->addr = reinterpret_cast<uintptr_t>(data);
+        sqe->len = bytes;
+        sqe->buf_index = uint16_t(bufferIndex);
+    } else {
+        iov->iov_base = data;
+        iov->iov_len = bytes;
+        sqe->opcode = write ? IORING_OP_WRITEV : IORING_OP_READV;
+        sqe->addr = reinterpret_cast<uintptr_t>(iov);
+        sqe->len = 1;
+    }
+}
+
+#endif
@@ -0,0 +1,87 @@
+/*******************************************************************************
+    Copyright (c) 2021, Andrea Maggiordomo, Paolo Cignoni and Marco Tarini
+
+    This file is part of TextureDefrag, a reference implementation for
+    the paper ``Texture Defragmentation for Photo-Reconstructed 3D Models''
+    by Andrea Maggiordomo, Paolo Cignoni and Marco Tarini.
+
+    TextureDefrag is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    TextureDefrag is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with TextureDefrag. If not, see <https://www.gnu.org/licenses/>.
+*******************************************************************************/
+
+#ifndef ASYNC_IO_H
+#define ASYNC_IO_H
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <cstddef>
+#include <cstdint>
+
+/* Reads and writes of large files with several requests in flight. With a queue
+ * depth greater than 0 (see SetAsyncIODepth) the files are transferred in chunks
+ * of 1 MB submitted to an io_uring instance (Linux 5.1 and later) with the buffers
+ * registered to the kernel, so that a single thread keeps a fast drive busy with
+ * few system calls. With depth 0 (the default), on the other systems and if the
+ * kernel does not allow io_uring (e.g. under a seccomp filter) the same functions
+ * use blocking calls */
+
+/* Sets the number of requests in flight of each transfer, 0 disables the
+ * asynchronous I/O. Returns false if io_uring is not available, the blocking
+ * calls are then used */
+bool SetAsyncIODepth(int depth);
+
+/* Returns the queue depth, 0 if the asynchronous I/O is not in use */
+int AsyncIODepth();
+
+/* Reads the whole file into data. Returns false on failure */
+bool ReadFileData(const std::string& path, std::vector<char>& data);
+
+/* Writes size bytes of data to the file, replacing it. Returns false on failure */
+bool WriteFileData(const std::string& path, const void *data, std::size_t size);
+
+/* Sequential writer of a file. The data is copied into chunk buffers, which are
+ * written in the background as they fill once the file exceeds a chunk. The
+ * writer can pass between threads, but its calls must not overlap */
+class AsyncFileWriter {
+
+public:
+
+    AsyncFileWriter();
+
+    /* Closes the file */
+    ~AsyncFileWriter();
+
+    AsyncFileWriter(const AsyncFileWriter&) = delete;
+    AsyncFileWriter& operator=(const AsyncFileWriter&) = delete;
+
+    /* Creates the file, or truncates it */
+    bool Open(const std::string& path);
+
+    /* Appends the data. Returns false if this or an earlier write failed */
+    bool Write(const void *data, std::size_t size);
+
+    /* Overwrites the data at offset, which must lie in the data already appended,
+     * once the writes in flight complete (used to rewrite the headers) */
+    bool WriteAt(uint64_t offset, const void *data, std::size_t size);
+
+    /* Writes the buffered data and closes the file. Returns false if a write failed */
+    bool Close();
+
+private:
+
+    struct State;
+    std::unique_ptr<State> state;
+};
+
+#endif // ASYNC_IO_H
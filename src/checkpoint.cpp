@@ -0,0 +1,650 @@
+/*******************************************************************************
+    Copyright (c) 2021, Andrea Maggiordomo, Paolo Cignoni and Marco Tarini
+
+    This file is part of TextureDefrag, a reference implementation for
+    the paper ``Texture Defragmentation for Photo-Reconstructed 3D Models''
+    by Andrea Maggiordomo, Paolo Cignoni and Marco Tarini.
+
+    TextureDefrag is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    TextureDefrag is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with TextureDefrag. If not, see <https://www.gnu.org/licenses/>.
+*******************************************************************************/
+
+
+#include "checkpoint.h"
+#include "seam_remover.h"
+#include "seams.h"
+#include "mesh.h"
+#include "mesh_graph.h"
+#include "mesh_attribute.h"
+#include "derived_data.h"
+#include "arap.h"
+#include "logging.h"
+#include "utils.h"
+#include "timer.h"
+#include "trace.h"
+
+#include <vector>
+#include <string>
+#include <cstring>
+#include <cstdint>
+#include <set>
+#include <type_traits>
+
+#include <QFile>
+#include <QSaveFile>
+
+
+static const uint64_t CHECKPOINT_MAGIC = 0x31504b4347464454ULL; // "TDFGCKP1"
+
+/* Must be incremented whenever the records or the serialized state change */
+static const uint64_t CHECKPOINT_VERSION = 4;
+
+struct CheckpointHeader {
+    uint64_t magic;
+    uint64_t version;
+    uint64_t vn;
+    uint64_t fn;
+    uint64_t en; // number of edges of the seam mesh
+    uint64_t vertexRecordSize;
+    uint64_t faceRecordSize;
+    double arapNum;
+    double arapDenom;
+    double inputUVBorderLength;
+    double currentUVBorderLength;
+};
+
+static const uint64_t MOVELOG_MAGIC = 0x31564f4d47464454ULL; // "TDFGMOV1"
+static const uint64_t MOVELOG_VERSION = 1;
+
+/* The header of the move log is followed by the moves, each one is the sequence
+ * of the fields of AcceptedMove with the lengths of the arrays */
+struct MoveLogHeader {
+    uint64_t magic;
+    uint64_t version;
+    uint64_t vn;
+    uint64_t fn;
+    uint64_t en;
+    uint64_t moves;
+};
+
+struct CheckpointVertex {
+    double t[2];
+};
+
+/* v and ffp are vertex and face indices */
+struct CheckpointFace {
+    double wt[3][2];
+    int32_t v[3];
+    int32_t ffp[3];
+    int8_t ffi[3];
+    uint8_t pad[5];
+};
+
+/* The variable length part of the checkpoint is a sequence of int32 and double
+ * values, each block is preceded by its length */
+struct CheckpointBuffer {
+    std::vector<char> data;
+
+    template <typename T>
+    void Put(const T& v)
+    {
+        static_assert(std::is_trivially_copyable<T>::value, "Put() requires trivially copyable values");
+        const char *p = reinterpret_cast<const char *>(&v);
+        data.insert(data.end(), p, p + sizeof(T));
+    }
+
+    void PutInt(long long v)
+    {
+        Put(int32_t(v));
+    }
+
+    void PutIntArray(const std::vector<int>& v)
+    {
+        PutInt(v.size());
+        for (int i : v)
+            PutInt(i);
+    }
+};
+
+/* bounds checked cursor over the checkpoint, reads past the end or invalid values
+ * clear the ok flag and return zero */
+struct CheckpointReader {
+    const char *p;
+    const char *end;
+    bool ok;
+
+    template <typename T>
+    T Get()
+    {
+        T v;
+        if (ok && std::size_t(end - p) >= sizeof(T)) {
+            std::memcpy(&v, p, sizeof(T));
+            p += sizeof(T);
+        } else {
+            ok = false;
+            std::memset(&v, 0, sizeof(T));
+        }
+        return v;
+    }
+
+    /* Reads an int in [0, bound) */
+    int GetIndex(int bound)
+    {
+        int32_t i = Get<int32_t>();
+        if (i < 0 || i >= bound) {
+            ok = false;
+            return 0;
+        }
+        return i;
+    }
+
+    /* Reads a block length, which cannot exceed the number of bytes left */
+    int GetCount()
+    {
+        int32_t n = Get<int32_t>();
+        if (n < 0 || std::size_t(n) > std::size_t(end - p)) {
+            ok = false;
+            return 0;
+        }
+        return n;
+    }
+};
+
+static std::vector<char> SerializeCheckpoint(GraphHandle graph, AlgoStateHandle state);
+static bool WriteCheckpointFile(const std::string& path, const std::vector<char>& data);
+
+
+// CheckpointWriter class implementation
+// =====================================
+
+CheckpointWriter::CheckpointWriter(const std::string& path_)
+    : path{path_}
+{
+}
+
+CheckpointWriter::~CheckpointWriter()
+{
+    Wait();
+}
+
+bool CheckpointWriter::Idle() const
+{
+    return !pending.valid() || pending.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+}
+
+void CheckpointWriter::Write(GraphHandle graph, AlgoStateHandle state)
+{
+    TRACE_SCOPE_CAT("Checkpoint", "checkpoint");
+    Timer t;
+    std::shared_ptr<std::vector<char>> data = std::make_shared<std::vector<char>>(SerializeCheckpoint(graph, state));
+    LOG_VERBOSE << "Serialized the checkpoint (" << data->size() / (1024 * 1024) << " MB) in " << t.TimeElapsed() << " seconds";
+
+    Wait();
+
+    std::string file = path;
+    pending = std::async(std::launch::async, [file, data]() {
+        TRACE_SCOPE_CAT("WriteCheckpoint", "checkpoint");
+        return WriteCheckpointFile(file, *data);
+    });
+}
+
+bool CheckpointWriter::Wait()
+{
+    if (!pending.valid())
+        return true;
+    bool ok = pending.get();
+    if (!ok)
+        LOG_WARN << "Unable to write the checkpoint " << path;
+    return ok;
+}
+
+
+// -- checkpoint loading -------------------------------------------------------
+
+AlgoStateHandle LoadCheckpoint(const std::string& path, GraphHandle graph)
+{
+    Mesh& m = graph->mesh;
+
+    QFile file(path.c_str());
+    if (!file.open(QIODevice::ReadOnly)) {
+        LOG_WARN << "Unable to open the checkpoint " << path;
+        return nullptr;
+    }
+
+    const qint64 size = file.size();
+    const char *data = (size > qint64(sizeof(CheckpointHeader))) ? reinterpret_cast<const char *>(file.map(0, size)) : nullptr;
+    if (data == nullptr) {
+        LOG_WARN << "Unable to read the checkpoint " << path;
+        return nullptr;
+    }
+
+    CheckpointReader reader = { data, data + size, true };
+    CheckpointHeader header = reader.Get<CheckpointHeader>();
+    if (header.magic != CHECKPOINT_MAGIC || header.version != CHECKPOINT_VERSION
+            || header.vertexRecordSize != sizeof(CheckpointVertex) || header.faceRecordSize != sizeof(CheckpointFace)) {
+        LOG_WARN << "Ignoring the incompatible checkpoint " << path;
+        return nullptr;
+    }
+
+    AlgoStateHandle state = std::make_shared<AlgoState>();
+
+    // the seam mesh depends only on the prepared input mesh, it is the same that
+    // InitializeState() built in the interrupted run
+    BuildSeamMesh(m, state->sm);
+    if (header.vn != m.vert.size() || header.fn != m.face.size() || header.en != state->sm.edge.size()
+            || std::size_t(reader.end - reader.p) < header.vn * sizeof(CheckpointVertex) + header.fn * sizeof(CheckpointFace)) {
+        LOG_WARN << "The checkpoint " << path << " does not match the input mesh";
+        return nullptr;
+    }
+
+    const int vn = m.vert.size();
+    const int fn = m.face.size();
+    const int en = state->sm.edge.size();
+    const int svn = state->sm.vert.size();
+
+    const char *vertexRecords = reader.p;
+    const char *faceRecords = reader.p + vn * sizeof(CheckpointVertex);
+    reader.p += vn * sizeof(CheckpointVertex) + fn * sizeof(CheckpointFace);
+
+    bool validFaces = true;
+    for (int i = 0; i < fn && validFaces; ++i) {
+        CheckpointFace r;
+        std::memcpy(&r, faceRecords + i * sizeof(CheckpointFace), sizeof(r));
+        for (int k = 0; k < 3; ++k)
+            validFaces = validFaces && r.v[k] >= 0 && r.v[k] < vn && r.ffp[k] >= 0 && r.ffp[k] < fn && r.ffi[k] >= 0 && r.ffi[k] < 3;
+    }
+    reader.ok = reader.ok && validFaces;
+
+    // charts, every face must belong to exactly one chart
+    struct ChartRecord {
+        RegionID id;
+        int numMerges;
+        std::vector<int> faces;
+    };
+    std::vector<ChartRecord> charts(reader.GetCount());
+    std::vector<RegionID> faceId(fn, INVALID_ID);
+    for (auto& cr : charts) {
+        cr.id = reader.Get<int32_t>();
+        cr.numMerges = reader.Get<int32_t>();
+        cr.faces.resize(reader.GetCount());
+        for (auto& fi : cr.faces) {
+            fi = reader.GetIndex(fn);
+            reader.ok = reader.ok && cr.id >= 0 && faceId[fi] == INVALID_ID;
+            faceId[fi] = cr.id;
+        }
+    }
+    for (int i = 0; i < fn && reader.ok; ++i)
+        reader.ok = (faceId[i] != INVALID_ID);
+
+    // seam clusters and their records
+    std::vector<ClusteredSeamHandle> clusters(reader.GetCount());
+    std::vector<ClusterId> clusterIds(clusters.size(), ClusterStore::NONE);
+    for (unsigned i = 0; i < clusters.size(); ++i) {
+        ClusteredSeamHandle& csh = clusters[i];
+        csh = ClusteredSeamHandle::Make(state->sm);
+        csh->seams.resize(reader.GetCount());
+        for (auto& sh : csh->seams) {
+            sh = SeamHandle::Make(state->sm);
+            sh->edges.resize(reader.GetCount());
+            for (auto& e : sh->edges)
+                e = reader.GetIndex(en);
+            sh->endpoints.resize(reader.GetCount());
+            for (auto& v : sh->endpoints)
+                v = reader.GetIndex(svn);
+            reader.ok = reader.ok && !sh->edges.empty();
+        }
+        reader.ok = reader.ok && !csh->seams.empty();
+
+        clusterIds[i] = state->clusters.Acquire(csh);
+        ClusterRecord& r = state->clusters[clusterIds[i]];
+        r.active = (reader.Get<int32_t>() != 0);
+        r.cost = reader.Get<double>();
+        r.penalty = reader.Get<double>();
+        r.status = CheckStatus(reader.GetIndex(CheckStatus::_END));
+        r.mvalue = CostInfo::MatchingValue(reader.GetIndex(CostInfo::_END));
+        r.transform.t.X() = reader.Get<double>();
+        r.transform.t.Y() = reader.Get<double>();
+        for (int k = 0; k < 4; ++k)
+            r.transform.matCoeff[k] = reader.Get<double>();
+        r.estimated = (reader.Get<int32_t>() != 0);
+    }
+    const int nc = clusters.size();
+
+    for (int n = reader.GetCount(); n > 0; --n) {
+        int i = reader.GetIndex(nc);
+        double priority = reader.Get<double>();
+        if (reader.ok) {
+            reader.ok = state->clusters[clusterIds[i]].active;
+            state->queue.push(std::make_pair(clusters[i], priority));
+        }
+    }
+    std::set<RegionID> chartIds;
+    for (const auto& cr : charts)
+        chartIds.insert(cr.id);
+    for (int n = reader.GetCount(); n > 0; --n) {
+        RegionID id = reader.Get<int32_t>();
+        reader.ok = reader.ok && chartIds.count(id) > 0;
+        for (int k = reader.GetCount(); k > 0; --k) {
+            int i = reader.GetIndex(nc);
+            if (reader.ok)
+                state->clusters.InsertChartCluster(id, clusterIds[i]);
+        }
+    }
+    for (int n = reader.GetCount(); n > 0; --n) {
+        int vi = reader.GetIndex(svn);
+        for (int k = reader.GetCount(); k > 0; --k) {
+            int i = reader.GetIndex(nc);
+            if (reader.ok)
+                state->clusters.InsertEndpointCluster(vi, clusterIds[i]);
+        }
+    }
+    for (int n = reader.GetCount(); n > 0; --n) {
+        std::set<RegionID>& s = state->failed[reader.Get<int32_t>()];
+        for (int k = reader.GetCount(); k > 0; --k)
+            s.insert(reader.Get<int32_t>());
+    }
+    std::vector<int> changed(reader.GetCount());
+    for (auto& fi : changed)
+        fi = reader.GetIndex(fn);
+
+    if (!reader.ok || reader.Get<uint64_t>() != CHECKPOINT_MAGIC || reader.p != reader.end) {
+        LOG_WARN << "Ignoring the corrupted checkpoint " << path;
+        return nullptr;
+    }
+
+    // the checkpoint is valid, restore the mesh
+    for (int i = 0; i < vn; ++i) {
+        CheckpointVertex r;
+        std::memcpy(&r, vertexRecords + i * sizeof(CheckpointVertex), sizeof(r));
+        m.vert[i].T().P() = vcg::Point2d(r.t[0], r.t[1]);
+    }
+    for (int i = 0; i < fn; ++i) {
+        CheckpointFace r;
+        std::memcpy(&r, faceRecords + i * sizeof(CheckpointFace), sizeof(r));
+        MeshFace& f = m.face[i];
+        for (int k = 0; k < 3; ++k) {
+            f.WT(k).P() = vcg::Point2d(r.wt[k][0], r.wt[k][1]);
+            f.V(k) = &m.vert[r.v[k]];
+            f.FFp(k) = &m.face[r.ffp[k]];
+            f.FFi(k) = r.ffi[k];
+        }
+        f.id = faceId[i];
+    }
+    InvalidateDerivedData(m, DERIVED_VERTEX_FACE | DERIVED_NORMALS);
+
+    // rebuild the charts with the face order of the interrupted run
+    graph->charts.clear();
+    for (const auto& cr : charts) {
+        ChartHandle chart = graph->GetChart_Insert(cr.id);
+        chart->numMerges = cr.numMerges;
+        for (int fi : cr.faces)
+            chart->AddFace(&m.face[fi]);
+    }
+    ComputeChartAdjacency(*graph);
+
+    state->uvIndex.Init(m);
+    state->changeSet.Bind(m.face);
+    for (int fi : changed)
+        state->changeSet.insert(&m.face[fi]);
+
+    // the per-face energies are recomputed, the totals are restored so that the
+    // energy of the atlas matches the interrupted run
+    ARAP::ComputeEnergyFromStoredWedgeTC(m, nullptr, nullptr, &state->faceArapNum);
+    state->arapNum = header.arapNum;
+    state->arapDenom = header.arapDenom;
+    state->inputUVBorderLength = header.inputUVBorderLength;
+    state->currentUVBorderLength = header.currentUVBorderLength;
+
+    LOG_INFO << "Resumed the optimization from " << path << " (" << graph->Count() << " charts, "
+             << state->queue.size() << " operations in the queue)";
+    return state;
+}
+
+
+// -- move log -----------------------------------------------------------------
+
+bool WriteMoveLog(const std::string& path, GraphHandle graph, ConstAlgoStateHandle state)
+{
+    MoveLogHeader header;
+    header.magic = MOVELOG_MAGIC;
+    header.version = MOVELOG_VERSION;
+    header.vn = graph->mesh.vert.size();
+    header.fn = graph->mesh.face.size();
+    header.en = state->sm.edge.size();
+    header.moves = state->acceptedMoves.size();
+
+    CheckpointBuffer buffer;
+    buffer.Put(header);
+    for (const AcceptedMove& move : state->acceptedMoves) {
+        buffer.PutIntArray(move.edges);
+        buffer.Put(move.transform.t.X());
+        buffer.Put(move.transform.t.Y());
+        for (int k = 0; k < 4; ++k)
+            buffer.Put(move.transform.matCoeff[k]);
+        buffer.Put(move.finalEnergy);
+        buffer.PutIntArray(move.faces);
+        for (const vcg::Point2d& tc : move.texcoords) {
+            buffer.Put(tc.X());
+            buffer.Put(tc.Y());
+        }
+    }
+
+    return WriteCheckpointFile(path, buffer.data);
+}
+
+bool LoadMoveLog(const std::string& path, GraphHandle graph, ConstAlgoStateHandle state, std::vector<AcceptedMove>& moves)
+{
+    moves.clear();
+
+    QFile file(path.c_str());
+    if (!file.open(QIODevice::ReadOnly)) {
+        LOG_WARN << "Unable to open the move log " << path;
+        return false;
+    }
+
+    const qint64 size = file.size();
+    const char *data = (size >= qint64(sizeof(MoveLogHeader))) ? reinterpret_cast<const char *>(file.map(0, size)) : nullptr;
+    if (data == nullptr) {
+        LOG_WARN << "Unable to read the move log " << path;
+        return false;
+    }
+
+    CheckpointReader reader = { data, data + size, true };
+    MoveLogHeader header = reader.Get<MoveLogHeader>();
+    if (header.magic != MOVELOG_MAGIC || header.version != MOVELOG_VERSION) {
+        LOG_WARN << "Ignoring the incompatible move log " << path;
+        return false;
+    }
+
+    const int fn = graph->mesh.face.size();
+    const int en = state->sm.edge.size();
+    if (header.vn != graph->mesh.vert.size() || header.fn != std::size_t(fn) || header.en != std::size_t(en)) {
+        LOG_WARN << "The move log " << path << " does not match the input mesh";
+        return false;
+    }
+
+    for (uint64_t i = 0; i < header.moves && reader.ok; ++i) {
+        AcceptedMove move;
+        move.edges.resize(reader.GetCount());
+        for (int& e : move.edges)
+            e = reader.GetIndex(en);
+        move.transform.t.X() = reader.Get<double>();
+        move.transform.t.Y() = reader.Get<double>();
+        for (int k = 0; k < 4; ++k)
+            move.transform.matCoeff[k] = reader.Get<double>();
+        move.finalEnergy = reader.Get<double>();
+        move.faces.resize(reader.GetCount());
+        for (int& fi : move.faces)
+            fi = reader.GetIndex(fn);
+        move.texcoords.resize(3 * move.faces.size());
+        for (vcg::Point2d& tc : move.texcoords) {
+            tc.X() = reader.Get<double>();
+            tc.Y() = reader.Get<double>();
+        }
+        if (move.edges.empty())
+            reader.ok = false;
+        moves.push_back(std::move(move));
+    }
+
+    if (!reader.ok || reader.p != reader.end) {
+        LOG_WARN << "The move log " << path << " is corrupted";
+        moves.clear();
+        return false;
+    }
+
+    return true;
+}
+
+
+// -- static functions ---------------------------------------------------------
+
+static std::vector<char> SerializeCheckpoint(GraphHandle graph, AlgoStateHandle state)
+{
+    Mesh& m = graph->mesh;
+
+    CheckpointHeader header;
+    std::memset(&header, 0, sizeof(header));
+    header.magic = CHECKPOINT_MAGIC;
+    header.version = CHECKPOINT_VERSION;
+    header.vn = m.vert.size();
+    header.fn = m.face.size();
+    header.en = state->sm.edge.size();
+    header.vertexRecordSize = sizeof(CheckpointVertex);
+    header.faceRecordSize = sizeof(CheckpointFace);
+    header.arapNum = state->arapNum;
+    header.arapDenom = state->arapDenom;
+    header.inputUVBorderLength = state->inputUVBorderLength;
+    header.currentUVBorderLength = state->currentUVBorderLength;
+
+    CheckpointBuffer buffer;
+    buffer.data.reserve(sizeof(header) + m.vert.size() * sizeof(CheckpointVertex) + m.face.size() * (sizeof(CheckpointFace) + 4));
+    buffer.Put(header);
+
+    for (const auto& v : m.vert) {
+        CheckpointVertex r;
+        r.t[0] = v.cT().U();
+        r.t[1] = v.cT().V();
+        buffer.Put(r);
+    }
+
+    for (auto& f : m.face) {
+        CheckpointFace r;
+        std::memset(&r, 0, sizeof(r));
+        for (int k = 0; k < 3; ++k) {
+            r.wt[k][0] = f.cWT(k).U();
+            r.wt[k][1] = f.cWT(k).V();
+            r.v[k] = tri::Index(m, f.cV(k));
+            r.ffp[k] = tri::Index(m, f.cFFp(k));
+            r.ffi[k] = f.cFFi(k);
+        }
+        buffer.Put(r);
+    }
+
+    buffer.PutInt(graph->Count());
+    for (const auto& entry : graph->charts) {
+        buffer.PutInt(entry.first);
+        buffer.PutInt(entry.second->numMerges);
+        buffer.PutInt(entry.second->FN());
+        for (auto fptr : entry.second->fpVec)
+            buffer.PutInt(tri::Index(m, fptr));
+    }
+
+    // the clusters are numbered in the order of the slots of their records
+    const ClusterStore& store = state->clusters;
+    std::vector<int> clusterIndex(store.Slots(), -1);
+    int nc = 0;
+    for (ClusterId cid = 0; cid < store.Slots(); ++cid)
+        if (store[cid].csh)
+            clusterIndex[cid] = nc++;
+
+    buffer.PutInt(nc);
+    for (ClusterId cid = 0; cid < store.Slots(); ++cid) {
+        const ClusterRecord& r = store[cid];
+        if (!r.csh)
+            continue;
+        buffer.PutInt(r.csh->seams.size());
+        for (const auto& sh : r.csh->seams) {
+            buffer.PutIntArray(sh->edges);
+            buffer.PutIntArray(sh->endpoints);
+        }
+        buffer.PutInt(r.active ? 1 : 0);
+        buffer.Put(r.cost);
+        buffer.Put(r.penalty);
+        buffer.PutInt(r.status);
+        buffer.PutInt(r.mvalue);
+        buffer.Put(r.transform.t.X());
+        buffer.Put(r.transform.t.Y());
+        for (int k = 0; k < 4; ++k)
+            buffer.Put(r.transform.matCoeff[k]);
+        buffer.PutInt(r.estimated ? 1 : 0);
+    }
+
+    buffer.PutInt(state->queue.size());
+    for (const auto& entry : state->queue) {
+        ClusterId cid = store.Find(entry.first);
+        ensure(cid != ClusterStore::NONE);
+        buffer.PutInt(clusterIndex[cid]);
+        buffer.Put(entry.second);
+    }
+
+    int nonEmptyCharts = 0;
+    for (RegionID id = 0; id < store.ChartSlots(); ++id)
+        nonEmptyCharts += store.ChartClusters(id).empty() ? 0 : 1;
+    buffer.PutInt(nonEmptyCharts);
+    for (RegionID id = 0; id < store.ChartSlots(); ++id) {
+        const std::vector<ClusterId>& members = store.ChartClusters(id);
+        if (members.empty())
+            continue;
+        buffer.PutInt(id);
+        buffer.PutInt(members.size());
+        for (ClusterId cid : members)
+            buffer.PutInt(clusterIndex[cid]);
+    }
+
+    int nonEmptyEndpoints = 0;
+    for (int vi = 0; vi < store.EndpointSlots(); ++vi)
+        nonEmptyEndpoints += store.EndpointClusters(vi).empty() ? 0 : 1;
+    buffer.PutInt(nonEmptyEndpoints);
+    for (int vi = 0; vi < store.EndpointSlots(); ++vi) {
+        const std::vector<ClusterId>& members = store.EndpointClusters(vi);
+        if (members.empty())
+            continue;
+        buffer.PutInt(vi);
+        buffer.PutInt(members.size());
+        for (ClusterId cid : members)
+            buffer.PutInt(clusterIndex[cid]);
+    }
+    buffer.PutInt(state->failed.size());
+    for (const auto& entry : state->failed) {
+        buffer.PutInt(entry.first);
+        buffer.PutInt(entry.second.size());
+        for (RegionID id : entry.second)
+            buffer.PutInt(id);
+    }
+    buffer.PutInt(state->changeSet.size());
+    for (auto fptr : state->changeSet)
+        buffer.PutInt(tri::Index(m, fptr));
+
+    buffer.Put(CHECKPOINT_MAGIC);
+    return std::move(buffer.data);
+}
+
+static bool WriteCheckpointFile(const std::string& path, const std::vector<char>& data)
+{
+    // the checkpoint replaces the previous one only once it is completely written
+    QSaveFile file(path.c_str());
+    if (!file.open(QIODevice::WriteOnly))
+        return false;
+    bool ok = file.write(data.data(), data.size()) == qint64(data.size());
+    return ok && file.commit();
+}
@@ -0,0 +1,87 @@
+/*******************************************************************************
+    Copyright (c) 2021, Andrea Maggiordomo, Paolo Cignoni and Marco Tarini
+
+    This file is part of TextureDefrag, a reference implementation for
+    the paper ``Texture Defragmentation for Photo-Reconstructed 3D Models''
+    by Andrea Maggiordomo, Paolo Cignoni and Marco Tarini.
+
+    TextureDefrag is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    TextureDefrag is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with TextureDefrag. If not, see <https://www.gnu.org/licenses/>.
+*******************************************************************************/
+
+
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include "types.h"
+
+#include <string>
+#include <vector>
+#include <future>
+
+/* Checkpoints of the greedy optimization, so that an interrupted run can resume
+ * from the last checkpoint instead of starting over. A checkpoint stores the
+ * texture coordinates and the face-vertex and FF topology of the mesh (which are
+ * changed by the merges), the charts and the seam clusters with the queue and the
+ * records of the AlgoState that reference them. The seam mesh and the spatial index
+ * are not stored, they are rebuilt on resume from the prepared input mesh, which
+ * must therefore be the same as in the interrupted run. */
+
+/* Writes checkpoints in the background. The state is serialized in memory by the
+ * calling thread, and the buffer is written to disk asynchronously */
+class CheckpointWriter {
+
+public:
+
+    explicit CheckpointWriter(const std::string& path);
+
+    /* Waits for the pending write */
+    ~CheckpointWriter();
+
+    CheckpointWriter(const CheckpointWriter&) = delete;
+    CheckpointWriter& operator=(const CheckpointWriter&) = delete;
+
+    /* Returns true if no write is in progress */
+    bool Idle() const;
+
+    /* Serializes the mesh, the graph and the state and starts writing them. If the
+     * previous checkpoint is still being written it waits for it to complete */
+    void Write(GraphHandle graph, AlgoStateHandle state);
+
+    /* Waits for the pending write, returns false if it failed */
+    bool Wait();
+
+private:
+
+    std::string path;
+    std::future<bool> pending;
+};
+
+/* Restores the checkpoint into the graph built from the prepared input mesh (after
+ * ReorientCharts()) and returns the state of the greedy optimization at the time
+ * of the checkpoint. Returns nullptr, leaving the mesh and the graph untouched, if
+ * the checkpoint cannot be read or does not match the mesh */
+AlgoStateHandle LoadCheckpoint(const std::string& path, GraphHandle graph);
+
+struct AcceptedMove;
+
+/* Writes the moves accepted by the greedy optimization (AlgoState::acceptedMoves)
+ * to the move log, which can be replayed by ReplayOptimization() to repeat the
+ * optimization of the same mesh without evaluating the moves again */
+bool WriteMoveLog(const std::string& path, GraphHandle graph, ConstAlgoStateHandle state);
+
+/* Reads the move log, returns false if it cannot be read or was not recorded on
+ * the mesh of the graph */
+bool LoadMoveLog(const std::string& path, GraphHandle graph, ConstAlgoStateHandle state, std::vector<AcceptedMove>& moves);
+
+#endif // CHECKPOINT_H
@@ -0,0 +1,83 @@
+/*******************************************************************************
+    Copyright (c) 2021, Andrea Maggiordomo, Paolo Cignoni and Marco Tarini
+
+    This file is part of TextureDefrag, a reference implementation for
+    the paper ``Texture Defragmentation for Photo-Reconstructed 3D Models''
+    by Andrea Maggiordomo, Paolo Cignoni and Marco Tarini.
+
+    TextureDefrag is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    TextureDefrag is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with TextureDefrag. If not, see <https://www.gnu.org/licenses/>.
+*******************************************************************************/
+
+
+#include "cpu_features.h"
+
+
+static SimdLevel Detect()
+{
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f"))
+        return SIMD_AVX512;
+    if (__builtin_cpu_supports("avx2"))
+        return SIMD_AVX2;
+    if (__builtin_cpu_supports("sse4.2"))
+        return SIMD_SSE42;
+    return SIMD_GENERIC;
+#elif defined(__aarch64__) || defined(__ARM_NEON)
+    return SIMD_NEON;
+#else
+    return SIMD_GENERIC;
+#endif
+}
+
+SimdLevel DetectSimdLevel()
+{
+    static const SimdLevel level = Detect();
+    return level;
+}
+
+SimdLevel CompiledSimdLevel()
+{
+#if defined(__AVX512F__)
+    return SIMD_AVX512;
+#elif defined(__AVX2__)
+    return SIMD_AVX2;
+#elif defined(__SSE4_2__)
+    return SIMD_SSE42;
+#elif defined(__ARM_NEON)
+    return SIMD_NEON;
+#else
+    return SIMD_GENERIC;
+#endif
+}
+
+SimdLevel KernelSimdLevel()
+{
+    // the clones cover all the x86-64 levels, so the loader picks the detected one
+    if (SIMD_DISPATCH_ENABLED)
+        return DetectSimdLevel();
+    else
+        return CompiledSimdLevel();
+}
+
+const char *SimdLevelName(SimdLevel level)
+{
+    switch (level) {
+    case SIMD_SSE42:  return "SSE4.2";
+    case SIMD_AVX2:   return "AVX2";
+    case SIMD_AVX512: return "AVX-512";
+    case SIMD_NEON:   return "NEON";
+    default:          return "generic";
+    }
+}
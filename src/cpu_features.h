@@ -0,0 +1,61 @@
+/*******************************************************************************
+    Copyright (c) 2021, Andrea Maggiordomo, Paolo Cignoni and Marco Tarini
+
+    This file is part of TextureDefrag, a reference implementation for
+    the paper ``Texture Defragmentation for Photo-Reconstructed 3D Models''
+    by Andrea Maggiordomo, Paolo Cignoni and Marco Tarini.
+
+    TextureDefrag is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    TextureDefrag is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with TextureDefrag. If not, see <https://www.gnu.org/licenses/>.
+*******************************************************************************/
+
+
+#ifndef CPU_FEATURES_H
+#define CPU_FEATURES_H
+
+/* SIMD instruction sets of the kernels. By default the code is compiled with
+ * -march=native, and the kernels use the instruction set of the build machine.
+ * Portable builds (qmake CPU_DISPATCH=1) target the baseline of the
+ * architecture, and the kernels marked with SIMD_DISPATCH are compiled for
+ * each of the x86-64 levels below, the version to run is selected by the
+ * dynamic loader at startup (on ARM64 NEON is part of the baseline) */
+
+enum SimdLevel {
+    SIMD_GENERIC = 0,
+    SIMD_SSE42,
+    SIMD_AVX2,
+    SIMD_AVX512,
+    SIMD_NEON
+};
+
+#if defined(CPU_DISPATCH) && defined(__GNUC__) && defined(__x86_64__) && defined(__linux__)
+#define SIMD_DISPATCH __attribute__((target_clones("avx512f", "avx2", "sse4.2", "default")))
+#define SIMD_DISPATCH_ENABLED 1
+#else
+#define SIMD_DISPATCH
+#define SIMD_DISPATCH_ENABLED 0
+#endif
+
+/* Highest instruction set supported by the CPU, detected once */
+SimdLevel DetectSimdLevel();
+
+/* Instruction set enabled at compile time */
+SimdLevel CompiledSimdLevel();
+
+/* Instruction set used by the kernels, the detected one with runtime dispatch
+ * and the compiled one otherwise */
+SimdLevel KernelSimdLevel();
+
+const char *SimdLevelName(SimdLevel level);
+
+#endif // CPU_FEATURES_H
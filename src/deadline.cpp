@@ -0,0 +1,95 @@
+/*******************************************************************************
+    Copyright (c) 2021, Andrea Maggiordomo, Paolo Cignoni and Marco Tarini
+
+    This file is part of TextureDefrag, a reference implementation for
+    the paper ``Texture Defragmentation for Photo-Reconstructed 3D Models''
+    by Andrea Maggiordomo, Paolo Cignoni and Marco Tarini.
+
+    TextureDefrag is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    TextureDefrag is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with TextureDefrag. If not, see <https://www.gnu.org/licenses/>.
+*******************************************************************************/
+
+
+#include "deadline.h"
+#include "logging.h"
+#include "run_report.h"
+
+#include <algorithm>
+
+
+// per-unit costs of the phases that follow the greedy optimization, on the slow
+// side of what a desktop machine achieves
+static const double finalizeSecondsPerMegaFace = 4.0;
+static const double packSecondsPerChart        = 0.01;
+static const double renderSecondsPerMegaPixel  = 0.5;
+static const double saveSecondsPerMegaFace     = 3.0;
+
+// margin applied to the estimates
+static const double safetyFactor = 1.5;
+
+// the optimization always gets a token time limit, a zero limit would disable it
+static const double minimumOptimizationTime = 0.001;
+
+PhaseBudget ComputePhaseBudget(double deadline, double elapsed, int charts, int faces, double outputMP)
+{
+    PhaseBudget budget;
+    budget.deadline = deadline;
+    budget.elapsed = elapsed;
+
+    double megaFaces = faces / 1000000.0;
+    budget.finalize = safetyFactor * finalizeSecondsPerMegaFace * megaFaces;
+    budget.pack = safetyFactor * packSecondsPerChart * charts;
+    budget.render = safetyFactor * (renderSecondsPerMegaPixel * outputMP + saveSecondsPerMegaFace * megaFaces);
+
+    budget.optimize = deadline - elapsed - budget.finalize - budget.pack - budget.render;
+    if (budget.optimize < minimumOptimizationTime) {
+        LOG_WARN << "The deadline of " << deadline << " seconds leaves no time to the greedy optimization";
+        budget.optimize = minimumOptimizationTime;
+    }
+
+    return budget;
+}
+
+double BudgetTimeLimit(const PhaseBudget& budget, double timelimit)
+{
+    if (budget.deadline <= 0)
+        return timelimit;
+    return (timelimit > 0) ? std::min(timelimit, budget.optimize) : budget.optimize;
+}
+
+void ReportPhaseBudget(const PhaseBudget& budget)
+{
+    LOG_INFO << "Deadline of " << budget.deadline << " seconds, " << budget.elapsed << " elapsed, budgets:"
+             << " optimization " << budget.optimize
+             << ", finalization " << budget.finalize
+             << ", packing " << budget.pack
+             << ", rendering " << budget.render;
+
+    ReportValue("deadline", "deadline_s", budget.deadline);
+    ReportValue("deadline", "elapsed_s", budget.elapsed);
+    ReportValue("deadline", "optimize_s", budget.optimize);
+    ReportValue("deadline", "finalize_s", budget.finalize);
+    ReportValue("deadline", "pack_s", budget.pack);
+    ReportValue("deadline", "render_s", budget.render);
+}
+
+void ReportDeadline(const PhaseBudget& budget, double total)
+{
+    if (total > budget.deadline)
+        LOG_WARN << "The deadline of " << budget.deadline << " seconds was missed by " << (total - budget.deadline) << " seconds";
+    else
+        LOG_INFO << "Completed " << (budget.deadline - total) << " seconds before the deadline";
+
+    ReportValue("deadline", "total_s", total);
+    ReportValue("deadline", "met", (total <= budget.deadline) ? 1.0 : 0.0);
+}
@@ -0,0 +1,53 @@
+/*******************************************************************************
+    Copyright (c) 2021, Andrea Maggiordomo, Paolo Cignoni and Marco Tarini
+
+    This file is part of TextureDefrag, a reference implementation for
+    the paper ``Texture Defragmentation for Photo-Reconstructed 3D Models''
+    by Andrea Maggiordomo, Paolo Cignoni and Marco Tarini.
+
+    TextureDefrag is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    TextureDefrag is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with TextureDefrag. If not, see <https://www.gnu.org/licenses/>.
+*******************************************************************************/
+
+
+#ifndef DEADLINE_H
+#define DEADLINE_H
+
+/* Split of a wall-clock deadline of the whole run among the phases of the pipeline.
+ * Packing and rendering cannot be interrupted, so their time is estimated from the
+ * size of the atlas and reserved first, the greedy optimization gets what is left
+ * as its time limit. The per-unit costs of the estimates are meant to be pessimistic */
+struct PhaseBudget {
+    double deadline = 0;  // seconds available to the whole run, 0 if there is no deadline
+    double elapsed = 0;   // seconds spent before the greedy optimization
+    double optimize = 0;  // time limit of the greedy optimization
+    double finalize = 0;  // estimated time of the finalization and chart rotation
+    double pack = 0;      // estimated time of the packing, texture trimming and chart shifting
+    double render = 0;    // estimated time of the texture rendering and of the saving of the output
+};
+
+/* Splits the time left before the deadline, the estimates scale with the number of
+ * charts and faces of the atlas and with the megapixels of the output textures */
+PhaseBudget ComputePhaseBudget(double deadline, double elapsed, int charts, int faces, double outputMP);
+
+/* Returns the time limit of the greedy optimization, the budgeted one or the
+ * requested timelimit (0 if unlimited) if it is shorter */
+double BudgetTimeLimit(const PhaseBudget& budget, double timelimit);
+
+/* Logs the budgets of the phases and adds them to the run report */
+void ReportPhaseBudget(const PhaseBudget& budget);
+
+/* Logs whether a run that took total seconds met the deadline and reports it */
+void ReportDeadline(const PhaseBudget& budget, double total);
+
+#endif // DEADLINE_H
@@ -0,0 +1,339 @@
+/*******************************************************************************
+    Copyright (c) 2021, Andrea Maggiordomo, Paolo Cignoni and Marco Tarini
+
+    This file is part of TextureDefrag, a reference implementation for
+    the paper ``Texture Defragmentation for Photo-Reconstructed 3D Models''
+    by Andrea Maggiordomo, Paolo Cignoni and Marco Tarini.
+
+    TextureDefrag is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    TextureDefrag is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with TextureDefrag. If not, see <https://www.gnu.org/licenses/>.
+*******************************************************************************/
+
+
+
+#include "defrag.h"
+
+#include "mesh.h"
+#include "mesh_graph.h"
+#include "mesh_attribute.h"
+#include "seam_remover.h"
+#include "texture_object.h"
+#include "texture_optimization.h"
+#include "texture_rendering.h"
+#include "packing.h"
+#include "logging.h"
+#include "utils.h"
+#include "timer.h"
+#include "deadline.h"
+
+#include <vcg/complex/algorithms/update/topology.h>
+
+#include <map>
+#include <memory>
+#include <cstring>
+
+#include <QImage>
+#include <QOpenGLContext>
+
+
+namespace defrag {
+
+static bool ValidInput(const MeshView& view, const TextureSources& textures);
+static TextureObjectHandle CreateTextureObject(const TextureSources& textures);
+static void BuildMesh(const MeshView& view, Mesh& m);
+static void ExtractResult(Mesh& m, Result *result);
+
+bool Defragment(const MeshView& mesh, const TextureSources& textures, const Options& options, Result *result)
+{
+    ensure(result != nullptr);
+    *result = Result();
+
+    if (!ValidInput(mesh, textures))
+        return false;
+
+    Timer wall;
+
+    AlgoParameters ap;
+    ap.matchingThreshold = options.matchingThreshold;
+    ap.coincidentSeamTolerance = options.coincidentSeamTolerance;
+    ap.reduce = options.reduceSeams;
+    ap.reduceBisection = options.reduceSeamsBisection;
+    ap.boundaryTolerance = options.boundaryTolerance;
+    ap.distortionTolerance = options.distortionTolerance;
+    ap.arapSolverTolerance = options.arapSolverTolerance;
+    ap.arapAndersonWindow = options.arapAndersonWindow;
+    ap.arapEarlyStopMargin = options.arapEarlyStopMargin;
+    ap.scaffoldWidth = options.scaffoldWidth;
+    if (!ParseARAPSolverBackend(options.arapSolver, &ap.arapSolver)) {
+        LOG_ERR << "Unrecognized ARAP solver " << options.arapSolver;
+        return false;
+    }
+    ap.globalDistortionThreshold = options.globalDistortionThreshold;
+    ap.UVBorderLengthReduction = options.UVBorderLengthReduction;
+    ap.offsetFactor = options.offsetFactor;
+    ap.timelimit = options.timelimit;
+    ap.rotationNum = options.rotationNum;
+    ap.mergeBatchSize = options.mergeBatchSize;
+    ap.lazyCostFactor = options.lazyCostFactor;
+    ap.rasterOverlapFaces = options.rasterOverlapFaces;
+    ap.rasterOverlapResolution = options.rasterOverlapResolution;
+    ap.partitions = options.partitions;
+    ap.parallelPacking = options.parallelPacking;
+    ap.hierarchicalPacking = options.hierarchicalPacking;
+    ap.gpuPacking = options.gpuPacking;
+    ap.deterministic = options.deterministic;
+    ap.greedyThreads = options.greedyThreads;
+    ap.arapThreads = options.arapThreads;
+    ap.packingThreads = options.packingThreads;
+    ap.packingLayoutFile = options.packingLayoutFile;
+    ap.tileSize = options.tileSize;
+
+    // mesh preparation, as done by the tool on a loaded mesh
+
+    TextureObjectHandle textureObject = CreateTextureObject(textures);
+    textureObject->SetCacheBudgetGB(options.textureCacheGB);
+
+    Mesh m;
+    BuildMesh(mesh, m);
+    LOG_INFO << "Defragmenting mesh (VN " << m.VN() << ", FN " << m.FN() << ", " << textures.size() << " textures)";
+
+    ScaleTextureCoordinatesToImage(m, textureObject);
+
+    int vndup;
+    PrepareMesh(m, &vndup);
+    ComputeWedgeTexCoordStorageAttribute(m);
+
+    GraphHandle graph = ComputeGraph(m, textureObject);
+
+    // optimization
+
+    ChartOrientation orientation;
+    ReorientCharts(graph, &orientation);
+    std::map<RegionID, bool> flipped = std::move(orientation.flipped);
+
+    result->inputCharts = graph->Count();
+
+    AlgoStateHandle state = InitializeState(graph, ap, &orientation);
+    orientation = ChartOrientation();
+    PhaseBudget budget;
+    if (options.deadline > 0) {
+        budget = ComputePhaseBudget(options.deadline, wall.TimeElapsed(), graph->Count(), m.FN(), textureObject->GetResolutionInMegaPixels());
+        ap.timelimit = BudgetTimeLimit(budget, options.timelimit);
+        ReportPhaseBudget(budget);
+    }
+    GreedyOptimization(graph, state, ap);
+
+    Finalize(graph, m.name, &vndup);
+
+    std::map<ChartHandle, int> anchorMap;
+    RotateChartsForResampling(graph, state->changeSet, flipped, false, anchorMap);
+    state.reset();
+
+    result->outputCharts = graph->Count();
+
+    // packing, the zero-area charts are discarded
+
+    SetRasterizerCacheAutoSize(options.packingCacheGB < 0 ? RASTERIZER_CACHE_FREE_MEMORY_FRACTION : 0);
+    if (options.packingCacheGB >= 0)
+        SetRasterizerCacheMaxBytes(options.packingCacheGB == 0 ? 0 : static_cast<std::size_t>(options.packingCacheGB * 1024.0 * 1024.0 * 1024.0));
+
+    std::vector<ChartHandle> chartsToPack;
+    for (auto& entry : graph->charts) {
+        if (entry.second->AreaUV() != 0) {
+            chartsToPack.push_back(entry.second);
+        } else {
+            for (auto fptr : entry.second->fpVec) {
+                for (int j = 0; j < fptr->VN(); ++j) {
+                    fptr->V(j)->T().P() = Point2d::Zero();
+                    fptr->V(j)->T().N() = 0;
+                    fptr->WT(j).P() = Point2d::Zero();
+                    fptr->WT(j).N() = 0;
+                }
+            }
+        }
+    }
+
+    std::vector<TextureSize> texszVec;
+    int npacked = Pack(chartsToPack, textureObject, texszVec, ap, anchorMap);
+    if (npacked < (int) chartsToPack.size()) {
+        LOG_ERR << "Not all charts were packed (" << chartsToPack.size() << " charts, " << npacked << " packed)";
+        return false;
+    }
+
+    FaceBuckets faceBuckets;
+    BucketFaces(m, faceBuckets);
+    TrimTexture(faceBuckets, texszVec, false);
+    IntegerShift(m, chartsToPack, texszVec, anchorMap, flipped);
+
+    chartsToPack.clear();
+    anchorMap.clear();
+    graph.reset();
+
+    // rendering
+
+    result->sheets.resize(texszVec.size());
+    for (unsigned i = 0; i < texszVec.size(); ++i) {
+        result->sheets[i].width = texszVec[i].w;
+        result->sheets[i].height = texszVec[i].h;
+    }
+
+    if (options.renderTextures) {
+        TextureSaveParameters renderParams;
+        renderParams.renderContexts = options.renderContexts;
+        renderParams.renderThreads = options.renderThreads;
+        renderParams.scratchDirectory = options.scratchDirectory;
+        renderParams.maxInputMipLevel = options.maxInputMipLevel;
+        renderParams.softwareRendering = options.softwareRendering || QOpenGLContext::currentContext() == nullptr;
+        std::vector<std::shared_ptr<QImage>> images = RenderTextures(m, textureObject, texszVec, false, RenderMode::Linear, renderParams, false, &faceBuckets);
+        for (unsigned i = 0; i < images.size(); ++i) {
+            if (!images[i])
+                continue;
+            QImage img = images[i]->convertToFormat(QImage::Format_RGBA8888);
+            images[i].reset();
+            Sheet& sheet = result->sheets[i];
+            const std::size_t rowBytes = std::size_t(img.width()) * 4;
+            sheet.pixels.resize(rowBytes * img.height());
+            for (int y = 0; y < img.height(); ++y)
+                std::memcpy(sheet.pixels.data() + y * rowBytes, img.constScanLine(y), rowBytes);
+        }
+    }
+    textureObject.reset();
+
+    ExtractResult(m, result);
+
+    if (options.deadline > 0)
+        ReportDeadline(budget, wall.TimeElapsed());
+
+    return true;
+}
+
+// -- static functions ---------------------------------------------------------
+
+static bool ValidInput(const MeshView& view, const TextureSources& textures)
+{
+    if (view.positions == nullptr || view.indices == nullptr || view.uvs == nullptr
+            || view.numVertices <= 0 || view.numFaces <= 0 || view.numUVs <= 0) {
+        LOG_ERR << "The mesh has no vertices, faces or texture coordinates";
+        return false;
+    }
+    if (textures.empty()) {
+        LOG_ERR << "The mesh has no textures";
+        return false;
+    }
+    for (unsigned i = 0; i < textures.size(); ++i) {
+        const TextureSource& tex = textures[i];
+        if (tex.width <= 0 || tex.height <= 0 || (tex.pixels == nullptr && !tex.read)
+                || (tex.pixels != nullptr && tex.stride != 0 && tex.stride < tex.width * 4)) {
+            LOG_ERR << "The texture " << i << " is not valid";
+            return false;
+        }
+    }
+    const uint32_t numUVRefs = view.uvIndices ? view.numUVs : view.numVertices;
+    if (!view.uvIndices && view.numUVs < view.numVertices) {
+        LOG_ERR << "The mesh has per vertex texture coordinates, but fewer than its vertices";
+        return false;
+    }
+    for (int i = 0; i < view.numFaces; ++i) {
+        for (int k = 0; k < 3; ++k) {
+            if (view.indices[3*i+k] >= uint32_t(view.numVertices) || (view.uvIndices && view.uvIndices[3*i+k] >= numUVRefs)) {
+                LOG_ERR << "The face " << i << " references a vertex or a texture coordinate out of range";
+                return false;
+            }
+        }
+        if (view.textureIndices && (view.textureIndices[i] < 0 || view.textureIndices[i] >= (int) textures.size())) {
+            LOG_ERR << "The face " << i << " references the texture " << view.textureIndices[i] << " out of range";
+            return false;
+        }
+    }
+    return true;
+}
+
+/* The images are converted each time the texture object needs them, so that they
+ * are only held decoded within the texture cache budget */
+static TextureObjectHandle CreateTextureObject(const TextureSources& textures)
+{
+    TextureObjectHandle textureObject = std::make_shared<TextureObject>();
+    for (unsigned i = 0; i < textures.size(); ++i) {
+        TextureSource tex = textures[i];
+        auto source = [tex]() -> QImage {
+            if (tex.pixels) {
+                int stride = tex.stride > 0 ? tex.stride : tex.width * 4;
+                return ToARGB32(QImage(tex.pixels, tex.width, tex.height, stride, QImage::Format_RGBA8888));
+            }
+            QImage img(tex.width, tex.height, QImage::Format_RGBA8888);
+            if (img.isNull() || !tex.read(img.bits(), img.bytesPerLine()))
+                return QImage();
+            return ToARGB32(img);
+        };
+        bool added = textureObject->AddImage("texture_" + std::to_string(i), { tex.width, tex.height }, source);
+        ensure(added);
+    }
+    return textureObject;
+}
+
+/* Copies the mesh view, the index of the input face is stored in a face attribute
+ * that follows the faces through the compaction of the mesh */
+static void BuildMesh(const MeshView& view, Mesh& m)
+{
+    tri::Allocator<Mesh>::AddVertices(m, view.numVertices);
+    for (int i = 0; i < view.numVertices; ++i)
+        m.vert[i].P() = Point3d(view.positions[3*i], view.positions[3*i+1], view.positions[3*i+2]);
+
+    tri::Allocator<Mesh>::AddFaces(m, view.numFaces);
+    auto inputFace = tri::Allocator<Mesh>::GetPerFaceAttribute<int>(m, "FaceAttribute_InputFace");
+    int numTextures = 0;
+    for (int i = 0; i < view.numFaces; ++i) {
+        MeshFace& f = m.face[i];
+        int ti = view.textureIndices ? view.textureIndices[i] : 0;
+        for (int k = 0; k < 3; ++k) {
+            f.V(k) = &m.vert[view.indices[3*i+k]];
+            uint32_t uvi = view.uvIndices ? view.uvIndices[3*i+k] : view.indices[3*i+k];
+            f.WT(k).P() = Point2d(view.uvs[2*uvi], view.uvs[2*uvi+1]);
+            f.WT(k).N() = ti;
+        }
+        f.SetMesh();
+        inputFace[f] = i;
+        numTextures = std::max(numTextures, ti + 1);
+    }
+
+    m.textures.clear();
+    for (int i = 0; i < numTextures; ++i)
+        m.textures.push_back("texture_" + std::to_string(i));
+}
+
+static void ExtractResult(Mesh& m, Result *result)
+{
+    tri::Allocator<Mesh>::CompactEveryVector(m);
+    auto inputFace = tri::Allocator<Mesh>::GetPerFaceAttribute<int>(m, "FaceAttribute_InputFace");
+
+    result->positions.reserve(3 * m.vert.size());
+    for (const MeshVertex& v : m.vert)
+        for (int k = 0; k < 3; ++k)
+            result->positions.push_back((float) v.cP()[k]);
+
+    result->indices.reserve(3 * m.face.size());
+    result->uvs.reserve(6 * m.face.size());
+    result->textureIndices.reserve(m.face.size());
+    result->inputFaces.reserve(m.face.size());
+    for (MeshFace& f : m.face) {
+        for (int k = 0; k < 3; ++k) {
+            result->indices.push_back((uint32_t) tri::Index(m, f.cV(k)));
+            result->uvs.push_back((float) f.cWT(k).U());
+            result->uvs.push_back((float) f.cWT(k).V());
+        }
+        result->textureIndices.push_back(f.cWT(0).N());
+        result->inputFaces.push_back((uint32_t) inputFace[f]);
+    }
+}
+
+} // namespace defrag
@@ -0,0 +1,148 @@
+/*******************************************************************************
+    Copyright (c) 2021, Andrea Maggiordomo, Paolo Cignoni and Marco Tarini
+
+    This file is part of TextureDefrag, a reference implementation for
+    the paper ``Texture Defragmentation for Photo-Reconstructed 3D Models''
+    by Andrea Maggiordomo, Paolo Cignoni and Marco Tarini.
+
+    TextureDefrag is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    TextureDefrag is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with TextureDefrag. If not, see <https://www.gnu.org/licenses/>.
+*******************************************************************************/
+
+
+
+#ifndef DEFRAG_H
+#define DEFRAG_H
+
+/* Library interface of the texture defragmentation, for applications that hold the
+ * meshes and the decoded textures in memory. Defragment() runs the same pipeline
+ * as the texture-defrag tool (mesh preparation, greedy optimization, packing and
+ * rendering of the new texture sheets) without reading or writing any file */
+
+#include <vector>
+#include <string>
+#include <functional>
+#include <cstdint>
+
+namespace defrag {
+
+/* Triangle mesh with wedge texture coordinates. The texture coordinates follow the
+ * obj convention: [0,1] over the texture image, with v = 0 on its bottom row */
+struct MeshView {
+    const float *positions = nullptr;       // 3 floats per vertex
+    int numVertices = 0;
+
+    const uint32_t *indices = nullptr;      // 3 vertex indices per face
+    int numFaces = 0;
+
+    const float *uvs = nullptr;             // 2 floats per texture coordinate
+    int numUVs = 0;
+    const uint32_t *uvIndices = nullptr;    // 3 texture coordinate indices per face, if null the texture coordinates are per vertex
+
+    const int32_t *textureIndices = nullptr; // texture of each face, if null all the faces use the texture 0
+};
+
+/* Texture image, either a buffer or a callback that fills one. The texels are 4
+ * bytes in the order R, G, B, A, and the rows are stored top to bottom */
+struct TextureSource {
+    int width = 0;
+    int height = 0;
+
+    const unsigned char *pixels = nullptr;  // must stay valid until Defragment() returns
+    int stride = 0;                         // bytes per row of pixels, 0 if the rows are contiguous
+
+    /* Used when pixels is null, writes the texels in a buffer of height rows of
+     * stride bytes and returns false on failure. The image can be requested more
+     * than once, also from several threads at once, if it does not fit the texture
+     * cache budget */
+    std::function<bool(unsigned char *pixels, int stride)> read;
+};
+
+typedef std::vector<TextureSource> TextureSources;
+
+/* Parameters of the defragmentation, the defaults are those of texture-defrag */
+struct Options {
+    double matchingThreshold = 2.0;          // -m
+    double coincidentSeamTolerance = 0;      // -m _,coincident=N, matching error below which the seams are stitched before the greedy optimization (0 disables it)
+    bool reduceSeams = false;                // -m _,reduce=linear, shorten the seams whose matching error is above the tolerance instead of discarding them
+    bool reduceSeamsBisection = false;       // -m _,reduce=bisection, shorten them to the longest feasible run of edges (requires reduceSeams)
+    double boundaryTolerance = 0.2;          // -b
+    double distortionTolerance = 0.5;        // -d
+    double arapSolverTolerance = 1e-10;      // -d _,solver-tolerance=N, relative residual tolerance of the iterative and mixed precision ARAP solvers
+    std::string arapSolver = "ldlt";         // -d _,solver=name, backend of the ARAP solves: ldlt, ldlt-mixed, cg or bicgstab
+    int arapAndersonWindow = 0;              // -d _,anderson=N, previous iterates combined by the Anderson acceleration of the ARAP solves (0 disables it)
+    double arapEarlyStopMargin = 0;          // -d _,early-stop=N, fraction of the distortion limits below which the ARAP solve of a move stops (0 disables it)
+    double scaffoldWidth = 0;                // -d _,scaffold=N, width of the scaffold band around the shells, relative to their average boundary edge length (0 disables it)
+    double globalDistortionThreshold = 0.025; // -g
+    double UVBorderLengthReduction = 0.0;    // -u
+    double offsetFactor = 5.0;               // -a
+    double timelimit = 0.0;                  // -t
+    double deadline = 0.0;                   // -W, wall-clock deadline of the whole call in seconds
+    int rotationNum = 4;                     // -r
+    int mergeBatchSize = 1;                  // -s
+    double lazyCostFactor = 0;               // -s _,lazy=N, factor of the previous matching error estimating the cost of the seams re-queued after a move (0 disables it)
+    int rasterOverlapFaces = 0;              // -s _,raster-overlap=N, optimization areas with at least this many faces are also checked for overlaps by rasterization, if a context is current (0 disables it)
+    int rasterOverlapResolution = 1024;      // -s _,raster-resolution=N, texels along the longest side of the rasterized grid
+    int partitions = 1;                      // -G
+    bool parallelPacking = false;            // -j 1
+    bool hierarchicalPacking = false;        // -j 2
+    bool gpuPacking = false;                 // -j 64
+    bool deterministic = false;              // -j 128
+    int greedyThreads = 0;                   // -j flags,N, threads of the greedy optimization (0 uses all of them)
+    int arapThreads = 0;                     // -j flags,_,N, threads of the ARAP solves of the moves
+    int packingThreads = 0;                  // -j flags,_,_,N, threads of the packing
+    std::string packingLayoutFile;           // -h, layout of a previous packing reused for the unchanged charts
+    int tileSize = 0;                        // -f _,tile=N, side of the fixed size texture tiles the charts are packed into (0 disables them)
+
+    double textureCacheGB = 8.0;             // -c
+    double packingCacheGB = 8.0;             // -p, negative to size it from the free system memory
+
+    /* The sheets are rendered with the OpenGL context current on the calling thread,
+     * or on the CPU if there is none or if softwareRendering is set */
+    bool renderTextures = true;
+    bool softwareRendering = false;
+    int renderContexts = 1;                  // -y
+    int renderThreads = 0;                   // -j flags,_,_,_,N, threads of the software renderer and of the vertex fill of the contexts
+    int maxInputMipLevel = 0;                // -L
+    std::string scratchDirectory;            // -n _,scratch=dir, directory of the scratch files backing the sheet images (empty keeps them in memory)
+};
+
+/* Texture sheet, with the texels in the layout of TextureSource */
+struct Sheet {
+    int width = 0;
+    int height = 0;
+    std::vector<unsigned char> pixels;       // width * 4 bytes per row, rows top to bottom, empty if the sheet is not rendered
+};
+
+/* The defragmented mesh. The mesh is cut along the texture seams, so it has its
+ * own vertices, and the degenerate and non-manifold input faces are removed */
+struct Result {
+    std::vector<float> positions;            // 3 floats per vertex
+    std::vector<uint32_t> indices;           // 3 vertex indices per face
+    std::vector<float> uvs;                  // 2 floats per wedge (3 per face), in the obj convention
+    std::vector<int32_t> textureIndices;     // sheet of each face
+    std::vector<uint32_t> inputFaces;        // index of the input face of each face
+    std::vector<Sheet> sheets;
+
+    int inputCharts = 0;
+    int outputCharts = 0;
+};
+
+/* Defragments the texture atlas of mesh, whose faces reference the textures by
+ * index. Returns false, logging the reason, if the input is not valid or the
+ * charts cannot be packed */
+bool Defragment(const MeshView& mesh, const TextureSources& textures, const Options& options, Result *result);
+
+} // namespace defrag
+
+#endif // DEFRAG_H
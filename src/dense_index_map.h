@@ -0,0 +1,74 @@
+/*******************************************************************************
+    Copyright (c) 2021, Andrea Maggiordomo, Paolo Cignoni and Marco Tarini
+
+    This file is part of TextureDefrag, a reference implementation for
+    the paper ``Texture Defragmentation for Photo-Reconstructed 3D Models''
+    by Andrea Maggiordomo, Paolo Cignoni and Marco Tarini.
+
+    TextureDefrag is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    TextureDefrag is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with TextureDefrag. If not, see <https://www.gnu.org/licenses/>.
+*******************************************************************************/
+
+
+#ifndef DENSE_INDEX_MAP_H
+#define DENSE_INDEX_MAP_H
+
+#include <vector>
+#include <cstddef>
+
+/* Map from the indices of the elements of a mesh to non-negative ints, stored in
+ * a vector that covers the range of the indices mapped since the last Reset().
+ * The charts are stored contiguously (see ReorderForLocality()), so the range is
+ * close to the size of the chart. The mapped indices are recorded so that Reset()
+ * only clears them, and the vector is meant to be reused across calls (e.g. as a
+ * thread_local), to avoid both the hashing and the allocations of an unordered_map */
+class DenseIndexMap {
+
+public:
+
+    /* Clears the map, the indices that can be mapped are the ones in [lo, hi] */
+    void Reset(int lo, int hi)
+    {
+        for (int i : touched)
+            value[i] = -1;
+        touched.clear();
+        base = lo;
+        std::size_t n = (hi >= lo) ? std::size_t(hi - lo + 1) : 0;
+        if (value.size() < n)
+            value.resize(n, -1);
+    }
+
+    /* Returns the value mapped to i, or -1 if i is not mapped (or out of range) */
+    int Get(int i) const
+    {
+        std::size_t k = std::size_t(i - base);
+        return (i >= base && k < value.size()) ? value[k] : -1;
+    }
+
+    /* Maps i (in the range of the last Reset()) to v >= 0 */
+    void Set(int i, int v)
+    {
+        int& slot = value[i - base];
+        if (slot == -1)
+            touched.push_back(i - base);
+        slot = v;
+    }
+
+private:
+
+    int base = 0;
+    std::vector<int> value;
+    std::vector<int> touched;
+};
+
+#endif // DENSE_INDEX_MAP_H
@@ -0,0 +1,84 @@
+/*******************************************************************************
+    Copyright (c) 2021, Andrea Maggiordomo, Paolo Cignoni and Marco Tarini
+
+    This file is part of TextureDefrag, a reference implementation for
+    the paper ``Texture Defragmentation for Photo-Reconstructed 3D Models''
+    by Andrea Maggiordomo, Paolo Cignoni and Marco Tarini.
+
+    TextureDefrag is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    TextureDefrag is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with TextureDefrag. If not, see <https://www.gnu.org/licenses/>.
+*******************************************************************************/
+
+#include "derived_data.h"
+#include "run_report.h"
+
+#include <vcg/complex/algorithms/update/topology.h>
+#include <vcg/complex/algorithms/update/normal.h>
+#include <vcg/complex/algorithms/update/bounding.h>
+
+
+static bool BeginUpdate(Mesh& m, DerivedData data, const char *name);
+
+void RequireFaceFace(Mesh& m)
+{
+    if (BeginUpdate(m, DERIVED_FACE_FACE, "face_face"))
+        ComputeFaceFaceTopology(m);
+}
+
+void RequireVertexFace(Mesh& m)
+{
+    if (BeginUpdate(m, DERIVED_VERTEX_FACE, "vertex_face"))
+        tri::UpdateTopology<Mesh>::VertexFace(m);
+}
+
+void RequireNormals(Mesh& m)
+{
+    if (BeginUpdate(m, DERIVED_NORMALS, "normals")) {
+        tri::UpdateNormal<Mesh>::PerFaceNormalized(m);
+        tri::UpdateNormal<Mesh>::PerVertexNormalized(m);
+    }
+}
+
+void RequireBoundingBox(Mesh& m)
+{
+    if (BeginUpdate(m, DERIVED_BOUNDING_BOX, "bounding_box"))
+        tri::UpdateBounding<Mesh>::Box(m);
+}
+
+void InvalidateDerivedData(Mesh& m, unsigned data)
+{
+    m.derivedData &= ~data;
+}
+
+void SetDerivedDataValid(Mesh& m, unsigned data)
+{
+    m.derivedData |= data;
+}
+
+bool IsDerivedDataValid(const Mesh& m, unsigned data)
+{
+    return (m.derivedData & data) == data;
+}
+
+// -- static functions ---------------------------------------------------------
+
+/* Returns true if the data must be computed, in which case it is counted and
+ * marked as valid */
+static bool BeginUpdate(Mesh& m, DerivedData data, const char *name)
+{
+    if (m.derivedData & data)
+        return false;
+    m.derivedData |= data;
+    ReportAdd("derived_data", name, 1);
+    return true;
+}
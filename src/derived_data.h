@@ -0,0 +1,52 @@
+/*******************************************************************************
+    Copyright (c) 2021, Andrea Maggiordomo, Paolo Cignoni and Marco Tarini
+
+    This file is part of TextureDefrag, a reference implementation for
+    the paper ``Texture Defragmentation for Photo-Reconstructed 3D Models''
+    by Andrea Maggiordomo, Paolo Cignoni and Marco Tarini.
+
+    TextureDefrag is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    TextureDefrag is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with TextureDefrag. If not, see <https://www.gnu.org/licenses/>.
+*******************************************************************************/
+
+#ifndef DERIVED_DATA_H
+#define DERIVED_DATA_H
+
+#include "mesh.h"
+
+/* Data derived from the geometry and the connectivity of a mesh, computed on
+ * demand. Each Require function computes its data only if the mesh does not
+ * hold an up to date copy, and the functions that edit the mesh mark the data
+ * they make stale with InvalidateDerivedData() instead of recomputing it. The
+ * functions that keep some data up to date themselves mark it as valid. Each
+ * computation is counted in the derived_data section of the run report */
+
+enum DerivedData : unsigned {
+    DERIVED_FACE_FACE    = 1u << 0,
+    DERIVED_VERTEX_FACE  = 1u << 1,
+    DERIVED_NORMALS      = 1u << 2, // per face and per vertex, normalized
+    DERIVED_BOUNDING_BOX = 1u << 3,
+    DERIVED_ALL          = (1u << 4) - 1
+};
+
+/* The FF topology is computed with ComputeFaceFaceTopology() */
+void RequireFaceFace(Mesh& m);
+void RequireVertexFace(Mesh& m);
+void RequireNormals(Mesh& m);
+void RequireBoundingBox(Mesh& m);
+
+void InvalidateDerivedData(Mesh& m, unsigned data = DERIVED_ALL);
+void SetDerivedDataValid(Mesh& m, unsigned data);
+bool IsDerivedDataValid(const Mesh& m, unsigned data);
+
+#endif // DERIVED_DATA_H
@@ -0,0 +1,81 @@
+/*******************************************************************************
+    Copyright (c) 2021, Andrea Maggiordomo, Paolo Cignoni and Marco Tarini
+
+    This file is part of TextureDefrag, a reference implementation for
+    the paper ``Texture Defragmentation for Photo-Reconstructed 3D Models''
+    by Andrea Maggiordomo, Paolo Cignoni and Marco Tarini.
+
+    TextureDefrag is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    TextureDefrag is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with TextureDefrag. If not, see <https://www.gnu.org/licenses/>.
+*******************************************************************************/
+
+
+
+#ifndef DISJOINT_SET_H
+#define DISJOINT_SET_H
+
+#include <vector>
+#include <atomic>
+#include <utility>
+
+/* Lock-free union-find over the integers [0, n). The parent of an element never
+ * has a larger index, so the root of a set is always its smallest element and
+ * the links cannot form cycles. Roots are linked with a CAS and the paths are
+ * compressed by halving (a racing update still stores an ancestor), so Find()
+ * and Unite() can be called concurrently */
+class ConcurrentDisjointSet {
+
+public:
+
+    explicit ConcurrentDisjointSet(int n)
+        : parent(n)
+    {
+        #pragma omp parallel for
+        for (int i = 0; i < n; ++i)
+            parent[i].store(i, std::memory_order_relaxed);
+    }
+
+    int Find(int i)
+    {
+        while (true) {
+            int p = parent[i].load(std::memory_order_relaxed);
+            if (p == i)
+                return i;
+            int g = parent[p].load(std::memory_order_relaxed);
+            if (g != p)
+                parent[i].compare_exchange_weak(p, g, std::memory_order_relaxed);
+            i = g;
+        }
+    }
+
+    void Unite(int i, int j)
+    {
+        while (true) {
+            i = Find(i);
+            j = Find(j);
+            if (i == j)
+                return;
+            if (i < j)
+                std::swap(i, j);
+            int expected = i;
+            if (parent[i].compare_exchange_strong(expected, j, std::memory_order_relaxed))
+                return;
+        }
+    }
+
+private:
+
+    std::vector<std::atomic<int>> parent;
+};
+
+#endif // DISJOINT_SET_H
@@ -0,0 +1,147 @@
+/*******************************************************************************
+    Copyright (c) 2021, Andrea Maggiordomo, Paolo Cignoni and Marco Tarini
+
+    This file is part of TextureDefrag, a reference implementation for
+    the paper ``Texture Defragmentation for Photo-Reconstructed 3D Models''
+    by Andrea Maggiordomo, Paolo Cignoni and Marco Tarini.
+
+    TextureDefrag is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    TextureDefrag is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with TextureDefrag. If not, see <https://www.gnu.org/licenses/>.
+*******************************************************************************/
+
+#include "distributed.h"
+#include "logging.h"
+
+#include <chrono>
+#include <thread>
+#include <string>
+
+#include <QDir>
+#include <QFile>
+#include <QSaveFile>
+#include <QString>
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+
+// interval between the checks of the files waited for
+constexpr int POLL_INTERVAL_MS = 500;
+
+// interval between the messages logged while waiting
+constexpr double WAIT_LOG_INTERVAL_S = 60.0;
+
+static std::string ProcessName();
+
+
+WorkDirectory::WorkDirectory(const std::string& path)
+    : path(path)
+{
+    QDir().mkpath(QString(path.c_str()));
+}
+
+std::string WorkDirectory::FilePath(const std::string& name) const
+{
+    return QDir(QString(path.c_str())).absoluteFilePath(QString(name.c_str())).toStdString();
+}
+
+bool WorkDirectory::Exists(const std::string& name) const
+{
+    return QFile(FilePath(name).c_str()).exists();
+}
+
+bool WorkDirectory::Claim(const std::string& name) const
+{
+    std::string claimPath = FilePath(name + ".claim");
+    std::string owner = ProcessName() + "\n";
+#ifdef __linux__
+    // the exclusive creation is atomic, also on NFS
+    int fd = open(claimPath.c_str(), O_WRONLY | O_CREAT | O_EXCL, 0644);
+    if (fd < 0)
+        return false;
+    bool written = write(fd, owner.data(), owner.size()) == ssize_t(owner.size());
+    close(fd);
+    if (!written)
+        LOG_WARN << "Unable to record the owner of " << claimPath;
+    return true;
+#else
+    // two processes can both claim the item, it is then processed twice
+    QFile file(claimPath.c_str());
+    if (file.exists() || !file.open(QIODevice::WriteOnly))
+        return false;
+    file.write(owner.data(), owner.size());
+    return true;
+#endif
+}
+
+bool WorkDirectory::MarkDone(const std::string& name) const
+{
+    return WriteFile(name + ".done", nullptr, 0);
+}
+
+bool WorkDirectory::IsDone(const std::string& name) const
+{
+    return Exists(name + ".done");
+}
+
+bool WorkDirectory::WriteFile(const std::string& name, const void *data, std::size_t size) const
+{
+    QSaveFile file(FilePath(name).c_str());
+    if (!file.open(QIODevice::WriteOnly))
+        return false;
+    if (size > 0 && file.write(reinterpret_cast<const char *>(data), size) != qint64(size))
+        return false;
+    return file.commit();
+}
+
+bool WorkDirectory::ReadFile(const std::string& name, std::vector<char>& data) const
+{
+    QFile file(FilePath(name).c_str());
+    if (!file.open(QIODevice::ReadOnly))
+        return false;
+    data.resize(file.size());
+    return file.read(data.data(), data.size()) == qint64(data.size());
+}
+
+int WorkDirectory::WaitFor(const std::vector<std::string>& names) const
+{
+    auto start = std::chrono::steady_clock::now();
+    double logged = 0;
+    while (true) {
+        for (unsigned i = 0; i < names.size(); ++i)
+            if (Exists(names[i]))
+                return i;
+        std::this_thread::sleep_for(std::chrono::milliseconds(POLL_INTERVAL_MS));
+        double waited = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        if (waited - logged >= WAIT_LOG_INTERVAL_S) {
+            LOG_INFO << "Waiting for " << FilePath(names[0]) << " (" << int(waited) << " s)";
+            logged = waited;
+        }
+    }
+}
+
+
+// -- static functions ---------------------------------------------------------
+
+static std::string ProcessName()
+{
+#ifdef __linux__
+    char host[256] = {};
+    gethostname(host, sizeof(host) - 1);
+    return std::string(host) + ":" + std::to_string(getpid());
+#else
+    return "unknown";
+#endif
+}
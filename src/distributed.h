@@ -0,0 +1,83 @@
+/*******************************************************************************
+    Copyright (c) 2021, Andrea Maggiordomo, Paolo Cignoni and Marco Tarini
+
+    This file is part of TextureDefrag, a reference implementation for
+    the paper ``Texture Defragmentation for Photo-Reconstructed 3D Models''
+    by Andrea Maggiordomo, Paolo Cignoni and Marco Tarini.
+
+    TextureDefrag is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    TextureDefrag is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with TextureDefrag. If not, see <https://www.gnu.org/licenses/>.
+*******************************************************************************/
+
+#ifndef DISTRIBUTED_H
+#define DISTRIBUTED_H
+
+#include <string>
+#include <vector>
+#include <cstddef>
+
+/* Distributed processing of a job by a coordinator and worker processes, possibly
+ * on other nodes, that share a work directory on a common file system. The
+ * coordinator loads and prepares the mesh and publishes it as a stage snapshot,
+ * the tiles of the greedy optimization (see OptimizeTiles) and then the texture
+ * sheets are processed by whichever process claims them first, and the coordinator
+ * packs the charts and saves the mesh. The processes communicate through files:
+ *
+ *   prepared.pack      the prepared mesh (a packing stage snapshot, see mesh_cache.h)
+ *   tiles.plan         the faces of the tiles, written after the snapshot
+ *   tile_N.claim       created by the process optimizing tile N
+ *   tile_N.result      the texture coordinates and charts of the optimized tile N
+ *   sheets.output      the output mesh file the sheets are named after
+ *   sheets.render      the packed mesh (a rendering stage snapshot)
+ *   sheet_N.claim      created by the process rendering sheet N
+ *   sheet_N.done       created once sheet N is saved
+ *   job.done           created by the coordinator when it exits, the workers stop
+ *
+ * The files with contents are written to a temporary file and renamed, so they only
+ * appear once complete. The work directory must be empty when the coordinator
+ * starts, and the workers must run with the same options. A worker that dies after
+ * claiming an item stalls the coordinator until its claim file is removed */
+class WorkDirectory {
+
+public:
+
+    explicit WorkDirectory(const std::string& path);
+
+    std::string FilePath(const std::string& name) const;
+
+    bool Exists(const std::string& name) const;
+
+    /* Creates name.claim if it does not exist, returns false if another process
+     * claimed the item first. The claim file records the host and the process id */
+    bool Claim(const std::string& name) const;
+
+    /* Creates name.done */
+    bool MarkDone(const std::string& name) const;
+
+    bool IsDone(const std::string& name) const;
+
+    /* Writes the file atomically, returns false on failure */
+    bool WriteFile(const std::string& name, const void *data, std::size_t size) const;
+
+    /* Reads the whole file, returns false if it cannot be read */
+    bool ReadFile(const std::string& name, std::vector<char>& data) const;
+
+    /* Waits until one of the files exists and returns its index */
+    int WaitFor(const std::vector<std::string>& names) const;
+
+private:
+
+    std::string path;
+};
+
+#endif // DISTRIBUTED_H
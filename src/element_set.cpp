@@ -0,0 +1,81 @@
+/*******************************************************************************
+    Copyright (c) 2021, Andrea Maggiordomo, Paolo Cignoni and Marco Tarini
+
+    This file is part of TextureDefrag, a reference implementation for
+    the paper ``Texture Defragmentation for Photo-Reconstructed 3D Models''
+    by Andrea Maggiordomo, Paolo Cignoni and Marco Tarini.
+
+    TextureDefrag is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    TextureDefrag is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with TextureDefrag. If not, see <https://www.gnu.org/licenses/>.
+*******************************************************************************/
+
+
+
+#include "element_set.h"
+
+#include <mutex>
+#include <algorithm>
+
+
+static std::mutex poolMutex;
+static std::vector<std::unique_ptr<ElementStorage>> pool;
+
+
+void ElementStorage::NextGeneration()
+{
+    generation++;
+    if (generation == 0) {
+        // the stamps of old generations could match again after the wrap around
+        std::fill(stamp.begin(), stamp.end(), 0);
+        generation = 1;
+    }
+}
+
+std::unique_ptr<ElementStorage> AcquireElementStorage(std::size_t n, bool slots)
+{
+    std::unique_ptr<ElementStorage> storage;
+    {
+        std::lock_guard<std::mutex> lock(poolMutex);
+        if (!pool.empty()) {
+            // prefer the storage that does not need to grow
+            auto it = std::find_if(pool.begin(), pool.end(), [&] (const std::unique_ptr<ElementStorage>& s) {
+                return s->stamp.size() >= n && (!slots || s->slot.size() >= n);
+            });
+            if (it == pool.end())
+                it = pool.end() - 1;
+            storage = std::move(*it);
+            pool.erase(it);
+        }
+    }
+    if (!storage)
+        storage.reset(new ElementStorage);
+
+    storage->NextGeneration();
+    if (storage->stamp.size() < n)
+        storage->stamp.resize(n, 0);
+    if (slots && storage->slot.size() < n)
+        storage->slot.resize(n);
+    return storage;
+}
+
+void ReleaseElementStorage(std::unique_ptr<ElementStorage> storage)
+{
+    std::lock_guard<std::mutex> lock(poolMutex);
+    pool.push_back(std::move(storage));
+}
+
+void ClearElementStoragePool()
+{
+    std::lock_guard<std::mutex> lock(poolMutex);
+    pool.clear();
+}
@@ -0,0 +1,253 @@
+/*******************************************************************************
+    Copyright (c) 2021, Andrea Maggiordomo, Paolo Cignoni and Marco Tarini
+
+    This file is part of TextureDefrag, a reference implementation for
+    the paper ``Texture Defragmentation for Photo-Reconstructed 3D Models''
+    by Andrea Maggiordomo, Paolo Cignoni and Marco Tarini.
+
+    TextureDefrag is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    TextureDefrag is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with TextureDefrag. If not, see <https://www.gnu.org/licenses/>.
+*******************************************************************************/
+
+
+#ifndef ELEMENT_SET_H
+#define ELEMENT_SET_H
+
+#include <vector>
+#include <memory>
+#include <utility>
+#include <cstdint>
+
+#include "utils.h"
+
+/* Per-element storage of the dense sets and maps: an element is a member if its
+ * stamp is equal to the current generation, and slot is the position of its
+ * entry. Incrementing the generation empties the set in constant time */
+struct ElementStorage {
+    std::vector<uint32_t> stamp;
+    std::vector<uint32_t> slot;
+    uint32_t generation = 0;
+
+    void NextGeneration();
+};
+
+/* The storage is recycled through a pool, so that the short lived sets built
+ * for each move acquire vectors already sized to the mesh instead of allocating
+ * and clearing them */
+std::unique_ptr<ElementStorage> AcquireElementStorage(std::size_t n, bool slots);
+void ReleaseElementStorage(std::unique_ptr<ElementStorage> storage);
+
+/* Frees the storage currently held by the pool */
+void ClearElementStoragePool();
+
+/* Base of the dense containers of the elements (vertices or faces) of a mesh
+ * container. The elements are identified by their index, the container must
+ * not be reallocated while it is bound */
+template <typename Element>
+class ElementIndex {
+
+public:
+
+    typedef Element *Pointer;
+
+    ElementIndex() : base{nullptr}, n{0} {}
+
+    ElementIndex(const ElementIndex&) = delete;
+    ElementIndex& operator=(const ElementIndex&) = delete;
+
+    ElementIndex(ElementIndex&& other) : base{other.base}, n{other.n}, storage{std::move(other.storage)}
+    {
+        other.base = nullptr;
+        other.n = 0;
+    }
+
+    ElementIndex& operator=(ElementIndex&& other)
+    {
+        std::swap(base, other.base);
+        std::swap(n, other.n);
+        std::swap(storage, other.storage);
+        return *this;
+    }
+
+    ~ElementIndex()
+    {
+        if (storage)
+            ReleaseElementStorage(std::move(storage));
+    }
+
+    bool IsBound() const { return storage != nullptr; }
+
+protected:
+
+    Pointer base;
+    std::size_t n;
+    std::unique_ptr<ElementStorage> storage;
+
+    void BindStorage(std::vector<Element>& container, bool slots)
+    {
+        base = container.empty() ? nullptr : &container[0];
+        n = container.size();
+        if (storage && storage->stamp.size() >= n && (!slots || storage->slot.size() >= n)) {
+            // the storage held by the container is large enough, rebinding is O(1)
+            storage->NextGeneration();
+        } else {
+            if (storage)
+                ReleaseElementStorage(std::move(storage));
+            storage = AcquireElementStorage(n, slots);
+        }
+    }
+
+    std::size_t Index(const Element *p) const
+    {
+        ensure(p >= base && p < base + n);
+        return std::size_t(p - base);
+    }
+
+    bool Contains(const Element *p) const
+    {
+        return storage && storage->stamp[Index(p)] == storage->generation;
+    }
+
+    /* Marks the element, returns false if it was already a member */
+    bool Mark(const Element *p)
+    {
+        ensure(storage);
+        uint32_t& s = storage->stamp[Index(p)];
+        if (s == storage->generation)
+            return false;
+        s = storage->generation;
+        return true;
+    }
+
+    void ClearStamps()
+    {
+        if (storage)
+            storage->NextGeneration();
+    }
+};
+
+/* Set of the elements of a mesh container, iterated in insertion order */
+template <typename Element>
+class ElementSet : public ElementIndex<Element> {
+
+    typedef ElementIndex<Element> Base;
+
+public:
+
+    typedef typename Base::Pointer Pointer;
+    typedef typename std::vector<Pointer>::const_iterator const_iterator;
+
+    ElementSet() {}
+    explicit ElementSet(std::vector<Element>& container) { Bind(container); }
+
+    /* Binds the set to the container, the set is emptied */
+    void Bind(std::vector<Element>& container)
+    {
+        Base::BindStorage(container, false);
+        items.clear();
+    }
+
+    bool insert(Pointer p)
+    {
+        if (!Base::Mark(p))
+            return false;
+        items.push_back(p);
+        return true;
+    }
+
+    template <typename InputIterator>
+    void insert(InputIterator first, InputIterator last)
+    {
+        for (; first != last; ++first)
+            insert(*first);
+    }
+
+    std::size_t count(const Element *p) const { return Base::Contains(p) ? 1 : 0; }
+
+    void clear()
+    {
+        Base::ClearStamps();
+        items.clear();
+    }
+
+    std::size_t size() const { return items.size(); }
+    bool empty() const { return items.empty(); }
+    const_iterator begin() const { return items.begin(); }
+    const_iterator end() const { return items.end(); }
+
+private:
+
+    std::vector<Pointer> items;
+};
+
+/* Map from the elements of a mesh container to values of type T, iterated in
+ * insertion order */
+template <typename Element, typename T>
+class ElementMap : public ElementIndex<Element> {
+
+    typedef ElementIndex<Element> Base;
+
+public:
+
+    typedef typename Base::Pointer Pointer;
+    typedef std::pair<Pointer, T> Entry;
+    typedef typename std::vector<Entry>::iterator iterator;
+    typedef typename std::vector<Entry>::const_iterator const_iterator;
+
+    ElementMap() {}
+    explicit ElementMap(std::vector<Element>& container) { Bind(container); }
+
+    /* Binds the map to the container, the map is emptied */
+    void Bind(std::vector<Element>& container)
+    {
+        Base::BindStorage(container, true);
+        entries.clear();
+    }
+
+    /* Returns the value of the element, inserting a default value if needed */
+    T& operator[](Pointer p)
+    {
+        if (Base::Mark(p)) {
+            Base::storage->slot[Base::Index(p)] = (uint32_t) entries.size();
+            entries.push_back(std::make_pair(p, T()));
+        }
+        return entries[Base::storage->slot[Base::Index(p)]].second;
+    }
+
+    const T& at(const Element *p) const
+    {
+        ensure(Base::Contains(p));
+        return entries[Base::storage->slot[Base::Index(p)]].second;
+    }
+
+    std::size_t count(const Element *p) const { return Base::Contains(p) ? 1 : 0; }
+
+    void clear()
+    {
+        Base::ClearStamps();
+        entries.clear();
+    }
+
+    std::size_t size() const { return entries.size(); }
+    bool empty() const { return entries.empty(); }
+    iterator begin() { return entries.begin(); }
+    iterator end() { return entries.end(); }
+    const_iterator begin() const { return entries.begin(); }
+    const_iterator end() const { return entries.end(); }
+
+private:
+
+    std::vector<Entry> entries;
+};
+
+#endif // ELEMENT_SET_H
@@ -0,0 +1,394 @@
+/*******************************************************************************
+    Copyright (c) 2021, Andrea Maggiordomo, Paolo Cignoni and Marco Tarini
+
+    This file is part of TextureDefrag, a reference implementation for
+    the paper ``Texture Defragmentation for Photo-Reconstructed 3D Models''
+    by Andrea Maggiordomo, Paolo Cignoni and Marco Tarini.
+
+    TextureDefrag is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    TextureDefrag is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with TextureDefrag. If not, see <https://www.gnu.org/licenses/>.
+*******************************************************************************/
+
+
+
+#include "float_format.h"
+
+#include <cstdint>
+#include <cstring>
+#include <cstdio>
+#include <cmath>
+
+
+/* A floating point value f * 2^e with a 64-bit significand */
+struct DiyFp {
+    uint64_t f;
+    int e;
+};
+
+struct Boundaries {
+    DiyFp w;
+    DiyFp minus;
+    DiyFp plus;
+};
+
+struct CachedPower {
+    uint64_t f;
+    int e;
+    int k;
+};
+
+/* the scaled value is kept with a binary exponent in this range, so that the
+ * integral part fits in 32 bits */
+static const int ALPHA = -60;
+static const int GAMMA = -32;
+
+static const int CACHED_POWERS_MIN_DEC_EXP = -300;
+static const int CACHED_POWERS_DEC_STEP = 8;
+
+/* 10^k = f * 2^e for k in [-300, 324], with f normalized and rounded to nearest */
+static const CachedPower CACHED_POWERS[] = {
+    { 0xAB70FE17C79AC6CAULL, -1060, -300 },
+    { 0xFF77B1FCBEBCDC4FULL, -1034, -292 },
+    { 0xBE5691EF416BD60CULL, -1007, -284 },
+    { 0x8DD01FAD907FFC3CULL,  -980, -276 },
+    { 0xD3515C2831559A83ULL,  -954, -268 },
+    { 0x9D71AC8FADA6C9B5ULL,  -927, -260 },
+    { 0xEA9C227723EE8BCBULL,  -901, -252 },
+    { 0xAECC49914078536DULL,  -874, -244 },
+    { 0x823C12795DB6CE57ULL,  -847, -236 },
+    { 0xC21094364DFB5637ULL,  -821, -228 },
+    { 0x9096EA6F3848984FULL,  -794, -220 },
+    { 0xD77485CB25823AC7ULL,  -768, -212 },
+    { 0xA086CFCD97BF97F4ULL,  -741, -204 },
+    { 0xEF340A98172AACE5ULL,  -715, -196 },
+    { 0xB23867FB2A35B28EULL,  -688, -188 },
+    { 0x84C8D4DFD2C63F3BULL,  -661, -180 },
+    { 0xC5DD44271AD3CDBAULL,  -635, -172 },
+    { 0x936B9FCEBB25C996ULL,  -608, -164 },
+    { 0xDBAC6C247D62A584ULL,  -582, -156 },
+    { 0xA3AB66580D5FDAF6ULL,  -555, -148 },
+    { 0xF3E2F893DEC3F126ULL,  -529, -140 },
+    { 0xB5B5ADA8AAFF80B8ULL,  -502, -132 },
+    { 0x87625F056C7C4A8BULL,  -475, -124 },
+    { 0xC9BCFF6034C13053ULL,  -449, -116 },
+    { 0x964E858C91BA2655ULL,  -422, -108 },
+    { 0xDFF9772470297EBDULL,  -396, -100 },
+    { 0xA6DFBD9FB8E5B88FULL,  -369,  -92 },
+    { 0xF8A95FCF88747D94ULL,  -343,  -84 },
+    { 0xB94470938FA89BCFULL,  -316,  -76 },
+    { 0x8A08F0F8BF0F156BULL,  -289,  -68 },
+    { 0xCDB02555653131B6ULL,  -263,  -60 },
+    { 0x993FE2C6D07B7FACULL,  -236,  -52 },
+    { 0xE45C10C42A2B3B06ULL,  -210,  -44 },
+    { 0xAA242499697392D3ULL,  -183,  -36 },
+    { 0xFD87B5F28300CA0EULL,  -157,  -28 },
+    { 0xBCE5086492111AEBULL,  -130,  -20 },
+    { 0x8CBCCC096F5088CCULL,  -103,  -12 },
+    { 0xD1B71758E219652CULL,   -77,   -4 },
+    { 0x9C40000000000000ULL,   -50,    4 },
+    { 0xE8D4A51000000000ULL,   -24,   12 },
+    { 0xAD78EBC5AC620000ULL,     3,   20 },
+    { 0x813F3978F8940984ULL,    30,   28 },
+    { 0xC097CE7BC90715B3ULL,    56,   36 },
+    { 0x8F7E32CE7BEA5C70ULL,    83,   44 },
+    { 0xD5D238A4ABE98068ULL,   109,   52 },
+    { 0x9F4F2726179A2245ULL,   136,   60 },
+    { 0xED63A231D4C4FB27ULL,   162,   68 },
+    { 0xB0DE65388CC8ADA8ULL,   189,   76 },
+    { 0x83C7088E1AAB65DBULL,   216,   84 },
+    { 0xC45D1DF942711D9AULL,   242,   92 },
+    { 0x924D692CA61BE758ULL,   269,  100 },
+    { 0xDA01EE641A708DEAULL,   295,  108 },
+    { 0xA26DA3999AEF774AULL,   322,  116 },
+    { 0xF209787BB47D6B85ULL,   348,  124 },
+    { 0xB454E4A179DD1877ULL,   375,  132 },
+    { 0x865B86925B9BC5C2ULL,   402,  140 },
+    { 0xC83553C5C8965D3DULL,   428,  148 },
+    { 0x952AB45CFA97A0B3ULL,   455,  156 },
+    { 0xDE469FBD99A05FE3ULL,   481,  164 },
+    { 0xA59BC234DB398C25ULL,   508,  172 },
+    { 0xF6C69A72A3989F5CULL,   534,  180 },
+    { 0xB7DCBF5354E9BECEULL,   561,  188 },
+    { 0x88FCF317F22241E2ULL,   588,  196 },
+    { 0xCC20CE9BD35C78A5ULL,   614,  204 },
+    { 0x98165AF37B2153DFULL,   641,  212 },
+    { 0xE2A0B5DC971F303AULL,   667,  220 },
+    { 0xA8D9D1535CE3B396ULL,   694,  228 },
+    { 0xFB9B7CD9A4A7443CULL,   720,  236 },
+    { 0xBB764C4CA7A44410ULL,   747,  244 },
+    { 0x8BAB8EEFB6409C1AULL,   774,  252 },
+    { 0xD01FEF10A657842CULL,   800,  260 },
+    { 0x9B10A4E5E9913129ULL,   827,  268 },
+    { 0xE7109BFBA19C0C9DULL,   853,  276 },
+    { 0xAC2820D9623BF429ULL,   880,  284 },
+    { 0x80444B5E7AA7CF85ULL,   907,  292 },
+    { 0xBF21E44003ACDD2DULL,   933,  300 },
+    { 0x8E679C2F5E44FF8FULL,   960,  308 },
+    { 0xD433179D9C8CB841ULL,   986,  316 },
+    { 0x9E19DB92B4E31BA9ULL,  1013,  324 },
+};
+
+static DiyFp Sub(const DiyFp& x, const DiyFp& y);
+static DiyFp Mul(const DiyFp& x, const DiyFp& y);
+static DiyFp Normalize(DiyFp x);
+static Boundaries ComputeBoundaries(double value);
+static CachedPower GetCachedPower(int e);
+static int FindLargestPow10(uint32_t n, uint32_t& pow10);
+static void Round(char *buf, int len, uint64_t dist, uint64_t delta, uint64_t rest, uint64_t tenK);
+static void GenerateDigits(char *buf, int& len, int& decimalExponent, DiyFp mMinus, DiyFp w, DiyFp mPlus);
+static int FormatDigits(char *buf, int len, int decimalExponent);
+
+
+int FormatDouble(double x, char *buf)
+{
+    if (!std::isfinite(x))
+        return std::snprintf(buf, FORMAT_DOUBLE_BUFFER_SIZE, "%g", x);
+
+    char *p = buf;
+    if (std::signbit(x)) {
+        *p++ = '-';
+        x = -x;
+    }
+
+    if (x == 0) {
+        *p++ = '0';
+        return int(p - buf);
+    }
+
+    Boundaries b = ComputeBoundaries(x);
+    CachedPower cached = GetCachedPower(b.plus.e);
+    DiyFp c = { cached.f, cached.e };
+
+    DiyFp w = Mul(b.w, c);
+    DiyFp wMinus = Mul(b.minus, c);
+    DiyFp wPlus = Mul(b.plus, c);
+
+    // shrink the interval by one unit to account for the rounding of the products
+    DiyFp mMinus = { wMinus.f + 1, wMinus.e };
+    DiyFp mPlus = { wPlus.f - 1, wPlus.e };
+
+    int len = 0;
+    int decimalExponent = -cached.k;
+    GenerateDigits(p, len, decimalExponent, mMinus, w, mPlus);
+
+    return int(p - buf) + FormatDigits(p, len, decimalExponent);
+}
+
+
+// -- static functions ---------------------------------------------------------
+
+static DiyFp Sub(const DiyFp& x, const DiyFp& y)
+{
+    DiyFp d = { x.f - y.f, x.e };
+    return d;
+}
+
+/* Returns the upper 64 bits of the 128-bit product, rounded */
+static DiyFp Mul(const DiyFp& x, const DiyFp& y)
+{
+    const uint64_t mask = 0xffffffffULL;
+    uint64_t xLo = x.f & mask;
+    uint64_t xHi = x.f >> 32;
+    uint64_t yLo = y.f & mask;
+    uint64_t yHi = y.f >> 32;
+
+    uint64_t p0 = xLo * yLo;
+    uint64_t p1 = xLo * yHi;
+    uint64_t p2 = xHi * yLo;
+    uint64_t p3 = xHi * yHi;
+
+    uint64_t q = (p0 >> 32) + (p1 & mask) + (p2 & mask) + (uint64_t(1) << 31);
+    DiyFp r = { p3 + (p1 >> 32) + (p2 >> 32) + (q >> 32), x.e + y.e + 64 };
+    return r;
+}
+
+static DiyFp Normalize(DiyFp x)
+{
+    while ((x.f >> 63) == 0) {
+        x.f <<= 1;
+        x.e--;
+    }
+    return x;
+}
+
+/* Computes the value and the midpoints to its neighbors, with the upper one
+ * normalized and the lower one at the same exponent */
+static Boundaries ComputeBoundaries(double value)
+{
+    const int bias = 1023 + 52;
+    const uint64_t hiddenBit = uint64_t(1) << 52;
+
+    uint64_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    uint64_t exponentBits = bits >> 52;
+    uint64_t significand = bits & (hiddenBit - 1);
+
+    DiyFp v;
+    if (exponentBits == 0) {
+        v.f = significand;
+        v.e = 1 - bias;
+    } else {
+        v.f = significand + hiddenBit;
+        v.e = int(exponentBits) - bias;
+    }
+
+    // the lower neighbor is closer if the significand is a power of two
+    bool lowerCloser = (significand == 0 && exponentBits > 1);
+
+    DiyFp mPlus = { 2 * v.f + 1, v.e - 1 };
+    DiyFp mMinus;
+    if (lowerCloser) {
+        mMinus.f = 4 * v.f - 1;
+        mMinus.e = v.e - 2;
+    } else {
+        mMinus.f = 2 * v.f - 1;
+        mMinus.e = v.e - 1;
+    }
+
+    Boundaries b;
+    b.w = Normalize(v);
+    b.plus = Normalize(mPlus);
+    b.minus.f = mMinus.f << (mMinus.e - b.plus.e);
+    b.minus.e = b.plus.e;
+    return b;
+}
+
+/* Returns the cached power c such that ALPHA <= c.e + e + 64 <= GAMMA */
+static CachedPower GetCachedPower(int e)
+{
+    // k = ceil((ALPHA - e - 1) * log10(2))
+    int f = ALPHA - e - 1;
+    int k = (f * 78913) / (1 << 18) + (f > 0);
+    int index = (-CACHED_POWERS_MIN_DEC_EXP + k + (CACHED_POWERS_DEC_STEP - 1)) / CACHED_POWERS_DEC_STEP;
+    return CACHED_POWERS[index];
+}
+
+static int FindLargestPow10(uint32_t n, uint32_t& pow10)
+{
+    uint32_t p = 1000000000;
+    int digits = 10;
+    while (p > n && digits > 1) {
+        p /= 10;
+        digits--;
+    }
+    pow10 = p;
+    return digits;
+}
+
+/* Moves the last digit down while the value stays in the interval and gets closer to w */
+static void Round(char *buf, int len, uint64_t dist, uint64_t delta, uint64_t rest, uint64_t tenK)
+{
+    while (rest < dist && delta - rest >= tenK && (rest + tenK < dist || dist - rest > rest + tenK - dist)) {
+        buf[len - 1]--;
+        rest += tenK;
+    }
+}
+
+/* Generates the shortest digit string in (mMinus, mPlus), the first digits
+ * from the integral part and the remaining ones from the fractional part */
+static void GenerateDigits(char *buf, int& len, int& decimalExponent, DiyFp mMinus, DiyFp w, DiyFp mPlus)
+{
+    uint64_t delta = Sub(mPlus, mMinus).f;
+    uint64_t dist = Sub(mPlus, w).f;
+
+    const int shift = -mPlus.e;
+    const uint64_t one = uint64_t(1) << shift;
+
+    uint32_t p1 = uint32_t(mPlus.f >> shift);
+    uint64_t p2 = mPlus.f & (one - 1);
+
+    uint32_t pow10;
+    int n = FindLargestPow10(p1, pow10);
+    while (n > 0) {
+        uint32_t d = p1 / pow10;
+        p1 = p1 % pow10;
+        buf[len++] = char('0' + d);
+        n--;
+        uint64_t rest = (uint64_t(p1) << shift) + p2;
+        if (rest <= delta) {
+            decimalExponent += n;
+            Round(buf, len, dist, delta, rest, uint64_t(pow10) << shift);
+            return;
+        }
+        pow10 /= 10;
+    }
+
+    int m = 0;
+    while (true) {
+        p2 *= 10;
+        buf[len++] = char('0' + (p2 >> shift));
+        p2 &= one - 1;
+        m++;
+        delta *= 10;
+        dist *= 10;
+        if (p2 <= delta)
+            break;
+    }
+    decimalExponent -= m;
+    Round(buf, len, dist, delta, p2, one);
+}
+
+/* Rewrites the digits buf[0..len) * 10^decimalExponent in fixed or exponential
+ * notation, returns the resulting length */
+static int FormatDigits(char *buf, int len, int decimalExponent)
+{
+    const int minExp = -4;
+    const int maxExp = 15;
+
+    // position of the decimal point relative to the first digit
+    int n = len + decimalExponent;
+
+    if (len <= n && n <= maxExp) {
+        // integer, pad with zeros
+        std::memset(buf + len, '0', n - len);
+        return n;
+    }
+
+    if (0 < n && n <= maxExp) {
+        // dd.ddd
+        std::memmove(buf + n + 1, buf + n, len - n);
+        buf[n] = '.';
+        return len + 1;
+    }
+
+    if (minExp < n && n <= 0) {
+        // 0.000ddd
+        std::memmove(buf + 2 - n, buf, len);
+        buf[0] = '0';
+        buf[1] = '.';
+        std::memset(buf + 2, '0', -n);
+        return 2 - n + len;
+    }
+
+    // d.ddde+xx
+    int pos = 1;
+    if (len > 1) {
+        std::memmove(buf + 2, buf + 1, len - 1);
+        buf[1] = '.';
+        pos = len + 1;
+    }
+    int e = n - 1;
+    buf[pos++] = 'e';
+    buf[pos++] = (e < 0) ? '-' : '+';
+    if (e < 0)
+        e = -e;
+    if (e >= 100) {
+        buf[pos++] = char('0' + e / 100);
+        e %= 100;
+        buf[pos++] = char('0' + e / 10);
+    } else {
+        buf[pos++] = char('0' + e / 10);
+    }
+    buf[pos++] = char('0' + e % 10);
+    return pos;
+}
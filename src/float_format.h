@@ -0,0 +1,38 @@
+/*******************************************************************************
+    Copyright (c) 2021, Andrea Maggiordomo, Paolo Cignoni and Marco Tarini
+
+    This file is part of TextureDefrag, a reference implementation for
+    the paper ``Texture Defragmentation for Photo-Reconstructed 3D Models''
+    by Andrea Maggiordomo, Paolo Cignoni and Marco Tarini.
+
+    TextureDefrag is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    TextureDefrag is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with TextureDefrag. If not, see <https://www.gnu.org/licenses/>.
+*******************************************************************************/
+
+
+#ifndef FLOAT_FORMAT_H
+#define FLOAT_FORMAT_H
+
+/* Size of the buffer required by FormatDouble() */
+constexpr int FORMAT_DOUBLE_BUFFER_SIZE = 32;
+
+/* Writes to buf the decimal representation of x that reads back to the same
+ * double, without a terminating null character, and returns its length. The
+ * digits are generated with the Grisu2 algorithm (Loitsch, ``Printing
+ * Floating-Point Numbers Quickly and Accurately with Integers'', 2010), which
+ * yields the shortest representation for almost all values. Values in the range
+ * [1e-4, 1e15) are written in fixed notation, the other ones in exponential notation.
+ * Infinities and NaNs are written as printf("%g") does. */
+int FormatDouble(double x, char *buf);
+
+#endif // FLOAT_FORMAT_H
@@ -25,9 +25,13 @@
 #include <iostream>
 #include <fstream>
 #include <memory>
+#include <atomic>
 
 #include <QImage>
 #include <QFileInfo>
+#include <QString>
+#include <QByteArray>
+#include <QtGlobal>
 
 #include <QOpenGLContext>
 
@@ -48,6 +52,178 @@ OpenGLFunctionsHandle GetOpenGLFunctionsHandle()
     return glFuncs;
 }
 
+bool ParseOpenGLBackend(const std::string& name, OpenGLBackend *backend)
+{
+    QString s = QString::fromStdString(name).toLower();
+    if (s == "auto")
+        *backend = OpenGLBackend::Auto;
+    else if (s == "egl")
+        *backend = OpenGLBackend::EGL;
+    else if (s == "x11" || s == "glx")
+        *backend = OpenGLBackend::X11;
+    else
+        return false;
+    return true;
+}
+
+void SelectOpenGLBackend(OpenGLBackend backend)
+{
+    if (qEnvironmentVariableIsSet("QT_QPA_PLATFORM")) {
+        LOG_VERBOSE << "[GL] Using the platform plugin set by QT_QPA_PLATFORM (" << qgetenv("QT_QPA_PLATFORM").toStdString() << ")";
+        return;
+    }
+    if (backend == OpenGLBackend::Auto)
+        backend = qEnvironmentVariableIsEmpty("DISPLAY") ? OpenGLBackend::EGL : OpenGLBackend::X11;
+
+    if (backend == OpenGLBackend::EGL) {
+        // eglfs without a device integration opens the default EGL display, which is
+        // the GPU device on the Nvidia driver. Mesa needs the surfaceless platform
+        // to run without a window system. The offscreen surfaces are pbuffers
+        qputenv("QT_QPA_PLATFORM", "eglfs");
+        if (!qEnvironmentVariableIsSet("QT_QPA_EGLFS_INTEGRATION"))
+            qputenv("QT_QPA_EGLFS_INTEGRATION", "none");
+        if (!qEnvironmentVariableIsSet("EGL_PLATFORM"))
+            qputenv("EGL_PLATFORM", "surfaceless");
+        LOG_INFO << "[GL] Using the EGL backend";
+    } else {
+        qputenv("QT_QPA_PLATFORM", "xcb");
+        LOG_INFO << "[GL] Using the X11 backend";
+    }
+}
+
+bool HasComputeShaders()
+{
+    QOpenGLContext *context = QOpenGLContext::currentContext();
+    return context && (context->format().version() >= qMakePair(4, 3)
+                       || (context->hasExtension("GL_ARB_compute_shader") && context->hasExtension("GL_ARB_shader_storage_buffer_object")));
+}
+
+bool IsSoftwareRenderer()
+{
+    OpenGLFunctionsHandle glFuncs = GetOpenGLFunctionsHandle();
+    const char *renderer = reinterpret_cast<const char *>(glFuncs->glGetString(GL_RENDERER));
+    if (!renderer)
+        return false;
+    QString s = QString(renderer).toLower();
+    return s.contains("llvmpipe") || s.contains("softpipe") || s.contains("swrast") || s.contains("software rasterizer");
+}
+
+#ifndef GL_GPU_MEMORY_INFO_CURRENT_AVAILABLE_VIDMEM_NVX
+#define GL_GPU_MEMORY_INFO_CURRENT_AVAILABLE_VIDMEM_NVX 0x9049
+#endif
+#ifndef GL_TEXTURE_FREE_MEMORY_ATI
+#define GL_TEXTURE_FREE_MEMORY_ATI 0x87FC
+#endif
+
+bool QueryAvailableGPUMemory(uint64_t *bytes)
+{
+    QOpenGLContext *context = QOpenGLContext::currentContext();
+    if (!context)
+        return false;
+    OpenGLFunctionsHandle glFuncs = GetOpenGLFunctionsHandle();
+    // both report kilobytes, the first value of the ATI query is the total free memory
+    GLint kb[4] = {0, 0, 0, 0};
+    if (context->hasExtension("GL_NVX_gpu_memory_info"))
+        glFuncs->glGetIntegerv(GL_GPU_MEMORY_INFO_CURRENT_AVAILABLE_VIDMEM_NVX, kb);
+    else if (context->hasExtension("GL_ATI_meminfo"))
+        glFuncs->glGetIntegerv(GL_TEXTURE_FREE_MEMORY_ATI, kb);
+    else
+        return false;
+    if (glFuncs->glGetError() != GL_NO_ERROR || kb[0] <= 0)
+        return false;
+    *bytes = uint64_t(kb[0]) * 1024;
+    return true;
+}
+
+#ifndef GL_DEBUG_OUTPUT
+#define GL_DEBUG_OUTPUT 0x92E0
+#endif
+#ifndef GL_DEBUG_OUTPUT_SYNCHRONOUS
+#define GL_DEBUG_OUTPUT_SYNCHRONOUS 0x8242
+#endif
+#ifndef GL_DEBUG_TYPE_ERROR
+#define GL_DEBUG_TYPE_ERROR 0x824C
+#endif
+#ifndef GL_DEBUG_TYPE_PERFORMANCE
+#define GL_DEBUG_TYPE_PERFORMANCE 0x8250
+#endif
+#ifndef GL_DEBUG_SEVERITY_HIGH
+#define GL_DEBUG_SEVERITY_HIGH 0x9146
+#endif
+#ifndef GL_DEBUG_SEVERITY_MEDIUM
+#define GL_DEBUG_SEVERITY_MEDIUM 0x9147
+#endif
+#ifndef GL_DEBUG_SEVERITY_NOTIFICATION
+#define GL_DEBUG_SEVERITY_NOTIFICATION 0x826B
+#endif
+#ifndef GL_COMPUTE_SHADER
+#define GL_COMPUTE_SHADER 0x91B9
+#endif
+#ifndef GL_DONT_CARE
+#define GL_DONT_CARE 0x1100
+#endif
+
+namespace {
+
+typedef void (QOPENGLF_APIENTRY *DebugProc)(GLenum source, GLenum type, GLuint id, GLenum severity,
+                                             GLsizei length, const char *message, const void *userParam);
+typedef void (QOPENGLF_APIENTRYP DebugMessageCallbackProc)(DebugProc callback, const void *userParam);
+typedef void (QOPENGLF_APIENTRYP DebugMessageControlProc)(GLenum source, GLenum type, GLenum severity,
+                                                          GLsizei count, const GLuint *ids, GLboolean enabled);
+
+// a broken loop can raise the same error at every call, the messages after the
+// first ones are only counted
+constexpr int MAX_DEBUG_MESSAGES = 100;
+std::atomic<int> debugMessages(0);
+
+// called by the driver, possibly on a thread of its own
+void QOPENGLF_APIENTRY DebugMessage(GLenum, GLenum type, GLuint id, GLenum severity,
+                                    GLsizei length, const char *message, const void *)
+{
+    int n = debugMessages.fetch_add(1, std::memory_order_relaxed);
+    if (n > MAX_DEBUG_MESSAGES)
+        return;
+    if (n == MAX_DEBUG_MESSAGES) {
+        LOG_WARN << "[OPENGL] Too many debug messages, the next ones are not logged";
+        return;
+    }
+    std::string text = (length >= 0) ? std::string(message, std::size_t(length)) : std::string(message);
+    if (type == GL_DEBUG_TYPE_ERROR)
+        LOG_ERR << "[OPENGL] Error (id " << id << "): " << text;
+    else if (type == GL_DEBUG_TYPE_PERFORMANCE || severity == GL_DEBUG_SEVERITY_HIGH || severity == GL_DEBUG_SEVERITY_MEDIUM)
+        LOG_WARN << "[OPENGL] Debug message (id " << id << "): " << text;
+    else
+        LOG_VERBOSE << "[OPENGL] Debug message (id " << id << "): " << text;
+}
+
+} // namespace
+
+bool EnableGLDebugOutput()
+{
+    QOpenGLContext *context = QOpenGLContext::currentContext();
+    if (!context)
+        return false;
+    if (context->format().version() < qMakePair(4, 3) && !context->hasExtension("GL_KHR_debug")) {
+        LOG_VERBOSE << "[GL] The context has no debug output, the OpenGL errors are not reported";
+        return false;
+    }
+    DebugMessageCallbackProc debugMessageCallback = reinterpret_cast<DebugMessageCallbackProc>(context->getProcAddress("glDebugMessageCallback"));
+    DebugMessageControlProc debugMessageControl = reinterpret_cast<DebugMessageControlProc>(context->getProcAddress("glDebugMessageControl"));
+    if (!debugMessageCallback || !debugMessageControl)
+        return false;
+
+    OpenGLFunctionsHandle glFuncs = GetOpenGLFunctionsHandle();
+    // the notifications (such as the buffer placement hints) are not logged
+    debugMessageControl(GL_DONT_CARE, GL_DONT_CARE, GL_DEBUG_SEVERITY_NOTIFICATION, 0, nullptr, GL_FALSE);
+    debugMessageCallback(DebugMessage, nullptr);
+    glFuncs->glEnable(GL_DEBUG_OUTPUT);
+#ifdef GL_STRICT_ERRORS
+    glFuncs->glEnable(GL_DEBUG_OUTPUT_SYNCHRONOUS);
+#endif
+    LOG_VERBOSE << "[GL] OpenGL errors reported by the debug output";
+    return true;
+}
+
 void CheckGLError(const char* file, int line) {
     OpenGLFunctionsHandle glFuncs = GetOpenGLFunctionsHandle();
     GLenum err;
@@ -67,8 +243,6 @@ void CheckGLError(const char* file, int line) {
     }
 }
 
-#define CHECK_GL_ERROR() CheckGLError(__FILE__, __LINE__)
-
 std::string ReadShader(const char *path)
 {
     std::ifstream sf(path);
@@ -139,4 +313,46 @@ uint32_t CompileShaders(const char **vs_text, const char **fs_text)
     CHECK_GL_ERROR();
 
     return program;
-}
\ No newline at end of file
+}
+
+uint32_t CompileComputeShader(const char **cs_text)
+{
+    OpenGLFunctionsHandle glFuncs = GetOpenGLFunctionsHandle();
+
+    GLint status;
+    char infoLog[1024] = {0};
+
+    GLuint cs = glFuncs->glCreateShader(GL_COMPUTE_SHADER);
+    glFuncs->glShaderSource(cs, 1, cs_text, NULL);
+    glFuncs->glCompileShader(cs);
+    glFuncs->glGetShaderInfoLog(cs, 1024, NULL, infoLog);
+    if (*infoLog) {
+        LOG_DEBUG << infoLog;
+        memset(infoLog, 0, 1024);
+    }
+    glFuncs->glGetShaderiv(cs, GL_COMPILE_STATUS, &status);
+    if (status == GL_FALSE) {
+        LOG_ERR << "Compute shader compilation failed";
+        glFuncs->glDeleteShader(cs);
+        return 0;
+    }
+
+    GLuint program = glFuncs->glCreateProgram();
+    glFuncs->glAttachShader(program, cs);
+    glFuncs->glLinkProgram(program);
+    glFuncs->glGetProgramInfoLog(program, 1024, NULL, infoLog);
+    if (*infoLog) {
+        LOG_DEBUG << infoLog;
+    }
+    glFuncs->glGetProgramiv(program, GL_LINK_STATUS, &status);
+    glFuncs->glDeleteShader(cs);
+    if (status == GL_FALSE) {
+        LOG_ERR << "Compute shader program link failed";
+        glFuncs->glDeleteProgram(program);
+        return 0;
+    }
+
+    CHECK_GL_ERROR();
+
+    return program;
+}
@@ -25,6 +25,7 @@
 #include <vector>
 #include <memory>
 #include <cstdint>
+#include <string>
 
 #include <QOpenGLFunctions_4_1_Core>
 
@@ -33,11 +34,51 @@ using OpenGLFunctionsHandle = OpenGLFunctionsVersion*;
 
 OpenGLFunctionsHandle GetOpenGLFunctionsHandle();
 
+/* Window system used to create the OpenGL contexts */
+enum class OpenGLBackend {
+    Auto,  // EGL if there is no X display, the platform default otherwise
+    EGL,   // EGL without a window system (device or surfaceless platform)
+    X11    // GLX on the X display (e.g. through xvfb-run)
+};
+
+/* Parses a backend name (auto, egl, x11), returns false if the name is not recognized */
+bool ParseOpenGLBackend(const std::string& name, OpenGLBackend *backend);
+
+/* Selects the Qt platform plugin of the backend. Must be called before the
+ * application object is created, and does nothing if QT_QPA_PLATFORM is set */
+void SelectOpenGLBackend(OpenGLBackend backend);
+
+/* Returns true if the current context has compute shaders and shader storage
+ * buffers (OpenGL 4.3, or the ARB extensions) */
+bool HasComputeShaders();
+
+/* Returns true if the current context renders in software (e.g. llvmpipe) */
+bool IsSoftwareRenderer();
+
+/* Stores in *bytes the GPU memory currently free for the current context, as
+ * reported by the GL_NVX_gpu_memory_info (Nvidia) or GL_ATI_meminfo (AMD)
+ * extensions. Returns false if the context supports neither */
+bool QueryAvailableGPUMemory(uint64_t *bytes);
+
+
+/* Logs the errors reported by the driver through the debug output of the current
+ * context (GL_KHR_debug, core in OpenGL 4.3). The messages are delivered
+ * asynchronously, without the synchronization of glGetError, except in strict
+ * builds where they are delivered by the call that raised them. Returns false if
+ * the context has no debug output */
+bool EnableGLDebugOutput();
 
 /* Prints the last OpenGL error code */
 void CheckGLError(const char* file, int line);
-// Add a macro for convenience
+
+// glGetError waits for the driver on many implementations, so the checks after the
+// calls are compiled only in strict builds (qmake GL_STRICT_ERRORS=1, and debug
+// builds), the other builds rely on the debug output
+#ifdef GL_STRICT_ERRORS
 #define CHECK_GL_ERROR() CheckGLError(__FILE__, __LINE__)
+#else
+#define CHECK_GL_ERROR() ((void) 0)
+#endif
 
 /* Reads a shader from path into a string and returns it */
 std::string ReadShader(const char *path);
@@ -45,5 +86,9 @@ std::string ReadShader(const char *path);
 /* Compiles a vertex shader source and a fragment shader source into a program */
 uint32_t CompileShaders(const char **vs_text, const char **fs_text);
 
+/* Compiles a compute shader source into a program (OpenGL 4.3), returns 0 if the
+ * compilation or the link fails */
+uint32_t CompileComputeShader(const char **cs_text);
+
 
 #endif // GL_UTIL_H
\ No newline at end of file
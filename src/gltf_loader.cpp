@@ -0,0 +1,1066 @@
+/*******************************************************************************
+    Copyright (c) 2021, Andrea Maggiordomo, Paolo Cignoni and Marco Tarini
+
+    This file is part of TextureDefrag, a reference implementation for
+    the paper ``Texture Defragmentation for Photo-Reconstructed 3D Models''
+    by Andrea Maggiordomo, Paolo Cignoni and Marco Tarini.
+
+    TextureDefrag is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    TextureDefrag is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with TextureDefrag. If not, see <https://www.gnu.org/licenses/>.
+*******************************************************************************/
+
+
+#include "gltf_loader.h"
+#include "mesh.h"
+#include "timer.h"
+#include "logging.h"
+
+#include <wrap/io_trimesh/io_mask.h>
+
+#include <vector>
+#include <string>
+#include <array>
+#include <map>
+#include <memory>
+#include <algorithm>
+#include <cstring>
+#include <cstdint>
+#include <cmath>
+
+#include <omp.h>
+
+#include <QFile>
+#include <QFileInfo>
+#include <QByteArray>
+#include <QString>
+#include <QUrl>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QJsonArray>
+#include <QJsonValue>
+
+
+static const uint32_t GLB_MAGIC = 0x46546c67;      // "glTF"
+static const uint32_t GLB_CHUNK_JSON = 0x4e4f534a; // "JSON"
+static const uint32_t GLB_CHUNK_BIN = 0x004e4942;  // "BIN\0"
+
+enum GLTFComponentType {
+    GLTF_BYTE = 5120,
+    GLTF_UNSIGNED_BYTE = 5121,
+    GLTF_SHORT = 5122,
+    GLTF_UNSIGNED_SHORT = 5123,
+    GLTF_UNSIGNED_INT = 5125,
+    GLTF_FLOAT = 5126
+};
+
+enum GLTFPrimitiveMode {
+    GLTF_TRIANGLES = 4,
+    GLTF_TRIANGLE_STRIP = 5,
+    GLTF_TRIANGLE_FAN = 6
+};
+
+/* maximum depth of the node hierarchy, deeper nodes are assumed to be part of a cycle */
+static const int MAX_NODE_DEPTH = 256;
+
+// column-major 4x4 matrix, as in glTF
+typedef std::array<double, 16> GLTFMatrix;
+
+struct GLTFBuffer {
+    const unsigned char *data = nullptr;
+    uint64_t size = 0;
+    QByteArray bytes;             // contents of a data uri
+    std::shared_ptr<QFile> file;  // mapped file
+};
+
+/* A buffer view. The views compressed with meshoptimizer are decoded before the
+ * accessors are resolved, and only if an accessor of a loaded primitive uses them */
+struct GLTFBufferView {
+    const unsigned char *data = nullptr;
+    uint64_t length = 0;
+    int stride = 0;
+
+    bool compressed = false;
+    bool needed = false;
+    const unsigned char *source = nullptr;
+    uint64_t sourceLength = 0;
+    int count = 0;
+    int elementSize = 0;
+    std::string mode;
+    std::string filter;
+    std::vector<unsigned char> decoded;
+};
+
+struct GLTFAccessor {
+    const unsigned char *data = nullptr;
+    int stride = 0;
+    int componentType = 0;
+    int components = 0;
+    bool normalized = false;
+    int count = 0;
+};
+
+struct GLTFPrimitive {
+    int positionsAccessor = -1;
+    int texCoordsAccessor = -1;
+    int indicesAccessor = -1;
+    int mode = GLTF_TRIANGLES;
+    int texture = 0;            // index in m.textures
+    GLTFMatrix matrix;          // transform of the node
+    bool flip = false;          // the transform mirrors the triangles
+    double uvTransform[6];      // rows of the 2x3 affine transform of the texture coordinates
+
+    GLTFAccessor positions;
+    GLTFAccessor texCoords;
+    GLTFAccessor indices;
+    int numTriangles = 0;
+    int vertexOffset = 0;
+    int faceOffset = 0;
+};
+
+struct GLTFContext {
+    std::string fileName;
+    QString baseDir;
+    QJsonObject root;
+    std::vector<GLTFBuffer> buffers;
+    std::vector<GLTFBufferView> views;
+    std::vector<GLTFPrimitive> primitives;
+    std::map<int, int> imageTexture; // index in m.textures of the images
+    int skipped = 0;                 // primitives without a base color texture
+};
+
+static bool ReadGLTFFile(const char *fileName, GLTFContext& ctx, std::shared_ptr<QFile>& glbFile, const unsigned char *& glbBin, uint64_t& glbBinSize);
+static bool LoadBuffers(GLTFContext& ctx, const unsigned char *glbBin, uint64_t glbBinSize);
+static bool LoadBufferViews(GLTFContext& ctx);
+static bool CollectPrimitives(GLTFContext& ctx, Mesh& m);
+static void CollectNode(GLTFContext& ctx, int node, const GLTFMatrix& parent, int depth, std::vector<std::pair<int, GLTFMatrix>>& instances);
+static bool AddPrimitive(GLTFContext& ctx, const QJsonObject& primitive, const GLTFMatrix& matrix, Mesh& m);
+static bool TextureImage(GLTFContext& ctx, int texture, std::string& name);
+static bool AccessorView(GLTFContext& ctx, int accessor, int *view);
+static bool ResolveAccessor(GLTFContext& ctx, int index, GLTFAccessor& acc);
+static bool DecodeView(GLTFBufferView& view);
+static GLTFMatrix NodeMatrix(const QJsonObject& node);
+static GLTFMatrix MultiplyMatrices(const GLTFMatrix& a, const GLTFMatrix& b);
+static int ComponentSize(int componentType);
+static inline double ReadComponent(const unsigned char *p, int componentType, bool normalized);
+static inline uint32_t ReadIndex(const GLTFAccessor& acc, int i);
+static bool DecodeMeshoptVertexBuffer(unsigned char *dst, std::size_t count, std::size_t size, const unsigned char *src, std::size_t srcSize);
+static bool DecodeMeshoptIndexBuffer(unsigned char *dst, std::size_t count, std::size_t size, const unsigned char *src, std::size_t srcSize);
+static bool DecodeMeshoptIndexSequence(unsigned char *dst, std::size_t count, std::size_t size, const unsigned char *src, std::size_t srcSize);
+static void DecodeMeshoptExponentialFilter(unsigned char *data, std::size_t count);
+
+
+bool LoadGLTF(const char *fileName, Mesh& m, int& loadMask)
+{
+    Timer t;
+
+    m.Clear();
+    m.textures.clear();
+    loadMask = 0;
+
+    GLTFContext ctx;
+    ctx.fileName = fileName;
+    ctx.baseDir = QFileInfo(fileName).absolutePath();
+
+    std::shared_ptr<QFile> glbFile;
+    const unsigned char *glbBin = nullptr;
+    uint64_t glbBinSize = 0;
+    if (!ReadGLTFFile(fileName, ctx, glbFile, glbBin, glbBinSize))
+        return false;
+
+    // the extensions that change the geometry or the texture coordinates must be known
+    for (const QJsonValue& ext : ctx.root.value("extensionsRequired").toArray()) {
+        QString name = ext.toString();
+        if (name == "KHR_draco_mesh_compression") {
+            LOG_ERR << "Error: " << fileName << " requires Draco mesh compression, which is not supported (decompress it or use meshoptimizer compression)";
+            return false;
+        }
+        if (name != "EXT_meshopt_compression" && name != "KHR_meshopt_compression" && name != "KHR_mesh_quantization"
+                && name != "KHR_texture_transform" && !name.startsWith("KHR_materials_") && !name.startsWith("KHR_texture_basisu")
+                && name != "EXT_texture_webp")
+            LOG_WARN << fileName << " requires the unsupported glTF extension " << name.toStdString() << ", ignored";
+    }
+
+    if (!LoadBuffers(ctx, glbBin, glbBinSize) || !LoadBufferViews(ctx) || !CollectPrimitives(ctx, m)) {
+        m.Clear();
+        m.textures.clear();
+        return false;
+    }
+
+    if (ctx.skipped > 0)
+        LOG_WARN << "Skipped " << ctx.skipped << " primitives of " << fileName << " without a base color texture or its texture coordinates";
+    if (ctx.primitives.empty()) {
+        LOG_ERR << "Error: " << fileName << " has no textured triangles";
+        return false;
+    }
+
+    // the compressed views are independent, each is decoded by one thread
+    std::vector<int> compressed;
+    for (unsigned i = 0; i < ctx.views.size(); ++i)
+        if (ctx.views[i].compressed && ctx.views[i].needed)
+            compressed.push_back(i);
+    std::vector<char> decoded(compressed.size(), 0);
+    #pragma omp parallel for schedule(dynamic, 1)
+    for (int i = 0; i < (int) compressed.size(); ++i)
+        decoded[i] = DecodeView(ctx.views[compressed[i]]);
+    for (unsigned i = 0; i < compressed.size(); ++i) {
+        if (!decoded[i]) {
+            LOG_ERR << "Error: Unable to decode the compressed buffer view " << compressed[i] << " of " << fileName;
+            m.textures.clear();
+            return false;
+        }
+    }
+
+    int numVertices = 0;
+    int numTriangles = 0;
+    for (GLTFPrimitive& p : ctx.primitives) {
+        bool ok = ResolveAccessor(ctx, p.positionsAccessor, p.positions) && ResolveAccessor(ctx, p.texCoordsAccessor, p.texCoords)
+                && (p.indicesAccessor < 0 || ResolveAccessor(ctx, p.indicesAccessor, p.indices));
+        if (ok && (p.positions.components != 3 || p.texCoords.components != 2 || p.texCoords.count != p.positions.count
+                   || (p.indicesAccessor >= 0 && (p.indices.components != 1 || p.indices.componentType == GLTF_FLOAT)))) {
+            LOG_ERR << "Error: Invalid accessors of a primitive of " << fileName;
+            ok = false;
+        }
+        if (!ok) {
+            m.textures.clear();
+            return false;
+        }
+        int n = (p.indicesAccessor >= 0) ? p.indices.count : p.positions.count;
+        p.numTriangles = (p.mode == GLTF_TRIANGLES) ? n / 3 : std::max(0, n - 2);
+        p.vertexOffset = numVertices;
+        p.faceOffset = numTriangles;
+        numVertices += p.positions.count;
+        numTriangles += p.numTriangles;
+    }
+
+    tri::Allocator<Mesh>::AddVertices(m, numVertices);
+    tri::Allocator<Mesh>::AddFaces(m, numTriangles);
+
+    // the primitives are converted one at a time, each in parallel over its elements
+    bool invalidIndex = false;
+    for (const GLTFPrimitive& p : ctx.primitives) {
+        const GLTFMatrix& M = p.matrix;
+
+        #pragma omp parallel for
+        for (int i = 0; i < p.positions.count; ++i) {
+            const unsigned char *e = p.positions.data + std::size_t(i) * p.positions.stride;
+            const int cs = ComponentSize(p.positions.componentType);
+            double x = ReadComponent(e, p.positions.componentType, p.positions.normalized);
+            double y = ReadComponent(e + cs, p.positions.componentType, p.positions.normalized);
+            double z = ReadComponent(e + 2 * cs, p.positions.componentType, p.positions.normalized);
+            MeshVertex& v = m.vert[p.vertexOffset + i];
+            v.P() = Point3d(M[0] * x + M[4] * y + M[8] * z + M[12],
+                            M[1] * x + M[5] * y + M[9] * z + M[13],
+                            M[2] * x + M[6] * y + M[10] * z + M[14]);
+        }
+
+        bool invalid = false;
+        #pragma omp parallel for reduction(||:invalid)
+        for (int i = 0; i < p.numTriangles; ++i) {
+            int corner[3];
+            if (p.mode == GLTF_TRIANGLES) {
+                corner[0] = 3 * i; corner[1] = 3 * i + 1; corner[2] = 3 * i + 2;
+            } else if (p.mode == GLTF_TRIANGLE_STRIP) {
+                corner[0] = i; corner[1] = i + 1 + (i % 2); corner[2] = i + 2 - (i % 2);
+            } else {
+                corner[0] = i + 1; corner[1] = i + 2; corner[2] = 0;
+            }
+            if (p.flip)
+                std::swap(corner[1], corner[2]);
+
+            MeshFace& f = m.face[p.faceOffset + i];
+            for (int j = 0; j < 3; ++j) {
+                uint32_t vi = (p.indicesAccessor >= 0) ? ReadIndex(p.indices, corner[j]) : uint32_t(corner[j]);
+                if (vi >= uint32_t(p.positions.count)) {
+                    invalid = true;
+                    vi = 0;
+                }
+                f.V(j) = &m.vert[p.vertexOffset + vi];
+                const unsigned char *e = p.texCoords.data + std::size_t(vi) * p.texCoords.stride;
+                const int cs = ComponentSize(p.texCoords.componentType);
+                double u = ReadComponent(e, p.texCoords.componentType, p.texCoords.normalized);
+                double v = ReadComponent(e + cs, p.texCoords.componentType, p.texCoords.normalized);
+                const double *T = p.uvTransform;
+                // glTF images have the origin at the top left corner
+                f.WT(j).u() = T[0] * u + T[1] * v + T[2];
+                f.WT(j).v() = 1.0 - (T[3] * u + T[4] * v + T[5]);
+                f.WT(j).n() = p.texture;
+            }
+            f.N().Import(TriangleNormal(f).Normalize());
+        }
+        invalidIndex = invalidIndex || invalid;
+    }
+
+    if (invalidIndex) {
+        LOG_ERR << "Error: " << fileName << " has indices out of the range of the vertices";
+        m.Clear();
+        m.textures.clear();
+        return false;
+    }
+
+    loadMask = tri::io::Mask::IOM_VERTCOORD | tri::io::Mask::IOM_FACEINDEX | tri::io::Mask::IOM_WEDGTEXCOORD;
+
+    LOG_VERBOSE << "Loaded " << fileName << " (" << ctx.primitives.size() << " primitives, " << compressed.size()
+                << " compressed buffer views) in " << t.TimeElapsed() << " seconds";
+
+    return true;
+}
+
+
+// -- static functions ---------------------------------------------------------
+
+/* Reads the json of the file, and the binary chunk of a glb file which stays mapped
+ * while glbFile exists */
+static bool ReadGLTFFile(const char *fileName, GLTFContext& ctx, std::shared_ptr<QFile>& glbFile, const unsigned char *& glbBin, uint64_t& glbBinSize)
+{
+    std::shared_ptr<QFile> file = std::make_shared<QFile>(fileName);
+    if (!file->open(QIODevice::ReadOnly)) {
+        LOG_ERR << "Error: Unable to open " << fileName;
+        return false;
+    }
+
+    QByteArray json;
+    uint32_t magic = 0;
+    if (file->peek((char *) &magic, sizeof(magic)) == sizeof(magic) && magic == GLB_MAGIC) {
+        const uint64_t size = file->size();
+        const unsigned char *data = file->map(0, size);
+        if (!data || size < 20) {
+            LOG_ERR << "Error: Unable to read " << fileName;
+            return false;
+        }
+        uint32_t header[3];
+        std::memcpy(header, data, sizeof(header));
+        if (header[1] != 2 || header[2] > size) {
+            LOG_ERR << "Error: " << fileName << " is not a glTF 2.0 binary file";
+            return false;
+        }
+        // the json chunk comes first, followed by the optional binary chunk
+        uint64_t offset = 12;
+        while (offset + 8 <= header[2]) {
+            uint32_t chunk[2];
+            std::memcpy(chunk, data + offset, sizeof(chunk));
+            if (offset + 8 + chunk[0] > header[2]) {
+                LOG_ERR << "Error: Truncated chunk in " << fileName;
+                return false;
+            }
+            if (chunk[1] == GLB_CHUNK_JSON && json.isEmpty())
+                json = QByteArray((const char *) data + offset + 8, chunk[0]);
+            else if (chunk[1] == GLB_CHUNK_BIN && !glbBin) {
+                glbBin = data + offset + 8;
+                glbBinSize = chunk[0];
+            }
+            offset += 8 + ((uint64_t(chunk[0]) + 3) & ~uint64_t(3));
+        }
+        glbFile = file;
+    } else {
+        json = file->readAll();
+    }
+
+    QJsonParseError error;
+    QJsonDocument doc = QJsonDocument::fromJson(json, &error);
+    if (!doc.isObject()) {
+        LOG_ERR << "Error: Unable to parse the json of " << fileName << ": " << error.errorString().toStdString();
+        return false;
+    }
+    ctx.root = doc.object();
+    if (!ctx.root.value("asset").toObject().value("version").toString().startsWith("2.")) {
+        LOG_ERR << "Error: " << fileName << " is not a glTF 2.0 file";
+        return false;
+    }
+    return true;
+}
+
+static bool LoadBuffers(GLTFContext& ctx, const unsigned char *glbBin, uint64_t glbBinSize)
+{
+    QJsonArray buffers = ctx.root.value("buffers").toArray();
+    ctx.buffers.resize(buffers.size());
+    for (int i = 0; i < buffers.size(); ++i) {
+        QJsonObject b = buffers[i].toObject();
+        GLTFBuffer& buffer = ctx.buffers[i];
+        uint64_t byteLength = (uint64_t) b.value("byteLength").toDouble(0);
+        if (!b.contains("uri")) {
+            // the binary chunk of a glb file, or the fallback buffer of meshoptimizer
+            // compressed views that has no data
+            if (i == 0 && glbBin) {
+                buffer.data = glbBin;
+                buffer.size = glbBinSize;
+            }
+        } else {
+            QString uri = b.value("uri").toString();
+            if (uri.startsWith("data:")) {
+                int comma = uri.indexOf(',');
+                if (comma < 0 || !uri.left(comma).endsWith(";base64")) {
+                    LOG_ERR << "Error: Unsupported data uri of buffer " << i << " of " << ctx.fileName;
+                    return false;
+                }
+                buffer.bytes = QByteArray::fromBase64(uri.mid(comma + 1).toLatin1());
+                buffer.data = (const unsigned char *) buffer.bytes.constData();
+                buffer.size = buffer.bytes.size();
+            } else {
+                QString path = ctx.baseDir + "/" + QUrl::fromPercentEncoding(uri.toUtf8());
+                buffer.file = std::make_shared<QFile>(path);
+                if (!buffer.file->open(QIODevice::ReadOnly) || !(buffer.data = buffer.file->map(0, buffer.file->size()))) {
+                    LOG_ERR << "Error: Unable to read the buffer " << path.toStdString() << " of " << ctx.fileName;
+                    return false;
+                }
+                buffer.size = buffer.file->size();
+            }
+        }
+        if (buffer.data && buffer.size < byteLength) {
+            LOG_ERR << "Error: Buffer " << i << " of " << ctx.fileName << " is shorter than its byteLength";
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool LoadBufferViews(GLTFContext& ctx)
+{
+    QJsonArray views = ctx.root.value("bufferViews").toArray();
+    ctx.views.resize(views.size());
+    for (int i = 0; i < views.size(); ++i) {
+        QJsonObject v = views[i].toObject();
+        GLTFBufferView& view = ctx.views[i];
+        view.length = (uint64_t) v.value("byteLength").toDouble(0);
+        view.stride = v.value("byteStride").toInt(0);
+
+        QJsonObject extensions = v.value("extensions").toObject();
+        QJsonObject meshopt = extensions.value("KHR_meshopt_compression").toObject();
+        if (meshopt.isEmpty())
+            meshopt = extensions.value("EXT_meshopt_compression").toObject();
+        if (!meshopt.isEmpty()) {
+            int b = meshopt.value("buffer").toInt(-1);
+            uint64_t offset = (uint64_t) meshopt.value("byteOffset").toDouble(0);
+            view.sourceLength = (uint64_t) meshopt.value("byteLength").toDouble(0);
+            if (b < 0 || b >= (int) ctx.buffers.size() || !ctx.buffers[b].data || offset + view.sourceLength > ctx.buffers[b].size) {
+                LOG_ERR << "Error: Invalid compressed buffer view " << i << " of " << ctx.fileName;
+                return false;
+            }
+            view.compressed = true;
+            view.source = ctx.buffers[b].data + offset;
+            view.count = meshopt.value("count").toInt(0);
+            view.elementSize = meshopt.value("byteStride").toInt(0);
+            view.mode = meshopt.value("mode").toString().toStdString();
+            view.filter = meshopt.value("filter").toString("NONE").toStdString();
+            view.length = uint64_t(view.count) * view.elementSize;
+            continue;
+        }
+
+        int b = v.value("buffer").toInt(-1);
+        uint64_t offset = (uint64_t) v.value("byteOffset").toDouble(0);
+        // the views of the fallback buffers of compressed views have no data
+        if (b >= 0 && b < (int) ctx.buffers.size() && ctx.buffers[b].data) {
+            if (offset + view.length > ctx.buffers[b].size) {
+                LOG_ERR << "Error: Buffer view " << i << " of " << ctx.fileName << " exceeds its buffer";
+                return false;
+            }
+            view.data = ctx.buffers[b].data + offset;
+        }
+    }
+    return true;
+}
+
+/* Collects the primitives of the meshes instanced by the nodes of the scene, and the
+ * textures of their materials */
+static bool CollectPrimitives(GLTFContext& ctx, Mesh& m)
+{
+    QJsonArray scenes = ctx.root.value("scenes").toArray();
+    QJsonArray meshes = ctx.root.value("meshes").toArray();
+
+    GLTFMatrix identity = {1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1};
+    std::vector<std::pair<int, GLTFMatrix>> instances;
+    if (scenes.isEmpty()) {
+        // without scenes, each mesh is loaded once in its own coordinates
+        for (int i = 0; i < meshes.size(); ++i)
+            instances.push_back(std::make_pair(i, identity));
+    } else {
+        int scene = ctx.root.value("scene").toInt(0);
+        if (scene < 0 || scene >= scenes.size()) {
+            LOG_ERR << "Error: Invalid scene index in " << ctx.fileName;
+            return false;
+        }
+        for (const QJsonValue& node : scenes[scene].toObject().value("nodes").toArray())
+            CollectNode(ctx, node.toInt(-1), identity, 0, instances);
+    }
+
+    for (const auto& instance : instances) {
+        if (instance.first < 0 || instance.first >= meshes.size()) {
+            LOG_ERR << "Error: Invalid mesh index in " << ctx.fileName;
+            return false;
+        }
+        for (const QJsonValue& primitive : meshes[instance.first].toObject().value("primitives").toArray())
+            if (!AddPrimitive(ctx, primitive.toObject(), instance.second, m))
+                return false;
+    }
+    return true;
+}
+
+static void CollectNode(GLTFContext& ctx, int node, const GLTFMatrix& parent, int depth, std::vector<std::pair<int, GLTFMatrix>>& instances)
+{
+    QJsonArray nodes = ctx.root.value("nodes").toArray();
+    if (node < 0 || node >= nodes.size() || depth > MAX_NODE_DEPTH) {
+        LOG_WARN << "Ignoring an invalid node of " << ctx.fileName;
+        return;
+    }
+    QJsonObject n = nodes[node].toObject();
+    GLTFMatrix matrix = MultiplyMatrices(parent, NodeMatrix(n));
+    if (n.contains("mesh"))
+        instances.push_back(std::make_pair(n.value("mesh").toInt(-1), matrix));
+    for (const QJsonValue& child : n.value("children").toArray())
+        CollectNode(ctx, child.toInt(-1), matrix, depth + 1, instances);
+}
+
+static bool AddPrimitive(GLTFContext& ctx, const QJsonObject& primitive, const GLTFMatrix& matrix, Mesh& m)
+{
+    int mode = primitive.value("mode").toInt(GLTF_TRIANGLES);
+    if (mode != GLTF_TRIANGLES && mode != GLTF_TRIANGLE_STRIP && mode != GLTF_TRIANGLE_FAN)
+        return true;
+
+    // the accessors of Draco compressed primitives only have data with an uncompressed fallback
+    QJsonObject attributes = primitive.value("attributes").toObject();
+    if (primitive.value("extensions").toObject().contains("KHR_draco_mesh_compression")) {
+        int positions = attributes.value("POSITION").toInt(-1);
+        QJsonArray accessors = ctx.root.value("accessors").toArray();
+        if (positions < 0 || positions >= accessors.size() || !accessors[positions].toObject().contains("bufferView")) {
+            LOG_ERR << "Error: " << ctx.fileName << " has Draco compressed primitives, which are not supported (decompress it or use meshoptimizer compression)";
+            return false;
+        }
+    }
+    if (!attributes.contains("POSITION"))
+        return true;
+
+    QJsonArray materials = ctx.root.value("materials").toArray();
+    int material = primitive.value("material").toInt(-1);
+    QJsonObject baseColor = (material >= 0 && material < materials.size())
+            ? materials[material].toObject().value("pbrMetallicRoughness").toObject().value("baseColorTexture").toObject()
+            : QJsonObject();
+    QJsonObject transform = baseColor.value("extensions").toObject().value("KHR_texture_transform").toObject();
+    int texCoord = transform.value("texCoord").toInt(baseColor.value("texCoord").toInt(0));
+    QString texCoordName = QString("TEXCOORD_") + QString::number(texCoord);
+    if (baseColor.isEmpty() || !attributes.contains(texCoordName)) {
+        ctx.skipped++;
+        return true;
+    }
+
+    GLTFPrimitive p;
+    p.mode = mode;
+    p.matrix = matrix;
+    p.positionsAccessor = attributes.value("POSITION").toInt(-1);
+    p.texCoordsAccessor = attributes.value(texCoordName).toInt(-1);
+    p.indicesAccessor = primitive.value("indices").toInt(-1);
+
+    const GLTFMatrix& M = matrix;
+    double det = M[0] * (M[5] * M[10] - M[9] * M[6]) - M[4] * (M[1] * M[10] - M[9] * M[2]) + M[8] * (M[1] * M[6] - M[5] * M[2]);
+    p.flip = (det < 0);
+
+    // uv' = T * R * S * uv
+    QJsonArray offset = transform.value("offset").toArray();
+    QJsonArray scale = transform.value("scale").toArray();
+    double rotation = transform.value("rotation").toDouble(0);
+    double sx = scale.size() == 2 ? scale[0].toDouble() : 1.0;
+    double sy = scale.size() == 2 ? scale[1].toDouble() : 1.0;
+    double c = std::cos(rotation);
+    double s = std::sin(rotation);
+    double T[6] = { c * sx, s * sy, offset.size() == 2 ? offset[0].toDouble() : 0.0,
+                   -s * sx, c * sy, offset.size() == 2 ? offset[1].toDouble() : 0.0 };
+    std::copy(T, T + 6, p.uvTransform);
+
+    int image;
+    std::string name;
+    QJsonArray textures = ctx.root.value("textures").toArray();
+    int texture = baseColor.value("index").toInt(-1);
+    if (texture < 0 || texture >= textures.size()) {
+        LOG_ERR << "Error: Invalid texture index in " << ctx.fileName;
+        return false;
+    }
+    QJsonObject t = textures[texture].toObject();
+    image = t.value("source").toInt(-1);
+    // the images of the texture extensions replace the source
+    for (const QJsonValue& ext : t.value("extensions").toObject())
+        if (image < 0)
+            image = ext.toObject().value("source").toInt(-1);
+    if (!TextureImage(ctx, image, name))
+        return false;
+    auto it = ctx.imageTexture.find(image);
+    if (it == ctx.imageTexture.end()) {
+        it = ctx.imageTexture.insert(std::make_pair(image, (int) m.textures.size())).first;
+        m.textures.push_back(name);
+    }
+    p.texture = it->second;
+
+    for (int a : {p.positionsAccessor, p.texCoordsAccessor, p.indicesAccessor}) {
+        int view;
+        if (a < 0 && a == p.indicesAccessor)
+            continue;
+        if (!AccessorView(ctx, a, &view))
+            return false;
+        ctx.views[view].needed = true;
+    }
+
+    ctx.primitives.push_back(p);
+    return true;
+}
+
+/* Returns the name of the image file, the images embedded in the buffers are not supported */
+static bool TextureImage(GLTFContext& ctx, int image, std::string& name)
+{
+    QJsonArray images = ctx.root.value("images").toArray();
+    if (image < 0 || image >= images.size()) {
+        LOG_ERR << "Error: Invalid image index in " << ctx.fileName;
+        return false;
+    }
+    QString uri = images[image].toObject().value("uri").toString();
+    if (uri.isEmpty() || uri.startsWith("data:")) {
+        LOG_ERR << "Error: The images embedded in " << ctx.fileName << " are not supported, the textures must be separate files";
+        return false;
+    }
+    name = QUrl::fromPercentEncoding(uri.toUtf8()).toStdString();
+    return true;
+}
+
+static bool AccessorView(GLTFContext& ctx, int accessor, int *view)
+{
+    QJsonArray accessors = ctx.root.value("accessors").toArray();
+    if (accessor < 0 || accessor >= accessors.size()) {
+        LOG_ERR << "Error: Invalid accessor index in " << ctx.fileName;
+        return false;
+    }
+    QJsonObject a = accessors[accessor].toObject();
+    *view = a.value("bufferView").toInt(-1);
+    if (a.contains("sparse") || *view < 0 || *view >= (int) ctx.views.size()) {
+        LOG_ERR << "Error: Sparse accessors and accessors without a buffer view are not supported (" << ctx.fileName << ")";
+        return false;
+    }
+    return true;
+}
+
+static bool ResolveAccessor(GLTFContext& ctx, int index, GLTFAccessor& acc)
+{
+    int viewIndex;
+    if (!AccessorView(ctx, index, &viewIndex))
+        return false;
+    QJsonObject a = ctx.root.value("accessors").toArray()[index].toObject();
+    const GLTFBufferView& view = ctx.views[viewIndex];
+
+    static const std::map<QString, int> componentCount = { {"SCALAR", 1}, {"VEC2", 2}, {"VEC3", 3}, {"VEC4", 4} };
+    auto it = componentCount.find(a.value("type").toString());
+    acc.componentType = a.value("componentType").toInt(0);
+    acc.components = (it != componentCount.end()) ? it->second : 0;
+    acc.normalized = a.value("normalized").toBool(false);
+    acc.count = a.value("count").toInt(0);
+    uint64_t offset = (uint64_t) a.value("byteOffset").toDouble(0);
+    int elementSize = ComponentSize(acc.componentType) * acc.components;
+    acc.stride = (view.stride > 0) ? view.stride : elementSize;
+    if (elementSize == 0 || !view.data || acc.count < 0
+            || (acc.count > 0 && offset + uint64_t(acc.count - 1) * acc.stride + elementSize > view.length)) {
+        LOG_ERR << "Error: Invalid accessor " << index << " of " << ctx.fileName;
+        return false;
+    }
+    acc.data = view.data + offset;
+    return true;
+}
+
+static bool DecodeView(GLTFBufferView& view)
+{
+    if (view.count <= 0 || view.elementSize <= 0)
+        return false;
+    view.decoded.resize(uint64_t(view.count) * view.elementSize);
+    bool ok = false;
+    if (view.mode == "ATTRIBUTES") {
+        ok = (view.elementSize % 4 == 0) && view.elementSize <= 256
+                && DecodeMeshoptVertexBuffer(view.decoded.data(), view.count, view.elementSize, view.source, view.sourceLength);
+        if (ok && view.filter == "EXPONENTIAL")
+            DecodeMeshoptExponentialFilter(view.decoded.data(), view.decoded.size() / 4);
+        // the octahedral and quaternion filters are only used for normals, tangents and rotations
+        else if (ok && view.filter != "NONE")
+            ok = false;
+    } else if (view.mode == "TRIANGLES") {
+        ok = (view.elementSize == 2 || view.elementSize == 4) && view.count % 3 == 0
+                && DecodeMeshoptIndexBuffer(view.decoded.data(), view.count, view.elementSize, view.source, view.sourceLength);
+    } else if (view.mode == "INDICES") {
+        ok = (view.elementSize == 2 || view.elementSize == 4)
+                && DecodeMeshoptIndexSequence(view.decoded.data(), view.count, view.elementSize, view.source, view.sourceLength);
+    }
+    view.data = view.decoded.data();
+    view.stride = view.elementSize;
+    return ok;
+}
+
+static GLTFMatrix NodeMatrix(const QJsonObject& node)
+{
+    GLTFMatrix M = {1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1};
+    QJsonArray matrix = node.value("matrix").toArray();
+    if (matrix.size() == 16) {
+        for (int i = 0; i < 16; ++i)
+            M[i] = matrix[i].toDouble();
+        return M;
+    }
+
+    // M = T * R * S
+    QJsonArray t = node.value("translation").toArray();
+    QJsonArray r = node.value("rotation").toArray();
+    QJsonArray s = node.value("scale").toArray();
+    double x = 0, y = 0, z = 0, w = 1;
+    if (r.size() == 4) {
+        x = r[0].toDouble(); y = r[1].toDouble(); z = r[2].toDouble(); w = r[3].toDouble();
+    }
+    const double R[3][3] = {
+        {1 - 2 * (y * y + z * z), 2 * (x * y - z * w), 2 * (x * z + y * w)},
+        {2 * (x * y + z * w), 1 - 2 * (x * x + z * z), 2 * (y * z - x * w)},
+        {2 * (x * z - y * w), 2 * (y * z + x * w), 1 - 2 * (x * x + y * y)}
+    };
+    for (int col = 0; col < 3; ++col) {
+        double sc = (s.size() == 3) ? s[col].toDouble() : 1.0;
+        for (int row = 0; row < 3; ++row)
+            M[4 * col + row] = R[row][col] * sc;
+    }
+    if (t.size() == 3)
+        for (int row = 0; row < 3; ++row)
+            M[12 + row] = t[row].toDouble();
+    return M;
+}
+
+static GLTFMatrix MultiplyMatrices(const GLTFMatrix& a, const GLTFMatrix& b)
+{
+    GLTFMatrix c;
+    for (int col = 0; col < 4; ++col)
+        for (int row = 0; row < 4; ++row) {
+            double sum = 0;
+            for (int k = 0; k < 4; ++k)
+                sum += a[4 * k + row] * b[4 * col + k];
+            c[4 * col + row] = sum;
+        }
+    return c;
+}
+
+static int ComponentSize(int componentType)
+{
+    switch (componentType) {
+    case GLTF_BYTE:
+    case GLTF_UNSIGNED_BYTE: return 1;
+    case GLTF_SHORT:
+    case GLTF_UNSIGNED_SHORT: return 2;
+    case GLTF_UNSIGNED_INT:
+    case GLTF_FLOAT: return 4;
+    default: return 0;
+    }
+}
+
+// the normalized integers are converted as in the glTF specification
+static inline double ReadComponent(const unsigned char *p, int componentType, bool normalized)
+{
+    switch (componentType) {
+    case GLTF_BYTE: {
+        int8_t v;
+        std::memcpy(&v, p, sizeof(v));
+        return normalized ? std::max(v / 127.0, -1.0) : v;
+    }
+    case GLTF_UNSIGNED_BYTE:
+        return normalized ? p[0] / 255.0 : p[0];
+    case GLTF_SHORT: {
+        int16_t v;
+        std::memcpy(&v, p, sizeof(v));
+        return normalized ? std::max(v / 32767.0, -1.0) : v;
+    }
+    case GLTF_UNSIGNED_SHORT: {
+        uint16_t v;
+        std::memcpy(&v, p, sizeof(v));
+        return normalized ? v / 65535.0 : v;
+    }
+    case GLTF_UNSIGNED_INT: {
+        uint32_t v;
+        std::memcpy(&v, p, sizeof(v));
+        return normalized ? v / 4294967295.0 : v;
+    }
+    default: {
+        float v;
+        std::memcpy(&v, p, sizeof(v));
+        return v;
+    }
+    }
+}
+
+static inline uint32_t ReadIndex(const GLTFAccessor& acc, int i)
+{
+    const unsigned char *p = acc.data + std::size_t(i) * acc.stride;
+    if (acc.componentType == GLTF_UNSIGNED_BYTE)
+        return p[0];
+    if (acc.componentType == GLTF_UNSIGNED_SHORT) {
+        uint16_t v;
+        std::memcpy(&v, p, sizeof(v));
+        return v;
+    }
+    uint32_t v;
+    std::memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+/* The decoders of the meshoptimizer codecs follow the bitstream specification of
+ * EXT_meshopt_compression */
+
+static const std::size_t MESHOPT_BYTE_GROUP_SIZE = 16;
+static const std::size_t MESHOPT_BYTE_GROUP_DECODE_LIMIT = 24;
+static const std::size_t MESHOPT_VERTEX_BLOCK_SIZE_BYTES = 8192;
+static const std::size_t MESHOPT_VERTEX_BLOCK_MAX_SIZE = 256;
+static const std::size_t MESHOPT_TAIL_MIN_SIZE = 32;
+
+static const unsigned char *DecodeMeshoptBytesGroup(const unsigned char *data, unsigned char *buffer, int bitslog2)
+{
+    if (bitslog2 == 0) {
+        std::memset(buffer, 0, MESHOPT_BYTE_GROUP_SIZE);
+        return data;
+    }
+    if (bitslog2 == 3) {
+        std::memcpy(buffer, data, MESHOPT_BYTE_GROUP_SIZE);
+        return data + MESHOPT_BYTE_GROUP_SIZE;
+    }
+    // 2 or 4 bits per byte, most significant first, the values with all the bits set
+    // are followed by the byte in the area after the packed bits
+    const int bits = 1 << bitslog2;
+    const unsigned char escape = (1 << bits) - 1;
+    const unsigned char *var = data + bits * MESHOPT_BYTE_GROUP_SIZE / 8;
+    for (std::size_t k = 0; k < MESHOPT_BYTE_GROUP_SIZE; ++k) {
+        int shift = 8 - bits - (k * bits) % 8;
+        unsigned char enc = (data[k * bits / 8] >> shift) & escape;
+        buffer[k] = (enc == escape) ? *var++ : enc;
+    }
+    return var;
+}
+
+static const unsigned char *DecodeMeshoptBytes(const unsigned char *data, const unsigned char *end, unsigned char *buffer, std::size_t size)
+{
+    // 2 bits per group in the header
+    const unsigned char *header = data;
+    std::size_t headerSize = (size / MESHOPT_BYTE_GROUP_SIZE + 3) / 4;
+    if (std::size_t(end - data) < headerSize)
+        return nullptr;
+    data += headerSize;
+
+    for (std::size_t i = 0; i < size; i += MESHOPT_BYTE_GROUP_SIZE) {
+        if (std::size_t(end - data) < MESHOPT_BYTE_GROUP_DECODE_LIMIT)
+            return nullptr;
+        std::size_t group = i / MESHOPT_BYTE_GROUP_SIZE;
+        int bitslog2 = (header[group / 4] >> ((group % 4) * 2)) & 3;
+        data = DecodeMeshoptBytesGroup(data, buffer + i, bitslog2);
+    }
+    return data;
+}
+
+static bool DecodeMeshoptVertexBuffer(unsigned char *dst, std::size_t count, std::size_t size, const unsigned char *src, std::size_t srcSize)
+{
+    const unsigned char *data = src;
+    const unsigned char *end = src + srcSize;
+    if (srcSize < 1 + size || (*data & 0xf0) != 0xa0 || (*data & 0x0f) > 0)
+        return false;
+    data++;
+
+    // the deltas of the first block are from the vertex stored in the tail
+    unsigned char last[256];
+    std::memcpy(last, end - size, size);
+
+    std::size_t blockSize = std::min(MESHOPT_VERTEX_BLOCK_SIZE_BYTES / size & ~(MESHOPT_BYTE_GROUP_SIZE - 1), MESHOPT_VERTEX_BLOCK_MAX_SIZE);
+    std::vector<unsigned char> buffer(MESHOPT_VERTEX_BLOCK_MAX_SIZE);
+
+    for (std::size_t offset = 0; offset < count; offset += blockSize) {
+        std::size_t n = std::min(blockSize, count - offset);
+        std::size_t aligned = (n + MESHOPT_BYTE_GROUP_SIZE - 1) & ~(MESHOPT_BYTE_GROUP_SIZE - 1);
+        unsigned char *block = dst + offset * size;
+        // each byte of the vertex is stored as a stream of zigzag deltas
+        for (std::size_t k = 0; k < size; ++k) {
+            data = DecodeMeshoptBytes(data, end, buffer.data(), aligned);
+            if (!data)
+                return false;
+            unsigned char p = last[k];
+            for (std::size_t i = 0; i < n; ++i) {
+                unsigned char d = buffer[i];
+                p += (unsigned char) (-(d & 1) ^ (d >> 1));
+                block[i * size + k] = p;
+            }
+        }
+        std::memcpy(last, block + (n - 1) * size, size);
+    }
+
+    return std::size_t(end - data) == std::max(size, MESHOPT_TAIL_MIN_SIZE);
+}
+
+static unsigned int DecodeMeshoptVByte(const unsigned char *& data)
+{
+    unsigned char lead = *data++;
+    if (lead < 128)
+        return lead;
+    unsigned int result = lead & 127;
+    unsigned int shift = 7;
+    for (int i = 0; i < 4; ++i) {
+        unsigned char group = *data++;
+        result |= unsigned(group & 127) << shift;
+        shift += 7;
+        if (group < 128)
+            break;
+    }
+    return result;
+}
+
+static unsigned int DecodeMeshoptIndex(const unsigned char *& data, unsigned int last)
+{
+    unsigned int v = DecodeMeshoptVByte(data);
+    unsigned int d = (v >> 1) ^ -int(v & 1);
+    return last + d;
+}
+
+static inline void WriteMeshoptIndex(unsigned char *dst, std::size_t i, std::size_t size, unsigned int index)
+{
+    if (size == 2) {
+        uint16_t v = (uint16_t) index;
+        std::memcpy(dst + 2 * i, &v, sizeof(v));
+    } else {
+        uint32_t v = index;
+        std::memcpy(dst + 4 * i, &v, sizeof(v));
+    }
+}
+
+static bool DecodeMeshoptIndexBuffer(unsigned char *dst, std::size_t count, std::size_t size, const unsigned char *src, std::size_t srcSize)
+{
+    // header, one code per triangle and the 16 bytes table of the auxiliary codes
+    if (srcSize < 1 + count / 3 + 16 || (src[0] & 0xf0) != 0xe0 || (src[0] & 0x0f) > 1)
+        return false;
+    const int version = src[0] & 0x0f;
+
+    unsigned int edgeFifo[16][2];
+    unsigned int vertexFifo[16];
+    std::memset(edgeFifo, -1, sizeof(edgeFifo));
+    std::memset(vertexFifo, -1, sizeof(vertexFifo));
+    std::size_t edgeOffset = 0;
+    std::size_t vertexOffset = 0;
+    auto PushEdge = [&](unsigned int a, unsigned int b) {
+        edgeFifo[edgeOffset][0] = a;
+        edgeFifo[edgeOffset][1] = b;
+        edgeOffset = (edgeOffset + 1) & 15;
+    };
+    auto PushVertex = [&](unsigned int v, bool cond) {
+        vertexFifo[vertexOffset] = v;
+        vertexOffset = (vertexOffset + (cond ? 1 : 0)) & 15;
+    };
+
+    unsigned int next = 0;
+    unsigned int last = 0;
+    const int fecmax = (version >= 1) ? 13 : 15;
+
+    const unsigned char *code = src + 1;
+    const unsigned char *data = code + count / 3;
+    const unsigned char *dataSafeEnd = src + srcSize - 16;
+    const unsigned char *codeauxTable = dataSafeEnd;
+
+    for (std::size_t i = 0; i < count; i += 3) {
+        // a triangle reads at most 16 bytes, the table follows the data
+        if (data > dataSafeEnd)
+            return false;
+
+        unsigned char codetri = *code++;
+        unsigned int a, b, c;
+
+        if (codetri < 0xf0) {
+            // an edge of the fifo and a vertex
+            int fe = codetri >> 4;
+            a = edgeFifo[(edgeOffset - 1 - fe) & 15][0];
+            b = edgeFifo[(edgeOffset - 1 - fe) & 15][1];
+            int fec = codetri & 15;
+            if (fec < fecmax) {
+                c = (fec == 0) ? next++ : vertexFifo[(vertexOffset - 1 - fec) & 15];
+                PushVertex(c, fec == 0);
+            } else {
+                // 13 and 14 are the deltas -1 and 1 from the last free index
+                last = c = (fec != 15) ? last + (fec - (fec ^ 3)) : DecodeMeshoptIndex(data, last);
+                PushVertex(c, true);
+            }
+            PushEdge(c, b);
+            PushEdge(a, c);
+        } else {
+            int fea, feb, fec;
+            if (codetri < 0xfe) {
+                unsigned char codeaux = codeauxTable[codetri & 15];
+                fea = 0;
+                feb = codeaux >> 4;
+                fec = codeaux & 15;
+            } else {
+                unsigned char codeaux = *data++;
+                fea = (codetri == 0xfe) ? 0 : 15;
+                feb = codeaux >> 4;
+                fec = codeaux & 15;
+                if (codeaux == 0)
+                    next = 0;
+            }
+
+            // the new vertices are numbered before the free indices are read
+            a = (fea == 0) ? next++ : 0;
+            b = (feb == 0) ? next++ : vertexFifo[(vertexOffset - feb) & 15];
+            c = (fec == 0) ? next++ : vertexFifo[(vertexOffset - fec) & 15];
+            if (fea == 15)
+                last = a = DecodeMeshoptIndex(data, last);
+            if (feb == 15)
+                last = b = DecodeMeshoptIndex(data, last);
+            if (fec == 15)
+                last = c = DecodeMeshoptIndex(data, last);
+
+            PushVertex(a, true);
+            PushVertex(b, feb == 0 || feb == 15);
+            PushVertex(c, fec == 0 || fec == 15);
+            PushEdge(b, a);
+            PushEdge(c, b);
+            PushEdge(a, c);
+        }
+
+        WriteMeshoptIndex(dst, i + 0, size, a);
+        WriteMeshoptIndex(dst, i + 1, size, b);
+        WriteMeshoptIndex(dst, i + 2, size, c);
+    }
+
+    return data == dataSafeEnd;
+}
+
+static bool DecodeMeshoptIndexSequence(unsigned char *dst, std::size_t count, std::size_t size, const unsigned char *src, std::size_t srcSize)
+{
+    // header, at least one byte per index and a 4 bytes tail
+    if (srcSize < 1 + count + 4 || (src[0] & 0xf0) != 0xd0 || (src[0] & 0x0f) > 1)
+        return false;
+
+    const unsigned char *data = src + 1;
+    const unsigned char *dataSafeEnd = src + srcSize - 4;
+
+    // the deltas are from one of two baselines
+    unsigned int last[2] = {0, 0};
+    for (std::size_t i = 0; i < count; ++i) {
+        if (data >= dataSafeEnd)
+            return false;
+        unsigned int v = DecodeMeshoptVByte(data);
+        unsigned int current = v & 1;
+        v >>= 1;
+        unsigned int d = (v >> 1) ^ -int(v & 1);
+        last[current] += d;
+        WriteMeshoptIndex(dst, i, size, last[current]);
+    }
+
+    return data == dataSafeEnd;
+}
+
+// each value is a 24 bits signed mantissa and an 8 bits signed exponent
+static void DecodeMeshoptExponentialFilter(unsigned char *data, std::size_t count)
+{
+    #pragma omp parallel for
+    for (long long i = 0; i < (long long) count; ++i) {
+        uint32_t v;
+        std::memcpy(&v, data + 4 * i, sizeof(v));
+        int m = int(v << 8) >> 8;
+        int e = int(v) >> 24;
+        float f = std::ldexp(float(m), e);
+        std::memcpy(data + 4 * i, &f, sizeof(f));
+    }
+}
@@ -0,0 +1,45 @@
+/*******************************************************************************
+    Copyright (c) 2021, Andrea Maggiordomo, Paolo Cignoni and Marco Tarini
+
+    This file is part of TextureDefrag, a reference implementation for
+    the paper ``Texture Defragmentation for Photo-Reconstructed 3D Models''
+    by Andrea Maggiordomo, Paolo Cignoni and Marco Tarini.
+
+    TextureDefrag is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    TextureDefrag is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with TextureDefrag. If not, see <https://www.gnu.org/licenses/>.
+*******************************************************************************/
+
+
+#ifndef GLTF_LOADER_H
+#define GLTF_LOADER_H
+
+class Mesh;
+
+/* Loads a glTF 2.0 file (a .gltf file with its buffers in files or data uris, or a
+ * .glb file) directly into the mesh. The triangles of the primitives (also those of
+ * strips and fans) of the meshes instanced by the nodes of the scene are loaded with
+ * the positions transformed by the nodes, and with the texture coordinates of the
+ * base color texture of their material (KHR_texture_transform is applied); the
+ * images of the base color textures are the textures of the mesh, read relative to
+ * the current directory as the material libraries of LoadOBJ. The attributes can be
+ * quantized (KHR_mesh_quantization) and the buffer views compressed with the codecs
+ * of meshoptimizer (EXT_meshopt_compression and KHR_meshopt_compression, version 0
+ * vertex streams): the compressed views are decoded concurrently, then the
+ * primitives are converted in parallel over their vertices and triangles. The
+ * primitives without a base color texture are skipped. Draco compressed primitives
+ * without an uncompressed fallback and images embedded in the buffers are not
+ * supported. Returns false and logs the error if the file cannot be loaded, leaving
+ * the mesh empty */
+bool LoadGLTF(const char *fileName, Mesh& m, int& loadMask);
+
+#endif // GLTF_LOADER_H
@@ -0,0 +1,698 @@
+/*******************************************************************************
+    Copyright (c) 2021, Andrea Maggiordomo, Paolo Cignoni and Marco Tarini
+
+    This file is part of TextureDefrag, a reference implementation for
+    the paper ``Texture Defragmentation for Photo-Reconstructed 3D Models''
+    by Andrea Maggiordomo, Paolo Cignoni and Marco Tarini.
+
+    TextureDefrag is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    TextureDefrag is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with TextureDefrag. If not, see <https://www.gnu.org/licenses/>.
+*******************************************************************************/
+
+#include "gpu_arap.h"
+#include "gl_utils.h"
+#include "logging.h"
+
+#include <algorithm>
+#include <cmath>
+#include <initializer_list>
+
+#include <QOpenGLContext>
+#include <QPointer>
+
+
+#ifndef GL_SHADER_STORAGE_BUFFER
+#define GL_SHADER_STORAGE_BUFFER 0x90D2
+#endif
+#ifndef GL_SHADER_STORAGE_BARRIER_BIT
+#define GL_SHADER_STORAGE_BARRIER_BIT 0x00002000
+#endif
+#ifndef GL_BUFFER_UPDATE_BARRIER_BIT
+#define GL_BUFFER_UPDATE_BARRIER_BIT 0x00000200
+#endif
+
+typedef void (QOPENGLF_APIENTRYP DispatchComputeProc)(GLuint numGroupsX, GLuint numGroupsY, GLuint numGroupsZ);
+typedef void (QOPENGLF_APIENTRYP MemoryBarrierProc)(GLbitfield barriers);
+
+// number of iterations of the conjugate gradient between the convergence tests
+constexpr int CG_CHECK_INTERVAL = 8;
+
+// The kernels that reduce a value over their invocations write two partial sums per
+// work group, that are summed in a fixed order by the reduce kernel, so the results
+// do not change across runs
+#define ARAP_REDUCTION_GLSL                                                             \
+    "layout(local_size_x = 256) in;                                                  \n" \
+    "                                                                                \n" \
+    "shared dvec4 reduction0[256];                                                   \n" \
+    "shared dvec4 reduction1[256];                                                   \n" \
+    "                                                                                \n" \
+    "void reduce(dvec4 v0, dvec4 v1)                                                 \n" \
+    "{                                                                               \n" \
+    "    uint t = gl_LocalInvocationID.x;                                            \n" \
+    "    reduction0[t] = v0;                                                         \n" \
+    "    reduction1[t] = v1;                                                         \n" \
+    "    barrier();                                                                  \n" \
+    "    for (uint s = 128u; s > 0u; s >>= 1u) {                                     \n" \
+    "        if (t < s) {                                                            \n" \
+    "            reduction0[t] += reduction0[t + s];                                 \n" \
+    "            reduction1[t] += reduction1[t + s];                                 \n" \
+    "        }                                                                       \n" \
+    "        barrier();                                                              \n" \
+    "    }                                                                           \n" \
+    "}                                                                               \n"
+
+#define ARAP_PARTIALS_GLSL(binding)                                                     \
+    "layout(std430, binding = " #binding ") writeonly buffer Partials { dvec4 partial[]; };\n" \
+    "                                                                                \n" \
+    "void storePartials()                                                            \n" \
+    "{                                                                               \n" \
+    "    if (gl_LocalInvocationID.x == 0u) {                                         \n" \
+    "        partial[2u * gl_WorkGroupID.x] = reduction0[0];                         \n" \
+    "        partial[2u * gl_WorkGroupID.x + 1u] = reduction1[0];                    \n" \
+    "    }                                                                           \n" \
+    "}                                                                               \n"
+
+#define ARAP_SCALARS_GLSL(binding, access)                                              \
+    "layout(std430, binding = " #binding ") " access " buffer Scalars {              \n" \
+    "    dvec2 rz;    // residual dot preconditioned residual                        \n" \
+    "    dvec2 rr;    // squared norm of the residual                                \n" \
+    "    dvec2 bb;    // squared norm of the right-hand side                         \n" \
+    "    dvec2 pap;   // direction dot product                                       \n" \
+    "    dvec2 alpha;                                                                \n" \
+    "    dvec2 beta;                                                                 \n" \
+    "    double energy;                                                              \n" \
+    "};                                                                              \n"
+
+// One invocation per face, the closest rotation to the Jacobian of the face and its
+// energy (see RotationKernel() and JacobianEnergy() in arap.cpp)
+static const char *rotations_cs_text[] = {
+    "#version 430 core                                                               \n"
+    "                                                                                \n"
+    ARAP_REDUCTION_GLSL
+    "                                                                                \n"
+    "layout(std430, binding = 0) readonly buffer Faces { int faceVertex[]; };        \n"
+    "layout(std430, binding = 1) readonly buffer Frames { dvec4 frameInv[]; };       \n"
+    "layout(std430, binding = 2) readonly buffer Areas { double frameArea[]; };      \n"
+    "layout(std430, binding = 3) readonly buffer TexCoords { dvec2 uv[]; };          \n"
+    "layout(std430, binding = 4) writeonly buffer Rotations { dvec2 rotation[]; };   \n"
+    ARAP_PARTIALS_GLSL(5)
+    "                                                                                \n"
+    "uniform int count;                                                              \n"
+    "                                                                                \n"
+    "void main(void)                                                                 \n"
+    "{                                                                               \n"
+    "    int fi = int(gl_GlobalInvocationID.x);                                      \n"
+    "    double e = 0.0;                                                             \n"
+    "    if (fi < count) {                                                           \n"
+    "        dvec2 u0 = uv[faceVertex[3 * fi]];                                      \n"
+    "        dvec2 u10 = uv[faceVertex[3 * fi + 1]] - u0;                            \n"
+    "        dvec2 u20 = uv[faceVertex[3 * fi + 2]] - u0;                            \n"
+    "        dvec4 f = frameInv[fi];                                                 \n"
+    "        double j00 = u10.x * f.x + u20.x * f.z;                                 \n"
+    "        double j01 = u10.x * f.y + u20.x * f.w;                                 \n"
+    "        double j10 = u10.y * f.x + u20.y * f.z;                                 \n"
+    "        double j11 = u10.y * f.y + u20.y * f.w;                                 \n"
+    "        double c = j00 + j11;                                                   \n"
+    "        double s = j10 - j01;                                                   \n"
+    "        double n = sqrt(c * c + s * s);                                         \n"
+    "        rotation[fi] = (n > 0.0) ? dvec2(c / n, s / n) : dvec2(1.0, 0.0);       \n"
+    "        double q = 0.5 * n;                                                     \n"
+    "        double r = 0.5 * sqrt((j00 - j11) * (j00 - j11) + (j10 + j01) * (j10 + j01));\n"
+    "        double sigma0 = q + r;                                                  \n"
+    "        double sigma1 = abs(q - r);                                             \n"
+    "        e = frameArea[fi] * ((sigma0 - 1.0) * (sigma0 - 1.0) + (sigma1 - 1.0) * (sigma1 - 1.0));\n"
+    "    }                                                                           \n"
+    "    reduce(dvec4(e, 0.0, 0.0, 0.0), dvec4(0.0));                                \n"
+    "    storePartials();                                                            \n"
+    "}                                                                               \n"
+};
+
+// One invocation per vertex, gathers the rotated terms of the incident corners (see
+// ComputeRHS() in arap.cpp)
+static const char *rhs_cs_text[] = {
+    "#version 430 core                                                               \n"
+    "                                                                                \n"
+    "layout(local_size_x = 256) in;                                                  \n"
+    "                                                                                \n"
+    "layout(std430, binding = 0) readonly buffer CornerPtr { int cornerPtr[]; };     \n"
+    "layout(std430, binding = 1) readonly buffer Corners { int corners[]; };         \n"
+    "layout(std430, binding = 2) readonly buffer Rotations { dvec2 rotation[]; };    \n"
+    "layout(std430, binding = 3) readonly buffer CornerTargets { dvec2 cornerTarget[]; };\n"
+    "layout(std430, binding = 4) readonly buffer VertexTerms { dvec4 vertexTerm[]; };\n"
+    "layout(std430, binding = 5) writeonly buffer Rhs { dvec2 b[]; };                \n"
+    "                                                                                \n"
+    "uniform int count;                                                              \n"
+    "                                                                                \n"
+    "void main(void)                                                                 \n"
+    "{                                                                               \n"
+    "    int vi = int(gl_GlobalInvocationID.x);                                      \n"
+    "    if (vi >= count)                                                            \n"
+    "        return;                                                                 \n"
+    "    dvec4 t = vertexTerm[vi];                                                   \n"
+    "    if (t.z != 0.0) {                                                           \n"
+    "        b[vi] = t.xy;                                                           \n"
+    "        return;                                                                 \n"
+    "    }                                                                           \n"
+    "    dvec2 sum = dvec2(0.0);                                                     \n"
+    "    for (int c = cornerPtr[vi]; c < cornerPtr[vi + 1]; ++c) {                   \n"
+    "        int corner = corners[c];                                                \n"
+    "        dvec2 r = rotation[corner / 3];                                         \n"
+    "        dvec2 q = cornerTarget[corner];                                         \n"
+    "        sum += dvec2(r.x * q.x - r.y * q.y, r.y * q.x + r.x * q.y);             \n"
+    "    }                                                                           \n"
+    "    b[vi] = sum + t.xy;                                                         \n"
+    "}                                                                               \n"
+};
+
+// The matrix is stored as the row pointers followed by the column indices (at
+// colOffset), and the values followed by the inverse of the diagonal (at diagOffset)
+#define ARAP_MATRIX_GLSL                                                                \
+    "layout(std430, binding = 0) readonly buffer Pattern { int pattern[]; };         \n" \
+    "layout(std430, binding = 1) readonly buffer Values { double values[]; };        \n" \
+    "                                                                                \n" \
+    "uniform int count;                                                              \n" \
+    "uniform int colOffset;                                                          \n" \
+    "uniform int diagOffset;                                                         \n"
+
+// One invocation per vertex, initial residual, preconditioned residual and direction
+static const char *cg_init_cs_text[] = {
+    "#version 430 core                                                               \n"
+    "                                                                                \n"
+    ARAP_REDUCTION_GLSL
+    "                                                                                \n"
+    ARAP_MATRIX_GLSL
+    "layout(std430, binding = 2) readonly buffer TexCoords { dvec2 x[]; };           \n"
+    "layout(std430, binding = 3) readonly buffer Rhs { dvec2 b[]; };                 \n"
+    "layout(std430, binding = 4) writeonly buffer Residual { dvec2 r[]; };           \n"
+    "layout(std430, binding = 5) writeonly buffer Direction { dvec2 p[]; };          \n"
+    ARAP_PARTIALS_GLSL(6)
+    "                                                                                \n"
+    "void main(void)                                                                 \n"
+    "{                                                                               \n"
+    "    int vi = int(gl_GlobalInvocationID.x);                                      \n"
+    "    dvec4 v0 = dvec4(0.0);                                                      \n"
+    "    dvec4 v1 = dvec4(0.0);                                                      \n"
+    "    if (vi < count) {                                                           \n"
+    "        dvec2 ax = dvec2(0.0);                                                  \n"
+    "        for (int s = pattern[vi]; s < pattern[vi + 1]; ++s)                     \n"
+    "            ax += values[s] * x[pattern[colOffset + s]];                        \n"
+    "        dvec2 bi = b[vi];                                                       \n"
+    "        dvec2 ri = bi - ax;                                                     \n"
+    "        dvec2 zi = values[diagOffset + vi] * ri;                                \n"
+    "        r[vi] = ri;                                                             \n"
+    "        p[vi] = zi;                                                             \n"
+    "        v0 = dvec4(ri * zi, ri * ri);                                           \n"
+    "        v1 = dvec4(bi * bi, 0.0, 0.0);                                          \n"
+    "    }                                                                           \n"
+    "    reduce(v0, v1);                                                             \n"
+    "    storePartials();                                                            \n"
+    "}                                                                               \n"
+};
+
+// One invocation per vertex, product of the matrix and the direction
+static const char *cg_product_cs_text[] = {
+    "#version 430 core                                                               \n"
+    "                                                                                \n"
+    ARAP_REDUCTION_GLSL
+    "                                                                                \n"
+    ARAP_MATRIX_GLSL
+    "layout(std430, binding = 2) readonly buffer Direction { dvec2 p[]; };           \n"
+    "layout(std430, binding = 3) writeonly buffer Product { dvec2 ap[]; };           \n"
+    ARAP_PARTIALS_GLSL(4)
+    "                                                                                \n"
+    "void main(void)                                                                 \n"
+    "{                                                                               \n"
+    "    int vi = int(gl_GlobalInvocationID.x);                                      \n"
+    "    dvec4 v0 = dvec4(0.0);                                                      \n"
+    "    if (vi < count) {                                                           \n"
+    "        dvec2 api = dvec2(0.0);                                                 \n"
+    "        for (int s = pattern[vi]; s < pattern[vi + 1]; ++s)                     \n"
+    "            api += values[s] * p[pattern[colOffset + s]];                       \n"
+    "        ap[vi] = api;                                                           \n"
+    "        v0 = dvec4(p[vi] * api, 0.0, 0.0);                                      \n"
+    "    }                                                                           \n"
+    "    reduce(v0, dvec4(0.0));                                                     \n"
+    "    storePartials();                                                            \n"
+    "}                                                                               \n"
+};
+
+// One invocation per vertex, updates the solution and the residual
+static const char *cg_update_cs_text[] = {
+    "#version 430 core                                                               \n"
+    "                                                                                \n"
+    ARAP_REDUCTION_GLSL
+    "                                                                                \n"
+    ARAP_MATRIX_GLSL
+    "layout(std430, binding = 2) buffer TexCoords { dvec2 x[]; };                    \n"
+    "layout(std430, binding = 3) buffer Residual { dvec2 r[]; };                     \n"
+    "layout(std430, binding = 4) readonly buffer Direction { dvec2 p[]; };           \n"
+    "layout(std430, binding = 5) readonly buffer Product { dvec2 ap[]; };            \n"
+    ARAP_SCALARS_GLSL(6, "readonly")
+    ARAP_PARTIALS_GLSL(7)
+    "                                                                                \n"
+    "void main(void)                                                                 \n"
+    "{                                                                               \n"
+    "    int vi = int(gl_GlobalInvocationID.x);                                      \n"
+    "    dvec4 v0 = dvec4(0.0);                                                      \n"
+    "    if (vi < count) {                                                           \n"
+    "        x[vi] += alpha * p[vi];                                                 \n"
+    "        dvec2 ri = r[vi] - alpha * ap[vi];                                      \n"
+    "        dvec2 zi = values[diagOffset + vi] * ri;                                \n"
+    "        r[vi] = ri;                                                             \n"
+    "        v0 = dvec4(ri * zi, ri * ri);                                           \n"
+    "    }                                                                           \n"
+    "    reduce(v0, dvec4(0.0));                                                     \n"
+    "    storePartials();                                                            \n"
+    "}                                                                               \n"
+};
+
+// One invocation per vertex, next direction
+static const char *cg_direction_cs_text[] = {
+    "#version 430 core                                                               \n"
+    "                                                                                \n"
+    "layout(local_size_x = 256) in;                                                  \n"
+    "                                                                                \n"
+    ARAP_MATRIX_GLSL
+    "layout(std430, binding = 2) readonly buffer Residual { dvec2 r[]; };            \n"
+    "layout(std430, binding = 3) buffer Direction { dvec2 p[]; };                    \n"
+    ARAP_SCALARS_GLSL(4, "readonly")
+    "                                                                                \n"
+    "void main(void)                                                                 \n"
+    "{                                                                               \n"
+    "    int vi = int(gl_GlobalInvocationID.x);                                      \n"
+    "    if (vi < count)                                                             \n"
+    "        p[vi] = values[diagOffset + vi] * r[vi] + beta * p[vi];                 \n"
+    "}                                                                               \n"
+};
+
+// One work group, sums the partials of the groups of the last kernel and derives the
+// scalars of the conjugate gradient: mode 0 after the initialization, 1 after the
+// product, 2 after the update, 3 stores the energy of the local step
+static const char *reduce_cs_text[] = {
+    "#version 430 core                                                               \n"
+    "                                                                                \n"
+    ARAP_REDUCTION_GLSL
+    "                                                                                \n"
+    "layout(std430, binding = 0) readonly buffer Partials { dvec4 partial[]; };      \n"
+    ARAP_SCALARS_GLSL(1, "")
+    "                                                                                \n"
+    "uniform int numGroups;                                                          \n"
+    "uniform int mode;                                                               \n"
+    "                                                                                \n"
+    "dvec2 ratio(dvec2 a, dvec2 b)                                                   \n"
+    "{                                                                               \n"
+    "    return dvec2((b.x != 0.0) ? a.x / b.x : 0.0, (b.y != 0.0) ? a.y / b.y : 0.0);\n"
+    "}                                                                               \n"
+    "                                                                                \n"
+    "void main(void)                                                                 \n"
+    "{                                                                               \n"
+    "    dvec4 v0 = dvec4(0.0);                                                      \n"
+    "    dvec4 v1 = dvec4(0.0);                                                      \n"
+    "    for (int g = int(gl_LocalInvocationID.x); g < numGroups; g += 256) {        \n"
+    "        v0 += partial[2 * g];                                                   \n"
+    "        v1 += partial[2 * g + 1];                                               \n"
+    "    }                                                                           \n"
+    "    reduce(v0, v1);                                                             \n"
+    "    if (gl_LocalInvocationID.x != 0u)                                           \n"
+    "        return;                                                                 \n"
+    "    dvec4 s0 = reduction0[0];                                                   \n"
+    "    dvec4 s1 = reduction1[0];                                                   \n"
+    "    if (mode == 0) {                                                            \n"
+    "        rz = s0.xy;                                                             \n"
+    "        rr = s0.zw;                                                             \n"
+    "        bb = s1.xy;                                                             \n"
+    "    } else if (mode == 1) {                                                     \n"
+    "        pap = s0.xy;                                                            \n"
+    "        alpha = ratio(rz, pap);                                                 \n"
+    "    } else if (mode == 2) {                                                     \n"
+    "        beta = ratio(s0.xy, rz);                                                \n"
+    "        rz = s0.xy;                                                             \n"
+    "        rr = s0.zw;                                                             \n"
+    "    } else {                                                                    \n"
+    "        energy = s0.x;                                                          \n"
+    "    }                                                                           \n"
+    "}                                                                               \n"
+};
+
+constexpr GLuint ARAP_GROUP_SIZE = 256;
+
+enum ARAPKernel {
+    ROTATIONS_KERNEL,
+    RHS_KERNEL,
+    CG_INIT_KERNEL,
+    CG_PRODUCT_KERNEL,
+    CG_UPDATE_KERNEL,
+    CG_DIRECTION_KERNEL,
+    REDUCE_KERNEL,
+    ARAP_KERNEL_COUNT
+};
+
+enum ARAPBuffer {
+    FACES_BUFFER,
+    FRAMES_BUFFER,
+    AREAS_BUFFER,
+    CORNER_PTR_BUFFER,
+    CORNERS_BUFFER,
+    CORNER_TARGETS_BUFFER,
+    VERTEX_TERMS_BUFFER,
+    PATTERN_BUFFER,
+    VALUES_BUFFER,
+    TEXCOORDS_BUFFER,
+    ROTATIONS_BUFFER,
+    RHS_BUFFER,
+    RESIDUAL_BUFFER,
+    DIRECTION_BUFFER,
+    PRODUCT_BUFFER,
+    PARTIALS_BUFFER,
+    SCALARS_BUFFER,
+    ARAP_BUFFER_COUNT
+};
+
+// Layout of the Scalars block
+struct ARAPScalars {
+    double rz[2];
+    double rr[2];
+    double bb[2];
+    double pap[2];
+    double alpha[2];
+    double beta[2];
+    double energy;
+};
+
+struct GPUARAPSolver::Impl {
+    QPointer<QOpenGLContext> owner;
+    OpenGLFunctionsHandle glFuncs = nullptr;
+    DispatchComputeProc dispatchCompute = nullptr;
+    MemoryBarrierProc memoryBarrier = nullptr;
+    GLuint programs[ARAP_KERNEL_COUNT] = {};
+    GLuint buffers[ARAP_BUFFER_COUNT] = {};
+    std::size_t capacity[ARAP_BUFFER_COUNT] = {};
+
+    int vn = 0;
+    int fn = 0;
+
+    bool current() const
+    {
+        return !owner.isNull() && QOpenGLContext::currentContext() == owner;
+    }
+
+    /* Stores the data in the buffer (if not null), which grows if it is too small */
+    void upload(ARAPBuffer b, const void *data, std::size_t bytes)
+    {
+        // empty buffers cannot be bound
+        bytes = std::max<std::size_t>(bytes, sizeof(double));
+        glFuncs->glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffers[b]);
+        if (bytes > capacity[b]) {
+            capacity[b] = std::max(bytes, 2 * capacity[b]);
+            glFuncs->glBufferData(GL_SHADER_STORAGE_BUFFER, capacity[b], nullptr, GL_DYNAMIC_DRAW);
+        }
+        if (data)
+            glFuncs->glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, bytes, data);
+        glFuncs->glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    }
+
+    void download(ARAPBuffer b, void *data, std::size_t bytes)
+    {
+        glFuncs->glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffers[b]);
+        glFuncs->glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, bytes, data);
+        glFuncs->glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    }
+
+    void setUniform(ARAPKernel k, const char *name, int value)
+    {
+        glFuncs->glUseProgram(programs[k]);
+        glFuncs->glUniform1i(glFuncs->glGetUniformLocation(programs[k], name), value);
+    }
+
+    /* Runs the kernel over n invocations, with the buffers bound in order from 0 */
+    void dispatch(ARAPKernel k, int n, std::initializer_list<ARAPBuffer> bound)
+    {
+        GLuint binding = 0;
+        for (ARAPBuffer b : bound)
+            glFuncs->glBindBufferBase(GL_SHADER_STORAGE_BUFFER, binding++, buffers[b]);
+        glFuncs->glUseProgram(programs[k]);
+        dispatchCompute(groups(n), 1, 1);
+        memoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+    }
+
+    /* Sums the partials of the last kernel, run over n invocations */
+    void reduce(int n, int mode)
+    {
+        glFuncs->glUseProgram(programs[REDUCE_KERNEL]);
+        glFuncs->glUniform1i(glFuncs->glGetUniformLocation(programs[REDUCE_KERNEL], "numGroups"), (int) groups(n));
+        glFuncs->glUniform1i(glFuncs->glGetUniformLocation(programs[REDUCE_KERNEL], "mode"), mode);
+        glFuncs->glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, buffers[PARTIALS_BUFFER]);
+        glFuncs->glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, buffers[SCALARS_BUFFER]);
+        dispatchCompute(1, 1, 1);
+        memoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+    }
+
+    ARAPScalars scalars()
+    {
+        memoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+        ARAPScalars s;
+        download(SCALARS_BUFFER, &s, sizeof(s));
+        return s;
+    }
+
+    void unbind()
+    {
+        for (GLuint binding = 0; binding < 8; ++binding)
+            glFuncs->glBindBufferBase(GL_SHADER_STORAGE_BUFFER, binding, 0);
+        glFuncs->glUseProgram(0);
+    }
+
+    static GLuint groups(int n)
+    {
+        return (GLuint(n) + ARAP_GROUP_SIZE - 1) / ARAP_GROUP_SIZE;
+    }
+
+    bool create();
+    static void collectOrphans(QOpenGLContext *current);
+};
+
+// The solver of each thread, and the solvers of the contexts that were not current
+// when they were replaced, deleted when their context is current again (or dropped
+// if the context no longer exists)
+static thread_local std::unique_ptr<GPUARAPSolver> threadSolver;
+static thread_local std::vector<std::unique_ptr<GPUARAPSolver>> orphanedSolvers;
+
+// the last context on which the solver could not be created, not retried
+static thread_local QPointer<QOpenGLContext> unsupportedContext;
+
+
+bool GPUARAPSolver::Impl::create()
+{
+    QOpenGLContext *context = QOpenGLContext::currentContext();
+    dispatchCompute = reinterpret_cast<DispatchComputeProc>(context->getProcAddress("glDispatchCompute"));
+    memoryBarrier = reinterpret_cast<MemoryBarrierProc>(context->getProcAddress("glMemoryBarrier"));
+    if (!dispatchCompute || !memoryBarrier)
+        return false;
+
+    owner = context;
+    glFuncs = GetOpenGLFunctionsHandle();
+
+    const char **sources[ARAP_KERNEL_COUNT] = {
+        rotations_cs_text, rhs_cs_text, cg_init_cs_text, cg_product_cs_text, cg_update_cs_text, cg_direction_cs_text, reduce_cs_text
+    };
+    bool compiled = true;
+    for (int k = 0; k < ARAP_KERNEL_COUNT; ++k) {
+        programs[k] = CompileComputeShader(sources[k]);
+        compiled = compiled && programs[k] != 0;
+    }
+    glFuncs->glGenBuffers(ARAP_BUFFER_COUNT, buffers);
+    if (!compiled) {
+        LOG_WARN << "[GL] Failed to build the ARAP shaders";
+        return false;
+    }
+
+    CHECK_GL_ERROR();
+    return true;
+}
+
+void GPUARAPSolver::Impl::collectOrphans(QOpenGLContext *current)
+{
+    auto end = std::remove_if(orphanedSolvers.begin(), orphanedSolvers.end(),
+                              [current] (const std::unique_ptr<GPUARAPSolver>& s) {
+                                  return s->impl->owner.isNull() || (current != nullptr && s->impl->owner == current);
+                              });
+    // the destructor deletes the objects of the current context
+    orphanedSolvers.erase(end, orphanedSolvers.end());
+}
+
+
+GPUARAPSolver::GPUARAPSolver()
+    : impl(new Impl)
+{
+}
+
+GPUARAPSolver::~GPUARAPSolver()
+{
+    // the objects are released with the context if it is no longer current
+    if (!impl->current())
+        return;
+    for (GLuint program : impl->programs)
+        impl->glFuncs->glDeleteProgram(program);
+    impl->glFuncs->glDeleteBuffers(ARAP_BUFFER_COUNT, impl->buffers);
+}
+
+bool GPUARAPSolver::Load(const GPUARAPProblem& problem, const std::vector<double>& texCoords)
+{
+    if (!impl->current())
+        return false;
+
+    Impl& d = *impl;
+    d.vn = problem.vn;
+    d.fn = problem.fn;
+
+    std::vector<GLint> pattern(problem.rowPtr);
+    pattern.insert(pattern.end(), problem.colIdx.begin(), problem.colIdx.end());
+
+    // the inverse of the diagonal is the Jacobi preconditioner
+    std::vector<double> values(problem.values);
+    values.resize(problem.values.size() + d.vn);
+    for (int vi = 0; vi < d.vn; ++vi) {
+        double diag = 0;
+        for (int s = problem.rowPtr[vi]; s < problem.rowPtr[vi + 1]; ++s)
+            if (problem.colIdx[s] == vi)
+                diag = problem.values[s];
+        if (!(diag > 0))
+            return false;
+        values[problem.values.size() + vi] = 1.0 / diag;
+    }
+
+    d.upload(FACES_BUFFER, problem.faceVertex.data(), problem.faceVertex.size() * sizeof(GLint));
+    d.upload(FRAMES_BUFFER, problem.frameInv.data(), problem.frameInv.size() * sizeof(double));
+    d.upload(AREAS_BUFFER, problem.frameArea.data(), problem.frameArea.size() * sizeof(double));
+    d.upload(CORNER_PTR_BUFFER, problem.cornerPtr.data(), problem.cornerPtr.size() * sizeof(GLint));
+    d.upload(CORNERS_BUFFER, problem.corners.data(), problem.corners.size() * sizeof(GLint));
+    d.upload(CORNER_TARGETS_BUFFER, problem.cornerTarget.data(), problem.cornerTarget.size() * sizeof(double));
+    d.upload(VERTEX_TERMS_BUFFER, problem.vertexTerm.data(), problem.vertexTerm.size() * sizeof(double));
+    d.upload(PATTERN_BUFFER, pattern.data(), pattern.size() * sizeof(GLint));
+    d.upload(VALUES_BUFFER, values.data(), values.size() * sizeof(double));
+    d.upload(TEXCOORDS_BUFFER, texCoords.data(), 2 * d.vn * sizeof(double));
+    d.upload(ROTATIONS_BUFFER, nullptr, 2 * d.fn * sizeof(double));
+    for (ARAPBuffer b : { RHS_BUFFER, RESIDUAL_BUFFER, DIRECTION_BUFFER, PRODUCT_BUFFER })
+        d.upload(b, nullptr, 2 * d.vn * sizeof(double));
+    d.upload(PARTIALS_BUFFER, nullptr, 2 * Impl::groups(std::max(d.vn, d.fn)) * 4 * sizeof(double));
+    d.upload(SCALARS_BUFFER, nullptr, sizeof(ARAPScalars));
+
+    d.setUniform(ROTATIONS_KERNEL, "count", d.fn);
+    d.setUniform(RHS_KERNEL, "count", d.vn);
+    for (ARAPKernel k : { CG_INIT_KERNEL, CG_PRODUCT_KERNEL, CG_UPDATE_KERNEL, CG_DIRECTION_KERNEL }) {
+        d.setUniform(k, "count", d.vn);
+        d.setUniform(k, "colOffset", d.vn + 1);
+        d.setUniform(k, "diagOffset", (int) problem.values.size());
+    }
+    d.glFuncs->glUseProgram(0);
+
+    CHECK_GL_ERROR();
+    return true;
+}
+
+double GPUARAPSolver::Rotations()
+{
+    Impl& d = *impl;
+    d.dispatch(ROTATIONS_KERNEL, d.fn, { FACES_BUFFER, FRAMES_BUFFER, AREAS_BUFFER, TEXCOORDS_BUFFER, ROTATIONS_BUFFER, PARTIALS_BUFFER });
+    d.reduce(d.fn, 3);
+    d.unbind();
+    CHECK_GL_ERROR();
+    return d.scalars().energy;
+}
+
+bool GPUARAPSolver::GlobalStep(double tol, int maxIterations, int *iterations)
+{
+    Impl& d = *impl;
+
+    d.dispatch(RHS_KERNEL, d.vn, { CORNER_PTR_BUFFER, CORNERS_BUFFER, ROTATIONS_BUFFER, CORNER_TARGETS_BUFFER, VERTEX_TERMS_BUFFER, RHS_BUFFER });
+    d.dispatch(CG_INIT_KERNEL, d.vn, { PATTERN_BUFFER, VALUES_BUFFER, TEXCOORDS_BUFFER, RHS_BUFFER, RESIDUAL_BUFFER, DIRECTION_BUFFER, PARTIALS_BUFFER });
+    d.reduce(d.vn, 0);
+
+    double tol2 = tol * tol;
+    auto Converged = [tol2] (const ARAPScalars& s) {
+        return s.rr[0] <= tol2 * s.bb[0] && s.rr[1] <= tol2 * s.bb[1];
+    };
+
+    ARAPScalars s = d.scalars();
+    bool converged = Converged(s);
+    int k = 0;
+    while (!converged && k < maxIterations && std::isfinite(s.rr[0]) && std::isfinite(s.rr[1])) {
+        d.dispatch(CG_PRODUCT_KERNEL, d.vn, { PATTERN_BUFFER, VALUES_BUFFER, DIRECTION_BUFFER, PRODUCT_BUFFER, PARTIALS_BUFFER });
+        d.reduce(d.vn, 1);
+        d.dispatch(CG_UPDATE_KERNEL, d.vn, { PATTERN_BUFFER, VALUES_BUFFER, TEXCOORDS_BUFFER, RESIDUAL_BUFFER, DIRECTION_BUFFER, PRODUCT_BUFFER, SCALARS_BUFFER, PARTIALS_BUFFER });
+        d.reduce(d.vn, 2);
+        k++;
+        if (k % CG_CHECK_INTERVAL == 0 || k == maxIterations) {
+            s = d.scalars();
+            converged = Converged(s);
+            if (converged)
+                break;
+        }
+        d.dispatch(CG_DIRECTION_KERNEL, d.vn, { PATTERN_BUFFER, VALUES_BUFFER, RESIDUAL_BUFFER, DIRECTION_BUFFER, SCALARS_BUFFER });
+    }
+    d.unbind();
+    CHECK_GL_ERROR();
+
+    LOG_DEBUG << "ARAP GPU solve converged in " << k << " iterations with error "
+              << std::sqrt(std::max(s.rr[0] / s.bb[0], s.rr[1] / s.bb[1]));
+    *iterations = k;
+    return converged;
+}
+
+void GPUARAPSolver::ReadTexCoords(std::vector<double>& texCoords)
+{
+    texCoords.resize(2 * impl->vn);
+    impl->memoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+    impl->download(TEXCOORDS_BUFFER, texCoords.data(), texCoords.size() * sizeof(double));
+}
+
+GPUARAPSolver *GetGPUARAPSolver()
+{
+    QOpenGLContext *current = QOpenGLContext::currentContext();
+    if (!current)
+        return nullptr;
+
+    if (threadSolver && threadSolver->impl->owner != current)
+        orphanedSolvers.push_back(std::move(threadSolver));
+
+    if (!threadSolver) {
+        // reuse the solver left to this context, if any
+        auto it = std::find_if(orphanedSolvers.begin(), orphanedSolvers.end(),
+                               [current] (const std::unique_ptr<GPUARAPSolver>& s) { return s->impl->owner == current; });
+        if (it != orphanedSolvers.end()) {
+            threadSolver = std::move(*it);
+            orphanedSolvers.erase(it);
+        } else if (unsupportedContext != current) {
+            std::unique_ptr<GPUARAPSolver> solver(new GPUARAPSolver);
+            if (HasComputeShaders() && solver->impl->create())
+                threadSolver = std::move(solver);
+            else
+                unsupportedContext = current;
+        }
+    }
+    GPUARAPSolver::Impl::collectOrphans(current);
+
+    return threadSolver.get();
+}
+
+void ReleaseGPUARAPResources()
+{
+    QOpenGLContext *current = QOpenGLContext::currentContext();
+    if (threadSolver) {
+        if (threadSolver->impl->owner == current)
+            threadSolver.reset();
+        else
+            orphanedSolvers.push_back(std::move(threadSolver));
+    }
+    GPUARAPSolver::Impl::collectOrphans(current);
+}
@@ -0,0 +1,96 @@
+/*******************************************************************************
+    Copyright (c) 2021, Andrea Maggiordomo, Paolo Cignoni and Marco Tarini
+
+    This file is part of TextureDefrag, a reference implementation for
+    the paper ``Texture Defragmentation for Photo-Reconstructed 3D Models''
+    by Andrea Maggiordomo, Paolo Cignoni and Marco Tarini.
+
+    TextureDefrag is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    TextureDefrag is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with TextureDefrag. If not, see <https://www.gnu.org/licenses/>.
+*******************************************************************************/
+
+
+#ifndef GPU_ARAP_H
+#define GPU_ARAP_H
+
+#include <memory>
+#include <vector>
+
+// shells with at least this many faces are solved on the GPU when it is enabled
+constexpr int GPU_ARAP_DEFAULT_MIN_FACES = 20000;
+
+/* Data of an ARAP problem in the layout of the shader buffers. The system matrix
+ * is the symmetric one, with the fixed vertices eliminated */
+struct GPUARAPProblem {
+    int vn = 0;
+    int fn = 0;
+    std::vector<int> faceVertex;      // vertex indices of the faces, 3 per face
+    std::vector<double> frameInv;     // inverse of the local frame of each face, 4 per face (row major)
+    std::vector<double> frameArea;    // area of each face in its local frame
+    std::vector<double> cornerTarget; // right-hand side term of each corner before the rotation of its face, 2 per corner
+    std::vector<int> cornerPtr;       // corners incident to each vertex, in compressed rows
+    std::vector<int> corners;
+    std::vector<int> rowPtr;          // system matrix, in compressed rows
+    std::vector<int> colIdx;
+    std::vector<double> values;
+    std::vector<double> vertexTerm;   // per vertex, the term of the eliminated fixed vertices (or the position of a fixed vertex) and 1 if the vertex is fixed, 4 per vertex
+};
+
+/* Local/global ARAP iterations with compute shaders (OpenGL 4.3, double precision).
+ * The problem and the tex coords stay in shader storage buffers for the whole solve:
+ * the local step computes the rotations and the energy of the faces, and the global
+ * step assembles the right-hand side and runs a Jacobi preconditioned conjugate
+ * gradient on the u and v coordinates at once, warm started from the current tex
+ * coords. Only the reduced scalars are read back, every few iterations of the
+ * conjugate gradient to test its convergence.
+ *
+ * The objects belong to the OpenGL context current on the thread that creates the
+ * solver, each thread gets its own with GetGPUARAPSolver() */
+class GPUARAPSolver {
+
+public:
+
+    ~GPUARAPSolver();
+
+    /* Uploads the problem and the initial tex coords (u, v per vertex) */
+    bool Load(const GPUARAPProblem& problem, const std::vector<double>& texCoords);
+
+    /* Local step, returns the area weighted energy of the current tex coords */
+    double Rotations();
+
+    /* Global step, solves for the tex coords with the last rotations until the norm
+     * of the residual is below tol (relative to the right-hand side). Returns false
+     * if the solve does not converge within maxIterations iterations */
+    bool GlobalStep(double tol, int maxIterations, int *iterations);
+
+    void ReadTexCoords(std::vector<double>& texCoords);
+
+private:
+
+    friend GPUARAPSolver *GetGPUARAPSolver();
+    friend void ReleaseGPUARAPResources();
+
+    GPUARAPSolver();
+
+    struct Impl;
+    std::unique_ptr<Impl> impl;
+};
+
+/* Returns the solver of the calling thread, on the OpenGL context current on it, or
+ * nullptr if there is none or if it does not support compute shaders */
+GPUARAPSolver *GetGPUARAPSolver();
+
+/* Releases the objects of the solver of the calling thread */
+void ReleaseGPUARAPResources();
+
+#endif // GPU_ARAP_H
@@ -0,0 +1,465 @@
+/*******************************************************************************
+    Copyright (c) 2021, Andrea Maggiordomo, Paolo Cignoni and Marco Tarini
+
+    This file is part of TextureDefrag, a reference implementation for
+    the paper ``Texture Defragmentation for Photo-Reconstructed 3D Models''
+    by Andrea Maggiordomo, Paolo Cignoni and Marco Tarini.
+
+    TextureDefrag is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    TextureDefrag is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with TextureDefrag. If not, see <https://www.gnu.org/licenses/>.
+*******************************************************************************/
+
+#include "gpu_placement.h"
+#include "gl_utils.h"
+#include "logging.h"
+
+#include <algorithm>
+#include <climits>
+
+#include <QOpenGLContext>
+
+
+#ifndef GL_SHADER_STORAGE_BUFFER
+#define GL_SHADER_STORAGE_BUFFER 0x90D2
+#endif
+#ifndef GL_SHADER_STORAGE_BARRIER_BIT
+#define GL_SHADER_STORAGE_BARRIER_BIT 0x00002000
+#endif
+#ifndef GL_BUFFER_UPDATE_BARRIER_BIT
+#define GL_BUFFER_UPDATE_BARRIER_BIT 0x00000200
+#endif
+
+typedef void (QOPENGLF_APIENTRYP DispatchComputeProc)(GLuint numGroupsX, GLuint numGroupsY, GLuint numGroupsZ);
+typedef void (QOPENGLF_APIENTRYP MemoryBarrierProc)(GLbitfield barriers);
+
+// The horizons of the containers are stored one after the other, the bottom horizon
+// of a container (one value per column) followed by its left horizon (one per row).
+// The sides of the rasterizations of the poly are stored the same way, and each
+// rotation is described by the offsets of its sides and by its extents
+#define PLACEMENT_BUFFERS_GLSL                                                          \
+    "layout(std430, binding = 0) buffer Horizons { int horizon[]; };                 \n" \
+    "// offset of the bottom horizon, offset of the left horizon, width, height      \n" \
+    "layout(std430, binding = 1) readonly buffer Containers { ivec4 container[]; };  \n" \
+    "layout(std430, binding = 2) readonly buffer Sides { int side[]; };              \n" \
+    "// offsets of bottom, deltaY, left, deltaX, then width, height, maxTop, maxRight\n" \
+    "layout(std430, binding = 3) readonly buffer Rotations { ivec4 rotation[]; };    \n" \
+    "// rotation, container, from left, column or row                                \n" \
+    "layout(std430, binding = 4) readonly buffer Candidates { ivec4 candidate[]; };  \n" \
+    "// cost, drop                                                                   \n" \
+    "layout(std430, binding = 5) buffer Results { ivec2 result[]; };                 \n" \
+    "layout(std430, binding = 6) buffer Best { int bestCost; int bestIndex; };       \n" \
+    "                                                                                \n" \
+    "const int INVALID_COST = 2147483647;                                            \n"
+
+// One invocation per candidate, computes the drop and the cost as the packer does
+// (see RasterizedOutline2Packer::PackingField) and keeps the lowest cost in bestCost
+static const char *evaluate_cs_text[] = {
+    "#version 430 core                                                               \n"
+    "                                                                                \n"
+    "layout(local_size_x = 64) in;                                                   \n"
+    "                                                                                \n"
+    PLACEMENT_BUFFERS_GLSL
+    "                                                                                \n"
+    "uniform int numCandidates;                                                      \n"
+    "uniform int costFunction; // 0 min wasted space, 1 lowest horizon, 2 mixed      \n"
+    "uniform int minmax;                                                             \n"
+    "                                                                                \n"
+    "int costY(ivec4 c, ivec4 ro, ivec4 rs, int x, int y, bool atDrop)               \n"
+    "{                                                                               \n"
+    "    if (costFunction == 1 && atDrop)                                            \n"
+    "        return y + rs.z;                                                        \n"
+    "    int score = (costFunction == 1) ? -INVALID_COST : 0;                        \n"
+    "    for (int i = 0; i < rs.x; ++i) {                                            \n"
+    "        int b = side[ro.x + i];                                                 \n"
+    "        int h = horizon[c.x + x + i];                                           \n"
+    "        if (costFunction == 1) {                                                \n"
+    "            int d = side[ro.y + i];                                             \n"
+    "            score = max(score, (y + b + d < h) ? -(y + b) : y + b + d);         \n"
+    "        } else {                                                                \n"
+    "            score += (y + b < h) ? -(y + b) : y + b - h;                        \n"
+    "        }                                                                       \n"
+    "    }                                                                           \n"
+    "    if (costFunction == 2) {                                                    \n"
+    "        for (int j = 0; j < rs.y; ++j) {                                        \n"
+    "            int l = side[ro.z + j];                                             \n"
+    "            int h = horizon[c.y + y + j];                                       \n"
+    "            score += (x + l < h) ? -(c.z - x - l) : x + l - h;                  \n"
+    "        }                                                                       \n"
+    "    }                                                                           \n"
+    "    return score;                                                               \n"
+    "}                                                                               \n"
+    "                                                                                \n"
+    "int costX(ivec4 c, ivec4 ro, ivec4 rs, int x, int y, bool atDrop)               \n"
+    "{                                                                               \n"
+    "    if (costFunction == 1 && atDrop)                                            \n"
+    "        return x + rs.w;                                                        \n"
+    "    int score = (costFunction == 1) ? -INVALID_COST : 0;                        \n"
+    "    for (int j = 0; j < rs.y; ++j) {                                            \n"
+    "        int l = side[ro.z + j];                                                 \n"
+    "        int h = horizon[c.y + y + j];                                           \n"
+    "        if (costFunction == 1) {                                                \n"
+    "            int d = side[ro.w + j];                                             \n"
+    "            score = max(score, (x + l + d < h) ? -(x + l) : x + l + d);         \n"
+    "        } else {                                                                \n"
+    "            score += (x + l < h) ? -(x + l) : x + l - h;                        \n"
+    "        }                                                                       \n"
+    "    }                                                                           \n"
+    "    if (costFunction == 2) {                                                    \n"
+    "        // the penalty counts x above the horizon, as the packer does           \n"
+    "        for (int i = 0; i < rs.x; ++i) {                                        \n"
+    "            int b = side[ro.x + i];                                             \n"
+    "            int h = horizon[c.x + x + i];                                       \n"
+    "            score += (y + b < h) ? -(c.w - y - b) : x + b - h;                  \n"
+    "        }                                                                       \n"
+    "    }                                                                           \n"
+    "    return score;                                                               \n"
+    "}                                                                               \n"
+    "                                                                                \n"
+    "void main(void)                                                                 \n"
+    "{                                                                               \n"
+    "    int k = int(gl_GlobalInvocationID.x);                                       \n"
+    "    if (k >= numCandidates)                                                     \n"
+    "        return;                                                                 \n"
+    "    ivec4 cand = candidate[k];                                                  \n"
+    "    ivec4 c = container[cand.y];                                                \n"
+    "    ivec4 ro = rotation[2 * cand.x];                                            \n"
+    "    ivec4 rs = rotation[2 * cand.x + 1];                                        \n"
+    "    int cost = INVALID_COST;                                                    \n"
+    "    int drop = -INVALID_COST;                                                   \n"
+    "    if (cand.z == 0) {                                                          \n"
+    "        int x = cand.w;                                                         \n"
+    "        for (int i = 0; i < rs.x; ++i)                                          \n"
+    "            drop = max(drop, horizon[c.x + x + i] - side[ro.x + i]);            \n"
+    "        if (drop + rs.y < c.w) {                                                \n"
+    "            cost = costY(c, ro, rs, x, drop, true);                             \n"
+    "            if (minmax != 0)                                                    \n"
+    "                cost += costX(c, ro, rs, x, drop, false);                       \n"
+    "        }                                                                       \n"
+    "    } else {                                                                    \n"
+    "        int y = cand.w;                                                         \n"
+    "        for (int j = 0; j < rs.y; ++j)                                          \n"
+    "            drop = max(drop, horizon[c.y + y + j] - side[ro.z + j]);            \n"
+    "        if (drop + rs.x < c.z) {                                                \n"
+    "            cost = costX(c, ro, rs, drop, y, true);                             \n"
+    "            if (minmax != 0)                                                    \n"
+    "                cost += costY(c, ro, rs, drop, y, false);                       \n"
+    "        }                                                                       \n"
+    "    }                                                                           \n"
+    "    result[k] = ivec2(cost, drop);                                              \n"
+    "    if (cost != INVALID_COST)                                                   \n"
+    "        atomicMin(bestCost, cost);                                              \n"
+    "}                                                                               \n"
+};
+
+// Keeps in bestIndex the first candidate with the lowest cost, as the packer does
+static const char *select_cs_text[] = {
+    "#version 430 core                                                               \n"
+    "                                                                                \n"
+    "layout(local_size_x = 64) in;                                                   \n"
+    "                                                                                \n"
+    PLACEMENT_BUFFERS_GLSL
+    "                                                                                \n"
+    "uniform int numCandidates;                                                      \n"
+    "                                                                                \n"
+    "void main(void)                                                                 \n"
+    "{                                                                               \n"
+    "    int k = int(gl_GlobalInvocationID.x);                                       \n"
+    "    if (k < numCandidates && bestCost != INVALID_COST && result[k].x == bestCost)\n"
+    "        atomicMin(bestIndex, k);                                                \n"
+    "}                                                                               \n"
+};
+
+// One invocation per column and per row of the placed rasterization, raises the
+// horizons of the container to the top and to the right side of the poly
+static const char *place_cs_text[] = {
+    "#version 430 core                                                               \n"
+    "                                                                                \n"
+    "layout(local_size_x = 64) in;                                                   \n"
+    "                                                                                \n"
+    PLACEMENT_BUFFERS_GLSL
+    "                                                                                \n"
+    "uniform int placeContainer;                                                     \n"
+    "uniform int placeRotation;                                                      \n"
+    "uniform ivec2 placePosition;                                                    \n"
+    "                                                                                \n"
+    "void main(void)                                                                 \n"
+    "{                                                                               \n"
+    "    int i = int(gl_GlobalInvocationID.x);                                       \n"
+    "    ivec4 c = container[placeContainer];                                        \n"
+    "    ivec4 ro = rotation[2 * placeRotation];                                     \n"
+    "    ivec4 rs = rotation[2 * placeRotation + 1];                                 \n"
+    "    int x = placePosition.x;                                                    \n"
+    "    int y = placePosition.y;                                                    \n"
+    "    if (i < rs.x) {                                                             \n"
+    "        int h = c.x + x + i;                                                    \n"
+    "        horizon[h] = max(horizon[h], y + side[ro.x + i] + side[ro.y + i]);      \n"
+    "    }                                                                           \n"
+    "    if (i < rs.y) {                                                             \n"
+    "        int h = c.y + y + i;                                                    \n"
+    "        horizon[h] = max(horizon[h], x + side[ro.z + i] + side[ro.w + i]);      \n"
+    "    }                                                                           \n"
+    "}                                                                               \n"
+};
+
+constexpr GLuint PLACEMENT_GROUP_SIZE = 64;
+
+enum PlacementBuffer {
+    HORIZONS_BUFFER,
+    CONTAINERS_BUFFER,
+    SIDES_BUFFER,
+    ROTATIONS_BUFFER,
+    CANDIDATES_BUFFER,
+    RESULTS_BUFFER,
+    BEST_BUFFER,
+    PLACEMENT_BUFFER_COUNT
+};
+
+struct GPUPlacementEvaluator::Impl {
+    QOpenGLContext *owner = nullptr;
+    OpenGLFunctionsHandle glFuncs = nullptr;
+    DispatchComputeProc dispatchCompute = nullptr;
+    MemoryBarrierProc memoryBarrier = nullptr;
+    GLuint evaluateProgram = 0;
+    GLuint selectProgram = 0;
+    GLuint placeProgram = 0;
+    GLuint buffers[PLACEMENT_BUFFER_COUNT] = {};
+    std::size_t capacity[PLACEMENT_BUFFER_COUNT] = {};
+
+    int costFunction = 0;
+    bool minmax = false;
+
+    // the poly whose sides are in the buffers, and the number of its rotations there
+    const vcg::RasterizedOutline2 *uploadedPoly = nullptr;
+    int uploadedRotations = 0;
+
+    std::vector<GLint> sides;
+    std::vector<GLint> rotations;
+    std::vector<GLint> candidates;
+
+    bool current() const
+    {
+        return owner && QOpenGLContext::currentContext() == owner;
+    }
+
+    /* Stores the data in the buffer (if not null), which grows if it is too small */
+    void upload(PlacementBuffer b, const void *data, std::size_t bytes)
+    {
+        glFuncs->glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffers[b]);
+        if (bytes > capacity[b]) {
+            capacity[b] = std::max(bytes, 2 * capacity[b]);
+            glFuncs->glBufferData(GL_SHADER_STORAGE_BUFFER, capacity[b], nullptr, GL_DYNAMIC_DRAW);
+        }
+        if (data && bytes > 0)
+            glFuncs->glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, bytes, data);
+        glFuncs->glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    }
+
+    /* Uploads the sides of the first rotationNum rasterizations of the poly */
+    void uploadPoly(vcg::RasterizedOutline2& poly, int rotationNum)
+    {
+        sides.clear();
+        rotations.clear();
+        for (int rast_i = 0; rast_i < rotationNum; ++rast_i) {
+            int gw = poly.hasGrid(rast_i) ? poly.gridWidth(rast_i) : 0;
+            int gh = poly.hasGrid(rast_i) ? poly.gridHeight(rast_i) : 0;
+            GLint offset = sides.size();
+            rotations.insert(rotations.end(), { offset, offset + gw, offset + 2 * gw, offset + 2 * gw + gh });
+            if (gw > 0) {
+                sides.insert(sides.end(), poly.getBottom(rast_i).begin(), poly.getBottom(rast_i).end());
+                sides.insert(sides.end(), poly.getDeltaY(rast_i).begin(), poly.getDeltaY(rast_i).end());
+                sides.insert(sides.end(), poly.getLeft(rast_i).begin(), poly.getLeft(rast_i).end());
+                sides.insert(sides.end(), poly.getDeltaX(rast_i).begin(), poly.getDeltaX(rast_i).end());
+                rotations.insert(rotations.end(), { gw, gh, poly.getMaxTop(rast_i), poly.getMaxRight(rast_i) });
+            } else {
+                rotations.insert(rotations.end(), { 0, 0, 0, 0 });
+            }
+        }
+        // empty buffers cannot be bound
+        if (sides.empty())
+            sides.push_back(0);
+        upload(SIDES_BUFFER, sides.data(), sides.size() * sizeof(GLint));
+        upload(ROTATIONS_BUFFER, rotations.data(), rotations.size() * sizeof(GLint));
+        uploadedPoly = &poly;
+        uploadedRotations = rotationNum;
+    }
+
+    void bindBuffers()
+    {
+        for (int b = 0; b < PLACEMENT_BUFFER_COUNT; ++b)
+            glFuncs->glBindBufferBase(GL_SHADER_STORAGE_BUFFER, b, buffers[b]);
+    }
+
+    void unbindBuffers()
+    {
+        for (int b = 0; b < PLACEMENT_BUFFER_COUNT; ++b)
+            glFuncs->glBindBufferBase(GL_SHADER_STORAGE_BUFFER, b, 0);
+        glFuncs->glUseProgram(0);
+    }
+
+    static GLuint groups(int n)
+    {
+        return (GLuint(n) + PLACEMENT_GROUP_SIZE - 1) / PLACEMENT_GROUP_SIZE;
+    }
+};
+
+
+GPUPlacementEvaluator::GPUPlacementEvaluator()
+    : impl(new Impl)
+{
+}
+
+GPUPlacementEvaluator::~GPUPlacementEvaluator()
+{
+    // the objects are released with the context if it is no longer current
+    if (!impl->current())
+        return;
+    impl->glFuncs->glDeleteProgram(impl->evaluateProgram);
+    impl->glFuncs->glDeleteProgram(impl->selectProgram);
+    impl->glFuncs->glDeleteProgram(impl->placeProgram);
+    impl->glFuncs->glDeleteBuffers(PLACEMENT_BUFFER_COUNT, impl->buffers);
+}
+
+bool GPUPlacementEvaluator::begin(const std::vector<vcg::Point2i>& containerSizes, int costFunction, bool minmax)
+{
+    if (!impl->current() || containerSizes.empty())
+        return false;
+
+    std::vector<GLint> containers;
+    GLint horizonSize = 0;
+    for (const vcg::Point2i& size : containerSizes) {
+        containers.insert(containers.end(), { horizonSize, horizonSize + size.X(), size.X(), size.Y() });
+        horizonSize += size.X() + size.Y();
+    }
+    std::vector<GLint> horizons(horizonSize, 0);
+    impl->upload(HORIZONS_BUFFER, horizons.data(), horizons.size() * sizeof(GLint));
+    impl->upload(CONTAINERS_BUFFER, containers.data(), containers.size() * sizeof(GLint));
+
+    impl->costFunction = costFunction;
+    impl->minmax = minmax;
+    impl->uploadedPoly = nullptr;
+    impl->uploadedRotations = 0;
+    CHECK_GL_ERROR();
+    return true;
+}
+
+bool GPUPlacementEvaluator::evaluate(vcg::RasterizedOutline2& poly, int rotationNum, const std::vector<Candidate>& candidates,
+                                     int& best, vcg::Point2i& pos, int& cost)
+{
+    if (!impl->current())
+        return false;
+
+    OpenGLFunctionsHandle glFuncs = impl->glFuncs;
+    int numCandidates = candidates.size();
+
+    if (&poly != impl->uploadedPoly || rotationNum > impl->uploadedRotations)
+        impl->uploadPoly(poly, rotationNum);
+
+    impl->candidates.clear();
+    impl->candidates.reserve(4 * candidates.size());
+    for (const Candidate& c : candidates)
+        impl->candidates.insert(impl->candidates.end(), { c.rast, c.container, c.fromLeft, c.pos });
+    impl->upload(CANDIDATES_BUFFER, impl->candidates.data(), impl->candidates.size() * sizeof(GLint));
+    impl->upload(RESULTS_BUFFER, nullptr, candidates.size() * 2 * sizeof(GLint));
+    const GLint noBest[2] = { INT_MAX, INT_MAX };
+    impl->upload(BEST_BUFFER, noBest, sizeof(noBest));
+
+    impl->bindBuffers();
+
+    glFuncs->glUseProgram(impl->evaluateProgram);
+    glFuncs->glUniform1i(glFuncs->glGetUniformLocation(impl->evaluateProgram, "numCandidates"), numCandidates);
+    glFuncs->glUniform1i(glFuncs->glGetUniformLocation(impl->evaluateProgram, "costFunction"), impl->costFunction);
+    glFuncs->glUniform1i(glFuncs->glGetUniformLocation(impl->evaluateProgram, "minmax"), impl->minmax ? 1 : 0);
+    impl->dispatchCompute(Impl::groups(numCandidates), 1, 1);
+    impl->memoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+    glFuncs->glUseProgram(impl->selectProgram);
+    glFuncs->glUniform1i(glFuncs->glGetUniformLocation(impl->selectProgram, "numCandidates"), numCandidates);
+    impl->dispatchCompute(Impl::groups(numCandidates), 1, 1);
+    impl->memoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+
+    impl->unbindBuffers();
+
+    GLint bestValues[2];
+    glFuncs->glBindBuffer(GL_SHADER_STORAGE_BUFFER, impl->buffers[BEST_BUFFER]);
+    glFuncs->glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(bestValues), bestValues);
+
+    best = -1;
+    if (bestValues[1] >= 0 && bestValues[1] < numCandidates) {
+        GLint result[2];
+        glFuncs->glBindBuffer(GL_SHADER_STORAGE_BUFFER, impl->buffers[RESULTS_BUFFER]);
+        glFuncs->glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, bestValues[1] * sizeof(result), sizeof(result), result);
+        best = bestValues[1];
+        cost = result[0];
+        const Candidate& c = candidates[best];
+        pos = c.fromLeft ? vcg::Point2i(result[1], c.pos) : vcg::Point2i(c.pos, result[1]);
+    }
+    glFuncs->glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+    CHECK_GL_ERROR();
+    return true;
+}
+
+void GPUPlacementEvaluator::place(vcg::RasterizedOutline2& poly, int rast, int container, vcg::Point2i pos)
+{
+    if (!impl->current() || !poly.hasGrid(rast))
+        return;
+
+    OpenGLFunctionsHandle glFuncs = impl->glFuncs;
+
+    if (&poly != impl->uploadedPoly || rast >= impl->uploadedRotations)
+        impl->uploadPoly(poly, rast + 1);
+
+    impl->bindBuffers();
+    glFuncs->glUseProgram(impl->placeProgram);
+    glFuncs->glUniform1i(glFuncs->glGetUniformLocation(impl->placeProgram, "placeContainer"), container);
+    glFuncs->glUniform1i(glFuncs->glGetUniformLocation(impl->placeProgram, "placeRotation"), rast);
+    glFuncs->glUniform2i(glFuncs->glGetUniformLocation(impl->placeProgram, "placePosition"), pos.X(), pos.Y());
+    impl->dispatchCompute(Impl::groups(std::max(poly.gridWidth(rast), poly.gridHeight(rast))), 1, 1);
+    // the next evaluation reads the raised horizons
+    impl->memoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+    impl->unbindBuffers();
+
+    CHECK_GL_ERROR();
+}
+
+std::unique_ptr<GPUPlacementEvaluator> CreateGPUPlacementEvaluator()
+{
+    QOpenGLContext *context = QOpenGLContext::currentContext();
+    if (!context)
+        return nullptr;
+    if (!HasComputeShaders()) {
+        LOG_VERBOSE << "[GL] The context has no compute shaders";
+        return nullptr;
+    }
+
+    std::unique_ptr<GPUPlacementEvaluator> evaluator(new GPUPlacementEvaluator);
+    GPUPlacementEvaluator::Impl& impl = *evaluator->impl;
+    impl.dispatchCompute = reinterpret_cast<DispatchComputeProc>(context->getProcAddress("glDispatchCompute"));
+    impl.memoryBarrier = reinterpret_cast<MemoryBarrierProc>(context->getProcAddress("glMemoryBarrier"));
+    if (!impl.dispatchCompute || !impl.memoryBarrier)
+        return nullptr;
+
+    impl.owner = context;
+    impl.glFuncs = GetOpenGLFunctionsHandle();
+    impl.evaluateProgram = CompileComputeShader(evaluate_cs_text);
+    impl.selectProgram = CompileComputeShader(select_cs_text);
+    impl.placeProgram = CompileComputeShader(place_cs_text);
+    impl.glFuncs->glGenBuffers(PLACEMENT_BUFFER_COUNT, impl.buffers);
+    if (!impl.evaluateProgram || !impl.selectProgram || !impl.placeProgram) {
+        LOG_WARN << "[GL] Failed to build the placement shaders";
+        return nullptr;
+    }
+
+    CHECK_GL_ERROR();
+    return evaluator;
+}
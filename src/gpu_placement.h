@@ -0,0 +1,65 @@
+/*******************************************************************************
+    Copyright (c) 2021, Andrea Maggiordomo, Paolo Cignoni and Marco Tarini
+
+    This file is part of TextureDefrag, a reference implementation for
+    the paper ``Texture Defragmentation for Photo-Reconstructed 3D Models''
+    by Andrea Maggiordomo, Paolo Cignoni and Marco Tarini.
+
+    TextureDefrag is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    TextureDefrag is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with TextureDefrag. If not, see <https://www.gnu.org/licenses/>.
+*******************************************************************************/
+
+#ifndef GPU_PLACEMENT_H
+#define GPU_PLACEMENT_H
+
+#include <vcg/space/rasterized_outline2_packer.h>
+
+#include <memory>
+
+/* Evaluation of the candidate placements of the packer with compute shaders. The
+ * horizons of the containers stay in shader storage buffers for the whole packing,
+ * the candidates of all the rotations of a chart are evaluated by one dispatch and
+ * reduced to the first one of the lowest cost by a second one, so only the best
+ * candidate is read back, and the horizons are raised on the GPU after each
+ * placement. The drops and the costs are the integer ones of the packer, so the
+ * placements are the same as on the CPU.
+ *
+ * The objects belong to the OpenGL context current on the thread that creates the
+ * evaluator, and the evaluator declines the packings run by other threads (such as
+ * the concurrent permutation trials), which fall back to the CPU search */
+class GPUPlacementEvaluator : public vcg::RasterizedPlacementEvaluator {
+
+public:
+
+    ~GPUPlacementEvaluator();
+
+    bool begin(const std::vector<vcg::Point2i>& containerSizes, int costFunction, bool minmax) override;
+    bool evaluate(vcg::RasterizedOutline2& poly, int rotationNum, const std::vector<Candidate>& candidates,
+                  int& best, vcg::Point2i& pos, int& cost) override;
+    void place(vcg::RasterizedOutline2& poly, int rast, int container, vcg::Point2i pos) override;
+
+private:
+
+    friend std::unique_ptr<GPUPlacementEvaluator> CreateGPUPlacementEvaluator();
+
+    GPUPlacementEvaluator();
+
+    struct Impl;
+    std::unique_ptr<Impl> impl;
+};
+
+/* Returns an evaluator on the OpenGL context current on the calling thread, or
+ * nullptr if there is none or if it does not support compute shaders (OpenGL 4.3) */
+std::unique_ptr<GPUPlacementEvaluator> CreateGPUPlacementEvaluator();
+
+#endif // GPU_PLACEMENT_H
@@ -0,0 +1,232 @@
+/*******************************************************************************
+    Copyright (c) 2021, Andrea Maggiordomo, Paolo Cignoni and Marco Tarini
+
+    This file is part of TextureDefrag, a reference implementation for
+    the paper ``Texture Defragmentation for Photo-Reconstructed 3D Models''
+    by Andrea Maggiordomo, Paolo Cignoni and Marco Tarini.
+
+    TextureDefrag is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    TextureDefrag is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with TextureDefrag. If not, see <https://www.gnu.org/licenses/>.
+*******************************************************************************/
+
+#include "huge_pages.h"
+#include "logging.h"
+
+#include <fstream>
+#include <sstream>
+#include <mutex>
+#include <atomic>
+#include <unordered_map>
+#include <algorithm>
+
+#include <QImage>
+
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
+
+
+struct HugePageMapping {
+    std::size_t bytes;
+    bool hugetlb;
+};
+
+static std::atomic<bool> hugePagesEnabled(false);
+static std::atomic<bool> explicitHugePages(false);
+static std::atomic<std::size_t> hugePageThreshold(HUGE_PAGE_BYTES);
+
+// the buffers of the containers destroyed at exit can outlive the static objects
+// of this file, so the registry of the mappings is never destroyed
+static std::mutex& mappingsMutex = *new std::mutex();
+static std::unordered_map<void *, HugePageMapping>& mappings = *new std::unordered_map<void *, HugePageMapping>();
+static HugePageStats stats;
+
+void EnableHugePages(std::size_t thresholdBytes, bool explicitPages)
+{
+    hugePageThreshold = std::max(thresholdBytes, HUGE_PAGE_BYTES);
+    explicitHugePages = explicitPages;
+    hugePagesEnabled = true;
+}
+
+bool HugePagesEnabled()
+{
+    return hugePagesEnabled;
+}
+
+std::string TransparentHugePageMode()
+{
+    // the active mode is the bracketed one, e.g. "always [madvise] never"
+    std::ifstream in("/sys/kernel/mm/transparent_hugepage/enabled");
+    std::string line;
+    if (!in || !std::getline(in, line))
+        return "unavailable";
+    std::size_t open = line.find('[');
+    std::size_t close = line.find(']');
+    if (open == std::string::npos || close == std::string::npos || close < open)
+        return line;
+    return line.substr(open + 1, close - open - 1);
+}
+
+void *AllocateHugePages(std::size_t bytes)
+{
+#if defined(__linux__) && defined(MADV_HUGEPAGE)
+    if (!hugePagesEnabled || bytes < hugePageThreshold)
+        return nullptr;
+
+    const std::size_t size = ((bytes + HUGE_PAGE_BYTES - 1) / HUGE_PAGE_BYTES) * HUGE_PAGE_BYTES;
+    void *data = nullptr;
+    bool hugetlb = false;
+    bool fallback = false;
+
+#ifdef MAP_HUGETLB
+    if (explicitHugePages) {
+        void *p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (p != MAP_FAILED) {
+            data = p;
+            hugetlb = true;
+        } else {
+            fallback = true;
+        }
+    }
+#endif
+
+    if (data == nullptr) {
+        // over-allocate and trim the mapping to a huge page aligned range
+        void *p = mmap(nullptr, size + HUGE_PAGE_BYTES, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (p == MAP_FAILED)
+            return nullptr;
+        std::uintptr_t begin = reinterpret_cast<std::uintptr_t>(p);
+        std::uintptr_t aligned = ((begin + HUGE_PAGE_BYTES - 1) / HUGE_PAGE_BYTES) * HUGE_PAGE_BYTES;
+        if (aligned > begin)
+            munmap(p, aligned - begin);
+        std::size_t tail = (begin + size + HUGE_PAGE_BYTES) - (aligned + size);
+        if (tail > 0)
+            munmap(reinterpret_cast<void *>(aligned + size), tail);
+        data = reinterpret_cast<void *>(aligned);
+        // the pages are not touched yet, so they are backed by huge pages on the first touch
+        madvise(data, size, MADV_HUGEPAGE);
+    }
+
+    std::lock_guard<std::mutex> lock(mappingsMutex);
+    mappings[data] = HugePageMapping{size, hugetlb};
+    stats.mappedBytes += size;
+    stats.peakMappedBytes = std::max(stats.peakMappedBytes, stats.mappedBytes);
+    if (hugetlb)
+        stats.hugetlbBytes += size;
+    if (fallback)
+        stats.fallbacks++;
+    return data;
+#else
+    (void) bytes;
+    return nullptr;
+#endif
+}
+
+bool FreeHugePages(void *data)
+{
+#ifdef __linux__
+    if (data == nullptr)
+        return false;
+    HugePageMapping mapping;
+    {
+        std::lock_guard<std::mutex> lock(mappingsMutex);
+        auto it = mappings.find(data);
+        if (it == mappings.end())
+            return false;
+        mapping = it->second;
+        mappings.erase(it);
+        stats.mappedBytes -= mapping.bytes;
+        if (mapping.hugetlb)
+            stats.hugetlbBytes -= mapping.bytes;
+    }
+    munmap(data, mapping.bytes);
+    return true;
+#else
+    (void) data;
+    return false;
+#endif
+}
+
+void AdviseHugePages(const void *data, std::size_t bytes)
+{
+#if defined(__linux__) && defined(MADV_HUGEPAGE)
+    if (!hugePagesEnabled || data == nullptr || bytes < hugePageThreshold)
+        return;
+    std::uintptr_t begin = reinterpret_cast<std::uintptr_t>(data);
+    std::uintptr_t first = ((begin + HUGE_PAGE_BYTES - 1) / HUGE_PAGE_BYTES) * HUGE_PAGE_BYTES;
+    std::uintptr_t last = ((begin + bytes) / HUGE_PAGE_BYTES) * HUGE_PAGE_BYTES;
+    if (last <= first)
+        return;
+    {
+        std::lock_guard<std::mutex> lock(mappingsMutex);
+        // the buffers of AllocateHugePages are already advised
+        if (mappings.count(reinterpret_cast<void *>(begin)) > 0)
+            return;
+    }
+    if (madvise(reinterpret_cast<void *>(first), last - first, MADV_HUGEPAGE) == 0) {
+        std::lock_guard<std::mutex> lock(mappingsMutex);
+        stats.advisedBytes += last - first;
+    }
+#else
+    (void) data;
+    (void) bytes;
+#endif
+}
+
+static void FreeImagePixels(void *info)
+{
+    FreeHugePages(info);
+}
+
+std::shared_ptr<QImage> CreateLargeImage(int width, int height)
+{
+    if (width > 0 && height > 0) {
+        const std::size_t bytesPerLine = std::size_t(width) * 4;
+        void *data = AllocateHugePages(bytesPerLine * height);
+        if (data != nullptr)
+            return std::make_shared<QImage>(static_cast<uchar *>(data), width, height, (int) bytesPerLine, QImage::Format_ARGB32, FreeImagePixels, data);
+    }
+    return std::make_shared<QImage>(width, height, QImage::Format_ARGB32);
+}
+
+// Memory of the process backed by huge pages, in bytes, from the kB fields of the smaps
+static std::size_t ReadResidentHugePageBytes()
+{
+    std::ifstream in("/proc/self/smaps_rollup");
+    if (!in)
+        in.open("/proc/self/smaps");
+    std::size_t kb = 0;
+    std::string line;
+    while (std::getline(in, line)) {
+        if (line.compare(0, 14, "AnonHugePages:") == 0 || line.compare(0, 16, "Private_Hugetlb:") == 0 || line.compare(0, 15, "Shared_Hugetlb:") == 0) {
+            std::istringstream fields(line.substr(line.find(':') + 1));
+            std::size_t value = 0;
+            if (fields >> value)
+                kb += value;
+        }
+    }
+    return kb * 1024;
+}
+
+HugePageStats GetHugePageStats()
+{
+    HugePageStats s;
+    {
+        std::lock_guard<std::mutex> lock(mappingsMutex);
+        s = stats;
+    }
+#ifdef __linux__
+    s.residentBytes = ReadResidentHugePageBytes();
+#endif
+    return s;
+}
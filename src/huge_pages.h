@@ -0,0 +1,128 @@
+/*******************************************************************************
+    Copyright (c) 2021, Andrea Maggiordomo, Paolo Cignoni and Marco Tarini
+
+    This file is part of TextureDefrag, a reference implementation for
+    the paper ``Texture Defragmentation for Photo-Reconstructed 3D Models''
+    by Andrea Maggiordomo, Paolo Cignoni and Marco Tarini.
+
+    TextureDefrag is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    TextureDefrag is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with TextureDefrag. If not, see <https://www.gnu.org/licenses/>.
+*******************************************************************************/
+
+#ifndef HUGE_PAGES_H
+#define HUGE_PAGES_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <string>
+#include <vector>
+
+class QImage;
+
+/* Huge page backing of the large buffers. The mesh arrays, the occupancy grids
+ * of the packing and the texture sheet images are accessed at random over
+ * hundreds of megabytes, and with 4 KB pages most of the accesses miss the TLB.
+ * Once enabled, the allocations of at least the threshold are mapped directly,
+ * aligned to 2 MB and either advised as transparent huge pages or, if explicit
+ * pages are requested, taken from the hugetlb pool of the system (falling back
+ * to transparent pages when the pool is exhausted). The smaller allocations go
+ * to the default allocator. Only implemented on Linux, elsewhere the functions
+ * have no effect */
+
+constexpr std::size_t HUGE_PAGE_BYTES = std::size_t(2) << 20;
+
+// allocations below this size are left to the default allocator
+constexpr std::size_t DEFAULT_HUGE_PAGE_THRESHOLD = std::size_t(16) << 20;
+
+struct HugePageStats {
+    std::size_t mappedBytes = 0;     // current size of the buffers mapped for huge pages
+    std::size_t peakMappedBytes = 0;
+    std::size_t hugetlbBytes = 0;    // current size of the buffers in the hugetlb pool
+    std::size_t advisedBytes = 0;    // total size of the ranges of existing buffers advised
+    std::size_t residentBytes = 0;   // memory of the process actually backed by huge pages (AnonHugePages and hugetlb)
+    int fallbacks = 0;               // explicit allocations that fell back to transparent pages
+};
+
+/* Enables the huge page allocations of at least thresholdBytes (raised to the
+ * huge page size). Must be called before the buffers are allocated, since the
+ * buffers allocated before keep their pages */
+void EnableHugePages(std::size_t thresholdBytes, bool explicitPages);
+
+bool HugePagesEnabled();
+
+/* Transparent huge page mode of the system (always, madvise or never), for the log */
+std::string TransparentHugePageMode();
+
+/* Maps a buffer of the given size for huge pages, returns nullptr if huge pages
+ * are disabled, if the size is below the threshold or if the mapping fails */
+void *AllocateHugePages(std::size_t bytes);
+
+/* Unmaps a buffer returned by AllocateHugePages, returns false (and does nothing)
+ * if the buffer was not allocated by it */
+bool FreeHugePages(void *data);
+
+/* Advises the kernel to back the huge page aligned part of an existing range
+ * with transparent huge pages, the pages already touched are collapsed in the
+ * background. Ranges below the threshold are skipped */
+void AdviseHugePages(const void *data, std::size_t bytes);
+
+template <typename T>
+void AdviseHugePages(const std::vector<T>& v)
+{
+    if (!v.empty())
+        AdviseHugePages(v.data(), v.size() * sizeof(T));
+}
+
+/* ARGB32 image whose pixels are allocated with AllocateHugePages when possible */
+std::shared_ptr<QImage> CreateLargeImage(int width, int height);
+
+HugePageStats GetHugePageStats();
+
+/* Allocator of the containers of large buffers, allocates with AllocateHugePages
+ * and falls back to the default allocator */
+template <typename T>
+class HugePageAllocator {
+
+public:
+
+    typedef T value_type;
+
+    HugePageAllocator() = default;
+
+    template <typename U>
+    HugePageAllocator(const HugePageAllocator<U>&) { }
+
+    T *allocate(std::size_t n)
+    {
+        void *p = AllocateHugePages(n * sizeof(T));
+        if (p == nullptr)
+            p = ::operator new(n * sizeof(T));
+        return static_cast<T *>(p);
+    }
+
+    void deallocate(T *p, std::size_t n)
+    {
+        if (n * sizeof(T) < HUGE_PAGE_BYTES || !FreeHugePages(p))
+            ::operator delete(p);
+    }
+};
+
+template <typename T, typename U>
+bool operator==(const HugePageAllocator<T>&, const HugePageAllocator<U>&) { return true; }
+
+template <typename T, typename U>
+bool operator!=(const HugePageAllocator<T>&, const HugePageAllocator<U>&) { return false; }
+
+#endif // HUGE_PAGES_H
@@ -0,0 +1,165 @@
+/*******************************************************************************
+    Copyright (c) 2021, Andrea Maggiordomo, Paolo Cignoni and Marco Tarini
+
+    This file is part of TextureDefrag, a reference implementation for
+    the paper ``Texture Defragmentation for Photo-Reconstructed 3D Models''
+    by Andrea Maggiordomo, Paolo Cignoni and Marco Tarini.
+
+    TextureDefrag is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    TextureDefrag is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with TextureDefrag. If not, see <https://www.gnu.org/licenses/>.
+*******************************************************************************/
+
+#include "image_writers.h"
+
+#include <cstring>
+
+static void AppendU8(std::vector<unsigned char>& out, uint8_t v);
+static void AppendU16(std::vector<unsigned char>& out, uint16_t v);
+static void AppendU32(std::vector<unsigned char>& out, uint32_t v);
+static void AppendU64(std::vector<unsigned char>& out, uint64_t v);
+
+bool EncodeTGA(const unsigned char *bgra, int width, int height, std::size_t bytesPerLine,
+               std::vector<unsigned char>& out)
+{
+    std::size_t rowBytes = std::size_t(width) * 4;
+    out.clear();
+    out.reserve(18 + rowBytes * height);
+    if (!EncodeTGAHeader(width, height, out))
+        return false;
+
+    // tga pixels are stored as BGRA, so the rows are copied as they are
+    std::size_t offset = out.size();
+    out.resize(offset + rowBytes * height);
+    for (int y = 0; y < height; ++y)
+        std::memcpy(out.data() + offset + y * rowBytes, bgra + y * bytesPerLine, rowBytes);
+
+    return true;
+}
+
+bool EncodeTGAHeader(int width, int height, std::vector<unsigned char>& out)
+{
+    out.clear();
+    if (width <= 0 || height <= 0 || width > 0xFFFF || height > 0xFFFF)
+        return false;
+
+    AppendU8(out, 0);  // no image id
+    AppendU8(out, 0);  // no color map
+    AppendU8(out, 2);  // uncompressed true-color image
+    AppendU16(out, 0); // color map specification (unused)
+    AppendU16(out, 0);
+    AppendU8(out, 0);
+    AppendU16(out, 0); // x origin
+    AppendU16(out, 0); // y origin
+    AppendU16(out, uint16_t(width));
+    AppendU16(out, uint16_t(height));
+    AppendU8(out, 32);   // bits per pixel
+    AppendU8(out, 0x28); // 8 alpha bits, top-left origin
+    return true;
+}
+
+bool EncodeKTX2BC7(const unsigned char *blocks, std::size_t size, int width, int height,
+                   std::vector<unsigned char>& out)
+{
+    out.clear();
+    if (width <= 0 || height <= 0)
+        return false;
+
+    std::size_t blocksX = (width + 3) / 4;
+    std::size_t blocksY = (height + 3) / 4;
+    if (size != blocksX * blocksY * 16)
+        return false;
+
+    const uint32_t VK_FORMAT_BC7_SRGB_BLOCK = 146;
+    const uint8_t KHR_DF_MODEL_BC7 = 134;
+    const uint8_t KHR_DF_PRIMARIES_BT709 = 1;
+    const uint8_t KHR_DF_TRANSFER_SRGB = 2;
+
+    // file layout: identifier (12), header (36), index (32), level index (24),
+    // data format descriptor (44), padding to the 16-byte block alignment, level 0
+    const uint32_t dfdOffset = 12 + 36 + 32 + 24;
+    const uint32_t dfdLength = 4 + 24 + 16;
+    const uint64_t levelOffset = (dfdOffset + dfdLength + 15) & ~uint64_t(15);
+
+    static const unsigned char identifier[12] = { 0xAB, 'K', 'T', 'X', ' ', '2', '0', 0xBB, '\r', '\n', 0x1A, '\n' };
+    out.reserve(levelOffset + size);
+    out.insert(out.end(), identifier, identifier + 12);
+
+    AppendU32(out, VK_FORMAT_BC7_SRGB_BLOCK);
+    AppendU32(out, 1); // typeSize
+    AppendU32(out, uint32_t(width));
+    AppendU32(out, uint32_t(height));
+    AppendU32(out, 0); // pixelDepth
+    AppendU32(out, 0); // layerCount
+    AppendU32(out, 1); // faceCount
+    AppendU32(out, 1); // levelCount
+    AppendU32(out, 0); // no supercompression
+
+    AppendU32(out, dfdOffset);
+    AppendU32(out, dfdLength);
+    AppendU32(out, 0); // no key/value data
+    AppendU32(out, 0);
+    AppendU64(out, 0); // no supercompression global data
+    AppendU64(out, 0);
+
+    AppendU64(out, levelOffset);
+    AppendU64(out, size);
+    AppendU64(out, size);
+
+    // basic data format descriptor block with a single 128-bit sample
+    AppendU32(out, dfdLength);
+    AppendU32(out, 0);                // vendorId (khronos), descriptorType (basic)
+    AppendU32(out, 2 | (24 + 16) << 16); // versionNumber, descriptorBlockSize
+    AppendU8(out, KHR_DF_MODEL_BC7);
+    AppendU8(out, KHR_DF_PRIMARIES_BT709);
+    AppendU8(out, KHR_DF_TRANSFER_SRGB);
+    AppendU8(out, 0);                 // flags (straight alpha)
+    AppendU8(out, 3);                 // texel block dimensions minus one
+    AppendU8(out, 3);
+    AppendU8(out, 0);
+    AppendU8(out, 0);
+    AppendU32(out, 16);               // bytesPlane0
+    AppendU32(out, 0);                // bytesPlane4-7
+    AppendU32(out, 127 << 16);        // bitOffset 0, bitLength 127, channel 0 (color)
+    AppendU32(out, 0);                // samplePosition
+    AppendU32(out, 0);                // sampleLower
+    AppendU32(out, 0xFFFFFFFF);       // sampleUpper
+
+    out.resize(levelOffset, 0);
+    out.insert(out.end(), blocks, blocks + size);
+    return true;
+}
+
+// -- static functions ---------------------------------------------------------
+
+static void AppendU8(std::vector<unsigned char>& out, uint8_t v)
+{
+    out.push_back(v);
+}
+
+static void AppendU16(std::vector<unsigned char>& out, uint16_t v)
+{
+    out.push_back((unsigned char) (v & 0xFF));
+    out.push_back((unsigned char) (v >> 8));
+}
+
+static void AppendU32(std::vector<unsigned char>& out, uint32_t v)
+{
+    for (int i = 0; i < 4; ++i)
+        out.push_back((unsigned char) ((v >> (8 * i)) & 0xFF));
+}
+
+static void AppendU64(std::vector<unsigned char>& out, uint64_t v)
+{
+    for (int i = 0; i < 8; ++i)
+        out.push_back((unsigned char) ((v >> (8 * i)) & 0xFF));
+}
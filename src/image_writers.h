@@ -0,0 +1,47 @@
+/*******************************************************************************
+    Copyright (c) 2021, Andrea Maggiordomo, Paolo Cignoni and Marco Tarini
+
+    This file is part of TextureDefrag, a reference implementation for
+    the paper ``Texture Defragmentation for Photo-Reconstructed 3D Models''
+    by Andrea Maggiordomo, Paolo Cignoni and Marco Tarini.
+
+    TextureDefrag is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    TextureDefrag is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with TextureDefrag. If not, see <https://www.gnu.org/licenses/>.
+*******************************************************************************/
+
+
+#ifndef IMAGE_WRITERS_H
+#define IMAGE_WRITERS_H
+
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+/* Encodes a 32-bit image stored as BGRA bytes (the memory layout of
+ * QImage::Format_ARGB32 on little-endian machines) as an uncompressed 32-bit
+ * tga file with top-left origin. Returns false if the encoding fails. */
+bool EncodeTGA(const unsigned char *bgra, int width, int height, std::size_t bytesPerLine,
+               std::vector<unsigned char>& out);
+
+/* Returns the header of the tga file written by EncodeTGA(), the BGRA rows follow
+ * top to bottom without padding. Returns false if the size is not supported. */
+bool EncodeTGAHeader(int width, int height, std::vector<unsigned char>& out);
+
+/* Wraps the BC7 blocks of a single 2D image in a KTX2 container (one mip level,
+ * no supercompression). The blocks are stored in row-major order starting from
+ * the top-left corner of the image, and the texels are sRGB encoded. Returns
+ * false if the size of the block data does not match the image size. */
+bool EncodeKTX2BC7(const unsigned char *blocks, std::size_t size, int width, int height,
+                   std::vector<unsigned char>& out);
+
+#endif // IMAGE_WRITERS_H
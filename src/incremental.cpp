@@ -0,0 +1,246 @@
+/*******************************************************************************
+    Copyright (c) 2021, Andrea Maggiordomo, Paolo Cignoni and Marco Tarini
+
+    This file is part of TextureDefrag, a reference implementation for
+    the paper ``Texture Defragmentation for Photo-Reconstructed 3D Models''
+    by Andrea Maggiordomo, Paolo Cignoni and Marco Tarini.
+
+    TextureDefrag is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    TextureDefrag is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with TextureDefrag. If not, see <https://www.gnu.org/licenses/>.
+*******************************************************************************/
+
+#include "incremental.h"
+#include "tiling.h"
+#include "seam_remover.h"
+#include "mesh.h"
+#include "mesh_graph.h"
+#include "mesh_attribute.h"
+#include "mesh_cache.h"
+#include "logging.h"
+#include "utils.h"
+#include "run_report.h"
+
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <cstring>
+
+
+/* Hash of a face and its lowest wedge, where the comparison of the wedges starts so
+ * that the faces match whatever vertex they start from */
+struct FaceHash {
+    uint64_t hash;
+    int first;
+};
+
+static void FaceWedges(const MeshFace& f, const TexCoordStorage& tcs, float w[3][6]);
+static FaceHash HashFace(const MeshFace& f, const TexCoordStorage& tcs);
+static bool SameFace(const MeshFace& f1, const TexCoordStorage& tcs1, int first1, const MeshFace& f2, const TexCoordStorage& tcs2, int first2);
+
+
+AlgoStateHandle OptimizeIncremental(GraphHandle& graph, const AlgoParameters& params, const std::string& snapshotPath, IncrementalCharts& kept)
+{
+    Mesh& m = graph->mesh;
+
+    Mesh pm;
+    TextureObjectHandle previousTextures;
+    StageSnapshot snapshot;
+    if (!LoadStageSnapshot(snapshotPath, pm, previousTextures, snapshot) || snapshot.stage != SnapshotStage::Packing)
+        return nullptr;
+    previousTextures = nullptr;
+
+    auto wtcsa = GetWedgeTexCoordStorageAttribute(m);
+    auto previouswtcsa = GetWedgeTexCoordStorageAttribute(pm);
+
+    const int fn = (int) m.face.size();
+    const int previousFn = (int) pm.face.size();
+
+    std::vector<FaceHash> hashes(fn);
+    std::vector<FaceHash> previousHashes(previousFn);
+    #pragma omp parallel for schedule(static, 4096)
+    for (int i = 0; i < fn; ++i)
+        hashes[i] = HashFace(m.face[i], wtcsa[m.face[i]]);
+    #pragma omp parallel for schedule(static, 4096)
+    for (int i = 0; i < previousFn; ++i)
+        previousHashes[i] = HashFace(pm.face[i], previouswtcsa[pm.face[i]]);
+
+    std::unordered_multimap<uint64_t, int> previousFaces;
+    previousFaces.reserve(previousFn);
+    for (int i = 0; i < previousFn; ++i)
+        previousFaces.emplace(previousHashes[i].hash, i);
+
+    // the face matched to each face of the other mesh, and the rotation of the
+    // wedges: wedge k of m.face[i] is wedge (k + rotation[i]) % 3 of its match
+    std::vector<int> match(fn, -1);
+    std::vector<int> previousMatch(previousFn, -1);
+    std::vector<int> rotation(fn, 0);
+    for (int i = 0; i < fn; ++i) {
+        auto range = previousFaces.equal_range(hashes[i].hash);
+        for (auto it = range.first; it != range.second; ++it) {
+            int pi = it->second;
+            if (previousMatch[pi] == -1 && SameFace(m.face[i], wtcsa[m.face[i]], hashes[i].first, pm.face[pi], previouswtcsa[pm.face[pi]], previousHashes[pi].first)) {
+                match[i] = pi;
+                previousMatch[pi] = i;
+                rotation[i] = (previousHashes[pi].first - hashes[i].first + 3) % 3;
+                break;
+            }
+        }
+    }
+    std::unordered_multimap<uint64_t, int>().swap(previousFaces);
+
+    // the previous chart of each input chart whose faces all match faces of that chart
+    std::unordered_map<RegionID, RegionID> inputTarget;
+    for (const auto& entry : graph->charts) {
+        RegionID target = INVALID_ID;
+        for (auto fptr : entry.second->fpVec) {
+            int i = (int) tri::Index(m, fptr);
+            RegionID id = (match[i] != -1) ? pm.face[match[i]].id : INVALID_ID;
+            if (id == INVALID_ID || (target != INVALID_ID && id != target)) {
+                target = INVALID_ID;
+                break;
+            }
+            target = id;
+        }
+        inputTarget[entry.first] = target;
+    }
+
+    // a previous chart is kept if its faces are all matched and made of whole input
+    // charts
+    RegionID nextId = 0;
+    for (const auto& f : m.face)
+        nextId = std::max(nextId, f.id + 1);
+
+    std::map<RegionID, int> numMerges;
+    for (const auto& entry : snapshot.graph->charts) {
+        const ChartHandle& chart = entry.second;
+        bool keep = true;
+        for (auto pf : chart->fpVec) {
+            int i = previousMatch[tri::Index(pm, pf)];
+            if (i == -1 || inputTarget[m.face[i].id] != entry.first) {
+                keep = false;
+                break;
+            }
+        }
+        if (!keep)
+            continue;
+
+        // the faces take the tex coords and the topology of the chart, their vertices
+        // are only shared within their input charts
+        const RegionID id = nextId++;
+        for (auto pf : chart->fpVec) {
+            const int i = previousMatch[tri::Index(pm, pf)];
+            MeshFace& f = m.face[i];
+            for (int k = 0; k < 3; ++k) {
+                const int pk = (k + rotation[i]) % 3;
+                f.WT(k) = pf->WT(pk);
+                f.V(k)->T() = f.WT(k);
+                Mesh::FacePointer pg = pf->FFp(pk);
+                const int g = (pg == pf) ? -1 : previousMatch[tri::Index(pm, pg)];
+                if (g == -1 || pg->id != entry.first) {
+                    f.FFp(k) = &f;
+                    f.FFi(k) = k;
+                } else {
+                    f.FFp(k) = &m.face[g];
+                    f.FFi(k) = (pf->FFi(pk) - rotation[g] + 3) % 3;
+                }
+            }
+            f.id = id;
+        }
+        kept.kept.insert(id);
+        kept.keptFaces += chart->FN();
+        numMerges[id] = chart->numMerges;
+
+        // the anchor face of the chart, the area of its input chart is the area not
+        // resampled (the faces moved by the previous optimization are not known)
+        auto it = snapshot.anchorMap.find(chart);
+        if (it != snapshot.anchorMap.end() && previousMatch[it->second] != -1) {
+            const MeshFace& anchor = m.face[previousMatch[it->second]];
+            kept.anchors[id] = previousMatch[it->second];
+            for (auto pf : chart->fpVec) {
+                const MeshFace& f = m.face[previousMatch[tri::Index(pm, pf)]];
+                if (f.initialId == anchor.initialId)
+                    kept.anchoredArea += Area3D(f);
+            }
+        }
+    }
+
+    std::vector<Mesh::FacePointer> faces;
+    for (auto& f : m.face)
+        if (kept.kept.count(f.id) == 0)
+            faces.push_back(&f);
+
+    LOG_INFO << "Incremental optimization: " << kept.kept.size() << " of " << snapshot.graph->charts.size() << " charts of "
+             << snapshotPath << " kept (" << kept.keptFaces << " faces), optimizing " << faces.size() << " faces";
+    ReportValue("optimization/incremental", "kept_charts", kept.kept.size());
+    ReportValue("optimization/incremental", "kept_faces", kept.keptFaces);
+    ReportValue("optimization/incremental", "optimized_faces", faces.size());
+
+    snapshot.graph = nullptr;
+    snapshot.anchorMap.clear();
+
+    AlgoStateHandle state = OptimizeRegion(graph, params, faces);
+    for (const auto& entry : numMerges)
+        graph->GetChart(entry.first)->numMerges = entry.second;
+
+    return state;
+}
+
+
+// -- static functions ---------------------------------------------------------
+
+/* Position, input tex coord and texture index of the wedges, in single precision
+ * so that the meshes read again from text files still match */
+static void FaceWedges(const MeshFace& f, const TexCoordStorage& tcs, float w[3][6])
+{
+    for (int k = 0; k < 3; ++k) {
+        float v[6] = { float(f.cP(k)[0]), float(f.cP(k)[1]), float(f.cP(k)[2]),
+                       float(tcs.tc[k].U()), float(tcs.tc[k].V()), float(tcs.tc[k].N()) };
+        for (int j = 0; j < 6; ++j)
+            w[k][j] = (v[j] == 0) ? 0.0f : v[j]; // -0 hashes as 0
+    }
+}
+
+static FaceHash HashFace(const MeshFace& f, const TexCoordStorage& tcs)
+{
+    float w[3][6];
+    FaceWedges(f, tcs, w);
+
+    FaceHash fh;
+    fh.first = 0;
+    for (int k = 1; k < 3; ++k)
+        if (std::lexicographical_compare(w[k], w[k] + 6, w[fh.first], w[fh.first] + 6))
+            fh.first = k;
+
+    const uint64_t prime = 1099511628211ULL;
+    fh.hash = 1469598103934665603ULL;
+    for (int k = 0; k < 3; ++k) {
+        for (float c : w[(fh.first + k) % 3]) {
+            uint32_t bits;
+            std::memcpy(&bits, &c, sizeof(bits));
+            fh.hash = (fh.hash ^ bits) * prime;
+        }
+    }
+    return fh;
+}
+
+static bool SameFace(const MeshFace& f1, const TexCoordStorage& tcs1, int first1, const MeshFace& f2, const TexCoordStorage& tcs2, int first2)
+{
+    float w1[3][6];
+    float w2[3][6];
+    FaceWedges(f1, tcs1, w1);
+    FaceWedges(f2, tcs2, w2);
+    for (int k = 0; k < 3; ++k)
+        if (!std::equal(w1[(first1 + k) % 3], w1[(first1 + k) % 3] + 6, w2[(first2 + k) % 3]))
+            return false;
+    return true;
+}
@@ -0,0 +1,58 @@
+/*******************************************************************************
+    Copyright (c) 2021, Andrea Maggiordomo, Paolo Cignoni and Marco Tarini
+
+    This file is part of TextureDefrag, a reference implementation for
+    the paper ``Texture Defragmentation for Photo-Reconstructed 3D Models''
+    by Andrea Maggiordomo, Paolo Cignoni and Marco Tarini.
+
+    TextureDefrag is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    TextureDefrag is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with TextureDefrag. If not, see <https://www.gnu.org/licenses/>.
+*******************************************************************************/
+
+#ifndef INCREMENTAL_H
+#define INCREMENTAL_H
+
+#include "types.h"
+
+#include <string>
+#include <set>
+#include <map>
+
+struct AlgoParameters;
+
+/* Incremental re-defragmentation of an edited mesh. The faces of the prepared mesh
+ * are matched to the faces of the packing snapshot of a previous run on the mesh
+ * before the edit (see mesh_cache.h) by hashing their positions, input tex coords
+ * and texture indices. The charts of the previous atlas whose faces are all
+ * unchanged, and made of whole input charts, are kept with their tex coords and
+ * their topology; the other faces are optimized as a single tile whose borders
+ * towards the kept charts are frozen (see OptimizeRegion). The kept charts are not
+ * rotated again, so with the packing layout of the previous run they also keep
+ * their placement (see AlgoParameters::packingLayoutFile), and the time of the
+ * optimization and of the packing depends on the size of the edit rather than on
+ * the size of the mesh */
+
+struct IncrementalCharts {
+    std::set<RegionID> kept;            // ids of the kept charts
+    std::map<RegionID, int> anchors;    // anchor faces of the kept charts that have one (see RotateChartsForResampling)
+    double anchoredArea = 0;            // 3D area of the input charts of the anchors
+    int keptFaces = 0;
+};
+
+/* Keeps the unchanged charts of the snapshot of the previous run and optimizes the
+ * other faces of the graph, which is rebuilt. The charts of the graph must have
+ * been reoriented (see ReorientCharts). Returns null, leaving the graph untouched,
+ * if the snapshot cannot be loaded or is not a snapshot of the packing stage */
+AlgoStateHandle OptimizeIncremental(GraphHandle& graph, const AlgoParameters& params, const std::string& snapshotPath, IncrementalCharts& kept);
+
+#endif // INCREMENTAL_H
@@ -0,0 +1,180 @@
+/*******************************************************************************
+    Copyright (c) 2021, Andrea Maggiordomo, Paolo Cignoni and Marco Tarini
+
+    This file is part of TextureDefrag, a reference implementation for
+    the paper ``Texture Defragmentation for Photo-Reconstructed 3D Models''
+    by Andrea Maggiordomo, Paolo Cignoni and Marco Tarini.
+
+    TextureDefrag is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    TextureDefrag is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with TextureDefrag. If not, see <https://www.gnu.org/licenses/>.
+*******************************************************************************/
+
+#ifndef INDEXED_HEAP_H
+#define INDEXED_HEAP_H
+
+#include <vector>
+#include <unordered_map>
+#include <utility>
+#include <functional>
+
+#include "utils.h"
+
+/* Binary min-heap of (key, priority) pairs that stores at most one entry per
+ * key. Pushing an existing key updates its priority in place, and keys can be
+ * erased at any time, so the heap size is always equal to the number of live
+ * keys (no stale entries need to be filtered or purged). Entries with equal
+ * priorities are ordered by KeyOrder, if given, so that the order in which they
+ * are popped does not depend on the order in which they were pushed. */
+template <typename Key>
+struct NoKeyOrder {
+    bool operator()(const Key&, const Key&) const { return false; }
+};
+
+template <typename Key, typename Priority, typename Hash = std::hash<Key>, typename KeyOrder = NoKeyOrder<Key>>
+class IndexedHeap {
+
+public:
+
+    typedef std::pair<Key, Priority> Entry;
+    typedef typename std::vector<Entry>::const_iterator const_iterator;
+
+    /* Iterates the entries in heap order, pushing them in this order into an
+     * empty heap rebuilds the same heap */
+    const_iterator begin() const { return heap.begin(); }
+    const_iterator end() const { return heap.end(); }
+
+    bool empty() const { return heap.empty(); }
+    std::size_t size() const { return heap.size(); }
+
+    const Entry& top() const
+    {
+        ensure(!heap.empty());
+        return heap.front();
+    }
+
+    void pop()
+    {
+        ensure(!heap.empty());
+        RemoveAt(0);
+    }
+
+    /* Inserts the entry, or updates the priority if the key is already in the heap */
+    void push(const Entry& entry)
+    {
+        auto it = pos.find(entry.first);
+        if (it == pos.end()) {
+            pos[entry.first] = heap.size();
+            heap.push_back(entry);
+            SiftUp(heap.size() - 1);
+        } else {
+            std::size_t i = it->second;
+            Priority old = heap[i].second;
+            heap[i].second = entry.second;
+            if (entry.second < old)
+                SiftUp(i);
+            else
+                SiftDown(i);
+        }
+    }
+
+    /* Removes the key from the heap, returns false if the key was not found */
+    bool erase(const Key& key)
+    {
+        auto it = pos.find(key);
+        if (it == pos.end())
+            return false;
+        RemoveAt(it->second);
+        return true;
+    }
+
+    bool contains(const Key& key) const
+    {
+        return pos.find(key) != pos.end();
+    }
+
+    void clear()
+    {
+        heap.clear();
+        pos.clear();
+    }
+
+private:
+
+    std::vector<Entry> heap;
+    std::unordered_map<Key, std::size_t, Hash> pos;
+    KeyOrder keyOrder;
+
+    bool Precedes(std::size_t i, std::size_t j) const
+    {
+        if (heap[i].second < heap[j].second)
+            return true;
+        if (heap[j].second < heap[i].second)
+            return false;
+        return keyOrder(heap[i].first, heap[j].first);
+    }
+
+    void RemoveAt(std::size_t i)
+    {
+        pos.erase(heap[i].first);
+        std::size_t last = heap.size() - 1;
+        if (i != last) {
+            heap[i] = heap[last];
+            pos[heap[i].first] = i;
+            heap.pop_back();
+            SiftDown(i);
+            SiftUp(i);
+        } else {
+            heap.pop_back();
+        }
+    }
+
+    void Swap(std::size_t i, std::size_t j)
+    {
+        std::swap(heap[i], heap[j]);
+        pos[heap[i].first] = i;
+        pos[heap[j].first] = j;
+    }
+
+    void SiftUp(std::size_t i)
+    {
+        while (i > 0) {
+            std::size_t parent = (i - 1) / 2;
+            if (Precedes(i, parent)) {
+                Swap(i, parent);
+                i = parent;
+            } else {
+                break;
+            }
+        }
+    }
+
+    void SiftDown(std::size_t i)
+    {
+        std::size_t n = heap.size();
+        while (true) {
+            std::size_t smallest = i;
+            std::size_t l = 2 * i + 1;
+            std::size_t r = 2 * i + 2;
+            if (l < n && Precedes(l, smallest))
+                smallest = l;
+            if (r < n && Precedes(r, smallest))
+                smallest = r;
+            if (smallest == i)
+                break;
+            Swap(i, smallest);
+            i = smallest;
+        }
+    }
+};
+
+#endif // INDEXED_HEAP_H
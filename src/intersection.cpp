@@ -21,26 +21,68 @@
 
 #include "intersection.h"
 #include "utils.h"
+#include "cpu_features.h"
 
 #include <vcg/space/index/grid_util2d.h>
 #include <vcg/space/index/grid_util.h>
 #include <vcg/space/intersection2.h>
 
 #include <unordered_map>
+#include <algorithm>
+#include <cmath>
 
 
-struct Point2iHasher {
-    std::size_t operator()(const vcg::Point2i& p) const noexcept
+/* Segment endpoints stored as a structure of arrays, so that the pairwise tests
+ * of a grid cell run over contiguous buffers */
+struct SegmentBuffer {
+    std::vector<double> x0;
+    std::vector<double> y0;
+    std::vector<double> x1;
+    std::vector<double> y1;
+
+    int Size() const { return (int) x0.size(); }
+
+    void Append(const std::vector<HalfEdge>& heVec)
+    {
+        for (const auto& he : heVec) {
+            vcg::Point2d p0 = he.P0();
+            vcg::Point2d p1 = he.P1();
+            x0.push_back(p0[0]);
+            y0.push_back(p0[1]);
+            x1.push_back(p1[0]);
+            y1.push_back(p1[1]);
+        }
+    }
+
+    void Clear()
     {
-        std::size_t seed = 0;
-        seed ^= std::hash<int>()(p[0]) + 0x9e3779b9 + (seed << 6) + (seed >> 2);
-        seed ^= std::hash<int>()(p[1]) + 0x9e3779b9 + (seed << 6) + (seed >> 2);
-        return seed;
+        x0.clear();
+        y0.clear();
+        x1.clear();
+        y1.clear();
     }
 };
 
+/* Uniform grid stored in compressed row format: the segments overlapping cell c
+ * are segments[offset[c]]...segments[offset[c+1]-1], sorted by index */
+struct SegmentGrid {
+    vcg::Box2d bbox;
+    vcg::Point2i siz;
+    vcg::Point2d voxel;
+    std::vector<int> offset;
+    std::vector<int> segments;
+
+    int CellIndex(int h, int k) const { return k * siz[0] + h; }
+    int CellCoord(double t, int dim) const;
+};
+
 
 static vcg::Box2d ComputeBox(const std::vector<HalfEdge>& hev);
+static void BuildSegmentGrid(const SegmentBuffer& sb, SegmentGrid& grid);
+static void FindIntersectingPairs(const SegmentBuffer& sb, const SegmentGrid& grid, int firstSetSize, const std::function<bool(int, int)>& discard,
+                                  bool stopAtFirst, std::vector<std::pair<int, int>>& pairs);
+static std::vector<std::pair<int, int>> IntersectionPairs(const std::vector<HalfEdge>& heVec, int firstSetSize, const HalfEdgePairPredicate& discard, bool stopAtFirst);
+SIMD_DISPATCH static void IntersectSegmentBlock(const SegmentBuffer& cb, int j, int kbegin, int kend, std::vector<char>& hit);
 
 
 bool SegmentBoxIntersection(const Segment& seg, const vcg::Box2d& box)
@@ -63,128 +105,172 @@ bool SegmentBoxIntersection(const Segment& seg, const vcg::Box2d& box)
             box.max[1] >= std::max(seg.P0()[1], seg.P1()[1]));
 }
 
-std::vector<HalfEdgePair> CrossIntersection(const std::vector<HalfEdge>& heVec1, const std::vector<HalfEdge>& heVec2)
+std::vector<HalfEdgePair> CrossIntersection(const std::vector<HalfEdge>& heVec1, const std::vector<HalfEdge>& heVec2, const HalfEdgePairPredicate& discard)
 {
-    using HalfEdgeID = std::pair<int, int>;
+    std::vector<HalfEdgePair> isects;
+    if (heVec1.empty() || heVec2.empty())
+        return isects;
 
+    std::vector<HalfEdge> heVec;
+    heVec.reserve(heVec1.size() + heVec2.size());
+    heVec.insert(heVec.end(), heVec1.begin(), heVec1.end());
+    heVec.insert(heVec.end(), heVec2.begin(), heVec2.end());
+
+    for (const auto& p : IntersectionPairs(heVec, heVec1.size(), discard, false))
+        isects.push_back(std::make_pair(heVec[p.first], heVec[p.second]));
+
+    return isects;
+}
+
+bool CrossIntersectionAny(const std::vector<HalfEdge>& heVec1, const std::vector<HalfEdge>& heVec2, const HalfEdgePairPredicate& discard)
+{
+    if (heVec1.empty() || heVec2.empty())
+        return false;
+
+    std::vector<HalfEdge> heVec;
+    heVec.reserve(heVec1.size() + heVec2.size());
+    heVec.insert(heVec.end(), heVec1.begin(), heVec1.end());
+    heVec.insert(heVec.end(), heVec2.begin(), heVec2.end());
+
+    return IntersectionPairs(heVec, heVec1.size(), discard, true).size() > 0;
+}
+
+std::vector<HalfEdgePair> Intersection(const std::vector<HalfEdge>& heVec, const HalfEdgePairPredicate& discard)
+{
     std::vector<HalfEdgePair> isects;
+    for (const auto& p : IntersectionPairs(heVec, -1, discard, false))
+        isects.push_back(std::make_pair(heVec[p.first], heVec[p.second]));
+    return isects;
+}
 
-    std::unordered_map<vcg::Point2i, std::vector<HalfEdgeID>, Point2iHasher> grid;
-    unsigned elems = heVec1.size() + heVec2.size();
-
-    // init grid helper
-    vcg::BasicGrid2D<double> gh;
-    vcg::Box2d bbox1 = ComputeBox(heVec1);
-    vcg::Box2d bbox2 = ComputeBox(heVec2);
-    gh.bbox = bbox1;
-    gh.bbox.Add(bbox2.min);
-    gh.bbox.Add(bbox2.max);
-    vcg::BestDim2D<double>(elems, gh.bbox.Dim(), gh.siz);
-    gh.ComputeDimAndVoxel();
-
-    const std::vector<HalfEdge> *vp[] = {&heVec1, &heVec2};
-
-    for (int i = 0; i < 2; ++i) {
-        for (unsigned j = 0; j < vp[i]->size(); ++j) {
-            const HalfEdge& he = vp[i]->at(j);
-
-            vcg::Box2d segmentBox;
-            segmentBox.Add(he.P0());
-            segmentBox.Add(he.P1());
-            vcg::Box2i gridCover;
-            gh.BoxToIBox(segmentBox, gridCover);
-            for (int h = gridCover.min[0]; h <= gridCover.max[0]; h++) {
-                for (int k = gridCover.min[1]; k <= gridCover.max[1]; k++) {
-                    vcg::Box2d cell;
-                    vcg::Point2i voxel(h, k);
-                    gh.IPiToBox(voxel, cell);
-                    if (SegmentBoxIntersection(Segment(he.P0(), he.P1()), cell)) {
-                        grid[voxel].push_back(std::make_pair(i, j));
-                    }
-                }
-            }
-        }
-    }
+bool IntersectionAny(const std::vector<HalfEdge>& heVec, const HalfEdgePairPredicate& discard)
+{
+    return IntersectionPairs(heVec, -1, discard, true).size() > 0;
+}
 
-    for (auto& entry : grid) {
-        for (unsigned j = 0; j < entry.second.size(); ++j) {
-            for (unsigned k = j+1; k < entry.second.size(); ++k) {
-                HalfEdgeID i1 = entry.second[j];
-                HalfEdgeID i2 = entry.second[k];
-
-                if (i1.first > i2.first)
-                    std::swap(i1, i2);
-
-                if (i1.first != i2.first) {
-                    ensure(i1.first == 0);
-                    // test for intersection only if the segments have no common endpoints (this improves robustness)
-                    HalfEdge he1 = vp[i1.first]->at(i1.second);
-                    HalfEdge he2 = vp[i2.first]->at(i2.second);
-                    vcg::Point2d intersectionPoint;
-                    if (he1.P0() != he2.P0() && he1.P1() != he2.P1() && he1.P0() != he2.P1() && he1.P1() != he2.P0()
-                            && SegmentSegmentIntersection(Segment(he1.P0(), he1.P1()), Segment(he2.P0(), he2.P1()), intersectionPoint)) {
-                        isects.push_back(std::make_pair(he1, he2));
-                    }
-                }
-            }
+// UVFaceGrid class implementation
+// ===============================
+
+void UVFaceGrid::Init(Mesh& m)
+{
+    std::vector<Mesh::FacePointer> faces;
+    faces.reserve(m.face.size());
+    for (auto& f : m.face)
+        if (!f.IsD())
+            faces.push_back(&f);
+    Init(m, faces);
+}
+
+void UVFaceGrid::Init(Mesh& m, const std::vector<Mesh::FacePointer>& faces)
+{
+    mesh = &m;
+    cells.clear();
+    cover.clear();
+    cover.resize(m.face.size());
+
+    vcg::Box2d box;
+    double totalLength = 0;
+    int ne = 0;
+    for (auto fptr : faces) {
+        for (int i = 0; i < 3; ++i) {
+            box.Add(fptr->V(i)->T().P());
+            totalLength += (fptr->V0(i)->T().P() - fptr->V1(i)->T().P()).Norm();
+            ne++;
         }
     }
 
-    return isects;
+    origin = box.IsNull() ? vcg::Point2d::Zero() : box.min;
+    cellSize = (ne > 0 && totalLength > 0) ? 8.0 * (totalLength / ne) : 1.0;
+
+    for (auto fptr : faces)
+        Insert(fptr);
 }
 
-std::vector<HalfEdgePair> Intersection(const std::vector<HalfEdge>& heVec)
+vcg::Point2i UVFaceGrid::Cell(const vcg::Point2d& p) const
 {
-    std::vector<HalfEdgePair> isects;
+    return vcg::Point2i((int) std::floor((p[0] - origin[0]) / cellSize), (int) std::floor((p[1] - origin[1]) / cellSize));
+}
 
-    std::unordered_map<vcg::Point2i, std::vector<int>, Point2iHasher> grid;
-    unsigned elems = heVec.size();
-
-    // init grid helper
-    vcg::BasicGrid2D<double> gh;
-    gh.bbox = ComputeBox(heVec);
-    vcg::BestDim2D<double>(elems, gh.bbox.Dim(), gh.siz);
-    gh.ComputeDimAndVoxel();
-
-    for (unsigned j = 0; j < heVec.size(); ++j) {
-        const HalfEdge& he = heVec[j];
-
-        vcg::Box2d segmentBox;
-        segmentBox.Add(he.P0());
-        segmentBox.Add(he.P1());
-        vcg::Box2i gridCover;
-        gh.BoxToIBox(segmentBox, gridCover);
-        for (int h = gridCover.min[0]; h <= gridCover.max[0]; h++) {
-            for (int k = gridCover.min[1]; k <= gridCover.max[1]; k++) {
-                vcg::Box2d cell;
-                vcg::Point2i voxel(h, k);
-                gh.IPiToBox(voxel, cell);
-                if (SegmentBoxIntersection(Segment(he.P0(), he.P1()), cell)) {
-                    grid[voxel].push_back(j);
-                }
-            }
+void UVFaceGrid::Insert(Mesh::ConstFacePointer fp)
+{
+    ensure(mesh != nullptr);
+    vcg::Box2d box;
+    for (int i = 0; i < 3; ++i)
+        box.Add(fp->cV(i)->T().P());
+
+    int fi = (int) tri::Index(*mesh, fp);
+    vcg::Box2i& c = cover[fi];
+    c.min = Cell(box.min);
+    c.max = Cell(box.max);
+    for (int h = c.min[0]; h <= c.max[0]; ++h)
+        for (int k = c.min[1]; k <= c.max[1]; ++k)
+            cells[vcg::Point2i(h, k)].push_back(fi);
+}
+
+void UVFaceGrid::Remove(Mesh::ConstFacePointer fp)
+{
+    ensure(mesh != nullptr);
+    int fi = (int) tri::Index(*mesh, fp);
+    const vcg::Box2i& c = cover[fi];
+    for (int h = c.min[0]; h <= c.max[0]; ++h) {
+        for (int k = c.min[1]; k <= c.max[1]; ++k) {
+            auto it = cells.find(vcg::Point2i(h, k));
+            ensure(it != cells.end());
+            std::vector<int>& v = it->second;
+            auto vit = std::find(v.begin(), v.end(), fi);
+            ensure(vit != v.end());
+            *vit = v.back();
+            v.pop_back();
+            if (v.empty())
+                cells.erase(it);
         }
     }
+}
 
-    for (auto& entry : grid) {
-        for (unsigned j = 0; j < entry.second.size(); ++j) {
-            for (unsigned k = j+1; k < entry.second.size(); ++k) {
-                int i1 = entry.second[j];
-                int i2 = entry.second[k];
-                Segment s1 = Segment(heVec[i1].P0(), heVec[i1].P1());
-                Segment s2 = Segment(heVec[i2].P0(), heVec[i2].P1());
-                vcg::Point2d intersectionPoint;
-
-                if (s1.P0() != s2.P0() && s1.P1() != s2.P1() && s1.P0() != s2.P1() && s1.P1() != s2.P0()
-                        && SegmentSegmentIntersection(s1, s2, intersectionPoint)) {
-                    isects.push_back(std::make_pair(heVec[i1], heVec[i2]));
-                }
+void UVFaceGrid::Update(Mesh::ConstFacePointer fp)
+{
+    Remove(fp);
+    Insert(fp);
+}
+
+std::size_t UVFaceGrid::MemoryBytes() const
+{
+    std::size_t bytes = cover.capacity() * sizeof(vcg::Box2i) + cells.bucket_count() * sizeof(void *);
+    for (const auto& entry : cells)
+        bytes += sizeof(void *) + sizeof(entry) + entry.second.capacity() * sizeof(int);
+    return bytes;
+}
+
+void UVFaceGrid::Query(const vcg::Box2d& box, std::vector<Mesh::FacePointer>& faces) const
+{
+    ensure(mesh != nullptr);
+    if (box.IsNull())
+        return;
+
+    vcg::Point2i cmin = Cell(box.min);
+    vcg::Point2i cmax = Cell(box.max);
+
+    std::vector<int> found;
+    if ((long long) (cmax[0] - cmin[0] + 1) * (cmax[1] - cmin[1] + 1) > (long long) cells.size()) {
+        // the box covers more cells than the occupied ones, iterate over the grid instead
+        for (const auto& entry : cells)
+            if (entry.first[0] >= cmin[0] && entry.first[0] <= cmax[0] && entry.first[1] >= cmin[1] && entry.first[1] <= cmax[1])
+                found.insert(found.end(), entry.second.begin(), entry.second.end());
+    } else {
+        for (int h = cmin[0]; h <= cmax[0]; ++h) {
+            for (int k = cmin[1]; k <= cmax[1]; ++k) {
+                auto it = cells.find(vcg::Point2i(h, k));
+                if (it != cells.end())
+                    found.insert(found.end(), it->second.begin(), it->second.end());
             }
         }
     }
 
+    std::sort(found.begin(), found.end());
+    found.erase(std::unique(found.begin(), found.end()), found.end());
 
-    return isects;
+    for (int fi : found)
+        faces.push_back(&mesh->face[fi]);
 }
 
 static vcg::Box2d ComputeBox(const std::vector<HalfEdge>& hev)
@@ -196,3 +282,190 @@ static vcg::Box2d ComputeBox(const std::vector<HalfEdge>& hev)
     }
     return box;
 }
+
+int SegmentGrid::CellCoord(double t, int dim) const
+{
+    if (!(voxel[dim] > 0))
+        return 0;
+    int c = int((t - bbox.min[dim]) / voxel[dim]);
+    return std::min(std::max(c, 0), siz[dim] - 1);
+}
+
+/* Builds the grid with a counting sort on the (cell, segment) incidences. A
+ * segment is assigned to the cells of its bounding box that are not entirely on
+ * one side of its supporting line */
+static void BuildSegmentGrid(const SegmentBuffer& sb, SegmentGrid& grid)
+{
+    int n = sb.Size();
+
+    grid.bbox.SetNull();
+    for (int i = 0; i < n; ++i) {
+        grid.bbox.Add(vcg::Point2d(sb.x0[i], sb.y0[i]));
+        grid.bbox.Add(vcg::Point2d(sb.x1[i], sb.y1[i]));
+    }
+    vcg::BestDim2D<double>(n, grid.bbox.Dim(), grid.siz);
+    grid.voxel[0] = grid.bbox.DimX() / grid.siz[0];
+    grid.voxel[1] = grid.bbox.DimY() / grid.siz[1];
+
+    std::vector<std::pair<int, int>> incidences; // (cell, segment)
+    incidences.reserve(2 * n);
+    for (int i = 0; i < n; ++i) {
+        int hmin = grid.CellCoord(std::min(sb.x0[i], sb.x1[i]), 0);
+        int hmax = grid.CellCoord(std::max(sb.x0[i], sb.x1[i]), 0);
+        int kmin = grid.CellCoord(std::min(sb.y0[i], sb.y1[i]), 1);
+        int kmax = grid.CellCoord(std::max(sb.y0[i], sb.y1[i]), 1);
+        if (hmin == hmax || kmin == kmax) {
+            for (int h = hmin; h <= hmax; ++h)
+                for (int k = kmin; k <= kmax; ++k)
+                    incidences.push_back(std::make_pair(grid.CellIndex(h, k), i));
+        } else {
+            double dx = sb.x1[i] - sb.x0[i];
+            double dy = sb.y1[i] - sb.y0[i];
+            for (int h = hmin; h <= hmax; ++h) {
+                for (int k = kmin; k <= kmax; ++k) {
+                    double cx0 = grid.bbox.min[0] + h * grid.voxel[0] - sb.x0[i];
+                    double cy0 = grid.bbox.min[1] + k * grid.voxel[1] - sb.y0[i];
+                    double cx1 = cx0 + grid.voxel[0];
+                    double cy1 = cy0 + grid.voxel[1];
+                    double o1 = dx * cy0 - dy * cx0;
+                    double o2 = dx * cy0 - dy * cx1;
+                    double o3 = dx * cy1 - dy * cx0;
+                    double o4 = dx * cy1 - dy * cx1;
+                    bool separated = (o1 > 0 && o2 > 0 && o3 > 0 && o4 > 0) || (o1 < 0 && o2 < 0 && o3 < 0 && o4 < 0);
+                    if (!separated)
+                        incidences.push_back(std::make_pair(grid.CellIndex(h, k), i));
+                }
+            }
+        }
+    }
+
+    int ncells = grid.siz[0] * grid.siz[1];
+    grid.offset.assign(ncells + 1, 0);
+    for (const auto& inc : incidences)
+        grid.offset[inc.first + 1]++;
+    for (int c = 0; c < ncells; ++c)
+        grid.offset[c + 1] += grid.offset[c];
+
+    // the incidences are generated by increasing segment index, so the
+    // segments of each cell end up sorted
+    std::vector<int> fill(grid.offset.begin(), grid.offset.end() - 1);
+    grid.segments.resize(incidences.size());
+    for (const auto& inc : incidences)
+        grid.segments[fill[inc.first]++] = inc.second;
+}
+
+/* Collects the pairs (i, j) with i < j of segments that intersect without
+ * sharing an endpoint. If firstSetSize is not negative, only the pairs with
+ * i < firstSetSize <= j are reported. Pairs for which discard returns true are
+ * skipped. Each pair is reported once, unless stopAtFirst is set in which case
+ * the search ends as soon as a pair is found */
+static std::vector<std::pair<int, int>> IntersectionPairs(const std::vector<HalfEdge>& heVec, int firstSetSize, const HalfEdgePairPredicate& discard, bool stopAtFirst)
+{
+    std::vector<std::pair<int, int>> pairs;
+    if (heVec.empty())
+        return pairs;
+
+    SegmentBuffer sb;
+    sb.Append(heVec);
+
+    SegmentGrid grid;
+    BuildSegmentGrid(sb, grid);
+
+    std::function<bool(int, int)> discardPair = nullptr;
+    if (discard)
+        discardPair = [&] (int i, int j) { return discard(std::make_pair(heVec[i], heVec[j])); };
+
+    FindIntersectingPairs(sb, grid, firstSetSize, discardPair, stopAtFirst, pairs);
+    return pairs;
+}
+
+static void FindIntersectingPairs(const SegmentBuffer& sb, const SegmentGrid& grid, int firstSetSize, const std::function<bool(int, int)>& discard,
+                                  bool stopAtFirst, std::vector<std::pair<int, int>>& pairs)
+{
+    SegmentBuffer cb;
+    std::vector<char> hit;
+
+    int ncells = grid.siz[0] * grid.siz[1];
+    for (int c = 0; c < ncells; ++c) {
+        int begin = grid.offset[c];
+        int end = grid.offset[c + 1];
+        int n = end - begin;
+        if (n < 2)
+            continue;
+
+        cb.Clear();
+        for (int i = begin; i < end; ++i) {
+            int si = grid.segments[i];
+            cb.x0.push_back(sb.x0[si]);
+            cb.y0.push_back(sb.y0[si]);
+            cb.x1.push_back(sb.x1[si]);
+            cb.y1.push_back(sb.y1[si]);
+        }
+
+        // the segments of the first set come first in each cell
+        int split = n;
+        if (firstSetSize >= 0)
+            split = std::lower_bound(grid.segments.begin() + begin, grid.segments.begin() + end, firstSetSize) - (grid.segments.begin() + begin);
+
+        int jend = (firstSetSize >= 0) ? split : n;
+        for (int j = 0; j < jend; ++j) {
+            int kbegin = (firstSetSize >= 0) ? split : j + 1;
+            if (kbegin >= n)
+                continue;
+            IntersectSegmentBlock(cb, j, kbegin, n, hit);
+            for (int k = kbegin; k < n; ++k) {
+                if (hit[k - kbegin]) {
+                    int i1 = grid.segments[begin + j];
+                    int i2 = grid.segments[begin + k];
+                    if (discard && discard(i1, i2))
+                        continue;
+                    pairs.push_back(std::make_pair(i1, i2));
+                    if (stopAtFirst)
+                        return;
+                }
+            }
+        }
+    }
+
+    std::sort(pairs.begin(), pairs.end());
+    pairs.erase(std::unique(pairs.begin(), pairs.end()), pairs.end());
+}
+
+/* Tests segment j against the segments [kbegin, kend) of the buffer. This is
+ * the same test of vcg::SegmentSegmentIntersection() (segments that share an
+ * endpoint are not reported), written as a branchless loop over the buffer so
+ * that it can be vectorized by the compiler */
+SIMD_DISPATCH static void IntersectSegmentBlock(const SegmentBuffer& cb, int j, int kbegin, int kend, std::vector<char>& hit)
+{
+    const double Eps = 1e-8;
+
+    const double p0x = cb.x0[j];
+    const double p0y = cb.y0[j];
+    const double p1x = cb.x1[j];
+    const double p1y = cb.y1[j];
+    const double a = p1x - p0x;
+    const double c = p1y - p0y;
+
+    const double *x0 = cb.x0.data();
+    const double *y0 = cb.y0.data();
+    const double *x1 = cb.x1.data();
+    const double *y1 = cb.y1.data();
+
+    hit.resize(kend - kbegin);
+    char *h = hit.data();
+
+    for (int k = kbegin; k < kend; ++k) {
+        double b = x0[k] - x1[k];
+        double d = y0[k] - y1[k];
+        double e = x0[k] - p0x;
+        double f = y0[k] - p0y;
+        double det = a * d - b * c;
+        double lambda0 = (d * e - b * f) / det;
+        double lambda1 = (-c * e + a * f) / det;
+
+        bool shared = (p0x == x0[k] && p0y == y0[k]) | (p1x == x1[k] && p1y == y1[k])
+                    | (p0x == x1[k] && p0y == y1[k]) | (p1x == x0[k] && p1y == y0[k]);
+        bool isect = (std::fabs(det) >= Eps) & (lambda0 >= 0.0) & (lambda0 <= 1.0) & (lambda1 >= 0.0) & (lambda1 <= 1.0);
+        h[k - kbegin] = (char) (isect & !shared);
+    }
+}
@@ -27,6 +27,8 @@
 #include <vcg/space/box2.h>
 
 #include <vector>
+#include <unordered_map>
+#include <functional>
 
 #include "mesh.h"
 
@@ -49,7 +51,69 @@ typedef std::pair<HalfEdge, HalfEdge> HalfEdgePair;
 
 bool SegmentBoxIntersection(const Segment& seg, const vcg::Box2d& box);
 
-std::vector<HalfEdgePair> Intersection(const std::vector<HalfEdge>& heVec);
-std::vector<HalfEdgePair> CrossIntersection(const std::vector<HalfEdge>& heVec1, const std::vector<HalfEdge>& heVec2);
+/* Predicate used to filter the intersecting pairs, returns true if the pair must be ignored */
+typedef std::function<bool(const HalfEdgePair&)> HalfEdgePairPredicate;
+
+/* Return all the pairs of intersecting half-edges (excluding the pairs with shared
+ * endpoints and the pairs discarded by the predicate) */
+std::vector<HalfEdgePair> Intersection(const std::vector<HalfEdge>& heVec, const HalfEdgePairPredicate& discard = nullptr);
+std::vector<HalfEdgePair> CrossIntersection(const std::vector<HalfEdge>& heVec1, const std::vector<HalfEdge>& heVec2, const HalfEdgePairPredicate& discard = nullptr);
+
+/* Same as above, but stop at the first intersecting pair. Use these if the
+ * intersecting half-edges are not needed */
+bool IntersectionAny(const std::vector<HalfEdge>& heVec, const HalfEdgePairPredicate& discard = nullptr);
+bool CrossIntersectionAny(const std::vector<HalfEdge>& heVec1, const std::vector<HalfEdge>& heVec2, const HalfEdgePairPredicate& discard = nullptr);
+
+struct Point2iHasher {
+    std::size_t operator()(const vcg::Point2i& p) const noexcept
+    {
+        std::size_t seed = 0;
+        seed ^= std::hash<int>()(p[0]) + 0x9e3779b9 + (seed << 6) + (seed >> 2);
+        seed ^= std::hash<int>()(p[1]) + 0x9e3779b9 + (seed << 6) + (seed >> 2);
+        return seed;
+    }
+};
+
+/* Persistent uniform grid that indexes the faces of a mesh by their UV bounding
+ * box (computed from the vertex texture coordinates). The grid is meant to be
+ * updated incrementally when the texture coordinates of a subset of faces
+ * change, and queried for the faces that may overlap a given region. Queries
+ * do not modify the object. */
+class UVFaceGrid {
+
+public:
+
+    UVFaceGrid() : mesh{nullptr}, cellSize{1} {}
+
+    /* Indexes all the faces of m. The cell size is a multiple of the average
+     * UV edge length */
+    void Init(Mesh& m);
+
+    /* Indexes only the given faces of m */
+    void Init(Mesh& m, const std::vector<Mesh::FacePointer>& faces);
+
+    void Insert(Mesh::ConstFacePointer fp);
+    void Remove(Mesh::ConstFacePointer fp);
+    void Update(Mesh::ConstFacePointer fp);
+
+    /* Appends to faces the (unique) faces whose indexed box may overlap box,
+     * sorted by face index */
+    void Query(const vcg::Box2d& box, std::vector<Mesh::FacePointer>& faces) const;
+
+    std::size_t CellCount() const { return cells.size(); }
+
+    /* Estimates the memory used by the grid */
+    std::size_t MemoryBytes() const;
+
+private:
+
+    Mesh *mesh;
+    double cellSize;
+    vcg::Point2d origin;
+    std::unordered_map<vcg::Point2i, std::vector<int>, Point2iHasher> cells;
+    std::vector<vcg::Box2i> cover;
+
+    vcg::Point2i Cell(const vcg::Point2d& p) const;
+};
 
 #endif // INTERSECTION_H
@@ -0,0 +1,113 @@
+/*******************************************************************************
+    Copyright (c) 2021, Andrea Maggiordomo, Paolo Cignoni and Marco Tarini
+
+    This file is part of TextureDefrag, a reference implementation for
+    the paper ``Texture Defragmentation for Photo-Reconstructed 3D Models''
+    by Andrea Maggiordomo, Paolo Cignoni and Marco Tarini.
+
+    TextureDefrag is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    TextureDefrag is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with TextureDefrag. If not, see <https://www.gnu.org/licenses/>.
+*******************************************************************************/
+
+
+#ifndef LATENCY_HISTOGRAM_H
+#define LATENCY_HISTOGRAM_H
+
+#include <cstdint>
+#include <algorithm>
+
+/* Histogram of durations with a bounded relative error, in the style of HDR
+ * histograms. The durations are recorded in microseconds, each power of two is
+ * split in 16 linear buckets, so the percentiles are within 1/16 of the recorded
+ * values. The sum and the maximum are exact */
+struct LatencyHistogram {
+
+    static constexpr int SUB_BUCKETS = 16;
+    static constexpr int MAX_EXPONENT = 42; // about 50 days
+    static constexpr int BUCKETS = (MAX_EXPONENT - 2) * SUB_BUCKETS;
+
+    uint64_t counts[BUCKETS] = {};
+    uint64_t count = 0;
+    double sum = 0;
+    double max = 0;
+
+    void Record(double seconds)
+    {
+        seconds = std::max(seconds, 0.0);
+        counts[Bucket(uint64_t(seconds * 1e6 + 0.5))]++;
+        count++;
+        sum += seconds;
+        max = std::max(max, seconds);
+    }
+
+    void Merge(const LatencyHistogram& other)
+    {
+        for (int i = 0; i < BUCKETS; ++i)
+            counts[i] += other.counts[i];
+        count += other.count;
+        sum += other.sum;
+        max = std::max(max, other.max);
+    }
+
+    void Clear()
+    {
+        std::fill(counts, counts + BUCKETS, 0);
+        count = 0;
+        sum = 0;
+        max = 0;
+    }
+
+    /* Returns the duration in seconds below which the fraction q of the recorded
+     * durations fall, as the upper bound of its bucket (never above the maximum) */
+    double Percentile(double q) const
+    {
+        if (count == 0)
+            return 0;
+        uint64_t rank = std::max(uint64_t(1), uint64_t(q * count + 0.5));
+        uint64_t seen = 0;
+        for (int i = 0; i < BUCKETS; ++i) {
+            seen += counts[i];
+            if (seen >= rank)
+                return std::min(UpperBound(i) * 1e-6, max);
+        }
+        return max;
+    }
+
+private:
+
+    // the values below SUB_BUCKETS have a bucket each, the values in [2^e, 2^(e+1))
+    // are split in SUB_BUCKETS buckets of equal width
+    static int Bucket(uint64_t us)
+    {
+        if (us < SUB_BUCKETS)
+            return int(us);
+        int e = 0;
+        while ((us >> (e + 1)) != 0)
+            e++;
+        if (e > MAX_EXPONENT)
+            return BUCKETS - 1;
+        int sub = int(us >> (e - 4)) - SUB_BUCKETS;
+        return (e - 3) * SUB_BUCKETS + sub;
+    }
+
+    static double UpperBound(int bucket)
+    {
+        if (bucket < SUB_BUCKETS)
+            return bucket + 1;
+        int e = bucket / SUB_BUCKETS + 3;
+        int sub = bucket % SUB_BUCKETS;
+        return double(uint64_t(SUB_BUCKETS + sub + 1) << (e - 4));
+    }
+};
+
+#endif // LATENCY_HISTOGRAM_H
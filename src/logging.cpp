@@ -21,19 +21,168 @@
 
 #include "logging.h"
 
+#include <algorithm>
 #include <string>
 #include <fstream>
 #include <sstream>
 #include <thread>
 #include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <memory>
+#include <chrono>
 #include <map>
 #include <iomanip>
 #include <iostream>
+#include <cstdlib>
 
 namespace logging {
 
+namespace {
+
+// number of messages each thread can queue before waiting for the writer
+constexpr std::size_t QUEUE_CAPACITY = 4096;
+
+// interval at which the writer drains the queues
+constexpr std::chrono::milliseconds WRITER_INTERVAL(20);
+
+struct MessageQueue {
+    std::vector<std::string> slots;
+    std::atomic<std::size_t> head{0}; // next slot written by the producer
+    std::atomic<std::size_t> tail{0}; // next slot read by the consumer
+
+    MessageQueue() : slots(QUEUE_CAPACITY) {}
+};
+
+std::atomic<bool> asyncMode(false);
+
+// the queues are owned by the list and never freed, the consumer only scans the
+// active ones. The queue of a terminating thread is drained and recycled through
+// the free list, so the number of queues is bounded by the peak thread count
+std::mutex queuesMtx;
+std::vector<std::unique_ptr<MessageQueue>> queues;
+std::vector<MessageQueue *> activeQueues;
+std::vector<MessageQueue *> freeQueues;
+
+// held by the consumer of the queues, the writer or a thread writing synchronously
+std::mutex drainMtx;
+
+std::thread writer;
+std::mutex writerMtx;
+std::condition_variable writerCv;
+bool stopWriter = false;
+
+void ReleaseQueue(MessageQueue *q);
+
+// returns the queue of the thread to the free list when the thread exits
+struct ThreadQueueOwner {
+    MessageQueue *queue = nullptr;
+
+    ~ThreadQueueOwner()
+    {
+        if (queue)
+            ReleaseQueue(queue);
+    }
+};
+
+thread_local ThreadQueueOwner threadQueue;
+thread_local std::string threadName;
+
+MessageQueue *GetThreadQueue()
+{
+    if (threadQueue.queue == nullptr) {
+        std::lock_guard<std::mutex> lock(queuesMtx);
+        if (freeQueues.empty()) {
+            queues.emplace_back(new MessageQueue);
+            threadQueue.queue = queues.back().get();
+        } else {
+            threadQueue.queue = freeQueues.back();
+            freeQueues.pop_back();
+        }
+        activeQueues.push_back(threadQueue.queue);
+    }
+    return threadQueue.queue;
+}
+
+void Enqueue(std::string&& msg)
+{
+    MessageQueue *q = GetThreadQueue();
+    std::size_t h = q->head.load(std::memory_order_relaxed);
+    while (h - q->tail.load(std::memory_order_acquire) == QUEUE_CAPACITY) {
+        writerCv.notify_one();
+        std::this_thread::yield();
+    }
+    q->slots[h % QUEUE_CAPACITY] = std::move(msg);
+    q->head.store(h + 1, std::memory_order_release);
+}
+
+// Appends the queued messages to out, must be called with drainMtx held
+void DrainQueues(std::string& out)
+{
+    std::vector<MessageQueue *> qv;
+    {
+        std::lock_guard<std::mutex> lock(queuesMtx);
+        qv = activeQueues;
+    }
+    for (auto q : qv) {
+        std::size_t t = q->tail.load(std::memory_order_relaxed);
+        std::size_t h = q->head.load(std::memory_order_acquire);
+        for (; t < h; ++t) {
+            std::string& slot = q->slots[t % QUEUE_CAPACITY];
+            out.append(slot);
+            slot.clear();
+        }
+        q->tail.store(t, std::memory_order_release);
+    }
+}
+
+// Writes the last messages of a terminating thread and moves its queue to the
+// free list. The thread can no longer log, so the queue is empty after the flush.
+// The drain lock is held while the queue is deactivated, so that no consumer is
+// reading it when it is handed to another thread
+void ReleaseQueue(MessageQueue *q)
+{
+    Logger::Flush();
+    std::lock_guard<std::mutex> drainLock(drainMtx);
+    std::lock_guard<std::mutex> lock(queuesMtx);
+    activeQueues.erase(std::find(activeQueues.begin(), activeQueues.end(), q));
+    freeQueues.push_back(q);
+}
+
+void WriterLoop()
+{
+    std::string out;
+    for (;;) {
+        bool stop;
+        {
+            std::unique_lock<std::mutex> lock(writerMtx);
+            writerCv.wait_for(lock, WRITER_INTERVAL, [] () { return stopWriter; });
+            stop = stopWriter;
+        }
+        Logger::Flush();
+        if (stop)
+            break;
+    }
+}
+
+void StopWriter()
+{
+    if (writer.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(writerMtx);
+            stopWriter = true;
+        }
+        writerCv.notify_one();
+        writer.join();
+        stopWriter = false;
+    }
+    Logger::Flush();
+}
+
+} // namespace
+
 Buffer::Buffer(int level)
-    : os{}
+    : os{}, level{level}
 {
     switch(level) {
     case -2:
@@ -52,7 +201,7 @@ Buffer::Buffer(int level)
 
 Buffer::~Buffer()
 {
-    Logger::Log(os.str());
+    Logger::Log(os.str(), level);
 }
 
 int Logger::logLevel = 0;
@@ -63,7 +212,26 @@ std::mutex Logger::singletonMtx{};
 void Logger::Init(int level)
 {
     Logger::logLevel = level;
-    threadNames[std::this_thread::get_id()] = "MainThread";
+    RegisterName("MainThread");
+}
+
+void Logger::SetAsync(bool async)
+{
+    if (!async) {
+        asyncMode = false;
+        StopWriter();
+        return;
+    }
+    std::lock_guard<std::mutex> lock(writerMtx);
+    if (!writer.joinable()) {
+        static bool atexitRegistered = false;
+        if (!atexitRegistered) {
+            std::atexit(StopWriter);
+            atexitRegistered = true;
+        }
+        writer = std::thread(WriterLoop);
+    }
+    asyncMode = true;
 }
 
 int Logger::GetLogLevel()
@@ -81,32 +249,64 @@ void Logger::RegisterName(const std::string& threadName)
 {
     std::lock_guard<std::mutex> lock{Logger::singletonMtx};
     threadNames[std::this_thread::get_id()] = threadName;
+    logging::threadName = threadName;
 }
 
 std::string Logger::GetName()
 {
-    std::lock_guard<std::mutex> lock{Logger::singletonMtx};
-    auto tid = std::this_thread::get_id();
-    if (threadNames.count(tid) > 0)
-        return threadNames[tid];
-    else {
-        std::stringstream ss;
-        ss << tid;
-        return ss.str();
+    // the name is looked up once per thread, RegisterName() updates the cached one
+    if (threadName.empty()) {
+        std::lock_guard<std::mutex> lock{Logger::singletonMtx};
+        auto tid = std::this_thread::get_id();
+        if (threadNames.count(tid) > 0) {
+            threadName = threadNames[tid];
+        } else {
+            std::stringstream ss;
+            ss << tid;
+            threadName = ss.str();
+        }
     }
+    return threadName;
 }
 
-void Logger::Log(const std::string& s)
+void Logger::Log(const std::string& s, int level)
 {
-    std::stringstream ss;
-    ss << std::setw(16) << Logger::GetName() << " | " << s << std::endl;
+    std::string msg;
+    {
+        std::stringstream ss;
+        ss << std::setw(16) << Logger::GetName() << " | " << s << "\n";
+        msg = ss.str();
+    }
+
+    if (asyncMode && level > Level::Error) {
+        Enqueue(std::move(msg));
+        return;
+    }
+
+    // synchronous write, after the messages queued so far
+    std::lock_guard<std::mutex> drainLock(drainMtx);
+    std::string out;
+    DrainQueues(out);
+    out.append(msg);
 
     std::lock_guard<std::mutex> lock{Logger::singletonMtx};
+    std::cout << out << std::flush;
+    for (auto os : streamVec)
+        (*os) << out << std::flush;
+}
 
-    std::cout << ss.str() << std::flush;
+void Logger::Flush()
+{
+    std::lock_guard<std::mutex> drainLock(drainMtx);
+    std::string out;
+    DrainQueues(out);
+    if (out.empty())
+        return;
 
+    std::lock_guard<std::mutex> lock{Logger::singletonMtx};
+    std::cout << out << std::flush;
     for (auto os : streamVec)
-        (*os) << ss.str() << std::flush;
+        (*os) << out << std::flush;
 }
 
 void LogMemoryUsage()
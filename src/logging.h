@@ -29,12 +29,21 @@
 #include <vector>
 #include <map>
 
+// messages of a level above LOG_MAX_LEVEL are removed at compile time, so that the
+// verbose and debug messages of the inner loops (and the evaluation of their
+// arguments) cost nothing in the builds that do not need them (see base.pri)
+#ifndef LOG_MAX_LEVEL
+#define LOG_MAX_LEVEL 2
+#endif
+
 // logging macros
 
 #define LOG_INIT(level) (logging::Logger::Init(level))
+#define LOG_SET_ASYNC(async) (logging::Logger::SetAsync(async))
 #define LOG_SET_THREAD_NAME(name) (logging::Logger::RegisterName(name))
 #define LOG_GET_THREAD_NAME (logging::Logger::GetName())
-#define LOG(level) (level > logging::Logger::GetLogLevel()) ? ((void) 0) : logging::V_() & logging::Buffer(level)
+#define LOG_ENABLED(level) (logging::CompiledIn(level) && level <= logging::Logger::GetLogLevel())
+#define LOG(level) !LOG_ENABLED(level) ? ((void) 0) : logging::V_() & logging::Buffer(level)
 
 #define LOG_ERR     LOG(logging::Level::Error)
 #define LOG_WARN    LOG(logging::Level::Warning)
@@ -52,9 +61,15 @@ enum Level {
     Debug   =  2
 };
 
+constexpr bool CompiledIn(int level)
+{
+    return level <= LOG_MAX_LEVEL;
+}
+
 class Buffer {
 
     std::ostringstream os;
+    int level;
 
 public:
 
@@ -82,6 +97,12 @@ struct V_ {
     void operator &(const Buffer&) { }
 };
 
+/* In asynchronous mode each thread appends its messages to a lock-free single
+ * producer single consumer queue of its own, and a background thread drains the
+ * queues to the streams. The messages of a thread keep their order, the messages
+ * of different threads can be written in a different order than they were logged.
+ * Errors are written synchronously, after draining the queues, so that they reach
+ * the streams before the process exits. Pending messages are written at exit */
 class Logger {
 
     static int logLevel;
@@ -94,11 +115,17 @@ public:
 
     static void Init(int level);
 
+    /* Enables or disables the asynchronous mode */
+    static void SetAsync(bool async);
+
     static int GetLogLevel();
     static std::string GetName();
     static void RegisterStream(std::ostream *os);
     static void RegisterName(const std::string& threadName);
-    static void Log(const std::string& s);
+    static void Log(const std::string& s, int level = Level::Info);
+
+    /* Writes the pending messages of the asynchronous mode */
+    static void Flush();
 
 };
 
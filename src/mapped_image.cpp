@@ -0,0 +1,114 @@
+/*******************************************************************************
+    Copyright (c) 2021, Andrea Maggiordomo, Paolo Cignoni and Marco Tarini
+
+    This file is part of TextureDefrag, a reference implementation for
+    the paper ``Texture Defragmentation for Photo-Reconstructed 3D Models''
+    by Andrea Maggiordomo, Paolo Cignoni and Marco Tarini.
+
+    TextureDefrag is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    TextureDefrag is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with TextureDefrag. If not, see <https://www.gnu.org/licenses/>.
+*******************************************************************************/
+
+#include "mapped_image.h"
+#include "huge_pages.h"
+#include "logging.h"
+
+#include <mutex>
+#include <algorithm>
+#include <cstdlib>
+#include <vector>
+
+#include <QImage>
+
+#ifdef __linux__
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+
+struct FileBackedPixels {
+    void *data;
+    std::size_t bytes;
+};
+
+static std::mutex statsMutex;
+static FileBackedImageStats stats;
+
+static void FreeFileBackedPixels(void *info)
+{
+    FileBackedPixels *pixels = static_cast<FileBackedPixels *>(info);
+#ifdef __linux__
+    munmap(pixels->data, pixels->bytes);
+#endif
+    {
+        std::lock_guard<std::mutex> lock(statsMutex);
+        stats.currentBytes -= pixels->bytes;
+    }
+    delete pixels;
+}
+
+std::shared_ptr<QImage> CreateFileBackedImage(const std::string& directory, int width, int height)
+{
+#ifdef __linux__
+    if (directory.empty() || width <= 0 || height <= 0)
+        return nullptr;
+
+    const std::size_t bytesPerLine = std::size_t(width) * 4;
+    const std::size_t bytes = bytesPerLine * height;
+
+    std::string name = directory + "/texture-defrag-sheet-XXXXXX";
+    std::vector<char> path(name.begin(), name.end());
+    path.push_back('\0');
+    int fd = mkstemp(path.data());
+    void *data = MAP_FAILED;
+    if (fd >= 0) {
+        unlink(path.data());
+        // the file is sparse, its blocks are allocated as the rows are written back
+        if (ftruncate(fd, off_t(bytes)) == 0)
+            data = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd);
+    }
+
+    std::lock_guard<std::mutex> lock(statsMutex);
+    if (data == MAP_FAILED) {
+        if (stats.failures++ == 0)
+            LOG_WARN << "Unable to map a scratch file of " << bytes << " bytes in " << directory << ", allocating the texture sheets in memory";
+        return nullptr;
+    }
+    stats.currentBytes += bytes;
+    stats.peakBytes = std::max(stats.peakBytes, stats.currentBytes);
+    stats.images++;
+
+    FileBackedPixels *pixels = new FileBackedPixels{data, bytes};
+    return std::make_shared<QImage>(static_cast<uchar *>(data), width, height, (int) bytesPerLine, QImage::Format_ARGB32, FreeFileBackedPixels, pixels);
+#else
+    (void) directory;
+    (void) width;
+    (void) height;
+    return nullptr;
+#endif
+}
+
+std::shared_ptr<QImage> CreateSheetImage(const std::string& scratchDirectory, int width, int height)
+{
+    std::shared_ptr<QImage> image = CreateFileBackedImage(scratchDirectory, width, height);
+    if (!image)
+        image = CreateLargeImage(width, height);
+    return image;
+}
+
+FileBackedImageStats GetFileBackedImageStats()
+{
+    std::lock_guard<std::mutex> lock(statsMutex);
+    return stats;
+}
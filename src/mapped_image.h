@@ -0,0 +1,56 @@
+/*******************************************************************************
+    Copyright (c) 2021, Andrea Maggiordomo, Paolo Cignoni and Marco Tarini
+
+    This file is part of TextureDefrag, a reference implementation for
+    the paper ``Texture Defragmentation for Photo-Reconstructed 3D Models''
+    by Andrea Maggiordomo, Paolo Cignoni and Marco Tarini.
+
+    TextureDefrag is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    TextureDefrag is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with TextureDefrag. If not, see <https://www.gnu.org/licenses/>.
+*******************************************************************************/
+
+#ifndef MAPPED_IMAGE_H
+#define MAPPED_IMAGE_H
+
+#include <cstddef>
+#include <memory>
+#include <string>
+
+class QImage;
+
+/* Texture sheet images backed by scratch files. A full sheet is written once by
+ * the renderer and then read once by the encoder, so with the pixels in a shared
+ * mapping of a file the kernel can write back and evict the rows already
+ * rendered or encoded, and the resident memory no longer grows with the size
+ * of the sheets. The file is unlinked as soon as it is created, so it is
+ * removed when the image is destroyed or the process exits. Only implemented on
+ * Linux, elsewhere the images are allocated in memory */
+
+/* ARGB32 image whose pixels are mapped from a scratch file created in directory,
+ * returns nullptr if the file cannot be created or mapped */
+std::shared_ptr<QImage> CreateFileBackedImage(const std::string& directory, int width, int height);
+
+/* Image of a full texture sheet: file backed if scratchDirectory is not empty,
+ * otherwise (or if the mapping fails) allocated by CreateLargeImage */
+std::shared_ptr<QImage> CreateSheetImage(const std::string& scratchDirectory, int width, int height);
+
+struct FileBackedImageStats {
+    std::size_t currentBytes = 0;
+    std::size_t peakBytes = 0;
+    int images = 0;                  // images created
+    int failures = 0;                // images allocated in memory since the scratch file could not be mapped
+};
+
+FileBackedImageStats GetFileBackedImageStats();
+
+#endif // MAPPED_IMAGE_H
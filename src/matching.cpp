@@ -24,6 +24,7 @@
 
 #include <vector>
 #include <numeric>
+#include <cmath>
 
 #include <Eigen/Core>
 #include <Eigen/Eigenvalues>
@@ -180,6 +181,57 @@ MatchingTransform ComputeMatchingRigidMatrix(const std::vector<vcg::Point2d>& ta
     return { vcg::Point2d(t[0], t[1]), { R(0,0), R(0,1), R(1,0), R(1,1) } };
 }
 
+MatchingTransform ComputeMatchingRigidMatrix(const MatchingPointSet& points)
+{
+    ensure(points.size() >= 2);
+
+    const int n = (int) points.size();
+    const double *ax = points.ax.data();
+    const double *ay = points.ay.data();
+    const double *bx = points.bx.data();
+    const double *by = points.by.data();
+
+    // the sums are computed relative to the first pair of points to avoid the
+    // cancellation of the raw moments when the coordinates are far from the origin
+    const double ox = ax[0];
+    const double oy = ay[0];
+    const double qx = bx[0];
+    const double qy = by[0];
+
+    double sax = 0, say = 0, sbx = 0, sby = 0;
+    double sxx = 0, sxy = 0, syx = 0, syy = 0;
+    #pragma omp simd reduction(+:sax, say, sbx, sby, sxx, sxy, syx, syy)
+    for (int i = 0; i < n; ++i) {
+        double px = ax[i] - ox;
+        double py = ay[i] - oy;
+        double mx = bx[i] - qx;
+        double my = by[i] - qy;
+        sax += px; say += py;
+        sbx += mx; sby += my;
+        sxx += mx * px; sxy += mx * py;
+        syx += my * px; syy += my * py;
+    }
+
+    // centered covariance S = sum (b - cb) (a - ca)^T
+    double cax = sax / n, cay = say / n;
+    double cbx = sbx / n, cby = sby / n;
+    double s00 = sxx - n * cbx * cax;
+    double s01 = sxy - n * cbx * cay;
+    double s10 = syx - n * cby * cax;
+    double s11 = syy - n * cby * cay;
+
+    // the rotation that maximizes sum (a - ca) . R (b - cb)
+    double theta = std::atan2(s01 - s10, s00 + s11);
+    double c = std::cos(theta);
+    double s = std::sin(theta);
+
+    cax += ox; cay += oy;
+    cbx += qx; cby += qy;
+
+    vcg::Point2d t(cax - (c * cbx - s * cby), cay - (s * cbx + c * cby));
+    return { t, { c, -s, s, c } };
+}
+
 double MatchingError(const MatchingTransform& matching, const std::vector<vcg::Point2d>& points1, const std::vector<vcg::Point2d>& points2)
 {
     return MatchingErrorAverage(matching, points1, points2);
@@ -206,3 +258,28 @@ double MatchingErrorTotal(const MatchingTransform& matching, const std::vector<v
 
     return error;
 }
+
+double MatchingErrorTotal(const MatchingTransform& matching, const MatchingPointSet& points)
+{
+    const int n = (int) points.size();
+    const double *ax = points.ax.data();
+    const double *ay = points.ay.data();
+    const double *bx = points.bx.data();
+    const double *by = points.by.data();
+    const double m0 = matching.matCoeff[0];
+    const double m1 = matching.matCoeff[1];
+    const double m2 = matching.matCoeff[2];
+    const double m3 = matching.matCoeff[3];
+    const double tx = matching.t.X();
+    const double ty = matching.t.Y();
+
+    double error = 0;
+    #pragma omp simd reduction(+:error)
+    for (int i = 0; i < n; ++i) {
+        double dx = ax[i] - (m0 * bx[i] + m1 * by[i] + tx);
+        double dy = ay[i] - (m2 * bx[i] + m3 * by[i] + ty);
+        error += std::sqrt(dx * dx + dy * dy);
+    }
+
+    return error;
+}
@@ -43,6 +43,43 @@ struct MatchingTransform {
         return {vcg::Point2d::Zero(), { 1.0, 0.0, 0.0, 1.0 }};
     }
 
+    inline MatchingTransform Inverse() const
+    {
+        double det = matCoeff[0] * matCoeff[3] - matCoeff[1] * matCoeff[2];
+        MatchingTransform inv;
+        inv.matCoeff[0] =  matCoeff[3] / det;
+        inv.matCoeff[1] = -matCoeff[1] / det;
+        inv.matCoeff[2] = -matCoeff[2] / det;
+        inv.matCoeff[3] =  matCoeff[0] / det;
+        inv.t = vcg::Point2d(-(inv.matCoeff[0] * t.X() + inv.matCoeff[1] * t.Y()),
+                             -(inv.matCoeff[2] * t.X() + inv.matCoeff[3] * t.Y()));
+        return inv;
+    }
+
+};
+
+/* Sequence of corresponding point pairs stored as separate coordinate arrays
+ * (the a points are the targets, the b points are matched to them), so that the
+ * fitting and error loops run over contiguous doubles */
+struct MatchingPointSet {
+    std::vector<double> ax;
+    std::vector<double> ay;
+    std::vector<double> bx;
+    std::vector<double> by;
+
+    std::size_t size() const { return ax.size(); }
+
+    void clear()
+    {
+        ax.clear(); ay.clear();
+        bx.clear(); by.clear();
+    }
+
+    inline void push_back(const vcg::Point2d& pa, const vcg::Point2d& pb)
+    {
+        ax.push_back(pa.X()); ay.push_back(pa.Y());
+        bx.push_back(pb.X()); by.push_back(pb.Y());
+    }
 };
 
 /* Computes the least squares affine transform of the matchingVector points to
@@ -57,11 +94,17 @@ MatchingTransform ComputeMatchingSimilarityMatrix(const std::vector<vcg::Point2d
  * points to the targetVector points */
 MatchingTransform ComputeMatchingRigidMatrix(const std::vector<vcg::Point2d>& targetVector, const std::vector<vcg::Point2d>& matchingVector);
 
+/* Computes the least squares rigid transform of the b points to the a points.
+ * The centroids and the covariance sums are accumulated in a single pass and
+ * the rotation is computed in closed form */
+MatchingTransform ComputeMatchingRigidMatrix(const MatchingPointSet& points);
+
 /* Computes the average matching error applied to the given point sequences */
 double MatchingError(const MatchingTransform& matching, const std::vector<vcg::Point2d>& points1, const std::vector<vcg::Point2d>& points2);
 double MatchingErrorAverage(const MatchingTransform& matching, const std::vector<vcg::Point2d>& points1, const std::vector<vcg::Point2d>& points2);
 
 /* Computes the absolute matching error applied to the given point sequences */
 double MatchingErrorTotal(const MatchingTransform& matching, const std::vector<vcg::Point2d>& points1, const std::vector<vcg::Point2d>& points2);
+double MatchingErrorTotal(const MatchingTransform& matching, const MatchingPointSet& points);
 
 #endif // MATCHING_H
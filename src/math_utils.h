@@ -113,5 +113,32 @@ Eigen::Matrix2d ComputeTransformationMatrix(const PointType& x10, const PointTyp
     return g * f.inverse();
 }
 
+/* Closed-form SVD of a 2x2 matrix, A = U * diag(s) * V^T with s[0] >= s[1] >= 0.
+ * U is a rotation, V is a rotation or a reflection if det(A) < 0 */
+inline void SVD2x2(const Eigen::Matrix2d& A, Eigen::Matrix2d& U, Eigen::Vector2d& s, Eigen::Matrix2d& V)
+{
+    double e = (A(0, 0) + A(1, 1)) / 2.0;
+    double f = (A(0, 0) - A(1, 1)) / 2.0;
+    double g = (A(1, 0) + A(0, 1)) / 2.0;
+    double h = (A(1, 0) - A(0, 1)) / 2.0;
+    double q = std::sqrt(e * e + h * h);
+    double r = std::sqrt(f * f + g * g);
+    double a1 = std::atan2(g, f);
+    double a2 = std::atan2(h, e);
+    double theta = (a2 - a1) / 2.0;
+    double phi = (a2 + a1) / 2.0;
+
+    U << std::cos(phi), -std::sin(phi),
+         std::sin(phi),  std::cos(phi);
+    V << std::cos(theta), std::sin(theta),
+        -std::sin(theta), std::cos(theta);
+    s[0] = q + r;
+    s[1] = q - r;
+    if (s[1] < 0) {
+        s[1] = -s[1];
+        V.col(1) = -V.col(1);
+    }
+}
+
 #endif // MATH_UTILS_H
 
@@ -0,0 +1,298 @@
+/*******************************************************************************
+    Copyright (c) 2021, Andrea Maggiordomo, Paolo Cignoni and Marco Tarini
+
+    This file is part of TextureDefrag, a reference implementation for
+    the paper ``Texture Defragmentation for Photo-Reconstructed 3D Models''
+    by Andrea Maggiordomo, Paolo Cignoni and Marco Tarini.
+
+    TextureDefrag is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    TextureDefrag is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with TextureDefrag. If not, see <https://www.gnu.org/licenses/>.
+*******************************************************************************/
+
+
+#include "memory_budget.h"
+#include "mesh.h"
+#include "mesh_attribute.h"
+#include "logging.h"
+
+#include <atomic>
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+
+#if defined(__APPLE__)
+#include <mach/mach.h>
+#include <sys/sysctl.h>
+#elif defined(_WIN32)
+#include <windows.h>
+#endif
+
+
+static const int NUM_SUBSYSTEMS = (int) MemorySubsystem::_END;
+
+static const char *subsystemNames[NUM_SUBSYSTEMS] = {
+    "mesh", "seam state", "shells", "packing", "render images", "input images", "gpu textures"
+};
+
+static std::atomic<long long> used[NUM_SUBSYSTEMS];
+static std::atomic<long long> peak[NUM_SUBSYSTEMS];
+static std::atomic<std::size_t> budget(0);
+
+static long long ProcessResidentBytes();
+
+static void UpdatePeak(int i, long long value)
+{
+    long long p = peak[i].load(std::memory_order_relaxed);
+    while (value > p && !peak[i].compare_exchange_weak(p, value, std::memory_order_relaxed))
+        ;
+}
+
+void MemoryAdd(MemorySubsystem s, long long bytes)
+{
+    int i = (int) s;
+    long long value = used[i].fetch_add(bytes, std::memory_order_relaxed) + bytes;
+    UpdatePeak(i, value);
+}
+
+void MemorySet(MemorySubsystem s, long long bytes)
+{
+    int i = (int) s;
+    used[i].store(bytes, std::memory_order_relaxed);
+    UpdatePeak(i, bytes);
+}
+
+long long MemoryUsed(MemorySubsystem s)
+{
+    return used[(int) s].load(std::memory_order_relaxed);
+}
+
+long long MemoryPeak(MemorySubsystem s)
+{
+    return peak[(int) s].load(std::memory_order_relaxed);
+}
+
+const char *MemorySubsystemName(MemorySubsystem s)
+{
+    return subsystemNames[(int) s];
+}
+
+long long MemoryUsedTotal()
+{
+    long long total = 0;
+    for (int i = 0; i < NUM_SUBSYSTEMS; ++i)
+        if (i != (int) MemorySubsystem::GPUTextures)
+            total += used[i].load(std::memory_order_relaxed);
+    return total;
+}
+
+void SetMemoryBudget(std::size_t bytes)
+{
+    budget = bytes;
+}
+
+std::size_t GetMemoryBudget()
+{
+    return budget;
+}
+
+long long MemoryBudgetAvailable()
+{
+    std::size_t b = budget;
+    if (b == 0)
+        return -1;
+    return std::max(0LL, (long long) b - MemoryUsedTotal());
+}
+
+std::size_t MemoryBudgetLimit(std::size_t requested, double fraction, std::size_t held)
+{
+    long long available = MemoryBudgetAvailable();
+    if (available < 0)
+        return requested;
+    std::size_t limit = held + (std::size_t) (available * fraction);
+    // a limit of 0 means unlimited, keep at least one byte
+    limit = std::max<std::size_t>(limit, 1);
+    return (requested == 0) ? limit : std::min(requested, limit);
+}
+
+std::size_t EstimateMeshBytes(Mesh& m)
+{
+    std::size_t bytes = m.vert.capacity() * sizeof(MeshVertex) + m.face.capacity() * sizeof(MeshFace);
+    if (Has3DFaceAdjacencyAttribute(m))
+        bytes += m.face.size() * sizeof(FF);
+    if (HasWedgeTexCoordStorageAttribute(m))
+        bytes += m.face.size() * sizeof(TexCoordStorage);
+    return bytes;
+}
+
+void LogMemoryBreakdown(const std::string& phase)
+{
+    const double GB = 1024.0 * 1024.0 * 1024.0;
+    std::stringstream ss;
+    ss << std::fixed << std::setprecision(2);
+    ss << "[MEM] " << phase << ":";
+    for (int i = 0; i < NUM_SUBSYSTEMS; ++i)
+        ss << " " << subsystemNames[i] << " " << used[i] / GB << " (peak " << peak[i] / GB << ")";
+    ss << " | tracked " << MemoryUsedTotal() / GB << " GB";
+    long long rss = ProcessResidentBytes();
+    if (rss >= 0)
+        ss << ", resident " << rss / GB << " GB";
+    if (budget > 0)
+        ss << ", budget " << budget / GB << " GB";
+    LOG_INFO << ss.str();
+}
+
+void LogSystemMemoryUsage()
+{
+#if defined(__APPLE__)
+    // macOS implementation
+    mach_port_t host_port = mach_host_self();
+    mach_msg_type_number_t host_size = sizeof(vm_statistics64_data_t) / sizeof(integer_t);
+    vm_size_t pagesize;
+    host_page_size(host_port, &pagesize);
+
+    vm_statistics64_data_t vm_stat;
+    if (host_statistics64(host_port, HOST_VM_INFO64, (host_info64_t)&vm_stat, &host_size) != KERN_SUCCESS) {
+        LOG_WARN << "Failed to fetch macOS vm statistics";
+        return;
+    }
+
+    uint64_t total_mem_val;
+    size_t len = sizeof(total_mem_val);
+    if (sysctlbyname("hw.memsize", &total_mem_val, &len, NULL, 0) != 0) {
+        LOG_WARN << "Failed to fetch macOS total memory";
+        return;
+    }
+
+    uint64_t used_memory = (vm_stat.active_count + vm_stat.inactive_count + vm_stat.wire_count) * (uint64_t)pagesize;
+
+    double used_mem_gb = (double)used_memory / (1024.0 * 1024.0 * 1024.0);
+    double total_mem_gb = (double)total_mem_val / (1024.0 * 1024.0 * 1024.0);
+
+    LOG_INFO << "System RAM: " << std::fixed << std::setprecision(2) << used_mem_gb << " / " << total_mem_gb << " GB used";
+
+#elif defined(__linux__)
+    // Linux implementation
+    std::ifstream meminfo("/proc/meminfo");
+    if (!meminfo.is_open()) {
+        LOG_WARN << "Could not open /proc/meminfo to read memory stats";
+        return;
+    }
+
+    std::string line;
+    long long mem_total = -1, mem_available = -1;
+    while (std::getline(meminfo, line)) {
+        if (line.rfind("MemTotal:", 0) == 0) {
+            try { mem_total = std::stoll(line.substr(10)); } catch (...) {}
+        }
+        if (line.rfind("MemAvailable:", 0) == 0) {
+            try { mem_available = std::stoll(line.substr(13)); } catch (...) {}
+        }
+    }
+
+    if (mem_total != -1 && mem_available != -1) {
+        long long used_mem = mem_total - mem_available; // in kB
+        double used_mem_gb = (double)used_mem / (1024.0 * 1024.0);
+        double total_mem_gb = (double)mem_total / (1024.0 * 1024.0);
+        LOG_INFO << "System RAM: " << std::fixed << std::setprecision(2) << used_mem_gb << " / " << total_mem_gb << " GB used";
+    } else {
+        LOG_WARN << "Could not parse MemTotal/MemAvailable from /proc/meminfo";
+    }
+
+#elif defined(_WIN32)
+    // Windows implementation
+    MEMORYSTATUSEX statex;
+    statex.dwLength = sizeof(statex);
+    if (GlobalMemoryStatusEx(&statex)) {
+        double total_mem_gb = (double)statex.ullTotalPhys / (1024.0 * 1024.0 * 1024.0);
+        double used_mem_gb = (double)(statex.ullTotalPhys - statex.ullAvailPhys) / (1024.0 * 1024.0 * 1024.0);
+
+        LOG_INFO << "System RAM: " << std::fixed << std::setprecision(2) << used_mem_gb << " / " << total_mem_gb << " GB used";
+    } else {
+        LOG_WARN << "Windows GlobalMemoryStatusEx failed.";
+    }
+#else
+    LOG_WARN << "Memory usage logging not implemented for this platform.";
+#endif
+}
+
+long long SystemAvailableBytes()
+{
+#if defined(__APPLE__)
+    mach_port_t host_port = mach_host_self();
+    mach_msg_type_number_t host_size = sizeof(vm_statistics64_data_t) / sizeof(integer_t);
+    vm_size_t pagesize;
+    host_page_size(host_port, &pagesize);
+    vm_statistics64_data_t vm_stat;
+    if (host_statistics64(host_port, HOST_VM_INFO64, (host_info64_t)&vm_stat, &host_size) != KERN_SUCCESS)
+        return -1;
+    // the inactive pages can be reclaimed without swapping
+    return (long long) (vm_stat.free_count + vm_stat.inactive_count) * (long long) pagesize;
+#elif defined(__linux__)
+    std::ifstream meminfo("/proc/meminfo");
+    std::string line;
+    while (std::getline(meminfo, line)) {
+        if (line.rfind("MemAvailable:", 0) == 0) {
+            try { return std::stoll(line.substr(13)) * 1024; } catch (...) {}
+        }
+    }
+    return -1;
+#elif defined(_WIN32)
+    MEMORYSTATUSEX statex;
+    statex.dwLength = sizeof(statex);
+    if (GlobalMemoryStatusEx(&statex))
+        return (long long) statex.ullAvailPhys;
+    return -1;
+#else
+    return -1;
+#endif
+}
+
+/* Returns the value in bytes of a field of /proc/self/status, or -1 */
+static long long ProcessStatusBytes(const std::string& field)
+{
+#ifdef __linux__
+    std::ifstream status("/proc/self/status");
+    std::string line;
+    while (std::getline(status, line)) {
+        if (line.rfind(field, 0) == 0) {
+            try { return std::stoll(line.substr(field.size())) * 1024; } catch (...) {}
+        }
+    }
+#endif
+    return -1;
+}
+
+/* Returns the resident set size of the process, or -1 if it is not available */
+static long long ProcessResidentBytes()
+{
+    return ProcessStatusBytes("VmRSS:");
+}
+
+long long ProcessPeakResidentBytes()
+{
+    return ProcessStatusBytes("VmHWM:");
+}
+
+bool ResetProcessPeakResident()
+{
+#ifdef __linux__
+    // writing 5 to clear_refs resets the peak resident set size (Linux 4.0)
+    std::ofstream clearRefs("/proc/self/clear_refs");
+    clearRefs << "5";
+    clearRefs.flush();
+    return bool(clearRefs);
+#else
+    return false;
+#endif
+}
@@ -0,0 +1,98 @@
+/*******************************************************************************
+    Copyright (c) 2021, Andrea Maggiordomo, Paolo Cignoni and Marco Tarini
+
+    This file is part of TextureDefrag, a reference implementation for
+    the paper ``Texture Defragmentation for Photo-Reconstructed 3D Models''
+    by Andrea Maggiordomo, Paolo Cignoni and Marco Tarini.
+
+    TextureDefrag is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    TextureDefrag is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with TextureDefrag. If not, see <https://www.gnu.org/licenses/>.
+*******************************************************************************/
+
+
+#ifndef MEMORY_BUDGET_H
+#define MEMORY_BUDGET_H
+
+#include <string>
+#include <cstddef>
+
+class Mesh;
+
+/* Accounting of the memory used by the subsystems of the pipeline, and the global
+ * memory budget the caches and queues adapt to. The counters are maintained by the
+ * subsystems with the size of their main data structures (estimated for the node
+ * based containers), they are not a replacement for the resident set size of the
+ * process, which is logged next to them. Updates are lock free and can be issued
+ * by any thread */
+
+enum class MemorySubsystem {
+    Mesh,         // mesh and per-element attributes
+    SeamState,    // seam mesh and state of the greedy optimization
+    Shells,       // shells and move data of the greedy optimization
+    Packing,      // packing rasterization cache
+    RenderImages, // rendered texture images waiting to be saved
+    InputImages,  // input texture images decoded ahead of the rendering (see TexturePredecoder)
+    GPUTextures,  // input textures resident in the texture GPU caches
+    _END
+};
+
+/* Adds bytes (which may be negative) to the counter of the subsystem */
+void MemoryAdd(MemorySubsystem s, long long bytes);
+
+/* Sets the counter of the subsystem */
+void MemorySet(MemorySubsystem s, long long bytes);
+
+long long MemoryUsed(MemorySubsystem s);
+long long MemoryPeak(MemorySubsystem s);
+
+const char *MemorySubsystemName(MemorySubsystem s);
+
+/* Sum of the counters of the host memory subsystems (the GPU textures are excluded) */
+long long MemoryUsedTotal();
+
+/* Sets the global budget of the host memory, 0 for unlimited */
+void SetMemoryBudget(std::size_t bytes);
+std::size_t GetMemoryBudget();
+
+/* Returns the bytes still available within the budget according to the counters,
+ * or -1 if the budget is unlimited */
+long long MemoryBudgetAvailable();
+
+/* Limits the requested size of a cache or queue (0 for unlimited) to the given
+ * fraction of the memory available within the budget, plus the bytes the cache
+ * already holds. Returns the requested size if the budget is unlimited */
+std::size_t MemoryBudgetLimit(std::size_t requested, double fraction, std::size_t held = 0);
+
+/* Estimates the size of the mesh and of its per-face attributes */
+std::size_t EstimateMeshBytes(Mesh& m);
+
+/* Logs the counters and peaks of the subsystems, the resident set size of the
+ * process and the budget, tagged with the name of the phase just completed */
+void LogMemoryBreakdown(const std::string& phase);
+
+/* Logs the used and total physical memory of the system */
+void LogSystemMemoryUsage();
+
+/* Returns the physical memory of the system available to new allocations without
+ * swapping (MemAvailable on Linux), or -1 if it is not available */
+long long SystemAvailableBytes();
+
+/* Returns the peak resident set size of the process, or -1 if it is not available */
+long long ProcessPeakResidentBytes();
+
+/* Resets the peak resident set size of the process to the current one, so that
+ * the following peak is measured from now on. Returns false if not supported, in
+ * which case the peak is the peak of the whole process */
+bool ResetProcessPeakResident();
+
+#endif // MEMORY_BUDGET_H
@@ -20,14 +20,20 @@
 *******************************************************************************/
 
 #include <vcg/complex/complex.h>
-#include <vcg/complex/algorithms/attribute_seam.h>
 
 #include "gl_utils.h" // required for obj importer to use glu::tessellator
 
 #include <wrap/io_trimesh/import.h>
-#include <wrap/io_trimesh/export.h>
+#include <wrap/io_trimesh/export_off.h>
+#include <wrap/io_trimesh/export_stl.h>
+#include <wrap/io_trimesh/export_dxf.h>
 
 #include <string>
+#include <mutex>
+#include <limits>
+#include <algorithm>
+
+#include <omp.h>
 
 #include <QFileInfo>
 #include <QDir>
@@ -35,10 +41,32 @@
 #include <QImageReader>
 
 #include "mesh.h"
+#include "derived_data.h"
+#include "obj_loader.h"
+#include "gltf_loader.h"
+#include "remote_input.h"
+#include "mesh_writer.h"
 #include "texture_object.h"
 #include "timer.h"
+#include "dense_index_map.h"
 #include "utils.h"
 #include "logging.h"
+#include "disjoint_set.h"
+#include "mesh_attribute.h"
+
+
+constexpr std::ptrdiff_t PARALLEL_SORT_MIN_CHUNK = 1 << 16;
+
+// The importers resolve the material and texture files from the working directory,
+// which is process wide: the meshes loaded concurrently are loaded one at a time,
+// and the working directory is restored on every return
+static std::mutex workingDirMutex;
+
+struct WorkingDirGuard {
+    QString wd;
+    explicit WorkingDirGuard(const QString& dir) : wd(QDir::currentPath()) { QDir::setCurrent(dir); }
+    ~WorkingDirGuard() { QDir::setCurrent(wd); }
+};
 
 bool LoadMesh(const char *fileName, Mesh& m, TextureObjectHandle& textureObject, int &loadMask)
 {
@@ -46,7 +74,17 @@ bool LoadMesh(const char *fileName, Mesh& m, TextureObjectHandle& textureObject,
     textureObject = std::make_shared<TextureObject>();
     loadMask = 0;
 
-    QFileInfo fi(fileName);
+    // remote meshes are parsed from their staged copy (see remote_input.h)
+    std::string localFileName = fileName;
+    if (IsRemoteUri(localFileName)) {
+        localFileName = StageRemoteMesh(localFileName);
+        if (localFileName.empty()) {
+            LOG_ERR << "Unable to download " << fileName;
+            return false;
+        }
+    }
+
+    QFileInfo fi(localFileName.c_str());
     fi.makeAbsolute();
 
     if (!fi.exists() || !fi.isReadable()) {
@@ -57,41 +95,94 @@ bool LoadMesh(const char *fileName, Mesh& m, TextureObjectHandle& textureObject,
     std::string dirname = fi.dir().dirName().toStdString();
     m.name = dirname + "_" + fi.fileName().toStdString();
 
-    QString wd = QDir::currentPath();
-    QDir::setCurrent(fi.absoluteDir().absolutePath());
+    std::lock_guard<std::mutex> lock(workingDirMutex);
+    WorkingDirGuard wdGuard(fi.absoluteDir().absolutePath());
 
-    int r = tri::io::Importer<Mesh>::Open(m, fi.fileName().toStdString().c_str(), loadMask);
-    if (tri::io::Importer<Mesh>::ErrorCritical(r)) {
-        LOG_ERR << tri::io::Importer<Mesh>::ErrorMsg(r);
-        return false;
-    } else if (r) {
-        LOG_WARN << tri::io::Importer<Mesh>::ErrorMsg(r);
+    // obj files are read with the parallel parser unless they use statements it
+    // does not handle, gltf and glb files with their own loader, the other formats
+    // go through the vcg importer
+    std::string meshFileName = fi.fileName().toStdString();
+    const QString suffix = fi.suffix().toLower();
+    if (suffix == "gltf" || suffix == "glb") {
+        if (!LoadGLTF(meshFileName.c_str(), m, loadMask))
+            return false;
+    } else {
+        int r;
+        bool critical;
+        const char *errorMsg;
+        if (suffix == "obj" && LoadOBJ(meshFileName.c_str(), m, loadMask, r)) {
+            critical = tri::io::ImporterOBJ<Mesh>::ErrorCritical(r);
+            errorMsg = tri::io::ImporterOBJ<Mesh>::ErrorMsg(r);
+        } else {
+            r = tri::io::Importer<Mesh>::Open(m, meshFileName.c_str(), loadMask);
+            critical = tri::io::Importer<Mesh>::ErrorCritical(r);
+            errorMsg = tri::io::Importer<Mesh>::ErrorMsg(r);
+        }
+        if (critical) {
+            LOG_ERR << errorMsg;
+            return false;
+        } else if (r) {
+            LOG_WARN << errorMsg;
+        }
     }
 
     for (auto& f : m.face)
         f.SetMesh();
+    InvalidateDerivedData(m);
 
     LOG_INFO << "Loaded mesh " << fileName << " (VN " <<  m.VN() << ", FN " << m.FN() << ")";
 
-    for (const string& textureName : m.textures) {
-        QFileInfo textureFile(textureName.c_str());
+    if (!LoadTextureImages(m.textures, textureObject))
+        return false;
+
+    return true;
+}
+
+bool LoadTextureImages(const std::vector<std::string>& textureNames, TextureObjectHandle textureObject)
+{
+    // the names are resolved against the working directory before probing
+    // the files concurrently, which only reads their headers
+    const int n = (int) textureNames.size();
+    std::vector<std::string> paths(n);
+    for (int i = 0; i < n; ++i) {
+        QFileInfo textureFile(textureNames[i].c_str());
         textureFile.makeAbsolute();
-        if (!textureFile.exists() || !textureFile.isReadable()) {
-            LOG_ERR << "Error: Texture file " << textureName.c_str() << " does not exist or is not readable.";
+        paths[i] = textureFile.absoluteFilePath().toStdString();
+    }
+
+    enum ProbeStatus { Ok, Missing, Unreadable };
+    std::vector<ProbeStatus> status(n, Ok);
+    std::vector<TextureSize> sizes(n);
+
+    // the textures of the remote meshes are queued for download, their sizes are
+    // read from the first bytes of the files
+    std::vector<char> remote(n);
+    for (int i = 0; i < n; ++i)
+        remote[i] = StageRemoteFile(paths[i]);
+
+    #pragma omp parallel for schedule(dynamic, 1)
+    for (int i = 0; i < n; ++i) {
+        QFileInfo textureFile(paths[i].c_str());
+        if (!remote[i] && (!textureFile.exists() || !textureFile.isReadable()))
+            status[i] = Missing;
+        else if (!ReadImageSize(paths[i], &sizes[i]))
+            status[i] = Unreadable;
+    }
+
+    for (int i = 0; i < n; ++i) {
+        if (status[i] == Missing) {
+            LOG_ERR << "Error: Texture file " << textureNames[i].c_str() << " does not exist or is not readable.";
             return false;
         }
-
-        if (!textureObject->AddImage(textureFile.absoluteFilePath().toStdString())) {
-            LOG_ERR << "Error: Unable to load texture file " << textureName.c_str();
+        if (status[i] == Unreadable || !textureObject->AddImage(paths[i], sizes[i])) {
+            LOG_ERR << "Error: Unable to load texture file " << textureNames[i].c_str();
             return false;
         }
     }
-
-    QDir::setCurrent(wd);
     return true;
 }
 
-bool SaveMesh(const char *fileName, Mesh& m, const std::vector<std::shared_ptr<QImage>>& textureImages, bool color)
+bool SaveMesh(const char *fileName, Mesh& m, const std::vector<std::shared_ptr<QImage>>& textureImages, bool color, const char *textureExtension, bool embedTextures)
 {
     int mask = tri::io::Mask::IOM_WEDGTEXCOORD;
 
@@ -99,7 +190,7 @@ bool SaveMesh(const char *fileName, Mesh& m, const std::vector<std::shared_ptr<Q
         m.textures.clear();
         for (std::size_t i = 0; i < textureImages.size(); ++i) {
             std::stringstream suffix;
-            suffix << "_texture_" << i << ".png";
+            suffix << "_texture_" << i << "." << textureExtension;
             std::string s(fileName);
             m.textures.push_back(s.substr(0, s.find_last_of('.')).append(suffix.str()));
         }
@@ -107,10 +198,40 @@ bool SaveMesh(const char *fileName, Mesh& m, const std::vector<std::shared_ptr<Q
 
     Timer t;
     LOG_INFO << "Saving mesh file " << fileName;
-    if (color) mask = mask | tri::io::Mask::IOM_FACEQUALITY | tri::io::Mask::IOM_FACECOLOR;
-    int err;
-    if ((err = tri::io::Exporter<Mesh>::Save(m, fileName, mask))) {
-        LOG_ERR << "Error: " << tri::io::Exporter<Mesh>::ErrorMsg(err);
+
+    // obj, ply and glb files are written with the parallel writers, the other formats
+    // go through the vcg exporters (the generic tri::io::Exporter also instantiates
+    // the obj exporter, which requires vcg::TexCoord2 tex coords)
+    QString suffix = QFileInfo(fileName).suffix().toLower();
+    if (suffix == "obj") {
+        if (!WriteOBJ(fileName, m, color))
+            return false;
+    } else if (suffix == "ply") {
+        if (!WritePLY(fileName, m, color))
+            return false;
+    } else if (suffix == "glb") {
+        if (!WriteGLB(fileName, m, embedTextures))
+            return false;
+    } else if (suffix == "off") {
+        int err;
+        if ((err = tri::io::ExporterOFF<Mesh>::Save(m, fileName, mask))) {
+            LOG_ERR << "Error: " << tri::io::ExporterOFF<Mesh>::ErrorMsg(err);
+            return false;
+        }
+    } else if (suffix == "stl") {
+        int err;
+        if ((err = tri::io::ExporterSTL<Mesh>::Save(m, fileName))) {
+            LOG_ERR << "Error: " << tri::io::ExporterSTL<Mesh>::ErrorMsg(err);
+            return false;
+        }
+    } else if (suffix == "dxf") {
+        int err;
+        if ((err = tri::io::ExporterDXF<Mesh>::Save(m, fileName))) {
+            LOG_ERR << "Error: " << tri::io::ExporterDXF<Mesh>::ErrorMsg(err);
+            return false;
+        }
+    } else {
+        LOG_ERR << "Error: unsupported file format " << suffix.toStdString();
         return false;
     }
     LOG_INFO << "Saving mesh took " << t.TimeElapsed() << " seconds";
@@ -162,57 +283,661 @@ Box2d UVBoxVertex(const Mesh& m)
     return uvbox;
 }
 
-/* Utility functions for AttributeSeam */
-static inline void vExt(const Mesh& msrc, const MeshFace& f, int k, const Mesh& mdst, MeshVertex& v)
+/* Sorts the range in parallel, the chunks are sorted independently and then
+ * merged pairwise */
+template <typename RandomIt, typename Compare>
+static void ParallelSort(RandomIt first, RandomIt last, Compare comp)
 {
-    (void) msrc;
-    (void) mdst;
-    v.ImportData(*(f.cV(k)));
-    v.T() = f.cWT(k);
+    const std::ptrdiff_t n = last - first;
+    int numChunks = 1;
+    while (numChunks < omp_get_max_threads() && n / (2 * numChunks) >= PARALLEL_SORT_MIN_CHUNK)
+        numChunks *= 2;
+
+    if (numChunks == 1) {
+        std::sort(first, last, comp);
+        return;
+    }
+
+    std::vector<std::ptrdiff_t> bound(numChunks + 1);
+    for (int i = 0; i <= numChunks; ++i)
+        bound[i] = n * i / numChunks;
+
+    #pragma omp parallel for
+    for (int i = 0; i < numChunks; ++i)
+        std::sort(first + bound[i], first + bound[i + 1], comp);
+
+    for (int width = 1; width < numChunks; width *= 2) {
+        #pragma omp parallel for
+        for (int i = 0; i < numChunks; i += 2 * width)
+            std::inplace_merge(first + bound[i], first + bound[i + width], first + bound[i + 2 * width], comp);
+    }
+}
+
+int RemoveDuplicateVertices(Mesh& m)
+{
+    std::vector<int> perm;
+    perm.reserve(m.vert.size());
+    for (unsigned i = 0; i < m.vert.size(); ++i)
+        if (!m.vert[i].IsD())
+            perm.push_back(i);
+
+    ParallelSort(perm.begin(), perm.end(), [&m](int a, int b) {
+        const vcg::Point3d& pa = m.vert[a].cP();
+        const vcg::Point3d& pb = m.vert[b].cP();
+        return (pa != pb) ? (pa < pb) : (a < b);
+    });
+
+    // the first vertex of each run of equal positions is kept
+    std::vector<int> rep(m.vert.size());
+    for (unsigned i = 0; i < m.vert.size(); ++i)
+        rep[i] = i;
+    int deleted = 0;
+    for (unsigned k = 1; k < perm.size(); ++k) {
+        int first = rep[perm[k - 1]];
+        if (m.vert[perm[k]].cP() == m.vert[first].cP()) {
+            rep[perm[k]] = first;
+            tri::Allocator<Mesh>::DeleteVertex(m, m.vert[perm[k]]);
+            deleted++;
+        }
+    }
+
+    const int fn = (int) m.face.size();
+    std::vector<char> degenerate(fn, 0);
+    #pragma omp parallel for
+    for (int i = 0; i < fn; ++i) {
+        auto& f = m.face[i];
+        if (f.IsD())
+            continue;
+        for (int k = 0; k < 3; ++k)
+            f.V(k) = &m.vert[rep[tri::Index(m, f.V(k))]];
+        degenerate[i] = (f.V(0) == f.V(1) || f.V(0) == f.V(2) || f.V(1) == f.V(2));
+    }
+
+    for (int i = 0; i < fn; ++i)
+        if (degenerate[i])
+            tri::Allocator<Mesh>::DeleteFace(m, m.face[i]);
+
+    return deleted;
 }
 
-static inline bool vCmp(const Mesh& mdst, const MeshVertex& v1, const MeshVertex& v2)
+int RemoveZeroAreaFaces(Mesh& m)
 {
-    (void) mdst;
-    return v1.T() == v2.T();
+    const int fn = (int) m.face.size();
+    std::vector<char> zeroArea(fn, 0);
+    #pragma omp parallel for
+    for (int i = 0; i < fn; ++i)
+        zeroArea[i] = !m.face[i].IsD() && vcg::DoubleArea(m.face[i]) <= 0;
+
+    int removed = 0;
+    for (int i = 0; i < fn; ++i) {
+        if (zeroArea[i]) {
+            tri::Allocator<Mesh>::DeleteFace(m, m.face[i]);
+            removed++;
+        }
+    }
+    return removed;
+}
+
+void ComputeFaceFaceTopology(Mesh& m)
+{
+    struct HalfEdgeKey {
+        uint64_t edge;  // vertex indices of the edge, the smallest in the high bits
+        int corner;     // 3 * face index + edge index
+        bool operator<(const HalfEdgeKey& other) const { return edge != other.edge ? edge < other.edge : corner < other.corner; }
+    };
+
+    const int fn = (int) m.face.size();
+    std::vector<HalfEdgeKey> keys(3 * fn);
+    std::vector<char> live(fn);
+    #pragma omp parallel for
+    for (int i = 0; i < fn; ++i) {
+        const auto& f = m.face[i];
+        live[i] = !f.IsD();
+        for (int k = 0; k < 3; ++k) {
+            uint64_t v0 = tri::Index(m, f.cV0(k));
+            uint64_t v1 = tri::Index(m, f.cV1(k));
+            // the half-edges of deleted faces are sorted to the end and ignored
+            uint64_t edge = live[i] ? ((std::min(v0, v1) << 32) | std::max(v0, v1)) : std::numeric_limits<uint64_t>::max();
+            keys[3 * i + k] = { edge, 3 * i + k };
+        }
+    }
+
+    ParallelSort(keys.begin(), keys.end(), std::less<HalfEdgeKey>());
+
+    // the faces that share an edge are linked in a circular list, as in
+    // tri::UpdateTopology::FaceFace() (a border edge links its face to itself)
+    const int numKeys = (int) keys.size();
+    #pragma omp parallel for schedule(static, 4096)
+    for (int k = 0; k < numKeys; ++k) {
+        if ((k > 0 && keys[k].edge == keys[k - 1].edge) || !live[keys[k].corner / 3])
+            continue;
+        int end = k + 1;
+        while (end < numKeys && keys[end].edge == keys[k].edge)
+            end++;
+        for (int q = k; q < end; ++q) {
+            int next = (q + 1 < end) ? q + 1 : k;
+            auto& f = m.face[keys[q].corner / 3];
+            f.FFp(keys[q].corner % 3) = &m.face[keys[next].corner / 3];
+            f.FFi(keys[q].corner % 3) = keys[next].corner % 3;
+        }
+    }
+}
+
+void OrientFacesCoherently(Mesh& m, bool *isOriented, bool *isOrientable)
+{
+    const int fn = (int) m.face.size();
+
+    // the faces connected by any edge can update each other's topology when
+    // flipped, so they are processed by the same thread
+    ConcurrentDisjointSet components(fn);
+    #pragma omp parallel for schedule(static, 4096)
+    for (int i = 0; i < fn; ++i) {
+        if (m.face[i].IsD())
+            continue;
+        for (int k = 0; k < 3; ++k)
+            if (!face::IsBorder(m.face[i], k))
+                components.Unite(i, (int) tri::Index(m, m.face[i].FFp(k)));
+    }
+
+    std::vector<int> roots;
+    std::vector<int> next(fn, -1); // faces of each component, as a list in index order
+    {
+        std::vector<int> last(fn, -1);
+        for (int i = 0; i < fn; ++i) {
+            if (m.face[i].IsD())
+                continue;
+            int r = components.Find(i);
+            if (r == i)
+                roots.push_back(i);
+            else
+                next[last[r]] = i;
+            last[r] = i;
+        }
+    }
+
+    bool oriented = true;
+    bool orientable = true;
+
+    tri::UpdateFlags<Mesh>::FaceClearV(m);
+
+    #pragma omp parallel for schedule(dynamic, 1) reduction(&&:oriented, orientable)
+    for (int c = 0; c < (int) roots.size(); ++c) {
+        std::vector<Mesh::FacePointer> stack;
+        bool componentOrientable = true;
+        for (int i = roots[c]; i != -1 && componentOrientable; i = next[i]) {
+            if (m.face[i].IsV())
+                continue;
+            m.face[i].SetV();
+            stack.push_back(&m.face[i]);
+            while (!stack.empty()) {
+                Mesh::FacePointer fp = stack.back();
+                stack.pop_back();
+                for (int j = 0; j < 3; ++j) {
+                    if (face::IsBorder(*fp, j) || !face::IsManifold(*fp, j))
+                        continue;
+                    Mesh::FacePointer fpaux = fp->FFp(j);
+                    int iaux = fp->FFi(j);
+                    if (!face::CheckOrientation(*fpaux, iaux)) {
+                        oriented = false;
+                        if (fpaux->IsV()) {
+                            orientable = false;
+                            componentOrientable = false;
+                            break;
+                        }
+                        // unlike tri::Clean::OrientCoherentlyMesh() the wedge
+                        // tex coords and the normal follow the swapped vertices
+                        face::SwapEdge<MeshFace, true>(*fpaux, iaux);
+                        std::swap(fpaux->WT(iaux), fpaux->WT((iaux + 1) % 3));
+                        fpaux->N() = -fpaux->N();
+                    }
+                    if (!fpaux->IsV()) {
+                        fpaux->SetV();
+                        stack.push_back(fpaux);
+                    }
+                }
+            }
+        }
+    }
+
+    if (isOriented)
+        *isOriented = oriented;
+    if (isOrientable)
+        *isOrientable = orientable;
+}
+
+int RemoveNonManifoldFaces(Mesh& m)
+{
+    const int fn = (int) m.face.size();
+    std::vector<char> nonManifold(fn, 0);
+    #pragma omp parallel for
+    for (int i = 0; i < fn; ++i) {
+        const auto& f = m.face[i];
+        nonManifold[i] = !f.IsD() && (!face::IsManifold(f, 0) || !face::IsManifold(f, 1) || !face::IsManifold(f, 2));
+    }
+
+    std::vector<Mesh::FacePointer> toDelete;
+    for (int i = 0; i < fn; ++i)
+        if (nonManifold[i])
+            toDelete.push_back(&m.face[i]);
+
+    // as in tri::Clean::RemoveNonManifoldFace(), the smallest faces are removed
+    // first and each face is checked again before removing it
+    std::sort(toDelete.begin(), toDelete.end(), [](Mesh::FacePointer a, Mesh::FacePointer b) {
+        double da = vcg::DoubleArea(*a);
+        double db = vcg::DoubleArea(*b);
+        return (da != db) ? (da < db) : (a < b);
+    });
+
+    int removed = 0;
+    for (auto fp : toDelete) {
+        if (!face::IsManifold(*fp, 0) || !face::IsManifold(*fp, 1) || !face::IsManifold(*fp, 2)) {
+            for (int j = 0; j < 3; ++j)
+                if (!face::IsBorder(*fp, j))
+                    face::FFDetach(*fp, j);
+            tri::Allocator<Mesh>::DeleteFace(m, *fp);
+            removed++;
+        }
+    }
+    return removed;
 }
 
 void CutAlongSeams(Mesh& m)
 {
-    tri::AttributeSeam::SplitVertex(m, vExt, vCmp);
-    tri::Allocator<Mesh>::CompactVertexVector(m);
-    tri::UpdateTopology<Mesh>::FaceFace(m);
-    tri::UpdateTopology<Mesh>::VertexFace(m);
+    const int fn = (int) m.face.size();
+    const int vn = (int) m.vert.size();
+    const int numCorners = 3 * fn;
+
+    auto CornerVertex = [&m](int c) { return (int) tri::Index(m, m.face[c / 3].cV(c % 3)); };
+    auto CornerTex = [&m](int c) -> const MeshTexCoord& { return m.face[c / 3].WT(c % 3); };
+
+    // the corners are bucketed by vertex, in face order
+    std::vector<int> offset(vn + 1, 0);
+    for (int i = 0; i < fn; ++i)
+        if (!m.face[i].IsD())
+            for (int k = 0; k < 3; ++k)
+                offset[CornerVertex(3 * i + k) + 1]++;
+    for (int v = 0; v < vn; ++v)
+        offset[v + 1] += offset[v];
+
+    std::vector<int> bucket(offset[vn]);
+    {
+        std::vector<int> pos(offset.begin(), offset.end() - 1);
+        for (int i = 0; i < fn; ++i)
+            if (!m.face[i].IsD())
+                for (int k = 0; k < 3; ++k)
+                    bucket[pos[CornerVertex(3 * i + k)]++] = 3 * i + k;
+    }
+
+    // the corners of each vertex are grouped by wedge tex coord, leader[c] is
+    // the first corner of the group of c. As in tri::AttributeSeam::SplitVertex(),
+    // the vertex keeps the group of its first corner, and each other group gets
+    // a new vertex
+    std::vector<int> leader(numCorners, -1);
+    std::vector<int> added(numCorners + 1, 0);
+    #pragma omp parallel
+    {
+        std::vector<int> groups;
+        #pragma omp for schedule(dynamic, 4096)
+        for (int v = 0; v < vn; ++v) {
+            groups.clear();
+            for (int j = offset[v]; j < offset[v + 1]; ++j) {
+                int c = bucket[j];
+                leader[c] = c;
+                for (int g : groups) {
+                    if (CornerTex(g) == CornerTex(c)) {
+                        leader[c] = g;
+                        break;
+                    }
+                }
+                if (leader[c] == c) {
+                    if (!groups.empty())
+                        added[c] = 1;
+                    groups.push_back(c);
+                }
+            }
+        }
+    }
+
+    // the added vertices follow the order of their first corners
+    int numAdded = 0;
+    for (int c = 0; c < numCorners; ++c) {
+        int a = added[c];
+        added[c] = numAdded;
+        numAdded += a;
+    }
+    added[numCorners] = numAdded;
+
+    tri::Allocator<Mesh>::AddVertices(m, numAdded);
+
+    // the added vertices are copied before the tex coords of the sources change
+    #pragma omp parallel for schedule(static, 4096)
+    for (int c = 0; c < numCorners; ++c) {
+        if (added[c + 1] > added[c]) {
+            MeshVertex& nv = m.vert[vn + added[c]];
+            nv.ImportData(*m.face[c / 3].cV(c % 3));
+            nv.T() = CornerTex(c);
+        }
+    }
+
+    #pragma omp parallel for schedule(static, 4096)
+    for (int v = 0; v < vn; ++v)
+        if (offset[v + 1] > offset[v])
+            m.vert[v].T() = CornerTex(bucket[offset[v]]);
+
+    #pragma omp parallel for schedule(static, 4096)
+    for (int c = 0; c < numCorners; ++c) {
+        int l = leader[c];
+        if (l >= 0 && added[l + 1] > added[l])
+            m.face[c / 3].V(c % 3) = &m.vert[vn + added[l]];
+    }
+
+    // the faces that no longer share both vertices of an edge are detached
+    #pragma omp parallel for
+    for (int i = 0; i < fn; ++i) {
+        auto& f = m.face[i];
+        if (f.IsD())
+            continue;
+        for (int k = 0; k < 3; ++k) {
+            if (face::IsBorder(f, k))
+                continue;
+            const auto& g = *f.FFp(k);
+            int j = f.FFi(k);
+            bool shared = (f.V0(k) == g.cV1(j) && f.V1(k) == g.cV0(j)) || (f.V0(k) == g.cV0(j) && f.V1(k) == g.cV1(j));
+            if (!shared) {
+                f.FFp(k) = &f;
+                f.FFi(k) = k;
+            }
+        }
+    }
+
+    InvalidateDerivedData(m, DERIVED_VERTEX_FACE);
+}
+
+int SplitNonManifoldVertices(Mesh& m)
+{
+    const int fn = (int) m.face.size();
+    const int vn = (int) m.vert.size();
+
+    // fans of corners around each vertex, connected through the shared edges
+    ConcurrentDisjointSet fans(3 * fn);
+    #pragma omp parallel for schedule(static, 4096)
+    for (int i = 0; i < fn; ++i) {
+        const auto& f = m.face[i];
+        if (f.IsD())
+            continue;
+        for (int k = 0; k < 3; ++k) {
+            if (face::IsBorder(f, k))
+                continue;
+            const auto& g = *f.cFFp(k);
+            int gi = (int) tri::Index(m, g);
+            int j = f.cFFi(k);
+            if (f.cV0(k) == g.cV1(j) && f.cV1(k) == g.cV0(j)) {
+                fans.Unite(3 * i + k, 3 * gi + (j + 1) % 3);
+                fans.Unite(3 * i + (k + 1) % 3, 3 * gi + j);
+            } else if (f.cV0(k) == g.cV0(j) && f.cV1(k) == g.cV1(j)) {
+                fans.Unite(3 * i + k, 3 * gi + j);
+                fans.Unite(3 * i + (k + 1) % 3, 3 * gi + (j + 1) % 3);
+            }
+        }
+    }
+
+    // the fan with the first corner keeps the vertex, the roots are the first
+    // corners of the fans so they are visited before the other corners
+    std::vector<int> fanVertex(3 * fn, -1);
+    std::vector<char> hasFan(vn, 0);
+    std::vector<int> source;
+    for (int c = 0; c < 3 * fn; ++c) {
+        if (m.face[c / 3].IsD() || fans.Find(c) != c)
+            continue;
+        int v = (int) tri::Index(m, m.face[c / 3].cV(c % 3));
+        if (!hasFan[v]) {
+            hasFan[v] = 1;
+            fanVertex[c] = v;
+        } else {
+            fanVertex[c] = vn + (int) source.size();
+            source.push_back(v);
+        }
+    }
+
+    if (source.empty())
+        return 0;
+
+    tri::Allocator<Mesh>::AddVertices(m, source.size());
+
+    #pragma omp parallel for
+    for (int i = 0; i < (int) source.size(); ++i)
+        m.vert[vn + i].ImportData(m.vert[source[i]]);
+
+    #pragma omp parallel for
+    for (int i = 0; i < fn; ++i) {
+        if (m.face[i].IsD())
+            continue;
+        for (int k = 0; k < 3; ++k)
+            m.face[i].V(k) = &m.vert[fanVertex[fans.Find(3 * i + k)]];
+    }
+
+    InvalidateDerivedData(m, DERIVED_VERTEX_FACE);
+
+    return (int) source.size();
+}
+
+/* Spreads the lowest 21 bits of x to every third bit */
+static uint64_t SpreadBits3(uint64_t x)
+{
+    x &= 0x1fffff;
+    x = (x | x << 32) & 0x1f00000000ffffULL;
+    x = (x | x << 16) & 0x1f0000ff0000ffULL;
+    x = (x | x << 8) & 0x100f00f00f00f00fULL;
+    x = (x | x << 4) & 0x10c30c30c30c30c3ULL;
+    x = (x | x << 2) & 0x1249249249249249ULL;
+    return x;
+}
+
+/* Moves the element i of v to newIndex[i], following the cycles of the permutation */
+template <typename Container>
+static void PermuteInPlace(Container& v, const std::vector<std::size_t>& newIndex)
+{
+    std::vector<bool> done(v.size(), false);
+    for (std::size_t i = 0; i < v.size(); ++i) {
+        if (done[i])
+            continue;
+        typename Container::value_type carry = v[i];
+        for (std::size_t j = newIndex[i]; j != i; j = newIndex[j]) {
+            std::swap(carry, v[j]);
+            done[j] = true;
+        }
+        v[i] = carry;
+        done[i] = true;
+    }
+}
+
+/* Moves the element i of the attributes to newIndex[i]. The vcg reordering only
+ * supports compactions (it copies in place in index order), so the elements are
+ * first moved to the upper half of the containers resized to twice their size,
+ * and then back */
+static void PermuteAttributes(std::set<Mesh::PointerToAttribute>& attributes, const std::vector<std::size_t>& newIndex)
+{
+    const std::size_t n = newIndex.size();
+    const std::size_t none = std::numeric_limits<std::size_t>::max();
+    std::vector<std::size_t> up(2 * n, none);
+    std::vector<std::size_t> down(2 * n, none);
+    for (std::size_t i = 0; i < n; ++i) {
+        up[i] = n + newIndex[i];
+        down[n + i] = i;
+    }
+    for (const Mesh::PointerToAttribute& a : attributes) {
+        Mesh::PointerToAttribute pa = a;
+        pa.Resize(2 * n);
+        pa.Reorder(up);
+        pa.Reorder(down);
+        pa.Resize(n);
+    }
+}
+
+int ReorderForLocality(Mesh& m)
+{
+    if (m.fn != (int) m.face.size() || m.vn != (int) m.vert.size())
+        tri::Allocator<Mesh>::CompactEveryVector(m);
+
+    const int fn = (int) m.face.size();
+    const int vn = (int) m.vert.size();
+    if (fn == 0)
+        return 0;
+
+    ConcurrentDisjointSet components(fn);
+    #pragma omp parallel for schedule(static, 4096)
+    for (int i = 0; i < fn; ++i) {
+        for (int k = 0; k < 3; ++k) {
+            int j = (int) tri::Index(m, m.face[i].FFp(k));
+            if (j != i)
+                components.Unite(i, j);
+        }
+    }
+
+    // the roots are the smallest faces of the components
+    std::vector<int> chart(fn);
+    int numCharts = 0;
+    for (int i = 0; i < fn; ++i) {
+        int r = components.Find(i);
+        chart[i] = (r == i) ? numCharts++ : chart[r];
+    }
+
+    std::vector<vcg::Point3d> centroid(fn);
+    #pragma omp parallel for
+    for (int i = 0; i < fn; ++i)
+        centroid[i] = (m.face[i].cP(0) + m.face[i].cP(1) + m.face[i].cP(2)) / 3.0;
+
+    std::vector<vcg::Box3d> box(numCharts);
+    for (int i = 0; i < fn; ++i)
+        box[chart[i]].Add(centroid[i]);
+
+    // the curve is scaled uniformly in each chart, by its longest side
+    struct FaceKey {
+        int chart;
+        uint64_t code;
+        int face;
+        bool operator<(const FaceKey& other) const {
+            if (chart != other.chart)
+                return chart < other.chart;
+            return (code != other.code) ? code < other.code : face < other.face;
+        }
+    };
+    std::vector<FaceKey> keys(fn);
+    #pragma omp parallel for
+    for (int i = 0; i < fn; ++i) {
+        const vcg::Box3d& b = box[chart[i]];
+        double side = std::max(std::max(b.DimX(), b.DimY()), std::max(b.DimZ(), std::numeric_limits<double>::min()));
+        vcg::Point3d q = (centroid[i] - b.min) * (double((1 << 21) - 1) / side);
+        uint64_t code = SpreadBits3(uint64_t(q.X())) | (SpreadBits3(uint64_t(q.Y())) << 1) | (SpreadBits3(uint64_t(q.Z())) << 2);
+        keys[i] = { chart[i], code, i };
+    }
+    ParallelSort(keys.begin(), keys.end(), std::less<FaceKey>());
+    std::vector<int>().swap(chart);
+    std::vector<vcg::Point3d>().swap(centroid);
+
+    std::vector<std::size_t> faceIndex(fn);
+    #pragma omp parallel for
+    for (int i = 0; i < fn; ++i)
+        faceIndex[keys[i].face] = i;
+
+    // the vertices in order of first use, the unreferenced ones at the end
+    const std::size_t none = std::numeric_limits<std::size_t>::max();
+    std::vector<std::size_t> vertIndex(vn, none);
+    std::size_t next = 0;
+    for (const FaceKey& key : keys)
+        for (int k = 0; k < 3; ++k) {
+            std::size_t& vi = vertIndex[tri::Index(m, m.face[key.face].cV(k))];
+            if (vi == none)
+                vi = next++;
+        }
+    for (std::size_t& vi : vertIndex)
+        if (vi == none)
+            vi = next++;
+    std::vector<FaceKey>().swap(keys);
+
+    // the pointers are remapped before the elements are moved, the storage is the same
+    MeshFace *fbase = &m.face[0];
+    MeshVertex *vbase = &m.vert[0];
+    #pragma omp parallel for
+    for (int i = 0; i < fn; ++i) {
+        MeshFace& f = m.face[i];
+        for (int k = 0; k < 3; ++k) {
+            f.FFp(k) = fbase + faceIndex[f.FFp(k) - fbase];
+            f.V(k) = vbase + vertIndex[f.V(k) - vbase];
+        }
+    }
+    for (auto& e : m.edge)
+        for (int k = 0; k < 2; ++k)
+            e.V(k) = vbase + vertIndex[e.V(k) - vbase];
+
+    auto ffadj = Get3DFaceAdjacencyAttribute(m);
+    #pragma omp parallel for
+    for (int i = 0; i < fn; ++i)
+        for (int k = 0; k < 3; ++k)
+            ffadj[i].f[k] = (int) faceIndex[ffadj[i].f[k]];
+
+    PermuteInPlace(m.face, faceIndex);
+    PermuteAttributes(m.face_attr, faceIndex);
+    PermuteInPlace(m.vert, vertIndex);
+    PermuteAttributes(m.vert_attr, vertIndex);
+
+    InvalidateDerivedData(m, DERIVED_VERTEX_FACE);
+
+    return numCharts;
 }
 
 void MeshFromFacePointers(const std::vector<Mesh::FacePointer>& vfp, Mesh& out)
 {
+    static thread_local std::vector<int> cornerVertex;
+    static thread_local std::vector<Mesh::VertexPointer> vertices;
+    IndexVertices(vfp, cornerVertex, vertices);
+
+    // the element vectors of out keep their capacity across calls
     out.Clear();
-    std::unordered_map<Mesh::VertexPointer, Mesh::VertexPointer> vpmap;
-    vpmap.reserve(vfp.size() * 2);
-    std::size_t vn = 0;
-    for (auto fptr : vfp) {
-        for (int i = 0; i < 3; ++i) {
-            if (vpmap.count(fptr->V(i)) == 0) {
-                vn++;
-                vpmap[fptr->V(i)] = nullptr;
-            }
+    tri::Allocator<Mesh>::AddVertices(out, vertices.size());
+    tri::Allocator<Mesh>::AddFaces(out, vfp.size());
+    for (std::size_t j = 0; j < vertices.size(); ++j)
+        out.vert[j].P() = vertices[j]->P();
+    for (std::size_t i = 0; i < vfp.size(); ++i) {
+        Mesh::FacePointer mfp = &out.face[i];
+        for (int k = 0; k < 3; ++k) {
+            mfp->V(k) = &out.vert[cornerVertex[3 * i + k]];
+            mfp->WT(k) = vfp[i]->WT(k);
         }
+        mfp->SetMesh();
     }
-    auto mvi = tri::Allocator<Mesh>::AddVertices(out, vn);
-    auto mfi = tri::Allocator<Mesh>::AddFaces(out, vfp.size());
+}
+
+void IndexVertices(const std::vector<Mesh::FacePointer>& vfp, std::vector<int>& cornerVertex, std::vector<Mesh::VertexPointer>& vertices)
+{
+    static thread_local DenseIndexMap vertexMap;
+
+    cornerVertex.resize(3 * vfp.size());
+    vertices.clear();
+    if (vfp.empty())
+        return;
+
+    // the vertices are indexed by their offset from the lowest one, as they are
+    // all in the vertex vector of the mesh
+    Mesh::VertexPointer lo = vfp[0]->V(0);
+    Mesh::VertexPointer hi = lo;
     for (auto fptr : vfp) {
-        Mesh::FacePointer mfp = &*mfi++;
-        for (int i = 0; i < 3; ++i) {
-            Mesh::VertexPointer vp = fptr->V(i);
-            typename Mesh::VertexPointer& mvp = vpmap[vp];
-            if (mvp == nullptr) {
-                mvp = &*mvi++;
-                mvp->P() = vp->P();
+        for (int k = 0; k < 3; ++k) {
+            lo = std::min(lo, fptr->V(k), std::less<Mesh::VertexPointer>());
+            hi = std::max(hi, fptr->V(k), std::less<Mesh::VertexPointer>());
+        }
+    }
+    vertexMap.Reset(0, int(hi - lo));
+    for (std::size_t i = 0; i < vfp.size(); ++i) {
+        for (int k = 0; k < 3; ++k) {
+            Mesh::VertexPointer vp = vfp[i]->V(k);
+            int j = vertexMap.Get(int(vp - lo));
+            if (j == -1) {
+                j = (int) vertices.size();
+                vertexMap.Set(int(vp - lo), j);
+                vertices.push_back(vp);
             }
-            mfp->V(i) = mvp;
-            mfp->WT(i) = fptr->WT(i);
+            cornerVertex[3 * i + k] = j;
         }
-        mfp->SetMesh();
     }
 }
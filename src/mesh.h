@@ -76,10 +76,93 @@ private:
     unsigned char _qualifier;
 };
 
+/* Texture coordinates are stored in double precision unless the build defines
+ * FLOAT_TEXCOORDS (qmake FLOAT_TEXCOORDS=1), which halves the memory they take.
+ * The stored points then convert to and from vcg::Point2d, so that the code
+ * reading them (ARAP, matching, packing) keeps computing in double */
+#ifdef FLOAT_TEXCOORDS
+
+class TexCoordPoint : public vcg::Point2f {
+
+public:
+
+    TexCoordPoint() {}
+    TexCoordPoint(float u, float v) : vcg::Point2f(u, v) {}
+    TexCoordPoint(const vcg::Point2f& p) : vcg::Point2f(p) {}
+    TexCoordPoint(const vcg::Point2d& p) : vcg::Point2f(float(p.X()), float(p.Y())) {}
+
+    operator vcg::Point2d() const { return vcg::Point2d(X(), Y()); }
+
+    TexCoordPoint& operator+=(const vcg::Point2d& p) { X() += p.X(); Y() += p.Y(); return *this; }
+    TexCoordPoint& operator-=(const vcg::Point2d& p) { X() -= p.X(); Y() -= p.Y(); return *this; }
+};
+
+inline vcg::Point2d operator+(const TexCoordPoint& a, const TexCoordPoint& b) { return vcg::Point2d(a) + vcg::Point2d(b); }
+inline vcg::Point2d operator-(const TexCoordPoint& a, const TexCoordPoint& b) { return vcg::Point2d(a) - vcg::Point2d(b); }
+inline vcg::Point2d operator+(const TexCoordPoint& a, const vcg::Point2d& b) { return vcg::Point2d(a) + b; }
+inline vcg::Point2d operator-(const TexCoordPoint& a, const vcg::Point2d& b) { return vcg::Point2d(a) - b; }
+inline vcg::Point2d operator*(const TexCoordPoint& a, double s) { return vcg::Point2d(a) * s; }
+
+/* Same interface as vcg::TexCoord2<float, 1>, with TexCoordPoint as PointType */
+class MeshTexCoord {
+
+public:
+    typedef TexCoordPoint PointType;
+    typedef float ScalarType;
+
+    MeshTexCoord() {}
+    MeshTexCoord(float u, float v) : _t(u, v), _n(0) {}
+
+    const PointType& P() const { return _t; }
+    PointType& P() { return _t; }
+
+    float& U() { return _t[0]; }
+    float& V() { return _t[1]; }
+    const float& U() const { return _t[0]; }
+    const float& V() const { return _t[1]; }
+
+    short& N() { return _n; }
+    short N() const { return _n; }
+
+    float& u() { return _t[0]; }
+    float& v() { return _t[1]; }
+    const float& u() const { return _t[0]; }
+    const float& v() const { return _t[1]; }
+
+    short& n() { return _n; }
+    short n() const { return _n; }
+
+    template <class TexCoordType>
+    void Import(const TexCoordType& tc) { _t = TexCoordPoint(float(tc.U()), float(tc.V())); _n = tc.N(); }
+
+    bool operator==(const MeshTexCoord& tc) const { return _t == tc._t && _n == tc._n; }
+    bool operator!=(const MeshTexCoord& tc) const { return !(*this == tc); }
+    bool operator<(const MeshTexCoord& tc) const { return (_t != tc._t) && (tc._t < _t); }
+
+private:
+    PointType _t;
+    short _n;
+};
+
+template <class T> class MeshVertexTexCoord : public vertex::TexCoord<MeshTexCoord, T> {
+public: static void Name(std::vector<std::string>& name) { name.push_back(std::string("TexCoord2f")); T::Name(name); }
+};
+template <class T> class MeshWedgeTexCoord : public face::WedgeTexCoord<MeshTexCoord, T> {
+public: static void Name(std::vector<std::string>& name) { name.push_back(std::string("WedgeTexCoord2f")); T::Name(name); }
+};
+
+#else
+
+typedef vcg::TexCoord2d MeshTexCoord;
+template <class T> using MeshVertexTexCoord = vertex::TexCoord2d<T>;
+template <class T> using MeshWedgeTexCoord = face::WedgeTexCoord2d<T>;
+
+#endif
+
 struct MeshUsedTypes : public UsedTypes<Use<MeshVertex>::AsVertexType, Use<MeshFace>::AsFaceType, Use<MeshEdge>::AsEdgeType> {};
 
-class MeshVertex : public Vertex<MeshUsedTypes, vertex::Coord3d, vertex::TexCoord2d, vertex::Normal3d, vertex::VEAdj, vertex::VFAdj, vertex::Color4b, vertex::Qualityd, vertex::Mark, vertex::BitFlags> {};
-class MeshFace : public Face<MeshUsedTypes, FaceQualifier, face::VertexRef, face::FFAdj, face::VFAdj, face::Mark, face::WedgeTexCoord2d, face::Normal3d, face::Color4b, face::Qualityf, face::BitFlags>
+class MeshVertex : public Vertex<MeshUsedTypes, vertex::Coord3d, MeshVertexTexCoord, vertex::Normal3d, vertex::VFAdj, vertex::Mark, vertex::BitFlags> {};
+class MeshFace : public Face<MeshUsedTypes, FaceQualifier, face::VertexRef, face::FFAdj, face::VFAdj, face::Mark, MeshWedgeTexCoord, face::Normal3d, face::BitFlags>
 {
 public:
     RegionID id = INVALID_ID;
@@ -91,16 +174,51 @@ class Mesh : public tri::TriMesh<std::vector<MeshVertex>, std::vector<MeshFace>>
 public:
     std::string name{"mesh"};
 
+    /* Slots of the named attributes of mesh_attribute.h. Their handles are
+     * resolved by name the first time they are requested and then cached in
+     * the mesh, so the lookups do not go through the attribute sets */
+    enum AttributeSlot {
+        ATTRIBUTE_3D_FACE_ADJACENCY,
+        ATTRIBUTE_WEDGE_TEXCOORD_STORAGE,
+        ATTRIBUTE_BOUNDARY_INFO,
+        ATTRIBUTE_TARGET_SHAPE,
+        ATTRIBUTE_FACE_INDEX,
+        ATTRIBUTE_SHELL_3D_SHAPE,
+        ATTRIBUTE_FACE_COLOR,
+        ATTRIBUTE_SLOT_COUNT
+    };
+
+    struct CachedAttribute {
+        void *handle = nullptr;
+        int n = 0;
+    };
+
+    CachedAttribute attributeCache[ATTRIBUTE_SLOT_COUNT];
+
+    /* Mask of the derived data that is up to date (see derived_data.h) */
+    unsigned derivedData = 0;
+
     ~Mesh()
     {
         ClearAttributes();
     }
+
+    /* Hides TriMesh::ClearAttributes(), the cached handles are dropped with the attributes */
+    void ClearAttributes()
+    {
+        for (auto& ca : attributeCache)
+            ca = CachedAttribute();
+        tri::TriMesh<std::vector<MeshVertex>, std::vector<MeshFace>>::ClearAttributes();
+    }
 };
 
 struct SeamUsedTypes : public UsedTypes<Use<SeamVertex>::AsVertexType, Use<SeamEdge>::AsEdgeType/*, Use<SeamFace>::AsFaceType*/>{};
 
-class SeamVertex  : public Vertex< SeamUsedTypes, vertex::Coord3d, vertex::Normal3d, vertex::Color4b, vertex::VEAdj, vertex::VFAdj,vertex::BitFlags  >{};
-class SeamEdge    : public Edge<   SeamUsedTypes, edge::VertexRef, edge::VEAdj, edge::EEAdj, edge::Color4b, edge::BitFlags> {
+/* The seam mesh only stores what the seam traversal needs: the seam vertices are
+ * the vertices of the uncut mesh (the copies of a vertex along the seams are welded),
+ * and each edge refers to the two face-edges of the parent mesh it joins */
+class SeamVertex  : public Vertex< SeamUsedTypes, vertex::Coord3d, vertex::VEAdj, vertex::BitFlags  >{};
+class SeamEdge    : public Edge<   SeamUsedTypes, edge::VertexRef, edge::VEAdj, edge::EEAdj, edge::BitFlags> {
 public:
     Mesh::FacePointer fa;
     Mesh::FacePointer fb;
@@ -108,10 +226,23 @@ public:
     int eb;
 };
 //class SeamFace    : public Face  < SeamUsedTypes, face::VertexRef, face::VFAdj, face::FFAdj, face::Mark, face::Color4b, face::BitFlags > {};
-class SeamMesh : public tri::TriMesh< std::vector<SeamVertex>, std::vector<SeamEdge>/*, std::vector<SeamFace> */>{};
+class SeamMesh : public tri::TriMesh< std::vector<SeamVertex>, std::vector<SeamEdge>/*, std::vector<SeamFace> */>{
+public:
+    // the mesh the seam mesh was built from
+    Mesh *parent = nullptr;
+    // color attribute of the mesh faces, if the mesh had one when the seam mesh was built
+    bool hasFaceColor = false;
+    Mesh::PerFaceAttributeHandle<vcg::Color4b> faceColor;
+};
 
 bool LoadMesh(const char *fileName, Mesh& m, TextureObjectHandle& textureObject, int &loadMask);
-bool SaveMesh(const char *fileName, Mesh& m, const std::vector<std::shared_ptr<QImage>>& textureImages, bool color);
+/* Adds the texture images to the texture object, relative names are resolved
+ * against the current directory. Returns false if an image cannot be read */
+bool LoadTextureImages(const std::vector<std::string>& textureNames, TextureObjectHandle textureObject);
+/* Saves the mesh, obj, ply and glb files are written with the writers in mesh_writer.h.
+ * If embedTextures is true the textures are copied in glb files */
+bool SaveMesh(const char *fileName, Mesh& m, const std::vector<std::shared_ptr<QImage>>& textureImages, bool color, const char *textureExtension = "png",
+              bool embedTextures = false);
 
 void ScaleTextureCoordinatesToImage(Mesh& m, TextureObjectHandle textureObject);
 void ScaleTextureCoordinatesToParameterArea(Mesh& m, TextureObjectHandle textureObject);
@@ -119,13 +250,63 @@ void ScaleTextureCoordinatesToParameterArea(Mesh& m, TextureObjectHandle texture
 vcg::Box2d UVBox(const Mesh& m);
 vcg::Box2d UVBoxVertex(const Mesh& m);
 
-/* Duplicates vertices at seams */
+/* The following functions are the steps of PrepareMesh(), parallel versions of
+ * the corresponding vcg routines */
+
+/* Merges the vertices with the same position (the one with the smallest index is
+ * kept) and removes the faces that become degenerate. Returns the number of
+ * removed vertices */
+int RemoveDuplicateVertices(Mesh& m);
+
+/* Removes the faces with zero area, returns their number */
+int RemoveZeroAreaFaces(Mesh& m);
+
+/* Computes the FF topology from the sorted half-edges of the mesh. As in
+ * tri::UpdateTopology::FaceFace() the faces sharing a non-manifold edge are
+ * linked in a circular list */
+void ComputeFaceFaceTopology(Mesh& m);
+
+/* Flips the faces that are not consistently oriented with their neighbors,
+ * the connected components are visited in parallel. The wedge tex coords and
+ * the face normals are flipped with the vertices. Requires the FF topology, and
+ * keeps it up to date */
+void OrientFacesCoherently(Mesh& m, bool *isOriented, bool *isOrientable);
+
+/* Removes the faces with non-manifold edges, smallest first, keeping the FF
+ * topology up to date. Returns the number of removed faces */
+int RemoveNonManifoldFaces(Mesh& m);
+
+/* Duplicates vertices at seams, the corners of each vertex are grouped by wedge
+ * tex coord and each group after the first gets a new vertex. Requires the FF
+ * topology to be up to date and the edges to be manifold, the FF topology of the
+ * cut mesh is updated and the VF topology is invalidated (see derived_data.h) */
 void CutAlongSeams(Mesh& m);
 
+/* Splits the vertices shared by more than one fan of faces, the faces of each
+ * additional fan get a copy of the vertex. Requires the FF topology, and
+ * invalidates the VF topology if any vertex is split. Returns the number of
+ * added vertices */
+int SplitNonManifoldVertices(Mesh& m);
+
+/* Reorders the faces and the vertices of the prepared mesh for locality: the
+ * faces of each chart (connected component of the FF topology) become a
+ * contiguous range, in order of the first face of the chart, and are sorted
+ * along a Morton curve of their 3D centroids within the chart. The vertices are
+ * numbered in order of first use by the faces. The FF topology, the per face and
+ * per vertex attributes and the 3D adjacency attribute are remapped, and the VF
+ * topology is invalidated. Returns the number of charts */
+int ReorderForLocality(Mesh& m);
+
 /* Builds a mesh from a given vector of face pointers. The order of the faces
  * is guaranteed to be preserved in the face container of the mesh. */
 void MeshFromFacePointers(const std::vector<Mesh::FacePointer>& vfp, Mesh& out);
 
+/* Numbers the vertices of the faces (which must belong to the same mesh) in order
+ * of first reference: cornerVertex[3 * i + k] is the number of the k-th vertex of
+ * vfp[i], and vertices lists the numbered vertices. The vertices are mapped with a
+ * per-thread DenseIndexMap instead of hashing their pointers */
+void IndexVertices(const std::vector<Mesh::FacePointer>& vfp, std::vector<int>& cornerVertex, std::vector<Mesh::VertexPointer>& vertices);
+
 inline double AreaUV(const Mesh::FaceType& f)
 {
     vcg::Point2d u0 = f.cWT(0).P();
@@ -23,11 +23,13 @@
 #include "math_utils.h"
 #include "logging.h"
 
+// assumes topology is updated (FaceFace) and the face vector is compact
 void Compute3DFaceAdjacencyAttribute(Mesh& m)
 {
     auto ffadj = Get3DFaceAdjacencyAttribute(m);
-    tri::UpdateTopology<Mesh>::FaceFace(m);
-    for (auto& f : m.face) {
+    #pragma omp parallel for
+    for (int fi = 0; fi < (int) m.face.size(); ++fi) {
+        auto& f = m.face[fi];
         for (int i = 0; i < 3; ++i) {
             ffadj[f].f[i] = tri::Index(m, f.FFp(i));
             ffadj[f].e[i] = f.FFi(i);
@@ -49,7 +51,7 @@ void ComputeWedgeTexCoordStorageAttribute(Mesh& m)
 // assumes topology is updated (FaceFace)
 void ComputeBoundaryInfoAttribute(Mesh& m)
 {
-    BoundaryInfo& info = (tri::Allocator<Mesh>::GetPerMeshAttribute<BoundaryInfo>(m, "MeshAttribute_BoundaryInfo"))();
+    BoundaryInfo& info = LookupPerMeshAttribute<BoundaryInfo>(m, Mesh::ATTRIBUTE_BOUNDARY_INFO, "MeshAttribute_BoundaryInfo", true)();
     info.Clear();
     tri::UpdateFlags<Mesh>::FaceClearV(m);
     for (auto& f : m.face) {
@@ -27,7 +27,7 @@
 
 
 struct TexCoordStorage {
-    vcg::TexCoord2d tc[3];
+    MeshTexCoord tc[3];
 };
 
 struct CoordStorage {
@@ -77,6 +77,7 @@ inline Mesh::PerMeshAttributeHandle<BoundaryInfo> GetBoundaryInfoAttribute(Mesh&
 inline Mesh::PerFaceAttributeHandle<CoordStorage> GetTargetShapeAttribute(Mesh& shell);
 inline Mesh::PerFaceAttributeHandle<int> GetFaceIndexAttribute(Mesh& shell);
 inline Mesh::PerFaceAttributeHandle<CoordStorage> GetShell3DShapeAttribute(Mesh& shell);
+inline Mesh::PerFaceAttributeHandle<vcg::Color4b> GetFaceColorAttribute(Mesh& m);
 
 inline bool Has3DFaceAdjacencyAttribute(Mesh& m);
 inline bool HasWedgeTexCoordStorageAttribute(Mesh& m);
@@ -84,77 +85,137 @@ inline bool HasBoundaryInfoAttribute(Mesh& m);
 inline bool HasTargetShapeAttribute(Mesh& shell);
 inline bool HasFaceIndexAttribute(Mesh& shell);
 inline bool HasShell3DShapeAttribute(Mesh& shell);
+inline bool HasFaceColorAttribute(Mesh& m);
 
 void Compute3DFaceAdjacencyAttribute(Mesh& m);
 void ComputeWedgeTexCoordStorageAttribute(Mesh& m);
 void ComputeBoundaryInfoAttribute(Mesh& m);
 
 
+/* Cached lookups of the named attributes, see Mesh::AttributeSlot. The handle
+ * is resolved by name (and the attribute added if add is true) only when the
+ * slot is empty, inside a critical section so that the first lookup can happen
+ * in a parallel region. Returns an invalid handle if the attribute is missing */
+template <typename AttrType>
+inline Mesh::PerFaceAttributeHandle<AttrType> LookupPerFaceAttribute(Mesh& m, Mesh::AttributeSlot slot, const char *name, bool add)
+{
+    Mesh::CachedAttribute& ca = m.attributeCache[slot];
+    if (ca.handle == nullptr) {
+        #pragma omp critical (mesh_attribute_cache)
+        if (ca.handle == nullptr) {
+            auto h = add ? tri::Allocator<Mesh>::GetPerFaceAttribute<AttrType>(m, name)
+                         : tri::Allocator<Mesh>::FindPerFaceAttribute<AttrType>(m, name);
+            if (tri::Allocator<Mesh>::IsValidHandle<AttrType>(m, h)) {
+                ca.n = h.n_attr;
+                ca.handle = h._handle;
+            }
+        }
+    }
+    return Mesh::PerFaceAttributeHandle<AttrType>(ca.handle, ca.n);
+}
+
+template <typename AttrType>
+inline Mesh::PerMeshAttributeHandle<AttrType> LookupPerMeshAttribute(Mesh& m, Mesh::AttributeSlot slot, const char *name, bool add)
+{
+    Mesh::CachedAttribute& ca = m.attributeCache[slot];
+    if (ca.handle == nullptr) {
+        #pragma omp critical (mesh_attribute_cache)
+        if (ca.handle == nullptr) {
+            auto h = add ? tri::Allocator<Mesh>::GetPerMeshAttribute<AttrType>(m, name)
+                         : tri::Allocator<Mesh>::FindPerMeshAttribute<AttrType>(m, name);
+            if (tri::Allocator<Mesh>::IsValidHandle<AttrType>(m, h)) {
+                ca.n = h.n_attr;
+                ca.handle = h._handle;
+            }
+        }
+    }
+    return Mesh::PerMeshAttributeHandle<AttrType>(ca.handle, ca.n);
+}
+
+/* Contiguous storage of a per face attribute, indexed by face index */
+template <typename AttrType>
+inline AttrType *FaceAttributeData(Mesh::PerFaceAttributeHandle<AttrType>& h)
+{
+    return h._handle->data.data();
+}
+
 inline Mesh::PerFaceAttributeHandle<FF> Get3DFaceAdjacencyAttribute(Mesh& m)
 {
-    return tri::Allocator<Mesh>::GetPerFaceAttribute<FF>(m, "FaceAttribute_3DFaceAdjacency");
+    return LookupPerFaceAttribute<FF>(m, Mesh::ATTRIBUTE_3D_FACE_ADJACENCY, "FaceAttribute_3DFaceAdjacency", true);
 }
 
 inline bool Has3DFaceAdjacencyAttribute(Mesh& m)
 {
-    return tri::Allocator<Mesh>::IsValidHandle<FF>(
-                m, tri::Allocator<Mesh>::FindPerFaceAttribute<FF>(m, "FaceAttribute_3DFaceAdjacency"));
+    return LookupPerFaceAttribute<FF>(m, Mesh::ATTRIBUTE_3D_FACE_ADJACENCY, "FaceAttribute_3DFaceAdjacency", false)._handle != nullptr;
 }
 
 inline Mesh::PerFaceAttributeHandle<TexCoordStorage> GetWedgeTexCoordStorageAttribute(Mesh& m)
 {
-    return tri::Allocator<Mesh>::GetPerFaceAttribute<TexCoordStorage>(m, "WedgeTexCoordStorage");
+    return LookupPerFaceAttribute<TexCoordStorage>(m, Mesh::ATTRIBUTE_WEDGE_TEXCOORD_STORAGE, "WedgeTexCoordStorage", true);
 }
 
 inline bool HasWedgeTexCoordStorageAttribute(Mesh& m)
 {
-    return tri::Allocator<Mesh>::IsValidHandle<TexCoordStorage>(
-                m, tri::Allocator<Mesh>::FindPerFaceAttribute<TexCoordStorage>(m, "WedgeTexCoordStorage"));
+    return LookupPerFaceAttribute<TexCoordStorage>(m, Mesh::ATTRIBUTE_WEDGE_TEXCOORD_STORAGE, "WedgeTexCoordStorage", false)._handle != nullptr;
 }
 
 inline Mesh::PerMeshAttributeHandle<BoundaryInfo> GetBoundaryInfoAttribute(Mesh& m)
 {
     ensure(HasBoundaryInfoAttribute(m));
-    return tri::Allocator<Mesh>::GetPerMeshAttribute<BoundaryInfo>(m, "MeshAttribute_BoundaryInfo");
+    return LookupPerMeshAttribute<BoundaryInfo>(m, Mesh::ATTRIBUTE_BOUNDARY_INFO, "MeshAttribute_BoundaryInfo", false);
 }
 
 inline bool HasBoundaryInfoAttribute(Mesh& m)
 {
-    return tri::Allocator<Mesh>::IsValidHandle<BoundaryInfo>(
-                m, tri::Allocator<Mesh>::FindPerMeshAttribute<BoundaryInfo>(m, "MeshAttribute_BoundaryInfo"));
+    return LookupPerMeshAttribute<BoundaryInfo>(m, Mesh::ATTRIBUTE_BOUNDARY_INFO, "MeshAttribute_BoundaryInfo", false)._handle != nullptr;
 }
 
 inline Mesh::PerFaceAttributeHandle<CoordStorage> GetTargetShapeAttribute(Mesh& shell)
 {
-    return tri::Allocator<Mesh>::GetPerFaceAttribute<CoordStorage>(shell, "FaceAttribute_TargetShape");
+    return LookupPerFaceAttribute<CoordStorage>(shell, Mesh::ATTRIBUTE_TARGET_SHAPE, "FaceAttribute_TargetShape", true);
 }
 
 inline bool HasTargetShapeAttribute(Mesh& shell)
 {
-    return tri::Allocator<Mesh>::IsValidHandle<CoordStorage>(
-                shell, tri::Allocator<Mesh>::FindPerFaceAttribute<CoordStorage>(shell, "FaceAttribute_TargetShape"));
+    return LookupPerFaceAttribute<CoordStorage>(shell, Mesh::ATTRIBUTE_TARGET_SHAPE, "FaceAttribute_TargetShape", false)._handle != nullptr;
 }
 
 inline Mesh::PerFaceAttributeHandle<int> GetFaceIndexAttribute(Mesh& shell)
 {
-    return tri::Allocator<Mesh>::GetPerFaceAttribute<int>(shell, "FaceAttribute_FaceIndex");
+    return LookupPerFaceAttribute<int>(shell, Mesh::ATTRIBUTE_FACE_INDEX, "FaceAttribute_FaceIndex", true);
 }
 
 inline bool HasFaceIndexAttribute(Mesh& shell)
 {
-    return tri::Allocator<Mesh>::IsValidHandle<int>(
-                shell, tri::Allocator<Mesh>::FindPerFaceAttribute<int>(shell, "FaceAttribute_FaceIndex"));
+    return LookupPerFaceAttribute<int>(shell, Mesh::ATTRIBUTE_FACE_INDEX, "FaceAttribute_FaceIndex", false)._handle != nullptr;
 }
 
 inline Mesh::PerFaceAttributeHandle<CoordStorage> GetShell3DShapeAttribute(Mesh& shell)
 {
-    return tri::Allocator<Mesh>::GetPerFaceAttribute<CoordStorage>(shell, "FaceAttribute_Shell3DShape");
+    return LookupPerFaceAttribute<CoordStorage>(shell, Mesh::ATTRIBUTE_SHELL_3D_SHAPE, "FaceAttribute_Shell3DShape", true);
 }
 
 inline bool HasShell3DShapeAttribute(Mesh& shell)
 {
-    return tri::Allocator<Mesh>::IsValidHandle<CoordStorage>(
-                shell, tri::Allocator<Mesh>::FindPerFaceAttribute<CoordStorage>(shell, "FaceAttribute_Shell3DShape"));
+    return LookupPerFaceAttribute<CoordStorage>(shell, Mesh::ATTRIBUTE_SHELL_3D_SHAPE, "FaceAttribute_Shell3DShape", false)._handle != nullptr;
+}
+
+/* The face colors (the material colors of the input and the debug colorization
+ * of the output) are only allocated when they are used, white by default */
+inline Mesh::PerFaceAttributeHandle<vcg::Color4b> GetFaceColorAttribute(Mesh& m)
+{
+    bool created = !HasFaceColorAttribute(m);
+    auto color = LookupPerFaceAttribute<vcg::Color4b>(m, Mesh::ATTRIBUTE_FACE_COLOR, "FaceAttribute_Color", true);
+    if (created) {
+        for (auto& f : m.face)
+            color[f] = vcg::Color4b::White;
+    }
+    return color;
+}
+
+inline bool HasFaceColorAttribute(Mesh& m)
+{
+    return LookupPerFaceAttribute<vcg::Color4b>(m, Mesh::ATTRIBUTE_FACE_COLOR, "FaceAttribute_Color", false)._handle != nullptr;
 }
 
 #endif // MESH_ATTRIBUTE_H
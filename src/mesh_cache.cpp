@@ -0,0 +1,817 @@
+/*******************************************************************************
+    Copyright (c) 2021, Andrea Maggiordomo, Paolo Cignoni and Marco Tarini
+
+    This file is part of TextureDefrag, a reference implementation for
+    the paper ``Texture Defragmentation for Photo-Reconstructed 3D Models''
+    by Andrea Maggiordomo, Paolo Cignoni and Marco Tarini.
+
+    TextureDefrag is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    TextureDefrag is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with TextureDefrag. If not, see <https://www.gnu.org/licenses/>.
+*******************************************************************************/
+
+
+#include "mesh_cache.h"
+#include "mesh_attribute.h"
+#include "derived_data.h"
+#include "logging.h"
+#include "utils.h"
+
+#include <wrap/io_trimesh/io_mask.h>
+
+#include <vector>
+#include <string>
+#include <cstring>
+#include <cstdio>
+#include <limits>
+
+#include <QFile>
+#include <QSaveFile>
+#include <QFileInfo>
+#include <QDir>
+#include <QString>
+
+
+static const uint64_t MESH_CACHE_MAGIC = 0x31434853454d4454ULL; // "TDMESHC1"
+
+/* Must be incremented whenever the records or the mesh preparation change */
+static const uint64_t MESH_CACHE_VERSION = 3;
+
+/* number of records converted and written at once */
+static const std::size_t WRITE_BLOCK_RECORDS = 1 << 16;
+
+struct CacheHeader {
+    uint64_t magic;
+    uint64_t version;
+    uint64_t hash;
+    uint64_t size;
+    uint64_t vertexRecordSize;
+    uint64_t faceRecordSize;
+    uint64_t vn;
+    uint64_t fn;
+    uint64_t numTextures;
+    int64_t loadMask;
+    int64_t vndup;
+};
+
+static const uint64_t STAGE_SNAPSHOT_MAGIC = 0x3147545353444454ULL; // "TDDSSTG1"
+
+/* Must be incremented whenever the records or the layout of the stage snapshots change */
+static const uint64_t STAGE_SNAPSHOT_VERSION = 1;
+
+/* The header is followed by the texture sizes and the texture paths, the input
+ * file, the mesh name, the vertex and face records, then for the packing stage the
+ * chart records, the face indices of the charts (padded to 8 bytes) and the
+ * orientation records, for the rendering stage the sizes of the sheets */
+struct StageHeader {
+    uint64_t magic;
+    uint64_t version;
+    uint64_t stage;
+    uint64_t vertexRecordSize;
+    uint64_t faceRecordSize;
+    uint64_t vn;
+    uint64_t fn;
+    uint64_t numTextures;
+    uint64_t attributes;
+    uint64_t numCharts;
+    uint64_t numChartFaces;
+    uint64_t numFlipped;
+    uint64_t numSheets;
+    int64_t vndupIn;
+    int64_t vndupOut;
+    int64_t inputCharts;
+    int64_t outputCharts;
+    double inputUVLen;
+    double outputUVLen;
+    double inputMP;
+    double zeroResamplingFraction;
+};
+
+/* anchor is the index of the anchor face of the chart, -1 if it has none */
+struct StageChart {
+    int32_t id;
+    int32_t anchor;
+    int64_t numFaces;
+};
+
+struct StageFlipped {
+    int32_t id;
+    int32_t flipped;
+};
+
+struct CachedVertex {
+    double p[3];
+    double n[3];
+    double t[2];
+    int32_t tn;
+    int32_t flags;
+};
+
+/* ffp and adjFace are face indices (-1 for null pointers), wtStorage is the wedge
+ * texcoord storage attribute, adjFace/adjEdge the 3D face adjacency attribute and
+ * c the face color attribute (if the load mask has IOM_FACECOLOR) */
+struct CachedFace {
+    double wt[3][2];
+    double wtStorage[3][2];
+    double n[3];
+    int32_t v[3];
+    int32_t ffp[3];
+    int32_t adjFace[3];
+    int32_t flags;
+    int32_t id;
+    int32_t initialId;
+    int16_t wtn[3];
+    int16_t wtStorageN[3];
+    int8_t ffi[3];
+    int8_t adjEdge[3];
+    uint8_t c[4];
+    uint8_t qualifier;
+    uint8_t pad[1];
+};
+
+/* bounds checked cursor over the mapped snapshot */
+struct CacheReader {
+    const unsigned char *p;
+    const unsigned char *end;
+
+    bool Read(void *dst, std::size_t n)
+    {
+        if (std::size_t(end - p) < n)
+            return false;
+        std::memcpy(dst, p, n);
+        p += n;
+        return true;
+    }
+
+    bool ReadString(std::string& s)
+    {
+        uint64_t len;
+        if (!Read(&len, sizeof(len)) || std::size_t(end - p) < len)
+            return false;
+        s.assign(reinterpret_cast<const char *>(p), len);
+        p += (len + 7) & ~uint64_t(7);
+        p = std::min(p, end);
+        return true;
+    }
+};
+
+/* Optional face attributes stored in the face records */
+enum RecordAttributes : uint64_t {
+    RECORD_ADJACENCY = 1,
+    RECORD_STORAGE = 2,
+    RECORD_COLOR = 4
+};
+
+static uint64_t HashBytes(const unsigned char *data, std::size_t size);
+static void AppendString(std::vector<char>& buffer, const std::string& s);
+static bool WriteRecords(QSaveFile& file, Mesh& m, uint64_t attributes);
+static bool ReadRecords(CacheReader& reader, Mesh& m, uint64_t vn, uint64_t fn, uint64_t attributes);
+static void ToRecord(Mesh& m, const MeshVertex& v, CachedVertex& r);
+static void ToRecord(Mesh& m, MeshFace& f, Mesh::PerFaceAttributeHandle<FF> *ffadj,
+                     Mesh::PerFaceAttributeHandle<TexCoordStorage> *wtcs, Mesh::PerFaceAttributeHandle<Color4b> *color, CachedFace& r);
+static void FromRecord(const CachedVertex& r, MeshVertex& v);
+static bool FromRecord(Mesh& m, const CachedFace& r, MeshFace& f, Mesh::PerFaceAttributeHandle<FF> *ffadj,
+                       Mesh::PerFaceAttributeHandle<TexCoordStorage> *wtcs, Mesh::PerFaceAttributeHandle<Color4b> *color);
+static bool LoadSnapshotTextures(const std::vector<std::string>& texturePaths, const std::vector<TextureSize>& textureSizes,
+                                 TextureObjectHandle& textureObject, const std::string& path);
+
+
+bool GetMeshCacheEntry(const std::string& cacheDir, const char *fileName, MeshCacheEntry *entry)
+{
+    if (!QDir().mkpath(QString(cacheDir.c_str())))
+        return false;
+
+    QFile file(fileName);
+    if (!file.open(QIODevice::ReadOnly))
+        return false;
+    entry->size = file.size();
+    entry->hash = HashBytes(nullptr, 0);
+    if (entry->size > 0) {
+        const unsigned char *data = file.map(0, entry->size);
+        if (data == nullptr)
+            return false;
+        entry->hash = HashBytes(data, entry->size);
+        file.unmap(const_cast<unsigned char *>(data));
+    }
+
+    char name[32];
+    std::snprintf(name, sizeof(name), "%016llx.mcache", (unsigned long long) entry->hash);
+    entry->path = cacheDir + "/" + name;
+    return true;
+}
+
+bool LoadMeshCache(const MeshCacheEntry& entry, const char *fileName, Mesh& m, TextureObjectHandle& textureObject,
+                   int *loadMask, int *vndup)
+{
+    m.Clear();
+
+    QFile file(entry.path.c_str());
+    if (!file.open(QIODevice::ReadOnly))
+        return false;
+
+    const qint64 size = file.size();
+    const unsigned char *data = (size > qint64(sizeof(CacheHeader))) ? file.map(0, size) : nullptr;
+    if (data == nullptr)
+        return false;
+
+    CacheReader reader = { data, data + size };
+    CacheHeader header;
+    reader.Read(&header, sizeof(header));
+    if (header.magic != MESH_CACHE_MAGIC || header.version != MESH_CACHE_VERSION
+            || header.hash != entry.hash || header.size != entry.size
+            || header.vertexRecordSize != sizeof(CachedVertex) || header.faceRecordSize != sizeof(CachedFace)) {
+        LOG_WARN << "Ignoring the stale mesh snapshot " << entry.path;
+        return false;
+    }
+
+    std::vector<TextureSize> textureSizes(header.numTextures);
+    std::vector<std::string> textureNames(header.numTextures);
+    bool ok = header.numTextures < (1 << 20)
+            && reader.Read(textureSizes.data(), textureSizes.size() * sizeof(TextureSize));
+    for (std::size_t i = 0; ok && i < header.numTextures; ++i)
+        ok = reader.ReadString(textureNames[i]);
+    ok = ok && (std::size_t(reader.end - reader.p) == header.vn * sizeof(CachedVertex) + header.fn * sizeof(CachedFace));
+    if (!ok) {
+        LOG_WARN << "Ignoring the corrupted mesh snapshot " << entry.path;
+        return false;
+    }
+
+    QFileInfo fi(fileName);
+    fi.makeAbsolute();
+    m.name = fi.dir().dirName().toStdString() + "_" + fi.fileName().toStdString();
+    m.textures = textureNames;
+
+    // the texture names are relative to the mesh file, as in LoadMesh()
+    std::vector<std::string> texturePaths;
+    QDir meshDir = fi.absoluteDir();
+    for (const std::string& name : textureNames)
+        texturePaths.push_back(meshDir.absoluteFilePath(QString(name.c_str())).toStdString());
+
+    if (!LoadSnapshotTextures(texturePaths, textureSizes, textureObject, entry.path)) {
+        m.Clear();
+        m.textures.clear();
+        return false;
+    }
+
+    uint64_t attributes = RECORD_ADJACENCY | RECORD_STORAGE;
+    if (header.loadMask & tri::io::Mask::IOM_FACECOLOR)
+        attributes |= RECORD_COLOR;
+    if (!ReadRecords(reader, m, header.vn, header.fn, attributes)) {
+        LOG_WARN << "Ignoring the corrupted mesh snapshot " << entry.path;
+        m.Clear();
+        m.textures.clear();
+        return false;
+    }
+
+    // the records hold the FF topology and the normals
+    InvalidateDerivedData(m);
+    SetDerivedDataValid(m, DERIVED_FACE_FACE | DERIVED_NORMALS);
+
+    *loadMask = int(header.loadMask);
+    *vndup = int(header.vndup);
+
+    LOG_INFO << "Loaded the prepared mesh from " << entry.path << " (VN " << m.VN() << ", FN " << m.FN() << ")";
+    return true;
+}
+
+bool ReadMeshCacheTextures(const MeshCacheEntry& entry, const char *fileName, std::vector<std::string>& texturePaths)
+{
+    texturePaths.clear();
+
+    QFile file(entry.path.c_str());
+    if (!file.open(QIODevice::ReadOnly))
+        return false;
+
+    const qint64 size = file.size();
+    const unsigned char *data = (size > qint64(sizeof(CacheHeader))) ? file.map(0, size) : nullptr;
+    if (data == nullptr)
+        return false;
+
+    CacheReader reader = { data, data + size };
+    CacheHeader header;
+    reader.Read(&header, sizeof(header));
+    if (header.magic != MESH_CACHE_MAGIC || header.version != MESH_CACHE_VERSION
+            || header.hash != entry.hash || header.size != entry.size || header.numTextures >= (1 << 20)
+            || std::size_t(reader.end - reader.p) < header.numTextures * sizeof(TextureSize))
+        return false;
+    reader.p += header.numTextures * sizeof(TextureSize);
+
+    QDir meshDir = QFileInfo(fileName).absoluteDir();
+    for (std::size_t i = 0; i < header.numTextures; ++i) {
+        std::string name;
+        if (!reader.ReadString(name)) {
+            texturePaths.clear();
+            return false;
+        }
+        texturePaths.push_back(meshDir.absoluteFilePath(QString(name.c_str())).toStdString());
+    }
+    return true;
+}
+
+bool SaveMeshCache(const MeshCacheEntry& entry, Mesh& m, TextureObjectHandle textureObject, int loadMask, int vndup)
+{
+    ensure(Has3DFaceAdjacencyAttribute(m) && HasWedgeTexCoordStorageAttribute(m));
+    ensure(m.VN() == (int) m.vert.size() && m.FN() == (int) m.face.size());
+
+    std::vector<TextureSize> textureSizes = textureObject->GetTextureSizes();
+    ensure(textureSizes.size() == m.textures.size());
+
+    CacheHeader header;
+    std::memset(&header, 0, sizeof(header));
+    header.magic = MESH_CACHE_MAGIC;
+    header.version = MESH_CACHE_VERSION;
+    header.hash = entry.hash;
+    header.size = entry.size;
+    header.vertexRecordSize = sizeof(CachedVertex);
+    header.faceRecordSize = sizeof(CachedFace);
+    header.vn = m.vert.size();
+    header.fn = m.face.size();
+    header.numTextures = m.textures.size();
+    header.loadMask = loadMask;
+    header.vndup = vndup;
+
+    std::vector<char> textureData;
+    for (const std::string& name : m.textures)
+        AppendString(textureData, name);
+
+    QSaveFile file(entry.path.c_str());
+    if (!file.open(QIODevice::WriteOnly))
+        return false;
+
+    bool ok = file.write(reinterpret_cast<const char *>(&header), sizeof(header)) == qint64(sizeof(header))
+            && file.write(reinterpret_cast<const char *>(textureSizes.data()), textureSizes.size() * sizeof(TextureSize)) == qint64(textureSizes.size() * sizeof(TextureSize))
+            && file.write(textureData.data(), textureData.size()) == qint64(textureData.size());
+
+    uint64_t attributes = RECORD_ADJACENCY | RECORD_STORAGE;
+    if (HasFaceColorAttribute(m))
+        attributes |= RECORD_COLOR;
+    ok = ok && WriteRecords(file, m, attributes);
+
+    if (!ok || !file.commit()) {
+        LOG_WARN << "Unable to write the mesh snapshot " << entry.path;
+        return false;
+    }
+
+    LOG_INFO << "Saved the prepared mesh to " << entry.path;
+    return true;
+}
+
+bool SaveStageSnapshot(const std::string& path, Mesh& m, TextureObjectHandle textureObject, const StageSnapshot& snapshot)
+{
+    ensure(snapshot.stage == SnapshotStage::Packing || snapshot.stage == SnapshotStage::Rendering);
+    ensure(snapshot.stage != SnapshotStage::Packing || snapshot.graph);
+
+    std::vector<TextureSize> textureSizes = textureObject->GetTextureSizes();
+    ensure(textureSizes.size() == m.textures.size());
+
+    StageHeader header;
+    std::memset(&header, 0, sizeof(header));
+    header.magic = STAGE_SNAPSHOT_MAGIC;
+    header.version = STAGE_SNAPSHOT_VERSION;
+    header.stage = uint64_t(snapshot.stage);
+    header.vertexRecordSize = sizeof(CachedVertex);
+    header.faceRecordSize = sizeof(CachedFace);
+    header.vn = m.vert.size();
+    header.fn = m.face.size();
+    header.numTextures = m.textures.size();
+    if (Has3DFaceAdjacencyAttribute(m))
+        header.attributes |= RECORD_ADJACENCY;
+    if (HasWedgeTexCoordStorageAttribute(m))
+        header.attributes |= RECORD_STORAGE;
+    if (HasFaceColorAttribute(m))
+        header.attributes |= RECORD_COLOR;
+    header.vndupIn = snapshot.vndupIn;
+    header.vndupOut = snapshot.vndupOut;
+    header.inputCharts = snapshot.inputCharts;
+    header.outputCharts = snapshot.outputCharts;
+    header.inputUVLen = snapshot.inputUVLen;
+    header.outputUVLen = snapshot.outputUVLen;
+    header.inputMP = snapshot.inputMP;
+    header.zeroResamplingFraction = snapshot.zeroResamplingFraction;
+
+    // the texture paths are made absolute with respect to the input file, as they
+    // are resolved when the mesh is loaded
+    std::vector<char> stringData;
+    QDir meshDir = QFileInfo(QString(snapshot.inputFile.c_str())).absoluteDir();
+    for (const std::string& name : m.textures)
+        AppendString(stringData, meshDir.absoluteFilePath(QString(name.c_str())).toStdString());
+    AppendString(stringData, QFileInfo(QString(snapshot.inputFile.c_str())).absoluteFilePath().toStdString());
+    AppendString(stringData, m.name);
+
+    std::vector<StageChart> charts;
+    std::vector<int32_t> chartFaces;
+    std::vector<StageFlipped> flipped;
+    if (snapshot.stage == SnapshotStage::Packing) {
+        for (auto& entry : snapshot.graph->charts) {
+            auto it = snapshot.anchorMap.find(entry.second);
+            StageChart sc;
+            sc.id = entry.first;
+            sc.anchor = (it != snapshot.anchorMap.end()) ? it->second : -1;
+            sc.numFaces = entry.second->fpVec.size();
+            charts.push_back(sc);
+            for (auto fptr : entry.second->fpVec)
+                chartFaces.push_back((int32_t) tri::Index(m, fptr));
+        }
+        if (chartFaces.size() % 2)
+            chartFaces.push_back(-1);
+        for (auto& entry : snapshot.flipped)
+            flipped.push_back({ entry.first, entry.second ? 1 : 0 });
+        header.numCharts = charts.size();
+        header.numChartFaces = chartFaces.size();
+        header.numFlipped = flipped.size();
+    } else {
+        header.numSheets = snapshot.texszVec.size();
+    }
+
+    QSaveFile file(path.c_str());
+    if (!file.open(QIODevice::WriteOnly))
+        return false;
+
+    bool ok = file.write(reinterpret_cast<const char *>(&header), sizeof(header)) == qint64(sizeof(header))
+            && file.write(reinterpret_cast<const char *>(textureSizes.data()), textureSizes.size() * sizeof(TextureSize)) == qint64(textureSizes.size() * sizeof(TextureSize))
+            && file.write(stringData.data(), stringData.size()) == qint64(stringData.size())
+            && WriteRecords(file, m, header.attributes)
+            && file.write(reinterpret_cast<const char *>(charts.data()), charts.size() * sizeof(StageChart)) == qint64(charts.size() * sizeof(StageChart))
+            && file.write(reinterpret_cast<const char *>(chartFaces.data()), chartFaces.size() * sizeof(int32_t)) == qint64(chartFaces.size() * sizeof(int32_t))
+            && file.write(reinterpret_cast<const char *>(flipped.data()), flipped.size() * sizeof(StageFlipped)) == qint64(flipped.size() * sizeof(StageFlipped));
+    if (snapshot.stage == SnapshotStage::Rendering)
+        ok = ok && file.write(reinterpret_cast<const char *>(snapshot.texszVec.data()), snapshot.texszVec.size() * sizeof(TextureSize)) == qint64(snapshot.texszVec.size() * sizeof(TextureSize));
+
+    if (!ok || !file.commit())
+        return false;
+
+    return true;
+}
+
+bool LoadStageSnapshot(const std::string& path, Mesh& m, TextureObjectHandle& textureObject, StageSnapshot& snapshot)
+{
+    m.Clear();
+    m.textures.clear();
+    snapshot = StageSnapshot();
+
+    QFile file(path.c_str());
+    if (!file.open(QIODevice::ReadOnly))
+        return false;
+
+    const qint64 size = file.size();
+    const unsigned char *data = (size > qint64(sizeof(StageHeader))) ? file.map(0, size) : nullptr;
+    if (data == nullptr)
+        return false;
+
+    CacheReader reader = { data, data + size };
+    StageHeader header;
+    reader.Read(&header, sizeof(header));
+    if (header.magic != STAGE_SNAPSHOT_MAGIC || header.version != STAGE_SNAPSHOT_VERSION
+            || header.vertexRecordSize != sizeof(CachedVertex) || header.faceRecordSize != sizeof(CachedFace)
+            || (header.stage != uint64_t(SnapshotStage::Packing) && header.stage != uint64_t(SnapshotStage::Rendering))) {
+        LOG_WARN << path << " is not a stage snapshot of this version";
+        return false;
+    }
+
+    const uint64_t MAX_COUNT = uint64_t(1) << 31;
+    std::vector<TextureSize> textureSizes;
+    std::vector<std::string> texturePaths;
+    bool ok = header.numTextures < (1 << 20) && header.numCharts < MAX_COUNT && header.numChartFaces < MAX_COUNT
+            && header.numFlipped < MAX_COUNT && header.numSheets < (1 << 20);
+    if (ok) {
+        textureSizes.resize(header.numTextures);
+        texturePaths.resize(header.numTextures);
+        ok = reader.Read(textureSizes.data(), textureSizes.size() * sizeof(TextureSize));
+    }
+    for (std::size_t i = 0; ok && i < header.numTextures; ++i)
+        ok = reader.ReadString(texturePaths[i]);
+    std::string meshName;
+    ok = ok && reader.ReadString(snapshot.inputFile) && reader.ReadString(meshName);
+    if (!ok) {
+        LOG_WARN << "The stage snapshot " << path << " is corrupted";
+        return false;
+    }
+
+    if (!LoadSnapshotTextures(texturePaths, textureSizes, textureObject, path))
+        return false;
+
+    // the mesh references the textures by name, as if it was loaded from the input file
+    QDir meshDir = QFileInfo(QString(snapshot.inputFile.c_str())).absoluteDir();
+    for (const std::string& texturePath : texturePaths)
+        m.textures.push_back(meshDir.relativeFilePath(QString(texturePath.c_str())).toStdString());
+    m.name = meshName;
+
+    ok = ReadRecords(reader, m, header.vn, header.fn, header.attributes);
+
+    std::vector<StageChart> charts(ok ? header.numCharts : 0);
+    std::vector<int32_t> chartFaces(ok ? header.numChartFaces : 0);
+    std::vector<StageFlipped> flipped(ok ? header.numFlipped : 0);
+    snapshot.texszVec.resize(ok ? header.numSheets : 0);
+    ok = ok && reader.Read(charts.data(), charts.size() * sizeof(StageChart))
+            && reader.Read(chartFaces.data(), chartFaces.size() * sizeof(int32_t))
+            && reader.Read(flipped.data(), flipped.size() * sizeof(StageFlipped))
+            && reader.Read(snapshot.texszVec.data(), snapshot.texszVec.size() * sizeof(TextureSize))
+            && reader.p == reader.end;
+
+    if (ok && header.stage == uint64_t(SnapshotStage::Packing)) {
+        // the charts keep their ids and the order of their faces, so that the
+        // packing is the same as in the run that wrote the snapshot
+        snapshot.graph = std::make_shared<MeshGraph>(m);
+        snapshot.graph->textureObject = textureObject;
+        std::size_t first = 0;
+        for (std::size_t i = 0; ok && i < charts.size(); ++i) {
+            const StageChart& sc = charts[i];
+            ok = sc.id >= 0 && sc.id < (int) m.face.size() && sc.numFaces > 0 && sc.numFaces <= int64_t(chartFaces.size() - first)
+                    && sc.anchor >= -1 && sc.anchor < (int) m.face.size() && snapshot.graph->charts.count(sc.id) == 0;
+            if (!ok)
+                break;
+            ChartHandle chart = snapshot.graph->GetChart_Insert(sc.id);
+            chart->fpVec.reserve(sc.numFaces);
+            for (std::size_t k = first; ok && k < first + sc.numFaces; ++k) {
+                ok = chartFaces[k] >= 0 && chartFaces[k] < (int) m.face.size() && m.face[chartFaces[k]].id == sc.id;
+                if (ok)
+                    chart->fpVec.push_back(&m.face[chartFaces[k]]);
+            }
+            chart->dirty = true;
+            if (sc.anchor >= 0)
+                snapshot.anchorMap[chart] = sc.anchor;
+            first += sc.numFaces;
+        }
+        for (const StageFlipped& sf : flipped)
+            snapshot.flipped[sf.id] = (sf.flipped != 0);
+        if (ok && (header.attributes & RECORD_ADJACENCY))
+            ComputeChartAdjacency(*snapshot.graph);
+    }
+
+    if (!ok) {
+        LOG_WARN << "The stage snapshot " << path << " is corrupted";
+        snapshot = StageSnapshot();
+        m.Clear();
+        m.textures.clear();
+        return false;
+    }
+
+    // the records hold the FF topology and the normals
+    InvalidateDerivedData(m);
+    SetDerivedDataValid(m, DERIVED_FACE_FACE | DERIVED_NORMALS);
+
+    snapshot.stage = SnapshotStage(header.stage);
+    snapshot.vndupIn = int(header.vndupIn);
+    snapshot.vndupOut = int(header.vndupOut);
+    snapshot.inputCharts = int(header.inputCharts);
+    snapshot.outputCharts = int(header.outputCharts);
+    snapshot.inputUVLen = header.inputUVLen;
+    snapshot.outputUVLen = header.outputUVLen;
+    snapshot.inputMP = header.inputMP;
+    snapshot.zeroResamplingFraction = header.zeroResamplingFraction;
+
+    LOG_INFO << "Loaded the " << (snapshot.stage == SnapshotStage::Packing ? "packing" : "rendering") << " stage snapshot "
+             << path << " (VN " << m.VN() << ", FN " << m.FN() << ")";
+    return true;
+}
+
+
+// -- static functions ---------------------------------------------------------
+
+/* FNV-1a over 64-bit words, with a shift after each step so that the high bits of
+ * the words also reach the low bits of the hash */
+static uint64_t HashBytes(const unsigned char *data, std::size_t size)
+{
+    const uint64_t prime = 1099511628211ULL;
+    uint64_t h = 1469598103934665603ULL;
+    std::size_t i = 0;
+    for (; i + 8 <= size; i += 8) {
+        uint64_t w;
+        std::memcpy(&w, data + i, 8);
+        h = (h ^ w) * prime;
+        h ^= h >> 32;
+    }
+    for (; i < size; ++i)
+        h = (h ^ data[i]) * prime;
+    h = (h ^ uint64_t(size)) * prime;
+    return h ^ (h >> 32);
+}
+
+/* Appends the length and the characters of the string, padded to 8 bytes */
+static void AppendString(std::vector<char>& buffer, const std::string& s)
+{
+    uint64_t len = s.size();
+    const char *p = reinterpret_cast<const char *>(&len);
+    buffer.insert(buffer.end(), p, p + sizeof(len));
+    buffer.insert(buffer.end(), s.begin(), s.end());
+    buffer.resize((buffer.size() + 7) & ~std::size_t(7), 0);
+}
+
+/* Writes the vertex and face records in blocks, the face records have the face
+ * attributes selected by the mask */
+static bool WriteRecords(QSaveFile& file, Mesh& m, uint64_t attributes)
+{
+    RequireNormals(m);
+
+    bool ok = true;
+    std::vector<CachedVertex> vertexBlock;
+    for (std::size_t first = 0; ok && first < m.vert.size(); first += WRITE_BLOCK_RECORDS) {
+        std::size_t n = std::min(WRITE_BLOCK_RECORDS, m.vert.size() - first);
+        vertexBlock.resize(n);
+        #pragma omp parallel for
+        for (int i = 0; i < (int) n; ++i)
+            ToRecord(m, m.vert[first + i], vertexBlock[i]);
+        ok = file.write(reinterpret_cast<const char *>(vertexBlock.data()), n * sizeof(CachedVertex)) == qint64(n * sizeof(CachedVertex));
+    }
+
+    Mesh::PerFaceAttributeHandle<FF> ffadj;
+    Mesh::PerFaceAttributeHandle<TexCoordStorage> wtcs;
+    Mesh::PerFaceAttributeHandle<Color4b> color;
+    if (attributes & RECORD_ADJACENCY)
+        ffadj = Get3DFaceAdjacencyAttribute(m);
+    if (attributes & RECORD_STORAGE)
+        wtcs = GetWedgeTexCoordStorageAttribute(m);
+    if (attributes & RECORD_COLOR)
+        color = GetFaceColorAttribute(m);
+    std::vector<CachedFace> faceBlock;
+    for (std::size_t first = 0; ok && first < m.face.size(); first += WRITE_BLOCK_RECORDS) {
+        std::size_t n = std::min(WRITE_BLOCK_RECORDS, m.face.size() - first);
+        faceBlock.resize(n);
+        #pragma omp parallel for
+        for (int i = 0; i < (int) n; ++i)
+            ToRecord(m, m.face[first + i], (attributes & RECORD_ADJACENCY) ? &ffadj : nullptr, (attributes & RECORD_STORAGE) ? &wtcs : nullptr,
+                     (attributes & RECORD_COLOR) ? &color : nullptr, faceBlock[i]);
+        ok = file.write(reinterpret_cast<const char *>(faceBlock.data()), n * sizeof(CachedFace)) == qint64(n * sizeof(CachedFace));
+    }
+    return ok;
+}
+
+/* Reads vn vertex and fn face records into the empty mesh m, creating the face
+ * attributes selected by the mask. The deleted elements keep their flag and are
+ * not counted in m.VN() and m.FN(). Returns false if the records are truncated or
+ * reference elements out of range */
+static bool ReadRecords(CacheReader& reader, Mesh& m, uint64_t vn, uint64_t fn, uint64_t attributes)
+{
+    if (vn > uint64_t(std::numeric_limits<int>::max()) || fn > uint64_t(std::numeric_limits<int>::max())
+            || std::size_t(reader.end - reader.p) / sizeof(CachedVertex) < vn
+            || std::size_t(reader.end - reader.p) - vn * sizeof(CachedVertex) < fn * sizeof(CachedFace))
+        return false;
+
+    tri::Allocator<Mesh>::AddVertices(m, vn);
+    tri::Allocator<Mesh>::AddFaces(m, fn);
+
+    const CachedVertex *vertexRecords = reinterpret_cast<const CachedVertex *>(reader.p);
+    const CachedFace *faceRecords = reinterpret_cast<const CachedFace *>(reader.p + vn * sizeof(CachedVertex));
+
+    int deletedVertices = 0;
+    #pragma omp parallel for reduction(+:deletedVertices)
+    for (int i = 0; i < (int) vn; ++i) {
+        CachedVertex r;
+        std::memcpy(&r, vertexRecords + i, sizeof(r));
+        FromRecord(r, m.vert[i]);
+        if (m.vert[i].IsD())
+            deletedVertices++;
+    }
+
+    Mesh::PerFaceAttributeHandle<FF> ffadj;
+    Mesh::PerFaceAttributeHandle<TexCoordStorage> wtcs;
+    Mesh::PerFaceAttributeHandle<Color4b> color;
+    if (attributes & RECORD_ADJACENCY)
+        ffadj = Get3DFaceAdjacencyAttribute(m);
+    if (attributes & RECORD_STORAGE)
+        wtcs = GetWedgeTexCoordStorageAttribute(m);
+    if (attributes & RECORD_COLOR)
+        color = GetFaceColorAttribute(m);
+    bool validFaces = true;
+    int deletedFaces = 0;
+    #pragma omp parallel for reduction(&&:validFaces) reduction(+:deletedFaces)
+    for (int i = 0; i < (int) fn; ++i) {
+        CachedFace r;
+        std::memcpy(&r, faceRecords + i, sizeof(r));
+        validFaces = FromRecord(m, r, m.face[i], (attributes & RECORD_ADJACENCY) ? &ffadj : nullptr, (attributes & RECORD_STORAGE) ? &wtcs : nullptr,
+                                (attributes & RECORD_COLOR) ? &color : nullptr) && validFaces;
+        if (m.face[i].IsD())
+            deletedFaces++;
+    }
+
+    m.vn -= deletedVertices;
+    m.fn -= deletedFaces;
+    reader.p += vn * sizeof(CachedVertex) + fn * sizeof(CachedFace);
+    return validFaces;
+}
+
+/* Loads the input textures of a snapshot, and checks that their sizes did not
+ * change since the snapshot was written */
+static bool LoadSnapshotTextures(const std::vector<std::string>& texturePaths, const std::vector<TextureSize>& textureSizes,
+                                 TextureObjectHandle& textureObject, const std::string& path)
+{
+    textureObject = std::make_shared<TextureObject>();
+    if (!LoadTextureImages(texturePaths, textureObject))
+        return false;
+    std::vector<TextureSize> currentSizes = textureObject->GetTextureSizes();
+    bool sameSizes = currentSizes.size() == textureSizes.size();
+    for (std::size_t i = 0; sameSizes && i < textureSizes.size(); ++i)
+        sameSizes = (currentSizes[i].w == textureSizes[i].w && currentSizes[i].h == textureSizes[i].h);
+    if (!sameSizes) {
+        LOG_INFO << "The input texture sizes changed, ignoring the snapshot " << path;
+        return false;
+    }
+    return true;
+}
+
+static void ToRecord(Mesh& m, const MeshVertex& v, CachedVertex& r)
+{
+    (void) m;
+    std::memset(&r, 0, sizeof(r));
+    for (int k = 0; k < 3; ++k) {
+        r.p[k] = v.cP()[k];
+        r.n[k] = v.cN()[k];
+    }
+    r.t[0] = v.cT().U();
+    r.t[1] = v.cT().V();
+    r.tn = v.cT().N();
+    r.flags = v.cFlags();
+}
+
+static void ToRecord(Mesh& m, MeshFace& f, Mesh::PerFaceAttributeHandle<FF> *ffadj,
+                     Mesh::PerFaceAttributeHandle<TexCoordStorage> *wtcs, Mesh::PerFaceAttributeHandle<Color4b> *color, CachedFace& r)
+{
+    std::memset(&r, 0, sizeof(r));
+    for (int k = 0; k < 3; ++k) {
+        r.wt[k][0] = f.cWT(k).U();
+        r.wt[k][1] = f.cWT(k).V();
+        r.wtn[k] = f.cWT(k).N();
+        if (wtcs) {
+            r.wtStorage[k][0] = (*wtcs)[f].tc[k].U();
+            r.wtStorage[k][1] = (*wtcs)[f].tc[k].V();
+            r.wtStorageN[k] = (*wtcs)[f].tc[k].N();
+        }
+        r.n[k] = f.cN()[k];
+        r.v[k] = tri::Index(m, f.cV(k));
+        r.ffp[k] = f.cFFp(k) ? (int32_t) tri::Index(m, f.cFFp(k)) : -1;
+        r.ffi[k] = f.cFFi(k);
+        if (ffadj) {
+            r.adjFace[k] = (*ffadj)[f].f[k];
+            r.adjEdge[k] = (*ffadj)[f].e[k];
+        }
+    }
+    r.flags = f.cFlags();
+    r.id = f.id;
+    r.initialId = f.initialId;
+    if (color) {
+        for (int k = 0; k < 4; ++k)
+            r.c[k] = (*color)[f][k];
+    }
+    r.qualifier = f.IsMesh() ? 1 : (f.IsHoleFilling() ? 2 : (f.IsScaffold() ? 3 : 0));
+}
+
+static void FromRecord(const CachedVertex& r, MeshVertex& v)
+{
+    v.P() = Point3d(r.p[0], r.p[1], r.p[2]);
+    v.N() = Point3d(r.n[0], r.n[1], r.n[2]);
+    v.T().U() = r.t[0];
+    v.T().V() = r.t[1];
+    v.T().N() = r.tn;
+    v.Flags() = r.flags;
+}
+
+/* Returns false if the record references vertices or faces out of range */
+static bool FromRecord(Mesh& m, const CachedFace& r, MeshFace& f, Mesh::PerFaceAttributeHandle<FF> *ffadj,
+                       Mesh::PerFaceAttributeHandle<TexCoordStorage> *wtcs, Mesh::PerFaceAttributeHandle<Color4b> *color)
+{
+    const int vn = m.vert.size();
+    const int fn = m.face.size();
+    for (int k = 0; k < 3; ++k) {
+        if (r.v[k] < 0 || r.v[k] >= vn || r.ffp[k] >= fn || r.adjFace[k] < 0 || r.adjFace[k] >= fn)
+            return false;
+    }
+    for (int k = 0; k < 3; ++k) {
+        f.WT(k).U() = r.wt[k][0];
+        f.WT(k).V() = r.wt[k][1];
+        f.WT(k).N() = r.wtn[k];
+        if (wtcs) {
+            (*wtcs)[f].tc[k].U() = r.wtStorage[k][0];
+            (*wtcs)[f].tc[k].V() = r.wtStorage[k][1];
+            (*wtcs)[f].tc[k].N() = r.wtStorageN[k];
+        }
+        f.N()[k] = r.n[k];
+        f.V(k) = &m.vert[r.v[k]];
+        f.FFp(k) = (r.ffp[k] >= 0) ? &m.face[r.ffp[k]] : nullptr;
+        f.FFi(k) = r.ffi[k];
+        if (ffadj) {
+            (*ffadj)[f].f[k] = r.adjFace[k];
+            (*ffadj)[f].e[k] = r.adjEdge[k];
+        }
+    }
+    f.Flags() = r.flags;
+    f.id = r.id;
+    f.initialId = r.initialId;
+    if (color)
+        (*color)[f] = Color4b(r.c[0], r.c[1], r.c[2], r.c[3]);
+    if (r.qualifier == 1)
+        f.SetMesh();
+    else if (r.qualifier == 2)
+        f.SetHoleFilling();
+    else if (r.qualifier == 3)
+        f.SetScaffold();
+    return true;
+}
@@ -0,0 +1,116 @@
+/*******************************************************************************
+    Copyright (c) 2021, Andrea Maggiordomo, Paolo Cignoni and Marco Tarini
+
+    This file is part of TextureDefrag, a reference implementation for
+    the paper ``Texture Defragmentation for Photo-Reconstructed 3D Models''
+    by Andrea Maggiordomo, Paolo Cignoni and Marco Tarini.
+
+    TextureDefrag is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    TextureDefrag is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with TextureDefrag. If not, see <https://www.gnu.org/licenses/>.
+*******************************************************************************/
+
+
+#ifndef MESH_CACHE_H
+#define MESH_CACHE_H
+
+#include "mesh.h"
+#include "mesh_graph.h"
+#include "texture_object.h"
+
+#include <string>
+#include <vector>
+#include <map>
+#include <cstdint>
+
+/* Binary snapshots of the input meshes after PrepareMesh() and
+ * ComputeWedgeTexCoordStorageAttribute(), so that runs on the same input can skip
+ * the loading and the preparation of the mesh. A snapshot stores the vertices and
+ * faces with their FF topology, the 3D face adjacency and wedge texcoord storage
+ * attributes and the chart ids as flat arrays of records. Snapshots are named
+ * after a hash of the contents of the input file, and are valid only for the same
+ * format version and input texture sizes. */
+
+struct MeshCacheEntry {
+    std::string path;   // snapshot file
+    uint64_t hash = 0;  // hash of the contents of the input mesh file
+    uint64_t size = 0;  // size of the input mesh file
+};
+
+/* Hashes the mesh file and returns its snapshot entry in the cache directory,
+ * which is created if needed. Returns false if the file cannot be read or the
+ * directory cannot be created */
+bool GetMeshCacheEntry(const std::string& cacheDir, const char *fileName, MeshCacheEntry *entry);
+
+/* Loads the snapshot of the mesh file into m, and loads its input textures into a
+ * new texture object. The texture names are resolved against the directory of the
+ * mesh file. Returns false, leaving the mesh empty, if the snapshot does not exist,
+ * does not match the entry or the texture sizes changed */
+bool LoadMeshCache(const MeshCacheEntry& entry, const char *fileName, Mesh& m, TextureObjectHandle& textureObject,
+                   int *loadMask, int *vndup);
+
+/* Reads the paths of the input textures from the snapshot of the mesh file, resolved
+ * against the directory of the mesh file, without loading the mesh or the textures.
+ * Returns false if the snapshot does not exist or does not match the entry */
+bool ReadMeshCacheTextures(const MeshCacheEntry& entry, const char *fileName, std::vector<std::string>& texturePaths);
+
+/* Writes the snapshot of the prepared mesh. Returns false on failure */
+bool SaveMeshCache(const MeshCacheEntry& entry, Mesh& m, TextureObjectHandle textureObject, int loadMask, int vndup);
+
+/* Stage snapshots are the re-entry points of the pipeline after the optimization
+ * (the packing can be re-run alone, e.g. with other packing options) and after the
+ * packing (only the texture rendering and the saving are left). Besides the mesh
+ * records, a snapshot of the packing stage stores the faces of each chart, the
+ * anchor faces of the charts and the orientation of the input charts, a snapshot of
+ * the rendering stage the sizes of the output texture sheets. The input textures
+ * are referenced by their absolute paths and loaded again */
+
+enum class SnapshotStage {
+    None,
+    Packing,
+    Rendering
+};
+
+struct StageSnapshot {
+    SnapshotStage stage = SnapshotStage::None;
+    std::string inputFile;
+
+    // values of the run carried over to the report
+    int vndupIn = 0;
+    int vndupOut = 0;
+    int inputCharts = 0;
+    int outputCharts = 0;
+    double inputUVLen = 0;
+    double outputUVLen = 0;
+    double inputMP = 0;
+    double zeroResamplingFraction = 0;
+
+    // packing stage
+    GraphHandle graph;
+    std::map<RegionID, bool> flipped;
+    std::map<ChartHandle, int> anchorMap;
+
+    // rendering stage
+    std::vector<TextureSize> texszVec;
+};
+
+/* Writes the snapshot of the mesh and the state of the given stage. Returns false
+ * on failure */
+bool SaveStageSnapshot(const std::string& path, Mesh& m, TextureObjectHandle textureObject, const StageSnapshot& snapshot);
+
+/* Loads a stage snapshot into m, loads the input textures into a new texture object
+ * and, for the packing stage, rebuilds the graph of the charts on m. Returns false,
+ * leaving the mesh empty, if the snapshot cannot be read or the texture sizes
+ * changed */
+bool LoadStageSnapshot(const std::string& path, Mesh& m, TextureObjectHandle& textureObject, StageSnapshot& snapshot);
+
+#endif // MESH_CACHE_H
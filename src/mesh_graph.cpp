@@ -28,6 +28,7 @@
 #include "timer.h"
 #include "utils.h"
 #include "logging.h"
+#include "disjoint_set.h"
 
 #include <vcg/complex/complex.h>
 #include <vcg/complex/algorithms/parametrization/distortion.h>
@@ -38,8 +39,8 @@
 
 #include <vector>
 #include <unordered_set>
-#include <unordered_map>
 #include <memory>
+#include <atomic>
 
 #include <QImage>
 
@@ -47,35 +48,26 @@
 
 void CopyToMesh(FaceGroup& fg, Mesh& m)
 {
+    static thread_local std::vector<int> cornerVertex;
+    static thread_local std::vector<Mesh::VertexPointer> vertices;
+    IndexVertices(fg.fpVec, cornerVertex, vertices);
+
+    // the element vectors of m keep their capacity across calls
     m.Clear();
     auto ia = GetFaceIndexAttribute(m);
-    std::unordered_map<Mesh::VertexPointer, Mesh::VertexPointer> vpmap;
-    vpmap.reserve(fg.FN() * 3);
-    std::size_t vn = 0;
-    for (auto fptr : fg.fpVec) {
-        for (int i = 0; i < 3; ++i) {
-            if (vpmap.count(fptr->V(i)) == 0) {
-                vn++;
-                vpmap[fptr->V(i)] = nullptr;
-            }
-        }
+    tri::Allocator<Mesh>::AddVertices(m, vertices.size());
+    tri::Allocator<Mesh>::AddFaces(m, fg.FN());
+    for (std::size_t j = 0; j < vertices.size(); ++j) {
+        m.vert[j].P() = vertices[j]->P();
+        m.vert[j].T() = vertices[j]->T();
     }
-    auto mvi = tri::Allocator<Mesh>::AddVertices(m, vn);
-    auto mfi = tri::Allocator<Mesh>::AddFaces(m, fg.FN());
-    for (auto fptr : fg.fpVec) {
-        Mesh::FacePointer mfp = &*mfi++;
+    for (std::size_t i = 0; i < fg.FN(); ++i) {
+        Mesh::FacePointer fptr = fg.fpVec[i];
+        Mesh::FacePointer mfp = &m.face[i];
         ia[mfp] = tri::Index(fg.mesh, fptr);
-        for (int i = 0; i < 3; ++i) {
-            Mesh::VertexPointer vp = fptr->V(i);
-            typename Mesh::VertexPointer& mvp = vpmap[vp];
-            if (mvp == nullptr) {
-                mvp = &*mvi++;
-                mvp->P() = vp->P();
-                mvp->T() = vp->T();
-                mvp->C() = vp->C();
-            }
-            mfp->V(i) = mvp;
-            mfp->WT(i) = fptr->WT(i);
+        for (int k = 0; k < 3; ++k) {
+            mfp->V(k) = &m.vert[cornerVertex[3 * i + k]];
+            mfp->WT(k) = fptr->WT(k);
         }
         mfp->SetMesh();
     }
@@ -86,6 +78,12 @@ void CopyToMesh(FaceGroup& fg, Mesh& m)
 // FaceGroup class implementation
 // ==============================
 
+static unsigned long NextChartVersion()
+{
+    static std::atomic<unsigned long> counter{0};
+    return ++counter;
+}
+
 FaceGroup::FaceGroup(Mesh& m, const RegionID id_)
     : mesh{m},
       id{id_},
@@ -96,7 +94,10 @@ FaceGroup::FaceGroup(Mesh& m, const RegionID id_)
       maxMappedFaceValue{-1},
       error{0},
       dirty{false},
-      cache{}
+      cache{},
+      borderValid{false},
+      border{},
+      version{NextChartVersion()}
 {
 }
 
@@ -111,6 +112,9 @@ void FaceGroup::Clear()
     error = 0;
     dirty = false;
     cache = {};
+    borderValid = false;
+    border.clear();
+    version = NextChartVersion();
 }
 
 void FaceGroup::UpdateCache() const
@@ -148,6 +152,39 @@ void FaceGroup::UpdateCache() const
     dirty = false;
 }
 
+const FaceGroup::Cache& FaceGroup::GetCache() const
+{
+    if (dirty)
+        UpdateCache();
+    return cache;
+}
+
+void FaceGroup::SetCache(const Cache& c)
+{
+    cache = c;
+    dirty = false;
+    version = NextChartVersion();
+}
+
+const std::vector<HalfEdge>& FaceGroup::GetBorder() const
+{
+    if (!borderValid) {
+        border.clear();
+        for (auto fptr : fpVec)
+            for (int i = 0; i < 3; ++i)
+                if (face::IsBorder(*fptr, i))
+                    border.push_back(HalfEdge{fptr, i});
+        borderValid = true;
+    }
+    return border;
+}
+
+void FaceGroup::SetBorder(std::vector<HalfEdge>&& b)
+{
+    border = std::move(b);
+    borderValid = true;
+}
+
 vcg::Point3d FaceGroup::AverageNormal() const
 {
     if (dirty)
@@ -160,6 +197,8 @@ void FaceGroup::AddFace(const Mesh::FacePointer fptr)
 {
     fpVec.push_back(fptr);
     dirty = true;
+    borderValid = false;
+    version = NextChartVersion();
 }
 
 double FaceGroup::OriginalAreaUV() const
@@ -231,6 +270,7 @@ bool FaceGroup::UVFlipped()
 void FaceGroup::ParameterizationChanged()
 {
     dirty = true;
+    version = NextChartVersion();
 }
 
 Mesh::FacePointer FaceGroup::Fp()
@@ -254,6 +294,53 @@ void FaceGroup::UpdateBorder() const
         UpdateCache();
 }
 
+// ChartStore class implementation
+// ===============================
+
+void ChartStore::insert(const ChartHandle& c)
+{
+    ensure(c != nullptr && c->id >= 0);
+    if (c->id >= (RegionID) slot.size())
+        slot.resize(c->id + 1, -1);
+    ensure(slot[c->id] == -1);
+    slot[c->id] = (int) entries.size();
+    entries.push_back(std::make_pair(c->id, c));
+    live++;
+}
+
+bool ChartStore::erase(RegionID id)
+{
+    if (count(id) == 0)
+        return false;
+    entries[slot[id]].second = nullptr;
+    slot[id] = -1;
+    live--;
+    if (entries.size() > 2 * live)
+        Compact();
+    return true;
+}
+
+void ChartStore::clear()
+{
+    entries.clear();
+    slot.clear();
+    live = 0;
+}
+
+void ChartStore::Compact()
+{
+    std::size_t n = 0;
+    for (std::size_t i = 0; i < entries.size(); ++i) {
+        if (entries[i].second != nullptr) {
+            slot[entries[i].first] = (int) n;
+            if (i != n)
+                entries[n] = std::move(entries[i]);
+            n++;
+        }
+    }
+    entries.resize(n);
+}
+
 // MeshGraph class implementation
 // ==============================
 
@@ -284,16 +371,17 @@ std::pair<float,float> MeshGraph::DistortionRange() const
 
 std::shared_ptr<FaceGroup> MeshGraph::GetChart(RegionID i)
 {
-    //ensure(charts.find(i) != charts.end() && "Chart does not exist");
-    auto e = charts.find(i);
-    if (e != charts.end()) return e->second;
-    else return nullptr;
+    return charts.get(i);
 }
 
 std::shared_ptr<FaceGroup> MeshGraph::GetChart_Insert(RegionID i)
 {
-    if (charts.find(i) == charts.end()) charts.insert(std::make_pair(i, std::make_shared<FaceGroup>(mesh, i)));
-    return charts[i];
+    ChartHandle c = charts.get(i);
+    if (c == nullptr) {
+        c = std::make_shared<FaceGroup>(mesh, i);
+        charts.insert(c);
+    }
+    return c;
 }
 
 std::size_t MeshGraph::Count() const
@@ -352,48 +440,109 @@ double MeshGraph::BorderUV() const
 
 GraphHandle ComputeGraph(Mesh &m, TextureObjectHandle textureObject)
 {
-    // visit the connected components and assign chart ids
-    tri::UpdateFlags<Mesh>::FaceClearV(m);
-    RegionID id = 0;
-    for (auto& f : m.face) {
-        if (!f.IsV()) {
-            // visit the connected component
-            std::stack<Mesh::FacePointer> s;
-            s.push(&f);
-            while (!s.empty()) {
-                Mesh::FacePointer fp = s.top();
-                s.pop();
-                fp->SetV();
-                fp->id = id;
-                fp->initialId = id;
-                for (int i = 0; i < 3; ++i) {
-                    Mesh::FacePointer ffp = fp->FFp(i);
-                    if (!ffp->IsV())
-                        s.push(ffp);
-                }
-            }
-            id++;
+    const int fn = (int) m.face.size();
+
+    // label the connected components, the chart ids are assigned in order of
+    // the smallest face index of each component
+    ConcurrentDisjointSet components(fn);
+
+    #pragma omp parallel for schedule(static, 4096)
+    for (int i = 0; i < fn; ++i) {
+        for (int k = 0; k < 3; ++k) {
+            int j = (int) tri::Index(m, m.face[i].FFp(k));
+            if (j != i)
+                components.Unite(i, j);
         }
     }
 
+    std::vector<int> root(fn);
+    #pragma omp parallel for
+    for (int i = 0; i < fn; ++i)
+        root[i] = components.Find(i);
+
+    std::vector<RegionID> rootId(fn, INVALID_ID);
+    RegionID numCharts = 0;
+    for (int i = 0; i < fn; ++i)
+        if (root[i] == i)
+            rootId[i] = numCharts++;
+
+    std::vector<std::atomic<int>> count(numCharts);
+    #pragma omp parallel for
+    for (int c = 0; c < numCharts; ++c)
+        count[c].store(0, std::memory_order_relaxed);
+
+    #pragma omp parallel for
+    for (int i = 0; i < fn; ++i) {
+        RegionID id = rootId[root[i]];
+        m.face[i].id = id;
+        m.face[i].initialId = id;
+        count[id].fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // counting sort of the faces by chart, the faces of each chart stay in
+    // index order
+    std::vector<int> offset(numCharts + 1, 0);
+    for (int c = 0; c < numCharts; ++c)
+        offset[c + 1] = offset[c] + count[c].load(std::memory_order_relaxed);
+
+    std::vector<Mesh::FacePointer> sorted(fn);
+    {
+        std::vector<int> cursor(offset.begin(), offset.end() - 1);
+        for (int i = 0; i < fn; ++i)
+            sorted[cursor[m.face[i].id]++] = &m.face[i];
+    }
+
     GraphHandle graph = std::make_shared<MeshGraph>(m);
     graph->textureObject = textureObject;
 
+    for (RegionID c = 0; c < numCharts; ++c)
+        graph->GetChart_Insert(c);
+
     auto ffadj = Get3DFaceAdjacencyAttribute(m);
 
-    tri::UpdateTopology<Mesh>::FaceFace(m);
-    for (auto &f : m.face) {
-        RegionID regionId = f.id;
-        graph->GetChart_Insert(regionId)->AddFace(&f);
-        for (int i = 0; i < f.VN(); ++i) {
-            RegionID adjId = m.face[ffadj[f].f[i]].id;
-            if (regionId != adjId) {
-                (graph->GetChart_Insert(regionId)->adj).insert(graph->GetChart_Insert(adjId));
+    #pragma omp parallel for schedule(dynamic, 64)
+    for (int c = 0; c < numCharts; ++c) {
+        ChartHandle chart = graph->GetChart(c);
+        chart->fpVec.assign(sorted.begin() + offset[c], sorted.begin() + offset[c + 1]);
+        chart->dirty = true;
+
+        std::vector<RegionID> adjIds;
+        for (auto fptr : chart->fpVec) {
+            for (int i = 0; i < 3; ++i) {
+                RegionID adjId = m.face[ffadj[fptr].f[i]].id;
+                if (adjId != c)
+                    adjIds.push_back(adjId);
             }
         }
+        std::sort(adjIds.begin(), adjIds.end());
+        adjIds.erase(std::unique(adjIds.begin(), adjIds.end()), adjIds.end());
+        for (RegionID adjId : adjIds)
+            chart->adj.insert(graph->GetChart(adjId));
     }
 
+    ComputeFaceFaceTopology(m);
+
     return graph;
 }
 
+void ComputeChartAdjacency(MeshGraph& graph)
+{
+    Mesh& m = graph.mesh;
+    auto ffadj = Get3DFaceAdjacencyAttribute(m);
+
+    for (auto& entry : graph.charts)
+        entry.second->adj.clear();
+
+    for (auto& entry : graph.charts) {
+        ChartHandle chart = entry.second;
+        for (auto fptr : chart->fpVec) {
+            for (int i = 0; i < fptr->VN(); ++i) {
+                RegionID adjId = m.face[ffadj[fptr].f[i]].id;
+                if (adjId != chart->id && graph.charts.count(adjId))
+                    chart->adj.insert(graph.GetChart(adjId));
+            }
+        }
+    }
+}
+
 
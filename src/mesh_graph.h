@@ -27,28 +27,56 @@
 #include <unordered_map>
 #include <memory>
 #include <algorithm>
+#include <iterator>
 
 #include <QImage>
 
 #include "types.h"
 #include "mesh.h"
 #include "math_utils.h"
+#include "intersection.h"
 
 class Mesh;
 
 typedef std::pair<ChartHandle, ChartHandle> ChartPair;
 
+/* Set of the charts adjacent to a chart, stored as a vector sorted by chart id.
+ * Charts have few neighbors, so lookups and updates on the sorted vector are
+ * cheaper than on a hash set, and the iteration order is deterministic */
+class ChartAdjacency {
+
+public:
+
+    typedef std::vector<ChartHandle>::const_iterator const_iterator;
+
+    const_iterator begin() const { return adj.begin(); }
+    const_iterator end() const { return adj.end(); }
+
+    std::size_t size() const { return adj.size(); }
+    bool empty() const { return adj.empty(); }
+
+    const_iterator find(const ChartHandle& c) const;
+    std::size_t count(const ChartHandle& c) const { return find(c) != end() ? 1 : 0; }
+
+    /* Inserts the chart, returns false if it was already in the set */
+    bool insert(const ChartHandle& c);
+
+    /* Removes the chart, returns false if it was not in the set */
+    bool erase(const ChartHandle& c);
+
+    void clear() { adj.clear(); }
+
+private:
+
+    std::vector<ChartHandle> adj;
+
+    std::vector<ChartHandle>::iterator LowerBound(const ChartHandle& c);
+};
+
 /* FaceGroup class
  * Used to store a mesh chart as an array of Face pointers */
 struct FaceGroup {
 
-    struct Hasher {
-        std::size_t operator()(const ChartHandle& ch) const
-        {
-            return std::hash<RegionID>()(ch->id);
-        }
-    };
-
     struct Cache {
         double areaUV;
         double area3D;
@@ -60,10 +88,24 @@ struct FaceGroup {
 
     void UpdateCache() const;
 
+    /* Returns the cached aggregates of the chart, updating them if needed */
+    const Cache& GetCache() const;
+
+    /* Replaces the cached aggregates with values maintained incrementally by the
+     * caller (see AcceptMove() in seam_remover.cpp) */
+    void SetCache(const Cache& c);
+
+    /* Returns the border half-edges of the chart, computed from the face adjacency
+     * on first use. Merging charts only removes border edges, so AcceptMove() (see
+     * seam_remover.cpp) replaces the list of the merged chart with the half-edges
+     * of the input lists that are still on the border */
+    const std::vector<HalfEdge>& GetBorder() const;
+    void SetBorder(std::vector<HalfEdge>&& border);
+
     Mesh& mesh;
     RegionID id;
     std::vector<Mesh::FacePointer> fpVec;
-    std::unordered_set<ChartHandle, Hasher> adj;
+    ChartAdjacency adj;
 
     int numMerges;
 
@@ -75,6 +117,14 @@ struct FaceGroup {
     mutable bool dirty;
     mutable Cache cache;
 
+    mutable bool borderValid;
+    mutable std::vector<HalfEdge> border;
+
+    /* Version of the chart parameterization, it changes (to a value never used by
+     * any chart) whenever faces are added or the parameterization is changed, so
+     * that values derived from the tex coords can be cached (see ClusteredSeam) */
+    unsigned long version;
+
     FaceGroup(Mesh& m, const RegionID id_);
 
     void Clear();
@@ -99,6 +149,107 @@ struct FaceGroup {
     void UpdateBorder() const;
 };
 
+inline std::vector<ChartHandle>::iterator ChartAdjacency::LowerBound(const ChartHandle& c)
+{
+    return std::lower_bound(adj.begin(), adj.end(), c, [] (const ChartHandle& c1, const ChartHandle& c2) {
+        return c1->id < c2->id;
+    });
+}
+
+inline ChartAdjacency::const_iterator ChartAdjacency::find(const ChartHandle& c) const
+{
+    auto it = const_cast<ChartAdjacency *>(this)->LowerBound(c);
+    return (it != adj.end() && *it == c) ? const_iterator(it) : end();
+}
+
+inline bool ChartAdjacency::insert(const ChartHandle& c)
+{
+    auto it = LowerBound(c);
+    if (it != adj.end() && *it == c)
+        return false;
+    adj.insert(it, c);
+    return true;
+}
+
+inline bool ChartAdjacency::erase(const ChartHandle& c)
+{
+    auto it = LowerBound(c);
+    if (it == adj.end() || *it != c)
+        return false;
+    adj.erase(it);
+    return true;
+}
+
+/* Dense storage of the charts of the graph. The charts are stored contiguously
+ * with their id in insertion order, and each id maps to its slot in constant
+ * time. Erasing a chart leaves a tombstone (skipped by the iterators) that is
+ * reclaimed when the tombstones outnumber the live charts, so erasing a chart
+ * invalidates the iterators */
+class ChartStore {
+
+public:
+
+    typedef std::pair<RegionID, ChartHandle> Entry;
+
+    class const_iterator {
+    public:
+        typedef std::forward_iterator_tag iterator_category;
+        typedef Entry value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef const Entry *pointer;
+        typedef const Entry& reference;
+
+        const_iterator(const Entry *p_, const Entry *end_) : p{p_}, pend{end_} { Skip(); }
+
+        reference operator*() const { return *p; }
+        pointer operator->() const { return p; }
+        const_iterator& operator++() { ++p; Skip(); return *this; }
+        const_iterator operator++(int) { const_iterator it = *this; ++(*this); return it; }
+        bool operator==(const const_iterator& other) const { return p == other.p; }
+        bool operator!=(const const_iterator& other) const { return p != other.p; }
+
+    private:
+        const Entry *p;
+        const Entry *pend;
+
+        void Skip() { while (p != pend && p->second == nullptr) ++p; }
+    };
+
+    ChartStore() : live{0} {}
+
+    const_iterator begin() const { return const_iterator(entries.data(), entries.data() + entries.size()); }
+    const_iterator end() const { return const_iterator(entries.data() + entries.size(), entries.data() + entries.size()); }
+
+    std::size_t size() const { return live; }
+    bool empty() const { return live == 0; }
+
+    /* Returns the chart with the given id, or nullptr if there is no such chart */
+    ChartHandle get(RegionID id) const
+    {
+        if (id < 0 || id >= (RegionID) slot.size() || slot[id] < 0)
+            return nullptr;
+        return entries[slot[id]].second;
+    }
+
+    std::size_t count(RegionID id) const { return get(id) != nullptr ? 1 : 0; }
+
+    /* Inserts the chart, ensures that its id is not already in the store */
+    void insert(const ChartHandle& c);
+
+    /* Removes the chart with the given id, returns false if there is no such chart */
+    bool erase(RegionID id);
+
+    void clear();
+
+private:
+
+    std::vector<Entry> entries;
+    std::vector<int> slot; // indexed by id, -1 if the id is not in the store
+    std::size_t live;
+
+    void Compact();
+};
+
 /* Constructs a mesh from a FaceGroup, the created mesh has the FaceIndex
  * attribute defined (see mesh_attribute.h) */
 void CopyToMesh(FaceGroup& fg, Mesh& m);
@@ -107,17 +258,22 @@ void CopyToMesh(FaceGroup& fg, Mesh& m);
  * to determine chart adjacency relations */
 GraphHandle ComputeGraph(Mesh &m, TextureObjectHandle textureObject);
 
+/* Recomputes the adjacency of the charts of the graph from the chart ids of the
+ * faces and the 3D face adjacency attribute. Faces adjacent to charts that are
+ * not in the graph are ignored */
+void ComputeChartAdjacency(MeshGraph& graph);
+
 /*
  * MeshGraph class
  *
- * The graph is actually stored as an associative array mapping each Region id to the relative FaceGroup, the adjacencies
+ * The graph is stored as a dense array of FaceGroup objects indexed by Region id (see ChartStore), the adjacencies
  * are recorded inside each FaceGroup
  */
 struct MeshGraph {
 
     Mesh& mesh;
 
-    std::unordered_map<RegionID, ChartHandle> charts;
+    ChartStore charts;
     TextureObjectHandle textureObject;
 
     MeshGraph(Mesh& m);
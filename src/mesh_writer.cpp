@@ -0,0 +1,737 @@
+/*******************************************************************************
+    Copyright (c) 2021, Andrea Maggiordomo, Paolo Cignoni and Marco Tarini
+
+    This file is part of TextureDefrag, a reference implementation for
+    the paper ``Texture Defragmentation for Photo-Reconstructed 3D Models''
+    by Andrea Maggiordomo, Paolo Cignoni and Marco Tarini.
+
+    TextureDefrag is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    TextureDefrag is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with TextureDefrag. If not, see <https://www.gnu.org/licenses/>.
+*******************************************************************************/
+
+
+
+#include "mesh_writer.h"
+#include "mesh.h"
+#include "mesh_attribute.h"
+#include "float_format.h"
+#include "utils.h"
+#include "logging.h"
+#include "async_io.h"
+
+#include <vector>
+#include <string>
+#include <unordered_map>
+#include <algorithm>
+#include <cstring>
+#include <cstdio>
+#include <cstdint>
+#include <cctype>
+#include <cmath>
+
+#include <omp.h>
+
+#include <QFile>
+#include <QFileInfo>
+#include <QDir>
+#include <QString>
+
+
+/* number of vertices or faces formatted by a single task */
+static const int BLOCK_ITEMS = 1 << 14;
+
+/* number of blocks formatted before the buffers are written, per thread */
+static const int BLOCKS_PER_THREAD = 4;
+
+struct TexCoordKey {
+    double u;
+    double v;
+
+    bool operator==(const TexCoordKey& other) const { return u == other.u && v == other.v; }
+};
+
+struct TexCoordKeyHash {
+    std::size_t operator()(const TexCoordKey& k) const
+    {
+        // +0.0 turns -0.0 into 0.0, since the two compare equal
+        uint64_t a, b;
+        double u = k.u + 0.0;
+        double v = k.v + 0.0;
+        std::memcpy(&a, &u, sizeof(a));
+        std::memcpy(&b, &v, sizeof(b));
+        uint64_t h = (a ^ (b * 0x9e3779b97f4a7c15ULL)) * 0xff51afd7ed558ccdULL;
+        return std::size_t(h ^ (h >> 32));
+    }
+};
+
+/* Faces are assigned to a material in order of first use, and each wedge to a
+ * texture coordinate index in order of first use (as in the vcg exporter, the
+ * texture index of the wedge is not part of the key) */
+struct OBJFaceData {
+    std::vector<int> material;    // per face, -1 if the face is deleted
+    std::vector<int> texCoord;    // per wedge, 1-based index of the vt line
+    std::vector<unsigned char> emit; // per face, bit 0 if the material changes, bit k+1 if wedge k starts a vt line
+    std::vector<uint32_t> materialColor;
+    std::vector<int> materialTexture;
+    int numTexCoords;
+};
+
+/* A vertex of the glTF mesh, split at the wedges with distinct texture coordinates */
+struct GLBVertexKey {
+    int vi;
+    TexCoordKey t;
+
+    bool operator==(const GLBVertexKey& other) const { return vi == other.vi && t == other.t; }
+};
+
+struct GLBVertexKeyHash {
+    std::size_t operator()(const GLBVertexKey& k) const
+    {
+        return TexCoordKeyHash()(k.t) ^ (std::size_t(k.vi) * 0x9e3779b97f4a7c15ULL);
+    }
+};
+
+struct GLBImage {
+    std::string path;
+    std::string mimeType;
+    qint64 size;
+};
+
+static const uint32_t GLB_MAGIC = 0x46546c67;      // "glTF"
+static const uint32_t GLB_CHUNK_JSON = 0x4e4f534a; // "JSON"
+static const uint32_t GLB_CHUNK_BIN = 0x004e4942;  // "BIN\0"
+
+static void ComputeOBJFaceData(Mesh& m, bool color, OBJFaceData& data);
+static bool WriteMaterialLibrary(const std::string& fileName, Mesh& m, const OBJFaceData& data, bool color);
+template <typename FormatBlock>
+static bool WriteBlocks(AsyncFileWriter& file, int numItems, FormatBlock format);
+static std::vector<int> ComputeVertexIndices(Mesh& m);
+static inline void AppendDouble(std::string& buf, double x);
+static inline void AppendInt(std::string& buf, int x);
+template <typename T>
+static inline void AppendBinary(std::string& buf, const T& x);
+static std::string ImageMimeType(const std::string& fileName);
+static std::string EncodeURI(const std::string& s);
+static bool WritePadding(AsyncFileWriter& file, qint64 size, char c);
+static bool CopyFile(AsyncFileWriter& file, const std::string& path, qint64 size);
+
+
+bool WriteOBJ(const char *fileName, Mesh& m, bool color)
+{
+    ensure(HasPerWedgeTexCoord(m));
+
+    AsyncFileWriter file;
+    if (!file.Open(fileName)) {
+        LOG_ERR << "Error: Unable to open " << fileName << " for writing";
+        return false;
+    }
+
+    std::string shortName(fileName);
+    shortName = shortName.substr(shortName.find_last_of('/') + 1);
+
+    std::vector<int> vertexIndex = ComputeVertexIndices(m);
+
+    OBJFaceData data;
+    ComputeOBJFaceData(m, color, data);
+
+    char header[1024];
+    std::snprintf(header, sizeof(header),
+                  "####\n#\n# OBJ File Generated by Meshlab\n#\n####\n"
+                  "# Object %s\n#\n# Vertices: %d\n# Faces: %d\n#\n####\n"
+                  "mtllib ./%s.mtl\n\n", shortName.c_str(), m.vn, m.fn, shortName.c_str());
+    bool ok = file.Write(header, std::strlen(header));
+
+    ok = ok && WriteBlocks(file, (int) m.vert.size(), [&m](std::string& buf, int first, int last) {
+        for (int i = first; i < last; ++i) {
+            const MeshVertex& v = m.vert[i];
+            if (v.IsD())
+                continue;
+            buf.append("v ");
+            AppendDouble(buf, v.cP()[0]);
+            buf.push_back(' ');
+            AppendDouble(buf, v.cP()[1]);
+            buf.push_back(' ');
+            AppendDouble(buf, v.cP()[2]);
+            buf.push_back('\n');
+        }
+    });
+
+    std::snprintf(header, sizeof(header), "# %d vertices, 0 vertices normals\n\n", m.vn);
+    ok = ok && file.Write(header, std::strlen(header));
+
+    ok = ok && WriteBlocks(file, (int) m.face.size(), [&m, &data, &vertexIndex](std::string& buf, int first, int last) {
+        for (int i = first; i < last; ++i) {
+            const MeshFace& f = m.face[i];
+            if (f.IsD())
+                continue;
+            if (data.emit[i] & 1) {
+                buf.append("\nusemtl material_");
+                AppendInt(buf, data.material[i]);
+                buf.push_back('\n');
+            }
+            for (int k = 0; k < 3; ++k) {
+                if (data.emit[i] & (2 << k)) {
+                    buf.append("vt ");
+                    AppendDouble(buf, f.cWT(k).U());
+                    buf.push_back(' ');
+                    AppendDouble(buf, f.cWT(k).V());
+                    buf.push_back('\n');
+                }
+            }
+            buf.append("f ");
+            for (int k = 0; k < 3; ++k) {
+                if (k > 0)
+                    buf.push_back(' ');
+                AppendInt(buf, vertexIndex[tri::Index(m, f.cV(k))] + 1);
+                buf.push_back('/');
+                AppendInt(buf, data.texCoord[3 * i + k]);
+            }
+            buf.push_back('\n');
+        }
+    });
+
+    std::snprintf(header, sizeof(header), "# %d faces, %d coords texture\n\n# End of File\n", m.fn, data.numTexCoords);
+    ok = ok && file.Write(header, std::strlen(header));
+
+    ok = file.Close() && ok;
+    if (!ok) {
+        LOG_ERR << "Error: Failed to write " << fileName;
+        return false;
+    }
+
+    return WriteMaterialLibrary(std::string(fileName) + ".mtl", m, data, color);
+}
+
+bool WritePLY(const char *fileName, Mesh& m, bool color)
+{
+    ensure(HasPerWedgeTexCoord(m));
+
+    AsyncFileWriter file;
+    if (!file.Open(fileName)) {
+        LOG_ERR << "Error: Unable to open " << fileName << " for writing";
+        return false;
+    }
+
+    std::vector<int> vertexIndex = ComputeVertexIndices(m);
+
+    bool saveTexIndex = m.textures.size() > 1;
+
+    std::string header = "ply\nformat binary_little_endian 1.0\ncomment VCGLIB generated\n";
+    for (const std::string& textureName : m.textures)
+        header.append("comment TextureFile ").append(textureName).append("\n");
+    header.append("element vertex ").append(std::to_string(m.vn)).append("\n");
+    header.append("property double x\nproperty double y\nproperty double z\n");
+    header.append("element face ").append(std::to_string(m.fn)).append("\n");
+    header.append("property list uchar int vertex_indices\n");
+    header.append("property list uchar float texcoord\n");
+    if (saveTexIndex)
+        header.append("property int texnumber\n");
+    if (color)
+        header.append("property uchar red\nproperty uchar green\nproperty uchar blue\nproperty uchar alpha\n"
+                      "property float quality\n");
+    header.append("end_header\n");
+
+    bool ok = file.Write(header.data(), header.size());
+
+    ok = ok && WriteBlocks(file, (int) m.vert.size(), [&m](std::string& buf, int first, int last) {
+        for (int i = first; i < last; ++i) {
+            const MeshVertex& v = m.vert[i];
+            if (v.IsD())
+                continue;
+            double p[3] = { v.cP()[0], v.cP()[1], v.cP()[2] };
+            AppendBinary(buf, p);
+        }
+    });
+
+    // the faces without a color attribute are white, the quality is not stored
+    Mesh::PerFaceAttributeHandle<Color4b> faceColor;
+    bool hasFaceColor = color && HasFaceColorAttribute(m);
+    if (hasFaceColor)
+        faceColor = GetFaceColorAttribute(m);
+
+    ok = ok && WriteBlocks(file, (int) m.face.size(), [&m, &vertexIndex, &faceColor, saveTexIndex, color, hasFaceColor](std::string& buf, int first, int last) {
+        for (int i = first; i < last; ++i) {
+            const MeshFace& f = m.face[i];
+            if (f.IsD())
+                continue;
+            int32_t vi[3];
+            float t[6];
+            for (int k = 0; k < 3; ++k) {
+                vi[k] = vertexIndex[tri::Index(m, f.cV(k))];
+                t[2*k] = (float) f.cWT(k).U();
+                t[2*k+1] = (float) f.cWT(k).V();
+            }
+            buf.push_back(char(3));
+            AppendBinary(buf, vi);
+            buf.push_back(char(6));
+            AppendBinary(buf, t);
+            if (saveTexIndex)
+                AppendBinary(buf, int32_t(f.cWT(0).N()));
+            if (color) {
+                AppendBinary(buf, hasFaceColor ? faceColor[f] : Color4b(Color4b::White));
+                AppendBinary(buf, 0.0f);
+            }
+        }
+    });
+
+    ok = file.Close() && ok;
+    if (!ok) {
+        LOG_ERR << "Error: Failed to write " << fileName;
+        return false;
+    }
+
+    return true;
+}
+
+bool WriteGLB(const char *fileName, Mesh& m, bool embedTextures)
+{
+    ensure(HasPerWedgeTexCoord(m));
+
+    const int numTextures = (int) m.textures.size();
+
+    // one primitive per texture, the last one collects the faces without a texture
+    std::vector<std::vector<int>> primitiveFaces(numTextures + 1);
+    for (unsigned i = 0; i < m.face.size(); ++i) {
+        if (m.face[i].IsD())
+            continue;
+        int ti = m.face[i].cWT(0).N();
+        primitiveFaces[(ti >= 0 && ti < numTextures) ? ti : numTextures].push_back(i);
+    }
+
+    std::vector<GLBVertexKey> vertices;
+    std::vector<uint32_t> indices;
+    indices.reserve(3 * m.fn);
+    {
+        std::unordered_map<GLBVertexKey, uint32_t, GLBVertexKeyHash> vertexIndex;
+        vertexIndex.reserve(2 * m.vn);
+        for (const std::vector<int>& faces : primitiveFaces) {
+            for (int fi : faces) {
+                const MeshFace& f = m.face[fi];
+                for (int k = 0; k < 3; ++k) {
+                    GLBVertexKey key = { (int) tri::Index(m, f.cV(k)), { f.cWT(k).U(), f.cWT(k).V() } };
+                    auto it = vertexIndex.insert(std::make_pair(key, (uint32_t) vertices.size()));
+                    if (it.second)
+                        vertices.push_back(key);
+                    indices.push_back(it.first->second);
+                }
+            }
+        }
+    }
+
+    const int nv = (int) vertices.size();
+
+    // the texture coordinates are quantized to normalized unsigned shorts if they
+    // are all in the unit square, and the v axis is flipped (glTF images have the
+    // origin at the top left corner)
+    bool quantizeTexCoords = true;
+    for (int i = 0; i < nv && quantizeTexCoords; ++i)
+        quantizeTexCoords = (vertices[i].t.u >= 0 && vertices[i].t.u <= 1 && vertices[i].t.v >= 0 && vertices[i].t.v <= 1);
+
+    std::vector<float> positions(3 * nv);
+    std::vector<uint16_t> texCoordsQ(quantizeTexCoords ? 2 * nv : 0);
+    std::vector<float> texCoordsF(quantizeTexCoords ? 0 : 2 * nv);
+
+    #pragma omp parallel for
+    for (int i = 0; i < nv; ++i) {
+        const MeshVertex& v = m.vert[vertices[i].vi];
+        for (int j = 0; j < 3; ++j)
+            positions[3*i+j] = (float) v.cP()[j];
+        if (quantizeTexCoords) {
+            texCoordsQ[2*i] = (uint16_t) std::lround(vertices[i].t.u * 65535.0);
+            texCoordsQ[2*i+1] = (uint16_t) std::lround((1.0 - vertices[i].t.v) * 65535.0);
+        } else {
+            texCoordsF[2*i] = (float) vertices[i].t.u;
+            texCoordsF[2*i+1] = (float) (1.0 - vertices[i].t.v);
+        }
+    }
+
+    float pmin[3] = { 0, 0, 0 };
+    float pmax[3] = { 0, 0, 0 };
+    for (int i = 0; i < nv; ++i) {
+        for (int j = 0; j < 3; ++j) {
+            pmin[j] = (i == 0) ? positions[3*i+j] : std::min(pmin[j], positions[3*i+j]);
+            pmax[j] = (i == 0) ? positions[3*i+j] : std::max(pmax[j], positions[3*i+j]);
+        }
+    }
+
+    QDir baseDir = QFileInfo(fileName).absoluteDir();
+    std::vector<GLBImage> images(numTextures);
+    for (int i = 0; i < numTextures; ++i) {
+        images[i].path = baseDir.absoluteFilePath(QString::fromStdString(m.textures[i])).toStdString();
+        images[i].mimeType = ImageMimeType(m.textures[i]);
+        images[i].size = 0;
+        if (images[i].mimeType.empty())
+            LOG_WARN << "Texture " << m.textures[i] << " is not a png or jpeg image, glTF viewers are not required to support it";
+        if (embedTextures && !images[i].mimeType.empty()) {
+            QFileInfo imageInfo(images[i].path.c_str());
+            if (!imageInfo.exists()) {
+                LOG_ERR << "Error: Unable to embed texture " << images[i].path << " in " << fileName;
+                return false;
+            }
+            images[i].size = imageInfo.size();
+        }
+    }
+
+    // binary buffer layout: indices, positions, texture coordinates, embedded images (4-byte aligned)
+    const uint64_t indicesSize = indices.size() * sizeof(uint32_t);
+    const uint64_t positionsSize = positions.size() * sizeof(float);
+    const uint64_t texCoordsSize = quantizeTexCoords ? texCoordsQ.size() * sizeof(uint16_t) : texCoordsF.size() * sizeof(float);
+
+    std::string views;
+    auto AppendView = [&views](uint64_t offset, uint64_t length, int target) {
+        if (!views.empty())
+            views.push_back(',');
+        views.append("{\"buffer\":0,\"byteOffset\":").append(std::to_string(offset));
+        views.append(",\"byteLength\":").append(std::to_string(length));
+        if (target)
+            views.append(",\"target\":").append(std::to_string(target));
+        views.push_back('}');
+    };
+    AppendView(0, indicesSize, 34963);
+    AppendView(indicesSize, positionsSize, 34962);
+    AppendView(indicesSize + positionsSize, texCoordsSize, 34962);
+
+    uint64_t binSize = indicesSize + positionsSize + texCoordsSize;
+    std::vector<int> imageView(numTextures, -1);
+    int numViews = 3;
+    for (int i = 0; i < numTextures; ++i) {
+        if (images[i].size > 0) {
+            imageView[i] = numViews++;
+            AppendView(binSize, images[i].size, 0);
+            binSize += (images[i].size + 3) & ~qint64(3);
+        }
+    }
+
+    std::string json = "{\"asset\":{\"version\":\"2.0\",\"generator\":\"TextureDefrag\"},"
+                       "\"scene\":0,\"scenes\":[{\"nodes\":[0]}],\"nodes\":[{\"mesh\":0}],";
+
+    // accessors 0 and 1 are the vertex attributes, the index accessors follow
+    json.append("\"accessors\":[{\"bufferView\":1,\"componentType\":5126,\"type\":\"VEC3\",\"count\":").append(std::to_string(nv));
+    json.append(",\"min\":[");
+    for (int j = 0; j < 3; ++j) {
+        if (j > 0)
+            json.push_back(',');
+        AppendDouble(json, pmin[j]);
+    }
+    json.append("],\"max\":[");
+    for (int j = 0; j < 3; ++j) {
+        if (j > 0)
+            json.push_back(',');
+        AppendDouble(json, pmax[j]);
+    }
+    json.append("]},{\"bufferView\":2,\"type\":\"VEC2\",\"count\":").append(std::to_string(nv));
+    json.append(quantizeTexCoords ? ",\"componentType\":5123,\"normalized\":true}" : ",\"componentType\":5126}");
+
+    std::string primitives;
+    uint64_t indexOffset = 0;
+    int accessor = 2;
+    for (int p = 0; p <= numTextures; ++p) {
+        if (primitiveFaces[p].empty())
+            continue;
+        uint64_t count = 3 * primitiveFaces[p].size();
+        json.append(",{\"bufferView\":0,\"byteOffset\":").append(std::to_string(indexOffset));
+        json.append(",\"componentType\":5125,\"type\":\"SCALAR\",\"count\":").append(std::to_string(count)).append("}");
+        indexOffset += count * sizeof(uint32_t);
+
+        if (!primitives.empty())
+            primitives.push_back(',');
+        primitives.append("{\"attributes\":{\"POSITION\":0,\"TEXCOORD_0\":1},\"indices\":").append(std::to_string(accessor++));
+        if (p < numTextures)
+            primitives.append(",\"material\":").append(std::to_string(p));
+        primitives.push_back('}');
+    }
+    json.append("],\"meshes\":[{\"primitives\":[").append(primitives).append("]}]");
+
+    if (numTextures > 0) {
+        std::string materials, textures, imageList;
+        for (int i = 0; i < numTextures; ++i) {
+            if (i > 0) {
+                materials.push_back(',');
+                textures.push_back(',');
+                imageList.push_back(',');
+            }
+            materials.append("{\"pbrMetallicRoughness\":{\"baseColorTexture\":{\"index\":").append(std::to_string(i));
+            materials.append("},\"metallicFactor\":0,\"roughnessFactor\":1}}");
+            textures.append("{\"sampler\":0,\"source\":").append(std::to_string(i)).append("}");
+            if (imageView[i] >= 0)
+                imageList.append("{\"bufferView\":").append(std::to_string(imageView[i])).append(",\"mimeType\":\"").append(images[i].mimeType).append("\"}");
+            else
+                imageList.append("{\"uri\":\"").append(EncodeURI(m.textures[i])).append("\"}");
+        }
+        json.append(",\"materials\":[").append(materials).append("]");
+        json.append(",\"textures\":[").append(textures).append("]");
+        json.append(",\"images\":[").append(imageList).append("]");
+        // the charts are packed next to each other, the sheets must not wrap
+        json.append(",\"samplers\":[{\"magFilter\":9729,\"minFilter\":9987,\"wrapS\":33071,\"wrapT\":33071}]");
+    }
+
+    json.append(",\"bufferViews\":[").append(views).append("]");
+    json.append(",\"buffers\":[{\"byteLength\":").append(std::to_string(binSize)).append("}]}");
+
+    const uint64_t jsonChunkSize = (json.size() + 3) & ~uint64_t(3);
+    const uint64_t totalSize = 12 + 8 + jsonChunkSize + 8 + binSize;
+    if (totalSize > 0xffffffffULL) {
+        LOG_ERR << "Error: " << fileName << " would exceed the 4GB limit of glb files";
+        return false;
+    }
+
+    AsyncFileWriter file;
+    if (!file.Open(fileName)) {
+        LOG_ERR << "Error: Unable to open " << fileName << " for writing";
+        return false;
+    }
+
+    std::string header;
+    AppendBinary(header, GLB_MAGIC);
+    AppendBinary(header, uint32_t(2));
+    AppendBinary(header, uint32_t(totalSize));
+    AppendBinary(header, uint32_t(jsonChunkSize));
+    AppendBinary(header, GLB_CHUNK_JSON);
+    bool ok = file.Write(header.data(), header.size())
+            && file.Write(json.data(), json.size())
+            && WritePadding(file, jsonChunkSize - json.size(), ' ');
+
+    header.clear();
+    AppendBinary(header, uint32_t(binSize));
+    AppendBinary(header, GLB_CHUNK_BIN);
+    ok = ok && file.Write(header.data(), header.size())
+            && file.Write(reinterpret_cast<const char *>(indices.data()), indicesSize)
+            && file.Write(reinterpret_cast<const char *>(positions.data()), positionsSize)
+            && file.Write(quantizeTexCoords ? reinterpret_cast<const char *>(texCoordsQ.data()) : reinterpret_cast<const char *>(texCoordsF.data()), texCoordsSize);
+
+    for (int i = 0; ok && i < numTextures; ++i) {
+        if (imageView[i] >= 0)
+            ok = CopyFile(file, images[i].path, images[i].size) && WritePadding(file, ((images[i].size + 3) & ~qint64(3)) - images[i].size, '\0');
+    }
+
+    ok = file.Close() && ok;
+    if (!ok) {
+        LOG_ERR << "Error: Failed to write " << fileName;
+        return false;
+    }
+
+    return true;
+}
+
+
+// -- static functions ---------------------------------------------------------
+
+static void ComputeOBJFaceData(Mesh& m, bool color, OBJFaceData& data)
+{
+    // textures with the same name share the material, as in the vcg exporter
+    std::vector<int> textureKey(m.textures.size());
+    for (unsigned i = 0; i < m.textures.size(); ++i)
+        textureKey[i] = std::find(m.textures.begin(), m.textures.end(), m.textures[i]) - m.textures.begin();
+
+    data.material.assign(m.face.size(), -1);
+    data.texCoord.assign(3 * m.face.size(), 0);
+    data.emit.assign(m.face.size(), 0);
+    data.materialColor.clear();
+    data.materialTexture.clear();
+    data.numTexCoords = 0;
+
+    std::unordered_map<uint64_t, int> materialIndex;
+    std::unordered_map<TexCoordKey, int, TexCoordKeyHash> texCoordIndex;
+    texCoordIndex.reserve(m.face.size() * 2);
+
+    Mesh::PerFaceAttributeHandle<Color4b> faceColor;
+    bool hasFaceColor = color && HasFaceColorAttribute(m);
+    if (hasFaceColor)
+        faceColor = GetFaceColorAttribute(m);
+
+    int currentMaterial = -1;
+    for (unsigned i = 0; i < m.face.size(); ++i) {
+        const MeshFace& f = m.face[i];
+        if (f.IsD())
+            continue;
+
+        int ti = f.cWT(0).N();
+        int tex = (ti >= 0 && ti < (int) textureKey.size()) ? textureKey[ti] : -1;
+        uint32_t c = 0xffffffff;
+        if (hasFaceColor)
+            std::memcpy(&c, &faceColor[f][0], sizeof(c));
+        uint64_t key = (uint64_t(c) << 32) | uint32_t(tex);
+        auto mi = materialIndex.insert(std::make_pair(key, (int) data.materialColor.size()));
+        if (mi.second) {
+            data.materialColor.push_back(c);
+            data.materialTexture.push_back(tex);
+        }
+        data.material[i] = mi.first->second;
+        if (data.material[i] != currentMaterial) {
+            data.emit[i] |= 1;
+            currentMaterial = data.material[i];
+        }
+
+        for (int k = 0; k < 3; ++k) {
+            TexCoordKey tk = { f.cWT(k).U(), f.cWT(k).V() };
+            auto it = texCoordIndex.insert(std::make_pair(tk, data.numTexCoords + 1));
+            if (it.second) {
+                data.numTexCoords++;
+                data.emit[i] |= (2 << k);
+            }
+            data.texCoord[3 * i + k] = it.first->second;
+        }
+    }
+}
+
+static bool WriteMaterialLibrary(const std::string& fileName, Mesh& m, const OBJFaceData& data, bool color)
+{
+    if (data.materialColor.empty())
+        return true;
+
+    std::FILE *fp = std::fopen(fileName.c_str(), "w");
+    if (fp == nullptr) {
+        LOG_ERR << "Error: Unable to open " << fileName << " for writing";
+        return false;
+    }
+
+    std::fprintf(fp, "#\n# Wavefront material file\n# Converted by Meshlab Group\n#\n\n");
+    for (unsigned i = 0; i < data.materialColor.size(); ++i) {
+        unsigned char c[4] = { 255, 255, 255, 255 };
+        if (color)
+            std::memcpy(c, &data.materialColor[i], sizeof(c));
+        std::fprintf(fp, "newmtl material_%u\n", i);
+        std::fprintf(fp, "Ka %f %f %f\n", 0.2f, 0.2f, 0.2f);
+        std::fprintf(fp, "Kd %f %f %f\n", c[0] / 255.0f, c[1] / 255.0f, c[2] / 255.0f);
+        std::fprintf(fp, "Ks %f %f %f\n", 1.0f, 1.0f, 1.0f);
+        std::fprintf(fp, "Tr %f\n", c[3] / 255.0f);
+        std::fprintf(fp, "illum %d\n", 2);
+        std::fprintf(fp, "Ns %f\n", 0.0f);
+        if (data.materialTexture[i] >= 0 && m.textures[data.materialTexture[i]].size() > 0)
+            std::fprintf(fp, "map_Kd %s\n", m.textures[data.materialTexture[i]].c_str());
+        std::fprintf(fp, "\n");
+    }
+
+    bool ok = !std::ferror(fp);
+    ok = (std::fclose(fp) == 0) && ok;
+    if (!ok)
+        LOG_ERR << "Error: Failed to write " << fileName;
+    return ok;
+}
+
+/* Formats the items in blocks of BLOCK_ITEMS, several blocks at a time in parallel,
+ * and writes the buffers in order. The buffers are reused across rounds so that
+ * after the first round no allocation takes place; with the asynchronous I/O the
+ * writes of a round overlap the formatting of the next one */
+template <typename FormatBlock>
+static bool WriteBlocks(AsyncFileWriter& file, int numItems, FormatBlock format)
+{
+    int numBlocks = (numItems + BLOCK_ITEMS - 1) / BLOCK_ITEMS;
+    int blocksPerRound = std::max(1, omp_get_max_threads() * BLOCKS_PER_THREAD);
+    std::vector<std::string> buffers(std::min(numBlocks, blocksPerRound));
+
+    for (int firstBlock = 0; firstBlock < numBlocks; firstBlock += blocksPerRound) {
+        int n = std::min(blocksPerRound, numBlocks - firstBlock);
+        #pragma omp parallel for schedule(dynamic, 1)
+        for (int b = 0; b < n; ++b) {
+            int first = (firstBlock + b) * BLOCK_ITEMS;
+            buffers[b].clear();
+            format(buffers[b], first, std::min(numItems, first + BLOCK_ITEMS));
+        }
+        for (int b = 0; b < n; ++b) {
+            if (!file.Write(buffers[b].data(), buffers[b].size()))
+                return false;
+        }
+    }
+    return true;
+}
+
+static std::vector<int> ComputeVertexIndices(Mesh& m)
+{
+    std::vector<int> vertexIndex(m.vert.size(), -1);
+    int n = 0;
+    for (unsigned i = 0; i < m.vert.size(); ++i)
+        if (!m.vert[i].IsD())
+            vertexIndex[i] = n++;
+    ensure(n == m.vn);
+    return vertexIndex;
+}
+
+static inline void AppendDouble(std::string& buf, double x)
+{
+    char s[FORMAT_DOUBLE_BUFFER_SIZE];
+    buf.append(s, FormatDouble(x, s));
+}
+
+static inline void AppendInt(std::string& buf, int x)
+{
+    char s[16];
+    char *p = s + sizeof(s);
+    unsigned u = (x < 0) ? 0u - unsigned(x) : unsigned(x);
+    do {
+        *--p = char('0' + u % 10);
+        u /= 10;
+    } while (u > 0);
+    if (x < 0)
+        *--p = '-';
+    buf.append(p, s + sizeof(s) - p);
+}
+
+template <typename T>
+static inline void AppendBinary(std::string& buf, const T& x)
+{
+    buf.append(reinterpret_cast<const char *>(&x), sizeof(T));
+}
+
+/* Returns the mime type of the image formats supported by glTF, or an empty string */
+static std::string ImageMimeType(const std::string& fileName)
+{
+    QString suffix = QFileInfo(fileName.c_str()).suffix().toLower();
+    if (suffix == "png")
+        return "image/png";
+    else if (suffix == "jpg" || suffix == "jpeg")
+        return "image/jpeg";
+    else
+        return "";
+}
+
+/* Percent-encodes the characters of a relative uri reference that are not unreserved */
+static std::string EncodeURI(const std::string& s)
+{
+    static const char *hex = "0123456789ABCDEF";
+    std::string uri;
+    for (unsigned char c : s) {
+        if (std::isalnum(c) || c == '-' || c == '_' || c == '.' || c == '~' || c == '/') {
+            uri.push_back(char(c));
+        } else {
+            uri.push_back('%');
+            uri.push_back(hex[c >> 4]);
+            uri.push_back(hex[c & 15]);
+        }
+    }
+    return uri;
+}
+
+static bool WritePadding(AsyncFileWriter& file, qint64 size, char c)
+{
+    char padding[4] = { c, c, c, c };
+    return size == 0 || file.Write(padding, size);
+}
+
+/* Appends size bytes of the file at path */
+static bool CopyFile(AsyncFileWriter& file, const std::string& path, qint64 size)
+{
+    QFile in(path.c_str());
+    if (!in.open(QIODevice::ReadOnly)) {
+        LOG_ERR << "Error: Unable to read " << path;
+        return false;
+    }
+    std::vector<char> buf(1 << 20);
+    for (qint64 copied = 0; copied < size; ) {
+        qint64 n = in.read(buf.data(), std::min(qint64(buf.size()), size - copied));
+        if (n <= 0 || !file.Write(buf.data(), n))
+            return false;
+        copied += n;
+    }
+    return true;
+}
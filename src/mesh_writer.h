@@ -0,0 +1,50 @@
+/*******************************************************************************
+    Copyright (c) 2021, Andrea Maggiordomo, Paolo Cignoni and Marco Tarini
+
+    This file is part of TextureDefrag, a reference implementation for
+    the paper ``Texture Defragmentation for Photo-Reconstructed 3D Models''
+    by Andrea Maggiordomo, Paolo Cignoni and Marco Tarini.
+
+    TextureDefrag is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    TextureDefrag is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with TextureDefrag. If not, see <https://www.gnu.org/licenses/>.
+*******************************************************************************/
+
+
+#ifndef MESH_WRITER_H
+#define MESH_WRITER_H
+
+class Mesh;
+
+/* Writes the mesh to a Wavefront OBJ file with per-wedge texture coordinates, and
+ * the material library to fileName.mtl, laid out as vcg::tri::io::ExporterOBJ
+ * does. The vertex and face lines are formatted in parallel in blocks that are
+ * written sequentially, with floating point values that read back to the same
+ * double (see FormatDouble). Materials are created per texture or, if color is
+ * true, per texture and face color. Returns false on failure. */
+bool WriteOBJ(const char *fileName, Mesh& m, bool color);
+
+/* Writes the mesh to a binary little endian PLY file with per-wedge texture
+ * coordinates and texture indices. Face color and quality are only saved if
+ * color is true. Returns false on failure. */
+bool WritePLY(const char *fileName, Mesh& m, bool color);
+
+/* Writes the mesh to a binary glTF 2.0 file with 32-bit indices and one primitive
+ * per texture, after splitting the vertices at the wedges with distinct texture
+ * coordinates. The texture coordinates are quantized to normalized unsigned shorts
+ * if they are all in the unit square. The textures in m.textures are resolved
+ * relative to the directory of the output file; if embedTextures is true the png
+ * and jpeg images are copied in the binary chunk, otherwise they are referenced by
+ * their relative path. Face colors are not saved. Returns false on failure. */
+bool WriteGLB(const char *fileName, Mesh& m, bool embedTextures);
+
+#endif // MESH_WRITER_H
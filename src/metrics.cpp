@@ -0,0 +1,354 @@
+/*******************************************************************************
+    Copyright (c) 2021, Andrea Maggiordomo, Paolo Cignoni and Marco Tarini
+
+    This file is part of TextureDefrag, a reference implementation for
+    the paper ``Texture Defragmentation for Photo-Reconstructed 3D Models''
+    by Andrea Maggiordomo, Paolo Cignoni and Marco Tarini.
+
+    TextureDefrag is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    TextureDefrag is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with TextureDefrag. If not, see <https://www.gnu.org/licenses/>.
+*******************************************************************************/
+
+
+#include "metrics.h"
+#include "memory_budget.h"
+#include "logging.h"
+#include "utils.h"
+
+#include <vcg/space/rasterized_outline2_packer.h>
+#include <wrap/qt/outline2_rasterizer.h>
+
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <sstream>
+#include <cstring>
+#include <cerrno>
+
+#ifndef _WIN32
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <unistd.h>
+#endif
+
+
+static const int NUM_COUNTERS = (int) MetricCounter::_END;
+static const int NUM_TIMES = (int) MetricTime::_END;
+
+static std::atomic<uint64_t> counters[NUM_COUNTERS];
+static std::atomic<uint64_t> timesMicros[NUM_TIMES];
+
+// upper bounds of the buckets of the phase histograms, in seconds
+static const double phaseBuckets[] = {0.01, 0.05, 0.1, 0.5, 1, 5, 10, 30, 60, 120, 300, 600, 1800, 3600};
+static const int NUM_PHASE_BUCKETS = sizeof(phaseBuckets) / sizeof(phaseBuckets[0]);
+static const int MAX_PHASES = 64;
+
+struct PhaseHistogram {
+    std::string name;
+    std::atomic<uint64_t> buckets[NUM_PHASE_BUCKETS + 1]; // the last one counts the durations above all the bounds
+    std::atomic<uint64_t> sumMicros;
+};
+
+// the histograms are appended under the mutex and published by the release store
+// of the count, so that they are looked up without locking
+static PhaseHistogram phases[MAX_PHASES];
+static std::atomic<int> numPhases(0);
+static std::mutex phaseMtx;
+
+static std::atomic<long long> peakResident(-1);
+
+void MetricsAdd(MetricCounter c, uint64_t n)
+{
+    counters[(int) c].fetch_add(n, std::memory_order_relaxed);
+}
+
+void MetricsAdd(MetricTime t, double seconds)
+{
+    timesMicros[(int) t].fetch_add((uint64_t) (seconds * 1e6), std::memory_order_relaxed);
+}
+
+static PhaseHistogram *FindPhase(const std::string& phase)
+{
+    int n = numPhases.load(std::memory_order_acquire);
+    for (int i = 0; i < n; ++i)
+        if (phases[i].name == phase)
+            return &phases[i];
+
+    std::lock_guard<std::mutex> lock(phaseMtx);
+    n = numPhases.load(std::memory_order_relaxed);
+    for (int i = 0; i < n; ++i)
+        if (phases[i].name == phase)
+            return &phases[i];
+    if (n == MAX_PHASES)
+        return nullptr;
+    phases[n].name = phase;
+    numPhases.store(n + 1, std::memory_order_release);
+    return &phases[n];
+}
+
+void MetricsObservePhase(const std::string& phase, double seconds, long long peakResidentBytes)
+{
+    PhaseHistogram *h = FindPhase(phase);
+    if (h) {
+        int b = 0;
+        while (b < NUM_PHASE_BUCKETS && seconds > phaseBuckets[b])
+            b++;
+        h->buckets[b].fetch_add(1, std::memory_order_relaxed);
+        h->sumMicros.fetch_add((uint64_t) (seconds * 1e6), std::memory_order_relaxed);
+    }
+
+    long long p = peakResident.load(std::memory_order_relaxed);
+    while (peakResidentBytes > p && !peakResident.compare_exchange_weak(p, peakResidentBytes, std::memory_order_relaxed))
+        ;
+}
+
+static std::string EscapeLabel(const std::string& value)
+{
+    std::string escaped;
+    for (char c : value) {
+        if (c == '\\' || c == '"')
+            escaped += '\\';
+        if (c == '\n')
+            escaped += "\\n";
+        else
+            escaped += c;
+    }
+    return escaped;
+}
+
+static void Header(std::ostream& os, const char *name, const char *type, const char *help)
+{
+    os << "# HELP " << name << " " << help << "\n";
+    os << "# TYPE " << name << " " << type << "\n";
+}
+
+static double Ratio(uint64_t hits, uint64_t misses)
+{
+    return (hits + misses) > 0 ? double(hits) / double(hits + misses) : 0.0;
+}
+
+std::string FormatMetrics()
+{
+    auto Counter = [] (MetricCounter c) { return counters[(int) c].load(std::memory_order_relaxed); };
+    auto Seconds = [] (MetricTime t) { return timesMicros[(int) t].load(std::memory_order_relaxed) * 1e-6; };
+
+    std::ostringstream os;
+    os.precision(12);
+
+    Header(os, "texdefrag_jobs_total", "counter", "Jobs processed, by final status.");
+    os << "texdefrag_jobs_total{status=\"ok\"} " << Counter(MetricCounter::JobsSucceeded) << "\n";
+    os << "texdefrag_jobs_total{status=\"failed\"} " << Counter(MetricCounter::JobsFailed) << "\n";
+
+    int n = numPhases.load(std::memory_order_acquire);
+    Header(os, "texdefrag_phase_duration_seconds", "histogram", "Wall time of the phases of the jobs.");
+    for (int i = 0; i < n; ++i) {
+        const PhaseHistogram& h = phases[i];
+        std::string label = "phase=\"" + EscapeLabel(h.name) + "\"";
+        uint64_t cumulative = 0;
+        for (int b = 0; b <= NUM_PHASE_BUCKETS; ++b) {
+            cumulative += h.buckets[b].load(std::memory_order_relaxed);
+            os << "texdefrag_phase_duration_seconds_bucket{" << label << ",le=\"";
+            if (b < NUM_PHASE_BUCKETS)
+                os << phaseBuckets[b];
+            else
+                os << "+Inf";
+            os << "\"} " << cumulative << "\n";
+        }
+        os << "texdefrag_phase_duration_seconds_sum{" << label << "} " << h.sumMicros.load(std::memory_order_relaxed) * 1e-6 << "\n";
+        os << "texdefrag_phase_duration_seconds_count{" << label << "} " << cumulative << "\n";
+    }
+
+    uint64_t texHits = Counter(MetricCounter::TextureCacheHits);
+    uint64_t texMisses = Counter(MetricCounter::TextureCacheMisses);
+    Header(os, "texdefrag_texture_cache_lookups_total", "counter", "Lookups of the input textures in the texture caches of the rendering.");
+    os << "texdefrag_texture_cache_lookups_total{result=\"hit\"} " << texHits << "\n";
+    os << "texdefrag_texture_cache_lookups_total{result=\"miss\"} " << texMisses << "\n";
+    Header(os, "texdefrag_texture_cache_hit_ratio", "gauge", "Fraction of the texture cache lookups that hit.");
+    os << "texdefrag_texture_cache_hit_ratio " << Ratio(texHits, texMisses) << "\n";
+    Header(os, "texdefrag_texture_cache_evictions_total", "counter", "Input textures evicted from the texture caches.");
+    os << "texdefrag_texture_cache_evictions_total " << Counter(MetricCounter::TextureCacheEvictions) << "\n";
+
+    QtOutline2Rasterizer::CacheStats rs = QtOutline2Rasterizer::statsSnapshot(false);
+    Header(os, "texdefrag_rasterizer_cache_lookups_total", "counter", "Lookups of the packing rasterization cache.");
+    os << "texdefrag_rasterizer_cache_lookups_total{result=\"hit\"} " << rs.hits << "\n";
+    os << "texdefrag_rasterizer_cache_lookups_total{result=\"miss\"} " << rs.misses << "\n";
+    Header(os, "texdefrag_rasterizer_cache_hit_ratio", "gauge", "Fraction of the packing rasterization cache lookups that hit.");
+    os << "texdefrag_rasterizer_cache_hit_ratio " << Ratio(rs.hits, rs.misses) << "\n";
+    Header(os, "texdefrag_rasterizer_cache_disk_hits_total", "counter", "Misses of the packing rasterization cache found in the disk cache.");
+    os << "texdefrag_rasterizer_cache_disk_hits_total " << rs.diskHits << "\n";
+    Header(os, "texdefrag_rasterizer_cache_evictions_total", "counter", "Rasterizations evicted from the packing rasterization cache.");
+    os << "texdefrag_rasterizer_cache_evictions_total " << rs.evictions << "\n";
+    Header(os, "texdefrag_rasterizer_cache_bytes", "gauge", "Size of the packing rasterization cache.");
+    os << "texdefrag_rasterizer_cache_bytes " << rs.bytesCurrent << "\n";
+
+    Header(os, "texdefrag_sheets_saved_total", "counter", "Texture sheets written by the save queue.");
+    os << "texdefrag_sheets_saved_total " << Counter(MetricCounter::SheetsSaved) << "\n";
+    Header(os, "texdefrag_sheet_save_seconds_total", "counter", "Time spent encoding and writing the texture sheets.");
+    os << "texdefrag_sheet_save_seconds_total " << Seconds(MetricTime::SheetSave) << "\n";
+    Header(os, "texdefrag_save_queue_wait_seconds_total", "counter", "Time the rendering waited for the save queue, to enqueue a sheet or for the queue to drain.");
+    os << "texdefrag_save_queue_wait_seconds_total{wait=\"enqueue\"} " << Seconds(MetricTime::SaveEnqueueWait) << "\n";
+    os << "texdefrag_save_queue_wait_seconds_total{wait=\"finish\"} " << Seconds(MetricTime::SaveFinishWait) << "\n";
+
+    Header(os, "texdefrag_memory_used_bytes", "gauge", "Memory accounted to the subsystems of the pipeline.");
+    for (int i = 0; i < (int) MemorySubsystem::_END; ++i)
+        os << "texdefrag_memory_used_bytes{subsystem=\"" << MemorySubsystemName((MemorySubsystem) i) << "\"} " << MemoryUsed((MemorySubsystem) i) << "\n";
+    Header(os, "texdefrag_memory_peak_bytes", "gauge", "Peak memory accounted to the subsystems of the pipeline.");
+    for (int i = 0; i < (int) MemorySubsystem::_END; ++i)
+        os << "texdefrag_memory_peak_bytes{subsystem=\"" << MemorySubsystemName((MemorySubsystem) i) << "\"} " << MemoryPeak((MemorySubsystem) i) << "\n";
+    long long peak = peakResident.load(std::memory_order_relaxed);
+    if (peak >= 0) {
+        Header(os, "texdefrag_peak_resident_bytes", "gauge", "Peak resident set size of the process over the phases of the jobs.");
+        os << "texdefrag_peak_resident_bytes " << peak << "\n";
+    }
+
+    return os.str();
+}
+
+#ifndef _WIN32
+
+static std::thread serverThread;
+static std::atomic<bool> serverRunning(false);
+static int serverSocket = -1;
+
+static void SendAll(int fd, const std::string& data)
+{
+#ifdef MSG_NOSIGNAL
+    const int flags = MSG_NOSIGNAL;
+#else
+    const int flags = 0;
+#endif
+    std::size_t sent = 0;
+    while (sent < data.size()) {
+        ssize_t n = send(fd, data.data() + sent, data.size() - sent, flags);
+        if (n <= 0)
+            return;
+        sent += n;
+    }
+}
+
+static void ServeRequest(int fd)
+{
+    // a stalled client cannot hold the endpoint for long
+    timeval tv = {2, 0};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+    std::string request;
+    char buf[1024];
+    while (request.find("\r\n\r\n") == std::string::npos && request.size() < 8192) {
+        ssize_t n = recv(fd, buf, sizeof(buf), 0);
+        if (n <= 0)
+            break;
+        request.append(buf, n);
+    }
+
+    std::string line = request.substr(0, request.find("\r\n"));
+    std::string method = line.substr(0, line.find(' '));
+    std::string path = (method.size() < line.size()) ? line.substr(method.size() + 1) : "";
+    path = path.substr(0, path.find_first_of(" ?"));
+
+    std::string status = "200 OK";
+    std::string body;
+    if (method != "GET" && method != "HEAD") {
+        status = "405 Method Not Allowed";
+        body = "Method not allowed\n";
+    } else if (path != "/metrics") {
+        status = "404 Not Found";
+        body = "Not found, the metrics are served at /metrics\n";
+    } else {
+        body = FormatMetrics();
+    }
+
+    std::ostringstream response;
+    response << "HTTP/1.1 " << status << "\r\n"
+             << "Content-Type: text/plain; version=0.0.4; charset=utf-8\r\n"
+             << "Content-Length: " << body.size() << "\r\n"
+             << "Connection: close\r\n\r\n";
+    if (method != "HEAD")
+        response << body;
+    SendAll(fd, response.str());
+}
+
+static void ServeMetrics()
+{
+    while (serverRunning.load()) {
+        // the socket is polled with a timeout to notice the shutdown
+        pollfd pfd;
+        pfd.fd = serverSocket;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+        if (poll(&pfd, 1, 250) <= 0)
+            continue;
+        int fd = accept(serverSocket, nullptr, nullptr);
+        if (fd < 0)
+            continue;
+        ServeRequest(fd);
+        close(fd);
+    }
+}
+
+bool StartMetricsServer(int port)
+{
+    ensure(!serverRunning);
+
+    serverSocket = socket(AF_INET, SOCK_STREAM, 0);
+    if (serverSocket < 0) {
+        LOG_ERR << "Unable to create the socket of the metrics endpoint: " << std::strerror(errno);
+        return false;
+    }
+    int reuse = 1;
+    setsockopt(serverSocket, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+    sockaddr_in addr;
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons((uint16_t) port);
+    if (bind(serverSocket, (sockaddr *) &addr, sizeof(addr)) != 0 || listen(serverSocket, 16) != 0) {
+        LOG_ERR << "Unable to serve the metrics on port " << port << ": " << std::strerror(errno);
+        close(serverSocket);
+        serverSocket = -1;
+        return false;
+    }
+
+    serverRunning = true;
+    serverThread = std::thread(ServeMetrics);
+    LOG_INFO << "Serving the metrics at http://localhost:" << port << "/metrics";
+    return true;
+}
+
+void StopMetricsServer()
+{
+    if (!serverRunning)
+        return;
+    serverRunning = false;
+    serverThread.join();
+    close(serverSocket);
+    serverSocket = -1;
+}
+
+#else
+
+bool StartMetricsServer(int port)
+{
+    LOG_ERR << "The metrics endpoint is not supported on Windows, port " << port << " is not served";
+    return false;
+}
+
+void StopMetricsServer()
+{
+}
+
+#endif
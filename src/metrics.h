@@ -0,0 +1,73 @@
+/*******************************************************************************
+    Copyright (c) 2021, Andrea Maggiordomo, Paolo Cignoni and Marco Tarini
+
+    This file is part of TextureDefrag, a reference implementation for
+    the paper ``Texture Defragmentation for Photo-Reconstructed 3D Models''
+    by Andrea Maggiordomo, Paolo Cignoni and Marco Tarini.
+
+    TextureDefrag is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    TextureDefrag is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with TextureDefrag. If not, see <https://www.gnu.org/licenses/>.
+*******************************************************************************/
+
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <string>
+#include <cstdint>
+
+/* Operational metrics of a long running process (the batch mode), served in the
+ * Prometheus text format by an embedded HTTP endpoint. The counters and the phase
+ * histograms are updated with relaxed atomic operations by any thread, and a
+ * scrape reads them without blocking the updates. The memory counters (see
+ * memory_budget.h) and the packing rasterization cache statistics are read when
+ * the metrics are scraped */
+
+enum class MetricCounter {
+    JobsSucceeded,
+    JobsFailed,
+    TextureCacheHits,      // lookups of the input textures in the texture caches of the rendering
+    TextureCacheMisses,
+    TextureCacheEvictions,
+    SheetsSaved,           // texture sheets written by the save queue
+    _END
+};
+
+enum class MetricTime {
+    SaveEnqueueWait,       // time the rendering waited for room in the save queue
+    SaveFinishWait,        // time the rendering waited for the save queue to drain
+    SheetSave,             // time spent encoding and writing the texture sheets
+    _END
+};
+
+void MetricsAdd(MetricCounter c, uint64_t n = 1);
+void MetricsAdd(MetricTime t, double seconds);
+
+/* Records the duration of a phase of a job in the histogram of the phase, and the
+ * peak resident set size of the process measured during the phase (negative if
+ * not available). The number of distinct phases is limited, the phases beyond
+ * the limit are not recorded */
+void MetricsObservePhase(const std::string& phase, double seconds, long long peakResidentBytes);
+
+/* Writes the metrics in the Prometheus text exposition format */
+std::string FormatMetrics();
+
+/* Serves the metrics over HTTP on the given port (of all the interfaces) from a
+ * background thread, at the path /metrics. Returns false if the port cannot be
+ * bound. Not supported on Windows */
+bool StartMetricsServer(int port);
+
+/* Stops the server, if running */
+void StopMetricsServer();
+
+#endif // METRICS_H
@@ -0,0 +1,206 @@
+/*******************************************************************************
+    Copyright (c) 2021, Andrea Maggiordomo, Paolo Cignoni and Marco Tarini
+
+    This file is part of TextureDefrag, a reference implementation for
+    the paper ``Texture Defragmentation for Photo-Reconstructed 3D Models''
+    by Andrea Maggiordomo, Paolo Cignoni and Marco Tarini.
+
+    TextureDefrag is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    TextureDefrag is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with TextureDefrag. If not, see <https://www.gnu.org/licenses/>.
+*******************************************************************************/
+
+
+#include "numa_placement.h"
+#include "logging.h"
+
+#include <fstream>
+#include <sstream>
+#include <atomic>
+#include <algorithm>
+#include <cstdlib>
+#include <omp.h>
+
+#ifdef __linux__
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#endif
+
+
+// pages moved by each move_pages call
+constexpr int MOVE_PAGES_BATCH = 4096;
+
+// minimum number of pages per thread of the distributed ranges
+constexpr std::size_t MIN_PAGES_PER_THREAD = 16;
+
+static std::atomic<bool> placementEnabled(false);
+
+static std::vector<int> ParseCpuList(const std::string& list)
+{
+    std::vector<int> cpus;
+    std::stringstream ss(list);
+    std::string range;
+    while (std::getline(ss, range, ',')) {
+        if (range.empty())
+            continue;
+        std::size_t dash = range.find('-');
+        int first = std::atoi(range.substr(0, dash).c_str());
+        int last = (dash == std::string::npos) ? first : std::atoi(range.substr(dash + 1).c_str());
+        for (int cpu = first; cpu <= last; ++cpu)
+            cpus.push_back(cpu);
+    }
+    return cpus;
+}
+
+static NumaTopology ReadTopology()
+{
+    NumaTopology topology;
+#ifdef __linux__
+    std::vector<std::string> cpus;
+    for (int node = 0; ; ++node) {
+        std::ifstream in("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+        if (!in)
+            break;
+        std::string list;
+        std::getline(in, list);
+        cpus.push_back(list);
+    }
+    if (cpus.size() > 0) {
+        topology.nodes = cpus.size();
+        topology.cpus = cpus;
+    }
+#endif
+    return topology;
+}
+
+const NumaTopology& GetNumaTopology()
+{
+    static const NumaTopology topology = ReadTopology();
+    return topology;
+}
+
+void EnableNumaPlacement(char *argv[])
+{
+    placementEnabled = true;
+#ifdef __linux__
+    if (getenv("OMP_PROC_BIND") == nullptr && getenv("OMP_PLACES") == nullptr) {
+        setenv("OMP_PROC_BIND", "close", 1);
+        setenv("OMP_PLACES", "cores", 1);
+        execv("/proc/self/exe", argv);
+        // if the restart fails the threads are not bound, but the pages are still placed
+    }
+#else
+    (void) argv;
+#endif
+}
+
+bool NumaPlacementEnabled()
+{
+    return placementEnabled;
+}
+
+std::string OpenMPBindingInfo()
+{
+    std::string policy;
+    switch (omp_get_proc_bind()) {
+    case omp_proc_bind_false:  policy = "unbound"; break;
+    case omp_proc_bind_true:   policy = "bound"; break;
+    case omp_proc_bind_master: policy = "master"; break;
+    case omp_proc_bind_close:  policy = "close"; break;
+    case omp_proc_bind_spread: policy = "spread"; break;
+    default:                   policy = "unknown"; break;
+    }
+    return policy + ", " + std::to_string(omp_get_num_places()) + " places";
+}
+
+void DistributeStatic(const void *data, std::size_t bytes)
+{
+#if defined(__linux__) && defined(SYS_move_pages)
+    const NumaTopology& topology = GetNumaTopology();
+    if (!placementEnabled || topology.nodes < 2 || data == nullptr)
+        return;
+
+    // node of each cpu
+    static const std::vector<int> cpuNode = [&] () {
+        std::vector<int> nodeOf;
+        for (int node = 0; node < topology.nodes; ++node) {
+            for (int cpu : ParseCpuList(topology.cpus[node])) {
+                if (cpu >= (int) nodeOf.size())
+                    nodeOf.resize(cpu + 1, -1);
+                nodeOf[cpu] = node;
+            }
+        }
+        return nodeOf;
+    }();
+
+    // node of each thread of the parallel loops
+    int nt = omp_get_max_threads();
+    std::vector<int> threadNode(nt, -1);
+    #pragma omp parallel num_threads(nt)
+    {
+        int cpu = sched_getcpu();
+        if (cpu >= 0 && cpu < (int) cpuNode.size())
+            threadNode[omp_get_thread_num()] = cpuNode[cpu];
+    }
+
+    const std::size_t pageSize = sysconf(_SC_PAGESIZE);
+    std::size_t firstPage = reinterpret_cast<std::size_t>(data) / pageSize;
+    std::size_t lastPage = (reinterpret_cast<std::size_t>(data) + bytes - 1) / pageSize;
+    std::size_t npages = lastPage - firstPage + 1;
+    if (npages < MIN_PAGES_PER_THREAD * nt)
+        return;
+
+    std::vector<void *> pages;
+    std::vector<int> nodes;
+    std::vector<int> status;
+    long moved = 0;
+    long failed = 0;
+    auto Flush = [&] () {
+        if (pages.empty())
+            return;
+        status.assign(pages.size(), 0);
+        // MPOL_MF_MOVE moves the pages that are only mapped by this process
+        long ret = syscall(SYS_move_pages, 0, (unsigned long) pages.size(), pages.data(), nodes.data(), status.data(), 1 << 1);
+        if (ret < 0)
+            failed += pages.size();
+        else
+            moved += pages.size();
+        pages.clear();
+        nodes.clear();
+    };
+
+    // the static schedule gives thread t the t-th contiguous block of the range, a
+    // page shared by two blocks goes to the first one
+    std::size_t nextPage = firstPage;
+    for (int t = 0; t < nt; ++t) {
+        std::size_t begin = reinterpret_cast<std::size_t>(data) + (bytes * t) / nt;
+        std::size_t end = reinterpret_cast<std::size_t>(data) + (bytes * (t + 1)) / nt;
+        std::size_t page = std::max(begin / pageSize, nextPage);
+        nextPage = std::max(nextPage, (end + pageSize - 1) / pageSize);
+        if (threadNode[t] < 0)
+            continue;
+        for (; page * pageSize < end; ++page) {
+            pages.push_back(reinterpret_cast<void *>(page * pageSize));
+            nodes.push_back(threadNode[t]);
+            if ((int) pages.size() == MOVE_PAGES_BATCH)
+                Flush();
+        }
+    }
+    Flush();
+
+    LOG_DEBUG << "NUMA: moved " << moved << " pages (" << failed << " failed)";
+#else
+    (void) data;
+    (void) bytes;
+#endif
+}
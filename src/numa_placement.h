@@ -0,0 +1,70 @@
+/*******************************************************************************
+    Copyright (c) 2021, Andrea Maggiordomo, Paolo Cignoni and Marco Tarini
+
+    This file is part of TextureDefrag, a reference implementation for
+    the paper ``Texture Defragmentation for Photo-Reconstructed 3D Models''
+    by Andrea Maggiordomo, Paolo Cignoni and Marco Tarini.
+
+    TextureDefrag is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    TextureDefrag is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with TextureDefrag. If not, see <https://www.gnu.org/licenses/>.
+*******************************************************************************/
+
+
+#ifndef NUMA_PLACEMENT_H
+#define NUMA_PLACEMENT_H
+
+#include <vector>
+#include <string>
+#include <cstddef>
+
+/* NUMA placement of the large arrays. The arrays of the mesh are allocated and
+ * filled by the loading thread, so on multi-socket machines their pages all
+ * live on one node. With the placement enabled, the OpenMP threads are bound to
+ * the cores and the pages of the arrays are moved to the node of the thread
+ * that processes them with the default (static) schedule of the parallel
+ * loops, which is where they would be after a parallel first touch. Only
+ * implemented on Linux, elsewhere (and on single node machines) the functions
+ * have no effect */
+
+struct NumaTopology {
+    int nodes = 1;
+    std::vector<std::string> cpus; // cpu list of each node, in the format of the sysfs
+};
+
+/* Topology of the machine, read once */
+const NumaTopology& GetNumaTopology();
+
+/* Enables the placement and binds the OpenMP threads to the cores. If neither
+ * OMP_PROC_BIND nor OMP_PLACES is set, they are set to close and cores and the
+ * process is restarted with the same arguments, since the OpenMP runtime may
+ * read them when it is loaded (libgomp does). Must be called at the start of
+ * main */
+void EnableNumaPlacement(char *argv[]);
+
+bool NumaPlacementEnabled();
+
+/* Binding policy and places of the OpenMP runtime, for the log */
+std::string OpenMPBindingInfo();
+
+/* Moves the pages of the range to the nodes of the threads that process it with
+ * a static schedule, ranges smaller than a few pages per thread are skipped */
+void DistributeStatic(const void *data, std::size_t bytes);
+
+template <typename T>
+void DistributeStatic(const std::vector<T>& v)
+{
+    if (!v.empty())
+        DistributeStatic(v.data(), v.size() * sizeof(T));
+}
+
+#endif // NUMA_PLACEMENT_H
@@ -0,0 +1,649 @@
+/*******************************************************************************
+    Copyright (c) 2021, Andrea Maggiordomo, Paolo Cignoni and Marco Tarini
+
+    This file is part of TextureDefrag, a reference implementation for
+    the paper ``Texture Defragmentation for Photo-Reconstructed 3D Models''
+    by Andrea Maggiordomo, Paolo Cignoni and Marco Tarini.
+
+    TextureDefrag is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    TextureDefrag is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with TextureDefrag. If not, see <https://www.gnu.org/licenses/>.
+*******************************************************************************/
+
+
+#include <vcg/complex/complex.h>
+
+#include "gl_utils.h" // required for obj importer to use glu::tessellator
+
+#include <wrap/io_trimesh/import_obj.h>
+
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <cstring>
+#include <cstdlib>
+#include <cstdint>
+
+#include <omp.h>
+
+#include <QFile>
+
+#include "obj_loader.h"
+#include "mesh.h"
+#include "mesh_attribute.h"
+#include "timer.h"
+#include "utils.h"
+#include "logging.h"
+
+
+typedef tri::io::ImporterOBJ<Mesh> ImporterOBJ;
+typedef tri::io::Material Material;
+
+/* minimum size of the chunks scanned by each thread */
+static const qint64 MIN_CHUNK_BYTES = 1 << 20;
+
+struct OBJToken {
+    const char *b;
+    const char *e;
+};
+
+/* A range of whole lines of the file, with the number of elements it defines
+ * (computed by the first pass) and the state at its first line (computed from
+ * the prefix sums of the counts of the previous chunks) */
+struct OBJChunk {
+    const char *begin = nullptr;
+    const char *end = nullptr;
+
+    int numVertices = 0;
+    int numTexCoords = 0;
+    int numNormals = 0;
+    int numTriangles = 0;
+    int firstVertexSeparators = -1;
+    bool hasQuads = false;
+    bool unsupported = false;
+
+    std::vector<std::string> materialLibraries;
+    std::vector<std::string> materialNames; // arguments of the usemtl statements, in order
+    const char *firstMaterialLibrary = nullptr;
+    const char *firstMaterialUse = nullptr;
+
+    int vertexOffset = 0;
+    int texCoordOffset = 0;
+    int normalOffset = 0;
+    int triangleOffset = 0;
+    short materialIndex = 0;
+    Color4b color = Color4b(Color4b::LightGray);
+
+    int result = ImporterOBJ::E_NOERROR;
+};
+
+struct OBJParseContext {
+    Mesh *m;
+    int mask;
+    bool hasNormals;
+    int numVertices;
+    int numTexCoords;
+    int numNormals;
+    const std::vector<Material> *materials;
+    Mesh::PerFaceAttributeHandle<Color4b> faceColor;
+    std::vector<Point2f> texCoords;
+    std::vector<Point3d> normals;
+    std::vector<int> wedgeTexCoords; // texcoord indices of the triangle corners
+    std::vector<int> wedgeNormals;   // normal indices of the triangle corners
+};
+
+static void ScanChunk(OBJChunk& chunk);
+static void ParseChunk(OBJChunk& chunk, OBJParseContext& ctx);
+static const char *LineEnd(const char *line, const char *end);
+static int Tokenize(const char *b, const char *e, OBJToken *tokens, int maxTokens);
+static bool TokenIs(const OBJToken& token, const char *s);
+static std::string StatementArgument(const char *line, const char *eol, const OBJToken *tokens, int numTokens);
+static double ParseDouble(const OBJToken& token);
+static int ParseInt(const char *b, const char *e);
+static void SplitToken(const OBJToken& token, bool hasNormals, int& vId, int& nId, int& tId);
+static void UseMaterial(const std::string& name, const std::vector<Material>& materials, short& index, Color4b& color, int& result);
+
+
+bool LoadOBJ(const char *fileName, Mesh& m, int& loadMask, int& result)
+{
+    Timer t;
+
+    m.Clear();
+    loadMask = 0;
+    result = ImporterOBJ::E_NOERROR;
+
+    QFile file(fileName);
+    if (!file.open(QIODevice::ReadOnly)) {
+        result = ImporterOBJ::E_CANTOPEN;
+        return true;
+    }
+
+    const qint64 size = file.size();
+    if (size == 0) {
+        result = ImporterOBJ::E_NO_VERTEX;
+        return true;
+    }
+
+    const char *data = reinterpret_cast<const char *>(file.map(0, size));
+    if (data == nullptr) {
+        LOG_VERBOSE << "Unable to map " << fileName << ", falling back to the vcg importer";
+        return false;
+    }
+
+    int numChunks = (int) std::max(qint64(1), std::min(qint64(omp_get_max_threads()) * 8, size / MIN_CHUNK_BYTES));
+    std::vector<OBJChunk> chunks(numChunks);
+    const char *p = data;
+    for (int c = 0; c < numChunks; ++c) {
+        chunks[c].begin = p;
+        if (c == numChunks - 1) {
+            p = data + size;
+        } else {
+            const char *target = std::max(p, data + (size * (c + 1)) / numChunks);
+            const char *nl = (const char *) std::memchr(target, '\n', (data + size) - target);
+            p = nl ? nl + 1 : data + size;
+        }
+        chunks[c].end = p;
+    }
+
+    #pragma omp parallel for schedule(dynamic, 1)
+    for (int c = 0; c < numChunks; ++c)
+        ScanChunk(chunks[c]);
+
+    int numVertices = 0;
+    int numTexCoords = 0;
+    int numNormals = 0;
+    int numTriangles = 0;
+    int firstVertexSeparators = -1;
+    bool hasQuads = false;
+    bool hasMaterialUse = false;
+    std::vector<std::string> materialLibraries;
+    const char *firstMaterialLibrary = nullptr;
+    const char *firstMaterialUse = nullptr;
+    for (OBJChunk& chunk : chunks) {
+        if (chunk.unsupported) {
+            LOG_VERBOSE << "The obj file uses features not supported by the parallel parser, falling back to the vcg importer";
+            return false;
+        }
+        chunk.vertexOffset = numVertices;
+        chunk.texCoordOffset = numTexCoords;
+        chunk.normalOffset = numNormals;
+        chunk.triangleOffset = numTriangles;
+        numVertices += chunk.numVertices;
+        numTexCoords += chunk.numTexCoords;
+        numNormals += chunk.numNormals;
+        numTriangles += chunk.numTriangles;
+        if (firstVertexSeparators == -1)
+            firstVertexSeparators = chunk.firstVertexSeparators;
+        hasQuads |= chunk.hasQuads;
+        hasMaterialUse |= !chunk.materialNames.empty();
+        materialLibraries.insert(materialLibraries.end(), chunk.materialLibraries.begin(), chunk.materialLibraries.end());
+        if (!firstMaterialLibrary)
+            firstMaterialLibrary = chunk.firstMaterialLibrary;
+        if (!firstMaterialUse)
+            firstMaterialUse = chunk.firstMaterialUse;
+    }
+
+    // each mtllib statement replaces the materials, so the material state of the
+    // chunks can be computed upfront only if the library is loaded before its use
+    if (materialLibraries.size() > 1 || (firstMaterialLibrary && firstMaterialUse && firstMaterialUse < firstMaterialLibrary)) {
+        LOG_VERBOSE << "The obj file redefines its materials, falling back to the vcg importer";
+        return false;
+    }
+
+    if (numVertices == 0) {
+        result = ImporterOBJ::E_NO_VERTEX;
+        return true;
+    }
+
+    // same mask computed by ImporterOBJ::LoadMask()
+    int mask = 0;
+    if (numTexCoords > 0) {
+        if (numTexCoords == numVertices)
+            mask |= tri::io::Mask::IOM_VERTTEXCOORD;
+        mask |= tri::io::Mask::IOM_WEDGTEXCOORD;
+        mask |= tri::io::Mask::IOM_FACECOLOR;
+    }
+    if (hasMaterialUse)
+        mask |= tri::io::Mask::IOM_FACECOLOR;
+    if (firstVertexSeparators >= 6)
+        mask |= tri::io::Mask::IOM_VERTCOLOR;
+    if (numNormals > 0)
+        mask |= (numNormals == numVertices) ? tri::io::Mask::IOM_VERTNORMAL : tri::io::Mask::IOM_WEDGNORMAL;
+    // the face colors are stored in an attribute, which ClampMask() does not see
+    bool hasFaceColor = (mask & tri::io::Mask::IOM_FACECOLOR);
+    tri::io::Mask::ClampMask<Mesh>(m, mask);
+    if (hasFaceColor)
+        mask |= tri::io::Mask::IOM_FACECOLOR;
+    if (hasQuads)
+        mask |= tri::io::Mask::IOM_BITPOLYGONAL;
+
+    std::vector<Material> materials(1);
+    materials[0].index = 0;
+    if (materialLibraries.size() == 1 && !ImporterOBJ::LoadMaterials(materialLibraries[0].c_str(), materials, m.textures))
+        result = ImporterOBJ::E_MATERIAL_FILE_NOT_FOUND;
+    if (hasMaterialUse && materials.size() == 1 && materials[0].materialName == "") {
+        // like ImporterOBJ, look for a material library with the name of the file
+        std::string materialFileName(fileName);
+        if (materialFileName.size() >= 4) {
+            materialFileName.replace(materialFileName.end() - 4, materialFileName.end(), ".mtl");
+            ImporterOBJ::LoadMaterials(materialFileName.c_str(), materials, m.textures);
+        }
+    }
+
+    short materialIndex = 0;
+    Color4b color = Color4b(Color4b::LightGray);
+    for (OBJChunk& chunk : chunks) {
+        chunk.materialIndex = materialIndex;
+        chunk.color = color;
+        int ignored;
+        for (const std::string& name : chunk.materialNames)
+            UseMaterial(name, materials, materialIndex, color, ignored);
+    }
+
+    OBJParseContext ctx;
+    ctx.m = &m;
+    ctx.mask = mask;
+    ctx.hasNormals = (numNormals > 0);
+    ctx.numVertices = numVertices;
+    ctx.numTexCoords = numTexCoords;
+    ctx.numNormals = numNormals;
+    ctx.materials = &materials;
+    ctx.texCoords.resize(numTexCoords);
+    ctx.normals.resize(numNormals);
+    if (mask & tri::io::Mask::IOM_WEDGTEXCOORD)
+        ctx.wedgeTexCoords.resize(3 * std::size_t(numTriangles));
+    if (mask & tri::io::Mask::IOM_VERTNORMAL)
+        ctx.wedgeNormals.resize(3 * std::size_t(numTriangles));
+
+    tri::Allocator<Mesh>::AddVertices(m, numVertices);
+    tri::Allocator<Mesh>::AddFaces(m, numTriangles);
+    if (mask & tri::io::Mask::IOM_FACECOLOR)
+        ctx.faceColor = GetFaceColorAttribute(m);
+
+    #pragma omp parallel for schedule(dynamic, 1)
+    for (int c = 0; c < numChunks; ++c)
+        ParseChunk(chunks[c], ctx);
+
+    for (const OBJChunk& chunk : chunks) {
+        if (ImporterOBJ::ErrorCritical(chunk.result)) {
+            m.Clear();
+            m.textures.clear();
+            result = chunk.result;
+            return true;
+        }
+        if (chunk.result != ImporterOBJ::E_NOERROR)
+            result = chunk.result;
+    }
+
+    // the texture coordinates and the vertices can be referenced by any chunk, so
+    // the faces are completed once all the chunks are parsed
+    int numDeleted = 0;
+    #pragma omp parallel for reduction(+:numDeleted)
+    for (int i = 0; i < numTriangles; ++i) {
+        MeshFace& f = m.face[i];
+        if (f.IsD()) {
+            numDeleted++;
+            continue;
+        }
+        if (mask & tri::io::Mask::IOM_WEDGTEXCOORD) {
+            for (int j = 0; j < 3; ++j) {
+                const Point2f& uv = ctx.texCoords[ctx.wedgeTexCoords[3 * std::size_t(i) + j]];
+                f.WT(j).u() = uv[0];
+                f.WT(j).v() = uv[1];
+            }
+        }
+        f.N().Import(TriangleNormal(f).Normalize());
+    }
+
+    // vertices shared by several faces take the attributes of the last one, as in ImporterOBJ
+    if (mask & (tri::io::Mask::IOM_VERTTEXCOORD | tri::io::Mask::IOM_VERTNORMAL)) {
+        for (int i = 0; i < numTriangles; ++i) {
+            MeshFace& f = m.face[i];
+            if (f.IsD())
+                continue;
+            for (int j = 0; j < 3; ++j) {
+                if (mask & tri::io::Mask::IOM_VERTTEXCOORD)
+                    f.V(j)->T() = f.WT(j);
+                if (mask & tri::io::Mask::IOM_VERTNORMAL)
+                    f.V(j)->N() = ctx.normals[ctx.wedgeNormals[3 * std::size_t(i) + j]];
+            }
+        }
+    }
+
+    if (numDeleted > 0) {
+        m.fn -= numDeleted;
+        tri::Allocator<Mesh>::CompactFaceVector(m);
+    }
+
+    loadMask = mask;
+
+    LOG_VERBOSE << "Parsed " << fileName << " in " << numChunks << " chunks (" << t.TimeElapsed() << " seconds)";
+
+    return true;
+}
+
+
+// -- static functions ---------------------------------------------------------
+
+/* First pass, counts the elements defined in the chunk and checks that the
+ * statements are supported */
+static void ScanChunk(OBJChunk& chunk)
+{
+    OBJToken tokens[2];
+    for (const char *line = chunk.begin; line < chunk.end && !chunk.unsupported; ) {
+        const char *eol = LineEnd(line, chunk.end);
+        const char *last = (eol > line && eol[-1] == '\r') ? eol - 1 : eol;
+        if (last > line && last[-1] == '\\') {
+            chunk.unsupported = true;
+        } else if (*line == '#') {
+            if (last - line >= 5 && std::strncmp(line, "#MRGB", 5) == 0)
+                chunk.unsupported = true;
+        } else {
+            int n = Tokenize(line, eol, tokens, 2);
+            if (n == 0) {
+                // empty line
+            } else if (TokenIs(tokens[0], "v")) {
+                if (chunk.numVertices++ == 0)
+                    chunk.firstVertexSeparators = (int) std::count(line, eol, ' ') + (int) std::count(line, eol, '\t');
+            } else if (TokenIs(tokens[0], "vt")) {
+                chunk.numTexCoords++;
+            } else if (TokenIs(tokens[0], "vn")) {
+                chunk.numNormals++;
+            } else if (TokenIs(tokens[0], "f")) {
+                int vertexesPerFace = n - 1;
+                if (vertexesPerFace > 4)
+                    chunk.unsupported = true;
+                else if (vertexesPerFace >= 3)
+                    chunk.numTriangles += vertexesPerFace - 2;
+                chunk.hasQuads |= (vertexesPerFace == 4);
+            } else if (TokenIs(tokens[0], "l") || TokenIs(tokens[0], "q")) {
+                chunk.unsupported = true;
+            } else if (TokenIs(tokens[0], "mtllib") && n > 1) {
+                if (!chunk.firstMaterialLibrary)
+                    chunk.firstMaterialLibrary = line;
+                chunk.materialLibraries.push_back(StatementArgument(line, eol, tokens, n));
+            } else if (TokenIs(tokens[0], "usemtl") && n > 1) {
+                if (!chunk.firstMaterialUse)
+                    chunk.firstMaterialUse = line;
+                chunk.materialNames.push_back(StatementArgument(line, eol, tokens, n));
+            }
+        }
+        line = (eol < chunk.end) ? eol + 1 : chunk.end;
+    }
+}
+
+/* Second pass, parses the chunk statements mirroring ImporterOBJ::Open() */
+static void ParseChunk(OBJChunk& chunk, OBJParseContext& ctx)
+{
+    Mesh& m = *ctx.m;
+    const int mask = ctx.mask;
+
+    int vi = chunk.vertexOffset;
+    int ti = chunk.texCoordOffset;
+    int ni = chunk.normalOffset;
+    int fi = chunk.triangleOffset;
+    short materialIndex = chunk.materialIndex;
+    Color4b color = chunk.color;
+
+    OBJToken tokens[8];
+    for (const char *line = chunk.begin; line < chunk.end; ) {
+        const char *eol = LineEnd(line, chunk.end);
+        int n = (*line == '#') ? 0 : Tokenize(line, eol, tokens, 8);
+        if (n == 0) {
+            // empty line or comment
+        } else if (TokenIs(tokens[0], "v")) {
+            if (n < 4) {
+                chunk.result = ImporterOBJ::E_BAD_VERTEX_STATEMENT;
+                return;
+            }
+            MeshVertex& v = m.vert[vi++];
+            v.P() = Point3d(ParseDouble(tokens[1]), ParseDouble(tokens[2]), ParseDouble(tokens[3]));
+            // the vertex colors are not stored
+        } else if (TokenIs(tokens[0], "vt")) {
+            if (n < 3) {
+                chunk.result = ImporterOBJ::E_BAD_VERT_TEX_STATEMENT;
+                return;
+            }
+            ctx.texCoords[ti++] = Point2f(float(ParseDouble(tokens[1])), float(ParseDouble(tokens[2])));
+        } else if (TokenIs(tokens[0], "vn")) {
+            if (n != 4) {
+                chunk.result = ImporterOBJ::E_BAD_VERT_NORMAL_STATEMENT;
+                return;
+            }
+            ctx.normals[ni++] = Point3d(ParseDouble(tokens[1]), ParseDouble(tokens[2]), ParseDouble(tokens[3]));
+        } else if (TokenIs(tokens[0], "f")) {
+            const int vertexesPerFace = n - 1;
+            if (vertexesPerFace < 3) {
+                chunk.result = ImporterOBJ::E_LESS_THAN_3_VERT_IN_FACE;
+            } else {
+                int vId[4], nId[4], tId[4];
+                for (int k = 0; k < vertexesPerFace; ++k) {
+                    SplitToken(tokens[k + 1], ctx.hasNormals, vId[k], nId[k], tId[k]);
+                    ImporterOBJ::GoodObjIndex(vId[k], vi);
+                    ImporterOBJ::GoodObjIndex(tId[k], ctx.numTexCoords);
+                }
+                // fan triangulation of quads, as in ImporterOBJ
+                for (int tri = 0; tri < vertexesPerFace - 2; ++tri) {
+                    const int locInd[3] = { 0, tri + 1, tri + 2 };
+                    const std::size_t slot = fi++;
+                    MeshFace& f = m.face[slot];
+
+                    int fv[3], fn[3], ft[3];
+                    for (int j = 0; j < 3; ++j) {
+                        fv[j] = vId[locInd[j]];
+                        fn[j] = nId[locInd[j]];
+                        ft[j] = tId[locInd[j]];
+                    }
+
+                    bool valid = true;
+                    if (mask & tri::io::Mask::IOM_WEDGTEXCOORD) {
+                        for (int j = 0; j < 3; ++j)
+                            valid &= (ft[j] >= 0 && ft[j] < ctx.numTexCoords);
+                    }
+                    if (valid && (fv[0] == fv[1] || fv[0] == fv[2] || fv[1] == fv[2])) {
+                        chunk.result = ImporterOBJ::E_VERTICES_WITH_SAME_IDX_IN_FACE;
+                        valid = false;
+                    }
+                    for (int j = 0; j < 3; ++j)
+                        valid &= (fv[j] >= 0 && fv[j] < ctx.numVertices);
+                    if (mask & tri::io::Mask::IOM_VERTNORMAL) {
+                        for (int j = 0; j < 3; ++j)
+                            valid &= (ImporterOBJ::GoodObjIndex(fn[j], ni) && fn[j] < ctx.numNormals);
+                    }
+                    if (!valid) {
+                        f.SetD();
+                        continue;
+                    }
+
+                    for (int j = 0; j < 3; ++j) {
+                        f.V(j) = &m.vert[fv[j]];
+                        if (mask & tri::io::Mask::IOM_WEDGTEXCOORD) {
+                            ctx.wedgeTexCoords[3 * slot + j] = ft[j];
+                            f.WT(j).n() = (*ctx.materials)[materialIndex].index;
+                        }
+                        if (mask & tri::io::Mask::IOM_VERTNORMAL)
+                            ctx.wedgeNormals[3 * slot + j] = fn[j];
+                        // only edges between consecutive polygon vertices are real edges
+                        if ((locInd[j] + 1) % vertexesPerFace == locInd[(j + 1) % 3])
+                            f.ClearF(j);
+                        else
+                            f.SetF(j);
+                    }
+                    if (mask & tri::io::Mask::IOM_FACECOLOR)
+                        ctx.faceColor[f] = color;
+                }
+            }
+        } else if (TokenIs(tokens[0], "usemtl") && n > 1) {
+            UseMaterial(StatementArgument(line, eol, tokens, n), *ctx.materials, materialIndex, color, chunk.result);
+        }
+        line = (eol < chunk.end) ? eol + 1 : chunk.end;
+    }
+}
+
+static const char *LineEnd(const char *line, const char *end)
+{
+    const char *eol = (const char *) std::memchr(line, '\n', end - line);
+    return eol ? eol : end;
+}
+
+/* Splits the line at blanks like ImporterOBJ::TokenizeNextLine(), stores at most
+ * maxTokens tokens and returns the number of tokens in the line */
+static int Tokenize(const char *b, const char *e, OBJToken *tokens, int maxTokens)
+{
+    int n = 0;
+    const char *p = b;
+    while (true) {
+        while (p < e && (*p == ' ' || *p == '\t' || *p == '\r'))
+            p++;
+        if (p == e)
+            break;
+        const char *q = p + 1;
+        while (q < e && *q != ' ' && *q != '\t' && *q != '\r')
+            q++;
+        if (n < maxTokens) {
+            tokens[n].b = p;
+            tokens[n].e = q;
+        }
+        n++;
+        p = q;
+    }
+    return n;
+}
+
+static bool TokenIs(const OBJToken& token, const char *s)
+{
+    std::size_t len = std::strlen(s);
+    return std::size_t(token.e - token.b) == len && std::strncmp(token.b, s, len) == 0;
+}
+
+/* Returns the argument of mtllib and usemtl statements, which can contain spaces */
+static std::string StatementArgument(const char *line, const char *eol, const OBJToken *tokens, int numTokens)
+{
+    if (numTokens == 2)
+        return std::string(tokens[1].b, tokens[1].e);
+    if (eol > line && eol[-1] == '\r')
+        eol--;
+    return std::string(line + std::min<std::ptrdiff_t>(7, eol - line), eol);
+}
+
+/* Parses the token as atof() does. Decimal numbers with at most 15 significant
+ * digits and a power of ten that is exactly representable are converted with a
+ * single correctly rounded operation, which gives the same value of strtod();
+ * other numbers fall back to strtod() */
+static double ParseDouble(const OBJToken& token)
+{
+    static const double powersOf10[] = {
+        1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+    };
+
+    const char *p = token.b;
+    const char *e = token.e;
+
+    bool negative = false;
+    if (p < e && (*p == '+' || *p == '-'))
+        negative = (*p++ == '-');
+
+    uint64_t mantissa = 0;
+    int significantDigits = 0;
+    int exponent = 0;
+    bool digits = false;
+    for (; p < e && *p >= '0' && *p <= '9'; ++p) {
+        digits = true;
+        mantissa = mantissa * 10 + (*p - '0');
+        if (mantissa > 0)
+            significantDigits++;
+    }
+    if (p < e && *p == '.') {
+        for (++p; p < e && *p >= '0' && *p <= '9'; ++p) {
+            digits = true;
+            mantissa = mantissa * 10 + (*p - '0');
+            if (mantissa > 0)
+                significantDigits++;
+            exponent--;
+        }
+    }
+    if (digits && p < e && (*p == 'e' || *p == 'E')) {
+        const char *q = p + 1;
+        bool negativeExponent = false;
+        if (q < e && (*q == '+' || *q == '-'))
+            negativeExponent = (*q++ == '-');
+        if (q < e && *q >= '0' && *q <= '9') {
+            int value = 0;
+            for (; q < e && *q >= '0' && *q <= '9'; ++q)
+                value = std::min(value * 10 + (*q - '0'), 100000);
+            exponent += negativeExponent ? -value : value;
+            p = q;
+        }
+    }
+
+    if (digits && p == e && significantDigits <= 15 && exponent >= -22 && exponent <= 22) {
+        double value = double(mantissa);
+        value = (exponent < 0) ? value / powersOf10[-exponent] : value * powersOf10[exponent];
+        return negative ? -value : value;
+    }
+
+    char buffer[64];
+    std::size_t len = token.e - token.b;
+    if (len < sizeof(buffer)) {
+        std::memcpy(buffer, token.b, len);
+        buffer[len] = 0;
+        return std::strtod(buffer, nullptr);
+    }
+    return std::strtod(std::string(token.b, token.e).c_str(), nullptr);
+}
+
+/* Parses the leading integer of the range as atoi() does */
+static int ParseInt(const char *b, const char *e)
+{
+    const char *p = b;
+    bool negative = false;
+    if (p < e && (*p == '+' || *p == '-'))
+        negative = (*p++ == '-');
+    long long value = 0;
+    for (; p < e && *p >= '0' && *p <= '9'; ++p)
+        value = std::min(value * 10 + (*p - '0'), (long long) INT32_MAX);
+    return int(negative ? -value : value);
+}
+
+/* Same as ImporterOBJ::SplitToken(), returns the zero-based indices of the face
+ * corner token v/t/n (the missing indices are set to 0) */
+static void SplitToken(const OBJToken& token, bool hasNormals, int& vId, int& nId, int& tId)
+{
+    vId = nId = tId = 0;
+
+    const char *firstSep = std::find(token.b, token.e, '/');
+    const char *secondSep = (firstSep == token.e) ? token.e : std::find(firstSep + 1, token.e, '/');
+
+    vId = ParseInt(token.b, firstSep) - 1;
+    if (firstSep != token.e && (secondSep == token.e || firstSep + 1 < secondSep))
+        tId = ParseInt(firstSep + 1, secondSep) - 1;
+    if (secondSep != token.e)
+        nId = ParseInt(secondSep + 1, token.e) - 1;
+    else if (hasNormals)
+        nId = ParseInt(token.b, token.e) - 1;
+}
+
+static void UseMaterial(const std::string& name, const std::vector<Material>& materials, short& index, Color4b& color, int& result)
+{
+    for (unsigned i = 0; i < materials.size(); ++i) {
+        if (materials[i].materialName == name) {
+            const Material& material = materials[i];
+            index = i;
+            color = Color4b((unsigned char) (material.Kd[0] * 255.0), (unsigned char) (material.Kd[1] * 255.0),
+                            (unsigned char) (material.Kd[2] * 255.0), (unsigned char) (material.Tr * 255.0));
+            return;
+        }
+    }
+    index = 0;
+    result = ImporterOBJ::E_MATERIAL_NOT_FOUND;
+}
@@ -0,0 +1,44 @@
+/*******************************************************************************
+    Copyright (c) 2021, Andrea Maggiordomo, Paolo Cignoni and Marco Tarini
+
+    This file is part of TextureDefrag, a reference implementation for
+    the paper ``Texture Defragmentation for Photo-Reconstructed 3D Models''
+    by Andrea Maggiordomo, Paolo Cignoni and Marco Tarini.
+
+    TextureDefrag is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    TextureDefrag is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with TextureDefrag. If not, see <https://www.gnu.org/licenses/>.
+*******************************************************************************/
+
+
+#ifndef OBJ_LOADER_H
+#define OBJ_LOADER_H
+
+class Mesh;
+
+/* Loads a Wavefront OBJ file with a memory-mapped, multi-threaded parser. The
+ * file is split in chunks at line boundaries that are scanned in parallel to
+ * count the elements of each chunk; after a prefix sum of the counts the chunks
+ * are parsed again in parallel, writing vertices, faces and wedge texture
+ * coordinates directly to their final position in the mesh. The material libraries
+ * are read relative to the current directory, as in vcg::tri::io::ImporterOBJ,
+ * and the resulting mesh, loadMask and m.textures match the ones of ImporterOBJ
+ * (the material colors are stored in the face color attribute).
+ * Returns false if the file uses features that the parser does not handle
+ * (polygons with more than 4 vertices, edges, qobj quads, continued lines, ZBrush
+ * vertex colors, more than one material library or materials used before the
+ * library is declared), in which case the mesh is left empty and the file should
+ * be loaded with ImporterOBJ. Otherwise returns true and sets result to an
+ * ImporterOBJ error code. */
+bool LoadOBJ(const char *fileName, Mesh& m, int& loadMask, int& result);
+
+#endif // OBJ_LOADER_H
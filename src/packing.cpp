@@ -25,13 +25,21 @@
 #include "logging.h"
 #include "utils.h"
 #include "mesh_attribute.h"
+#include "memory_budget.h"
+#include "trace.h"
+#include "run_report.h"
+#include "thread_count.h"
+#include "huge_pages.h"
+#include "gpu_placement.h"
 
 #include <vcg/complex/algorithms/outline_support.h>
 #ifdef _OPENMP
 #include <omp.h>
 #endif
 #include <cstdint>
+#include <atomic>
 #include <set>
+#include <unordered_set>
 #include <chrono>
 #include <vcg/space/rasterized_outline2_packer.h>
 #include <wrap/qt/outline2_rasterizer.h>
@@ -41,54 +49,150 @@
 #include <numeric>
 #include <cmath>
 #include <random>
-
-typedef vcg::RasterizedOutline2Packer<float, QtOutline2Rasterizer> RasterizationBasedPacker;
+#include <limits>
+#include <unordered_map>
+#include <cstring>
+
+#include <QFile>
+#include <QSaveFile>
+
+// the occupancy grids of the large containers are backed by huge pages when enabled
+typedef vcg::RasterizedOutline2Packer<float, QtOutline2Rasterizer, HugePageAllocator<uint64_t>> RasterizationBasedPacker;
+
+static int PackContainer(std::vector<Outline2f>& outlines, vcg::Point2i& container, std::vector<vcg::Similarity2f>& transforms,
+                         std::vector<int>& polyToContainer, const RasterizationBasedPacker::Parameters& rpack_params, double packingScale);
+static std::vector<std::vector<unsigned>> PartitionByArea(const std::vector<unsigned>& eligible, const std::vector<double>& chartAreas,
+                                                          const std::vector<double>& capacity);
+static Outline2f SimplifyOutline(const Outline2f& outline, double tolerance);
+
+/* The layout of a packing, the transformations of the charts in the containers
+ * (in packing grid units) and the outline hashes that identify the charts */
+struct PackingLayout {
+    int rotationNum = 0;
+    int gutterWidth = 0;
+    double packingScale = 0;
+    std::vector<vcg::Point2i> containers;
+    std::vector<uint64_t> hashes;
+    std::vector<int> chartContainers;
+    std::vector<vcg::Similarity2f> transforms;
+};
+
+static uint64_t OutlineHash(const Outline2f& outline);
+static bool LoadPackingLayout(const std::string& path, PackingLayout& layout);
+static bool SavePackingLayout(const std::string& path, const PackingLayout& layout);
 
 void SetRasterizerCacheMaxBytes(std::size_t bytes)
 {
     QtOutline2Rasterizer::setCacheMaxBytes(bytes);
 }
 
+static std::atomic<double> rasterizerCacheAutoFraction(0);
+
+void SetRasterizerCacheAutoSize(double fraction)
+{
+    rasterizerCacheAutoFraction = std::max(fraction, 0.0);
+}
+
+/* Resizes the rasterizer cache from the free system memory if the automatic sizing
+ * is enabled. The cache gets the fraction of the free memory plus the bytes it
+ * holds, so that it evicts entries when the free memory drops */
+static void AutoSizeRasterizerCache(bool log)
+{
+    double fraction = rasterizerCacheAutoFraction;
+    if (fraction <= 0)
+        return;
+    long long available = SystemAvailableBytes();
+    if (available < 0)
+        return;
+    const QtOutline2Rasterizer::CacheStats s = QtOutline2Rasterizer::statsSnapshot(false);
+    std::size_t maxBytes = std::max<std::size_t>(std::size_t((available + s.bytesCurrent) * fraction), 1);
+    if (maxBytes == s.bytesMax)
+        return;
+    if (log)
+        LOG_INFO << "Packing rasterization cache budget set to " << (maxBytes / (1024.0 * 1024.0 * 1024.0)) << " GB ("
+                 << (available / (1024.0 * 1024.0 * 1024.0)) << " GB of system memory free)";
+    else if (maxBytes < s.bytesMax)
+        LOG_VERBOSE << "Packing rasterization cache budget reduced to " << maxBytes << " bytes by the free system memory";
+    QtOutline2Rasterizer::setCacheMaxBytes(maxBytes);
+}
+
+bool SetRasterizerDiskCache(const std::string& dir, std::size_t maxBytes)
+{
+    return QtOutline2Rasterizer::setDiskCache(dir, maxBytes);
+}
+
+/* The counters of the rasterizer cache are process wide, a packing run reports the
+ * difference from the snapshot taken when it started instead of resetting them,
+ * so that concurrent runs do not clear each other's counters */
+static QtOutline2Rasterizer::CacheStats CacheStatsSince(const QtOutline2Rasterizer::CacheStats& start)
+{
+    QtOutline2Rasterizer::CacheStats s = QtOutline2Rasterizer::statsSnapshot(false);
+    s.calls -= start.calls;
+    s.hits -= start.hits;
+    s.misses -= start.misses;
+    s.inserts -= start.inserts;
+    s.evictions -= start.evictions;
+    s.diskHits -= start.diskHits;
+    s.diskWrites -= start.diskWrites;
+    s.diskEvictions -= start.diskEvictions;
+    s.t_lookup_s -= start.t_lookup_s;
+    s.t_miss_raster_s -= start.t_miss_raster_s;
+    s.t_hit_copy_s -= start.t_hit_copy_s;
+    s.t_rotate_s -= start.t_rotate_s;
+    s.t_total_s -= start.t_total_s;
+    return s;
+}
+
 
 int Pack(const std::vector<ChartHandle>& charts, TextureObjectHandle textureObject, std::vector<TextureSize>& texszVec, const struct AlgoParameters& params, const std::map<ChartHandle, int>& anchorMap)
 {
-    using Packer = RasterizedOutline2Packer<float, QtOutline2Rasterizer>;
+    TRACE_SCOPE_CAT("Pack", "packing");
+    ScopedThreadCount packingThreads(params.packingThreads);
+    using Packer = RasterizationBasedPacker;
     auto rpack_params = Packer::Parameters();
     
-    // Reset rasterizer cache stats for this packing run
-    QtOutline2Rasterizer::statsSnapshot(true);
+    // Snapshot the rasterizer cache stats for this packing run, and shrink the cache
+    // to half of what is left of the global memory budget
+    AutoSizeRasterizerCache(true);
+    const QtOutline2Rasterizer::CacheStats cacheStatsStart = QtOutline2Rasterizer::statsSnapshot(false);
+    {
+        const auto& s = cacheStatsStart;
+        MemorySet(MemorySubsystem::Packing, s.bytesCurrent);
+        std::size_t maxBytes = MemoryBudgetLimit(s.bytesMax, 0.5, s.bytesCurrent);
+        if (maxBytes < s.bytesMax) {
+            LOG_INFO << "Packing rasterization cache budget reduced to " << maxBytes << " bytes by the memory budget";
+            QtOutline2Rasterizer::setCacheMaxBytes(maxBytes);
+        }
+    }
     
     // Pack the atlas
 
     texszVec.clear();
 
-    std::vector<Outline2f> outlines;
-    outlines.reserve(charts.size());
-    std::vector<float> chartScaleMul;
-    chartScaleMul.reserve(charts.size());
-    std::vector<double> chartAreasOriginal;
-    chartAreasOriginal.reserve(charts.size());
+    const int numCharts = (int) charts.size();
+    std::vector<Outline2f> outlines(numCharts);
+    std::vector<float> chartScaleMul(numCharts);
+    std::vector<double> chartAreasOriginal(numCharts);
+    std::vector<double> chartAreas(numCharts); // absolute UV area after the per-chart scaling
+    std::vector<uint64_t> outlineHashes(numCharts);
 
-    for (auto c : charts) {
+    // the extraction only reads the faces of its chart, so the charts are processed in parallel
+    #pragma omp parallel for schedule(dynamic, 16)
+    for (int i = 0; i < numCharts; ++i) {
         // Determine per-chart scale: 1.0 for 1:1 copy (present in anchorMap), sqrt(2) for resampled charts
-        float mul = (anchorMap.find(c) != anchorMap.end()) ? 1.0f : static_cast<float>(std::sqrt(2.0));
-        chartScaleMul.push_back(mul);
+        float mul = (anchorMap.find(charts[i]) != anchorMap.end()) ? 1.0f : static_cast<float>(std::sqrt(2.0));
+        chartScaleMul[i] = mul;
         // Save the outline of the parameterization for this portion of the mesh and apply per-chart scaling
-        Outline2f outline = ExtractOutline2f(*c);
+        Outline2f outline = ExtractOutline2f(*charts[i]);
         // Track original area before scaling
-        double originalAreaAbs = std::abs(vcg::tri::OutlineUtil<float>::Outline2Area(outline));
-        chartAreasOriginal.push_back(originalAreaAbs);
+        chartAreasOriginal[i] = std::abs(vcg::tri::OutlineUtil<float>::Outline2Area(outline));
+        chartAreas[i] = chartAreasOriginal[i] * double(mul) * double(mul);
         for (auto &p : outline) {
             p.X() *= mul;
             p.Y() *= mul;
         }
-        outlines.push_back(outline);
-    }
-
-    // Precompute per-chart absolute UV area (after per-chart scaling)
-    std::vector<double> chartAreas(outlines.size(), 0.0);
-    for (size_t i = 0; i < outlines.size(); ++i) {
-        chartAreas[i] = std::abs(vcg::tri::OutlineUtil<float>::Outline2Area(outlines[i]));
+        outlineHashes[i] = OutlineHash(outline);
+        outlines[i] = std::move(outline);
     }
 
     int packingSize = 16384;
@@ -99,6 +203,7 @@ int Pack(const std::vector<ChartHandle>& charts, TextureObjectHandle textureObje
         vcg::Point2i container(packingSize * rs.first, packingSize * rs.second);
         containerVec.push_back(container);
     }
+    const bool tiled = (params.tileSize > 0);
 
     // compute the scale factor for the packing
     int packingArea = 0;
@@ -138,11 +243,93 @@ int Pack(const std::vector<ChartHandle>& charts, TextureObjectHandle textureObje
     rpack_params.costFunction = Packer::Parameters::LowestHorizon;
     rpack_params.doubleHorizon = false;
     rpack_params.innerHorizon = false;
-    //rpack_params.permutations = false;
-    rpack_params.permutations = (charts.size() < 50);
+    // The random permutation trials run concurrently, each on its own packing fields.
+    // Small atlases try the default number of permutations, medium ones a single
+    // round of one trial per thread (the first thread packs the area ordering), or
+    // a fixed number of trials in deterministic mode
+    const int DETERMINISTIC_PERMUTATION_TRIALS = 7;
+    const unsigned DETERMINISTIC_SEED = 5489u;
+    const std::size_t PERMUTATION_SMALL_ATLAS_CHARTS = 50;
+    const std::size_t PERMUTATION_MAX_CHARTS = 500;
+    rpack_params.permutationThreads = 0;
+    rpack_params.permutationSeed = params.deterministic ? DETERMINISTIC_SEED : 0;
+    if (charts.size() < PERMUTATION_SMALL_ATLAS_CHARTS) {
+        rpack_params.permutations = true;
+    } else {
+        rpack_params.permutationTrials = params.deterministic ? DETERMINISTIC_PERMUTATION_TRIALS : omp_get_max_threads() - 1;
+        rpack_params.permutations = (charts.size() < PERMUTATION_MAX_CHARTS && rpack_params.permutationTrials > 0);
+    }
     rpack_params.rotationNum = params.rotationNum;
     rpack_params.gutterWidth = 4;
     rpack_params.minmax = false; // not used
+    rpack_params.rasterizationLookAhead = 2;
+    rpack_params.hierarchicalSearch = params.hierarchicalPacking;
+
+    // The GPU evaluator is used by the packings run on this thread, the others (such
+    // as the permutation trials) search the placements on the CPU
+    std::unique_ptr<GPUPlacementEvaluator> placementEvaluator;
+    if (params.gpuPacking) {
+        placementEvaluator = CreateGPUPlacementEvaluator();
+        if (placementEvaluator)
+            LOG_INFO << "Evaluating the chart placements on the GPU";
+        else
+            LOG_WARN << "No OpenGL 4.3 context current, the chart placements are evaluated on the CPU";
+    }
+    rpack_params.placementEvaluator = placementEvaluator.get();
+
+    // A previous layout is reused at its packing scale, so that the unchanged charts get
+    // the same simplified outlines and rasterizations, and keep their placements
+    PackingLayout previousLayout;
+    bool reuseLayout = false;
+    if (!params.packingLayoutFile.empty() && LoadPackingLayout(params.packingLayoutFile, previousLayout)) {
+        if (previousLayout.rotationNum != rpack_params.rotationNum || previousLayout.gutterWidth != rpack_params.gutterWidth) {
+            LOG_WARN << "Ignoring the packing layout " << params.packingLayoutFile << ", computed with different packing parameters";
+        } else {
+            reuseLayout = true;
+            packingScale = previousLayout.packingScale;
+            LOG_INFO << "[DIAG] Packing scale factor of the packing layout " << params.packingLayoutFile << ": " << packingScale;
+        }
+    }
+
+    // With fixed size tiles every container is a tile at the packing scale, so the
+    // sheets never exceed the tile size whatever the size of the atlas
+    vcg::Point2i defaultContainer(packingSize, packingSize);
+    if (tiled) {
+        // the resolution of the tiles does not depend on the packing scale, which only
+        // has to keep the tiles within the size of the packing grids
+        if (!reuseLayout && params.tileSize * packingScale > packingSize)
+            packingScale = double(packingSize) / params.tileSize;
+        int side = std::max(1, (int) std::floor(params.tileSize * packingScale));
+        defaultContainer = vcg::Point2i(side, side);
+        containerVec.assign(containerVec.size(), defaultContainer);
+        LOG_INFO << "[DIAG] Packing into tiles of " << params.tileSize << "x" << params.tileSize << " pixels (" << side << "x" << side << " at the packing scale)";
+    }
+
+    // Simplify the outlines once, every rasterization and cache lookup walks all their
+    // vertices. The simplified outlines enclose the original ones and are at most a
+    // quarter of the gutter (in packing pixels) larger. The sizes of their bounding
+    // boxes are stored for the eligibility tests of the container loops
+    std::vector<float> outlineDimX(numCharts, 0);
+    std::vector<float> outlineDimY(numCharts, 0);
+    {
+        const double tolerance = 0.25 * rpack_params.gutterWidth / packingScale;
+        std::size_t verticesBefore = 0;
+        std::size_t verticesAfter = 0;
+        #pragma omp parallel for schedule(dynamic, 16) reduction(+:verticesBefore, verticesAfter)
+        for (int i = 0; i < numCharts; ++i) {
+            verticesBefore += outlines[i].size();
+            outlines[i] = SimplifyOutline(outlines[i], tolerance);
+            verticesAfter += outlines[i].size();
+            vcg::Box2f bbox;
+            for (const auto& p : outlines[i])
+                bbox.Add(p);
+            outlineDimX[i] = bbox.DimX();
+            outlineDimY[i] = bbox.DimY();
+        }
+        LOG_INFO << "[DIAG] Outlines simplified from " << verticesBefore << " to " << verticesAfter << " vertices (tolerance " << tolerance << ")";
+        ReportAdd("packing/profile", "outline_vertices_input", verticesBefore);
+        ReportAdd("packing/profile", "outline_vertices", verticesAfter);
+    }
 
     int totPacked = 0;
 
@@ -150,14 +337,14 @@ int Pack(const std::vector<ChartHandle>& charts, TextureObjectHandle textureObje
 
     std::vector<vcg::Similarity2f> packingTransforms(outlines.size(), vcg::Similarity2f{});
 
+    std::mt19937 subsetRng(params.deterministic ? DETERMINISTIC_SEED : std::random_device{}());
     auto selectSubset = [&](const std::vector<unsigned>& eligible,
                             double targetUVArea) -> std::vector<unsigned> {
         if (eligible.empty()) return {};
 
         // Randomly shuffle eligible charts to obtain a representative subset
         std::vector<unsigned> indices = eligible;
-        static thread_local std::mt19937 rng(std::random_device{}());
-        std::shuffle(indices.begin(), indices.end(), rng);
+        std::shuffle(indices.begin(), indices.end(), subsetRng);
 
         std::vector<unsigned> selected;
         selected.reserve(indices.size());
@@ -178,10 +365,221 @@ int Pack(const std::vector<ChartHandle>& charts, TextureObjectHandle textureObje
         return selected;
     };
 
+    // Returns -1 if the chart can be packed, otherwise the (negative) code used
+    // to mark the chart as skipped
+    auto checkPackable = [&](unsigned origIdx) -> int {
+        const float QIMAGE_MAX_DIM = 32766.0f; // QImage limit is 32767
+
+        if (outlines[origIdx].empty()) {
+            LOG_WARN << "[DIAG] Skipping empty outline for original chart index " << origIdx;
+            return -2; // Mark as skipped
+        }
+
+        const float dimX = outlineDimX[origIdx];
+        const float dimY = outlineDimY[origIdx];
+        if (!std::isfinite(dimX) || !std::isfinite(dimY) || dimX < 0 || dimY < 0) {
+            LOG_WARN << "[DIAG] Skipping chart with original index " << origIdx
+                     << " due to invalid/non-finite UV bounding box. This chart will not be packed.";
+            return -4; // Mark as skipped due to invalid bbox
+        }
+
+        float w = dimX * packingScale;
+        float h = dimY * packingScale;
+        float diagonal = std::sqrt(w * w + h * h);
+
+        // the charts that do not fit in a tile are scaled down into a tile of their own
+        // by the fallback below
+        if (tiled && (w + 2 * rpack_params.gutterWidth > defaultContainer.X() || h + 2 * rpack_params.gutterWidth > defaultContainer.Y()))
+            return -5;
+
+        if (diagonal > QIMAGE_MAX_DIM) {
+            LOG_WARN << "[DIAG] Skipping chart with original index " << origIdx
+                     << " because its scaled diagonal (" << diagonal
+                     << ") exceeds QImage limits. This chart will not be packed.";
+            return -3; // Mark as skipped due to size
+        }
+
+        return -1;
+    };
+
     unsigned nc = 0; // current container index
+
+    // Reuse the previous layout: the charts with the outline of a chart of the layout are
+    // placed where they were, and the space left in the containers of the layout is filled
+    // with the other charts. The charts still unpacked go through the loops below
+    if (reuseLayout) {
+        std::unordered_map<uint64_t, std::vector<int>> layoutCharts;
+        for (int k = (int) previousLayout.hashes.size() - 1; k >= 0; --k)
+            layoutCharts[previousLayout.hashes[k]].push_back(k);
+
+        std::vector<int> layoutIndex(numCharts, -1);
+        std::vector<std::vector<unsigned>> fixedCharts(previousLayout.containers.size());
+        std::vector<unsigned> eligible;
+        int numUnchanged = 0;
+        for (int i = 0; i < numCharts; ++i) {
+            int skipCode = checkPackable(i);
+            if (skipCode != -1) {
+                containerIndices[i] = skipCode;
+                totPacked++;
+                continue;
+            }
+            auto it = layoutCharts.find(outlineHashes[i]);
+            if (it != layoutCharts.end() && !it->second.empty()) {
+                layoutIndex[i] = it->second.back();
+                it->second.pop_back();
+                fixedCharts[previousLayout.chartContainers[layoutIndex[i]]].push_back(i);
+                numUnchanged++;
+            } else {
+                eligible.push_back(i);
+            }
+        }
+        LOG_INFO << "[DIAG] Packing layout " << params.packingLayoutFile << ": " << numUnchanged << " of " << numCharts << " charts unchanged";
+
+        std::vector<vcg::RasterizedOutline2> polyVec;
+        int numKept = 0;
+        for (unsigned k = 0; k < previousLayout.containers.size(); ++k) {
+            // the charts of the containers that are not tiles of the current size are packed again
+            if (fixedCharts[k].empty() || (tiled && previousLayout.containers[k] != defaultContainer))
+                continue;
+
+            const vcg::Point2i containerSize = previousLayout.containers[k];
+            double freeUVArea = double(containerSize.X()) * double(containerSize.Y()) / (packingScale * packingScale);
+            for (unsigned i : fixedCharts[k])
+                freeUVArea -= chartAreas[i];
+
+            std::vector<unsigned> containerCharts = fixedCharts[k];
+            std::vector<Packer::FixedPlacement> fixed(containerCharts.size());
+            for (unsigned j = 0; j < containerCharts.size(); ++j) {
+                fixed[j].container = 0;
+                fixed[j].tr = previousLayout.transforms[layoutIndex[containerCharts[j]]];
+            }
+            if (freeUVArea > 0) {
+                for (unsigned i : selectSubset(eligible, 5 * freeUVArea)) {
+                    containerCharts.push_back(i);
+                    fixed.push_back(Packer::FixedPlacement());
+                }
+            }
+
+            std::vector<Outline2f> containerOutlines;
+            for (unsigned i : containerCharts)
+                containerOutlines.push_back(outlines[i]);
+
+            std::vector<vcg::Similarity2f> transforms;
+            std::vector<int> polyToContainer;
+            polyVec.clear();
+            int n = Packer::PackBestEffortAtScale(containerOutlines, {containerSize}, transforms, polyToContainer, rpack_params, packingScale, polyVec, nullptr, &fixed);
+            if (n == 0)
+                continue;
+
+            if (nc >= containerVec.size())
+                containerVec.push_back(containerSize);
+            else
+                containerVec[nc] = containerSize;
+            double textureScale = 1.0 / packingScale;
+            texszVec.push_back(tiled ? TextureSize{params.tileSize, params.tileSize} : TextureSize{(int) (containerSize.X() * textureScale), (int) (containerSize.Y() * textureScale)});
+            for (unsigned j = 0; j < containerCharts.size(); ++j) {
+                if (polyToContainer[j] != -1) {
+                    unsigned i = containerCharts[j];
+                    containerIndices[i] = nc;
+                    packingTransforms[i] = transforms[j];
+                    if (fixed[j].container != -1 && transforms[j].tra == fixed[j].tr.tra)
+                        numKept++;
+                }
+            }
+            eligible.erase(std::remove_if(eligible.begin(), eligible.end(), [&](unsigned i) { return containerIndices[i] != -1; }), eligible.end());
+            totPacked += n;
+            nc++;
+        }
+
+        LOG_INFO << "[DIAG] Packing layout reused: " << numKept << " charts kept their placement in " << nc << " containers, "
+                 << (charts.size() - totPacked) << " charts left to pack";
+        ReportValue("packing", "layout_unchanged_charts", numUnchanged);
+        ReportValue("packing", "layout_kept_charts", numKept);
+    }
+
+    if (params.parallelPacking) {
+        // Pre-partition the charts by area into per-container buckets, and pack
+        // each container on its own thread. Charts that do not fit in their
+        // bucket are left to the sequential loop below, that packs them into
+        // additional containers
+        std::vector<unsigned> eligible;
+        double eligibleArea = 0;
+        for (unsigned i = 0; i < containerIndices.size(); ++i) {
+            if (containerIndices[i] != -1)
+                continue;
+            int skipCode = checkPackable(i);
+            if (skipCode != -1) {
+                containerIndices[i] = skipCode;
+                totPacked++;
+            } else {
+                eligible.push_back(i);
+                eligibleArea += chartAreas[i];
+            }
+        }
+
+        // estimate the number of containers from the expected packing efficiency
+        const double PARALLEL_PACKING_FILL = 0.8;
+        std::vector<vcg::Point2i> bucketContainers;
+        std::vector<double> capacity;
+        double totalCapacity = 0;
+        while (totalCapacity < eligibleArea) {
+            vcg::Point2i container = (bucketContainers.size() < containerVec.size()) ? containerVec[bucketContainers.size()] : defaultContainer;
+            double c = PARALLEL_PACKING_FILL * (double(container.X()) * double(container.Y())) / (packingScale * packingScale);
+            bucketContainers.push_back(container);
+            capacity.push_back(c);
+            totalCapacity += c;
+        }
+
+        if (bucketContainers.size() > 1) {
+            std::vector<std::vector<unsigned>> buckets = PartitionByArea(eligible, chartAreas, capacity);
+            int nb = (int) buckets.size();
+
+            LOG_INFO << "[DIAG] Packing " << eligible.size() << " charts into " << nb << " containers in parallel";
+
+            std::vector<std::vector<vcg::Similarity2f>> bucketTransforms(nb);
+            std::vector<std::vector<int>> bucketPolyToContainer(nb);
+            std::vector<int> bucketPacked(nb, 0);
+
+            #pragma omp parallel for schedule(dynamic, 1)
+            for (int k = 0; k < nb; ++k) {
+                if (buckets[k].empty())
+                    continue;
+                std::vector<Outline2f> bucketOutlines;
+                for (unsigned idx : buckets[k])
+                    bucketOutlines.push_back(outlines[idx]);
+                bucketPacked[k] = PackContainer(bucketOutlines, bucketContainers[k], bucketTransforms[k], bucketPolyToContainer[k], rpack_params, packingScale);
+            }
+
+            // commit the containers in order
+            for (int k = 0; k < nb; ++k) {
+                if (bucketPacked[k] == 0)
+                    continue;
+                if (nc >= containerVec.size())
+                    containerVec.push_back(bucketContainers[k]);
+                else
+                    containerVec[nc] = bucketContainers[k];
+                double textureScale = 1.0 / packingScale;
+                texszVec.push_back(tiled ? TextureSize{params.tileSize, params.tileSize} : TextureSize{(int) (containerVec[nc].X() * textureScale), (int) (containerVec[nc].Y() * textureScale)});
+                for (unsigned i = 0; i < buckets[k].size(); ++i) {
+                    if (bucketPolyToContainer[k][i] != -1) {
+                        int outlineInd = buckets[k][i];
+                        ensure(containerIndices[outlineInd] == -1);
+                        containerIndices[outlineInd] = nc;
+                        packingTransforms[outlineInd] = bucketTransforms[k][i];
+                    }
+                }
+                totPacked += bucketPacked[k];
+                nc++;
+            }
+
+            LOG_INFO << "[DIAG] Parallel packing placed " << totPacked << " charts into " << nc << " containers, "
+                     << (charts.size() - totPacked) << " charts left for the final pass";
+        }
+    }
+
     while (totPacked < (int) charts.size()) {
         if (nc >= containerVec.size())
-            containerVec.push_back(vcg::Point2i(packingSize, packingSize));
+            containerVec.push_back(defaultContainer);
 
         // Build list of yet-unpacked chart indices
         std::vector<unsigned> pending;
@@ -194,38 +592,13 @@ int Pack(const std::vector<ChartHandle>& charts, TextureObjectHandle textureObje
         if (pending.empty())
             break;
 
-        const float QIMAGE_MAX_DIM = 32766.0f; // QImage limit is 32767
         std::vector<unsigned> eligible;
         eligible.reserve(pending.size());
 
         for(unsigned origIdx : pending) {
-            if (outlines[origIdx].empty()) {
-                LOG_WARN << "[DIAG] Skipping empty outline for original chart index " << origIdx;
-                containerIndices[origIdx] = -2; // Mark as skipped
-                totPacked++;
-                continue;
-            }
-
-            vcg::Box2f bbox;
-            for(const auto& p : outlines[origIdx]) bbox.Add(p);
-
-            if (!std::isfinite(bbox.DimX()) || !std::isfinite(bbox.DimY()) || bbox.DimX() < 0 || bbox.DimY() < 0) {
-                LOG_WARN << "[DIAG] Skipping chart with original index " << origIdx
-                         << " due to invalid/non-finite UV bounding box. This chart will not be packed.";
-                containerIndices[origIdx] = -4; // Mark as skipped due to invalid bbox
-                totPacked++;
-                continue;
-            }
-
-            float w = bbox.DimX() * packingScale;
-            float h = bbox.DimY() * packingScale;
-            float diagonal = std::sqrt(w * w + h * h);
-
-            if (diagonal > QIMAGE_MAX_DIM) {
-                LOG_WARN << "[DIAG] Skipping chart with original index " << origIdx
-                         << " because its scaled diagonal (" << diagonal
-                         << ") exceeds QImage limits. This chart will not be packed.";
-                containerIndices[origIdx] = -3; // Mark as skipped due to size
+            int skipCode = checkPackable(origIdx);
+            if (skipCode != -1) {
+                containerIndices[origIdx] = skipCode;
                 totPacked++;
                 continue;
             }
@@ -271,37 +644,9 @@ int Pack(const std::vector<ChartHandle>& charts, TextureObjectHandle textureObje
             LOG_INFO << "[DIAG] Largest chart in this packing batch is index " << original_batch_idx
                      << " with UV area " << chartAreas[original_batch_idx];
         }
-        const int MAX_SIZE = 20000;
         std::vector<vcg::Similarity2f> transforms;
         std::vector<int> polyToContainer;
-        int n = 0;
-        int packAttempts = 0;
-        const int MAX_PACK_ATTEMPTS = 50;
-        do {
-            if (++packAttempts > MAX_PACK_ATTEMPTS) {
-                LOG_ERR << "[DIAG] FATAL: Packing loop exceeded " << MAX_PACK_ATTEMPTS << " attempts. Aborting.";
-                LOG_ERR << "[DIAG] This likely indicates an un-packable chart or runaway logic.";
-                LOG_ERR << "[DIAG] Current target grid size: " << containerVec[nc].X() << "x" << containerVec[nc].Y();
-                std::exit(-1);
-            }
-            transforms.clear();
-            polyToContainer.clear();
-            LOG_INFO << "Packing " << outlines_iter.size() << " charts into grid of size " << containerVec[nc].X() << " " << containerVec[nc].Y() << " (Attempt " << packAttempts << ")";
-            n = RasterizationBasedPacker::PackBestEffortAtScale(outlines_iter, {containerVec[nc]}, transforms, polyToContainer, rpack_params, packingScale);
-            LOG_INFO << "[DIAG] Packing attempt finished. Charts packed: " << n << ".";
-            const auto& prof = RasterizationBasedPacker::LastProfile();
-            LOG_INFO << "[PACK-PROF] polys=" << prof.polys_considered
-                     << " placed=" << prof.placed_count << " not_placed=" << prof.not_placed_count
-                     << " rasterize=" << prof.rasterize_s << "s (" << prof.rasterize_calls << " calls)"
-                     << " candY(b/e)=" << prof.candidateY_build_s << "/" << prof.evaluate_drop_y_s << "s cols=" << prof.candidateY_cols_evaluated
-                     << " candX(b/e)=" << prof.candidateX_build_s << "/" << prof.evaluate_drop_x_s << "s rows=" << prof.candidateX_rows_evaluated
-                     << " place=" << prof.place_s << "s trans=" << prof.transform_s << "s total=" << prof.total_s << "s";
-            if (n == 0 && !outlines_iter.empty()) {
-                LOG_WARN << "[DIAG] Failed to pack any of the " << outlines_iter.size() << " charts in this batch.";
-                containerVec[nc].X() *= 1.1;
-                containerVec[nc].Y() *= 1.1;
-            }
-        } while (n == 0 && !outlines_iter.empty() && containerVec[nc].X() <= MAX_SIZE && containerVec[nc].Y() <= MAX_SIZE);
+        int n = PackContainer(outlines_iter, containerVec[nc], transforms, polyToContainer, rpack_params, packingScale);
 
         if (n > 0) totPacked += n;
 
@@ -309,7 +654,7 @@ int Pack(const std::vector<ChartHandle>& charts, TextureObjectHandle textureObje
             break;
         else {
             double textureScale = 1.0 / packingScale;
-            texszVec.push_back({(int) (containerVec[nc].X() * textureScale), (int) (containerVec[nc].Y() * textureScale)});
+            texszVec.push_back(tiled ? TextureSize{params.tileSize, params.tileSize} : TextureSize{(int) (containerVec[nc].X() * textureScale), (int) (containerVec[nc].Y() * textureScale)});
             for (unsigned i = 0; i < outlines_iter.size(); ++i) {
                 if (polyToContainer[i] != -1) {
                     ensure(polyToContainer[i] == 0); // We only use a single container
@@ -335,105 +680,163 @@ int Pack(const std::vector<ChartHandle>& charts, TextureObjectHandle textureObje
         return v;
     };
     
-    // Handle any remaining unpacked charts by giving them individual containers
+    // the fallback containers below do not use the packing scale, they are not part of the layout
+    const unsigned layoutContainers = nc;
+
+    // Handle any remaining unpacked charts. The small ones are packed together into
+    // shared sheets, the others get individual containers
     std::vector<unsigned> remainingUnpacked;
     for (unsigned ci = 0; ci < charts.size(); ++ci) {
+        if (containerIndices[ci] == -5) {
+            // larger than a tile, counted as skipped by the loops above
+            containerIndices[ci] = -1;
+            totPacked--;
+        }
         if (containerIndices[ci] == -1) {
             remainingUnpacked.push_back(ci);
         }
     }
-    
+
     if (!remainingUnpacked.empty()) {
-        LOG_INFO << "[DIAG] Creating individual containers for " << remainingUnpacked.size() << " unpacked charts.";
-        
+        LOG_INFO << "[DIAG] Creating fallback containers for " << remainingUnpacked.size() << " unpacked charts.";
+
+        // The fallback containers hold the outlines at their texture resolution (no packing scale)
+        const int padding = 2 * rpack_params.gutterWidth;
+        const int MAX_QIMAGE_SIZE = 32767;
+        const int SHARED_SHEET_MAX_SIZE = tiled ? params.tileSize : 4096;
+        const double SHARED_SHEET_FILL = 0.5;
+
+        auto commitContainer = [&](vcg::Point2i size, TextureSize tsz) {
+            if (nc >= containerVec.size())
+                containerVec.push_back(size);
+            else
+                containerVec[nc] = size;
+            texszVec.push_back(tsz);
+            nc++;
+        };
+
+        // charts that fit in a quarter of the side of the largest sheet are shared
+        std::vector<unsigned> sharedCharts;
+        std::vector<unsigned> individualCharts;
+        double sharedArea = 0;
+        int sharedMaxSide = 0;
         for (unsigned ci : remainingUnpacked) {
-            float mul = chartScaleMul[ci];
-            ChartHandle chartptr = charts[ci];
-            auto outline = ExtractOutline2d(*chartptr);
-            
-            // Compute bounding box of the outline
-            vcg::Box2d bb;
-            for (const auto& p : outline) {
+            int side = (int) std::ceil(std::max(outlineDimX[ci], outlineDimY[ci])) + padding;
+            if (side <= SHARED_SHEET_MAX_SIZE / 4) {
+                sharedCharts.push_back(ci);
+                sharedArea += double(outlineDimX[ci] + padding) * double(outlineDimY[ci] + padding);
+                sharedMaxSide = std::max(sharedMaxSide, side);
+            } else {
+                individualCharts.push_back(ci);
+            }
+        }
+
+        while (sharedCharts.size() > 1) {
+            int sheetSize = roundUpToPowerOfTwo(std::max(sharedMaxSide, (int) std::ceil(std::sqrt(sharedArea / SHARED_SHEET_FILL))));
+            sheetSize = tiled ? params.tileSize : std::min(sheetSize, SHARED_SHEET_MAX_SIZE);
+
+            std::vector<Outline2f> sheetOutlines;
+            for (unsigned ci : sharedCharts)
+                sheetOutlines.push_back(outlines[ci]);
+            std::vector<vcg::Similarity2f> sheetTransforms;
+            std::vector<int> sheetPolyToContainer;
+            int n = Packer::PackBestEffortAtScale(sheetOutlines, {vcg::Point2i(sheetSize, sheetSize)}, sheetTransforms, sheetPolyToContainer, rpack_params, 1.0f);
+            if (n == 0)
+                break;
+
+            LOG_INFO << "[DIAG] Packed " << n << " unpacked charts into shared container " << nc
+                     << " of size " << sheetSize << "x" << sheetSize;
+
+            std::vector<unsigned> left;
+            sharedArea = 0;
+            sharedMaxSide = 0;
+            for (unsigned k = 0; k < sharedCharts.size(); ++k) {
+                unsigned ci = sharedCharts[k];
+                if (sheetPolyToContainer[k] != -1) {
+                    containerIndices[ci] = nc;
+                    packingTransforms[ci] = sheetTransforms[k];
+                } else {
+                    left.push_back(ci);
+                    sharedArea += double(outlineDimX[ci] + padding) * double(outlineDimY[ci] + padding);
+                    sharedMaxSide = std::max(sharedMaxSide, (int) std::ceil(std::max(outlineDimX[ci], outlineDimY[ci])) + padding);
+                }
+            }
+            commitContainer(vcg::Point2i(sheetSize, sheetSize), {sheetSize, sheetSize});
+            totPacked += n;
+            sharedCharts = left;
+        }
+        individualCharts.insert(individualCharts.end(), sharedCharts.begin(), sharedCharts.end());
+
+        // A single chart is fitted directly: its bounding box (plus the padding) is
+        // scaled down only if the container exceeds the QImage limits
+        for (unsigned ci : individualCharts) {
+            vcg::Box2f bb;
+            for (const auto& p : outlines[ci])
                 bb.Add(p);
+
+            int requiredWidth = std::min(roundUpToPowerOfTwo((int) std::ceil(bb.DimX()) + padding), MAX_QIMAGE_SIZE);
+            int requiredHeight = std::min(roundUpToPowerOfTwo((int) std::ceil(bb.DimY()) + padding), MAX_QIMAGE_SIZE);
+            if (tiled) {
+                requiredWidth = params.tileSize;
+                requiredHeight = params.tileSize;
             }
-            
-            // Calculate container size based on bounding box and per-chart scale
-            int padding = 8; // 8 pixel padding
-            int requiredWidth = (int)std::ceil(bb.DimX() * mul) + padding;
-            int requiredHeight = (int)std::ceil(bb.DimY() * mul) + padding;
-            
-            // Round up to nearest power of two
-            requiredWidth = roundUpToPowerOfTwo(requiredWidth);
-            requiredHeight = roundUpToPowerOfTwo(requiredHeight);
-            
-            // Respect QImage's 32767 pixel limit
-            const int MAX_QIMAGE_SIZE = 32767;
-            requiredWidth = std::min(requiredWidth, MAX_QIMAGE_SIZE);
-            requiredHeight = std::min(requiredHeight, MAX_QIMAGE_SIZE);
-            
-            // Create a new container for this chart
-            vcg::Point2i containerSize(requiredWidth, requiredHeight);
-            
-            LOG_INFO << "[DIAG] Creating container " << requiredWidth << "x" << requiredHeight 
-                     << " for chart " << ci << " (BB: " << bb.DimX() << "x" << bb.DimY() << ")";
-            
-            // Pack just this single chart into its dedicated container
-            std::vector<std::vector<vcg::Point2f>> singleOutlineVec;
-            singleOutlineVec.emplace_back();
-            singleOutlineVec.back().reserve(outline.size());
-            for (const auto &p : outline) {
-                singleOutlineVec.back().push_back(vcg::Point2f(static_cast<float>(p.X()*mul), static_cast<float>(p.Y()*mul)));
+
+            float scale = 1.0f;
+            if (bb.DimX() > 0)
+                scale = std::min(scale, (requiredWidth - padding) / bb.DimX());
+            if (bb.DimY() > 0)
+                scale = std::min(scale, (requiredHeight - padding) / bb.DimY());
+
+            if (!(scale > 0) || !std::isfinite(scale)) {
+                LOG_ERR << "[DIAG] Failed to pack chart " << ci << " even in individual container";
+                continue;
             }
- 
-            std::vector<vcg::Similarity2f> singleTrVec;
-            std::vector<int> singlePolyToContainer;
- 
-             // Try to pack at scale 1.0 first
-             bool packSuccess = Packer::PackAtFixedScale(
-                 singleOutlineVec,
-                 {containerSize},
-                 singleTrVec,
-                 singlePolyToContainer,
-                 rpack_params,
-                 1.0
-             );
- 
-             // If it fails at scale 1.0, try with decreasing scales
-             float scale = 1.0;
-             while (!packSuccess && scale > 0.1) {
-                 scale *= 0.9;
-                 packSuccess = Packer::PackAtFixedScale(
-                     singleOutlineVec,
-                     {containerSize},
-                     singleTrVec,
-                     singlePolyToContainer,
-                     rpack_params,
-                     scale
-                 );
-             }
- 
-             if (packSuccess && !singlePolyToContainer.empty() && singlePolyToContainer[0] != -1) {
-                 // Successfully packed the chart
-                 containerIndices[ci] = nc; // Assign to the current container index
-                 packingTransforms[ci] = singleTrVec[0];
- 
-                // Create a new texture/atlas for this chart
-                TextureSize tsz;
-                float textureScaleLocal = 1.0f / scale;
-                tsz.w = (int)std::max(1.0f, std::floor(requiredWidth * textureScaleLocal));
-                tsz.h = (int)std::max(1.0f, std::floor(requiredHeight * textureScaleLocal));
-                texszVec.push_back(tsz);
-                containerVec.push_back(containerSize); // Add the container to the list
-                nc++; // Increment container count for next individual container
- 
-                 totPacked++;
- 
-                 LOG_INFO << "[DIAG] Successfully packed chart " << ci << " into individual container " << (nc-1) << " with scale: " << scale;
-             } else {
-                 LOG_ERR << "[DIAG] Failed to pack chart " << ci << " even in individual container";
-             }
-         }
-     }
+
+            vcg::Similarity2f tr;
+            tr.rotRad = 0;
+            tr.sca = scale;
+            tr.tra = vcg::Point2f(0.5f * padding, 0.5f * padding) - bb.min * scale;
+
+            containerIndices[ci] = nc;
+            packingTransforms[ci] = tr;
+
+            // the texture keeps the resolution of the chart if it was scaled down, the
+            // tiles are resampled at the tile size
+            TextureSize tsz;
+            tsz.w = (int) std::max(1.0f, std::floor(requiredWidth / scale));
+            tsz.h = (int) std::max(1.0f, std::floor(requiredHeight / scale));
+            if (tiled) {
+                if (scale < 1.0f)
+                    LOG_WARN << "Chart " << ci << " is larger than a tile, its texture is downscaled by " << scale;
+                tsz = {params.tileSize, params.tileSize};
+            }
+
+            LOG_INFO << "[DIAG] Packed chart " << ci << " into individual container " << nc << " of size "
+                     << requiredWidth << "x" << requiredHeight << " (BB: " << bb.DimX() << "x" << bb.DimY() << ") with scale: " << scale;
+
+            commitContainer(vcg::Point2i(requiredWidth, requiredHeight), tsz);
+            totPacked++;
+        }
+    }
+
+    if (!params.packingLayoutFile.empty()) {
+        PackingLayout layout;
+        layout.rotationNum = rpack_params.rotationNum;
+        layout.gutterWidth = rpack_params.gutterWidth;
+        layout.packingScale = packingScale;
+        layout.containers.assign(containerVec.begin(), containerVec.begin() + layoutContainers);
+        for (int i = 0; i < numCharts; ++i) {
+            if (containerIndices[i] >= 0 && containerIndices[i] < (int) layoutContainers) {
+                layout.hashes.push_back(outlineHashes[i]);
+                layout.chartContainers.push_back(containerIndices[i]);
+                layout.transforms.push_back(packingTransforms[i]);
+            }
+        }
+        if (SavePackingLayout(params.packingLayoutFile, layout))
+            LOG_INFO << "Packing layout of " << layout.hashes.size() << " charts written to " << params.packingLayoutFile;
+        else
+            LOG_WARN << "Unable to write the packing layout " << params.packingLayoutFile;
+    }
 
     for (unsigned i = 0; i < charts.size(); ++i) {
         for (auto fptr : charts[i]->fpVec) {
@@ -468,7 +871,7 @@ int Pack(const std::vector<ChartHandle>& charts, TextureObjectHandle textureObje
 
     // Log rasterizer cache stats for this packing pass
     {
-        auto s = QtOutline2Rasterizer::statsSnapshot(false);
+        auto s = CacheStatsSince(cacheStatsStart);
         long long lookups = static_cast<long long>(s.hits) + static_cast<long long>(s.misses);
         double hitRate = (lookups > 0) ? (double(s.hits) / double(lookups)) : 0.0;
         LOG_INFO << "[PACK-CACHE] lookups=" << lookups
@@ -478,6 +881,26 @@ int Pack(const std::vector<ChartHandle>& charts, TextureObjectHandle textureObje
                  << " inserts=" << s.inserts
                  << " evictions=" << s.evictions
                  << " bytes=" << s.bytesCurrent << "/" << s.bytesMax;
+        MemorySet(MemorySubsystem::Packing, s.bytesCurrent);
+        ReportValue("packing/rasterizer_cache", "lookups", lookups);
+        ReportValue("packing/rasterizer_cache", "hits", s.hits);
+        ReportValue("packing/rasterizer_cache", "misses", s.misses);
+        ReportValue("packing/rasterizer_cache", "hit_rate", hitRate);
+        ReportValue("packing/rasterizer_cache", "inserts", s.inserts);
+        ReportValue("packing/rasterizer_cache", "evictions", s.evictions);
+        ReportValue("packing/rasterizer_cache", "bytes", s.bytesCurrent);
+        ReportValue("packing/rasterizer_cache", "max_bytes", s.bytesMax);
+        ReportValue("packing/rasterizer_cache", "disk_hits", s.diskHits);
+        ReportValue("packing/rasterizer_cache", "disk_writes", s.diskWrites);
+        ReportValue("packing/rasterizer_cache", "disk_evictions", s.diskEvictions);
+        ReportValue("packing/rasterizer_cache", "disk_bytes", s.diskBytesCurrent);
+        ReportValue("packing/rasterizer_cache", "rasterize_s", s.t_total_s);
+        ReportValue("packing/rasterizer_cache", "miss_rasterize_s", s.t_miss_raster_s);
+        if (s.diskBytesMax > 0)
+            LOG_INFO << "[PACK-CACHE] disk hits=" << s.diskHits
+                     << " writes=" << s.diskWrites
+                     << " evictions=" << s.diskEvictions
+                     << " bytes=" << s.diskBytesCurrent << "/" << s.diskBytesMax;
     }
 
     return totPacked;
@@ -500,18 +923,20 @@ Outline2d ExtractOutline2d(FaceGroup& chart)
     std::vector<Outline2d> outline2Vec;
     Outline2d outline;
 
-    for (auto fptr : chart.fpVec)
-        fptr->ClearV();
+    // the faces already traversed are marked locally instead of with the V flag, so that
+    // the outlines of different charts can be extracted concurrently
+    std::unordered_set<const Mesh::FaceType *> visited;
+    visited.reserve(chart.fpVec.size());
 
     for (auto fptr : chart.fpVec) {
         for (int i = 0; i < 3; ++i) {
-            if (!fptr->IsV() && face::IsBorder(*fptr, i)) {
+            if (visited.count(fptr) == 0 && face::IsBorder(*fptr, i)) {
                 face::Pos<Mesh::FaceType> p(fptr, i);
                 face::Pos<Mesh::FaceType> startPos = p;
                 ensure(p.IsBorder());
                 do {
                     ensure(p.IsManifold());
-                    p.F()->SetV();
+                    visited.insert(p.F());
                     vcg::Point2d uv = p.F()->WT(p.VInd()).P();
                     outline.push_back(uv);
                     p.NextB();
@@ -582,7 +1007,10 @@ void IntegerShift(Mesh& m, const std::vector<ChartHandle>& chartsToPack, const s
 
     auto Rotate = [] (vcg::Point2d p, double theta) -> vcg::Point2d { return p.Rotate(theta); };
 
-    for (auto c : chartsToPack) {
+    // the charts do not share vertices, so they are shifted in parallel
+    #pragma omp parallel for schedule(dynamic, 64)
+    for (int ci = 0; ci < (int) chartsToPack.size(); ++ci) {
+        const ChartHandle& c = chartsToPack[ci];
         auto it = anchorMap.find(c);
         if (it != anchorMap.end()) {
             Mesh::FacePointer fptr = &(m.face[it->second]);
@@ -652,3 +1080,361 @@ void IntegerShift(Mesh& m, const std::vector<ChartHandle>& chartsToPack, const s
         }
     }
 }
+
+// -- static functions ---------------------------------------------------------
+
+/* Packs the outlines into the container. If no outline fits, the container is
+ * grown (preserving its aspect ratio) to the smallest size, within 10%, at which
+ * some outline can be packed, using a bracketed search between the container
+ * size (or the size required by the smallest outline area) and MAX_SIZE. The
+ * rasterizations are computed once and shared by all the attempts, since the
+ * scale does not change. Returns the number of outlines packed */
+static int PackContainer(std::vector<Outline2f>& outlines, vcg::Point2i& container, std::vector<vcg::Similarity2f>& transforms,
+                         std::vector<int>& polyToContainer, const RasterizationBasedPacker::Parameters& rpack_params, double packingScale)
+{
+    TRACE_SCOPE_CAT("PackContainer", "packing");
+    const int MAX_SIZE = 20000;
+    const double SEARCH_TOLERANCE = 1.1;
+
+    struct PackAttempt {
+        vcg::Point2i size;
+        int packed;
+        RasterizationBasedPacker::ProfileData prof;
+    };
+
+    std::vector<PackAttempt> attempts;
+    std::vector<vcg::RasterizedOutline2> polyVec;
+
+    const vcg::Point2i baseContainer = container;
+    auto ScaledContainer = [&](double f) -> vcg::Point2i {
+        return vcg::Point2i(int(baseContainer.X() * f), int(baseContainer.Y() * f));
+    };
+
+    auto Attempt = [&](vcg::Point2i size, std::vector<vcg::Similarity2f>& trVec, std::vector<int>& polyToCont) -> int {
+        trVec.clear();
+        polyToCont.clear();
+        LOG_INFO << "Packing " << outlines.size() << " charts into grid of size " << size.X() << " " << size.Y() << " (Attempt " << (attempts.size() + 1) << ")";
+        AutoSizeRasterizerCache(false);
+        RasterizationBasedPacker::ProfileData prof;
+        int np = RasterizationBasedPacker::PackBestEffortAtScale(outlines, {size}, trVec, polyToCont, rpack_params, packingScale, polyVec, &prof);
+        LOG_INFO << "[DIAG] Packing attempt finished. Charts packed: " << np << ".";
+        LOG_INFO << "[PACK-PROF] polys=" << prof.polys_considered
+                 << " placed=" << prof.placed_count << " not_placed=" << prof.not_placed_count
+                 << " rasterize=" << prof.rasterize_s << "s (" << prof.rasterize_calls << " calls)"
+                 << " candY(b/e)=" << prof.candidateY_build_s << "/" << prof.evaluate_drop_y_s << "s cols=" << prof.candidateY_cols_evaluated
+                 << " candX(b/e)=" << prof.candidateX_build_s << "/" << prof.evaluate_drop_x_s << "s rows=" << prof.candidateX_rows_evaluated
+                 << " place=" << prof.place_s << "s trans=" << prof.transform_s << "s total=" << prof.total_s << "s";
+        ReportAdd("packing/profile", "attempts", 1);
+        ReportAdd("packing/profile", "polys", prof.polys_considered);
+        ReportAdd("packing/profile", "placed", prof.placed_count);
+        ReportAdd("packing/profile", "not_placed", prof.not_placed_count);
+        ReportAdd("packing/profile", "rasterize_s", prof.rasterize_s);
+        ReportAdd("packing/profile", "rasterize_calls", prof.rasterize_calls);
+        ReportAdd("packing/profile", "candidate_y_build_s", prof.candidateY_build_s);
+        ReportAdd("packing/profile", "candidate_y_evaluate_s", prof.evaluate_drop_y_s);
+        ReportAdd("packing/profile", "candidate_y_cols", prof.candidateY_cols_evaluated);
+        ReportAdd("packing/profile", "candidate_x_build_s", prof.candidateX_build_s);
+        ReportAdd("packing/profile", "candidate_x_evaluate_s", prof.evaluate_drop_x_s);
+        ReportAdd("packing/profile", "candidate_x_rows", prof.candidateX_rows_evaluated);
+        ReportAdd("packing/profile", "gpu_evaluations", prof.gpu_evaluations);
+        ReportAdd("packing/profile", "place_s", prof.place_s);
+        ReportAdd("packing/profile", "transform_s", prof.transform_s);
+        ReportAdd("packing/profile", "total_s", prof.total_s);
+        attempts.push_back({size, np, prof});
+        if (np == 0 && !outlines.empty())
+            LOG_WARN << "[DIAG] Failed to pack any of the " << outlines.size() << " charts in this batch.";
+        return np;
+    };
+
+    int n = Attempt(container, transforms, polyToContainer);
+
+    if (n == 0 && !outlines.empty()) {
+        // bracket the scaling factor of the container side: lo always fails, hi succeeds
+        double minArea = std::numeric_limits<double>::max();
+        for (const auto& outline : outlines)
+            minArea = std::min(minArea, std::abs(vcg::tri::OutlineUtil<float>::Outline2Area(outline)) * packingScale * packingScale);
+        double containerArea = double(baseContainer.X()) * double(baseContainer.Y());
+
+        double lo = 1.0;
+        if (containerArea > 0)
+            lo = std::max(lo, std::sqrt(minArea / containerArea));
+        double hi = double(MAX_SIZE) / std::max(baseContainer.X(), baseContainer.Y());
+
+        if (hi > lo) {
+            std::vector<vcg::Similarity2f> trVec;
+            std::vector<int> polyToCont;
+            n = Attempt(ScaledContainer(hi), trVec, polyToCont);
+            if (n > 0) {
+                transforms = trVec;
+                polyToContainer = polyToCont;
+                while (hi / lo > SEARCH_TOLERANCE) {
+                    double mid = std::sqrt(lo * hi);
+                    int nmid = Attempt(ScaledContainer(mid), trVec, polyToCont);
+                    if (nmid > 0) {
+                        hi = mid;
+                        n = nmid;
+                        transforms = trVec;
+                        polyToContainer = polyToCont;
+                    } else {
+                        lo = mid;
+                    }
+                }
+                container = ScaledContainer(hi);
+            }
+        }
+    }
+
+    if (attempts.size() > 1) {
+        LOG_INFO << "[PACK-SEARCH] attempts=" << attempts.size() << " final grid=" << container.X() << "x" << container.Y() << " packed=" << n;
+        for (unsigned i = 0; i < attempts.size(); ++i)
+            LOG_VERBOSE << "[PACK-SEARCH]   " << i << ": grid=" << attempts[i].size.X() << "x" << attempts[i].size.Y()
+                        << " packed=" << attempts[i].packed << " rasterize=" << attempts[i].prof.rasterize_s << "s ("
+                        << attempts[i].prof.rasterize_calls << " calls) total=" << attempts[i].prof.total_s << "s";
+    }
+
+    return n;
+}
+
+/* Distributes the charts (largest first) to the buckets, picking each time the
+ * bucket with the lowest load relative to its capacity */
+static std::vector<std::vector<unsigned>> PartitionByArea(const std::vector<unsigned>& eligible, const std::vector<double>& chartAreas,
+                                                          const std::vector<double>& capacity)
+{
+    std::vector<unsigned> sorted = eligible;
+    std::sort(sorted.begin(), sorted.end(), [&](unsigned a, unsigned b) {
+        return chartAreas[a] > chartAreas[b];
+    });
+
+    std::vector<std::vector<unsigned>> buckets(capacity.size());
+    std::vector<double> load(capacity.size(), 0.0);
+    for (unsigned idx : sorted) {
+        std::size_t best = 0;
+        for (std::size_t k = 1; k < buckets.size(); ++k)
+            if ((load[k] / capacity[k]) < (load[best] / capacity[best]))
+                best = k;
+        buckets[best].push_back(idx);
+        load[best] += chartAreas[idx];
+    }
+
+    return buckets;
+}
+
+/* Douglas-Peucker simplification that only moves the boundary outwards: a chain of
+ * vertices is replaced by the segment joining its ends only if all the vertices lie
+ * on the inner side of the segment, within tolerance of it. The result encloses the
+ * outline, the slivers that crossing segments can leave out where the outline is
+ * thinner than the tolerance are covered by the gutter, which is wider */
+static Outline2f SimplifyOutline(const Outline2f& outline, double tolerance)
+{
+    const int n = (int) outline.size();
+    if (n <= 4 || tolerance <= 0)
+        return outline;
+
+    // > 0 if the interior lies on the left of the edges
+    const double orientation = (vcg::tri::OutlineUtil<float>::Outline2Area(outline) >= 0) ? 1.0 : -1.0;
+
+    auto P = [&outline, n](int i) -> vcg::Point2d {
+        const vcg::Point2f& p = outline[i % n];
+        return vcg::Point2d(p.X(), p.Y());
+    };
+
+    // the chains are split at the vertex farthest from the first one, and kept vertices
+    // are flagged while processing the chains [a, b] (indices modulo n) with a stack
+    int far = 0;
+    double farDist = -1;
+    for (int i = 1; i < n; ++i) {
+        double d = (P(i) - P(0)).SquaredNorm();
+        if (d > farDist) {
+            farDist = d;
+            far = i;
+        }
+    }
+    std::vector<bool> keep(n, false);
+    keep[0] = true;
+    keep[far] = true;
+    std::vector<std::pair<int, int>> stack = { {0, far}, {far, n} };
+
+    while (!stack.empty()) {
+        int a = stack.back().first;
+        int b = stack.back().second;
+        stack.pop_back();
+        if (b - a < 2)
+            continue;
+        vcg::Point2d pa = P(a);
+        vcg::Point2d ab = P(b) - pa;
+        double len = ab.Norm();
+        // the vertex with the largest outward offset, or the farthest one if none is outside
+        int split = -1;
+        double outMax = 0;
+        double distMax = tolerance;
+        for (int i = a + 1; i < b; ++i) {
+            vcg::Point2d ap = P(i) - pa;
+            // signed distance, positive on the inner side (all outside of a degenerate segment)
+            double d = (len > 0) ? orientation * (ab.X() * ap.Y() - ab.Y() * ap.X()) / len : -ap.Norm();
+            if (d < 0 && -d > outMax) {
+                outMax = -d;
+                split = i;
+            } else if (outMax == 0 && std::abs(d) > distMax) {
+                distMax = std::abs(d);
+                split = i;
+            }
+        }
+        if (split != -1) {
+            keep[split] = true;
+            stack.push_back({a, split});
+            stack.push_back({split, b});
+        }
+    }
+
+    Outline2f simplified;
+    for (int i = 0; i < n; ++i)
+        if (keep[i])
+            simplified.push_back(outline[i]);
+    return simplified;
+}
+
+/* FNV-1a over the coordinates of the outline, starting from its lowest point so that
+ * the hash does not depend on the face the outline was traced from (the order of the
+ * faces of the chart) */
+static uint64_t OutlineHash(const Outline2f& outline)
+{
+    std::size_t first = 0;
+    for (std::size_t i = 1; i < outline.size(); ++i) {
+        if (outline[i].X() < outline[first].X() || (outline[i].X() == outline[first].X() && outline[i].Y() < outline[first].Y()))
+            first = i;
+    }
+
+    const uint64_t prime = 1099511628211ULL;
+    uint64_t h = 1469598103934665603ULL;
+    for (std::size_t i = 0; i < outline.size(); ++i) {
+        const auto& p = outline[(first + i) % outline.size()];
+        for (float c : {p.X(), p.Y()}) {
+            uint32_t w;
+            std::memcpy(&w, &c, sizeof(w));
+            h = (h ^ w) * prime;
+        }
+    }
+    return (h ^ uint64_t(outline.size())) * prime;
+}
+
+static const uint64_t PACKING_LAYOUT_MAGIC = 0x3159414c47464454ULL; // "TDFGLAY1"
+
+struct PackingLayoutHeader {
+    uint64_t magic;
+    int32_t rotationNum;
+    int32_t gutterWidth;
+    double packingScale;
+    uint64_t containers;
+    uint64_t charts;
+};
+
+/* The header is followed by the container sizes (two int32) and by the charts
+ * (outline hash, int32 container, and the rotation, scale and translation floats) */
+struct PackingLayoutChart {
+    uint64_t hash;
+    int32_t container;
+    float rotRad;
+    float sca;
+    float tra[2];
+};
+
+static bool LoadPackingLayout(const std::string& path, PackingLayout& layout)
+{
+    QFile file(path.c_str());
+    if (!file.exists())
+        return false;
+    if (!file.open(QIODevice::ReadOnly)) {
+        LOG_WARN << "Unable to open the packing layout " << path;
+        return false;
+    }
+
+    std::vector<char> data(file.size());
+    PackingLayoutHeader header;
+    if (data.size() < sizeof(header) || file.read(data.data(), data.size()) != qint64(data.size())) {
+        LOG_WARN << "Ignoring the invalid packing layout " << path;
+        return false;
+    }
+    std::memcpy(&header, data.data(), sizeof(header));
+    if (header.magic != PACKING_LAYOUT_MAGIC
+            || header.containers > uint64_t(data.size()) || header.charts > uint64_t(data.size())
+            || uint64_t(data.size()) != sizeof(header) + header.containers * 2 * sizeof(int32_t) + header.charts * sizeof(PackingLayoutChart)) {
+        LOG_WARN << "Ignoring the invalid packing layout " << path;
+        return false;
+    }
+
+    layout = PackingLayout();
+    layout.rotationNum = header.rotationNum;
+    layout.gutterWidth = header.gutterWidth;
+    layout.packingScale = header.packingScale;
+
+    const char *p = data.data() + sizeof(header);
+    for (uint64_t k = 0; k < header.containers; ++k) {
+        int32_t size[2];
+        std::memcpy(size, p, sizeof(size));
+        p += sizeof(size);
+        layout.containers.push_back(vcg::Point2i(size[0], size[1]));
+    }
+    for (uint64_t k = 0; k < header.charts; ++k) {
+        PackingLayoutChart chart;
+        std::memcpy(&chart, p, sizeof(chart));
+        p += sizeof(chart);
+        if (chart.container < 0 || uint64_t(chart.container) >= header.containers) {
+            LOG_WARN << "Ignoring the invalid packing layout " << path;
+            return false;
+        }
+        vcg::Similarity2f tr;
+        tr.rotRad = chart.rotRad;
+        tr.sca = chart.sca;
+        tr.tra = vcg::Point2f(chart.tra[0], chart.tra[1]);
+        layout.hashes.push_back(chart.hash);
+        layout.chartContainers.push_back(chart.container);
+        layout.transforms.push_back(tr);
+    }
+
+    if (!(layout.packingScale > 0) || !std::isfinite(layout.packingScale)) {
+        LOG_WARN << "Ignoring the invalid packing layout " << path;
+        return false;
+    }
+    return true;
+}
+
+static bool SavePackingLayout(const std::string& path, const PackingLayout& layout)
+{
+    PackingLayoutHeader header;
+    std::memset(&header, 0, sizeof(header));
+    header.magic = PACKING_LAYOUT_MAGIC;
+    header.rotationNum = layout.rotationNum;
+    header.gutterWidth = layout.gutterWidth;
+    header.packingScale = layout.packingScale;
+    header.containers = layout.containers.size();
+    header.charts = layout.hashes.size();
+
+    std::vector<char> data;
+    auto append = [&data](const void *v, std::size_t size) {
+        const char *p = reinterpret_cast<const char *>(v);
+        data.insert(data.end(), p, p + size);
+    };
+    append(&header, sizeof(header));
+    for (const vcg::Point2i& c : layout.containers) {
+        int32_t size[2] = { c.X(), c.Y() };
+        append(size, sizeof(size));
+    }
+    for (std::size_t k = 0; k < layout.hashes.size(); ++k) {
+        PackingLayoutChart chart;
+        std::memset(&chart, 0, sizeof(chart));
+        chart.hash = layout.hashes[k];
+        chart.container = layout.chartContainers[k];
+        chart.rotRad = layout.transforms[k].rotRad;
+        chart.sca = layout.transforms[k].sca;
+        chart.tra[0] = layout.transforms[k].tra.X();
+        chart.tra[1] = layout.transforms[k].tra.Y();
+        append(&chart, sizeof(chart));
+    }
+
+    // the layout replaces the previous one only once it is completely written
+    QSaveFile file(path.c_str());
+    if (!file.open(QIODevice::WriteOnly))
+        return false;
+    bool ok = file.write(data.data(), data.size()) == qint64(data.size());
+    return ok && file.commit();
+}
@@ -28,6 +28,7 @@
 #include <vector>
 #include <map>
 #include <cstddef>
+#include <string>
 
 
 /* Pack the texture atlas encoded in the graph. Assumes the segmentation
@@ -40,7 +41,8 @@ int Pack(const std::vector<ChartHandle>& charts, TextureObjectHandle textureObje
  * by the reparameterization procedure, it returns as outline the bounding box
  * of the chart texture coordinates.
  * NOTE: It assumes the face-face topology is computed according to the wedge
- * texture coordinates of the chart/mesh */
+ * texture coordinates of the chart/mesh. It does not modify the faces, so the
+ * outlines of distinct charts can be extracted concurrently */
 Outline2f ExtractOutline2f(FaceGroup& chart);
 Outline2d ExtractOutline2d(FaceGroup& chart);
 
@@ -54,4 +56,17 @@ void IntegerShift(Mesh& m,
 // Configure the packing rasterizer cache maximum size in bytes
 void SetRasterizerCacheMaxBytes(std::size_t bytes);
 
+// Sizes the packing rasterizer cache to the given fraction of the free system memory
+// (counting the bytes it already holds as free) at the start of each packing run and before each
+// packing attempt, so that it shrinks under memory pressure. 0 disables the automatic
+// sizing and keeps the size set with SetRasterizerCacheMaxBytes
+void SetRasterizerCacheAutoSize(double fraction);
+
+// Fraction of the free system memory given to the automatically sized rasterizer cache
+constexpr double RASTERIZER_CACHE_FREE_MEMORY_FRACTION = 0.5;
+
+// Configure the persistent packing rasterizer cache directory (empty to disable) and
+// its maximum size in bytes. Returns false if the directory cannot be used
+bool SetRasterizerDiskCache(const std::string& dir, std::size_t maxBytes);
+
 #endif // PACKING_H
@@ -0,0 +1,132 @@
+/*******************************************************************************
+    Copyright (c) 2021, Andrea Maggiordomo, Paolo Cignoni and Marco Tarini
+
+    This file is part of TextureDefrag, a reference implementation for
+    the paper ``Texture Defragmentation for Photo-Reconstructed 3D Models''
+    by Andrea Maggiordomo, Paolo Cignoni and Marco Tarini.
+
+    TextureDefrag is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    TextureDefrag is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with TextureDefrag. If not, see <https://www.gnu.org/licenses/>.
+*******************************************************************************/
+
+
+
+#include "parallel_threshold.h"
+#include "logging.h"
+
+#include <vector>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <limits>
+#include <algorithm>
+
+#include <omp.h>
+
+
+namespace {
+
+constexpr int DEFAULT_MIN_FACES = 2000;
+constexpr int MIN_CALIBRATED_FACES = 256;
+constexpr int MAX_CALIBRATED_FACES = 1 << 16;
+
+std::atomic<int> minFaces(DEFAULT_MIN_FACES);
+
+inline double Seconds(std::chrono::steady_clock::time_point t0, std::chrono::steady_clock::time_point t1)
+{
+    return std::chrono::duration<double>(t1 - t0).count();
+}
+
+// median time of a parallel loop with one trivial iteration per thread
+double ParallelRegionTime(int threads)
+{
+    std::vector<double> slots(threads * 8, 0.0); // one cache line per thread
+    for (int warmup = 0; warmup < 10; ++warmup) {
+        #pragma omp parallel for
+        for (int i = 0; i < threads; ++i)
+            slots[i * 8] += 1.0;
+    }
+    std::vector<double> times;
+    for (int rep = 0; rep < 51; ++rep) {
+        auto t0 = std::chrono::steady_clock::now();
+        #pragma omp parallel for
+        for (int i = 0; i < threads; ++i)
+            slots[i * 8] += 1.0;
+        times.push_back(Seconds(t0, std::chrono::steady_clock::now()));
+    }
+    std::nth_element(times.begin(), times.begin() + times.size() / 2, times.end());
+    return times[times.size() / 2];
+}
+
+// minimum time per face of a serial loop that gathers the corners of the faces
+// and computes the singular values of their 2x2 Jacobians
+double FaceLoopTime()
+{
+    const int nf = 4096;
+    const int nv = nf / 2;
+    std::vector<double> pos(2 * nv);
+    std::vector<int> corners(3 * nf);
+    for (int i = 0; i < nv; ++i) {
+        pos[2 * i] = std::cos(i * 0.37);
+        pos[2 * i + 1] = std::sin(i * 0.51);
+    }
+    for (int i = 0; i < 3 * nf; ++i)
+        corners[i] = int((i * 2654435761u) % unsigned(nv));
+    std::vector<double> energy(nf);
+
+    double best = std::numeric_limits<double>::max();
+    for (int rep = 0; rep < 20; ++rep) {
+        auto t0 = std::chrono::steady_clock::now();
+        for (int f = 0; f < nf; ++f) {
+            const double *p0 = &pos[2 * corners[3 * f]];
+            const double *p1 = &pos[2 * corners[3 * f + 1]];
+            const double *p2 = &pos[2 * corners[3 * f + 2]];
+            double j00 = p1[0] - p0[0], j01 = p2[0] - p0[0];
+            double j10 = p1[1] - p0[1], j11 = p2[1] - p0[1];
+            double c = std::hypot(j00 + j11, j10 - j01);
+            double a = std::hypot(j00 - j11, j10 + j01);
+            double s0 = 0.5 * (c + a) - 1.0;
+            double s1 = 0.5 * (c - a) - 1.0;
+            energy[f] = s0 * s0 + s1 * s1;
+        }
+        best = std::min(best, Seconds(t0, std::chrono::steady_clock::now()));
+    }
+    volatile double sink = energy[nf / 3];
+    (void) sink;
+    return best / nf;
+}
+
+} // namespace
+
+int ParallelMinFaces()
+{
+    return minFaces.load(std::memory_order_relaxed);
+}
+
+void CalibrateParallelMinFaces()
+{
+    int threads = omp_get_max_threads();
+    if (threads <= 1) {
+        minFaces = std::numeric_limits<int>::max();
+        LOG_INFO << "Parallel loop threshold: none (a single thread)";
+        return;
+    }
+    double regionTime = ParallelRegionTime(threads);
+    double faceTime = FaceLoopTime();
+    // the parallel loop on n faces saves n * faceTime * (1 - 1 / threads)
+    double n = 2.0 * regionTime / (faceTime * (1.0 - 1.0 / threads));
+    int calibrated = (n < MAX_CALIBRATED_FACES) ? std::max(int(std::ceil(n)), MIN_CALIBRATED_FACES) : MAX_CALIBRATED_FACES;
+    minFaces = calibrated;
+    LOG_INFO << "Parallel loop threshold: " << calibrated << " faces (parallel region " << regionTime * 1e6
+             << " us with " << threads << " threads, " << faceTime * 1e9 << " ns per face)";
+}
@@ -0,0 +1,71 @@
+/*******************************************************************************
+    Copyright (c) 2021, Andrea Maggiordomo, Paolo Cignoni and Marco Tarini
+
+    This file is part of TextureDefrag, a reference implementation for
+    the paper ``Texture Defragmentation for Photo-Reconstructed 3D Models''
+    by Andrea Maggiordomo, Paolo Cignoni and Marco Tarini.
+
+    TextureDefrag is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    TextureDefrag is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with TextureDefrag. If not, see <https://www.gnu.org/licenses/>.
+*******************************************************************************/
+
+
+#ifndef PARALLEL_THRESHOLD_H
+#define PARALLEL_THRESHOLD_H
+
+#include <array>
+#include <vector>
+#include <algorithm>
+
+/* Minimum number of faces of the meshes whose per-face loops run in OpenMP
+ * parallel regions (with an if clause), the loops on smaller meshes run serially
+ * since for the small shells of most merge operations the cost of starting the
+ * parallel region outweighs the work. The threshold is 2000 faces until it is
+ * calibrated */
+int ParallelMinFaces();
+
+/* Sets the threshold from the time of an empty parallel region with the current
+ * number of threads and the time of a reference per-face loop (close to the
+ * rotation pass of ARAP), so that a parallel loop at the threshold saves twice the
+ * cost of its region. Takes a few milliseconds, and must be called outside of
+ * parallel regions */
+void CalibrateParallelMinFaces();
+
+/* Size of the blocks of OrderedSum() */
+constexpr int ORDERED_SUM_BLOCK = 1024;
+
+/* Sums N quantities over the range [0, n). The range is split in blocks of
+ * ORDERED_SUM_BLOCK elements, kernel(begin, end, partial) adds the quantities of
+ * a block to partial[0..N), and the partial sums of the blocks are added in index
+ * order. Since the blocks do not depend on the number of threads, the sums are the
+ * same whether the blocks run in parallel or not, unlike the ones of an OpenMP
+ * reduction clause */
+template <int N, typename Kernel>
+std::array<double, N> OrderedSum(int n, bool parallel, Kernel kernel)
+{
+    int nb = (n + ORDERED_SUM_BLOCK - 1) / ORDERED_SUM_BLOCK;
+    std::vector<std::array<double, N>> partial(nb);
+    #pragma omp parallel for schedule(static) if (parallel && nb > 1)
+    for (int b = 0; b < nb; ++b) {
+        partial[b].fill(0);
+        kernel(b * ORDERED_SUM_BLOCK, std::min(n, (b + 1) * ORDERED_SUM_BLOCK), partial[b].data());
+    }
+    std::array<double, N> sum;
+    sum.fill(0);
+    for (int b = 0; b < nb; ++b)
+        for (int k = 0; k < N; ++k)
+            sum[k] += partial[b][k];
+    return sum;
+}
+
+#endif // PARALLEL_THRESHOLD_H
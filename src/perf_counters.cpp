@@ -0,0 +1,266 @@
+/*******************************************************************************
+    Copyright (c) 2021, Andrea Maggiordomo, Paolo Cignoni and Marco Tarini
+
+    This file is part of TextureDefrag, a reference implementation for
+    the paper ``Texture Defragmentation for Photo-Reconstructed 3D Models''
+    by Andrea Maggiordomo, Paolo Cignoni and Marco Tarini.
+
+    TextureDefrag is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    TextureDefrag is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with TextureDefrag. If not, see <https://www.gnu.org/licenses/>.
+*******************************************************************************/
+
+#include "perf_counters.h"
+#include "logging.h"
+#include "run_report.h"
+
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include <sstream>
+#include <iomanip>
+#include <algorithm>
+
+#include <omp.h>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+#include <cstring>
+#endif
+
+
+PerfCounterValues& PerfCounterValues::operator+=(const PerfCounterValues& other)
+{
+    cycles += other.cycles;
+    instructions += other.instructions;
+    llcMisses += other.llcMisses;
+    branchMisses += other.branchMisses;
+    return *this;
+}
+
+PerfCounterValues PerfCounterValues::operator-(const PerfCounterValues& other) const
+{
+    // the scaling of multiplexed counters can make a later read slightly smaller
+    auto Diff = [] (uint64_t a, uint64_t b) -> uint64_t { return a > b ? a - b : 0; };
+    PerfCounterValues d;
+    d.cycles = Diff(cycles, other.cycles);
+    d.instructions = Diff(instructions, other.instructions);
+    d.llcMisses = Diff(llcMisses, other.llcMisses);
+    d.branchMisses = Diff(branchMisses, other.branchMisses);
+    return d;
+}
+
+static std::atomic<bool> perfCountersEnabled(false);
+
+#ifdef __linux__
+
+enum PerfCounterIndex { COUNTER_CYCLES = 0, COUNTER_INSTRUCTIONS, COUNTER_LLC_MISSES, COUNTER_BRANCH_MISSES, COUNTER_COUNT };
+
+static const uint64_t counterConfig[COUNTER_COUNT] = {
+    PERF_COUNT_HW_CPU_CYCLES,
+    PERF_COUNT_HW_INSTRUCTIONS,
+    PERF_COUNT_HW_CACHE_MISSES, // mapped to the last level cache misses by the x86 and arm drivers
+    PERF_COUNT_HW_BRANCH_MISSES
+};
+
+static int OpenCounter(uint64_t config, int groupFd)
+{
+    perf_event_attr attr;
+    std::memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = config;
+    attr.disabled = (groupFd == -1) ? 1 : 0;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    // counts the calling thread on any cpu
+    return (int) syscall(__NR_perf_event_open, &attr, 0, -1, groupFd, PERF_FLAG_FD_CLOEXEC);
+}
+
+/* Group of counters of a thread. The counters that cannot be opened (e.g. the
+ * cache misses on some virtual PMUs) are left out of the group and read as 0 */
+struct ThreadCounterGroup {
+    int leader = -1;
+    int fds[COUNTER_COUNT] = {-1, -1, -1, -1};
+    int slot[COUNTER_COUNT] = {-1, -1, -1, -1}; // position of the counter in the values read from the group
+    int members = 0;
+
+    bool Open()
+    {
+        leader = OpenCounter(counterConfig[COUNTER_CYCLES], -1);
+        if (leader == -1)
+            return false;
+        fds[COUNTER_CYCLES] = leader;
+        slot[COUNTER_CYCLES] = members++;
+        for (int i = COUNTER_INSTRUCTIONS; i < COUNTER_COUNT; ++i) {
+            fds[i] = OpenCounter(counterConfig[i], leader);
+            if (fds[i] != -1)
+                slot[i] = members++;
+        }
+        ioctl(leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+        ioctl(leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+        return true;
+    }
+
+    void Close()
+    {
+        for (int i = COUNTER_COUNT - 1; i >= 0; --i)
+            if (fds[i] != -1)
+                close(fds[i]);
+        leader = -1;
+    }
+
+    PerfCounterValues Read() const
+    {
+        PerfCounterValues v;
+        if (leader == -1)
+            return v;
+
+        // nr, time enabled, time running and the values of the group
+        uint64_t buf[3 + COUNTER_COUNT];
+        ssize_t n = read(leader, buf, sizeof(buf));
+        if (n < (ssize_t) (3 * sizeof(uint64_t)) || buf[0] != (uint64_t) members)
+            return v;
+
+        // scale the counts if the group was multiplexed with other events
+        double scale = (buf[2] > 0 && buf[2] < buf[1]) ? double(buf[1]) / double(buf[2]) : 1.0;
+        auto Value = [&] (int counter) -> uint64_t {
+            return slot[counter] == -1 ? 0 : (uint64_t) (buf[3 + slot[counter]] * scale);
+        };
+        v.cycles = Value(COUNTER_CYCLES);
+        v.instructions = Value(COUNTER_INSTRUCTIONS);
+        v.llcMisses = Value(COUNTER_LLC_MISSES);
+        v.branchMisses = Value(COUNTER_BRANCH_MISSES);
+        return v;
+    }
+};
+
+// the groups of the live threads, and the final counts of the threads that exited
+// (the registry can outlive the static objects of this file at exit)
+static std::mutex& groupsMutex = *new std::mutex();
+static std::vector<const ThreadCounterGroup *>& liveGroups = *new std::vector<const ThreadCounterGroup *>();
+static PerfCounterValues& retiredCounts = *new PerfCounterValues();
+
+struct ThreadCounters {
+    ThreadCounterGroup group;
+    bool opened = false;
+
+    ThreadCounterGroup *Get()
+    {
+        if (!opened) {
+            opened = true;
+            if (group.Open()) {
+                std::lock_guard<std::mutex> lock(groupsMutex);
+                liveGroups.push_back(&group);
+            }
+        }
+        return group.leader != -1 ? &group : nullptr;
+    }
+
+    ~ThreadCounters()
+    {
+        if (group.leader == -1)
+            return;
+        std::lock_guard<std::mutex> lock(groupsMutex);
+        retiredCounts += group.Read();
+        liveGroups.erase(std::remove(liveGroups.begin(), liveGroups.end(), &group), liveGroups.end());
+        group.Close();
+    }
+};
+
+static thread_local ThreadCounters threadCounters;
+
+bool EnablePerfCounters()
+{
+    if (threadCounters.Get() == nullptr) {
+        LOG_WARN << "[PERF-COUNTERS] Unable to open the hardware counters (" << std::strerror(errno) << "), check kernel.perf_event_paranoid";
+        return false;
+    }
+    perfCountersEnabled = true;
+
+    #pragma omp parallel
+    threadCounters.Get();
+
+    const ThreadCounterGroup& g = threadCounters.group;
+    LOG_INFO << "[PERF-COUNTERS] Counting cycles"
+             << (g.slot[COUNTER_INSTRUCTIONS] != -1 ? ", instructions" : "")
+             << (g.slot[COUNTER_LLC_MISSES] != -1 ? ", llc misses" : "")
+             << (g.slot[COUNTER_BRANCH_MISSES] != -1 ? ", branch misses" : "");
+    return true;
+}
+
+PerfCounterValues ReadThreadPerfCounters()
+{
+    if (!perfCountersEnabled)
+        return PerfCounterValues();
+    ThreadCounterGroup *g = threadCounters.Get();
+    return g ? g->Read() : PerfCounterValues();
+}
+
+PerfCounterValues ReadProcessPerfCounters()
+{
+    if (!perfCountersEnabled)
+        return PerfCounterValues();
+    std::lock_guard<std::mutex> lock(groupsMutex);
+    PerfCounterValues total = retiredCounts;
+    for (auto g : liveGroups)
+        total += g->Read();
+    return total;
+}
+
+#else
+
+bool EnablePerfCounters()
+{
+    LOG_WARN << "[PERF-COUNTERS] Hardware counters are only supported on Linux";
+    return false;
+}
+
+PerfCounterValues ReadThreadPerfCounters()
+{
+    return PerfCounterValues();
+}
+
+PerfCounterValues ReadProcessPerfCounters()
+{
+    return PerfCounterValues();
+}
+
+#endif
+
+bool PerfCountersEnabled()
+{
+    return perfCountersEnabled;
+}
+
+std::string FormatPerfCounters(const PerfCounterValues& values)
+{
+    std::stringstream ss;
+    ss << "cycles=" << values.cycles
+       << " instructions=" << values.instructions
+       << " ipc=" << std::fixed << std::setprecision(2) << values.IPC()
+       << " llc_misses=" << values.llcMisses
+       << " branch_misses=" << values.branchMisses;
+    return ss.str();
+}
+
+void ReportPerfCounters(const std::string& section, const PerfCounterValues& values)
+{
+    ReportAdd(section, "cycles", values.cycles);
+    ReportAdd(section, "instructions", values.instructions);
+    ReportAdd(section, "llc_misses", values.llcMisses);
+    ReportAdd(section, "branch_misses", values.branchMisses);
+}
@@ -0,0 +1,71 @@
+/*******************************************************************************
+    Copyright (c) 2021, Andrea Maggiordomo, Paolo Cignoni and Marco Tarini
+
+    This file is part of TextureDefrag, a reference implementation for
+    the paper ``Texture Defragmentation for Photo-Reconstructed 3D Models''
+    by Andrea Maggiordomo, Paolo Cignoni and Marco Tarini.
+
+    TextureDefrag is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    TextureDefrag is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with TextureDefrag. If not, see <https://www.gnu.org/licenses/>.
+*******************************************************************************/
+
+#ifndef PERF_COUNTERS_H
+#define PERF_COUNTERS_H
+
+#include <cstdint>
+#include <string>
+
+/* Hardware performance counters of the profiled scopes. Each thread counts its
+ * own events in a group of counters opened with perf_event_open on its first
+ * read, so the counts of a scope are those of the thread that runs it and the
+ * counts of concurrent scopes add up. The counts of the whole process are the
+ * sum of the groups of all the threads that opened one; EnablePerfCounters()
+ * opens the groups of the OpenMP threads, the other threads only count once
+ * they run a profiled scope. Only user space events are counted, so that the
+ * counters can be opened with the default perf_event_paranoid setting. Only
+ * implemented on Linux, elsewhere the counters are not available */
+
+struct PerfCounterValues {
+    uint64_t cycles = 0;
+    uint64_t instructions = 0;
+    uint64_t llcMisses = 0;    // last level cache misses
+    uint64_t branchMisses = 0;
+
+    PerfCounterValues& operator+=(const PerfCounterValues& other);
+    PerfCounterValues operator-(const PerfCounterValues& other) const;
+
+    double IPC() const { return cycles > 0 ? double(instructions) / double(cycles) : 0; }
+};
+
+/* Enables the counters and opens the groups of the calling thread and of the
+ * OpenMP threads. Returns false (and leaves the counters disabled) if the
+ * cycles cannot be counted, e.g. in a virtual machine without a virtual PMU or
+ * if perf_event_paranoid is 3 or more */
+bool EnablePerfCounters();
+
+bool PerfCountersEnabled();
+
+/* Counters of the calling thread, zero if the counters are not enabled */
+PerfCounterValues ReadThreadPerfCounters();
+
+/* Sum of the counters of all the threads, zero if the counters are not enabled */
+PerfCounterValues ReadProcessPerfCounters();
+
+/* Formats the values for the log, e.g. "cycles=... instructions=... ipc=..." */
+std::string FormatPerfCounters(const PerfCounterValues& values);
+
+/* Adds the values to the run report, as the cycles, instructions, llc_misses
+ * and branch_misses keys of section */
+void ReportPerfCounters(const std::string& section, const PerfCounterValues& values);
+
+#endif // PERF_COUNTERS_H
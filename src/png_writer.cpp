@@ -0,0 +1,342 @@
+/*******************************************************************************
+    Copyright (c) 2021, Andrea Maggiordomo, Paolo Cignoni and Marco Tarini
+
+    This file is part of TextureDefrag, a reference implementation for
+    the paper ``Texture Defragmentation for Photo-Reconstructed 3D Models''
+    by Andrea Maggiordomo, Paolo Cignoni and Marco Tarini.
+
+    TextureDefrag is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    TextureDefrag is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with TextureDefrag. If not, see <https://www.gnu.org/licenses/>.
+*******************************************************************************/
+
+#include "png_writer.h"
+
+#include <wrap/openfbx/src/miniz.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+
+struct Band {
+    int row0;
+    int row1;
+    std::vector<unsigned char> deflated;
+    uint32_t adler;
+    bool ok;
+};
+
+static void ConvertRow(const unsigned char *bgra, int width, unsigned char *rgba);
+static void FilterRow(const unsigned char *curr, const unsigned char *prev, int rowBytes, unsigned char *out);
+static void DeflateBand(const unsigned char *bgra, const unsigned char *prevRow, int width, std::size_t bytesPerLine,
+                        int level, bool last, Band& band);
+static uint32_t Adler32Combine(uint32_t adler1, uint32_t adler2, std::size_t len2);
+static void AppendChunk(std::vector<unsigned char>& out, const char *type, const unsigned char *data, std::size_t size);
+static void AppendU32(std::vector<unsigned char>& out, uint32_t v);
+
+bool EncodePNG(const unsigned char *bgra, int width, int height, std::size_t bytesPerLine,
+               int level, int numThreads, std::vector<unsigned char>& out)
+{
+    out.clear();
+    if (width <= 0 || height <= 0)
+        return false;
+
+    PNGStreamEncoder encoder(width, height, level);
+    PNGStreamEncoder::EncodedRows encoded;
+    if (!encoder.EncodeRows(bgra, bytesPerLine, nullptr, 0, height, numThreads, encoded))
+        return false;
+
+    encoder.Begin(out);
+    encoder.Append(encoded, out);
+    encoder.End(out);
+    return true;
+}
+
+PNGStreamEncoder::PNGStreamEncoder(int width, int height, int level)
+    : width{width}, height{height}, level{std::min(std::max(level, 0), 9)}
+{
+}
+
+void PNGStreamEncoder::Begin(std::vector<unsigned char>& out) const
+{
+    static const unsigned char signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+    out.insert(out.end(), signature, signature + 8);
+
+    std::vector<unsigned char> ihdr;
+    AppendU32(ihdr, uint32_t(width));
+    AppendU32(ihdr, uint32_t(height));
+    ihdr.push_back(8); // bit depth
+    ihdr.push_back(6); // color type RGBA
+    ihdr.push_back(0); // deflate compression
+    ihdr.push_back(0); // adaptive filtering
+    ihdr.push_back(0); // no interlace
+    AppendChunk(out, "IHDR", ihdr.data(), ihdr.size());
+}
+
+bool PNGStreamEncoder::EncodeRows(const unsigned char *bgra, std::size_t bytesPerLine, const unsigned char *prevRow,
+                                  int firstRow, int rows, int numThreads, EncodedRows& encoded) const
+{
+    encoded.deflated.clear();
+    encoded.adler = 1;
+    encoded.rows = 0;
+    if (width <= 0 || rows <= 0 || firstRow < 0 || firstRow + rows > height)
+        return false;
+
+    numThreads = std::max(numThreads, 1);
+
+    // Bands are large enough to keep the compression close to a single stream
+    int rowsPerBand = std::max(64, (rows + 4 * numThreads - 1) / (4 * numThreads));
+    int numBands = (rows + rowsPerBand - 1) / rowsPerBand;
+    std::vector<Band> bands(numBands);
+    for (int i = 0; i < numBands; ++i) {
+        bands[i].row0 = i * rowsPerBand;
+        bands[i].row1 = std::min(rows, (i + 1) * rowsPerBand);
+    }
+
+    bool last = (firstRow + rows == height);
+
+    // the first row of a band is filtered against the last row of the previous band
+    #pragma omp parallel for schedule(dynamic) num_threads(numThreads)
+    for (int i = 0; i < numBands; ++i) {
+        const unsigned char *prev = (i > 0) ? bgra + std::size_t(bands[i].row0 - 1) * bytesPerLine : prevRow;
+        DeflateBand(bgra + std::size_t(bands[i].row0) * bytesPerLine, prev, width, bytesPerLine, level,
+                    last && i == numBands - 1, bands[i]);
+    }
+
+    for (const Band& band : bands) {
+        if (!band.ok)
+            return false;
+    }
+
+    // concatenate the raw deflate bands, and combine the adler32 of the filtered rows
+    std::size_t filteredRowBytes = std::size_t(width) * 4 + 1;
+    std::size_t size = 0;
+    for (const Band& band : bands)
+        size += band.deflated.size();
+    encoded.deflated.reserve(size);
+    for (int i = 0; i < numBands; ++i) {
+        std::size_t len = std::size_t(bands[i].row1 - bands[i].row0) * filteredRowBytes;
+        encoded.adler = (i == 0) ? bands[i].adler : Adler32Combine(encoded.adler, bands[i].adler, len);
+        encoded.deflated.insert(encoded.deflated.end(), bands[i].deflated.begin(), bands[i].deflated.end());
+        std::vector<unsigned char>().swap(bands[i].deflated);
+    }
+    encoded.rows = rows;
+    return true;
+}
+
+void PNGStreamEncoder::Append(EncodedRows& encoded, std::vector<unsigned char>& out)
+{
+    // the first chunk starts the zlib stream
+    if (rowsAppended == 0) {
+        unsigned char header[2] = { 0x78, 0x5e };
+        encoded.deflated.insert(encoded.deflated.begin(), header, header + 2);
+    }
+    std::size_t len = std::size_t(encoded.rows) * (std::size_t(width) * 4 + 1);
+    adler = (rowsAppended == 0) ? encoded.adler : Adler32Combine(adler, encoded.adler, len);
+    rowsAppended += encoded.rows;
+    AppendChunk(out, "IDAT", encoded.deflated.data(), encoded.deflated.size());
+    std::vector<unsigned char>().swap(encoded.deflated);
+}
+
+void PNGStreamEncoder::End(std::vector<unsigned char>& out)
+{
+    // the zlib stream ends with the adler32 of the filtered rows
+    std::vector<unsigned char> checksum;
+    AppendU32(checksum, adler);
+    AppendChunk(out, "IDAT", checksum.data(), checksum.size());
+    AppendChunk(out, "IEND", nullptr, 0);
+}
+
+int PNGCompressionLevel(int quality)
+{
+    // same mapping as the Qt png writer
+    if (quality < 0)
+        return 6;
+    quality = std::min(quality, 100);
+    return (100 - quality) * 9 / 91;
+}
+
+// -- static functions ---------------------------------------------------------
+
+static void ConvertRow(const unsigned char *bgra, int width, unsigned char *rgba)
+{
+    for (int x = 0; x < width; ++x) {
+        rgba[4 * x + 0] = bgra[4 * x + 2];
+        rgba[4 * x + 1] = bgra[4 * x + 1];
+        rgba[4 * x + 2] = bgra[4 * x + 0];
+        rgba[4 * x + 3] = bgra[4 * x + 3];
+    }
+}
+
+static inline unsigned char Paeth(int a, int b, int c)
+{
+    int p = a + b - c;
+    int pa = std::abs(p - a);
+    int pb = std::abs(p - b);
+    int pc = std::abs(p - c);
+    if (pa <= pb && pa <= pc)
+        return (unsigned char) a;
+    else if (pb <= pc)
+        return (unsigned char) b;
+    else
+        return (unsigned char) c;
+}
+
+/* Writes the filter type followed by the filtered row, choosing the filter with the
+ * minimum sum of absolute differences (the libpng heuristic). prev is null for the
+ * first row of the image */
+static void FilterRow(const unsigned char *curr, const unsigned char *prev, int rowBytes, unsigned char *out)
+{
+    const int bpp = 4;
+    static thread_local std::vector<unsigned char> candidates;
+    candidates.resize(5 * std::size_t(rowBytes));
+
+    unsigned char *none = candidates.data();
+    unsigned char *sub = none + rowBytes;
+    unsigned char *up = sub + rowBytes;
+    unsigned char *avg = up + rowBytes;
+    unsigned char *paeth = avg + rowBytes;
+
+    std::memcpy(none, curr, rowBytes);
+    for (int i = 0; i < rowBytes; ++i)
+        sub[i] = (unsigned char) (curr[i] - ((i >= bpp) ? curr[i - bpp] : 0));
+    if (prev) {
+        for (int i = 0; i < rowBytes; ++i) {
+            int a = (i >= bpp) ? curr[i - bpp] : 0;
+            int b = prev[i];
+            int c = (i >= bpp) ? prev[i - bpp] : 0;
+            up[i] = (unsigned char) (curr[i] - b);
+            avg[i] = (unsigned char) (curr[i] - ((a + b) >> 1));
+            paeth[i] = (unsigned char) (curr[i] - Paeth(a, b, c));
+        }
+    } else {
+        for (int i = 0; i < rowBytes; ++i)
+            avg[i] = (unsigned char) (curr[i] - (((i >= bpp) ? curr[i - bpp] : 0) >> 1));
+    }
+
+    uint64_t bestSum = UINT64_MAX;
+    int best = 0;
+    for (int f = 0; f < 5; ++f) {
+        if (prev == nullptr && (f == 2 || f == 4))
+            continue; // same as None and Sub without a previous row
+        const unsigned char *c = candidates.data() + std::size_t(f) * rowBytes;
+        uint64_t sum = 0;
+        for (int i = 0; i < rowBytes; ++i)
+            sum += (c[i] < 128) ? c[i] : (256 - c[i]);
+        if (sum < bestSum) {
+            bestSum = sum;
+            best = f;
+        }
+    }
+    out[0] = (unsigned char) best;
+    std::memcpy(out + 1, candidates.data() + std::size_t(best) * rowBytes, rowBytes);
+}
+
+/* Deflates the rows of the band, bgra points to the first row of the band and
+ * prevRow to the row before it (null for the first row of the image) */
+static void DeflateBand(const unsigned char *bgra, const unsigned char *prevRow, int width, std::size_t bytesPerLine,
+                        int level, bool last, Band& band)
+{
+    band.ok = false;
+    band.adler = 1;
+
+    int rowBytes = width * 4;
+    std::vector<unsigned char> prevRowRGBA(rowBytes);
+    std::vector<unsigned char> currRow(rowBytes);
+    std::vector<unsigned char> filtered(std::size_t(rowBytes) + 1);
+
+    if (prevRow)
+        ConvertRow(prevRow, width, prevRowRGBA.data());
+
+    mz_stream stream;
+    std::memset(&stream, 0, sizeof(stream));
+    if (mz_deflateInit2(&stream, level, MZ_DEFLATED, -MZ_DEFAULT_WINDOW_BITS, 9, MZ_DEFAULT_STRATEGY) != MZ_OK)
+        return;
+
+    std::size_t bandBytes = std::size_t(band.row1 - band.row0) * filtered.size();
+    band.deflated.resize(mz_deflateBound(&stream, mz_ulong(bandBytes)) + 64);
+
+    stream.next_out = band.deflated.data();
+    stream.avail_out = (unsigned int) band.deflated.size();
+
+    bool ok = true;
+    for (int y = band.row0; y < band.row1 && ok; ++y) {
+        ConvertRow(bgra + std::size_t(y - band.row0) * bytesPerLine, width, currRow.data());
+        FilterRow(currRow.data(), (y > band.row0 || prevRow) ? prevRowRGBA.data() : nullptr, rowBytes, filtered.data());
+        band.adler = (uint32_t) mz_adler32(band.adler, filtered.data(), filtered.size());
+        std::swap(prevRowRGBA, currRow);
+
+        // the last band terminates the deflate stream, the others end on a byte boundary
+        // so that the next band can be appended
+        int flush = (y == band.row1 - 1) ? (last ? MZ_FINISH : MZ_SYNC_FLUSH) : MZ_NO_FLUSH;
+        stream.next_in = filtered.data();
+        stream.avail_in = (unsigned int) filtered.size();
+        while (ok) {
+            if (stream.avail_out == 0) {
+                std::size_t used = band.deflated.size();
+                band.deflated.resize(used * 2);
+                stream.next_out = band.deflated.data() + used;
+                stream.avail_out = (unsigned int) (band.deflated.size() - used);
+            }
+            int status = mz_deflate(&stream, flush);
+            if (status == MZ_STREAM_END)
+                break;
+            if (status != MZ_OK && !(status == MZ_BUF_ERROR && stream.avail_out == 0)) {
+                // no progress is only expected once all the input is consumed
+                ok = (status == MZ_BUF_ERROR && stream.avail_in == 0 && flush != MZ_FINISH);
+                break;
+            }
+            if (stream.avail_in == 0 && stream.avail_out > 0 && flush != MZ_FINISH)
+                break;
+        }
+    }
+
+    band.deflated.resize(stream.total_out);
+    mz_deflateEnd(&stream);
+    band.ok = ok;
+}
+
+// Port of zlib's adler32_combine()
+static uint32_t Adler32Combine(uint32_t adler1, uint32_t adler2, std::size_t len2)
+{
+    const uint32_t BASE = 65521;
+    uint32_t rem = uint32_t(len2 % BASE);
+    uint32_t sum1 = adler1 & 0xffff;
+    uint32_t sum2 = uint32_t((uint64_t(rem) * sum1) % BASE);
+    sum1 += (adler2 & 0xffff) + BASE - 1;
+    sum2 += ((adler1 >> 16) & 0xffff) + ((adler2 >> 16) & 0xffff) + BASE - rem;
+    if (sum1 >= BASE) sum1 -= BASE;
+    if (sum1 >= BASE) sum1 -= BASE;
+    if (sum2 >= (BASE << 1)) sum2 -= (BASE << 1);
+    if (sum2 >= BASE) sum2 -= BASE;
+    return sum1 | (sum2 << 16);
+}
+
+static void AppendChunk(std::vector<unsigned char>& out, const char *type, const unsigned char *data, std::size_t size)
+{
+    AppendU32(out, uint32_t(size));
+    std::size_t typePos = out.size();
+    out.insert(out.end(), type, type + 4);
+    if (size > 0)
+        out.insert(out.end(), data, data + size);
+    uint32_t crc = (uint32_t) mz_crc32(MZ_CRC32_INIT, out.data() + typePos, size + 4);
+    AppendU32(out, crc);
+}
+
+static void AppendU32(std::vector<unsigned char>& out, uint32_t v)
+{
+    out.push_back((unsigned char) (v >> 24));
+    out.push_back((unsigned char) (v >> 16));
+    out.push_back((unsigned char) (v >> 8));
+    out.push_back((unsigned char) v);
+}
@@ -0,0 +1,80 @@
+/*******************************************************************************
+    Copyright (c) 2021, Andrea Maggiordomo, Paolo Cignoni and Marco Tarini
+
+    This file is part of TextureDefrag, a reference implementation for
+    the paper ``Texture Defragmentation for Photo-Reconstructed 3D Models''
+    by Andrea Maggiordomo, Paolo Cignoni and Marco Tarini.
+
+    TextureDefrag is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    TextureDefrag is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with TextureDefrag. If not, see <https://www.gnu.org/licenses/>.
+*******************************************************************************/
+
+#ifndef PNG_WRITER_H
+#define PNG_WRITER_H
+
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+/* Encodes a 32-bit image stored as BGRA bytes (the memory layout of
+ * QImage::Format_ARGB32 on little-endian machines) as an 8-bit RGBA png.
+ * The rows are split in bands that are filtered and deflated independently on
+ * numThreads threads, and the compressed bands are concatenated in a single
+ * zlib stream (one IDAT chunk per band). level is the deflate level (0-9).
+ * Returns false if the encoding fails. */
+bool EncodePNG(const unsigned char *bgra, int width, int height, std::size_t bytesPerLine,
+               int level, int numThreads, std::vector<unsigned char>& out);
+
+/* Encodes a png image incrementally, in bands of consecutive rows stored top to
+ * bottom, so that the rows can be compressed while the rest of the image is still
+ * being produced. Begin() returns the signature and the header, EncodeRows()
+ * filters and deflates a band of rows (different bands can be encoded concurrently),
+ * Append() returns the IDAT chunk of an encoded band and must be called in row
+ * order, End() returns the checksum of the zlib stream and the end chunk. */
+class PNGStreamEncoder {
+
+public:
+
+    struct EncodedRows {
+        std::vector<unsigned char> deflated;
+        uint32_t adler = 1;
+        int rows = 0;
+    };
+
+    PNGStreamEncoder(int width, int height, int level);
+
+    void Begin(std::vector<unsigned char>& out) const;
+
+    /* Encodes the rows [firstRow, firstRow + rows) stored in bgra. prevRow is the
+     * image row firstRow - 1 (BGRA, used by the filters), or null if firstRow is 0.
+     * The band is split in sub-bands deflated on numThreads threads */
+    bool EncodeRows(const unsigned char *bgra, std::size_t bytesPerLine, const unsigned char *prevRow,
+                    int firstRow, int rows, int numThreads, EncodedRows& encoded) const;
+
+    void Append(EncodedRows& encoded, std::vector<unsigned char>& out);
+
+    void End(std::vector<unsigned char>& out);
+
+private:
+
+    int width;
+    int height;
+    int level;
+    uint32_t adler = 1;
+    int rowsAppended = 0;
+};
+
+/* Returns the deflate level used by QImage::save() for the given png quality */
+int PNGCompressionLevel(int quality);
+
+#endif // PNG_WRITER_H
@@ -0,0 +1,169 @@
+/*******************************************************************************
+    Copyright (c) 2021, Andrea Maggiordomo, Paolo Cignoni and Marco Tarini
+
+    This file is part of TextureDefrag, a reference implementation for
+    the paper ``Texture Defragmentation for Photo-Reconstructed 3D Models''
+    by Andrea Maggiordomo, Paolo Cignoni and Marco Tarini.
+
+    TextureDefrag is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    TextureDefrag is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with TextureDefrag. If not, see <https://www.gnu.org/licenses/>.
+*******************************************************************************/
+
+
+#ifndef POOL_PTR_H
+#define POOL_PTR_H
+
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include <cstddef>
+#include <functional>
+#include <new>
+#include <utility>
+
+/* Free list of fixed size blocks of memory, the blocks are allocated in chunks
+ * and never returned to the system, they are reused by the next allocations */
+template <std::size_t Size>
+class BlockPool {
+
+public:
+
+    static void *Allocate()
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        if (freeList.empty()) {
+            char *chunk = static_cast<char *>(::operator new(CHUNK_BLOCKS * Size));
+            for (std::size_t i = 0; i < CHUNK_BLOCKS; ++i)
+                freeList.push_back(chunk + (CHUNK_BLOCKS - 1 - i) * Size);
+        }
+        void *p = freeList.back();
+        freeList.pop_back();
+        return p;
+    }
+
+    static void Deallocate(void *p)
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        freeList.push_back(p);
+    }
+
+private:
+
+    static constexpr std::size_t CHUNK_BLOCKS = 256;
+
+    static std::mutex mtx;
+    static std::vector<void *> freeList;
+};
+
+template <std::size_t Size> std::mutex BlockPool<Size>::mtx;
+template <std::size_t Size> std::vector<void *> BlockPool<Size>::freeList;
+
+/* Reference counted pointer to an object allocated from a BlockPool. The counter
+ * is stored next to the object, so the pointer is a single word and creating an
+ * object allocates neither a control block nor memory from the heap once the
+ * pool has free blocks. The counter is atomic, handles to the same object can be
+ * copied and released by different threads */
+template <typename T>
+class PoolPtr {
+
+    struct Node {
+        std::atomic<int> refs;
+        T object;
+
+        template <typename... Args>
+        Node(Args&&... args) : refs{0}, object(std::forward<Args>(args)...) {}
+    };
+
+public:
+
+    template <typename... Args>
+    static PoolPtr Make(Args&&... args)
+    {
+        void *p = BlockPool<sizeof(Node)>::Allocate();
+        try {
+            return PoolPtr(new (p) Node(std::forward<Args>(args)...));
+        } catch (...) {
+            BlockPool<sizeof(Node)>::Deallocate(p);
+            throw;
+        }
+    }
+
+    PoolPtr() : node{nullptr} {}
+    PoolPtr(std::nullptr_t) : node{nullptr} {}
+
+    PoolPtr(const PoolPtr& other) : node{other.node} { Acquire(); }
+    PoolPtr(PoolPtr&& other) : node{other.node} { other.node = nullptr; }
+
+    ~PoolPtr() { Release(); }
+
+    PoolPtr& operator=(const PoolPtr& other)
+    {
+        if (node != other.node) {
+            other.Acquire();
+            Release();
+            node = other.node;
+        }
+        return *this;
+    }
+
+    PoolPtr& operator=(PoolPtr&& other)
+    {
+        std::swap(node, other.node);
+        return *this;
+    }
+
+    T *get() const { return node ? &node->object : nullptr; }
+    T *operator->() const { return &node->object; }
+    T& operator*() const { return node->object; }
+
+    explicit operator bool() const { return node != nullptr; }
+
+    bool operator==(const PoolPtr& other) const { return node == other.node; }
+    bool operator!=(const PoolPtr& other) const { return node != other.node; }
+    bool operator<(const PoolPtr& other) const { return std::less<Node *>()(node, other.node); }
+
+    bool operator==(std::nullptr_t) const { return node == nullptr; }
+    bool operator!=(std::nullptr_t) const { return node != nullptr; }
+
+private:
+
+    Node *node;
+
+    explicit PoolPtr(Node *n) : node{n} { Acquire(); }
+
+    void Acquire() const
+    {
+        if (node)
+            node->refs.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void Release()
+    {
+        if (node && node->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            node->~Node();
+            BlockPool<sizeof(Node)>::Deallocate(node);
+        }
+        node = nullptr;
+    }
+};
+
+namespace std {
+
+template <typename T>
+struct hash<PoolPtr<T>> {
+    std::size_t operator()(const PoolPtr<T>& p) const { return std::hash<T *>()(p.get()); }
+};
+
+}
+
+#endif // POOL_PTR_H
@@ -29,6 +29,10 @@ typedef unsigned char byte;
 #include <QImage>
 #include <QRgb>
 
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
 namespace vcg
 {
     /* pull push filling algorithm */
@@ -131,8 +135,157 @@ namespace vcg
     }
 
 
+    /* Scanline implementation of the pull push filling, for 32-bit images. It gives
+     * the same result of the per-pixel functions above, but works on the image rows
+     * with a mip pyramid allocated once, and the rows of each level are processed
+     * in parallel */
+
+    struct PullPushLevel {
+        QRgb *bits;
+        int width;
+        int height;
+        std::size_t stride; // in pixels
+    };
+
+    // The four channels of a pixel in 16-bit lanes, so that weighted sums of up to
+    // 256 times a channel value are computed on all the channels at once
+    static inline uint64_t PullPushExpand(QRgb c)
+    {
+        return uint64_t(c & 0xff) | (uint64_t(c & 0xff00) << 8) | (uint64_t(c & 0xff0000) << 16) | (uint64_t(c & 0xff000000) << 24);
+    }
+
+    static inline QRgb PullPushPack(uint64_t e)
+    {
+        return QRgb((e & 0xff) | ((e >> 8) & 0xff00) | ((e >> 16) & 0xff0000) | ((e >> 24) & 0xff000000));
+    }
+
+    static inline QRgb PullPushDivide(uint64_t e, int d)
+    {
+        return qRgba(int((e >> 32) & 0xffff) / d, int((e >> 16) & 0xffff) / d, int(e & 0xffff) / d, int((e >> 48) & 0xffff) / d);
+    }
+
+    static void PullPushMipRows(const PullPushLevel& p, const PullPushLevel& mip, QRgb bkcolor)
+    {
+        #pragma omp parallel for schedule(static)
+        for (int y = 0; y < mip.height; ++y) {
+            const QRgb *row0 = p.bits + std::size_t(2 * y) * p.stride;
+            const QRgb *row1 = row0 + p.stride;
+            QRgb *out = mip.bits + std::size_t(y) * mip.stride;
+            for (int x = 0; x < mip.width; ++x) {
+                // the weights are 0 or 255, so the weighted mean is the mean of the valid pixels
+                QRgb c[4] = { row0[2 * x], row0[2 * x + 1], row1[2 * x], row1[2 * x + 1] };
+                uint64_t sum = 0;
+                int n = 0;
+                for (int k = 0; k < 4; ++k) {
+                    bool valid = (c[k] != bkcolor);
+                    sum += valid ? PullPushExpand(c[k]) : 0;
+                    n += valid;
+                }
+                switch (n) {
+                case 0:  out[x] = bkcolor; break;
+                case 1:  out[x] = PullPushPack(sum); break;
+                case 2:  out[x] = PullPushPack((sum >> 1) & 0x00ff00ff00ff00ffull); break;
+                case 4:  out[x] = PullPushPack((sum >> 2) & 0x00ff00ff00ff00ffull); break;
+                default: out[x] = PullPushDivide(sum, n);
+                }
+            }
+        }
+    }
+
+    static void PullPushFillRows(const PullPushLevel& p, const PullPushLevel& mip, QRgb bkcolor)
+    {
+        #pragma omp parallel for schedule(static)
+        for (int y = 0; y < mip.height; ++y) {
+            const QRgb *m = mip.bits + std::size_t(y) * mip.stride;
+            const QRgb *mUp = (y > 0) ? m - mip.stride : nullptr;
+            const QRgb *mDown = (y < mip.height - 1) ? m + mip.stride : nullptr;
+            QRgb *out[2] = { p.bits + std::size_t(2 * y) * p.stride, p.bits + std::size_t(2 * y + 1) * p.stride };
+            for (int x = 0; x < mip.width; ++x) {
+                bool left = x > 0;
+                bool right = x < mip.width - 1;
+                uint64_t center = PullPushExpand(m[x]) * 144;
+                for (int dy = 0; dy < 2; ++dy) {
+                    const QRgb *mv = (dy == 0) ? mUp : mDown;
+                    for (int dx = 0; dx < 2; ++dx) {
+                        QRgb& dst = out[dy][2 * x + dx];
+                        if (dst != bkcolor)
+                            continue;
+                        // weighted mean of the center and of the horizontal, vertical and
+                        // diagonal neighbors toward the pixel (the weights sum to 256 inside)
+                        bool h = (dx == 0) ? left : right;
+                        int hx = (dx == 0) ? x - 1 : x + 1;
+                        uint64_t sum = center;
+                        int wsum = 144;
+                        if (h) { sum += PullPushExpand(m[hx]) * 48; wsum += 48; }
+                        if (mv) { sum += PullPushExpand(mv[x]) * 48; wsum += 48; }
+                        if (h && mv) { sum += PullPushExpand(mv[hx]) * 16; wsum += 16; }
+                        dst = (wsum == 256) ? PullPushPack((sum >> 8) & 0x00ff00ff00ff00ffull) : PullPushDivide(sum, wsum);
+                    }
+                }
+            }
+        }
+        // avoid background bleeding on non power-of-two images
+
+        if ((p.width % 2) != 0) {
+            #pragma omp parallel for schedule(static)
+            for (int y = 0; y < p.height; ++y) {
+                QRgb *row = p.bits + std::size_t(y) * p.stride;
+                for (int x = std::max(2 * mip.width, 1); x < p.width; ++x) {
+                    if (row[x] == bkcolor)
+                        row[x] = row[x - 1];
+                }
+            }
+        }
+
+        if ((p.height % 2) != 0) {
+            for (int y = std::max(2 * mip.height, 1); y < p.height; ++y) {
+                QRgb *row = p.bits + std::size_t(y) * p.stride;
+                const QRgb *prev = row - p.stride;
+                #pragma omp parallel for schedule(static)
+                for (int x = 0; x < p.width; ++x) {
+                    if (row[x] == bkcolor)
+                        row[x] = prev[x];
+                }
+            }
+        }
+    }
+
+    static void PullPushScanline( QImage & p, QRgb  bkcolor )
+    {
+        std::vector<PullPushLevel> levels;
+        levels.push_back({ reinterpret_cast<QRgb *>(p.bits()), p.width(), p.height(), std::size_t(p.bytesPerLine() / 4) });
+
+        // same levels of PullPush(): the image size divided by 2, 4, ... until a side is 1
+        std::vector<std::size_t> offsets;
+        std::size_t pyramidSize = 0;
+        for (int div = 2; ; div *= 2) {
+            int w = p.width() / div;
+            int h = p.height() / div;
+            offsets.push_back(pyramidSize);
+            pyramidSize += std::size_t(w) * std::size_t(h);
+            levels.push_back({ nullptr, w, h, std::size_t(w) });
+            if (w <= 1 || h <= 1) break;
+        }
+        std::vector<QRgb> pyramid(pyramidSize);
+        for (std::size_t i = 1; i < levels.size(); ++i)
+            levels[i].bits = pyramid.data() + offsets[i - 1];
+
+        // pull phase create the mipmap
+        for (std::size_t i = 1; i < levels.size(); ++i)
+            PullPushMipRows(levels[i - 1], levels[i], bkcolor);
+
+        // push phase: refill
+        for (std::size_t i = levels.size() - 1; i > 0; --i)
+            PullPushFillRows(levels[i - 1], levels[i], bkcolor);
+    }
+
     static void PullPush( QImage & p, QRgb  bkcolor )
     {
+        if (!p.isNull() && (p.format() == QImage::Format_ARGB32 || p.format() == QImage::Format_RGB32)) {
+            PullPushScanline(p, bkcolor);
+            return;
+        }
+
         int i=0;
         std::vector<QImage> mip(16);
         int div=2;
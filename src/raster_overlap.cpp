@@ -0,0 +1,276 @@
+/*******************************************************************************
+    Copyright (c) 2021, Andrea Maggiordomo, Paolo Cignoni and Marco Tarini
+
+    This file is part of TextureDefrag, a reference implementation for
+    the paper ``Texture Defragmentation for Photo-Reconstructed 3D Models''
+    by Andrea Maggiordomo, Paolo Cignoni and Marco Tarini.
+
+    TextureDefrag is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    TextureDefrag is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with TextureDefrag. If not, see <https://www.gnu.org/licenses/>.
+*******************************************************************************/
+
+#include "raster_overlap.h"
+#include "gl_utils.h"
+#include "logging.h"
+
+#include <QPointer>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <memory>
+
+#include <QOpenGLContext>
+
+
+static const char *raster_vs_text[] = {
+    "#version 410 core                                           \n"
+    "                                                            \n"
+    "layout(location = 0) in vec2 position;                      \n"
+    "layout(location = 1) in float fixedFace;                    \n"
+    "flat out float ffixed;                                      \n"
+    "                                                            \n"
+    "void main(void)                                             \n"
+    "{                                                           \n"
+    "    ffixed = fixedFace;                                     \n"
+    "    gl_Position = vec4(2.0 * position - 1.0, 0.5, 1.0);     \n"
+    "}                                                           \n"
+};
+
+static const char *raster_fs_text[] = {
+    "#version 410 core                                           \n"
+    "                                                            \n"
+    "flat in float ffixed;                                       \n"
+    "out vec2 count;                                             \n"
+    "                                                            \n"
+    "void main(void)                                             \n"
+    "{                                                           \n"
+    "    count = (ffixed > 0.5) ? vec2(0.0, 1.0) : vec2(1.0, 0.0); \n"
+    "}                                                           \n"
+};
+
+// Floats per vertex: position in the box (normalized) and fixed flag
+static const int RASTER_VERTEX_STRIDE = 3;
+
+/* Objects of the coverage pass, owned by the OpenGL context that was current
+ * when they were created. The coverage target grows to the largest grid used.
+ * The owner is tracked with a guarded pointer, so that the objects of a
+ * destroyed context (which are freed with it) are never touched */
+struct RasterOverlapContext {
+    QPointer<QOpenGLContext> owner;
+    OpenGLFunctionsHandle glFuncs = nullptr;
+    GLuint program = 0;
+    GLuint vao = 0;
+    GLuint vertexbuf = 0;
+    GLuint fbo = 0;
+    GLuint coverage = 0;
+    int targetWidth = 0;
+    int targetHeight = 0;
+    std::vector<float> vertices;
+    std::vector<float> pixels;
+
+    RasterOverlapContext()
+    {
+        owner = QOpenGLContext::currentContext();
+        glFuncs = GetOpenGLFunctionsHandle();
+
+        program = CompileShaders(raster_vs_text, raster_fs_text);
+
+        glFuncs->glGenVertexArrays(1, &vao);
+        glFuncs->glBindVertexArray(vao);
+        glFuncs->glGenBuffers(1, &vertexbuf);
+        glFuncs->glBindBuffer(GL_ARRAY_BUFFER, vertexbuf);
+        glFuncs->glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, RASTER_VERTEX_STRIDE * sizeof(float), 0);
+        glFuncs->glEnableVertexAttribArray(0);
+        glFuncs->glVertexAttribPointer(1, 1, GL_FLOAT, GL_FALSE, RASTER_VERTEX_STRIDE * sizeof(float), (void *)(2 * sizeof(float)));
+        glFuncs->glEnableVertexAttribArray(1);
+        glFuncs->glBindVertexArray(0);
+
+        glFuncs->glGenFramebuffers(1, &fbo);
+        glFuncs->glGenTextures(1, &coverage);
+    }
+
+    ~RasterOverlapContext()
+    {
+        if (owner.isNull() || QOpenGLContext::currentContext() != owner)
+            return;
+        glFuncs->glDeleteProgram(program);
+        glFuncs->glDeleteVertexArrays(1, &vao);
+        glFuncs->glDeleteBuffers(1, &vertexbuf);
+        glFuncs->glDeleteFramebuffers(1, &fbo);
+        glFuncs->glDeleteTextures(1, &coverage);
+    }
+
+    void releaseBuffers()
+    {
+        std::vector<float>().swap(vertices);
+        std::vector<float>().swap(pixels);
+    }
+
+    void prepareTarget(int width, int height)
+    {
+        glFuncs->glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+        if (width > targetWidth || height > targetHeight) {
+            targetWidth = std::max(width, targetWidth);
+            targetHeight = std::max(height, targetHeight);
+            glFuncs->glBindTexture(GL_TEXTURE_2D, coverage);
+            glFuncs->glTexImage2D(GL_TEXTURE_2D, 0, GL_RG32F, targetWidth, targetHeight, 0, GL_RG, GL_FLOAT, NULL);
+            glFuncs->glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+            glFuncs->glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+            glFuncs->glBindTexture(GL_TEXTURE_2D, 0);
+            glFuncs->glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, coverage, 0);
+            if (glFuncs->glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+                LOG_ERR << "[OPENGL] FATAL: Framebuffer is not complete.";
+                CHECK_GL_ERROR();
+                std::exit(-1);
+            }
+        }
+    }
+};
+
+// The resources are per thread, since a context can only be current on one thread
+static thread_local std::unique_ptr<RasterOverlapContext> rasterContext;
+
+// The objects of contexts that were not current when they had to be released,
+// they are deleted when their context is current again (or dropped if the
+// context no longer exists)
+static thread_local std::vector<std::unique_ptr<RasterOverlapContext>> orphanedContexts;
+
+static void OrphanRasterContext();
+static void CollectOrphanedContexts(QOpenGLContext *current);
+
+
+static void AppendFaces(std::vector<float>& vertices, const std::vector<Mesh::FacePointer>& faces, const vcg::Box2d& box, float fixedFace)
+{
+    // the positions are normalized in double precision, so that the vertices
+    // shared by adjacent faces map to the same float coordinates
+    vcg::Point2d dim = box.max - box.min;
+    for (auto fptr : faces) {
+        for (int i = 0; i < 3; ++i) {
+            vcg::Point2d p = fptr->cV(i)->cT().P();
+            vertices.push_back(float((p.X() - box.min.X()) / dim.X()));
+            vertices.push_back(float((p.Y() - box.min.Y()) / dim.Y()));
+            vertices.push_back(fixedFace);
+        }
+    }
+}
+
+int CountOverlappingTexels(const std::vector<Mesh::FacePointer>& area, const std::vector<Mesh::FacePointer>& fixed,
+                           const vcg::Box2d& box, int resolution)
+{
+    QOpenGLContext *current = QOpenGLContext::currentContext();
+    if (current == nullptr)
+        return -1;
+
+    if (area.empty() || box.IsNull() || box.DimX() <= 0 || box.DimY() <= 0)
+        return 0;
+
+    if (rasterContext && rasterContext->owner != current)
+        OrphanRasterContext();
+
+    if (!rasterContext) {
+        // reuse the objects left to this context, if any
+        auto it = std::find_if(orphanedContexts.begin(), orphanedContexts.end(),
+                               [current] (const std::unique_ptr<RasterOverlapContext>& ctx) { return ctx->owner == current; });
+        if (it != orphanedContexts.end()) {
+            rasterContext = std::move(*it);
+            orphanedContexts.erase(it);
+        } else {
+            rasterContext.reset(new RasterOverlapContext);
+        }
+    }
+    CollectOrphanedContexts(current);
+
+    RasterOverlapContext& ctx = *rasterContext;
+    OpenGLFunctionsHandle glFuncs = ctx.glFuncs;
+
+    // the grid keeps the aspect ratio of the box
+    int width = resolution;
+    int height = resolution;
+    if (box.DimX() > box.DimY())
+        height = std::max(1, (int) std::ceil(resolution * box.DimY() / box.DimX()));
+    else
+        width = std::max(1, (int) std::ceil(resolution * box.DimX() / box.DimY()));
+
+    ctx.vertices.clear();
+    AppendFaces(ctx.vertices, area, box, 0);
+    AppendFaces(ctx.vertices, fixed, box, 1);
+
+    ctx.prepareTarget(width, height);
+    glFuncs->glViewport(0, 0, width, height);
+    glFuncs->glDisable(GL_DEPTH_TEST);
+    glFuncs->glDisable(GL_SCISSOR_TEST);
+    glFuncs->glClearColor(0, 0, 0, 0);
+    glFuncs->glClear(GL_COLOR_BUFFER_BIT);
+
+    glFuncs->glEnable(GL_BLEND);
+    glFuncs->glBlendEquation(GL_FUNC_ADD);
+    glFuncs->glBlendFunc(GL_ONE, GL_ONE);
+
+    glFuncs->glUseProgram(ctx.program);
+    glFuncs->glBindVertexArray(ctx.vao);
+    glFuncs->glBindBuffer(GL_ARRAY_BUFFER, ctx.vertexbuf);
+    glFuncs->glBufferData(GL_ARRAY_BUFFER, ctx.vertices.size() * sizeof(float), ctx.vertices.data(), GL_STREAM_DRAW);
+    glFuncs->glDrawArrays(GL_TRIANGLES, 0, ctx.vertices.size() / RASTER_VERTEX_STRIDE);
+    glFuncs->glBindVertexArray(0);
+
+    glFuncs->glDisable(GL_BLEND);
+
+    ctx.pixels.resize(2 * std::size_t(width) * height);
+    glFuncs->glPixelStorei(GL_PACK_ALIGNMENT, 4);
+    glFuncs->glReadPixels(0, 0, width, height, GL_RG, GL_FLOAT, ctx.pixels.data());
+    glFuncs->glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    CHECK_GL_ERROR();
+
+    int overlaps = 0;
+    for (std::size_t i = 0; i < ctx.pixels.size(); i += 2) {
+        float areaCount = ctx.pixels[i];
+        float fixedCount = ctx.pixels[i + 1];
+        if (areaCount > 1.5f || (areaCount > 0.5f && fixedCount > 0.5f))
+            overlaps++;
+    }
+
+    return overlaps;
+}
+
+void ReleaseRasterOverlapResources()
+{
+    QOpenGLContext *current = QOpenGLContext::currentContext();
+    if (rasterContext) {
+        if (current == rasterContext->owner)
+            rasterContext.reset();
+        else
+            OrphanRasterContext();
+    }
+    CollectOrphanedContexts(current);
+}
+
+// -- static functions ---
+
+static void OrphanRasterContext()
+{
+    // the GL objects can only be deleted by their context, but the memory on the
+    // CPU side is freed right away
+    rasterContext->releaseBuffers();
+    orphanedContexts.push_back(std::move(rasterContext));
+}
+
+static void CollectOrphanedContexts(QOpenGLContext *current)
+{
+    auto end = std::remove_if(orphanedContexts.begin(), orphanedContexts.end(),
+                              [current] (const std::unique_ptr<RasterOverlapContext>& ctx) {
+                                  return ctx->owner.isNull() || (current != nullptr && ctx->owner == current);
+                              });
+    // the destructor deletes the objects of the current context
+    orphanedContexts.erase(end, orphanedContexts.end());
+}
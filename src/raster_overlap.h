@@ -0,0 +1,48 @@
+/*******************************************************************************
+    Copyright (c) 2021, Andrea Maggiordomo, Paolo Cignoni and Marco Tarini
+
+    This file is part of TextureDefrag, a reference implementation for
+    the paper ``Texture Defragmentation for Photo-Reconstructed 3D Models''
+    by Andrea Maggiordomo, Paolo Cignoni and Marco Tarini.
+
+    TextureDefrag is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    TextureDefrag is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with TextureDefrag. If not, see <https://www.gnu.org/licenses/>.
+*******************************************************************************/
+
+#ifndef RASTER_OVERLAP_H
+#define RASTER_OVERLAP_H
+
+#include "mesh.h"
+
+#include <vector>
+
+/* Overlap test of an optimization area by rasterization. The triangles of the
+ * area and the fixed triangles are drawn with additive blending into the two
+ * channels of a float coverage buffer that spans the box, so a texel center
+ * covered by two triangles of the area, or by a triangle of the area and a fixed
+ * one, ends up with a count larger than one. The rasterization rules cover each
+ * texel center once along the edges shared by adjacent triangles, so the texels
+ * of a mesh without overlaps are covered at most once. Overlaps between fixed
+ * triangles are ignored, they were not introduced by the optimization.
+ *
+ * Returns the number of overlapping texels of a grid of resolution texels along
+ * the longest side of the box, or -1 if no OpenGL context is current on the
+ * calling thread. Overlaps smaller than a texel of the grid can be missed */
+int CountOverlappingTexels(const std::vector<Mesh::FacePointer>& area, const std::vector<Mesh::FacePointer>& fixed,
+                           const vcg::Box2d& box, int resolution);
+
+/* Deletes the objects of the test created on the calling thread if their context
+ * is current, otherwise they are left to their context */
+void ReleaseRasterOverlapResources();
+
+#endif // RASTER_OVERLAP_H
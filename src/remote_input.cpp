@@ -0,0 +1,753 @@
+/*******************************************************************************
+    Copyright (c) 2021, Andrea Maggiordomo, Paolo Cignoni and Marco Tarini
+
+    This file is part of TextureDefrag, a reference implementation for
+    the paper ``Texture Defragmentation for Photo-Reconstructed 3D Models''
+    by Andrea Maggiordomo, Paolo Cignoni and Marco Tarini.
+
+    TextureDefrag is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    TextureDefrag is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with TextureDefrag. If not, see <https://www.gnu.org/licenses/>.
+*******************************************************************************/
+
+#include "remote_input.h"
+#include "result_cache.h"
+#include "logging.h"
+#include "timer.h"
+
+#include <map>
+#include <deque>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include <condition_variable>
+
+#include <QByteArray>
+#include <QCoreApplication>
+#include <QCryptographicHash>
+#include <QDateTime>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QEventLoop>
+#include <QFile>
+#include <QFileInfo>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QMessageAuthenticationCode>
+#include <QNetworkAccessManager>
+#include <QNetworkReply>
+#include <QNetworkRequest>
+#include <QString>
+#include <QTimer>
+#include <QUrl>
+
+
+// size of the range requests, and number of requests in flight for each file
+constexpr qint64 RANGE_BYTES = 8ll << 20;
+constexpr int RANGE_CONNECTIONS = 4;
+
+// threads downloading the queued files
+constexpr int PREFETCH_THREADS = 4;
+
+// attempts of each request, and time without data after which a transfer is aborted
+constexpr int REQUEST_ATTEMPTS = 4;
+constexpr qint64 STALL_TIMEOUT_MS = 30000;
+
+// interval between the checks of the timeouts and of the cancellation of a transfer
+constexpr int WATCHDOG_INTERVAL_MS = 100;
+
+/* A remote object, the path is decoded and starts with a slash */
+struct RemoteObject {
+    std::string scheme;     // s3, http or https
+    std::string authority;  // bucket, or host and port
+    std::string path;
+    std::string query;      // encoded query of the http urls (signed urls), only kept for the mesh
+};
+
+struct StagedFile {
+    enum State { Queued, Fetching, Done, Failed };
+    State state = Queued;
+    RemoteObject object;
+};
+
+struct Response {
+    int status = 0;             // HTTP status, 0 if no reply was received
+    QByteArray body;
+    qint64 totalSize = -1;      // size of the object, from Content-Range or Content-Length
+    QDateTime lastModified;
+    QByteArray etag;
+};
+
+// the staged files by local path, and the queue of the files to download. The
+// thread list is never destroyed, the threads may still run when the process exits
+static std::mutex stagingMtx;
+static std::condition_variable stagingCv;
+static std::map<std::string, StagedFile> staged;
+static std::map<std::string, std::string> stagedMeshes;     // local path by uri
+static std::map<std::string, RemoteObject> origins;         // bucket or server by staging subdirectory
+static std::deque<std::string> queue;
+static std::vector<std::thread>& workers = *new std::vector<std::thread>;
+static std::atomic<bool> stopping(false);
+static RemoteInputStats stats;
+
+static bool ParseUri(const std::string& uri, RemoteObject *object);
+static std::string StagingRoot();
+static std::string NormalizePath(const std::string& path);
+static std::string LocalPath(const RemoteObject& object);
+static bool RemoteObjectOf(const std::string& localPath, RemoteObject *object);
+static bool FetchStagedFile(const std::string& localPath, std::unique_lock<std::mutex>& lock);
+static void RunPrefetch();
+static bool DownloadFile(const RemoteObject& object, const std::string& localPath);
+static bool Request(QNetworkAccessManager& nam, const RemoteObject& object, const QByteArray& verb,
+                    qint64 first, qint64 last, const QByteArray& ifMatch, Response *res);
+static QNetworkRequest MakeRequest(const RemoteObject& object, const QByteArray& verb);
+static QByteArray Hmac(const QByteArray& key, const QByteArray& message);
+static void ScanOBJDependencies(const std::string& path, std::vector<std::string>& libraries);
+static void ScanMTLTextures(const std::string& path, std::vector<std::string>& textures);
+static void ScanGLTFDependencies(const std::string& path, std::vector<std::string>& buffers, std::vector<std::string>& images);
+
+
+bool IsRemoteUri(const std::string& path)
+{
+    for (const char *scheme : {"s3://", "http://", "https://"})
+        if (path.compare(0, std::strlen(scheme), scheme) == 0)
+            return true;
+    return false;
+}
+
+std::string StageRemoteMesh(const std::string& uri)
+{
+    RemoteObject object;
+    if (!ParseUri(uri, &object)) {
+        LOG_ERR << "Unsupported URI " << uri;
+        return "";
+    }
+
+    // the first caller downloads the mesh, the others wait for it
+    std::string localPath;
+    bool download = false;
+    {
+        std::lock_guard<std::mutex> lock(stagingMtx);
+        auto it = stagedMeshes.find(uri);
+        if (it != stagedMeshes.end()) {
+            localPath = it->second;
+        } else {
+            localPath = LocalPath(object);
+            stagedMeshes[uri] = localPath;
+            StagedFile& sf = staged[localPath];
+            sf.object = object;
+            if (sf.state == StagedFile::Queued || sf.state == StagedFile::Failed) {
+                queue.erase(std::remove(queue.begin(), queue.end(), localPath), queue.end());
+                sf.state = StagedFile::Fetching;
+                download = true;
+            }
+        }
+    }
+
+    if (download) {
+        Timer t;
+        LOG_INFO << "Downloading " << uri;
+        std::unique_lock<std::mutex> lock(stagingMtx);
+        if (!FetchStagedFile(localPath, lock)) {
+            stagedMeshes.erase(uri);
+            return "";
+        }
+        lock.unlock();
+        LOG_INFO << "Downloaded " << uri << " (" << QFileInfo(localPath.c_str()).size() / double(1 << 20) << " MB) in " << t.TimeElapsed() << " seconds";
+    } else if (!WaitForRemoteFile(localPath)) {
+        return "";
+    }
+
+    // the files read by the parsers are downloaded now, the textures they reference
+    // are queued and transfer while the mesh is parsed
+    std::vector<std::string> dependencies;
+    std::vector<std::string> textures;
+    const QString suffix = QFileInfo(localPath.c_str()).suffix().toLower();
+    if (suffix == "obj") {
+        ScanOBJDependencies(localPath, dependencies);
+        if (!FetchRemoteFiles(dependencies))
+            LOG_WARN << "Unable to download the material libraries of " << uri;
+        for (const std::string& library : dependencies)
+            ScanMTLTextures(library, textures);
+    } else if (suffix == "gltf" || suffix == "glb") {
+        ScanGLTFDependencies(localPath, dependencies, textures);
+        if (!FetchRemoteFiles(dependencies))
+            LOG_WARN << "Unable to download the buffers of " << uri;
+    }
+    for (const std::string& texture : textures)
+        StageRemoteFile(texture);
+
+    return localPath;
+}
+
+bool StageRemoteFile(const std::string& localPath)
+{
+    const std::string path = NormalizePath(localPath);
+    std::lock_guard<std::mutex> lock(stagingMtx);
+    if (staged.count(path) > 0)
+        return true;
+    RemoteObject object;
+    if (!RemoteObjectOf(path, &object))
+        return false;
+    staged[path].object = object;
+    queue.push_back(path);
+    if (workers.empty()) {
+        for (int i = 0; i < PREFETCH_THREADS; ++i)
+            workers.emplace_back([i]() {
+                LOG_SET_THREAD_NAME("prefetch-" + std::to_string(i));
+                RunPrefetch();
+            });
+    }
+    stagingCv.notify_all();
+    return true;
+}
+
+bool IsStagedRemoteFile(const std::string& localPath)
+{
+    std::lock_guard<std::mutex> lock(stagingMtx);
+    return staged.count(NormalizePath(localPath)) > 0;
+}
+
+bool WaitForRemoteFile(const std::string& localPath)
+{
+    const std::string path = NormalizePath(localPath);
+    std::unique_lock<std::mutex> lock(stagingMtx);
+    auto it = staged.find(path);
+    if (it == staged.end())
+        return true;
+    if (it->second.state == StagedFile::Done || it->second.state == StagedFile::Failed)
+        return it->second.state == StagedFile::Done;
+
+    Timer t;
+    stats.waits++;
+    bool ok;
+    if (it->second.state == StagedFile::Queued) {
+        // needed now, downloaded before the rest of the queue
+        queue.erase(std::remove(queue.begin(), queue.end(), path), queue.end());
+        ok = FetchStagedFile(path, lock);
+    } else {
+        // the entries of the failed downloads may be dropped by StopRemoteFetches
+        auto state = [&path]() {
+            auto f = staged.find(path);
+            return (f == staged.end()) ? StagedFile::Failed : f->second.state;
+        };
+        stagingCv.wait(lock, [&state]() { return state() == StagedFile::Done || state() == StagedFile::Failed; });
+        ok = state() == StagedFile::Done;
+    }
+    stats.waitS += t.TimeElapsed();
+    return ok;
+}
+
+bool ReadRemoteFilePrefix(const std::string& localPath, int size, QByteArray *data)
+{
+    const std::string path = NormalizePath(localPath);
+    RemoteObject object;
+    {
+        std::lock_guard<std::mutex> lock(stagingMtx);
+        auto it = staged.find(path);
+        if (it != staged.end() && it->second.state == StagedFile::Failed)
+            return false;
+        if (it == staged.end() || it->second.state == StagedFile::Done) {
+            QFile file(path.c_str());
+            if (!file.open(QIODevice::ReadOnly))
+                return false;
+            *data = file.read(size);
+            return true;
+        }
+        object = it->second.object;
+    }
+
+    QNetworkAccessManager nam;
+    Response res;
+    if (!Request(nam, object, "GET", 0, size - 1, QByteArray(), &res))
+        return false;
+    *data = res.body.left(size);
+    std::lock_guard<std::mutex> lock(stagingMtx);
+    stats.bytes += res.body.size();
+    return true;
+}
+
+bool FetchRemoteFiles(const std::vector<std::string>& localPaths)
+{
+    // all the files are queued before waiting, so that they download concurrently
+    for (const std::string& path : localPaths)
+        StageRemoteFile(path);
+    bool ok = true;
+    for (const std::string& path : localPaths)
+        ok = WaitForRemoteFile(path) && ok;
+    return ok;
+}
+
+void StopRemoteFetches()
+{
+    std::vector<std::thread> stopped;
+    {
+        std::lock_guard<std::mutex> lock(stagingMtx);
+        stopping = true;
+        for (const std::string& path : queue)
+            staged.erase(path);
+        queue.clear();
+        stopped.swap(workers);
+        stagingCv.notify_all();
+    }
+    for (std::thread& worker : stopped)
+        worker.join();
+
+    // the transfers aborted are tried again if the files are staged again
+    std::lock_guard<std::mutex> lock(stagingMtx);
+    for (auto it = staged.begin(); it != staged.end(); ) {
+        if (it->second.state == StagedFile::Failed)
+            it = staged.erase(it);
+        else
+            ++it;
+    }
+    stopping = false;
+}
+
+RemoteInputStats GetRemoteInputStats()
+{
+    std::lock_guard<std::mutex> lock(stagingMtx);
+    return stats;
+}
+
+
+// -- static functions ---------------------------------------------------------
+
+static bool ParseUri(const std::string& uri, RemoteObject *object)
+{
+    *object = RemoteObject();
+    if (uri.compare(0, 5, "s3://") == 0) {
+        const std::size_t slash = uri.find('/', 5);
+        if (slash == std::string::npos || slash == 5 || slash + 1 == uri.size())
+            return false;
+        object->scheme = "s3";
+        object->authority = uri.substr(5, slash - 5);
+        object->path = QDir::cleanPath(QString::fromStdString(uri.substr(slash))).toStdString();
+        return true;
+    }
+
+    QUrl url(QString::fromStdString(uri));
+    if (!url.isValid() || (url.scheme() != "http" && url.scheme() != "https") || url.host().isEmpty())
+        return false;
+    object->scheme = url.scheme().toStdString();
+    object->authority = url.authority(QUrl::FullyEncoded).toStdString();
+    object->path = QDir::cleanPath(url.path(QUrl::FullyDecoded)).toStdString();
+    object->query = url.query(QUrl::FullyEncoded).toStdString();
+    return !object->path.empty() && object->path != "/";
+}
+
+static std::string StagingRoot()
+{
+    static const std::string root = []() {
+        QString dir = qEnvironmentVariableIsSet("TEXTURE_DEFRAG_STAGING")
+                ? QString::fromLocal8Bit(qgetenv("TEXTURE_DEFRAG_STAGING"))
+                : QDir::temp().absoluteFilePath("texture-defrag-remote");
+        return QDir::cleanPath(QDir().absoluteFilePath(dir)).toStdString();
+    }();
+    return root;
+}
+
+static std::string NormalizePath(const std::string& path)
+{
+    return QDir::cleanPath(QDir().absoluteFilePath(QString::fromStdString(path))).toStdString();
+}
+
+/* Returns the staging path of the object, in the subdirectory of its bucket or
+ * server. Called with stagingMtx held */
+static std::string LocalPath(const RemoteObject& object)
+{
+    char name[32];
+    std::snprintf(name, sizeof(name), "%016llx", (unsigned long long) CacheKey().Add(object.scheme).Add(object.authority).Value());
+    RemoteObject& origin = origins[name];
+    origin.scheme = object.scheme;
+    origin.authority = object.authority;
+    return StagingRoot() + "/" + name + object.path;
+}
+
+/* Returns the object mirrored by the path, if it lies in the subdirectory of a
+ * bucket or server already staged. Called with stagingMtx held */
+static bool RemoteObjectOf(const std::string& localPath, RemoteObject *object)
+{
+    const std::string root = StagingRoot() + "/";
+    if (localPath.compare(0, root.size(), root) != 0)
+        return false;
+    const std::size_t slash = localPath.find('/', root.size());
+    if (slash == std::string::npos)
+        return false;
+    auto it = origins.find(localPath.substr(root.size(), slash - root.size()));
+    if (it == origins.end())
+        return false;
+    *object = it->second;
+    object->path = localPath.substr(slash);
+    return true;
+}
+
+/* Downloads the staged file on the calling thread, with the lock held on entry and
+ * on exit. Returns false if the download failed */
+static bool FetchStagedFile(const std::string& localPath, std::unique_lock<std::mutex>& lock)
+{
+    StagedFile& sf = staged[localPath];
+    sf.state = StagedFile::Fetching;
+    const RemoteObject object = sf.object;
+
+    lock.unlock();
+    bool ok = DownloadFile(object, localPath);
+    lock.lock();
+
+    // the map entries are stable, but the entry may have been dropped by StopRemoteFetches
+    staged[localPath].state = ok ? StagedFile::Done : StagedFile::Failed;
+    if (!ok) {
+        stats.failed++;
+        LOG_WARN << "Unable to download " << object.scheme << "://" << object.authority << object.path;
+    }
+    stagingCv.notify_all();
+    return ok;
+}
+
+static void RunPrefetch()
+{
+    std::unique_lock<std::mutex> lock(stagingMtx);
+    while (true) {
+        stagingCv.wait(lock, []() { return stopping || !queue.empty(); });
+        if (stopping)
+            return;
+        std::string path = queue.front();
+        queue.pop_front();
+        FetchStagedFile(path, lock);
+    }
+}
+
+/* Downloads the object to localPath with up to RANGE_CONNECTIONS range requests in
+ * flight, unless the staged copy has the size and the modification time of the
+ * object. The copy is written next to localPath and renamed once complete, with the
+ * modification time of the object */
+static bool DownloadFile(const RemoteObject& object, const std::string& localPath)
+{
+    Timer t;
+    QNetworkAccessManager nam;
+    Response res;
+
+    QFileInfo local(localPath.c_str());
+    if (local.exists() && Request(nam, object, "HEAD", -1, -1, QByteArray(), &res) && res.totalSize == local.size()
+            && res.lastModified.isValid() && res.lastModified.toMSecsSinceEpoch() / 1000 == local.lastModified().toMSecsSinceEpoch() / 1000) {
+        std::lock_guard<std::mutex> lock(stagingMtx);
+        stats.reused++;
+        return true;
+    }
+
+    // the first range also returns the size of the object
+    if (!Request(nam, object, "GET", 0, RANGE_BYTES - 1, QByteArray(), &res))
+        return false;
+    const qint64 total = (res.status == 416) ? 0 : res.totalSize;
+    const qint64 firstBytes = res.body.size();
+    if (total < firstBytes || (firstBytes < total && res.status != 206))
+        return false;
+
+    if (!QDir().mkpath(local.absolutePath()))
+        return false;
+    const QString partPath = QString::fromStdString(localPath) + "." + QString::number(QCoreApplication::applicationPid()) + ".part";
+    {
+        QFile part(partPath);
+        if (!part.open(QIODevice::WriteOnly | QIODevice::Truncate) || !part.resize(total) || part.write(res.body) != firstBytes)
+            return false;
+    }
+
+    // the other ranges are requested only if the object did not change meanwhile
+    // (the weak entity tags cannot be matched)
+    const QByteArray etag = res.etag.startsWith("W/") ? QByteArray() : res.etag;
+    const qint64 ranges = (total - firstBytes + RANGE_BYTES - 1) / RANGE_BYTES;
+    std::atomic<qint64> next(0);
+    std::atomic<bool> ok(true);
+    std::atomic<qint64> bytes(firstBytes);
+    auto fetchRanges = [&](QNetworkAccessManager& rangeNam) {
+        QFile part(partPath);
+        if (!part.open(QIODevice::ReadWrite)) {
+            ok = false;
+            return;
+        }
+        Response rangeRes;
+        for (qint64 r = next++; r < ranges && ok; r = next++) {
+            const qint64 first = firstBytes + r * RANGE_BYTES;
+            const qint64 last = std::min(total, first + RANGE_BYTES) - 1;
+            if (!Request(rangeNam, object, "GET", first, last, etag, &rangeRes) || rangeRes.status != 206
+                    || rangeRes.body.size() != last - first + 1 || !part.seek(first) || part.write(rangeRes.body) != rangeRes.body.size())
+                ok = false;
+            else
+                bytes += rangeRes.body.size();
+        }
+    };
+    std::vector<std::thread> helpers;
+    for (int i = 1; i < std::min<qint64>(RANGE_CONNECTIONS, ranges); ++i)
+        helpers.emplace_back([&fetchRanges]() {
+            QNetworkAccessManager rangeNam;
+            fetchRanges(rangeNam);
+        });
+    fetchRanges(nam);
+    for (std::thread& helper : helpers)
+        helper.join();
+
+    if (ok) {
+        QFile part(partPath);
+        if (res.lastModified.isValid())
+            ok = part.open(QIODevice::ReadWrite) && part.setFileTime(res.lastModified, QFileDevice::FileModificationTime);
+        part.close();
+        QFile::remove(QString::fromStdString(localPath));
+        ok = ok && QFile::rename(partPath, QString::fromStdString(localPath));
+    }
+    if (!ok)
+        QFile::remove(partPath);
+
+    std::lock_guard<std::mutex> lock(stagingMtx);
+    stats.bytes += bytes;
+    stats.transferS += t.TimeElapsed();
+    if (ok)
+        stats.files++;
+    return ok;
+}
+
+/* Sends the request (a range request if first is not negative) on the calling
+ * thread and waits for the reply, retrying after the network errors and the
+ * errors of the server. Returns false if the object could not be read */
+static bool Request(QNetworkAccessManager& nam, const RemoteObject& object, const QByteArray& verb,
+                    qint64 first, qint64 last, const QByteArray& ifMatch, Response *res)
+{
+    for (int attempt = 0; attempt < REQUEST_ATTEMPTS && !stopping; ++attempt) {
+        if (attempt > 0)
+            std::this_thread::sleep_for(std::chrono::milliseconds(250 << attempt));
+
+        QNetworkRequest request = MakeRequest(object, verb);
+        if (first >= 0)
+            request.setRawHeader("Range", "bytes=" + QByteArray::number(first) + "-" + QByteArray::number(last));
+        if (!ifMatch.isEmpty())
+            request.setRawHeader("If-Match", ifMatch);
+
+        QNetworkReply *reply = (verb == "HEAD") ? nam.head(request) : nam.get(request);
+        QEventLoop loop;
+        QTimer watchdog;
+        QElapsedTimer idle;
+        idle.start();
+        QObject::connect(reply, &QNetworkReply::finished, &loop, &QEventLoop::quit);
+        QObject::connect(reply, &QNetworkReply::downloadProgress, &loop, [&idle](qint64, qint64) { idle.restart(); });
+        QObject::connect(&watchdog, &QTimer::timeout, &loop, [&idle, reply]() {
+            if (stopping || idle.elapsed() > STALL_TIMEOUT_MS)
+                reply->abort();
+        });
+        watchdog.start(WATCHDOG_INTERVAL_MS);
+        if (!reply->isFinished())
+            loop.exec();
+        watchdog.stop();
+
+        *res = Response();
+        res->status = reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+        res->body = reply->readAll();
+        res->lastModified = reply->header(QNetworkRequest::LastModifiedHeader).toDateTime();
+        res->etag = reply->rawHeader("ETag");
+        const QByteArray contentRange = reply->rawHeader("Content-Range");
+        const int totalStart = contentRange.lastIndexOf('/');
+        if (res->status == 206 && totalStart >= 0)
+            res->totalSize = contentRange.mid(totalStart + 1).toLongLong();
+        else if (res->status == 200 && verb == "HEAD")
+            res->totalSize = reply->header(QNetworkRequest::ContentLengthHeader).toLongLong();
+        else if (res->status == 200)
+            res->totalSize = res->body.size();
+        const QString error = reply->errorString();
+        delete reply;
+
+        // 416 is the reply to the first range of an empty object
+        if (res->status == 200 || res->status == 206 || (res->status == 416 && first == 0))
+            return true;
+        if (res->status != 0 && res->status != 429 && res->status < 500) {
+            LOG_VERBOSE << "Request for " << object.scheme << "://" << object.authority << object.path << " failed with status " << res->status;
+            return false;
+        }
+        LOG_VERBOSE << "Request for " << object.scheme << "://" << object.authority << object.path << " failed (attempt " << attempt + 1
+                    << "): " << (res->status ? std::to_string(res->status) : error.toStdString());
+    }
+    return false;
+}
+
+/* Builds the request of the object. The s3 requests are signed with AWS Signature
+ * Version 4 if credentials are set, the payload of GET and HEAD requests is empty */
+static QNetworkRequest MakeRequest(const RemoteObject& object, const QByteArray& verb)
+{
+    QNetworkRequest request;
+    // the replies must not be compressed for the ranges to be byte offsets in the object
+    request.setRawHeader("Accept-Encoding", "identity");
+
+    if (object.scheme != "s3") {
+        QUrl url;
+        url.setScheme(QString::fromStdString(object.scheme));
+        url.setAuthority(QString::fromStdString(object.authority));
+        url.setPath(QString::fromStdString(object.path));
+        if (!object.query.empty())
+            url.setQuery(QString::fromStdString(object.query), QUrl::StrictMode);
+        request.setUrl(url);
+        request.setAttribute(QNetworkRequest::FollowRedirectsAttribute, true);
+        return request;
+    }
+
+    QByteArray region = qgetenv("AWS_REGION");
+    if (region.isEmpty())
+        region = qgetenv("AWS_DEFAULT_REGION");
+    if (region.isEmpty())
+        region = "us-east-1";
+    QByteArray endpoint = qgetenv("AWS_ENDPOINT_URL_S3");
+    if (endpoint.isEmpty())
+        endpoint = qgetenv("AWS_ENDPOINT_URL");
+
+    // the keys are encoded once, as in the canonical requests of s3
+    const QByteArray bucket = QByteArray::fromStdString(object.authority);
+    const QByteArray key = QUrl::toPercentEncoding(QString::fromStdString(object.path), "/");
+    QByteArray canonicalPath;
+    QUrl url;
+    if (!endpoint.isEmpty()) {
+        while (endpoint.endsWith('/'))
+            endpoint.chop(1);
+        canonicalPath = "/" + QUrl::toPercentEncoding(QString::fromUtf8(bucket)) + key;
+        url = QUrl::fromEncoded(endpoint + canonicalPath, QUrl::StrictMode);
+    } else {
+        canonicalPath = key;
+        url = QUrl::fromEncoded("https://" + bucket + ".s3." + region + ".amazonaws.com" + canonicalPath, QUrl::StrictMode);
+    }
+    request.setUrl(url);
+
+    const QByteArray accessKey = qgetenv("AWS_ACCESS_KEY_ID");
+    const QByteArray secretKey = qgetenv("AWS_SECRET_ACCESS_KEY");
+    if (accessKey.isEmpty() || secretKey.isEmpty())
+        return request;
+    const QByteArray token = qgetenv("AWS_SESSION_TOKEN");
+
+    // the host header sent by Qt carries the port unless it is the default one
+    QByteArray host = url.host(QUrl::FullyEncoded).toUtf8();
+    const int defaultPort = (url.scheme() == "https") ? 443 : 80;
+    if (url.port(defaultPort) != defaultPort)
+        host += ":" + QByteArray::number(url.port());
+
+    const QByteArray amzDate = QDateTime::currentDateTimeUtc().toString("yyyyMMdd'T'HHmmss'Z'").toLatin1();
+    const QByteArray date = amzDate.left(8);
+    const QByteArray payloadHash = QCryptographicHash::hash(QByteArray(), QCryptographicHash::Sha256).toHex();
+    QByteArray canonicalHeaders = "host:" + host + "\nx-amz-content-sha256:" + payloadHash + "\nx-amz-date:" + amzDate + "\n";
+    QByteArray signedHeaders = "host;x-amz-content-sha256;x-amz-date";
+    if (!token.isEmpty()) {
+        canonicalHeaders += "x-amz-security-token:" + token + "\n";
+        signedHeaders += ";x-amz-security-token";
+        request.setRawHeader("x-amz-security-token", token);
+    }
+    const QByteArray canonicalRequest = verb + "\n" + canonicalPath + "\n\n" + canonicalHeaders + "\n" + signedHeaders + "\n" + payloadHash;
+    const QByteArray scope = date + "/" + region + "/s3/aws4_request";
+    const QByteArray stringToSign = "AWS4-HMAC-SHA256\n" + amzDate + "\n" + scope + "\n"
+            + QCryptographicHash::hash(canonicalRequest, QCryptographicHash::Sha256).toHex();
+    const QByteArray signingKey = Hmac(Hmac(Hmac(Hmac("AWS4" + secretKey, date), region), "s3"), "aws4_request");
+
+    request.setRawHeader("x-amz-date", amzDate);
+    request.setRawHeader("x-amz-content-sha256", payloadHash);
+    request.setRawHeader("Authorization", "AWS4-HMAC-SHA256 Credential=" + accessKey + "/" + scope + ", SignedHeaders=" + signedHeaders
+                         + ", Signature=" + Hmac(signingKey, stringToSign).toHex());
+    return request;
+}
+
+static QByteArray Hmac(const QByteArray& key, const QByteArray& message)
+{
+    return QMessageAuthenticationCode::hash(message, key, QCryptographicHash::Sha256);
+}
+
+/* Returns the lines of the text file starting with the keyword, without it. As in
+ * the obj importer, the arguments can contain spaces */
+static std::vector<std::string> KeywordArguments(const char *data, qint64 size, const char *keyword)
+{
+    std::vector<std::string> arguments;
+    const std::size_t n = std::strlen(keyword);
+    const char *p = data;
+    const char *end = data + size;
+    while (p < end) {
+        const char *eol = static_cast<const char *>(std::memchr(p, '\n', end - p));
+        if (eol == nullptr)
+            eol = end;
+        const char *b = p;
+        while (b < eol && (*b == ' ' || *b == '\t'))
+            b++;
+        if (std::size_t(eol - b) > n && std::strncmp(b, keyword, n) == 0 && (b[n] == ' ' || b[n] == '\t')) {
+            const char *e = eol;
+            b += n;
+            while (b < e && (*b == ' ' || *b == '\t'))
+                b++;
+            while (e > b && (e[-1] == '\r' || e[-1] == ' ' || e[-1] == '\t'))
+                e--;
+            if (e > b)
+                arguments.push_back(std::string(b, e));
+        }
+        p = eol + 1;
+    }
+    return arguments;
+}
+
+/* Returns the material libraries of the obj file */
+static void ScanOBJDependencies(const std::string& path, std::vector<std::string>& libraries)
+{
+    QFile file(path.c_str());
+    const qint64 size = file.open(QIODevice::ReadOnly) ? file.size() : 0;
+    const char *data = (size > 0) ? reinterpret_cast<const char *>(file.map(0, size)) : nullptr;
+    std::vector<std::string> names;
+    if (data != nullptr)
+        names = KeywordArguments(data, size, "mtllib");
+    QFileInfo fi(path.c_str());
+    for (const std::string& name : names)
+        libraries.push_back(NormalizePath(fi.absoluteDir().absoluteFilePath(QString::fromStdString(name)).toStdString()));
+}
+
+static void ScanMTLTextures(const std::string& path, std::vector<std::string>& textures)
+{
+    QFile file(path.c_str());
+    if (!file.open(QIODevice::ReadOnly))
+        return;
+    const QByteArray data = file.readAll();
+    QDir dir = QFileInfo(path.c_str()).absoluteDir();
+    for (const std::string& name : KeywordArguments(data.constData(), data.size(), "map_Kd"))
+        textures.push_back(NormalizePath(dir.absoluteFilePath(QString::fromStdString(name)).toStdString()));
+}
+
+/* Returns the external buffers and images of the gltf or glb file */
+static void ScanGLTFDependencies(const std::string& path, std::vector<std::string>& buffers, std::vector<std::string>& images)
+{
+    QFile file(path.c_str());
+    if (!file.open(QIODevice::ReadOnly))
+        return;
+    QByteArray json;
+    const QByteArray header = file.peek(20);
+    if (header.size() == 20 && header.startsWith("glTF")) {
+        // the json chunk is the first of a glb file
+        quint32 length;
+        std::memcpy(&length, header.constData() + 12, 4);
+        if (!file.seek(20))
+            return;
+        json = file.read(length);
+    } else {
+        json = file.readAll();
+    }
+
+    const QJsonObject root = QJsonDocument::fromJson(json).object();
+    QDir dir = QFileInfo(path.c_str()).absoluteDir();
+    for (const char *kind : {"buffers", "images"}) {
+        for (const QJsonValue& value : root.value(kind).toArray()) {
+            const QString uri = value.toObject().value("uri").toString();
+            if (uri.isEmpty() || uri.startsWith("data:"))
+                continue;
+            const std::string localPath = NormalizePath(dir.absoluteFilePath(QUrl::fromPercentEncoding(uri.toUtf8())).toStdString());
+            (std::strcmp(kind, "buffers") == 0 ? buffers : images).push_back(localPath);
+        }
+    }
+}
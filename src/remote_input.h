@@ -0,0 +1,95 @@
+/*******************************************************************************
+    Copyright (c) 2021, Andrea Maggiordomo, Paolo Cignoni and Marco Tarini
+
+    This file is part of TextureDefrag, a reference implementation for
+    the paper ``Texture Defragmentation for Photo-Reconstructed 3D Models''
+    by Andrea Maggiordomo, Paolo Cignoni and Marco Tarini.
+
+    TextureDefrag is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    TextureDefrag is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with TextureDefrag. If not, see <https://www.gnu.org/licenses/>.
+*******************************************************************************/
+
+#ifndef REMOTE_INPUT_H
+#define REMOTE_INPUT_H
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+class QByteArray;
+
+/* Input meshes read from object storage or web servers, given as s3://bucket/key,
+ * http:// or https:// URIs. The files are downloaded to a staging directory that
+ * mirrors the remote layout (one subdirectory per bucket or server), so that the
+ * parsers and the relative references to the textures work on local files as
+ * usual, and the copies are reused by the later runs while the remote files keep
+ * their size and modification time.
+ *
+ * The mesh is fetched with parallel range requests. The files it needs to be
+ * parsed (the material libraries of obj files and the buffers of gltf files) are
+ * fetched with it, and the textures they reference are queued for download on
+ * background threads, so that they transfer while the mesh is parsed, prepared
+ * and optimized. The sizes of the textures are read from the first bytes of the
+ * files with their own range requests, and the readers of the images wait for the
+ * files they need, which are then downloaded before the rest of the queue.
+ *
+ * The s3 requests go to AWS_ENDPOINT_URL (path style) if set, otherwise to the
+ * virtual hosted endpoint of AWS_REGION, and are signed (AWS Signature Version 4)
+ * if AWS_ACCESS_KEY_ID and AWS_SECRET_ACCESS_KEY are set. The staging directory
+ * is texture-defrag-remote in the temporary directory, or TEXTURE_DEFRAG_STAGING */
+
+struct RemoteInputStats {
+    int files = 0;              // files downloaded
+    int reused = 0;             // files whose staged copy was still current
+    int failed = 0;             // files that could not be downloaded
+    uint64_t bytes = 0;         // bytes downloaded (including the probes of the image headers)
+    double transferS = 0.0;     // time spent downloading (summed over the threads)
+    int waits = 0;              // readers that waited for a file being downloaded
+    double waitS = 0.0;         // time the readers spent waiting
+};
+
+/* Returns true if path is an s3, http or https URI */
+bool IsRemoteUri(const std::string& path);
+
+/* Downloads the mesh at uri and the files needed to parse it, and queues the
+ * download of the textures it references. Returns the local path of the mesh,
+ * empty on failure. The later calls with the same uri return the same path */
+std::string StageRemoteMesh(const std::string& uri);
+
+/* If localPath lies in the staging directory, queues the download of the remote
+ * file it mirrors (once) and returns true. Returns false for the other paths */
+bool StageRemoteFile(const std::string& localPath);
+
+/* Returns true if the file at localPath is being or was downloaded */
+bool IsStagedRemoteFile(const std::string& localPath);
+
+/* Waits until the staged file at localPath is downloaded, downloading it on the
+ * calling thread if it is still queued. Returns false if the download failed,
+ * true at once for the files that are not staged */
+bool WaitForRemoteFile(const std::string& localPath);
+
+/* Reads the first bytes (up to size) of the staged file at localPath, from the
+ * local copy if downloaded, otherwise with a range request */
+bool ReadRemoteFilePrefix(const std::string& localPath, int size, QByteArray *data);
+
+/* Stages and waits for the files of localPaths that lie in the staging directory.
+ * Returns false if a download failed */
+bool FetchRemoteFiles(const std::vector<std::string>& localPaths);
+
+/* Cancels the queued downloads and stops the background threads. Staging a file
+ * starts them again */
+void StopRemoteFetches();
+
+RemoteInputStats GetRemoteInputStats();
+
+#endif // REMOTE_INPUT_H
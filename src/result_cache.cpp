@@ -0,0 +1,193 @@
+/*******************************************************************************
+    Copyright (c) 2021, Andrea Maggiordomo, Paolo Cignoni and Marco Tarini
+
+    This file is part of TextureDefrag, a reference implementation for
+    the paper ``Texture Defragmentation for Photo-Reconstructed 3D Models''
+    by Andrea Maggiordomo, Paolo Cignoni and Marco Tarini.
+
+    TextureDefrag is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    TextureDefrag is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with TextureDefrag. If not, see <https://www.gnu.org/licenses/>.
+*******************************************************************************/
+
+#include "result_cache.h"
+#include "remote_input.h"
+#include "logging.h"
+
+#include <random>
+#include <cstdio>
+
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QString>
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#endif
+
+
+// version of the entries, part of the input keys so that the entries of earlier
+// versions are never hit
+static const int RESULT_CACHE_VERSION = 1;
+
+// list of the files of an output entry, written last
+static const char *OUTPUT_LIST_FILE = "files";
+
+// copy of the run report in an output entry
+static const char *OUTPUT_REPORT_FILE = "report.json";
+
+static bool CopyFile(const QString& src, const QString& dst);
+
+
+CacheKey::CacheKey(uint64_t parent)
+    : hash(14695981039346656037ULL)
+{
+    AddBytes(&parent, sizeof(parent));
+}
+
+CacheKey& CacheKey::Add(const std::string& s)
+{
+    Add(int64_t(s.size()));
+    AddBytes(s.data(), s.size());
+    return *this;
+}
+
+CacheKey& CacheKey::Add(double v)
+{
+    AddBytes(&v, sizeof(v));
+    return *this;
+}
+
+CacheKey& CacheKey::Add(int64_t v)
+{
+    AddBytes(&v, sizeof(v));
+    return *this;
+}
+
+// FNV-1a
+void CacheKey::AddBytes(const void *data, std::size_t size)
+{
+    const unsigned char *p = static_cast<const unsigned char *>(data);
+    for (std::size_t i = 0; i < size; ++i) {
+        hash ^= p[i];
+        hash *= 1099511628211ULL;
+    }
+}
+
+uint64_t InputCacheKey(uint64_t meshHash, const std::vector<std::string>& texturePaths)
+{
+    // the staged copies of the remote textures take the size and the time of the
+    // remote files once downloaded
+    FetchRemoteFiles(texturePaths);
+
+    CacheKey key(meshHash);
+    key.Add(RESULT_CACHE_VERSION);
+    key.Add(int64_t(texturePaths.size()));
+    for (const std::string& path : texturePaths) {
+        QFileInfo fi(path.c_str());
+        key.Add(path);
+        key.Add(int64_t(fi.exists() ? fi.size() : -1));
+        key.Add(int64_t(fi.exists() ? fi.lastModified().toMSecsSinceEpoch() : 0));
+    }
+    return key.Value();
+}
+
+std::string ResultCachePath(const std::string& cacheDir, uint64_t key, const char *extension)
+{
+    std::string dir = cacheDir + "/results";
+    QDir().mkpath(QString(dir.c_str()));
+    char name[64];
+    std::snprintf(name, sizeof(name), "%016llx.%s", (unsigned long long) key, extension);
+    return dir + "/" + name;
+}
+
+bool StoreCachedOutput(const std::string& cacheDir, uint64_t key, const std::vector<std::string>& files, const std::string& report)
+{
+    QString entry = ResultCachePath(cacheDir, key, "output").c_str();
+    if (QDir(entry).exists())
+        return true;
+
+    // the files are copied to a staging directory renamed to the entry when complete,
+    // so that a concurrent job never restores a partial entry
+    QString staging = entry + ".tmp" + QString::number(std::random_device()());
+    bool ok = QDir().mkpath(staging);
+    QByteArray list;
+    for (const std::string& file : files) {
+        QString name = QFileInfo(file.c_str()).fileName();
+        ok = ok && CopyFile(file.c_str(), staging + "/" + name);
+        list.append(name.toUtf8()).append('\n');
+    }
+    if (!report.empty())
+        ok = ok && CopyFile(report.c_str(), staging + "/" + OUTPUT_REPORT_FILE);
+    if (ok) {
+        QSaveFile listFile(staging + "/" + OUTPUT_LIST_FILE);
+        ok = listFile.open(QIODevice::WriteOnly) && listFile.write(list) == list.size() && listFile.commit();
+    }
+    ok = ok && QDir().rename(staging, entry);
+    if (!ok)
+        QDir(staging).removeRecursively();
+    return ok;
+}
+
+bool RestoreCachedOutput(const std::string& cacheDir, uint64_t key, const std::string& outputDir, const std::string& report)
+{
+    QString entry = ResultCachePath(cacheDir, key, "output").c_str();
+    QFile listFile(entry + "/" + OUTPUT_LIST_FILE);
+    if (!listFile.open(QIODevice::ReadOnly))
+        return false;
+    QStringList names = QString::fromUtf8(listFile.readAll()).split('\n');
+
+    QDir dir(outputDir.c_str());
+    for (const QString& name : names) {
+        if (name.isEmpty())
+            continue;
+        if (!CopyFile(entry + "/" + name, dir.absoluteFilePath(name))) {
+            LOG_WARN << "Unable to restore " << name.toStdString() << " from the result cache entry " << entry.toStdString();
+            return false;
+        }
+    }
+    if (!report.empty() && QFile(entry + "/" + OUTPUT_REPORT_FILE).exists() && !CopyFile(entry + "/" + OUTPUT_REPORT_FILE, report.c_str()))
+        LOG_WARN << "Unable to restore the run report from the result cache entry " << entry.toStdString();
+    return true;
+}
+
+
+// -- static functions ---------------------------------------------------------
+
+/* Copies the file, replacing dst. The copy is a clone sharing the blocks of src
+ * until either is written where the file system supports it (btrfs, xfs), so that
+ * the cache entries cost neither the time nor the space of a copy, and writing the
+ * output files does not change the entries as with hard links */
+static bool CopyFile(const QString& src, const QString& dst)
+{
+    QFile::remove(dst);
+#if defined(__linux__) && defined(FICLONE)
+    int in = open(src.toStdString().c_str(), O_RDONLY);
+    if (in >= 0) {
+        int out = open(dst.toStdString().c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        bool cloned = (out >= 0) && ioctl(out, FICLONE, in) == 0;
+        if (out >= 0)
+            close(out);
+        close(in);
+        if (cloned)
+            return true;
+        QFile::remove(dst);
+    }
+#endif
+    return QFile::copy(src, dst);
+}
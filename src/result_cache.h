@@ -0,0 +1,78 @@
+/*******************************************************************************
+    Copyright (c) 2021, Andrea Maggiordomo, Paolo Cignoni and Marco Tarini
+
+    This file is part of TextureDefrag, a reference implementation for
+    the paper ``Texture Defragmentation for Photo-Reconstructed 3D Models''
+    by Andrea Maggiordomo, Paolo Cignoni and Marco Tarini.
+
+    TextureDefrag is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    TextureDefrag is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with TextureDefrag. If not, see <https://www.gnu.org/licenses/>.
+*******************************************************************************/
+
+#ifndef RESULT_CACHE_H
+#define RESULT_CACHE_H
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+/* Cache of the results of the jobs, kept in the results subdirectory of the mesh
+ * cache directory (see mesh_cache.h). The entries are keyed hierarchically: the
+ * input key hashes the contents of the input mesh and the sizes and modification
+ * times of its textures, and each stage extends the key of the previous one with
+ * its own options, so that changing the options of a stage only invalidates the
+ * entries of that stage and of the later ones. The entries of the optimization
+ * and of the packing are the stage snapshots the job is resumed from, the output
+ * entries are copies of the files written by the job, restored in place of
+ * running it */
+
+class CacheKey {
+
+public:
+
+    explicit CacheKey(uint64_t parent = 0);
+
+    CacheKey& Add(const std::string& s);
+    CacheKey& Add(double v);
+    CacheKey& Add(int64_t v);
+    CacheKey& Add(int v) { return Add(int64_t(v)); }
+    CacheKey& Add(bool v) { return Add(int64_t(v)); }
+
+    uint64_t Value() const { return hash; }
+
+private:
+
+    void AddBytes(const void *data, std::size_t size);
+
+    uint64_t hash;
+};
+
+/* Returns the input key of the mesh with the given content hash and texture files.
+ * The missing textures are hashed as such, the job fails later when loading them.
+ * The remote textures (see remote_input.h) are downloaded first */
+uint64_t InputCacheKey(uint64_t meshHash, const std::vector<std::string>& texturePaths);
+
+/* Returns the path of the entry of the key with the given extension, in the results
+ * subdirectory of cacheDir which is created if needed */
+std::string ResultCachePath(const std::string& cacheDir, uint64_t key, const char *extension);
+
+/* Stores copies of the files as the output entry of the key, and of the run report
+ * if report is not empty. The entry only appears once complete */
+bool StoreCachedOutput(const std::string& cacheDir, uint64_t key, const std::vector<std::string>& files, const std::string& report);
+
+/* Restores the files of the output entry of the key in outputDir and the run report
+ * to report if not empty, replacing the existing files. Returns false if there is
+ * no entry or a file cannot be restored */
+bool RestoreCachedOutput(const std::string& cacheDir, uint64_t key, const std::string& outputDir, const std::string& report);
+
+#endif // RESULT_CACHE_H
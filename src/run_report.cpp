@@ -0,0 +1,154 @@
+/*******************************************************************************
+    Copyright (c) 2021, Andrea Maggiordomo, Paolo Cignoni and Marco Tarini
+
+    This file is part of TextureDefrag, a reference implementation for
+    the paper ``Texture Defragmentation for Photo-Reconstructed 3D Models''
+    by Andrea Maggiordomo, Paolo Cignoni and Marco Tarini.
+
+    TextureDefrag is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    TextureDefrag is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with TextureDefrag. If not, see <https://www.gnu.org/licenses/>.
+*******************************************************************************/
+
+
+
+#include "run_report.h"
+
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <fstream>
+#include <cmath>
+#include <cstdio>
+
+
+namespace {
+
+struct ReportNode {
+    enum Type { Object, Number, String } type = Object;
+    double number = 0;
+    std::string str;
+    std::vector<std::pair<std::string, std::unique_ptr<ReportNode>>> children;
+
+    ReportNode *Child(const std::string& key)
+    {
+        for (auto& entry : children)
+            if (entry.first == key)
+                return entry.second.get();
+        children.emplace_back(key, std::unique_ptr<ReportNode>(new ReportNode));
+        return children.back().second.get();
+    }
+};
+
+std::mutex reportMtx;
+ReportNode root;
+
+ReportNode *Lookup(const std::string& section, const std::string& key)
+{
+    ReportNode *node = &root;
+    std::size_t begin = 0;
+    while (begin <= section.size()) {
+        std::size_t end = section.find('/', begin);
+        if (end == std::string::npos)
+            end = section.size();
+        if (end > begin)
+            node = node->Child(section.substr(begin, end - begin));
+        begin = end + 1;
+    }
+    return node->Child(key);
+}
+
+void WriteString(std::ostream& os, const std::string& s)
+{
+    os << '"';
+    for (char c : s) {
+        if (c == '"' || c == '\\')
+            os << '\\' << c;
+        else if ((unsigned char) c < 0x20)
+            os << ' ';
+        else
+            os << c;
+    }
+    os << '"';
+}
+
+void WriteNode(std::ostream& os, const ReportNode& node, int indent)
+{
+    if (node.type == ReportNode::Number) {
+        if (std::isfinite(node.number)) {
+            char buf[32];
+            std::snprintf(buf, sizeof(buf), "%.12g", node.number);
+            os << buf;
+        } else {
+            os << "null";
+        }
+    } else if (node.type == ReportNode::String) {
+        WriteString(os, node.str);
+    } else {
+        os << "{";
+        for (std::size_t i = 0; i < node.children.size(); ++i) {
+            os << (i > 0 ? ",\n" : "\n") << std::string(indent + 2, ' ');
+            WriteString(os, node.children[i].first);
+            os << ": ";
+            WriteNode(os, *node.children[i].second, indent + 2);
+        }
+        if (!node.children.empty())
+            os << "\n" << std::string(indent, ' ');
+        os << "}";
+    }
+}
+
+} // namespace
+
+void ReportValue(const std::string& section, const std::string& key, double value)
+{
+    std::lock_guard<std::mutex> lock(reportMtx);
+    ReportNode *node = Lookup(section, key);
+    node->type = ReportNode::Number;
+    node->number = value;
+}
+
+void ReportValue(const std::string& section, const std::string& key, const std::string& value)
+{
+    std::lock_guard<std::mutex> lock(reportMtx);
+    ReportNode *node = Lookup(section, key);
+    node->type = ReportNode::String;
+    node->str = value;
+}
+
+void ReportAdd(const std::string& section, const std::string& key, double value)
+{
+    std::lock_guard<std::mutex> lock(reportMtx);
+    ReportNode *node = Lookup(section, key);
+    if (node->type != ReportNode::Number) {
+        node->type = ReportNode::Number;
+        node->number = 0;
+    }
+    node->number += value;
+}
+
+void ClearReport()
+{
+    std::lock_guard<std::mutex> lock(reportMtx);
+    root.children.clear();
+}
+
+bool WriteReport(const std::string& path)
+{
+    std::ofstream os(path);
+    if (!os)
+        return false;
+    std::lock_guard<std::mutex> lock(reportMtx);
+    WriteNode(os, root, 0);
+    os << "\n";
+    return bool(os);
+}
@@ -0,0 +1,48 @@
+/*******************************************************************************
+    Copyright (c) 2021, Andrea Maggiordomo, Paolo Cignoni and Marco Tarini
+
+    This file is part of TextureDefrag, a reference implementation for
+    the paper ``Texture Defragmentation for Photo-Reconstructed 3D Models''
+    by Andrea Maggiordomo, Paolo Cignoni and Marco Tarini.
+
+    TextureDefrag is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    TextureDefrag is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with TextureDefrag. If not, see <https://www.gnu.org/licenses/>.
+*******************************************************************************/
+
+
+
+#ifndef RUN_REPORT_H
+#define RUN_REPORT_H
+
+#include <string>
+
+/* Machine readable report of the run, written as a JSON object. The values are
+ * grouped in sections, and a section name with '/' separators names a section
+ * nested in another. Sections and values are written in the order they are first
+ * reported, a value reported again replaces the previous one. The functions can
+ * be called by any thread */
+
+void ReportValue(const std::string& section, const std::string& key, double value);
+void ReportValue(const std::string& section, const std::string& key, const std::string& value);
+
+/* Adds value to the numeric value of the key (which starts from 0), to accumulate
+ * the metrics of repeated operations */
+void ReportAdd(const std::string& section, const std::string& key, double value);
+
+/* Discards all the values reported so far, to start the report of a new run */
+void ClearReport();
+
+/* Writes the report, returns false on failure */
+bool WriteReport(const std::string& path);
+
+#endif // RUN_REPORT_H
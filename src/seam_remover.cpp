@@ -23,6 +23,7 @@
 #include "mesh.h"
 #include "mesh_attribute.h"
 #include "mesh_graph.h"
+#include "derived_data.h"
 #include "matching.h"
 #include "intersection.h"
 #include "shell.h"
@@ -31,76 +32,113 @@
 #include "logging.h"
 #include "seams.h"
 #include "texture_rendering.h"
+#include "checkpoint.h"
+#include "memory_budget.h"
+#include "trace.h"
+#include "run_report.h"
+#include "thread_count.h"
+#include "raster_overlap.h"
+#include "gpu_arap.h"
+#include "parallel_threshold.h"
+#include "texture_optimization.h"
 
 
 #include <fstream>
+#include <algorithm>
 #include <iomanip>
 #include <unordered_set>
+#include <bitset>
+#include <limits>
 
 #include <vcg/complex/algorithms/clean.h>
 
-#if defined(__APPLE__)
-#include <mach/mach.h>
-#include <sys/sysctl.h>
-#elif defined(__linux__)
-#include <string>
-#include <fstream>
-#elif defined(_WIN32)
-#include <windows.h>
-#endif
-
 
 constexpr double PENALTY_MULTIPLIER = 2.0;
 
+// number of buckets of the queue that grows the optimization area
+constexpr int OFFSET_BUCKETS = 64;
 
-struct Perf {
-    double t_init;
-    double t_seamdata;
-    double t_alignmerge;
-    double t_optimization_area;
-    double t_optimize;
-    double t_optimize_build;
-    double t_optimize_arap;
-    double t_check_before;
-    double t_check_after;
-    double t_accept;
-    double t_reject;
-    Timer timer;
-};
+// one in this many moves predicted to fail the distortion checks is solved anyway,
+// to estimate the precision of the predictor
+constexpr int PRESCREEN_AUDIT_INTERVAL = 16;
 
 
-static void InsertNewClusterInQueue(ClusteredSeamHandle csh, AlgoStateHandle state, GraphHandle graph, const AlgoParameters& params);
-static CostInfo ComputeCost(ClusteredSeamHandle csh, GraphHandle graph, const AlgoParameters& params, double penalty);
-static inline double GetPenalty(ClusteredSeamHandle csh, AlgoStateHandle state);
+static void InsertNewClustersInQueue(const std::vector<ClusteredSeamHandle>& cshvec, AlgoStateHandle state, GraphHandle graph, const AlgoParameters& params);
+static void InsertClusterInQueue(ClusteredSeamHandle csh, CostInfo ci, AlgoStateHandle state, GraphHandle graph, const AlgoParameters& params);
+static void InsertEstimatedClustersInQueue(const std::vector<ClusteredSeamHandle>& cshvec, AlgoStateHandle state, GraphHandle graph, const AlgoParameters& params);
+static bool ResolveEstimatedCost(const WeightedSeam& ws, AlgoStateHandle state, GraphHandle graph, const AlgoParameters& params);
+static double EstimateCost(const ClusteredSeamHandle& csh, GraphHandle graph, const AlgoParameters& params, double penalty);
+static void AddClusterMemberships(ClusteredSeamHandle csh, ClusterId cid, AlgoStateHandle state, GraphHandle graph);
+static CostInfo ComputeCost(const ClusteredSeamHandle& csh, GraphHandle graph, const AlgoParameters& params, double penalty);
+static inline double GetPenalty(const ClusteredSeamHandle& csh, AlgoStateHandle state);
 static inline bool Valid(const WeightedSeam& ws, ConstAlgoStateHandle state);
-static inline void PurgeQueue(AlgoStateHandle state);
 static void ComputeSeamData(SeamData& sd, ClusteredSeamHandle csh, GraphHandle graph, AlgoStateHandle state);
-static OffsetMap AlignAndMerge(ClusteredSeamHandle csh, SeamData& sd, const MatchingTransform& mi, const AlgoParameters& params);
-static void ComputeOptimizationArea(SeamData& sd, Mesh& mesh, OffsetMap& om);
-static std::unordered_set<Mesh::VertexPointer> ComputeVerticesWithinOffsetThreshold(Mesh& m, const OffsetMap& om, const SeamData& sd);
-static CheckStatus CheckBoundaryAfterAlignment(SeamData& sd);
+static OffsetMap AlignAndMerge(const ClusteredSeamHandle& csh, SeamData& sd, ConstAlgoStateHandle state, const MatchingTransform& mi, const AlgoParameters& params);
+static void ComputeOptimizationArea(SeamData& sd, ConstAlgoStateHandle state, Mesh& mesh, OffsetMap& om);
+static void ComputeVerticesWithinOffsetThreshold(Mesh& m, const OffsetMap& om, const SeamData& sd, ElementSet<MeshVertex>& vset);
+static std::vector<Mesh::FacePointer> QueryFixedFaces(const SeamData& sd, ConstAlgoStateHandle state, ChartHandle c, const vcg::Box2d& box);
+static std::vector<HalfEdge> ExtractHalfEdges(const std::vector<ChartHandle>& charts, const vcg::Box2d& box, bool internalOnly);
+static std::vector<HalfEdge> ExtractHalfEdges(const SeamData& sd, ConstAlgoStateHandle state, const std::vector<ChartHandle>& charts, const vcg::Box2d& box, bool internalOnly);
+static CheckStatus CheckBoundaryAfterAlignment(SeamData& sd, ConstAlgoStateHandle state);
 static CheckStatus CheckAfterLocalOptimization(SeamData& sd, AlgoStateHandle state, const AlgoParameters& params);
-static CheckStatus OptimizeChart(SeamData& sd, GraphHandle graph, bool fixIntersectingEdges);
+static int RasterizeOverlaps(const SeamData& sd, ConstAlgoStateHandle state, const AlgoParameters& params);
+static CheckStatus OptimizeChart(SeamData& sd, GraphHandle graph, ConstAlgoStateHandle state, const AlgoParameters& params, bool fixIntersectingEdges);
+static CheckStatus PredictDistortion(SeamData& sd, Mesh& mesh, ConstAlgoStateHandle state, const AlgoParameters& params);
+static CheckStatus CheckGlobalDistortion(const SeamData& sd, AlgoStateHandle state, const AlgoParameters& params);
+static CheckStatus EvaluateMove(SeamData& sd, ClusteredSeamHandle csh, GraphHandle graph, AlgoStateHandle state, const AlgoParameters& params);
+static void CommitMove(const SeamData& sd, CheckStatus status, AlgoStateHandle state, GraphHandle graph, const AlgoParameters& params);
+static int ExtractIndependentMoves(std::vector<WeightedSeam>& batch, AlgoStateHandle state, GraphHandle graph, const AlgoParameters& params);
 static void AcceptMove(const SeamData& sd, AlgoStateHandle state, GraphHandle graph, const AlgoParameters& params);
+static void UpdateMergedChartCache(const SeamData& sd);
 static void RejectMove(const SeamData& sd, AlgoStateHandle state, GraphHandle graph, CheckStatus status);
+static void RecordMove(const SeamData& sd, AlgoStateHandle state, GraphHandle graph);
+static void UndoMove(const SeamData& sd, GraphHandle graph);
 static void EraseSeam(ClusteredSeamHandle csh, AlgoStateHandle state, GraphHandle graph);
 static void InvalidateCluster(ClusteredSeamHandle csh, AlgoStateHandle state, GraphHandle graph, CheckStatus status, double penaltyMultiplier);
-static void RestoreChartAttributes(ChartHandle c, Mesh& m, std::vector<int>::const_iterator itvi,  std::vector<vcg::Point2d>::const_iterator ittc);
 static CostInfo ReduceSeam(ClusteredSeamHandle csh, AlgoStateHandle state, GraphHandle graph, const AlgoParameters& params);
+static CostInfo ReduceSeamBisection(ClusteredSeamHandle csh, AlgoStateHandle state, GraphHandle graph, const AlgoParameters& params);
+static void BisectCharts(const std::vector<ChartHandle>& charts, int k, std::vector<std::vector<ChartHandle>>& regions);
+static void OptimizePartitions(GraphHandle graph, AlgoStateHandle state, const AlgoParameters& params);
+static void RunGreedyLoop(GraphHandle graph, AlgoStateHandle state, const AlgoParameters& params, double timelimit, bool logProgress);
+static void MergeCoincidentSeams(GraphHandle graph, AlgoStateHandle state, const AlgoParameters& params);
+static bool IsCoincidentSeam(const ClusterRecord& r, GraphHandle graph, const AlgoParameters& params);
+static CheckStatus EvaluateStitch(SeamData& sd, ClusteredSeamHandle csh, GraphHandle graph, AlgoStateHandle state, const AlgoParameters& params);
+static void StitchChart(SeamData& sd, GraphHandle graph, ConstAlgoStateHandle state);
+static std::vector<uint64_t> ReferencedVertexBitmap(const Mesh& m);
+static void CompactVertexVector(Mesh& m);
+
+
+// The timer is shared by the threads that evaluate merge operations concurrently,
+// so the checkpoints are tracked locally and the accumulation is serialized
+static double PerfTimeElapsed(AlgoStats& stats)
+{
+    double t;
+    #pragma omp critical (perf)
+    t = stats.timer.TimeElapsed();
+    return t;
+}
 
+// The hardware counters are those of the calling thread, so the counts of the
+// scopes run concurrently add up like their times
+static void PerfAccumulate(AlgoStats& stats, double *field, const char *name, double t0, double *last,
+                           const PerfCounterValues& c0, PerfCounterValues *clast)
+{
+    PerfCounterValues c = ReadThreadPerfCounters();
+    #pragma omp critical (perf)
+    {
+        double t = stats.timer.TimeElapsed();
+        *field += t - t0;
+        *last = t;
+        if (PerfCountersEnabled())
+            stats.counters[name] += c - c0;
+    }
+    *clast = c;
+}
 
-Perf perf = {};
-
-#define PERF_TIMER_RESET (perf = {}, perf.timer.Reset())
-#define PERF_TIMER_START double perf_timer_t0 = perf.timer.TimeElapsed()
-#define PERF_TIMER_ACCUMULATE(field) perf.field += perf.timer.TimeElapsed() - perf_timer_t0
-#define PERF_TIMER_ACCUMULATE_FROM_PREVIOUS(field) perf.field += perf.timer.TimeSinceLastCheck()
-
-//static int statsCheck[10] = {};
-//static int feasibility[6] = {};
-
-static std::vector<int> statsCheck(CheckStatus::_END, 0);
-static std::vector<int> feasibility(CostInfo::MatchingValue::_END, 0);
+#define PERF_TIMER_START(stats) AlgoStats& perf_stats = (stats); double perf_timer_t0 = PerfTimeElapsed(perf_stats); double perf_timer_last = perf_timer_t0; \
+    PerfCounterValues perf_counters_t0 = ReadThreadPerfCounters(); PerfCounterValues perf_counters_last = perf_counters_t0
+#define PERF_TIMER_ACCUMULATE(field) PerfAccumulate(perf_stats, &perf_stats.field, #field, perf_timer_t0, &perf_timer_last, perf_counters_t0, &perf_counters_last)
+#define PERF_TIMER_ACCUMULATE_FROM_PREVIOUS(field) PerfAccumulate(perf_stats, &perf_stats.field, #field, perf_timer_last, &perf_timer_last, perf_counters_last, &perf_counters_last)
 
 static vcg::Color4b statusColor[] = {
     vcg::Color4b::White, // PASS=0,
@@ -116,6 +154,34 @@ static vcg::Color4b statusColor[] = {
     vcg::Color4b(176, 0, 255, 255) // FAIL_GLOBAL_OVERLAP_UNFIXABLE
 };
 
+static const char *statusName[] = {
+    "pass",
+    "local_overlap",
+    "global_overlap_before",
+    "global_overlap_after_opt",
+    "global_overlap_after_bnd",
+    "distortion_local",
+    "distortion_global",
+    "topology",
+    "numerical_error",
+    "unknown",
+    "global_overlap_unfixable"
+};
+
+static const char *moveStageName[] = {
+    "seam",
+    "merge",
+    "area",
+    "check_before",
+    "optimize",
+    "check_after",
+    "fix_overlaps",
+    "commit"
+};
+
+static_assert(sizeof(statusName) / sizeof(statusName[0]) == CheckStatus::_END, "missing status name");
+static_assert(sizeof(moveStageName) / sizeof(moveStageName[0]) == MOVE_STAGE_END, "missing move stage name");
+
 static vcg::Color4b mvColor[] = {
     vcg::Color4b::White, //   FEASIBLE=0,
     vcg::Color4b::Black, //   ZERO_AREA,
@@ -123,166 +189,475 @@ static vcg::Color4b mvColor[] = {
     vcg::Color4b::Magenta //   UNFEASIBLE_MATCHING,
 };
 
-static int accept = 0;
-static int reject = 0;
-
-static int num_retry = 0;
-static int retry_success = 0;
-
-double mincost = 100000;
-double maxcost = -1;
-
-double min_energy = 10000000000;
-double max_energy = 0;
-
-static void ClearGlobals()
+void AlgoStats::ClearCounters()
 {
-    for (unsigned i = 0; i < statsCheck.size(); ++i)
-        statsCheck[i] = 0;
-    for (unsigned i = 0; i < feasibility.size(); ++i)
-        feasibility[i] = 0;
+    for (int& n : statsCheck)
+        n = 0;
+    for (int& n : feasibility)
+        n = 0;
+    for (int& n : rejectionStage)
+        n = 0;
+    for (int i = 0; i < CheckStatus::_END; ++i) {
+        moveTime[i].Clear();
+        std::fill(statusStageTime[i], statusStageTime[i] + MOVE_STAGE_END, 0.0);
+        overlapFixes[i] = 0;
+    }
     accept = 0;
     reject = 0;
 
     num_retry = 0;
     retry_success = 0;
+
+    arap_iterations = 0;
+    arap_solver_iterations = 0;
+    arap_fallbacks = 0;
+    arap_parallel = 0;
+    arap_dense = 0;
+    arap_gpu = 0;
+    arap_early_pass = 0;
+    arap_early_fail = 0;
+
+    prescreen_pass = 0;
+    prescreen_missed = 0;
+    prescreen_audited = 0;
+    prescreen_audited_hits = 0;
+    prescreen_skipped = 0;
+
+    raster_checks = 0;
+    raster_overlaps = 0;
+    raster_missed = 0;
+
+    lazy_queued = 0;
+    lazy_resolved = 0;
+    lazy_requeued = 0;
+
+    coincident_merged = 0;
+    coincident_deferred = 0;
 }
 
-static void LogMemoryUsage()
+void AlgoStats::Merge(const AlgoStats& other)
 {
-#if defined(__APPLE__)
-    // macOS implementation
-    mach_port_t host_port = mach_host_self();
-    mach_msg_type_number_t host_size = sizeof(vm_statistics64_data_t) / sizeof(integer_t);
-    vm_size_t pagesize;
-    host_page_size(host_port, &pagesize);
-
-    vm_statistics64_data_t vm_stat;
-    if (host_statistics64(host_port, HOST_VM_INFO64, (host_info64_t)&vm_stat, &host_size) != KERN_SUCCESS) {
-        LOG_WARN << "Failed to fetch macOS vm statistics";
-        return;
+    #pragma omp critical (perf)
+    {
+        t_init += other.t_init;
+        t_seamdata += other.t_seamdata;
+        t_alignmerge += other.t_alignmerge;
+        t_optimization_area += other.t_optimization_area;
+        t_optimize += other.t_optimize;
+        t_optimize_build += other.t_optimize_build;
+        t_optimize_arap += other.t_optimize_arap;
+        t_check_before += other.t_check_before;
+        t_check_after += other.t_check_after;
+        t_accept += other.t_accept;
+        t_reject += other.t_reject;
+        for (const auto& entry : other.counters)
+            counters[entry.first] += entry.second;
+    }
+
+    #pragma omp critical (stats)
+    {
+        for (int i = 0; i < CheckStatus::_END; ++i)
+            statsCheck[i] += other.statsCheck[i];
+        for (int i = 0; i < CostInfo::MatchingValue::_END; ++i)
+            feasibility[i] += other.feasibility[i];
+        for (int i = 0; i < CostInfo::STAGE_END; ++i)
+            rejectionStage[i] += other.rejectionStage[i];
+        for (int i = 0; i < CheckStatus::_END; ++i) {
+            moveTime[i].Merge(other.moveTime[i]);
+            for (int j = 0; j < MOVE_STAGE_END; ++j)
+                statusStageTime[i][j] += other.statusStageTime[i][j];
+            overlapFixes[i] += other.overlapFixes[i];
+        }
+        accept += other.accept;
+        reject += other.reject;
+
+        num_retry += other.num_retry;
+        retry_success += other.retry_success;
+
+        arap_iterations += other.arap_iterations;
+        arap_solver_iterations += other.arap_solver_iterations;
+        arap_fallbacks += other.arap_fallbacks;
+        arap_parallel += other.arap_parallel;
+        arap_dense += other.arap_dense;
+        arap_gpu += other.arap_gpu;
+        arap_early_pass += other.arap_early_pass;
+        arap_early_fail += other.arap_early_fail;
+
+        prescreen_pass += other.prescreen_pass;
+        prescreen_missed += other.prescreen_missed;
+        prescreen_audited += other.prescreen_audited;
+        prescreen_audited_hits += other.prescreen_audited_hits;
+        prescreen_skipped += other.prescreen_skipped;
+
+        raster_checks += other.raster_checks;
+        raster_overlaps += other.raster_overlaps;
+        raster_missed += other.raster_missed;
+
+        lazy_queued += other.lazy_queued;
+        lazy_resolved += other.lazy_resolved;
+        lazy_requeued += other.lazy_requeued;
+
+        coincident_merged += other.coincident_merged;
+        coincident_deferred += other.coincident_deferred;
+
+        mincost = std::min(mincost, other.mincost);
+        maxcost = std::max(maxcost, other.maxcost);
+        min_energy = std::min(min_energy, other.min_energy);
+        max_energy = std::max(max_energy, other.max_energy);
     }
+}
 
-    uint64_t total_mem_val;
-    size_t len = sizeof(total_mem_val);
-    if (sysctlbyname("hw.memsize", &total_mem_val, &len, NULL, 0) != 0) {
-        LOG_WARN << "Failed to fetch macOS total memory";
-        return;
+/* Adds the stats of the optimization to the run report, they are accumulated over
+ * the tiles when the atlas is optimized in tiles */
+static void ReportExecutionStats(AlgoStats& stats)
+{
+    ReportAdd("greedy/time", "init_s", stats.t_init);
+    ReportAdd("greedy/time", "seam_s", stats.t_seamdata);
+    ReportAdd("greedy/time", "merge_s", stats.t_alignmerge);
+    ReportAdd("greedy/time", "area_s", stats.t_optimization_area);
+    ReportAdd("greedy/time", "optimize_s", stats.t_optimize);
+    ReportAdd("greedy/time", "optimize_build_s", stats.t_optimize_build);
+    ReportAdd("greedy/time", "optimize_arap_s", stats.t_optimize_arap);
+    ReportAdd("greedy/time", "check_before_s", stats.t_check_before);
+    ReportAdd("greedy/time", "check_after_s", stats.t_check_after);
+    ReportAdd("greedy/time", "accept_s", stats.t_accept);
+    ReportAdd("greedy/time", "reject_s", stats.t_reject);
+    ReportAdd("greedy/time", "total_s", stats.timer.TimeElapsed());
+    for (const auto& entry : stats.counters)
+        ReportPerfCounters("greedy/counters/" + entry.first.substr(2), entry.second);
+
+    ReportAdd("greedy/moves", "accepted", stats.accept);
+    ReportAdd("greedy/moves", "rejected", stats.reject);
+    ReportAdd("greedy/moves", "retried", stats.num_retry);
+    ReportAdd("greedy/moves", "retry_accepted", stats.retry_success);
+    ReportAdd("greedy/arap", "iterations", stats.arap_iterations);
+    ReportAdd("greedy/arap", "solver_iterations", stats.arap_solver_iterations);
+    ReportAdd("greedy/arap", "backend_fallbacks", stats.arap_fallbacks);
+    ReportAdd("greedy/arap", "parallel_solves", stats.arap_parallel);
+    ReportValue("greedy/arap", "parallel_min_faces", ParallelMinFaces());
+    ReportAdd("greedy/arap", "dense_solves", stats.arap_dense);
+    ReportAdd("greedy/arap", "gpu_solves", stats.arap_gpu);
+    ReportAdd("greedy/arap", "early_pass", stats.arap_early_pass);
+    ReportAdd("greedy/arap", "early_fail", stats.arap_early_fail);
+    ReportAdd("greedy/prescreen", "predicted_pass", stats.prescreen_pass);
+    ReportAdd("greedy/prescreen", "predicted_pass_failed", stats.prescreen_missed);
+    ReportAdd("greedy/prescreen", "audited", stats.prescreen_audited);
+    ReportAdd("greedy/prescreen", "audited_failed", stats.prescreen_audited_hits);
+    ReportAdd("greedy/prescreen", "skipped", stats.prescreen_skipped);
+    ReportAdd("greedy/raster_overlap", "checks", stats.raster_checks);
+    ReportAdd("greedy/raster_overlap", "overlaps", stats.raster_overlaps);
+    ReportAdd("greedy/raster_overlap", "missed_by_borders", stats.raster_missed);
+    ReportAdd("greedy/lazy", "queued", stats.lazy_queued);
+    ReportAdd("greedy/lazy", "resolved", stats.lazy_resolved);
+    ReportAdd("greedy/lazy", "requeued", stats.lazy_requeued);
+    ReportAdd("greedy/coincident", "merged", stats.coincident_merged);
+    ReportAdd("greedy/coincident", "deferred", stats.coincident_deferred);
+
+    ReportAdd("greedy/statsCheck", "local_overlap", stats.statsCheck[FAIL_LOCAL_OVERLAP]);
+    ReportAdd("greedy/statsCheck", "global_overlap_before", stats.statsCheck[FAIL_GLOBAL_OVERLAP_BEFORE]);
+    ReportAdd("greedy/statsCheck", "global_overlap_after_opt", stats.statsCheck[FAIL_GLOBAL_OVERLAP_AFTER_OPT]);
+    ReportAdd("greedy/statsCheck", "global_overlap_after_bnd", stats.statsCheck[FAIL_GLOBAL_OVERLAP_AFTER_BND]);
+    ReportAdd("greedy/statsCheck", "global_overlap_unfixable", stats.statsCheck[FAIL_GLOBAL_OVERLAP_UNFIXABLE]);
+    ReportAdd("greedy/statsCheck", "distortion_local", stats.statsCheck[FAIL_DISTORTION_LOCAL]);
+    ReportAdd("greedy/statsCheck", "distortion_global", stats.statsCheck[FAIL_DISTORTION_GLOBAL]);
+    ReportAdd("greedy/statsCheck", "topology", stats.statsCheck[FAIL_TOPOLOGY]);
+    ReportAdd("greedy/statsCheck", "numerical_error", stats.statsCheck[FAIL_NUMERICAL_ERROR]);
+
+    ReportAdd("greedy/feasibility", "feasible", stats.feasibility[CostInfo::FEASIBLE]);
+    ReportAdd("greedy/feasibility", "zero_area", stats.feasibility[CostInfo::ZERO_AREA]);
+    ReportAdd("greedy/feasibility", "unfeasible_boundary", stats.feasibility[CostInfo::UNFEASIBLE_BOUNDARY]);
+    ReportAdd("greedy/feasibility", "unfeasible_matching", stats.feasibility[CostInfo::UNFEASIBLE_MATCHING]);
+    ReportAdd("greedy/feasibility", "rejected", stats.feasibility[CostInfo::REJECTED]);
+    ReportAdd("greedy/feasibility", "rejected_at_area", stats.rejectionStage[CostInfo::STAGE_AREA]);
+    ReportAdd("greedy/feasibility", "rejected_at_boundary", stats.rejectionStage[CostInfo::STAGE_BOUNDARY]);
+    ReportAdd("greedy/feasibility", "rejected_at_lookahead", stats.rejectionStage[CostInfo::STAGE_LOOKAHEAD]);
+    ReportAdd("greedy/feasibility", "rejected_at_matching", stats.rejectionStage[CostInfo::STAGE_MATCHING]);
+
+    // the counts and the times add up over the tiles, the percentiles are those of
+    // the last optimization
+    for (int i = 0; i < CheckStatus::_END; ++i) {
+        const LatencyHistogram& h = stats.moveTime[i];
+        if (h.count == 0)
+            continue;
+        std::string section = std::string("greedy/outcomes/") + statusName[i];
+        ReportAdd(section, "moves", (double) h.count);
+        ReportAdd(section, "total_s", h.sum);
+        ReportValue(section, "p50_s", h.Percentile(0.5));
+        ReportValue(section, "p99_s", h.Percentile(0.99));
+        ReportValue(section, "max_s", h.max);
+        ReportAdd(section, "overlap_fixes", stats.overlapFixes[i]);
+        for (int j = 0; j < MOVE_STAGE_END; ++j)
+            ReportAdd(section, std::string(moveStageName[j]) + "_s", stats.statusStageTime[i][j]);
     }
+}
 
-    uint64_t used_memory = (vm_stat.active_count + vm_stat.inactive_count + vm_stat.wire_count) * (uint64_t)pagesize;
+/* Estimates the memory held by the state, the node based containers are counted
+ * with two pointers of overhead per entry */
+static std::size_t EstimateStateBytes(const AlgoState& state)
+{
+    const std::size_t node = 2 * sizeof(void *);
+    std::size_t bytes = state.sm.vert.capacity() * sizeof(SeamVertex) + state.sm.edge.capacity() * sizeof(SeamEdge);
+    bytes += state.queue.size() * (sizeof(WeightedSeam) + node);
+    bytes += state.clusters.MemoryBytes();
+    for (const auto& entry : state.failed)
+        bytes += sizeof(entry) + node + entry.second.size() * (sizeof(RegionID) + node);
+    bytes += state.changeSet.size() * sizeof(Mesh::FacePointer);
+    bytes += state.uvIndex.MemoryBytes();
+    bytes += state.faceArapNum.capacity() * sizeof(double);
+    return bytes;
+}
 
-    double used_mem_gb = (double)used_memory / (1024.0 * 1024.0 * 1024.0);
-    double total_mem_gb = (double)total_mem_val / (1024.0 * 1024.0 * 1024.0);
+/* Updates the memory accounted to the state, by difference so that the states of
+ * concurrent optimizations are accounted together */
+static void UpdateStateBytes(AlgoState& state)
+{
+    long long bytes = EstimateStateBytes(state);
+    MemoryAdd(MemorySubsystem::SeamState, bytes - state.trackedBytes);
+    state.trackedBytes = bytes;
+}
 
-    LOG_INFO << "System RAM: " << std::fixed << std::setprecision(2) << used_mem_gb << " / " << total_mem_gb << " GB used";
+AlgoState::~AlgoState()
+{
+    MemoryAdd(MemorySubsystem::SeamState, -trackedBytes);
+}
 
-#elif defined(__linux__)
-    // Linux implementation
-    std::ifstream meminfo("/proc/meminfo");
-    if (!meminfo.is_open()) {
-        LOG_WARN << "Could not open /proc/meminfo to read memory stats";
-        return;
-    }
+// -- ClusterStore -------------------------------------------------------------
 
-    std::string line;
-    long long mem_total = -1, mem_available = -1;
-    while (std::getline(meminfo, line)) {
-        if (line.rfind("MemTotal:", 0) == 0) {
-            try { mem_total = std::stoll(line.substr(10)); } catch (...) {}
-        }
-        if (line.rfind("MemAvailable:", 0) == 0) {
-            try { mem_available = std::stoll(line.substr(13)); } catch (...) {}
+constexpr ClusterId ClusterStore::NONE;
+
+static const std::vector<ClusterId> noClusters;
+
+ClusterId ClusterStore::Find(const ClusteredSeamHandle& csh) const
+{
+    auto it = index.find(csh);
+    return (it != index.end()) ? it->second : NONE;
+}
+
+ClusterId ClusterStore::Acquire(const ClusteredSeamHandle& csh)
+{
+    auto ins = index.insert(std::make_pair(csh, NONE));
+    if (ins.second) {
+        if (freeSlots.empty()) {
+            ins.first->second = (ClusterId) records.size();
+            records.emplace_back();
+        } else {
+            ins.first->second = freeSlots.back();
+            freeSlots.pop_back();
         }
+        records[ins.first->second].csh = csh;
     }
+    return ins.first->second;
+}
 
-    if (mem_total != -1 && mem_available != -1) {
-        long long used_mem = mem_total - mem_available; // in kB
-        double used_mem_gb = (double)used_mem / (1024.0 * 1024.0);
-        double total_mem_gb = (double)mem_total / (1024.0 * 1024.0);
-        LOG_INFO << "System RAM: " << std::fixed << std::setprecision(2) << used_mem_gb << " / " << total_mem_gb << " GB used";
-    } else {
-        LOG_WARN << "Could not parse MemTotal/MemAvailable from /proc/meminfo";
-    }
+void ClusterStore::Release(ClusterId id)
+{
+    ensure(records[id].csh != nullptr);
+    index.erase(records[id].csh);
+    records[id] = ClusterRecord();
+    freeSlots.push_back(id);
+}
 
-#elif defined(_WIN32)
-    // Windows implementation
-    MEMORYSTATUSEX statex;
-    statex.dwLength = sizeof(statex);
-    if (GlobalMemoryStatusEx(&statex)) {
-        double total_mem_gb = (double)statex.ullTotalPhys / (1024.0 * 1024.0 * 1024.0);
-        double used_mem_gb = (double)(statex.ullTotalPhys - statex.ullAvailPhys) / (1024.0 * 1024.0 * 1024.0);
+const std::vector<ClusterId>& ClusterStore::ChartClusters(RegionID id) const
+{
+    return (id < (RegionID) chartClusters.size()) ? chartClusters[id] : noClusters;
+}
 
-        LOG_INFO << "System RAM: " << std::fixed << std::setprecision(2) << used_mem_gb << " / " << total_mem_gb << " GB used";
-    } else {
-        LOG_WARN << "Windows GlobalMemoryStatusEx failed.";
+void ClusterStore::InsertChartCluster(RegionID id, ClusterId cid)
+{
+    if (id >= (RegionID) chartClusters.size())
+        chartClusters.resize(id + 1);
+    std::vector<ClusterId>& v = chartClusters[id];
+    if (std::find(v.begin(), v.end(), cid) == v.end())
+        v.push_back(cid);
+}
+
+void ClusterStore::EraseChartCluster(RegionID id, ClusterId cid)
+{
+    if (id < (RegionID) chartClusters.size()) {
+        std::vector<ClusterId>& v = chartClusters[id];
+        auto it = std::find(v.begin(), v.end(), cid);
+        if (it != v.end())
+            v.erase(it);
     }
-#else
-    LOG_WARN << "Memory usage logging not implemented for this platform.";
-#endif
 }
 
-void LogExecutionStats()
+void ClusterStore::ClearChartClusters(RegionID id)
+{
+    if (id < (RegionID) chartClusters.size())
+        std::vector<ClusterId>().swap(chartClusters[id]);
+}
+
+const std::vector<ClusterId>& ClusterStore::EndpointClusters(int vi) const
+{
+    return (vi < (int) endpointClusters.size()) ? endpointClusters[vi] : noClusters;
+}
+
+void ClusterStore::InsertEndpointCluster(int vi, ClusterId cid)
+{
+    if (vi >= (int) endpointClusters.size())
+        endpointClusters.resize(vi + 1);
+    std::vector<ClusterId>& v = endpointClusters[vi];
+    if (std::find(v.begin(), v.end(), cid) == v.end())
+        v.push_back(cid);
+}
+
+bool ClusterStore::EraseEndpointCluster(int vi, ClusterId cid)
+{
+    if (vi >= (int) endpointClusters.size())
+        return false;
+    std::vector<ClusterId>& v = endpointClusters[vi];
+    auto it = std::find(v.begin(), v.end(), cid);
+    if (it == v.end())
+        return false;
+    v.erase(it);
+    return true;
+}
+
+void ClusterStore::Clear()
+{
+    records.clear();
+    freeSlots.clear();
+    index.clear();
+    chartClusters.clear();
+    endpointClusters.clear();
+}
+
+std::size_t ClusterStore::MemoryBytes() const
+{
+    const std::size_t node = 2 * sizeof(void *);
+    std::size_t bytes = records.capacity() * sizeof(ClusterRecord) + freeSlots.capacity() * sizeof(ClusterId);
+    bytes += index.size() * (sizeof(ClusteredSeamHandle) + sizeof(ClusterId) + node) + index.bucket_count() * sizeof(void *);
+    for (const auto& v : chartClusters)
+        bytes += sizeof(v) + v.capacity() * sizeof(ClusterId);
+    for (const auto& v : endpointClusters)
+        bytes += sizeof(v) + v.capacity() * sizeof(ClusterId);
+    return bytes;
+}
+
+/* Estimates the memory held by the buffers of the move data */
+static std::size_t EstimateSeamDataBytes(const SeamData& sd)
+{
+    std::size_t bytes = sd.shell.vert.capacity() * sizeof(MeshVertex) + sd.shell.face.capacity() * sizeof(MeshFace);
+    bytes += sd.undoVertexTex.capacity() * sizeof(SeamData::VertexTexRecord);
+    bytes += sd.undoWedgeTex.capacity() * sizeof(SeamData::WedgeTexRecord);
+    bytes += sd.undoVertexRef.capacity() * sizeof(SeamData::VertexRefRecord);
+    return bytes;
+}
+
+static void LogExecutionStats(AlgoStats& stats)
 {
-    LogMemoryUsage();
+    LogSystemMemoryUsage();
     LOG_INFO    << "======== EXECUTION STATS ========";
-    LOG_INFO    << "INIT       " << std::fixed << std::setprecision(3) << perf.t_init / perf.timer.TimeElapsed()                                << " , " << std::defaultfloat << std::setprecision(6)<< perf.t_init << " secs";
-    LOG_INFO    << "SEAM       " << std::fixed << std::setprecision(3) << perf.t_seamdata / perf.timer.TimeElapsed()                            << " , " << std::defaultfloat << std::setprecision(6)<< perf.t_seamdata << " secs";
-    LOG_INFO    << "MERGE      " << std::fixed << std::setprecision(3) << perf.t_alignmerge / perf.timer.TimeElapsed()                          << " , " << std::defaultfloat << std::setprecision(6)<< perf.t_alignmerge << " secs";
-    LOG_INFO    << "AREA OPT   " << std::fixed << std::setprecision(3) << perf.t_optimization_area / perf.timer.TimeElapsed()                   << " , " << std::defaultfloat << std::setprecision(6)<< perf.t_optimization_area << " secs";
-    LOG_INFO    << "OPTIMIZE   " << std::fixed << std::setprecision(3) << perf.t_optimize / perf.timer.TimeElapsed()                            << " , " << std::defaultfloat << std::setprecision(6)<< perf.t_optimize << " secs";
-    LOG_VERBOSE << "  BUILD    " << std::fixed << std::setprecision(3) << perf.t_optimize_build / perf.timer.TimeElapsed()                      << " , " << std::defaultfloat << std::setprecision(6)<< perf.t_optimize_build << " secs";
-    LOG_VERBOSE << "  ARAP     " << std::fixed << std::setprecision(3) << perf.t_optimize_arap / perf.timer.TimeElapsed()                       << " , " << std::defaultfloat << std::setprecision(6)<< perf.t_optimize_arap << " secs";
-    LOG_INFO    << "CHECK      " << std::fixed << std::setprecision(3) << (perf.t_check_before + perf.t_check_after) / perf.timer.TimeElapsed() << " , " << std::defaultfloat << std::setprecision(6)<< (perf.t_check_before + perf.t_check_after) << " secs";
-    LOG_VERBOSE << "  BEFORE   " << std::fixed << std::setprecision(3) << perf.t_check_before / perf.timer.TimeElapsed()                        << " , " << std::defaultfloat << std::setprecision(6)<< perf.t_check_before << " secs";
-    LOG_VERBOSE << "  AFTER    " << std::fixed << std::setprecision(3) << perf.t_check_after / perf.timer.TimeElapsed()                         << " , " << std::defaultfloat << std::setprecision(6)<< perf.t_check_after << " secs";
-    LOG_INFO    << "ACCEPT     " << std::fixed << std::setprecision(3) << perf.t_accept / perf.timer.TimeElapsed()                              << " , " << std::defaultfloat << std::setprecision(6)<< perf.t_accept << " secs";
-    LOG_INFO    << "  count:                    " << accept;
-    LOG_INFO    << "  with retry:               " << retry_success;
-    LOG_VERBOSE << "  min energy:               " << min_energy;
-    LOG_VERBOSE << "  max energy:               " << max_energy;
-    LOG_INFO    << "REJECT     " << std::fixed << std::setprecision(3) << perf.t_reject / perf.timer.TimeElapsed()                              << " , " << std::defaultfloat << std::setprecision(6)<< perf.t_reject << " secs";
-    LOG_INFO    << "  count:                    " << reject;
-    LOG_INFO    << "  with retry:               " << num_retry - retry_success;
-    LOG_VERBOSE << "  local overlaps            " << statsCheck[FAIL_LOCAL_OVERLAP];
-    LOG_VERBOSE << "  global overlaps before    " << statsCheck[FAIL_GLOBAL_OVERLAP_BEFORE];
-    LOG_VERBOSE << "  global overlaps after opt " << statsCheck[FAIL_GLOBAL_OVERLAP_AFTER_OPT];
-    LOG_VERBOSE << "  global overlaps after bnd " << statsCheck[FAIL_GLOBAL_OVERLAP_AFTER_BND];
-    LOG_VERBOSE << "  global overlaps unfixable " << statsCheck[FAIL_GLOBAL_OVERLAP_UNFIXABLE];
-    LOG_VERBOSE << "  distortion (local)        " << statsCheck[FAIL_DISTORTION_LOCAL];
-    LOG_VERBOSE << "  distortion (global)       " << statsCheck[FAIL_DISTORTION_GLOBAL];
-    LOG_VERBOSE << "  topology                  " << statsCheck[FAIL_TOPOLOGY];
-    LOG_VERBOSE << "  numerical error           " << statsCheck[FAIL_NUMERICAL_ERROR];
+    LOG_INFO    << "INIT       " << std::fixed << std::setprecision(3) << stats.t_init / stats.timer.TimeElapsed()                                << " , " << std::defaultfloat << std::setprecision(6)<< stats.t_init << " secs";
+    LOG_INFO    << "SEAM       " << std::fixed << std::setprecision(3) << stats.t_seamdata / stats.timer.TimeElapsed()                            << " , " << std::defaultfloat << std::setprecision(6)<< stats.t_seamdata << " secs";
+    LOG_INFO    << "MERGE      " << std::fixed << std::setprecision(3) << stats.t_alignmerge / stats.timer.TimeElapsed()                          << " , " << std::defaultfloat << std::setprecision(6)<< stats.t_alignmerge << " secs";
+    LOG_INFO    << "AREA OPT   " << std::fixed << std::setprecision(3) << stats.t_optimization_area / stats.timer.TimeElapsed()                   << " , " << std::defaultfloat << std::setprecision(6)<< stats.t_optimization_area << " secs";
+    LOG_INFO    << "OPTIMIZE   " << std::fixed << std::setprecision(3) << stats.t_optimize / stats.timer.TimeElapsed()                            << " , " << std::defaultfloat << std::setprecision(6)<< stats.t_optimize << " secs";
+    LOG_VERBOSE << "  BUILD    " << std::fixed << std::setprecision(3) << stats.t_optimize_build / stats.timer.TimeElapsed()                      << " , " << std::defaultfloat << std::setprecision(6)<< stats.t_optimize_build << " secs";
+    LOG_VERBOSE << "  ARAP     " << std::fixed << std::setprecision(3) << stats.t_optimize_arap / stats.timer.TimeElapsed()                       << " , " << std::defaultfloat << std::setprecision(6)<< stats.t_optimize_arap << " secs";
+    LOG_VERBOSE << "    iterations:             " << stats.arap_iterations;
+    LOG_VERBOSE << "    solver iterations:      " << stats.arap_solver_iterations;
+    LOG_VERBOSE << "    backend fallbacks:      " << stats.arap_fallbacks;
+    LOG_VERBOSE << "    parallel solves:        " << stats.arap_parallel << " (shells of " << ParallelMinFaces() << " faces or more)";
+    LOG_VERBOSE << "    dense solves:           " << stats.arap_dense;
+    LOG_VERBOSE << "    GPU solves:             " << stats.arap_gpu;
+    LOG_VERBOSE << "    early terminations:     " << stats.arap_early_pass + stats.arap_early_fail << " (" << stats.arap_early_fail << " failed)";
+    if (stats.prescreen_pass + stats.prescreen_audited + stats.prescreen_skipped > 0) {
+        // the precision is estimated on the audited moves, and the recall assumes
+        // that the skipped moves are hits with the same rate
+        double precision = (stats.prescreen_audited > 0) ? stats.prescreen_audited_hits / (double) stats.prescreen_audited : 1.0;
+        double hits = precision * (stats.prescreen_audited + stats.prescreen_skipped);
+        double recall = (hits + stats.prescreen_missed > 0) ? hits / (hits + stats.prescreen_missed) : 1.0;
+        LOG_VERBOSE << "  PRESCREEN";
+        LOG_VERBOSE << "    predicted pass:         " << stats.prescreen_pass << " (" << stats.prescreen_missed << " failed)";
+        LOG_VERBOSE << "    predicted fail:         " << stats.prescreen_audited + stats.prescreen_skipped << " (" << stats.prescreen_skipped << " skipped)";
+        LOG_VERBOSE << "    precision:              " << precision << " (" << stats.prescreen_audited << " audited)";
+        LOG_VERBOSE << "    recall:                 " << recall;
+    }
+    if (stats.raster_checks > 0) {
+        LOG_VERBOSE << "  RASTERIZED OVERLAP CHECKS";
+        LOG_VERBOSE << "    checks:                 " << stats.raster_checks;
+        LOG_VERBOSE << "    overlaps:               " << stats.raster_overlaps << " (" << stats.raster_missed << " missed by the borders)";
+    }
+    if (stats.lazy_queued > 0) {
+        LOG_VERBOSE << "  LAZY COSTS";
+        LOG_VERBOSE << "    estimated:              " << stats.lazy_queued;
+        LOG_VERBOSE << "    costed:                 " << stats.lazy_resolved << " (" << stats.lazy_requeued << " requeued)";
+    }
+    if (stats.coincident_merged + stats.coincident_deferred > 0) {
+        LOG_VERBOSE << "  COINCIDENT SEAMS";
+        LOG_VERBOSE << "    stitched:               " << stats.coincident_merged;
+        LOG_VERBOSE << "    left to the loop:       " << stats.coincident_deferred;
+    }
+    LOG_INFO    << "CHECK      " << std::fixed << std::setprecision(3) << (stats.t_check_before + stats.t_check_after) / stats.timer.TimeElapsed() << " , " << std::defaultfloat << std::setprecision(6)<< (stats.t_check_before + stats.t_check_after) << " secs";
+    LOG_VERBOSE << "  BEFORE   " << std::fixed << std::setprecision(3) << stats.t_check_before / stats.timer.TimeElapsed()                        << " , " << std::defaultfloat << std::setprecision(6)<< stats.t_check_before << " secs";
+    LOG_VERBOSE << "  AFTER    " << std::fixed << std::setprecision(3) << stats.t_check_after / stats.timer.TimeElapsed()                         << " , " << std::defaultfloat << std::setprecision(6)<< stats.t_check_after << " secs";
+    LOG_INFO    << "ACCEPT     " << std::fixed << std::setprecision(3) << stats.t_accept / stats.timer.TimeElapsed()                              << " , " << std::defaultfloat << std::setprecision(6)<< stats.t_accept << " secs";
+    LOG_INFO    << "  count:                    " << stats.accept;
+    LOG_INFO    << "  with retry:               " << stats.retry_success;
+    LOG_VERBOSE << "  min energy:               " << stats.min_energy;
+    LOG_VERBOSE << "  max energy:               " << stats.max_energy;
+    LOG_INFO    << "REJECT     " << std::fixed << std::setprecision(3) << stats.t_reject / stats.timer.TimeElapsed()                              << " , " << std::defaultfloat << std::setprecision(6)<< stats.t_reject << " secs";
+    LOG_INFO    << "  count:                    " << stats.reject;
+    LOG_INFO    << "  with retry:               " << stats.num_retry - stats.retry_success;
+    LOG_VERBOSE << "  local overlaps            " << stats.statsCheck[FAIL_LOCAL_OVERLAP];
+    LOG_VERBOSE << "  global overlaps before    " << stats.statsCheck[FAIL_GLOBAL_OVERLAP_BEFORE];
+    LOG_VERBOSE << "  global overlaps after opt " << stats.statsCheck[FAIL_GLOBAL_OVERLAP_AFTER_OPT];
+    LOG_VERBOSE << "  global overlaps after bnd " << stats.statsCheck[FAIL_GLOBAL_OVERLAP_AFTER_BND];
+    LOG_VERBOSE << "  global overlaps unfixable " << stats.statsCheck[FAIL_GLOBAL_OVERLAP_UNFIXABLE];
+    LOG_VERBOSE << "  distortion (local)        " << stats.statsCheck[FAIL_DISTORTION_LOCAL];
+    LOG_VERBOSE << "  distortion (global)       " << stats.statsCheck[FAIL_DISTORTION_GLOBAL];
+    LOG_VERBOSE << "  topology                  " << stats.statsCheck[FAIL_TOPOLOGY];
+    LOG_VERBOSE << "  numerical error           " << stats.statsCheck[FAIL_NUMERICAL_ERROR];
     LOG_VERBOSE << "    FEASIBILITY";
-    LOG_VERBOSE << "      feasible              " << feasibility[CostInfo::FEASIBLE];
-    LOG_VERBOSE << "      unfeasible boundary   " << feasibility[CostInfo::UNFEASIBLE_BOUNDARY];
-    LOG_VERBOSE << "      unfeasible matching   " << feasibility[CostInfo::UNFEASIBLE_MATCHING];
-    LOG_INFO    << "TOTAL      " << std::fixed << std::setprecision(3) << perf.timer.TimeElapsed() / perf.timer.TimeElapsed()          << " , " << std::defaultfloat << std::setprecision(6)<< perf.timer.TimeElapsed() << " secs";
-    LOG_VERBOSE << "Minimum computed cost is " << mincost;
-    LOG_VERBOSE << "Maximum computed cost is " << maxcost;
+    LOG_VERBOSE << "      feasible              " << stats.feasibility[CostInfo::FEASIBLE];
+    LOG_VERBOSE << "      unfeasible boundary   " << stats.feasibility[CostInfo::UNFEASIBLE_BOUNDARY];
+    LOG_VERBOSE << "      unfeasible matching   " << stats.feasibility[CostInfo::UNFEASIBLE_MATCHING];
+    LOG_VERBOSE << "      rejected at area      " << stats.rejectionStage[CostInfo::STAGE_AREA];
+    LOG_VERBOSE << "      rejected at boundary  " << stats.rejectionStage[CostInfo::STAGE_BOUNDARY];
+    LOG_VERBOSE << "      rejected at lookahead " << stats.rejectionStage[CostInfo::STAGE_LOOKAHEAD];
+    LOG_VERBOSE << "      rejected at matching  " << stats.rejectionStage[CostInfo::STAGE_MATCHING];
+    LOG_VERBOSE << "OUTCOMES   moves, total, p50, p99, max secs, overlap fixing passes, slowest stage";
+    for (int i = 0; i < CheckStatus::_END; ++i) {
+        const LatencyHistogram& h = stats.moveTime[i];
+        if (h.count == 0)
+            continue;
+        int slowest = int(std::max_element(stats.statusStageTime[i], stats.statusStageTime[i] + MOVE_STAGE_END) - stats.statusStageTime[i]);
+        LOG_VERBOSE << "  " << std::left << std::setw(25) << statusName[i] << std::right
+                    << h.count << " , " << h.sum << " , " << h.Percentile(0.5) << " , " << h.Percentile(0.99) << " , " << h.max
+                    << " , " << stats.overlapFixes[i] << " , " << moveStageName[slowest]
+                    << " (" << std::fixed << std::setprecision(3) << (h.sum > 0 ? stats.statusStageTime[i][slowest] / h.sum : 0.0) << std::defaultfloat << std::setprecision(6) << ")";
+    }
+    LOG_INFO    << "TOTAL      " << std::fixed << std::setprecision(3) << stats.timer.TimeElapsed() / stats.timer.TimeElapsed()          << " , " << std::defaultfloat << std::setprecision(6)<< stats.timer.TimeElapsed() << " secs";
+    if (!stats.counters.empty()) {
+        LOG_INFO << "[PERF-COUNTERS] by timed scope, counted on the threads that run the scopes (not on the workers of their parallel loops)";
+        for (const auto& entry : stats.counters)
+            LOG_INFO << "  " << std::left << std::setw(21) << entry.first << std::right << FormatPerfCounters(entry.second);
+    }
+    LOG_VERBOSE << "Minimum computed cost is " << stats.mincost;
+    LOG_VERBOSE << "Maximum computed cost is " << stats.maxcost;
     LOG_INFO    << "===================================";
 }
 
 static void PrintStateInfo(AlgoStateHandle state, GraphHandle graph, const AlgoParameters& params)
 {
-    std::set<ClusteredSeamHandle> moveSet;
+    std::vector<bool> isMove(state->clusters.Slots(), false);
+    for (RegionID id = 0; id < state->clusters.ChartSlots(); ++id)
+        for (ClusterId cid : state->clusters.ChartClusters(id))
+            isMove[cid] = true;
 
-    for (auto& entry : state->chartSeamMap) {
-        for (auto csh : entry.second) {
-            moveSet.insert(csh);
-        }
-    }
-
-    LOG_VERBOSE << "Status of the residual " << moveSet.size() << " operations:";
+    LOG_VERBOSE << "Status of the residual " << std::count(isMove.begin(), isMove.end(), true) << " operations:";
 
     int nstat[100] = {};
     int mstat[100] = {};
-    for (auto csh : moveSet) {
-        auto it = state->status.find(csh);
-        ensure(it != state->status.end());
-        ensure(it->second != PASS);
-        CostInfo ci = ComputeCost(csh, graph, params, GetPenalty(csh, state));
-        nstat[state->status[csh]]++;
+    for (ClusterId cid = 0; cid < (ClusterId) isMove.size(); ++cid) {
+        if (!isMove[cid])
+            continue;
+        const ClusterRecord& r = state->clusters[cid];
+        ensure(r.active);
+        ensure(r.status != PASS);
+        CostInfo ci = ComputeCost(r.csh, graph, params, r.penalty);
+        nstat[r.status]++;
         mstat[ci.mvalue]++;
     }
 
@@ -307,57 +682,65 @@ static void PrintStateInfo(AlgoStateHandle state, GraphHandle graph, const AlgoP
 
 void PrepareMesh(Mesh& m, int *vndup)
 {
-    int dupVert = tri::Clean<Mesh>::RemoveDuplicateVertex(m);
+    TRACE_SCOPE_CAT("PrepareMesh", "prepare");
+
+    int dupVert = RemoveDuplicateVertices(m);
     if (dupVert > 0)
         LOG_INFO << "Removed " << dupVert << " duplicate vertices";
 
-    int zeroArea = tri::Clean<Mesh>::RemoveZeroAreaFace(m);
+    int zeroArea = RemoveZeroAreaFaces(m);
     if (zeroArea > 0)
         LOG_INFO << "Removed " << zeroArea << " zero area faces";
 
-    tri::UpdateTopology<Mesh>::FaceFace(m);
+    // the FF topology is built once, the following steps keep it up to date
+    InvalidateDerivedData(m);
+    RequireFaceFace(m);
 
     // orient faces coherently
     bool wasOriented, isOrientable;
-    tri::Clean<Mesh>::OrientCoherentlyMesh(m, wasOriented, isOrientable);
+    OrientFacesCoherently(m, &wasOriented, &isOrientable);
 
-    tri::UpdateTopology<Mesh>::FaceFace(m);
-
-    int numRemovedFaces = tri::Clean<Mesh>::RemoveNonManifoldFace(m);
+    int numRemovedFaces = RemoveNonManifoldFaces(m);
     if (numRemovedFaces > 0)
         LOG_INFO << "Removed " << numRemovedFaces << " non-manifold faces";
 
     tri::Allocator<Mesh>::CompactEveryVector(m);
-    tri::UpdateTopology<Mesh>::FaceFace(m);
 
     Compute3DFaceAdjacencyAttribute(m);
 
     CutAlongSeams(m);
-    tri::Allocator<Mesh>::CompactEveryVector(m);
 
     *vndup = m.VN();
 
-    tri::UpdateTopology<Mesh>::FaceFace(m);
-    while (tri::Clean<Mesh>::SplitNonManifoldVertex(m, 0))
-        ;
-    tri::UpdateTopology<Mesh>::VertexFace(m);
+    SplitNonManifoldVertices(m);
 
-    tri::Allocator<Mesh>::CompactEveryVector(m);
+    // the charts are the connected components of the cut mesh
+    int numCharts = ReorderForLocality(m);
+    LOG_VERBOSE << "Reordered the faces and vertices of " << numCharts << " charts";
 }
 
-AlgoStateHandle InitializeState(GraphHandle graph, const AlgoParameters& algoParameters)
+AlgoStateHandle InitializeState(GraphHandle graph, const AlgoParameters& algoParameters, const ChartOrientation *orientation)
 {
-    PERF_TIMER_RESET;
-    PERF_TIMER_START;
-
+    TRACE_SCOPE_CAT("InitializeState", "greedy");
     AlgoStateHandle state = std::make_shared<AlgoState>();
-    ARAP::ComputeEnergyFromStoredWedgeTC(graph->mesh, &state->arapNum, &state->arapDenom);
+    PERF_TIMER_START(state->stats);
+
+    if (orientation && orientation->faceArapNum.size() == graph->mesh.face.size()) {
+        state->arapNum = orientation->arapNum;
+        state->arapDenom = orientation->arapDenom;
+        state->faceArapNum = orientation->faceArapNum;
+    } else {
+        ARAP::ComputeEnergyFromStoredWedgeTC(graph->mesh, &state->arapNum, &state->arapDenom, &state->faceArapNum);
+    }
     state->inputUVBorderLength = 0;
     state->currentUVBorderLength = 0;
 
     BuildSeamMesh(graph->mesh, state->sm);
     std::vector<SeamHandle> seams = GenerateSeams(state->sm);
 
+    state->uvIndex.Init(graph->mesh);
+    state->changeSet.Bind(graph->mesh.face);
+
     // disconnecting seams are (initially) clustered by chart adjacency
     // non-disconnecting seams are not clustered (segment granularity)
 
@@ -371,14 +754,15 @@ AlgoStateHandle InitializeState(GraphHandle graph, const AlgoParameters& algoPar
             nself++;
         else
             ndisconnecting++;
-        InsertNewClusterInQueue(csh, state, graph, algoParameters);
     }
+    InsertNewClustersInQueue(cshvec, state, graph, algoParameters);
     LOG_INFO << "Found " << ndisconnecting << " disconnecting seams";
     LOG_INFO << "Found " << nself << " non-disconnecting seams";
 
     // sanity check
-    for (auto& entry : state->chartSeamMap) {
-        ensure(entry.second.size() >= (graph->GetChart(entry.first)->adj.size()));
+    for (RegionID id = 0; id < state->clusters.ChartSlots(); ++id) {
+        if (state->clusters.ChartClusters(id).size() > 0)
+            ensure(state->clusters.ChartClusters(id).size() >= (graph->GetChart(id)->adj.size()));
     }
 
     for (const auto& ch : graph->charts) {
@@ -386,33 +770,359 @@ AlgoStateHandle InitializeState(GraphHandle graph, const AlgoParameters& algoPar
         state->currentUVBorderLength += ch.second->BorderUV();
     }
 
+    UpdateStateBytes(*state);
+
     PERF_TIMER_ACCUMULATE(t_init);
     return state;
 }
 
-void GreedyOptimization(GraphHandle graph, AlgoStateHandle state, const AlgoParameters& params)
+bool SameQueueParameters(const AlgoParameters& a, const AlgoParameters& b)
+{
+    // the parameters of the costs and of the reduction of the unfeasible seams
+    return a.matchingThreshold == b.matchingThreshold
+            && a.boundaryTolerance == b.boundaryTolerance
+            && a.reductionFactor == b.reductionFactor
+            && a.reduce == b.reduce
+            && a.reduceBisection == b.reduceBisection
+            && a.visitComponents == b.visitComponents
+            && a.expb == b.expb;
+}
+
+/* Splits the charts in k regions of similar 3D area by recursive bisection. Each
+ * bisection orders the charts breadth-first from a peripheral chart, and cuts the
+ * order at the area fraction of the first half, so that the regions tend to be
+ * compact and few seams cross them */
+static void BisectCharts(const std::vector<ChartHandle>& charts, int k, std::vector<std::vector<ChartHandle>>& regions)
+{
+    if (k <= 1 || charts.size() <= 1) {
+        regions.push_back(charts);
+        return;
+    }
+
+    std::unordered_set<ChartHandle> chartSet(charts.begin(), charts.end());
+    auto BreadthFirstOrder = [&] (ChartHandle seed) {
+        std::vector<ChartHandle> order;
+        std::unordered_set<ChartHandle> visited;
+        for (unsigned i = 0; i <= charts.size() && order.size() < charts.size(); ++i) {
+            // restart from the first unvisited chart if the charts are disconnected
+            ChartHandle start = (i == 0) ? seed : charts[i - 1];
+            if (!visited.insert(start).second)
+                continue;
+            std::size_t head = order.size();
+            order.push_back(start);
+            while (head < order.size()) {
+                ChartHandle c = order[head++];
+                for (auto adj : c->adj)
+                    if (chartSet.count(adj) > 0 && visited.insert(adj).second)
+                        order.push_back(adj);
+            }
+        }
+        return order;
+    };
+
+    // the last chart reached by a visit is far from where the visit started
+    std::vector<ChartHandle> order = BreadthFirstOrder(BreadthFirstOrder(charts.front()).back());
+
+    int k1 = k / 2;
+    double totalArea = 0;
+    for (auto c : order)
+        totalArea += c->Area3D();
+    double targetArea = totalArea * k1 / (double) k;
+
+    std::size_t cut = 0;
+    double area = 0;
+    while (cut < order.size() - 1 && (cut == 0 || area + 0.5 * order[cut]->Area3D() <= targetArea))
+        area += order[cut++]->Area3D();
+
+    BisectCharts(std::vector<ChartHandle>(order.begin(), order.begin() + cut), k1, regions);
+    BisectCharts(std::vector<ChartHandle>(order.begin() + cut, order.end()), k - k1, regions);
+}
+
+/* Optimizes the clusters of params.partitions regions of the graph concurrently.
+ * Each region is optimized by its own greedy loop on a graph that only holds the
+ * charts of the region (adjacencies to other regions are dropped), with a state
+ * that holds the clusters internal to the region and a share of the distortion
+ * budget proportional to its area. The regions are then merged back in the graph
+ * and the state, and the clusters that cross the regions are recomputed from
+ * their seams and inserted in the queue, so that the serial loop that follows
+ * can process them */
+static void OptimizePartitions(GraphHandle graph, AlgoStateHandle state, const AlgoParameters& params)
 {
-    ClearGlobals();
+    TRACE_SCOPE_CAT("OptimizePartitions", "greedy");
+    Mesh& m = graph->mesh;
+
+    std::vector<ChartHandle> charts;
+    for (const auto& entry : graph->charts)
+        charts.push_back(entry.second);
+
+    std::vector<std::vector<ChartHandle>> regions;
+    BisectCharts(charts, params.partitions, regions);
+
+    const int nr = regions.size();
+    std::unordered_map<RegionID, int> regionIndex;
+    for (int r = 0; r < nr; ++r)
+        for (auto c : regions[r])
+            regionIndex[c->id] = r;
+
+    // each region gets the same share of its area of the distortion budget
+    const double energy = state->arapNum / state->arapDenom;
+
+    std::vector<GraphHandle> rgraph(nr);
+    std::vector<AlgoStateHandle> rstate(nr);
+    for (int r = 0; r < nr; ++r) {
+        rgraph[r] = std::make_shared<MeshGraph>(m);
+        rgraph[r]->textureObject = graph->textureObject;
+
+        AlgoStateHandle rs = std::make_shared<AlgoState>();
+        rs->inputUVBorderLength = 0;
+        std::vector<Mesh::FacePointer> faces;
+        for (auto c : regions[r]) {
+            rgraph[r]->charts.insert(c);
+            faces.insert(faces.end(), c->fpVec.begin(), c->fpVec.end());
+            rs->inputUVBorderLength += c->BorderUV();
+            auto it = state->failed.find(c->id);
+            if (it != state->failed.end())
+                rs->failed.insert(*it);
+        }
+        rs->currentUVBorderLength = rs->inputUVBorderLength;
+
+        ARAP::ComputeEnergyFromStoredWedgeTC(faces, m, &rs->arapNum, &rs->arapDenom);
+        rs->arapNum = energy * rs->arapDenom;
+        rs->faceArapNum = state->faceArapNum;
+
+        rs->changeSet.Bind(m.face);
+        rs->uvIndex.Init(m, faces);
+        rstate[r] = rs;
+    }
+
+    for (int r = 0; r < nr; ++r)
+        ComputeChartAdjacency(*rgraph[r]);
+
+    std::vector<ClusteredSeamHandle> crossing;
+    for (const WeightedSeam& ws : state->queue) {
+        ClusteredSeamHandle csh = ws.first;
+        ChartPair p = GetCharts(csh, graph);
+        int r = regionIndex[p.first->id];
+        if (r != regionIndex[p.second->id]) {
+            crossing.push_back(csh);
+            continue;
+        }
+
+        AlgoStateHandle rs = rstate[r];
+        rs->queue.push(ws);
+        ClusterId cid = rs->clusters.Acquire(csh);
+        rs->clusters[cid] = state->clusters[state->clusters.Find(csh)];
+        rs->clusters.InsertChartCluster(p.first->id, cid);
+        rs->clusters.InsertChartCluster(p.second->id, cid);
+        for (int vi : GetEndpoints(csh))
+            rs->clusters.InsertEndpointCluster(vi, cid);
+    }
+
+    LOG_INFO << "Optimizing " << nr << " partitions concurrently, " << crossing.size() << " clusters cross the partitions";
+
+    // the regions are processed by the threads of the outer team, the parallel
+    // regions nested in the greedy loops are run by a single thread
+    AlgoParameters rparams = params;
+    rparams.checkpointInterval = 0;
+    rparams.checkpointFile = "";
+    rparams.moveLogFile = "";
+    // the partitions run concurrently, see OptimizeChart()
+    rparams.arapGPUFaces = 0;
+
+    #pragma omp parallel for schedule(dynamic, 1)
+    for (int r = 0; r < nr; ++r)
+        RunGreedyLoop(rgraph[r], rstate[r], rparams, params.timelimit, false);
+
+    for (int r = 0; r < nr; ++r)
+        state->stats.Merge(rstate[r]->stats);
+
+    // merge the regions back
+    graph->charts.clear();
+    for (int r = 0; r < nr; ++r) {
+        for (const auto& entry : rgraph[r]->charts)
+            graph->charts.insert(entry.second);
+        // the adjacencies are recomputed below, and must survive the region graph
+        rgraph[r]->charts.clear();
+    }
+    ComputeChartAdjacency(*graph);
+
+    state->queue.clear();
+    state->clusters.Clear();
+    state->failed.clear();
+
+    for (int r = 0; r < nr; ++r) {
+        AlgoStateHandle rs = rstate[r];
+        for (const WeightedSeam& ws : rs->queue)
+            state->queue.push(ws);
+        // the records are copied to the slots of the state, their ids change
+        std::vector<ClusterId> cidMap(rs->clusters.Slots(), ClusterStore::NONE);
+        for (ClusterId cid = 0; cid < rs->clusters.Slots(); ++cid) {
+            if (rs->clusters[cid].csh) {
+                cidMap[cid] = state->clusters.Acquire(rs->clusters[cid].csh);
+                state->clusters[cidMap[cid]] = rs->clusters[cid];
+            }
+        }
+        for (RegionID id = 0; id < rs->clusters.ChartSlots(); ++id)
+            for (ClusterId cid : rs->clusters.ChartClusters(id))
+                state->clusters.InsertChartCluster(id, cidMap[cid]);
+        for (int vi = 0; vi < rs->clusters.EndpointSlots(); ++vi)
+            for (ClusterId cid : rs->clusters.EndpointClusters(vi))
+                state->clusters.InsertEndpointCluster(vi, cidMap[cid]);
+        state->failed.insert(rs->failed.begin(), rs->failed.end());
+        state->changeSet.insert(rs->changeSet.begin(), rs->changeSet.end());
+    }
+
+    state->uvIndex.Init(m);
+    ARAP::ComputeEnergyFromStoredWedgeTC(m, &state->arapNum, &state->arapDenom, &state->faceArapNum);
+    state->currentUVBorderLength = 0;
+    for (const auto& entry : graph->charts)
+        state->currentUVBorderLength += entry.second->BorderUV();
+
+    // the charts of the crossing clusters may have been merged, so the clusters
+    // are rebuilt from their seams
+    std::vector<SeamHandle> seams;
+    for (auto csh : crossing)
+        for (auto sh : csh->seams)
+            seams.push_back(sh);
+    InsertNewClustersInQueue(ClusterSeamsByChartId(seams), state, graph, params);
+
+    LOG_INFO << "Atlas energy after the partitioned optimization is " << state->arapNum / state->arapDenom;
+}
+
+/* Tracks the moving averages of the latency and of the outcome of the moves of
+ * the greedy loop, and passes the progress to the callback of the parameters at
+ * most every progressInterval seconds */
+class ProgressReporter {
+
+public:
+
+    /* The moves committed before the loop (by the partitioned optimization) are
+     * not accounted */
+    ProgressReporter(ConstAlgoStateHandle state, const AlgoParameters& params, double timelimit)
+        : params(params), timelimit{timelimit}, accepted{state->stats.accept}, rejected{state->stats.reject},
+          tmove{0}, latency{0}, acceptRatio{0}, lastReport{0}, first{true}
+    {
+    }
+
+    /* Accounts the moves committed since the last update, reporting the progress
+     * if the interval elapsed */
+    void Update(ConstAlgoStateHandle state, int iterations)
+    {
+        int acc = state->stats.accept - accepted;
+        int rej = state->stats.reject - rejected;
+        if (acc + rej > 0) {
+            // the moves committed together (a batch) share the elapsed time
+            double elapsed = t.TimeElapsed();
+            double moveLatency = (elapsed - tmove) / (acc + rej);
+            double alpha = 1.0 - std::pow(1.0 - SMOOTHING, acc + rej);
+            latency = first ? moveLatency : latency + alpha * (moveLatency - latency);
+            acceptRatio = first ? acc / double(acc + rej) : acceptRatio + alpha * (acc / double(acc + rej) - acceptRatio);
+            first = false;
+            accepted = state->stats.accept;
+            rejected = state->stats.reject;
+            tmove = elapsed;
+        }
+
+        if (t.TimeElapsed() - lastReport >= params.progressInterval)
+            Report(state, iterations, false);
+    }
+
+    /* Reports the progress at the end of the loop */
+    void Finish(ConstAlgoStateHandle state, int iterations)
+    {
+        Report(state, iterations, true);
+    }
 
+private:
+
+    static constexpr double SMOOTHING = 0.05;
+
+    void Report(ConstAlgoStateHandle state, int iterations, bool done)
+    {
+        GreedyProgress progress;
+        progress.iterations = iterations;
+        progress.accepted = state->stats.accept;
+        progress.rejected = state->stats.reject;
+        progress.queueSize = state->queue.size();
+        progress.validMoves = 0;
+        for (ClusterId cid = 0; cid < state->clusters.Slots(); ++cid)
+            if (state->clusters[cid].active && state->clusters[cid].cost != Infinity())
+                progress.validMoves++;
+        progress.acceptRatio = acceptRatio;
+        progress.movesPerSecond = (latency > 0) ? 1.0 / latency : 0;
+        progress.borderRatio = state->currentUVBorderLength / state->inputUVBorderLength;
+        progress.borderTarget = params.UVBorderLengthReduction;
+        progress.elapsed = t.TimeElapsed();
+
+        // each valid move is evaluated at most once more unless it is re-queued
+        // after a rejection, so this is an estimate of the moves left to evaluate
+        // and not a bound
+        progress.remaining = -1;
+        if (done) {
+            progress.remaining = 0;
+        } else if (latency > 0) {
+            progress.remaining = progress.validMoves * latency;
+            if (timelimit > 0)
+                progress.remaining = std::min(progress.remaining, std::max(0.0, timelimit - progress.elapsed));
+        }
+        progress.done = done;
+
+        params.progressCallback(progress);
+        lastReport = t.TimeElapsed();
+    }
+
+    const AlgoParameters& params;
+    double timelimit;
     Timer t;
-    Timer tglobal;
+    int accepted;
+    int rejected;
+    double tmove;
+    double latency;
+    double acceptRatio;
+    double lastReport;
+    bool first;
+};
 
-    PrintStateInfo(state, graph, params);
+/* Runs the greedy loop on the queue of the state until it is empty or one of the
+ * stopping criteria is met */
+static void RunGreedyLoop(GraphHandle graph, AlgoStateHandle state, const AlgoParameters& params, double timelimit, bool logProgress)
+{
+    TRACE_SCOPE_CAT("RunGreedyLoop", "greedy");
+    Timer t;
+
+    // the move data is reused by the following moves, so that the buffers of the
+    // containers and of the shell grow to the size of the largest move and then
+    // stop being reallocated
+    std::vector<std::unique_ptr<SeamData>> sdvec;
+    sdvec.emplace_back(new SeamData);
+
+    // the move data of concurrent loops is accounted by difference
+    long long shellBytes = 0;
+    auto UpdateShellBytes = [&] () {
+        long long bytes = 0;
+        for (const auto& sd : sdvec)
+            bytes += EstimateSeamDataBytes(*sd);
+        MemoryAdd(MemorySubsystem::Shells, bytes - shellBytes);
+        shellBytes = bytes;
+    };
 
-    LOG_INFO << "Atlas energy before optimization is " << ARAP::ComputeEnergyFromStoredWedgeTC(graph->mesh, nullptr, nullptr);
+    std::unique_ptr<CheckpointWriter> checkpoint;
+    if (params.checkpointFile != "" && params.checkpointInterval > 0)
+        checkpoint.reset(new CheckpointWriter(params.checkpointFile));
+    Timer tcheckpoint;
+
+    // the partitioned loops run concurrently and do not report their progress
+    std::unique_ptr<ProgressReporter> progress;
+    if (logProgress && params.progressCallback)
+        progress.reset(new ProgressReporter(state, params, timelimit));
 
     int k = 0;
     while (state->queue.size() > 0) {
 
-        if (state->queue.size() > 2 * state->cost.size())
-            PurgeQueue(state);
-
-        if (state->queue.size() == 0) {
-            LOG_INFO << "Queue is empty, interrupting.";
-            break;
-        }
+        if (progress)
+            progress->Update(state, k);
 
-        if (params.timelimit > 0 && t.TimeElapsed() > params.timelimit) {
+        if (timelimit > 0 && t.TimeElapsed() > timelimit) {
             LOG_INFO << "Timelimit hit, interrupting.";
             break;
         }
@@ -422,128 +1132,721 @@ void GreedyOptimization(GraphHandle graph, AlgoStateHandle state, const AlgoPara
             break;
         }
 
+        // checkpoints are taken between moves, and skipped while the previous one
+        // is still being written
+        if (checkpoint && tcheckpoint.TimeElapsed() > params.checkpointInterval && checkpoint->Idle()) {
+            LOG_VERBOSE << "Writing checkpoint after " << k << " iterations";
+            checkpoint->Write(graph, state);
+            tcheckpoint.Reset();
+        }
+
+        if (params.mergeBatchSize > 1) {
+            // evaluate a batch of independent moves concurrently, and commit them in priority order
+            std::vector<WeightedSeam> batch;
+            if (ExtractIndependentMoves(batch, state, graph, params) == 0) {
+                LOG_INFO << "Queue is empty, interrupting.";
+                break;
+            }
+
+            while (sdvec.size() < batch.size())
+                sdvec.emplace_back(new SeamData);
+            std::vector<CheckStatus> statusvec(batch.size(), UNKNOWN);
+
+            #pragma omp parallel for schedule(dynamic, 1)
+            for (int i = 0; i < (int) batch.size(); ++i) {
+                sdvec[i]->Clear();
+                statusvec[i] = EvaluateMove(*sdvec[i], batch[i].first, graph, state, params);
+            }
+            UpdateShellBytes();
+
+            bool targetReached = false;
+            for (unsigned i = 0; i < batch.size(); ++i) {
+                const SeamData& sd = *sdvec[i];
+
+                // a move is committed only if its cluster was not touched by the moves committed before it
+                ChartPair p = GetCharts(sd.csh, graph);
+                bool valid = Valid(batch[i], state) && p.first == sd.a && p.second == sd.b;
+
+                if (targetReached || !valid) {
+                    UndoMove(sd, graph);
+                    if (Valid(batch[i], state))
+                        state->queue.push(batch[i]);
+                    continue;
+                }
+
+                // the atlas energy changed if any move was accepted before this one
+                CheckStatus status = statusvec[i];
+                if (status == PASS)
+                    status = CheckGlobalDistortion(sd, state, params);
+
+                ++k;
+                if (logProgress && (k % 200) == 0) {
+                    LOG_INFO << "Logging execution stats after " << k << " iterations";
+                    UpdateStateBytes(*state);
+                    LogExecutionStats(state->stats);
+                }
+
+                CommitMove(sd, status, state, graph, params);
+
+                if (params.UVBorderLengthReduction > (state->currentUVBorderLength / state->inputUVBorderLength))
+                    targetReached = true;
+            }
+            continue;
+        }
+
         WeightedSeam ws = state->queue.top();
         state->queue.pop();
         if (Valid(ws, state)) {
-            if (ws.second == Infinity()) {
+            if (ResolveEstimatedCost(ws, state, graph, params)) {
+                // the exact cost is ordered against the next candidate
+                continue;
+            } else if (ws.second == Infinity()) {
                 // sanity check
-                for (auto& entry : state->cost)
-                    ensure(entry.second == Infinity());
+                for (ClusterId cid = 0; cid < state->clusters.Slots(); ++cid)
+                    ensure(!state->clusters[cid].active || state->clusters[cid].cost == Infinity());
                 LOG_INFO << "Queue is empty, interrupting.";
                 break;
             } else {
                 ++k;
-                if ((k % 200) == 0) {
+                if (logProgress && (k % 200) == 0) {
                     LOG_INFO << "Logging execution stats after " << k << " iterations";
-                    LogExecutionStats();
+                    UpdateStateBytes(*state);
+                    LogExecutionStats(state->stats);
                 }
-                SeamData sd;
-                ComputeSeamData(sd, ws.first, graph, state);
-                LOG_DEBUG << "  Chart ids are " << sd.a->id << " " << sd.b->id << " (areas = " << sd.a->AreaUV() << ", " << sd.b->AreaUV() << ")";
+                SeamData& sd = *sdvec[0];
+                sd.Clear();
+                CheckStatus status = EvaluateMove(sd, ws.first, graph, state, params);
+                UpdateShellBytes();
+                CommitMove(sd, status, state, graph, params);
+            }
+        }
+    }
 
-                OffsetMap om = AlignAndMerge(ws.first, sd, state->transform[ws.first], params);
+    if (progress)
+        progress->Finish(state, k);
 
-                ComputeOptimizationArea(sd, graph->mesh, om);
+    // the last checkpoint allows to continue a run interrupted by the time limit
+    if (checkpoint) {
+        checkpoint->Write(graph, state);
+        if (checkpoint->Wait())
+            LOG_INFO << "Saved the final checkpoint to " << params.checkpointFile;
+    }
 
-                // when merging two charts, check if they collide outside the optimization area
+    MemoryAdd(MemorySubsystem::Shells, -shellBytes);
+}
 
-                CheckStatus status = (sd.a != sd.b) ? CheckBoundaryAfterAlignment(sd) : PASS;
+/* Merges the seams whose sides already coincide after the rigid matching (see
+ * AlgoParameters::coincidentSeamTolerance) before the greedy loop. Each round
+ * stitches the coincident clusters of pairwise disjoint charts concurrently,
+ * without the ARAP solve, and commits them in cost order. A stitch that fails the
+ * checks is undone without penalties, and its cluster is left to the greedy loop */
+static void MergeCoincidentSeams(GraphHandle graph, AlgoStateHandle state, const AlgoParameters& params)
+{
+    TRACE_SCOPE_CAT("MergeCoincidentSeams", "greedy");
+    Timer t;
 
-                if (status == PASS)
-                    status = OptimizeChart(sd, graph, false);
+    std::set<ClusteredSeamHandle> deferred;
+    std::vector<std::unique_ptr<SeamData>> sdvec;
+    int rounds = 0;
+    int merged = 0;
+    while (true) {
+        std::vector<std::pair<double, ClusterId>> candidates;
+        for (ClusterId cid = 0; cid < state->clusters.Slots(); ++cid) {
+            const ClusterRecord& r = state->clusters[cid];
+            if (r.active && deferred.count(r.csh) == 0 && IsCoincidentSeam(r, graph, params))
+                candidates.push_back(std::make_pair(r.cost, cid));
+        }
+        // the ids of the clusters depend on the order of their allocation, so
+        // equal costs are ordered by the seams
+        std::sort(candidates.begin(), candidates.end(), [&](const std::pair<double, ClusterId>& x, const std::pair<double, ClusterId>& y) {
+            if (x.first != y.first)
+                return x.first < y.first;
+            return ClusteredSeamOrder()(state->clusters[x.second].csh, state->clusters[y.second].csh);
+        });
+
+        std::vector<ClusteredSeamHandle> batch;
+        std::unordered_set<RegionID> locked;
+        for (const auto& entry : candidates) {
+            ClusteredSeamHandle csh = state->clusters[entry.second].csh;
+            ChartPair charts = GetCharts(csh, graph);
+            if (locked.count(charts.first->id) == 0 && locked.count(charts.second->id) == 0) {
+                locked.insert(charts.first->id);
+                locked.insert(charts.second->id);
+                batch.push_back(csh);
+            }
+        }
+        if (batch.empty())
+            break;
+        rounds++;
 
-                if (status == PASS)
-                    status = CheckAfterLocalOptimization(sd, state, params);
-
-                while (status == FAIL_GLOBAL_OVERLAP_AFTER_OPT || status == FAIL_GLOBAL_OVERLAP_AFTER_BND) {
-                    LOG_DEBUG << "Global overlaps detected after ARAP optimization, fixing edges";
-                    CheckStatus iterStatus = OptimizeChart(sd, graph, true);
-                    if (iterStatus == _END)
-                        break;
-                    else
-                        status = CheckAfterLocalOptimization(sd, state, params);
-                }
+        while (sdvec.size() < batch.size())
+            sdvec.emplace_back(new SeamData);
+        std::vector<CheckStatus> statusvec(batch.size(), UNKNOWN);
 
-                statsCheck[status]++;
-
-                if (status == PASS) {
-                    AcceptMove(sd, state, graph, params);
-                    ColorizeSeam(sd.csh, vcg::Color4b(255, 69, 0, 255));
-                    accept++;
-                    LOG_DEBUG << "Accepted operation";
-                } else {
-                    RejectMove(sd, state, graph, status);
-                    reject++;
-                    LOG_DEBUG << "Rejected operation";
-                }
+        #pragma omp parallel for schedule(dynamic, 1)
+        for (int i = 0; i < (int) batch.size(); ++i) {
+            sdvec[i]->Clear();
+            statusvec[i] = EvaluateStitch(*sdvec[i], batch[i], graph, state, params);
+        }
+
+        for (unsigned i = 0; i < batch.size(); ++i) {
+            const SeamData& sd = *sdvec[i];
+            // the atlas energy changed if any stitch was accepted before this one
+            CheckStatus status = statusvec[i];
+            if (status == PASS)
+                status = CheckGlobalDistortion(sd, state, params);
+            if (status == PASS) {
+                CommitMove(sd, PASS, state, graph, params);
+                state->stats.coincident_merged++;
+                merged++;
+            } else {
+                UndoMove(sd, graph);
+                deferred.insert(batch[i]);
+                state->stats.coincident_deferred++;
             }
         }
     }
 
+    LOG_INFO << "Merged " << merged << " coincident seams in " << rounds << " rounds (" << deferred.size()
+             << " left to the greedy loop) in " << t.TimeElapsed() << " seconds";
+}
+
+void GreedyOptimization(GraphHandle graph, AlgoStateHandle state, const AlgoParameters& params)
+{
+    TRACE_SCOPE_CAT("GreedyOptimization", "greedy");
+    ScopedThreadCount greedyThreads(params.greedyThreads);
+    state->stats.ClearCounters();
+
+    // the seam merges walk and edit the vertex fans
+    RequireVertexFace(graph->mesh);
+
+    Timer t;
+    Timer tglobal;
+
+    PrintStateInfo(state, graph, params);
+
+    LOG_INFO << "Atlas energy before optimization is " << state->arapNum / state->arapDenom;
+
+    if (params.coincidentSeamTolerance > 0)
+        MergeCoincidentSeams(graph, state, params);
+
+    double timelimit = params.timelimit;
+    bool partitioned = false;
+    if (params.partitions > 1 && graph->charts.size() > 1) {
+        OptimizePartitions(graph, state, params);
+        partitioned = true;
+        if (params.timelimit > 0)
+            timelimit = params.timelimit - t.TimeElapsed();
+    }
+
+    if (params.timelimit > 0 && timelimit <= 0)
+        LOG_INFO << "Timelimit hit, interrupting.";
+    else
+        RunGreedyLoop(graph, state, params, timelimit, true);
+
     PrintStateInfo(state, graph, params);
 
-    LogExecutionStats();
+    UpdateStateBytes(*state);
+    LogExecutionStats(state->stats);
+    ReportExecutionStats(state->stats);
 
     Mesh shell;
 
     LOG_INFO << "Atlas energy after optimization is " << ARAP::ComputeEnergyFromStoredWedgeTC(graph->mesh, nullptr, nullptr);
 
+    // the moves of the partitions are not recorded, they cannot be replayed on the whole atlas
+    if (params.moveLogFile != "") {
+        if (partitioned)
+            LOG_WARN << "The move log is not written when the optimization is partitioned";
+        else if (WriteMoveLog(params.moveLogFile, graph, state))
+            LOG_INFO << "Saved the log of " << state->acceptedMoves.size() << " accepted moves to " << params.moveLogFile;
+        else
+            LOG_WARN << "Unable to write the move log " << params.moveLogFile;
+    }
+
+    // the storage of the containers of the moves is no longer needed
+    ClearElementStoragePool();
+    ReleaseRasterOverlapResources();
+    ReleaseGPUARAPResources();
 }
 
 void Finalize(GraphHandle graph, const std::string& outname, int *vndup)
 {
-    std::unordered_set<Mesh::ConstVertexPointer> vset;
-    for (const MeshFace& f : graph->mesh.face)
-        for (int i = 0; i < 3; ++i)
-            vset.insert(f.cV(i));
+    TRACE_SCOPE_CAT("Finalize", "greedy");
+    Mesh& m = graph->mesh;
 
-    *vndup = (int) vset.size();
+    std::vector<uint64_t> referenced = ReferencedVertexBitmap(m);
+    int vn = 0;
+    #pragma omp parallel for reduction(+:vn)
+    for (int w = 0; w < (int) referenced.size(); ++w)
+        vn += (int) std::bitset<64>(referenced[w]).count();
+    *vndup = vn;
+
+    // The seams that were not merged still have duplicated vertices after the mesh
+    // is cut along them, so the vertices with the same position are welded. Welding
+    // redirects the faces to one vertex of each group, so the bitmap is rebuilt
+    // before the unreferenced vertices are removed
+    int duplicates = tri::Clean<Mesh>::RemoveDuplicateVertex(m);
+    if (duplicates > 0)
+        referenced = ReferencedVertexBitmap(m);
+
+    int unreferenced = 0;
+    #pragma omp parallel for reduction(+:unreferenced)
+    for (int vi = 0; vi < (int) m.vert.size(); ++vi) {
+        if (!m.vert[vi].IsD() && (referenced[vi / 64] & (uint64_t(1) << (vi % 64))) == 0) {
+            m.vert[vi].SetD();
+            unreferenced++;
+        }
+    }
+    m.vn -= unreferenced;
+    LOG_DEBUG << "Finalize removed " << duplicates << " duplicate and " << unreferenced << " unreferenced vertices";
+
+    CompactVertexVector(m);
+    InvalidateDerivedData(m, DERIVED_VERTEX_FACE | DERIVED_NORMALS);
+}
 
-    // The following two calls are probably not necessary as at this point the mesh has been cut along texture seams
-    // and there should not be any duplicate vertex. In any case, it is safer to leave them here.
-    tri::Clean<Mesh>::RemoveDuplicateVertex(graph->mesh);
-    tri::Clean<Mesh>::RemoveUnreferencedVertex(graph->mesh);
-    tri::UpdateTopology<Mesh>::VertexFace(graph->mesh);
+void SeamData::Clear()
+{
+    csh = nullptr;
+    a = nullptr;
+    b = nullptr;
+
+    undoVertexTex.clear();
+    undoWedgeTex.clear();
+    undoVertexRef.clear();
+
+    // the element containers are rebound by ComputeSeamData(), clearing them here
+    // only drops the entries
+    loggedVertices.clear();
+    loggedFaces.clear();
+    mrep.clear();
+    evec.clear();
+    vfmap.clear();
+    verticesWithinThreshold.clear();
+    optimizationArea.clear();
+    fixedVerticesFromIntersectingEdges.clear();
+
+    texcoordoptVert.clear();
+    texcoordoptWedge.clear();
+
+    inputNegativeArea = 0;
+    inputAbsoluteArea = 0;
+    inputUVBorderLength = 0;
+    inputCacheA = {};
+    inputCacheB = {};
+    seamBorderUV = 0;
+    seamBorder3D = 0;
+    inputOptSignedAreaUV = 0;
+    inputOptBorderUV = 0;
+    inputArapNum = 0;
+    inputArapDenom = 0;
+    outputArapNum = 0;
+    outputArapDenom = 0;
+    outputFaceArapNum.clear();
+
+    alignment = MatchingTransform::Identity();
+
+    prescreen = PRESCREEN_NONE;
+    std::fill(stageTime, stageTime + MOVE_STAGE_END, 0.0);
+    overlapFixes = 0;
+    si = ARAPSolveInfo();
+    arapCache.reset();
+    arap.reset();
+
+    // vcg only clears the element vectors of the mesh, so their capacity is kept
+    shell.Clear();
+    shell.ClearAttributes();
+
+    intersectionOpt.clear();
+    intersectionBoundary.clear();
+    intersectionInternal.clear();
 }
 
 // -- static functions ---------------------------------------------------------
 
-static void InsertNewClusterInQueue(ClusteredSeamHandle csh, AlgoStateHandle state, GraphHandle graph, const AlgoParameters& params)
+/* Pops from the queue up to batchSize valid moves that involve pairwise disjoint
+ * charts. Since charts do not share vertices after the mesh has been cut along
+ * the seams, these moves only touch disjoint portions of the mesh and can be
+ * evaluated independently. Moves that conflict with a selected one are
+ * reinserted in the queue. The estimated costs that reach the top are resolved
+ * and reordered before the moves are selected. Returns the number of selected
+ * moves, 0 if the queue only contains unfeasible moves (or is empty). */
+static int ExtractIndependentMoves(std::vector<WeightedSeam>& batch, AlgoStateHandle state, GraphHandle graph, const AlgoParameters& params)
 {
-    ColorizeSeam(csh, vcg::Color4b::White);
+    TRACE_SCOPE_CAT("ExtractIndependentMoves", "greedy");
+    batch.clear();
+
+    std::unordered_set<RegionID> locked;
+    std::vector<WeightedSeam> deferred;
+
+    // bound the number of conflicting moves scanned per batch
+    int batchSize = params.mergeBatchSize;
+    int maxDeferred = 4 * batchSize;
+
+    while (state->queue.size() > 0 && (int) batch.size() < batchSize && (int) deferred.size() < maxDeferred) {
+        WeightedSeam ws = state->queue.top();
+        if (!Valid(ws, state)) {
+            state->queue.pop();
+            continue;
+        }
+
+        if (ws.second == Infinity()) {
+            if (batch.empty()) {
+                // sanity check
+                for (ClusterId cid = 0; cid < state->clusters.Slots(); ++cid)
+                    ensure(!state->clusters[cid].active || state->clusters[cid].cost == Infinity());
+            }
+            break;
+        }
+
+        state->queue.pop();
+
+        if (ResolveEstimatedCost(ws, state, graph, params))
+            continue;
+
+        ChartPair charts = GetCharts(ws.first, graph);
+        if (locked.count(charts.first->id) > 0 || locked.count(charts.second->id) > 0) {
+            deferred.push_back(ws);
+        } else {
+            locked.insert(charts.first->id);
+            locked.insert(charts.second->id);
+            batch.push_back(ws);
+        }
+    }
+
+    for (const auto& ws : deferred)
+        state->queue.push(ws);
+
+    return (int) batch.size();
+}
+
+static CheckStatus EvaluateMove(SeamData& sd, ClusteredSeamHandle csh, GraphHandle graph, AlgoStateHandle state, const AlgoParameters& params)
+{
+    TRACE_SCOPE_CAT("EvaluateMove", "greedy");
+    Timer timer;
+    ComputeSeamData(sd, csh, graph, state);
+    sd.stageTime[MOVE_SEAM_DATA] = timer.TimeSinceLastCheck();
+    LOG_DEBUG << "  Chart ids are " << sd.a->id << " " << sd.b->id << " (areas = " << sd.a->AreaUV() << ", " << sd.b->AreaUV() << ")";
+
+    ClusterId cid = state->clusters.Find(csh);
+    ensure(cid != ClusterStore::NONE && state->clusters[cid].active);
+    OffsetMap om = AlignAndMerge(csh, sd, state, state->clusters[cid].transform, params);
+    sd.stageTime[MOVE_ALIGN_MERGE] = timer.TimeSinceLastCheck();
+
+    ComputeOptimizationArea(sd, state, graph->mesh, om);
+    sd.stageTime[MOVE_OPTIMIZATION_AREA] = timer.TimeSinceLastCheck();
+
+    // when merging two charts, check if they collide outside the optimization area
+
+    CheckStatus status = (sd.a != sd.b) ? CheckBoundaryAfterAlignment(sd, state) : PASS;
+    sd.stageTime[MOVE_CHECK_BEFORE] = timer.TimeSinceLastCheck();
+
+    if (status == PASS)
+        status = OptimizeChart(sd, graph, state, params, false);
+    sd.stageTime[MOVE_OPTIMIZE] = timer.TimeSinceLastCheck();
 
-    CostInfo ci = ComputeCost(csh, graph, params, GetPenalty(csh, state));
+    if (status == PASS)
+        status = CheckAfterLocalOptimization(sd, state, params);
+    sd.stageTime[MOVE_CHECK_AFTER] = timer.TimeSinceLastCheck();
+
+    while (status == FAIL_GLOBAL_OVERLAP_AFTER_OPT || status == FAIL_GLOBAL_OVERLAP_AFTER_BND) {
+        LOG_DEBUG << "Global overlaps detected after ARAP optimization, fixing edges";
+        sd.overlapFixes++;
+        CheckStatus iterStatus = OptimizeChart(sd, graph, state, params, true);
+        if (iterStatus == _END)
+            break;
+        else
+            status = CheckAfterLocalOptimization(sd, state, params);
+    }
+    sd.stageTime[MOVE_FIX_OVERLAPS] = timer.TimeSinceLastCheck();
+
+    return status;
+}
+
+/* Returns true if the cluster joins sides that coincide after the rigid matching,
+ * within AlgoParameters::coincidentSeamTolerance of the seam length. The residual
+ * is the one of the cost cache, the estimated clusters are never coincident */
+static bool IsCoincidentSeam(const ClusterRecord& r, GraphHandle graph, const AlgoParameters& params)
+{
+    if (r.estimated || r.cost == Infinity() || r.mvalue != CostInfo::FEASIBLE)
+        return false;
+
+    const ClusteredSeam::CostCache& cc = r.csh->costCache;
+    if (!cc.valid || !cc.hasMatching || cc.numPoints == 0)
+        return false;
+
+    ChartPair charts = GetCharts(r.csh, graph);
+    if (cc.a != charts.first->id || cc.b != charts.second->id
+            || cc.versionA != charts.first->version || cc.versionB != charts.second->version)
+        return false;
+
+    double avgErr = cc.totalError / (double) cc.numPoints;
+    return avgErr <= params.coincidentSeamTolerance * ((cc.boundaryA + cc.boundaryB) / 2.0);
+}
+
+/* Same as EvaluateMove(), but the merged vertices are only snapped to their
+ * average position and the ARAP solve is skipped (see StitchChart()). A failed
+ * check is not retried, the move is left to the greedy loop */
+static CheckStatus EvaluateStitch(SeamData& sd, ClusteredSeamHandle csh, GraphHandle graph, AlgoStateHandle state, const AlgoParameters& params)
+{
+    TRACE_SCOPE_CAT("EvaluateStitch", "greedy");
+    Timer timer;
+    ComputeSeamData(sd, csh, graph, state);
+    sd.stageTime[MOVE_SEAM_DATA] = timer.TimeSinceLastCheck();
+
+    ClusterId cid = state->clusters.Find(csh);
+    ensure(cid != ClusterStore::NONE && state->clusters[cid].active);
+    OffsetMap om = AlignAndMerge(csh, sd, state, state->clusters[cid].transform, params);
+    sd.stageTime[MOVE_ALIGN_MERGE] = timer.TimeSinceLastCheck();
+
+    ComputeOptimizationArea(sd, state, graph->mesh, om);
+    sd.stageTime[MOVE_OPTIMIZATION_AREA] = timer.TimeSinceLastCheck();
+
+    CheckStatus status = (sd.a != sd.b) ? CheckBoundaryAfterAlignment(sd, state) : PASS;
+    sd.stageTime[MOVE_CHECK_BEFORE] = timer.TimeSinceLastCheck();
+
+    if (status == PASS)
+        StitchChart(sd, graph, state);
+    sd.stageTime[MOVE_OPTIMIZE] = timer.TimeSinceLastCheck();
+
+    if (status == PASS)
+        status = CheckAfterLocalOptimization(sd, state, params);
+    sd.stageTime[MOVE_CHECK_AFTER] = timer.TimeSinceLastCheck();
+
+    return status;
+}
+
+static void CommitMove(const SeamData& sd, CheckStatus status, AlgoStateHandle state, GraphHandle graph, const AlgoParameters& params)
+{
+    TRACE_SCOPE_CAT("CommitMove", "greedy");
+    // the counters are also updated by the moves of a batch evaluated concurrently
+    #pragma omp atomic
+    state->stats.statsCheck[status]++;
+
+    bool distortionFailure = (status == FAIL_DISTORTION_LOCAL || status == FAIL_DISTORTION_GLOBAL);
+    switch (sd.prescreen) {
+    case SeamData::PRESCREEN_PASS:
+        #pragma omp atomic
+        state->stats.prescreen_pass++;
+        if (distortionFailure) {
+            #pragma omp atomic
+            state->stats.prescreen_missed++;
+        }
+        break;
+    case SeamData::PRESCREEN_FAIL_SOLVED:
+        #pragma omp atomic
+        state->stats.prescreen_audited++;
+        if (distortionFailure) {
+            #pragma omp atomic
+            state->stats.prescreen_audited_hits++;
+        }
+        break;
+    case SeamData::PRESCREEN_FAIL_SKIPPED:
+        #pragma omp atomic
+        state->stats.prescreen_skipped++;
+        break;
+    default:
+        break;
+    }
+
+    Timer timer;
+    if (status == PASS) {
+        if (params.moveLogFile != "")
+            RecordMove(sd, state, graph);
+        AcceptMove(sd, state, graph, params);
+        ColorizeSeam(sd.csh, vcg::Color4b(255, 69, 0, 255));
+        #pragma omp atomic
+        state->stats.accept++;
+        LOG_DEBUG << "Accepted operation";
+    } else {
+        RejectMove(sd, state, graph, status);
+        #pragma omp atomic
+        state->stats.reject++;
+        LOG_DEBUG << "Rejected operation";
+    }
+    double commitTime = timer.TimeElapsed();
+
+    #pragma omp critical (stats)
+    {
+        AlgoStats& stats = state->stats;
+        double moveTime = commitTime;
+        for (int i = 0; i < MOVE_COMMIT; ++i) {
+            stats.statusStageTime[status][i] += sd.stageTime[i];
+            moveTime += sd.stageTime[i];
+        }
+        stats.statusStageTime[status][MOVE_COMMIT] += commitTime;
+        stats.moveTime[status].Record(moveTime);
+        stats.overlapFixes[status] += sd.overlapFixes;
+    }
+}
+
+/* Computes the costs of the clusters and inserts them in the queue. The costs are
+ * computed concurrently since ComputeCost() only reads the graph, the penalties
+ * and the lazily computed chart caches are prepared beforehand. The state is then
+ * updated serially, in the order of the clusters */
+static void InsertNewClustersInQueue(const std::vector<ClusteredSeamHandle>& cshvec, AlgoStateHandle state, GraphHandle graph, const AlgoParameters& params)
+{
+    std::vector<double> penalty(cshvec.size());
+    for (unsigned i = 0; i < cshvec.size(); ++i) {
+        penalty[i] = GetPenalty(cshvec[i], state);
+        ChartPair p = GetCharts(cshvec[i], graph);
+        p.first->GetCache();
+        p.second->GetCache();
+    }
+
+    std::vector<CostInfo> civec(cshvec.size());
+
+    #pragma omp parallel for schedule(dynamic, 8) if (cshvec.size() > 8)
+    for (int i = 0; i < (int) cshvec.size(); ++i)
+        civec[i] = ComputeCost(cshvec[i], graph, params, penalty[i]);
+
+    for (unsigned i = 0; i < cshvec.size(); ++i)
+        InsertClusterInQueue(cshvec[i], civec[i], state, graph, params);
+}
+
+static void InsertClusterInQueue(ClusteredSeamHandle csh, CostInfo ci, AlgoStateHandle state, GraphHandle graph, const AlgoParameters& params)
+{
+    ColorizeSeam(csh, vcg::Color4b::White);
 
     if (params.reduce) {
+        // stops when the seam cannot be shortened, a single edge can still be unfeasible
+        double length = ComputeSeamLength3D(csh);
         while (ci.mvalue == CostInfo::UNFEASIBLE_MATCHING) {
-            ci = ReduceSeam(csh, state, graph, params);
+            ci = params.reduceBisection ? ReduceSeamBisection(csh, state, graph, params) : ReduceSeam(csh, state, graph, params);
+            double reduced = ComputeSeamLength3D(csh);
+            if (!(reduced < length))
+                break;
+            length = reduced;
         }
     }
 
     ColorizeSeam(csh, mvColor[ci.mvalue]);
 
-    feasibility[ci.mvalue]++;
+    #pragma omp atomic
+    state->stats.feasibility[ci.mvalue]++;
+
+    if (ci.mvalue != CostInfo::FEASIBLE) {
+        #pragma omp atomic
+        state->stats.rejectionStage[ci.stage]++;
+    }
 
     if (ci.cost != Infinity()) {
-        mincost = std::min(mincost, ci.cost);
-        maxcost = std::max(maxcost, ci.cost);
+        #pragma omp critical (stats)
+        {
+            state->stats.mincost = std::min(state->stats.mincost, ci.cost);
+            state->stats.maxcost = std::max(state->stats.maxcost, ci.cost);
+        }
     }
 
     state->queue.push(std::make_pair(csh, ci.cost));
-    state->cost[csh] = ci.cost;
-    state->transform[csh] = ci.matching;
-    state->status[csh] = UNKNOWN;
-    state->mvalue[csh] = ci.mvalue;
+    ClusterId cid = state->clusters.Acquire(csh);
+    ClusterRecord& r = state->clusters[cid];
+    r.active = true;
+    r.cost = ci.cost;
+    r.transform = ci.matching;
+    r.status = UNKNOWN;
+    r.mvalue = ci.mvalue;
+    r.estimated = false;
+
+    AddClusterMemberships(csh, cid, state, graph);
+}
+
+/* Inserts the clusters in the queue with the estimate of their cost, the exact
+ * cost is only computed if the cluster reaches the top of the queue. The
+ * clusters without an estimate are costed immediately */
+static void InsertEstimatedClustersInQueue(const std::vector<ClusteredSeamHandle>& cshvec, AlgoStateHandle state, GraphHandle graph, const AlgoParameters& params)
+{
+    std::vector<ClusteredSeamHandle> costed;
+    for (auto csh : cshvec) {
+        double penalty = GetPenalty(csh, state);
+        double estimate = EstimateCost(csh, graph, params, penalty);
+        if (estimate < 0) {
+            costed.push_back(csh);
+            continue;
+        }
+
+        ColorizeSeam(csh, vcg::Color4b::White);
+
+        state->queue.push(std::make_pair(csh, estimate));
+        ClusterId cid = state->clusters.Acquire(csh);
+        ClusterRecord& r = state->clusters[cid];
+        r.active = true;
+        r.cost = estimate;
+        r.transform = MatchingTransform::Identity();
+        r.status = UNKNOWN;
+        r.mvalue = CostInfo::FEASIBLE;
+        r.estimated = true;
+
+        AddClusterMemberships(csh, cid, state, graph);
+
+        state->stats.lazy_queued++;
+    }
+    InsertNewClustersInQueue(costed, state, graph, params);
+}
+
+/* If the popped entry is an estimate, computes the exact cost of the cluster and
+ * reinserts it in the queue. Returns true if the entry was an estimate */
+static bool ResolveEstimatedCost(const WeightedSeam& ws, AlgoStateHandle state, GraphHandle graph, const AlgoParameters& params)
+{
+    ClusterId cid = state->clusters.Find(ws.first);
+    if (!state->clusters[cid].estimated)
+        return false;
+
+    EraseSeam(ws.first, state, graph);
+    InsertNewClustersInQueue({ws.first}, state, graph, params);
+
+    state->stats.lazy_resolved++;
+    if (state->queue.size() > 0 && state->queue.top().first != ws.first)
+        state->stats.lazy_requeued++;
+
+    return true;
+}
+
+/* Returns the estimate of the cost of the cluster after its charts changed, or
+ * a negative value if there is no estimate. The matching error cannot be bounded
+ * without computing the matching, so the estimate scales the error of the
+ * previous matching by AlgoParameters::lazyCostFactor, while the border and area
+ * terms are those of the current charts. The boundary test is deferred to the
+ * exact cost */
+static double EstimateCost(const ClusteredSeamHandle& csh, GraphHandle graph, const AlgoParameters& params, double penalty)
+{
+    const ClusteredSeam::CostCache& cc = csh->costCache;
+    if (!cc.valid || !cc.hasMatching || cc.numPoints == 0 || cc.boundaryA == 0 || cc.boundaryB == 0)
+        return -1;
+
+    ChartPair charts = GetCharts(csh, graph);
+    ChartHandle a = charts.first;
+    ChartHandle b = charts.second;
+    if (a->AreaUV() == 0 || b->AreaUV() == 0 || a->Area3D() == 0 || b->Area3D() == 0)
+        return -1;
+
+    // the cached seam lengths are oriented as the charts of the previous evaluation
+    double boundaryA = cc.boundaryA;
+    double boundaryB = cc.boundaryB;
+    if (cc.a == b->id || cc.b == a->id)
+        std::swap(boundaryA, boundaryB);
+
+    double avgErr = params.lazyCostFactor * cc.totalError / (double) cc.numPoints;
+    double lossgain = avgErr * std::pow(std::min(a->BorderUV() / boundaryA, b->BorderUV() / boundaryB), params.expb);
+    double cost = lossgain * std::min(a->AreaUV(), b->AreaUV());
+
+    if (cost == 0 && penalty > 1.0)
+        cost = 1;
+
+    return cost * penalty;
+}
 
-    // initialize chart-to-seam map
+static void AddClusterMemberships(ClusteredSeamHandle csh, ClusterId cid, AlgoStateHandle state, GraphHandle graph)
+{
+    // add the cluster to its charts
     ChartPair p = GetCharts(csh, graph);
-    state->chartSeamMap[p.first->id].insert(csh);
-    state->chartSeamMap[p.second->id].insert(csh);
+    state->clusters.InsertChartCluster(p.first->id, cid);
+    state->clusters.InsertChartCluster(p.second->id, cid);
 
-    // add cluster to endpoint map
+    // add the cluster to its endpoints
     std::set<int> endpoints = GetEndpoints(csh);
     for (auto vi : endpoints)
-        state->emap[vi].insert(csh);
+        state->clusters.InsertEndpointCluster(vi, cid);
 }
 
 // this function returns true if there exists a sequence of at most maxSteps operations
@@ -592,7 +1895,7 @@ static bool IslandLookahead(ChartHandle a, ChartHandle b, int maxSteps)
     return false;
 }
 
-static CostInfo ComputeCost(ClusteredSeamHandle csh, GraphHandle graph, const AlgoParameters& params, double penalty)
+static CostInfo ComputeCost(const ClusteredSeamHandle& csh, GraphHandle graph, const AlgoParameters& params, double penalty)
 {
     bool swapped;
     ChartPair charts = GetCharts(csh, graph, &swapped);
@@ -600,57 +1903,90 @@ static CostInfo ComputeCost(ClusteredSeamHandle csh, GraphHandle graph, const Al
     ChartHandle a = charts.first;
     ChartHandle b = charts.second;
     if (a->AreaUV() == 0 || b->AreaUV() == 0 || a->Area3D() == 0 || b->Area3D() == 0) {
-        return { Infinity(), {}, CostInfo::ZERO_AREA };
-    }
-
-    std::vector<vcg::Point2d> bpa;
-    std::vector<vcg::Point2d> bpb;
-
-    ExtractUVCoordinates(csh, bpa, bpb, {a->id});
-
-    MatchingTransform mi = MatchingTransform::Identity();
-    // if seam is disconnecting compute the actual matching
-    if (a != b)
-        mi = ComputeMatchingRigidMatrix(bpa, bpb);
-
-    std::map<RegionID, double> bmap;
-    double seamLength3D = 0;
-
-    int ne = 0;
-    SeamMesh& seamMesh = csh->sm;
-    for (SeamHandle sh : csh->seams) {
-        for (int iedge : sh->edges) {
-            SeamEdge& edge = seamMesh.edge[iedge];
-            bmap[edge.fa->id] += (edge.fa->V0(edge.ea)->T().P() - edge.fa->V1(edge.ea)->T().P()).Norm();
-            bmap[edge.fb->id] += (edge.fb->V0(edge.eb)->T().P() - edge.fb->V1(edge.eb)->T().P()).Norm();
-            seamLength3D += (edge.fa->P0(edge.ea) - edge.fa->P1(edge.ea)).Norm();
-            ne++;
+        return { Infinity(), {}, CostInfo::ZERO_AREA, CostInfo::STAGE_AREA };
+    }
+
+    // the uv quantities of the seam only change if the seams or the two charts
+    // change, which is not the case when a cluster is re-costed after a penalty update
+    ClusteredSeam::CostCache& cc = csh->costCache;
+    if (!(cc.valid && cc.a == a->id && cc.b == b->id && cc.versionA == a->version && cc.versionB == b->version)) {
+        double boundaryA = 0;
+        double boundaryB = 0;
+        SeamMesh& seamMesh = csh->sm;
+        for (const SeamHandle& sh : csh->seams) {
+            for (int iedge : sh->edges) {
+                SeamEdge& edge = seamMesh.edge[iedge];
+                double la = (edge.fa->V0(edge.ea)->T().P() - edge.fa->V1(edge.ea)->T().P()).Norm();
+                double lb = (edge.fb->V0(edge.eb)->T().P() - edge.fb->V1(edge.eb)->T().P()).Norm();
+                boundaryA += (edge.fa->id == a->id ? la : 0) + (edge.fb->id == a->id ? lb : 0);
+                boundaryB += (edge.fa->id == b->id ? la : 0) + (edge.fb->id == b->id ? lb : 0);
+            }
         }
+
+        cc.valid = true;
+        cc.hasMatching = false;
+        cc.a = a->id;
+        cc.b = b->id;
+        cc.versionA = a->version;
+        cc.versionB = b->version;
+        cc.boundaryA = boundaryA;
+        cc.boundaryB = boundaryB;
     }
 
     CostInfo ci;
-    ci.matching = mi;
+    ci.matching = MatchingTransform::Identity();
     ci.mvalue = CostInfo::FEASIBLE;
 
+    // the boundary test only needs the seam lengths and the chart borders, the
+    // island lookahead is only visited if the test fails
     if (a != b) {
-        double maxSeamToBoundaryRatio = std::max(bmap[a->id] / a->BorderUV(), bmap[b->id] / b->BorderUV());
-        if (maxSeamToBoundaryRatio < params.boundaryTolerance && (!params.visitComponents || !IslandLookahead(a, b, 5))) {
-            ci.cost = Infinity();
-            ci.mvalue = CostInfo::UNFEASIBLE_BOUNDARY;
-            return ci;
+        double maxSeamToBoundaryRatio = std::max(cc.boundaryA / a->BorderUV(), cc.boundaryB / b->BorderUV());
+        if (maxSeamToBoundaryRatio < params.boundaryTolerance) {
+            ci.stage = CostInfo::STAGE_BOUNDARY;
+            if (params.visitComponents) {
+                ci.stage = CostInfo::STAGE_LOOKAHEAD;
+                if (IslandLookahead(a, b, 5))
+                    ci.stage = CostInfo::STAGE_MATCHING;
+            }
+            if (ci.stage != CostInfo::STAGE_MATCHING) {
+                ci.cost = Infinity();
+                ci.mvalue = CostInfo::UNFEASIBLE_BOUNDARY;
+                return ci;
+            }
         }
     }
 
-    double totErr = MatchingErrorTotal(mi, bpa, bpb);
-    double avgErr = totErr / (double) bpa.size();
+    ci.stage = CostInfo::STAGE_MATCHING;
 
-    if (avgErr > params.matchingThreshold * ((bmap[a->id] + bmap[b->id]) / 2.0)) {
+    if (!cc.hasMatching) {
+        // the point buffers are reused across evaluations (costs are computed concurrently)
+        static thread_local MatchingPointSet bp;
+        bp.clear();
+
+        ExtractUVCoordinates(csh, bp, {a->id});
+
+        MatchingTransform mi = MatchingTransform::Identity();
+        // if seam is disconnecting compute the actual matching
+        if (a != b)
+            mi = ComputeMatchingRigidMatrix(bp);
+
+        cc.hasMatching = true;
+        cc.matching = mi;
+        cc.totalError = MatchingErrorTotal(mi, bp);
+        cc.numPoints = (int) bp.size();
+    }
+
+    ci.matching = cc.matching;
+
+    double avgErr = cc.totalError / (double) cc.numPoints;
+
+    if (avgErr > params.matchingThreshold * ((cc.boundaryA + cc.boundaryB) / 2.0)) {
         ci.cost = Infinity();
         ci.mvalue = CostInfo::UNFEASIBLE_MATCHING;
         return ci;
     }
 
-    double lossgain = avgErr * std::pow(std::min(a->BorderUV() / bmap[a->id], b->BorderUV() / bmap[b->id]), params.expb);
+    double lossgain = avgErr * std::pow(std::min(a->BorderUV() / cc.boundaryA, b->BorderUV() / cc.boundaryB), params.expb);
     double sizebonus = std::min(a->AreaUV(), b->AreaUV());
 
     ci.cost = lossgain * sizebonus;
@@ -663,36 +1999,22 @@ static CostInfo ComputeCost(ClusteredSeamHandle csh, GraphHandle graph, const Al
     return ci;
 }
 
-static inline double GetPenalty(ClusteredSeamHandle csh, AlgoStateHandle state)
+static inline double GetPenalty(const ClusteredSeamHandle& csh, AlgoStateHandle state)
 {
-    if (state->penalty.find(csh) == state->penalty.end())
-        state->penalty[csh] = 1.0;
-    return state->penalty[csh];
+    ClusterId cid = state->clusters.Find(csh);
+    return (cid != ClusterStore::NONE) ? state->clusters[cid].penalty : 1.0;
 }
 
 static inline bool Valid(const WeightedSeam& ws, ConstAlgoStateHandle state)
 {
-    auto it = state->cost.find(ws.first);
-    return (it != state->cost.end() && it->second == ws.second);
-}
-
-static inline void PurgeQueue(AlgoStateHandle state)
-{
-    if (state->queue.empty()) return;
-    LOG_INFO << "Purging queue of size " << state->queue.size() << " (cost map size is " << state->cost.size() << ")";
-    decltype(state->queue) newQueue;
-    for (const auto& costEntry : state->cost) {
-        if (costEntry.second != Infinity()) {
-            newQueue.push(std::make_pair(costEntry.first, costEntry.second));
-        }
-    }
-    state->queue.swap(newQueue);
-    LOG_INFO << "Queue purged, new size is " << state->queue.size();
+    ClusterId cid = state->clusters.Find(ws.first);
+    return (cid != ClusterStore::NONE && state->clusters[cid].active && state->clusters[cid].cost == ws.second);
 }
 
 static void ComputeSeamData(SeamData& sd, ClusteredSeamHandle csh, GraphHandle graph, AlgoStateHandle state)
 {
-    PERF_TIMER_START;
+    TRACE_SCOPE_CAT("ComputeSeamData", "greedy");
+    PERF_TIMER_START(state->stats);
 
     sd.csh = csh;
 
@@ -700,71 +2022,96 @@ static void ComputeSeamData(SeamData& sd, ClusteredSeamHandle csh, GraphHandle g
     sd.a = charts.first;
     sd.b = charts.second;
 
-    if (state->failed[sd.a->id].count(sd.b->id) > 0)
-        num_retry++;
+    auto failedIt = state->failed.find(sd.a->id);
+    if (failedIt != state->failed.end() && failedIt->second.count(sd.b->id) > 0) {
+        #pragma omp atomic
+        state->stats.num_retry++;
+    }
 
     Mesh& m = graph->mesh;
 
-    sd.texcoorda.reserve(3 * sd.a->FN());
-    sd.vertexinda.reserve(3 * sd.a->FN());
-    for (auto fptr : sd.a->fpVec) {
-        sd.texcoorda.push_back(fptr->V(0)->T().P());
-        sd.texcoorda.push_back(fptr->V(1)->T().P());
-        sd.texcoorda.push_back(fptr->V(2)->T().P());
-        sd.vertexinda.push_back(tri::Index(m, fptr->V(0)));
-        sd.vertexinda.push_back(tri::Index(m, fptr->V(1)));
-        sd.vertexinda.push_back(tri::Index(m, fptr->V(2)));
-    }
-
-    if (sd.a != sd.b) {
-        sd.texcoordb.reserve(3 * sd.b->FN());
-        sd.vertexindb.reserve(3 * sd.b->FN());
-        for (auto fptr : sd.b->fpVec) {
-            sd.texcoordb.push_back(fptr->V(0)->T().P());
-            sd.texcoordb.push_back(fptr->V(1)->T().P());
-            sd.texcoordb.push_back(fptr->V(2)->T().P());
-            sd.vertexindb.push_back(tri::Index(m, fptr->V(0)));
-            sd.vertexindb.push_back(tri::Index(m, fptr->V(1)));
-            sd.vertexindb.push_back(tri::Index(m, fptr->V(2)));
-        }
-    }
+    sd.loggedVertices.Bind(m.vert);
+    sd.loggedFaces.Bind(m.face);
+    sd.mrep.Bind(m.vert);
+    sd.evec.Bind(csh->sm.vert);
+    sd.vfmap.Bind(m.vert);
+    sd.verticesWithinThreshold.Bind(m.vert);
+    sd.optimizationArea.Bind(m.face);
+    sd.fixedVerticesFromIntersectingEdges.Bind(m.vert);
 
     sd.inputUVBorderLength = sd.a->BorderUV();
     if (sd.a != sd.b)
         sd.inputUVBorderLength += sd.b->BorderUV();
 
+    // store the caches and the border contribution of the seam edges, so that the
+    // cache of the merged chart can be updated incrementally
+    sd.inputCacheA = sd.a->GetCache();
+    sd.inputCacheB = sd.b->GetCache();
+
+    // the border lists must be computed before the seam is merged
+    sd.a->GetBorder();
+    sd.b->GetBorder();
+    sd.seamBorderUV = 0;
+    sd.seamBorder3D = 0;
+    for (const SeamHandle& sh : csh->seams) {
+        for (int iedge : sh->edges) {
+            const SeamEdge& edge = csh->sm.edge[iedge];
+            sd.seamBorderUV += EdgeLengthUV(*edge.fa, edge.ea) + EdgeLengthUV(*edge.fb, edge.eb);
+            sd.seamBorder3D += EdgeLength(*edge.fa, edge.ea) + EdgeLength(*edge.fb, edge.eb);
+        }
+    }
+
     PERF_TIMER_ACCUMULATE(t_seamdata);
 }
 
-static void WedgeTexFromVertexTex(ChartHandle c)
+/* Records the vertex tex coord in the undo log, if it was not already recorded.
+ * Returns true if the vertex was recorded by this call */
+static inline bool LogVertexTex(SeamData& sd, Mesh::VertexPointer vp)
+{
+    if (!sd.loggedVertices.insert(vp))
+        return false;
+    sd.undoVertexTex.push_back({vp, vp->T().P()});
+    return true;
+}
+
+/* Records the wedge tex coords in the undo log, if they were not already recorded */
+static inline void LogWedgeTex(SeamData& sd, Mesh::FacePointer fp)
 {
-    for (auto fptr : c->fpVec)
+    if (sd.loggedFaces.insert(fp))
+        sd.undoWedgeTex.push_back({fp, { fp->WT(0).P(), fp->WT(1).P(), fp->WT(2).P() }});
+}
+
+static void WedgeTexFromVertexTex(SeamData& sd, const std::vector<Mesh::FacePointer>& fpVec)
+{
+    for (auto fptr : fpVec) {
+        LogWedgeTex(sd, fptr);
         for (int i = 0; i < 3; ++i)
             fptr->WT(i).P() = fptr->V(i)->T().P();
+    }
 }
 
-static OffsetMap AlignAndMerge(ClusteredSeamHandle csh, SeamData& sd, const MatchingTransform& mi, const AlgoParameters& params)
+static OffsetMap AlignAndMerge(const ClusteredSeamHandle& csh, SeamData& sd, ConstAlgoStateHandle state, const MatchingTransform& mi, const AlgoParameters& params)
 {
-    PERF_TIMER_START;
+    TRACE_SCOPE_CAT("AlignAndMerge", "greedy");
+    PERF_TIMER_START(state->stats);
 
-    OffsetMap om;
+    OffsetMap om(sd.a->mesh.vert);
 
     // align
+    sd.alignment = mi;
     if (sd.a != sd.b) {
-        std::unordered_set<Mesh::VertexPointer> visited;
+        // nothing is logged yet, so each vertex of b is logged (and moved) once
         for (auto fptr : sd.b->fpVec) {
             for (int i = 0; i < 3; ++i) {
-                if (visited.count(fptr->V(i)) == 0) {
-                    visited.insert(fptr->V(i));
+                if (LogVertexTex(sd, fptr->V(i)))
                     fptr->V(i)->T().P() = mi.Apply(fptr->V(i)->T().P());
-                }
             }
         }
     }
 
     // elect representative vertices for the merge (only 1 vert must be referenced after the merge)
     SeamMesh& seamMesh = csh->sm;
-    for (SeamHandle sh : csh->seams) {
+    for (const SeamHandle& sh : csh->seams) {
         for (int iedge : sh->edges) {
             SeamEdge& edge = seamMesh.edge[iedge];
 
@@ -803,15 +2150,21 @@ static OffsetMap AlignAndMerge(ClusteredSeamHandle csh, SeamData& sd, const Matc
 
     // update vertex references
     for (auto fptr : sd.a->fpVec) {
-        for (int i = 0; i < 3; ++i)
-            if (sd.mrep.count(fptr->V(i)))
+        for (int i = 0; i < 3; ++i) {
+            if (sd.mrep.count(fptr->V(i))) {
+                sd.undoVertexRef.push_back({fptr, i, fptr->V(i)});
                 fptr->V(i) = sd.mrep[fptr->V(i)];
+            }
+        }
     }
     if (sd.a != sd.b) {
         for (auto fptr : sd.b->fpVec) {
-            for (int i = 0; i < 3; ++i)
-                if (sd.mrep.count(fptr->V(i)))
+            for (int i = 0; i < 3; ++i) {
+                if (sd.mrep.count(fptr->V(i))) {
+                    sd.undoVertexRef.push_back({fptr, i, fptr->V(i)});
                     fptr->V(i) = sd.mrep[fptr->V(i)];
+                }
+            }
         }
     }
 
@@ -819,7 +2172,7 @@ static OffsetMap AlignAndMerge(ClusteredSeamHandle csh, SeamData& sd, const Matc
     // merge the VF lists
 
     // face-face
-    for (SeamHandle sh : csh->seams) {
+    for (const SeamHandle& sh : csh->seams) {
         for (int iedge : sh->edges) {
             SeamEdge& edge = seamMesh.edge[iedge];
             edge.fa->FFp(edge.ea) = edge.fb;
@@ -859,6 +2212,7 @@ static OffsetMap AlignAndMerge(ClusteredSeamHandle csh, SeamData& sd, const Matc
             maxOffset = std::max(maxOffset, params.offsetFactor * (vp->T().P() - avg).Norm());
 
         om[entry.second.front()] = maxOffset;
+        LogVertexTex(sd, entry.second.front());
         entry.second.front()->T().P() = avg;
     }
 
@@ -866,27 +2220,35 @@ static OffsetMap AlignAndMerge(ClusteredSeamHandle csh, SeamData& sd, const Matc
     return om;
 }
 
-static void ComputeOptimizationArea(SeamData& sd, Mesh& mesh, OffsetMap& om)
+static void ComputeOptimizationArea(SeamData& sd, ConstAlgoStateHandle state, Mesh& mesh, OffsetMap& om)
 {
-    PERF_TIMER_START;
+    TRACE_SCOPE_CAT("ComputeOptimizationArea", "greedy");
+    PERF_TIMER_START(state->stats);
 
     std::vector<Mesh::FacePointer> fpvec;
     fpvec.insert(fpvec.end(), sd.a->fpVec.begin(), sd.a->fpVec.end());
     if (sd.a != sd.b)
         fpvec.insert(fpvec.end(), sd.b->fpVec.begin(), sd.b->fpVec.end());
 
-    sd.verticesWithinThreshold = ComputeVerticesWithinOffsetThreshold(mesh, om, sd);
+    ComputeVerticesWithinOffsetThreshold(mesh, om, sd, sd.verticesWithinThreshold);
     sd.optimizationArea.clear();
 
     for (auto fptr : fpvec) {
         for (int i = 0; i < 3; ++i) {
-            if (sd.verticesWithinThreshold.find(fptr->V(i)) != sd.verticesWithinThreshold.end()) {
+            if (sd.verticesWithinThreshold.count(fptr->V(i))) {
                 sd.optimizationArea.insert(fptr);
                 break;
             }
         }
     }
 
+    // from now on the move only changes the tex coords of the optimization area
+    for (auto fptr : sd.optimizationArea) {
+        LogWedgeTex(sd, fptr);
+        for (int i = 0; i < 3; ++i)
+            LogVertexTex(sd, fptr->V(i));
+    }
+
     for (auto fptr : sd.optimizationArea) {
         sd.texcoordoptVert.push_back(fptr->V(0)->T().P());
         sd.texcoordoptVert.push_back(fptr->V(1)->T().P());
@@ -899,8 +2261,13 @@ static void ComputeOptimizationArea(SeamData& sd, Mesh& mesh, OffsetMap& om)
     }
 
     {
+        // the wedge tex coords are not yet updated, and the alignment of b is
+        // rigid, so these are the contributions of the optimization area to the
+        // chart caches before the move
         sd.inputNegativeArea = 0;
         sd.inputAbsoluteArea = 0;
+        sd.inputOptSignedAreaUV = 0;
+        sd.inputOptBorderUV = 0;
         for (auto fptr : sd.optimizationArea) {
             vcg::Point2d uv0in = fptr->WT(0).P();
             vcg::Point2d uv1in = fptr->WT(1).P();
@@ -910,6 +2277,11 @@ static void ComputeOptimizationArea(SeamData& sd, Mesh& mesh, OffsetMap& om)
             if (inputAreaUV < 0)
                 sd.inputNegativeArea += inputAreaUV;
             sd.inputAbsoluteArea += std::abs(inputAreaUV);
+            sd.inputOptSignedAreaUV += inputAreaUV;
+
+            for (int i = 0; i < 3; ++i)
+                if (face::IsBorder(*fptr, i))
+                    sd.inputOptBorderUV += EdgeLengthUV(*fptr, i);
         }
     }
 
@@ -917,64 +2289,67 @@ static void ComputeOptimizationArea(SeamData& sd, Mesh& mesh, OffsetMap& om)
 }
 
 /* Visit vertices starting from the merged ones, subject to the distance budget
- * stored in the OffsetMap object. */
-static std::unordered_set<Mesh::VertexPointer> ComputeVerticesWithinOffsetThreshold(Mesh& m, const OffsetMap& om, const SeamData& sd)
+ * stored in the OffsetMap object. The visited vertices are stored in vset. */
+static void ComputeVerticesWithinOffsetThreshold(Mesh& m, const OffsetMap& om, const SeamData& sd, ElementSet<MeshVertex>& vset)
 {
-    // typedef for heap nodes
+    // bucket queue nodes
     typedef std::pair<Mesh::VertexPointer, double> VertexNode;
 
-    // comparison operator for the max-heap
-    auto cmp = [] (const VertexNode& v1, const VertexNode& v2) { return v1.second < v2.second; };
-
-    std::unordered_set<Mesh::VertexPointer> vset;
+    vset.clear();
 
     // distance budget map
-    OffsetMap dist;
-    // heap
-    std::vector<VertexNode> h;
+    OffsetMap dist(m.vert);
+
+    // the vertices are visited from the largest budget down, using a bucket queue
+    // over the quantized budgets. A vertex is visited again if its budget grows
+    // after it was visited (stale nodes are skipped), so the order of the visits
+    // within a bucket does not change the result
+    double maxBudget = 0;
+    for (const auto& entry : om)
+        maxBudget = std::max(maxBudget, entry.second);
+    const double scale = (maxBudget > 0) ? (OFFSET_BUCKETS - 1) / maxBudget : 0;
+    auto Bucket = [scale] (double d) { return std::min(OFFSET_BUCKETS - 1, int(d * scale)); };
+
+    std::vector<std::vector<VertexNode>> buckets(OFFSET_BUCKETS);
 
     for (const auto& entry : om) {
-        h.push_back(std::make_pair(entry.first, entry.second));
+        buckets[Bucket(entry.second)].push_back(std::make_pair(entry.first, entry.second));
         dist[entry.first] = entry.second;
     }
 
-    std::make_heap(h.begin(), h.end());
+    for (int b = OFFSET_BUCKETS - 1; b >= 0; --b) {
+        while (!buckets[b].empty()) {
+            VertexNode node = buckets[b].back();
+            buckets[b].pop_back();
+            if (node.second != dist[node.first])
+                continue;
 
-    while (!h.empty()) {
-        std::pop_heap(h.begin(), h.end(), cmp);
-        VertexNode node = h.back();
-        h.pop_back();
-        if (node.second == dist[node.first]) {
-            std::vector<Mesh::FacePointer> faces;
-            std::vector<int> indices;
-            face::VFStarVF(node.first, faces, indices);
-            for (unsigned i = 0; i < faces.size(); ++i) {
-                if(faces[i]->id != sd.a->id && faces[i]->id != sd.b->id){
-                    LOG_ERR << "issue at face " << tri::Index(m, faces[i]);
+            // walk the fan without collecting it
+            for (face::VFIterator<MeshFace> vfi(node.first); !vfi.End(); ++vfi) {
+                Mesh::FacePointer fp = vfi.F();
+                int z = vfi.I();
+                if(fp->id != sd.a->id && fp->id != sd.b->id){
+                    LOG_ERR << "issue at face " << tri::Index(m, fp);
                 }
-                ensure(faces[i]->id == sd.a->id || faces[i]->id == sd.b->id);
+                ensure(fp->id == sd.a->id || fp->id == sd.b->id);
 
                 // if either neighboring vertex is seen with more spare distance,
                 // update the distance map
 
-                int e1 = indices[i];
-                Mesh::VertexPointer v1 = faces[i]->V1(indices[i]);
-                double d1 = dist[node.first] - EdgeLengthUV(*faces[i], e1);
+                Mesh::VertexPointer v1 = fp->V1(z);
+                double d1 = node.second - EdgeLengthUV(*fp, z);
 
-                if (d1 >= 0 && (dist.find(v1) == dist.end() || dist[v1] < d1)) {
+                if (d1 >= 0 && (!dist.count(v1) || dist[v1] < d1)) {
                     dist[v1] = d1;
-                    h.push_back(std::make_pair(v1, d1));
-                    std::push_heap(h.begin(), h.end(), cmp);
+                    buckets[Bucket(d1)].push_back(std::make_pair(v1, d1));
                 }
 
-                int e2 = (indices[i]+2)%3;
-                Mesh::VertexPointer v2 = faces[i]->V2(indices[i]);
-                double d2 = dist[node.first] - EdgeLengthUV(*faces[i], e2);
+                Mesh::VertexPointer v2 = fp->V2(z);
+                double d2 = node.second - EdgeLengthUV(*fp, (z+2)%3);
 
-               if (d2 >= 0 && (dist.find(v2) == dist.end() || dist[v2] < d2)) {
+                if (d2 >= 0 && (!dist.count(v2) || dist[v2] < d2)) {
                     dist[v2] = d2;
-                    h.push_back(std::make_pair(v2, d2));
-                    std::push_heap(h.begin(), h.end(), cmp);
+                    buckets[Bucket(d2)].push_back(std::make_pair(v2, d2));
                 }
             }
         }
@@ -984,8 +2359,6 @@ static std::unordered_set<Mesh::VertexPointer> ComputeVerticesWithinOffsetThresh
         vset.insert(entry.first);
 
     LOG_DEBUG << "vset.size() == " << vset.size();
-
-    return vset;
 }
 
 static std::vector<HalfEdge> ExtractHalfEdges(const std::vector<ChartHandle>& charts, const vcg::Box2d& box, bool internalOnly)
@@ -999,28 +2372,99 @@ static std::vector<HalfEdge> ExtractHalfEdges(const std::vector<ChartHandle>& ch
     return hvec;
 }
 
-static CheckStatus CheckBoundaryAfterAlignmentInner(SeamData& sd)
+static std::vector<Mesh::FacePointer> QueryFixedFaces(const SeamData& sd, ConstAlgoStateHandle state, ChartHandle c, const vcg::Box2d& box)
+{
+    ensure(c == sd.a || c == sd.b);
+
+    std::vector<Mesh::FacePointer> faces;
+    if (box.IsNull())
+        return faces;
+
+    // the index stores the committed texture coordinates, the faces of b have
+    // been moved by the alignment so the query box is mapped back
+    vcg::Box2d qbox = box;
+    if (sd.a != sd.b && c == sd.b) {
+        MatchingTransform inv = sd.alignment.Inverse();
+        qbox.SetNull();
+        qbox.Add(inv.Apply(box.min));
+        qbox.Add(inv.Apply(box.max));
+        qbox.Add(inv.Apply(vcg::Point2d(box.min.X(), box.max.Y())));
+        qbox.Add(inv.Apply(vcg::Point2d(box.max.X(), box.min.Y())));
+    }
+    // inflate the box to account for the round-off of the transform, the
+    // candidates are tested against the exact box by the caller anyway
+    qbox.Offset(1e-6 * qbox.Diag() + 1e-12);
+
+    state->uvIndex.Query(qbox, faces);
+    faces.erase(std::remove_if(faces.begin(), faces.end(), [&] (Mesh::FacePointer fptr) {
+        return fptr->id != c->id || sd.optimizationArea.count(fptr);
+    }), faces.end());
+
+    return faces;
+}
+
+/* Same as ExtractHalfEdges() restricted to the charts of the move, but the faces
+ * outside the optimization area are retrieved from the spatial index */
+static std::vector<HalfEdge> ExtractHalfEdges(const SeamData& sd, ConstAlgoStateHandle state, const std::vector<ChartHandle>& charts, const vcg::Box2d& box, bool internalOnly)
+{
+    std::set<ChartHandle> chartSet(charts.begin(), charts.end());
+
+    std::vector<Mesh::FacePointer> faces;
+    for (auto ch : chartSet) {
+        std::vector<Mesh::FacePointer> fixed = QueryFixedFaces(sd, state, ch, box);
+        faces.insert(faces.end(), fixed.begin(), fixed.end());
+    }
+    for (auto fptr : sd.optimizationArea)
+        if ((chartSet.count(sd.a) && fptr->id == sd.a->id) || (chartSet.count(sd.b) && fptr->id == sd.b->id))
+            faces.push_back(fptr);
+
+    // keep the half-edges in a deterministic order
+    std::sort(faces.begin(), faces.end());
+
+    std::vector<HalfEdge> hvec;
+    for (auto fptr : faces)
+        for (int i = 0; i < 3; ++i)
+            if ((!internalOnly || !face::IsBorder(*fptr, i)) && SegmentBoxIntersection(Segment(fptr->V0(i)->T().P(), fptr->V1(i)->T().P()), box))
+                hvec.push_back(HalfEdge{fptr, i});
+    return hvec;
+}
+
+static CheckStatus CheckBoundaryAfterAlignmentInner(SeamData& sd, ConstAlgoStateHandle state)
 {
     ensure(sd.a != sd.b);
 
     // check if the borders of the fixed areas of a and b intersect each other
+    // b is the smaller chart, so its border is collected from the border list
+    // and from the faces around the optimization area, while the border of a is
+    // only extracted around the border of b
+    std::vector<HalfEdge> bVec;
+    vcg::Box2d bBox;
+    auto AddB = [&] (const HalfEdge& he) {
+        bVec.push_back(he);
+        bBox.Add(he.P0());
+        bBox.Add(he.P1());
+    };
+
+    // the listed half-edges of the seam are no longer on the border
+    for (const HalfEdge& he : sd.b->GetBorder())
+        if (!sd.optimizationArea.count(he.fp) && face::IsBorder(*he.fp, he.e))
+            AddB(he);
+
+    // the fixed half-edges of b that face the optimization area
+    for (auto fptr : sd.optimizationArea)
+        for (int i = 0; i < 3; ++i)
+            if (!face::IsBorder(*fptr, i) && fptr->FFp(i)->id == sd.b->id && !sd.optimizationArea.count(fptr->FFp(i)))
+                AddB(HalfEdge{fptr->FFp(i), fptr->FFi(i)});
+
     std::vector<HalfEdge> aVec;
-    for (auto fptr : sd.a->fpVec)
-        if (sd.optimizationArea.find(fptr) == sd.optimizationArea.end())
-            for (int i = 0; i < 3; ++i)
-                if (face::IsBorder(*fptr, i) || (sd.optimizationArea.find(fptr->FFp(i)) != sd.optimizationArea.end()))
+    for (auto fptr : QueryFixedFaces(sd, state, sd.a, bBox))
+        for (int i = 0; i < 3; ++i)
+            if (face::IsBorder(*fptr, i) || sd.optimizationArea.count(fptr->FFp(i)))
+                if (SegmentBoxIntersection(Segment(fptr->V0(i)->T().P(), fptr->V1(i)->T().P()), bBox))
                     aVec.push_back(HalfEdge{fptr, i});
 
-    std::vector<HalfEdge> bVec;
-    for (auto fptr : sd.b->fpVec)
-        if (sd.optimizationArea.find(fptr) == sd.optimizationArea.end())
-            for (int i = 0; i < 3; ++i)
-                if (face::IsBorder(*fptr, i) || (sd.optimizationArea.find(fptr->FFp(i)) != sd.optimizationArea.end()))
-                    bVec.push_back(HalfEdge{fptr, i});
-
     if ((aVec.size() > 0) && (bVec.size() > 0)) {
-        std::vector<HalfEdgePair> heVec = CrossIntersection(aVec, bVec);
-        if (heVec.size() > 0)
+        if (CrossIntersectionAny(aVec, bVec))
             return FAIL_GLOBAL_OVERLAP_BEFORE;
     }
 #if 0
@@ -1037,24 +2481,78 @@ static CheckStatus CheckBoundaryAfterAlignmentInner(SeamData& sd)
         if (heVec.size() > 0)
             return FAIL_GLOBAL_OVERLAP_BEFORE;
     }
-#endif
+#endif
+
+    return PASS;
+}
+
+static CheckStatus CheckBoundaryAfterAlignment(SeamData& sd, ConstAlgoStateHandle state)
+{
+    PERF_TIMER_START(state->stats);
+    LOG_DEBUG << "Running CheckBoundaryAfterAlignment()";
+    CheckStatus status = CheckBoundaryAfterAlignmentInner(sd, state);
+    PERF_TIMER_ACCUMULATE(t_check_before);
+    return status;
+}
+
+/* Energy of the chart faces of the shell (the hole-filling and scaffold faces are excluded)
+ * computed from the vertex tex coords of the shell, as the area weighted sum
+ * num and the total area denom */
+static void ComputeShellChartEnergy(SeamData& sd, Mesh& mesh, double *num, double *denom)
+{
+    ensure(HasFaceIndexAttribute(sd.shell));
+    auto ia = GetFaceIndexAttribute(sd.shell);
+    auto tsa = GetWedgeTexCoordStorageAttribute(mesh);
+    *num = 0;
+    *denom = 0;
+    for (auto& sf : sd.shell.face) {
+        if (sf.IsMesh()) {
+            auto& f = mesh.face[ia[sf]];
+            vcg::Point2d x10 = tsa[f].tc[1].P() - tsa[f].tc[0].P();
+            vcg::Point2d x20 = tsa[f].tc[2].P() - tsa[f].tc[0].P();
+            vcg::Point2d u10 = sf.V(1)->T().P() - sf.V(0)->T().P();
+            vcg::Point2d u20 = sf.V(2)->T().P() - sf.V(0)->T().P();
+            double area;
+            double energy = ARAP::ComputeEnergy(x10, x20, u10, u20, &area);
+            if (area > 0) {
+                *num += (area * energy);
+                *denom += area;
+            }
+        }
+    }
+}
+
+/* Predicts the outcome of the distortion checks from the shell tex coords of a
+ * partial ARAP solve. Since the remaining iterations can only lower the energy,
+ * the energy of the optimization area is scaled down by the prescreen margin, and
+ * the move is predicted to fail if it exceeds the thresholds even so */
+static CheckStatus PredictDistortion(SeamData& sd, Mesh& mesh, ConstAlgoStateHandle state, const AlgoParameters& params)
+{
+    TRACE_SCOPE_CAT("PredictDistortion", "greedy");
+    double num;
+    double denom;
+    ComputeShellChartEnergy(sd, mesh, &num, &denom);
 
+    double predictedNum = num / params.prescreenMargin;
+    if ((state->arapNum + (predictedNum - sd.inputArapNum)) / state->arapDenom > params.globalDistortionThreshold)
+        return FAIL_DISTORTION_GLOBAL;
+    if (denom > 0 && predictedNum / denom > params.distortionTolerance)
+        return FAIL_DISTORTION_LOCAL;
     return PASS;
 }
 
-static CheckStatus CheckBoundaryAfterAlignment(SeamData& sd)
+static CheckStatus CheckGlobalDistortion(const SeamData& sd, AlgoStateHandle state, const AlgoParameters& params)
 {
-    PERF_TIMER_START;
-    LOG_DEBUG << "Running CheckBoundaryAfterAlignment()";
-    CheckStatus status = CheckBoundaryAfterAlignmentInner(sd);
-    PERF_TIMER_ACCUMULATE(t_check_before);
-    return status;
+    TRACE_SCOPE_CAT("CheckGlobalDistortion", "greedy");
+    double newArapVal = (state->arapNum + (sd.outputArapNum - sd.inputArapNum)) / state->arapDenom;
+    if (newArapVal > params.globalDistortionThreshold)
+        return FAIL_DISTORTION_GLOBAL;
+    return PASS;
 }
 
 static CheckStatus CheckAfterLocalOptimizationInner(SeamData& sd, AlgoStateHandle state, const AlgoParameters& params)
 {
-    double newArapVal = (state->arapNum + (sd.outputArapNum - sd.inputArapNum)) / state->arapDenom;
-    if (newArapVal > params.globalDistortionThreshold)
+    if (CheckGlobalDistortion(sd, state, params) != PASS)
         return FAIL_DISTORTION_GLOBAL;
 
     double localDistortion = sd.outputArapNum / sd.outputArapDenom;
@@ -1079,33 +2577,56 @@ static CheckStatus CheckAfterLocalOptimizationInner(SeamData& sd, AlgoStateHandl
         return FAIL_LOCAL_OVERLAP;
     }
 
+    // large areas without folds are also rasterized, which detects the overlaps
+    // of the interiors missed by the border intersections. The rasterization is
+    // only an additional rejection, the exact tests below always run. Only the
+    // first check of a move is rasterized, since the rasterization cannot ignore
+    // the intersections of the edges fixed by the retries
+    bool rasterOverlap = false;
+    if (params.rasterOverlapFaces > 0 && (int) sd.optimizationArea.size() >= params.rasterOverlapFaces
+            && outputNegativeArea == 0 && sd.fixedVerticesFromIntersectingEdges.empty()) {
+        int overlaps = RasterizeOverlaps(sd, state, params);
+        if (overlaps >= 0) {
+            rasterOverlap = (overlaps > 0);
+            #pragma omp atomic
+            state->stats.raster_checks++;
+            if (rasterOverlap) {
+                #pragma omp atomic
+                state->stats.raster_overlaps++;
+            }
+        }
+    }
+
     // Functions to detect if the half-edges have already been fixed (in which case detecting the intersection is meaningless,
     // the half-edges were intersecting to begin with)
 
     auto FixedPair = [&] (const HalfEdgePair& hep) -> bool {
         return /*hep.first.fp->id == hep.second.fp->id
-                &&*/ sd.fixedVerticesFromIntersectingEdges.find(hep.first.V0()) != sd.fixedVerticesFromIntersectingEdges.end()
-                && sd.fixedVerticesFromIntersectingEdges.find(hep.first.V1()) != sd.fixedVerticesFromIntersectingEdges.end()
-                && sd.fixedVerticesFromIntersectingEdges.find(hep.second.V0()) != sd.fixedVerticesFromIntersectingEdges.end()
-                && sd.fixedVerticesFromIntersectingEdges.find(hep.second.V1()) != sd.fixedVerticesFromIntersectingEdges.end();
+                &&*/ sd.fixedVerticesFromIntersectingEdges.count(hep.first.V0())
+                && sd.fixedVerticesFromIntersectingEdges.count(hep.first.V1())
+                && sd.fixedVerticesFromIntersectingEdges.count(hep.second.V0())
+                && sd.fixedVerticesFromIntersectingEdges.count(hep.second.V1());
     };
 
     auto FixedFirst = [&] (const HalfEdgePair& hep) -> bool {
         return /*hep.first.fp->id == hep.second.fp->id
-                &&*/ sd.fixedVerticesFromIntersectingEdges.find(hep.first.V0()) != sd.fixedVerticesFromIntersectingEdges.end()
-                && sd.fixedVerticesFromIntersectingEdges.find(hep.first.V1()) != sd.fixedVerticesFromIntersectingEdges.end();
+                &&*/ sd.fixedVerticesFromIntersectingEdges.count(hep.first.V0())
+                && sd.fixedVerticesFromIntersectingEdges.count(hep.first.V1());
     };
 
     // ensure the optimization border does not self-intersect
     std::vector<HalfEdge> sVec;
+    vcg::Box2d sBox;
     for (auto fptr : sd.optimizationArea)
         for (int i = 0; i < 3; ++i)
-            if (face::IsBorder(*fptr, i) || (sd.optimizationArea.find(fptr->FFp(i)) == sd.optimizationArea.end()))
+            if (face::IsBorder(*fptr, i) || !sd.optimizationArea.count(fptr->FFp(i))) {
                 sVec.push_back(HalfEdge{fptr, i});
+                sBox.Add(fptr->V0(i)->T().P());
+                sBox.Add(fptr->V1(i)->T().P());
+            }
 
     if (sVec.size() > 0) {
-        sd.intersectionOpt = Intersection(sVec);
-        sd.intersectionOpt.erase(std::remove_if(sd.intersectionOpt.begin(), sd.intersectionOpt.end(), FixedPair), sd.intersectionOpt.end());
+        sd.intersectionOpt = Intersection(sVec, FixedPair);
         if (sd.intersectionOpt.size() > 0) {
             return FAIL_GLOBAL_OVERLAP_AFTER_OPT;
         }
@@ -1115,29 +2636,29 @@ static CheckStatus CheckAfterLocalOptimizationInner(SeamData& sd, AlgoStateHandl
     // note that this check is not suficient, we should make sure that the optimization AREA
     // does not intersect with the non-optimized area. This check should be done either with
     // rasterization or triangle intersections
+    // only the fixed border edges that are inside the bbox of the optimization border can intersect it
     std::vector<HalfEdge> nopVecBorder;
-    for (auto fptr : sd.a->fpVec)
-        if (sd.optimizationArea.find(fptr) == sd.optimizationArea.end())
+    for (auto ch : (sd.a != sd.b) ? std::vector<ChartHandle>{sd.a, sd.b} : std::vector<ChartHandle>{sd.a})
+        for (auto fptr : QueryFixedFaces(sd, state, ch, sBox))
             for (int i = 0; i < 3; ++i)
-                if (face::IsBorder(*fptr, i) /* || (sd.optimizationArea.find(fptr->FFp(i)) != sd.optimizationArea.end()) */)
-                    nopVecBorder.push_back(HalfEdge{fptr, i});
-
-    if (sd.a != sd.b) {
-        for (auto fptr : sd.b->fpVec)
-            if (sd.optimizationArea.find(fptr) == sd.optimizationArea.end())
-                for (int i = 0; i < 3; ++i)
-                    if (face::IsBorder(*fptr, i) /* || (sd.optimizationArea.find(fptr->FFp(i)) != sd.optimizationArea.end()) */)
+                if (face::IsBorder(*fptr, i) /* || sd.optimizationArea.count(fptr->FFp(i)) */)
+                    if (SegmentBoxIntersection(Segment(fptr->V0(i)->T().P(), fptr->V1(i)->T().P()), sBox))
                         nopVecBorder.push_back(HalfEdge{fptr, i});
-    }
 
     if (sVec.size() > 0 && nopVecBorder.size() > 0) {
-        sd.intersectionBoundary = CrossIntersection(sVec, nopVecBorder);
-        sd.intersectionBoundary.erase(std::remove_if(sd.intersectionBoundary.begin(), sd.intersectionBoundary.end(), FixedFirst), sd.intersectionBoundary.end());
+        sd.intersectionBoundary = CrossIntersection(sVec, nopVecBorder, FixedFirst);
         if (sd.intersectionBoundary.size() > 0) {
             return FAIL_GLOBAL_OVERLAP_AFTER_BND;
         }
     }
 
+    // the rasterization found an overlap of the interiors that the border tests missed
+    if (rasterOverlap) {
+        #pragma omp atomic
+        state->stats.raster_missed++;
+        return FAIL_GLOBAL_OVERLAP_AFTER_BND;
+    }
+
     // also ensure that the optimization border does not overlap any internal edge (inside or outside the optimization area)
     // to speed things up, only check edges that are inside the bbox of the opt area
     vcg::Box2d optBox;
@@ -1145,11 +2666,10 @@ static CheckStatus CheckAfterLocalOptimizationInner(SeamData& sd, AlgoStateHandl
         for (int i = 0; i < 3; ++i)
             optBox.Add(fptr->V(i)->T().P());
 
-    std::vector<HalfEdge> internal = ExtractHalfEdges({sd.a, sd.b}, optBox, true); // internal only
+    std::vector<HalfEdge> internal = ExtractHalfEdges(sd, state, {sd.a, sd.b}, optBox, true); // internal only
 
     if (sVec.size() > 0 && internal.size() > 0) {
-        sd.intersectionInternal = CrossIntersection(sVec, internal);
-        sd.intersectionInternal.erase(std::remove_if(sd.intersectionInternal.begin(), sd.intersectionInternal.end(), FixedFirst), sd.intersectionInternal.end());
+        sd.intersectionInternal = CrossIntersection(sVec, internal, FixedFirst);
         if (sd.intersectionInternal.size() > 0) {
             return FAIL_GLOBAL_OVERLAP_AFTER_BND;
         }
@@ -1161,29 +2681,52 @@ static CheckStatus CheckAfterLocalOptimizationInner(SeamData& sd, AlgoStateHandl
             box.Add(fptr->V(i)->T().P());
 
     // also check if the edges of b overlap the edges of a (only check the edges inside the bbox of b)
-    std::vector<HalfEdge> aVec = ExtractHalfEdges({sd.a}, box, false);
+    std::vector<HalfEdge> aVec = ExtractHalfEdges(sd, state, {sd.a}, box, false);
     std::vector<HalfEdge> bVec = ExtractHalfEdges({sd.b}, box, false);
     if ((aVec.size() > 0) && (bVec.size() > 0)) {
-        std::vector<HalfEdgePair> heVec = CrossIntersection(aVec, bVec);
-        if (heVec.size() > 0)
+        if (CrossIntersectionAny(aVec, bVec))
             return FAIL_GLOBAL_OVERLAP_UNFIXABLE;
     }
 
     return PASS;
 }
 
+/* Rasterizes the optimization area together with the faces of the charts of the
+ * move that lie in its box, returns the number of overlapping texels or -1 if the
+ * rasterization is not available on the calling thread */
+static int RasterizeOverlaps(const SeamData& sd, ConstAlgoStateHandle state, const AlgoParameters& params)
+{
+    TRACE_SCOPE_CAT("RasterizeOverlaps", "greedy");
+    std::vector<Mesh::FacePointer> area(sd.optimizationArea.begin(), sd.optimizationArea.end());
+
+    vcg::Box2d box;
+    for (auto fptr : area)
+        for (int i = 0; i < 3; ++i)
+            box.Add(fptr->V(i)->T().P());
+
+    std::vector<Mesh::FacePointer> fixed;
+    for (auto ch : (sd.a != sd.b) ? std::vector<ChartHandle>{sd.a, sd.b} : std::vector<ChartHandle>{sd.a}) {
+        std::vector<Mesh::FacePointer> faces = QueryFixedFaces(sd, state, ch, box);
+        fixed.insert(fixed.end(), faces.begin(), faces.end());
+    }
+
+    return CountOverlappingTexels(area, fixed, box, params.rasterOverlapResolution);
+}
+
 static CheckStatus CheckAfterLocalOptimization(SeamData& sd, AlgoStateHandle state, const AlgoParameters& params)
 {
-    PERF_TIMER_START;
+    TRACE_SCOPE_CAT("CheckAfterLocalOptimization", "greedy");
+    PERF_TIMER_START(state->stats);
     LOG_DEBUG << "Running CheckAfterLocalOptimization()";
     CheckStatus status = CheckAfterLocalOptimizationInner(sd, state, params);
     PERF_TIMER_ACCUMULATE(t_check_after);
     return status;
 }
 
-static CheckStatus OptimizeChart(SeamData& sd, GraphHandle graph, bool fixIntersectingEdges)
+static CheckStatus OptimizeChart(SeamData& sd, GraphHandle graph, ConstAlgoStateHandle state, const AlgoParameters& params, bool fixIntersectingEdges)
 {
-    PERF_TIMER_START;
+    TRACE_SCOPE_CAT("OptimizeChart", "greedy");
+    PERF_TIMER_START(state->stats);
 
     // Create a support face group that contains only the faces that must be
     // optimized with arap, i.e. the faces that have at least one vertex in vset
@@ -1199,22 +2742,37 @@ static CheckStatus OptimizeChart(SeamData& sd, GraphHandle graph, bool fixInters
         fptr->V(2)->T().P() = *itV++; fptr->WT(2).P() = *itW++;
     }
 
-    // before updating the wedge tex coords, compute the arap contribution of the optimization area
-    // WARNING: it is critial that at this point the wedge tex coords HAVE NOT YET BEEN UPDATED
-    ARAP::ComputeEnergyFromStoredWedgeTC(support.fpVec, graph->mesh, &sd.inputArapNum, &sd.inputArapDenom);
+    // the arap contribution of the optimization area before the move is cached per face
+    // in the state, it is the energy of the wedge tex coords that are about to be updated
+    auto wtcsa = GetWedgeTexCoordStorageAttribute(graph->mesh);
+    sd.inputArapNum = 0;
+    sd.inputArapDenom = 0;
+    for (auto fptr : support.fpVec) {
+        sd.inputArapNum += state->faceArapNum[tri::Index(graph->mesh, fptr)];
+        sd.inputArapDenom += std::abs((wtcsa[fptr].tc[1].P() - wtcsa[fptr].tc[0].P()) ^ (wtcsa[fptr].tc[2].P() - wtcsa[fptr].tc[0].P()));
+    }
 
-    WedgeTexFromVertexTex(sd.a);
+    // outside the optimization area the wedge tex coords of a already match the
+    // vertex tex coords, the faces of b were rigidly aligned
+    WedgeTexFromVertexTex(sd, support.fpVec);
     if (sd.a != sd.b)
-        WedgeTexFromVertexTex(sd.b);
+        WedgeTexFromVertexTex(sd, sd.b->fpVec);
 
-    LOG_DEBUG << "Building shell...";
+    // The retry passes only fix more vertices, so the shell, its target shapes
+    // and the precomputed data of the solver are kept from the previous pass
+    bool reuseShell = fixIntersectingEdges && sd.arap;
 
-    sd.shell.Clear();
-    sd.shell.ClearAttributes();
-    bool singleComponent = BuildShellWithTargetsFromUV(sd.shell, support, 1.0);
+    ShellTopology topology;
+    bool singleComponent = true;
+    if (!reuseShell) {
+        LOG_DEBUG << "Building shell...";
+        sd.shell.Clear();
+        sd.shell.ClearAttributes();
+        singleComponent = BuildShellWithTargetsFromUV(sd.shell, support, 1.0, &topology);
 
-    if (!singleComponent)
-        LOG_DEBUG << "Shell is not single component";
+        if (!singleComponent)
+            LOG_DEBUG << "Shell is not single component";
+    }
 
     // Use the existing texture coordinates as starting point for ARAP
 
@@ -1228,41 +2786,69 @@ static CheckStatus OptimizeChart(SeamData& sd, GraphHandle graph, bool fixInters
         }
     }
 
-    // split non manifold vertices
-    while (tri::Clean<Mesh>::SplitNonManifoldVertex(sd.shell, 0.3))
-        ;
+    if (!reuseShell) {
+        // the shell is already cut along the seams, with the non manifold vertices split
+        if (topology.holes == 0 || topology.genus != 0) {
+            return FAIL_TOPOLOGY;
+        }
 
-    CutAlongSeams(sd.shell);
+        if (singleComponent && topology.holes > 1)
+            CloseHoles3D(sd.shell);
 
-    int nholes = tri::Clean<Mesh>::CountHoles(sd.shell);
-    int genus = tri::Clean<Mesh>::MeshGenus(sd.shell);
-    if (nholes == 0 || genus != 0) {
-        return FAIL_TOPOLOGY;
+        // the scaffold band around the boundary penalizes the fold-overs of the
+        // boundary during the solve, instead of fixing them with the retry passes
+        if (params.scaffoldWidth > 0) {
+            int nscaffold = AddBoundaryScaffold(sd.shell, params.scaffoldWidth);
+            LOG_DEBUG << "Added " << nscaffold << " scaffold faces";
+        }
+    } else {
+        // the hole-filling faces only reference boundary vertices of the chart faces
+        for (auto& sf : sd.shell.face)
+            if (sf.IsHoleFilling())
+                for (int j = 0; j < 3; ++j)
+                    sf.WT(j) = sf.V(j)->T();
+        RestoreBoundaryScaffold(sd.shell);
     }
 
-    if (singleComponent && nholes > 1)
-        CloseHoles3D(sd.shell);
-
     SyncShellWithUV(sd.shell);
 
     PERF_TIMER_ACCUMULATE(t_optimize_build);
 
     LOG_DEBUG << "Optimizing...";
-    ARAP arap(sd.shell);
+    if (!sd.arapCache)
+        sd.arapCache = std::make_shared<ARAPFactorizationCache>();
+
+    if (!reuseShell)
+        sd.arap = std::make_shared<ARAP>(sd.shell);
+
+    ARAP& arap = *sd.arap;
     arap.SetMaxIterations(100);
+    arap.SetSolverBackend(params.arapSolver);
+    arap.SetSolverTolerance(params.arapSolverTolerance);
+    arap.SetFactorizationCache(sd.arapCache);
+    arap.SetMultilevel(params.arapMultilevelFaces, params.arapMultilevelIterations);
+    arap.SetAndersonAcceleration(params.arapAndersonWindow);
+    arap.SetDenseThreshold(params.arapDenseFaces);
+    // only the thread of the OpenGL context can solve on the GPU, so the moves
+    // evaluated concurrently are all solved on the CPU, whichever thread runs them,
+    // and the result does not depend on the scheduling
+    arap.SetGPUThreshold((params.mergeBatchSize > 1) ? 0 : params.arapGPUFaces);
 
     // select the vertices, using the fact that the faces are mirrored in
-    // the support object
+    // the support object (on the retry passes they are already fixed)
 
-    for (unsigned i = 0; i < support.FN(); ++i) {
-        for (int j = 0; j < 3; ++j) {
-            if (sd.verticesWithinThreshold.find(support.fpVec[i]->V(j)) == sd.verticesWithinThreshold.end()) {
-                ensure(sd.shell.face[i].IsHoleFilling() == false);
-                sd.shell.face[i].V(j)->SetS();
+    if (!reuseShell) {
+        for (unsigned i = 0; i < support.FN(); ++i) {
+            for (int j = 0; j < 3; ++j) {
+                if (!sd.verticesWithinThreshold.count(support.fpVec[i]->V(j))) {
+                    ensure(sd.shell.face[i].IsHoleFilling() == false);
+                    sd.shell.face[i].V(j)->SetS();
+                }
             }
         }
     }
 
+    int nfixed = 0;
     if (fixIntersectingEdges) {
         unsigned fixedBefore = sd.fixedVerticesFromIntersectingEdges.size();
         for (auto hep : sd.intersectionOpt) {
@@ -1286,25 +2872,165 @@ static CheckStatus OptimizeChart(SeamData& sd, GraphHandle graph, bool fixInters
 
         for (unsigned i = 0; i < support.FN(); ++i) {
             for (int j = 0; j < 3; ++j) {
-                if (sd.fixedVerticesFromIntersectingEdges.find(support.fpVec[i]->V(j)) != sd.fixedVerticesFromIntersectingEdges.end())
-                    sd.shell.face[i].V(j)->SetS();
+                auto sv = sd.shell.face[i].V(j);
+                if (sd.fixedVerticesFromIntersectingEdges.count(support.fpVec[i]->V(j)) && !sv->IsS()) {
+                    sv->SetS();
+                    if (reuseShell) {
+                        arap.FixVertex(sv, sv->T().P());
+                        nfixed++;
+                    }
+                }
             }
         }
     }
 
-    // Fix the selected vertices of the shell;
-    int nfixed = arap.FixSelectedVertices();
-    LOG_DEBUG << "Fixed " << nfixed << " vertices";
-    double tol = 0.02;
-    while (nfixed < 2) {
-        LOG_DEBUG << "Not enough selected vertices found, fixing random edge with tolerance " << tol;
-        nfixed += arap.FixRandomEdgeWithinTolerance(tol);
-        tol += 0.02;
+    // Fix the selected vertices of the shell, on the retry passes the solver
+    // already has the vertices fixed by the previous passes
+    if (!reuseShell) {
+        nfixed = arap.FixSelectedVertices();
+        LOG_DEBUG << "Fixed " << nfixed << " vertices";
+        double tol = 0.02;
+        while (nfixed < 2) {
+            LOG_DEBUG << "Not enough selected vertices found, fixing random edge with tolerance " << tol;
+            nfixed += arap.FixRandomEdgeWithinTolerance(tol);
+            tol += 0.02;
+        }
+        ensure(nfixed > 0);
+    } else {
+        LOG_DEBUG << "Fixed " << nfixed << " more vertices";
+    }
+
+    // Adaptive iteration budget of the first pass: the solve is stopped as soon as
+    // the energy of the chart is within the margin of the limit imposed by the
+    // distortion checks (the energy can only decrease, so the checks will pass), or
+    // as soon as the limit is out of reach. The reachable energy is extrapolated
+    // from the last decrements assuming that they shrink at least geometrically
+    bool earlyStop = false;
+    CheckStatus earlyStatus = PASS;
+    std::vector<double> chartNum;
+    ARAPIterationCallback budget = nullptr;
+    if (params.arapEarlyStopMargin > 0 && !fixIntersectingEdges) {
+        budget = [&](int iterations, int iterationLimit) -> bool {
+            double num;
+            double denom;
+            ComputeShellChartEnergy(sd, graph->mesh, &num, &denom);
+            if (!(denom > 0))
+                return true;
+            chartNum.push_back(num);
+
+            double localLimit = params.distortionTolerance * denom;
+            double globalLimit = params.globalDistortionThreshold * state->arapDenom - (state->arapNum - sd.inputArapNum);
+            double limit = std::min(localLimit, globalLimit);
+
+            if (num <= params.arapEarlyStopMargin * limit) {
+                earlyStop = true;
+                earlyStatus = PASS;
+                return false;
+            }
+
+            int n = chartNum.size();
+            if (n >= 4) {
+                double d1 = chartNum[n - 2] - chartNum[n - 1];
+                double d2 = chartNum[n - 3] - chartNum[n - 2];
+                double d3 = chartNum[n - 4] - chartNum[n - 3];
+                if (d1 > 0 && d2 > 0 && d3 > 0) {
+                    double rho = std::max(d1 / d2, d2 / d3);
+                    if (rho < 1) {
+                        int remaining = iterationLimit - iterations;
+                        double reachable = num - d1 * rho * (1 - std::pow(rho, remaining)) / (1 - rho);
+                        if (reachable > limit) {
+                            earlyStop = true;
+                            earlyStatus = (reachable > globalLimit) ? FAIL_DISTORTION_GLOBAL : FAIL_DISTORTION_LOCAL;
+                            return false;
+                        }
+                    }
+                }
+            }
+            return true;
+        };
     }
-    ensure(nfixed > 0);
+
+    // the thread count of the solves, restored when the move returns to the greedy loop
+    ScopedThreadCount arapThreads(params.arapThreads);
 
     LOG_DEBUG << "Solving...";
-    sd.si = arap.Solve();
+    if (params.prescreenIterations > 0 && !fixIntersectingEdges) {
+        // run the first iterations and predict the outcome of the distortion checks,
+        // the solve is resumed from the current tex coords so no work is lost if
+        // the move is not skipped
+        arap.SetMaxIterations(params.prescreenIterations);
+        sd.si = arap.Solve();
+        if (!sd.si.numericalError && sd.si.iterations == params.prescreenIterations) {
+            CheckStatus predicted = PredictDistortion(sd, graph->mesh, state, params);
+            if (predicted == PASS) {
+                sd.prescreen = SeamData::PRESCREEN_PASS;
+            } else if ((sd.a->id + sd.b->id) % PRESCREEN_AUDIT_INTERVAL != 0) {
+                sd.prescreen = SeamData::PRESCREEN_FAIL_SKIPPED;
+                #pragma omp atomic
+                state->stats.arap_iterations += sd.si.iterations;
+                #pragma omp atomic
+                state->stats.arap_solver_iterations += sd.si.solverIterations;
+                PERF_TIMER_ACCUMULATE_FROM_PREVIOUS(t_optimize_arap);
+                PERF_TIMER_ACCUMULATE(t_optimize);
+                LOG_DEBUG << "Distortion predictor rejected the move after " << sd.si.iterations << " iterations";
+                return predicted;
+            } else {
+                sd.prescreen = SeamData::PRESCREEN_FAIL_SOLVED;
+            }
+            // the partial solve already started from the coarse solution
+            arap.SetMultilevel(0, 0);
+            arap.SetMaxIterations(std::max(1, 100 - sd.si.iterations));
+            arap.SetIterationCallback(budget);
+            ARAPSolveInfo si = arap.Solve();
+            sd.si.finalEnergy = si.finalEnergy;
+            sd.si.iterations += si.iterations;
+            sd.si.numericalError = si.numericalError;
+            sd.si.solverIterations += si.solverIterations;
+            sd.si.backend = si.backend;
+            sd.si.stopped = si.stopped;
+        }
+    } else {
+        arap.SetIterationCallback(budget);
+        sd.si = arap.Solve();
+    }
+
+    // the callback references the locals of this call, and the solver is reused by the retry passes
+    arap.SetIterationCallback(nullptr);
+
+    #pragma omp atomic
+    state->stats.arap_iterations += sd.si.iterations;
+    #pragma omp atomic
+    state->stats.arap_solver_iterations += sd.si.solverIterations;
+    if (sd.shell.FN() >= ParallelMinFaces()) {
+        #pragma omp atomic
+        state->stats.arap_parallel++;
+    }
+    if (sd.si.fallback) {
+        #pragma omp atomic
+        state->stats.arap_fallbacks++;
+    }
+    if (sd.si.backend == DENSE_LLT) {
+        #pragma omp atomic
+        state->stats.arap_dense++;
+    }
+    if (sd.si.backend == GPU_JACOBI_CG) {
+        #pragma omp atomic
+        state->stats.arap_gpu++;
+    }
+
+    if (earlyStop && sd.si.stopped && !sd.si.numericalError) {
+        if (earlyStatus == PASS) {
+            #pragma omp atomic
+            state->stats.arap_early_pass++;
+        } else {
+            #pragma omp atomic
+            state->stats.arap_early_fail++;
+            PERF_TIMER_ACCUMULATE_FROM_PREVIOUS(t_optimize_arap);
+            PERF_TIMER_ACCUMULATE(t_optimize);
+            LOG_DEBUG << "ARAP solve stopped after " << sd.si.iterations << " iterations, the distortion limit is out of reach";
+            return earlyStatus;
+        }
+    }
 
     PERF_TIMER_ACCUMULATE_FROM_PREVIOUS(t_optimize_arap);
 
@@ -1315,7 +3041,7 @@ static CheckStatus OptimizeChart(SeamData& sd, GraphHandle graph, bool fixInters
     ensure(HasFaceIndexAttribute(sd.shell));
     auto ia = GetFaceIndexAttribute(sd.shell);
     for (auto& sf : sd.shell.face) {
-        if (!sf.IsHoleFilling()) {
+        if (sf.IsMesh()) {
             auto& f = (graph->mesh).face[ia[sf]];
             for (int k = 0; k < 3; ++k) {
                 f.WT(k).P() = sf.V(k)->T().P();
@@ -1325,20 +3051,45 @@ static CheckStatus OptimizeChart(SeamData& sd, GraphHandle graph, bool fixInters
     }
 
     if (!sd.si.numericalError)
-        ARAP::ComputeEnergyFromStoredWedgeTC(support.fpVec, graph->mesh, &sd.outputArapNum, &sd.outputArapDenom);
+        ARAP::ComputeEnergyFromStoredWedgeTC(support.fpVec, graph->mesh, &sd.outputArapNum, &sd.outputArapDenom, &sd.outputFaceArapNum);
 
     PERF_TIMER_ACCUMULATE(t_optimize);
 
     return sd.si.numericalError ? FAIL_NUMERICAL_ERROR : PASS;
 }
 
-static bool SeamInterceptsOptimizationArea(ClusteredSeamHandle csh, const SeamData& sd)
+/* Computes the quantities of the local optimization used by AcceptMove() for a
+ * move whose tex coords are left as merged by AlignAndMerge(), that is with the
+ * seam vertices at the average of the coincident sides */
+static void StitchChart(SeamData& sd, GraphHandle graph, ConstAlgoStateHandle state)
+{
+    Mesh& m = graph->mesh;
+
+    std::vector<Mesh::FacePointer> area(sd.optimizationArea.begin(), sd.optimizationArea.end());
+
+    auto wtcsa = GetWedgeTexCoordStorageAttribute(m);
+    sd.inputArapNum = 0;
+    sd.inputArapDenom = 0;
+    for (auto fptr : area) {
+        sd.inputArapNum += state->faceArapNum[tri::Index(m, fptr)];
+        sd.inputArapDenom += std::abs((wtcsa[fptr].tc[1].P() - wtcsa[fptr].tc[0].P()) ^ (wtcsa[fptr].tc[2].P() - wtcsa[fptr].tc[0].P()));
+    }
+
+    WedgeTexFromVertexTex(sd, area);
+    if (sd.a != sd.b)
+        WedgeTexFromVertexTex(sd, sd.b->fpVec);
+
+    ARAP::ComputeEnergyFromStoredWedgeTC(area, m, &sd.outputArapNum, &sd.outputArapDenom, &sd.outputFaceArapNum);
+    sd.si.finalEnergy = (sd.outputArapDenom > 0) ? sd.outputArapNum / sd.outputArapDenom : 0;
+}
+
+static bool SeamInterceptsOptimizationArea(const ClusteredSeamHandle& csh, const SeamData& sd)
 {
     const SeamMesh& sm = csh->sm;
     for (auto sh : csh->seams) {
         for (int i : sh->edges) {
             const SeamEdge& edge = sm.edge[i];
-            if ((sd.optimizationArea.find(edge.fa) != sd.optimizationArea.end()) || (sd.optimizationArea.find(edge.fb) != sd.optimizationArea.end()))
+            if (sd.optimizationArea.count(edge.fa) || sd.optimizationArea.count(edge.fb))
                 return true;
         }
     }
@@ -1347,25 +3098,46 @@ static bool SeamInterceptsOptimizationArea(ClusteredSeamHandle csh, const SeamDa
 
 static void AcceptMove(const SeamData& sd, AlgoStateHandle state, GraphHandle graph, const AlgoParameters& params)
 {
-    PERF_TIMER_START;
+    TRACE_SCOPE_CAT("AcceptMove", "greedy");
+    PERF_TIMER_START(state->stats);
 
-    if (min_energy > sd.si.finalEnergy)
-        min_energy = sd.si.finalEnergy;
-    if (max_energy < sd.si.finalEnergy)
-        max_energy = sd.si.finalEnergy;
+    #pragma omp critical (stats)
+    {
+        if (state->stats.min_energy > sd.si.finalEnergy)
+            state->stats.min_energy = sd.si.finalEnergy;
+        if (state->stats.max_energy < sd.si.finalEnergy)
+            state->stats.max_energy = sd.si.finalEnergy;
+    }
 
     state->changeSet.insert(sd.optimizationArea.begin(), sd.optimizationArea.end());
 
+    // the faces of b were rigidly moved by the alignment, the faces of a only
+    // changed inside the optimization area
+    if (sd.a != sd.b)
+        for (auto fptr : sd.b->fpVec)
+            state->uvIndex.Update(fptr);
+    for (auto fptr : sd.optimizationArea)
+        if (sd.a == sd.b || fptr->id != sd.b->id)
+            state->uvIndex.Update(fptr);
+
     std::vector<SeamHandle> shared;
     std::set<ClusteredSeamHandle> sharedClusters; // clusters that can be aggregated after the merge
     std::set<ClusteredSeamHandle> independentClusters; // clusters not directly impacted by the merge
 
     std::set<ClusteredSeamHandle> selfClusters;
 
+    // the merge only removes the seam edges from the border
+    std::vector<HalfEdge> mergedBorder;
+    for (ChartHandle c : (sd.a != sd.b) ? std::vector<ChartHandle>{sd.a, sd.b} : std::vector<ChartHandle>{sd.a})
+        for (const HalfEdge& he : c->GetBorder())
+            if (face::IsBorder(*he.fp, he.e))
+                mergedBorder.push_back(he);
+
     if (sd.a != sd.b) {
         // ``disjoint'' seams, i.e. seams between B and C with C not in N(a)
         // are inherited by A
-        for (auto csh : state->chartSeamMap[sd.b->id]) {
+        for (ClusterId cid : state->clusters.ChartClusters(sd.b->id)) {
+            ClusteredSeamHandle csh = state->clusters[cid].csh;
             ChartPair p = GetCharts(csh, graph);
             ChartHandle c = (p.first == sd.b) ? p.second : p.first;
             if (c == sd.a || c == sd.b) {
@@ -1383,7 +3155,8 @@ static void AcceptMove(const SeamData& sd, AlgoStateHandle state, GraphHandle gr
         }
 
         // we also need to recompute the cost of seams between A and C with C not in N(b)
-        for (auto csh : state->chartSeamMap[sd.a->id]) {
+        for (ClusterId cid : state->clusters.ChartClusters(sd.a->id)) {
+            ClusteredSeamHandle csh = state->clusters[cid].csh;
             ChartPair p = GetCharts(csh, graph);
             ChartHandle c = (p.first == sd.a) ? p.second : p.first;
             if (c == sd.a || c == sd.b) {
@@ -1402,7 +3175,8 @@ static void AcceptMove(const SeamData& sd, AlgoStateHandle state, GraphHandle gr
 
         /*
         for (auto x : std::set<ChartHandle>{sd.a, sd.b}) {
-            for (auto csh : state->chartSeamMap[x->id]) {
+            for (ClusterId cid : state->clusters.ChartClusters(x->id)) {
+                ClusteredSeamHandle csh = state->clusters[cid].csh;
                 ChartPair p = GetCharts(csh, graph);
                 ChartHandle c = (p.first == x) ? p.second : p.first;
                 if ((sd.a->adj.find(c) != sd.a->adj.end()) && (sd.b->adj.find(c) != sd.b->adj.end())) {
@@ -1433,18 +3207,20 @@ static void AcceptMove(const SeamData& sd, AlgoStateHandle state, GraphHandle gr
         graph->charts.erase(sd.b->id);
 
         // update state
-        state->chartSeamMap.erase(sd.b->id);
+        state->clusters.ClearChartClusters(sd.b->id);
         std::set<RegionID>& failed_b = state->failed[sd.b->id];
         state->failed[sd.a->id].insert(failed_b.begin(), failed_b.end());
         state->failed.erase(sd.b->id);
     } else {
         // if removing a non-disconnecting seam then all the clusters are independent
-        independentClusters.insert(state->chartSeamMap[sd.b->id].begin(), state->chartSeamMap[sd.b->id].end());
+        for (ClusterId cid : state->clusters.ChartClusters(sd.b->id))
+            independentClusters.insert(state->clusters[cid].csh);
         independentClusters.erase(sd.csh);
     }
 
-    // invalidate cache
-    sd.a->ParameterizationChanged();
+    // update the cache of the merged chart without visiting all its faces
+    UpdateMergedChartCache(sd);
+    sd.a->SetBorder(std::move(mergedBorder));
 
     // update current UV border length
     double deltaUVBorderLength = sd.a->BorderUV() - sd.inputUVBorderLength;
@@ -1453,22 +3229,30 @@ static void AcceptMove(const SeamData& sd, AlgoStateHandle state, GraphHandle gr
     // update atlas energy
     state->arapNum += (sd.outputArapNum - sd.inputArapNum);
     state->arapDenom += (sd.outputArapDenom - sd.inputArapDenom);
+    auto itArap = sd.outputFaceArapNum.begin();
+    for (auto fptr : sd.optimizationArea)
+        state->faceArapNum[tri::Index(graph->mesh, fptr)] = *itArap++;
 
-    if (state->failed[sd.a->id].count(sd.b->id) > 0)
-        retry_success++;
+    if (state->failed[sd.a->id].count(sd.b->id) > 0) {
+        #pragma omp atomic
+        state->stats.retry_success++;
+    }
 
     // Erase seam
     EraseSeam(sd.csh, state, graph);
-    state->penalty.erase(sd.csh);
+    ClusterId acceptedId = state->clusters.Find(sd.csh);
+    if (acceptedId != ClusterStore::NONE)
+        state->clusters.Release(acceptedId);
 
+    std::vector<ClusteredSeamHandle> reinsert;
     for (auto csh : independentClusters) {
-        auto it = state->status.find(csh);
-        ensure(it != state->status.end());
+        ClusterId cid = state->clusters.Find(csh);
+        ensure(cid != ClusterStore::NONE && state->clusters[cid].active);
 
-        CheckStatus clusterStatus = it->second;
+        CheckStatus clusterStatus = state->clusters[cid].status;
         ensure(clusterStatus != PASS);
 
-        CostInfo::MatchingValue mv = state->mvalue[csh];
+        CostInfo::MatchingValue mv = state->clusters[cid].mvalue;
 
         EraseSeam(csh, state, graph);
 
@@ -1481,16 +3265,18 @@ static void AcceptMove(const SeamData& sd, AlgoStateHandle state, GraphHandle gr
         if (invalidate || (params.ignoreOnReject && mv == CostInfo::REJECTED))
             InvalidateCluster(csh, state, graph, clusterStatus, 1.0);
         else
-            InsertNewClusterInQueue(csh, state, graph, params);
+            reinsert.push_back(csh);
     }
+    if (params.lazyCostFactor > 0)
+        InsertEstimatedClustersInQueue(reinsert, state, graph, params);
+    else
+        InsertNewClustersInQueue(reinsert, state, graph, params);
 
     for (auto csh : sharedClusters)
         EraseSeam(csh, state, graph);
 
     std::vector<ClusteredSeamHandle> cshvec = ClusterSeamsByChartId(shared);
-    for (auto csh : cshvec) {
-        InsertNewClusterInQueue(csh, state, graph, params);
-    }
+    InsertNewClustersInQueue(cshvec, state, graph, params);
 
     if (params.visitComponents) {
         // if potential islands are allowed to ignore the boundary length limit,
@@ -1499,33 +3285,87 @@ static void AcceptMove(const SeamData& sd, AlgoStateHandle state, GraphHandle gr
 
         std::set<ClusteredSeamHandle> unfeasibleBoundaryAdj;
         for (ChartHandle c : sd.a->adj)
-            for (auto csh : state->chartSeamMap[c->id])
-                if (state->mvalue[csh] == CostInfo::MatchingValue::UNFEASIBLE_BOUNDARY)
-                    unfeasibleBoundaryAdj.insert(csh);
+            for (ClusterId cid : state->clusters.ChartClusters(c->id))
+                if (state->clusters[cid].mvalue == CostInfo::MatchingValue::UNFEASIBLE_BOUNDARY)
+                    unfeasibleBoundaryAdj.insert(state->clusters[cid].csh);
 
-        for (ClusteredSeamHandle csh : unfeasibleBoundaryAdj) {
+        for (ClusteredSeamHandle csh : unfeasibleBoundaryAdj)
             EraseSeam(csh, state, graph);
-            InsertNewClusterInQueue(csh, state, graph, params);
-        }
+        InsertNewClustersInQueue(std::vector<ClusteredSeamHandle>(unfeasibleBoundaryAdj.begin(), unfeasibleBoundaryAdj.end()), state, graph, params);
     }
 
     PERF_TIMER_ACCUMULATE(t_accept);
 }
 
+/* Computes the cache of the chart resulting from an accepted move from the caches
+ * of the input charts. The faces outside the optimization area are unchanged (or
+ * rigidly aligned, for chart b), and the merge only removes the seam edges from
+ * the border, so only the contributions of the optimization area and of the seam
+ * need to be updated */
+static void UpdateMergedChartCache(const SeamData& sd)
+{
+    double optSignedAreaUV = 0;
+    double optBorderUV = 0;
+    for (auto fptr : sd.optimizationArea) {
+        optSignedAreaUV += AreaUV(*fptr);
+        for (int i = 0; i < 3; ++i)
+            if (face::IsBorder(*fptr, i))
+                optBorderUV += EdgeLengthUV(*fptr, i);
+    }
+
+    FaceGroup::Cache cache = sd.inputCacheA;
+    double signedAreaUV = sd.inputCacheA.uvFlipped ? -sd.inputCacheA.areaUV : sd.inputCacheA.areaUV;
+    if (sd.a != sd.b) {
+        signedAreaUV += sd.inputCacheB.uvFlipped ? -sd.inputCacheB.areaUV : sd.inputCacheB.areaUV;
+        cache.area3D += sd.inputCacheB.area3D;
+        cache.borderUV += sd.inputCacheB.borderUV;
+        cache.border3D += sd.inputCacheB.border3D;
+        cache.weightedSumNormal += sd.inputCacheB.weightedSumNormal;
+    }
+
+    signedAreaUV += optSignedAreaUV - sd.inputOptSignedAreaUV;
+    cache.areaUV = std::abs(signedAreaUV);
+    cache.uvFlipped = (signedAreaUV < 0);
+    cache.borderUV = std::max(0.0, cache.borderUV - sd.seamBorderUV + optBorderUV - sd.inputOptBorderUV);
+    cache.border3D = std::max(0.0, cache.border3D - sd.seamBorder3D);
+
+    sd.a->SetCache(cache);
+}
+
 static void RejectMove(const SeamData& sd, AlgoStateHandle state, GraphHandle graph, CheckStatus status)
 {
-    PERF_TIMER_START;
+    TRACE_SCOPE_CAT("RejectMove", "greedy");
+    PERF_TIMER_START(state->stats);
 
-    Mesh& m = graph->mesh;
+    UndoMove(sd, graph);
+
+    EraseSeam(sd.csh, state, graph);
 
-    // restore texture coordinates and indices
-    RestoreChartAttributes(sd.a, m, sd.vertexinda.begin(), sd.texcoorda.begin());
+    InvalidateCluster(sd.csh, state, graph, status, PENALTY_MULTIPLIER);
     if (sd.a != sd.b)
-        RestoreChartAttributes(sd.b, m, sd.vertexindb.begin(), sd.texcoordb.begin());
+        state->failed[sd.a->id].insert(sd.b->id);
+
+    PERF_TIMER_ACCUMULATE(t_reject);
+}
+
+/* Restores the mesh attributes and topology as they were before the move was
+ * evaluated. The algorithm state is not affected. */
+static void UndoMove(const SeamData& sd, GraphHandle graph)
+{
+    (void) graph;
+
+    // replay the undo log to restore the vertex references and the texture coordinates
+    for (auto it = sd.undoVertexRef.rbegin(); it != sd.undoVertexRef.rend(); ++it)
+        it->fp->V(it->i) = it->vp;
+    for (const auto& r : sd.undoVertexTex)
+        r.vp->T().P() = r.tc;
+    for (const auto& r : sd.undoWedgeTex)
+        for (int i = 0; i < 3; ++i)
+            r.fp->WT(i).P() = r.wtc[i];
 
     // restore face-face topology
     SeamMesh& seamMesh = sd.csh->sm;
-    for (SeamHandle sh : sd.csh->seams) {
+    for (const SeamHandle& sh : sd.csh->seams) {
         for (int iedge : sh->edges) {
             const SeamEdge& edge = seamMesh.edge[iedge];
             edge.fa->FFp(edge.ea) = edge.fa;
@@ -1546,47 +3386,40 @@ static void RejectMove(const SeamData& sd, AlgoStateHandle state, GraphHandle gr
             sd.vfmap.at(verts[i]).first.back()->VFi(sd.vfmap.at(verts[i]).second.back()) = 0;
         }
     }
-
-    EraseSeam(sd.csh, state, graph);
-
-    InvalidateCluster(sd.csh, state, graph, status, PENALTY_MULTIPLIER);
-    if (sd.a != sd.b)
-        state->failed[sd.a->id].insert(sd.b->id);
-
-    PERF_TIMER_ACCUMULATE(t_reject);
 }
 
 static void EraseSeam(ClusteredSeamHandle csh, AlgoStateHandle state, GraphHandle graph)
 {
     ensure(csh->size() > 0);
 
-    std::size_t n = state->cost.erase(csh);
-    ensure(n > 0);
-
-    n = state->transform.erase(csh);
-    ensure(n > 0);
+    ClusterId cid = state->clusters.Find(csh);
+    ensure(cid != ClusterStore::NONE && state->clusters[cid].active);
 
-    n = state->status.erase(csh);
-    ensure(n > 0);
-
-    n = state->mvalue.erase(csh);
-    ensure(n > 0);
+    // the cluster is not in the queue if it is the move currently being processed
+    state->queue.erase(csh);
 
     ChartPair charts = GetCharts(csh, graph);
 
-    // the following check are needed because AcceptMove() may erase seams after
-    // fiddling with the chartSeamMap...
-    if (state->chartSeamMap.find(charts.first->id) != state->chartSeamMap.end())
-        state->chartSeamMap[charts.first->id].erase(csh);
-
-    if (state->chartSeamMap.find(charts.second->id) != state->chartSeamMap.end())
-        state->chartSeamMap[charts.second->id].erase(csh);
+    // the clusters of chart b are already cleared if AcceptMove() erases the
+    // seams after the merge, so missing members are ignored
+    state->clusters.EraseChartCluster(charts.first->id, cid);
+    state->clusters.EraseChartCluster(charts.second->id, cid);
 
-    // erase seam from endpoint map
+    // erase seam from its endpoints
     std::set<int> endpoints = GetEndpoints(csh);
     for (auto vi : endpoints) {
-        unsigned n = state->emap[vi].erase(csh);
-        ensure(n > 0);
+        bool erased = state->clusters.EraseEndpointCluster(vi, cid);
+        ensure(erased);
+    }
+
+    // the record is kept if the cluster has a penalty for its next evaluation
+    if (state->clusters[cid].penalty == 1.0) {
+        state->clusters.Release(cid);
+    } else {
+        double penalty = state->clusters[cid].penalty;
+        state->clusters[cid] = ClusterRecord();
+        state->clusters[cid].csh = csh;
+        state->clusters[cid].penalty = penalty;
     }
 }
 
@@ -1600,34 +3433,25 @@ static void InvalidateCluster(ClusteredSeamHandle csh, AlgoStateHandle state, Gr
     ci.matching = MatchingTransform::Identity();
 
     state->queue.push(std::make_pair(csh, ci.cost));
-    state->cost[csh] = Infinity();
-    state->transform[csh] = ci.matching;
-    state->status[csh] = status;
-    state->mvalue[csh] = ci.mvalue;
-
-    ChartPair p = GetCharts(csh, graph);
-    state->chartSeamMap[p.first->id].insert(csh);
-    state->chartSeamMap[p.second->id].insert(csh);
+    ClusterId cid = state->clusters.Acquire(csh);
+    ClusterRecord& r = state->clusters[cid];
+    r.active = true;
+    r.cost = Infinity();
+    r.transform = ci.matching;
+    r.status = status;
+    r.mvalue = ci.mvalue;
 
     // add penalty if the cluster is later re-evaluated
-    double penalty = GetPenalty(csh, state);
-    state->penalty[csh] = penalty * penaltyMultiplier;
+    r.penalty *= penaltyMultiplier;
+
+    ChartPair p = GetCharts(csh, graph);
+    state->clusters.InsertChartCluster(p.first->id, cid);
+    state->clusters.InsertChartCluster(p.second->id, cid);
 
-    // add cluster to endpoint map
+    // add the cluster to its endpoints
     std::set<int> endpoints = GetEndpoints(csh);
     for (auto vi : endpoints)
-        state->emap[vi].insert(csh);
-}
-
-static void RestoreChartAttributes(ChartHandle c, Mesh& m, std::vector<int>::const_iterator itvi,  std::vector<vcg::Point2d>::const_iterator ittc)
-{
-    for (auto fptr : c->fpVec) {
-        for (int i = 0; i < 3; ++i) {
-            fptr->V(i) = &m.vert[*itvi++];
-            fptr->V(i)->T().P() = *ittc;
-            fptr->WT(i).P() = *ittc++;
-        }
-    }
+        state->clusters.InsertEndpointCluster(vi, cid);
 }
 
 static CostInfo ReduceSeam(ClusteredSeamHandle csh, AlgoStateHandle state, GraphHandle graph, const AlgoParameters& params)
@@ -1641,12 +3465,12 @@ static CostInfo ReduceSeam(ClusteredSeamHandle csh, AlgoStateHandle state, Graph
     // reduce ``forward''
     ClusteredSeamHandle fwd, bwd;
     {
-        fwd = std::make_shared<ClusteredSeam>(sm);
+        fwd = ClusteredSeamHandle::Make(sm);
         double lenfwd = 0;
         auto seamHandleIt = csh->seams.begin();
         while (lenfwd < params.reductionFactor * totlen && seamHandleIt != csh->seams.end()) {
             SeamHandle sh  = *seamHandleIt;
-            SeamHandle shnew = std::make_shared<Seam>(sm);
+            SeamHandle shnew = SeamHandle::Make(sm);
 
             std::map<SeamMesh::VertexPointer, int> visited;
             for (int e : sh->edges) {
@@ -1678,12 +3502,12 @@ static CostInfo ReduceSeam(ClusteredSeamHandle csh, AlgoStateHandle state, Graph
 
     // reduce ``backward''
     {
-        bwd = std::make_shared<ClusteredSeam>(sm);
+        bwd = ClusteredSeamHandle::Make(sm);
         double lenbwd = 0;
         auto seamHandleIt = csh->seams.rbegin();
         while (lenbwd < params.reductionFactor * totlen && seamHandleIt != csh->seams.rend()) {
             SeamHandle sh  = *seamHandleIt;
-            SeamHandle shnew = std::make_shared<Seam>(sm);
+            SeamHandle shnew = SeamHandle::Make(sm);
 
             std::map<SeamMesh::VertexPointer, int> visited;
             for (auto ei = sh->edges.rbegin(); ei != sh->edges.rend(); ++ei) {
@@ -1720,9 +3544,418 @@ static CostInfo ReduceSeam(ClusteredSeamHandle csh, AlgoStateHandle state, Graph
 
     if (cfwd.cost < cbwd.cost) {
         csh->seams = fwd->seams;
+        csh->costCache = fwd->costCache;
         return cfwd;
     } else {
         csh->seams = bwd->seams;
+        csh->costCache = bwd->costCache;
         return cbwd;
     }
 }
+
+/* Sums of the uv quantities that ComputeCost() extracts from a run of seam edges.
+ * The prefix sums over the edges of a cluster give the rigid matching of any
+ * sub-seam that starts at one end of the cluster in constant time */
+struct SeamMoments {
+    double n = 0;
+    double sax = 0, say = 0, sbx = 0, sby = 0; // sums of the a and b points
+    double sxx = 0, sxy = 0, syx = 0, syy = 0; // sums of the products b_i * a_j
+    double saa = 0, sbb = 0;                   // sums of the squared norms
+    double sdd = 0;                            // sum of the squared distances between the a and b points
+    double boundaryA = 0, boundaryB = 0;       // uv length of the edges on the two charts
+
+    void AddPair(const vcg::Point2d& pa, const vcg::Point2d& pb, const vcg::Point2d& oa, const vcg::Point2d& ob)
+    {
+        vcg::Point2d p = pa - oa;
+        vcg::Point2d q = pb - ob;
+        n += 1;
+        sax += p.X(); say += p.Y();
+        sbx += q.X(); sby += q.Y();
+        sxx += q.X() * p.X(); sxy += q.X() * p.Y();
+        syx += q.Y() * p.X(); syy += q.Y() * p.Y();
+        saa += p.SquaredNorm();
+        sbb += q.SquaredNorm();
+        sdd += (pa - pb).SquaredNorm();
+    }
+
+    SeamMoments operator-(const SeamMoments& o) const
+    {
+        SeamMoments d;
+        d.n = n - o.n;
+        d.sax = sax - o.sax; d.say = say - o.say;
+        d.sbx = sbx - o.sbx; d.sby = sby - o.sby;
+        d.sxx = sxx - o.sxx; d.sxy = sxy - o.sxy;
+        d.syx = syx - o.syx; d.syy = syy - o.syy;
+        d.saa = saa - o.saa; d.sbb = sbb - o.sbb;
+        d.sdd = sdd - o.sdd;
+        d.boundaryA = boundaryA - o.boundaryA;
+        d.boundaryB = boundaryB - o.boundaryB;
+        return d;
+    }
+};
+
+// computes the prefix sums of the moments of the edges in the given order, the
+// points are deduplicated as in ExtractUVCoordinates() and shifted by oa and ob
+// to avoid the cancellation of the raw moments far from the origin
+static void ComputeSeamMoments(SeamMesh& sm, const std::vector<int>& edges, RegionID a, RegionID b,
+                               const vcg::Point2d& oa, const vcg::Point2d& ob, std::vector<SeamMoments>& prefix)
+{
+    SeamVisitedSet visited(sm);
+
+    prefix.assign(edges.size() + 1, SeamMoments());
+    for (unsigned i = 0; i < edges.size(); ++i) {
+        SeamMoments& m = prefix[i + 1];
+        m = prefix[i];
+
+        SeamEdge& edge = sm.edge[edges[i]];
+        Mesh::FacePointer fa = edge.fa;
+        Mesh::FacePointer fb = edge.fb;
+        int ea = edge.ea;
+        int eb = edge.eb;
+
+        double la = (fa->V0(ea)->T().P() - fa->V1(ea)->T().P()).Norm();
+        double lb = (fb->V0(eb)->T().P() - fb->V1(eb)->T().P()).Norm();
+        m.boundaryA += (fa->id == a ? la : 0) + (fb->id == a ? lb : 0);
+        m.boundaryB += (fa->id == b ? la : 0) + (fb->id == b ? lb : 0);
+
+        if (fa->id != a) {
+            std::swap(fa, fb);
+            std::swap(ea, eb);
+        }
+        if (!visited.Contains(fa->V0(ea)) || !visited.Contains(fb->V1(eb))) {
+            visited.Insert(fa->V0(ea));
+            visited.Insert(fb->V1(eb));
+            m.AddPair(fa->V0(ea)->T().P(), fb->V1(eb)->T().P(), oa, ob);
+        }
+        if (!visited.Contains(fa->V1(ea)) || !visited.Contains(fb->V0(eb))) {
+            visited.Insert(fa->V1(ea));
+            visited.Insert(fb->V0(eb));
+            m.AddPair(fa->V1(ea)->T().P(), fb->V0(eb)->T().P(), oa, ob);
+        }
+    }
+}
+
+// returns true if the matching of the points is feasible according to ComputeCost().
+// The root mean squared residual of the rigid fit (computed in closed form from the
+// moments) bounds the average residual from above, so a positive answer implies that
+// ComputeCost() does not find the matching unfeasible
+static bool MatchingFeasible(const SeamMoments& m, bool fit, const AlgoParameters& params)
+{
+    if (m.n < 2)
+        return false;
+
+    double sq = m.sdd;
+    if (fit) {
+        double cax = m.sax / m.n, cay = m.say / m.n;
+        double cbx = m.sbx / m.n, cby = m.sby / m.n;
+        double s00 = m.sxx - m.n * cbx * cax;
+        double s01 = m.sxy - m.n * cbx * cay;
+        double s10 = m.syx - m.n * cby * cax;
+        double s11 = m.syy - m.n * cby * cay;
+        double varA = m.saa - m.n * (cax * cax + cay * cay);
+        double varB = m.sbb - m.n * (cbx * cbx + cby * cby);
+        sq = varA + varB - 2.0 * std::hypot(s00 + s11, s01 - s10);
+    }
+
+    double rms = std::sqrt(std::max(sq, 0.0) / m.n);
+    return rms <= params.matchingThreshold * ((m.boundaryA + m.boundaryB) / 2.0);
+}
+
+// returns the largest number of edges in [1, total) whose moments (taken from the
+// prefix sums) are feasible, or 0. Assumes the residual does not decrease as the
+// sub-seam grows
+static int SearchFeasiblePrefix(const std::vector<SeamMoments>& prefix, bool fit, const AlgoParameters& params)
+{
+    int lo = 0;
+    int hi = (int) prefix.size() - 1;
+    while (hi - lo > 1) {
+        int mid = lo + (hi - lo) / 2;
+        if (MatchingFeasible(prefix[mid], fit, params))
+            lo = mid;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+// builds the cluster made of the first (or last) count edges of csh
+static ClusteredSeamHandle TrimClusteredSeam(const ClusteredSeamHandle& csh, int count, bool fromBack)
+{
+    SeamMesh& sm = csh->sm;
+    ClusteredSeamHandle trimmed = ClusteredSeamHandle::Make(sm);
+    for (unsigned k = 0; k < csh->seams.size() && count > 0; ++k) {
+        const SeamHandle& sh = csh->seams[fromBack ? csh->seams.size() - 1 - k : k];
+        if ((int) sh->edges.size() <= count) {
+            trimmed->seams.push_back(sh);
+            count -= sh->edges.size();
+        } else {
+            SeamHandle shnew = SeamHandle::Make(sm);
+            if (fromBack)
+                shnew->edges.assign(sh->edges.end() - count, sh->edges.end());
+            else
+                shnew->edges.assign(sh->edges.begin(), sh->edges.begin() + count);
+
+            std::map<SeamMesh::VertexPointer, int> visited;
+            for (int e : shnew->edges) {
+                visited[sm.edge[e].V(0)]++;
+                visited[sm.edge[e].V(1)]++;
+            }
+            for (auto& entry : visited) {
+                if (entry.second == 1) {
+                    shnew->endpoints.push_back(tri::Index(sm, entry.first));
+                }
+            }
+            if (tri::Index(sm, sm.edge[shnew->edges.front()].V(0)) != (unsigned) shnew->endpoints.front()
+                    && tri::Index(sm, sm.edge[shnew->edges.front()].V(1)) != (unsigned) shnew->endpoints.front()) {
+                std::reverse(shnew->endpoints.begin(), shnew->endpoints.end());
+            }
+
+            trimmed->seams.push_back(shnew);
+            count = 0;
+        }
+    }
+    if (fromBack)
+        std::reverse(trimmed->seams.begin(), trimmed->seams.end());
+    return trimmed;
+}
+
+// Alternative to ReduceSeam() that trims the cluster to the longest sub-seam from
+// each end whose matching is feasible in a single step. The moments of the uv points
+// are accumulated once per direction and the sub-seams are binary-searched on their
+// prefix sums, only the two resulting candidates are costed. Falls back to ReduceSeam()
+// if no proper sub-seam is found feasible
+static CostInfo ReduceSeamBisection(ClusteredSeamHandle csh, AlgoStateHandle state, GraphHandle graph, const AlgoParameters& params)
+{
+    SeamMesh& sm = csh->sm;
+    ChartPair charts = GetCharts(csh, graph);
+    RegionID a = charts.first->id;
+    RegionID b = charts.second->id;
+
+    std::vector<int> edges;
+    for (const SeamHandle& sh : csh->seams)
+        edges.insert(edges.end(), sh->edges.begin(), sh->edges.end());
+
+    SeamEdge& e0 = sm.edge[edges.front()];
+    vcg::Point2d oa = (e0.fa->id == a) ? e0.fa->V0(e0.ea)->T().P() : e0.fb->V0(e0.eb)->T().P();
+    vcg::Point2d ob = (e0.fa->id == a) ? e0.fb->V1(e0.eb)->T().P() : e0.fa->V1(e0.ea)->T().P();
+
+    bool fit = (a != b);
+    std::vector<SeamMoments> prefix;
+
+    ComputeSeamMoments(sm, edges, a, b, oa, ob, prefix);
+    int nfwd = SearchFeasiblePrefix(prefix, fit, params);
+
+    std::reverse(edges.begin(), edges.end());
+    ComputeSeamMoments(sm, edges, a, b, oa, ob, prefix);
+    int nbwd = SearchFeasiblePrefix(prefix, fit, params);
+
+    if (nfwd == 0 && nbwd == 0)
+        return ReduceSeam(csh, state, graph, params);
+
+    double penalty = GetPenalty(csh, state);
+
+    ClusteredSeamHandle best = nullptr;
+    CostInfo cbest = { Infinity(), {}, CostInfo::UNFEASIBLE_MATCHING, CostInfo::STAGE_MATCHING };
+    if (nfwd > 0) {
+        best = TrimClusteredSeam(csh, nfwd, false);
+        cbest = ComputeCost(best, graph, params, penalty);
+    }
+    if (nbwd > 0) {
+        ClusteredSeamHandle bwd = TrimClusteredSeam(csh, nbwd, true);
+        CostInfo cbwd = ComputeCost(bwd, graph, params, penalty);
+        if (!best || !(cbest.cost < cbwd.cost)) {
+            best = bwd;
+            cbest = cbwd;
+        }
+    }
+
+    csh->seams = best->seams;
+    csh->costCache = best->costCache;
+    return cbest;
+}
+
+// -- move log -----------------------------------------------------------------
+
+static void GetSortedEdges(const ClusteredSeamHandle& csh, std::vector<int>& edges)
+{
+    edges.clear();
+    for (const SeamHandle& sh : csh->seams)
+        edges.insert(edges.end(), sh->edges.begin(), sh->edges.end());
+    std::sort(edges.begin(), edges.end());
+}
+
+// appends the move about to be accepted to the move log of the state
+static void RecordMove(const SeamData& sd, AlgoStateHandle state, GraphHandle graph)
+{
+    AcceptedMove move;
+    GetSortedEdges(sd.csh, move.edges);
+    move.transform = state->clusters[state->clusters.Find(sd.csh)].transform;
+    move.finalEnergy = sd.si.finalEnergy;
+    for (auto fptr : sd.optimizationArea) {
+        move.faces.push_back(tri::Index(graph->mesh, fptr));
+        for (int i = 0; i < 3; ++i)
+            move.texcoords.push_back(fptr->WT(i).P());
+    }
+    state->acceptedMoves.push_back(std::move(move));
+}
+
+// returns the active cluster made of the given edges, or nullptr
+static ClusteredSeamHandle FindCluster(const std::vector<int>& edges, AlgoStateHandle state, GraphHandle graph)
+{
+    const SeamEdge& edge = state->sm.edge[edges.front()];
+    ChartHandle c = graph->GetChart(edge.fa->id);
+
+    std::vector<int> clusterEdges;
+    for (ClusterId cid : state->clusters.ChartClusters(c->id)) {
+        const ClusterRecord& r = state->clusters[cid];
+        if (!r.active)
+            continue;
+        GetSortedEdges(r.csh, clusterEdges);
+        if (clusterEdges == edges)
+            return r.csh;
+    }
+    return nullptr;
+}
+
+// replaces the local optimization of the move with the tex coords of the log, and
+// computes the quantities of the optimization used by AcceptMove()
+static bool ApplyRecordedMove(SeamData& sd, const AcceptedMove& move, GraphHandle graph, ConstAlgoStateHandle state)
+{
+    Mesh& m = graph->mesh;
+
+    std::vector<Mesh::FacePointer> area(sd.optimizationArea.begin(), sd.optimizationArea.end());
+    if (area.size() != move.faces.size())
+        return false;
+    for (unsigned i = 0; i < area.size(); ++i)
+        if (area[i] != &m.face[move.faces[i]])
+            return false;
+
+    auto wtcsa = GetWedgeTexCoordStorageAttribute(m);
+    sd.inputArapNum = 0;
+    sd.inputArapDenom = 0;
+    for (auto fptr : area) {
+        sd.inputArapNum += state->faceArapNum[tri::Index(m, fptr)];
+        sd.inputArapDenom += std::abs((wtcsa[fptr].tc[1].P() - wtcsa[fptr].tc[0].P()) ^ (wtcsa[fptr].tc[2].P() - wtcsa[fptr].tc[0].P()));
+    }
+
+    WedgeTexFromVertexTex(sd, area);
+    if (sd.a != sd.b)
+        WedgeTexFromVertexTex(sd, sd.b->fpVec);
+
+    auto itTex = move.texcoords.begin();
+    for (auto fptr : area) {
+        for (int i = 0; i < 3; ++i) {
+            LogVertexTex(sd, fptr->V(i));
+            fptr->WT(i).P() = *itTex;
+            fptr->V(i)->T().P() = *itTex;
+            ++itTex;
+        }
+    }
+
+    sd.si.finalEnergy = move.finalEnergy;
+    ARAP::ComputeEnergyFromStoredWedgeTC(area, m, &sd.outputArapNum, &sd.outputArapDenom, &sd.outputFaceArapNum);
+
+    return true;
+}
+
+bool ReplayOptimization(GraphHandle graph, AlgoStateHandle state, const AlgoParameters& params, const std::string& path)
+{
+    TRACE_SCOPE_CAT("ReplayOptimization", "greedy");
+    state->stats.ClearCounters();
+
+    std::vector<AcceptedMove> moves;
+    if (!LoadMoveLog(path, graph, state, moves))
+        return false;
+
+    RequireVertexFace(graph->mesh);
+
+    LOG_INFO << "Replaying " << moves.size() << " moves from " << path;
+    LOG_INFO << "Atlas energy before optimization is " << state->arapNum / state->arapDenom;
+
+    SeamData sd;
+    for (unsigned i = 0; i < moves.size(); ++i) {
+        ClusteredSeamHandle csh = FindCluster(moves[i].edges, state, graph);
+        if (!csh) {
+            LOG_ERR << "Move " << i << " of the log " << path << " does not match any cluster of the optimization";
+            return false;
+        }
+
+        sd.Clear();
+        ComputeSeamData(sd, csh, graph, state);
+        OffsetMap om = AlignAndMerge(csh, sd, state, moves[i].transform, params);
+        ComputeOptimizationArea(sd, state, graph->mesh, om);
+
+        if (!ApplyRecordedMove(sd, moves[i], graph, state)) {
+            UndoMove(sd, graph);
+            LOG_ERR << "The optimization area of move " << i << " of the log " << path << " does not match the optimization";
+            return false;
+        }
+
+        AcceptMove(sd, state, graph, params);
+        state->stats.accept++;
+    }
+
+    PrintStateInfo(state, graph, params);
+    UpdateStateBytes(*state);
+    ReportExecutionStats(state->stats);
+
+    LOG_INFO << "Atlas energy after optimization is " << ARAP::ComputeEnergyFromStoredWedgeTC(graph->mesh, nullptr, nullptr);
+
+    ClearElementStoragePool();
+
+    return true;
+}
+
+/* Bitmap of the vertices referenced by the faces that are not deleted */
+static std::vector<uint64_t> ReferencedVertexBitmap(const Mesh& m)
+{
+    std::vector<uint64_t> referenced((m.vert.size() + 63) / 64, 0);
+    const int fn = (int) m.face.size();
+    #pragma omp parallel for if (fn >= ParallelMinFaces())
+    for (int fi = 0; fi < fn; ++fi) {
+        const MeshFace& f = m.face[fi];
+        if (f.IsD())
+            continue;
+        for (int i = 0; i < 3; ++i) {
+            std::size_t vi = tri::Index(m, f.cV(i));
+            #pragma omp atomic
+            referenced[vi / 64] |= (uint64_t(1) << (vi % 64));
+        }
+    }
+    return referenced;
+}
+
+/* Removes the deleted vertices from the vertex vector, keeping the order of the
+ * others. The new indices are the prefix sums of the live vertices, computed by
+ * blocks in parallel, then vcg moves the vertices and their attributes and updates
+ * the face references */
+static void CompactVertexVector(Mesh& m)
+{
+    if (m.vn == (int) m.vert.size())
+        return;
+
+    const int BLOCK = 4096;
+    const int vn = (int) m.vert.size();
+    const int nb = (vn + BLOCK - 1) / BLOCK;
+    std::vector<std::size_t> blockBase(nb + 1, 0);
+    #pragma omp parallel for
+    for (int b = 0; b < nb; ++b) {
+        for (int vi = b * BLOCK; vi < std::min(vn, (b + 1) * BLOCK); ++vi)
+            if (!m.vert[vi].IsD())
+                blockBase[b + 1]++;
+    }
+    for (int b = 0; b < nb; ++b)
+        blockBase[b + 1] += blockBase[b];
+    ensure(blockBase[nb] == (std::size_t) m.vn);
+
+    tri::Allocator<Mesh>::PointerUpdater<Mesh::VertexPointer> pu;
+    pu.remap.assign(vn, std::numeric_limits<std::size_t>::max());
+    #pragma omp parallel for
+    for (int b = 0; b < nb; ++b) {
+        std::size_t pos = blockBase[b];
+        for (int vi = b * BLOCK; vi < std::min(vn, (b + 1) * BLOCK); ++vi)
+            if (!m.vert[vi].IsD())
+                pu.remap[vi] = pos++;
+    }
+    tri::Allocator<Mesh>::PermutateVertexVector(m, pu);
+}
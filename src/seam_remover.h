@@ -24,6 +24,9 @@
 
 #include <vector>
 #include <memory>
+#include <string>
+#include <functional>
+#include <map>
 
 #include <vcg/space/point3.h>
 #include <vcg/space/point2.h>
@@ -36,8 +39,31 @@
 
 #include "seams.h"
 #include "intersection.h"
-
-typedef std::unordered_map<Mesh::VertexPointer, double> OffsetMap;
+#include "indexed_heap.h"
+#include "element_set.h"
+#include "timer.h"
+#include "latency_histogram.h"
+#include "perf_counters.h"
+
+struct ChartOrientation;
+
+typedef ElementMap<MeshVertex, double> OffsetMap;
+
+/* Progress of the greedy optimization, passed to AlgoParameters::progressCallback */
+struct GreedyProgress {
+    int iterations;           // moves evaluated
+    int accepted;
+    int rejected;
+    std::size_t queueSize;    // entries of the queue, including the stale ones
+    std::size_t validMoves;   // active clusters with a finite cost
+    double acceptRatio;       // moving average of the fraction of accepted moves
+    double movesPerSecond;    // from the moving average of the move latency
+    double borderRatio;       // current UV border length relative to the input
+    double borderTarget;      // AlgoParameters::UVBorderLengthReduction
+    double elapsed;           // seconds since the start of the loop
+    double remaining;         // estimated seconds to go, negative if unknown
+    bool done;                // set on the last report of the loop
+};
 
 struct AlgoParameters {
     double matchingThreshold         = 2.0;
@@ -47,6 +73,7 @@ struct AlgoParameters {
     double globalDistortionThreshold = 0.025;
     double reductionFactor           = 0.8;
     bool   reduce                    = false;
+    bool   reduceBisection           = false; // reduce the unfeasible seams by binary-searching the longest feasible sub-seam from each end
     double timelimit                 = 0;
     bool   visitComponents           = true;
     double expb                      = 1.0;
@@ -54,6 +81,50 @@ struct AlgoParameters {
     bool   ignoreOnReject            = false;
     double resolutionScaling         = 1.0;
     int    rotationNum               = 4;
+    int    mergeBatchSize            = 1; // number of independent merge operations evaluated concurrently
+    ARAPSolverBackend arapSolver     = SIMPLICIAL_LDLT;
+    double arapSolverTolerance       = 1e-10; // relative residual tolerance of the iterative (or mixed precision) ARAP solver
+    int    arapMultilevelFaces       = 0; // shells with at least this many faces are optimized coarse-to-fine (0 disables it)
+    int    arapMultilevelIterations  = 20; // ARAP iterations on the full shell after the coarse-to-fine solve
+    int    arapAndersonWindow        = 0; // number of previous ARAP iterates combined by the Anderson acceleration (0 disables it)
+    int    arapDenseFaces            = 64; // shells with at most this many faces are solved with a dense factorization (0 disables it)
+    int    arapGPUFaces              = 0; // shells with at least this many faces are solved with compute shaders, if a context is current on the thread (0 disables it)
+    double scaffoldWidth             = 0; // width of the scaffold band added around the shells, relative to the average boundary edge length (0 disables it)
+    double arapEarlyStopMargin       = 0; // the ARAP solve of a move stops once its energy is below this fraction of the distortion limits, or once the limits are out of reach (0 disables it)
+    int    rasterOverlapFaces        = 0; // optimization areas with at least this many faces are checked for overlaps by rasterizing them on the GPU, if a context is current on the thread (0 disables it)
+    int    rasterOverlapResolution   = 1024; // texels along the longest side of the grid of the rasterized overlap check
+    double coincidentSeamTolerance   = 0; // the seams whose matching error is below this fraction of their length are stitched in bulk before the greedy loop, without the ARAP solve (0 disables it)
+    double lazyCostFactor            = 0; // the clusters re-queued after an accepted move are queued with their previous matching error scaled by this factor, and costed when they reach the top (0 disables it)
+    bool   parallelPacking           = false; // pack the texture containers concurrently
+    int    greedyThreads             = 0; // threads of the greedy optimization, outside of the ARAP solves (0 uses all of them)
+    int    arapThreads               = 0; // threads of the ARAP solves of the moves (0 uses all of them)
+    int    packingThreads            = 0; // threads of the placement search of the packing (0 uses all of them)
+    bool   hierarchicalPacking       = false; // coarse-to-fine search of the chart placements (see RasterizedOutline2Packer::Parameters)
+    bool   gpuPacking                = false; // evaluate the chart placements with compute shaders, if an OpenGL 4.3 context is current on the packing thread (see gpu_placement.h)
+    bool   deterministic             = false; // seeded random choices and a number of packing trials independent of the threads, so that the output only depends on the input and the parameters
+    std::string packingLayoutFile    = ""; // layout of a previous packing reused for the unchanged charts, rewritten after the packing (see Pack())
+    int    tileSize                  = 0; // side in pixels of the fixed size texture tiles the charts are packed into (0 sizes the containers from the input textures, see Pack())
+    int    prescreenIterations       = 0; // ARAP iterations run to predict the distortion of a move before the full solve (0 disables the predictor)
+    double prescreenMargin           = 2.0; // energy reduction still assumed achievable by the full solve when predicting the distortion
+    double checkpointInterval        = 0; // seconds between the checkpoints of the greedy optimization (0 disables them)
+    std::string checkpointFile       = ""; // file of the checkpoints of the greedy optimization (see checkpoint.h)
+    int    partitions                = 1; // number of chart regions optimized concurrently before the seams across them (1 disables it)
+    std::string moveLogFile          = ""; // file the accepted moves are recorded to, to be replayed by ReplayOptimization() (see checkpoint.h)
+    double progressInterval          = 1.0; // seconds between the calls of the progress callback
+    std::function<void(const GreedyProgress&)> progressCallback; // called from the thread of the greedy loop (the partitioned loops do not report)
+};
+
+/* Stages of the evaluation of a move, timed for each move (see EvaluateMove()) */
+enum MoveStage {
+    MOVE_SEAM_DATA=0,
+    MOVE_ALIGN_MERGE,
+    MOVE_OPTIMIZATION_AREA,
+    MOVE_CHECK_BEFORE,
+    MOVE_OPTIMIZE,
+    MOVE_CHECK_AFTER,
+    MOVE_FIX_OVERLAPS,  // passes that optimize the chart again with the intersecting edges fixed
+    MOVE_COMMIT,        // acceptance or rejection of the move
+    MOVE_STAGE_END
 };
 
 struct SeamData {
@@ -62,19 +133,39 @@ struct SeamData {
     ChartHandle a;
     ChartHandle b;
 
-    std::vector<vcg::Point2d> texcoorda;
-    std::vector<vcg::Point2d> texcoordb;
-    std::vector<int> vertexinda;
-    std::vector<int> vertexindb;
+    // undo log of the move, it records the values overwritten by the move the first
+    // time they are changed, so that UndoMove() only restores what was modified
+    struct VertexTexRecord {
+        Mesh::VertexPointer vp;
+        vcg::Point2d tc;
+    };
 
-    std::map<Mesh::VertexPointer, Mesh::VertexPointer> mrep;
-    std::map<SeamMesh::VertexPointer, std::vector<Mesh::VertexPointer>> evec;
+    struct WedgeTexRecord {
+        Mesh::FacePointer fp;
+        vcg::Point2d wtc[3];
+    };
+
+    struct VertexRefRecord {
+        Mesh::FacePointer fp;
+        int i;
+        Mesh::VertexPointer vp;
+    };
+
+    std::vector<VertexTexRecord> undoVertexTex;
+    std::vector<WedgeTexRecord> undoWedgeTex;
+    std::vector<VertexRefRecord> undoVertexRef;
+
+    // the containers of the mesh elements are bound to the mesh by ComputeSeamData()
+    ElementSet<MeshVertex> loggedVertices;
+    ElementSet<MeshFace> loggedFaces;
+    ElementMap<MeshVertex, Mesh::VertexPointer> mrep;
+    ElementMap<SeamVertex, std::vector<Mesh::VertexPointer>> evec;
 
     typedef std::pair<std::vector<Mesh::FacePointer>, std::vector<int>> FanInfo;
-    std::map<Mesh::VertexPointer, FanInfo> vfmap;
+    ElementMap<MeshVertex, FanInfo> vfmap;
 
-    std::unordered_set<Mesh::VertexPointer> verticesWithinThreshold;
-    std::unordered_set<Mesh::FacePointer> optimizationArea;
+    ElementSet<MeshVertex> verticesWithinThreshold;
+    ElementSet<MeshFace> optimizationArea;
     std::vector<vcg::Point2d> texcoordoptVert;
     std::vector<vcg::Point2d> texcoordoptWedge;
 
@@ -83,23 +174,55 @@ struct SeamData {
 
     double inputUVBorderLength;
 
+    // the chart caches before the move, and the contributions to the cached
+    // aggregates of the elements changed by the move (see AcceptMove())
+    FaceGroup::Cache inputCacheA;
+    FaceGroup::Cache inputCacheB;
+    double seamBorderUV;
+    double seamBorder3D;
+    double inputOptSignedAreaUV;
+    double inputOptBorderUV;
+
     double inputArapNum;
     double inputArapDenom;
 
     double outputArapNum;
     double outputArapDenom;
+    std::vector<double> outputFaceArapNum; // contribution to outputArapNum of each face of the optimization area
+
+    MatchingTransform alignment; // the rigid transform applied to chart b
+
+    // outcome of the distortion predictor run before the full ARAP solve (see OptimizeChart())
+    enum PrescreenOutcome {
+        PRESCREEN_NONE,          // the predictor was not run
+        PRESCREEN_PASS,          // the move was predicted to pass the distortion checks
+        PRESCREEN_FAIL_SOLVED,   // the move was predicted to fail, but was solved anyway to audit the predictor
+        PRESCREEN_FAIL_SKIPPED   // the move was predicted to fail and rejected without the full solve
+    };
+
+    PrescreenOutcome prescreen;
+
+    double stageTime[MOVE_STAGE_END]; // time of each stage of the evaluation of the move
+    int overlapFixes;                 // passes of the loop that fixes the overlaps after the optimization
 
     ARAPSolveInfo si;
+    std::shared_ptr<ARAPFactorizationCache> arapCache; // shared by the retry passes of the optimization
 
     Mesh shell;
+    std::shared_ptr<ARAP> arap; // solver of the shell, kept by the retry passes that only fix more vertices
 
     std::vector<HalfEdgePair> intersectionOpt;
     std::vector<HalfEdgePair> intersectionBoundary;
     std::vector<HalfEdgePair> intersectionInternal;
 
-    std::unordered_set<Mesh::VertexPointer> fixedVerticesFromIntersectingEdges;
+    ElementSet<MeshVertex> fixedVerticesFromIntersectingEdges;
+
+    SeamData() : a{nullptr}, b{nullptr}, inputNegativeArea{0}, inputAbsoluteArea{0}, alignment{MatchingTransform::Identity()}, prescreen{PRESCREEN_NONE} {}
 
-    SeamData() : a{nullptr}, b{nullptr}, inputNegativeArea{0}, inputAbsoluteArea{0} {}
+    /* Resets the object to its default state so that it can be reused by the next
+     * move. The capacity of the vectors, of the element containers and of the shell
+     * mesh is retained, so that reusing the object avoids most of the allocations */
+    void Clear();
 };
 
 // enum of the possible outcomes for safety checks when performing merge operations
@@ -128,47 +251,235 @@ struct CostInfo {
         _END
     };
 
+    /* Stages of the cost evaluation, from the cheapest. A cluster rejected by a
+     * stage skips the following ones */
+    enum Stage {
+        STAGE_AREA=0,     // area of the two charts
+        STAGE_BOUNDARY,   // ratio of the seam length to the chart borders
+        STAGE_LOOKAHEAD,  // island lookahead, when the boundary ratio is too low
+        STAGE_MATCHING,   // rigid matching of the uv coordinates along the seam
+        STAGE_END
+    };
+
     double cost;
     MatchingTransform matching;
     MatchingValue mvalue;
+    Stage stage; // the stage that determined mvalue
 };
 
-struct AlgoState {
+/* Counters and timings of the greedy optimization. They are kept in the state, so
+ * that independent optimizations can run concurrently in the same process, and
+ * updated atomically because the moves of a batch are evaluated concurrently */
+struct AlgoStats {
+    double t_init = 0;
+    double t_seamdata = 0;
+    double t_alignmerge = 0;
+    double t_optimization_area = 0;
+    double t_optimize = 0;
+    double t_optimize_build = 0;
+    double t_optimize_arap = 0;
+    double t_check_before = 0;
+    double t_check_after = 0;
+    double t_accept = 0;
+    double t_reject = 0;
+    Timer timer;
+
+    // hardware counters of the timed scopes by timing field, if the counters are enabled
+    std::map<std::string, PerfCounterValues> counters;
+
+    int statsCheck[CheckStatus::_END] = {};
+    int feasibility[CostInfo::MatchingValue::_END] = {};
+    int rejectionStage[CostInfo::STAGE_END] = {}; // unfeasible clusters by stage of the cost evaluation
+
+    // time of the moves by final status, with the time of each stage of the
+    // evaluation and the passes that fixed the overlaps summed by final status
+    LatencyHistogram moveTime[CheckStatus::_END];
+    double statusStageTime[CheckStatus::_END][MOVE_STAGE_END] = {};
+    int overlapFixes[CheckStatus::_END] = {};
+
+    int accept = 0;
+    int reject = 0;
+
+    int num_retry = 0;
+    int retry_success = 0;
+
+    long long arap_iterations = 0;
+    long long arap_solver_iterations = 0;
+    int arap_fallbacks = 0; // solves that did not run on the requested backend
+    int arap_parallel = 0; // solves on shells large enough for the parallel loops (see ParallelMinFaces())
+    int arap_dense = 0; // solves of small shells with the dense factorization
+    int arap_gpu = 0; // solves of large shells with compute shaders
+    int arap_early_pass = 0; // solves stopped by the adaptive budget within the distortion limits
+    int arap_early_fail = 0; // solves stopped by the adaptive budget with the distortion limits out of reach
+
+    int prescreen_pass = 0;
+    int prescreen_missed = 0; // predicted to pass, failed the distortion checks
+    int prescreen_audited = 0;
+    int prescreen_audited_hits = 0; // predicted to fail, failed the distortion checks
+    int prescreen_skipped = 0;
+
+    int raster_checks = 0;   // overlap checks of the optimization areas by rasterization
+    int raster_overlaps = 0; // rasterized checks that found overlapping texels
+    int raster_missed = 0;   // overlaps found by the rasterization and missed by the border intersections
+
+    int lazy_queued = 0;   // clusters queued with the estimate of their cost
+    int lazy_resolved = 0; // estimates that reached the top of the queue and were costed
+    int lazy_requeued = 0; // costed estimates that were no longer the cheapest move
+
+    int coincident_merged = 0;   // coincident seams stitched before the greedy loop
+    int coincident_deferred = 0; // coincident seams that failed the checks of the stitch
+
+    double mincost = 100000;
+    double maxcost = -1;
+
+    double min_energy = 10000000000;
+    double max_energy = 0;
+
+    /* Resets the counters of the moves, the timings and the cost ranges are kept */
+    void ClearCounters();
+
+    /* Adds the counters and the timings of other, which must not be updated
+     * concurrently. The timer is not changed */
+    void Merge(const AlgoStats& other);
+};
 
-    struct WeightedSeamCmp {
-        bool operator()(const WeightedSeam& a, const WeightedSeam& b)
-        {
-            return a.second > b.second;
-        }
-    };
+typedef int ClusterId;
+
+/* State of a cluster of seams. A record is active while the cluster is a move
+ * of the optimization, an inactive record only keeps the penalty of a cluster
+ * that can be evaluated again */
+struct ClusterRecord {
+    ClusteredSeamHandle csh; // nullptr if the slot is free
+    bool active = false;
+    double cost = 0;
+    double penalty = 1.0;
+    CheckStatus status = UNKNOWN;
+    MatchingTransform transform = MatchingTransform::Identity(); // the rigid matching computed for the move
+    CostInfo::MatchingValue mvalue = CostInfo::REJECTED;
+    bool estimated = false; // the cost is the estimate of AlgoParameters::lazyCostFactor, and the transform is not computed
+};
+
+/* Slot map of the cluster records, identified by their slot index (the slots of
+ * the released records are reused), with the clusters of each chart and of each
+ * endpoint (a vertex of the seam mesh) in flat vectors. Iterating the members of
+ * a chart does not look up the records by cluster handle, the only hash lookup
+ * is the one from the handle to the record id */
+class ClusterStore {
+
+public:
+
+    static constexpr ClusterId NONE = -1;
 
-    std::priority_queue<WeightedSeam, std::vector<WeightedSeam>, WeightedSeamCmp> queue;
-    std::unordered_map<ClusteredSeamHandle, double> cost;
-    std::unordered_map<ClusteredSeamHandle, double> penalty;
-    std::unordered_map<RegionID, std::set<ClusteredSeamHandle>> chartSeamMap;
+    /* Returns the id of the record of the cluster, or NONE if it has no record */
+    ClusterId Find(const ClusteredSeamHandle& csh) const;
 
-    std::map<ClusteredSeamHandle, CheckStatus> status;
+    /* Returns the id of the record of the cluster, adding an inactive record with
+     * unit penalty if it has none */
+    ClusterId Acquire(const ClusteredSeamHandle& csh);
 
-    std::map<int, std::set<ClusteredSeamHandle>> emap; // endpoint -> seams map
+    /* Frees the record, the cluster must not be a member of any chart or endpoint */
+    void Release(ClusterId id);
 
-    std::unordered_map<ClusteredSeamHandle, MatchingTransform> transform; // the rigid matching computed for each currently active move
-    std::unordered_map<ClusteredSeamHandle, CostInfo::MatchingValue> mvalue;
+    ClusterRecord& operator[](ClusterId id) { return records[id]; }
+    const ClusterRecord& operator[](ClusterId id) const { return records[id]; }
+
+    /* Number of slots, the ids of the records are smaller than this */
+    int Slots() const { return (int) records.size(); }
+
+    /* Number of records */
+    std::size_t Size() const { return index.size(); }
+
+    /* The clusters of the chart, the insertion of a member is ignored if it is
+     * already present and its removal if it is missing */
+    const std::vector<ClusterId>& ChartClusters(RegionID id) const;
+    void InsertChartCluster(RegionID id, ClusterId cid);
+    void EraseChartCluster(RegionID id, ClusterId cid);
+    void ClearChartClusters(RegionID id);
+    int ChartSlots() const { return (int) chartClusters.size(); }
+
+    /* The clusters of the endpoint, EraseEndpointCluster() returns false if the
+     * cluster was not a member */
+    const std::vector<ClusterId>& EndpointClusters(int vi) const;
+    void InsertEndpointCluster(int vi, ClusterId cid);
+    bool EraseEndpointCluster(int vi, ClusterId cid);
+    int EndpointSlots() const { return (int) endpointClusters.size(); }
+
+    void Clear();
+
+    std::size_t MemoryBytes() const;
+
+private:
+
+    std::vector<ClusterRecord> records;
+    std::vector<ClusterId> freeSlots;
+    std::unordered_map<ClusteredSeamHandle, ClusterId> index;
+
+    std::vector<std::vector<ClusterId>> chartClusters;
+    std::vector<std::vector<ClusterId>> endpointClusters;
+};
+
+/* A move accepted by the greedy optimization, as recorded in the move log. The
+ * cluster is identified by the edges of the seam mesh and the faces by their index
+ * in the mesh, the faces are listed in the order of the optimization area */
+struct AcceptedMove {
+    std::vector<int> edges;              // sorted edges of the seam cluster
+    MatchingTransform transform;         // alignment of the two charts
+    double finalEnergy;                  // energy of the local optimization
+    std::vector<int> faces;              // faces of the optimization area
+    std::vector<vcg::Point2d> texcoords; // optimized tex coords, three per face
+};
+
+struct AlgoState {
+
+    IndexedHeap<ClusteredSeamHandle, double, std::hash<ClusteredSeamHandle>, ClusteredSeamOrder> queue; // the move with the lowest cost is at the top
+    ClusterStore clusters;
 
     std::unordered_map<RegionID, std::set<RegionID>> failed;
 
     SeamMesh sm;
-    std::set<Mesh::FacePointer> changeSet;
+    ElementSet<MeshFace> changeSet;
+
+    UVFaceGrid uvIndex; // spatial index of the committed face texture coordinates
 
     double arapNum;
     double arapDenom;
+    std::vector<double> faceArapNum; // contribution of each face to arapNum
 
     double inputUVBorderLength;
     double currentUVBorderLength;
+
+    mutable AlgoStats stats; // the checks that take a const state record their timings
+
+    std::vector<AcceptedMove> acceptedMoves; // recorded if AlgoParameters::moveLogFile is set
+
+    long long trackedBytes = 0; // bytes of the state added to the SeamState memory counter
+
+    ~AlgoState();
 };
 
 void PrepareMesh(Mesh& m, int *vndup);
-AlgoStateHandle InitializeState(GraphHandle graph, const AlgoParameters& algoParameters);
+
+/* Builds the state of the greedy optimization of the graph. If orientation is the
+ * outcome of the ReorientCharts() of the graph, its energy is used instead of being
+ * computed again */
+AlgoStateHandle InitializeState(GraphHandle graph, const AlgoParameters& algoParameters, const ChartOrientation *orientation = nullptr);
+
+/* Returns true if InitializeState() builds the same queue with the parameters a and
+ * b, so that a state initialized with a can be optimized with b */
+bool SameQueueParameters(const AlgoParameters& a, const AlgoParameters& b);
+
 void GreedyOptimization(GraphHandle graph, AlgoStateHandle state, const AlgoParameters& params);
+
+/* Repeats the moves of the log recorded by a previous GreedyOptimization() of the
+ * same prepared input mesh with the same parameters, on the state returned by
+ * InitializeState(). The candidate moves are not evaluated and the optimized tex
+ * coords are restored from the log. Returns false if the log cannot be read or
+ * does not match the optimization, in which case the mesh may be left with the
+ * moves replayed so far */
+bool ReplayOptimization(GraphHandle graph, AlgoStateHandle state, const AlgoParameters& params, const std::string& path);
+
+/* Counts the vertices referenced by the faces (in vndup), welds the vertices with
+ * the same position, removes the unreferenced ones and compacts the vertex vector */
 void Finalize(GraphHandle graph, const std::string& outname, int *vndup);
 
 
@@ -25,14 +25,19 @@
 
 #include <vcg/complex/algorithms/clean.h>
 
+#include <numeric>
+
 
 static void SortSeam(SeamHandle seam);
 static int NextNotVisitedEdge(const SeamMesh& sm, const std::vector<int>& edges);
 
 static inline PosF GetDualPos(Mesh& m, const PosF& pos, Mesh::PerFaceAttributeHandle<FF>& ffadj);
+static inline bool OwnsSeamEdge(Mesh& m, int fi, int i, Mesh::PerFaceAttributeHandle<FF>& ffadj);
+static inline int FindRoot(std::vector<int>& parent, int i);
+static DenseIndexMap& VisitedMap();
 
 
-ChartPair GetCharts(ClusteredSeamHandle csh, GraphHandle graph, bool *swapped)
+ChartPair GetCharts(const ClusteredSeamHandle& csh, GraphHandle graph, bool *swapped)
 {
     ensure(csh->size() > 0);
 
@@ -52,11 +57,11 @@ ChartPair GetCharts(ClusteredSeamHandle csh, GraphHandle graph, bool *swapped)
     return p;
 }
 
-std::set<int> GetEndpoints(ClusteredSeamHandle csh)
+std::set<int> GetEndpoints(const ClusteredSeamHandle& csh)
 {
     // count occurrences and extract real endpoints
     std::map<int, int> endpoints;
-    for (SeamHandle sh : csh->seams) {
+    for (const SeamHandle& sh : csh->seams) {
         for (int e : sh->endpoints)
             endpoints[e]++;
     }
@@ -70,22 +75,24 @@ std::set<int> GetEndpoints(ClusteredSeamHandle csh)
     return es;
 }
 
-void ColorizeSeam(ClusteredSeamHandle csh, const vcg::Color4b& color)
+void ColorizeSeam(const ClusteredSeamHandle& csh, const vcg::Color4b& color)
 {
     for (auto sh : csh->seams)
         ColorizeSeam(sh, color);
 }
 
-void ColorizeSeam(SeamHandle sh, const vcg::Color4b& color)
+void ColorizeSeam(const SeamHandle& sh, const vcg::Color4b& color)
 {
     SeamMesh& sm = sh->sm;
+    if (!sm.hasFaceColor)
+        return;
     for (int e : sh->edges) {
-        sm.edge[e].fa->C() = color;
-        sm.edge[e].fb->C() = color;
+        sm.faceColor[sm.edge[e].fa] = color;
+        sm.faceColor[sm.edge[e].fb] = color;
     }
 }
 
-double ComputeSeamLength3D(ClusteredSeamHandle csh)
+double ComputeSeamLength3D(const ClusteredSeamHandle& csh)
 {
     ensure(csh->size() > 0);
     double l = 0;
@@ -94,7 +101,7 @@ double ComputeSeamLength3D(ClusteredSeamHandle csh)
     return l;
 }
 
-double ComputeSeamLength3D(SeamHandle sh)
+double ComputeSeamLength3D(const SeamHandle& sh)
 {
     double l = 0;
     SeamMesh& sm = sh->sm;
@@ -103,11 +110,17 @@ double ComputeSeamLength3D(SeamHandle sh)
     return l;
 }
 
+SeamVisitedSet::SeamVisitedSet(const SeamMesh& sm)
+    : base{sm.parent->vert.data()}, map{VisitedMap()}
+{
+    map.Reset(0, int(sm.parent->vert.size()) - 1);
+}
+
 // ASSUMPTION: the mesh is coherently oriented in 3D and UV space
-void ExtractUVCoordinates(ClusteredSeamHandle csh, std::vector<Point2d>& uva, std::vector<Point2d>& uvb, const std::unordered_set<RegionID> &a)
+void ExtractUVCoordinates(const ClusteredSeamHandle& csh, std::vector<Point2d>& uva, std::vector<Point2d>& uvb, const std::unordered_set<RegionID> &a)
 {
-    std::unordered_set<Mesh::VertexPointer> visited;
-    for (SeamHandle sh : csh->seams) {
+    SeamVisitedSet visited(csh->sm);
+    for (const SeamHandle& sh : csh->seams) {
         SeamMesh& seamMesh = sh->sm;
         for (int iedge : sh->edges) {
             SeamEdge& edge = seamMesh.edge[iedge];
@@ -119,15 +132,15 @@ void ExtractUVCoordinates(ClusteredSeamHandle csh, std::vector<Point2d>& uva, st
                 std::swap(fa, fb);
                 std::swap(ea, eb);
             }
-            if ((visited.count(fa->V0(ea)) == 0) || (visited.count(fb->V1(eb)) == 0)) {
-                visited.insert(fa->V0(ea));
-                visited.insert(fb->V1(eb));
+            if (!visited.Contains(fa->V0(ea)) || !visited.Contains(fb->V1(eb))) {
+                visited.Insert(fa->V0(ea));
+                visited.Insert(fb->V1(eb));
                 uva.push_back(fa->V0(ea)->T().P());
                 uvb.push_back(fb->V1(eb)->T().P());
             }
-            if ((visited.count(fa->V1(ea)) == 0) || (visited.count(fb->V0(eb)) == 0)) {
-                visited.insert(fa->V1(ea));
-                visited.insert(fb->V0(eb));
+            if (!visited.Contains(fa->V1(ea)) || !visited.Contains(fb->V0(eb))) {
+                visited.Insert(fa->V1(ea));
+                visited.Insert(fb->V0(eb));
                 uva.push_back(fa->V1(ea)->T().P());
                 uvb.push_back(fb->V0(eb)->T().P());
             }
@@ -135,33 +148,127 @@ void ExtractUVCoordinates(ClusteredSeamHandle csh, std::vector<Point2d>& uva, st
     }
 }
 
+void ExtractUVCoordinates(const ClusteredSeamHandle& csh, MatchingPointSet& points, const std::unordered_set<RegionID> &a)
+{
+    SeamVisitedSet visited(csh->sm);
+    for (const SeamHandle& sh : csh->seams) {
+        SeamMesh& seamMesh = sh->sm;
+        for (int iedge : sh->edges) {
+            SeamEdge& edge = seamMesh.edge[iedge];
+            Mesh::FacePointer fa = edge.fa;
+            Mesh::FacePointer fb = edge.fb;
+            int ea = edge.ea;
+            int eb = edge.eb;
+            if (a.find(edge.fa->id) == a.end()) {
+                std::swap(fa, fb);
+                std::swap(ea, eb);
+            }
+            if (!visited.Contains(fa->V0(ea)) || !visited.Contains(fb->V1(eb))) {
+                visited.Insert(fa->V0(ea));
+                visited.Insert(fb->V1(eb));
+                points.push_back(fa->V0(ea)->T().P(), fb->V1(eb)->T().P());
+            }
+            if (!visited.Contains(fa->V1(ea)) || !visited.Contains(fb->V0(eb))) {
+                visited.Insert(fa->V1(ea));
+                visited.Insert(fb->V0(eb));
+                points.push_back(fa->V1(ea)->T().P(), fb->V0(eb)->T().P());
+            }
+        }
+    }
+}
+
 void BuildSeamMesh(Mesh& m, SeamMesh& seamMesh)
 {
     seamMesh.Clear();
+    seamMesh.parent = &m;
+
+    seamMesh.hasFaceColor = HasFaceColorAttribute(m);
+    if (seamMesh.hasFaceColor)
+        seamMesh.faceColor = GetFaceColorAttribute(m);
 
     auto ffadj = Get3DFaceAdjacencyAttribute(m);
 
-    seamMesh.Clear();
-    tri::UpdateFlags<Mesh>::FaceClearFaceEdgeS(m);
-    for (auto& f : m.face) {
+    const int fn = (int) m.face.size();
+
+    // count the seam edges of each face, and compute their offsets in the edge vector
+    std::vector<int> offset(fn + 1, 0);
+    #pragma omp parallel for schedule(static)
+    for (int fi = 0; fi < fn; ++fi) {
+        int n = 0;
+        for (int i = 0; i < 3; ++i)
+            if (OwnsSeamEdge(m, fi, i, ffadj))
+                n++;
+        offset[fi + 1] = n;
+    }
+    std::partial_sum(offset.begin(), offset.end(), offset.begin());
+
+    const int en = offset[fn];
+
+    // collect the face-edge pairs of the seam edges
+    std::vector<std::pair<PosF, PosF>> sides(en);
+    #pragma omp parallel for schedule(static)
+    for (int fi = 0; fi < fn; ++fi) {
+        int k = offset[fi];
         for (int i = 0; i < 3; ++i) {
-            if (face::IsBorder(f, i) && f.IsFaceEdgeS(i) == false){
-                PosF pa(&f, i);
+            if (OwnsSeamEdge(m, fi, i, ffadj)) {
+                PosF pa(&m.face[fi], i);
                 PosF pb = GetDualPos(m, pa, ffadj);
                 if (pa.F()->id > pb.F()->id)
                     std::swap(pa, pb);
-                auto ei = tri::Allocator<SeamMesh>::AddEdge(seamMesh, pa.V()->P(), pa.VFlip()->P());
-                ei->fa = pa.F();
-                ei->ea = pa.E();
-                ei->fb = pb.F();
-                ei->eb = pb.E();
-                pa.F()->SetFaceEdgeS(pa.E());
-                pb.F()->SetFaceEdgeS(pb.E());
+                sides[k++] = std::make_pair(pa, pb);
+            }
+        }
+    }
+
+    // weld the vertices on the two sides of each seam edge, which are copies of
+    // the same vertex of the uncut mesh
+    std::vector<int> parent(m.vert.size());
+    std::iota(parent.begin(), parent.end(), 0);
+    for (const auto& side : sides) {
+        const PosF& pa = side.first;
+        const PosF& pb = side.second;
+        Mesh::VertexPointer vb0 = pb.V();
+        Mesh::VertexPointer vb1 = pb.VFlip();
+        if (pa.V()->P() != vb0->P())
+            std::swap(vb0, vb1);
+        parent[FindRoot(parent, tri::Index(m, pa.V()))] = FindRoot(parent, tri::Index(m, vb0));
+        parent[FindRoot(parent, tri::Index(m, pa.VFlip()))] = FindRoot(parent, tri::Index(m, vb1));
+    }
+
+    // assign the seam vertices in order of first reference
+    std::vector<int> vid(m.vert.size(), -1);
+    std::vector<Mesh::VertexPointer> vsrc;
+    std::vector<int> ev(2 * en);
+    for (int k = 0; k < en; ++k) {
+        Mesh::VertexPointer v[2] = { sides[k].first.V(), sides[k].first.VFlip() };
+        for (int j = 0; j < 2; ++j) {
+            int r = FindRoot(parent, tri::Index(m, v[j]));
+            if (vid[r] == -1) {
+                vid[r] = (int) vsrc.size();
+                vsrc.push_back(v[j]);
             }
+            ev[2 * k + j] = vid[r];
         }
     }
 
-    tri::Clean<SeamMesh>::RemoveDuplicateVertex(seamMesh);
+    tri::Allocator<SeamMesh>::AddVertices(seamMesh, vsrc.size());
+    tri::Allocator<SeamMesh>::AddEdges(seamMesh, en);
+
+    #pragma omp parallel for schedule(static)
+    for (int i = 0; i < (int) vsrc.size(); ++i)
+        seamMesh.vert[i].P() = vsrc[i]->P();
+
+    #pragma omp parallel for schedule(static)
+    for (int k = 0; k < en; ++k) {
+        SeamEdge& e = seamMesh.edge[k];
+        e.V(0) = &seamMesh.vert[ev[2 * k]];
+        e.V(1) = &seamMesh.vert[ev[2 * k + 1]];
+        e.fa = sides[k].first.F();
+        e.ea = sides[k].first.E();
+        e.fb = sides[k].second.F();
+        e.eb = sides[k].second.E();
+    }
+
     tri::UpdateTopology<SeamMesh>::VertexEdge(seamMesh);
     tri::UpdateTopology<SeamMesh>::EdgeEdge(seamMesh);
 }
@@ -175,8 +282,11 @@ std::vector<SeamHandle> GenerateSeams(SeamMesh& seamMesh)
     tri::UpdateFlags<SeamMesh>::VertexClearV(seamMesh);
     tri::UpdateFlags<SeamMesh>::EdgeClearV(seamMesh);
 
+    // the star vectors are reused by all the queries
+    std::vector<SeamMesh::EdgePointer> starVec;
+    std::vector<SeamMesh::EdgePointer> eptrStarVec;
+
     for (auto& v : seamMesh.vert) {
-        std::vector<SeamMesh::EdgePointer> starVec;
         edge::VEStarVE(&v, starVec);
         for (auto startEdge : starVec) {
             // if the edge was already visited or was on the border of the mesh, skip
@@ -186,7 +296,7 @@ std::vector<SeamHandle> GenerateSeams(SeamMesh& seamMesh)
 
             std::pair<RegionID, RegionID> chartPair = std::make_pair(startEdge->fa->id, startEdge->fb->id);
 
-            SeamHandle seam = std::make_shared<Seam>(seamMesh);
+            SeamHandle seam = SeamHandle::Make(seamMesh);
             startEdge->SetV();
             std::stack<SeamMesh::EdgePointer> s;
             s.push(startEdge);
@@ -195,7 +305,6 @@ std::vector<SeamHandle> GenerateSeams(SeamMesh& seamMesh)
                 s.pop();
                 seam->edges.push_back(tri::Index(seamMesh, eptr));
                 for (int i = 0; i < 2; ++i) {
-                    std::vector<SeamMesh::EdgePointer> eptrStarVec;
                     edge::VEStarVE(eptr->V(i), eptrStarVec);
 
                     // test edge case where the seam traverses a non-manif vert adjacent to multiple charts
@@ -244,14 +353,14 @@ std::vector<ClusteredSeamHandle> ClusterSeamsByChartId(const std::vector<SeamHan
         SeamEdge e = sm.edge[sh->edges.front()];
         std::pair<RegionID, RegionID> idpair(e.fa->id, e.fb->id);
         if (idpair.first == idpair.second) {
-            ClusteredSeamHandle csh = std::make_shared<ClusteredSeam>(sm);
+            ClusteredSeamHandle csh = ClusteredSeamHandle::Make(sm);
             csh->seams.push_back(sh);
             cshvec.push_back(csh);
         } else {
             if (idpair.first > idpair.second)
                 std::swap(idpair.first, idpair.second);
             if (cshmap.find(idpair) == cshmap.end()) {
-                cshmap[idpair] = std::make_shared<ClusteredSeam>(sm);
+                cshmap[idpair] = ClusteredSeamHandle::Make(sm);
                 cshvec.push_back(cshmap[idpair]);
             }
             cshmap[idpair]->seams.push_back(sh);
@@ -266,9 +375,9 @@ ClusteredSeamHandle Flatten(const std::vector<ClusteredSeamHandle>& cshVec)
     if (cshVec.size() == 0)
         return nullptr;
 
-    ClusteredSeamHandle out = std::make_shared<ClusteredSeam>(cshVec.front()->sm);
+    ClusteredSeamHandle out = ClusteredSeamHandle::Make(cshVec.front()->sm);
     for (ClusteredSeamHandle csh : cshVec)
-        for (SeamHandle sh : csh->seams)
+        for (const SeamHandle& sh : csh->seams)
             out->seams.push_back(sh);
 
     return out;
@@ -323,3 +432,30 @@ static inline PosF GetDualPos(Mesh& m, const PosF& pos, Mesh::PerFaceAttributeHa
     dual.FlipV();
     return dual;
 }
+
+/* The seam edge shared by the face-edge pairs (f, i) and (g, j) is owned by the
+ * pair that comes first in the face order, so that each edge is added once */
+static inline bool OwnsSeamEdge(Mesh& m, int fi, int i, Mesh::PerFaceAttributeHandle<FF>& ffadj)
+{
+    Mesh::FacePointer fp = &m.face[fi];
+    if (!face::IsBorder(*fp, i))
+        return false;
+    int gi = ffadj[fp].f[i];
+    int j = ffadj[fp].e[i];
+    return fi < gi || (fi == gi && i <= j);
+}
+
+static inline int FindRoot(std::vector<int>& parent, int i)
+{
+    while (parent[i] != i) {
+        parent[i] = parent[parent[i]];
+        i = parent[i];
+    }
+    return i;
+}
+
+static DenseIndexMap& VisitedMap()
+{
+    static thread_local DenseIndexMap visitedMap;
+    return visitedMap;
+}
@@ -27,6 +27,8 @@
 
 #include "types.h"
 #include "mesh_graph.h"
+#include "matching.h"
+#include "dense_index_map.h"
 
 struct Seam {
     SeamMesh& sm;
@@ -37,25 +39,85 @@ struct Seam {
 };
 
 struct ClusteredSeam {
+
+    /* Quantities derived by ComputeCost() from the tex coords along the seam. They
+     * are valid as long as the seams are unchanged and the two charts still have
+     * the recorded ids and parameterization versions (see FaceGroup::version). The
+     * matching is only computed for the seams that pass the boundary test */
+    struct CostCache {
+        bool valid;
+        bool hasMatching;
+        RegionID a;
+        RegionID b;
+        unsigned long versionA;
+        unsigned long versionB;
+        MatchingTransform matching;
+        double totalError; // total matching error of the extracted uv coordinates
+        int numPoints;     // number of extracted uv coordinates
+        double boundaryA;  // uv length of the seam on chart a
+        double boundaryB;  // uv length of the seam on chart b
+    };
+
     SeamMesh& sm;
     std::vector<SeamHandle> seams;
 
-    ClusteredSeam(SeamMesh& m) : sm{m} {}
+    CostCache costCache;
+
+    ClusteredSeam(SeamMesh& m) : sm{m}, costCache{} {}
     std::size_t size() { return seams.size(); }
     SeamHandle at(int i) { return seams.at(i); }
 };
 
-ChartPair GetCharts(ClusteredSeamHandle csh, GraphHandle graph, bool *swapped = nullptr);
-std::set<int> GetEndpoints(ClusteredSeamHandle csh);
+/* Orders the clusters by the first edge of their first seam. The seams of distinct
+ * clusters are disjoint, so unlike the order of the handles (by address) this order
+ * is the same in every run */
+struct ClusteredSeamOrder {
+    bool operator()(const ClusteredSeamHandle& a, const ClusteredSeamHandle& b) const
+    {
+        return a->seams.front()->edges.front() < b->seams.front()->edges.front();
+    }
+};
+
+/* Set of the parent mesh vertices visited by a seam traversal, indexed by the vertex
+ * index in the parent mesh of the seam mesh. The storage is a per-thread map that is
+ * shared by all the sets, so at most one set per thread can be alive at any time */
+class SeamVisitedSet {
+
+public:
+
+    explicit SeamVisitedSet(const SeamMesh& sm);
+
+    bool Contains(Mesh::ConstVertexPointer vp) const
+    {
+        return map.Get(int(vp - base)) != -1;
+    }
+
+    void Insert(Mesh::ConstVertexPointer vp)
+    {
+        map.Set(int(vp - base), 1);
+    }
+
+private:
+
+    Mesh::ConstVertexPointer base;
+    DenseIndexMap& map;
+};
+
+ChartPair GetCharts(const ClusteredSeamHandle& csh, GraphHandle graph, bool *swapped = nullptr);
+std::set<int> GetEndpoints(const ClusteredSeamHandle& csh);
 
-void ColorizeSeam(ClusteredSeamHandle csh, const vcg::Color4b& color);
-void ColorizeSeam(SeamHandle sh, const vcg::Color4b& color);
+/* Colors the faces along the seam, if the mesh has the face color attribute */
+void ColorizeSeam(const ClusteredSeamHandle& csh, const vcg::Color4b& color);
+void ColorizeSeam(const SeamHandle& sh, const vcg::Color4b& color);
 
-double ComputeSeamLength3D(ClusteredSeamHandle csh);
-double ComputeSeamLength3D(SeamHandle sh);
+double ComputeSeamLength3D(const ClusteredSeamHandle& csh);
+double ComputeSeamLength3D(const SeamHandle& sh);
 
 // a is a set of ids that logically describe one side of the seam (whose coordinates are inserted in uva)
-void ExtractUVCoordinates(ClusteredSeamHandle csh, std::vector<Point2d>& uva, std::vector<Point2d>& uvb, const std::unordered_set<RegionID>& a);
+void ExtractUVCoordinates(const ClusteredSeamHandle& csh, std::vector<Point2d>& uva, std::vector<Point2d>& uvb, const std::unordered_set<RegionID>& a);
+
+// same as above, but the coordinates are appended to the SoA buffers of the point set
+void ExtractUVCoordinates(const ClusteredSeamHandle& csh, MatchingPointSet& points, const std::unordered_set<RegionID>& a);
 
 void BuildSeamMesh(Mesh& m, SeamMesh& seamMesh);
 std::vector<SeamHandle> GenerateSeams(SeamMesh& seamMesh);
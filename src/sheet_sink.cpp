@@ -0,0 +1,237 @@
+/*******************************************************************************
+    Copyright (c) 2021, Andrea Maggiordomo, Paolo Cignoni and Marco Tarini
+
+    This file is part of TextureDefrag, a reference implementation for
+    the paper ``Texture Defragmentation for Photo-Reconstructed 3D Models''
+    by Andrea Maggiordomo, Paolo Cignoni and Marco Tarini.
+
+    TextureDefrag is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    TextureDefrag is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with TextureDefrag. If not, see <https://www.gnu.org/licenses/>.
+*******************************************************************************/
+
+
+#include "sheet_sink.h"
+#include "logging.h"
+
+#include <algorithm>
+#include <cstring>
+#include <cerrno>
+#include <thread>
+#include <chrono>
+#include <mutex>
+#include <map>
+
+#include <QImage>
+
+#ifdef __linux__
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+class CallbackSheetSink : public SheetSink {
+
+public:
+
+    explicit CallbackSheetSink(SheetCallback callback) : callback{callback} {}
+
+    void BeginSheet(int sheet, const std::string& name, int width, int height) override
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        sheets[sheet] = { name, width, height };
+    }
+
+    void WriteBand(int sheet, int firstRow, const QImage& band) override
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        const SheetInfo& info = sheets.at(sheet);
+        callback({ sheet, &info.name, info.width, info.height, firstRow, band.height(), std::size_t(band.bytesPerLine()), band.constBits(), false });
+    }
+
+    void EndSheet(int sheet) override
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        const SheetInfo& info = sheets.at(sheet);
+        callback({ sheet, &info.name, info.width, info.height, info.height, 0, std::size_t(info.width) * 4, nullptr, true });
+        sheets.erase(sheet);
+    }
+
+private:
+
+    struct SheetInfo {
+        std::string name;
+        int width;
+        int height;
+    };
+
+    SheetCallback callback;
+    std::mutex mtx;
+    std::map<int, SheetInfo> sheets;
+};
+
+std::shared_ptr<SheetSink> CreateCallbackSheetSink(SheetCallback callback)
+{
+    return std::make_shared<CallbackSheetSink>(callback);
+}
+
+#ifdef __linux__
+
+class SharedMemorySheetSink : public SheetSink {
+
+public:
+
+    SharedMemorySheetSink(const std::string& name, void *base, std::size_t size)
+        : name{name}, base{static_cast<unsigned char *>(base)}, size{size}, header{static_cast<SheetRingHeader *>(base)}
+    {
+    }
+
+    ~SharedMemorySheetSink()
+    {
+        __atomic_store_n(&header->closed, 1u, __ATOMIC_RELEASE);
+        // the consumer maps the object by name, it is only unlinked once it has read everything
+        LOG_VERBOSE << "Waiting for the consumer of " << name << " to read the sheets left";
+        while (__atomic_load_n(&header->tail, __ATOMIC_ACQUIRE) < header->head)
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        munmap(base, size);
+        shm_unlink(name.c_str());
+    }
+
+    void BeginSheet(int sheet, const std::string& name, int width, int height) override
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        sheets[sheet] = { name, width, height };
+    }
+
+    void WriteBand(int sheet, int firstRow, const QImage& band) override
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        const SheetInfo& info = sheets.at(sheet);
+        const std::size_t rowBytes = std::size_t(band.width()) * 4;
+        const int slotRows = int((header->slotBytes - sizeof(SheetSlotHeader)) / rowBytes);
+        if (slotRows == 0) {
+            LOG_ERR << "The rows of " << info.name << " do not fit the slots of " << name << ", the sheet is not published";
+            return;
+        }
+        for (int r = 0; r < band.height(); r += slotRows) {
+            int rows = std::min(slotRows, band.height() - r);
+            SheetSlotHeader *slot = AcquireSlot();
+            FillSlotHeader(slot, sheet, info, firstRow + r, rows, false);
+            unsigned char *dst = reinterpret_cast<unsigned char *>(slot + 1);
+            for (int k = 0; k < rows; ++k)
+                std::memcpy(dst + k * rowBytes, band.constScanLine(r + k), rowBytes);
+            PublishSlot();
+        }
+    }
+
+    void EndSheet(int sheet) override
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        const SheetInfo& info = sheets.at(sheet);
+        SheetSlotHeader *slot = AcquireSlot();
+        FillSlotHeader(slot, sheet, info, info.height, 0, true);
+        PublishSlot();
+        sheets.erase(sheet);
+    }
+
+private:
+
+    struct SheetInfo {
+        std::string name;
+        int width;
+        int height;
+    };
+
+    // waits for the slot at the head of the ring to be free
+    SheetSlotHeader *AcquireSlot()
+    {
+        uint64_t head = header->head;
+        while (head - __atomic_load_n(&header->tail, __ATOMIC_ACQUIRE) >= header->slotCount)
+            std::this_thread::sleep_for(std::chrono::microseconds(200));
+        return reinterpret_cast<SheetSlotHeader *>(base + sizeof(SheetRingHeader) + (head % header->slotCount) * header->slotBytes);
+    }
+
+    void PublishSlot()
+    {
+        __atomic_store_n(&header->head, header->head + 1, __ATOMIC_RELEASE);
+    }
+
+    static void FillSlotHeader(SheetSlotHeader *slot, int sheet, const SheetInfo& info, int firstRow, int rows, bool last)
+    {
+        std::memset(slot->name, 0, sizeof(slot->name));
+        std::strncpy(slot->name, info.name.c_str(), sizeof(slot->name) - 1);
+        slot->sheet = sheet;
+        slot->width = info.width;
+        slot->height = info.height;
+        slot->firstRow = firstRow;
+        slot->rows = rows;
+        slot->last = last ? 1 : 0;
+        slot->bytes = uint64_t(rows) * uint64_t(info.width) * 4;
+    }
+
+    std::string name;
+    unsigned char *base;
+    std::size_t size;
+    SheetRingHeader *header;
+    std::mutex mtx;
+    std::map<int, SheetInfo> sheets;
+};
+
+std::shared_ptr<SheetSink> CreateSharedMemorySheetSink(const std::string& name, int slotCount, std::size_t slotBytes)
+{
+    if (slotCount <= 0 || slotBytes <= sizeof(SheetSlotHeader)) {
+        LOG_ERR << "Invalid size of the shared memory ring " << name;
+        return nullptr;
+    }
+    // the object names are absolute
+    std::string shmName = (name.empty() || name[0] != '/') ? "/" + name : name;
+    int fd = shm_open(shmName.c_str(), O_CREAT | O_RDWR | O_TRUNC, 0600);
+    if (fd == -1) {
+        LOG_ERR << "Unable to create the shared memory object " << shmName << ": " << std::strerror(errno);
+        return nullptr;
+    }
+    std::size_t size = sizeof(SheetRingHeader) + std::size_t(slotCount) * slotBytes;
+    void *base = MAP_FAILED;
+    if (ftruncate(fd, off_t(size)) == 0)
+        base = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    int err = errno;
+    close(fd);
+    if (base == MAP_FAILED) {
+        LOG_ERR << "Unable to map " << (size >> 20) << " MB of the shared memory object " << shmName << ": " << std::strerror(err);
+        shm_unlink(shmName.c_str());
+        return nullptr;
+    }
+
+    SheetRingHeader *header = static_cast<SheetRingHeader *>(base);
+    std::memset(header, 0, sizeof(SheetRingHeader));
+    header->version = SHEET_RING_VERSION;
+    header->slotCount = uint32_t(slotCount);
+    header->slotBytes = slotBytes;
+    // the magic is written last, the consumer waits for it before reading the header
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    std::memcpy(header->magic, "TDSHEETS", 8);
+
+    LOG_INFO << "Publishing the texture sheets in the shared memory object " << shmName << " (" << slotCount << " slots of "
+             << (slotBytes >> 20) << " MB)";
+    return std::make_shared<SharedMemorySheetSink>(shmName, base, size);
+}
+
+#else
+
+std::shared_ptr<SheetSink> CreateSharedMemorySheetSink(const std::string& name, int, std::size_t)
+{
+    LOG_ERR << "Unable to create the shared memory object " << name << ": only implemented on Linux";
+    return nullptr;
+}
+
+#endif
@@ -0,0 +1,116 @@
+/*******************************************************************************
+    Copyright (c) 2021, Andrea Maggiordomo, Paolo Cignoni and Marco Tarini
+
+    This file is part of TextureDefrag, a reference implementation for
+    the paper ``Texture Defragmentation for Photo-Reconstructed 3D Models''
+    by Andrea Maggiordomo, Paolo Cignoni and Marco Tarini.
+
+    TextureDefrag is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    TextureDefrag is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with TextureDefrag. If not, see <https://www.gnu.org/licenses/>.
+*******************************************************************************/
+
+
+#ifndef SHEET_SINK_H
+#define SHEET_SINK_H
+
+#include <string>
+#include <memory>
+#include <functional>
+#include <cstdint>
+
+class QImage;
+
+/* Receives the rendered texture sheets instead of the image files, to hand the
+ * pixels to a consumer in the same process or on the same host without encoding
+ * and decoding them (see TextureSaveParameters::sheetSink). The sheets arrive as
+ * bands of rows, top to bottom, in the layout of QImage::Format_ARGB32 (BGRA bytes
+ * on little endian machines). The bands of a sheet are passed in order, but the
+ * sheets rendered by several contexts are interleaved, so the methods can be
+ * called concurrently and must be thread safe */
+class SheetSink {
+
+public:
+
+    virtual ~SheetSink() {}
+
+    /* Starts the sheet of the given index, name (the file name it would be saved
+     * with, see TextureSheetNames) and size */
+    virtual void BeginSheet(int sheet, const std::string& name, int width, int height) = 0;
+
+    /* Passes the rows [firstRow, firstRow + band.height()) of the sheet. The band is
+     * only valid during the call */
+    virtual void WriteBand(int sheet, int firstRow, const QImage& band) = 0;
+
+    /* Ends the sheet, after its last band */
+    virtual void EndSheet(int sheet) = 0;
+};
+
+/* The band of a sheet passed to a SheetCallback. The pixels are not copied and
+ * are only valid during the call */
+struct SheetBand {
+    int sheet;
+    const std::string *name;
+    int width;                  // of the sheet
+    int height;                 // of the sheet
+    int firstRow;
+    int rows;
+    std::size_t bytesPerLine;
+    const unsigned char *pixels;
+    bool last;                  // end of the sheet, a band of no rows
+};
+
+typedef std::function<void(const SheetBand&)> SheetCallback;
+
+/* Sink that passes the bands to a callback, under a lock (the callback is never
+ * called concurrently). The end of each sheet is passed as a band of no rows */
+std::shared_ptr<SheetSink> CreateCallbackSheetSink(SheetCallback callback);
+
+/* Sink that publishes the bands in a ring of slots in a POSIX shared memory object,
+ * read by a process on the same host. The object starts with a SheetRingHeader,
+ * followed by slotCount slots of slotBytes bytes, each a SheetSlotHeader followed by
+ * the pixels of rows * width * 4 bytes. The bands larger than a slot are split, and
+ * the end of each sheet is published as a slot of no rows with last set. The
+ * producer fills the slot head % slotCount and then increments head, the consumer
+ * reads the slot tail % slotCount and then increments tail; the producer waits while
+ * the ring is full. When the sink is destroyed it sets closed, waits for the
+ * consumer to read the slots left and unlinks the object. Only implemented on Linux,
+ * returns nullptr elsewhere or if the object cannot be created */
+std::shared_ptr<SheetSink> CreateSharedMemorySheetSink(const std::string& name, int slotCount, std::size_t slotBytes);
+
+constexpr uint32_t SHEET_RING_VERSION = 1;
+constexpr int SHEET_RING_DEFAULT_SLOTS = 8;
+constexpr std::size_t SHEET_RING_DEFAULT_SLOT_BYTES = std::size_t(64) << 20;
+
+struct SheetRingHeader {
+    char magic[8];              // "TDSHEETS"
+    uint32_t version;           // SHEET_RING_VERSION
+    uint32_t slotCount;
+    uint64_t slotBytes;
+    uint64_t head;              // slots published, written by the producer (atomic, release)
+    uint64_t tail;              // slots read, written by the consumer (atomic, release)
+    uint32_t closed;            // set by the producer after the last slot
+    uint32_t reserved;
+};
+
+struct SheetSlotHeader {
+    char name[256];             // file name of the sheet, null terminated (truncated if longer)
+    int32_t sheet;
+    int32_t width;
+    int32_t height;
+    int32_t firstRow;
+    int32_t rows;
+    int32_t last;               // 1 for the end of the sheet (a slot of no rows)
+    uint64_t bytes;             // of the pixels that follow the header
+};
+
+#endif // SHEET_SINK_H
@@ -25,15 +25,24 @@
 #include "logging.h"
 #include "mesh_graph.h"
 #include "mesh_attribute.h"
+#include "derived_data.h"
+#include "parallel_threshold.h"
+#include "dense_index_map.h"
 
 #include "timer.h"
 
 #include <vcg/complex/algorithms/hole.h>
 
 #include <vector>
+#include <array>
+#include <numeric>
+#include <limits>
+#include <unordered_map>
 
 
-static bool Build(Mesh& shell, FaceGroup& fg);
+static bool Build(Mesh& shell, FaceGroup& fg, ShellTopology& topology);
+static int FindRoot(std::vector<int>& parent, int i);
+static void Unite(std::vector<int>& parent, int i, int j);
 
 /*
  * Convention: s0 > s1
@@ -55,9 +64,12 @@ static bool Build(Mesh& shell, FaceGroup& fg);
  *      start making it smaller until we reach the target area
  *
  * */
-bool BuildShellWithTargetsFromUV(Mesh& shell, FaceGroup& fg, double downsamplingFactor)
+bool BuildShellWithTargetsFromUV(Mesh& shell, FaceGroup& fg, double downsamplingFactor, ShellTopology *topology)
 {
-    bool singleComponent = Build(shell, fg);
+    ShellTopology shellTopology;
+    bool singleComponent = Build(shell, fg, shellTopology);
+    if (topology)
+        *topology = shellTopology;
 
     auto ia_ = GetFaceIndexAttribute(shell);
     for (unsigned i = 0; i < fg.FN(); ++i) {
@@ -73,7 +85,10 @@ bool BuildShellWithTargetsFromUV(Mesh& shell, FaceGroup& fg, double downsampling
     auto tsa = GetTargetShapeAttribute(shell);
     auto wtcsa = GetWedgeTexCoordStorageAttribute(m);
 
-    for (auto& sf : shell.face) {
+    const int fn = shell.FN();
+    #pragma omp parallel for reduction(+:targetArea) if (fn >= ParallelMinFaces())
+    for (int i = 0; i < fn; ++i) {
+        auto& sf = shell.face[i];
         CoordStorage target;
         auto& f = m.face[ia[sf]];
 
@@ -90,6 +105,12 @@ bool BuildShellWithTargetsFromUV(Mesh& shell, FaceGroup& fg, double downsampling
             target.P[0] = vcg::Point3d(u0.X(), u0.Y(), 0) * downsamplingFactor;
             target.P[1] = vcg::Point3d(u1.X(), u1.Y(), 0) * downsamplingFactor;
             target.P[2] = vcg::Point3d(u2.X(), u2.Y(), 0) * downsamplingFactor;
+        } else if (downsamplingFactor == 1.0) {
+            // the generator is the input mapping itself, that takes the local
+            // frame of the face to the edges of the input wedge tex coords
+            target.P[0] = Point3d(0, 0, 0);
+            target.P[1] = Point3d(u10.X(), u10.Y(), 0);
+            target.P[2] = Point3d(u20.X(), u20.Y(), 0);
         } else {
             // Compute the matrix of the input mapping and its SVD
             Point2d x10;
@@ -100,12 +121,7 @@ bool BuildShellWithTargetsFromUV(Mesh& shell, FaceGroup& fg, double downsampling
             Eigen::Matrix2d U;
             Eigen::Matrix2d V;
             Eigen::Vector2d s;
-            Eigen::JacobiSVD<Eigen::Matrix2d> svd;
-            svd.compute(A, Eigen::ComputeFullU | Eigen::ComputeFullV);
-            U = svd.matrixU();
-            V = svd.matrixV();
-            s = svd.singularValues();
-            ensure(s[0] >= s[1]);
+            SVD2x2(A, U, s, V);
 
             // Compute the 'generator' matrix  and the target shape
             Eigen::Vector2d sNew;
@@ -127,13 +143,13 @@ bool BuildShellWithTargetsFromUV(Mesh& shell, FaceGroup& fg, double downsampling
         tsa[sf] = target;
         targetArea += ((target.P[1] - target.P[0]) ^ (target.P[2] - target.P[0])).Norm() / 2.0;
 
-        ensure(std::isfinite(targetArea));
-
         sa[sf].P[0] = sf.P(0);
         sa[sf].P[1] = sf.P(1);
         sa[sf].P[2] = sf.P(2);
     }
 
+    ensure(std::isfinite(targetArea));
+
     return singleComponent;
 }
 
@@ -201,7 +217,131 @@ void CloseHoles3D(Mesh& shell)
     }
 
     tri::UpdateTopology<Mesh>::FaceFace(shell);
-    tri::UpdateTopology<Mesh>::VertexFace(shell);
+    InvalidateDerivedData(shell, DERIVED_VERTEX_FACE);
+}
+
+int AddBoundaryScaffold(Mesh& shell, double width)
+{
+    struct BoundaryEdge {
+        int v0;
+        int v1;
+        double orientation; // sign of the UV area of the shell face of the edge
+    };
+
+    std::vector<BoundaryEdge> edges;
+    std::vector<int> boundaryVertex;
+    std::vector<vcg::Point2d> offsetDir; // sum of the outward normals of the edges of each boundary vertex
+    std::unordered_map<int, int> boundaryIndex;
+    auto AddNormal = [&](int v, const vcg::Point2d& n) {
+        auto it = boundaryIndex.find(v);
+        if (it == boundaryIndex.end()) {
+            boundaryIndex[v] = boundaryVertex.size();
+            boundaryVertex.push_back(v);
+            offsetDir.push_back(n);
+        } else {
+            offsetDir[it->second] += n;
+        }
+    };
+    double length = 0;
+    for (auto& sf : shell.face) {
+        for (int i = 0; i < 3; ++i) {
+            if (face::IsBorder(sf, i)) {
+                const vcg::Point2d& u0 = sf.V0(i)->T().P();
+                const vcg::Point2d& u1 = sf.V1(i)->T().P();
+                const vcg::Point2d& u2 = sf.V2(i)->T().P();
+                double orientation = (u1 - u0) ^ (u2 - u0);
+                vcg::Point2d e = u1 - u0;
+                double len = e.Norm();
+                if (len == 0 || orientation == 0)
+                    continue;
+
+                // the outward normal points away from the opposite vertex
+                vcg::Point2d n(e.Y(), -e.X());
+                if (n * (u2 - u0) > 0)
+                    n = -n;
+                n /= len;
+
+                BoundaryEdge be = { (int) tri::Index(shell, sf.V0(i)), (int) tri::Index(shell, sf.V1(i)), orientation };
+                edges.push_back(be);
+                AddNormal(be.v0, n);
+                AddNormal(be.v1, n);
+                length += len;
+            }
+        }
+    }
+
+    if (edges.empty())
+        return 0;
+
+    double offset = width * length / edges.size();
+
+    // the scaffold vertex of the k-th boundary vertex is vn + k
+    int vn = shell.VN();
+    auto vi = tri::Allocator<Mesh>::AddVertices(shell, boundaryVertex.size());
+    for (unsigned k = 0; k < boundaryVertex.size(); ++k) {
+        vcg::Point2d dir = offsetDir[k];
+        if (dir.Norm() > 0)
+            dir.Normalize();
+        vcg::Point2d uv = shell.vert[boundaryVertex[k]].T().P() + dir * offset;
+        vi->T().P() = uv;
+        vi->P() = vcg::Point3d(uv.X(), uv.Y(), 0);
+        ++vi;
+    }
+
+    // the scaffold faces of the edge v0 -> v1 are (v1, v0, s0) and (v1, s0, s1), which
+    // traverse the edge in the opposite direction of the shell face
+    std::vector<std::array<int, 3>> faces;
+    for (const auto& be : edges) {
+        int s0 = vn + boundaryIndex[be.v0];
+        int s1 = vn + boundaryIndex[be.v1];
+        std::array<int, 3> t[2] = { {be.v1, be.v0, s0}, {be.v1, s0, s1} };
+        for (int k = 0; k < 2; ++k) {
+            const vcg::Point2d& u0 = shell.vert[t[k][0]].T().P();
+            const vcg::Point2d& u1 = shell.vert[t[k][1]].T().P();
+            const vcg::Point2d& u2 = shell.vert[t[k][2]].T().P();
+            if (((u1 - u0) ^ (u2 - u0)) * be.orientation > 0)
+                faces.push_back(t[k]);
+        }
+    }
+
+    auto ia = GetFaceIndexAttribute(shell);
+    auto tsa = GetTargetShapeAttribute(shell);
+    auto sa = GetShell3DShapeAttribute(shell);
+
+    auto fi = tri::Allocator<Mesh>::AddFaces(shell, faces.size());
+    for (const auto& t : faces) {
+        auto& sf = *fi;
+        sf.SetScaffold();
+        ia[sf] = -1;
+        for (int i = 0; i < 3; ++i) {
+            sf.V(i) = &shell.vert[t[i]];
+            sf.WT(i) = sf.V(i)->T();
+            vcg::Point2d uv = sf.WT(i).P();
+            tsa[sf].P[i] = vcg::Point3d(uv.X(), uv.Y(), 0);
+            sa[sf].P[i] = tsa[sf].P[i];
+        }
+        ++fi;
+    }
+
+    tri::UpdateTopology<Mesh>::FaceFace(shell);
+    InvalidateDerivedData(shell, DERIVED_VERTEX_FACE);
+
+    return (int) faces.size();
+}
+
+/* The scaffold vertices are only referenced by scaffold faces, whose target
+ * shapes store the initial tex coords of their vertices */
+void RestoreBoundaryScaffold(Mesh& shell)
+{
+    auto tsa = GetTargetShapeAttribute(shell);
+    for (auto& sf : shell.face) {
+        if (sf.IsScaffold()) {
+            for (int i = 0; i < 3; ++i) {
+                sf.V(i)->T().P() = vcg::Point2d(tsa[sf].P[i].X(), tsa[sf].P[i].Y());
+                sf.WT(i) = sf.V(i)->T();
+            }
+        }
+    }
 }
 
 void SyncShellWithUV(Mesh& shell)
@@ -211,7 +351,7 @@ void SyncShellWithUV(Mesh& shell)
         v.P().Y() = v.T().V();
         v.P().Z() = 0.0;
     }
-    tri::UpdateBounding<Mesh>::Box(shell);
+    InvalidateDerivedData(shell, DERIVED_BOUNDING_BOX | DERIVED_NORMALS);
 }
 
 void SyncShellWith3D(Mesh& shell)
@@ -222,7 +362,7 @@ void SyncShellWith3D(Mesh& shell)
         for (int i = 0; i < 3; ++i)
             sf.P(i) = sa[sf].P[i];
     }
-    tri::UpdateBounding<Mesh>::Box(shell);
+    InvalidateDerivedData(shell, DERIVED_BOUNDING_BOX | DERIVED_NORMALS);
 }
 
 void ClearHoleFillingFaces(Mesh& shell, bool holefill, bool scaffold)
@@ -233,19 +373,232 @@ void ClearHoleFillingFaces(Mesh& shell, bool holefill, bool scaffold)
 
     tri::Clean<Mesh>::RemoveUnreferencedVertex(shell);
     tri::UpdateTopology<Mesh>::FaceFace(shell);
-    tri::UpdateTopology<Mesh>::VertexFace(shell);
+    InvalidateDerivedData(shell, DERIVED_VERTEX_FACE);
     tri::Allocator<Mesh>::CompactEveryVector(shell);
 }
 
-static bool Build(Mesh& shell, FaceGroup& fg)
+// -- static functions ---------------------------------------------------------
+
+/* Builds the shell directly from the topology of the parent mesh. The FF
+ * adjacency of the parent mesh already reflects the current parameterization
+ * (it is cut along the seams, and updated when the seams are merged), so each
+ * shell vertex is a fan of corners around a parent vertex that are connected
+ * through the shared edges of the chart faces. This is the same mesh that
+ * welding the faces in 3D, splitting the non-manifold vertices and cutting
+ * along the seams would produce, and the counts needed to check its topology
+ * are computed along the way. */
+static bool Build(Mesh& shell, FaceGroup& fg, ShellTopology& topology)
 {
-    CopyToMesh(fg, shell);
+    Mesh& m = fg.mesh;
+    const int fn = (int) fg.FN();
 
-    tri::Clean<Mesh>::RemoveDuplicateVertex(shell);
-    tri::Allocator<Mesh>::CompactEveryVector(shell);
+    shell.Clear();
+    auto ia = GetFaceIndexAttribute(shell);
 
-    tri::UpdateBounding<Mesh>::Box(shell);
-    tri::UpdateTopology<Mesh>::FaceFace(shell);
+    // the faces and the vertices of the chart are mapped to the shell with dense
+    // maps over their index ranges in the mesh, reused by the shells of the thread
+    static thread_local DenseIndexMap faceIndex;
+    static thread_local DenseIndexMap firstFan;
+    int flo = std::numeric_limits<int>::max();
+    int fhi = -1;
+    int vlo = std::numeric_limits<int>::max();
+    int vhi = -1;
+    for (int i = 0; i < fn; ++i) {
+        int f = (int) tri::Index(m, fg.fpVec[i]);
+        flo = std::min(flo, f);
+        fhi = std::max(fhi, f);
+        for (int k = 0; k < 3; ++k) {
+            int v = (int) tri::Index(m, fg.fpVec[i]->V(k));
+            vlo = std::min(vlo, v);
+            vhi = std::max(vhi, v);
+        }
+    }
+    faceIndex.Reset(flo, fhi);
+    firstFan.Reset(vlo, vhi);
+    for (int i = 0; i < fn; ++i)
+        faceIndex.Set((int) tri::Index(m, fg.fpVec[i]), i);
+
+    // An edge is shared only if the parent adjacency is mutual and the two
+    // faces reference the same vertices, anything else is a border
+    std::vector<int> ffp(3 * fn, -1);
+    std::vector<int> ffi(3 * fn, -1);
+    std::vector<int> corner(3 * fn);
+    std::iota(corner.begin(), corner.end(), 0);
+    for (int i = 0; i < fn; ++i) {
+        Mesh::FacePointer fp = fg.fpVec[i];
+        for (int k = 0; k < 3; ++k) {
+            Mesh::FacePointer gp = fp->FFp(k);
+            if (gp == nullptr || gp == fp)
+                continue;
+            int g = faceIndex.Get((int) tri::Index(m, gp));
+            if (g == -1)
+                continue;
+            int j = fp->FFi(k);
+            if (gp->FFp(j) != fp || gp->FFi(j) != k)
+                continue;
+            if (fp->V0(k) == gp->V1(j) && fp->V1(k) == gp->V0(j)) {
+                Unite(corner, 3 * i + k, 3 * g + (j + 1) % 3);
+                Unite(corner, 3 * i + (k + 1) % 3, 3 * g + j);
+            } else if (fp->V0(k) == gp->V0(j) && fp->V1(k) == gp->V1(j)) {
+                Unite(corner, 3 * i + k, 3 * g + j);
+                Unite(corner, 3 * i + (k + 1) % 3, 3 * g + (j + 1) % 3);
+            } else {
+                continue;
+            }
+            ffp[3 * i + k] = g;
+            ffi[3 * i + k] = j;
+        }
+    }
+
+    // One shell vertex per fan of corners. The roots are the smallest corner
+    // of each fan, so they are numbered before the other corners
+    std::vector<int> vertexIndex(3 * fn, -1);
+    std::vector<Mesh::VertexPointer> vertexSource;
+    std::vector<bool> split;
+    for (int c = 0; c < 3 * fn; ++c) {
+        int r = FindRoot(corner, c);
+        if (vertexIndex[r] == -1) {
+            Mesh::VertexPointer vp = fg.fpVec[c / 3]->V(c % 3);
+            int v = (int) tri::Index(m, vp);
+            vertexIndex[r] = (int) vertexSource.size();
+            split.push_back(firstFan.Get(v) != -1);
+            if (firstFan.Get(v) == -1)
+                firstFan.Set(v, vertexIndex[r]);
+            vertexSource.push_back(vp);
+        }
+        vertexIndex[c] = vertexIndex[r];
+    }
+
+    const int vn = (int) vertexSource.size();
+    tri::Allocator<Mesh>::AddVertices(shell, vn);
+    tri::Allocator<Mesh>::AddFaces(shell, fn);
+
+    for (int i = 0; i < vn; ++i) {
+        auto& sv = shell.vert[i];
+        sv.P() = vertexSource[i]->P();
+        sv.T() = vertexSource[i]->T();
+    }
+
+    for (int i = 0; i < fn; ++i) {
+        Mesh::FacePointer fp = fg.fpVec[i];
+        auto& sf = shell.face[i];
+        ia[sf] = tri::Index(m, fp);
+        for (int k = 0; k < 3; ++k) {
+            sf.V(k) = &shell.vert[vertexIndex[3 * i + k]];
+            sf.WT(k) = fp->WT(k);
+            if (ffp[3 * i + k] >= 0) {
+                sf.FFp(k) = &shell.face[ffp[3 * i + k]];
+                sf.FFi(k) = ffi[3 * i + k];
+            } else {
+                sf.FFp(k) = &sf;
+                sf.FFi(k) = k;
+            }
+        }
+        sf.SetMesh();
+    }
+
+    // As in tri::Clean::SplitNonManifoldVertex(), the additional fans of a
+    // vertex are moved slightly towards their faces
+    std::vector<vcg::Point3d> delta(vn, vcg::Point3d(0, 0, 0));
+    std::vector<int> count(vn, 0);
+    for (int i = 0; i < fn; ++i) {
+        for (int k = 0; k < 3; ++k) {
+            int v = vertexIndex[3 * i + k];
+            if (split[v]) {
+                delta[v] += vcg::Barycenter(shell.face[i]) - shell.vert[v].P();
+                count[v]++;
+            }
+        }
+    }
+    for (int v = 0; v < vn; ++v)
+        if (split[v])
+            shell.vert[v].P() += delta[v] * (0.3 / count[v]);
+
+    // Connected components of the shell, and of its faces welded in 3D
+    std::vector<int> component(fn);
+    std::iota(component.begin(), component.end(), 0);
+    int borderEdges = 0;
+    for (int i = 0; i < fn; ++i) {
+        for (int k = 0; k < 3; ++k) {
+            if (ffp[3 * i + k] >= 0)
+                Unite(component, i, ffp[3 * i + k]);
+            else
+                borderEdges++;
+        }
+    }
+
+    topology.components = 0;
+    for (int i = 0; i < fn; ++i)
+        if (FindRoot(component, i) == i)
+            topology.components++;
+
+    if (Has3DFaceAdjacencyAttribute(m)) {
+        auto ffadj = Get3DFaceAdjacencyAttribute(m);
+        for (int i = 0; i < fn; ++i) {
+            for (int k = 0; k < 3; ++k) {
+                int adj = ffadj[fg.fpVec[i]].f[k];
+                if (adj < 0)
+                    continue;
+                int g = faceIndex.Get(adj);
+                if (g != -1)
+                    Unite(component, i, g);
+            }
+        }
+        topology.components3D = 0;
+        for (int i = 0; i < fn; ++i)
+            if (FindRoot(component, i) == i)
+                topology.components3D++;
+    } else {
+        topology.components3D = topology.components;
+    }
+
+    // The vertices are manifold, so each border vertex has exactly two border
+    // edges and the boundary loops are the components of the border edges
+    std::vector<int> loop(vn);
+    std::iota(loop.begin(), loop.end(), 0);
+    std::vector<bool> onBorder(vn, false);
+    for (int i = 0; i < fn; ++i) {
+        for (int k = 0; k < 3; ++k) {
+            if (ffp[3 * i + k] < 0) {
+                int v0 = vertexIndex[3 * i + k];
+                int v1 = vertexIndex[3 * i + (k + 1) % 3];
+                Unite(loop, v0, v1);
+                onBorder[v0] = true;
+                onBorder[v1] = true;
+            }
+        }
+    }
+
+    topology.holes = 0;
+    for (int v = 0; v < vn; ++v)
+        if (onBorder[v] && FindRoot(loop, v) == v)
+            topology.holes++;
 
-    return tri::Clean<Mesh>::CountConnectedComponents(shell) == 1;
+    int edges = (3 * fn + borderEdges) / 2;
+    topology.genus = tri::Clean<Mesh>::MeshGenus(vn, edges, fn, topology.holes, topology.components);
+
+    InvalidateDerivedData(shell, DERIVED_BOUNDING_BOX | DERIVED_VERTEX_FACE);
+
+    LOG_DEBUG << "Built shell has " << shell.FN() << " faces and " << shell.VN() << " vertices";
+
+    return topology.components3D == 1;
+}
+
+static int FindRoot(std::vector<int>& parent, int i)
+{
+    while (parent[i] != i) {
+        parent[i] = parent[parent[i]];
+        i = parent[i];
+    }
+    return i;
+}
+
+static void Unite(std::vector<int>& parent, int i, int j)
+{
+    i = FindRoot(parent, i);
+    j = FindRoot(parent, j);
+    if (i < j)
+        parent[j] = i;
+    else if (j < i)
+        parent[i] = j;
 }
@@ -25,6 +25,14 @@
 class Mesh;
 class FaceGroup;
 
+/* Topology of a shell, computed while building it */
+struct ShellTopology {
+    int components3D = 0; // connected components of the faces welded in 3D, across the seams
+    int components = 0;   // connected components of the shell
+    int holes = 0;        // boundary loops of the shell
+    int genus = 0;
+};
+
 /* Builds a shell for the given chart. A shell is a mesh object specifically
  * constructed to compute the parameterization of a chart. In order to support
  * the various operations that we need to perform on it, it is more convenient
@@ -32,11 +40,32 @@ class FaceGroup;
  * not updated). The shell has suitable attributes to retrieve information about
  * the shell-face to input mesh-face mappings, as well as the target shape
  * features of each face to guide the parameterization process. (See also the
- * comments in mesh_attribute.h). */
-bool BuildShellWithTargetsFromUV(Mesh& shell, FaceGroup& fg, double downscaleFactor);
+ * comments in mesh_attribute.h).
+ * The shell is derived from the FF topology of the chart mesh: it is cut along
+ * the seams of the parameterization, its non-manifold vertices are split and
+ * its FF and VF topology is up to date. Returns true if the faces are a single
+ * connected component in 3D, and fills topology if not null. */
+bool BuildShellWithTargetsFromUV(Mesh& shell, FaceGroup& fg, double downscaleFactor, ShellTopology *topology = nullptr);
 
 void CloseHoles3D(Mesh& shell);
 
+/* Adds a band of scaffold faces along the boundary loops of the shell, made of
+ * two faces for each boundary edge and of a new vertex for each boundary vertex,
+ * offset in UV away from the shell faces by width times the average length of
+ * the boundary edges. The target shape of a scaffold face is its initial UV
+ * shape (stored in absolute coordinates), so that the ARAP solve penalizes the
+ * boundary moves that would fold the band (i.e. that bring the boundary over
+ * the nearby parts of the shell). The faces that would be degenerate or flipped
+ * with respect to the adjacent shell face are not added. The vertex tex coords
+ * must be current, and the FF topology up to date. Returns the number of
+ * scaffold faces */
+int AddBoundaryScaffold(Mesh& shell, double width);
+
+/* Restores the initial tex coords of the scaffold faces (and vertices) of the
+ * shell, the tex coords of the boundary vertices must be the same as when the
+ * scaffold was added */
+void RestoreBoundaryScaffold(Mesh& shell);
+
 /* This function synchronizes a shell with its UV coordinates, that is it
  * updates its vertex coordinates to match the parameter space configurations
  * (with z = 0). The operation is performed per-vertex. */
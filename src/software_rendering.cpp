@@ -0,0 +1,388 @@
+/*******************************************************************************
+    Copyright (c) 2021, Andrea Maggiordomo, Paolo Cignoni and Marco Tarini
+
+    This file is part of TextureDefrag, a reference implementation for
+    the paper ``Texture Defragmentation for Photo-Reconstructed 3D Models''
+    by Andrea Maggiordomo, Paolo Cignoni and Marco Tarini.
+
+    TextureDefrag is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    TextureDefrag is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with TextureDefrag. If not, see <https://www.gnu.org/licenses/>.
+*******************************************************************************/
+
+
+#include "software_rendering.h"
+#include "mesh.h"
+#include "mesh_attribute.h"
+#include "pushpull.h"
+#include "logging.h"
+#include "utils.h"
+#include "mapped_image.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+#include <QImage>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+
+// A face of the sheet in pixel space (rows top to bottom), with the vertices
+// ordered to have positive area and the normalized input texture coordinates
+struct RasterTriangle {
+    float x[3];
+    float y[3];
+    float s[3];
+    float t[3];
+    float area;
+    float color[4];
+};
+
+static void RasterizeTile(const std::vector<RasterTriangle>& triangles, const std::vector<int>& bin, const QImage *input,
+                          RenderMode imode, int x0, int y0, int x1, int y1, uchar *bits, std::size_t bytesPerLine);
+static void SampleBilinear(const QImage& img, float s, float t, float *rgba);
+static void SampleBicubic(const QImage& img, float s, float t, float *rgba);
+static inline float EdgeFunction(float ax, float ay, float bx, float by, float px, float py);
+static inline bool TopLeftEdge(float ax, float ay, float bx, float by);
+
+SoftwareRenderer::SoftwareRenderer(TextureObjectHandle textureObject, uint64_t budgetBytes)
+    : textureObject{textureObject},
+      budgetBytes{budgetBytes}
+{
+}
+
+std::shared_ptr<QImage> SoftwareRenderer::Render(const std::vector<Mesh::FacePointer>& fvec, Mesh& m,
+                                                 bool filter, RenderMode imode, int textureWidth, int textureHeight)
+{
+    auto WTCSh = GetWedgeTexCoordStorageAttribute(m);
+
+    // the faces are white if the mesh has no color attribute
+    Mesh::PerFaceAttributeHandle<vcg::Color4b> faceColor;
+    bool hasFaceColor = HasFaceColorAttribute(m);
+    if (hasFaceColor)
+        faceColor = GetFaceColorAttribute(m);
+
+    std::shared_ptr<QImage> textureImage = CreateSheetImage(scratchDirectory, textureWidth, textureHeight);
+    if (textureImage->isNull()) {
+        LOG_ERR << "[DIAG] FATAL: QImage allocation FAILED. System is out of memory.";
+        logging::LogMemoryUsage();
+        std::exit(-1);
+    }
+    textureImage->fill(qRgba(0, 0, 0, 255));
+    uchar *bits = textureImage->bits();
+    const std::size_t bytesPerLine = textureImage->bytesPerLine();
+
+    const int tilesX = (textureWidth + TILE_SIZE - 1) / TILE_SIZE;
+    const int tilesY = (textureHeight + TILE_SIZE - 1) / TILE_SIZE;
+    std::vector<std::vector<int>> bins(tilesX * tilesY);
+    std::vector<int> touched;
+    std::vector<RasterTriangle> triangles;
+
+    double t_decode_s = 0.0;
+    double t_raster_s = 0.0;
+
+    // Draw the faces one input texture at a time, so only its decoded image is needed
+    for (int first = 0; first < (int) fvec.size(); ) {
+        int ti = WTCSh[fvec[first]].tc[0].N();
+        int last = first;
+        while (last < (int) fvec.size() && WTCSh[fvec[last]].tc[0].N() == ti)
+            last++;
+
+        std::shared_ptr<const QImage> input;
+        if (imode != FaceColor) {
+            auto t_decode_start = std::chrono::high_resolution_clock::now();
+            input = DecodedImage(ti);
+            // the next input texture is decoded while this one is drawn
+            if (last < (int) fvec.size())
+                Prefetch(WTCSh[fvec[last]].tc[0].N());
+            auto t_decode_end = std::chrono::high_resolution_clock::now();
+            t_decode_s += std::chrono::duration<double>(t_decode_end - t_decode_start).count();
+        }
+
+        auto t_raster_start = std::chrono::high_resolution_clock::now();
+
+        // Set up the triangles and bin them to the output tiles they overlap
+        const double iw = textureObject->TextureWidth(ti);
+        const double ih = textureObject->TextureHeight(ti);
+        triangles.clear();
+        for (int k = first; k < last; ++k) {
+            Mesh::FacePointer fptr = fvec[k];
+            RasterTriangle tri;
+            for (int j = 0; j < 3; ++j) {
+                tri.x[j] = float(fptr->cWT(j).U() * textureWidth);
+                tri.y[j] = float((1.0 - fptr->cWT(j).V()) * textureHeight);
+                vcg::Point2d uv = WTCSh[fptr].tc[j].P();
+                tri.s[j] = float(uv.X() / iw);
+                tri.t[j] = float(uv.Y() / ih);
+            }
+            vcg::Color4b color = hasFaceColor ? faceColor[fptr] : vcg::Color4b(vcg::Color4b::White);
+            for (int c = 0; c < 4; ++c)
+                tri.color[c] = color[c] / 255.0f;
+            tri.area = EdgeFunction(tri.x[0], tri.y[0], tri.x[1], tri.y[1], tri.x[2], tri.y[2]);
+            if (tri.area == 0)
+                continue;
+            if (tri.area < 0) {
+                std::swap(tri.x[1], tri.x[2]);
+                std::swap(tri.y[1], tri.y[2]);
+                std::swap(tri.s[1], tri.s[2]);
+                std::swap(tri.t[1], tri.t[2]);
+                tri.area = -tri.area;
+            }
+
+            float minX = std::min({tri.x[0], tri.x[1], tri.x[2]});
+            float maxX = std::max({tri.x[0], tri.x[1], tri.x[2]});
+            float minY = std::min({tri.y[0], tri.y[1], tri.y[2]});
+            float maxY = std::max({tri.y[0], tri.y[1], tri.y[2]});
+            if (maxX < 0 || maxY < 0 || minX > textureWidth || minY > textureHeight)
+                continue;
+            int tx0 = std::max(0, int(std::floor(minX)) / TILE_SIZE);
+            int tx1 = std::min(tilesX - 1, int(std::floor(maxX)) / TILE_SIZE);
+            int ty0 = std::max(0, int(std::floor(minY)) / TILE_SIZE);
+            int ty1 = std::min(tilesY - 1, int(std::floor(maxY)) / TILE_SIZE);
+
+            int index = (int) triangles.size();
+            triangles.push_back(tri);
+            for (int ty = ty0; ty <= ty1; ++ty) {
+                for (int tx = tx0; tx <= tx1; ++tx) {
+                    std::vector<int>& bin = bins[ty * tilesX + tx];
+                    if (bin.empty())
+                        touched.push_back(ty * tilesX + tx);
+                    bin.push_back(index);
+                }
+            }
+        }
+
+        // The tiles cover disjoint pixels, each one draws its triangles in order
+#ifdef _OPENMP
+        #pragma omp parallel for schedule(dynamic)
+#endif
+        for (int n = 0; n < (int) touched.size(); ++n) {
+            int tile = touched[n];
+            int x0 = (tile % tilesX) * TILE_SIZE;
+            int y0 = (tile / tilesX) * TILE_SIZE;
+            RasterizeTile(triangles, bins[tile], input.get(), imode, x0, y0,
+                          std::min(x0 + TILE_SIZE, textureWidth), std::min(y0 + TILE_SIZE, textureHeight), bits, bytesPerLine);
+        }
+        for (int tile : touched)
+            bins[tile].clear();
+        touched.clear();
+
+        auto t_raster_end = std::chrono::high_resolution_clock::now();
+        t_raster_s += std::chrono::duration<double>(t_raster_end - t_raster_start).count();
+
+        first = last;
+    }
+
+    if (filter)
+        vcg::PullPush(*textureImage, qRgba(0, 0, 0, 255));
+
+    LOG_INFO << "[SW-RENDER-PROFILE] decode_s=" << t_decode_s
+             << " raster_s=" << t_raster_s
+             << " image=" << textureWidth << "x" << textureHeight;
+    return textureImage;
+}
+
+std::shared_ptr<const QImage> SoftwareRenderer::DecodedImage(int i)
+{
+    auto it = cache.find(i);
+    if (it != cache.end()) {
+        stats.hits++;
+        lruList.splice(lruList.begin(), lruList, it->second.lru);
+        return it->second.image;
+    }
+
+    stats.misses++;
+    std::shared_ptr<QImage> img;
+    if (prefetchIndex == i) {
+        img = std::make_shared<QImage>(prefetched.get());
+        prefetchIndex = -1;
+    } else {
+        img = std::make_shared<QImage>(ToARGB32(ReadTextureImage(textureObject->texInfoVec[i], 1 << textureObject->MipLevel(i))));
+    }
+    ensure(!img->isNull());
+    ensure(img->width() == textureObject->ResidentWidth(i) && img->height() == textureObject->ResidentHeight(i));
+
+    // Evict the least recently used images, the ones still referenced by the caller stay alive
+    uint64_t bytes = uint64_t(img->bytesPerLine()) * uint64_t(img->height());
+    while (budgetBytes > 0 && !lruList.empty() && currentBytes + bytes > budgetBytes) {
+        int victim = lruList.back();
+        auto vit = cache.find(victim);
+        uint64_t victimBytes = uint64_t(vit->second.image->bytesPerLine()) * uint64_t(vit->second.image->height());
+        currentBytes -= victimBytes;
+        stats.evictions++;
+        stats.bytesEvicted += victimBytes;
+        cache.erase(vit);
+        lruList.pop_back();
+    }
+
+    lruList.push_front(i);
+    cache[i] = { img, lruList.begin() };
+    currentBytes += bytes;
+    return img;
+}
+
+void SoftwareRenderer::Prefetch(int i)
+{
+    if (cache.count(i) > 0 || prefetchIndex == i)
+        return;
+    // a prefetch that was not used is completed and discarded
+    if (prefetchIndex != -1)
+        prefetched.wait();
+    TextureImageInfo tii = textureObject->texInfoVec[i];
+    int reduction = 1 << textureObject->MipLevel(i);
+    prefetched = std::async(std::launch::async, [tii, reduction]() { return ToARGB32(ReadTextureImage(tii, reduction)); });
+    prefetchIndex = i;
+}
+
+// -- static functions ---------------------------------------------------------
+
+/* Rasterizes the binned triangles inside the tile [x0,x1)x[y0,y1), shading them
+ * like the fragment shader. The pixel centers are at half-integer coordinates, and
+ * the pixels on shared edges are assigned with the top-left rule */
+static void RasterizeTile(const std::vector<RasterTriangle>& triangles, const std::vector<int>& bin, const QImage *input,
+                          RenderMode imode, int x0, int y0, int x1, int y1, uchar *bits, std::size_t bytesPerLine)
+{
+    for (int k : bin) {
+        const RasterTriangle& tri = triangles[k];
+        const bool tl0 = TopLeftEdge(tri.x[1], tri.y[1], tri.x[2], tri.y[2]);
+        const bool tl1 = TopLeftEdge(tri.x[2], tri.y[2], tri.x[0], tri.y[0]);
+        const bool tl2 = TopLeftEdge(tri.x[0], tri.y[0], tri.x[1], tri.y[1]);
+
+        int px0 = std::max(x0, int(std::ceil(std::min({tri.x[0], tri.x[1], tri.x[2]}) - 0.5f)));
+        int px1 = std::min(x1 - 1, int(std::floor(std::max({tri.x[0], tri.x[1], tri.x[2]}) - 0.5f)));
+        int py0 = std::max(y0, int(std::ceil(std::min({tri.y[0], tri.y[1], tri.y[2]}) - 0.5f)));
+        int py1 = std::min(y1 - 1, int(std::floor(std::max({tri.y[0], tri.y[1], tri.y[2]}) - 0.5f)));
+
+        for (int py = py0; py <= py1; ++py) {
+            const float cy = py + 0.5f;
+            QRgb *row = reinterpret_cast<QRgb *>(bits + std::size_t(py) * bytesPerLine);
+            for (int px = px0; px <= px1; ++px) {
+                const float cx = px + 0.5f;
+                float w0 = EdgeFunction(tri.x[1], tri.y[1], tri.x[2], tri.y[2], cx, cy);
+                float w1 = EdgeFunction(tri.x[2], tri.y[2], tri.x[0], tri.y[0], cx, cy);
+                float w2 = EdgeFunction(tri.x[0], tri.y[0], tri.x[1], tri.y[1], cx, cy);
+                if ((w0 < 0 || (w0 == 0 && !tl0)) || (w1 < 0 || (w1 == 0 && !tl1)) || (w2 < 0 || (w2 == 0 && !tl2)))
+                    continue;
+
+                const float b0 = w0 / tri.area;
+                const float b1 = w1 / tri.area;
+                const float b2 = w2 / tri.area;
+                const float s = b0 * tri.s[0] + b1 * tri.s[1] + b2 * tri.s[2];
+                const float t = b0 * tri.t[0] + b1 * tri.t[1] + b2 * tri.t[2];
+
+                // Nearest is drawn like Linear, as the shader leaves the filtering to the texture
+                float rgba[4];
+                if (imode == FaceColor) {
+                    std::copy(tri.color, tri.color + 4, rgba);
+                } else if (imode == Cubic) {
+                    SampleBicubic(*input, s, t, rgba);
+                } else if (s < 0) {
+                    rgba[0] = 0; rgba[1] = 1; rgba[2] = 0; rgba[3] = 1;
+                } else {
+                    SampleBilinear(*input, s, t, rgba);
+                    rgba[3] = 1;
+                }
+
+                int c[4];
+                for (int j = 0; j < 4; ++j)
+                    c[j] = std::min(255, std::max(0, int(rgba[j] * 255.0f + 0.5f)));
+                row[px] = qRgba(c[0], c[1], c[2], c[3]);
+            }
+        }
+    }
+}
+
+/* Bilinear lookup with the repeat wrap mode. The input images are top-down while
+ * the texture coordinates follow the OpenGL convention (t = 0 is the bottom row) */
+static void SampleBilinear(const QImage& img, float s, float t, float *rgba)
+{
+    const int w = img.width();
+    const int h = img.height();
+    const float x = s * w - 0.5f;
+    const float y = (1.0f - t) * h - 0.5f;
+    const float fx = std::floor(x);
+    const float fy = std::floor(y);
+    const float ax = x - fx;
+    const float ay = y - fy;
+
+    int xa = int(fx) % w;
+    if (xa < 0) xa += w;
+    int ya = int(fy) % h;
+    if (ya < 0) ya += h;
+    const int xb = (xa + 1 == w) ? 0 : xa + 1;
+    const int yb = (ya + 1 == h) ? 0 : ya + 1;
+
+    const QRgb *ra = reinterpret_cast<const QRgb *>(img.constScanLine(ya));
+    const QRgb *rb = reinterpret_cast<const QRgb *>(img.constScanLine(yb));
+    const QRgb p[4] = { ra[xa], ra[xb], rb[xa], rb[xb] };
+    const float wt[4] = { (1 - ax) * (1 - ay), ax * (1 - ay), (1 - ax) * ay, ax * ay };
+
+    rgba[0] = rgba[1] = rgba[2] = rgba[3] = 0;
+    for (int k = 0; k < 4; ++k) {
+        rgba[0] += wt[k] * qRed(p[k]);
+        rgba[1] += wt[k] * qGreen(p[k]);
+        rgba[2] += wt[k] * qBlue(p[k]);
+        rgba[3] += wt[k] * qAlpha(p[k]);
+    }
+    for (int k = 0; k < 4; ++k)
+        rgba[k] /= 255.0f;
+}
+
+/* Cubic B-spline lookup from four bilinear lookups, as in the fragment shader */
+static void SampleBicubic(const QImage& img, float s, float t, float *rgba)
+{
+    const float size[2] = { float(img.width()), float(img.height()) };
+    const float st[2] = { s, t };
+    float g1[2];
+    float h0[2];
+    float h1[2];
+    for (int a = 0; a < 2; ++a) {
+        float coord = st[a] * size[a] - 0.5f;
+        float idx = std::floor(coord);
+        float fraction = coord - idx;
+        float one_frac = 1.0f - fraction;
+        float w0 = (1.0f / 6.0f) * one_frac * one_frac * one_frac;
+        float w1 = (2.0f / 3.0f) - 0.5f * fraction * fraction * (2.0f - fraction);
+        float w2 = (2.0f / 3.0f) - 0.5f * one_frac * one_frac * (2.0f - one_frac);
+        float w3 = (1.0f / 6.0f) * fraction * fraction * fraction;
+        float g0 = w0 + w1;
+        g1[a] = w2 + w3;
+        h0[a] = ((w1 / g0) - 0.5f + idx) / size[a];
+        h1[a] = ((w3 / g1[a]) + 1.5f + idx) / size[a];
+    }
+
+    float tex00[4], tex10[4], tex01[4], tex11[4];
+    SampleBilinear(img, h0[0], h0[1], tex00);
+    SampleBilinear(img, h1[0], h0[1], tex10);
+    SampleBilinear(img, h0[0], h1[1], tex01);
+    SampleBilinear(img, h1[0], h1[1], tex11);
+    for (int k = 0; k < 4; ++k) {
+        float a = tex00[k] + (tex01[k] - tex00[k]) * g1[1];
+        float b = tex10[k] + (tex11[k] - tex10[k]) * g1[1];
+        rgba[k] = a + (b - a) * g1[0];
+    }
+}
+
+static inline float EdgeFunction(float ax, float ay, float bx, float by, float px, float py)
+{
+    return (bx - ax) * (py - ay) - (by - ay) * (px - ax);
+}
+
+/* With positive area (rows growing downwards) an edge is a top edge if it is
+ * horizontal and points right, a left edge if it points up */
+static inline bool TopLeftEdge(float ax, float ay, float bx, float by)
+{
+    return (ay == by && bx > ax) || (by < ay);
+}
@@ -0,0 +1,93 @@
+/*******************************************************************************
+    Copyright (c) 2021, Andrea Maggiordomo, Paolo Cignoni and Marco Tarini
+
+    This file is part of TextureDefrag, a reference implementation for
+    the paper ``Texture Defragmentation for Photo-Reconstructed 3D Models''
+    by Andrea Maggiordomo, Paolo Cignoni and Marco Tarini.
+
+    TextureDefrag is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    TextureDefrag is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with TextureDefrag. If not, see <https://www.gnu.org/licenses/>.
+*******************************************************************************/
+
+
+#ifndef SOFTWARE_RENDERING_H
+#define SOFTWARE_RENDERING_H
+
+#include "texture_rendering.h"
+
+#include <vector>
+#include <string>
+#include <memory>
+#include <list>
+#include <unordered_map>
+#include <future>
+
+class QImage;
+
+/* Renders the texture sheets on the CPU, for hosts without a usable OpenGL
+ * context. The rasterization follows the conventions of RenderTexture (pixel
+ * centers, repeat wrap mode, the bilinear lookups and the bicubic lookup of the
+ * fragment shader), and the faces are drawn in the same order. The output is
+ * split in tiles rasterized in parallel, and the decoded input textures are
+ * cached within a memory budget */
+class SoftwareRenderer {
+
+public:
+
+    static constexpr int TILE_SIZE = 64;
+
+    /* budgetBytes is the memory of the decoded input textures (0 means unlimited) */
+    SoftwareRenderer(TextureObjectHandle textureObject, uint64_t budgetBytes);
+
+    SoftwareRenderer(const SoftwareRenderer &) = delete;
+    SoftwareRenderer &operator=(const SoftwareRenderer &) = delete;
+
+    /* Renders the faces of fvec to a sheet of the given size. The faces are grouped
+     * by input texture, and drawn in order as in the OpenGL path */
+    std::shared_ptr<QImage> Render(const std::vector<Mesh::FacePointer>& fvec, Mesh& m,
+                                   bool filter, RenderMode imode, int textureWidth, int textureHeight);
+
+    /* The sheets are backed by scratch files of the directory if it is not empty (see mapped_image.h) */
+    void SetScratchDirectory(const std::string& directory) { scratchDirectory = directory; }
+
+    TextureObject::CacheStats GetCacheStats() const { return stats; }
+    uint64_t GetCurrentCacheBytes() const { return currentBytes; }
+
+private:
+
+    struct CacheEntry {
+        std::shared_ptr<const QImage> image;
+        std::list<int>::iterator lru;
+    };
+
+    std::shared_ptr<const QImage> DecodedImage(int i);
+
+    /* Starts decoding the input texture i on a worker thread, if it is not cached */
+    void Prefetch(int i);
+
+    TextureObjectHandle textureObject;
+    uint64_t budgetBytes;
+    uint64_t currentBytes = 0;
+    std::list<int> lruList;  // input textures, most-recently-used at front
+    std::unordered_map<int, CacheEntry> cache;
+
+    // the input texture decoded in the background while the current one is drawn
+    int prefetchIndex = -1;
+    std::future<QImage> prefetched;
+
+    std::string scratchDirectory;
+
+    TextureObject::CacheStats stats;
+};
+
+#endif // SOFTWARE_RENDERING_H
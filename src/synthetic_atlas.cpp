@@ -0,0 +1,465 @@
+/*******************************************************************************
+    Copyright (c) 2021, Andrea Maggiordomo, Paolo Cignoni and Marco Tarini
+
+    This file is part of TextureDefrag, a reference implementation for
+    the paper ``Texture Defragmentation for Photo-Reconstructed 3D Models''
+    by Andrea Maggiordomo, Paolo Cignoni and Marco Tarini.
+
+    TextureDefrag is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    TextureDefrag is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with TextureDefrag. If not, see <https://www.gnu.org/licenses/>.
+*******************************************************************************/
+
+
+#include "synthetic_atlas.h"
+#include "mesh.h"
+#include "logging.h"
+#include "utils.h"
+
+#include <random>
+#include <algorithm>
+#include <numeric>
+#include <cmath>
+#include <memory>
+#include <deque>
+#include <unordered_map>
+
+#include <QImage>
+#include <QPainter>
+#include <QLinearGradient>
+#include <QColor>
+#include <QFileInfo>
+#include <QDir>
+
+
+/* Square grid of side x side quads, with two faces each */
+struct GridPatch {
+    int side;
+    std::vector<int> vertexIndex; // index in the mesh of the (side + 1)^2 grid vertices
+    std::vector<int> quadChart;   // chart of each quad
+
+    int Vertex(int i, int j) const { return vertexIndex[j * (side + 1) + i]; }
+};
+
+struct SyntheticChart {
+    int patch;
+    int imin, jmin, imax, jmax; // bounding box of the chart quads in the grid
+    int rotation;               // multiple of 90 degrees
+    int page;
+    vcg::Point2d origin;        // corner of the chart box in the texture (in pixels)
+
+    int W() const { return imax - imin + 1; }
+    int H() const { return jmax - jmin + 1; }
+    int RotatedW() const { return (rotation % 2 == 0) ? W() : H(); }
+    int RotatedH() const { return (rotation % 2 == 0) ? H() : W(); }
+};
+
+static void BuildTerrain(Mesh& m, std::vector<GridPatch>& patches, int faces, std::mt19937& gen);
+static void BuildSphere(Mesh& m, std::vector<GridPatch>& patches, int faces, std::mt19937& gen);
+static void AssignCharts(GridPatch& patch, int numCharts, double spread, int firstChart, std::mt19937& gen);
+static bool ShelfPack(std::vector<SyntheticChart>& charts, double texelsPerQuad, int gutter, int pages, int size);
+
+
+bool GenerateSyntheticAtlas(Mesh& m, std::vector<std::shared_ptr<QImage>>& textureImages, const SyntheticAtlasParameters& params)
+{
+    ensure(params.faces > 0 && params.charts > 0 && params.textures > 0 && params.textureSize > 0 && params.spread >= 0);
+
+    std::mt19937 gen(params.seed);
+
+    m.Clear();
+    std::vector<GridPatch> patches;
+    if (params.shape == SyntheticShape::Sphere)
+        BuildSphere(m, patches, params.faces, gen);
+    else
+        BuildTerrain(m, patches, params.faces, gen);
+
+    int numCharts = 0;
+    int patchCharts = std::max(1, (int) std::lround(params.charts / (double) patches.size()));
+    for (auto& patch : patches) {
+        AssignCharts(patch, patchCharts, params.spread, numCharts, gen);
+        numCharts = *std::max_element(patch.quadChart.begin(), patch.quadChart.end()) + 1;
+    }
+
+    std::vector<SyntheticChart> charts(numCharts, SyntheticChart{-1, 0, 0, -1, -1, 0, 0, vcg::Point2d::Zero()});
+    for (unsigned p = 0; p < patches.size(); ++p) {
+        const GridPatch& patch = patches[p];
+        for (int j = 0; j < patch.side; ++j) {
+            for (int i = 0; i < patch.side; ++i) {
+                SyntheticChart& c = charts[patch.quadChart[j * patch.side + i]];
+                if (c.patch == -1) {
+                    c.patch = p;
+                    c.imin = c.imax = i;
+                    c.jmin = c.jmax = j;
+                }
+                c.imin = std::min(c.imin, i);
+                c.jmin = std::min(c.jmin, j);
+                c.imax = std::max(c.imax, i);
+                c.jmax = std::max(c.jmax, j);
+            }
+        }
+    }
+
+    std::uniform_int_distribution<int> rotation(0, 3);
+    double quadArea = 0;
+    for (auto& c : charts) {
+        c.rotation = rotation(gen);
+        if (c.patch != -1)
+            quadArea += c.W() * c.H();
+    }
+
+    // the texel density is reduced until the charts fit in the textures
+    const int GUTTER = 2;
+    const double MIN_TEXELS_PER_QUAD = 0.05;
+    const int size = params.textureSize;
+    double texelsPerQuad = std::sqrt(0.7 * params.textures * double(size) * size / quadArea);
+    while (!ShelfPack(charts, texelsPerQuad, GUTTER, params.textures, size)) {
+        texelsPerQuad *= 0.9;
+        if (texelsPerQuad < MIN_TEXELS_PER_QUAD) {
+            LOG_ERR << "Synthetic atlas: the charts do not fit in the textures, use fewer charts or larger textures";
+            return false;
+        }
+    }
+
+    int numFaces = 0;
+    for (const auto& patch : patches)
+        numFaces += 2 * patch.side * patch.side;
+
+    LOG_INFO << "Synthetic atlas: " << numFaces << " faces, " << numCharts << " charts, "
+             << params.textures << " textures of " << size << "x" << size << " pixels, " << texelsPerQuad << " texels per quad";
+
+    tri::Allocator<Mesh>::AddFaces(m, numFaces);
+    int fi = 0;
+    for (const auto& patch : patches) {
+        for (int j = 0; j < patch.side; ++j) {
+            for (int i = 0; i < patch.side; ++i) {
+                const SyntheticChart& c = charts[patch.quadChart[j * patch.side + i]];
+                auto TexCoord = [&] (int vi, int vj) {
+                    double u = vi - c.imin;
+                    double v = vj - c.jmin;
+                    vcg::Point2d p;
+                    switch (c.rotation) {
+                        case 0: p = vcg::Point2d(u, v); break;
+                        case 1: p = vcg::Point2d(c.H() - v, u); break;
+                        case 2: p = vcg::Point2d(c.W() - u, c.H() - v); break;
+                        default: p = vcg::Point2d(v, c.W() - u);
+                    }
+                    return (c.origin + vcg::Point2d(GUTTER, GUTTER) + p * texelsPerQuad) / double(size);
+                };
+
+                int corners[2][3][2] = {{{i, j}, {i + 1, j}, {i + 1, j + 1}}, {{i, j}, {i + 1, j + 1}, {i, j + 1}}};
+                for (int k = 0; k < 2; ++k) {
+                    MeshFace& f = m.face[fi++];
+                    for (int h = 0; h < 3; ++h) {
+                        f.V(h) = &m.vert[patch.Vertex(corners[k][h][0], corners[k][h][1])];
+                        f.WT(h).P() = TexCoord(corners[k][h][0], corners[k][h][1]);
+                        f.WT(h).N() = c.page;
+                    }
+                }
+            }
+        }
+    }
+
+    textureImages.clear();
+    for (int p = 0; p < params.textures; ++p) {
+        textureImages.push_back(std::make_shared<QImage>(size, size, QImage::Format_RGB32));
+        textureImages.back()->fill(QColor(128, 128, 128));
+    }
+
+    std::vector<std::unique_ptr<QPainter>> painters(textureImages.size());
+    for (std::size_t p = 0; p < textureImages.size(); ++p)
+        painters[p].reset(new QPainter(textureImages[p].get()));
+    std::uniform_int_distribution<int> channel(32, 224);
+    for (const auto& c : charts) {
+        if (c.patch == -1)
+            continue;
+        // the image rows are top to bottom
+        double w = c.RotatedW() * texelsPerQuad + 2 * GUTTER;
+        double h = c.RotatedH() * texelsPerQuad + 2 * GUTTER;
+        QRectF rect(c.origin.X(), size - c.origin.Y() - h, w, h);
+        QColor color(channel(gen), channel(gen), channel(gen));
+        QLinearGradient gradient(rect.topLeft(), rect.bottomRight());
+        gradient.setColorAt(0, color.lighter(130));
+        gradient.setColorAt(1, color.darker(130));
+        painters[c.page]->fillRect(rect, gradient);
+    }
+
+    return true;
+}
+
+bool SaveSyntheticAtlas(const char *fileName, const SyntheticAtlasParameters& params)
+{
+    Mesh m;
+    std::vector<std::shared_ptr<QImage>> textureImages;
+    if (!GenerateSyntheticAtlas(m, textureImages, params))
+        return false;
+
+    // the texture names are relative to the mesh file
+    QFileInfo fi(fileName);
+    QDir dir = fi.absoluteDir();
+    m.textures.clear();
+    for (unsigned i = 0; i < textureImages.size(); ++i) {
+        std::string name = fi.completeBaseName().toStdString() + "_texture_" + std::to_string(i) + ".png";
+        if (!textureImages[i]->save(dir.absoluteFilePath(QString::fromStdString(name)), "png")) {
+            LOG_ERR << "Unable to save the texture " << name;
+            return false;
+        }
+        m.textures.push_back(name);
+    }
+
+    return SaveMesh(fileName, m, textureImages, false);
+}
+
+/* Height field over a single grid, the quads are about 1 unit wide */
+static void BuildTerrain(Mesh& m, std::vector<GridPatch>& patches, int faces, std::mt19937& gen)
+{
+    const int side = std::max(1, (int) std::lround(std::sqrt(faces / 2.0)));
+
+    std::uniform_real_distribution<double> phase(0, 2.0 * M_PI);
+    double ph[4] = { phase(gen), phase(gen), phase(gen), phase(gen) };
+    auto Height = [&] (int i, int j) {
+        double x = 2.0 * M_PI * i / side;
+        double y = 2.0 * M_PI * j / side;
+        return side * (0.08 * std::sin(x + ph[0]) * std::cos(1.5 * y + ph[1])
+                       + 0.01 * std::sin(7.0 * x + ph[2]) * std::sin(5.0 * y + ph[3]));
+    };
+
+    GridPatch patch;
+    patch.side = side;
+    tri::Allocator<Mesh>::AddVertices(m, (side + 1) * (side + 1));
+    for (int j = 0; j <= side; ++j) {
+        for (int i = 0; i <= side; ++i) {
+            m.vert[j * (side + 1) + i].P() = vcg::Point3d(i, j, Height(i, j));
+            patch.vertexIndex.push_back(j * (side + 1) + i);
+        }
+    }
+    patches.push_back(std::move(patch));
+}
+
+/* The six faces of a cube of side n (in quads) are projected on a bumpy sphere.
+ * The (u, v) axes of each face are oriented so that the faces point outwards,
+ * and the vertices along the cube edges are shared by the adjacent faces */
+static void BuildSphere(Mesh& m, std::vector<GridPatch>& patches, int faces, std::mt19937& gen)
+{
+    const int n = std::max(1, (int) std::lround(std::sqrt(faces / 12.0)));
+
+    struct CubeFace {
+        vcg::Point3i origin;
+        vcg::Point3i u;
+        vcg::Point3i v;
+    };
+    const CubeFace cubeFaces[6] = {
+        { vcg::Point3i(n, 0, 0), vcg::Point3i(0, 1, 0), vcg::Point3i(0, 0, 1) },
+        { vcg::Point3i(0, 0, 0), vcg::Point3i(0, 0, 1), vcg::Point3i(0, 1, 0) },
+        { vcg::Point3i(0, n, 0), vcg::Point3i(0, 0, 1), vcg::Point3i(1, 0, 0) },
+        { vcg::Point3i(0, 0, 0), vcg::Point3i(1, 0, 0), vcg::Point3i(0, 0, 1) },
+        { vcg::Point3i(0, 0, n), vcg::Point3i(1, 0, 0), vcg::Point3i(0, 1, 0) },
+        { vcg::Point3i(0, 0, 0), vcg::Point3i(0, 1, 0), vcg::Point3i(1, 0, 0) }
+    };
+
+    std::uniform_real_distribution<double> phase(0, 2.0 * M_PI);
+    double ph[3] = { phase(gen), phase(gen), phase(gen) };
+    const double radius = 2.0 * n / M_PI; // the quads are about 1 unit wide
+
+    // only the vertices on the cube edges can be shared
+    std::unordered_map<long long, int> edgeVertices;
+    auto VertexKey = [n] (const vcg::Point3i& p) {
+        return ((long long) p[0] * (n + 1) + p[1]) * (n + 1) + p[2];
+    };
+
+    for (const auto& cf : cubeFaces) {
+        GridPatch patch;
+        patch.side = n;
+        for (int j = 0; j <= n; ++j) {
+            for (int i = 0; i <= n; ++i) {
+                vcg::Point3i p = cf.origin + cf.u * i + cf.v * j;
+                bool onEdge = (i == 0 || i == n || j == 0 || j == n);
+                if (onEdge) {
+                    auto it = edgeVertices.find(VertexKey(p));
+                    if (it != edgeVertices.end()) {
+                        patch.vertexIndex.push_back(it->second);
+                        continue;
+                    }
+                }
+                vcg::Point3d dir = vcg::Point3d(p[0], p[1], p[2]) * (2.0 / n) - vcg::Point3d(1, 1, 1);
+                dir.Normalize();
+                double r = radius * (1.0 + 0.05 * std::sin(5.0 * dir[0] + ph[0]) * std::sin(4.0 * dir[1] + ph[1]) * std::sin(3.0 * dir[2] + ph[2]));
+                int vi = (int) m.vert.size();
+                tri::Allocator<Mesh>::AddVertex(m, dir * r);
+                if (onEdge)
+                    edgeVertices[VertexKey(p)] = vi;
+                patch.vertexIndex.push_back(vi);
+            }
+        }
+        patches.push_back(std::move(patch));
+    }
+}
+
+/* Assigns the quads of the patch to about numCharts charts, numbered from
+ * firstChart. The quads are assigned to the nearest seed, among the ones of
+ * the neighboring cells of a lattice where each cell has a randomly jittered
+ * seed. With a non-zero spread the lattice is finer, and the cells are grouped
+ * by region growing in charts of log-normally distributed number of cells */
+static void AssignCharts(GridPatch& patch, int numCharts, double spread, int firstChart, std::mt19937& gen)
+{
+    const int side = patch.side;
+    const int CELLS_PER_CHART = (spread > 0) ? 8 : 1;
+    const int lattice = std::max(1, std::min(side, (int) std::lround(std::sqrt((double) numCharts * CELLS_PER_CHART))));
+    const double cellSize = side / (double) lattice;
+    const int numCells = lattice * lattice;
+
+    std::uniform_real_distribution<double> jitter(0.1, 0.9);
+    std::vector<vcg::Point2d> seeds(numCells);
+    for (int cy = 0; cy < lattice; ++cy)
+        for (int cx = 0; cx < lattice; ++cx)
+            seeds[cy * lattice + cx] = vcg::Point2d((cx + jitter(gen)) * cellSize, (cy + jitter(gen)) * cellSize);
+
+    // chart of each cell
+    std::vector<int> cellChart(numCells);
+    if (spread == 0) {
+        std::iota(cellChart.begin(), cellChart.end(), 0);
+    } else {
+        int k = std::max(1, std::min(numCharts, numCells));
+        std::lognormal_distribution<double> area(0, spread);
+        std::vector<double> target(k);
+        for (auto& t : target)
+            t = area(gen);
+        double scale = numCells / std::accumulate(target.begin(), target.end(), 0.0);
+
+        std::vector<int> order(numCells);
+        std::iota(order.begin(), order.end(), 0);
+        std::shuffle(order.begin(), order.end(), gen);
+
+        auto Neighbors = [lattice] (int cell, int nb[4]) {
+            int cx = cell % lattice;
+            int cy = cell / lattice;
+            int n = 0;
+            if (cx > 0)           nb[n++] = cell - 1;
+            if (cx < lattice - 1) nb[n++] = cell + 1;
+            if (cy > 0)           nb[n++] = cell - lattice;
+            if (cy < lattice - 1) nb[n++] = cell + lattice;
+            return n;
+        };
+
+        std::fill(cellChart.begin(), cellChart.end(), -1);
+        unsigned next = 0;
+        for (int c = 0; c < k; ++c) {
+            while (next < order.size() && cellChart[order[next]] != -1)
+                next++;
+            if (next == order.size())
+                break;
+            int targetCells = std::max(1, (int) std::lround(target[c] * scale));
+            std::deque<int> queue = { order[next] };
+            cellChart[order[next]] = c;
+            int grown = 1;
+            while (!queue.empty() && grown < targetCells) {
+                int cell = queue.front();
+                queue.pop_front();
+                int nb[4];
+                int n = Neighbors(cell, nb);
+                for (int i = 0; i < n && grown < targetCells; ++i) {
+                    if (cellChart[nb[i]] == -1) {
+                        cellChart[nb[i]] = c;
+                        queue.push_back(nb[i]);
+                        grown++;
+                    }
+                }
+            }
+        }
+
+        // the cells left out are merged with a neighboring chart
+        bool changed = true;
+        while (changed) {
+            changed = false;
+            for (int cell = 0; cell < numCells; ++cell) {
+                int nb[4];
+                int n = Neighbors(cell, nb);
+                for (int i = 0; i < n && cellChart[cell] == -1; ++i) {
+                    if (cellChart[nb[i]] != -1) {
+                        cellChart[cell] = cellChart[nb[i]];
+                        changed = true;
+                    }
+                }
+            }
+        }
+    }
+
+    // compact the chart ids of the patch
+    std::vector<int> chartId(numCells, -1);
+    int numPatchCharts = 0;
+    patch.quadChart.resize(side * side);
+    for (int j = 0; j < side; ++j) {
+        for (int i = 0; i < side; ++i) {
+            vcg::Point2d center(i + 0.5, j + 0.5);
+            int cx = std::min(lattice - 1, (int) (center.X() / cellSize));
+            int cy = std::min(lattice - 1, (int) (center.Y() / cellSize));
+            int nearest = -1;
+            double nearestDist = 0;
+            for (int y = std::max(0, cy - 1); y <= std::min(lattice - 1, cy + 1); ++y) {
+                for (int x = std::max(0, cx - 1); x <= std::min(lattice - 1, cx + 1); ++x) {
+                    double d = (seeds[y * lattice + x] - center).SquaredNorm();
+                    if (nearest == -1 || d < nearestDist) {
+                        nearest = y * lattice + x;
+                        nearestDist = d;
+                    }
+                }
+            }
+            int c = cellChart[nearest];
+            if (chartId[c] == -1)
+                chartId[c] = numPatchCharts++;
+            patch.quadChart[j * side + i] = firstChart + chartId[c];
+        }
+    }
+}
+
+/* Packs the chart boxes (with a gutter on each side) in rows of decreasing
+ * height, the rows are stacked bottom to top and continue in the next page
+ * when the current one is full. Returns false if the charts do not fit */
+static bool ShelfPack(std::vector<SyntheticChart>& charts, double texelsPerQuad, int gutter, int pages, int size)
+{
+    std::vector<int> order(charts.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(), [&] (int c1, int c2) {
+        return charts[c1].RotatedH() > charts[c2].RotatedH() || (charts[c1].RotatedH() == charts[c2].RotatedH() && c1 < c2);
+    });
+
+    int page = 0;
+    double x = 0;
+    double y = 0;
+    double rowHeight = 0;
+    for (int ci : order) {
+        SyntheticChart& c = charts[ci];
+        if (c.patch == -1)
+            continue;
+        double w = std::ceil(c.RotatedW() * texelsPerQuad) + 2 * gutter;
+        double h = std::ceil(c.RotatedH() * texelsPerQuad) + 2 * gutter;
+        if (w > size || h > size)
+            return false;
+        if (x + w > size) {
+            x = 0;
+            y += rowHeight;
+            rowHeight = 0;
+        }
+        if (y + h > size) {
+            page++;
+            x = 0;
+            y = 0;
+            rowHeight = 0;
+        }
+        if (page >= pages)
+            return false;
+        c.page = page;
+        c.origin = vcg::Point2d(x, y);
+        x += w;
+        rowHeight = std::max(rowHeight, h);
+    }
+    return true;
+}
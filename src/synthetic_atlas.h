@@ -0,0 +1,64 @@
+/*******************************************************************************
+    Copyright (c) 2021, Andrea Maggiordomo, Paolo Cignoni and Marco Tarini
+
+    This file is part of TextureDefrag, a reference implementation for
+    the paper ``Texture Defragmentation for Photo-Reconstructed 3D Models''
+    by Andrea Maggiordomo, Paolo Cignoni and Marco Tarini.
+
+    TextureDefrag is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    TextureDefrag is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with TextureDefrag. If not, see <https://www.gnu.org/licenses/>.
+*******************************************************************************/
+
+
+#ifndef SYNTHETIC_ATLAS_H
+#define SYNTHETIC_ATLAS_H
+
+#include <vector>
+#include <memory>
+
+class Mesh;
+class QImage;
+
+enum class SyntheticShape {
+    Terrain, // height field over a square grid
+    Sphere   // bumpy sphere, made of the six grids of a cube projected on the sphere
+};
+
+struct SyntheticAtlasParameters {
+    SyntheticShape shape = SyntheticShape::Terrain;
+    int faces = 100000;     // approximate number of faces
+    int charts = 1000;      // approximate number of charts
+    double spread = 0;      // standard deviation of the log of the chart areas (0 for charts of similar size)
+    int textures = 1;       // number of texture images
+    int textureSize = 4096; // side of the texture images in pixels
+    unsigned seed = 0;
+};
+
+/* Generates a photogrammetry-like input of about params.faces triangles, made
+ * of regular grids, whose parameterization is fragmented in about params.charts
+ * charts. The grids are split in the Voronoi regions of randomly jittered
+ * seeds, that are the charts if params.spread is 0, otherwise the regions are
+ * grouped in charts of log-normally distributed areas. Charts never cross the
+ * borders of the grids. The charts are randomly rotated by multiples of 90
+ * degrees and packed in params.textures texture images, with the same texel
+ * density, and each chart is painted with a gradient of its own color. The
+ * wedge tex coords are in [0,1], their index is the texture image. Returns
+ * false if the charts do not fit in the textures */
+bool GenerateSyntheticAtlas(Mesh& m, std::vector<std::shared_ptr<QImage>>& textureImages, const SyntheticAtlasParameters& params);
+
+/* Generates the atlas and saves it in fileName, the textures are saved as png
+ * images in the same directory. Returns false if the atlas cannot be generated
+ * or a file cannot be written */
+bool SaveSyntheticAtlas(const char *fileName, const SyntheticAtlasParameters& params);
+
+#endif // SYNTHETIC_ATLAS_H
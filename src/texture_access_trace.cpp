@@ -0,0 +1,200 @@
+/*******************************************************************************
+    Copyright (c) 2021, Andrea Maggiordomo, Paolo Cignoni and Marco Tarini
+
+    This file is part of TextureDefrag, a reference implementation for
+    the paper ``Texture Defragmentation for Photo-Reconstructed 3D Models''
+    by Andrea Maggiordomo, Paolo Cignoni and Marco Tarini.
+
+    TextureDefrag is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    TextureDefrag is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with TextureDefrag. If not, see <https://www.gnu.org/licenses/>.
+*******************************************************************************/
+
+
+#include "texture_access_trace.h"
+#include "logging.h"
+
+#include <sstream>
+#include <unordered_map>
+#include <algorithm>
+#include <limits>
+
+// Fixed cost of an upload in the cost-aware policy, in bytes, so that small textures
+// cost more to upload per byte than large ones (driver calls, allocation, decoding setup)
+static const double UPLOAD_OVERHEAD_BYTES = 1 << 20;
+
+static void ReplayJob(const std::vector<TextureAccess>& trace, TextureCachePolicy policy, uint64_t budgetBytes, TextureCacheReplay& replay);
+
+
+TextureAccessTrace::TextureAccessTrace(const std::string& path)
+    : out(path, std::ios::out | std::ios::trunc)
+{
+    out << "# texture-defrag texture access trace\n";
+    out << "# job texture bytes sheet tile\n";
+    out.flush();
+}
+
+bool TextureAccessTrace::Good() const
+{
+    return out.good();
+}
+
+int TextureAccessTrace::BeginJob(const std::string& id)
+{
+    std::lock_guard<std::mutex> lock(mtx);
+    int job = jobs++;
+    out << "# job " << job << " " << id << "\n";
+    return job;
+}
+
+void TextureAccessTrace::Record(const TextureAccess& access)
+{
+    std::lock_guard<std::mutex> lock(mtx);
+    out << access.job << " " << access.texture << " " << access.bytes << " " << access.sheet << " " << access.tile << "\n";
+}
+
+bool TextureAccessTrace::Flush()
+{
+    std::lock_guard<std::mutex> lock(mtx);
+    out.flush();
+    return out.good();
+}
+
+bool ReadTextureAccessTrace(const std::string& path, std::vector<TextureAccess>& trace)
+{
+    std::ifstream in(path);
+    if (!in)
+        return false;
+    trace.clear();
+    std::string line;
+    int lineNumber = 0;
+    while (std::getline(in, line)) {
+        lineNumber++;
+        if (line.empty() || line[0] == '#')
+            continue;
+        std::istringstream ss(line);
+        TextureAccess a;
+        if (!(ss >> a.job >> a.texture >> a.bytes >> a.sheet >> a.tile) || a.job < 0 || a.texture < 0) {
+            LOG_ERR << "Malformed access at line " << lineNumber << " of " << path;
+            return false;
+        }
+        trace.push_back(a);
+    }
+    return !in.bad();
+}
+
+const char *TextureCachePolicyName(TextureCachePolicy policy)
+{
+    switch (policy) {
+        case TextureCachePolicy::LRU: return "lru";
+        case TextureCachePolicy::CostAware: return "cost";
+        case TextureCachePolicy::Planned: return "planned";
+    }
+    return "unknown";
+}
+
+TextureCacheReplay ReplayTextureAccessTrace(const std::vector<TextureAccess>& trace, TextureCachePolicy policy, uint64_t budgetBytes)
+{
+    // the accesses of the jobs can be interleaved if several jobs were rendered at once
+    std::vector<TextureAccess> sorted = trace;
+    std::stable_sort(sorted.begin(), sorted.end(), [](const TextureAccess& a1, const TextureAccess& a2) { return a1.job < a2.job; });
+
+    TextureCacheReplay replay;
+    std::vector<TextureAccess> jobTrace;
+    for (std::size_t k = 0; k < sorted.size(); ++k) {
+        jobTrace.push_back(sorted[k]);
+        if (k + 1 == sorted.size() || sorted[k + 1].job != sorted[k].job) {
+            ReplayJob(jobTrace, policy, budgetBytes, replay);
+            jobTrace.clear();
+        }
+    }
+    return replay;
+}
+
+
+// -- static functions ---------------------------------------------------------
+
+static void ReplayJob(const std::vector<TextureAccess>& trace, TextureCachePolicy policy, uint64_t budgetBytes, TextureCacheReplay& replay)
+{
+    const std::size_t NEVER = std::numeric_limits<std::size_t>::max();
+
+    // position of the next access to the same texture, for the planned policy
+    std::vector<std::size_t> nextUse(trace.size(), NEVER);
+    if (policy == TextureCachePolicy::Planned) {
+        std::unordered_map<int, std::size_t> next;
+        for (std::size_t k = trace.size(); k-- > 0;) {
+            auto it = next.find(trace[k].texture);
+            nextUse[k] = (it == next.end()) ? NEVER : it->second;
+            next[trace[k].texture] = k;
+        }
+    }
+
+    struct Entry {
+        uint64_t bytes;
+        std::size_t lastUse;
+        std::size_t nextUse;
+        uint64_t frequency;
+        double priority;
+    };
+
+    std::unordered_map<int, Entry> resident;
+    uint64_t currentBytes = 0;
+    double inflation = 0; // the priority of the last evicted texture (GreedyDual)
+
+    auto Priority = [&](const Entry& e) {
+        return inflation + double(e.frequency) * (double(e.bytes) + UPLOAD_OVERHEAD_BYTES) / std::max(double(e.bytes), 1.0);
+    };
+
+    for (std::size_t k = 0; k < trace.size(); ++k) {
+        const TextureAccess& a = trace[k];
+        replay.accesses++;
+
+        auto it = resident.find(a.texture);
+        if (it != resident.end()) {
+            replay.hits++;
+            Entry& e = it->second;
+            e.lastUse = k;
+            e.nextUse = nextUse[k];
+            e.frequency++;
+            e.priority = Priority(e);
+            continue;
+        }
+
+        replay.misses++;
+        replay.uploadBytes += a.bytes;
+        while (budgetBytes > 0 && !resident.empty() && currentBytes + a.bytes > budgetBytes) {
+            auto victim = resident.begin();
+            for (auto jt = resident.begin(); jt != resident.end(); ++jt) {
+                const Entry& e = jt->second;
+                const Entry& v = victim->second;
+                bool better = false;
+                switch (policy) {
+                    case TextureCachePolicy::LRU: better = e.lastUse < v.lastUse; break;
+                    case TextureCachePolicy::CostAware: better = e.priority < v.priority || (e.priority == v.priority && e.lastUse < v.lastUse); break;
+                    case TextureCachePolicy::Planned: better = e.nextUse > v.nextUse || (e.nextUse == v.nextUse && e.lastUse < v.lastUse); break;
+                }
+                if (better)
+                    victim = jt;
+            }
+            if (policy == TextureCachePolicy::CostAware)
+                inflation = victim->second.priority;
+            currentBytes -= victim->second.bytes;
+            resident.erase(victim);
+            replay.evictions++;
+        }
+
+        Entry e = { a.bytes, k, nextUse[k], 1, 0.0 };
+        e.priority = Priority(e);
+        resident[a.texture] = e;
+        currentBytes += a.bytes;
+    }
+}
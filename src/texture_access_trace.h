@@ -0,0 +1,106 @@
+/*******************************************************************************
+    Copyright (c) 2021, Andrea Maggiordomo, Paolo Cignoni and Marco Tarini
+
+    This file is part of TextureDefrag, a reference implementation for
+    the paper ``Texture Defragmentation for Photo-Reconstructed 3D Models''
+    by Andrea Maggiordomo, Paolo Cignoni and Marco Tarini.
+
+    TextureDefrag is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    TextureDefrag is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with TextureDefrag. If not, see <https://www.gnu.org/licenses/>.
+*******************************************************************************/
+
+
+#ifndef TEXTURE_ACCESS_TRACE_H
+#define TEXTURE_ACCESS_TRACE_H
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <fstream>
+#include <mutex>
+
+/* Trace of the input textures bound by the rendering (see TextureObject::Bind), to
+ * size the texture cache offline: the trace is replayed by the texture cache
+ * simulator (texture-defrag-cachesim) against several eviction policies and
+ * budgets, in seconds instead of a render for each configuration.
+ *
+ * The trace is a text file, one access per line as
+ *
+ *     job texture bytes sheet tile
+ *
+ * where bytes is the resident size of the texture, sheet the output sheet being
+ * rendered (the first sheet of a batch of small sheets) and tile the tile of the
+ * sheet. The textures of distinct jobs are held by distinct caches. Lines starting
+ * with # are comments, each job is introduced by a `# job <n> <id>` line */
+
+struct TextureAccess {
+    int job;
+    int texture;
+    uint64_t bytes;
+    int sheet;
+    int tile;
+};
+
+/* Writes the accesses to the trace file, can be shared by the texture objects of
+ * several jobs and used from several threads */
+class TextureAccessTrace {
+
+public:
+
+    /* Opens the trace file, check Good() for errors */
+    explicit TextureAccessTrace(const std::string& path);
+
+    bool Good() const;
+
+    /* Starts the trace of a job, returns the job number to record its accesses with */
+    int BeginJob(const std::string& id);
+
+    void Record(const TextureAccess& access);
+
+    /* Flushes the file, returns false if writing failed */
+    bool Flush();
+
+private:
+
+    std::mutex mtx;
+    std::ofstream out;
+    int jobs = 0;
+};
+
+/* Reads the trace file, returns false if it cannot be read or is malformed */
+bool ReadTextureAccessTrace(const std::string& path, std::vector<TextureAccess>& trace);
+
+enum class TextureCachePolicy {
+    LRU,       // evicts the least recently used texture, as TextureObject without an access plan
+    CostAware, // GreedyDual-Size-Frequency, keeps the textures that are used often and cost more to upload per byte
+    Planned    // evicts the texture used again farthest in the future (Belady), the bound of the planned orders
+};
+
+const char *TextureCachePolicyName(TextureCachePolicy policy);
+
+struct TextureCacheReplay {
+    uint64_t accesses = 0;
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t evictions = 0;
+    uint64_t uploadBytes = 0;
+
+    double HitRate() const { return accesses > 0 ? double(hits) / double(accesses) : 0.0; }
+};
+
+/* Replays the trace against a cache of the given policy and budget (0 for unlimited).
+ * Each job starts with an empty cache, a texture larger than the budget is uploaded
+ * anyway (as TextureObject does) after evicting everything else */
+TextureCacheReplay ReplayTextureAccessTrace(const std::vector<TextureAccess>& trace, TextureCachePolicy policy, uint64_t budgetBytes);
+
+#endif // TEXTURE_ACCESS_TRACE_H
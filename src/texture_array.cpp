@@ -0,0 +1,212 @@
+/*******************************************************************************
+    Copyright (c) 2021, Andrea Maggiordomo, Paolo Cignoni and Marco Tarini
+
+    This file is part of TextureDefrag, a reference implementation for
+    the paper ``Texture Defragmentation for Photo-Reconstructed 3D Models''
+    by Andrea Maggiordomo, Paolo Cignoni and Marco Tarini.
+
+    TextureDefrag is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    TextureDefrag is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with TextureDefrag. If not, see <https://www.gnu.org/licenses/>.
+*******************************************************************************/
+
+
+#include "texture_array.h"
+#include "gl_utils.h"
+#include "logging.h"
+#include "utils.h"
+
+#include <algorithm>
+#include <chrono>
+#include <map>
+#include <utility>
+
+#include <QImage>
+
+
+TextureArrays::TextureArrays(TextureObjectHandle textureObject, uint64_t budgetBytes)
+    : textureObject{textureObject}
+{
+    OpenGLFunctionsHandle glFuncs = GetOpenGLFunctionsHandle();
+
+    GLint maxLayers = 0;
+    GLint maxSize = 0;
+    glFuncs->glGetIntegerv(GL_MAX_ARRAY_TEXTURE_LAYERS, &maxLayers);
+    glFuncs->glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxSize);
+
+    // group the textures by size
+    const int n = (int) textureObject->ArraySize();
+    arrayVec.resize(n, -1);
+    layerVec.resize(n, -1);
+    std::map<std::pair<int, int>, int> arrayIndex;
+    std::vector<int> textureCount;
+    uint64_t totalBytes = 0;
+    for (int i = 0; i < n; ++i) {
+        int w = textureObject->TextureWidth(i);
+        int h = textureObject->TextureHeight(i);
+        if (w > maxSize || h > maxSize)
+            continue;
+        auto key = std::make_pair(w, h);
+        if (arrayIndex.count(key) == 0) {
+            arrayIndex[key] = (int) arrays.size();
+            arrays.emplace_back();
+            arrays.back().size = {w, h};
+            textureCount.push_back(0);
+        }
+        arrayVec[i] = arrayIndex[key];
+        textureCount[arrayVec[i]]++;
+        totalBytes += uint64_t(w) * h * 4;
+    }
+
+    uint64_t allocatedBytes = 0;
+    for (int a = 0; a < (int) arrays.size(); ++a) {
+        TextureArray& ta = arrays[a];
+        const uint64_t layerBytes = uint64_t(ta.size.w) * ta.size.h * 4;
+        uint64_t layers = std::min<uint64_t>(textureCount[a], maxLayers);
+        if (budgetBytes > 0) {
+            double share = double(budgetBytes) * double(textureCount[a] * layerBytes) / double(totalBytes);
+            layers = std::min<uint64_t>(layers, uint64_t(share / layerBytes));
+        }
+        ta.layers = int(std::max<uint64_t>(layers, 1));
+
+        glFuncs->glGenTextures(1, &ta.name);
+        glFuncs->glBindTexture(GL_TEXTURE_2D_ARRAY, ta.name);
+        glFuncs->glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGBA8, ta.size.w, ta.size.h, ta.layers, 0, GL_BGRA, GL_UNSIGNED_BYTE, NULL);
+        glFuncs->glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glFuncs->glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glFuncs->glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+        glFuncs->glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+        glFuncs->glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+        CHECK_GL_ERROR();
+
+        ta.layerTex.resize(ta.layers, -1);
+        ta.lru.resize(ta.layers);
+        for (int l = 0; l < ta.layers; ++l) {
+            ta.lruList.push_back(l);
+            ta.lru[l] = std::prev(ta.lruList.end());
+        }
+        allocatedBytes += ta.layers * layerBytes;
+    }
+
+    LOG_INFO << "Texture arrays allocated with " << TotalLayers() << " layers in " << arrays.size() << " arrays ("
+             << allocatedBytes / (1024.0 * 1024.0) << " MB, " << n << " input textures)";
+}
+
+TextureArrays::~TextureArrays()
+{
+    OpenGLFunctionsHandle glFuncs = GetOpenGLFunctionsHandle();
+    for (TextureArray& ta : arrays)
+        glFuncs->glDeleteTextures(1, &ta.name);
+}
+
+int TextureArrays::ArrayOf(int i) const
+{
+    ensure(i >= 0 && i < (int) arrayVec.size());
+    return arrayVec[i];
+}
+
+int TextureArrays::LayerOf(int i) const
+{
+    ensure(i >= 0 && i < (int) layerVec.size());
+    return layerVec[i];
+}
+
+TextureSize TextureArrays::LayerSize(int a) const
+{
+    ensure(a >= 0 && a < (int) arrays.size());
+    return arrays[a].size;
+}
+
+int TextureArrays::Layers(int a) const
+{
+    ensure(a >= 0 && a < (int) arrays.size());
+    return arrays[a].layers;
+}
+
+int TextureArrays::TotalLayers() const
+{
+    int layers = 0;
+    for (const TextureArray& ta : arrays)
+        layers += ta.layers;
+    return layers;
+}
+
+bool TextureArrays::MakeResident(const std::vector<int>& textures)
+{
+    std::vector<int> requested(arrays.size(), 0);
+    for (int i : textures) {
+        if (ArrayOf(i) < 0)
+            return false;
+        requested[ArrayOf(i)]++;
+    }
+    for (int a = 0; a < (int) arrays.size(); ++a)
+        if (requested[a] > arrays[a].layers)
+            return false;
+
+    // move the resident layers to the front first, so that the layers recycled
+    // from the back never hold textures of this request
+    std::vector<int> missing;
+    for (int i : textures) {
+        if (layerVec[i] >= 0) {
+            TextureArray& ta = arrays[arrayVec[i]];
+            ta.lruList.splice(ta.lruList.begin(), ta.lruList, ta.lru[layerVec[i]]);
+            stats.layerHits++;
+        } else {
+            missing.push_back(i);
+        }
+    }
+
+    if (missing.empty())
+        return true;
+
+    auto t_upload_start = std::chrono::high_resolution_clock::now();
+    for (int i : missing) {
+        TextureArray& ta = arrays[arrayVec[i]];
+        int l = ta.lruList.back();
+        if (ta.layerTex[l] >= 0) {
+            layerVec[ta.layerTex[l]] = -1;
+            stats.layerEvictions++;
+        }
+        LoadLayer(i, l);
+        ta.layerTex[l] = i;
+        layerVec[i] = l;
+        ta.lruList.splice(ta.lruList.begin(), ta.lruList, ta.lru[l]);
+        stats.layerMisses++;
+    }
+    auto t_upload_end = std::chrono::high_resolution_clock::now();
+    stats.uploadS += std::chrono::duration<double>(t_upload_end - t_upload_start).count();
+
+    return true;
+}
+
+void TextureArrays::Bind(int a, int unit)
+{
+    ensure(a >= 0 && a < (int) arrays.size());
+    OpenGLFunctionsHandle glFuncs = GetOpenGLFunctionsHandle();
+    glFuncs->glActiveTexture(GL_TEXTURE0 + unit);
+    glFuncs->glBindTexture(GL_TEXTURE_2D_ARRAY, arrays[a].name);
+    CHECK_GL_ERROR();
+}
+
+void TextureArrays::LoadLayer(int i, int layer)
+{
+    QImage img = ToARGB32(ReadTextureImage(textureObject->texInfoVec[i]));
+    ensure(!img.isNull());
+    ensure(img.width() == textureObject->TextureWidth(i) && img.height() == textureObject->TextureHeight(i));
+
+    OpenGLFunctionsHandle glFuncs = GetOpenGLFunctionsHandle();
+    glFuncs->glBindTexture(GL_TEXTURE_2D_ARRAY, arrays[arrayVec[i]].name);
+    glFuncs->glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glFuncs->glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, layer, img.width(), img.height(), 1, GL_BGRA, GL_UNSIGNED_BYTE, img.constBits());
+    glFuncs->glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+    CHECK_GL_ERROR();
+}
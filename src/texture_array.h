@@ -0,0 +1,100 @@
+/*******************************************************************************
+    Copyright (c) 2021, Andrea Maggiordomo, Paolo Cignoni and Marco Tarini
+
+    This file is part of TextureDefrag, a reference implementation for
+    the paper ``Texture Defragmentation for Photo-Reconstructed 3D Models''
+    by Andrea Maggiordomo, Paolo Cignoni and Marco Tarini.
+
+    TextureDefrag is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    TextureDefrag is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with TextureDefrag. If not, see <https://www.gnu.org/licenses/>.
+*******************************************************************************/
+
+
+#ifndef TEXTURE_ARRAY_H
+#define TEXTURE_ARRAY_H
+
+#include "texture_object.h"
+
+#include <vector>
+#include <list>
+#include <cstdint>
+
+/* Keeps the input textures of a TextureObject as layers of texture arrays, one
+ * array for each distinct texture size, so that the faces sampling any number of
+ * inputs of the same size are drawn with a single draw call, with the layer index
+ * in the vertex stream. The arrays share the memory budget in proportion to the
+ * size of their textures, and their layers are recycled in LRU order. Texel rows
+ * are stored top to bottom, as decoded, and the v coordinate is flipped when the
+ * arrays are sampled. */
+class TextureArrays {
+
+public:
+
+    struct Stats {
+        uint64_t layerHits = 0;
+        uint64_t layerMisses = 0;
+        uint64_t layerEvictions = 0;
+        double uploadS = 0.0;
+    };
+
+    /* Allocates the arrays within budgetBytes (0 means a layer for every texture,
+     * up to the OpenGL limit) */
+    TextureArrays(TextureObjectHandle textureObject, uint64_t budgetBytes);
+    ~TextureArrays();
+
+    TextureArrays(const TextureArrays &) = delete;
+    TextureArrays &operator=(const TextureArrays &) = delete;
+
+    int ArrayCount() const { return (int) arrays.size(); }
+
+    /* Returns the array of texture i, -1 if the texture is too large for an array */
+    int ArrayOf(int i) const;
+
+    /* Returns the layer of texture i, -1 if the texture is not resident */
+    int LayerOf(int i) const;
+
+    TextureSize LayerSize(int a) const;
+    int Layers(int a) const;
+    int TotalLayers() const;
+
+    /* Makes the textures resident, textures must be unique. Returns false, without
+     * changing the resident layers, if they do not fit in their arrays */
+    bool MakeResident(const std::vector<int>& textures);
+
+    /* Binds the array a to the given texture unit */
+    void Bind(int a, int unit);
+
+    Stats GetStats() const { return stats; }
+
+private:
+
+    struct TextureArray {
+        TextureSize size;
+        int layers = 0;
+        uint32_t name = 0;
+        std::vector<int> layerTex;                   // texture stored in each layer, -1 if free
+        std::list<int> lruList;                      // layers, most-recently-used at front
+        std::vector<std::list<int>::iterator> lru;
+    };
+
+    void LoadLayer(int i, int layer);
+
+    TextureObjectHandle textureObject;
+    std::vector<TextureArray> arrays;
+    std::vector<int> arrayVec;  // array of each texture
+    std::vector<int> layerVec;  // layer of each texture
+
+    Stats stats;
+};
+
+#endif // TEXTURE_ARRAY_H
@@ -20,12 +20,21 @@
 *******************************************************************************/
 
 #include "texture_object.h"
+#include "texture_predecode.h"
 #include "logging.h"
 #include "utils.h"
 #include "gl_utils.h"
+#include "memory_budget.h"
+#include "trace.h"
+#include "remote_input.h"
+#include "async_io.h"
+#include "texture_access_trace.h"
 
 #include <cmath>
+#include <cstring>
 #include <algorithm>
+#include <chrono>
+#include <cstdint>
 
 #ifdef _OPENMP
 #include <omp.h>
@@ -33,9 +42,33 @@
 
 #include <QImageReader>
 #include <QImage>
+#include <QBuffer>
+#include <QFile>
+#include <QFileInfo>
+#include <QByteArray>
 #include <QOpenGLContext>
 
 
+// bytes read from the start of the remote images still downloading to parse their size
+constexpr int REMOTE_HEADER_BYTES = 128 * 1024;
+
+#ifndef GL_COMPRESSED_RGBA_BPTC_UNORM
+#define GL_COMPRESSED_RGBA_BPTC_UNORM 0x8E8C
+#endif
+
+static bool DecodeImage(const TextureImageInfo& tii, int reduction, int width, int height, unsigned char *dst);
+static inline QRgb PackARGB(unsigned r, unsigned g, unsigned b, unsigned a);
+static bool ReadFileRange(const std::string& path, uint64_t offset, uint64_t size, unsigned char *dst);
+static bool ReadHeaderSize(QIODevice& file, TextureSize *size);
+static bool ReadJPEGSize(QIODevice& file, TextureSize *size);
+static bool ReadTIFFSize(QIODevice& file, bool bigEndian, TextureSize *size);
+static uint32_t ReadU16BE(const unsigned char *p);
+static uint32_t ReadU32BE(const unsigned char *p);
+static uint32_t ReadU32(const unsigned char *p);
+static bool ParseKTX2BC7(const std::string& path, int width, int height, uint64_t *offset, uint64_t *size, bool *topDown);
+static bool ParseDDSBC7(const std::string& path, int width, int height, uint64_t *offset, uint64_t *size);
+static uint64_t BC7Size(int width, int height);
+
 TextureObject::TextureObject()
 {
     SetCacheBudgetGB(8.0);
@@ -53,53 +86,129 @@ TextureObject::~TextureObject()
 
 bool TextureObject::AddImage(std::string path)
 {
-    QImageReader qir(QString(path.c_str()));
-    if (qir.canRead()) {
-        TextureImageInfo tii = {};
-        tii.path = path;
-        tii.size = { qir.size().width(), qir.size().height() };
-        texInfoVec.push_back(tii);
-        texNameVec.push_back(0);
-        texBytesVec_.push_back(0);
-        return true;
-    } else return false;
+    TextureSize size;
+    if (!ReadImageSize(path, &size))
+        return false;
+    return AddImage(path, size);
+}
+
+bool TextureObject::AddImage(std::string path, TextureSize size)
+{
+    if (size.w <= 0 || size.h <= 0)
+        return false;
+    TextureImageInfo tii = {};
+    tii.path = path;
+    tii.size = size;
+    texInfoVec.push_back(tii);
+    texNameVec.push_back(0);
+    texBytesVec_.push_back(0);
+    sidecarVec_.push_back(CompressedSource());
+    texFlippedVec_.push_back(false);
+    mipLevelVec_.push_back(0);
+    loadSecondsVec_.push_back(0.0);
+    evictedVec_.push_back(false);
+    return true;
+}
+
+bool TextureObject::AddImage(const std::string& name, TextureSize size, std::function<QImage()> source)
+{
+    if (!source || size.w <= 0 || size.h <= 0)
+        return false;
+    TextureImageInfo tii = {};
+    tii.path = name;
+    tii.size = size;
+    tii.source = std::move(source);
+    texInfoVec.push_back(tii);
+    texNameVec.push_back(0);
+    texBytesVec_.push_back(0);
+    // in memory images have no compressed sidecar file
+    CompressedSource src;
+    src.scanned = true;
+    sidecarVec_.push_back(src);
+    texFlippedVec_.push_back(false);
+    mipLevelVec_.push_back(0);
+    loadSecondsVec_.push_back(0.0);
+    evictedVec_.push_back(false);
+    return true;
+}
+
+TextureObjectHandle TextureObject::CreateSibling() const
+{
+    TextureObjectHandle sibling = std::make_shared<TextureObject>();
+    sibling->texInfoVec = texInfoVec;
+    sibling->texNameVec.assign(texInfoVec.size(), 0);
+    sibling->texBytesVec_.assign(texInfoVec.size(), 0);
+    sibling->sidecarVec_ = sidecarVec_;
+    sibling->texFlippedVec_.assign(texInfoVec.size(), false);
+    sibling->mipLevelVec_ = mipLevelVec_;
+    sibling->loadSecondsVec_.assign(texInfoVec.size(), 0.0);
+    sibling->evictedVec_.assign(texInfoVec.size(), false);
+    sibling->cacheBudgetBytes_ = cacheBudgetBytes_;
+    sibling->compressed_ = compressed_;
+    return sibling;
 }
 
 void TextureObject::Bind(int i)
 {
     OpenGLFunctionsHandle glFuncs = GetOpenGLFunctionsHandle();
     ensure(i >= 0 && i < (int) texInfoVec.size());
-    // load texture from qimage on first use
-    if (texNameVec[i] == 0) {
+    if (trace_)
+        trace_->Record({traceJob_, i, ResidentBytes(ResidentWidth(i), ResidentHeight(i)), traceSheet_, traceTile_});
+    // follow the plan, skipping ahead to the next use of the texture if needed
+    if (accessPos_ < accessPlan_.size()) {
+        if (accessPlan_[accessPos_] == i) {
+            accessPos_++;
+        } else {
+            std::size_t next = NextUse(i);
+            if (next != SIZE_MAX)
+                accessPos_ = next + 1;
+        }
+    }
+    auto t_load_start = std::chrono::high_resolution_clock::now();
+    const bool miss = (texNameVec[i] == 0);
+    if (miss) {
         cacheMisses_++;
-        QImage img(texInfoVec[i].path.c_str());
-        ensure(!img.isNull());
-        if ((img.format() != QImage::Format_RGB32) && (img.format() != QImage::Format_ARGB32)) {
-            QImage glimg = img.convertToFormat(QImage::Format_ARGB32);
-            img = glimg;
+        if (evictedVec_[i])
+            reloads_++;
+        // finish the upload if the texture was prefetched
+        if (pending_.count(i) > 0) {
+            auto t_wait_start = std::chrono::high_resolution_clock::now();
+            pending_[i].decoded.wait();
+            auto t_wait_end = std::chrono::high_resolution_clock::now();
+            prefetchWaitS_ += std::chrono::duration<double>(t_wait_end - t_wait_start).count();
+            UploadPending(i);
+        }
+    }
+    // load the compressed blocks if there is a sidecar file
+    if (texNameVec[i] == 0 && compressed_ && mipLevelVec_[i] == 0 && !Sidecar(i).path.empty()) {
+        const CompressedSource& src = Sidecar(i);
+        std::vector<unsigned char> blocks(src.size);
+        if (ReadFileRange(src.path, src.offset, src.size, blocks.data())) {
+            EvictIfNeeded(src.size);
+            UploadBlocks(i, blocks.data(), src.size, src.topDown);
+            TouchLRU(i);
+        } else {
+            LOG_WARN << "Unable to read " << src.path << ", compressing " << texInfoVec[i].path << " at upload";
         }
+    }
+    // load texture from qimage on first use, the decoded rows are uploaded top to
+    // bottom and the v coordinate is flipped when sampling, instead of mirroring
+    if (texNameVec[i] == 0) {
+        QImage img = ToARGB32(ReadTextureImage(texInfoVec[i], 1 << mipLevelVec_[i]));
+        ensure(!img.isNull());
+        ensure(img.width() == ResidentWidth(i) && img.height() == ResidentHeight(i));
 
         // Before allocating, ensure we have space within the GPU cache budget
-        const uint64_t bytesNeeded = static_cast<uint64_t>(img.width()) * static_cast<uint64_t>(img.height()) * 4ull;
+        const uint64_t bytesNeeded = ResidentBytes(img.width(), img.height());
         EvictIfNeeded(bytesNeeded);
 
-        glFuncs->glGenTextures(1, &texNameVec[i]);
-
-        Mirror(img);
-        glFuncs->glBindTexture(GL_TEXTURE_2D, texNameVec[i]);
-        glFuncs->glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
-
-        glFuncs->glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, img.width(), img.height(), 0, GL_BGRA, GL_UNSIGNED_BYTE, img.constBits());
-        glFuncs->glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-        glFuncs->glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-        CHECK_GL_ERROR();
-
-        // Track memory usage and LRU
-        texBytesVec_[i] = bytesNeeded;
-        currentCacheBytes_ += bytesNeeded;
+        UploadImage(i, img.width(), img.height(), img.constBits(), true);
         TouchLRU(i);
     }
-    else {
+    if (miss) {
+        auto t_load_end = std::chrono::high_resolution_clock::now();
+        loadSecondsVec_[i] = std::chrono::duration<double>(t_load_end - t_load_start).count();
+    } else {
         cacheHits_++;
         glFuncs->glBindTexture(GL_TEXTURE_2D, texNameVec[i]);
         TouchLRU(i);
@@ -107,9 +216,71 @@ void TextureObject::Bind(int i)
     }
 }
 
+void TextureObject::Prefetch(const std::vector<int>& indices)
+{
+    TRACE_SCOPE_CAT("Prefetch", "gl");
+    OpenGLFunctionsHandle glFuncs = GetOpenGLFunctionsHandle();
+
+    // upload the textures whose decoding is complete
+    std::vector<std::size_t> ready;
+    for (auto& entry : pending_) {
+        if (entry.second.decoded.wait_for(std::chrono::seconds(0)) == std::future_status::ready)
+            ready.push_back(entry.first);
+    }
+    for (std::size_t idx : ready)
+        UploadPending(idx);
+
+    std::unordered_set<std::size_t> pinned(indices.begin(), indices.end());
+    if (!lruList_.empty())
+        pinned.insert(lruList_.front()); // the texture currently bound
+
+    for (int i : indices) {
+        ensure(i >= 0 && i < (int) texInfoVec.size());
+        if (texNameVec[i] != 0 || pending_.count(i) > 0)
+            continue;
+
+        const int width = ResidentWidth(i);
+        const int height = ResidentHeight(i);
+        const int reduction = 1 << mipLevelVec_[i];
+        const uint64_t bytes = ResidentBytes(width, height);
+        if (!EvictIfNeeded(bytes, &pinned))
+            break;
+
+        const CompressedSource src = (compressed_ && reduction == 1) ? Sidecar(i) : CompressedSource();
+        const uint64_t bufferBytes = src.path.empty() ? uint64_t(width) * uint64_t(height) * 4ull : src.size;
+
+        PendingUpload& pu = pending_[i];
+        pu.bytes = bytes;
+        pu.blocks = !src.path.empty();
+        pendingBytes_ += bytes;
+
+        glFuncs->glGenBuffers(1, &pu.pbo);
+        glFuncs->glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pu.pbo);
+        glFuncs->glBufferData(GL_PIXEL_UNPACK_BUFFER, bufferBytes, NULL, GL_STREAM_DRAW);
+        unsigned char *dst = (unsigned char *) glFuncs->glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, bufferBytes,
+                                                                         GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+        glFuncs->glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        CHECK_GL_ERROR();
+
+        if (dst == nullptr) {
+            CancelPending(i);
+            break;
+        }
+
+        TextureImageInfo tii = texInfoVec[i];
+        pu.decoded = std::async(std::launch::async, [tii, width, height, reduction, src, dst]() {
+            if (!src.path.empty())
+                return ReadFileRange(src.path, src.offset, src.size, dst);
+            return DecodeImage(tii, reduction, width, height, dst);
+        });
+        prefetched_++;
+    }
+}
+
 void TextureObject::Release(int i)
 {
     ensure(i >= 0 && i < (int) texInfoVec.size());
+    CancelPending(i);
     if (texNameVec[i]) {
         OpenGLFunctionsHandle glFuncs = GetOpenGLFunctionsHandle();
         glFuncs->glDeleteTextures(1, &texNameVec[i]);
@@ -117,6 +288,7 @@ void TextureObject::Release(int i)
         // Update memory tracking and LRU map
         if (texBytesVec_.size() > static_cast<size_t>(i)) {
             currentCacheBytes_ -= texBytesVec_[i];
+            MemoryAdd(MemorySubsystem::GPUTextures, -(long long) texBytesVec_[i]);
             texBytesVec_[i] = 0;
         }
         RemoveFromLRU(i);
@@ -142,6 +314,35 @@ int TextureObject::TextureHeight(std::size_t i)
     return texInfoVec[i].size.h;
 }
 
+void TextureObject::SetMipLevel(std::size_t i, int level)
+{
+    ensure(i < mipLevelVec_.size() && level >= 0);
+    if (mipLevelVec_[i] == level)
+        return;
+    Release(int(i));
+    mipLevelVec_[i] = level;
+}
+
+int TextureObject::MipLevel(std::size_t i) const
+{
+    ensure(i < mipLevelVec_.size());
+    return mipLevelVec_[i];
+}
+
+int TextureObject::ResidentWidth(std::size_t i) const
+{
+    ensure(i < texInfoVec.size());
+    const int reduction = 1 << mipLevelVec_[i];
+    return (texInfoVec[i].size.w + reduction - 1) / reduction;
+}
+
+int TextureObject::ResidentHeight(std::size_t i) const
+{
+    ensure(i < texInfoVec.size());
+    const int reduction = 1 << mipLevelVec_[i];
+    return (texInfoVec[i].size.h + reduction - 1) / reduction;
+}
+
 int TextureObject::MaxSize()
 {
     int maxsz = 0;
@@ -198,6 +399,52 @@ std::vector<std::pair<double, double>> TextureObject::ComputeRelativeSizes()
     return trs;
 }
 
+QImage ReadTextureImage(const TextureImageInfo& tii, int reduction)
+{
+    const QSize reducedSize((tii.size.w + reduction - 1) / reduction, (tii.size.h + reduction - 1) / reduction);
+    if (tii.source) {
+        QImage img = tii.source();
+        if (reduction > 1 && !img.isNull())
+            img = img.scaled(reducedSize, Qt::IgnoreAspectRatio, Qt::SmoothTransformation);
+        return img;
+    }
+
+    // the image may have been decoded in the background (see TexturePredecoder)
+    QImage img = FindPredecodedImage(tii.path, reduction);
+    if (!img.isNull())
+        return img;
+
+    // the remote files are read once downloaded (see remote_input.h)
+    if (!WaitForRemoteFile(tii.path))
+        return QImage();
+    if (!DecodeImageFile(tii.path, reduction > 1 ? reducedSize : QSize(), &img))
+        return QImage();
+    // kept for the later jobs of a batch (see SetRetainedImageBudget)
+    if (reduction == 1)
+        RetainDecodedImage(tii.path, img);
+    return img;
+}
+
+bool DecodeImageFile(const std::string& path, const QSize& scaledSize, QImage *img)
+{
+    if (AsyncIODepth() > 0) {
+        std::vector<char> data;
+        if (!ReadFileData(path, data))
+            return false;
+        QByteArray bytes = QByteArray::fromRawData(data.data(), int(data.size()));
+        QBuffer buffer(&bytes);
+        buffer.open(QIODevice::ReadOnly);
+        QImageReader reader(&buffer, QFileInfo(QString(path.c_str())).suffix().toLower().toLatin1());
+        if (scaledSize.isValid())
+            reader.setScaledSize(scaledSize);
+        return reader.read(img);
+    }
+    QImageReader reader(QString(path.c_str()));
+    if (scaledSize.isValid())
+        reader.setScaledSize(scaledSize);
+    return reader.read(img);
+}
+
 void Mirror(QImage& img)
 {
     const int height = img.height();
@@ -213,6 +460,119 @@ void Mirror(QImage& img)
     }
 }
 
+bool ReadImageSize(const std::string& path, TextureSize *size)
+{
+    // the headers of the remote files are read without waiting for the downloads,
+    // the formats not parsed here are probed by Qt once downloaded
+    if (IsStagedRemoteFile(path)) {
+        QByteArray header;
+        if (ReadRemoteFilePrefix(path, REMOTE_HEADER_BYTES, &header)) {
+            QBuffer buffer(&header);
+            if (buffer.open(QIODevice::ReadOnly) && ReadHeaderSize(buffer, size))
+                return true;
+        }
+        if (!WaitForRemoteFile(path))
+            return false;
+    }
+    {
+        QFile file(path.c_str());
+        if (!file.open(QIODevice::ReadOnly))
+            return false;
+        if (ReadHeaderSize(file, size))
+            return true;
+    }
+    QImageReader qir(QString(path.c_str()));
+    if (!qir.canRead() || !qir.size().isValid())
+        return false;
+    size->w = qir.size().width();
+    size->h = qir.size().height();
+    return true;
+}
+
+void CopyImageARGB32(const QImage& img, unsigned char *dst, bool bottomUp)
+{
+    const int width = img.width();
+    const int height = img.height();
+    const std::size_t rowBytes = std::size_t(width) * 4;
+    const QImage::Format format = img.format();
+
+    // the formats not produced by the decoders go through Qt
+    QImage converted;
+    const QImage *src = &img;
+    switch (format) {
+    case QImage::Format_RGB32:
+    case QImage::Format_ARGB32:
+    case QImage::Format_RGBA8888:
+    case QImage::Format_RGBX8888:
+    case QImage::Format_RGB888:
+    case QImage::Format_Grayscale8:
+    case QImage::Format_Indexed8:
+        break;
+    default:
+        converted = img.convertToFormat(QImage::Format_ARGB32);
+        src = &converted;
+    }
+    const QImage::Format srcFormat = src->format();
+
+    std::vector<QRgb> colorTable;
+    if (srcFormat == QImage::Format_Indexed8) {
+        QVector<QRgb> table = src->colorTable();
+        colorTable.assign(table.begin(), table.end());
+        colorTable.resize(256, PackARGB(0, 0, 0, 255));
+    }
+
+#ifdef _OPENMP
+    #pragma omp parallel for schedule(static) if (height >= 64)
+#endif
+    for (int y = 0; y < height; ++y) {
+        const uchar *in = src->constScanLine(y);
+        QRgb *out = reinterpret_cast<QRgb *>(dst + std::size_t(bottomUp ? height - 1 - y : y) * rowBytes);
+        switch (srcFormat) {
+        case QImage::Format_RGB32:
+        case QImage::Format_ARGB32:
+            std::memcpy(out, in, rowBytes);
+            break;
+        case QImage::Format_RGBA8888:
+            #pragma omp simd
+            for (int x = 0; x < width; ++x)
+                out[x] = PackARGB(in[4*x], in[4*x+1], in[4*x+2], in[4*x+3]);
+            break;
+        case QImage::Format_RGBX8888:
+            #pragma omp simd
+            for (int x = 0; x < width; ++x)
+                out[x] = PackARGB(in[4*x], in[4*x+1], in[4*x+2], 255);
+            break;
+        case QImage::Format_RGB888:
+            #pragma omp simd
+            for (int x = 0; x < width; ++x)
+                out[x] = PackARGB(in[3*x], in[3*x+1], in[3*x+2], 255);
+            break;
+        case QImage::Format_Grayscale8:
+            #pragma omp simd
+            for (int x = 0; x < width; ++x)
+                out[x] = PackARGB(in[x], in[x], in[x], 255);
+            break;
+        case QImage::Format_Indexed8:
+            for (int x = 0; x < width; ++x)
+                out[x] = colorTable[in[x]];
+            break;
+        default:
+            break;
+        }
+    }
+}
+
+QImage ToARGB32(const QImage& img)
+{
+    if (img.isNull() || img.format() == QImage::Format_RGB32 || img.format() == QImage::Format_ARGB32)
+        return img;
+    QImage converted(img.width(), img.height(), QImage::Format_ARGB32);
+    if (converted.isNull())
+        return converted;
+    CopyImageARGB32(img, converted.bits(), false);
+    return converted;
+}
+
 void TextureObject::SetCacheBudgetGB(double gigabytes)
 {
     if (gigabytes <= 0) {
@@ -242,27 +602,92 @@ uint64_t TextureObject::GetCurrentCacheBytes() const
     return currentCacheBytes_;
 }
 
-void TextureObject::EvictIfNeeded(uint64_t bytesToAdd)
-{
-    if (cacheBudgetBytes_ == 0) return; // unlimited
-    // Evict while exceeding budget
-    while (currentCacheBytes_ + bytesToAdd > cacheBudgetBytes_) {
-        if (lruList_.empty()) break;
-        std::size_t victim = lruList_.back();
-        lruList_.pop_back();
-        lruMap_.erase(victim);
-        if (victim < texNameVec.size() && texNameVec[victim] != 0) {
-            OpenGLFunctionsHandle glFuncs = GetOpenGLFunctionsHandle();
-            glFuncs->glDeleteTextures(1, &texNameVec[victim]);
-            texNameVec[victim] = 0;
-            if (victim < texBytesVec_.size()) {
-                cacheEvictions_++;
-                bytesEvicted_ += texBytesVec_[victim];
-                currentCacheBytes_ -= texBytesVec_[victim];
-                texBytesVec_[victim] = 0;
-            }
+void TextureObject::SetAccessTrace(std::shared_ptr<TextureAccessTrace> trace, int job)
+{
+    trace_ = trace;
+    traceJob_ = job;
+    traceSheet_ = 0;
+    traceTile_ = 0;
+}
+
+void TextureObject::SetAccessPlan(const std::vector<int>& plan)
+{
+    accessPlan_ = plan;
+    accessPos_ = 0;
+    accessUses_.clear();
+    for (std::size_t k = 0; k < accessPlan_.size(); ++k)
+        accessUses_[accessPlan_[k]].push_back(k);
+}
+
+std::size_t TextureObject::NextUse(std::size_t idx) const
+{
+    auto it = accessUses_.find(idx);
+    if (it == accessUses_.end())
+        return SIZE_MAX;
+    auto pos = std::lower_bound(it->second.begin(), it->second.end(), accessPos_);
+    return (pos == it->second.end()) ? SIZE_MAX : *pos;
+}
+
+std::list<std::size_t>::iterator TextureObject::ChooseVictim(const std::unordered_set<std::size_t> *pinned)
+{
+    // the least recently used of the textures that are not pinned and not used again
+    // in the plan (all of them without a plan)
+    for (auto it = lruList_.end(); it != lruList_.begin();) {
+        --it;
+        if (pinned && pinned->count(*it) > 0)
+            continue;
+        if (NextUse(*it) == SIZE_MAX)
+            return it;
+    }
+
+    // otherwise the texture that frees the most bytes for the longest time for the
+    // least load time, textures never loaded by Bind are assumed to load at 1 GB/s
+    auto victim = lruList_.end();
+    double bestScore = -1.0;
+    for (auto it = lruList_.begin(); it != lruList_.end(); ++it) {
+        if (pinned && pinned->count(*it) > 0)
+            continue;
+        double distance = double(NextUse(*it) - accessPos_ + 1);
+        double bytes = double(texBytesVec_[*it]);
+        double cost = (loadSecondsVec_[*it] > 0.0) ? loadSecondsVec_[*it] : bytes * 1e-9;
+        double score = distance * bytes / std::max(cost, 1e-6);
+        if (score > bestScore) {
+            bestScore = score;
+            victim = it;
         }
     }
+    return victim;
+}
+
+void TextureObject::Evict(std::size_t idx)
+{
+    RemoveFromLRU(idx);
+    if (idx < texNameVec.size() && texNameVec[idx] != 0) {
+        OpenGLFunctionsHandle glFuncs = GetOpenGLFunctionsHandle();
+        glFuncs->glDeleteTextures(1, &texNameVec[idx]);
+        texNameVec[idx] = 0;
+        if (idx < texBytesVec_.size()) {
+            cacheEvictions_++;
+            bytesEvicted_ += texBytesVec_[idx];
+            currentCacheBytes_ -= texBytesVec_[idx];
+            MemoryAdd(MemorySubsystem::GPUTextures, -(long long) texBytesVec_[idx]);
+            texBytesVec_[idx] = 0;
+        }
+        evictedVec_[idx] = true;
+    }
+}
+
+bool TextureObject::EvictIfNeeded(uint64_t bytesToAdd, const std::unordered_set<std::size_t> *pinned)
+{
+    if (cacheBudgetBytes_ == 0) return true; // unlimited
+    // Evict while exceeding budget, the pending uploads already reserved their bytes
+    while (currentCacheBytes_ + pendingBytes_ + bytesToAdd > cacheBudgetBytes_) {
+        auto it = ChooseVictim(pinned);
+        if (it == lruList_.end())
+            break;
+        Evict(*it);
+    }
+    return currentCacheBytes_ + pendingBytes_ + bytesToAdd <= cacheBudgetBytes_;
 }
 
 void TextureObject::TouchLRU(std::size_t idx)
@@ -289,6 +714,10 @@ void TextureObject::ResetCacheStats() {
     cacheMisses_ = 0;
     cacheEvictions_ = 0;
     bytesEvicted_ = 0;
+    prefetched_ = 0;
+    prefetchWaitS_ = 0.0;
+    reloads_ = 0;
+    evictedVec_.assign(texInfoVec.size(), false);
 }
 
 TextureObject::CacheStats TextureObject::GetCacheStats() const {
@@ -297,5 +726,395 @@ TextureObject::CacheStats TextureObject::GetCacheStats() const {
     s.misses = cacheMisses_;
     s.evictions = cacheEvictions_;
     s.bytesEvicted = bytesEvicted_;
+    s.prefetched = prefetched_;
+    s.prefetchWaitS = prefetchWaitS_;
+    s.reloads = reloads_;
     return s;
-}
\ No newline at end of file
+}
+
+void TextureObject::UploadPending(std::size_t idx)
+{
+    TRACE_SCOPE_CAT("UploadPending", "gl");
+    auto it = pending_.find(idx);
+    ensure(it != pending_.end());
+    PendingUpload& pu = it->second;
+    bool decoded = pu.decoded.get();
+
+    OpenGLFunctionsHandle glFuncs = GetOpenGLFunctionsHandle();
+    glFuncs->glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pu.pbo);
+    bool unmapped = glFuncs->glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+    if (decoded && unmapped) {
+        // the reserved bytes move from the pending uploads to the cache
+        pendingBytes_ -= pu.bytes;
+        if (pu.blocks)
+            UploadBlocks(idx, nullptr, sidecarVec_[idx].size, sidecarVec_[idx].topDown);
+        else
+            UploadImage(idx, ResidentWidth(idx), ResidentHeight(idx), nullptr, true);
+        TouchLRU(idx);
+    } else {
+        LOG_WARN << "Prefetching texture " << texInfoVec[idx].path << " failed";
+        pendingBytes_ -= pu.bytes;
+    }
+    glFuncs->glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    glFuncs->glDeleteBuffers(1, &pu.pbo);
+    pending_.erase(it);
+    // if the upload failed Bind() falls back to the synchronous load
+}
+
+void TextureObject::CancelPending(std::size_t idx)
+{
+    auto it = pending_.find(idx);
+    if (it == pending_.end())
+        return;
+    PendingUpload& pu = it->second;
+    if (pu.decoded.valid())
+        pu.decoded.wait();
+    OpenGLFunctionsHandle glFuncs = GetOpenGLFunctionsHandle();
+    glFuncs->glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pu.pbo);
+    glFuncs->glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+    glFuncs->glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    glFuncs->glDeleteBuffers(1, &pu.pbo);
+    pendingBytes_ -= pu.bytes;
+    pending_.erase(it);
+}
+
+/* Creates the texture idx from pixels, which is either a client pointer or an
+ * offset in the bound pixel unpack buffer, topDown is the order of the rows */
+void TextureObject::UploadImage(std::size_t idx, int width, int height, const void *pixels, bool topDown)
+{
+    TRACE_SCOPE_CAT("UploadImage", "gl");
+    OpenGLFunctionsHandle glFuncs = GetOpenGLFunctionsHandle();
+
+    glFuncs->glGenTextures(1, &texNameVec[idx]);
+    glFuncs->glBindTexture(GL_TEXTURE_2D, texNameVec[idx]);
+    glFuncs->glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+
+    // in compressed mode the driver encodes the texels to BC7
+    GLint internalFormat = compressed_ ? GL_COMPRESSED_RGBA_BPTC_UNORM : GL_RGBA8;
+    glFuncs->glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, width, height, 0, GL_BGRA, GL_UNSIGNED_BYTE, pixels);
+    glFuncs->glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glFuncs->glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    CHECK_GL_ERROR();
+
+    // Track memory usage
+    texBytesVec_[idx] = ResidentBytes(width, height);
+    currentCacheBytes_ += texBytesVec_[idx];
+    MemoryAdd(MemorySubsystem::GPUTextures, texBytesVec_[idx]);
+    texFlippedVec_[idx] = topDown;
+}
+
+/* Creates the texture idx from BC7 blocks, which are either a client pointer or
+ * an offset in the bound pixel unpack buffer */
+void TextureObject::UploadBlocks(std::size_t idx, const void *blocks, uint64_t size, bool topDown)
+{
+    TRACE_SCOPE_CAT("UploadBlocks", "gl");
+    OpenGLFunctionsHandle glFuncs = GetOpenGLFunctionsHandle();
+    const int width = texInfoVec[idx].size.w;
+    const int height = texInfoVec[idx].size.h;
+
+    glFuncs->glGenTextures(1, &texNameVec[idx]);
+    glFuncs->glBindTexture(GL_TEXTURE_2D, texNameVec[idx]);
+    glFuncs->glCompressedTexImage2D(GL_TEXTURE_2D, 0, GL_COMPRESSED_RGBA_BPTC_UNORM, width, height, 0, GLsizei(size), blocks);
+    glFuncs->glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glFuncs->glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    CHECK_GL_ERROR();
+
+    texBytesVec_[idx] = size;
+    currentCacheBytes_ += size;
+    MemoryAdd(MemorySubsystem::GPUTextures, size);
+    texFlippedVec_[idx] = topDown;
+}
+
+bool TextureObject::SetCompressedResidency(bool enable)
+{
+    if (enable == compressed_)
+        return true;
+    if (enable) {
+        QOpenGLContext *context = QOpenGLContext::currentContext();
+        ensure(context != nullptr);
+        bool bc7 = (context->format().version() >= qMakePair(4, 2)) || context->hasExtension("GL_ARB_texture_compression_bptc");
+        if (!bc7) {
+            LOG_WARN << "BC7 textures are not supported by the OpenGL context, input textures stay uncompressed";
+            return false;
+        }
+    }
+    ReleaseAll();
+    compressed_ = enable;
+    return true;
+}
+
+bool TextureObject::TextureFlipped(std::size_t i) const
+{
+    ensure(i < texFlippedVec_.size());
+    return texFlippedVec_[i];
+}
+
+const TextureObject::CompressedSource& TextureObject::Sidecar(std::size_t idx)
+{
+    CompressedSource& src = sidecarVec_[idx];
+    if (!src.scanned) {
+        src.scanned = true;
+        const std::string& path = texInfoVec[idx].path;
+        const int width = texInfoVec[idx].size.w;
+        const int height = texInfoVec[idx].size.h;
+        std::string base = path.substr(0, path.find_last_of('.'));
+        if (ParseKTX2BC7(base + ".ktx2", width, height, &src.offset, &src.size, &src.topDown)) {
+            src.path = base + ".ktx2";
+        } else if (ParseDDSBC7(base + ".dds", width, height, &src.offset, &src.size)) {
+            src.path = base + ".dds";
+            src.topDown = true;
+        }
+        if (!src.path.empty())
+            LOG_VERBOSE << "Using the BC7 blocks of " << src.path << " for " << path;
+    }
+    return src;
+}
+
+uint64_t TextureObject::ResidentBytes(int width, int height) const
+{
+    if (compressed_)
+        return BC7Size(width, height);
+    else
+        return static_cast<uint64_t>(width) * static_cast<uint64_t>(height) * 4ull;
+}
+
+// -- static functions ---------------------------------------------------------
+
+/* Decodes the image of the texture and writes it to dst in its final layout (rows
+ * top to bottom, in the upload format). Runs on a worker thread, without OpenGL calls */
+static bool DecodeImage(const TextureImageInfo& tii, int reduction, int width, int height, unsigned char *dst)
+{
+    QImage img = ReadTextureImage(tii, reduction);
+    if (img.isNull() || img.width() != width || img.height() != height)
+        return false;
+    CopyImageARGB32(img, dst, false);
+    return true;
+}
+
+static inline QRgb PackARGB(unsigned r, unsigned g, unsigned b, unsigned a)
+{
+    return (a << 24) | (r << 16) | (g << 8) | b;
+}
+
+static bool ReadFileRange(const std::string& path, uint64_t offset, uint64_t size, unsigned char *dst)
+{
+    QFile file(path.c_str());
+    if (!file.open(QIODevice::ReadOnly) || !file.seek(offset))
+        return false;
+    return file.read(reinterpret_cast<char *>(dst), size) == qint64(size);
+}
+
+/* Parses the size from the header of png, jpeg, tiff and webp files */
+static bool ReadHeaderSize(QIODevice& file, TextureSize *size)
+{
+    unsigned char h[32];
+    if (file.read(reinterpret_cast<char *>(h), sizeof(h)) != qint64(sizeof(h)))
+        return false;
+
+    static const unsigned char pngSignature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+    if (std::memcmp(h, pngSignature, 8) == 0) {
+        // the IHDR chunk is always the first
+        if (std::memcmp(h + 12, "IHDR", 4) != 0)
+            return false;
+        size->w = int(ReadU32BE(h + 16));
+        size->h = int(ReadU32BE(h + 20));
+    } else if (h[0] == 0xFF && h[1] == 0xD8) {
+        if (!file.seek(2) || !ReadJPEGSize(file, size))
+            return false;
+    } else if (std::memcmp(h, "II*\0", 4) == 0 || std::memcmp(h, "MM\0*", 4) == 0) {
+        if (!ReadTIFFSize(file, h[0] == 'M', size))
+            return false;
+    } else if (std::memcmp(h, "RIFF", 4) == 0 && std::memcmp(h + 8, "WEBP", 4) == 0) {
+        if (std::memcmp(h + 12, "VP8 ", 4) == 0) {
+            // lossy, the frame header follows the start code 9d 01 2a
+            if (h[23] != 0x9D || h[24] != 0x01 || h[25] != 0x2A)
+                return false;
+            size->w = int((h[26] | (h[27] << 8)) & 0x3FFF);
+            size->h = int((h[28] | (h[29] << 8)) & 0x3FFF);
+        } else if (std::memcmp(h + 12, "VP8L", 4) == 0) {
+            // lossless, 14 bits for each side minus one after the signature byte 2f
+            if (h[20] != 0x2F)
+                return false;
+            size->w = 1 + int(h[21] | ((h[22] & 0x3F) << 8));
+            size->h = 1 + int(((h[22] & 0xC0) >> 6) | (h[23] << 2) | ((h[24] & 0x0F) << 10));
+        } else if (std::memcmp(h + 12, "VP8X", 4) == 0) {
+            // extended, 24 bits for each side minus one
+            size->w = 1 + int(h[24] | (h[25] << 8) | (h[26] << 16));
+            size->h = 1 + int(h[27] | (h[28] << 8) | (h[29] << 16));
+        } else {
+            return false;
+        }
+    } else {
+        return false;
+    }
+    return size->w > 0 && size->h > 0;
+}
+
+/* Skips the jpeg segments up to the first start of frame, the file is positioned
+ * after the SOI marker */
+static bool ReadJPEGSize(QIODevice& file, TextureSize *size)
+{
+    unsigned char b[8];
+    while (true) {
+        // markers can be preceded by any number of fill bytes
+        if (!file.getChar(reinterpret_cast<char *>(b)) || b[0] != 0xFF)
+            return false;
+        unsigned char marker = 0xFF;
+        while (marker == 0xFF) {
+            if (!file.getChar(reinterpret_cast<char *>(&marker)))
+                return false;
+        }
+        // standalone markers have no length
+        if (marker == 0x01 || (marker >= 0xD0 && marker <= 0xD7))
+            continue;
+        if (marker == 0xD9 || marker == 0xDA)
+            return false;
+        if (file.read(reinterpret_cast<char *>(b), 2) != 2)
+            return false;
+        uint32_t length = ReadU16BE(b);
+        if (length < 2)
+            return false;
+        bool sof = (marker >= 0xC0 && marker <= 0xCF) && marker != 0xC4 && marker != 0xC8 && marker != 0xCC;
+        if (sof) {
+            // precision, height and width
+            if (length < 7 || file.read(reinterpret_cast<char *>(b), 5) != 5)
+                return false;
+            size->h = int(ReadU16BE(b + 1));
+            size->w = int(ReadU16BE(b + 3));
+            return true;
+        }
+        if (!file.seek(file.pos() + length - 2))
+            return false;
+    }
+}
+
+/* Reads the ImageWidth and ImageLength tags of the first IFD of a (non big) tiff file */
+static bool ReadTIFFSize(QIODevice& file, bool bigEndian, TextureSize *size)
+{
+    auto U16 = [bigEndian](const unsigned char *p) -> uint32_t { return bigEndian ? ReadU16BE(p) : uint32_t(p[0] | (p[1] << 8)); };
+    auto U32 = [bigEndian](const unsigned char *p) -> uint32_t { return bigEndian ? ReadU32BE(p) : ReadU32(p); };
+
+    unsigned char b[12];
+    if (!file.seek(4) || file.read(reinterpret_cast<char *>(b), 4) != 4)
+        return false;
+    if (!file.seek(U32(b)) || file.read(reinterpret_cast<char *>(b), 2) != 2)
+        return false;
+    int numEntries = int(U16(b));
+    size->w = size->h = 0;
+    for (int k = 0; k < numEntries && (size->w == 0 || size->h == 0); ++k) {
+        if (file.read(reinterpret_cast<char *>(b), 12) != 12)
+            return false;
+        uint32_t tag = U16(b);
+        uint32_t type = U16(b + 2);
+        if (tag != 256 && tag != 257)
+            continue;
+        // SHORT or LONG values fit in the entry
+        uint32_t value = (type == 3) ? U16(b + 8) : (type == 4) ? U32(b + 8) : 0;
+        if (tag == 256)
+            size->w = int(value);
+        else
+            size->h = int(value);
+    }
+    return size->w > 0 && size->h > 0;
+}
+
+static uint32_t ReadU16BE(const unsigned char *p)
+{
+    return (uint32_t(p[0]) << 8) | uint32_t(p[1]);
+}
+
+static uint32_t ReadU32BE(const unsigned char *p)
+{
+    return (uint32_t(p[0]) << 24) | (uint32_t(p[1]) << 16) | (uint32_t(p[2]) << 8) | uint32_t(p[3]);
+}
+
+static uint32_t ReadU32(const unsigned char *p)
+{
+    return uint32_t(p[0]) | (uint32_t(p[1]) << 8) | (uint32_t(p[2]) << 16) | (uint32_t(p[3]) << 24);
+}
+
+static uint64_t ReadU64(const unsigned char *p)
+{
+    return uint64_t(ReadU32(p)) | (uint64_t(ReadU32(p + 4)) << 32);
+}
+
+/* Accepts single-level BC7 ktx2 files without supercompression. The rows are top to
+ * bottom unless the KTXorientation value says otherwise */
+static bool ParseKTX2BC7(const std::string& path, int width, int height, uint64_t *offset, uint64_t *size, bool *topDown)
+{
+    QFile file(path.c_str());
+    if (!file.open(QIODevice::ReadOnly))
+        return false;
+    QByteArray header = file.read(104);
+    if (header.size() != 104)
+        return false;
+    const unsigned char *h = reinterpret_cast<const unsigned char *>(header.constData());
+
+    static const unsigned char identifier[12] = { 0xAB, 'K', 'T', 'X', ' ', '2', '0', 0xBB, '\r', '\n', 0x1A, '\n' };
+    const uint32_t VK_FORMAT_BC7_UNORM_BLOCK = 145;
+    const uint32_t VK_FORMAT_BC7_SRGB_BLOCK = 146;
+    uint32_t vkFormat = ReadU32(h + 12);
+    if (std::memcmp(h, identifier, 12) != 0
+            || (vkFormat != VK_FORMAT_BC7_UNORM_BLOCK && vkFormat != VK_FORMAT_BC7_SRGB_BLOCK)
+            || ReadU32(h + 20) != uint32_t(width) || ReadU32(h + 24) != uint32_t(height)
+            || ReadU32(h + 28) != 0 || ReadU32(h + 32) > 1 || ReadU32(h + 36) != 1
+            || ReadU32(h + 40) > 1 || ReadU32(h + 44) != 0)
+        return false;
+
+    *offset = ReadU64(h + 80);
+    *size = ReadU64(h + 88);
+    if (*size != BC7Size(width, height) || *offset + *size > uint64_t(file.size()))
+        return false;
+
+    *topDown = true;
+    uint32_t kvdOffset = ReadU32(h + 56);
+    uint32_t kvdLength = ReadU32(h + 60);
+    if (kvdLength > 0 && kvdLength < (1u << 20) && file.seek(kvdOffset)) {
+        QByteArray kvd = file.read(kvdLength);
+        const unsigned char *k = reinterpret_cast<const unsigned char *>(kvd.constData());
+        std::size_t pos = 0;
+        while (pos + 4 <= std::size_t(kvd.size())) {
+            std::size_t len = ReadU32(k + pos);
+            if (pos + 4 + len > std::size_t(kvd.size()))
+                break;
+            std::string entry(reinterpret_cast<const char *>(k + pos + 4), len);
+            std::size_t sep = entry.find('\0');
+            if (sep != std::string::npos && entry.substr(0, sep) == "KTXorientation")
+                *topDown = (entry.size() < sep + 3) || entry[sep + 2] != 'u';
+            pos += 4 + ((len + 3) & ~std::size_t(3));
+        }
+    }
+    return true;
+}
+
+/* Accepts dds files with a DX10 header and BC7 data, using the first mip level */
+static bool ParseDDSBC7(const std::string& path, int width, int height, uint64_t *offset, uint64_t *size)
+{
+    QFile file(path.c_str());
+    if (!file.open(QIODevice::ReadOnly))
+        return false;
+    QByteArray header = file.read(148);
+    if (header.size() != 148)
+        return false;
+    const unsigned char *h = reinterpret_cast<const unsigned char *>(header.constData());
+
+    const uint32_t DXGI_FORMAT_BC7_UNORM = 98;
+    const uint32_t DXGI_FORMAT_BC7_UNORM_SRGB = 99;
+    const uint32_t D3D10_RESOURCE_DIMENSION_TEXTURE2D = 3;
+    uint32_t dxgiFormat = ReadU32(h + 128);
+    if (std::memcmp(h, "DDS ", 4) != 0 || ReadU32(h + 4) != 124
+            || ReadU32(h + 12) != uint32_t(height) || ReadU32(h + 16) != uint32_t(width)
+            || std::memcmp(h + 84, "DX10", 4) != 0
+            || (dxgiFormat != DXGI_FORMAT_BC7_UNORM && dxgiFormat != DXGI_FORMAT_BC7_UNORM_SRGB)
+            || ReadU32(h + 132) != D3D10_RESOURCE_DIMENSION_TEXTURE2D)
+        return false;
+
+    *offset = 148;
+    *size = BC7Size(width, height);
+    return *offset + *size <= uint64_t(file.size());
+}
+
+static uint64_t BC7Size(int width, int height)
+{
+    return uint64_t((width + 3) / 4) * uint64_t((height + 3) / 4) * 16ull;
+}
@@ -28,9 +28,14 @@
 #include <string>
 #include <list>
 #include <unordered_map>
+#include <unordered_set>
+#include <future>
+#include <functional>
 
 class QImage;
+class QSize;
 class TextureObject;
+class TextureAccessTrace;
 
 typedef std::shared_ptr<TextureObject> TextureObjectHandle;
 
@@ -42,8 +47,30 @@ struct TextureSize {
 struct TextureImageInfo {
     std::string path;
     TextureSize size;
+    std::function<QImage()> source; // reads an image held in memory, the path is then only its name
 };
 
+/* Reads the image of the texture, from its source if it has one, otherwise from its
+ * path. Returns a null image on failure. Can be called concurrently, also for the
+ * same texture. If reduction is greater than 1 the image is decoded at 1/reduction
+ * of its size (rounded up); jpeg images are then scaled while decoding (in the DCT
+ * domain), which is several times faster than decoding them at full size. The
+ * images decoded in the background by a TexturePredecoder are taken from memory,
+ * the remote files still downloading are waited for (see remote_input.h) */
+QImage ReadTextureImage(const TextureImageInfo& tii, int reduction = 1);
+
+/* Decodes the image file, at scaledSize if valid. With the asynchronous I/O enabled
+ * (see async_io.h) the file is read in memory with several requests in flight and
+ * decoded from there, otherwise the decoder reads it. Returns false on failure */
+bool DecodeImageFile(const std::string& path, const QSize& scaledSize, QImage *img);
+
+/* Reads the size of the image file from its header. Png, jpeg, tiff and webp
+ * headers are parsed directly, reading only the bytes that precede the size,
+ * the other formats go through QImageReader. Returns false if the file cannot
+ * be read or its format is not recognized. The headers of the remote files still
+ * downloading are read with a range request. Can be called concurrently */
+bool ReadImageSize(const std::string& path, TextureSize *size);
+
 /* wrapper to an array of textures */
 struct TextureObject {
 
@@ -59,9 +86,57 @@ struct TextureObject {
     /* Add QImage ref to the texture object */
     bool AddImage(std::string path);
 
+    /* Adds the image file path, whose size is already known (see ReadImageSize) */
+    bool AddImage(std::string path, TextureSize size);
+
+    /* Adds an image that is not read from a file, source is called each time the
+     * image is needed (possibly from several threads at once) and must return an
+     * image of the given size. The name is used in the messages */
+    bool AddImage(const std::string& name, TextureSize size, std::function<QImage()> source);
+
+    /* Returns a texture object over the same images, with the same cache budget
+     * and residency mode but an empty cache, to be used in another OpenGL context */
+    TextureObjectHandle CreateSibling() const;
+
     /* Binds the texture at index i */
     void Bind(int i);
 
+    /* Starts decoding the textures listed in indices (in order of expected use) on
+     * worker threads, directly into mapped pixel unpack buffers. Resident textures
+     * are skipped, and prefetching stops at the first texture that does not fit the
+     * cache budget without evicting the listed ones. Decoded textures are uploaded
+     * by the next calls to Prefetch() or by Bind() */
+    void Prefetch(const std::vector<int>& indices);
+
+    /* Sets the texture indices of the next calls to Bind, in order. While the plan
+     * lasts, the cache evicts first the textures that are not used again in it (in
+     * LRU order), then the one whose next use is farthest, weighing its size against
+     * the time it took to load it. The calls to Bind that do not follow the plan
+     * skip ahead to the next use of the texture. An empty plan restores plain LRU
+     * eviction */
+    void SetAccessPlan(const std::vector<int>& plan);
+
+    /* Records the calls to Bind in the trace as accesses of the given job (see
+     * texture_access_trace.h), a null trace stops the recording. The sheet and the
+     * tile of the accesses are the ones last set, the sibling objects do not record */
+    void SetAccessTrace(std::shared_ptr<TextureAccessTrace> trace, int job);
+    bool TracingAccesses() const { return trace_ != nullptr; }
+    void SetTraceSheet(int sheet) { traceSheet_ = sheet; }
+    void SetTraceTile(int tile) { traceTile_ = tile; }
+
+    /* Enables the residency of the textures as BC7 blocks, a quarter of the size of
+     * the uncompressed texels. The blocks are read from a ktx2 or dds file with the
+     * same base name as the image if there is one, otherwise the driver compresses
+     * the image at upload. Returns false, leaving the mode disabled, if the current
+     * context does not support BC7 */
+    bool SetCompressedResidency(bool enable);
+    bool CompressedResidency() const { return compressed_; }
+
+    /* True if the rows of the resident texture i are stored top to bottom (decoded
+     * images and blocks read from a file), so that the v coordinate must be flipped
+     * to sample it */
+    bool TextureFlipped(std::size_t i) const;
+
     /* Releases the texture i, without unbinding it if it is bound */
     void Release(int i);
     /* Releases all textures */
@@ -70,6 +145,17 @@ struct TextureObject {
     int TextureWidth(std::size_t i);
     int TextureHeight(std::size_t i);
 
+    /* Sets the mip level at which the texture i is decoded and made resident, the
+     * level l image is 1/2^l of the size of the texture (rounded up). Compressed
+     * sidecar files are only used at level 0. A resident or prefetched texture of
+     * another level is released */
+    void SetMipLevel(std::size_t i, int level);
+    int MipLevel(std::size_t i) const;
+
+    /* Size of the texture i at its mip level */
+    int ResidentWidth(std::size_t i) const;
+    int ResidentHeight(std::size_t i) const;
+
     int MaxSize();
     std::vector<TextureSize> GetTextureSizes();
 
@@ -86,6 +172,9 @@ struct TextureObject {
         uint64_t misses = 0;
         uint64_t evictions = 0;
         uint64_t bytesEvicted = 0;
+        uint64_t prefetched = 0;      // textures decoded ahead of their first use
+        double prefetchWaitS = 0.0;   // time spent in Bind waiting for a prefetched texture
+        uint64_t reloads = 0;         // misses of textures evicted earlier
     };
     void ResetCacheStats();
     CacheStats GetCacheStats() const;
@@ -98,8 +187,36 @@ struct TextureObject {
     uint64_t GetCurrentCacheBytes() const;
 
 private:
-    // LRU cache of GPU textures by index
-    void EvictIfNeeded(uint64_t bytesToAdd);
+    // Texture decoded on a worker thread into a mapped pixel unpack buffer
+    struct PendingUpload {
+        uint32_t pbo = 0;
+        uint64_t bytes = 0;
+        bool blocks = false;  // the buffer holds the BC7 blocks of the sidecar file
+        std::future<bool> decoded;
+    };
+
+    // BC7 blocks of a texture stored in a ktx2 or dds file
+    struct CompressedSource {
+        bool scanned = false;
+        std::string path;     // empty if there is no usable file
+        uint64_t offset = 0;
+        uint64_t size = 0;
+        bool topDown = true;
+    };
+
+    void UploadPending(std::size_t idx);
+    void CancelPending(std::size_t idx);
+    void UploadImage(std::size_t idx, int width, int height, const void *pixels, bool topDown);
+    void UploadBlocks(std::size_t idx, const void *blocks, uint64_t size, bool topDown);
+    const CompressedSource& Sidecar(std::size_t idx);
+    uint64_t ResidentBytes(int width, int height) const;
+
+    // LRU cache of GPU textures by index. Pinned textures are not evicted, returns
+    // false if the budget cannot accommodate the new bytes
+    bool EvictIfNeeded(uint64_t bytesToAdd, const std::unordered_set<std::size_t> *pinned = nullptr);
+    std::list<std::size_t>::iterator ChooseVictim(const std::unordered_set<std::size_t> *pinned);
+    void Evict(std::size_t idx);
+    std::size_t NextUse(std::size_t idx) const;
     void TouchLRU(std::size_t idx);
     void RemoveFromLRU(std::size_t idx);
 
@@ -109,16 +226,51 @@ private:
     std::list<std::size_t> lruList_;     // Most-recently-used at front, LRU at back
     std::unordered_map<std::size_t, std::list<std::size_t>::iterator> lruMap_;
 
+    // Planned order of the calls to Bind (see SetAccessPlan), with the positions of
+    // the uses of each texture in the plan, and the position of the next call
+    std::vector<int> accessPlan_;
+    std::unordered_map<std::size_t, std::vector<std::size_t>> accessUses_;
+    std::size_t accessPos_ = 0;
+    std::vector<double> loadSecondsVec_; // time of the last load of each texture in Bind
+    std::vector<bool> evictedVec_;       // evicted since the stats were reset
+
+    std::shared_ptr<TextureAccessTrace> trace_;
+    int traceJob_ = 0;
+    int traceSheet_ = 0;
+    int traceTile_ = 0;
+
+    bool compressed_ = false;
+    std::vector<CompressedSource> sidecarVec_;
+    std::vector<bool> texFlippedVec_;
+    std::vector<int> mipLevelVec_;
+
+    std::unordered_map<std::size_t, PendingUpload> pending_;
+    uint64_t pendingBytes_ = 0;          // Budget reserved by the pending uploads
+
     // Cache stats counters
     uint64_t cacheHits_ = 0;
     uint64_t cacheMisses_ = 0;
     uint64_t cacheEvictions_ = 0;
     uint64_t bytesEvicted_ = 0;
+    uint64_t prefetched_ = 0;
+    double prefetchWaitS_ = 0.0;
+    uint64_t reloads_ = 0;
 };
 
 /* Vertically mirrors a QImage in-place, useful to match the OpenGL convention
  * for texture data storage */
 void Mirror(QImage& img);
 
+/* Writes the texels of img to dst in the layout of QImage::Format_ARGB32 (BGRA
+ * bytes on little endian machines, as uploaded with GL_BGRA), with rows of
+ * width * 4 bytes stored top to bottom, or bottom to top if bottomUp is true.
+ * The formats produced by the image decoders are converted in a single pass,
+ * in parallel over the rows */
+void CopyImageARGB32(const QImage& img, unsigned char *dst, bool bottomUp);
+
+/* Returns img if its format is Format_RGB32 or Format_ARGB32, otherwise a copy
+ * converted with CopyImageARGB32 */
+QImage ToARGB32(const QImage& img);
+
 
 #endif // TEXTURE_OBJECT_H
\ No newline at end of file
@@ -38,18 +38,42 @@
 #include <cmath>
 
 
-static void MirrorU(ChartHandle chart);
+static bool OrientChart(ChartHandle chart, Mesh::PerFaceAttributeHandle<TexCoordStorage>& wtcsa, std::vector<double> *faceArapNum, double *arapNum, double *arapDenom);
 
-void ReorientCharts(GraphHandle graph)
+void ReorientCharts(GraphHandle graph, ChartOrientation *orientation)
 {
-    for (auto entry : graph->charts) {
-        ChartHandle chart = entry.second;
-        if (chart->UVFlipped())
-            MirrorU(chart);
+    Mesh& m = graph->mesh;
+    std::vector<ChartHandle> charts;
+    charts.reserve(graph->charts.size());
+    for (auto& entry : graph->charts)
+        charts.push_back(entry.second);
+
+    // the energy is computed from the input tex coords of the faces
+    bool energy = (orientation != nullptr) && HasWedgeTexCoordStorageAttribute(m);
+    auto wtcsa = energy ? GetWedgeTexCoordStorageAttribute(m) : Mesh::PerFaceAttributeHandle<TexCoordStorage>();
+    if (energy)
+        orientation->faceArapNum.assign(m.face.size(), 0);
+
+    std::vector<char> flipped(charts.size());
+    std::vector<double> arapNum(charts.size(), 0);
+    std::vector<double> arapDenom(charts.size(), 0);
+    #pragma omp parallel for schedule(dynamic, 16)
+    for (int i = 0; i < (int) charts.size(); ++i)
+        flipped[i] = OrientChart(charts[i], wtcsa, energy ? &orientation->faceArapNum : nullptr, &arapNum[i], &arapDenom[i]);
+
+    if (orientation) {
+        orientation->flipped.clear();
+        orientation->arapNum = 0;
+        orientation->arapDenom = 0;
+        for (unsigned i = 0; i < charts.size(); ++i) {
+            orientation->flipped[charts[i]->id] = flipped[i];
+            orientation->arapNum += arapNum[i];
+            orientation->arapDenom += arapDenom[i];
+        }
     }
 }
 
-int RotateChartForResampling(ChartHandle chart, const std::set<Mesh::FacePointer>& changeSet, const std::map<RegionID, bool> &flippedInput, bool colorize, double *zeroResamplingArea)
+int RotateChartForResampling(ChartHandle chart, const ElementSet<MeshFace>& changeSet, const std::map<RegionID, bool> &flippedInput, bool colorize, double *zeroResamplingArea)
 {
     Mesh& m = chart->mesh;
     auto wtcsh = GetWedgeTexCoordStorageAttribute(m);
@@ -58,15 +82,14 @@ int RotateChartForResampling(ChartHandle chart, const std::set<Mesh::FacePointer
     // compute the area contribution of each initial region restricted to
     // faces that have _NOT_ been changed by the optimization
 
-    std::unordered_map<RegionID, double> areaMap;
-    std::unordered_map<RegionID, Mesh::FacePointer> idfp;
+    // area and last unchanged face of each region
+    std::unordered_map<RegionID, std::pair<double, Mesh::FacePointer>> areaMap;
 
     for (auto fptr : chart->fpVec) {
-        double areaUV = AreaUV(*fptr);
-        double area3D = Area3D(*fptr);
-        if ((changeSet.find(fptr) == changeSet.end()) && (areaUV != 0)) {
-            areaMap[fptr->initialId] += area3D;
-            idfp[fptr->initialId] = fptr;
+        if (!changeSet.count(fptr) && (AreaUV(*fptr) != 0)) {
+            auto& entry = areaMap[fptr->initialId];
+            entry.first += Area3D(*fptr);
+            entry.second = fptr;
         }
     }
 
@@ -79,9 +102,9 @@ int RotateChartForResampling(ChartHandle chart, const std::set<Mesh::FacePointer
 
     Mesh::FacePointer zeroResamplingAreaFp = nullptr;
     for (auto& entry : areaMap) {
-        if (entry.second > *zeroResamplingArea) {
-            *zeroResamplingArea = entry.second;
-            zeroResamplingAreaFp = idfp[entry.first];
+        if (entry.second.first > *zeroResamplingArea) {
+            *zeroResamplingArea = entry.second.first;
+            zeroResamplingAreaFp = entry.second.second;
         }
     }
 
@@ -97,6 +120,10 @@ int RotateChartForResampling(ChartHandle chart, const std::set<Mesh::FacePointer
     //double rotAngle = ((signedArea > 0) ? -1 : 1) * VecAngle(d0, d1);
     double rotAngle = VecAngle(d0, d1);
 
+    Mesh::PerFaceAttributeHandle<vcg::Color4b> faceColor;
+    if (colorize)
+        faceColor = GetFaceColorAttribute(m);
+
     // rotate the uvs
     for (auto fptr : chart->fpVec) {
         for (int i = 0; i < 3; ++i) {
@@ -104,8 +131,8 @@ int RotateChartForResampling(ChartHandle chart, const std::set<Mesh::FacePointer
             fptr->V(i)->T().P() = fptr->WT(i).P();
         }
         if (colorize) {
-            if ((fptr->initialId == zeroResamplingAreaFp->initialId) && (changeSet.find(fptr) == changeSet.end()))
-                fptr->C() = vcg::Color4b(85, 246, 85, 255);
+            if ((fptr->initialId == zeroResamplingAreaFp->initialId) && !changeSet.count(fptr))
+                faceColor[fptr] = vcg::Color4b(85, 246, 85, 255);
         }
     }
 
@@ -113,19 +140,62 @@ int RotateChartForResampling(ChartHandle chart, const std::set<Mesh::FacePointer
 
 }
 
-void TrimTexture(Mesh& m, std::vector<TextureSize>& texszVec, bool unsafeMip)
+double RotateChartsForResampling(GraphHandle graph, const ElementSet<MeshFace>& changeSet, const std::map<RegionID, bool>& flippedInput, bool colorize, std::map<ChartHandle, int>& anchorMap,
+                                 const std::set<RegionID> *fixedCharts)
 {
-    std::vector<std::vector<Mesh::FacePointer>> facesByTexture;
-    unsigned ntex = FacesByTextureIndex(m, facesByTexture);
+    std::vector<ChartHandle> charts;
+    charts.reserve(graph->charts.size());
+    for (auto& entry : graph->charts)
+        if (!fixedCharts || fixedCharts->count(entry.first) == 0)
+            charts.push_back(entry.second);
+
+    std::vector<int> anchors(charts.size(), -1);
+    std::vector<double> zeroResamplingChartAreas(charts.size(), 0);
+
+    // the color attribute is added before the charts are rotated in parallel
+    if (colorize)
+        GetFaceColorAttribute(graph->mesh);
+
+    #pragma omp parallel for schedule(dynamic, 64)
+    for (int i = 0; i < (int) charts.size(); ++i)
+        anchors[i] = RotateChartForResampling(charts[i], changeSet, flippedInput, colorize, &zeroResamplingChartAreas[i]);
+
+    // the areas are added in the order of the charts, not of the threads
+    double zeroResamplingMeshArea = 0;
+    for (unsigned i = 0; i < charts.size(); ++i) {
+        if (anchors[i] != -1) {
+            anchorMap[charts[i]] = anchors[i];
+            zeroResamplingMeshArea += zeroResamplingChartAreas[i];
+        }
+    }
 
-    for (unsigned ti = 0; ti < ntex; ++ti) {
+    return zeroResamplingMeshArea;
+}
+
+void TrimTexture(const FaceBuckets& buckets, std::vector<TextureSize>& texszVec, bool unsafeMip)
+{
+    for (int ti = 0; ti < buckets.numSheets; ++ti) {
+        const Mesh::FacePointer *faces = buckets.faces.data() + buckets.SheetBegin(ti);
+        const int nf = buckets.SheetEnd(ti) - buckets.SheetBegin(ti);
+
+        // the faces with zero uv area are left untouched
+        std::vector<char> trim(nf);
         vcg::Box2d uvBox;
-        for (auto fptr : facesByTexture[ti]) {
-            if (AreaUV(*fptr) != 0) {
-                for (int i = 0; i < 3; ++i) {
-                    uvBox.Add(fptr->WT(i).P());
+
+        #pragma omp parallel
+        {
+            vcg::Box2d threadBox;
+            #pragma omp for schedule(static)
+            for (int k = 0; k < nf; ++k) {
+                trim[k] = (AreaUV(*faces[k]) != 0);
+                if (trim[k]) {
+                    for (int i = 0; i < 3; ++i) {
+                        threadBox.Add(faces[k]->WT(i).P());
+                    }
                 }
             }
+            #pragma omp critical (trim_box)
+            uvBox.Add(threadBox);
         }
 
         if (std::min(uvBox.DimX(), uvBox.DimY()) > 0.95)
@@ -158,35 +228,44 @@ void TrimTexture(Mesh& m, std::vector<TextureSize>& texszVec, bool unsafeMip)
 
         vcg::Point2d t(uvBox.min.X() / texszVec[ti].w, uvBox.min.Y() / texszVec[ti].h);
 
-        for (auto fptr : facesByTexture[ti]) {
-            if (AreaUV(*fptr) != 0) {
-                for (int i = 0; i < 3; ++i) {
-                    // Translate to new origin and scale to [0,1] domain of the trimmed texture
-                    fptr->WT(i).P() -= t;
-                    fptr->WT(i).P().Scale(uscale, vscale);
+        vcg::Box2d uvBoxCheck;
 
-                    // Clamp to [0,1) to avoid precision spill outside and texture wrap
-                    const double oneMinus = std::nextafter(1.0, 0.0);
-                    auto &uvP = fptr->WT(i).P();
-                    if (uvP.X() < 0.0) uvP.X() = 0.0; else if (uvP.X() > oneMinus) uvP.X() = oneMinus;
-                    if (uvP.Y() < 0.0) uvP.Y() = 0.0; else if (uvP.Y() > oneMinus) uvP.Y() = oneMinus;
+        #pragma omp parallel
+        {
+            vcg::Box2d threadBox;
+            #pragma omp for schedule(static)
+            for (int k = 0; k < nf; ++k) {
+                if (trim[k]) {
+                    for (int i = 0; i < 3; ++i) {
+                        // Translate to new origin and scale to [0,1] domain of the trimmed texture
+                        faces[k]->WT(i).P() -= t;
+                        faces[k]->WT(i).P().Scale(uscale, vscale);
 
-                    fptr->V(i)->T().P() = fptr->WT(i).P();
+                        // Clamp to [0,1) to avoid precision spill outside and texture wrap
+                        const double oneMinus = std::nextafter(1.0, 0.0);
+                        auto &uvP = faces[k]->WT(i).P();
+                        if (uvP.X() < 0.0) uvP.X() = 0.0; else if (uvP.X() > oneMinus) uvP.X() = oneMinus;
+                        if (uvP.Y() < 0.0) uvP.Y() = 0.0; else if (uvP.Y() > oneMinus) uvP.Y() = oneMinus;
+
+                        threadBox.Add(uvP);
+                    }
                 }
             }
+            #pragma omp critical (trim_box)
+            uvBoxCheck.Add(threadBox);
         }
 
-        // sanity check
-        {
-            vcg::Box2d uvBoxCheck;
-            for (auto fptr : facesByTexture[ti]) {
-                if (AreaUV(*fptr) != 0) {
-                    for (int i = 0; i < 3; ++i) {
-                        uvBoxCheck.Add(fptr->WT(i).P());
-                    }
-                }
+        // the vertices are shared by the faces of the same chart, so they are
+        // updated after the wedges instead of racing on them
+        for (int k = 0; k < nf; ++k) {
+            if (trim[k]) {
+                for (int i = 0; i < 3; ++i)
+                    faces[k]->V(i)->T().P() = faces[k]->WT(i).P();
             }
+        }
 
+        // sanity check
+        {
             const double EPS = 1e-9;
             ensure(uvBoxCheck.min.X() >= -EPS);
             ensure(uvBoxCheck.min.Y() >= -EPS);
@@ -202,20 +281,51 @@ void TrimTexture(Mesh& m, std::vector<TextureSize>& texszVec, bool unsafeMip)
 
 // -- static functions ---------------------------------------------------------
 
-static void MirrorU(ChartHandle chart)
+/* Updates the cached aggregates of the chart and, if its parameterization is
+ * flipped, mirrors it along the u axis in place (the uv box of the chart is kept),
+ * writing the wedge and the vertex tex coords in the same pass. Mirroring changes
+ * none of the aggregates, so the cache is restored afterwards. If faceArapNum is
+ * not null, adds the energy of each face of the reoriented chart to it, and the
+ * energy and the area of the chart to arapNum and arapDenom. Returns whether the
+ * chart was flipped */
+static bool OrientChart(ChartHandle chart, Mesh::PerFaceAttributeHandle<TexCoordStorage>& wtcsa, std::vector<double> *faceArapNum, double *arapNum, double *arapDenom)
 {
-    double u_old = chart->UVBox().min.X();
-    for (auto fptr : chart->fpVec) {
-        for (int i = 0; i < 3; ++i)
-            fptr->WT(i).U() *= -1;
+    FaceGroup::Cache cache = chart->GetCache();
+    bool flipped = cache.uvFlipped;
+    Mesh& m = chart->mesh;
+
+    double uSum = 0;
+    if (flipped) {
+        vcg::Box2d box;
+        for (auto fptr : chart->fpVec)
+            for (int i = 0; i < 3; ++i)
+                box.Add(fptr->WT(i).P());
+        uSum = box.min.X() + box.max.X();
     }
-    chart->ParameterizationChanged();
-    double u_new = chart->UVBox().min.X();
+
     for (auto fptr : chart->fpVec) {
-        for (int i = 0; i < 3; ++i) {
-            fptr->WT(i).U() += (u_old - u_new);
-            fptr->V(i)->T().U() = fptr->WT(i).U();
+        if (flipped) {
+            for (int i = 0; i < 3; ++i) {
+                fptr->WT(i).U() = uSum - fptr->WT(i).U();
+                fptr->V(i)->T().U() = fptr->WT(i).U();
+            }
+        }
+        if (faceArapNum) {
+            const TexCoordStorage& tcs = wtcsa[fptr];
+            double area;
+            double energy = ARAP::ComputeEnergy(tcs.tc[1].P() - tcs.tc[0].P(), tcs.tc[2].P() - tcs.tc[0].P(),
+                                                fptr->WT(1).P() - fptr->WT(0).P(), fptr->WT(2).P() - fptr->WT(0).P(), &area);
+            if (area > 0) {
+                (*faceArapNum)[tri::Index(m, fptr)] = area * energy;
+                *arapNum += area * energy;
+                *arapDenom += area;
+            }
         }
     }
-    chart->ParameterizationChanged();
-}
\ No newline at end of file
+
+    if (flipped) {
+        cache.uvFlipped = false;
+        chart->SetCache(cache);
+    }
+    return flipped;
+}
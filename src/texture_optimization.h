@@ -23,22 +23,32 @@
 #define TEXTURE_OPTIMIZATION_H
 
 #include "mesh.h"
+#include "element_set.h"
+#include "intersection.h" // Point2iHasher
 
 #include <utility>
+#include <set>
 #include <vcg/space/point2.h>
 
+#include <map>
+#include <vector>
 
-struct Point2iHasher {
-    std::size_t operator()(const vcg::Point2i& p) const noexcept
-    {
-        std::size_t seed = 0;
-        seed ^= std::hash<int>()(p[0]) + 0x9e3779b9 + (seed << 6) + (seed >> 2);
-        seed ^= std::hash<int>()(p[1]) + 0x9e3779b9 + (seed << 6) + (seed >> 2);
-        return seed;
-    }
+struct FaceBuckets;
+
+/* Outcome of ReorientCharts() */
+struct ChartOrientation {
+    std::map<RegionID, bool> flipped; // whether the input parameterization of each chart was flipped
+    double arapNum = 0;               // ARAP energy of the reoriented atlas (see ARAP::ComputeEnergyFromStoredWedgeTC())
+    double arapDenom = 0;
+    std::vector<double> faceArapNum;  // energy of each face, indexed by face
 };
 
-void ReorientCharts(GraphHandle graph);
+/* Mirrors the charts whose parameterization is flipped. The charts are processed in
+ * parallel, and each one in a single pass over its faces that also fills the cached
+ * aggregates of the chart (the areas and the border lengths). If orientation is not
+ * null, the pass also records the input orientation of the charts and the ARAP
+ * energy of the reoriented atlas, that InitializeState() can reuse */
+void ReorientCharts(GraphHandle graph, ChartOrientation *orientation = nullptr);
 
 
 /* Given a chart, compute both the set of 2D orientation of each initial component
@@ -47,9 +57,18 @@ void ReorientCharts(GraphHandle graph);
  * Returns the index of an anchor face, i.e. a face that does not belong to the
  * change set and is inside the largest initial component that induced the rotation
  */
-int RotateChartForResampling(ChartHandle chart, const std::set<Mesh::FacePointer> &changeSet, const std::map<RegionID, bool>& flippedInput, bool colorize, double *zeroResamplingArea);
+int RotateChartForResampling(ChartHandle chart, const ElementSet<MeshFace>& changeSet, const std::map<RegionID, bool>& flippedInput, bool colorize, double *zeroResamplingArea);
+
+/* Rotates all the charts of the graph for resampling, in parallel since the
+ * charts do not share vertices after Finalize(). The anchor face of each
+ * rotated chart is stored in anchorMap. The charts in fixedCharts (kept from a
+ * previous run, see incremental.h) are neither rotated nor anchored. Returns the
+ * 3D area of the faces that are not resampled */
+double RotateChartsForResampling(GraphHandle graph, const ElementSet<MeshFace>& changeSet, const std::map<RegionID, bool>& flippedInput, bool colorize, std::map<ChartHandle, int>& anchorMap,
+                                 const std::set<RegionID> *fixedCharts = nullptr);
 
-/* Texture trimming to remove unused space */
-void TrimTexture(Mesh& m, std::vector<TextureSize>& texszVec, bool unsafeMip);
+/* Texture trimming to remove unused space, the faces of each sheet are taken
+ * from the buckets computed after packing */
+void TrimTexture(const FaceBuckets& buckets, std::vector<TextureSize>& texszVec, bool unsafeMip);
 
 #endif // TEXTURE_OPTIMIZATION_H
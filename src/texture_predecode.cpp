@@ -0,0 +1,301 @@
+/*******************************************************************************
+    Copyright (c) 2021, Andrea Maggiordomo, Paolo Cignoni and Marco Tarini
+
+    This file is part of TextureDefrag, a reference implementation for
+    the paper ``Texture Defragmentation for Photo-Reconstructed 3D Models''
+    by Andrea Maggiordomo, Paolo Cignoni and Marco Tarini.
+
+    TextureDefrag is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    TextureDefrag is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with TextureDefrag. If not, see <https://www.gnu.org/licenses/>.
+*******************************************************************************/
+
+
+#include "texture_predecode.h"
+#include "memory_budget.h"
+#include "remote_input.h"
+#include "logging.h"
+#include "timer.h"
+
+#include <map>
+#include <list>
+#include <algorithm>
+#include <mutex>
+#include <condition_variable>
+
+#include <QImage>
+#include <QSize>
+#include <QString>
+#include <QFileInfo>
+#include <QDateTime>
+
+#ifdef __linux__
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+
+struct PredecodedImage {
+    enum { Queued, Decoding, Decoded, Claimed } state = Queued;
+    TextureSize size;
+    QImage image;
+    int reads = 0;
+};
+
+struct RetainedImage {
+    QImage image;
+    int64_t fileSize;
+    int64_t fileTime;
+    std::list<std::string>::iterator lru;
+};
+
+// the predecoded images by path, shared by the predecoders of the jobs in flight
+static std::mutex registryMtx;
+static std::condition_variable decodedCv;
+static std::map<std::string, std::shared_ptr<PredecodedImage>> registry;
+
+// the images kept after the jobs that read them ended, most recently used first
+// in retainedLRU. Guarded by registryMtx, the budget is read without it
+static std::map<std::string, RetainedImage> retained;
+static std::list<std::string> retainedLRU;
+static std::atomic<uint64_t> retainedBudget(0);
+static RetainedImageStats retainedStats;
+
+static bool StatImageFile(const std::string& path, int64_t *fileSize, int64_t *fileTime);
+static QImage FindRetainedImage(const std::string& path);
+static void InsertRetainedImage(const std::string& path, const QImage& img, int64_t fileSize, int64_t fileTime);
+static void EvictRetainedImages(uint64_t budgetBytes);
+
+TexturePredecoder::TexturePredecoder(TextureObjectHandle textureObject, uint64_t budgetBytes, int threads)
+    : budgetBytes(budgetBytes), stop(false)
+{
+    {
+        std::lock_guard<std::mutex> lock(registryMtx);
+        for (const TextureImageInfo& tii : textureObject->texInfoVec) {
+            // the images held in memory are not decoded
+            if (tii.source || registry.count(tii.path) > 0)
+                continue;
+            // the retained images are found by FindPredecodedImage, the files are only
+            // checked when read
+            if (retained.count(tii.path) > 0) {
+                stats.retained++;
+                continue;
+            }
+            std::shared_ptr<PredecodedImage> pi = std::make_shared<PredecodedImage>();
+            pi->size = tii.size;
+            registry[tii.path] = pi;
+            paths.push_back(tii.path);
+            images.push_back(pi);
+        }
+    }
+
+    threads = std::max(1, std::min(threads, (int) paths.size()));
+    for (int i = 0; i < threads && !paths.empty(); ++i)
+        workers.emplace_back([this, i]() {
+            LOG_SET_THREAD_NAME("predecode-" + std::to_string(i));
+#ifdef __linux__
+            // the nice value applies to the calling thread only
+            setpriority(PRIO_PROCESS, (id_t) syscall(SYS_gettid), 19);
+#endif
+            Run();
+        });
+}
+
+TexturePredecoder::~TexturePredecoder()
+{
+    stop = true;
+    for (auto& worker : workers)
+        worker.join();
+
+    // the files are checked before locking the registry
+    std::vector<std::pair<int64_t, int64_t>> files(paths.size(), std::make_pair(int64_t(-1), int64_t(0)));
+    if (retainedBudget > 0)
+        for (unsigned i = 0; i < paths.size(); ++i)
+            StatImageFile(paths[i], &files[i].first, &files[i].second);
+
+    std::lock_guard<std::mutex> lock(registryMtx);
+    for (unsigned i = 0; i < paths.size(); ++i) {
+        auto it = registry.find(paths[i]);
+        if (it != registry.end() && it->second == images[i])
+            registry.erase(it);
+        if (images[i]->state == PredecodedImage::Decoded && !images[i]->image.isNull() && files[i].first >= 0)
+            InsertRetainedImage(paths[i], images[i]->image, files[i].first, files[i].second);
+    }
+    MemoryAdd(MemorySubsystem::InputImages, -(long long) stats.bytes);
+}
+
+TexturePredecoder::Stats TexturePredecoder::GetStats() const
+{
+    std::lock_guard<std::mutex> lock(registryMtx);
+    Stats s = stats;
+    for (const auto& pi : images)
+        if (pi->reads > 0)
+            s.used++;
+    return s;
+}
+
+void TexturePredecoder::Run()
+{
+    std::unique_lock<std::mutex> lock(registryMtx);
+    while (!stop && next < paths.size()) {
+        std::size_t i = next++;
+        PredecodedImage& pi = *images[i];
+        if (pi.state != PredecodedImage::Queued)
+            continue;
+        uint64_t bytes = uint64_t(pi.size.w) * uint64_t(pi.size.h) * 4;
+        if (reservedBytes + bytes > budgetBytes) {
+            // left to the rendering
+            pi.state = PredecodedImage::Claimed;
+            stats.skipped++;
+            continue;
+        }
+        reservedBytes += bytes;
+        pi.state = PredecodedImage::Decoding;
+
+        lock.unlock();
+        Timer t;
+        QImage img;
+        // the remote files are decoded once downloaded
+        if (WaitForRemoteFile(paths[i]) && !DecodeImageFile(paths[i], QSize(), &img))
+            img = QImage();
+        double seconds = t.TimeElapsed();
+        lock.lock();
+
+        reservedBytes -= bytes;
+        pi.image = img;
+        pi.state = PredecodedImage::Decoded;
+        if (!img.isNull()) {
+            reservedBytes += img.bytesPerLine() * uint64_t(img.height());
+            stats.bytes += img.bytesPerLine() * uint64_t(img.height());
+            stats.decoded++;
+            MemoryAdd(MemorySubsystem::InputImages, img.bytesPerLine() * (long long) img.height());
+        }
+        stats.decodeS += seconds;
+        decodedCv.notify_all();
+    }
+}
+
+QImage FindPredecodedImage(const std::string& path, int reduction)
+{
+    QImage img;
+    {
+        std::unique_lock<std::mutex> lock(registryMtx);
+        auto it = registry.find(path);
+        if (it == registry.end()) {
+            // the image may have been retained from an earlier job
+            img = FindRetainedImage(path);
+            if (img.isNull())
+                return QImage();
+        } else {
+            std::shared_ptr<PredecodedImage> pi = it->second;
+            if (pi->state == PredecodedImage::Queued)
+                pi->state = PredecodedImage::Claimed;
+            decodedCv.wait(lock, [&pi]() { return pi->state != PredecodedImage::Decoding; });
+            if (pi->state != PredecodedImage::Decoded || pi->image.isNull())
+                return QImage();
+            pi->reads++;
+            img = pi->image;
+        }
+    }
+    if (reduction > 1) {
+        const QSize reducedSize((img.width() + reduction - 1) / reduction, (img.height() + reduction - 1) / reduction);
+        img = img.scaled(reducedSize, Qt::IgnoreAspectRatio, Qt::SmoothTransformation);
+    }
+    return img;
+}
+
+void SetRetainedImageBudget(uint64_t budgetBytes)
+{
+    std::lock_guard<std::mutex> lock(registryMtx);
+    retainedBudget = budgetBytes;
+    EvictRetainedImages(budgetBytes);
+}
+
+void RetainDecodedImage(const std::string& path, const QImage& img)
+{
+    int64_t fileSize;
+    int64_t fileTime;
+    if (retainedBudget == 0 || img.isNull() || !StatImageFile(path, &fileSize, &fileTime))
+        return;
+    std::lock_guard<std::mutex> lock(registryMtx);
+    InsertRetainedImage(path, img, fileSize, fileTime);
+}
+
+RetainedImageStats GetRetainedImageStats()
+{
+    std::lock_guard<std::mutex> lock(registryMtx);
+    RetainedImageStats s = retainedStats;
+    s.images = (int) retained.size();
+    return s;
+}
+
+// -- static functions ---------------------------------------------------------
+
+static bool StatImageFile(const std::string& path, int64_t *fileSize, int64_t *fileTime)
+{
+    QFileInfo fi(QString(path.c_str()));
+    if (!fi.exists())
+        return false;
+    *fileSize = fi.size();
+    *fileTime = fi.lastModified().toMSecsSinceEpoch();
+    return true;
+}
+
+// returns the retained image of path if the file did not change, the lock must be held
+static QImage FindRetainedImage(const std::string& path)
+{
+    auto it = retained.find(path);
+    if (it == retained.end())
+        return QImage();
+    RetainedImage& ri = it->second;
+    int64_t fileSize;
+    int64_t fileTime;
+    if (!StatImageFile(path, &fileSize, &fileTime) || ri.fileSize != fileSize || ri.fileTime != fileTime) {
+        uint64_t bytes = ri.image.bytesPerLine() * uint64_t(ri.image.height());
+        retainedStats.bytes -= bytes;
+        MemoryAdd(MemorySubsystem::InputImages, -(long long) bytes);
+        retainedLRU.erase(ri.lru);
+        retained.erase(it);
+        return QImage();
+    }
+    retainedLRU.splice(retainedLRU.begin(), retainedLRU, ri.lru);
+    retainedStats.hits++;
+    return ri.image;
+}
+
+// the lock must be held
+static void InsertRetainedImage(const std::string& path, const QImage& img, int64_t fileSize, int64_t fileTime)
+{
+    uint64_t bytes = img.bytesPerLine() * uint64_t(img.height());
+    if (bytes > retainedBudget || retained.count(path) > 0)
+        return;
+    EvictRetainedImages(retainedBudget - bytes);
+    retainedLRU.push_front(path);
+    retained[path] = RetainedImage{img, fileSize, fileTime, retainedLRU.begin()};
+    retainedStats.bytes += bytes;
+    MemoryAdd(MemorySubsystem::InputImages, bytes);
+}
+
+// releases the least recently used images until they fit budgetBytes, the lock must be held
+static void EvictRetainedImages(uint64_t budgetBytes)
+{
+    while (retainedStats.bytes > budgetBytes && !retainedLRU.empty()) {
+        auto it = retained.find(retainedLRU.back());
+        uint64_t bytes = it->second.image.bytesPerLine() * uint64_t(it->second.image.height());
+        retainedStats.bytes -= bytes;
+        retainedStats.evictions++;
+        MemoryAdd(MemorySubsystem::InputImages, -(long long) bytes);
+        retained.erase(it);
+        retainedLRU.pop_back();
+    }
+}
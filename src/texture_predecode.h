@@ -0,0 +1,111 @@
+/*******************************************************************************
+    Copyright (c) 2021, Andrea Maggiordomo, Paolo Cignoni and Marco Tarini
+
+    This file is part of TextureDefrag, a reference implementation for
+    the paper ``Texture Defragmentation for Photo-Reconstructed 3D Models''
+    by Andrea Maggiordomo, Paolo Cignoni and Marco Tarini.
+
+    TextureDefrag is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    TextureDefrag is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with TextureDefrag. If not, see <https://www.gnu.org/licenses/>.
+*******************************************************************************/
+
+#ifndef TEXTURE_PREDECODE_H
+#define TEXTURE_PREDECODE_H
+
+#include "texture_object.h"
+
+#include <vector>
+#include <string>
+#include <memory>
+#include <thread>
+#include <atomic>
+#include <cstdint>
+
+class QImage;
+
+struct PredecodedImage;
+
+/* Decodes the input textures in memory on background threads while the mesh is
+ * optimized and packed, so that the rendering starts with the images already
+ * decoded. ReadTextureImage returns the predecoded image of a file instead of
+ * reading it (waiting for it if it is being decoded), and scales it if a reduced
+ * image is requested. The images are kept until the predecoder is destroyed */
+class TexturePredecoder {
+
+public:
+
+    struct Stats {
+        int decoded = 0;      // images decoded
+        int skipped = 0;      // images that did not fit the budget
+        int used = 0;         // predecoded images read by ReadTextureImage
+        int retained = 0;     // images not decoded since they were retained from an earlier job
+        uint64_t bytes = 0;   // memory of the decoded images
+        double decodeS = 0.0; // time spent decoding (summed over the threads)
+    };
+
+    /* Starts decoding the images of textureObject read from files, in order of
+     * index, on the given number of threads running at the lowest scheduling
+     * priority. The images that would exceed budgetBytes are skipped, and are
+     * decoded when they are needed as usual */
+    TexturePredecoder(TextureObjectHandle textureObject, uint64_t budgetBytes, int threads);
+
+    /* Stops the decoding and releases the images (the copies already returned by
+     * ReadTextureImage stay valid) */
+    ~TexturePredecoder();
+
+    TexturePredecoder(const TexturePredecoder&) = delete;
+    TexturePredecoder& operator=(const TexturePredecoder&) = delete;
+
+    Stats GetStats() const;
+
+private:
+
+    void Run();
+
+    std::vector<std::string> paths;
+    std::vector<std::shared_ptr<PredecodedImage>> images; // null if the path was already registered
+    uint64_t budgetBytes;
+    uint64_t reservedBytes = 0;
+    std::size_t next = 0;
+    std::atomic<bool> stop;
+    std::vector<std::thread> workers;
+    Stats stats;
+};
+
+/* Returns the predecoded image of the file at path, scaled to the reduced size if
+ * reduction is greater than 1, waiting for it if it is being decoded. Returns a
+ * null image if the file is not predecoded, and then the file is no longer
+ * decoded in the background since the caller reads it */
+QImage FindPredecodedImage(const std::string& path, int reduction);
+
+/* Keeps up to budgetBytes of the decoded input images once the jobs that read them
+ * end, so that the later jobs of a batch reading the same files skip decoding them.
+ * The images are keyed by path and dropped if the size or the modification time of
+ * the file changed, the least recently used are released first. The images remain
+ * shared with the jobs reading them. A budget of 0 releases them all */
+void SetRetainedImageBudget(uint64_t budgetBytes);
+
+/* Retains the full size image decoded from the file at path if there is a budget
+ * for the retained images (called by ReadTextureImage) */
+void RetainDecodedImage(const std::string& path, const QImage& img);
+
+struct RetainedImageStats {
+    int images = 0;      // images retained
+    uint64_t bytes = 0;  // memory of the retained images
+    int hits = 0;        // reads of the retained images
+    int evictions = 0;   // images released over the budget
+};
+
+RetainedImageStats GetRetainedImageStats();
+
+#endif // TEXTURE_PREDECODE_H
@@ -31,15 +31,38 @@
 #include "pushpull.h"
 #include "mesh_attribute.h"
 #include "logging.h"
+#include "png_writer.h"
+#include "tiff_writer.h"
+#include "image_writers.h"
+#include "virtual_texture.h"
+#include "software_rendering.h"
+#include "texture_array.h"
+#include "memory_budget.h"
+#include "trace.h"
+#include "run_report.h"
+#include "metrics.h"
+#include "thread_count.h"
+#include "mapped_image.h"
+#include "async_io.h"
+#include "sheet_sink.h"
 
 #include <iostream>
 #include <algorithm>
 #include <memory>
+#include <cstring>
+#include <cmath>
 
 #include <thread>
 #include <mutex>
+#include <atomic>
+#include <functional>
 #include <condition_variable>
 #include <queue>
+#include <deque>
+#include <list>
+#include <map>
+#include <unordered_map>
+#include <sstream>
 
 #include <QImage>
 #include <QFileInfo>
@@ -49,19 +72,62 @@
 #include <QOpenGLContext>
 #include <QSurfaceFormat>
 #include <QOffscreenSurface>
+#include <QThread>
 
 #include <chrono>
 #include <limits>
 
+#include <omp.h>
+
+// Number of input textures decoded ahead of the one being drawn
+static const int TEXTURE_PREFETCH_DEPTH = 2;
+
+// Floats per vertex: position, texcoord, color (4 bytes) and texture array layer
+static const int VERTEX_STRIDE = 6;
+
+// Height of the bands of rows of the sheets saved while rendering
+static const int STREAM_BAND_ROWS = 1024;
+
+// Maximum side of the tiles (with their apron) dilated into the gutter, bounds the
+// memory of the render targets of the jump flooding
+static const int DILATION_TILE_SIZE = 4096;
+static const int MAX_GUTTER_WIDTH = 256;
+
+// Maximum number of downsampled levels of detail saved next to each sheet
+static const int MAX_LOD_LEVELS = 8;
+
+// GPU memory left out of the detected texture cache budget for the render targets,
+// the vertex and pixel buffers (and the other applications), and the smallest
+// detected budget
+static const uint64_t GPU_MEMORY_HEADROOM = 1024ull * 1024ull * 1024ull;
+static const uint64_t MIN_DETECTED_CACHE_BUDGET = 256ull * 1024ull * 1024ull;
+
+// The sheets with both sides up to SMALL_SHEET_SIDE are rendered together in a
+// scratch atlas of at most BATCH_ATLAS_SIZE pixels per side (see SheetBatch)
+static const int SMALL_SHEET_SIDE = 512;
+static const int BATCH_ATLAS_SIZE = 2048;
+
+#ifndef GL_COMPRESSED_RGBA_BPTC_UNORM
+#define GL_COMPRESSED_RGBA_BPTC_UNORM 0x8E8C
+#endif
+#ifndef GL_MAP_PERSISTENT_BIT
+#define GL_MAP_PERSISTENT_BIT 0x0040
+#endif
+#ifndef GL_MAP_COHERENT_BIT
+#define GL_MAP_COHERENT_BIT 0x0080
+#endif
+
 
 static const char *vs_text[] = {
     "#version 410 core                                           \n"
     "                                                            \n"
-    "in vec2 position;                                           \n"
-    "in vec2 texcoord;                                           \n"
-    "in vec4 color;                                              \n"
+    "layout(location = 0) in vec2 position;                      \n"
+    "layout(location = 1) in vec2 texcoord;                      \n"
+    "layout(location = 2) in vec4 color;                         \n"
+    "layout(location = 3) in float layer;                        \n"
     "out vec2 uv;                                                \n"
     "out vec4 fcolor;                                            \n"
+    "flat out float flayer;                                      \n"
     "uniform vec2 tile_min;                                      \n"
     "uniform vec2 tile_scale;                                    \n"
     "                                                            \n"
@@ -69,58 +135,199 @@ static const char *vs_text[] = {
     "{                                                           \n"
     "    uv = texcoord;                                          \n"
     "    fcolor = color;                                         \n"
+    "    flayer = layer;                                         \n"
     "    vec2 local = (position - tile_min) / tile_scale;        \n"
     "    vec2 p = vec2(2.0 * local.x - 1.0, 1.0 - 2.0 * local.y);\n"
     "    gl_Position = vec4(p, 0.5, 1.0);                        \n"
     "}                                                           \n"
 };
 
-static const char *fs_text[] = {
-    "#version 410 core                                                     \n"
-    "                                                                      \n"
-    "uniform sampler2D img0;                                               \n"
-    "                                                                      \n"
-    "uniform vec2 texture_size;                                            \n"
-    "uniform int render_mode;                                              \n"
-    "                                                                      \n"
-    "in vec2 uv;                                                           \n"
-    "in vec4 fcolor;                                                       \n"
-    "                                                                      \n"
-    "out vec4 texelColor;                                                  \n"
-    "                                                                      \n"
-    "void main(void)                                                       \n"
-    "{                                                                     \n"
-    "    if (render_mode == 0) {                                           \n"
-    "        if (uv.s < 0)                                                 \n"
-    "            texelColor = vec4(0, 1, 0, 1);                            \n"
-    "        else                                                          \n"
-    "            texelColor = vec4(texture2D(img0, uv).rgb, 1);            \n"
-    "    } else if (render_mode == 1) {                                    \n"
-    "        vec2 coord = uv * texture_size - vec2(0.5, 0.5);              \n"
-    "        vec2 idx = floor(coord);                                      \n"
-    "        vec2 fraction = coord - idx;                                  \n"
-    "        vec2 one_frac = vec2(1.0, 1.0) - fraction;                    \n"
-    "        vec2 one_frac2 = one_frac * one_frac;                         \n"
-    "        vec2 fraction2 = fraction * fraction;                         \n"
-    "        vec2 w0 = (1.0/6.0) * one_frac2 * one_frac;                   \n"
-    "        vec2 w1 = (2.0/3.0) - 0.5 * fraction2 * (2.0 - fraction);     \n"
-    "        vec2 w2 = (2.0/3.0) - 0.5 * one_frac2 * (2.0 - one_frac);     \n"
-    "        vec2 w3 = (1.0/6.0) * fraction2 * fraction;                   \n"
-    "        vec2 g0 = w0 + w1;                                            \n"
-    "        vec2 g1 = w2 + w3;                                            \n"
-    "        vec2 h0 = (w1 / g0) - 0.5 + idx;                              \n"
-    "        vec2 h1 = (w3 / g1) + 1.5 + idx;                              \n"
-    "        vec4 tex00 = texture2D(img0, vec2(h0.x, h0.y) / texture_size);\n"
-    "        vec4 tex10 = texture2D(img0, vec2(h1.x, h0.y) / texture_size);\n"
-    "        vec4 tex01 = texture2D(img0, vec2(h0.x, h1.y) / texture_size);\n"
-    "        vec4 tex11 = texture2D(img0, vec2(h1.x, h1.y) / texture_size);\n"
-    "        tex00 = mix(tex00, tex01, g1.y);                              \n"
-    "        tex10 = mix(tex10, tex11, g1.y);                              \n"
-    "        texelColor = mix(tex00, tex10, g1.x);                         \n"
-    "    } else {                                                          \n"
-    "        texelColor = fcolor;                                          \n"
-    "    }                                                                 \n"
-    "}                                                                     \n"
+// Attribute locations of the chart vertex shader, shared by all the program variants
+enum ChartAttribute { ATTRIB_POSITION = 0, ATTRIB_TEXCOORD = 1, ATTRIB_COLOR = 2, ATTRIB_LAYER = 3 };
+
+// Body of the chart fragment shader. The interpolation is selected at compile time
+// by one of the MODE_NEAREST, MODE_LINEAR, MODE_CUBIC or MODE_FACE_COLOR macros
+// (see ChartFragmentSource()), so each variant contains only the code of its mode.
+// Nearest and linear differ only in the sampler objects bound to the image units
+static const char *fs_body_text =
+    "uniform sampler2D img0;                                                \n"
+    "uniform sampler2DArray page_pool;                                      \n"
+    "uniform usampler2D page_table;                                         \n"
+    "uniform sampler2DArray img_array;                                      \n"
+    "                                                                       \n"
+    "uniform vec2 texture_size;                                             \n"
+    "uniform int paged;                                                     \n"
+    "uniform int flip_v;                                                    \n"
+    "uniform int layered;                                                   \n"
+    "uniform vec3 page_geometry; // content, border and side of a page      \n"
+    "                                                                       \n"
+    "in vec2 uv;                                                            \n"
+    "in vec4 fcolor;                                                        \n"
+    "flat in float flayer;                                                  \n"
+    "                                                                       \n"
+    "layout(location = 0) out vec4 texelColor;                              \n"
+    "layout(location = 1) out float coverage;                               \n"
+    "                                                                       \n"
+    "#ifndef MODE_FACE_COLOR                                                \n"
+    "vec4 sampleImage(vec2 st)                                              \n"
+    "{                                                                      \n"
+    "    if (layered == 1)                                                  \n"
+    "        return texture(img_array, vec3(st.s, 1.0 - st.t, flayer));     \n"
+    "    if (paged == 0)                                                    \n"
+    "        return texture(img0, (flip_v == 0) ? st : vec2(st.s, 1.0 - st.t)); \n"
+    "    vec2 t = st * texture_size;                                        \n"
+    "    t = t - texture_size * floor(t / texture_size);                    \n"
+    "    ivec2 page = min(ivec2(t / page_geometry.x), textureSize(page_table, 0) - 1); \n"
+    "    uint layer = texelFetch(page_table, page, 0).r;                    \n"
+    "    if (layer == 0u)                                                   \n"
+    "        return vec4(1, 0, 1, 1);                                       \n"
+    "    vec2 local = (t - vec2(page) * page_geometry.x + page_geometry.y) / page_geometry.z; \n"
+    "    return texture(page_pool, vec3(local, float(layer - 1u)));         \n"
+    "}                                                                      \n"
+    "#endif                                                                 \n"
+    "                                                                       \n"
+    "void main(void)                                                        \n"
+    "{                                                                      \n"
+    "    coverage = 1.0;                                                    \n"
+    "#if defined(MODE_NEAREST) || defined(MODE_LINEAR)                      \n"
+    "    if (uv.s < 0)                                                      \n"
+    "        texelColor = vec4(0, 1, 0, 1);                                 \n"
+    "    else                                                               \n"
+    "        texelColor = vec4(sampleImage(uv).rgb, 1);                     \n"
+    "#elif defined(MODE_CUBIC)                                              \n"
+    "    vec2 coord = uv * texture_size - vec2(0.5, 0.5);                   \n"
+    "    vec2 idx = floor(coord);                                           \n"
+    "    vec2 fraction = coord - idx;                                       \n"
+    "    vec2 one_frac = vec2(1.0, 1.0) - fraction;                         \n"
+    "    vec2 one_frac2 = one_frac * one_frac;                              \n"
+    "    vec2 fraction2 = fraction * fraction;                              \n"
+    "    vec2 w0 = (1.0/6.0) * one_frac2 * one_frac;                        \n"
+    "    vec2 w1 = (2.0/3.0) - 0.5 * fraction2 * (2.0 - fraction);          \n"
+    "    vec2 w2 = (2.0/3.0) - 0.5 * one_frac2 * (2.0 - one_frac);          \n"
+    "    vec2 w3 = (1.0/6.0) * fraction2 * fraction;                        \n"
+    "    vec2 g0 = w0 + w1;                                                 \n"
+    "    vec2 g1 = w2 + w3;                                                 \n"
+    "    vec2 h0 = (w1 / g0) - 0.5 + idx;                                   \n"
+    "    vec2 h1 = (w3 / g1) + 1.5 + idx;                                   \n"
+    "    vec4 tex00 = sampleImage(vec2(h0.x, h0.y) / texture_size);         \n"
+    "    vec4 tex10 = sampleImage(vec2(h1.x, h0.y) / texture_size);         \n"
+    "    vec4 tex01 = sampleImage(vec2(h0.x, h1.y) / texture_size);         \n"
+    "    vec4 tex11 = sampleImage(vec2(h1.x, h1.y) / texture_size);         \n"
+    "    tex00 = mix(tex00, tex01, g1.y);                                   \n"
+    "    tex10 = mix(tex10, tex11, g1.y);                                   \n"
+    "    texelColor = mix(tex00, tex10, g1.x);                              \n"
+    "#else                                                                  \n"
+    "    texelColor = fcolor;                                               \n"
+    "#endif                                                                 \n"
+    "}                                                                      \n";
+
+static constexpr int RENDER_MODE_COUNT = FaceColor + 1;
+
+static std::string ChartFragmentSource(RenderMode mode)
+{
+    static const char *defines[RENDER_MODE_COUNT] = {
+        "#define MODE_NEAREST\n", "#define MODE_LINEAR\n", "#define MODE_CUBIC\n", "#define MODE_FACE_COLOR\n"
+    };
+    return std::string("#version 410 core\n") + defines[mode] + fs_body_text;
+}
+
+// Full screen triangle of the post-processing passes, without vertex attributes
+static const char *quad_vs_text[] = {
+    "#version 410 core                                                      \n"
+    "                                                                       \n"
+    "void main(void)                                                        \n"
+    "{                                                                      \n"
+    "    vec2 p = vec2(gl_VertexID == 1 ? 3.0 : -1.0, gl_VertexID == 2 ? 3.0 : -1.0); \n"
+    "    gl_Position = vec4(p, 0.0, 1.0);                                   \n"
+    "}                                                                      \n"
+};
+
+// Jump flooding pass: each texel keeps the nearest of the seeds (covered texels)
+// found by its neighbours at distance step. The first pass initializes the seeds
+// from the coverage of the charts
+static const char *jfa_fs_text[] = {
+    "#version 410 core                                                      \n"
+    "                                                                       \n"
+    "uniform usampler2D seeds;                                              \n"
+    "uniform sampler2D coverage;                                            \n"
+    "uniform int init;                                                      \n"
+    "uniform int step;                                                      \n"
+    "uniform ivec2 size; // of the tile, the targets can be larger          \n"
+    "                                                                       \n"
+    "out uvec2 seed;                                                        \n"
+    "                                                                       \n"
+    "const uint NONE = 65535u;                                              \n"
+    "                                                                       \n"
+    "void main(void)                                                        \n"
+    "{                                                                      \n"
+    "    ivec2 p = ivec2(gl_FragCoord.xy);                                  \n"
+    "    if (init == 1) {                                                   \n"
+    "        seed = (texelFetch(coverage, p, 0).r > 0.0) ? uvec2(p) : uvec2(NONE); \n"
+    "        return;                                                        \n"
+    "    }                                                                  \n"
+    "    seed = uvec2(NONE);                                                \n"
+    "    float best = 0.0;                                                  \n"
+    "    for (int dy = -1; dy <= 1; ++dy) {                                 \n"
+    "        for (int dx = -1; dx <= 1; ++dx) {                             \n"
+    "            ivec2 q = p + ivec2(dx, dy) * step;                        \n"
+    "            if (q.x < 0 || q.y < 0 || q.x >= size.x || q.y >= size.y)  \n"
+    "                continue;                                              \n"
+    "            uvec2 s = texelFetch(seeds, q, 0).xy;                      \n"
+    "            if (s.x == NONE)                                           \n"
+    "                continue;                                              \n"
+    "            vec2 d = vec2(s) - vec2(p);                                \n"
+    "            if (seed.x == NONE || dot(d, d) < best) {                  \n"
+    "                seed = s;                                              \n"
+    "                best = dot(d, d);                                      \n"
+    "            }                                                          \n"
+    "        }                                                              \n"
+    "    }                                                                  \n"
+    "}                                                                      \n"
+};
+
+// Fills the texels within the gutter width from a chart with the color of the
+// nearest covered texel, the others keep the background color
+static const char *fill_fs_text[] = {
+    "#version 410 core                                                      \n"
+    "                                                                       \n"
+    "uniform sampler2D color;                                               \n"
+    "uniform usampler2D seeds;                                              \n"
+    "uniform float gutter;                                                  \n"
+    "                                                                       \n"
+    "out vec4 texelColor;                                                   \n"
+    "                                                                       \n"
+    "void main(void)                                                        \n"
+    "{                                                                      \n"
+    "    ivec2 p = ivec2(gl_FragCoord.xy);                                  \n"
+    "    uvec2 s = texelFetch(seeds, p, 0).xy;                              \n"
+    "    if (s.x != 65535u && distance(vec2(s), vec2(p)) <= gutter)         \n"
+    "        texelColor = texelFetch(color, ivec2(s), 0);                   \n"
+    "    else                                                               \n"
+    "        texelColor = vec4(0, 0, 0, 1);                                 \n"
+    "}                                                                      \n"
+};
+
+// Box filter of the levels of detail of a tile: each texel of the level is the
+// average of the factor x factor texels of the rendered tile it covers
+static const char *lod_fs_text[] = {
+    "#version 410 core                                                      \n"
+    "                                                                       \n"
+    "uniform sampler2D source;                                              \n"
+    "uniform ivec2 source_origin; // first texel of the tile in the source  \n"
+    "uniform ivec2 target_origin; // first texel of the level in the target \n"
+    "uniform int factor;                                                    \n"
+    "                                                                       \n"
+    "out vec4 texelColor;                                                   \n"
+    "                                                                       \n"
+    "void main(void)                                                        \n"
+    "{                                                                      \n"
+    "    ivec2 p = source_origin + (ivec2(gl_FragCoord.xy) - target_origin) * factor; \n"
+    "    vec4 sum = vec4(0.0);                                              \n"
+    "    for (int dy = 0; dy < factor; ++dy)                                \n"
+    "        for (int dx = 0; dx < factor; ++dx)                            \n"
+    "            sum += texelFetch(source, p + ivec2(dx, dy), 0);           \n"
+    "    texelColor = sum / float(factor * factor);                         \n"
+    "}                                                                      \n"
 };
 
 // A struct to manage persistent OpenGL state throughout the rendering of all texture sheets.
@@ -131,21 +338,114 @@ struct RenderingContext {
     std::unique_ptr<QOffscreenSurface> surface;
     bool ownContext = false;
 
-    GLuint program = 0;
+    // One variant of the chart program for each render mode, the variant of the
+    // sheet being rendered is selected by useChartProgram()
+    struct ChartProgram {
+        GLuint program = 0;
+        GLint loc_img0 = -1;
+        GLint loc_texture_size = -1;
+        GLint loc_tile_min = -1;
+        GLint loc_tile_scale = -1;
+        GLint loc_paged = -1;
+        GLint loc_flip_v = -1;
+        GLint loc_layered = -1;
+    };
+    ChartProgram chartPrograms[RENDER_MODE_COUNT];
+    ChartProgram chart;
+
+    // directory of the scratch files of the sheet images, set for each job
+    std::string scratchDirectory;
+
+    // Nearest sampler objects, bound to the image units in Nearest mode in place of
+    // the (linear) filtering state of the textures. The page pool clamps its pages
+    GLuint nearestSampler = 0;
+    GLuint nearestClampSampler = 0;
+
     GLuint vao = 0;
     GLuint vertexbuf = 0;
+
+    // The vertex buffer grows to the size of the largest sheet. With buffer storage
+    // it stays mapped (persistent and coherent) and is filled in place for each
+    // sheet: the readback of the previous sheet waits for its draw calls, so the
+    // buffer is never overwritten while in use
+    typedef void (QOPENGLF_APIENTRYP BufferStorageProc)(GLenum target, GLsizeiptr size, const void *data, GLbitfield flags);
+    BufferStorageProc glBufferStorage = nullptr;
+    GLsizeiptr vertexbufSize = 0;
+    void *vertexbufPtr = nullptr;
     GLuint fbo = 0;
     GLuint renderTarget = 0;
-    int renderedTexWidth = -1;
-    int renderedTexHeight = -1;
+    // The render target and the targets of the dilation only grow, to the largest
+    // tile rendered in the context. Each tile is drawn in the region at the origin
+    // (the viewport and the scissor box), so edge tiles and sheets of other sizes do
+    // not reallocate them
+    int targetWidth = 0;
+    int targetHeight = 0;
     GLint initialDrawBuffer = 0;
 
-    // Cached uniform locations
-    GLint loc_img0 = -1;
-    GLint loc_texture_size = -1;
-    GLint loc_render_mode = -1;
-    GLint loc_tile_min = -1;
-    GLint loc_tile_scale = -1;
+    // Double-buffered pixel pack buffers used to read back the rendered tiles
+    // asynchronously: the transfer of a tile overlaps with the drawing of the next one
+    struct TileReadback {
+        bool pending = false;
+        GLsync fence = 0;
+        int x = 0;
+        int row = 0;  // top row of the tile in the sheet image
+        int w = 0;
+        int h = 0;
+        int levels = 0; // levels of detail read back after the tile
+    };
+    GLuint pbo[2] = {0, 0};
+    GLsizeiptr pboSize[2] = {0, 0};
+    TileReadback readback[2];
+
+    // Dilation of the charts into the gutter by jump flooding (see dilate()), set up
+    // on first use. The charts write their coverage to the second color attachment
+    // of the render target, and the dilated tile is read back from postFbo
+    GLuint coverageTarget = 0;      // R8
+    GLuint seedTarget[2] = {0, 0};  // RG16UI, nearest covered texel (65535 if none)
+    GLuint dilatedTarget = 0;       // RGBA8
+    GLuint postFbo = 0;
+    GLuint postVao = 0;             // the full screen passes have no vertex attributes
+    GLuint jfaProgram = 0;
+    GLuint fillProgram = 0;
+    GLint loc_jfa_init = -1;
+    GLint loc_jfa_step = -1;
+    GLint loc_jfa_size = -1;
+    GLint loc_fill_gutter = -1;
+    int dilatedWidth = 0;
+    int dilatedHeight = 0;
+
+    // Levels of detail of the tiles (see downsample()), stacked from the first row
+    // of lodTarget, set up on first use
+    GLuint lodTarget = 0;           // RGBA8
+    GLuint lodFbo = 0;
+    GLuint lodProgram = 0;
+    GLint loc_lod_source_origin = -1;
+    GLint loc_lod_target_origin = -1;
+    GLint loc_lod_factor = -1;
+    int lodWidth = 0;
+    int lodHeight = 0;
+
+    // GPU time of the stages of the tiles, measured with timestamp queries. A
+    // timestamp is recorded when a stage is issued, and the GPU time to the next
+    // timestamp is charged to that stage (the wall clock times of the tile loop only
+    // measure the submission of the commands). The queries are resolved after the
+    // readback of their tile without blocking (see resolveTimestamps()), and the
+    // times accumulate over the sheets rendered in the context
+    enum GpuStage { GpuUpload, GpuDraw, GpuDilate, GpuLod, GpuReadback, GpuNone, GPU_STAGE_COUNT };
+    struct GpuTimestamp {
+        GLuint query;
+        GpuStage stage;
+    };
+    std::vector<GLuint> freeQueries;
+    std::deque<GpuTimestamp> timestamps;  // issued and not resolved yet, in order
+    GpuStage issuedStage = GpuNone;
+    GpuStage resolvedStage = GpuNone;
+    GLuint64 resolvedTime = 0;
+    double gpuStageS[GPU_STAGE_COUNT] = {};
+    // the resolved stages are also traced, on a track of the thread of the context
+    // with the GPU clock moved to the trace clock (see calibrateGpuClock())
+    std::string gpuTrack;
+    int64_t gpuClockOffset = 0;
 
     RenderingContext() {
         if (QOpenGLContext::currentContext() == nullptr) {
@@ -160,38 +460,36 @@ struct RenderingContext {
 
         CHECK_GL_ERROR();
 
-        program = CompileShaders(vs_text, fs_text);
-        glFuncs->glUseProgram(program);
+        for (int mode = 0; mode < RENDER_MODE_COUNT; ++mode)
+            chartPrograms[mode] = compileChartProgram(RenderMode(mode));
+        chart = chartPrograms[Linear];
+        glFuncs->glUseProgram(chart.program);
+
+        glFuncs->glGenSamplers(1, &nearestSampler);
+        glFuncs->glSamplerParameteri(nearestSampler, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glFuncs->glSamplerParameteri(nearestSampler, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glFuncs->glSamplerParameteri(nearestSampler, GL_TEXTURE_WRAP_S, GL_REPEAT);
+        glFuncs->glSamplerParameteri(nearestSampler, GL_TEXTURE_WRAP_T, GL_REPEAT);
+        glFuncs->glGenSamplers(1, &nearestClampSampler);
+        glFuncs->glSamplerParameteri(nearestClampSampler, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glFuncs->glSamplerParameteri(nearestClampSampler, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glFuncs->glSamplerParameteri(nearestClampSampler, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glFuncs->glSamplerParameteri(nearestClampSampler, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
 
         glFuncs->glGenVertexArrays(1, &vao);
         glFuncs->glBindVertexArray(vao);
 
         glFuncs->glGenBuffers(1, &vertexbuf);
-        glFuncs->glBindBuffer(GL_ARRAY_BUFFER, vertexbuf);
-
-        GLint pos_location = glFuncs->glGetAttribLocation(program, "position");
-        glFuncs->glVertexAttribPointer(pos_location, 2, GL_FLOAT, GL_FALSE, 5 * sizeof(float), 0);
-        glFuncs->glEnableVertexAttribArray(pos_location);
-
-        GLint tc_location = glFuncs->glGetAttribLocation(program, "texcoord");
-        glFuncs->glVertexAttribPointer(tc_location, 2, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void *)(2 * sizeof(float)));
-        glFuncs->glEnableVertexAttribArray(tc_location);
+        setupVertexAttributes();
 
-        GLint color_location = glFuncs->glGetAttribLocation(program, "color");
-        glFuncs->glVertexAttribPointer(color_location, 4, GL_UNSIGNED_BYTE, GL_TRUE, 5 * sizeof(float), (void *)(4 * sizeof(float)));
-        glFuncs->glEnableVertexAttribArray(color_location);
-
-        glFuncs->glBindBuffer(GL_ARRAY_BUFFER, 0);
-
-        // Cache uniform locations
-        loc_img0 = glFuncs->glGetUniformLocation(program, "img0");
-        loc_texture_size = glFuncs->glGetUniformLocation(program, "texture_size");
-        loc_render_mode = glFuncs->glGetUniformLocation(program, "render_mode");
-        loc_tile_min = glFuncs->glGetUniformLocation(program, "tile_min");
-        loc_tile_scale = glFuncs->glGetUniformLocation(program, "tile_scale");
+        QOpenGLContext *context = QOpenGLContext::currentContext();
+        if (context->format().version() >= qMakePair(4, 4) || context->hasExtension("GL_ARB_buffer_storage"))
+            glBufferStorage = reinterpret_cast<BufferStorageProc>(context->getProcAddress("glBufferStorage"));
+        LOG_VERBOSE << "Persistently mapped vertex buffer " << (glBufferStorage ? "enabled" : "not supported");
 
         glFuncs->glGenFramebuffers(1, &fbo);
         glFuncs->glGenTextures(1, &renderTarget);
+        glFuncs->glGenBuffers(2, pbo);
 
         glFuncs->glDisable(GL_DEPTH_TEST);
         glFuncs->glDisable(GL_STENCIL_TEST);
@@ -202,11 +500,41 @@ struct RenderingContext {
         glFuncs->glBindVertexArray(0);
         glFuncs->glBindFramebuffer(GL_FRAMEBUFFER, 0);
 
-        glFuncs->glDeleteProgram(program);
+        for (int mode = 0; mode < RENDER_MODE_COUNT; ++mode)
+            glFuncs->glDeleteProgram(chartPrograms[mode].program);
+        glFuncs->glBindSampler(0, 0);
+        glFuncs->glBindSampler(1, 0);
+        glFuncs->glBindSampler(3, 0);
+        glFuncs->glDeleteSamplers(1, &nearestSampler);
+        glFuncs->glDeleteSamplers(1, &nearestClampSampler);
         glFuncs->glDeleteVertexArrays(1, &vao);
         glFuncs->glDeleteBuffers(1, &vertexbuf);
         glFuncs->glDeleteFramebuffers(1, &fbo);
         glFuncs->glDeleteTextures(1, &renderTarget);
+        for (int i = 0; i < 2; ++i) {
+            if (readback[i].fence)
+                glFuncs->glDeleteSync(readback[i].fence);
+        }
+        glFuncs->glDeleteBuffers(2, pbo);
+        if (jfaProgram) {
+            glFuncs->glDeleteProgram(jfaProgram);
+            glFuncs->glDeleteProgram(fillProgram);
+            glFuncs->glDeleteFramebuffers(1, &postFbo);
+            glFuncs->glDeleteTextures(1, &coverageTarget);
+            glFuncs->glDeleteTextures(2, seedTarget);
+            glFuncs->glDeleteTextures(1, &dilatedTarget);
+        }
+        if (lodProgram) {
+            glFuncs->glDeleteProgram(lodProgram);
+            glFuncs->glDeleteFramebuffers(1, &lodFbo);
+            glFuncs->glDeleteTextures(1, &lodTarget);
+        }
+        if (postVao)
+            glFuncs->glDeleteVertexArrays(1, &postVao);
+        for (const GpuTimestamp& ts : timestamps)
+            freeQueries.push_back(ts.query);
+        if (!freeQueries.empty())
+            glFuncs->glDeleteQueries((GLsizei) freeQueries.size(), freeQueries.data());
 
         if (ownContext) {
             glFuncs->glDrawBuffer(initialDrawBuffer);
@@ -214,12 +542,176 @@ struct RenderingContext {
         }
     }
 
+    static const char *gpuStageName(GpuStage stage) {
+        switch (stage) {
+        case GpuUpload:   return "gpu-upload";
+        case GpuDraw:     return "gpu-draw";
+        case GpuDilate:   return "gpu-dilate";
+        case GpuLod:      return "gpu-lod";
+        case GpuReadback: return "gpu-readback";
+        default:          return "gpu-none";
+        }
+    }
+
+    // Records the start of a stage on the GPU, consecutive marks of the same stage
+    // are merged. The commands after a GpuNone mark are not timed
+    void markGpuStage(GpuStage stage) {
+        if (stage == issuedStage)
+            return;
+        GLuint query = 0;
+        if (freeQueries.empty()) {
+            glFuncs->glGenQueries(1, &query);
+        } else {
+            query = freeQueries.back();
+            freeQueries.pop_back();
+        }
+        glFuncs->glQueryCounter(query, GL_TIMESTAMP);
+        timestamps.push_back({query, stage});
+        issuedStage = stage;
+    }
+
+    // Charges the time between the resolved timestamps to their stages, in order. If
+    // wait is false it stops at the first query whose result is not available yet
+    void resolveTimestamps(bool wait) {
+        while (!timestamps.empty()) {
+            GpuTimestamp ts = timestamps.front();
+            if (!wait) {
+                GLint available = 0;
+                glFuncs->glGetQueryObjectiv(ts.query, GL_QUERY_RESULT_AVAILABLE, &available);
+                if (!available)
+                    break;
+            }
+            GLuint64 t = 0;
+            glFuncs->glGetQueryObjectui64v(ts.query, GL_QUERY_RESULT, &t);
+            if (resolvedStage != GpuNone && t >= resolvedTime) {
+                gpuStageS[resolvedStage] += double(t - resolvedTime) * 1e-9;
+                if (TracingEnabled())
+                    RecordTraceSpan(gpuTrack, gpuStageName(resolvedStage), "gpu",
+                                    int64_t(resolvedTime) + gpuClockOffset, int64_t(t) + gpuClockOffset);
+            }
+            resolvedStage = ts.stage;
+            resolvedTime = t;
+            freeQueries.push_back(ts.query);
+            timestamps.pop_front();
+        }
+    }
+
+    // Sets the offset from the GPU clock to the trace clock, the GPU time queried
+    // directly is the time at which the command is processed
+    void calibrateGpuClock() {
+        if (!TracingEnabled())
+            return;
+        GLint64 gpuNow = 0;
+        glFuncs->glGetInteger64v(GL_TIMESTAMP, &gpuNow);
+        gpuClockOffset = TraceClock() - int64_t(gpuNow);
+        gpuTrack = "GPU " + LOG_GET_THREAD_NAME;
+    }
+
+    // Compiles the chart program specialized for the given render mode, and sets the
+    // uniforms that never change (sampler units and page geometry)
+    ChartProgram compileChartProgram(RenderMode mode) {
+        std::string fs = ChartFragmentSource(mode);
+        const char *fs_src[] = { fs.c_str() };
+        ChartProgram cp;
+        cp.program = CompileShaders(vs_text, fs_src);
+        glFuncs->glUseProgram(cp.program);
+
+        cp.loc_img0 = glFuncs->glGetUniformLocation(cp.program, "img0");
+        cp.loc_texture_size = glFuncs->glGetUniformLocation(cp.program, "texture_size");
+        cp.loc_tile_min = glFuncs->glGetUniformLocation(cp.program, "tile_min");
+        cp.loc_tile_scale = glFuncs->glGetUniformLocation(cp.program, "tile_scale");
+        cp.loc_paged = glFuncs->glGetUniformLocation(cp.program, "paged");
+        cp.loc_flip_v = glFuncs->glGetUniformLocation(cp.program, "flip_v");
+        cp.loc_layered = glFuncs->glGetUniformLocation(cp.program, "layered");
+
+        glFuncs->glUniform1i(cp.loc_img0, 0);
+        glFuncs->glUniform1i(glFuncs->glGetUniformLocation(cp.program, "page_pool"), 1);
+        glFuncs->glUniform1i(glFuncs->glGetUniformLocation(cp.program, "page_table"), 2);
+        glFuncs->glUniform1i(glFuncs->glGetUniformLocation(cp.program, "img_array"), 3);
+        glFuncs->glUniform1i(cp.loc_layered, 0);
+        glFuncs->glUniform1i(cp.loc_paged, 0);
+        glFuncs->glUniform3f(glFuncs->glGetUniformLocation(cp.program, "page_geometry"),
+                             float(VirtualTexture::PAGE_CONTENT), float(VirtualTexture::PAGE_BORDER), float(VirtualTexture::PAGE_SIZE));
+        CHECK_GL_ERROR();
+        return cp;
+    }
+
+    // Makes the variant of the given mode current, and binds the nearest samplers to
+    // the image units (0 and 3) and the page pool (1) in Nearest mode. The page table
+    // (2) is always fetched with texelFetch
+    void useChartProgram(RenderMode mode) {
+        chart = chartPrograms[mode];
+        glFuncs->glUseProgram(chart.program);
+        bool nearest = (mode == Nearest);
+        glFuncs->glBindSampler(0, nearest ? nearestSampler : 0);
+        glFuncs->glBindSampler(1, nearest ? nearestClampSampler : 0);
+        glFuncs->glBindSampler(3, nearest ? nearestSampler : 0);
+    }
+
+    void setupVertexAttributes() {
+        glFuncs->glBindVertexArray(vao);
+        glFuncs->glBindBuffer(GL_ARRAY_BUFFER, vertexbuf);
+
+        glFuncs->glVertexAttribPointer(ATTRIB_POSITION, 2, GL_FLOAT, GL_FALSE, VERTEX_STRIDE * sizeof(float), 0);
+        glFuncs->glEnableVertexAttribArray(ATTRIB_POSITION);
+
+        glFuncs->glVertexAttribPointer(ATTRIB_TEXCOORD, 2, GL_FLOAT, GL_FALSE, VERTEX_STRIDE * sizeof(float), (void *)(2 * sizeof(float)));
+        glFuncs->glEnableVertexAttribArray(ATTRIB_TEXCOORD);
+
+        glFuncs->glVertexAttribPointer(ATTRIB_COLOR, 4, GL_UNSIGNED_BYTE, GL_TRUE, VERTEX_STRIDE * sizeof(float), (void *)(4 * sizeof(float)));
+        glFuncs->glEnableVertexAttribArray(ATTRIB_COLOR);
+
+        glFuncs->glVertexAttribPointer(ATTRIB_LAYER, 1, GL_FLOAT, GL_FALSE, VERTEX_STRIDE * sizeof(float), (void *)(5 * sizeof(float)));
+        glFuncs->glEnableVertexAttribArray(ATTRIB_LAYER);
+
+        glFuncs->glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+
+    // Returns a pointer to write bytes of vertex data, grows the buffer if needed
+    float *mapVertices(GLsizeiptr bytes) {
+        const GLbitfield persistentFlags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        if (bytes > vertexbufSize) {
+            LOG_DEBUG << "Growing the vertex buffer to " << bytes << " bytes";
+            if (glBufferStorage) {
+                // immutable storage cannot be resized, the buffer is replaced
+                glFuncs->glDeleteBuffers(1, &vertexbuf);
+                glFuncs->glGenBuffers(1, &vertexbuf);
+                setupVertexAttributes();
+                glFuncs->glBindBuffer(GL_ARRAY_BUFFER, vertexbuf);
+                glBufferStorage(GL_ARRAY_BUFFER, bytes, NULL, persistentFlags);
+                vertexbufPtr = glFuncs->glMapBufferRange(GL_ARRAY_BUFFER, 0, bytes, persistentFlags);
+                glFuncs->glBindBuffer(GL_ARRAY_BUFFER, 0);
+            } else {
+                glFuncs->glBindBuffer(GL_ARRAY_BUFFER, vertexbuf);
+                glFuncs->glBufferData(GL_ARRAY_BUFFER, bytes, NULL, GL_STREAM_DRAW);
+                glFuncs->glBindBuffer(GL_ARRAY_BUFFER, 0);
+            }
+            CHECK_GL_ERROR();
+            vertexbufSize = bytes;
+        }
+        if (glBufferStorage)
+            return (float *) vertexbufPtr;
+        glFuncs->glBindBuffer(GL_ARRAY_BUFFER, vertexbuf);
+        return (float *) glFuncs->glMapBufferRange(GL_ARRAY_BUFFER, 0, bytes, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+    }
+
+    void unmapVertices() {
+        if (!glBufferStorage) {
+            glFuncs->glUnmapBuffer(GL_ARRAY_BUFFER);
+            glFuncs->glBindBuffer(GL_ARRAY_BUFFER, 0);
+        }
+    }
+
+    // Grows the render target to hold a tile of the given size if needed, and
+    // restricts the viewport and the scissor box to the region of the tile
     void prepareRenderTarget(int width, int height) {
-        if (width != renderedTexWidth || height != renderedTexHeight) {
-            LOG_DEBUG << "Configuring render target for size " << width << "x" << height;
+        if (width > targetWidth || height > targetHeight) {
+            targetWidth = std::max(width, targetWidth);
+            targetHeight = std::max(height, targetHeight);
+            LOG_DEBUG << "Configuring render target for size " << targetWidth << "x" << targetHeight;
 
             glFuncs->glBindTexture(GL_TEXTURE_2D, renderTarget);
-            glFuncs->glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_BGRA, GL_UNSIGNED_BYTE, NULL);
+            glFuncs->glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, targetWidth, targetHeight, 0, GL_BGRA, GL_UNSIGNED_BYTE, NULL);
             glFuncs->glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
             glFuncs->glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
             glFuncs->glBindTexture(GL_TEXTURE_2D, 0);
@@ -232,34 +724,274 @@ struct RenderingContext {
                 CHECK_GL_ERROR();
                 std::exit(-1);
             }
+        }
+        // the clears of the tile are limited to its region by the scissor box
+        glFuncs->glViewport(0, 0, width, height);
+        glFuncs->glScissor(0, 0, width, height);
+        glFuncs->glEnable(GL_SCISSOR_TEST);
+    }
 
-            renderedTexWidth = width;
-            renderedTexHeight = height;
+    // Grows the targets of the dilation to hold a tile of the given size if needed,
+    // and attaches the coverage to the framebuffer of the render target
+    void prepareDilation(int width, int height) {
+        if (jfaProgram == 0) {
+            jfaProgram = CompileShaders(quad_vs_text, jfa_fs_text);
+            glFuncs->glUseProgram(jfaProgram);
+            glFuncs->glUniform1i(glFuncs->glGetUniformLocation(jfaProgram, "seeds"), 4);
+            glFuncs->glUniform1i(glFuncs->glGetUniformLocation(jfaProgram, "coverage"), 5);
+            loc_jfa_init = glFuncs->glGetUniformLocation(jfaProgram, "init");
+            loc_jfa_step = glFuncs->glGetUniformLocation(jfaProgram, "step");
+            loc_jfa_size = glFuncs->glGetUniformLocation(jfaProgram, "size");
+
+            fillProgram = CompileShaders(quad_vs_text, fill_fs_text);
+            glFuncs->glUseProgram(fillProgram);
+            glFuncs->glUniform1i(glFuncs->glGetUniformLocation(fillProgram, "seeds"), 4);
+            glFuncs->glUniform1i(glFuncs->glGetUniformLocation(fillProgram, "color"), 5);
+            loc_fill_gutter = glFuncs->glGetUniformLocation(fillProgram, "gutter");
+
+            glFuncs->glUseProgram(chart.program);
+            if (postVao == 0)
+                glFuncs->glGenVertexArrays(1, &postVao);
+            glFuncs->glGenFramebuffers(1, &postFbo);
+            glFuncs->glGenTextures(1, &coverageTarget);
+            glFuncs->glGenTextures(2, seedTarget);
+            glFuncs->glGenTextures(1, &dilatedTarget);
+            CHECK_GL_ERROR();
         }
-        // Always set viewport for robustness
+        if (width > dilatedWidth || height > dilatedHeight) {
+            dilatedWidth = std::max(width, dilatedWidth);
+            dilatedHeight = std::max(height, dilatedHeight);
+            LOG_DEBUG << "Configuring dilation targets for size " << dilatedWidth << "x" << dilatedHeight;
+            auto Allocate = [this](GLuint tex, GLint internalFormat, GLenum format, GLenum type) {
+                glFuncs->glBindTexture(GL_TEXTURE_2D, tex);
+                glFuncs->glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, dilatedWidth, dilatedHeight, 0, format, type, NULL);
+                glFuncs->glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+                glFuncs->glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+            };
+            Allocate(coverageTarget, GL_R8, GL_RED, GL_UNSIGNED_BYTE);
+            Allocate(seedTarget[0], GL_RG16UI, GL_RG_INTEGER, GL_UNSIGNED_SHORT);
+            Allocate(seedTarget[1], GL_RG16UI, GL_RG_INTEGER, GL_UNSIGNED_SHORT);
+            Allocate(dilatedTarget, GL_RGBA8, GL_BGRA, GL_UNSIGNED_BYTE);
+            glFuncs->glBindTexture(GL_TEXTURE_2D, 0);
+            CHECK_GL_ERROR();
+        }
+        glFuncs->glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+        glFuncs->glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, coverageTarget, 0);
+    }
+
+    // Dilates the charts drawn in the render target by up to gutter texels. The seeds
+    // are propagated by jump flooding with steps from the smallest power of two not
+    // below the gutter width down to one texel, then the texels of the gutter take the
+    // color of their nearest seed. Leaves postFbo bound, with the dilated tile in its
+    // first color attachment, and restores the program and vertex array of the charts
+    void dilate(int width, int height, int gutter) {
+        glFuncs->glBindFramebuffer(GL_FRAMEBUFFER, postFbo);
+        glFuncs->glDrawBuffer(GL_COLOR_ATTACHMENT0);
         glFuncs->glViewport(0, 0, width, height);
+        glFuncs->glBindVertexArray(postVao);
+        glFuncs->glUseProgram(jfaProgram);
+        glFuncs->glUniform2i(loc_jfa_size, width, height);
+
+        auto Pass = [this](GLuint source, GLuint target) {
+            glFuncs->glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, target, 0);
+            glFuncs->glActiveTexture(GL_TEXTURE4);
+            glFuncs->glBindTexture(GL_TEXTURE_2D, source);
+            glFuncs->glDrawArrays(GL_TRIANGLES, 0, 3);
+        };
+
+        glFuncs->glActiveTexture(GL_TEXTURE5);
+        glFuncs->glBindTexture(GL_TEXTURE_2D, coverageTarget);
+        glFuncs->glUniform1i(loc_jfa_init, 1);
+        Pass(0, seedTarget[0]);
+        glFuncs->glUniform1i(loc_jfa_init, 0);
+        int step = 1;
+        while (step < gutter)
+            step *= 2;
+        int src = 0;
+        for (; step >= 1; step /= 2) {
+            glFuncs->glUniform1i(loc_jfa_step, step);
+            Pass(seedTarget[src], seedTarget[1 - src]);
+            src = 1 - src;
+        }
+
+        glFuncs->glUseProgram(fillProgram);
+        glFuncs->glUniform1f(loc_fill_gutter, float(gutter));
+        glFuncs->glActiveTexture(GL_TEXTURE5);
+        glFuncs->glBindTexture(GL_TEXTURE_2D, renderTarget);
+        Pass(seedTarget[src], dilatedTarget);
+        CHECK_GL_ERROR();
+
+        glFuncs->glActiveTexture(GL_TEXTURE0);
+        glFuncs->glUseProgram(chart.program);
+        glFuncs->glBindVertexArray(vao);
+    }
+
+    // Row of the level of detail in lodTarget, the levels are stacked from level 1
+    static int lodRow(int tileH, int level) {
+        int row = 0;
+        for (int k = 1; k < level; ++k)
+            row += tileH >> k;
+        return row;
     }
+
+    // Downsamples the tile of tileW x tileH texels at (srcX, srcY) of the source
+    // texture to the levels of detail 1 to levels, each the box filter of the tile
+    // by a factor of 2^level. Leaves lodFbo bound, and restores the program and
+    // vertex array of the charts
+    void downsample(GLuint source, int srcX, int srcY, int tileW, int tileH, int levels) {
+        int width = tileW >> 1;
+        int height = lodRow(tileH, levels + 1);
+        if (lodProgram == 0) {
+            lodProgram = CompileShaders(quad_vs_text, lod_fs_text);
+            glFuncs->glUseProgram(lodProgram);
+            glFuncs->glUniform1i(glFuncs->glGetUniformLocation(lodProgram, "source"), 6);
+            loc_lod_source_origin = glFuncs->glGetUniformLocation(lodProgram, "source_origin");
+            loc_lod_target_origin = glFuncs->glGetUniformLocation(lodProgram, "target_origin");
+            loc_lod_factor = glFuncs->glGetUniformLocation(lodProgram, "factor");
+            if (postVao == 0)
+                glFuncs->glGenVertexArrays(1, &postVao);
+            glFuncs->glGenFramebuffers(1, &lodFbo);
+            glFuncs->glGenTextures(1, &lodTarget);
+            CHECK_GL_ERROR();
+        }
+        glFuncs->glBindFramebuffer(GL_FRAMEBUFFER, lodFbo);
+        if (width > lodWidth || height > lodHeight) {
+            lodWidth = std::max(width, lodWidth);
+            lodHeight = std::max(height, lodHeight);
+            LOG_DEBUG << "Configuring level of detail target for size " << lodWidth << "x" << lodHeight;
+            glFuncs->glBindTexture(GL_TEXTURE_2D, lodTarget);
+            glFuncs->glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, lodWidth, lodHeight, 0, GL_BGRA, GL_UNSIGNED_BYTE, NULL);
+            glFuncs->glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+            glFuncs->glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+            glFuncs->glBindTexture(GL_TEXTURE_2D, 0);
+            glFuncs->glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, lodTarget, 0);
+            if (glFuncs->glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+                LOG_ERR << "[OPENGL] FATAL: Level of detail framebuffer is not complete.";
+                CHECK_GL_ERROR();
+                std::exit(-1);
+            }
+        }
+        glFuncs->glDrawBuffer(GL_COLOR_ATTACHMENT0);
+        glFuncs->glBindVertexArray(postVao);
+        glFuncs->glUseProgram(lodProgram);
+        glFuncs->glActiveTexture(GL_TEXTURE6);
+        glFuncs->glBindTexture(GL_TEXTURE_2D, source);
+        glFuncs->glUniform2i(loc_lod_source_origin, srcX, srcY);
+        for (int k = 1; k <= levels; ++k) {
+            int row = lodRow(tileH, k);
+            glFuncs->glViewport(0, row, tileW >> k, tileH >> k);
+            glFuncs->glUniform2i(loc_lod_target_origin, 0, row);
+            glFuncs->glUniform1i(loc_lod_factor, 1 << k);
+            glFuncs->glDrawArrays(GL_TRIANGLES, 0, 3);
+        }
+        CHECK_GL_ERROR();
+
+        glFuncs->glActiveTexture(GL_TEXTURE0);
+        glFuncs->glUseProgram(chart.program);
+        glFuncs->glBindVertexArray(vao);
+    }
+};
+
+// A band of rows encoded for the format of its stream
+struct EncodedBand {
+    PNGStreamEncoder::EncodedRows png;   // raw rows for tga
+    TIFFStreamEncoder::EncodedRows tiff;
+    int rows = 0;
+};
+
+// A png, tga or tiff image saved by the queue in bands of rows while the sheet is
+// still being rendered. The bands are encoded by any worker, and written to the
+// file in row order as the previous ones complete
+struct BandStream {
+    QString path;
+    TextureFileFormat format = TextureFileFormat::PNG;
+    int width = 0;
+    int height = 0;
+    std::unique_ptr<PNGStreamEncoder> png;
+    std::unique_ptr<TIFFStreamEncoder> tiff;
+    AsyncFileWriter file;
+    bool ok = true;
+    int nextRow = 0;  // first row of the next band to write
+    std::map<int, EncodedBand> ready;  // bands waiting for the previous ones
+    double saveS = 0.0;
+    std::mutex mutex;
 };
 
-// Simple background saving queue to overlap PNG compression with rendering
+// Background saving queue to overlap the texture encoding with rendering. A pool of
+// workers encodes the queued images, and png images are compressed in parallel row
+// bands. The queue is bounded by the memory of the images waiting to be saved
 class ImageSaveQueue {
 public:
-    explicit ImageSaveQueue(int maxInFlight = 2) : maxInFlight(maxInFlight) {
-        worker = std::thread([this]() { this->run(); });
+    ImageSaveQueue(int numWorkers, std::size_t maxBytesInFlight)
+        : maxBytesInFlight(maxBytesInFlight)
+    {
+        numWorkers = std::max(numWorkers, 1);
+        encoderThreads = std::max(1, omp_get_max_threads() / numWorkers);
+        for (int i = 0; i < numWorkers; ++i)
+            workers.emplace_back([this, i]() {
+                LOG_SET_THREAD_NAME("save-" + std::to_string(i));
+                this->run();
+            });
     }
     ~ImageSaveQueue() {
         finish();
     }
-    void enqueue(QImage image, const QString& absolutePath, int quality) {
-        std::unique_lock<std::mutex> lock(mutex);
-        auto t_wait_start = std::chrono::high_resolution_clock::now();
-        notFull.wait(lock, [this]() { return stop || queue.size() < static_cast<size_t>(maxInFlight); });
-        auto t_wait_end = std::chrono::high_resolution_clock::now();
-        totalEnqueueWaitS += std::chrono::duration<double>(t_wait_end - t_wait_start).count();
-        if (stop) return;
-        queue.push(Task{std::move(image), absolutePath, quality});
+    void enqueue(QImage image, const QString& absolutePath, TextureFileFormat format, int quality) {
+        Task task;
+        task.bytes = std::size_t(image.bytesPerLine()) * std::size_t(image.height());
+        task.image = std::move(image);
+        task.path = absolutePath;
+        task.format = format;
+        task.quality = quality;
+        push(std::move(task));
+    }
+    // Starts saving a png, tga or tiff image in bands of rows, see enqueueBand()
+    std::shared_ptr<BandStream> beginStream(const QString& absolutePath, TextureFileFormat format, int quality, int width, int height) {
+        std::shared_ptr<BandStream> stream = std::make_shared<BandStream>();
+        stream->path = absolutePath;
+        stream->format = format;
+        stream->width = width;
+        stream->height = height;
+        std::vector<unsigned char> header;
+        if (format == TextureFileFormat::TGA) {
+            stream->ok = EncodeTGAHeader(width, height, header);
+        } else if (format == TextureFileFormat::TIFF) {
+            stream->tiff.reset(new TIFFStreamEncoder(width, height, PNGCompressionLevel(quality)));
+            stream->tiff->Begin(header);
+        } else {
+            stream->png.reset(new PNGStreamEncoder(width, height, PNGCompressionLevel(quality)));
+            stream->png->Begin(header);
+        }
+        stream->ok = stream->ok && stream->file.Open(absolutePath.toStdString())
+                && stream->file.Write(header.data(), header.size());
+        std::lock_guard<std::mutex> lock(mutex);
         tasksEnqueued++;
-        notEmpty.notify_one();
+        return stream;
+    }
+    // Enqueues the next band of rows of a stream, starting at firstRow. prevRow is
+    // a copy of the row before the band (empty for the first band), bands are
+    // enqueued top to bottom
+    void enqueueBand(std::shared_ptr<BandStream> stream, int firstRow, QImage band, std::vector<unsigned char> prevRow) {
+        Task task;
+        task.bytes = std::size_t(band.bytesPerLine()) * std::size_t(band.height());
+        task.image = std::move(band);
+        task.blocks = std::move(prevRow);
+        task.stream = std::move(stream);
+        task.firstRow = firstRow;
+        task.path = task.stream->path;
+        task.format = task.stream->format;
+        push(std::move(task));
+    }
+    // Enqueues the BC7 blocks of a texture image compressed on the GPU
+    void enqueueBC7(std::vector<unsigned char> blocks, int width, int height, const QString& absolutePath) {
+        Task task;
+        task.bytes = blocks.size();
+        task.blocks = std::move(blocks);
+        task.width = width;
+        task.height = height;
+        task.path = absolutePath;
+        task.format = TextureFileFormat::KTX2;
+        push(std::move(task));
     }
     void finish() {
         {
@@ -268,7 +1000,9 @@ public:
         }
         notEmpty.notify_all();
         notFull.notify_all();
-        if (worker.joinable()) worker.join();
+        for (auto& worker : workers) {
+            if (worker.joinable()) worker.join();
+        }
     }
     struct SaveStats {
         int enqueued = 0;
@@ -301,9 +1035,119 @@ public:
 private:
     struct Task {
         QImage image;
+        std::vector<unsigned char> blocks;  // or the row before the band of a stream
+        std::shared_ptr<BandStream> stream;
+        int firstRow = 0;
+        int width = 0;
+        int height = 0;
         QString path;
-        int quality;
+        TextureFileFormat format = TextureFileFormat::PNG;
+        int quality = -1;
+        std::size_t bytes = 0;
     };
+    void push(Task task) {
+        TRACE_SCOPE_CAT("SaveQueueWait", "save");
+        std::unique_lock<std::mutex> lock(mutex);
+        auto t_wait_start = std::chrono::high_resolution_clock::now();
+        // an image larger than the budget is accepted when nothing else is in flight
+        std::size_t bytes = task.bytes;
+        notFull.wait(lock, [this, bytes]() { return stop || bytesInFlight == 0 || bytesInFlight + bytes <= maxBytesInFlight; });
+        auto t_wait_end = std::chrono::high_resolution_clock::now();
+        totalEnqueueWaitS += std::chrono::duration<double>(t_wait_end - t_wait_start).count();
+        if (stop) return;
+        bytesInFlight += bytes;
+        MemoryAdd(MemorySubsystem::RenderImages, bytes);
+        if (!task.stream)
+            tasksEnqueued++;
+        queue.push(std::move(task));
+        notEmpty.notify_one();
+    }
+    bool save(const Task& task) {
+        if (task.format == TextureFileFormat::JPEG)
+            return task.image.save(task.path, "JPG", task.quality);
+
+        std::vector<unsigned char> data;
+        if (task.format == TextureFileFormat::KTX2) {
+            if (!EncodeKTX2BC7(task.blocks.data(), task.blocks.size(), task.width, task.height, data))
+                return false;
+        } else {
+            QImage image = task.image;
+            if (image.format() != QImage::Format_ARGB32)
+                image = image.convertToFormat(QImage::Format_ARGB32);
+            bool encoded;
+            if (task.format == TextureFileFormat::TGA)
+                encoded = EncodeTGA(image.constBits(), image.width(), image.height(), image.bytesPerLine(), data);
+            else if (task.format == TextureFileFormat::TIFF)
+                encoded = EncodeTIFF(image.constBits(), image.width(), image.height(), image.bytesPerLine(),
+                                     PNGCompressionLevel(task.quality), encoderThreads, data);
+            else
+                encoded = EncodePNG(image.constBits(), image.width(), image.height(), image.bytesPerLine(),
+                                    PNGCompressionLevel(task.quality), encoderThreads, data);
+            if (!encoded)
+                return false;
+        }
+        return WriteFileData(task.path.toStdString(), data.data(), data.size());
+    }
+    // Encodes the band and writes the bands of the stream that are ready. Returns
+    // true if the image is complete, and then sets ok and the total save time of the
+    // image (the time spent encoding and writing its bands)
+    bool saveBand(Task& task, bool& ok, double& saveS) {
+        auto t_band_start = std::chrono::high_resolution_clock::now();
+        BandStream& stream = *task.stream;
+        const QImage& band = task.image;
+        EncodedBand encoded;
+        bool encodedOk = true;
+        if (stream.ok) {
+            if (stream.png) {
+                encodedOk = stream.png->EncodeRows(band.constBits(), band.bytesPerLine(), task.blocks.empty() ? nullptr : task.blocks.data(),
+                                                   task.firstRow, band.height(), encoderThreads, encoded.png);
+            } else if (stream.tiff) {
+                encodedOk = stream.tiff->EncodeRows(band.constBits(), band.bytesPerLine(), task.firstRow, band.height(), encoderThreads, encoded.tiff);
+            } else {
+                std::size_t rowBytes = std::size_t(stream.width) * 4;
+                encoded.png.deflated.resize(rowBytes * band.height());
+                for (int y = 0; y < band.height(); ++y)
+                    std::memcpy(encoded.png.deflated.data() + y * rowBytes, band.constScanLine(y), rowBytes);
+            }
+        }
+        encoded.rows = band.height();
+
+        std::lock_guard<std::mutex> lock(stream.mutex);
+        stream.ok = stream.ok && encodedOk;
+        stream.ready[task.firstRow] = std::move(encoded);
+        while (!stream.ready.empty() && stream.ready.begin()->first == stream.nextRow) {
+            EncodedBand& rows = stream.ready.begin()->second;
+            stream.nextRow += rows.rows;
+            if (stream.ok) {
+                std::vector<unsigned char> data;
+                std::vector<unsigned char> header;
+                if (stream.png) {
+                    stream.png->Append(rows.png, data);
+                    if (stream.nextRow == stream.height)
+                        stream.png->End(data);
+                } else if (stream.tiff) {
+                    stream.tiff->Append(rows.tiff, data);
+                    if (stream.nextRow == stream.height)
+                        stream.tiff->End(data, header);
+                } else {
+                    data.swap(rows.png.deflated);
+                }
+                stream.ok = stream.file.Write(data.data(), data.size());
+                // the tiff header is rewritten with the offset of the directory
+                if (!header.empty())
+                    stream.ok = stream.ok && stream.file.WriteAt(0, header.data(), header.size());
+            }
+            stream.ready.erase(stream.ready.begin());
+        }
+        auto t_band_end = std::chrono::high_resolution_clock::now();
+        stream.saveS += std::chrono::duration<double>(t_band_end - t_band_start).count();
+        if (stream.nextRow < stream.height)
+            return false;
+        stream.ok = stream.file.Close() && stream.ok;
+        ok = stream.ok;
+        saveS = stream.saveS;
+        return true;
+    }
     void run() {
         for (;;) {
             Task task;
@@ -313,30 +1157,48 @@ private:
                 if (stop && queue.empty()) break;
                 task = std::move(queue.front());
                 queue.pop();
-                notFull.notify_one();
             }
-            auto t_save_start = std::chrono::high_resolution_clock::now();
-            bool ok = task.image.save(task.path, "png", task.quality);
-            auto t_save_end = std::chrono::high_resolution_clock::now();
-            double t_save_s = std::chrono::duration<double>(t_save_end - t_save_start).count();
-            {
-                std::lock_guard<std::mutex> lock(mutex);
-                tasksSaved++;
-                totalSaveS += t_save_s;
-                if (t_save_s > maxSaveS) maxSaveS = t_save_s;
-                if (t_save_s < minSaveS) minSaveS = t_save_s;
+            bool ok = true;
+            bool complete = true;
+            double t_save_s = 0.0;
+            TraceSpan saveSpan(task.stream ? "SaveBand" : "SaveImage", "save");
+            if (task.stream) {
+                complete = saveBand(task, ok, t_save_s);
+            } else {
+                auto t_save_start = std::chrono::high_resolution_clock::now();
+                ok = save(task);
+                auto t_save_end = std::chrono::high_resolution_clock::now();
+                t_save_s = std::chrono::duration<double>(t_save_end - t_save_start).count();
             }
-            if (!ok) {
+            saveSpan.End();
+            if (complete && !ok) {
                 LOG_ERR << "Error saving texture file " << task.path.toStdString();
             }
+            task.image = QImage();
+            std::vector<unsigned char>().swap(task.blocks);
+            task.stream.reset();
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (complete) {
+                    tasksSaved++;
+                    totalSaveS += t_save_s;
+                    if (t_save_s > maxSaveS) maxSaveS = t_save_s;
+                    if (t_save_s < minSaveS) minSaveS = t_save_s;
+                }
+                bytesInFlight -= task.bytes;
+            }
+            MemoryAdd(MemorySubsystem::RenderImages, -(long long) task.bytes);
+            notFull.notify_all();
         }
     }
-    std::thread worker;
+    std::vector<std::thread> workers;
+    int encoderThreads = 1;
     std::mutex mutex;
     std::condition_variable notEmpty;
     std::condition_variable notFull;
     std::queue<Task> queue;
-    int maxInFlight = 2;
+    std::size_t maxBytesInFlight = 0;
+    std::size_t bytesInFlight = 0;
     bool stop = false;
     // Stats
     int tasksEnqueued = 0;
@@ -347,92 +1209,481 @@ private:
     double totalEnqueueWaitS = 0.0;
 };
 
+// Order in which the output sheets are rendered, and the input textures bound in
+// each sheet, chosen to reduce the input texture uploads under the cache budget
+struct RenderPlan {
+    std::vector<int> sheetOrder;
+    std::vector<std::vector<int>> inputOrder;
+    uint64_t uploadBytes = 0;       // bytes uploaded by the plan
+    uint64_t indexOrderBytes = 0;   // bytes uploaded by rendering the sheets in index order
+};
+
+// Placement of a sheet in the scratch atlas of a batch, in pixels from the bottom
+// left corner of the atlas (the V axis of the sheets points up)
+struct SheetPlacement {
+    int sheet;
+    int x;
+    int y;
+    int w;
+    int h;
+};
+
+// Sheets rendered together. Consecutive small sheets of the plan are packed in
+// shelves of a scratch atlas and drawn with a single vertex upload and readback,
+// instead of paying the render target setup and the readback of each sheet. A
+// batch of one sheet is rendered on its own, in full
+struct SheetBatch {
+    std::vector<SheetPlacement> sheets;
+    int width = 0;
+    int height = 0;
+};
+
+// Sheets shared by the rendering contexts. Each context takes the next sheet of
+// the plan, and accumulates its stats when there are no sheets left
+struct SheetRenderJob {
+    const std::string *outFileName = nullptr;
+    std::vector<std::shared_ptr<QImage>> *images = nullptr; // the sheets are kept in memory if not null
+    Mesh *m = nullptr;
+    const FaceBuckets *faceBuckets = nullptr;
+    const std::vector<TextureSize> *texSizes = nullptr;
+    const RenderPlan *plan = nullptr;
+    const std::vector<SheetBatch> *batches = nullptr; // in the order of the plan
+    bool filter = false;
+    RenderMode imode = Linear;
+    int gutter = 0;
+    int lodLevels = 0;
+    bool adaptiveCacheBudget = false;
+    int renderContexts = 1;
+    int renderThreads = 0;
+    TextureFileFormat format = TextureFileFormat::PNG;
+    bool udimTiles = false;
+    std::function<bool(int)> claimSheet;
+    int jpegQuality = 90;
+    bool paged = false;
+    bool arrays = false;
+    bool software = false;
+    bool streaming = false;
+    std::string scratchDirectory;
+    ImageSaveQueue *saveQueue = nullptr;
+    SheetSink *sheetSink = nullptr; // the sheets are passed to the sink instead of being saved if not null
+
+    std::atomic<int> next{0};
+
+    std::mutex mutex;
+    double renderS = 0.0;
+    double enqueueS = 0.0;
+    double compressS = 0.0;
+    double gpuStageS[RenderingContext::GPU_STAGE_COUNT] = {};
+    int64_t pixels = 0;
+    TextureObject::CacheStats texCache;
+    uint64_t texBytesInUse = 0;
+    bool pagedUsed = false;
+    VirtualTexture::Stats pages;
+    int poolPages = 0;
+    bool arraysUsed = false;
+    TextureArrays::Stats layers;
+    int arrayLayers = 0;
+};
+
+// Thread that runs a function, the rendering contexts are moved to it
+class RenderThread : public QThread {
+public:
+    explicit RenderThread(std::function<void()> fn) : fn(std::move(fn)) { }
+protected:
+    void run() override { fn(); }
+private:
+    std::function<void()> fn;
+};
+
+// Receives the bands of rows of a sheet rendered in streaming mode, top to bottom
+typedef std::function<void(int firstRow, QImage band)> BandSink;
+
+static void RenderTextureSheets(const std::string *outFileName, std::vector<std::shared_ptr<QImage>> *images, Mesh& m, TextureObjectHandle textureObject,
+                                const std::vector<TextureSize> &texSizes, bool filter, RenderMode imode, const TextureSaveParameters& saveParams,
+                                bool pagedInputTextures, const FaceBuckets *faceBuckets);
+static RenderPlan PlanRenderOrder(const std::vector<std::vector<int>>& sheetInputs,
+                                  const std::vector<uint64_t>& inputBytes, uint64_t budgetBytes);
+static std::vector<SheetBatch> PlanSheetBatches(const RenderPlan& plan, const std::vector<TextureSize>& texSizes, int spacing, bool enabled);
+static void RenderSheets(SheetRenderJob& job, TextureObjectHandle textureObject, bool callerThread);
+static void SheetFaces(const FaceBuckets& buckets, int sheet, const std::vector<int>& inputOrder, std::vector<Mesh::FacePointer>& fvec);
+static void ChooseInputMipLevels(Mesh& m, const FaceBuckets& buckets, const std::vector<TextureSize>& texSizes, TextureObjectHandle textureObject, int maxLevel);
 static std::shared_ptr<QImage> RenderTexture(RenderingContext& ctx,
                                              std::vector<Mesh::FacePointer>& fvec,
                                              Mesh &m, TextureObjectHandle textureObject,
-                                             bool filter, RenderMode imode,
-                                             int textureWidth, int textureHeight);
+                                             VirtualTexture *virtualTexture, TextureArrays *textureArrays,
+                                             bool filter, RenderMode imode, int gutter,
+                                             int textureWidth, int textureHeight,
+                                             std::vector<QImage> *lodImages = nullptr,
+                                             const BandSink& bandSink = nullptr,
+                                             const std::vector<SheetPlacement> *placements = nullptr);
+static void IssueTileReadback(RenderingContext& ctx, int slot, int srcX, int srcY, int x, int row, int tileW, int tileH, int levels);
+static bool CompleteTileReadback(RenderingContext& ctx, int slot, QImage& image, int firstRow, std::vector<QImage> *lodImages, bool wait, double *waitTime);
+static QImage DownsampleImage(const QImage& image, int level);
+static bool HasBC7Compression();
+static bool CompressBC7(RenderingContext& ctx, const QImage& textureImage, std::vector<unsigned char>& blocks);
+
+// Rendering context kept between the calls of RenderTextureAndSave, owned by the
+// OpenGL context that was current when it was created (see KeepRenderingResources)
+static bool keepRenderingResources = false;
+static std::unique_ptr<RenderingContext> persistentRenderingContext;
+static QOpenGLContext *persistentRenderingOwner = nullptr;
+
+
+void KeepRenderingResources(bool keep)
+{
+    keepRenderingResources = keep;
+}
+
+void ReleaseRenderingResources()
+{
+    keepRenderingResources = false;
+    if (!persistentRenderingContext)
+        return;
+    if (QOpenGLContext::currentContext() == persistentRenderingOwner) {
+        persistentRenderingContext.reset();
+    } else {
+        // the objects belong to another context, they are left to it
+        LOG_WARN << "The OpenGL context of the rendering resources is not current, the resources are not released";
+        persistentRenderingContext.release();
+    }
+    persistentRenderingOwner = nullptr;
+}
 
+void BucketFaces(Mesh& m, FaceBuckets& buckets)
+{
+    TRACE_SCOPE_CAT("BucketFaces", "render");
+    ensure(HasWedgeTexCoordStorageAttribute(m));
+    auto WTCSh = GetWedgeTexCoordStorageAttribute(m);
+    const TexCoordStorage *wtcs = FaceAttributeData(WTCSh);
+
+    int nSheets = 1;
+    int nInputs = 1;
+    for (std::size_t fi = 0; fi < m.face.size(); ++fi) {
+        nSheets = std::max(nSheets, m.face[fi].cWT(0).N() + 1);
+        nInputs = std::max(nInputs, wtcs[fi].tc[0].N() + 1);
+    }
+
+    buckets.numSheets = nSheets;
+    buckets.numInputs = nInputs;
+    buckets.offset.assign(std::size_t(nSheets) * nInputs + 1, 0);
+    for (std::size_t fi = 0; fi < m.face.size(); ++fi) {
+        ensure(m.face[fi].cWT(0).N() >= 0 && wtcs[fi].tc[0].N() >= 0);
+        buckets.offset[m.face[fi].cWT(0).N() * nInputs + wtcs[fi].tc[0].N() + 1]++;
+    }
+    for (std::size_t b = 1; b < buckets.offset.size(); ++b)
+        buckets.offset[b] += buckets.offset[b - 1];
+
+    // the faces keep the mesh order within each bucket
+    std::vector<int> next(buckets.offset.begin(), buckets.offset.end() - 1);
+    buckets.faces.resize(m.face.size());
+    for (std::size_t fi = 0; fi < m.face.size(); ++fi)
+        buckets.faces[next[m.face[fi].cWT(0).N() * nInputs + wtcs[fi].tc[0].N()]++] = &m.face[fi];
+}
 
-int FacesByTextureIndex(Mesh& m, std::vector<std::vector<Mesh::FacePointer>>& fv)
+bool DetectTextureCacheBudget(int renderContexts, uint64_t *budgetBytes, uint64_t *availableBytes)
 {
-    fv.clear();
+    uint64_t available = 0;
+    if (!QueryAvailableGPUMemory(&available))
+        return false;
+    uint64_t usable = (available > GPU_MEMORY_HEADROOM) ? available - GPU_MEMORY_HEADROOM : 0;
+    *budgetBytes = std::max(usable / uint64_t(std::max(renderContexts, 1)), MIN_DETECTED_CACHE_BUDGET);
+    if (availableBytes)
+        *availableBytes = available;
+    return true;
+}
 
-    // Detect the number of required textures
-    int nTex = 1;
-    for (auto&f : m.face) {
-        nTex = std::max(nTex, f.cWT(0).N() + 1);
+const char *TextureFileExtension(TextureFileFormat format)
+{
+    switch (format) {
+    case TextureFileFormat::TGA:  return "tga";
+    case TextureFileFormat::JPEG: return "jpg";
+    case TextureFileFormat::KTX2: return "ktx2";
+    case TextureFileFormat::TIFF: return "tif";
+    default:                      return "png";
     }
+}
+
+bool ParseTextureFileFormat(const std::string& name, TextureFileFormat *format)
+{
+    QString s = QString::fromStdString(name).toLower();
+    if (s == "png")
+        *format = TextureFileFormat::PNG;
+    else if (s == "tga")
+        *format = TextureFileFormat::TGA;
+    else if (s == "jpg" || s == "jpeg")
+        *format = TextureFileFormat::JPEG;
+    else if (s == "ktx2")
+        *format = TextureFileFormat::KTX2;
+    else if (s == "tif" || s == "tiff")
+        *format = TextureFileFormat::TIFF;
+    else
+        return false;
+    return true;
+}
+
+TextureFileFormat SavedTextureFormat(const TextureSaveParameters& saveParams)
+{
+    if (saveParams.format == TextureFileFormat::KTX2 && (saveParams.softwareRendering || !HasBC7Compression()))
+        return TextureFileFormat::PNG;
+    return saveParams.format;
+}
 
-    fv.resize(nTex);
+// Path of the sheet i without the extension, <name>_texture_i or <name>.<1001+i> for
+// UDIM tiles
+static std::string SheetBasePath(const std::string& outFileName, int i, bool udim)
+{
+    std::stringstream suffix;
+    if (udim)
+        suffix << "." << (UDIM_FIRST_TILE + i);
+    else
+        suffix << "_texture_" << i;
+    return outFileName.substr(0, outFileName.find_last_of('.')).append(suffix.str());
+}
 
-    for (auto& f : m.face) {
-        int ti = f.cWT(0).N();
-        ensure(ti < nTex);
-        fv[ti].push_back(&f);
+std::vector<std::string> TextureSheetNames(const std::string& outFileName, int numSheets, TextureFileFormat format, bool udim)
+{
+    std::vector<std::string> names;
+    for (int i = 0; i < numSheets; ++i) {
+        std::string texturePath = SheetBasePath(outFileName, i, udim) + "." + TextureFileExtension(format);
+        names.push_back(QFileInfo(texturePath.c_str()).fileName().toStdString());
     }
+    return names;
+}
 
-    return fv.size();
+void ApplyUDIMLayout(Mesh& m, const std::string& outFileName, TextureFileFormat format)
+{
+    const int numSheets = (int) m.textures.size();
+    if (numSheets > UDIM_MAX_TILES)
+        LOG_WARN << "The " << numSheets << " texture tiles exceed the " << UDIM_MAX_TILES << " tiles of the UDIM numbering";
+
+    #pragma omp parallel for
+    for (int i = 0; i < (int) m.face.size(); ++i) {
+        auto& f = m.face[i];
+        for (int k = 0; k < f.VN(); ++k) {
+            int ti = f.WT(k).N();
+            f.WT(k).P() += vcg::Point2d(ti % 10, ti / 10);
+            f.WT(k).N() = 0;
+        }
+    }
+
+    std::string texturePath = outFileName.substr(0, outFileName.find_last_of('.')) + ".<UDIM>." + TextureFileExtension(format);
+    m.textures.assign(1, QFileInfo(texturePath.c_str()).fileName().toStdString());
 }
 
 void RenderTextureAndSave(const std::string& outFileName, Mesh& m, TextureObjectHandle textureObject, const std::vector<TextureSize> &texSizes,
-                                                   bool filter, RenderMode imode)
+                                                   bool filter, RenderMode imode, const TextureSaveParameters& saveParams,
+                                                   bool pagedInputTextures, const FaceBuckets *faceBuckets)
 {
+    TRACE_SCOPE_CAT("RenderTextureAndSave", "render");
+    RenderTextureSheets(&outFileName, nullptr, m, textureObject, texSizes, filter, imode, saveParams, pagedInputTextures, faceBuckets);
+}
+
+std::vector<std::shared_ptr<QImage>>
+RenderTextures(Mesh& m, TextureObjectHandle textureObject, const std::vector<TextureSize> &texSizes,
+               bool filter, RenderMode imode, const TextureSaveParameters& saveParams, bool pagedInputTextures,
+               const FaceBuckets *faceBuckets)
+{
+    TRACE_SCOPE_CAT("RenderTextures", "render");
+    std::vector<std::shared_ptr<QImage>> images;
+    RenderTextureSheets(nullptr, &images, m, textureObject, texSizes, filter, imode, saveParams, pagedInputTextures, faceBuckets);
+    return images;
+}
+
+/* Renders the sheets and saves them next to *outFileName, or stores them in *images
+ * if outFileName is null */
+static void RenderTextureSheets(const std::string *outFileName, std::vector<std::shared_ptr<QImage>> *images, Mesh& m, TextureObjectHandle textureObject,
+                                const std::vector<TextureSize> &texSizes, bool filter, RenderMode imode, const TextureSaveParameters& saveParams,
+                                bool pagedInputTextures, const FaceBuckets *faceBuckets)
+{
+    ScopedThreadCount renderThreads(saveParams.renderThreads);
+
     // Reset GPU texture cache stats for this rendering pass
     if (textureObject) textureObject->ResetCacheStats();
 
-    std::vector<std::vector<Mesh::FacePointer>> facesByTexture;
-    int nTex = FacesByTextureIndex(m, facesByTexture);
+    FaceBuckets localBuckets;
+    if (!faceBuckets) {
+        BucketFaces(m, localBuckets);
+        faceBuckets = &localBuckets;
+    }
+    int nTex = faceBuckets->numSheets;
 
     ensure(nTex <= (int) texSizes.size());
 
-    m.textures.clear();
+    // the pages and the layers of the arrays are cut from the full size images
+    if (textureObject) {
+        int maxLevel = (pagedInputTextures || saveParams.arrayInputTextures) ? 0 : saveParams.maxInputMipLevel;
+        ChooseInputMipLevels(m, *faceBuckets, texSizes, textureObject, maxLevel);
+    }
+
+    if (images) {
+        images->clear();
+        images->resize(nTex);
+    }
+
+    // Plan the sheet order from the input textures used by each sheet
+    RenderPlan plan;
+    {
+        std::vector<std::vector<int>> sheetInputs(nTex);
+        for (int i = 0; i < nTex; ++i) {
+            for (int ti = 0; ti < faceBuckets->numInputs; ++ti)
+                if (faceBuckets->Begin(i, ti) < faceBuckets->End(i, ti))
+                    sheetInputs[i].push_back(ti);
+        }
+        std::vector<uint64_t> inputBytes;
+        uint64_t budgetBytes = 0;
+        if (textureObject) {
+            for (std::size_t k = 0; k < textureObject->ArraySize(); ++k)
+                inputBytes.push_back(uint64_t(textureObject->ResidentWidth(k)) * uint64_t(textureObject->ResidentHeight(k)) * 4);
+            budgetBytes = textureObject->GetCacheBudgetBytes();
+        }
+        for (const auto& inputs : sheetInputs)
+            if (!inputs.empty() && inputs.back() >= (int) inputBytes.size())
+                inputBytes.resize(inputs.back() + 1, 0);
+        plan = PlanRenderOrder(sheetInputs, inputBytes, budgetBytes);
+    }
 
-    QFileInfo fi(outFileName.c_str());
-    QString wd = QDir::currentPath();
-    QDir::setCurrent(fi.absoluteDir().absolutePath());
+    // the sheets are named after the absolute path of the output file, the working
+    // directory is left untouched since the next mesh can be loading concurrently
+    const std::string absOutFileName = outFileName ? QFileInfo(outFileName->c_str()).absoluteFilePath().toStdString() : std::string();
 
     auto t_total_start = std::chrono::high_resolution_clock::now();
-    double t_total_render_s = 0.0;
-    double t_total_savequeue_enqueue_s = 0.0;
     double t_total_png_save_s = 0.0; // captured by queue
     double t_save_wait_s = 0.0;      // time waiting in finish()
-    int64_t total_pixels_rendered = 0;
 
-    RenderingContext renderingContext;
-    ImageSaveQueue saveQueue(2);
+    std::size_t saveBudgetBytes = static_cast<std::size_t>(std::max(saveParams.memoryBudgetGB, 0.0) * 1024.0 * 1024.0 * 1024.0);
+    // the images waiting to be saved take at most half of what is left of the global budget
+    if (saveBudgetBytes > 0)
+        saveBudgetBytes = MemoryBudgetLimit(saveBudgetBytes, 0.5);
+    ImageSaveQueue saveQueue(saveParams.workers, saveBudgetBytes);
     saveQueue.resetStats();
 
-    for (int i = 0; i < nTex; ++i) {
-        LOG_INFO << "Processing sheet " << (i + 1) << " of " << nTex << "...";
-        auto t_render_start = std::chrono::high_resolution_clock::now();
-        std::shared_ptr<QImage> teximg = RenderTexture(renderingContext, facesByTexture[i], m, textureObject, filter, imode, texSizes[i].w, texSizes[i].h);
-        auto t_render_end = std::chrono::high_resolution_clock::now();
-        double t_render_s = std::chrono::duration<double>(t_render_end - t_render_start).count();
-        t_total_render_s += t_render_s;
-        total_pixels_rendered += int64_t(texSizes[i].w) * int64_t(texSizes[i].h);
+    TextureFileFormat format = TextureFileFormat::PNG;
+    if (!images) {
+        // the sheets kept in memory are not encoded
+        format = SavedTextureFormat(saveParams);
+        if (format != saveParams.format && saveParams.softwareRendering)
+            LOG_WARN << "BC7 texture compression requires an OpenGL context, saving png textures";
+        else if (format != saveParams.format)
+            LOG_WARN << "BC7 texture compression is not supported by the OpenGL context, saving png textures";
+    }
 
-        std::stringstream suffix;
-        suffix << "_texture_" << i << ".png";
-        std::string s(outFileName);
-        std::string texturePath = s.substr(0, s.find_last_of('.')).append(suffix.str());
+    // the names are only assigned if they differ from the ones already set, since
+    // the mesh can be saved concurrently with the names predicted by TextureSheetNames
+    {
+        std::vector<std::string> names(nTex);
+        if (outFileName)
+            names = TextureSheetNames(absOutFileName, nTex, format, saveParams.udimTiles);
+        if (m.textures != names)
+            m.textures = names;
+    }
 
-        QFileInfo texFI(texturePath.c_str());
-        m.textures.push_back(texFI.fileName().toStdString());
-        const QString absPath = texFI.absoluteFilePath();
-        // Enqueue save to overlap compression with next sheet rendering
-        auto t_enqueue_start = std::chrono::high_resolution_clock::now();
-        saveQueue.enqueue(*teximg, absPath, 50);
-        auto t_enqueue_end = std::chrono::high_resolution_clock::now();
-        t_total_savequeue_enqueue_s += std::chrono::duration<double>(t_enqueue_end - t_enqueue_start).count();
+    SheetRenderJob job;
+    job.outFileName = outFileName ? &absOutFileName : nullptr;
+    job.images = images;
+    job.m = &m;
+    job.faceBuckets = faceBuckets;
+    job.texSizes = &texSizes;
+    job.plan = &plan;
+    // the sheets in a batch are spaced by more than the gutter, so that their charts
+    // are not dilated into each other
+    const int gutter = std::min(std::max(saveParams.gutterWidth, 0), MAX_GUTTER_WIDTH);
+    // the sheets claimed one at a time are rendered alone
+    std::vector<SheetBatch> batches = PlanSheetBatches(plan, texSizes, gutter + 1, !saveParams.softwareRendering && !saveParams.claimSheet);
+    job.batches = &batches;
+    job.filter = filter;
+    job.imode = imode;
+    job.gutter = gutter;
+    if (job.gutter != saveParams.gutterWidth)
+        LOG_WARN << "The gutter width is limited to " << MAX_GUTTER_WIDTH << " pixels";
+    if (job.gutter > 0 && saveParams.softwareRendering)
+        LOG_WARN << "The gutter of the texture sheets is not dilated by the software renderer";
+    job.lodLevels = std::min(std::max(saveParams.lodLevels, 0), MAX_LOD_LEVELS);
+    if (job.lodLevels != saveParams.lodLevels)
+        LOG_WARN << "The levels of detail of the texture sheets are limited to " << MAX_LOD_LEVELS;
+    if (job.lodLevels > 0 && (images || saveParams.sheetSink)) {
+        LOG_WARN << "The levels of detail are only saved with the texture sheets, ignoring them";
+        job.lodLevels = 0;
+    }
+    job.format = format;
+    job.udimTiles = saveParams.udimTiles;
+    job.claimSheet = saveParams.claimSheet;
+    job.jpegQuality = saveParams.jpegQuality;
+    job.paged = pagedInputTextures;
+    job.arrays = saveParams.arrayInputTextures;
+    job.software = saveParams.softwareRendering;
+    job.renderThreads = saveParams.renderThreads;
+    job.scratchDirectory = saveParams.scratchDirectory;
+    job.adaptiveCacheBudget = saveParams.adaptiveCacheBudget && !job.software;
+    job.sheetSink = images ? nullptr : saveParams.sheetSink.get();
+    // png and tga sheets are encoded in bands while rendering (and passed to the
+    // sink in bands), unless the whole image is needed (hole filling, or the software
+    // renderer output)
+    job.streaming = saveParams.streamingSave && !images && !filter && !job.software
+            && (job.sheetSink || format == TextureFileFormat::PNG || format == TextureFileFormat::TGA || format == TextureFileFormat::TIFF);
+    job.saveQueue = &saveQueue;
+
+    // The additional contexts render on their own threads with a sibling of the
+    // texture object, the calling thread renders with the current context. The
+    // software renderer is already parallel
+    int numContexts = job.software ? 1 : std::max(1, std::min(saveParams.renderContexts, nTex));
+    QOpenGLContext *currentContext = QOpenGLContext::currentContext();
+    ensure(numContexts == 1 || currentContext != nullptr);
+    QThread *callerThread = QThread::currentThread();
+    std::vector<std::unique_ptr<QOpenGLContext>> contexts;
+    std::vector<std::unique_ptr<QOffscreenSurface>> surfaces;
+    // the contexts split the free GPU memory, if some fail to be created their share stays unused
+    job.renderContexts = numContexts;
+    std::vector<std::unique_ptr<RenderThread>> threads;
+    for (int k = 1; k < numContexts; ++k) {
+        std::unique_ptr<QOpenGLContext> context(new QOpenGLContext());
+        context->setFormat(currentContext->format());
+        std::unique_ptr<QOffscreenSurface> surface(new QOffscreenSurface());
+        bool created = context->create();
+        if (created) {
+            surface->setFormat(context->format());
+            surface->create();
+        }
+        if (!created || !surface->isValid()) {
+            LOG_WARN << "Failed to create OpenGL rendering context " << k << ", rendering the sheets with " << k << " contexts";
+            break;
+        }
+        QOpenGLContext *ctxp = context.get();
+        QOffscreenSurface *surfacep = surface.get();
+        TextureObjectHandle sibling = textureObject ? textureObject->CreateSibling() : nullptr;
+        std::unique_ptr<RenderThread> thread(new RenderThread([&job, ctxp, surfacep, sibling, callerThread, k]() mutable {
+            LOG_SET_THREAD_NAME("render-" + std::to_string(k));
+            if (!ctxp->makeCurrent(surfacep)) {
+                LOG_ERR << "Failed to make OpenGL rendering context " << k << " current";
+                std::exit(-1);
+            }
+            EnableGLDebugOutput();
+            RenderSheets(job, sibling, false);
+            sibling.reset();
+            ctxp->doneCurrent();
+            ctxp->moveToThread(callerThread);
+        }));
+        context->moveToThread(thread.get());
+        thread->start();
+        contexts.push_back(std::move(context));
+        surfaces.push_back(std::move(surface));
+        threads.push_back(std::move(thread));
     }
+    numContexts = int(threads.size()) + 1;
+
+    RenderSheets(job, textureObject, true);
+    for (auto& thread : threads)
+        thread->wait();
+    threads.clear();
+    contexts.clear();
+    surfaces.clear();
 
     // Ensure all pending saves are complete before restoring working directory
     auto t_save_finish_start = std::chrono::high_resolution_clock::now();
+    TraceSpan finishSpan("SaveQueueFinish", "save");
     saveQueue.finish();
+    finishSpan.End();
     auto t_save_finish_end = std::chrono::high_resolution_clock::now();
     t_save_wait_s += std::chrono::duration<double>(t_save_finish_end - t_save_finish_start).count();
-    QDir::setCurrent(wd);
 
     // Snapshot queue save stats
     auto saveStats = saveQueue.statsSnapshot();
@@ -441,21 +1692,76 @@ void RenderTextureAndSave(const std::string& outFileName, Mesh& m, TextureObject
     auto t_total_end = std::chrono::high_resolution_clock::now();
     double t_total_s = std::chrono::duration<double>(t_total_end - t_total_start).count();
 
-    // Log performance summary
+    // Log performance summary (the render times are summed over the contexts)
+    int batchedSheets = 0;
+    for (const SheetBatch& batch : batches)
+        if (batch.sheets.size() > 1)
+            batchedSheets += (int) batch.sheets.size();
+
     LOG_INFO << "[RENDER-STATS] sheets=" << nTex
-             << " pixels=" << total_pixels_rendered
+             << " batches=" << batches.size()
+             << " batchedSheets=" << batchedSheets
+             << " renderer=" << (job.software ? "cpu" : "gpu")
+             << " contexts=" << numContexts
+             << " pixels=" << job.pixels
              << " total_s=" << t_total_s
-             << " render_s=" << t_total_render_s
-             << " enqueue_s=" << t_total_savequeue_enqueue_s
+             << " render_s=" << job.renderS
+             << " enqueue_s=" << job.enqueueS
+             << " gpu_compress_s=" << job.compressS
+             << " lod_levels=" << job.lodLevels
              << " save_wait_s=" << t_save_wait_s
+             << " format=" << TextureFileExtension(format)
              << " png_save_s=" << t_total_png_save_s
              << " png_min_s=" << saveStats.minSaveS
              << " png_max_s=" << saveStats.maxSaveS
              << " png_saved=" << saveStats.saved;
+    ReportValue("rendering", "sheets", nTex);
+    ReportValue("rendering", "batches", batches.size());
+    ReportValue("rendering", "batched_sheets", batchedSheets);
+    ReportValue("rendering", "renderer", job.software ? "cpu" : "gpu");
+    ReportValue("rendering", "contexts", numContexts);
+    ReportValue("rendering", "pixels", job.pixels);
+    ReportValue("rendering", "total_s", t_total_s);
+    ReportValue("rendering", "render_s", job.renderS);
+    ReportValue("rendering", "enqueue_s", job.enqueueS);
+    ReportValue("rendering", "gpu_compress_s", job.compressS);
+    ReportValue("rendering", "lod_levels", job.lodLevels);
+    ReportValue("rendering", "format", TextureFileExtension(format));
+    if (!job.software) {
+        const double *gpu = job.gpuStageS;
+        LOG_INFO << "[RENDER-STATS] gpu_upload_s=" << gpu[RenderingContext::GpuUpload]
+                 << " gpu_draw_s=" << gpu[RenderingContext::GpuDraw]
+                 << " gpu_dilate_s=" << gpu[RenderingContext::GpuDilate]
+                 << " gpu_lod_s=" << gpu[RenderingContext::GpuLod]
+                 << " gpu_readback_s=" << gpu[RenderingContext::GpuReadback];
+        ReportValue("rendering/gpu", "upload_s", gpu[RenderingContext::GpuUpload]);
+        ReportValue("rendering/gpu", "draw_s", gpu[RenderingContext::GpuDraw]);
+        ReportValue("rendering/gpu", "dilate_s", gpu[RenderingContext::GpuDilate]);
+        ReportValue("rendering/gpu", "lod_s", gpu[RenderingContext::GpuLod]);
+        ReportValue("rendering/gpu", "readback_s", gpu[RenderingContext::GpuReadback]);
+    }
+    ReportValue("rendering/save", "saved", saveStats.saved);
+    ReportValue("rendering/save", "save_s", t_total_png_save_s);
+    ReportValue("rendering/save", "min_save_s", saveStats.minSaveS);
+    ReportValue("rendering/save", "max_save_s", saveStats.maxSaveS);
+    ReportValue("rendering/save", "enqueue_wait_s", saveStats.totalEnqueueWaitS);
+    ReportValue("rendering/save", "finish_wait_s", t_save_wait_s);
+    if (!saveParams.scratchDirectory.empty()) {
+        FileBackedImageStats fileBacked = GetFileBackedImageStats();
+        LOG_INFO << "[RENDER-STATS] file_backed_images=" << fileBacked.images
+                 << " file_backed_peak_bytes=" << fileBacked.peakBytes
+                 << " file_backed_failures=" << fileBacked.failures;
+        ReportValue("rendering", "file_backed_images", fileBacked.images);
+        ReportValue("rendering", "file_backed_peak_bytes", fileBacked.peakBytes);
+    }
+    MetricsAdd(MetricCounter::SheetsSaved, saveStats.saved);
+    MetricsAdd(MetricTime::SheetSave, t_total_png_save_s);
+    MetricsAdd(MetricTime::SaveEnqueueWait, saveStats.totalEnqueueWaitS);
+    MetricsAdd(MetricTime::SaveFinishWait, t_save_wait_s);
 
-    // Log GPU texture cache stats
+    // Log GPU texture cache stats, summed over the caches of the contexts
     if (textureObject) {
-        auto cs = textureObject->GetCacheStats();
+        const auto& cs = job.texCache;
         uint64_t lookups = cs.hits + cs.misses;
         double hitRate = lookups ? double(cs.hits) / double(lookups) : 0.0;
         LOG_INFO << "[TEX-CACHE] lookups=" << lookups
@@ -463,31 +1769,571 @@ void RenderTextureAndSave(const std::string& outFileName, Mesh& m, TextureObject
                  << " misses=" << cs.misses
                  << " hitRate=" << hitRate
                  << " evictions=" << cs.evictions
+                 << " reloads=" << cs.reloads
                  << " bytesEvicted=" << cs.bytesEvicted
-                 << " bytesInUse=" << textureObject->GetCurrentCacheBytes()
-                 << "/budget=" << textureObject->GetCacheBudgetBytes();
+                 << " prefetched=" << cs.prefetched
+                 << " prefetchWait_s=" << cs.prefetchWaitS
+                 << " bytesInUse=" << job.texBytesInUse
+                 << "/budget=" << textureObject->GetCacheBudgetBytes()
+                 << " caches=" << numContexts;
+        ReportValue("rendering/texture_cache", "lookups", lookups);
+        ReportValue("rendering/texture_cache", "hits", cs.hits);
+        ReportValue("rendering/texture_cache", "misses", cs.misses);
+        ReportValue("rendering/texture_cache", "hit_rate", hitRate);
+        ReportValue("rendering/texture_cache", "evictions", cs.evictions);
+        ReportValue("rendering/texture_cache", "reloads", cs.reloads);
+        ReportValue("rendering/texture_cache", "bytes_evicted", cs.bytesEvicted);
+        ReportValue("rendering/texture_cache", "prefetched", cs.prefetched);
+        ReportValue("rendering/texture_cache", "prefetch_wait_s", cs.prefetchWaitS);
+        ReportValue("rendering/texture_cache", "bytes_in_use", job.texBytesInUse);
+        ReportValue("rendering/texture_cache", "budget_bytes", textureObject->GetCacheBudgetBytes());
+        MetricsAdd(MetricCounter::TextureCacheHits, cs.hits);
+        MetricsAdd(MetricCounter::TextureCacheMisses, cs.misses);
+        MetricsAdd(MetricCounter::TextureCacheEvictions, cs.evictions);
+    }
+
+    {
+        std::stringstream order;
+        for (int n = 0; n < nTex; ++n)
+            order << (n > 0 ? "," : "") << plan.sheetOrder[n];
+        LOG_INFO << "[RENDER-PLAN] order=" << order.str()
+                 << " plannedUploadBytes=" << plan.uploadBytes
+                 << " indexOrderUploadBytes=" << plan.indexOrderBytes;
+        ReportValue("rendering/plan", "upload_bytes", plan.uploadBytes);
+        ReportValue("rendering/plan", "index_order_upload_bytes", plan.indexOrderBytes);
+    }
+
+    if (job.pagedUsed) {
+        const auto& vs = job.pages;
+        uint64_t lookups = vs.pageHits + vs.pageMisses;
+        LOG_INFO << "[VT-CACHE] poolPages=" << job.poolPages
+                 << " pageLookups=" << lookups
+                 << " pageHits=" << vs.pageHits
+                 << " pageMisses=" << vs.pageMisses
+                 << " pageHitRate=" << (lookups ? double(vs.pageHits) / double(lookups) : 0.0)
+                 << " pageEvictions=" << vs.pageEvictions
+                 << " imagesDecoded=" << vs.imagesDecoded
+                 << " upload_s=" << vs.uploadS;
+        ReportValue("rendering/pages", "pool_pages", job.poolPages);
+        ReportValue("rendering/pages", "hits", vs.pageHits);
+        ReportValue("rendering/pages", "misses", vs.pageMisses);
+        ReportValue("rendering/pages", "evictions", vs.pageEvictions);
+        ReportValue("rendering/pages", "images_decoded", vs.imagesDecoded);
+        ReportValue("rendering/pages", "upload_s", vs.uploadS);
+    }
+
+    if (job.arraysUsed) {
+        const auto& as = job.layers;
+        uint64_t lookups = as.layerHits + as.layerMisses;
+        LOG_INFO << "[TEX-ARRAY] layers=" << job.arrayLayers
+                 << " layerLookups=" << lookups
+                 << " layerHits=" << as.layerHits
+                 << " layerMisses=" << as.layerMisses
+                 << " layerEvictions=" << as.layerEvictions
+                 << " upload_s=" << as.uploadS;
+        ReportValue("rendering/arrays", "layers", job.arrayLayers);
+        ReportValue("rendering/arrays", "hits", as.layerHits);
+        ReportValue("rendering/arrays", "misses", as.layerMisses);
+        ReportValue("rendering/arrays", "evictions", as.layerEvictions);
+        ReportValue("rendering/arrays", "upload_s", as.uploadS);
+    }
+}
+
+static void RenderSheets(SheetRenderJob& job, TextureObjectHandle textureObject, bool callerThread)
+{
+    // the thread count is per thread, so the contexts running on their own threads set it again
+    ScopedThreadCount renderThreads(job.renderThreads);
+    std::unique_ptr<RenderingContext> localRenderingContext;
+    RenderingContext *renderingContext = nullptr;
+    std::unique_ptr<VirtualTexture> virtualTexture;
+    std::unique_ptr<TextureArrays> textureArrays;
+    std::unique_ptr<SoftwareRenderer> softwareRenderer;
+    if (job.software) {
+        // the decoded input textures are cached within the texture cache budget
+        softwareRenderer.reset(new SoftwareRenderer(textureObject, textureObject->GetCacheBudgetBytes()));
+        softwareRenderer->SetScratchDirectory(job.scratchDirectory);
+    } else {
+        // the calling thread reuses the persistent rendering context if it belongs to
+        // its OpenGL context, the contexts of the worker threads are created per call
+        QOpenGLContext *current = QOpenGLContext::currentContext();
+        if (callerThread && keepRenderingResources && (!persistentRenderingContext || persistentRenderingOwner == current)) {
+            if (!persistentRenderingContext) {
+                persistentRenderingContext.reset(new RenderingContext());
+                persistentRenderingOwner = current;
+            } else {
+                LOG_VERBOSE << "Reusing the persistent rendering context";
+            }
+            renderingContext = persistentRenderingContext.get();
+        } else {
+            localRenderingContext.reset(new RenderingContext());
+            renderingContext = localRenderingContext.get();
+        }
+        if (job.paged && textureObject && textureObject->ArraySize() > 0)
+            virtualTexture.reset(new VirtualTexture(textureObject, textureObject->GetCacheBudgetBytes()));
+        else if (job.arrays && textureObject && textureObject->ArraySize() > 0)
+            textureArrays.reset(new TextureArrays(textureObject, textureObject->GetCacheBudgetBytes()));
+        renderingContext->scratchDirectory = job.scratchDirectory;
+    }
+    // the persistent context carries the GPU times of the previous calls
+    double gpuStart_s[RenderingContext::GPU_STAGE_COUNT] = {};
+    if (renderingContext)
+        std::copy(renderingContext->gpuStageS, renderingContext->gpuStageS + RenderingContext::GPU_STAGE_COUNT, gpuStart_s);
+
+    const RenderPlan& plan = *job.plan;
+    const std::vector<TextureSize>& texSizes = *job.texSizes;
+    const TextureFileFormat format = job.format;
+    const int nTex = int(plan.sheetOrder.size());
+
+    double t_total_render_s = 0.0;
+    double t_total_savequeue_enqueue_s = 0.0;
+    double t_total_compress_s = 0.0;
+    int64_t total_pixels_rendered = 0;
+    std::vector<Mesh::FacePointer> fvec;
+
+    // each sheet is rendered once, so the contexts write distinct elements
+    auto SheetPaths = [&](int i, QString& absPath, std::string& basePath) {
+        if (job.outFileName) {
+            basePath = SheetBasePath(*job.outFileName, i, job.udimTiles);
+            std::string texturePath = basePath + "." + TextureFileExtension(format);
+            absPath = QFileInfo(texturePath.c_str()).absoluteFilePath();
+        }
+    };
+
+    // the levels of detail are saved next to the sheet as _texture_N_lodK, down
+    // to the level whose shorter side is one pixel
+    auto SheetLevels = [&](int i) {
+        int lodLevels = job.lodLevels;
+        while (lodLevels > 0 && (std::min(texSizes[i].w, texSizes[i].h) >> lodLevels) == 0)
+            lodLevels--;
+        return lodLevels;
+    };
+
+    // BC7 blocks are encoded by the driver while the rendering context is current,
+    // the worker only writes the container
+    auto EnqueueImage = [&](QImage image, const QString& path) {
+        std::vector<unsigned char> blocks;
+        if (format == TextureFileFormat::KTX2) {
+            auto t_compress_start = std::chrono::high_resolution_clock::now();
+            if (!CompressBC7(*renderingContext, image, blocks)) {
+                LOG_ERR << "BC7 compression of texture " << path.toStdString() << " failed";
+                std::exit(-1);
+            }
+            auto t_compress_end = std::chrono::high_resolution_clock::now();
+            t_total_compress_s += std::chrono::duration<double>(t_compress_end - t_compress_start).count();
+        }
+
+        // Enqueue save to overlap compression with next sheet rendering
+        auto t_enqueue_start = std::chrono::high_resolution_clock::now();
+        if (format == TextureFileFormat::KTX2)
+            job.saveQueue->enqueueBC7(std::move(blocks), image.width(), image.height(), path);
+        else
+            job.saveQueue->enqueue(std::move(image), path, format, (format == TextureFileFormat::JPEG) ? job.jpegQuality : 50);
+        auto t_enqueue_end = std::chrono::high_resolution_clock::now();
+        t_total_savequeue_enqueue_s += std::chrono::duration<double>(t_enqueue_end - t_enqueue_start).count();
+    };
+
+    auto EnqueueLevels = [&](const std::string& basePath, std::vector<QImage>& lodImages) {
+        for (int k = 1; k <= (int) lodImages.size(); ++k) {
+            std::stringstream levelPath;
+            levelPath << basePath << "_lod" << k << "." << TextureFileExtension(format);
+            EnqueueImage(std::move(lodImages[k - 1]), QFileInfo(levelPath.str().c_str()).absoluteFilePath());
+        }
+    };
+
+    // passes a whole sheet to the sink as a single band
+    auto PublishSheet = [&](int i, const QImage& image) {
+        auto t_enqueue_start = std::chrono::high_resolution_clock::now();
+        job.sheetSink->BeginSheet(i, job.m->textures[i], image.width(), image.height());
+        job.sheetSink->WriteBand(i, 0, ToARGB32(image));
+        job.sheetSink->EndSheet(i);
+        auto t_enqueue_end = std::chrono::high_resolution_clock::now();
+        t_total_savequeue_enqueue_s += std::chrono::duration<double>(t_enqueue_end - t_enqueue_start).count();
+    };
+
+    for (int n = job.next++; n < (int) job.batches->size(); n = job.next++) {
+        const SheetBatch& batch = (*job.batches)[n];
+        if (job.claimSheet && !job.claimSheet(batch.sheets[0].sheet))
+            continue;
+        TRACE_SCOPE_CAT("RenderSheet", "render");
+        if (textureObject)
+            textureObject->SetTraceSheet(batch.sheets[0].sheet);
+
+        // the free memory does not count the textures already resident in this cache
+        uint64_t detectedBudget = 0;
+        uint64_t available = 0;
+        if (job.adaptiveCacheBudget && textureObject && DetectTextureCacheBudget(job.renderContexts, &detectedBudget, &available)) {
+            uint64_t budget = textureObject->GetCurrentCacheBytes() + detectedBudget;
+            LOG_VERBOSE << "Texture GPU cache budget set to " << (budget / (1024.0 * 1024.0 * 1024.0)) << " GB ("
+                        << (available / (1024.0 * 1024.0 * 1024.0)) << " GB of GPU memory free)";
+            textureObject->SetCacheBudgetBytes(budget);
+        }
+
+        if (batch.sheets.size() > 1) {
+            // The small sheets of the batch are drawn together in the scratch atlas,
+            // then cut from it. The holes are filled and the levels of detail are
+            // computed on the cut sheets, so that the sheets do not bleed into each other
+            LOG_INFO << "Processing " << batch.sheets.size() << " sheets of " << nTex << " in a "
+                     << batch.width << "x" << batch.height << " atlas...";
+            auto t_render_start = std::chrono::high_resolution_clock::now();
+            fvec.clear();
+            std::vector<Mesh::FacePointer> sheetFaces;
+            for (const SheetPlacement& p : batch.sheets) {
+                SheetFaces(*job.faceBuckets, p.sheet, plan.inputOrder[p.sheet], sheetFaces);
+                fvec.insert(fvec.end(), sheetFaces.begin(), sheetFaces.end());
+            }
+            // the faces of the same input texture are drawn in one group, in the
+            // order of the first sheet using the texture
+            {
+                auto WTCSh = GetWedgeTexCoordStorageAttribute(*job.m);
+                std::unordered_map<int, int> rank;
+                for (auto fptr : fvec)
+                    rank.insert(std::make_pair(WTCSh[fptr].tc[0].N(), int(rank.size())));
+                std::stable_sort(fvec.begin(), fvec.end(), [&](const Mesh::FacePointer& f1, const Mesh::FacePointer& f2) {
+                    return rank[WTCSh[f1].tc[0].N()] < rank[WTCSh[f2].tc[0].N()];
+                });
+            }
+            std::shared_ptr<QImage> atlas = RenderTexture(*renderingContext, fvec, *job.m, textureObject, virtualTexture.get(), textureArrays.get(),
+                                                          false, job.imode, job.gutter, batch.width, batch.height, nullptr, nullptr, &batch.sheets);
+            std::vector<std::shared_ptr<QImage>> sheetImages;
+            for (const SheetPlacement& p : batch.sheets) {
+                // the placements are from the bottom of the atlas, the image rows from the top
+                std::shared_ptr<QImage> teximg = std::make_shared<QImage>(atlas->copy(p.x, batch.height - (p.y + p.h), p.w, p.h));
+                if (job.filter)
+                    vcg::PullPush(*teximg, qRgba(0, 0, 0, 255));
+                sheetImages.push_back(teximg);
+                total_pixels_rendered += int64_t(p.w) * int64_t(p.h);
+            }
+            atlas.reset();
+            auto t_render_end = std::chrono::high_resolution_clock::now();
+            t_total_render_s += std::chrono::duration<double>(t_render_end - t_render_start).count();
+
+            for (std::size_t j = 0; j < batch.sheets.size(); ++j) {
+                int i = batch.sheets[j].sheet;
+                if (job.images) {
+                    (*job.images)[i] = sheetImages[j];
+                    continue;
+                }
+                if (job.sheetSink) {
+                    PublishSheet(i, *sheetImages[j]);
+                    sheetImages[j].reset();
+                    continue;
+                }
+                QString absPath;
+                std::string basePath;
+                SheetPaths(i, absPath, basePath);
+                std::vector<QImage> lodImages(SheetLevels(i));
+                for (int k = 1; k <= (int) lodImages.size(); ++k)
+                    lodImages[k - 1] = DownsampleImage(*sheetImages[j], k);
+                EnqueueLevels(basePath, lodImages);
+                EnqueueImage(std::move(*sheetImages[j]), absPath);
+                sheetImages[j].reset();
+            }
+            continue;
+        }
+
+        int i = batch.sheets.front().sheet;
+        LOG_INFO << "Processing sheet " << (i + 1) << " of " << nTex << "...";
+
+        QString absPath;
+        std::string basePath;
+        SheetPaths(i, absPath, basePath);
+        std::vector<QImage> lodImages(SheetLevels(i));
+
+        // When streaming, the bands of rows are enqueued as they are read back. The
+        // row before each band is copied for the png filters. The time spent waiting
+        // for the queue is also part of the render time
+        BandSink bandSink;
+        std::shared_ptr<BandStream> stream;
+        std::vector<unsigned char> prevRow;
+        if (job.streaming && job.sheetSink) {
+            job.sheetSink->BeginSheet(i, job.m->textures[i], texSizes[i].w, texSizes[i].h);
+            bandSink = [&](int firstRow, QImage band) {
+                auto t_enqueue_start = std::chrono::high_resolution_clock::now();
+                job.sheetSink->WriteBand(i, firstRow, band);
+                auto t_enqueue_end = std::chrono::high_resolution_clock::now();
+                t_total_savequeue_enqueue_s += std::chrono::duration<double>(t_enqueue_end - t_enqueue_start).count();
+            };
+        } else if (job.streaming) {
+            stream = job.saveQueue->beginStream(absPath, format, 50, texSizes[i].w, texSizes[i].h);
+            bandSink = [&](int firstRow, QImage band) {
+                auto t_enqueue_start = std::chrono::high_resolution_clock::now();
+                const uchar *lastRow = band.constScanLine(band.height() - 1);
+                std::vector<unsigned char> nextPrevRow(lastRow, lastRow + std::size_t(band.width()) * 4);
+                job.saveQueue->enqueueBand(stream, firstRow, std::move(band), std::move(prevRow));
+                prevRow = std::move(nextPrevRow);
+                auto t_enqueue_end = std::chrono::high_resolution_clock::now();
+                t_total_savequeue_enqueue_s += std::chrono::duration<double>(t_enqueue_end - t_enqueue_start).count();
+            };
+        }
+
+        // the levels are downsampled on the GPU from the rendered tiles, unless the
+        // holes of the sheet are filled afterwards or the sheet is rendered on the CPU
+        bool gpuLevels = !softwareRenderer && !job.filter;
+
+        auto t_render_start = std::chrono::high_resolution_clock::now();
+        SheetFaces(*job.faceBuckets, i, plan.inputOrder[i], fvec);
+        std::shared_ptr<QImage> teximg;
+        if (softwareRenderer)
+            teximg = softwareRenderer->Render(fvec, *job.m, job.filter, job.imode, texSizes[i].w, texSizes[i].h);
+        else
+            teximg = RenderTexture(*renderingContext, fvec, *job.m, textureObject, virtualTexture.get(), textureArrays.get(),
+                                   job.filter, job.imode, job.gutter, texSizes[i].w, texSizes[i].h,
+                                   gpuLevels ? &lodImages : nullptr, bandSink);
+        if (!gpuLevels) {
+            for (int k = 1; k <= (int) lodImages.size(); ++k)
+                lodImages[k - 1] = DownsampleImage(*teximg, k);
+        }
+        auto t_render_end = std::chrono::high_resolution_clock::now();
+        double t_render_s = std::chrono::duration<double>(t_render_end - t_render_start).count();
+        t_total_render_s += t_render_s;
+        total_pixels_rendered += int64_t(texSizes[i].w) * int64_t(texSizes[i].h);
+
+        if (job.images) {
+            (*job.images)[i] = teximg;
+            continue;
+        }
+
+        if (job.sheetSink) {
+            if (job.streaming)
+                job.sheetSink->EndSheet(i);
+            else
+                PublishSheet(i, *teximg);
+            continue;
+        }
+
+        EnqueueLevels(basePath, lodImages);
+        if (!stream)
+            EnqueueImage(std::move(*teximg), absPath);
     }
 
-    if (textureObject) textureObject->ReleaseAll();
+    {
+        std::lock_guard<std::mutex> lock(job.mutex);
+        job.renderS += t_total_render_s;
+        job.enqueueS += t_total_savequeue_enqueue_s;
+        job.compressS += t_total_compress_s;
+        for (int k = 0; renderingContext && k < RenderingContext::GPU_STAGE_COUNT; ++k)
+            job.gpuStageS[k] += renderingContext->gpuStageS[k] - gpuStart_s[k];
+        job.pixels += total_pixels_rendered;
+        if (textureObject) {
+            auto cs = softwareRenderer ? softwareRenderer->GetCacheStats() : textureObject->GetCacheStats();
+            job.texCache.hits += cs.hits;
+            job.texCache.misses += cs.misses;
+            job.texCache.evictions += cs.evictions;
+            job.texCache.reloads += cs.reloads;
+            job.texCache.bytesEvicted += cs.bytesEvicted;
+            job.texCache.prefetched += cs.prefetched;
+            job.texCache.prefetchWaitS += cs.prefetchWaitS;
+            job.texBytesInUse += softwareRenderer ? softwareRenderer->GetCurrentCacheBytes() : textureObject->GetCurrentCacheBytes();
+        }
+        if (virtualTexture) {
+            auto vs = virtualTexture->GetStats();
+            job.pagedUsed = true;
+            job.poolPages += virtualTexture->PoolLayers();
+            job.pages.pageHits += vs.pageHits;
+            job.pages.pageMisses += vs.pageMisses;
+            job.pages.pageEvictions += vs.pageEvictions;
+            job.pages.imagesDecoded += vs.imagesDecoded;
+            job.pages.uploadS += vs.uploadS;
+        }
+        if (textureArrays) {
+            auto as = textureArrays->GetStats();
+            job.arraysUsed = true;
+            job.arrayLayers += textureArrays->TotalLayers();
+            job.layers.layerHits += as.layerHits;
+            job.layers.layerMisses += as.layerMisses;
+            job.layers.layerEvictions += as.layerEvictions;
+            job.layers.uploadS += as.uploadS;
+        }
+    }
+
+    virtualTexture.reset();
+    textureArrays.reset();
+    if (textureObject && !softwareRenderer) textureObject->ReleaseAll();
+}
+
+/* Sets the mip level of each input texture to the coarsest level (up to maxLevel)
+ * that still has at least one texel per output pixel along every direction, for all
+ * the faces sampling it. The scale of a face is the largest singular value of the
+ * Jacobian of the map from the input texels to the output pixels */
+static void ChooseInputMipLevels(Mesh& m, const FaceBuckets& buckets, const std::vector<TextureSize>& texSizes, TextureObjectHandle textureObject, int maxLevel)
+{
+    const int nInputs = (int) textureObject->ArraySize();
+    if (maxLevel <= 0) {
+        for (int ti = 0; ti < nInputs; ++ti)
+            textureObject->SetMipLevel(ti, 0);
+        return;
+    }
+
+    TRACE_SCOPE_CAT("ChooseInputMipLevels", "render");
+    auto WTCSh = GetWedgeTexCoordStorageAttribute(m);
+    std::vector<double> maxScale(nInputs, 0);
+
+    #pragma omp parallel
+    {
+        std::vector<double> threadScale(nInputs, 0);
+        #pragma omp for schedule(static)
+        for (int k = 0; k < (int) buckets.faces.size(); ++k) {
+            Mesh::FacePointer fptr = buckets.faces[k];
+            const int ti = WTCSh[fptr].tc[0].N();
+            const int si = fptr->cWT(0).N();
+            if (ti < 0 || ti >= nInputs || si >= (int) texSizes.size())
+                continue;
+            // input edges in texels, output edges in pixels
+            vcg::Point2d a = WTCSh[fptr].tc[1].P() - WTCSh[fptr].tc[0].P();
+            vcg::Point2d b = WTCSh[fptr].tc[2].P() - WTCSh[fptr].tc[0].P();
+            vcg::Point2d p = fptr->cWT(1).P() - fptr->cWT(0).P();
+            vcg::Point2d q = fptr->cWT(2).P() - fptr->cWT(0).P();
+            p.Scale(texSizes[si].w, texSizes[si].h);
+            q.Scale(texSizes[si].w, texSizes[si].h);
+            double det = a.X() * b.Y() - a.Y() * b.X();
+            if (det == 0)
+                continue;
+            // J = [p q] * [a b]^-1
+            double j00 = (p.X() * b.Y() - q.X() * a.Y()) / det;
+            double j01 = (q.X() * a.X() - p.X() * b.X()) / det;
+            double j10 = (p.Y() * b.Y() - q.Y() * a.Y()) / det;
+            double j11 = (q.Y() * a.X() - p.Y() * b.X()) / det;
+            double e = (j00 + j11) / 2, f = (j00 - j11) / 2;
+            double g = (j10 + j01) / 2, h = (j10 - j01) / 2;
+            double sigma = std::sqrt(e * e + h * h) + std::sqrt(f * f + g * g);
+            threadScale[ti] = std::max(threadScale[ti], sigma);
+        }
+        #pragma omp critical (mip_scale)
+        for (int ti = 0; ti < nInputs; ++ti)
+            maxScale[ti] = std::max(maxScale[ti], threadScale[ti]);
+    }
+
+    int reduced = 0;
+    for (int ti = 0; ti < nInputs; ++ti) {
+        int level = 0;
+        if (maxScale[ti] > 0) {
+            while (level < maxLevel && maxScale[ti] * (2 << level) <= 1.0)
+                level++;
+        }
+        textureObject->SetMipLevel(ti, level);
+        if (level > 0) {
+            reduced++;
+            LOG_VERBOSE << "Input texture " << ti << " sampled at scale " << maxScale[ti] << ", using mip level " << level;
+        }
+    }
+    LOG_INFO << "Using reduced mip levels for " << reduced << " of " << nInputs << " input textures";
+}
+
+/* Collects the faces of the sheet grouped by input texture, following inputOrder
+ * (the input textures not listed in it follow in increasing order) */
+static void SheetFaces(const FaceBuckets& buckets, int sheet, const std::vector<int>& inputOrder, std::vector<Mesh::FacePointer>& fvec)
+{
+    fvec.clear();
+    fvec.reserve(buckets.SheetEnd(sheet) - buckets.SheetBegin(sheet));
+    std::vector<char> listed(buckets.numInputs, 0);
+    for (int ti : inputOrder) {
+        if (ti < buckets.numInputs && !listed[ti]) {
+            listed[ti] = 1;
+            fvec.insert(fvec.end(), buckets.faces.begin() + buckets.Begin(sheet, ti), buckets.faces.begin() + buckets.End(sheet, ti));
+        }
+    }
+    for (int ti = 0; ti < buckets.numInputs; ++ti) {
+        if (!listed[ti])
+            fvec.insert(fvec.end(), buckets.faces.begin() + buckets.Begin(sheet, ti), buckets.faces.begin() + buckets.End(sheet, ti));
+    }
 }
 
 static std::shared_ptr<QImage> RenderTexture(RenderingContext& ctx,
                                              std::vector<Mesh::FacePointer>& fvec,
                                              Mesh &m, TextureObjectHandle textureObject,
-                                             bool filter, RenderMode imode,
-                                             int textureWidth, int textureHeight)
+                                             VirtualTexture *virtualTexture, TextureArrays *textureArrays,
+                                             bool filter, RenderMode imode, int gutter,
+                                             int textureWidth, int textureHeight,
+                                             std::vector<QImage> *lodImages,
+                                             const BandSink& bandSink,
+                                             const std::vector<SheetPlacement> *placements)
 {
+    TRACE_SCOPE_CAT("RenderTexture", "render");
     auto WTCSh = GetWedgeTexCoordStorageAttribute(m);
 
-    // sort the faces in increasing order of input texture unit
-    auto FaceComparatorByInputTexIndex = [&WTCSh](const Mesh::FacePointer& f1, const Mesh::FacePointer& f2) {
-        return WTCSh[f1].tc[0].N() < WTCSh[f2].tc[0].N();
+    // the faces are white if the mesh has no color attribute
+    Mesh::PerFaceAttributeHandle<vcg::Color4b> faceColor;
+    bool hasFaceColor = HasFaceColorAttribute(m);
+    if (hasFaceColor)
+        faceColor = GetFaceColorAttribute(m);
+
+    // With a batch of sheets, the texture size is the size of the scratch atlas and
+    // the faces of each sheet (the texture index of their wedges) are drawn in its
+    // placement. AtlasPosition returns the position of a wedge in atlas pixels
+    std::vector<const SheetPlacement *> placementOf;
+    if (placements) {
+        for (const SheetPlacement& p : *placements) {
+            if (p.sheet >= (int) placementOf.size())
+                placementOf.resize(p.sheet + 1, nullptr);
+            placementOf[p.sheet] = &p;
+        }
+    }
+    auto AtlasPosition = [&placementOf, textureWidth, textureHeight](Mesh::FacePointer fptr, int i) -> vcg::Point2d {
+        const auto& wt = fptr->cWT(i);
+        if (placementOf.empty())
+            return vcg::Point2d(wt.U() * textureWidth, wt.V() * textureHeight);
+        const SheetPlacement *p = placementOf[wt.N()];
+        return vcg::Point2d(p->x + wt.U() * p->w, p->y + wt.V() * p->h);
     };
 
-    std::sort(fvec.begin(), fvec.end(), FaceComparatorByInputTexIndex);
+    // the faces are grouped by input texture unit in the planned input order (see SheetFaces)
+
+    // With texture arrays, all the input textures of the sheet are bound at once if
+    // they fit in the arrays. The faces are then drawn in runs of the same array
+    bool layered = false;
+    if (textureArrays && !virtualTexture) {
+        std::vector<int> inputs;
+        for (auto fptr : fvec)
+            if (inputs.empty() || inputs.back() != WTCSh[fptr].tc[0].N())
+                inputs.push_back(WTCSh[fptr].tc[0].N());
+        layered = textureArrays->MakeResident(inputs);
+        if (layered) {
+            std::stable_sort(fvec.begin(), fvec.end(), [&WTCSh, textureArrays](const Mesh::FacePointer& f1, const Mesh::FacePointer& f2) {
+                return textureArrays->ArrayOf(WTCSh[f1].tc[0].N()) < textureArrays->ArrayOf(WTCSh[f2].tc[0].N());
+            });
+        } else {
+            LOG_VERBOSE << "The input textures of the sheet do not fit in the texture arrays, binding them one at a time";
+        }
+    }
+
+    // Group the faces by input texture
+    struct FaceGroup {
+        int texIndex;
+        int first;
+        int count;
+        int source; // the group of the sheet the faces of a tile group belong to
+    };
+    std::vector<FaceGroup> groups;
+    std::vector<int> faceGroup(fvec.size());
+    for (int k = 0; k < (int) fvec.size(); ++k) {
+        int ti = WTCSh[fvec[k]].tc[0].N();
+        if (groups.empty() || groups.back().texIndex != ti)
+            groups.push_back({ti, k, 0, (int) groups.size()});
+        groups.back().count++;
+        faceGroup[k] = (int) groups.size() - 1;
+    }
+
+    // With paged input textures, collect the pages sampled by each group of faces
+    std::vector<std::vector<int>> groupPages;
+    if (virtualTexture) {
+        groupPages.resize(groups.size());
+        for (std::size_t g = 0; g < groups.size(); ++g) {
+            std::vector<int>& pages = groupPages[g];
+            for (int k = groups[g].first; k < groups[g].first + groups[g].count; ++k) {
+                vcg::Box2d box;
+                for (int j = 0; j < 3; ++j)
+                    box.Add(WTCSh[fvec[k]].tc[j].P());
+                virtualTexture->CollectPages(groups[g].texIndex, box.min.X(), box.min.Y(), box.max.X(), box.max.Y(), pages);
+            }
+            std::sort(pages.begin(), pages.end());
+            pages.erase(std::unique(pages.begin(), pages.end()), pages.end());
+        }
+    }
 
     OpenGLFunctionsHandle glFuncs = ctx.glFuncs;
-    glFuncs->glUseProgram(ctx.program);
+    // The program variant and the samplers are the same for all the draw calls of the sheet
+    ensure(imode >= Nearest && imode <= FaceColor);
+    ctx.useChartProgram(imode);
     glFuncs->glBindVertexArray(ctx.vao);
     CHECK_GL_ERROR();
 
@@ -500,37 +2346,6 @@ static std::shared_ptr<QImage> RenderTexture(RenderingContext& ctx,
         inTexSizes.push_back({iw, ih});
     }
 
-    auto t_vbo_start = std::chrono::high_resolution_clock::now();
-    glFuncs->glBindBuffer(GL_ARRAY_BUFFER, ctx.vertexbuf);
-    // Use streaming usage hint and buffer orphaning + map range to reduce stalls.
-    size_t bufferSize = fvec.size() * 15 * sizeof(float);
-    glFuncs->glBufferData(GL_ARRAY_BUFFER, bufferSize, NULL, GL_STREAM_DRAW);
-    float *p = (float *)glFuncs->glMapBufferRange(GL_ARRAY_BUFFER, 0, bufferSize, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
-    ensure(p != nullptr);
-    for (auto fptr : fvec) {
-        int ti = WTCSh[fptr].tc[0].N();
-        for (int i = 0; i < 3; ++i) {
-            *p++ = fptr->cWT(i).U();
-            *p++ = fptr->cWT(i).V();
-            vcg::Point2d uv = WTCSh[fptr].tc[i].P();
-            *p++ = uv.X() / inTexSizes[ti].w;
-            *p++ = uv.Y() / inTexSizes[ti].h;
-            unsigned char *colorptr = (unsigned char *) p;
-            *colorptr++ = fptr->C()[0];
-            *colorptr++ = fptr->C()[1];
-            *colorptr++ = fptr->C()[2];
-            *colorptr++ = fptr->C()[3];
-            p++;
-
-        }
-    }
-    glFuncs->glUnmapBuffer(GL_ARRAY_BUFFER);
-
-    p = nullptr;
-    glFuncs->glBindBuffer(GL_ARRAY_BUFFER, 0); // done, unbind
-    auto t_vbo_end = std::chrono::high_resolution_clock::now();
-    double t_vbo_s = std::chrono::duration<double>(t_vbo_end - t_vbo_start).count();
-
     // Query GL limits and determine tile size for render target
     GLint maxTexSize = 0;
     GLint maxRenderbufferSize = 0;
@@ -539,116 +2354,778 @@ static std::shared_ptr<QImage> RenderTexture(RenderingContext& ctx,
     glFuncs->glGetIntegerv(GL_MAX_RENDERBUFFER_SIZE, &maxRenderbufferSize);
     glFuncs->glGetIntegerv(GL_MAX_VIEWPORT_DIMS, maxViewportDims);
     int maxSide = std::min(std::min(maxTexSize, maxRenderbufferSize), std::min(maxViewportDims[0], maxViewportDims[1]));
+    // the dilated tiles are rendered with an apron of gutter pixels on each side
+    if (gutter > 0)
+        maxSide = std::min(maxSide, DILATION_TILE_SIZE) - 2 * gutter;
     int tileWMax = std::min(textureWidth, maxSide);
     int tileHMax = std::min(textureHeight, maxSide);
 
-    std::shared_ptr<QImage> textureImage = std::make_shared<QImage>(textureWidth, textureHeight, QImage::Format_ARGB32);
-    if (textureImage->isNull()) {
+    // When streaming, the tiles are at most STREAM_BAND_ROWS high and each band of
+    // rows is passed to the sink as soon as all its tiles are read back, so only the
+    // bands in flight are allocated. Otherwise the tiles are copied in the whole image
+    const bool streaming = bool(bandSink);
+    if (streaming) {
+        tileHMax = std::min(tileHMax, STREAM_BAND_ROWS);
+        // the bands start at multiples of the rows of the tiff strips
+        if (tileHMax < textureHeight && tileHMax > TIFF_ROWS_PER_STRIP)
+            tileHMax -= tileHMax % TIFF_ROWS_PER_STRIP;
+    }
+    // The levels of detail are downsampled from each tile after drawing it. The tiles
+    // start at multiples of the factor of the coarsest level, so that each texel of
+    // the levels covers the texels of a single tile
+    const int lodLevels = lodImages ? (int) lodImages->size() : 0;
+    if (lodLevels > 0) {
+        int factor = 1 << lodLevels;
+        if (tileWMax < textureWidth)
+            tileWMax -= tileWMax % factor;
+        if (tileHMax < textureHeight)
+            tileHMax -= tileHMax % factor;
+        ensure(tileWMax > 0 && tileHMax > 0);
+    }
+    const int numBands = (textureHeight + tileHMax - 1) / tileHMax;
+    const int tilesPerBand = (textureWidth + tileWMax - 1) / tileWMax;
+
+    auto t_bin_start = std::chrono::high_resolution_clock::now();
+    // Bin the faces by the tiles overlapped by their bounding box in the sheet (with
+    // a margin of one pixel, plus the gutter of the dilation), so that each tile
+    // draws only its own faces. The tile of
+    // band b and column c is the bin b * tilesPerBand + c, and its faces are stored
+    // contiguously in the vertex buffer, in the order of fvec. The faces spanning
+    // several tiles are replicated in the bins of all of them
+    const int numTiles = numBands * tilesPerBand;
+    std::vector<int> binOffset(numTiles + 1, 0);
+    std::vector<int> binFaces;
+    if (numTiles == 1) {
+        binFaces.resize(fvec.size());
+        for (int k = 0; k < (int) fvec.size(); ++k)
+            binFaces[k] = k;
+        binOffset[1] = (int) fvec.size();
+    } else {
+        struct TileRange {
+            int c0, c1;
+            int b0, b1;
+        };
+        std::vector<TileRange> range(fvec.size());
+        #pragma omp parallel for
+        for (int k = 0; k < (int) fvec.size(); ++k) {
+            vcg::Box2d box;
+            for (int i = 0; i < 3; ++i)
+                box.Add(AtlasPosition(fvec[k], i));
+            // the bands are numbered from the top row of the sheet, which is the
+            // top of the framebuffer
+            box.Offset(1 + gutter);
+            TileRange& r = range[k];
+            r.c0 = std::max(0, int(std::floor(box.min.X() / tileWMax)));
+            r.c1 = std::min(tilesPerBand - 1, int(std::floor(box.max.X() / tileWMax)));
+            r.b0 = std::max(0, int(std::floor((textureHeight - box.max.Y()) / tileHMax)));
+            r.b1 = std::min(numBands - 1, int(std::floor((textureHeight - box.min.Y()) / tileHMax)));
+        }
+        for (const TileRange& r : range)
+            for (int b = r.b0; b <= r.b1; ++b)
+                for (int c = r.c0; c <= r.c1; ++c)
+                    binOffset[b * tilesPerBand + c + 1]++;
+        for (int t = 0; t < numTiles; ++t)
+            binOffset[t + 1] += binOffset[t];
+        binFaces.resize(binOffset[numTiles]);
+        std::vector<int> binFill(binOffset.begin(), binOffset.end() - 1);
+        for (int k = 0; k < (int) fvec.size(); ++k)
+            for (int b = range[k].b0; b <= range[k].b1; ++b)
+                for (int c = range[k].c0; c <= range[k].c1; ++c)
+                    binFaces[binFill[b * tilesPerBand + c]++] = k;
+    }
+
+    // The groups of each tile, and with texture arrays the runs of faces of the same
+    // array (texIndex is the array index). The groups are drawn forward in even tiles
+    // and backward in odd tiles, so each tile starts with the textures bound last
+    std::vector<std::vector<FaceGroup>> tileGroups(numTiles);
+    std::vector<std::vector<FaceGroup>> tileArrayRuns(numTiles);
+    for (int t = 0; t < numTiles; ++t) {
+        for (int e = binOffset[t]; e < binOffset[t + 1]; ++e) {
+            int g = faceGroup[binFaces[e]];
+            std::vector<FaceGroup>& tg = tileGroups[t];
+            if (tg.empty() || tg.back().source != g)
+                tg.push_back({groups[g].texIndex, e, 0, g});
+            tg.back().count++;
+            if (layered) {
+                int a = textureArrays->ArrayOf(groups[g].texIndex);
+                std::vector<FaceGroup>& runs = tileArrayRuns[t];
+                if (runs.empty() || runs.back().texIndex != a)
+                    runs.push_back({a, e, 0, g});
+                runs.back().count++;
+            }
+        }
+    }
+    auto t_bin_end = std::chrono::high_resolution_clock::now();
+    double t_bin_s = std::chrono::duration<double>(t_bin_end - t_bin_start).count();
+
+    auto GroupAt = [](const std::vector<FaceGroup>& tg, int tile, std::size_t pos) {
+        return (tile % 2 == 0) ? pos : tg.size() - 1 - pos;
+    };
+    // the next textures of the tile are decoded while drawing with the current one
+    auto PrefetchFrom = [&](const std::vector<FaceGroup>& tg, int tile, std::size_t pos) {
+        std::vector<int> window;
+        for (std::size_t j = pos; j <= pos + TEXTURE_PREFETCH_DEPTH && j < tg.size(); ++j)
+            window.push_back(tg[GroupAt(tg, tile, j)].texIndex);
+        textureObject->Prefetch(window);
+    };
+    if (!virtualTexture && !layered) {
+        // the textures are bound in the order of the groups of the tiles drawn, so
+        // the cache evicts the textures used again last in the sheet
+        std::vector<int> accessPlan;
+        int drawnTiles = 0;
+        for (const std::vector<FaceGroup>& tg : tileGroups) {
+            if (tg.empty())
+                continue;
+            for (std::size_t pos = 0; pos < tg.size(); ++pos)
+                accessPlan.push_back(tg[GroupAt(tg, drawnTiles, pos)].texIndex);
+            drawnTiles++;
+        }
+        textureObject->SetAccessPlan(accessPlan);
+        for (const std::vector<FaceGroup>& tg : tileGroups) {
+            if (!tg.empty()) {
+                PrefetchFrom(tg, 0, 0);
+                break;
+            }
+        }
+    }
+
+    auto t_vbo_start = std::chrono::high_resolution_clock::now();
+    // The buffer is shared by all the sheets rendered in this context (see RenderingContext)
+    GLsizeiptr bufferSize = binFaces.size() * 3 * VERTEX_STRIDE * sizeof(float);
+    if (bufferSize > 0) {
+        float *vertices = ctx.mapVertices(bufferSize);
+        ensure(vertices != nullptr);
+        #pragma omp parallel for
+        for (int e = 0; e < (int) binFaces.size(); ++e) {
+            Mesh::FacePointer fptr = fvec[binFaces[e]];
+            int ti = WTCSh[fptr].tc[0].N();
+            float layer = layered ? float(textureArrays->LayerOf(ti)) : 0.0f;
+            float *p = vertices + e * 3 * VERTEX_STRIDE;
+            for (int i = 0; i < 3; ++i) {
+                vcg::Point2d pos = AtlasPosition(fptr, i);
+                *p++ = pos.X() / textureWidth;
+                *p++ = pos.Y() / textureHeight;
+                vcg::Point2d uv = WTCSh[fptr].tc[i].P();
+                *p++ = uv.X() / inTexSizes[ti].w;
+                *p++ = uv.Y() / inTexSizes[ti].h;
+                vcg::Color4b color = hasFaceColor ? faceColor[fptr] : vcg::Color4b(vcg::Color4b::White);
+                unsigned char *colorptr = (unsigned char *) p;
+                *colorptr++ = color[0];
+                *colorptr++ = color[1];
+                *colorptr++ = color[2];
+                *colorptr++ = color[3];
+                p++;
+                *p++ = layer;
+            }
+        }
+        ctx.unmapVertices();
+    }
+    auto t_vbo_end = std::chrono::high_resolution_clock::now();
+    double t_vbo_s = std::chrono::duration<double>(t_vbo_end - t_vbo_start).count();
+
+
+    std::shared_ptr<QImage> textureImage;
+    std::vector<QImage> bandImages(streaming ? numBands : 0);
+    std::vector<int> tilesLeft(numBands, tilesPerBand);
+    int slotBand[2] = {0, 0};
+    if (!streaming)
+        textureImage = CreateSheetImage(ctx.scratchDirectory, textureWidth, textureHeight);
+    if (!streaming && textureImage->isNull()) {
         LOG_ERR << "[DIAG] FATAL: QImage allocation FAILED. System is out of memory.";
         logging::LogMemoryUsage();
         std::exit(-1);
     }
+    for (int k = 1; k <= lodLevels; ++k) {
+        (*lodImages)[k - 1] = QImage(textureWidth >> k, textureHeight >> k, QImage::Format_ARGB32);
+        if ((*lodImages)[k - 1].isNull()) {
+            LOG_ERR << "[DIAG] FATAL: QImage allocation FAILED. System is out of memory.";
+            logging::LogMemoryUsage();
+            std::exit(-1);
+        }
+    }
 
     double t_draw_s = 0.0;
+    double t_dilate_s = 0.0;
+    double t_lod_s = 0.0;
     double t_read_s = 0.0;
+    double t_wait_s = 0.0;
+    double t_sink_s = 0.0;
+    int tileIndex = 0;
+    int draws = 0;
+    int skippedTiles = 0;
+    double gpuStart_s[RenderingContext::GPU_STAGE_COUNT];
+    std::copy(ctx.gpuStageS, ctx.gpuStageS + RenderingContext::GPU_STAGE_COUNT, gpuStart_s);
+    ctx.calibrateGpuClock();
+
+    auto SinkBand = [&](int b) {
+        auto t_sink_start = std::chrono::high_resolution_clock::now();
+        bandSink(b * tileHMax, std::move(bandImages[b]));
+        bandImages[b] = QImage();
+        auto t_sink_end = std::chrono::high_resolution_clock::now();
+        t_sink_s += std::chrono::duration<double>(t_sink_end - t_sink_start).count();
+    };
+
+    auto CompleteTile = [&](int slot, bool wait) {
+        if (!ctx.readback[slot].pending)
+            return;
+        int b = slotBand[slot];
+        QImage& image = streaming ? bandImages[b] : *textureImage;
+        int firstRow = streaming ? b * tileHMax : 0;
+        if (CompleteTileReadback(ctx, slot, image, firstRow, lodImages, wait, &t_wait_s) && --tilesLeft[b] == 0 && streaming)
+            SinkBand(b);
+    };
 
-    // Render and read back per-tile
-    for (int y = 0; y < textureHeight; y += tileHMax) {
-        int tileH = std::min(tileHMax, textureHeight - y);
+    // Render and read back per-tile, the bands of rows are rendered top to bottom
+    // (the image rows are flipped with respect to the framebuffer rows)
+    for (int b = 0; b < numBands; ++b) {
+        int row = b * tileHMax;
+        int tileH = std::min(tileHMax, textureHeight - row);
+        int y = textureHeight - (row + tileH);
+        if (streaming) {
+            bandImages[b] = QImage(textureWidth, tileH, QImage::Format_ARGB32);
+            if (bandImages[b].isNull()) {
+                LOG_ERR << "[DIAG] FATAL: QImage allocation FAILED. System is out of memory.";
+                logging::LogMemoryUsage();
+                std::exit(-1);
+            }
+        }
         for (int x = 0; x < textureWidth; x += tileWMax) {
             int tileW = std::min(tileWMax, textureWidth - x);
+            int bin = b * tilesPerBand + x / tileWMax;
+            const std::vector<FaceGroup>& tg = tileGroups[bin];
+
+            // a tile without faces is cleared in the image instead of being drawn and
+            // read back, the bands are still passed to the sink in order
+            if (binOffset[bin] == binOffset[bin + 1]) {
+                QImage& image = streaming ? bandImages[b] : *textureImage;
+                int firstRow = streaming ? row : 0;
+                for (int r = 0; r < tileH; ++r) {
+                    QRgb *dst = reinterpret_cast<QRgb *>(image.scanLine(row - firstRow + r)) + x;
+                    std::fill(dst, dst + tileW, qRgba(0, 0, 0, 255));
+                }
+                for (int k = 1; k <= lodLevels; ++k) {
+                    for (int r = 0; r < (tileH >> k); ++r) {
+                        QRgb *dst = reinterpret_cast<QRgb *>((*lodImages)[k - 1].scanLine((row >> k) + r)) + (x >> k);
+                        std::fill(dst, dst + (tileW >> k), qRgba(0, 0, 0, 255));
+                    }
+                }
+                skippedTiles++;
+                if (--tilesLeft[b] == 0 && streaming) {
+                    for (int i = 0; i < 2; ++i)
+                        CompleteTile((tileIndex + i) % 2, true);
+                    SinkBand(b);
+                }
+                continue;
+            }
 
-            ctx.prepareRenderTarget(tileW, tileH);
+            if (textureObject)
+                textureObject->SetTraceTile(bin);
+
+            // with the dilation the tile is rendered with an apron of gutter pixels
+            // (within the sheet), so that the charts across its sides are dilated too.
+            // The bottom and top refer to the rows of the sheet image
+            int apronLeft = std::min(gutter, x);
+            int apronRight = std::min(gutter, textureWidth - (x + tileW));
+            int apronBottom = std::min(gutter, y);
+            int apronTop = std::min(gutter, textureHeight - (y + tileH));
+            int targetW = tileW + apronLeft + apronRight;
+            int targetH = tileH + apronBottom + apronTop;
+
+            ctx.markGpuStage(RenderingContext::GpuDraw);
+            ctx.prepareRenderTarget(targetW, targetH);
+            if (gutter > 0)
+                ctx.prepareDilation(targetW, targetH);
             glFuncs->glBindFramebuffer(GL_FRAMEBUFFER, ctx.fbo);
 
-            glFuncs->glDrawBuffer(GL_COLOR_ATTACHMENT0);
-
-            glFuncs->glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
-            glFuncs->glClear(GL_COLOR_BUFFER_BIT);
+            if (gutter > 0) {
+                const GLenum buffers[2] = {GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1};
+                const GLfloat background[4] = {0.0f, 0.0f, 0.0f, 1.0f};
+                const GLfloat uncovered[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+                glFuncs->glDrawBuffers(2, buffers);
+                glFuncs->glClearBufferfv(GL_COLOR, 0, background);
+                glFuncs->glClearBufferfv(GL_COLOR, 1, uncovered);
+            } else {
+                glFuncs->glDrawBuffer(GL_COLOR_ATTACHMENT0);
+
+                glFuncs->glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+                glFuncs->glClear(GL_COLOR_BUFFER_BIT);
+            }
 
             // Set tile transform uniforms (in atlas normalized coordinates)
-            float tileMinX = float(x) / float(textureWidth);
-            float tileMinY = float(y) / float(textureHeight);
-            float tileScaleX = float(tileW) / float(textureWidth);
-            float tileScaleY = float(tileH) / float(textureHeight);
-            glFuncs->glUniform2f(ctx.loc_tile_min, tileMinX, tileMinY);
-            glFuncs->glUniform2f(ctx.loc_tile_scale, tileScaleX, tileScaleY);
+            float tileMinX = float(x - apronLeft) / float(textureWidth);
+            float tileMinY = float(y - apronBottom) / float(textureHeight);
+            float tileScaleX = float(targetW) / float(textureWidth);
+            float tileScaleY = float(targetH) / float(textureHeight);
+            glFuncs->glUniform2f(ctx.chart.loc_tile_min, tileMinX, tileMinY);
+            glFuncs->glUniform2f(ctx.chart.loc_tile_scale, tileScaleX, tileScaleY);
 
             auto t_draw_start = std::chrono::high_resolution_clock::now();
-            auto f0 = fvec.begin();
-            auto fbase = f0;
-            while (fbase != fvec.end()) {
-                auto fcurr = fbase;
-                int currTexIndex = WTCSh[*fcurr].tc[0].N();
-                while (fcurr != fvec.end() && WTCSh[*fcurr].tc[0].N() == currTexIndex)
-                    fcurr++;
-                int baseIndex = std::distance(f0, fbase) * 3;
-                int count = std::distance(fbase, fcurr) * 3;
+            if (layered) {
+                // one draw call for each array of the sheet, usually a single one
+                glFuncs->glUniform1i(ctx.chart.loc_layered, 1);
+                glFuncs->glUniform1i(ctx.chart.loc_paged, 0);
+                for (const FaceGroup& run : tileArrayRuns[bin]) {
+                    ctx.markGpuStage(RenderingContext::GpuUpload);
+                    textureArrays->Bind(run.texIndex, 3);
+                    TextureSize layerSize = textureArrays->LayerSize(run.texIndex);
+                    glFuncs->glUniform2f(ctx.chart.loc_texture_size, float(layerSize.w), float(layerSize.h));
+                    ctx.markGpuStage(RenderingContext::GpuDraw);
+                    glFuncs->glDrawArrays(GL_TRIANGLES, run.first * 3, run.count * 3);
+                    CHECK_GL_ERROR();
+                    draws++;
+                }
+                glFuncs->glActiveTexture(GL_TEXTURE0);
+            } else {
+                glFuncs->glUniform1i(ctx.chart.loc_layered, 0);
+            }
+            for (std::size_t pos = 0; !layered && pos < tg.size(); ++pos) {
+                const FaceGroup& group = tg[GroupAt(tg, tileIndex, pos)];
+                int currTexIndex = group.texIndex;
+                int baseIndex = group.first * 3;
+                int count = group.count * 3;
 
                 // Load texture image
+                ctx.markGpuStage(RenderingContext::GpuUpload);
                 glFuncs->glActiveTexture(GL_TEXTURE0);
                 LOG_DEBUG << "Binding texture unit " << currTexIndex;
-                textureObject->Bind(currTexIndex);
-
-                glFuncs->glUniform1i(ctx.loc_img0, 0);
-                glFuncs->glUniform2f(ctx.loc_texture_size, float(textureObject->TextureWidth(currTexIndex)), float(textureObject->TextureHeight(currTexIndex)));
-
-                glFuncs->glUniform1i(ctx.loc_render_mode, 0);
-
-                // Texture parameters are now set once in TextureObject::Bind, so we remove the redundant settings from here.
-                switch (imode) {
-                case Cubic:
-                    glFuncs->glUniform1i(ctx.loc_render_mode, 1);
-                    break;
-                case Linear:
-                    // Default render_mode 0
-                    break;
-                case Nearest:
-                    // Nearest filtering should be set on bound texture if needed
-                    break;
-                case FaceColor:
-                    glFuncs->glUniform1i(ctx.loc_render_mode, 2);
-                    break;
-                default:
-                    ensure(0 && "Should never happen");
+                if (virtualTexture && virtualTexture->MakeResident(currTexIndex, groupPages[group.source])) {
+                    virtualTexture->Bind(currTexIndex, 1, 2);
+                    glFuncs->glActiveTexture(GL_TEXTURE0);
+                    glFuncs->glUniform1i(ctx.chart.loc_paged, 1);
+                } else {
+                    if (virtualTexture)
+                        LOG_DEBUG << "Texture unit " << currTexIndex << " does not fit in the page pool, binding the whole image";
+                    else
+                        PrefetchFrom(tg, tileIndex, pos);
+                    textureObject->Bind(currTexIndex);
+                    glFuncs->glUniform1i(ctx.chart.loc_paged, 0);
+                    glFuncs->glUniform1i(ctx.chart.loc_flip_v, textureObject->TextureFlipped(currTexIndex) ? 1 : 0);
                 }
 
+                glFuncs->glUniform2f(ctx.chart.loc_texture_size, float(textureObject->ResidentWidth(currTexIndex)), float(textureObject->ResidentHeight(currTexIndex)));
+
+                ctx.markGpuStage(RenderingContext::GpuDraw);
                 glFuncs->glDrawArrays(GL_TRIANGLES, baseIndex, count);
                 CHECK_GL_ERROR();
-
-                fbase = fcurr;
+                draws++;
             }
             auto t_draw_end = std::chrono::high_resolution_clock::now();
             t_draw_s += std::chrono::duration<double>(t_draw_end - t_draw_start).count();
 
-            // Read back this tile directly into the final image using pixel pack offsets
-            glFuncs->glReadBuffer(GL_COLOR_ATTACHMENT0);
-            glFuncs->glPixelStorei(GL_PACK_ALIGNMENT, 4);
-            int rowPixels = textureImage->bytesPerLine() / 4;
-            glFuncs->glPixelStorei(GL_PACK_ROW_LENGTH, rowPixels);
-            int destSkipRows = textureHeight - (y + tileH);
-            glFuncs->glPixelStorei(GL_PACK_SKIP_ROWS, destSkipRows);
-            glFuncs->glPixelStorei(GL_PACK_SKIP_PIXELS, x);
+            if (gutter > 0) {
+                auto t_dilate_start = std::chrono::high_resolution_clock::now();
+                ctx.markGpuStage(RenderingContext::GpuDilate);
+                ctx.dilate(targetW, targetH, gutter);
+                auto t_dilate_end = std::chrono::high_resolution_clock::now();
+                t_dilate_s += std::chrono::duration<double>(t_dilate_end - t_dilate_start).count();
+            }
+
+            if (lodLevels > 0) {
+                auto t_lod_start = std::chrono::high_resolution_clock::now();
+                ctx.markGpuStage(RenderingContext::GpuLod);
+                ctx.downsample(gutter > 0 ? ctx.dilatedTarget : ctx.renderTarget, apronLeft, apronTop, tileW, tileH, lodLevels);
+                glFuncs->glBindFramebuffer(GL_FRAMEBUFFER, gutter > 0 ? ctx.postFbo : ctx.fbo);
+                auto t_lod_end = std::chrono::high_resolution_clock::now();
+                t_lod_s += std::chrono::duration<double>(t_lod_end - t_lod_start).count();
+            }
+
+            // Read back this tile asynchronously into a pixel buffer. If the buffer is
+            // still in use by the tile before the previous one, wait for its transfer first
             auto t_read_start = std::chrono::high_resolution_clock::now();
-            glFuncs->glReadPixels(0, 0, tileW, tileH, GL_BGRA, GL_UNSIGNED_BYTE, textureImage->bits());
+            int slot = tileIndex % 2;
+            CompleteTile(slot, true);
+            // the first framebuffer row is the top row of the target in the sheet
+            ctx.markGpuStage(RenderingContext::GpuReadback);
+            IssueTileReadback(ctx, slot, apronLeft, apronTop, x, row, tileW, tileH, lodLevels);
+            ctx.markGpuStage(RenderingContext::GpuNone);
+            slotBand[slot] = b;
+            // and copy the previous tile if its transfer is already complete
+            CompleteTile(1 - slot, false);
+            ctx.resolveTimestamps(false);
             auto t_read_end = std::chrono::high_resolution_clock::now();
             t_read_s += std::chrono::duration<double>(t_read_end - t_read_start).count();
+            tileIndex++;
+        }
+    }
 
-            // Reset pixel store state
-            glFuncs->glPixelStorei(GL_PACK_ROW_LENGTH, 0);
-            glFuncs->glPixelStorei(GL_PACK_SKIP_ROWS, 0);
-            glFuncs->glPixelStorei(GL_PACK_SKIP_PIXELS, 0);
+    // Copy the last pending tiles
+    {
+        auto t_read_start = std::chrono::high_resolution_clock::now();
+        for (int i = 0; i < 2; ++i) {
+            int slot = (tileIndex + i) % 2;
+            CompleteTile(slot, true);
         }
+        auto t_read_end = std::chrono::high_resolution_clock::now();
+        t_read_s += std::chrono::duration<double>(t_read_end - t_read_start).count();
     }
+    // the tiles are read back, so the last timestamps are available
+    ctx.resolveTimestamps(true);
+    double gpu_s[RenderingContext::GPU_STAGE_COUNT];
+    for (int i = 0; i < RenderingContext::GPU_STAGE_COUNT; ++i)
+        gpu_s[i] = ctx.gpuStageS[i] - gpuStart_s[i];
 
     glFuncs->glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glFuncs->glDisable(GL_SCISSOR_TEST);
+    if (!virtualTexture && !layered)
+        textureObject->SetAccessPlan({});
 
-    if (filter)
+    if (filter && textureImage)
         vcg::PullPush(*textureImage, qRgba(0, 0, 0, 255));
 
-    LOG_INFO << "[RENDER-PROFILE] vbo_s=" << t_vbo_s
+    LOG_INFO << "[RENDER-PROFILE] bin_s=" << t_bin_s
+             << " vbo_s=" << t_vbo_s
              << " draw_s=" << t_draw_s
+             << " dilate_s=" << t_dilate_s
+             << " lod_s=" << t_lod_s
+             << " lodLevels=" << lodLevels
              << " readPixels_s=" << t_read_s
+             << " readWait_s=" << t_wait_s
+             << " gpuUpload_s=" << gpu_s[RenderingContext::GpuUpload]
+             << " gpuDraw_s=" << gpu_s[RenderingContext::GpuDraw]
+             << " gpuDilate_s=" << gpu_s[RenderingContext::GpuDilate]
+             << " gpuLod_s=" << gpu_s[RenderingContext::GpuLod]
+             << " gpuReadback_s=" << gpu_s[RenderingContext::GpuReadback]
+             << " draws=" << draws
+             << " tiles=" << numTiles
+             << " skippedTiles=" << skippedTiles
+             << " binnedFaces=" << binFaces.size() << "/" << fvec.size()
+             << " streamedBands=" << (streaming ? numBands : 0)
+             << " bandSink_s=" << t_sink_s
              << " image=" << textureWidth << "x" << textureHeight;
     return textureImage;
-}
\ No newline at end of file
+}
+
+/* Bytes of the levels of detail 1 to levels of a tile, read back after its pixels */
+static GLsizeiptr LevelBytes(int tileW, int tileH, int levels)
+{
+    GLsizeiptr bytes = 0;
+    for (int k = 1; k <= levels; ++k)
+        bytes += GLsizeiptr(tileW >> k) * GLsizeiptr(tileH >> k) * 4;
+    return bytes;
+}
+
+/* Reads back the tileW x tileH pixels at (srcX, srcY) of the bound framebuffer,
+ * to be copied at column x and row row of the sheet, followed by the levels of
+ * detail 1 to levels of the tile from lodFbo (see RenderingContext::downsample()) */
+static void IssueTileReadback(RenderingContext& ctx, int slot, int srcX, int srcY, int x, int row, int tileW, int tileH, int levels)
+{
+    OpenGLFunctionsHandle glFuncs = ctx.glFuncs;
+    RenderingContext::TileReadback& rb = ctx.readback[slot];
+    ensure(!rb.pending);
+
+    GLsizeiptr tileBytes = GLsizeiptr(tileW) * GLsizeiptr(tileH) * 4;
+    GLsizeiptr bytes = tileBytes + LevelBytes(tileW, tileH, levels);
+    glFuncs->glBindBuffer(GL_PIXEL_PACK_BUFFER, ctx.pbo[slot]);
+    if (ctx.pboSize[slot] < bytes) {
+        glFuncs->glBufferData(GL_PIXEL_PACK_BUFFER, bytes, NULL, GL_STREAM_READ);
+        ctx.pboSize[slot] = bytes;
+    }
+
+    glFuncs->glReadBuffer(GL_COLOR_ATTACHMENT0);
+    glFuncs->glPixelStorei(GL_PACK_ALIGNMENT, 4);
+    glFuncs->glReadPixels(srcX, srcY, tileW, tileH, GL_BGRA, GL_UNSIGNED_BYTE, 0);
+    if (levels > 0) {
+        glFuncs->glBindFramebuffer(GL_READ_FRAMEBUFFER, ctx.lodFbo);
+        glFuncs->glReadBuffer(GL_COLOR_ATTACHMENT0);
+        GLsizeiptr offset = tileBytes;
+        for (int k = 1; k <= levels; ++k) {
+            glFuncs->glReadPixels(0, RenderingContext::lodRow(tileH, k), tileW >> k, tileH >> k, GL_BGRA, GL_UNSIGNED_BYTE, (void *) offset);
+            offset += GLsizeiptr(tileW >> k) * GLsizeiptr(tileH >> k) * 4;
+        }
+    }
+    glFuncs->glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    CHECK_GL_ERROR();
+
+    rb.fence = glFuncs->glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    glFuncs->glFlush();
+    rb.pending = true;
+    rb.x = x;
+    rb.row = row;
+    rb.w = tileW;
+    rb.h = tileH;
+    rb.levels = levels;
+}
+
+/* Copies the pixels of the tile read back in the slot into the image, whose first
+ * row is the sheet row firstRow (the whole sheet, or a band of rows), and its levels
+ * of detail into the whole images of the levels in lodImages. If wait is
+ * false and the transfer is not complete yet, it returns false without blocking.
+ * The framebuffer rows of the tile are stored bottom-up starting from the tile
+ * row, as done by a direct read. */
+static bool CompleteTileReadback(RenderingContext& ctx, int slot, QImage& image, int firstRow, std::vector<QImage> *lodImages, bool wait, double *waitTime)
+{
+    OpenGLFunctionsHandle glFuncs = ctx.glFuncs;
+    RenderingContext::TileReadback& rb = ctx.readback[slot];
+    if (!rb.pending)
+        return true;
+
+    auto t_wait_start = std::chrono::high_resolution_clock::now();
+    GLenum status = glFuncs->glClientWaitSync(rb.fence, GL_SYNC_FLUSH_COMMANDS_BIT, wait ? GL_TIMEOUT_IGNORED : 0);
+    auto t_wait_end = std::chrono::high_resolution_clock::now();
+    if (waitTime)
+        *waitTime += std::chrono::duration<double>(t_wait_end - t_wait_start).count();
+    if (status == GL_TIMEOUT_EXPIRED)
+        return false;
+    if (status == GL_WAIT_FAILED) {
+        LOG_ERR << "[OPENGL] FATAL: Waiting for the tile readback failed.";
+        CHECK_GL_ERROR();
+        std::exit(-1);
+    }
+    glFuncs->glDeleteSync(rb.fence);
+    rb.fence = 0;
+
+    GLsizeiptr tileBytes = GLsizeiptr(rb.w) * GLsizeiptr(rb.h) * 4;
+    GLsizeiptr bytes = tileBytes + LevelBytes(rb.w, rb.h, rb.levels);
+    glFuncs->glBindBuffer(GL_PIXEL_PACK_BUFFER, ctx.pbo[slot]);
+    const uchar *src = (const uchar *) glFuncs->glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, bytes, GL_MAP_READ_BIT);
+    ensure(src != nullptr);
+    int destSkipRows = rb.row - firstRow;
+    ensure(destSkipRows >= 0 && destSkipRows + rb.h <= image.height());
+    std::size_t rowBytes = std::size_t(rb.w) * 4;
+    uchar *bits = image.bits();
+    std::size_t bytesPerLine = image.bytesPerLine();
+    for (int r = 0; r < rb.h; ++r) {
+        uchar *dst = bits + std::size_t(destSkipRows + r) * bytesPerLine + std::size_t(rb.x) * 4;
+        std::memcpy(dst, src + r * rowBytes, rowBytes);
+    }
+    // the tiles start at multiples of the factor of the coarsest level
+    const uchar *levelSrc = src + tileBytes;
+    for (int k = 1; k <= rb.levels; ++k) {
+        ensure(lodImages && (int) lodImages->size() >= rb.levels);
+        QImage& level = (*lodImages)[k - 1];
+        int w = rb.w >> k;
+        int h = rb.h >> k;
+        std::size_t levelRowBytes = std::size_t(w) * 4;
+        for (int r = 0; r < h; ++r) {
+            uchar *dst = level.scanLine((rb.row >> k) + r) + std::size_t(rb.x >> k) * 4;
+            std::memcpy(dst, levelSrc + r * levelRowBytes, levelRowBytes);
+        }
+        levelSrc += std::size_t(h) * levelRowBytes;
+    }
+    glFuncs->glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    glFuncs->glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    CHECK_GL_ERROR();
+
+    rb.pending = false;
+    return true;
+}
+
+/* Returns the level of detail of the image reduced by a factor of 2^level along
+ * both sides, each pixel is the average of the block of pixels it covers (the
+ * remainder rows and columns are dropped), as the levels downsampled on the GPU */
+static QImage DownsampleImage(const QImage& image, int level)
+{
+    QImage src = (image.format() == QImage::Format_ARGB32) ? image : image.convertToFormat(QImage::Format_ARGB32);
+    const int factor = 1 << level;
+    QImage out(src.width() >> level, src.height() >> level, QImage::Format_ARGB32);
+    const uchar *srcBits = src.constBits();
+    const std::size_t srcBytesPerLine = src.bytesPerLine();
+    uchar *outBits = out.bits();
+    const std::size_t outBytesPerLine = out.bytesPerLine();
+    const int n = factor * factor;
+    #pragma omp parallel for
+    for (int r = 0; r < out.height(); ++r) {
+        QRgb *dst = reinterpret_cast<QRgb *>(outBits + std::size_t(r) * outBytesPerLine);
+        for (int c = 0; c < out.width(); ++c) {
+            int sum[4] = {0, 0, 0, 0};
+            for (int dy = 0; dy < factor; ++dy) {
+                const QRgb *p = reinterpret_cast<const QRgb *>(srcBits + std::size_t(r * factor + dy) * srcBytesPerLine) + c * factor;
+                for (int dx = 0; dx < factor; ++dx) {
+                    sum[0] += qRed(p[dx]);
+                    sum[1] += qGreen(p[dx]);
+                    sum[2] += qBlue(p[dx]);
+                    sum[3] += qAlpha(p[dx]);
+                }
+            }
+            dst[c] = qRgba((sum[0] + n / 2) / n, (sum[1] + n / 2) / n, (sum[2] + n / 2) / n, (sum[3] + n / 2) / n);
+        }
+    }
+    return out;
+}
+
+static bool HasBC7Compression()
+{
+    QOpenGLContext *context = QOpenGLContext::currentContext();
+    QPair<int, int> version = context->format().version();
+    return (version >= qMakePair(4, 2)) || context->hasExtension("GL_ARB_texture_compression_bptc");
+}
+
+static bool CompressBC7(RenderingContext& ctx, const QImage& textureImage, std::vector<unsigned char>& blocks)
+{
+    TRACE_SCOPE_CAT("CompressBC7", "gl");
+    OpenGLFunctionsHandle glFuncs = ctx.glFuncs;
+
+    QImage image = textureImage;
+    if (image.format() != QImage::Format_ARGB32)
+        image = image.convertToFormat(QImage::Format_ARGB32);
+
+    // the rows are uploaded top to bottom, so the blocks come back in the
+    // top-left origin order of the ktx2 container
+    GLuint tex;
+    glFuncs->glGenTextures(1, &tex);
+    glFuncs->glBindTexture(GL_TEXTURE_2D, tex);
+    glFuncs->glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glFuncs->glPixelStorei(GL_UNPACK_ROW_LENGTH, image.bytesPerLine() / 4);
+    glFuncs->glTexImage2D(GL_TEXTURE_2D, 0, GL_COMPRESSED_RGBA_BPTC_UNORM, image.width(), image.height(), 0,
+                          GL_BGRA, GL_UNSIGNED_BYTE, image.constBits());
+    glFuncs->glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+
+    GLint compressed = GL_FALSE;
+    GLint internalFormat = 0;
+    GLint compressedSize = 0;
+    glFuncs->glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_COMPRESSED, &compressed);
+    glFuncs->glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_INTERNAL_FORMAT, &internalFormat);
+    glFuncs->glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_COMPRESSED_IMAGE_SIZE, &compressedSize);
+
+    std::size_t expectedSize = std::size_t((image.width() + 3) / 4) * std::size_t((image.height() + 3) / 4) * 16;
+    bool ok = (compressed == GL_TRUE) && (internalFormat == GL_COMPRESSED_RGBA_BPTC_UNORM)
+            && (std::size_t(compressedSize) == expectedSize);
+    if (ok) {
+        blocks.resize(expectedSize);
+        glFuncs->glGetCompressedTexImage(GL_TEXTURE_2D, 0, blocks.data());
+    }
+
+    glFuncs->glBindTexture(GL_TEXTURE_2D, 0);
+    glFuncs->glDeleteTextures(1, &tex);
+    CHECK_GL_ERROR();
+
+    return ok;
+}
+
+/* Simulates the LRU texture cache of TextureObject */
+class TextureCacheSimulator {
+public:
+    TextureCacheSimulator(const std::vector<uint64_t>& inputBytes, uint64_t budgetBytes)
+        : inputBytes{inputBytes}, budgetBytes{budgetBytes} {}
+
+    bool Resident(int ti) const { return pos.count(ti) > 0; }
+
+    /* Binds the texture and returns the uploaded bytes */
+    uint64_t Bind(int ti)
+    {
+        auto it = pos.find(ti);
+        if (it != pos.end()) {
+            lru.splice(lru.begin(), lru, it->second);
+            return 0;
+        }
+        if (budgetBytes > 0) {
+            while (!lru.empty() && currentBytes + inputBytes[ti] > budgetBytes) {
+                currentBytes -= inputBytes[lru.back()];
+                pos.erase(lru.back());
+                lru.pop_back();
+            }
+        }
+        lru.push_front(ti);
+        pos[ti] = lru.begin();
+        currentBytes += inputBytes[ti];
+        return inputBytes[ti];
+    }
+
+private:
+    const std::vector<uint64_t>& inputBytes;
+    uint64_t budgetBytes;
+    uint64_t currentBytes = 0;
+    std::list<int> lru;
+    std::unordered_map<int, std::list<int>::iterator> pos;
+};
+
+/* Greedy planning on the sheet/input texture usage graph: the next sheet is the
+ * one with the fewest bytes to upload given the simulated cache content (ties
+ * are broken by the largest resident overlap, then by index). Within a sheet the
+ * resident inputs are bound first, so that loading the missing ones cannot
+ * evict them */
+/* Groups the consecutive small sheets of the plan in batches, packed in shelves of
+ * a scratch atlas with spacing pixels between them. The other sheets, and all of
+ * them if not enabled, are in batches of their own */
+static std::vector<SheetBatch> PlanSheetBatches(const RenderPlan& plan, const std::vector<TextureSize>& texSizes, int spacing, bool enabled)
+{
+    std::vector<SheetBatch> batches;
+    SheetBatch current;
+    int shelfX = 0;
+    int shelfY = 0;
+    int shelfH = 0;
+    auto Close = [&]() {
+        if (!current.sheets.empty())
+            batches.push_back(current);
+        current = SheetBatch();
+        shelfX = shelfY = shelfH = 0;
+    };
+    for (int i : plan.sheetOrder) {
+        int w = texSizes[i].w;
+        int h = texSizes[i].h;
+        if (!enabled || w > SMALL_SHEET_SIDE || h > SMALL_SHEET_SIDE) {
+            Close();
+            current.sheets.push_back({i, 0, 0, w, h});
+            current.width = w;
+            current.height = h;
+            Close();
+            continue;
+        }
+        if (shelfX > 0 && shelfX + w > BATCH_ATLAS_SIZE) {
+            shelfY += shelfH + spacing;
+            shelfX = 0;
+            shelfH = 0;
+        }
+        if (shelfY + h > BATCH_ATLAS_SIZE) {
+            Close();
+        }
+        current.sheets.push_back({i, shelfX, shelfY, w, h});
+        current.width = std::max(current.width, shelfX + w);
+        current.height = std::max(current.height, shelfY + h);
+        shelfX += w + spacing;
+        shelfH = std::max(shelfH, h);
+    }
+    Close();
+    return batches;
+}
+
+static RenderPlan PlanRenderOrder(const std::vector<std::vector<int>>& sheetInputs,
+                                  const std::vector<uint64_t>& inputBytes, uint64_t budgetBytes)
+{
+    RenderPlan plan;
+    const int nSheets = sheetInputs.size();
+    plan.inputOrder.resize(nSheets);
+
+    {
+        TextureCacheSimulator cache(inputBytes, budgetBytes);
+        for (int i = 0; i < nSheets; ++i)
+            for (int ti : sheetInputs[i])
+                plan.indexOrderBytes += cache.Bind(ti);
+    }
+
+    TextureCacheSimulator cache(inputBytes, budgetBytes);
+    std::vector<bool> done(nSheets, false);
+    for (int n = 0; n < nSheets; ++n) {
+        int best = -1;
+        uint64_t bestMissing = 0;
+        uint64_t bestResident = 0;
+        for (int i = 0; i < nSheets; ++i) {
+            if (done[i])
+                continue;
+            uint64_t missing = 0;
+            uint64_t resident = 0;
+            for (int ti : sheetInputs[i])
+                (cache.Resident(ti) ? resident : missing) += inputBytes[ti];
+            if (best == -1 || missing < bestMissing || (missing == bestMissing && resident > bestResident)) {
+                best = i;
+                bestMissing = missing;
+                bestResident = resident;
+            }
+        }
+
+        std::vector<int>& order = plan.inputOrder[best];
+        for (int ti : sheetInputs[best])
+            if (cache.Resident(ti))
+                order.push_back(ti);
+        for (int ti : sheetInputs[best])
+            if (!cache.Resident(ti))
+                order.push_back(ti);
+        for (int ti : order)
+            plan.uploadBytes += cache.Bind(ti);
+
+        plan.sheetOrder.push_back(best);
+        done[best] = true;
+    }
+
+    return plan;
+}
@@ -26,18 +26,122 @@
 #include "mesh_graph.h"
 
 #include <vector>
+#include <string>
+#include <memory>
+#include <functional>
 
 class Mesh;
 class MeshFace;
+class SheetSink;
 
 enum RenderMode {
     Nearest, Linear, Cubic, FaceColor
 };
 
-int FacesByTextureIndex(Mesh& m, std::vector<std::vector<Mesh::FacePointer>>& fv);
+enum class TextureFileFormat {
+    PNG, TGA, JPEG, KTX2, TIFF
+};
+
+struct TextureSaveParameters {
+    int workers = 2;              // number of texture images encoded concurrently
+    double memoryBudgetGB = 4.0;  // maximum size of the rendered images waiting to be saved
+    TextureFileFormat format = TextureFileFormat::PNG;
+    int jpegQuality = 90;         // quality of the jpeg images (0-100)
+    int renderContexts = 1;       // number of OpenGL contexts rendering the sheets concurrently
+    int renderThreads = 0;        // threads of the vertex fill and of the software renderer of each context (0 uses all of them)
+    bool softwareRendering = false; // render the sheets on the CPU, without OpenGL (see SoftwareRenderer)
+    bool arrayInputTextures = false; // bind the input textures as layers of texture arrays (see TextureArrays)
+    bool streamingSave = true;    // save png and tga sheets in bands of rows while they are rendered
+    int maxInputMipLevel = 0;     // highest mip level the input textures are reduced to when the faces sample them sparsely
+    int gutterWidth = 0;          // pixels around the charts filled on the GPU with the color of the nearest chart texel (0 disables it)
+    int lodLevels = 0;            // downsampled levels of detail saved next to each sheet (_texture_N_lodK), each halving the resolution
+    bool adaptiveCacheBudget = false; // resize the texture cache budget from the free GPU memory before each sheet (see DetectTextureCacheBudget)
+    std::string scratchDirectory; // directory of the scratch files backing the full sheet images, empty to keep them in memory (see mapped_image.h)
+    bool udimTiles = false;       // name the sheets <name>.<1001+N> as the tiles of a UDIM texture instead of <name>_texture_N
+    std::function<bool(int)> claimSheet; // called before rendering each sheet, which is skipped if it returns false (the sheets are then not batched)
+    std::shared_ptr<SheetSink> sheetSink; // receives the pixels of the sheets instead of saving them, without levels of detail (see sheet_sink.h)
+};
+
+/* Stores in *budgetBytes the texture cache budget of each of renderContexts
+ * rendering contexts, from the GPU memory reported free by the driver (stored in
+ * *availableBytes) minus a headroom for the render targets and the vertex and
+ * pixel buffers. Requires a current OpenGL context, returns false if the free
+ * memory cannot be queried (see QueryAvailableGPUMemory) */
+bool DetectTextureCacheBudget(int renderContexts, uint64_t *budgetBytes, uint64_t *availableBytes);
+
+/* Returns the file extension (without the dot) of the texture file format */
+const char *TextureFileExtension(TextureFileFormat format);
+
+/* Parses a texture file format name (png, tga, jpg/jpeg, ktx2, tif/tiff), returns false if
+ * the name is not recognized */
+bool ParseTextureFileFormat(const std::string& name, TextureFileFormat *format);
+
+/* Returns the format the sheets are saved in, png if the format is ktx2 and BC7
+ * compression is not available to the renderer. Requires the rendering context to
+ * be current unless the rendering is in software */
+TextureFileFormat SavedTextureFormat(const TextureSaveParameters& saveParams);
+
+/* Returns the file names (without the directory) of the numSheets texture sheets
+ * saved by RenderTextureAndSave next to outFileName, which sets them as the texture
+ * names of the mesh */
+std::vector<std::string> TextureSheetNames(const std::string& outFileName, int numSheets, TextureFileFormat format, bool udim = false);
+
+// UDIM numbers of the tiles, 10 per row of the UV space starting from 1001
+constexpr int UDIM_FIRST_TILE = 1001;
+constexpr int UDIM_MAX_TILES = 1000;
 
+/* Turns the texture sheets of m rendered as UDIM tiles into a single UDIM texture:
+ * the texture coordinates of the sheet N are offset by (N % 10, N / 10) with the
+ * texture index 0, and the mesh references <name>.<UDIM>.<ext>. The texture
+ * coordinates are no longer those of the sheets, so it must follow the rendering */
+void ApplyUDIMLayout(Mesh& m, const std::string& outFileName, TextureFileFormat format);
+
+/* The faces of the mesh bucketed by output sheet (the texture index of the wedges)
+ * and, within each sheet, by input texture (the texture index of the input wedge
+ * tex coords). The buckets are stored contiguously, in sheet-major order: the
+ * faces of sheet s and input texture t are faces[offset[b], offset[b+1]) with
+ * b = s * numInputs + t. The buckets are computed once after packing, and remain
+ * valid as long as the faces are neither added nor assigned to other textures */
+struct FaceBuckets {
+    int numSheets = 0;
+    int numInputs = 0;
+    std::vector<Mesh::FacePointer> faces;
+    std::vector<int> offset;
+
+    int Begin(int sheet, int input) const { return offset[sheet * numInputs + input]; }
+    int End(int sheet, int input) const { return offset[sheet * numInputs + input + 1]; }
+    int SheetBegin(int sheet) const { return offset[sheet * numInputs]; }
+    int SheetEnd(int sheet) const { return offset[(sheet + 1) * numInputs]; }
+};
+
+/* Buckets the faces of m with a counting sort (two passes over the faces) */
+void BucketFaces(Mesh& m, FaceBuckets& buckets);
+
+/* Renders and saves the texture sheets. If pagedInputTextures is true the input
+ * textures are streamed in pages within the texture cache budget (see VirtualTexture).
+ * With more than one rendering context, the sheets are distributed to contexts created
+ * on worker threads, each with its own input texture cache. The faces are taken from
+ * faceBuckets if not null, otherwise they are bucketed here */
 void
 RenderTextureAndSave(const std::string& outFileName, Mesh& m, TextureObjectHandle textureObject, const std::vector<TextureSize> &texSizes,
-                     bool filter, RenderMode imode);
+                     bool filter, RenderMode imode, const TextureSaveParameters& saveParams = TextureSaveParameters(),
+                     bool pagedInputTextures = false, const FaceBuckets *faceBuckets = nullptr);
+
+/* Renders the texture sheets like RenderTextureAndSave, but returns them instead of
+ * saving them. The images are indexed by the texture index of the faces, and the
+ * texture names of m are left empty */
+std::vector<std::shared_ptr<QImage>>
+RenderTextures(Mesh& m, TextureObjectHandle textureObject, const std::vector<TextureSize> &texSizes,
+               bool filter, RenderMode imode, const TextureSaveParameters& saveParams = TextureSaveParameters(),
+               bool pagedInputTextures = false, const FaceBuckets *faceBuckets = nullptr);
+
+/* If keep is true, the OpenGL resources of the rendering (the compiled program, the
+ * framebuffer, the vertex and pixel buffers) created by RenderTextureAndSave for the
+ * current context are kept and reused by the later calls with the same context */
+void KeepRenderingResources(bool keep);
+
+/* Releases the rendering resources kept for later calls, and stops keeping them.
+ * Must be called with the context that created them current */
+void ReleaseRenderingResources();
 
 #endif // TEXTURE_RENDERING_H
\ No newline at end of file
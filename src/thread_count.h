@@ -0,0 +1,55 @@
+/*******************************************************************************
+    Copyright (c) 2021, Andrea Maggiordomo, Paolo Cignoni and Marco Tarini
+
+    This file is part of TextureDefrag, a reference implementation for
+    the paper ``Texture Defragmentation for Photo-Reconstructed 3D Models''
+    by Andrea Maggiordomo, Paolo Cignoni and Marco Tarini.
+
+    TextureDefrag is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    TextureDefrag is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with TextureDefrag. If not, see <https://www.gnu.org/licenses/>.
+*******************************************************************************/
+
+
+#ifndef THREAD_COUNT_H
+#define THREAD_COUNT_H
+
+#include <omp.h>
+
+/* Sets the number of threads of the OpenMP parallel regions started by the
+ * calling thread until the object is destroyed (if n is not positive the count
+ * is left unchanged). The count is a setting of the calling thread, so the
+ * phases of the jobs that run concurrently on other threads are not affected,
+ * and the threads started by the phase (such as the rendering contexts) must
+ * set it again */
+class ScopedThreadCount {
+
+    int previous;
+
+public:
+
+    explicit ScopedThreadCount(int n) : previous{omp_get_max_threads()}
+    {
+        if (n > 0)
+            omp_set_num_threads(n);
+    }
+
+    ~ScopedThreadCount()
+    {
+        omp_set_num_threads(previous);
+    }
+
+    ScopedThreadCount(const ScopedThreadCount&) = delete;
+    ScopedThreadCount& operator=(const ScopedThreadCount&) = delete;
+};
+
+#endif // THREAD_COUNT_H
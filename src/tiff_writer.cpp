@@ -0,0 +1,223 @@
+/*******************************************************************************
+    Copyright (c) 2021, Andrea Maggiordomo, Paolo Cignoni and Marco Tarini
+
+    This file is part of TextureDefrag, a reference implementation for
+    the paper ``Texture Defragmentation for Photo-Reconstructed 3D Models''
+    by Andrea Maggiordomo, Paolo Cignoni and Marco Tarini.
+
+    TextureDefrag is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    TextureDefrag is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with TextureDefrag. If not, see <https://www.gnu.org/licenses/>.
+*******************************************************************************/
+
+#include "tiff_writer.h"
+
+#include <wrap/openfbx/src/miniz.h>
+
+#include <algorithm>
+#include <cstring>
+
+// The BigTIFF header is 16 bytes: byte order, version 43, size of the offsets, and
+// the offset of the first image directory
+static const std::size_t HEADER_BYTES = 16;
+
+enum TIFFType : uint16_t { SHORT = 3, LONG = 4, LONG8 = 16 };
+
+static bool DeflateStrip(const unsigned char *bgra, std::size_t bytesPerLine, int width, int rows, int level,
+                         std::vector<unsigned char>& out);
+static void AppendU16(std::vector<unsigned char>& out, uint16_t v);
+static void AppendU64(std::vector<unsigned char>& out, uint64_t v);
+static void AppendEntry(std::vector<unsigned char>& out, uint16_t tag, TIFFType type, uint64_t count, uint64_t value);
+
+bool EncodeTIFF(const unsigned char *bgra, int width, int height, std::size_t bytesPerLine,
+                int level, int numThreads, std::vector<unsigned char>& out)
+{
+    out.clear();
+    if (width <= 0 || height <= 0)
+        return false;
+
+    TIFFStreamEncoder encoder(width, height, level);
+    TIFFStreamEncoder::EncodedRows encoded;
+    if (!encoder.EncodeRows(bgra, bytesPerLine, 0, height, numThreads, encoded))
+        return false;
+
+    std::vector<unsigned char> header;
+    encoder.Begin(out);
+    encoder.Append(encoded, out);
+    encoder.End(out, header);
+    std::copy(header.begin(), header.end(), out.begin());
+    return true;
+}
+
+TIFFStreamEncoder::TIFFStreamEncoder(int width, int height, int level)
+    : width{width}, height{height}, level{std::min(std::max(level, 0), 9)}
+{
+}
+
+void TIFFStreamEncoder::Begin(std::vector<unsigned char>& out)
+{
+    out.push_back('I');
+    out.push_back('I');
+    AppendU16(out, 43);
+    AppendU16(out, 8);
+    AppendU16(out, 0);
+    AppendU64(out, 0); // the directory is written by End()
+    offset = HEADER_BYTES;
+}
+
+bool TIFFStreamEncoder::EncodeRows(const unsigned char *bgra, std::size_t bytesPerLine, int firstRow, int rows,
+                                   int numThreads, EncodedRows& encoded) const
+{
+    encoded.deflated.clear();
+    encoded.stripBytes.clear();
+    encoded.rows = 0;
+    if (width <= 0 || rows <= 0 || firstRow < 0 || firstRow + rows > height || firstRow % TIFF_ROWS_PER_STRIP != 0)
+        return false;
+    if (rows % TIFF_ROWS_PER_STRIP != 0 && firstRow + rows != height)
+        return false;
+
+    const int numStrips = (rows + TIFF_ROWS_PER_STRIP - 1) / TIFF_ROWS_PER_STRIP;
+    std::vector<std::vector<unsigned char>> strips(numStrips);
+    bool ok = true;
+    #pragma omp parallel for schedule(dynamic) num_threads(std::max(numThreads, 1)) reduction(&&:ok)
+    for (int i = 0; i < numStrips; ++i) {
+        int row0 = i * TIFF_ROWS_PER_STRIP;
+        int stripRows = std::min(TIFF_ROWS_PER_STRIP, rows - row0);
+        ok = DeflateStrip(bgra + std::size_t(row0) * bytesPerLine, bytesPerLine, width, stripRows, level, strips[i]) && ok;
+    }
+    if (!ok)
+        return false;
+
+    std::size_t size = 0;
+    for (const auto& strip : strips)
+        size += strip.size();
+    encoded.deflated.reserve(size);
+    for (auto& strip : strips) {
+        encoded.deflated.insert(encoded.deflated.end(), strip.begin(), strip.end());
+        encoded.stripBytes.push_back(strip.size());
+        std::vector<unsigned char>().swap(strip);
+    }
+    encoded.rows = rows;
+    return true;
+}
+
+void TIFFStreamEncoder::Append(EncodedRows& encoded, std::vector<unsigned char>& out)
+{
+    for (uint64_t bytes : encoded.stripBytes) {
+        stripOffsets.push_back(offset);
+        stripBytes.push_back(bytes);
+        offset += bytes;
+    }
+    out.insert(out.end(), encoded.deflated.begin(), encoded.deflated.end());
+    std::vector<unsigned char>().swap(encoded.deflated);
+}
+
+void TIFFStreamEncoder::End(std::vector<unsigned char>& out, std::vector<unsigned char>& header)
+{
+    // the directory starts on a word boundary
+    if (offset % 2 != 0) {
+        out.push_back(0);
+        offset++;
+    }
+    const uint64_t directory = offset;
+    const int numEntries = 12;
+    const uint64_t arrays = directory + 8 + 20 * numEntries + 8;
+    const uint64_t numStrips = stripOffsets.size();
+
+    // the arrays of a single strip fit in the entries
+    uint64_t offsetsValue = (numStrips == 1) ? stripOffsets[0] : arrays;
+    uint64_t bytesValue = (numStrips == 1) ? stripBytes[0] : arrays + 8 * numStrips;
+
+    std::vector<unsigned char> ifd;
+    AppendU64(ifd, numEntries);
+    AppendEntry(ifd, 256, LONG, 1, uint32_t(width));            // ImageWidth
+    AppendEntry(ifd, 257, LONG, 1, uint32_t(height));           // ImageLength
+    AppendEntry(ifd, 258, SHORT, 4, 0x0008000800080008ull);     // BitsPerSample
+    AppendEntry(ifd, 259, SHORT, 1, 8);                         // Compression, deflate
+    AppendEntry(ifd, 262, SHORT, 1, 2);                         // PhotometricInterpretation, RGB
+    AppendEntry(ifd, 273, LONG8, numStrips, offsetsValue);      // StripOffsets
+    AppendEntry(ifd, 277, SHORT, 1, 4);                         // SamplesPerPixel
+    AppendEntry(ifd, 278, LONG, 1, TIFF_ROWS_PER_STRIP);        // RowsPerStrip
+    AppendEntry(ifd, 279, LONG8, numStrips, bytesValue);        // StripByteCounts
+    AppendEntry(ifd, 284, SHORT, 1, 1);                         // PlanarConfiguration, interleaved
+    AppendEntry(ifd, 317, SHORT, 1, 2);                         // Predictor, horizontal differencing
+    AppendEntry(ifd, 338, SHORT, 1, 2);                         // ExtraSamples, unassociated alpha
+    AppendU64(ifd, 0);
+    if (numStrips > 1) {
+        for (uint64_t v : stripOffsets)
+            AppendU64(ifd, v);
+        for (uint64_t v : stripBytes)
+            AppendU64(ifd, v);
+    }
+    out.insert(out.end(), ifd.begin(), ifd.end());
+    offset += ifd.size();
+
+    header.clear();
+    header.push_back('I');
+    header.push_back('I');
+    AppendU16(header, 43);
+    AppendU16(header, 8);
+    AppendU16(header, 0);
+    AppendU64(header, directory);
+}
+
+// -- static functions ---------------------------------------------------------
+
+/* Converts the rows to RGBA with the horizontal differencing predictor (each sample
+ * minus the same sample of the previous pixel), and deflates them in a zlib stream */
+static bool DeflateStrip(const unsigned char *bgra, std::size_t bytesPerLine, int width, int rows, int level,
+                         std::vector<unsigned char>& out)
+{
+    const std::size_t rowBytes = std::size_t(width) * 4;
+    std::vector<unsigned char> raw(rowBytes * rows);
+    for (int y = 0; y < rows; ++y) {
+        const unsigned char *src = bgra + std::size_t(y) * bytesPerLine;
+        unsigned char *dst = raw.data() + std::size_t(y) * rowBytes;
+        unsigned char prev[4] = {0, 0, 0, 0};
+        for (int x = 0; x < width; ++x) {
+            const unsigned char rgba[4] = { src[4 * x + 2], src[4 * x + 1], src[4 * x + 0], src[4 * x + 3] };
+            for (int c = 0; c < 4; ++c) {
+                dst[4 * x + c] = (unsigned char) (rgba[c] - prev[c]);
+                prev[c] = rgba[c];
+            }
+        }
+    }
+
+    mz_ulong size = mz_compressBound(mz_ulong(raw.size()));
+    out.resize(size);
+    if (mz_compress2(out.data(), &size, raw.data(), mz_ulong(raw.size()), level) != MZ_OK)
+        return false;
+    out.resize(size);
+    return true;
+}
+
+static void AppendU16(std::vector<unsigned char>& out, uint16_t v)
+{
+    out.push_back((unsigned char) (v & 0xff));
+    out.push_back((unsigned char) (v >> 8));
+}
+
+static void AppendU64(std::vector<unsigned char>& out, uint64_t v)
+{
+    for (int i = 0; i < 8; ++i)
+        out.push_back((unsigned char) ((v >> (8 * i)) & 0xff));
+}
+
+/* Appends a directory entry, the value (or the offset of the values) is stored in the
+ * low bytes of the 8-byte field */
+static void AppendEntry(std::vector<unsigned char>& out, uint16_t tag, TIFFType type, uint64_t count, uint64_t value)
+{
+    AppendU16(out, tag);
+    AppendU16(out, type);
+    AppendU64(out, count);
+    AppendU64(out, value);
+}
@@ -0,0 +1,81 @@
+/*******************************************************************************
+    Copyright (c) 2021, Andrea Maggiordomo, Paolo Cignoni and Marco Tarini
+
+    This file is part of TextureDefrag, a reference implementation for
+    the paper ``Texture Defragmentation for Photo-Reconstructed 3D Models''
+    by Andrea Maggiordomo, Paolo Cignoni and Marco Tarini.
+
+    TextureDefrag is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    TextureDefrag is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with TextureDefrag. If not, see <https://www.gnu.org/licenses/>.
+*******************************************************************************/
+
+#ifndef TIFF_WRITER_H
+#define TIFF_WRITER_H
+
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+// Rows of the strips of the tiff files, the bands of an image encoded by
+// TIFFStreamEncoder start at multiples of it
+constexpr int TIFF_ROWS_PER_STRIP = 32;
+
+/* Encodes a 32-bit image stored as BGRA bytes (the memory layout of
+ * QImage::Format_ARGB32 on little-endian machines) as an 8-bit RGBA BigTIFF file
+ * (64-bit offsets, so the file is not limited to 4 GB). The strips are deflated
+ * independently, with the horizontal differencing predictor, on numThreads
+ * threads. level is the deflate level (0-9). Returns false if the encoding fails */
+bool EncodeTIFF(const unsigned char *bgra, int width, int height, std::size_t bytesPerLine,
+                int level, int numThreads, std::vector<unsigned char>& out);
+
+/* Encodes a BigTIFF image incrementally, in bands of consecutive rows stored top to
+ * bottom, like PNGStreamEncoder. Begin() returns the header, EncodeRows() deflates
+ * the strips of a band (different bands can be encoded concurrently), Append()
+ * returns the strips of an encoded band and must be called in row order, End()
+ * returns the image directory that follows the strips, and the header to write
+ * again over the one returned by Begin(), which now points to the directory */
+class TIFFStreamEncoder {
+
+public:
+
+    struct EncodedRows {
+        std::vector<unsigned char> deflated; // the strips of the band, concatenated
+        std::vector<uint64_t> stripBytes;
+        int rows = 0;
+    };
+
+    TIFFStreamEncoder(int width, int height, int level);
+
+    void Begin(std::vector<unsigned char>& out);
+
+    /* Encodes the rows [firstRow, firstRow + rows) stored in bgra. firstRow must be a
+     * multiple of TIFF_ROWS_PER_STRIP, and so must rows unless the band ends the image.
+     * The strips are deflated on numThreads threads */
+    bool EncodeRows(const unsigned char *bgra, std::size_t bytesPerLine, int firstRow, int rows,
+                    int numThreads, EncodedRows& encoded) const;
+
+    void Append(EncodedRows& encoded, std::vector<unsigned char>& out);
+
+    void End(std::vector<unsigned char>& out, std::vector<unsigned char>& header);
+
+private:
+
+    int width;
+    int height;
+    int level;
+    uint64_t offset = 0; // file offset of the next byte returned
+    std::vector<uint64_t> stripOffsets;
+    std::vector<uint64_t> stripBytes;
+};
+
+#endif // TIFF_WRITER_H
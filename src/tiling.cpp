@@ -0,0 +1,592 @@
+/*******************************************************************************
+    Copyright (c) 2021, Andrea Maggiordomo, Paolo Cignoni and Marco Tarini
+
+    This file is part of TextureDefrag, a reference implementation for
+    the paper ``Texture Defragmentation for Photo-Reconstructed 3D Models''
+    by Andrea Maggiordomo, Paolo Cignoni and Marco Tarini.
+
+    TextureDefrag is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    TextureDefrag is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with TextureDefrag. If not, see <https://www.gnu.org/licenses/>.
+*******************************************************************************/
+
+
+#include "tiling.h"
+#include "seam_remover.h"
+#include "mesh.h"
+#include "mesh_graph.h"
+#include "mesh_attribute.h"
+#include "derived_data.h"
+#include "logging.h"
+#include "utils.h"
+#include "memory_budget.h"
+#include "distributed.h"
+#include "run_report.h"
+
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <cstring>
+
+
+// coarse estimate of the memory used per face of a tile by its mesh copy, its seam
+// mesh and the state of its optimization
+constexpr long long TILE_BYTES_PER_FACE = 2048;
+
+static const uint64_t TILE_PLAN_MAGIC = 0x314e4c50454c4954ULL;   // "TILEPLN1"
+static const uint64_t TILE_RESULT_MAGIC = 0x3153455254454c54ULL; // "TLETRES1"
+
+/* Must be incremented whenever the layout of the plan or of the results change */
+static const uint64_t TILE_FORMAT_VERSION = 1;
+
+static const char *TILE_PLAN_FILE = "tiles.plan";
+
+/* The header of the plan is followed by the number of faces of each tile and by the
+ * face indices of the tiles. The token identifies the distributed job, the results
+ * of other jobs are rejected */
+struct TilePlanHeader {
+    uint64_t magic;
+    uint64_t version;
+    uint64_t token;
+    uint64_t vn;
+    uint64_t fn;
+    uint64_t numTiles;
+    uint64_t numFaces;
+};
+
+/* The header of a result is followed by the vertex records, the face records and
+ * the chart records of the tile */
+struct TileResultHeader {
+    uint64_t magic;
+    uint64_t version;
+    uint64_t token;
+    uint64_t tile;
+    uint64_t vn;
+    uint64_t fn;
+    uint64_t numCharts;
+};
+
+struct TileVertex {
+    double t[2];
+    int32_t tn;
+    int32_t pad;
+};
+
+/* v and ffp are indices of the vertices and faces of the tile, id is the chart id
+ * in the mesh */
+struct TileFace {
+    double wt[3][2];
+    int32_t v[3];
+    int32_t ffp[3];
+    int32_t id;
+    int16_t wtn[3];
+    int8_t ffi[3];
+    uint8_t changed;
+    uint8_t pad[2];
+};
+
+struct TileChartRecord {
+    int32_t id;
+    int32_t numMerges;
+};
+
+// the optimized tile, in the order of the faces of the tile and of its vertices
+// (see TileIndices)
+struct TileResult {
+    std::vector<TileVertex> vertices;
+    std::vector<TileFace> faces;
+    std::vector<TileChartRecord> charts;
+};
+
+struct TileChart {
+    ChartHandle chart;
+    vcg::Point3d centroid;
+};
+
+static void BisectTiles(std::vector<TileChart>& charts, int maxTileFaces, std::vector<std::vector<ChartHandle>>& tiles);
+static void TileIndices(Mesh& m, const std::vector<Mesh::FacePointer>& tile, std::vector<int>& faceMap, std::vector<int>& vertMap);
+static void OptimizeTile(Mesh& m, TextureObjectHandle textureObject, const std::vector<Mesh::FacePointer>& tile, const AlgoParameters& params,
+                         TileResult& result);
+static bool ApplyTile(Mesh& m, const std::vector<Mesh::FacePointer>& tile, const TileResult& result,
+                      ElementSet<MeshFace>& changeSet, std::map<RegionID, int>& numMerges);
+static AlgoParameters TileParameters(const AlgoParameters& params, std::size_t tileFaces, std::size_t meshFaces);
+static GraphHandle RebuildGraph(Mesh& m, TextureObjectHandle textureObject, const std::map<RegionID, int>& numMerges);
+static std::string TileName(std::size_t i);
+static bool WriteTilePlan(const WorkDirectory& dir, uint64_t token, Mesh& m, const std::vector<std::vector<Mesh::FacePointer>>& tileFaces);
+static bool ReadTilePlan(const WorkDirectory& dir, Mesh& m, uint64_t *token, std::vector<std::vector<Mesh::FacePointer>>& tileFaces);
+static bool WriteTileResult(const WorkDirectory& dir, uint64_t token, std::size_t tile, const TileResult& result);
+static bool ReadTileResult(const WorkDirectory& dir, uint64_t token, std::size_t tile, std::size_t fn, TileResult& result);
+
+
+AlgoStateHandle OptimizeTiles(GraphHandle& graph, const AlgoParameters& params, int maxTileFaces, const WorkDirectory *dir)
+{
+    ensure(maxTileFaces > 0);
+
+    // the optimization of a tile takes at most half of what is left of the memory budget
+    long long available = MemoryBudgetAvailable();
+    if (available >= 0) {
+        long long budgetFaces = std::max(1LL, available / 2 / TILE_BYTES_PER_FACE);
+        if (budgetFaces < maxTileFaces) {
+            LOG_INFO << "Tile size reduced to " << budgetFaces << " faces by the memory budget";
+            maxTileFaces = (int) budgetFaces;
+        }
+    }
+
+    Mesh& m = graph->mesh;
+    TextureObjectHandle textureObject = graph->textureObject;
+
+    std::vector<TileChart> charts;
+    for (const auto& entry : graph->charts) {
+        vcg::Point3d centroid = vcg::Point3d::Zero();
+        for (auto fptr : entry.second->fpVec)
+            centroid += vcg::Barycenter(*fptr);
+        charts.push_back({entry.second, centroid / (double) entry.second->FN()});
+    }
+
+    std::vector<std::vector<ChartHandle>> tiles;
+    BisectTiles(charts, maxTileFaces, tiles);
+    charts.clear();
+
+    LOG_INFO << "Optimizing the atlas in " << tiles.size() << " tiles of at most " << maxTileFaces << " faces";
+
+    AlgoStateHandle state = std::make_shared<AlgoState>();
+    state->changeSet.Bind(m.face);
+
+    // the tiles only reference the charts by their faces, the graph is released
+    // while the tiles are optimized
+    std::vector<std::vector<Mesh::FacePointer>> tileFaces(tiles.size());
+    for (unsigned i = 0; i < tiles.size(); ++i)
+        for (auto c : tiles[i])
+            tileFaces[i].insert(tileFaces[i].end(), c->fpVec.begin(), c->fpVec.end());
+    tiles.clear();
+    graph = nullptr;
+
+    // the tiles are published to the workers, and this process optimizes the ones
+    // it claims before collecting the results of the others
+    uint64_t token = 0;
+    if (dir) {
+        token = uint64_t(std::chrono::system_clock::now().time_since_epoch().count()) ^ (uint64_t(std::random_device()()) << 32);
+        if (!WriteTilePlan(*dir, token, m, tileFaces)) {
+            LOG_ERR << "Unable to write the plan of the tiles to " << dir->FilePath(TILE_PLAN_FILE) << ", optimizing the tiles locally";
+            dir = nullptr;
+        }
+    }
+
+    std::map<RegionID, int> numMerges;
+    std::vector<bool> applied(tileFaces.size(), false);
+    int claimed = 0;
+    for (unsigned i = 0; i < tileFaces.size(); ++i) {
+        if (dir && !dir->Claim(TileName(i)))
+            continue;
+        LOG_INFO << "Optimizing tile " << (i + 1) << "/" << tileFaces.size() << " (" << tileFaces[i].size() << " faces)";
+        TileResult result;
+        OptimizeTile(m, textureObject, tileFaces[i], TileParameters(params, tileFaces[i].size(), m.FN()), result);
+        ensure(ApplyTile(m, tileFaces[i], result, state->changeSet, numMerges));
+        applied[i] = true;
+        claimed++;
+        std::vector<Mesh::FacePointer>().swap(tileFaces[i]);
+    }
+
+    if (dir) {
+        LOG_INFO << "Optimized " << claimed << " of " << tileFaces.size() << " tiles, waiting for the workers";
+        ReportValue("optimization/tiles", "tiles", tileFaces.size());
+        ReportValue("optimization/tiles", "local", claimed);
+        for (unsigned i = 0; i < tileFaces.size(); ++i) {
+            if (applied[i])
+                continue;
+            dir->WaitFor({TileName(i) + ".result"});
+            TileResult result;
+            if (!ReadTileResult(*dir, token, i, tileFaces[i].size(), result) || !ApplyTile(m, tileFaces[i], result, state->changeSet, numMerges))
+                LOG_ERR << "The result of tile " << (i + 1) << " is not valid, the tile is not optimized";
+        }
+    }
+
+    graph = RebuildGraph(m, textureObject, numMerges);
+
+    return state;
+}
+
+AlgoStateHandle OptimizeRegion(GraphHandle& graph, const AlgoParameters& params, const std::vector<MeshFace *>& faces)
+{
+    Mesh& m = graph->mesh;
+    TextureObjectHandle textureObject = graph->textureObject;
+
+    AlgoStateHandle state = std::make_shared<AlgoState>();
+    state->changeSet.Bind(m.face);
+
+    std::map<RegionID, int> numMerges;
+    graph = nullptr;
+    if (!faces.empty()) {
+        TileResult result;
+        OptimizeTile(m, textureObject, faces, TileParameters(params, faces.size(), m.FN()), result);
+        ensure(ApplyTile(m, faces, result, state->changeSet, numMerges));
+    }
+
+    graph = RebuildGraph(m, textureObject, numMerges);
+
+    return state;
+}
+
+int OptimizeTilesWorker(Mesh& m, TextureObjectHandle textureObject, const AlgoParameters& params, const WorkDirectory& dir)
+{
+    uint64_t token;
+    std::vector<std::vector<Mesh::FacePointer>> tileFaces;
+    if (!ReadTilePlan(dir, m, &token, tileFaces)) {
+        LOG_ERR << "The plan of the tiles " << dir.FilePath(TILE_PLAN_FILE) << " does not match the prepared mesh";
+        return -1;
+    }
+
+    // the tiles are optimized on the prepared mesh, which the results do not change
+    int claimed = 0;
+    for (unsigned i = 0; i < tileFaces.size(); ++i) {
+        if (dir.Exists(TileName(i) + ".result") || !dir.Claim(TileName(i)))
+            continue;
+        LOG_INFO << "Optimizing tile " << (i + 1) << "/" << tileFaces.size() << " (" << tileFaces[i].size() << " faces)";
+        TileResult result;
+        OptimizeTile(m, textureObject, tileFaces[i], TileParameters(params, tileFaces[i].size(), m.FN()), result);
+        if (!WriteTileResult(dir, token, i, result)) {
+            LOG_ERR << "Unable to write the result of tile " << (i + 1);
+            return -1;
+        }
+        claimed++;
+    }
+    return claimed;
+}
+
+/* Splits the charts along the longest axis of the bounding box of their centroids
+ * until each tile has at most maxTileFaces faces, or a single chart */
+static void BisectTiles(std::vector<TileChart>& charts, int maxTileFaces, std::vector<std::vector<ChartHandle>>& tiles)
+{
+    std::size_t fn = 0;
+    vcg::Box3d box;
+    for (const auto& tc : charts) {
+        fn += tc.chart->FN();
+        box.Add(tc.centroid);
+    }
+
+    if (fn <= (std::size_t) maxTileFaces || charts.size() == 1) {
+        tiles.emplace_back();
+        for (const auto& tc : charts)
+            tiles.back().push_back(tc.chart);
+        return;
+    }
+
+    int axis = box.MaxDim();
+    std::sort(charts.begin(), charts.end(), [axis] (const TileChart& c1, const TileChart& c2) {
+        if (c1.centroid[axis] != c2.centroid[axis])
+            return c1.centroid[axis] < c2.centroid[axis];
+        return c1.chart->id < c2.chart->id;
+    });
+
+    // split at the median face
+    std::size_t cut = 0;
+    std::size_t n = 0;
+    while (cut < charts.size() - 1 && (cut == 0 || n + charts[cut].chart->FN() / 2 <= fn / 2))
+        n += charts[cut++].chart->FN();
+
+    std::vector<TileChart> second(charts.begin() + cut, charts.end());
+    charts.resize(cut);
+    BisectTiles(charts, maxTileFaces, tiles);
+    BisectTiles(second, maxTileFaces, tiles);
+}
+
+/* Indices in m of the faces and of the vertices of the tile, in the order of the
+ * faces and of the first reference to each vertex */
+static void TileIndices(Mesh& m, const std::vector<Mesh::FacePointer>& tile, std::vector<int>& faceMap, std::vector<int>& vertMap)
+{
+    std::vector<bool> visited(m.vert.size(), false);
+    faceMap.clear();
+    vertMap.clear();
+    faceMap.reserve(tile.size());
+    for (auto fptr : tile) {
+        faceMap.push_back(tri::Index(m, fptr));
+        for (int i = 0; i < 3; ++i) {
+            int vi = tri::Index(m, fptr->V(i));
+            if (!visited[vi]) {
+                visited[vi] = true;
+                vertMap.push_back(vi);
+            }
+        }
+    }
+}
+
+/* Copies the faces of the tile (with their vertices and attributes) in a mesh of
+ * their own, optimizes it and stores the tex coords, the vertex references, the
+ * FF topology and the chart ids of the optimized faces in the result */
+static void OptimizeTile(Mesh& m, TextureObjectHandle textureObject, const std::vector<Mesh::FacePointer>& tile, const AlgoParameters& params,
+                         TileResult& result)
+{
+    Mesh tm;
+    tm.name = m.name;
+
+    std::vector<int> faceMap; // index of the faces of tm in m
+    std::vector<int> vertMap; // index of the vertices of tm in m
+    TileIndices(m, tile, faceMap, vertMap);
+    std::vector<int> faceIndex(m.face.size(), -1); // index of the faces of m in tm
+    std::vector<int> vertIndex(m.vert.size(), -1); // index of the vertices of m in tm
+    for (unsigned i = 0; i < faceMap.size(); ++i)
+        faceIndex[faceMap[i]] = i;
+    for (unsigned i = 0; i < vertMap.size(); ++i)
+        vertIndex[vertMap[i]] = i;
+
+    tri::Allocator<Mesh>::AddVertices(tm, vertMap.size());
+    tri::Allocator<Mesh>::AddFaces(tm, faceMap.size());
+    for (unsigned i = 0; i < vertMap.size(); ++i)
+        tm.vert[i].ImportData(m.vert[vertMap[i]]);
+
+    auto ffadj = Get3DFaceAdjacencyAttribute(m);
+    auto wtcsa = GetWedgeTexCoordStorageAttribute(m);
+    auto tileffadj = Get3DFaceAdjacencyAttribute(tm);
+    auto tilewtcsa = GetWedgeTexCoordStorageAttribute(tm);
+    for (unsigned i = 0; i < faceMap.size(); ++i) {
+        MeshFace& f = m.face[faceMap[i]];
+        MeshFace& tf = tm.face[i];
+        tf.ImportData(f);
+        for (int k = 0; k < 3; ++k) {
+            tf.V(k) = &tm.vert[vertIndex[tri::Index(m, f.V(k))]];
+            // the seams towards faces of other tiles become mesh borders
+            int fk = faceIndex[ffadj[f].f[k]];
+            tileffadj[tf].f[k] = (fk != -1) ? fk : (int) i;
+            tileffadj[tf].e[k] = (fk != -1) ? ffadj[f].e[k] : k;
+        }
+        tilewtcsa[tf] = wtcsa[f];
+    }
+    RequireFaceFace(tm);
+
+    // the charts of the tile graph are the charts of the tile, with new ids
+    GraphHandle tileGraph = ComputeGraph(tm, textureObject);
+    std::vector<RegionID> globalId(tileGraph->charts.size(), INVALID_ID);
+    for (unsigned i = 0; i < faceMap.size(); ++i)
+        globalId[tm.face[i].initialId] = m.face[faceMap[i]].id;
+
+    AlgoStateHandle tileState = InitializeState(tileGraph, params);
+    GreedyOptimization(tileGraph, tileState, params);
+
+    result.vertices.resize(vertMap.size());
+    for (unsigned i = 0; i < vertMap.size(); ++i) {
+        TileVertex& r = result.vertices[i];
+        r.t[0] = tm.vert[i].T().U();
+        r.t[1] = tm.vert[i].T().V();
+        r.tn = tm.vert[i].T().N();
+        r.pad = 0;
+    }
+    result.faces.resize(faceMap.size());
+    for (unsigned i = 0; i < faceMap.size(); ++i) {
+        MeshFace& tf = tm.face[i];
+        TileFace& r = result.faces[i];
+        for (int k = 0; k < 3; ++k) {
+            r.wt[k][0] = tf.WT(k).U();
+            r.wt[k][1] = tf.WT(k).V();
+            r.wtn[k] = tf.WT(k).N();
+            r.v[k] = tri::Index(tm, tf.V(k));
+            r.ffp[k] = tri::Index(tm, tf.FFp(k));
+            r.ffi[k] = tf.FFi(k);
+        }
+        r.id = globalId[tf.id];
+        r.changed = 0;
+    }
+    for (auto fptr : tileState->changeSet)
+        result.faces[tri::Index(tm, fptr)].changed = 1;
+    result.charts.clear();
+    for (const auto& entry : tileGraph->charts)
+        result.charts.push_back({ globalId[entry.first], entry.second->numMerges });
+}
+
+/* Writes the tex coords, the vertex references, the FF topology and the chart ids
+ * of the optimized faces of the tile back to m. Returns false, leaving m untouched,
+ * if the result does not match the vertices of the tile */
+static bool ApplyTile(Mesh& m, const std::vector<Mesh::FacePointer>& tile, const TileResult& result,
+                      ElementSet<MeshFace>& changeSet, std::map<RegionID, int>& numMerges)
+{
+    std::vector<int> faceMap;
+    std::vector<int> vertMap;
+    TileIndices(m, tile, faceMap, vertMap);
+    if (faceMap.size() != result.faces.size() || vertMap.size() != result.vertices.size())
+        return false;
+
+    for (unsigned i = 0; i < vertMap.size(); ++i) {
+        const TileVertex& r = result.vertices[i];
+        m.vert[vertMap[i]].T() = MeshVertex::TexCoordType(r.t[0], r.t[1]);
+        m.vert[vertMap[i]].T().N() = r.tn;
+    }
+    for (unsigned i = 0; i < faceMap.size(); ++i) {
+        MeshFace& f = m.face[faceMap[i]];
+        const TileFace& r = result.faces[i];
+        for (int k = 0; k < 3; ++k) {
+            f.WT(k) = MeshFace::TexCoordType(r.wt[k][0], r.wt[k][1]);
+            f.WT(k).N() = r.wtn[k];
+            f.V(k) = &m.vert[vertMap[r.v[k]]];
+            f.FFp(k) = &m.face[faceMap[r.ffp[k]]];
+            f.FFi(k) = r.ffi[k];
+        }
+        f.id = r.id;
+        if (r.changed)
+            changeSet.insert(&f);
+    }
+    for (const TileChartRecord& r : result.charts)
+        numMerges[r.id] = r.numMerges;
+    return true;
+}
+
+static AlgoParameters TileParameters(const AlgoParameters& params, std::size_t tileFaces, std::size_t meshFaces)
+{
+    AlgoParameters tileParams = params;
+    tileParams.checkpointInterval = 0;
+    tileParams.checkpointFile = "";
+    tileParams.moveLogFile = "";
+    if (params.timelimit > 0)
+        tileParams.timelimit = params.timelimit * tileFaces / (double) meshFaces;
+    return tileParams;
+}
+
+/* Rebuilds the graph from the chart ids of the faces */
+static GraphHandle RebuildGraph(Mesh& m, TextureObjectHandle textureObject, const std::map<RegionID, int>& numMerges)
+{
+    GraphHandle graph = std::make_shared<MeshGraph>(m);
+    graph->textureObject = textureObject;
+    for (auto& f : m.face)
+        graph->GetChart_Insert(f.id)->AddFace(&f);
+    ComputeChartAdjacency(*graph);
+    for (const auto& entry : numMerges)
+        graph->GetChart(entry.first)->numMerges = entry.second;
+
+    // the merges of the tiles replaced vertex references
+    InvalidateDerivedData(m, DERIVED_VERTEX_FACE | DERIVED_NORMALS);
+
+    return graph;
+}
+
+static std::string TileName(std::size_t i)
+{
+    return "tile_" + std::to_string(i);
+}
+
+static bool WriteTilePlan(const WorkDirectory& dir, uint64_t token, Mesh& m, const std::vector<std::vector<Mesh::FacePointer>>& tileFaces)
+{
+    TilePlanHeader header;
+    std::memset(&header, 0, sizeof(header));
+    header.magic = TILE_PLAN_MAGIC;
+    header.version = TILE_FORMAT_VERSION;
+    header.token = token;
+    header.vn = m.vert.size();
+    header.fn = m.face.size();
+    header.numTiles = tileFaces.size();
+
+    std::vector<int64_t> sizes;
+    std::vector<int32_t> faces;
+    for (const auto& tile : tileFaces) {
+        sizes.push_back(tile.size());
+        for (auto fptr : tile)
+            faces.push_back((int32_t) tri::Index(m, fptr));
+    }
+    header.numFaces = faces.size();
+
+    std::vector<char> data(sizeof(header) + sizes.size() * sizeof(int64_t) + faces.size() * sizeof(int32_t));
+    char *p = data.data();
+    std::memcpy(p, &header, sizeof(header));
+    p += sizeof(header);
+    std::memcpy(p, sizes.data(), sizes.size() * sizeof(int64_t));
+    p += sizes.size() * sizeof(int64_t);
+    std::memcpy(p, faces.data(), faces.size() * sizeof(int32_t));
+    return dir.WriteFile(TILE_PLAN_FILE, data.data(), data.size());
+}
+
+static bool ReadTilePlan(const WorkDirectory& dir, Mesh& m, uint64_t *token, std::vector<std::vector<Mesh::FacePointer>>& tileFaces)
+{
+    std::vector<char> data;
+    if (!dir.ReadFile(TILE_PLAN_FILE, data) || data.size() < sizeof(TilePlanHeader))
+        return false;
+
+    TilePlanHeader header;
+    std::memcpy(&header, data.data(), sizeof(header));
+    if (header.magic != TILE_PLAN_MAGIC || header.version != TILE_FORMAT_VERSION || header.vn != m.vert.size() || header.fn != m.face.size()
+            || header.numTiles > header.fn || header.numFaces > header.fn
+            || data.size() != sizeof(header) + header.numTiles * sizeof(int64_t) + header.numFaces * sizeof(int32_t))
+        return false;
+
+    std::vector<int64_t> sizes(header.numTiles);
+    std::vector<int32_t> faces(header.numFaces);
+    std::memcpy(sizes.data(), data.data() + sizeof(header), sizes.size() * sizeof(int64_t));
+    std::memcpy(faces.data(), data.data() + sizeof(header) + sizes.size() * sizeof(int64_t), faces.size() * sizeof(int32_t));
+
+    tileFaces.assign(header.numTiles, {});
+    std::size_t first = 0;
+    for (std::size_t i = 0; i < sizes.size(); ++i) {
+        if (sizes[i] <= 0 || uint64_t(sizes[i]) > faces.size() - first)
+            return false;
+        for (std::size_t k = first; k < first + sizes[i]; ++k) {
+            if (faces[k] < 0 || faces[k] >= (int32_t) m.face.size())
+                return false;
+            tileFaces[i].push_back(&m.face[faces[k]]);
+        }
+        first += sizes[i];
+    }
+    *token = header.token;
+    return first == faces.size();
+}
+
+static bool WriteTileResult(const WorkDirectory& dir, uint64_t token, std::size_t tile, const TileResult& result)
+{
+    TileResultHeader header;
+    std::memset(&header, 0, sizeof(header));
+    header.magic = TILE_RESULT_MAGIC;
+    header.version = TILE_FORMAT_VERSION;
+    header.token = token;
+    header.tile = tile;
+    header.vn = result.vertices.size();
+    header.fn = result.faces.size();
+    header.numCharts = result.charts.size();
+
+    const std::size_t vertexBytes = result.vertices.size() * sizeof(TileVertex);
+    const std::size_t faceBytes = result.faces.size() * sizeof(TileFace);
+    const std::size_t chartBytes = result.charts.size() * sizeof(TileChartRecord);
+    std::vector<char> data(sizeof(header) + vertexBytes + faceBytes + chartBytes);
+    char *p = data.data();
+    std::memcpy(p, &header, sizeof(header));
+    std::memcpy(p + sizeof(header), result.vertices.data(), vertexBytes);
+    std::memcpy(p + sizeof(header) + vertexBytes, result.faces.data(), faceBytes);
+    std::memcpy(p + sizeof(header) + vertexBytes + faceBytes, result.charts.data(), chartBytes);
+    return dir.WriteFile(TileName(tile) + ".result", data.data(), data.size());
+}
+
+static bool ReadTileResult(const WorkDirectory& dir, uint64_t token, std::size_t tile, std::size_t fn, TileResult& result)
+{
+    std::vector<char> data;
+    if (!dir.ReadFile(TileName(tile) + ".result", data) || data.size() < sizeof(TileResultHeader))
+        return false;
+
+    TileResultHeader header;
+    std::memcpy(&header, data.data(), sizeof(header));
+    if (header.magic != TILE_RESULT_MAGIC || header.version != TILE_FORMAT_VERSION || header.token != token || header.tile != tile
+            || header.fn != fn || header.vn > 3 * fn || header.numCharts > fn
+            || data.size() != sizeof(header) + header.vn * sizeof(TileVertex) + header.fn * sizeof(TileFace) + header.numCharts * sizeof(TileChartRecord))
+        return false;
+
+    result.vertices.resize(header.vn);
+    result.faces.resize(header.fn);
+    result.charts.resize(header.numCharts);
+    const char *p = data.data() + sizeof(header);
+    std::memcpy(result.vertices.data(), p, result.vertices.size() * sizeof(TileVertex));
+    p += result.vertices.size() * sizeof(TileVertex);
+    std::memcpy(result.faces.data(), p, result.faces.size() * sizeof(TileFace));
+    p += result.faces.size() * sizeof(TileFace);
+    std::memcpy(result.charts.data(), p, result.charts.size() * sizeof(TileChartRecord));
+
+    // the indices must be within the tile
+    for (const TileFace& r : result.faces)
+        for (int k = 0; k < 3; ++k)
+            if (r.v[k] < 0 || uint64_t(r.v[k]) >= header.vn || r.ffp[k] < 0 || uint64_t(r.ffp[k]) >= header.fn || r.ffi[k] < 0 || r.ffi[k] > 2)
+                return false;
+    return true;
+}
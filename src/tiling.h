@@ -0,0 +1,60 @@
+/*******************************************************************************
+    Copyright (c) 2021, Andrea Maggiordomo, Paolo Cignoni and Marco Tarini
+
+    This file is part of TextureDefrag, a reference implementation for
+    the paper ``Texture Defragmentation for Photo-Reconstructed 3D Models''
+    by Andrea Maggiordomo, Paolo Cignoni and Marco Tarini.
+
+    TextureDefrag is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    TextureDefrag is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with TextureDefrag. If not, see <https://www.gnu.org/licenses/>.
+*******************************************************************************/
+
+
+#ifndef TILING_H
+#define TILING_H
+
+#include "types.h"
+
+#include <vector>
+
+struct AlgoParameters;
+class WorkDirectory;
+
+/* Tiled processing of the greedy optimization for large meshes. The charts of the
+ * prepared mesh are split in tiles of at most maxTileFaces faces (charts are never
+ * split, so the extents of the tiles overlap) by recursive bisection of the chart
+ * centroids. Each tile is copied in a mesh of its own, where the seams towards the
+ * charts of the other tiles are frozen as mesh borders, and is optimized by
+ * InitializeState() and GreedyOptimization(). The results are written back to the
+ * mesh before the next tile is processed, so the memory used by the optimization
+ * (seam mesh, state, move data) is bounded by the size of the tiles. On return the
+ * graph is rebuilt from the optimized charts, and the returned state only holds
+ * the set of faces changed by the optimization */
+AlgoStateHandle OptimizeTiles(GraphHandle& graph, const AlgoParameters& params, int maxTileFaces, const WorkDirectory *dir = nullptr);
+
+/* Optimizes the charts of the given faces as a single tile, the seams towards the
+ * other charts are frozen as mesh borders and the other charts are left unchanged
+ * (see incremental.h). The graph is rebuilt as by OptimizeTiles, the number of
+ * merges of the charts outside the tile is reset */
+AlgoStateHandle OptimizeRegion(GraphHandle& graph, const AlgoParameters& params, const std::vector<MeshFace *>& faces);
+
+/* With a work directory (see distributed.h), OptimizeTiles writes the faces of the
+ * tiles to it and only optimizes the tiles it claims, the others are optimized by
+ * the workers and their results are read back from the directory. The worker side
+ * reads the tiles of the prepared mesh m (loaded from the snapshot published in
+ * the directory) and optimizes the tiles it claims, writing their results. The
+ * workers leave m unchanged. Returns the number of tiles optimized, -1 if the tiles
+ * do not match m or a result cannot be written */
+int OptimizeTilesWorker(Mesh& m, TextureObjectHandle textureObject, const AlgoParameters& params, const WorkDirectory& dir);
+
+#endif // TILING_H
@@ -0,0 +1,215 @@
+/*******************************************************************************
+    Copyright (c) 2021, Andrea Maggiordomo, Paolo Cignoni and Marco Tarini
+
+    This file is part of TextureDefrag, a reference implementation for
+    the paper ``Texture Defragmentation for Photo-Reconstructed 3D Models''
+    by Andrea Maggiordomo, Paolo Cignoni and Marco Tarini.
+
+    TextureDefrag is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    TextureDefrag is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with TextureDefrag. If not, see <https://www.gnu.org/licenses/>.
+*******************************************************************************/
+
+
+
+#include "trace.h"
+#include "logging.h"
+#include "utils.h"
+
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <algorithm>
+#include <map>
+
+
+namespace {
+
+struct TraceEvent {
+    const char *name;
+    const char *category;
+    int64_t t0; // nanoseconds since the trace epoch
+    int64_t t1;
+};
+
+struct ThreadTrace {
+    int tid;
+    std::string threadName;
+    std::vector<TraceEvent> ring;
+    std::atomic<uint64_t> count{0}; // total number of spans recorded by the thread
+};
+
+std::atomic<bool> enabled(false);
+std::size_t ringSize = 0;
+std::chrono::steady_clock::time_point epoch;
+
+std::mutex registryMtx;
+std::vector<std::unique_ptr<ThreadTrace>> registry;
+std::map<std::string, ThreadTrace *> tracks; // the tracks of RecordTraceSpan, in the registry
+
+thread_local ThreadTrace *threadTrace = nullptr;
+
+inline int64_t Now()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - epoch).count();
+}
+
+// the buffers are owned by the registry, so that the spans of the threads that
+// terminated before the trace is written are not lost. registryMtx must be held
+ThreadTrace *AddTrace(const std::string& name)
+{
+    std::unique_ptr<ThreadTrace> tt(new ThreadTrace);
+    tt->threadName = name;
+    tt->ring.resize(ringSize);
+    tt->tid = (int) registry.size();
+    registry.push_back(std::move(tt));
+    return registry.back().get();
+}
+
+ThreadTrace *RegisterThread()
+{
+    std::string name = LOG_GET_THREAD_NAME;
+    std::lock_guard<std::mutex> lock(registryMtx);
+    return AddTrace(name);
+}
+
+void Append(ThreadTrace *tt, const char *name, const char *category, int64_t t0, int64_t t1)
+{
+    uint64_t n = tt->count.load(std::memory_order_relaxed);
+    tt->ring[n % ringSize] = { name, category, t0, t1 };
+    tt->count.store(n + 1, std::memory_order_release);
+}
+
+void Record(const char *name, const char *category, int64_t t0, int64_t t1)
+{
+    if (threadTrace == nullptr)
+        threadTrace = RegisterThread();
+    Append(threadTrace, name, category, t0, t1);
+}
+
+void WriteJSONString(std::ostream& os, const std::string& s)
+{
+    os << '"';
+    for (char c : s) {
+        if (c == '"' || c == '\\')
+            os << '\\' << c;
+        else if ((unsigned char) c < 0x20)
+            os << ' ';
+        else
+            os << c;
+    }
+    os << '"';
+}
+
+} // namespace
+
+void EnableTracing(std::size_t spansPerThread)
+{
+    ensure(spansPerThread > 0);
+    ringSize = spansPerThread;
+    epoch = std::chrono::steady_clock::now();
+    enabled = true;
+}
+
+bool TracingEnabled()
+{
+    return enabled.load(std::memory_order_relaxed);
+}
+
+int64_t TraceClock()
+{
+    return Now();
+}
+
+void RecordTraceSpan(const std::string& track, const char *name, const char *category, int64_t t0, int64_t t1)
+{
+    if (!TracingEnabled() || t0 < 0 || t1 < t0)
+        return;
+    // the tracks are shared by the threads, their spans are recorded under the lock
+    std::lock_guard<std::mutex> lock(registryMtx);
+    ThreadTrace *& tt = tracks[track];
+    if (tt == nullptr)
+        tt = AddTrace(track);
+    Append(tt, name, category, t0, t1);
+}
+
+bool WriteTrace(const std::string& path)
+{
+    std::ofstream os(path);
+    if (!os)
+        return false;
+
+    std::lock_guard<std::mutex> lock(registryMtx);
+    os << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+    bool first = true;
+    uint64_t dropped = 0;
+    for (const auto& tt : registry) {
+        if (!first)
+            os << ",\n";
+        first = false;
+        os << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << tt->tid << ",\"args\":{\"name\":";
+        WriteJSONString(os, tt->threadName);
+        os << "}}";
+        uint64_t n = tt->count.load(std::memory_order_acquire);
+        uint64_t begin = (n > ringSize) ? n - ringSize : 0;
+        dropped += begin;
+        for (uint64_t i = begin; i < n; ++i) {
+            const TraceEvent& e = tt->ring[i % ringSize];
+            // timestamps and durations are in microseconds
+            os << ",\n{\"name\":";
+            WriteJSONString(os, e.name);
+            os << ",\"cat\":";
+            WriteJSONString(os, e.category);
+            os << ",\"ph\":\"X\",\"pid\":1,\"tid\":" << tt->tid
+               << ",\"ts\":" << (e.t0 / 1000) << "." << (e.t0 % 1000 / 100)
+               << ",\"dur\":" << ((e.t1 - e.t0) / 1000) << "." << ((e.t1 - e.t0) % 1000 / 100) << "}";
+        }
+    }
+    os << "\n]}\n";
+
+    if (dropped > 0)
+        LOG_WARN << "[TRACE] " << dropped << " spans were overwritten in the per-thread buffers";
+    LOG_INFO << "[TRACE] Recorded the spans of " << registry.size() << " threads";
+
+    return bool(os);
+}
+
+TraceSpan::TraceSpan(const char *name, const char *category)
+    : name{name}, category{category}, t0{-1}
+{
+    if (TracingEnabled())
+        t0 = Now();
+}
+
+TraceSpan::~TraceSpan()
+{
+    End();
+}
+
+void TraceSpan::End()
+{
+    if (t0 >= 0) {
+        Record(name, category, t0, Now());
+        t0 = -1;
+    }
+}
+
+void TraceSpan::Next(const char *nextName)
+{
+    End();
+    name = nextName;
+    if (TracingEnabled())
+        t0 = Now();
+}
@@ -0,0 +1,84 @@
+/*******************************************************************************
+    Copyright (c) 2021, Andrea Maggiordomo, Paolo Cignoni and Marco Tarini
+
+    This file is part of TextureDefrag, a reference implementation for
+    the paper ``Texture Defragmentation for Photo-Reconstructed 3D Models''
+    by Andrea Maggiordomo, Paolo Cignoni and Marco Tarini.
+
+    TextureDefrag is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    TextureDefrag is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with TextureDefrag. If not, see <https://www.gnu.org/licenses/>.
+*******************************************************************************/
+
+
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <string>
+#include <cstdint>
+#include <cstddef>
+
+/* Scoped spans of the execution, exported as Chrome trace JSON (which can be
+ * loaded in chrome://tracing and in Perfetto). Each thread records its spans in a
+ * ring buffer of its own, allocated and registered the first time the thread
+ * records a span, so that recording takes no locks. The names and categories of
+ * the spans are not copied and must be string literals. When tracing is disabled
+ * a span only tests a flag */
+
+/* Enables the recording of the spans, keeping the last spansPerThread spans
+ * of each thread */
+void EnableTracing(std::size_t spansPerThread);
+
+bool TracingEnabled();
+
+/* Nanoseconds since tracing was enabled, the clock of the recorded spans */
+int64_t TraceClock();
+
+/* Records a span measured by other means (such as GPU timer queries), between the
+ * trace clock times t0 and t1, on the track of the given name. The tracks are shown
+ * as threads of their own, and may be recorded by any thread */
+void RecordTraceSpan(const std::string& track, const char *name, const char *category, int64_t t0, int64_t t1);
+
+/* Writes the spans recorded so far. Must be called when no thread records spans */
+bool WriteTrace(const std::string& path);
+
+/* Records the span from construction to End() or destruction */
+class TraceSpan {
+
+public:
+
+    explicit TraceSpan(const char *name, const char *category = "defrag");
+    ~TraceSpan();
+
+    TraceSpan(const TraceSpan&) = delete;
+    TraceSpan& operator=(const TraceSpan&) = delete;
+
+    void End();
+
+    /* Ends the span and starts a new one, to trace consecutive phases */
+    void Next(const char *nextName);
+
+private:
+
+    const char *name;
+    const char *category;
+    int64_t t0;
+};
+
+#define TRACE_CONCAT_(a, b) a ## b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+
+#define TRACE_SCOPE(name) TraceSpan TRACE_CONCAT(trace_span_, __LINE__)(name)
+#define TRACE_SCOPE_CAT(name, category) TraceSpan TRACE_CONCAT(trace_span_, __LINE__)(name, category)
+
+#endif // TRACE_H
@@ -26,6 +26,8 @@
 #include <vector>
 #include <vcg/space/point2.h>
 
+#include "pool_ptr.h"
+
 class Mesh;
 class MeshVertex;
 class MeshFace;
@@ -49,8 +51,8 @@ class ClusteredSeam;
 typedef std::shared_ptr<MeshGraph>       GraphHandle;
 typedef std::shared_ptr<FaceGroup>       ChartHandle;
 typedef std::shared_ptr<TextureObject>   TextureObjectHandle;
-typedef std::shared_ptr<Seam>            SeamHandle;
-typedef std::shared_ptr<ClusteredSeam>   ClusteredSeamHandle;
+typedef PoolPtr<Seam>                    SeamHandle;
+typedef PoolPtr<ClusteredSeam>           ClusteredSeamHandle;
 typedef std::shared_ptr<AlgoState>       AlgoStateHandle;
 typedef std::shared_ptr<const AlgoState> ConstAlgoStateHandle;
 
@@ -22,6 +22,8 @@
 #ifndef UTILS_H
 #define UTILS_H
 
+#include "logging.h"
+
 #include <cstdlib>
 #include <iostream>
 
@@ -33,6 +35,8 @@
 [[ noreturn ]]
 inline void ensure_fail(const char *expr, const char *filename, unsigned int line)
 {
+    // the messages queued by the asynchronous logger are written before aborting
+    logging::Logger::Flush();
     std::cerr << filename << " (line " << line << "): Failed check `" << expr << "'" << std::endl;
     std::abort();
 }
@@ -0,0 +1,298 @@
+/*******************************************************************************
+    Copyright (c) 2021, Andrea Maggiordomo, Paolo Cignoni and Marco Tarini
+
+    This file is part of TextureDefrag, a reference implementation for
+    the paper ``Texture Defragmentation for Photo-Reconstructed 3D Models''
+    by Andrea Maggiordomo, Paolo Cignoni and Marco Tarini.
+
+    TextureDefrag is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    TextureDefrag is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with TextureDefrag. If not, see <https://www.gnu.org/licenses/>.
+*******************************************************************************/
+
+
+#include "validation.h"
+#include "mesh_graph.h"
+#include "logging.h"
+#include "timer.h"
+#include "run_report.h"
+
+#include <vcg/simplex/face/topology.h>
+
+#include <vector>
+#include <memory>
+#include <algorithm>
+
+#include <omp.h>
+
+
+namespace {
+
+// face pointers checked per chart at the fast level
+constexpr int FAST_SAMPLES_PER_CHART = 8;
+
+/* Face-vertex and face-face adjacency of the mesh as flat arrays of indices, the
+ * vertices of the deleted faces are -1 */
+struct FlatTopology {
+    int vn = 0;
+    std::vector<int> fv;
+    std::vector<int> ff;
+    std::vector<char> ffi;
+};
+
+struct Snapshot {
+    ValidationReport report;
+    FlatTopology topology;
+    Timer t;
+};
+
+// index of the face in the mesh, -1 if the pointer is null, deleted or not in the mesh
+int FaceIndex(const Mesh& m, const MeshFace *fptr)
+{
+    if (fptr == nullptr || m.face.empty())
+        return -1;
+    const MeshFace *first = &m.face.front();
+    if (fptr < first || fptr >= first + m.face.size())
+        return -1;
+    return fptr->IsD() ? -1 : int(fptr - first);
+}
+
+void CheckCharts(Mesh& m, const std::vector<ChartHandle>& charts, ValidationLevel level, ValidationReport& report)
+{
+    int nullCharts = 0;
+    int emptyCharts = 0;
+    int checkedFaces = 0;
+    int invalidFaces = 0;
+    int nonManifoldEdges = 0;
+    #pragma omp parallel for schedule(dynamic, 64) reduction(+:nullCharts, emptyCharts, checkedFaces, invalidFaces, nonManifoldEdges)
+    for (int i = 0; i < (int) charts.size(); ++i) {
+        const ChartHandle& chart = charts[i];
+        if (chart == nullptr) {
+            nullCharts++;
+            continue;
+        }
+        const std::vector<Mesh::FacePointer>& fpVec = chart->fpVec;
+        if (fpVec.empty()) {
+            emptyCharts++;
+            continue;
+        }
+        int n = (int) fpVec.size();
+        int step = (level == ValidationLevel::Full) ? 1 : std::max(1, n / FAST_SAMPLES_PER_CHART);
+        for (int j = 0; j < n; j += step) {
+            checkedFaces++;
+            if (FaceIndex(m, fpVec[j]) == -1) {
+                invalidFaces++;
+            } else if (level == ValidationLevel::Fast) {
+                for (int k = 0; k < 3; ++k)
+                    if (!vcg::face::IsManifold(*fpVec[j], k))
+                        nonManifoldEdges++;
+            }
+        }
+    }
+    report.nullCharts = nullCharts;
+    report.emptyCharts = emptyCharts;
+    report.checkedFaces = checkedFaces;
+    report.invalidFaces = invalidFaces;
+    report.nonManifoldEdges = nonManifoldEdges;
+}
+
+void CopyTopology(Mesh& m, FlatTopology& topology)
+{
+    const int fn = (int) m.face.size();
+    topology.vn = (int) m.vert.size();
+    topology.fv.resize(3 * fn);
+    topology.ff.resize(3 * fn);
+    topology.ffi.resize(3 * fn);
+    #pragma omp parallel for
+    for (int fi = 0; fi < fn; ++fi) {
+        const MeshFace& f = m.face[fi];
+        for (int k = 0; k < 3; ++k) {
+            topology.fv[3 * fi + k] = f.IsD() ? -1 : int(f.cV(k) - &m.vert.front());
+            topology.ff[3 * fi + k] = f.IsD() ? fi : FaceIndex(m, f.cFFp(k));
+            topology.ffi[3 * fi + k] = f.IsD() ? k : f.cFFi(k);
+        }
+    }
+}
+
+bool IsManifoldEdge(const FlatTopology& topology, int f, int e)
+{
+    int g = topology.ff[3 * f + e];
+    return g == f || (g != -1 && topology.ff[3 * g + topology.ffi[3 * f + e]] == f);
+}
+
+int Corner(const FlatTopology& topology, int f, int v)
+{
+    for (int k = 0; k < 3; ++k)
+        if (topology.fv[3 * f + k] == v)
+            return k;
+    return -1;
+}
+
+/* Number of faces of the fan of v reached from the face f crossing the edges incident
+ * to v, first in one direction and, if a border is met, in the other. Returns -1 if
+ * the adjacency is inconsistent or the walk exceeds maxFaces */
+int StarSize(const FlatTopology& topology, int f, int v, int maxFaces)
+{
+    int count = 1;
+    for (int dir = 0; dir < 2; ++dir) {
+        int cur = f;
+        int c = Corner(topology, f, v);
+        int e = (dir == 0) ? c : (c + 2) % 3;
+        while (true) {
+            int g = topology.ff[3 * cur + e];
+            if (g == cur)
+                break;
+            if (g == f)
+                return count;
+            int ge = topology.ffi[3 * cur + e];
+            int gc = Corner(topology, g, v);
+            if (gc == -1 || ++count > maxFaces)
+                return -1;
+            e = (ge == gc) ? (gc + 2) % 3 : gc;
+            cur = g;
+        }
+    }
+    return count;
+}
+
+/* Counts the vertices whose faces are not all reached walking around the vertex,
+ * skipping the ones on non-manifold edges (as CountNonManifoldVertexFF) */
+int CountNonManifoldVertices(const FlatTopology& topology)
+{
+    // corners of each vertex
+    const int fn = (int) topology.fv.size() / 3;
+    std::vector<int> cornerPtr(topology.vn + 1, 0);
+    for (int v : topology.fv)
+        if (v != -1)
+            cornerPtr[v + 1]++;
+    for (int v = 0; v < topology.vn; ++v)
+        cornerPtr[v + 1] += cornerPtr[v];
+    std::vector<int> corners(cornerPtr[topology.vn]);
+    std::vector<int> fill(cornerPtr.begin(), cornerPtr.end() - 1);
+    for (int i = 0; i < 3 * fn; ++i)
+        if (topology.fv[i] != -1)
+            corners[fill[topology.fv[i]]++] = i;
+
+    int count = 0;
+    #pragma omp parallel for schedule(dynamic, 1024) reduction(+:count)
+    for (int v = 0; v < topology.vn; ++v) {
+        int begin = cornerPtr[v];
+        int end = cornerPtr[v + 1];
+        if (begin == end)
+            continue;
+        bool onNonManifoldEdge = false;
+        for (int i = begin; i < end && !onNonManifoldEdge; ++i) {
+            int f = corners[i] / 3;
+            int k = corners[i] % 3;
+            onNonManifoldEdge = !IsManifoldEdge(topology, f, k) || !IsManifoldEdge(topology, f, (k + 2) % 3);
+        }
+        if (!onNonManifoldEdge && StarSize(topology, corners[begin] / 3, v, end - begin) != end - begin)
+            count++;
+    }
+    return count;
+}
+
+std::shared_ptr<Snapshot> TakeSnapshot(GraphHandle graph, ValidationLevel level)
+{
+    std::shared_ptr<Snapshot> snapshot = std::make_shared<Snapshot>();
+    ValidationReport& report = snapshot->report;
+    report.level = level;
+    if (level == ValidationLevel::Off)
+        return snapshot;
+
+    std::vector<ChartHandle> charts;
+    charts.reserve(graph->charts.size());
+    for (auto& entry : graph->charts)
+        charts.push_back(entry.second);
+    report.charts = (int) charts.size();
+
+    CheckCharts(graph->mesh, charts, level, report);
+    if (level == ValidationLevel::Full)
+        CopyTopology(graph->mesh, snapshot->topology);
+    return snapshot;
+}
+
+ValidationReport Complete(std::shared_ptr<Snapshot> snapshot)
+{
+    ValidationReport report = snapshot->report;
+    if (report.level == ValidationLevel::Full) {
+        report.nonManifoldVertices = CountNonManifoldVertices(snapshot->topology);
+        snapshot->topology = FlatTopology();
+    }
+    report.seconds = snapshot->t.TimeElapsed();
+    return report;
+}
+
+} // namespace
+
+
+bool ParseValidationLevel(const std::string& s, ValidationLevel *level, bool *async)
+{
+    *async = false;
+    if (s == "off")
+        *level = ValidationLevel::Off;
+    else if (s == "fast")
+        *level = ValidationLevel::Fast;
+    else if (s == "full")
+        *level = ValidationLevel::Full;
+    else if (s == "async") {
+        *level = ValidationLevel::Full;
+        *async = true;
+    } else
+        return false;
+    return true;
+}
+
+ValidationReport ValidateIntegrity(GraphHandle graph, ValidationLevel level)
+{
+    return Complete(TakeSnapshot(graph, level));
+}
+
+std::future<ValidationReport> ValidateIntegrityAsync(GraphHandle graph, ValidationLevel level)
+{
+    std::shared_ptr<Snapshot> snapshot = TakeSnapshot(graph, level);
+    return std::async(std::launch::async, [snapshot]() { return Complete(snapshot); });
+}
+
+void LogValidationReport(const ValidationReport& report)
+{
+    if (report.level == ValidationLevel::Off)
+        return;
+
+    if (report.nullCharts > 0)
+        LOG_ERR << "[VALIDATION] CRITICAL: Found " << report.nullCharts << " null chart handles in graph!";
+    if (report.invalidFaces > 0)
+        LOG_ERR << "[VALIDATION] CRITICAL: Found " << report.invalidFaces << " invalid face pointers in the charts!";
+    if (report.emptyCharts > 0)
+        LOG_WARN << "[VALIDATION] Found " << report.emptyCharts << " charts with zero faces.";
+    if (report.nonManifoldEdges > 0)
+        LOG_WARN << "[VALIDATION] Found " << report.nonManifoldEdges << " non-manifold edges on the sampled faces.";
+    if (report.nonManifoldVertices > 0)
+        LOG_WARN << "[VALIDATION] Mesh has " << report.nonManifoldVertices << " non-manifold vertices after optimization.";
+
+    bool passed = (report.nullCharts == 0 && report.invalidFaces == 0 && report.nonManifoldEdges == 0 && report.nonManifoldVertices <= 0);
+    if (passed)
+        LOG_INFO << "[VALIDATION] " << (report.level == ValidationLevel::Full ? "Mesh is manifold. " : "")
+                 << "Integrity check passed (" << report.checkedFaces << " face pointers checked in " << report.seconds << " seconds).";
+
+    const char *section = "validation";
+    ReportValue(section, "level", report.level == ValidationLevel::Full ? "full" : "fast");
+    ReportValue(section, "null_charts", report.nullCharts);
+    ReportValue(section, "empty_charts", report.emptyCharts);
+    ReportValue(section, "checked_faces", report.checkedFaces);
+    ReportValue(section, "invalid_faces", report.invalidFaces);
+    if (report.level == ValidationLevel::Fast)
+        ReportValue(section, "non_manifold_edges", report.nonManifoldEdges);
+    else
+        ReportValue(section, "non_manifold_vertices", report.nonManifoldVertices);
+    ReportValue(section, "time_s", report.seconds);
+}
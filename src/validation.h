@@ -0,0 +1,69 @@
+/*******************************************************************************
+    Copyright (c) 2021, Andrea Maggiordomo, Paolo Cignoni and Marco Tarini
+
+    This file is part of TextureDefrag, a reference implementation for
+    the paper ``Texture Defragmentation for Photo-Reconstructed 3D Models''
+    by Andrea Maggiordomo, Paolo Cignoni and Marco Tarini.
+
+    TextureDefrag is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    TextureDefrag is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with TextureDefrag. If not, see <https://www.gnu.org/licenses/>.
+*******************************************************************************/
+
+
+#ifndef VALIDATION_H
+#define VALIDATION_H
+
+#include "types.h"
+
+#include <string>
+#include <future>
+
+/* Levels of the integrity validation of the graph and of the mesh that runs after
+ * the optimization. The fast level checks every chart handle and a sample of the
+ * face pointers of each chart, and the manifoldness of the edges of the sampled
+ * faces. The full level checks all the face pointers and counts the non-manifold
+ * vertices (as vcg::tri::Clean::CountNonManifoldVertexFF, without touching the flags
+ * of the mesh) */
+enum class ValidationLevel {
+    Off,
+    Fast,
+    Full
+};
+
+struct ValidationReport {
+    ValidationLevel level = ValidationLevel::Off;
+    int charts = 0;
+    int nullCharts = 0;
+    int emptyCharts = 0;
+    int checkedFaces = 0;         // face pointers checked (all of them at the full level)
+    int invalidFaces = 0;         // null, deleted or not in the mesh
+    int nonManifoldEdges = 0;     // non-manifold edges of the sampled faces (fast level only)
+    int nonManifoldVertices = -1; // -1 if not counted (fast level)
+    double seconds = 0;
+};
+
+/* Parses "off", "fast", "full" or "async" (the full level, whose non-manifold count
+ * runs while the packing starts, see ValidateIntegrityAsync()) */
+bool ParseValidationLevel(const std::string& s, ValidationLevel *level, bool *async);
+
+ValidationReport ValidateIntegrity(GraphHandle graph, ValidationLevel level);
+
+/* Checks the charts and copies the face adjacency of the mesh before returning, so
+ * the mesh can be modified while the vertices are checked in background (the mesh
+ * can even be destroyed, the future does not refer to it) */
+std::future<ValidationReport> ValidateIntegrityAsync(GraphHandle graph, ValidationLevel level);
+
+/* Logs the outcome of the validation and adds it to the run report */
+void LogValidationReport(const ValidationReport& report);
+
+#endif // VALIDATION_H
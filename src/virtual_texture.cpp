@@ -0,0 +1,255 @@
+/*******************************************************************************
+    Copyright (c) 2021, Andrea Maggiordomo, Paolo Cignoni and Marco Tarini
+
+    This file is part of TextureDefrag, a reference implementation for
+    the paper ``Texture Defragmentation for Photo-Reconstructed 3D Models''
+    by Andrea Maggiordomo, Paolo Cignoni and Marco Tarini.
+
+    TextureDefrag is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    TextureDefrag is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with TextureDefrag. If not, see <https://www.gnu.org/licenses/>.
+*******************************************************************************/
+
+#include "virtual_texture.h"
+#include "gl_utils.h"
+#include "logging.h"
+#include "utils.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+#include <omp.h>
+
+
+static void AxisPages(double t0, double t1, int size, std::vector<int>& out);
+
+VirtualTexture::VirtualTexture(TextureObjectHandle textureObject, uint64_t budgetBytes)
+    : textureObject{textureObject}
+{
+    OpenGLFunctionsHandle glFuncs = GetOpenGLFunctionsHandle();
+
+    uint64_t totalPages = 0;
+    tables.resize(textureObject->ArraySize());
+    for (std::size_t i = 0; i < tables.size(); ++i) {
+        PageTable& pt = tables[i];
+        pt.pagesX = (textureObject->TextureWidth(i) + PAGE_CONTENT - 1) / PAGE_CONTENT;
+        pt.pagesY = (textureObject->TextureHeight(i) + PAGE_CONTENT - 1) / PAGE_CONTENT;
+        pt.entries.resize(pt.pagesX * pt.pagesY, 0);
+        totalPages += pt.entries.size();
+        glFuncs->glGenTextures(1, &pt.name);
+    }
+
+    GLint maxLayers = 0;
+    glFuncs->glGetIntegerv(GL_MAX_ARRAY_TEXTURE_LAYERS, &maxLayers);
+    const uint64_t layerBytes = uint64_t(PAGE_SIZE) * PAGE_SIZE * 4;
+    uint64_t n = std::min<uint64_t>(totalPages, std::min<uint64_t>(maxLayers, 65535));
+    if (budgetBytes > 0)
+        n = std::min(n, budgetBytes / layerBytes);
+    layers = int(std::max<uint64_t>(n, 1));
+
+    glFuncs->glGenTextures(1, &pool);
+    glFuncs->glBindTexture(GL_TEXTURE_2D_ARRAY, pool);
+    glFuncs->glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGBA8, PAGE_SIZE, PAGE_SIZE, layers, 0, GL_BGRA, GL_UNSIGNED_BYTE, NULL);
+    glFuncs->glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glFuncs->glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glFuncs->glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glFuncs->glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glFuncs->glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+    CHECK_GL_ERROR();
+
+    layerVec.resize(layers);
+    for (int l = 0; l < layers; ++l) {
+        lruList.push_back(l);
+        layerVec[l].lru = std::prev(lruList.end());
+    }
+
+    staging.resize(layerBytes);
+
+    LOG_INFO << "Virtual texture pool allocated with " << layers << " pages of " << PAGE_SIZE << "x" << PAGE_SIZE
+             << " (" << (layers * layerBytes) / (1024.0 * 1024.0) << " MB, " << totalPages << " input pages)";
+}
+
+VirtualTexture::~VirtualTexture()
+{
+    OpenGLFunctionsHandle glFuncs = GetOpenGLFunctionsHandle();
+    glFuncs->glDeleteTextures(1, &pool);
+    for (PageTable& pt : tables)
+        glFuncs->glDeleteTextures(1, &pt.name);
+}
+
+int VirtualTexture::PagesX(int i) const
+{
+    ensure(i >= 0 && i < (int) tables.size());
+    return tables[i].pagesX;
+}
+
+int VirtualTexture::PagesY(int i) const
+{
+    ensure(i >= 0 && i < (int) tables.size());
+    return tables[i].pagesY;
+}
+
+void VirtualTexture::CollectPages(int i, double u0, double v0, double u1, double v1, std::vector<int>& pages) const
+{
+    ensure(i >= 0 && i < (int) tables.size());
+    // the bicubic lookup samples up to two texels away from the lookup position
+    const double margin = 2.0;
+    std::vector<int> px;
+    std::vector<int> py;
+    AxisPages(u0 - margin, u1 + margin, textureObject->TextureWidth(i), px);
+    AxisPages(v0 - margin, v1 + margin, textureObject->TextureHeight(i), py);
+    for (int y : py)
+        for (int x : px)
+            pages.push_back(y * tables[i].pagesX + x);
+}
+
+bool VirtualTexture::MakeResident(int i, const std::vector<int>& pages)
+{
+    ensure(i >= 0 && i < (int) tables.size());
+    if ((int) pages.size() > layers)
+        return false;
+
+    PageTable& pt = tables[i];
+
+    // move the resident pages to the front first, so that the layers recycled
+    // from the back never hold pages of this request
+    std::vector<int> missing;
+    for (int page : pages) {
+        ensure(page >= 0 && page < (int) pt.entries.size());
+        if (pt.entries[page] > 0) {
+            Layer& layer = layerVec[pt.entries[page] - 1];
+            lruList.splice(lruList.begin(), lruList, layer.lru);
+            stats.pageHits++;
+        } else {
+            missing.push_back(page);
+        }
+    }
+
+    if (missing.empty())
+        return true;
+
+    auto t_upload_start = std::chrono::high_resolution_clock::now();
+    for (int page : missing) {
+        int l = lruList.back();
+        Layer& layer = layerVec[l];
+        if (layer.tex >= 0) {
+            tables[layer.tex].entries[layer.page] = 0;
+            tables[layer.tex].dirty = true;
+            stats.pageEvictions++;
+        }
+        LoadPage(i, page, l);
+        layer.tex = i;
+        layer.page = page;
+        lruList.splice(lruList.begin(), lruList, layer.lru);
+        pt.entries[page] = uint16_t(l + 1);
+        pt.dirty = true;
+        stats.pageMisses++;
+    }
+    auto t_upload_end = std::chrono::high_resolution_clock::now();
+    stats.uploadS += std::chrono::duration<double>(t_upload_end - t_upload_start).count();
+
+    return true;
+}
+
+void VirtualTexture::Bind(int i, int poolUnit, int tableUnit)
+{
+    ensure(i >= 0 && i < (int) tables.size());
+    OpenGLFunctionsHandle glFuncs = GetOpenGLFunctionsHandle();
+    PageTable& pt = tables[i];
+
+    glFuncs->glActiveTexture(GL_TEXTURE0 + tableUnit);
+    glFuncs->glBindTexture(GL_TEXTURE_2D, pt.name);
+    if (pt.dirty) {
+        glFuncs->glPixelStorei(GL_UNPACK_ALIGNMENT, 2);
+        glFuncs->glTexImage2D(GL_TEXTURE_2D, 0, GL_R16UI, pt.pagesX, pt.pagesY, 0, GL_RED_INTEGER, GL_UNSIGNED_SHORT, pt.entries.data());
+        glFuncs->glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+        glFuncs->glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glFuncs->glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        pt.dirty = false;
+    }
+
+    glFuncs->glActiveTexture(GL_TEXTURE0 + poolUnit);
+    glFuncs->glBindTexture(GL_TEXTURE_2D_ARRAY, pool);
+    CHECK_GL_ERROR();
+}
+
+/* Copies the page with its border from the decoded image to the staging buffer
+ * (bottom to top rows, wrapping around the image edges) and uploads it */
+void VirtualTexture::LoadPage(int i, int page, int layer)
+{
+    const QImage& img = DecodedImage(i);
+    const int width = img.width();
+    const int height = img.height();
+    const int x0 = (page % tables[i].pagesX) * PAGE_CONTENT - PAGE_BORDER;
+    const int y0 = (page / tables[i].pagesX) * PAGE_CONTENT - PAGE_BORDER;
+
+    uint32_t *dst = reinterpret_cast<uint32_t *>(staging.data());
+    #pragma omp parallel for
+    for (int ly = 0; ly < PAGE_SIZE; ++ly) {
+        int sy = ((y0 + ly) % height + height) % height;
+        const uint32_t *src = reinterpret_cast<const uint32_t *>(img.constScanLine(height - 1 - sy));
+        uint32_t *row = dst + std::size_t(ly) * PAGE_SIZE;
+        for (int lx = 0; lx < PAGE_SIZE; ++lx) {
+            int sx = ((x0 + lx) % width + width) % width;
+            row[lx] = src[sx];
+        }
+    }
+
+    OpenGLFunctionsHandle glFuncs = GetOpenGLFunctionsHandle();
+    glFuncs->glBindTexture(GL_TEXTURE_2D_ARRAY, pool);
+    glFuncs->glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glFuncs->glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, layer, PAGE_SIZE, PAGE_SIZE, 1, GL_BGRA, GL_UNSIGNED_BYTE, staging.data());
+    glFuncs->glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+    CHECK_GL_ERROR();
+}
+
+const QImage& VirtualTexture::DecodedImage(int i)
+{
+    if (decodedIndex != i) {
+        decoded = ToARGB32(ReadTextureImage(textureObject->texInfoVec[i]));
+        ensure(!decoded.isNull());
+        ensure(decoded.width() == textureObject->TextureWidth(i) && decoded.height() == textureObject->TextureHeight(i));
+        decodedIndex = i;
+        stats.imagesDecoded++;
+    }
+    return decoded;
+}
+
+// -- static functions ---------------------------------------------------------
+
+/* Appends to out the pages along an axis of the given size that contain the texels
+ * in [t0, t1], including the texel pairs of the bilinear lookups at the extremes,
+ * wrapping around the edges */
+static void AxisPages(double t0, double t1, int size, std::vector<int>& out)
+{
+    const int content = VirtualTexture::PAGE_CONTENT;
+    const int numPages = (size + content - 1) / content;
+    int i0 = int(std::floor(t0 - 0.5));
+    int i1 = int(std::floor(t1 + 0.5));
+    if (i1 - i0 + 1 >= size) {
+        for (int p = 0; p < numPages; ++p)
+            out.push_back(p);
+        return;
+    }
+    int w0 = ((i0 % size) + size) % size;
+    int w1 = w0 + (i1 - i0);
+    if (w1 < size) {
+        for (int p = w0 / content; p <= w1 / content; ++p)
+            out.push_back(p);
+    } else {
+        for (int p = w0 / content; p < numPages; ++p)
+            out.push_back(p);
+        for (int p = 0; p <= (w1 - size) / content; ++p)
+            out.push_back(p);
+    }
+}
@@ -0,0 +1,117 @@
+/*******************************************************************************
+    Copyright (c) 2021, Andrea Maggiordomo, Paolo Cignoni and Marco Tarini
+
+    This file is part of TextureDefrag, a reference implementation for
+    the paper ``Texture Defragmentation for Photo-Reconstructed 3D Models''
+    by Andrea Maggiordomo, Paolo Cignoni and Marco Tarini.
+
+    TextureDefrag is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    TextureDefrag is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with TextureDefrag. If not, see <https://www.gnu.org/licenses/>.
+*******************************************************************************/
+
+
+#ifndef VIRTUAL_TEXTURE_H
+#define VIRTUAL_TEXTURE_H
+
+#include "texture_object.h"
+
+#include <vector>
+#include <list>
+#include <cstdint>
+
+#include <QImage>
+
+/* Streams the input textures of a TextureObject in fixed-size pages into a
+ * texture array (the page pool). Each input texture has a page table, an
+ * integer texture that stores for every page the pool layer plus one, or zero
+ * if the page is not resident. The pages carry a one texel border copied from
+ * the neighbouring pages (wrapping around the image edges as GL_REPEAT), so
+ * that bilinear lookups never straddle two layers. Pool layers are recycled
+ * in LRU order. Texel rows are stored bottom to top, as the textures bound by
+ * TextureObject. */
+class VirtualTexture {
+
+public:
+
+    static const int PAGE_SIZE = 512;  // side of a pool layer
+    static const int PAGE_BORDER = 1;
+    static const int PAGE_CONTENT = PAGE_SIZE - 2 * PAGE_BORDER;
+
+    struct Stats {
+        uint64_t pageHits = 0;
+        uint64_t pageMisses = 0;
+        uint64_t pageEvictions = 0;
+        uint64_t imagesDecoded = 0;
+        double uploadS = 0.0;
+    };
+
+    /* Allocates a pool that fits budgetBytes (0 means as many layers as the
+     * input textures have pages, up to the OpenGL limit) */
+    VirtualTexture(TextureObjectHandle textureObject, uint64_t budgetBytes);
+    ~VirtualTexture();
+
+    VirtualTexture(const VirtualTexture &) = delete;
+    VirtualTexture &operator=(const VirtualTexture &) = delete;
+
+    int PagesX(int i) const;
+    int PagesY(int i) const;
+    int PoolLayers() const { return layers; }
+
+    /* Appends to pages the pages of texture i sampled by the bilinear and bicubic
+     * lookups inside the texel-space box [u0,u1]x[v0,v1] */
+    void CollectPages(int i, double u0, double v0, double u1, double v1, std::vector<int>& pages) const;
+
+    /* Makes the pages of texture i resident, pages must be sorted and unique.
+     * Returns false if they do not fit in the pool */
+    bool MakeResident(int i, const std::vector<int>& pages);
+
+    /* Binds the page pool and the page table of texture i to the given texture units */
+    void Bind(int i, int poolUnit, int tableUnit);
+
+    Stats GetStats() const { return stats; }
+
+private:
+
+    struct Layer {
+        int tex = -1;
+        int page = -1;
+        std::list<int>::iterator lru;
+    };
+
+    struct PageTable {
+        int pagesX = 0;
+        int pagesY = 0;
+        std::vector<uint16_t> entries;
+        uint32_t name = 0;
+        bool dirty = true;
+    };
+
+    void LoadPage(int i, int page, int layer);
+    const QImage& DecodedImage(int i);
+
+    TextureObjectHandle textureObject;
+    uint32_t pool = 0;
+    int layers = 0;
+    std::vector<Layer> layerVec;
+    std::list<int> lruList;  // pool layers, most-recently-used at front
+    std::vector<PageTable> tables;
+
+    // the last decoded input image, reused while its pages are loaded
+    int decodedIndex = -1;
+    QImage decoded;
+    std::vector<unsigned char> staging;
+
+    Stats stats;
+};
+
+#endif // VIRTUAL_TEXTURE_H
@@ -0,0 +1,178 @@
+/*******************************************************************************
+    Copyright (c) 2021, Andrea Maggiordomo, Paolo Cignoni and Marco Tarini
+
+    This file is part of TextureDefrag, a reference implementation for
+    the paper ``Texture Defragmentation for Photo-Reconstructed 3D Models''
+    by Andrea Maggiordomo, Paolo Cignoni and Marco Tarini.
+
+    TextureDefrag is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    TextureDefrag is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with TextureDefrag. If not, see <https://www.gnu.org/licenses/>.
+*******************************************************************************/
+
+
+#include "test.h"
+
+#include "mesh.h"
+#include "mesh_attribute.h"
+#include "arap.h"
+
+#include <vector>
+#include <random>
+#include <string>
+#include <algorithm>
+#include <cmath>
+
+/* Tests of the ARAP solver on a distorted parameterization of a height field */
+
+/* Builds a height field of side x side quads, whose tex coords are its planar
+ * coordinates perturbed by a random jitter, as the ARAP benchmark shells */
+static void BuildGridShell(Mesh& shell, int side, unsigned seed)
+{
+    std::mt19937 gen(seed);
+    std::uniform_real_distribution<double> jitter(-0.2, 0.2);
+
+    tri::Allocator<Mesh>::AddVertices(shell, (side + 1) * (side + 1));
+    for (int j = 0; j <= side; ++j) {
+        for (int i = 0; i <= side; ++i) {
+            auto& v = shell.vert[j * (side + 1) + i];
+            v.P() = vcg::Point3d(i, j, 2.0 * std::sin(i * 0.3) * std::cos(j * 0.2));
+            v.T().P() = vcg::Point2d(i + jitter(gen), j + jitter(gen));
+        }
+    }
+
+    tri::Allocator<Mesh>::AddFaces(shell, 2 * side * side);
+    auto tsa = GetTargetShapeAttribute(shell);
+    for (int j = 0; j < side; ++j) {
+        for (int i = 0; i < side; ++i) {
+            int v0 = j * (side + 1) + i;
+            int corners[2][3] = {{v0, v0 + 1, v0 + side + 2}, {v0, v0 + side + 2, v0 + side + 1}};
+            for (int k = 0; k < 2; ++k) {
+                auto& f = shell.face[2 * (j * side + i) + k];
+                for (int h = 0; h < 3; ++h) {
+                    f.V(h) = &shell.vert[corners[k][h]];
+                    f.WT(h) = f.V(h)->T();
+                    tsa[f].P[h] = f.P(h);
+                }
+            }
+        }
+    }
+
+    tri::UpdateTopology<Mesh>::FaceFace(shell);
+    tri::UpdateTopology<Mesh>::VertexFace(shell);
+    tri::UpdateFlags<Mesh>::VertexBorderFromFaceAdj(shell);
+}
+
+/* Solves the ARAP problem of a new grid shell, with two vertices of the first
+ * face fixed as in the optimization of the shells. The solver is configured by
+ * setup before the solve. If texCoords is not null it receives the solution */
+template <typename Setup>
+static ARAPSolveInfo SolveGridShell(int side, Setup setup, std::vector<vcg::Point2d> *texCoords = nullptr)
+{
+    Mesh shell;
+    BuildGridShell(shell, side, 1);
+    ARAP arap(shell);
+    arap.FixVertex(shell.face[0].V(0), shell.face[0].V(0)->T().P());
+    arap.FixVertex(shell.face[0].V(1), shell.face[0].V(1)->T().P());
+    setup(arap);
+    ARAPSolveInfo si = arap.Solve();
+    if (texCoords) {
+        texCoords->clear();
+        for (auto& v : shell.vert)
+            texCoords->push_back(v.T().P());
+    }
+    return si;
+}
+
+
+// -- Anderson acceleration ----------------------------------------------------
+
+/* With the Anderson acceleration the solve must converge in no more iterations
+ * than the plain local/global iteration, to the same energy */
+static void ARAPAndersonConvergence(test::Context& t)
+{
+    const int MAX_ITERATIONS = 1000;
+    ARAPSolveInfo plain = SolveGridShell(32, [] (ARAP& arap) { arap.SetMaxIterations(MAX_ITERATIONS); });
+    CHECK(t, !plain.numericalError);
+    CHECK(t, plain.iterations < MAX_ITERATIONS);
+    CHECK(t, plain.finalEnergy < plain.initialEnergy);
+
+    for (int window : {2, 5, 10}) {
+        ARAPSolveInfo si = SolveGridShell(32, [window] (ARAP& arap) {
+            arap.SetMaxIterations(MAX_ITERATIONS);
+            arap.SetAndersonAcceleration(window);
+        });
+        std::string label = "window " + std::to_string(window) + ", " + std::to_string(si.iterations) + " iterations";
+        CHECK_MSG(t, !si.numericalError, label);
+        CHECK_MSG(t, si.iterations <= plain.iterations, label + " (" + std::to_string(plain.iterations) + " without acceleration)");
+        CHECK_MSG(t, std::abs(si.finalEnergy - plain.finalEnergy) <= 1e-3 * plain.finalEnergy, label);
+    }
+}
+TEST(ARAPAndersonConvergence);
+
+
+// -- mixed precision ----------------------------------------------------------
+
+/* The mixed precision solves must reach the energy of the double precision ones,
+ * and fall back to double precision when the refinement cannot reach the solver
+ * tolerance */
+static void ARAPMixedPrecisionFallback(test::Context& t)
+{
+    ARAPSolveInfo ldlt = SolveGridShell(32, [] (ARAP& arap) { arap.SetSolverBackend(SIMPLICIAL_LDLT); });
+    ARAPSolveInfo mixed = SolveGridShell(32, [] (ARAP& arap) { arap.SetSolverBackend(SIMPLICIAL_LDLT_MIXED); });
+    ARAPSolveInfo fallback = SolveGridShell(32, [] (ARAP& arap) {
+        arap.SetSolverBackend(SIMPLICIAL_LDLT_MIXED);
+        arap.SetSolverTolerance(1e-30);
+    });
+    CHECK(t, !ldlt.numericalError && !ldlt.fallback);
+
+    CHECK(t, !mixed.numericalError);
+    CHECK_MSG(t, !mixed.fallback && mixed.backend == SIMPLICIAL_LDLT_MIXED, ARAPSolverBackendName(mixed.backend));
+    CHECK(t, mixed.iterations == ldlt.iterations);
+    CHECK(t, std::abs(mixed.finalEnergy - ldlt.finalEnergy) <= 1e-9 * ldlt.finalEnergy);
+
+    CHECK(t, !fallback.numericalError);
+    CHECK_MSG(t, fallback.fallback && fallback.backend == SIMPLICIAL_LDLT, ARAPSolverBackendName(fallback.backend));
+    CHECK(t, fallback.iterations == ldlt.iterations);
+    CHECK(t, std::abs(fallback.finalEnergy - ldlt.finalEnergy) <= 1e-9 * ldlt.finalEnergy);
+}
+TEST(ARAPMixedPrecisionFallback);
+
+
+// -- conjugate gradient -------------------------------------------------------
+
+/* The preconditioned conjugate gradient solves the same systems as the LDLT
+ * factorization, up to the solver tolerance, and must reach the same energy */
+static void ARAPConjugateGradient(test::Context& t)
+{
+    std::vector<vcg::Point2d> ldltTexCoords;
+    std::vector<vcg::Point2d> cgTexCoords;
+    ARAPSolveInfo ldlt = SolveGridShell(32, [] (ARAP& arap) { arap.SetSolverBackend(SIMPLICIAL_LDLT); }, &ldltTexCoords);
+    ARAPSolveInfo cg = SolveGridShell(32, [] (ARAP& arap) {
+        arap.SetSolverBackend(CG_ICHOL);
+        arap.SetSolverTolerance(1e-10);
+    }, &cgTexCoords);
+
+    CHECK(t, !ldlt.numericalError);
+    CHECK(t, !cg.numericalError);
+    CHECK_MSG(t, !cg.fallback && cg.backend == CG_ICHOL, ARAPSolverBackendName(cg.backend));
+    CHECK(t, cg.solverIterations > 0);
+    CHECK(t, std::abs(cg.iterations - ldlt.iterations) <= 1);
+    CHECK(t, std::abs(cg.finalEnergy - ldlt.finalEnergy) <= 1e-6 * ldlt.finalEnergy);
+
+    double maxDistance = 0;
+    for (unsigned i = 0; i < ldltTexCoords.size() && i < cgTexCoords.size(); ++i)
+        maxDistance = std::max(maxDistance, (ldltTexCoords[i] - cgTexCoords[i]).Norm());
+    CHECK(t, cgTexCoords.size() == ldltTexCoords.size());
+    CHECK_MSG(t, maxDistance < 1e-4, "the solutions differ by " + std::to_string(maxDistance));
+}
+TEST(ARAPConjugateGradient);
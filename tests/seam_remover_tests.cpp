@@ -0,0 +1,219 @@
+/*******************************************************************************
+    Copyright (c) 2021, Andrea Maggiordomo, Paolo Cignoni and Marco Tarini
+
+    This file is part of TextureDefrag, a reference implementation for
+    the paper ``Texture Defragmentation for Photo-Reconstructed 3D Models''
+    by Andrea Maggiordomo, Paolo Cignoni and Marco Tarini.
+
+    TextureDefrag is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    TextureDefrag is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with TextureDefrag. If not, see <https://www.gnu.org/licenses/>.
+*******************************************************************************/
+
+
+#include "test.h"
+
+#include "mesh.h"
+#include "mesh_graph.h"
+#include "mesh_attribute.h"
+#include "seam_remover.h"
+#include "seams.h"
+#include "texture_object.h"
+#include "texture_optimization.h"
+
+#include <vector>
+#include <random>
+#include <memory>
+#include <string>
+#include <cmath>
+
+#include <QImage>
+
+/* Tests of the greedy optimization on small generated atlases, built so that the
+ * matching errors of the seams differ from each other */
+
+static const int QUAD_TEXELS = 8;
+
+/* Builds a height field of side x side quads cut in charts of chartSide x chartSide
+ * quads. The tex coords of each chart are the planar coordinates of its vertices,
+ * perturbed by a random jitter whose amplitude grows from 0 to maxJitter quads
+ * along the first axis of the chart, so that the matching of each seam degrades
+ * from one end to the other. The charts are rotated by random multiples of 90
+ * degrees and laid out on a grid in one texture. The mesh is prepared as in the
+ * pipeline, and the graph of its charts is returned */
+static GraphHandle BuildJitteredAtlas(Mesh& m, int side, int chartSide, double maxJitter, unsigned seed)
+{
+    std::mt19937 gen(seed);
+    std::uniform_real_distribution<double> unit(-1.0, 1.0);
+    std::uniform_int_distribution<int> rotation(0, 3);
+
+    tri::Allocator<Mesh>::AddVertices(m, (side + 1) * (side + 1));
+    for (int j = 0; j <= side; ++j)
+        for (int i = 0; i <= side; ++i)
+            m.vert[j * (side + 1) + i].P() = vcg::Point3d(i, j, 2.0 * std::sin(i * 0.3) * std::cos(j * 0.2));
+
+    const int charts = side / chartSide;
+    const int slot = chartSide + 2;
+    const int textureSize = charts * slot * QUAD_TEXELS;
+
+    tri::Allocator<Mesh>::AddFaces(m, 2 * side * side);
+    for (int cj = 0; cj < charts; ++cj) {
+        for (int ci = 0; ci < charts; ++ci) {
+            std::vector<vcg::Point2d> jitter((chartSide + 1) * (chartSide + 1));
+            for (int j = 0; j <= chartSide; ++j) {
+                for (int i = 0; i <= chartSide; ++i) {
+                    double amplitude = maxJitter * std::pow(i / (double) chartSide, 2.0);
+                    jitter[j * (chartSide + 1) + i] = vcg::Point2d(amplitude * unit(gen), amplitude * unit(gen));
+                }
+            }
+            int r = rotation(gen);
+            auto TexCoord = [&] (int i, int j) {
+                vcg::Point2d p = vcg::Point2d(i, j) + jitter[j * (chartSide + 1) + i] - vcg::Point2d(chartSide, chartSide) / 2.0;
+                for (int k = 0; k < r; ++k)
+                    p = vcg::Point2d(-p.Y(), p.X());
+                vcg::Point2d center((ci + 0.5) * slot, (cj + 0.5) * slot);
+                return (center + p) * double(QUAD_TEXELS);
+            };
+
+            for (int j = 0; j < chartSide; ++j) {
+                for (int i = 0; i < chartSide; ++i) {
+                    int gi = ci * chartSide + i;
+                    int gj = cj * chartSide + j;
+                    int v0 = gj * (side + 1) + gi;
+                    int corners[2][3][2] = {{{i, j}, {i + 1, j}, {i + 1, j + 1}}, {{i, j}, {i + 1, j + 1}, {i, j + 1}}};
+                    int vertices[2][3] = {{v0, v0 + 1, v0 + side + 2}, {v0, v0 + side + 2, v0 + side + 1}};
+                    for (int k = 0; k < 2; ++k) {
+                        MeshFace& f = m.face[2 * (gj * side + gi) + k];
+                        for (int h = 0; h < 3; ++h) {
+                            f.V(h) = &m.vert[vertices[k][h]];
+                            f.WT(h).P() = TexCoord(corners[k][h][0], corners[k][h][1]);
+                            f.WT(h).N() = 0;
+                        }
+                        f.SetMesh();
+                    }
+                }
+            }
+        }
+    }
+
+    m.textures.push_back("texture_0");
+    TextureObjectHandle textureObject = std::make_shared<TextureObject>();
+    textureObject->AddImage("texture_0", TextureSize{textureSize, textureSize}, [textureSize] () {
+        QImage img(textureSize, textureSize, QImage::Format_RGB32);
+        img.fill(QColor(128, 128, 128));
+        return img;
+    });
+
+    int vndup;
+    PrepareMesh(m, &vndup);
+    ComputeWedgeTexCoordStorageAttribute(m);
+    return ComputeGraph(m, textureObject);
+}
+
+/* Number of active clusters with a feasible matching, and their total seam length */
+static void FeasibleClusters(AlgoStateHandle state, int *count, double *length)
+{
+    *count = 0;
+    *length = 0;
+    for (ClusterId cid = 0; cid < state->clusters.Slots(); ++cid) {
+        const ClusterRecord& r = state->clusters[cid];
+        if (r.csh && r.active && r.mvalue == CostInfo::FEASIBLE) {
+            (*count)++;
+            *length += ComputeSeamLength3D(r.csh);
+        }
+    }
+}
+
+
+// -- seam reduction -----------------------------------------------------------
+
+/* The charts of the atlas match better near one end of their seams, and many seams
+ * are unfeasible as a whole. ReduceSeam() shortens an unfeasible seam by a constant
+ * factor, from the backward end while both reductions are still unfeasible, and can
+ * stop at a single unfeasible edge; the bisection trims each seam to its longest
+ * feasible run from either end, and must keep more feasible seams, and more of
+ * their length */
+static void SeamReductionBisection(test::Context& t)
+{
+    AlgoParameters params;
+    params.matchingThreshold = 0.05;
+    params.boundaryTolerance = 0;
+
+    int count[3];
+    double length[3];
+    int clusters[3];
+    for (int mode = 0; mode < 3; ++mode) {
+        Mesh m;
+        GraphHandle graph = BuildJitteredAtlas(m, 48, 8, 1.0, 1);
+        params.reduce = (mode > 0);
+        params.reduceBisection = (mode == 2);
+        AlgoStateHandle state = InitializeState(graph, params);
+        FeasibleClusters(state, &count[mode], &length[mode]);
+        clusters[mode] = 0;
+        for (int k = 0; k < CostInfo::_END; ++k)
+            clusters[mode] += state->stats.feasibility[k];
+    }
+
+    CHECK(t, clusters[0] > 0);
+    CHECK(t, clusters[1] == clusters[0] && clusters[2] == clusters[0]);
+    CHECK_MSG(t, count[0] < clusters[0], "the atlas has no unfeasible seam");
+
+    CHECK(t, count[1] >= count[0]);
+    CHECK(t, count[2] > count[1]);
+    CHECK(t, length[2] > length[1]);
+    CHECK_MSG(t, length[1] >= length[0], "the linear reduction kept " + std::to_string(length[1]) + " of " + std::to_string(length[0]));
+}
+TEST(SeamReductionBisection);
+
+
+// -- lazy costing -------------------------------------------------------------
+
+/* With a small lazyCostFactor the estimates of the clusters re-queued after a move
+ * are below their exact costs, so every estimate is costed before the move it could
+ * displace, and the greedy optimization must accept the same moves as exact costing:
+ * the final charts and tex coords are identical */
+static void LazyCosting(test::Context& t)
+{
+    AlgoParameters params;
+    params.matchingThreshold = 0.1;
+
+    int charts[2];
+    std::vector<RegionID> faceCharts[2];
+    std::vector<vcg::Point2d> texCoords[2];
+    AlgoStats stats[2];
+    for (int lazy = 0; lazy < 2; ++lazy) {
+        Mesh m;
+        GraphHandle graph = BuildJitteredAtlas(m, 24, 4, 0.6, 1);
+        params.lazyCostFactor = lazy ? 1e-3 : 0;
+        ReorientCharts(graph);
+        AlgoStateHandle state = InitializeState(graph, params);
+        GreedyOptimization(graph, state, params);
+        charts[lazy] = (int) graph->Count();
+        for (auto& f : m.face) {
+            faceCharts[lazy].push_back(f.id);
+            for (int i = 0; i < 3; ++i)
+                texCoords[lazy].push_back(f.WT(i).P());
+        }
+        stats[lazy] = state->stats;
+    }
+
+    CHECK_MSG(t, charts[0] > 1 && charts[0] < 36, "the exact costing left " + std::to_string(charts[0]) + " of 36 charts");
+    CHECK(t, stats[0].lazy_queued == 0);
+    CHECK(t, stats[1].lazy_queued > 0);
+    CHECK(t, stats[1].lazy_resolved > 0 && stats[1].lazy_resolved <= stats[1].lazy_queued);
+    CHECK(t, stats[1].lazy_requeued <= stats[1].lazy_resolved);
+
+    CHECK(t, charts[1] == charts[0]);
+    CHECK(t, faceCharts[1] == faceCharts[0]);
+    CHECK(t, texCoords[1] == texCoords[0]);
+}
+TEST(LazyCosting);
@@ -0,0 +1,73 @@
+/*******************************************************************************
+    Copyright (c) 2021, Andrea Maggiordomo, Paolo Cignoni and Marco Tarini
+
+    This file is part of TextureDefrag, a reference implementation for
+    the paper ``Texture Defragmentation for Photo-Reconstructed 3D Models''
+    by Andrea Maggiordomo, Paolo Cignoni and Marco Tarini.
+
+    TextureDefrag is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    TextureDefrag is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with TextureDefrag. If not, see <https://www.gnu.org/licenses/>.
+*******************************************************************************/
+
+
+#ifndef TEST_H
+#define TEST_H
+
+#include <string>
+
+/* Minimal harness for the regression tests, in the style of the benchmarks (see
+ * benchmark/benchmark.h). A test is a function that runs the code under test and
+ * checks its outcome with CHECK(), and is registered with TEST(). A test fails if
+ * any of its checks fails, the failed checks are printed with their location and
+ * the test goes on */
+
+namespace test {
+
+class Context {
+
+    int checks;
+    int failures;
+
+public:
+
+    Context();
+
+    /* Counts the check, and prints it as failed if ok is false. Returns ok */
+    bool Check(bool ok, const char *expression, const char *file, int line, const std::string& message = "");
+
+    int Checks() const { return checks; }
+    int Failures() const { return failures; }
+};
+
+typedef void (*Function)(Context&);
+
+/* Registers the test fn. Returns a dummy value to allow the registration from
+ * static initializers */
+int Register(const char *name, Function fn);
+
+} // namespace test
+
+#define TEST_CONCAT_(a, b) a ## b
+#define TEST_CONCAT(a, b) TEST_CONCAT_(a, b)
+
+#define TEST(fn) \
+    static int TEST_CONCAT(test_registration_, __LINE__) = test::Register(#fn, fn)
+
+#define CHECK(t, condition) \
+    (t).Check((condition), #condition, __FILE__, __LINE__)
+
+/* As CHECK(), the message (a std::string) is printed if the check fails */
+#define CHECK_MSG(t, condition, message) \
+    (t).Check((condition), #condition, __FILE__, __LINE__, (message))
+
+#endif // TEST_H
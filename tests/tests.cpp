@@ -0,0 +1,183 @@
+/*******************************************************************************
+    Copyright (c) 2021, Andrea Maggiordomo, Paolo Cignoni and Marco Tarini
+
+    This file is part of TextureDefrag, a reference implementation for
+    the paper ``Texture Defragmentation for Photo-Reconstructed 3D Models''
+    by Andrea Maggiordomo, Paolo Cignoni and Marco Tarini.
+
+    TextureDefrag is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    TextureDefrag is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with TextureDefrag. If not, see <https://www.gnu.org/licenses/>.
+*******************************************************************************/
+
+
+#include "test.h"
+#include "logging.h"
+#include "utils.h"
+
+#include <iostream>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+
+#include <omp.h>
+
+#include <QCoreApplication>
+
+/* Runs the regression tests of the components of the pipeline, defined in the
+ * *_tests.cpp files. Exits with a nonzero status if a test fails */
+
+struct Args {
+    std::string f = ""; // only run the tests whose name contains this string
+    int n = 0; // number of OpenMP threads (0 for the default)
+    int l = -1;
+};
+
+namespace test {
+
+struct Case {
+    std::string name;
+    Function fn;
+};
+
+static std::vector<Case>& Cases()
+{
+    static std::vector<Case> cases;
+    return cases;
+}
+
+Context::Context()
+    : checks{0},
+      failures{0}
+{
+}
+
+bool Context::Check(bool ok, const char *expression, const char *file, int line, const std::string& message)
+{
+    checks++;
+    if (!ok) {
+        failures++;
+        std::printf("    %s:%d: check failed: %s%s%s\n", file, line, expression, message.empty() ? "" : ", ", message.c_str());
+        std::fflush(stdout);
+    }
+    return ok;
+}
+
+int Register(const char *name, Function fn)
+{
+    Cases().push_back(Case{name, fn});
+    return 0;
+}
+
+} // namespace test
+
+void PrintArgsUsage(const char *binary);
+bool ParseOption(const std::string& option, const std::string& argument, Args *args);
+Args ParseArgs(int argc, char *argv[]);
+
+int main(int argc, char *argv[])
+{
+    Args args = ParseArgs(argc, argv);
+
+    LOG_INIT(args.l);
+    LOG_SET_ASYNC(false);
+
+    QCoreApplication app(argc, argv);
+
+    if (args.n > 0)
+        omp_set_num_threads(args.n);
+
+    int numRun = 0;
+    int numFailed = 0;
+    for (const auto& c : test::Cases()) {
+        if (args.f != "" && c.name.find(args.f) == std::string::npos)
+            continue;
+
+        test::Context t;
+        c.fn(t);
+        numRun++;
+
+        bool passed = (t.Failures() == 0 && t.Checks() > 0);
+        if (!passed)
+            numFailed++;
+        std::printf("%-48s %s (%d checks, %d failed)\n", c.name.c_str(), passed ? "passed" : "FAILED", t.Checks(), t.Failures());
+        std::fflush(stdout);
+    }
+
+    if (numRun == 0) {
+        std::cerr << "No test matches the filter " << args.f << std::endl;
+        return 1;
+    }
+
+    std::printf("%d of %d tests passed\n", numRun - numFailed, numRun);
+    return (numFailed > 0) ? 1 : 0;
+}
+
+void PrintArgsUsage(const char *binary) {
+    Args def;
+    std::cout << "Usage: " << binary << " [-fnl]" << std::endl;
+    std::cout << std::endl;
+    std::cout << "-f  <val>      " << "Only run the tests whose name contains the given string." << std::endl;
+    std::cout << "-n  <val>      " << "Number of OpenMP threads, 0 for the default." << " (default: " << def.n << ")" << std::endl;
+    std::cout << "-l  <val>      " << "Logging level, -1 to only log the warnings and the errors." << " (default: " << def.l << ")" << std::endl;
+    std::cout << std::endl;
+}
+
+bool ParseOption(const std::string& option, const std::string& argument, Args *args)
+{
+    ensure(option.size() == 2);
+    try {
+        switch (option[1]) {
+            case 'f' : args->f = argument; break;
+            case 'n' : args->n = std::stoi(argument); break;
+            case 'l' : args->l = std::stoi(argument); break;
+            default:
+                std::cerr << "Unrecognized option " << option << std::endl << std::endl;
+                return false;
+        }
+    } catch (std::exception&) {
+        std::cerr << "Error while parsing option `" << option << " " << argument << "`" << std::endl << std::endl;
+        return false;
+    }
+    return true;
+}
+
+Args ParseArgs(int argc, char *argv[])
+{
+    Args args;
+
+    for (int i = 1; i < argc; ++i) {
+        std::string argi(argv[i]);
+        if (argi == "-h" || argi == "--help") {
+            PrintArgsUsage(argv[0]);
+            std::exit(0);
+        } else if (argi[0] == '-' && argi.size() == 2) {
+            i++;
+            if (i >= argc) {
+                std::cerr << "Missing argument for option " << argi << std::endl << std::endl;
+                PrintArgsUsage(argv[0]);
+                std::exit(-1);
+            } else {
+                if (!ParseOption(argi, std::string(argv[i]), &args)) {
+                    PrintArgsUsage(argv[0]);
+                    std::exit(-1);
+                }
+            }
+        } else {
+            std::cerr << "Unexpected argument " << argi << std::endl << std::endl;
+            PrintArgsUsage(argv[0]);
+            std::exit(-1);
+        }
+    }
+
+    return args;
+}
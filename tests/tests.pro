@@ -0,0 +1,12 @@
+include(../base.pri)
+include(../sources.pri)
+
+TARGET = texture-defrag-tests
+
+SOURCES += \
+    tests.cpp \
+    arap_tests.cpp \
+    seam_remover_tests.cpp
+
+HEADERS += \
+    test.h
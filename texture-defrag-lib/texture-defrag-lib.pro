@@ -0,0 +1,15 @@
+include(../base.pri)
+include(../sources.pri)
+
+# static library of the defragmentation with the in-memory interface of defrag.h,
+# the application links it with the Qt modules and the OpenGL libraries of base.pri
+
+TEMPLATE = lib
+CONFIG += staticlib
+TARGET = texture-defrag
+
+SOURCES += \
+    ../src/defrag.cpp
+
+HEADERS += \
+    ../src/defrag.h
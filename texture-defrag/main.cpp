@@ -30,6 +30,30 @@
 #include "mesh_attribute.h"
 #include "seam_remover.h"
 #include "texture_rendering.h"
+#include "mesh_cache.h"
+#include "checkpoint.h"
+#include "tiling.h"
+#include "memory_budget.h"
+#include "deadline.h"
+#include "cpu_features.h"
+#include "numa_placement.h"
+#include "huge_pages.h"
+#include "perf_counters.h"
+#include "parallel_threshold.h"
+#include "texture_predecode.h"
+#include "distributed.h"
+#include "result_cache.h"
+#include "remote_input.h"
+#include "async_io.h"
+#include "incremental.h"
+#include "trace.h"
+#include "run_report.h"
+#include "metrics.h"
+#include "gl_utils.h"
+#include "validation.h"
+#include "texture_access_trace.h"
+#include "sheet_sink.h"
+#include "gpu_arap.h"
 
 #include <wrap/io_trimesh/io_mask.h>
 #include <wrap/system/qgetopt.h>
@@ -43,14 +67,36 @@
 #include <fstream>
 #include <map>
 #include <memory>
+#include <algorithm>
+#include <ctime>
+#include <cstdio>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <list>
+#include <functional>
+#include <future>
+#include <random>
 
 #include <omp.h>
 
+#ifndef _WIN32
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <cerrno>
+#endif
+
 #include <QApplication>
 #include <QImage>
 #include <QDir>
 #include <QFileInfo>
+#include <QSaveFile>
 #include <QString>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QJsonArray>
 #include <QOpenGLContext>
 #include <QSurfaceFormat>
 #include <QOffscreenSurface>
@@ -58,28 +104,300 @@
 
 struct Args {
     double m = 2.0;
+    double mCoincident = 0.0; // matching error below which the seams are stitched before the greedy optimization (0 disables it)
+    std::string mReduce = "off"; // reduction of the seams whose matching is unfeasible: off, linear or bisection
     double b = 0.2;
     double d = 0.5;
+    std::string dSolver = "ldlt"; // backend of the ARAP solves of the moves
+    double dSolverTolerance = 1e-10; // relative residual tolerance of the iterative and mixed precision ARAP solvers
+    int dAnderson = 0; // number of previous iterates combined by the Anderson acceleration of the ARAP solves (0 disables it)
+    double dEarlyStop = 0.0; // fraction of the distortion limits below which the ARAP solve of a move stops (0 disables it)
+    double dScaffold = 0.0; // width of the scaffold band around the shells, relative to their average boundary edge length (0 disables it)
     double g = 0.025;
     double u = 0.0;
     double a = 5.0;
     double t = 0.0;
+    double W = 0.0; // wall-clock deadline of the whole run in seconds
     std::string infile = "";
     std::string outfile = "";
     int r = 4;
     int l = 0;
-    double c = 8.0; // texture GPU cache budget in GB
+    ValidationLevel lValidation = ValidationLevel::Full; // integrity validation after the optimization
+    bool lValidationAsync = false; // the full validation counts the non-manifold vertices while the packing runs
+    double c = -1.0; // texture GPU cache budget in GB, negative to detect it from the free GPU memory
+    double cPredecode = 0.0; // memory budget in GB of the input textures decoded while the mesh is optimized (0 disables it)
+    double cRetain = 0.0; // memory budget in GB of the decoded input textures kept for the later jobs of a batch (0 disables it)
     double p = 8.0; // packing rasterization cache budget in GB
+    int s = 1; // number of merge operations evaluated concurrently
+    double sLazy = 0.0; // factor of the previous matching error of the clusters re-queued after a move, costed when they reach the top of the queue (0 disables it)
+    int sRasterOverlap = 0; // optimization areas with at least this many faces are also checked for overlaps by rasterization (0 disables it)
+    int sRasterResolution = 1024; // texels along the longest side of the grid of the rasterized overlap check
+    int j = 0; // parallel execution flags (see parallelFlags)
+    int jThreads[4] = {0, 0, 0, 0}; // threads of the greedy optimization, ARAP solves, packing and rendering (0 uses all of them)
+    std::string k = ""; // persistent packing rasterization cache directory
+    std::string h = ""; // packing layout file, reused for the unchanged charts and rewritten by the packing
+    std::string hBase = ""; // packing snapshot of the previous run on the mesh before the edit, whose unchanged charts are kept
+    double q = 16.0; // persistent packing rasterization cache budget in GB
+    int w = 2; // number of texture images encoded concurrently
+    int wDepth = 0; // requests in flight of the io_uring reads and writes (0 uses blocking calls)
+    double n = 4.0; // memory budget of the texture images waiting to be saved in GB
+    std::string nScratch = ""; // directory of the scratch files backing the full texture sheets
+    TextureFileFormat f = TextureFileFormat::PNG; // output texture file format
+    int fTile = 0; // side of the UDIM tiles the output textures are packed into (0 disables them)
+    std::string fShm = ""; // shared memory object the sheets are published to instead of being saved
+    int z = 90; // jpeg quality of the output textures
+    int v = 0; // input textures binding: 0 whole images, 1 pages, 2 texture array layers
+    int e = 0; // keep the input textures resident as BC7 blocks
+    int L = 0; // highest mip level of the input textures chosen from the footprint of the faces
+    int Z = 0; // gutter width in pixels dilated around the charts on the GPU
+    int V = 0; // levels of detail saved next to each texture sheet
+    int y = 1; // number of OpenGL contexts rendering the texture sheets
+    OpenGLBackend x = OpenGLBackend::Auto; // window system of the OpenGL contexts
+    std::string i = "auto"; // texture sheet renderer (gpu, cpu, auto or none)
+    std::string C = ""; // directory of the prepared mesh snapshots
+    bool CResults = false; // also cache the stage snapshots and the outputs of the jobs in C
+    int E = 0; // embed the textures in glb output files
+    int P = 0; // ARAP iterations of the distortion predictor
+    int M = 0; // minimum number of shell faces of the coarse-to-fine ARAP solve
+    std::string K = ""; // checkpoint file of the greedy optimization
+    double I = 600.0; // seconds between the checkpoints
+    std::string R = ""; // checkpoint the greedy optimization is resumed from
+    std::string O = ""; // log of the moves accepted by the greedy optimization
+    std::string Y = ""; // move log replayed instead of the greedy optimization
+    std::string F = ""; // base name of the stage snapshots written after the optimization and the packing
+    std::string U = ""; // stage snapshot the job is resumed from
+    std::string X = ""; // sweep file of the configurations optimized from the same prepared input
+    std::string H = ""; // JSON status file of the greedy optimization, rewritten as it progresses
+    int G = 1; // number of chart partitions optimized concurrently
+    int T = 0; // maximum number of faces of the tiles optimized one at a time
+    std::string TDir = ""; // work directory of a distributed job, shared with the workers
+    bool TWorker = false; // process the tiles and the sheets of the distributed job of TDir instead of a job of its own
+    double B = 0.0; // global memory budget in GB
+    std::string J = ""; // Chrome trace output file
+    std::string JTextures = ""; // texture access trace output file
+    std::string S = ""; // JSON run report output file
+    int A = 1; // write the log asynchronously
+    std::string D = ""; // batch manifest of JSON job specs ('-' for the standard input)
+    int Q[3] = {1, 1, 1}; // jobs loaded, optimized and packed concurrently in batch mode
+    int N = 0; // port of the metrics endpoint in batch mode (0 disables it)
+};
+
+// the flags of -j
+enum ParallelFlagBit : int {
+    PARALLEL_PACKING       = 1 << 0,
+    PARALLEL_HIERARCHICAL  = 1 << 1,
+    PARALLEL_NUMA          = 1 << 2,
+    PARALLEL_THP           = 1 << 3,
+    PARALLEL_HUGETLB       = 1 << 4,
+    PARALLEL_PERF          = 1 << 5,
+    PARALLEL_GPU_PACKING   = 1 << 6,
+    PARALLEL_DETERMINISTIC = 1 << 7,
+    PARALLEL_GPU_ARAP      = 1 << 8
+};
+
+struct ParallelFlag {
+    const char *name;
+    int flag;
+    const char *description;
+};
+
+// the flags of -j, by name and by value
+static const ParallelFlag parallelFlags[] = {
+    {"parallel",      PARALLEL_PACKING,       "pre-partitions the charts across the texture sheets and packs the sheets in parallel"},
+    {"hierarchical",  PARALLEL_HIERARCHICAL,  "searches the chart placements coarse-to-fine"},
+    {"numa",          PARALLEL_NUMA,          "binds the threads to the cores and places the mesh arrays on the NUMA nodes of the threads that process them"},
+    {"thp",           PARALLEL_THP,           "backs the large buffers (mesh arrays, packing grids and texture sheets) with transparent huge pages"},
+    {"hugetlb",       PARALLEL_HUGETLB,       "takes the large buffers from the hugetlb pool of the system"},
+    {"perf",          PARALLEL_PERF,          "logs and reports the cycles, instructions, cache and branch misses of the phases and of the timed scopes of the greedy optimization (Linux only)"},
+    {"gpu-packing",   PARALLEL_GPU_PACKING,   "evaluates the chart placements of the packing with compute shaders (requires OpenGL 4.3, the placements are the same)"},
+    {"deterministic", PARALLEL_DETERMINISTIC, "seeds the random choices of the packing and fixes its number of permutation trials, so that the output does not depend on the number of threads nor changes across runs (unless the greedy optimization is time limited)"},
+    {"gpu-arap",      PARALLEL_GPU_ARAP,      "runs the ARAP solves of the large shells with compute shaders, on the thread of the OpenGL context (requires OpenGL 4.3 with double precision, and a GPU rendering context, see -i)"}
 };
 
 void PrintArgsUsage(const char *binary);
 bool ParseOption(const std::string& option, const std::string& argument, Args *args);
 Args ParseArgs(int argc, char *argv[]);
 
-void EnsureOpenGLContextOrExit(std::unique_ptr<QOpenGLContext>& context, std::unique_ptr<QOffscreenSurface>& surface);
+bool CreateOpenGLContext(std::unique_ptr<QOpenGLContext>& context, std::unique_ptr<QOffscreenSurface>& surface);
+
+// How the texture sheets are rendered, chosen once for the process
+struct Renderer {
+    bool renderTextures = true;
+    bool softwareRendering = false;
+    std::shared_ptr<TextureAccessTrace> textureTrace; // records the texture binds of the jobs (-J textures=file), if set
+    std::shared_ptr<SheetSink> sheetSink; // receives the sheets of the jobs instead of the image files (-f shm=name), if set
+};
+
+/* A job processes one input mesh in four stages: loading (LoadJob), optimization
+ * (OptimizeJob) and packing (PackJob) on the CPU, then the texture rendering and
+ * the saving of the output on the thread of the OpenGL context (FinishJob). The
+ * phases are timed without the time spent waiting between the stages, the cpu time
+ * and peak memory of the phases are those of the whole process */
+struct Job {
+    Args args;
+    std::string id;
+    std::string savename;
+    bool failed = false;
+
+    Mesh m;
+    TextureObjectHandle textureObject;
+    std::vector<TextureSize> texszVec;
+    FaceBuckets faceBuckets; // faces by output sheet and input texture, computed after packing
+    std::unique_ptr<TexturePredecoder> predecoder; // input textures decoded ahead of the rendering (-c)
+
+    // state passed from a stage to the next
+    AlgoParameters ap;
+    GraphHandle graph;
+    AlgoStateHandle state;
+    std::map<RegionID, bool> flipped;
+    ChartOrientation orientation; // energy of the reoriented charts, released by the optimization
+    std::map<ChartHandle, int> anchorMap;
+    std::future<ValidationReport> validation; // integrity validation running in background (-l _,validation=async), logged by PackJob
+    SnapshotStage resumedAt = SnapshotStage::None; // stage the job was resumed at from a snapshot (-U)
+    bool prepared = false; // the charts were reoriented before the optimization stage (see RunSweep)
+
+    // keys of the result cache entries of the stages (-C dir,results=1), set when the
+    // input key is known
+    bool resultCache = false;
+    uint64_t optimizationKey = 0;
+    uint64_t packingKey = 0;
+    uint64_t outputKey = 0;
+    bool cachedOutput = false; // the outputs were restored from the result cache, the stages are skipped
+
+    int vndupIn = 0;
+    int vndupOut = 0;
+    int inputCharts = 0;
+    int outputCharts = 0;
+    double inputUVLen = 0;
+    double outputUVLen = 0;
+    double inputMP = 0;
+    double zeroResamplingFraction = 0;
+
+    Timer t;
+    Timer wall; // time of the job measured against the deadline (-W), never checked by the phases
+    PhaseBudget budget;
+    double queued = 0; // time spent waiting between the stages
+    std::map<std::string, double> timings;
+    std::clock_t phaseCPU = 0;
+    PerfCounterValues phaseCounters;
+    std::unique_ptr<TraceSpan> phaseSpan;
+
+    // the mesh memory of the jobs processed concurrently adds up in the counters
+    long long meshBytes = 0;
+
+    ~Job()
+    {
+        MemoryAdd(MemorySubsystem::Mesh, -meshBytes);
+    }
+
+    void UpdateMeshBytes()
+    {
+        long long bytes = EstimateMeshBytes(m);
+        MemoryAdd(MemorySubsystem::Mesh, bytes - meshBytes);
+        meshBytes = bytes;
+    }
+
+    // starts the first phase of a stage, the time since the previous stage ended
+    // is not part of it
+    void BeginPhase(const char *phase)
+    {
+        queued += t.TimeSinceLastCheck();
+        phaseSpan.reset(new TraceSpan(phase, "phase"));
+        phaseCPU = std::clock();
+        phaseCounters = ReadProcessPerfCounters();
+        ResetProcessPeakResident();
+    }
+
+    // ends the current phase and starts the next one (if any), the wall and cpu
+    // times and the peak memory of the phase are logged and reported
+    void EndPhase(const char *phase, const char *next)
+    {
+        timings[phase] = t.TimeSinceLastCheck();
+        double cpu = double(std::clock() - phaseCPU) / CLOCKS_PER_SEC;
+        if (next)
+            phaseSpan->Next(next);
+        else
+            phaseSpan->End();
+        LogMemoryBreakdown(phase);
+        std::string section = std::string("phases/") + phase;
+        ReportValue(section, "wall_s", timings[phase]);
+        ReportValue(section, "cpu_s", cpu);
+        long long peakResident = ProcessPeakResidentBytes();
+        ReportValue(section, "peak_rss_bytes", peakResident);
+        ReportValue(section, "tracked_bytes", MemoryUsedTotal());
+        MetricsObservePhase(phase, timings[phase], peakResident);
+        if (PerfCountersEnabled()) {
+            PerfCounterValues counters = ReadProcessPerfCounters();
+            LOG_INFO << "[PERF-COUNTERS] " << phase << ": " << FormatPerfCounters(counters - phaseCounters);
+            ReportPerfCounters(section, counters - phaseCounters);
+            phaseCounters = counters;
+        }
+        ResetProcessPeakResident();
+        phaseCPU = std::clock();
+    }
+};
+
+bool LoadJob(Job& job, const Renderer& renderer);
+bool ResumeJob(Job& job, const Renderer& renderer);
+void PrepareCharts(Job& job);
+bool OptimizeJob(Job& job);
+bool PackJob(Job& job);
+void BudgetOptimization(Job& job);
+void JoinValidation(Job& job);
+void ConfigureTextures(Job& job, const Renderer& renderer);
+void SetResultCacheKeys(Job& job, const Renderer& renderer, uint64_t inputKey);
+bool LookupResultCache(Job& job, const Renderer& renderer, const MeshCacheEntry& meshCacheEntry, const std::string& meshFile);
+void StoreResultCache(Job& job, TextureFileFormat sheetFormat, bool udimTiles);
+void SaveSnapshot(Job& job, SnapshotStage stage);
+bool SaveSnapshot(Job& job, SnapshotStage stage, const std::string& path);
+TextureSaveParameters SaveParametersFromArgs(const Args& args, const Renderer& renderer, bool udimTiles);
+bool FinishJob(Job& job, const Renderer& renderer);
+int RunWorker(const Args& args, const Renderer& renderer);
+int RunBatch(const Args& defaults, const Renderer& renderer);
+int RunSweep(const Args& defaults, const Renderer& renderer);
+AlgoParameters ParametersFromArgs(const Args& args);
 
 int main(int argc, char *argv[])
 {
+    // The arguments are parsed first, the OpenGL backend selects the Qt platform plugin
+    Args args = ParseArgs(argc, argv);
+
+    // the binding of the OpenMP threads is read when the runtime starts, this can restart the process
+    if (args.j & PARALLEL_NUMA)
+        EnableNumaPlacement(argv);
+
+    // before the large buffers are allocated
+    if (args.j & (PARALLEL_THP | PARALLEL_HUGETLB))
+        EnableHugePages(DEFAULT_HUGE_PAGE_THRESHOLD, (args.j & PARALLEL_HUGETLB) != 0);
+
+    LOG_INIT(args.l);
+
+    // the counters of the OpenMP threads are opened here, the log must be initialized
+    if (args.j & PARALLEL_PERF)
+        EnablePerfCounters();
+
+    // the writer thread of the log would not exist in the forked processes of a sweep
+    LOG_SET_ASYNC(args.A != 0 && args.X == "");
+    if (args.l > LOG_MAX_LEVEL)
+        LOG_WARN << "Logging level " << args.l << " requested, but the messages above level " << LOG_MAX_LEVEL << " are not compiled in this build";
+    if (args.N > 0 && args.D == "")
+        LOG_WARN << "The metrics endpoint is only served in batch mode (-D)";
+    if (args.cRetain > 0 && args.D == "")
+        LOG_WARN << "The decoded input textures are only kept across the jobs in batch mode (-D), retain= of -c is ignored";
+    // the OpenGL context cannot be used by the forked processes of a sweep
+    if (args.X != "" && args.i != "cpu" && args.i != "none") {
+        LOG_WARN << "The texture sheets of the sweep configurations are rendered on the CPU";
+        args.i = "cpu";
+    }
+    // the software renderer needs no OpenGL context, the offscreen platform does not
+    // require a window system
+    if (args.i == "cpu" || args.i == "none") {
+        if (!qEnvironmentVariableIsSet("QT_QPA_PLATFORM"))
+            qputenv("QT_QPA_PLATFORM", "offscreen");
+    } else {
+        SelectOpenGLBackend(args.x);
+    }
+
     // Make sure the executable directory is added to Qt's library path
     QApplication app(argc, argv);
 
@@ -87,270 +405,1740 @@ int main(int argc, char *argv[])
     std::unique_ptr<QOpenGLContext> mainContext;
     std::unique_ptr<QOffscreenSurface> mainSurface;
 
-    AlgoParameters ap;
+    Renderer renderer;
+    renderer.renderTextures = (args.i != "none");
+    renderer.softwareRendering = (args.i == "cpu");
+    if (renderer.renderTextures && !renderer.softwareRendering) {
+        LOG_INFO << "Verifying OpenGL context availability...";
+        bool hasContext = CreateOpenGLContext(mainContext, mainSurface);
+        bool hardware = hasContext && !IsSoftwareRenderer();
+        if (args.i == "gpu") {
+            if (!hasContext) {
+                LOG_ERR << "Failed to create the OpenGL context. Ensure an EGL driver is available for the headless backend (-x egl) or a valid X/GLX display (-x x11).";
+                std::exit(-1);
+            }
+            if (!hardware)
+                LOG_WARN << "[GL] The OpenGL context renders in software, texture rendering will be very slow. Check the GPU driver installation and the OpenGL backend (-x)";
+        } else if (!hardware) {
+            LOG_WARN << "No hardware OpenGL context is available, the texture sheets will be rendered on the CPU";
+            renderer.softwareRendering = true;
+        }
+    }
+    if (!renderer.renderTextures)
+        LOG_INFO << "Texture rendering is disabled, the texture sheets are not written";
+    else if (renderer.softwareRendering)
+        LOG_INFO << "Rendering the texture sheets on the CPU";
 
-    Args args = ParseArgs(argc, argv);
+#ifdef _OPENMP
+    LOG_INFO << "OpenMP is enabled.";
+    LOG_INFO << "Number of available processors: " << omp_get_num_procs();
+    LOG_INFO << "Max threads: " << omp_get_max_threads();
+    LOG_INFO << "NUMA nodes: " << GetNumaTopology().nodes << (NumaPlacementEnabled() ? " (placement of the mesh arrays enabled)" : "");
+    LOG_INFO << "Thread binding: " << OpenMPBindingInfo();
+    LOG_INFO << "Transparent huge pages: " << TransparentHugePageMode() << (HugePagesEnabled() ? " (huge pages of the large buffers enabled)" : "");
+#else
+    LOG_INFO << "OpenMP is not enabled.";
+#endif
+    LOG_INFO << "CPU SIMD support: " << SimdLevelName(DetectSimdLevel());
+    LOG_INFO << "SIMD kernels: " << SimdLevelName(KernelSimdLevel()) << (SIMD_DISPATCH_ENABLED ? " (runtime dispatch)" : " (compile time)");
+    CalibrateParallelMinFaces();
+
+    if (args.B > 0) {
+        SetMemoryBudget(static_cast<std::size_t>(args.B * 1024.0 * 1024.0 * 1024.0));
+        LOG_INFO << "Memory budget configured to " << args.B << " GB";
+    }
+
+    SetAsyncIODepth(args.wDepth);
+
+    // enough spans per thread for the phases and the last moves of the greedy optimization
+    const std::size_t TRACE_SPANS_PER_THREAD = 1 << 18;
+    if (args.J != "")
+        EnableTracing(TRACE_SPANS_PER_THREAD);
 
+    if (args.fShm != "" && renderer.renderTextures) {
+        renderer.sheetSink = CreateSharedMemorySheetSink(args.fShm, SHEET_RING_DEFAULT_SLOTS, SHEET_RING_DEFAULT_SLOT_BYTES);
+        if (!renderer.sheetSink)
+            std::exit(-1);
+    }
+
+    if (args.JTextures != "" && renderer.renderTextures && !renderer.softwareRendering) {
+        renderer.textureTrace = std::make_shared<TextureAccessTrace>(args.JTextures);
+        if (!renderer.textureTrace->Good()) {
+            LOG_WARN << "Unable to write the texture access trace " << args.JTextures;
+            renderer.textureTrace.reset();
+        }
+    }
+
+    int status = 0;
+    if (args.TWorker) {
+        status = RunWorker(args, renderer);
+    } else if (args.X != "") {
+        status = (RunSweep(args, renderer) > 0) ? 1 : 0;
+    } else if (args.D != "") {
+        if (args.N > 0 && !StartMetricsServer(args.N))
+            std::exit(-1);
+        status = (RunBatch(args, renderer) > 0) ? 1 : 0;
+        StopMetricsServer();
+    } else {
+        std::unique_ptr<Job> job(new Job);
+        job->args = args;
+        job->t.Reset();
+        bool ok = LoadJob(*job, renderer) && OptimizeJob(*job) && PackJob(*job);
+        if (ok)
+            FinishJob(*job, renderer);
+        // the workers of a distributed job stop once the coordinator exits
+        if (args.TDir != "")
+            WorkDirectory(args.TDir).MarkDone("job");
+        if (!ok)
+            std::exit(-1);
+    }
+
+    // the remote textures still queued are no longer needed
+    RemoteInputStats remoteStats = GetRemoteInputStats();
+    if (remoteStats.files + remoteStats.reused + remoteStats.failed > 0)
+        LOG_INFO << "Remote inputs: " << remoteStats.files << " files downloaded (" << remoteStats.bytes / double(1 << 20) << " MB in "
+                 << remoteStats.transferS << " thread seconds), " << remoteStats.reused << " staged copies reused, " << remoteStats.failed
+                 << " failed, " << remoteStats.waits << " waits (" << remoteStats.waitS << " seconds)";
+    StopRemoteFetches();
+
+    if (args.J != "") {
+        if (WriteTrace(args.J))
+            LOG_INFO << "Saved the execution trace to " << args.J;
+        else
+            LOG_WARN << "Unable to write the execution trace " << args.J;
+    }
+
+    // waits for the consumer to read the sheets left
+    renderer.sheetSink.reset();
+
+    if (renderer.textureTrace) {
+        if (renderer.textureTrace->Flush())
+            LOG_INFO << "Saved the texture access trace to " << args.JTextures;
+        else
+            LOG_WARN << "Unable to write the texture access trace " << args.JTextures;
+    }
+
+    return status;
+}
+
+bool LoadJob(Job& job, const Renderer& renderer)
+{
+    const Args& args = job.args;
+    Mesh& m = job.m;
+    TextureObjectHandle& textureObject = job.textureObject;
+    int loadMask;
+
+    job.ap = ParametersFromArgs(args);
+
+    if (args.U != "")
+        return ResumeJob(job, renderer);
+
+    // with a mesh cache directory, the preparation of the mesh is skipped if a
+    // snapshot of the same input exists
+    // the caches work on the staged copy of a remote mesh (see remote_input.h)
+    std::string meshFile = args.infile;
+    if (args.C != "" && IsRemoteUri(meshFile)) {
+        meshFile = StageRemoteMesh(meshFile);
+        if (meshFile.empty()) {
+            LOG_ERR << "Failed to open mesh";
+            return false;
+        }
+    }
+
+    MeshCacheEntry meshCacheEntry;
+    bool useMeshCache = false;
+    bool meshFromCache = false;
+    if (args.C != "") {
+        useMeshCache = GetMeshCacheEntry(args.C, meshFile.c_str(), &meshCacheEntry);
+        if (!useMeshCache)
+            LOG_WARN << "Unable to use " << args.C << " as mesh cache directory";
+    }
+
+    // with the result cache, the outputs of the same input and options are restored
+    // or the job is resumed from the snapshot of the latest stage cached
+    if (useMeshCache && args.CResults && LookupResultCache(job, renderer, meshCacheEntry, meshFile))
+        return job.cachedOutput || ResumeJob(job, renderer);
+
+    job.BeginPhase("Load mesh");
+
+    if (useMeshCache)
+        meshFromCache = LoadMeshCache(meshCacheEntry, meshFile.c_str(), m, textureObject, &loadMask, &job.vndupIn);
+
+    if (!meshFromCache && LoadMesh(args.infile.c_str(), m, textureObject, loadMask) == false) {
+        LOG_ERR << "Failed to open mesh";
+        return false;
+    }
+
+    // the paths of the textures of a mesh loaded for the first time are only known now
+    if (useMeshCache && args.CResults && !job.resultCache) {
+        QDir meshDir = QFileInfo(meshFile.c_str()).absoluteDir();
+        std::vector<std::string> texturePaths;
+        for (const std::string& name : m.textures)
+            texturePaths.push_back(meshDir.absoluteFilePath(name.c_str()).toStdString());
+        SetResultCacheKeys(job, renderer, InputCacheKey(meshCacheEntry.hash, texturePaths));
+    }
+    job.UpdateMeshBytes();
+    job.EndPhase("Load mesh", "Mesh preparation & Graph computation");
+
+    ConfigureTextures(job, renderer);
+
+    LOG_INFO << "[DIAG] Input mesh loaded: " << m.FN() << " faces, " << m.VN() << " vertices.";
+
+    ensure(loadMask & tri::io::Mask::IOM_WEDGTEXCOORD);
+    if (!meshFromCache) {
+        ScaleTextureCoordinatesToImage(m, textureObject);
+
+        LOG_VERBOSE << "Preparing mesh...";
+
+        PrepareMesh(m, &job.vndupIn);
+        ComputeWedgeTexCoordStorageAttribute(m);
+
+        if (useMeshCache)
+            SaveMeshCache(meshCacheEntry, m, textureObject, loadMask, job.vndupIn);
+    }
+
+    job.graph = ComputeGraph(m, textureObject);
+    job.UpdateMeshBytes();
+
+    // the arrays were filled by this thread, move them close to the threads of the parallel loops
+    if (NumaPlacementEnabled()) {
+        DistributeStatic(m.vert);
+        DistributeStatic(m.face);
+        auto wtcsa = GetWedgeTexCoordStorageAttribute(m);
+        if (m.FN() > 0)
+            DistributeStatic(&wtcsa[m.face[0]], m.face.size() * sizeof(wtcsa[m.face[0]]));
+    }
+
+    // the mesh containers use the default allocator of vcg, so their pages are
+    // collapsed into huge pages after they are filled
+    if (HugePagesEnabled()) {
+        AdviseHugePages(m.vert);
+        AdviseHugePages(m.face);
+        auto wtcsa = GetWedgeTexCoordStorageAttribute(m);
+        if (m.FN() > 0)
+            AdviseHugePages(&wtcsa[m.face[0]], m.face.size() * sizeof(wtcsa[m.face[0]]));
+    }
+
+    job.EndPhase("Mesh preparation & Graph computation", nullptr);
+
+    return true;
+}
+
+// replaces the status file atomically, so that it can be polled while it is rewritten
+static void WriteProgressFile(const std::string& path, const GreedyProgress& progress)
+{
+    QJsonObject status;
+    status.insert("iterations", progress.iterations);
+    status.insert("accepted", progress.accepted);
+    status.insert("rejected", progress.rejected);
+    status.insert("queue_size", (double) progress.queueSize);
+    status.insert("valid_moves", (double) progress.validMoves);
+    status.insert("accept_ratio", progress.acceptRatio);
+    status.insert("moves_per_s", progress.movesPerSecond);
+    status.insert("uv_border_ratio", progress.borderRatio);
+    status.insert("uv_border_target", progress.borderTarget);
+    status.insert("elapsed_s", progress.elapsed);
+    status.insert("eta_s", progress.remaining);
+    status.insert("done", progress.done);
+
+    QSaveFile file(QString::fromStdString(path));
+    if (!file.open(QIODevice::WriteOnly)
+            || file.write(QJsonDocument(status).toJson(QJsonDocument::Compact)) < 0
+            || !file.commit())
+        LOG_WARN << "Unable to write the status file " << path;
+}
+
+AlgoParameters ParametersFromArgs(const Args& args)
+{
+    AlgoParameters ap;
     ap.matchingThreshold = args.m;
+    ap.coincidentSeamTolerance = args.mCoincident;
+    ap.reduce = (args.mReduce != "off");
+    ap.reduceBisection = (args.mReduce == "bisection");
     ap.boundaryTolerance = args.b;
     ap.distortionTolerance = args.d;
+    ParseARAPSolverBackend(args.dSolver, &ap.arapSolver);
+    ap.arapSolverTolerance = args.dSolverTolerance;
+    ap.arapAndersonWindow = args.dAnderson;
+    ap.arapEarlyStopMargin = args.dEarlyStop;
+    ap.scaffoldWidth = args.dScaffold;
     ap.globalDistortionThreshold = args.g;
     ap.UVBorderLengthReduction = args.u;
     ap.offsetFactor = args.a;
     ap.timelimit = args.t;
     ap.rotationNum = args.r;
+    ap.mergeBatchSize = args.s;
+    ap.lazyCostFactor = args.sLazy;
+    ap.rasterOverlapFaces = args.sRasterOverlap;
+    ap.rasterOverlapResolution = args.sRasterResolution;
+    ap.parallelPacking = (args.j & PARALLEL_PACKING) != 0;
+    ap.hierarchicalPacking = (args.j & PARALLEL_HIERARCHICAL) != 0;
+    ap.gpuPacking = (args.j & PARALLEL_GPU_PACKING) != 0;
+    ap.deterministic = (args.j & PARALLEL_DETERMINISTIC) != 0;
+    ap.arapGPUFaces = (args.j & PARALLEL_GPU_ARAP) ? GPU_ARAP_DEFAULT_MIN_FACES : 0;
+    ap.greedyThreads = args.jThreads[0];
+    ap.arapThreads = args.jThreads[1];
+    ap.packingThreads = args.jThreads[2];
+    ap.packingLayoutFile = args.h;
+    ap.tileSize = args.fTile;
+    ap.prescreenIterations = args.P;
+    ap.arapMultilevelFaces = args.M;
+    ap.checkpointFile = args.K;
+    ap.checkpointInterval = args.I;
+    ap.partitions = args.G;
+    ap.moveLogFile = args.O;
+    if (args.H != "") {
+        std::string path = args.H;
+        ap.progressCallback = [path] (const GreedyProgress& progress) { WriteProgressFile(path, progress); };
+    }
+    return ap;
+}
 
-    LOG_INIT(args.l);
+// loads the stage snapshot args.U in place of the input mesh, the stages before
+// the one of the snapshot are skipped
+bool ResumeJob(Job& job, const Renderer& renderer)
+{
+    job.BeginPhase("Load snapshot");
 
-    LOG_INFO << "Verifying OpenGL context availability...";
-    EnsureOpenGLContextOrExit(mainContext, mainSurface);
+    StageSnapshot snapshot;
+    if (!LoadStageSnapshot(job.args.U, job.m, job.textureObject, snapshot)) {
+        LOG_ERR << "Unable to resume from the stage snapshot " << job.args.U;
+        return false;
+    }
+    ConfigureTextures(job, renderer);
+
+    if (job.args.infile == "")
+        job.args.infile = snapshot.inputFile;
+    job.resumedAt = snapshot.stage;
+    job.vndupIn = snapshot.vndupIn;
+    job.vndupOut = snapshot.vndupOut;
+    job.inputCharts = snapshot.inputCharts;
+    job.outputCharts = snapshot.outputCharts;
+    job.inputUVLen = snapshot.inputUVLen;
+    job.outputUVLen = snapshot.outputUVLen;
+    job.inputMP = snapshot.inputMP;
+    job.zeroResamplingFraction = snapshot.zeroResamplingFraction;
+    job.graph = snapshot.graph;
+    job.flipped = std::move(snapshot.flipped);
+    job.anchorMap = std::move(snapshot.anchorMap);
+    job.texszVec = std::move(snapshot.texszVec);
+
+    job.savename = job.args.outfile;
+    if (job.savename == "")
+        job.savename = "out_" + job.m.name;
+    if (job.savename.substr(job.savename.size() - 3, 3) == "fbx")
+        job.savename.append(".obj");
+
+    if (job.resumedAt == SnapshotStage::Rendering)
+        BucketFaces(job.m, job.faceBuckets);
+
+    job.UpdateMeshBytes();
+    job.EndPhase("Load snapshot", nullptr);
 
-#ifdef _OPENMP
-    LOG_INFO << "OpenMP is enabled.";
-    LOG_INFO << "Number of available processors: " << omp_get_num_procs();
-    LOG_INFO << "Max threads: " << omp_get_max_threads();
-#else
-    LOG_INFO << "OpenMP is not enabled.";
-#endif
+    return true;
+}
 
-    Mesh m;
-    TextureObjectHandle textureObject;
-    int loadMask;
+void ConfigureTextures(Job& job, const Renderer& renderer)
+{
+    // Configure GPU texture cache budget
+    if (job.textureObject) {
+        uint64_t budget = 0;
+        uint64_t available = 0;
+        if (job.args.c >= 0) {
+            job.textureObject->SetCacheBudgetGB(job.args.c);
+            LOG_INFO << "Texture GPU cache budget configured to " << job.args.c << " GB";
+        } else if (!renderer.softwareRendering && DetectTextureCacheBudget(job.args.y, &budget, &available)) {
+            job.textureObject->SetCacheBudgetBytes(budget);
+            LOG_INFO << "Texture GPU cache budget configured to " << (budget / (1024.0 * 1024.0 * 1024.0)) << " GB (detected "
+                     << (available / (1024.0 * 1024.0 * 1024.0)) << " GB of free GPU memory)";
+        } else {
+            job.textureObject->SetCacheBudgetGB(8.0);
+            LOG_INFO << "Texture GPU cache budget configured to 8 GB (free GPU memory not available)";
+        }
+        if (job.args.e && !renderer.softwareRendering)
+            job.textureObject->SetCompressedResidency(true);
+
+        // the buffered trace would be written again by the forked processes of a sweep
+        if (renderer.textureTrace && job.args.X == "")
+            job.textureObject->SetAccessTrace(renderer.textureTrace, renderer.textureTrace->BeginJob(job.id != "" ? job.id : job.args.infile));
+
+        // the threads would not exist in the forked processes of a sweep
+        if (job.args.cPredecode > 0 && renderer.renderTextures && job.args.X == "") {
+            std::size_t budgetBytes = MemoryBudgetLimit(std::size_t(job.args.cPredecode * 1024.0 * 1024.0 * 1024.0), 0.5);
+            job.predecoder.reset(new TexturePredecoder(job.textureObject, budgetBytes, 2));
+            LOG_INFO << "Decoding the input textures in the background within " << (budgetBytes / (1024.0 * 1024.0 * 1024.0)) << " GB";
+        }
+    }
+}
 
-    Timer t;
-    std::map<std::string, double> timings;
+// with a snapshot base name (-F), writes the snapshot the pipeline can be resumed
+// from at the given stage
+void SaveSnapshot(Job& job, SnapshotStage stage)
+{
+    const char *extension = (stage == SnapshotStage::Packing) ? "pack" : "render";
+
+    if (job.args.F != "") {
+        std::string path = job.args.F + "." + extension;
+        if (SaveSnapshot(job, stage, path))
+            LOG_INFO << "Saved the stage snapshot " << path;
+        else
+            LOG_WARN << "Unable to write the stage snapshot " << path;
+    }
 
-    if (LoadMesh(args.infile.c_str(), m, textureObject, loadMask) == false) {
-        LOG_ERR << "Failed to open mesh";
-        std::exit(-1);
+    // the snapshot is the result cache entry of the stage, written aside and renamed
+    // so that a concurrent job never resumes from a partial entry
+    if (job.resultCache) {
+        uint64_t key = (stage == SnapshotStage::Packing) ? job.optimizationKey : job.packingKey;
+        std::string path = ResultCachePath(job.args.C, key, extension);
+        std::string staging = path + ".tmp" + std::to_string(std::random_device()());
+        if (QFileInfo(path.c_str()).exists())
+            return;
+        if (SaveSnapshot(job, stage, staging) && QFile::rename(staging.c_str(), path.c_str())) {
+            LOG_VERBOSE << "Stored the stage snapshot in the result cache entry " << path;
+        } else {
+            QFile::remove(staging.c_str());
+            LOG_WARN << "Unable to store the result cache entry " << path;
+        }
     }
-    timings["Load mesh"] = t.TimeSinceLastCheck();
+}
 
-    // Configure GPU texture cache budget
-    if (textureObject) {
-        textureObject->SetCacheBudgetGB(args.c);
-        LOG_INFO << "Texture GPU cache budget configured to " << args.c << " GB";
+// writes the snapshot of the job at the given stage to path
+bool SaveSnapshot(Job& job, SnapshotStage stage, const std::string& path)
+{
+    StageSnapshot snapshot;
+    snapshot.stage = stage;
+    snapshot.inputFile = job.args.infile;
+    snapshot.vndupIn = job.vndupIn;
+    snapshot.vndupOut = job.vndupOut;
+    snapshot.inputCharts = job.inputCharts;
+    snapshot.outputCharts = job.outputCharts;
+    snapshot.inputUVLen = job.inputUVLen;
+    snapshot.outputUVLen = job.outputUVLen;
+    snapshot.inputMP = job.inputMP;
+    snapshot.zeroResamplingFraction = job.zeroResamplingFraction;
+    if (stage == SnapshotStage::Packing) {
+        snapshot.graph = job.graph;
+        snapshot.flipped = job.flipped;
+        snapshot.anchorMap = job.anchorMap;
+    } else {
+        snapshot.texszVec = job.texszVec;
+    }
+
+    return SaveStageSnapshot(path, job.m, job.textureObject, snapshot);
+}
+
+// returns the name of the output file of the job before its mesh is loaded
+static std::string CachedSaveName(const Args& args)
+{
+    std::string savename = args.outfile;
+    if (savename == "") {
+        QFileInfo fi(args.infile.c_str());
+        fi.makeAbsolute();
+        savename = "out_" + fi.dir().dirName().toStdString() + "_" + fi.fileName().toStdString();
     }
+    if (savename.substr(savename.size() - 3, 3) == "fbx")
+        savename.append(".obj");
+    return savename;
+}
 
-    // Configure packing rasterization cache budget
+// sets the keys of the result cache entries of the job, each extending the key of
+// the previous stage with the options the stage depends on
+void SetResultCacheKeys(Job& job, const Renderer& renderer, uint64_t inputKey)
+{
+    const Args& args = job.args;
+
+    CacheKey optimization(inputKey);
+    optimization.Add(args.m).Add(args.mCoincident).Add(args.mReduce).Add(args.b).Add(args.d).Add(args.dSolver).Add(args.dSolverTolerance).Add(args.dAnderson).Add(args.dEarlyStop).Add(args.dScaffold).Add(args.g).Add(args.u).Add(args.a).Add(args.t).Add(args.W)
+            .Add(args.s).Add(args.sLazy).Add(args.sRasterOverlap).Add(args.sRasterResolution).Add(args.P).Add(args.M).Add(args.G).Add(args.T).Add(args.R).Add(args.Y).Add(args.hBase).Add(args.j & PARALLEL_GPU_ARAP);
+
+    CacheKey packing(optimization.Value());
+    packing.Add(args.r).Add(args.j & (PARALLEL_PACKING | PARALLEL_HIERARCHICAL | PARALLEL_DETERMINISTIC)).Add(args.h).Add(args.fTile);
+
+    // the output files are named after the output file, wherever they are written
+    CacheKey output(packing.Value());
+    output.Add(QFileInfo(CachedSaveName(args).c_str()).fileName().toStdString()).Add(int(args.f)).Add(args.z).Add(args.Z).Add(args.V)
+            .Add(args.E).Add(args.L).Add(args.v).Add(args.e).Add(renderer.renderTextures).Add(renderer.softwareRendering);
+
+    job.resultCache = true;
+    job.optimizationKey = optimization.Value();
+    job.packingKey = packing.Value();
+    job.outputKey = output.Value();
+}
+
+/* Looks up the result cache entries of the job, latest stage first. Returns true if
+ * the outputs were restored (job.cachedOutput) or if the job is to be resumed from
+ * the snapshot of a stage (job.args.U). The keys are only set here if the snapshot
+ * of the prepared mesh lists the input textures. meshFile is the local path of the
+ * input mesh */
+bool LookupResultCache(Job& job, const Renderer& renderer, const MeshCacheEntry& meshCacheEntry, const std::string& meshFile)
+{
+    Args& args = job.args;
+
+    std::vector<std::string> texturePaths;
+    if (!ReadMeshCacheTextures(meshCacheEntry, meshFile.c_str(), texturePaths))
+        return false;
+    SetResultCacheKeys(job, renderer, InputCacheKey(meshCacheEntry.hash, texturePaths));
+
+    std::string savename = CachedSaveName(args);
+    std::string outputDir = QFileInfo(savename.c_str()).absolutePath().toStdString();
+    if (RestoreCachedOutput(args.C, job.outputKey, outputDir, args.S)) {
+        LOG_INFO << "Restored the outputs of " << args.infile << " from the result cache";
+        job.savename = savename;
+        job.cachedOutput = true;
+        return true;
+    }
+
+    for (uint64_t key : {job.packingKey, job.optimizationKey}) {
+        std::string path = ResultCachePath(args.C, key, (key == job.packingKey) ? "render" : "pack");
+        if (QFileInfo(path.c_str()).exists()) {
+            LOG_INFO << "Resuming " << args.infile << " from the result cache entry " << path;
+            args.U = path;
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Stores the output files of the job and its run report in the result cache: the
+ * mesh, its material library, the texture sheets and their levels of detail */
+void StoreResultCache(Job& job, TextureFileFormat sheetFormat, bool udimTiles)
+{
+    const Args& args = job.args;
+
+    QFileInfo meshInfo(job.savename.c_str());
+    QDir outputDir = meshInfo.absoluteDir();
+    std::vector<std::string> files = {meshInfo.absoluteFilePath().toStdString()};
+    std::string mtl = job.savename + ".mtl";
+    if (QFileInfo(mtl.c_str()).exists())
+        files.push_back(mtl);
+    std::string extension = TextureFileExtension(sheetFormat);
+    for (const std::string& name : TextureSheetNames(job.savename, job.texszVec.size(), sheetFormat, udimTiles)) {
+        std::string base = name.substr(0, name.size() - extension.size() - 1);
+        std::vector<std::string> names = {name};
+        for (int k = 1; k <= args.V; ++k)
+            names.push_back(base + "_lod" + std::to_string(k) + "." + extension);
+        for (const std::string& n : names) {
+            QString path = outputDir.absoluteFilePath(n.c_str());
+            if (QFileInfo(path).exists())
+                files.push_back(path.toStdString());
+        }
+    }
+
+    if (StoreCachedOutput(args.C, job.outputKey, files, args.S))
+        LOG_VERBOSE << "Stored the " << files.size() << " output files in the result cache";
+    else
+        LOG_WARN << "Unable to store the outputs in the result cache";
+}
+
+bool OptimizeJob(Job& job)
+{
+    const Args& args = job.args;
+    const AlgoParameters& ap = job.ap;
+    Mesh& m = job.m;
+    GraphHandle graph = job.graph;
+    AlgoStateHandle& state = job.state;
+    std::map<RegionID, bool>& flipped = job.flipped;
+
+    if (job.resumedAt != SnapshotStage::None || job.cachedOutput)
+        return true;
+
+    job.BeginPhase("Greedy optimization");
+
+    if (!job.prepared)
+        PrepareCharts(job);
+
+    if ((args.O != "" || args.Y != "") && (args.T > 0 || args.R != "" || args.G > 1)) {
+        LOG_ERR << "Move logs are not supported with tiles, partitions or checkpoints";
+        return false;
+    }
+
+    if (args.hBase != "" && (args.T > 0 || args.R != "" || args.K != "" || args.O != "" || args.Y != "" || args.X != "")) {
+        LOG_ERR << "Incremental runs are not supported with tiles, checkpoints, move logs or sweeps";
+        return false;
+    }
+
+    IncrementalCharts kept;
+
+    if (args.T > 0) {
+        if (args.R != "" || args.K != "") {
+            LOG_ERR << "Checkpoints are not supported when optimizing the atlas in tiles";
+            return false;
+        }
+        BudgetOptimization(job);
+        if (args.TDir != "") {
+            // the workers optimize the tiles of the prepared mesh published as a snapshot
+            WorkDirectory dir(args.TDir);
+            if (dir.Exists("prepared.pack") || dir.Exists("job.done")) {
+                LOG_ERR << "The work directory " << args.TDir << " is not empty";
+                return false;
+            }
+            if (!SaveSnapshot(job, SnapshotStage::Packing, dir.FilePath("prepared.pack"))) {
+                LOG_ERR << "Unable to write the prepared mesh to the work directory " << args.TDir;
+                return false;
+            }
+            state = OptimizeTiles(graph, ap, args.T, &dir);
+        } else {
+            state = OptimizeTiles(graph, ap, args.T);
+        }
+    } else if (args.hBase != "") {
+        BudgetOptimization(job);
+        state = OptimizeIncremental(graph, ap, args.hBase, kept);
+        if (!state) {
+            LOG_ERR << "Unable to load the packing snapshot " << args.hBase << " of the previous run";
+            return false;
+        }
+    } else if (args.Y != "") {
+        state = InitializeState(graph, ap, &job.orientation);
+        if (!ReplayOptimization(graph, state, ap, args.Y)) {
+            LOG_ERR << "Unable to replay the optimization from " << args.Y;
+            return false;
+        }
+    } else {
+        if (args.R != "") {
+            state = LoadCheckpoint(args.R, graph);
+            if (!state) {
+                LOG_ERR << "Unable to resume the optimization from " << args.R;
+                return false;
+            }
+        } else if (!state) {
+            // in a sweep the state can be initialized before the job is forked
+            state = InitializeState(graph, ap, &job.orientation);
+        }
+
+        BudgetOptimization(job);
+        GreedyOptimization(graph, state, ap);
+    }
+    // the tiles and the incremental optimization rebuild the graph
+    job.graph = graph;
+    job.orientation = ChartOrientation();
+    job.EndPhase("Greedy optimization", "Finalize");
+
+    job.savename = args.outfile;
+    if (job.savename == "")
+        job.savename = "out_" + m.name;
+    if (job.savename.substr(job.savename.size() - 3, 3) == "fbx")
+        job.savename.append(".obj");
+
+    Finalize(graph, job.savename, &job.vndupOut);
+    job.UpdateMeshBytes();
+    job.EndPhase("Finalize", "Chart rotation");
+
+    bool colorize = true;
+
+    if (colorize) {
+        auto faceColor = GetFaceColorAttribute(m);
+        for (auto& f : m.face)
+            faceColor[f] = vcg::Color4b(91, 130, 200, 255);
+    }
+
+    LOG_INFO << "Rotating charts...";
+    double zeroResamplingMeshArea = RotateChartsForResampling(graph, state->changeSet, flipped, colorize, job.anchorMap, &kept.kept);
+    for (const auto& entry : kept.anchors)
+        job.anchorMap[graph->GetChart(entry.first)] = entry.second;
+    zeroResamplingMeshArea += kept.anchoredArea;
+    job.EndPhase("Chart rotation", nullptr);
+    job.zeroResamplingFraction = zeroResamplingMeshArea / graph->Area3D();
+
+    if (args.lValidation != ValidationLevel::Off) {
+        LOG_INFO << "[VALIDATION] Checking graph and mesh integrity post-optimization...";
+        if (args.lValidationAsync)
+            job.validation = ValidateIntegrityAsync(graph, args.lValidation);
+        else
+            LogValidationReport(ValidateIntegrity(graph, args.lValidation));
+    }
+
+    // the state removes its memory from the SeamState counter
+    state.reset();
+
+    job.outputCharts = graph->Count();
+    job.outputUVLen = graph->BorderUV();
+
+    SaveSnapshot(job, SnapshotStage::Packing);
+
+    return true;
+}
+
+// records the orientation and the size of the input charts, then orients the charts
+// coherently and stores the wtc attribute
+void PrepareCharts(Job& job)
+{
+    GraphHandle graph = job.graph;
+
+    // mirroring the charts changes none of the aggregates of the graph
+    ReorientCharts(graph, &job.orientation);
+    job.flipped = std::move(job.orientation.flipped);
+
+    job.inputMP = job.textureObject->GetResolutionInMegaPixels();
+    job.inputCharts = graph->Count();
+    job.inputUVLen = graph->BorderUV();
+    job.prepared = true;
+}
+
+// with a deadline (-W), reserves the estimated time of the phases that follow the
+// greedy optimization and limits the optimization to what is left
+void BudgetOptimization(Job& job)
+{
+    if (job.args.W <= 0)
+        return;
+
+    job.budget = ComputePhaseBudget(job.args.W, job.wall.TimeElapsed(), job.graph->Count(), job.m.FN(), job.inputMP);
+    job.ap.timelimit = BudgetTimeLimit(job.budget, job.args.t);
+    ReportPhaseBudget(job.budget);
+}
+
+// waits for the background integrity validation of the job, if any, and logs it
+void JoinValidation(Job& job)
+{
+    if (job.validation.valid())
+        LogValidationReport(job.validation.get());
+}
+
+bool PackJob(Job& job)
+{
+    const Args& args = job.args;
+    Mesh& m = job.m;
+    GraphHandle graph = job.graph;
+
+    if (job.resumedAt == SnapshotStage::Rendering || job.cachedOutput)
+        return true;
+
+    job.BeginPhase("Packing");
+
+    // Configure packing rasterization cache budget, the cache is shared by the jobs
+    // of a batch. The persistent cache is the same for all the jobs, and is opened
+    // by the first one before any rasterization
     {
-        std::size_t rasterCacheBytes = (args.p <= 0.0)
-            ? 0
-            : static_cast<std::size_t>(args.p * 1024.0 * 1024.0 * 1024.0);
-        SetRasterizerCacheMaxBytes(rasterCacheBytes);
-        LOG_INFO << "Packing rasterization cache budget configured to " << args.p << " GB";
+        if (args.p < 0.0) {
+            SetRasterizerCacheAutoSize(RASTERIZER_CACHE_FREE_MEMORY_FRACTION);
+            LOG_INFO << "Packing rasterization cache budget configured from the free system memory";
+        } else {
+            std::size_t rasterCacheBytes = (args.p == 0.0)
+                ? 0
+                : static_cast<std::size_t>(args.p * 1024.0 * 1024.0 * 1024.0);
+            SetRasterizerCacheAutoSize(0);
+            SetRasterizerCacheMaxBytes(rasterCacheBytes);
+            LOG_INFO << "Packing rasterization cache budget configured to " << args.p << " GB";
+        }
     }
+    static std::mutex rasterizerDiskCacheMutex;
+    static std::string rasterizerDiskCache;
+    std::unique_lock<std::mutex> diskCacheLock(rasterizerDiskCacheMutex);
+    if (args.k != "" && args.k != rasterizerDiskCache) {
+        std::size_t diskCacheBytes = static_cast<std::size_t>(std::max(args.q, 0.0) * 1024.0 * 1024.0 * 1024.0);
+        if (SetRasterizerDiskCache(args.k, diskCacheBytes)) {
+            LOG_INFO << "Persistent packing rasterization cache in " << args.k << " (" << args.q << " GB)";
+            rasterizerDiskCache = args.k;
+        } else {
+            LOG_WARN << "Unable to use " << args.k << " as packing rasterization cache directory";
+        }
+    }
+    diskCacheLock.unlock();
 
-    LOG_INFO << "[DIAG] Input mesh loaded: " << m.FN() << " faces, " << m.VN() << " vertices.";
+    // pack the atlas
 
-    ensure(loadMask & tri::io::Mask::IOM_WEDGTEXCOORD);
-    tri::UpdateTopology<Mesh>::FaceFace(m);
+    // first discard zero-area charts
+    std::vector<ChartHandle> chartsToPack;
+    for (auto& entry : graph->charts) {
+        if (entry.second->AreaUV() != 0) {
+            chartsToPack.push_back(entry.second);
+        } else {
+            for (auto fptr : entry.second->fpVec) {
+                for (int j = 0; j < fptr->VN(); ++j) {
+                    fptr->V(j)->T().P() = Point2d::Zero();
+                    fptr->V(j)->T().N() = 0;
+                    fptr->WT(j).P() = Point2d::Zero();
+                    fptr->WT(j).N() = 0;
+                }
+            }
+        }
+    }
+
+    LOG_INFO << "Packing atlas of size " << chartsToPack.size();
+
+    std::vector<TextureSize>& texszVec = job.texszVec;
+    int npacked = Pack(chartsToPack, job.textureObject, texszVec, job.ap, job.anchorMap);
+    job.EndPhase("Packing", "Texture trimming");
+
+    LOG_INFO << "Packed " << npacked << " charts in " << job.timings["Packing"] << " seconds";
+
+    JoinValidation(job);
+
+    LOG_INFO << "[DIAG] Packing function finished.";
+    if (npacked < (int) chartsToPack.size()) {
+        LOG_ERR << "[VALIDATION] Not all charts were packed! Expected " << chartsToPack.size() << ", got " << npacked;
+        // The original code exits here, which is correct. This just adds a clearer log.
+        return false;
+    }
+
+    int64_t totalNewTexturePixels = 0;
+    for (const auto& sz : texszVec) {
+        totalNewTexturePixels += (int64_t)sz.w * sz.h;
+    }
+    double totalNewTextureMB = (totalNewTexturePixels * 4.0) / (1024.0 * 1024.0);
+    LOG_INFO << "[DIAG] Total texture memory to be allocated by rendering: " << totalNewTextureMB << " MB";
+
+    if (npacked < (int) chartsToPack.size()) {
+        LOG_ERR << "Not all charts were packed (" << chartsToPack.size() << " charts, " << npacked << " packed)";
+        return false;
+    }
+
+    LOG_INFO << "Trimming texture...";
 
-    tri::UpdateNormal<Mesh>::PerFaceNormalized(m);
-    tri::UpdateNormal<Mesh>::PerVertexNormalized(m);
+    BucketFaces(m, job.faceBuckets);
+    TrimTexture(job.faceBuckets, texszVec, false);
+    job.EndPhase("Texture trimming", "Chart shifting");
 
-    ScaleTextureCoordinatesToImage(m, textureObject);
+    LOG_INFO << "Shifting charts...";
+
+    IntegerShift(m, chartsToPack, texszVec, job.anchorMap, job.flipped);
+    job.EndPhase("Chart shifting", nullptr);
+
+    SaveSnapshot(job, SnapshotStage::Rendering);
+
+    // the sheets of a distributed job are rendered by the workers that claim them
+    if (args.TDir != "" && args.i != "none") {
+        WorkDirectory dir(args.TDir);
+        std::string output = QFileInfo(job.savename.c_str()).absoluteFilePath().toStdString();
+        if (!dir.WriteFile("sheets.output", output.data(), output.size())
+                || !SaveSnapshot(job, SnapshotStage::Rendering, dir.FilePath("sheets.render")))
+            LOG_WARN << "Unable to publish the texture sheets to the workers, rendering them locally";
+    }
+
+    // the charts are no longer needed, the rendering only uses the mesh
+    chartsToPack.clear();
+    job.anchorMap.clear();
+    job.graph.reset();
+
+    return true;
+}
+
+TextureSaveParameters SaveParametersFromArgs(const Args& args, const Renderer& renderer, bool udimTiles)
+{
+    TextureSaveParameters saveParams;
+    saveParams.workers = args.w;
+    saveParams.memoryBudgetGB = args.n;
+    saveParams.scratchDirectory = args.nScratch;
+    saveParams.format = args.f;
+    saveParams.jpegQuality = args.z;
+    saveParams.renderContexts = args.y;
+    saveParams.renderThreads = args.jThreads[3];
+    saveParams.softwareRendering = renderer.softwareRendering;
+    saveParams.arrayInputTextures = (args.v == 2);
+    saveParams.maxInputMipLevel = args.L;
+    saveParams.gutterWidth = args.Z;
+    saveParams.lodLevels = args.V;
+    saveParams.adaptiveCacheBudget = (args.c < 0);
+    saveParams.udimTiles = udimTiles;
+    saveParams.sheetSink = renderer.sheetSink;
+    return saveParams;
+}
+
+bool FinishJob(Job& job, const Renderer& renderer)
+{
+    const Args& args = job.args;
+    Mesh& m = job.m;
+    const std::vector<TextureSize>& texszVec = job.texszVec;
+
+    if (job.cachedOutput) {
+        LOG_INFO << "Skipped the processing of " << args.infile << ", the outputs were restored from the result cache";
+        return true;
+    }
+
+    job.BeginPhase("Texture rendering");
+
+    // the geometry and the texture coordinates are final and the names of the sheets
+    // are known in advance, so the mesh is saved while the sheets are rendered. The glb
+    // files embedding the textures read the sheets, and are saved after the rendering
+    std::future<bool> meshSaved;
+    const bool glb = QFileInfo(job.savename.c_str()).suffix().toLower() == "glb";
+    const bool embedTextures = (args.E == 1) && glb;
+    // the texture coordinates of the UDIM tiles are only offset after the rendering
+    const bool udimTiles = (args.fTile > 0) && !glb;
+    TextureFileFormat sheetFormat = args.f;
+
+    if (renderer.renderTextures) {
+        LOG_INFO << "Rendering texture...";
+
+        TextureSaveParameters saveParams = SaveParametersFromArgs(args, renderer, udimTiles);
+        sheetFormat = SavedTextureFormat(saveParams);
+        // the sheets of a distributed job claimed by the workers are waited for after the rendering
+        const int numSheets = job.faceBuckets.numSheets;
+        std::unique_ptr<WorkDirectory> dir;
+        std::vector<char> claimed(numSheets, 0); // written by the rendering contexts
+        if (args.TDir != "" && WorkDirectory(args.TDir).Exists("sheets.render")) {
+            dir.reset(new WorkDirectory(args.TDir));
+            saveParams.claimSheet = [&dir, &claimed](int i) {
+                claimed[i] = dir->Claim("sheet_" + std::to_string(i));
+                return claimed[i] != 0;
+            };
+        }
+        if (!embedTextures && !udimTiles) {
+            m.textures = TextureSheetNames(job.savename, job.faceBuckets.numSheets, sheetFormat);
+            LOG_INFO << "Saving mesh file while rendering...";
+            meshSaved = std::async(std::launch::async, [&job, &args]() {
+                TRACE_SCOPE_CAT("SaveMesh", "save");
+                return SaveMesh(job.savename.c_str(), job.m, {}, true, TextureFileExtension(args.f), args.E == 1);
+            });
+        }
+        RenderTextureAndSave(job.savename, m, job.textureObject, texszVec, false, RenderMode::Linear, saveParams, args.v == 1, &job.faceBuckets);
+        if (dir) {
+            int rendered = std::count(claimed.begin(), claimed.end(), 1);
+            LOG_INFO << "Rendered " << rendered << " of " << numSheets << " texture sheets, waiting for the workers";
+            ReportValue("rendering", "local_sheets", rendered);
+            for (int i = 0; i < numSheets; ++i)
+                if (!claimed[i])
+                    dir->WaitFor({"sheet_" + std::to_string(i) + ".done"});
+        }
+        if (udimTiles)
+            ApplyUDIMLayout(m, job.savename, sheetFormat);
+        if (job.predecoder) {
+            TexturePredecoder::Stats stats = job.predecoder->GetStats();
+            LOG_INFO << "Predecoded " << stats.decoded << " input textures (" << stats.bytes / (1 << 20) << " MB, " << stats.decodeS
+                     << " s of decoding), " << stats.used << " read by the rendering, " << stats.skipped << " over the budget, "
+                     << stats.retained << " retained from earlier jobs";
+            ReportValue("rendering/predecode", "decoded", stats.decoded);
+            ReportValue("rendering/predecode", "used", stats.used);
+            ReportValue("rendering/predecode", "skipped", stats.skipped);
+            ReportValue("rendering/predecode", "retained", stats.retained);
+            ReportValue("rendering/predecode", "bytes", stats.bytes);
+            ReportValue("rendering/predecode", "decode_s", stats.decodeS);
+        }
+    } else {
+        // the output mesh references no texture
+        m.textures.clear();
+    }
+    job.faceBuckets = FaceBuckets();
+    job.predecoder.reset();
+    job.EndPhase("Texture rendering", "Saving mesh");
+
+    double outputMP;
+    {
+        int64_t totArea = 0;
+        for (const auto& sz : texszVec) {
+            totArea += (int64_t)sz.w * sz.h;
+        }
+        outputMP = totArea / 1000000.0;
+    }
 
-    LOG_VERBOSE << "Preparing mesh...";
+    LOG_INFO << "InputVert " << m.VN();
+    LOG_INFO << "InputVertDup " << job.vndupIn;
+    LOG_INFO << "OutputVertDup " << job.vndupOut;
+    LOG_INFO << "InputCharts " << job.inputCharts;
+    LOG_INFO << "OutputCharts " << job.outputCharts;
+    LOG_INFO << "InputUVLen " << job.inputUVLen;
+    LOG_INFO << "OutputUVLen " << job.outputUVLen;
+    LOG_INFO << "InputMP " << job.inputMP;
+    LOG_INFO << "OutputMP " << outputMP;
+    LOG_INFO << "RelativeMPChange " << ((outputMP - job.inputMP) / job.inputMP);
+    LOG_INFO << "ZeroResamplingFraction " << job.zeroResamplingFraction;
+
+    ReportValue("run", "input", args.infile);
+    ReportValue("run", "output", job.savename);
+    ReportValue("run", "threads", omp_get_max_threads());
+    ReportValue("run", "simd", SimdLevelName(KernelSimdLevel()));
+    ReportValue("run", "parallel_min_faces", ParallelMinFaces());
+    ReportValue("run", "renderer", renderer.renderTextures ? (renderer.softwareRendering ? "cpu" : "gpu") : "none");
+    ReportValue("run", "queued_s", job.queued);
+    ReportValue("result", "InputFaces", m.FN());
+    ReportValue("result", "InputVert", m.VN());
+    ReportValue("result", "InputVertDup", job.vndupIn);
+    ReportValue("result", "OutputVertDup", job.vndupOut);
+    ReportValue("result", "InputCharts", job.inputCharts);
+    ReportValue("result", "OutputCharts", job.outputCharts);
+    ReportValue("result", "InputUVLen", job.inputUVLen);
+    ReportValue("result", "OutputUVLen", job.outputUVLen);
+    ReportValue("result", "InputMP", job.inputMP);
+    ReportValue("result", "OutputMP", outputMP);
+    ReportValue("result", "RelativeMPChange", (outputMP - job.inputMP) / job.inputMP);
+    ReportValue("result", "ZeroResamplingFraction", job.zeroResamplingFraction);
+    ReportValue("result", "OutputSheets", (double) texszVec.size());
+
+    bool saved;
+    if (meshSaved.valid()) {
+        saved = meshSaved.get();
+    } else {
+        LOG_INFO << "Saving mesh file...";
+        saved = SaveMesh(job.savename.c_str(), m, {}, true, TextureFileExtension(args.f), args.E == 1);
+    }
+    if (!saved)
+        LOG_ERR << "Model not saved correctly";
+    job.EndPhase("Saving mesh", nullptr);
 
-    int vndupIn;
-    PrepareMesh(m, &vndupIn);
-    ComputeWedgeTexCoordStorageAttribute(m);
+    LOG_INFO << "--- Timings ---";
+    for (const auto& timing : job.timings) {
+        LOG_INFO << timing.first << ": " << timing.second << "s";
+    }
+    LOG_INFO << "Processing took " << job.t.TimeElapsed() << " seconds";
+
+    HugePageStats hugePages;
+    if (HugePagesEnabled()) {
+        hugePages = GetHugePageStats();
+        LOG_INFO << "Huge pages: " << hugePages.residentBytes / (1 << 20) << " MB backed, " << hugePages.peakMappedBytes / (1 << 20)
+                 << " MB peak mapped (" << hugePages.hugetlbBytes / (1 << 20) << " MB from the hugetlb pool, " << hugePages.fallbacks
+                 << " fallbacks), " << hugePages.advisedBytes / (1 << 20) << " MB of existing buffers advised";
+    }
 
-    GraphHandle graph = ComputeGraph(m, textureObject);
-    timings["Mesh preparation & Graph computation"] = t.TimeSinceLastCheck();
+    if (args.W > 0)
+        ReportDeadline(job.budget, job.wall.TimeElapsed());
+
+    if (args.S != "") {
+        ReportValue("run", "total_s", job.t.TimeElapsed());
+        ReportValue("memory", "peak_rss_bytes", ProcessPeakResidentBytes());
+        if (HugePagesEnabled()) {
+            ReportValue("memory", "huge_page_bytes", hugePages.residentBytes);
+            ReportValue("memory", "huge_page_peak_mapped_bytes", hugePages.peakMappedBytes);
+            ReportValue("memory", "huge_page_advised_bytes", hugePages.advisedBytes);
+        }
+        for (int i = 0; i < (int) MemorySubsystem::_END; ++i)
+            ReportValue("memory/peak_bytes", MemorySubsystemName(MemorySubsystem(i)), MemoryPeak(MemorySubsystem(i)));
+        if (WriteReport(args.S))
+            LOG_INFO << "Saved the run report to " << args.S;
+        else
+            LOG_WARN << "Unable to write the run report " << args.S;
+    }
 
-    std::map<RegionID, bool> flipped;
-    for (auto& c : graph->charts)
-        flipped[c.first] = c.second->UVFlipped();
+    if (saved && job.resultCache)
+        StoreResultCache(job, sheetFormat, udimTiles);
 
-    double inputMP = textureObject->GetResolutionInMegaPixels();
-    int inputCharts = graph->Count();
-    double inputUVLen = graph->BorderUV();
+    return saved;
+}
 
-    // ensure all charts are oriented coherently, and then store the wtc attribute
-    ReorientCharts(graph);
+/* Reads the lines of a batch manifest on a background thread, so that with the
+ * standard input the jobs can be submitted while the previous ones are processed.
+ * The notify function is called after each line and at the end of the manifest */
+class ManifestReader {
 
-    std::map<ChartHandle, int> anchorMap;
-    AlgoStateHandle state = InitializeState(graph, ap);
+public:
 
-    GreedyOptimization(graph, state, ap);
-    timings["Greedy optimization"] = t.TimeSinceLastCheck();
-    int vndupOut;
+    ManifestReader(const std::string& manifest, std::function<void()> notify)
+        : notify(std::move(notify))
+    {
+        if (manifest != "-") {
+            file.open(manifest);
+            if (!file)
+                LOG_ERR << "Unable to read the batch manifest " << manifest;
+        }
+        std::istream *is = (manifest == "-") ? &std::cin : &file;
+        thread = std::thread([this, is]() {
+            LOG_SET_THREAD_NAME("manifest");
+            std::string line;
+            int lineNumber = 0;
+            while (*is && std::getline(*is, line)) {
+                lineNumber++;
+                {
+                    std::lock_guard<std::mutex> lock(mtx);
+                    lines.emplace_back(lineNumber, line);
+                }
+                this->notify();
+            }
+            {
+                std::lock_guard<std::mutex> lock(mtx);
+                done = true;
+            }
+            this->notify();
+        });
+    }
 
-    std::string savename = args.outfile;
-    if (savename == "")
-        savename = "out_" + m.name;
-    if (savename.substr(savename.size() - 3, 3) == "fbx")
-        savename.append(".obj");
+    ~ManifestReader()
+    {
+        thread.join();
+    }
 
-    Finalize(graph, savename, &vndupOut);
-    timings["Finalize"] = t.TimeSinceLastCheck();
+    /* Takes the next line if one is available */
+    bool Next(std::string& line, int& lineNumber)
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        if (lines.empty())
+            return false;
+        lineNumber = lines.front().first;
+        line = std::move(lines.front().second);
+        lines.pop_front();
+        return true;
+    }
 
-    double zeroResamplingFraction = 0;
+    /* Returns true if all the lines of the manifest have been taken */
+    bool AtEnd()
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        return done && lines.empty();
+    }
 
-    bool colorize = true;
+private:
 
-    if (colorize)
-        tri::UpdateColor<Mesh>::PerFaceConstant(m, vcg::Color4b(91, 130, 200, 255));
+    std::function<void()> notify;
+    std::ifstream file;
+    std::thread thread;
+    std::mutex mtx;
+    std::deque<std::pair<int, std::string>> lines;
+    bool done = false;
+};
 
-    LOG_INFO << "Rotating charts...";
-    double zeroResamplingMeshArea = 0;
-    for (auto entry : graph->charts) {
-        ChartHandle chart = entry.second;
-        double zeroResamplingChartArea;
-        int anchor = RotateChartForResampling(chart, state->changeSet, flipped, colorize, &zeroResamplingChartArea);
-        if (anchor != -1) {
-            anchorMap[chart] = anchor;
-            zeroResamplingMeshArea += zeroResamplingChartArea;
-        }
-    }
-    timings["Chart rotation"] = t.TimeSinceLastCheck();
-    zeroResamplingFraction = zeroResamplingMeshArea / graph->Area3D();
-
-    LOG_INFO << "[VALIDATION] Checking graph and mesh integrity post-optimization...";
-    int emptyCharts = 0;
-    for (auto const& [id, chart] : graph->charts) {
-        if (chart == nullptr) {
-            LOG_ERR << "[VALIDATION] CRITICAL: Found null chart handle in graph!";
-        } else if (chart->fpVec.empty()) {
-            emptyCharts++;
-        }
-        for (auto fptr : chart->fpVec) {
-            if (fptr == nullptr || fptr->IsD()) {
-                 LOG_ERR << "[VALIDATION] CRITICAL: Chart " << id << " contains an invalid face pointer!";
-            }
+/* Parses a job spec, a JSON object with the input mesh (the one of the defaults if
+ * missing), the optional output file and job id, and the options of the job as an array of strings that override the
+ * options of the command line, e.g.
+ *   {"id": "a", "input": "a.obj", "output": "out/a.obj", "args": ["-m", "3", "-S", "out/a.json"]}
+ * The relative paths are made absolute with respect to baseDir, since the working
+ * directory is changed while the meshes are loaded */
+static bool ParseJobSpec(const std::string& line, int lineNumber, const Args& defaults, const QDir& baseDir, Job& job)
+{
+    QJsonParseError err;
+    QJsonDocument doc = QJsonDocument::fromJson(QByteArray::fromStdString(line), &err);
+    if (doc.isNull() || !doc.isObject()) {
+        LOG_ERR << "Line " << lineNumber << " of the batch manifest is not a JSON object (" << err.errorString().toStdString() << ")";
+        return false;
+    }
+    QJsonObject spec = doc.object();
+
+    job.args = defaults;
+    job.args.D = "";
+    if (spec.contains("input"))
+        job.args.infile = spec.value("input").toString().toStdString();
+    job.args.outfile = spec.value("output").toString().toStdString();
+    job.id = spec.contains("id") ? spec.value("id").toString().toStdString() : std::to_string(lineNumber);
+
+    QJsonArray options = spec.value("args").toArray();
+    for (int i = 0; i < options.size(); i += 2) {
+        std::string option = options[i].toString().toStdString();
+        if (option.size() != 2 || option[0] != '-' || i + 1 >= options.size()) {
+            LOG_ERR << "Job " << job.id << ": malformed option " << option;
+            return false;
+        }
+        // the renderer, logging, tracing, memory budget, scheduling and persistent
+        // packing cache are set for the whole process
+        if (std::string("ixlAJBDQkqXN").find(option[1]) != std::string::npos) {
+            LOG_ERR << "Job " << job.id << ": option " << option << " can only be set on the command line";
+            return false;
+        }
+        if (!ParseOption(option, options[i + 1].toString().toStdString(), &job.args)) {
+            LOG_ERR << "Job " << job.id << ": invalid option " << option;
+            return false;
         }
     }
-    if(emptyCharts > 0) LOG_WARN << "[VALIDATION] Found " << emptyCharts << " charts with zero faces.";
 
-    int nonManifoldVerts = vcg::tri::Clean<Mesh>::CountNonManifoldVertexFF(m);
-    if (nonManifoldVerts > 0) {
-        LOG_WARN << "[VALIDATION] Mesh has " << nonManifoldVerts << " non-manifold vertices after optimization.";
-    } else {
-        LOG_INFO << "[VALIDATION] Mesh is manifold. Integrity check passed.";
+    if (job.args.infile == "" && job.args.U == "") {
+        LOG_ERR << "Job " << job.id << ": missing input mesh";
+        return false;
     }
 
-    state.reset();
-
-    int outputCharts = graph->Count();
-    double outputUVLen = graph->BorderUV();
+    for (std::string *path : {&job.args.infile, &job.args.outfile, &job.args.k, &job.args.C, &job.args.K, &job.args.R, &job.args.S, &job.args.F, &job.args.U, &job.args.H, &job.args.h, &job.args.hBase})
+        if (!path->empty() && !IsRemoteUri(*path))
+            *path = baseDir.absoluteFilePath(QString::fromStdString(*path)).toStdString();
+    return true;
+}
 
-    // pack the atlas
+/* Runs a worker of the distributed job of args.TDir (see distributed.h): optimizes
+ * the tiles and renders the texture sheets it claims, until the coordinator exits.
+ * Returns 1 if the work published by the coordinator cannot be processed */
+int RunWorker(const Args& args, const Renderer& renderer)
+{
+    WorkDirectory dir(args.TDir);
+    LOG_INFO << "Running as a worker of the distributed job in " << args.TDir;
+
+    if (dir.WaitFor({"tiles.plan", "job.done"}) == 0) {
+        Job job;
+        job.args = args;
+        job.args.U = dir.FilePath("prepared.pack");
+        // the input textures are only read by the rendering
+        job.args.cPredecode = 0;
+        if (!LoadJob(job, renderer))
+            return 1;
+        int tiles = OptimizeTilesWorker(job.m, job.textureObject, job.ap, dir);
+        if (tiles < 0)
+            return 1;
+        LOG_INFO << "Optimized " << tiles << " tiles";
+    }
 
-    // first discard zero-area charts
-    std::vector<ChartHandle> chartsToPack;
-    for (auto& entry : graph->charts) {
-        if (entry.second->AreaUV() != 0) {
-            chartsToPack.push_back(entry.second);
-        } else {
-            for (auto fptr : entry.second->fpVec) {
-                for (int j = 0; j < fptr->VN(); ++j) {
-                    fptr->V(j)->T().P() = Point2d::Zero();
-                    fptr->V(j)->T().N() = 0;
-                    fptr->WT(j).P() = Point2d::Zero();
-                    fptr->WT(j).N() = 0;
-                }
+    if (renderer.renderTextures && dir.WaitFor({"sheets.render", "job.done"}) == 0) {
+        std::vector<char> output;
+        if (!dir.ReadFile("sheets.output", output)) {
+            LOG_ERR << "Unable to read the output file name of the texture sheets from " << args.TDir;
+            return 1;
+        }
+        Job job;
+        job.args = args;
+        job.args.U = dir.FilePath("sheets.render");
+        job.args.outfile.assign(output.begin(), output.end());
+        if (!LoadJob(job, renderer))
+            return 1;
+
+        const bool glb = QFileInfo(job.savename.c_str()).suffix().toLower() == "glb";
+        TextureSaveParameters saveParams = SaveParametersFromArgs(job.args, renderer, (args.fTile > 0) && !glb);
+        std::vector<char> claimed(job.faceBuckets.numSheets, 0); // written by the rendering contexts
+        saveParams.claimSheet = [&dir, &claimed](int i) {
+            claimed[i] = dir.Claim("sheet_" + std::to_string(i));
+            return claimed[i] != 0;
+        };
+        RenderTextureAndSave(job.savename, job.m, job.textureObject, job.texszVec, false, RenderMode::Linear, saveParams, args.v == 1, &job.faceBuckets);
+
+        // the sheets are saved when the rendering returns
+        int rendered = 0;
+        for (unsigned i = 0; i < claimed.size(); ++i) {
+            if (claimed[i]) {
+                dir.MarkDone("sheet_" + std::to_string(i));
+                rendered++;
             }
         }
+        LOG_INFO << "Rendered " << rendered << " texture sheets";
     }
 
-    LOG_INFO << "Packing atlas of size " << chartsToPack.size();
+    return 0;
+}
 
-    std::vector<TextureSize> texszVec;
-    int npacked = Pack(chartsToPack, textureObject, texszVec, ap, anchorMap);
-    timings["Packing"] = t.TimeSinceLastCheck();
+/* Processes the jobs of the manifest args.D, and returns the number of failed
+ * jobs. The jobs go through the stages of a pipeline: the loading, optimization
+ * and packing stages run on worker threads, each on at most args.Q[stage] jobs at
+ * a time, and the rendering stage runs on this thread, which owns the OpenGL
+ * context. The workers prefer the later stages, and a new job is only admitted
+ * while the memory tracked by the counters is within the budget (-B) and there
+ * are no more jobs in flight than the stages can hold. The process keeps the
+ * OpenGL context, the rendering resources and the packing rasterization cache
+ * between the jobs. Jobs that write a run report are processed alone, so that the
+ * report only has their values */
+int RunBatch(const Args& defaults, const Renderer& renderer)
+{
+    enum Stage { StageLoad, StageOptimize, StagePack, StageRender };
+    static const char *stageName[] = { "load", "optimize", "pack", "render" };
 
-    LOG_INFO << "Packed " << npacked << " charts in " << timings["Packing"] << " seconds";
+    int limits[StageRender];
+    for (int s = StageLoad; s < StageRender; ++s)
+        limits[s] = std::max(1, defaults.Q[s]);
+    const int maxInFlight = limits[StageLoad] + limits[StageOptimize] + limits[StagePack] + 1;
 
-    LOG_INFO << "[DIAG] Packing function finished.";
-    if (npacked < (int) chartsToPack.size()) {
-        LOG_ERR << "[VALIDATION] Not all charts were packed! Expected " << chartsToPack.size() << ", got " << npacked;
-        // The original code exits here, which is correct. This just adds a clearer log.
-        std::exit(-1);
-    }
+    LOG_INFO << "Processing the jobs of " << (defaults.D == "-" ? std::string("the standard input") : defaults.D)
+             << " (load " << limits[StageLoad] << ", optimize " << limits[StageOptimize] << ", pack " << limits[StagePack] << " jobs at a time)";
 
-    int64_t totalNewTexturePixels = 0;
-    for (const auto& sz : texszVec) {
-        totalNewTexturePixels += (int64_t)sz.w * sz.h;
-    }
-    double totalNewTextureMB = (totalNewTexturePixels * 4.0) / (1024.0 * 1024.0);
-    LOG_INFO << "[DIAG] Total texture memory to be allocated by rendering: " << totalNewTextureMB << " MB";
+    KeepRenderingResources(true);
 
-    if (npacked < (int) chartsToPack.size()) {
-        LOG_ERR << "Not all charts were packed (" << chartsToPack.size() << " charts, " << npacked << " packed)";
-        std::exit(-1);
+    if (defaults.cRetain > 0) {
+        std::size_t budgetBytes = MemoryBudgetLimit(std::size_t(defaults.cRetain * 1024.0 * 1024.0 * 1024.0), 0.5);
+        SetRetainedImageBudget(budgetBytes);
+        LOG_INFO << "Keeping the decoded input textures across the jobs within " << (budgetBytes / (1024.0 * 1024.0 * 1024.0)) << " GB";
     }
 
-    LOG_INFO << "Trimming texture...";
-
-    TrimTexture(m, texszVec, false);
-    timings["Texture trimming"] = t.TimeSinceLastCheck();
+    // the working directory changes while the meshes are loaded
+    const QDir baseDir = QDir::current();
+
+    Timer batchTimer;
+    std::mutex mtx;
+    std::condition_variable cv;
+    std::list<std::unique_ptr<Job>> inFlight;
+    std::deque<Job *> waiting[StageRender + 1]; // jobs waiting for each stage (after the loading)
+    int running[StageRender] = {0, 0, 0};
+    std::unique_ptr<Job> admissible; // next job of the manifest, waiting to be admitted
+    bool exclusive = false;          // a job with a run report is in flight
+    bool manifestEnd = false;
+    bool shutdown = false;
+    int jobs = 0;
+    int failed = 0;
+
+    ManifestReader reader(defaults.D, [&]() {
+        std::lock_guard<std::mutex> lock(mtx);
+        cv.notify_all();
+    });
+
+    // returns the next job of the manifest that can enter the pipeline, the lock is held
+    auto Admit = [&] () -> Job * {
+        std::string line;
+        int lineNumber;
+        while (!admissible && reader.Next(line, lineNumber)) {
+            std::size_t first = line.find_first_not_of(" \t\r");
+            if (first == std::string::npos || line[first] == '#')
+                continue;
+            std::unique_ptr<Job> job(new Job);
+            jobs++;
+            if (ParseJobSpec(line, lineNumber, defaults, baseDir, *job)) {
+                admissible = std::move(job);
+            } else {
+                LOG_INFO << "[JOB] id=" << job->id << " status=invalid";
+                failed++;
+            }
+        }
+        if (!admissible) {
+            if (!manifestEnd && reader.AtEnd()) {
+                manifestEnd = true;
+                cv.notify_all();
+            }
+            return nullptr;
+        }
+        if (!inFlight.empty()) {
+            if (exclusive || admissible->args.S != "" || (int) inFlight.size() >= maxInFlight)
+                return nullptr;
+            if (MemoryBudgetAvailable() == 0)
+                return nullptr;
+        }
+        if (admissible->args.S != "") {
+            exclusive = true;
+            ClearReport();
+        }
+        inFlight.push_back(std::move(admissible));
+        return inFlight.back().get();
+    };
+
+    auto Worker = [&] (int k) {
+        LOG_SET_THREAD_NAME("stage-" + std::to_string(k));
+        std::unique_lock<std::mutex> lock(mtx);
+        while (!shutdown) {
+            Job *job = nullptr;
+            int stage = -1;
+            for (int s = StagePack; s > StageLoad && !job; --s) {
+                if (!waiting[s].empty() && running[s] < limits[s]) {
+                    job = waiting[s].front();
+                    waiting[s].pop_front();
+                    stage = s;
+                }
+            }
+            if (!job && running[StageLoad] < limits[StageLoad]) {
+                job = Admit();
+                stage = StageLoad;
+            }
+            if (!job) {
+                cv.wait(lock);
+                continue;
+            }
 
-    LOG_INFO << "Shifting charts...";
+            running[stage]++;
+            lock.unlock();
+            bool ok = false;
+            switch (stage) {
+            case StageLoad:
+                LOG_INFO << "[JOB] id=" << job->id << " input=" << job->args.infile;
+                job->t.Reset();
+                ok = LoadJob(*job, renderer);
+                break;
+            case StageOptimize:
+                ok = OptimizeJob(*job);
+                break;
+            case StagePack:
+                ok = PackJob(*job);
+                break;
+            }
+            lock.lock();
+            running[stage]--;
+            // failed jobs go straight to the rendering stage, which reports them
+            if (!ok) {
+                LOG_ERR << "Job " << job->id << " failed in the " << stageName[stage] << " stage";
+                job->failed = true;
+                waiting[StageRender].push_back(job);
+            } else {
+                waiting[stage + 1].push_back(job);
+            }
+            cv.notify_all();
+        }
+    };
+
+    std::vector<std::thread> workers;
+    for (int k = 0; k < maxInFlight - 1; ++k)
+        workers.emplace_back(Worker, k);
+
+    std::unique_lock<std::mutex> lock(mtx);
+    while (true) {
+        cv.wait(lock, [&]() { return !waiting[StageRender].empty() || (manifestEnd && !admissible && inFlight.empty()); });
+        if (waiting[StageRender].empty())
+            break;
+        Job *job = waiting[StageRender].front();
+        waiting[StageRender].pop_front();
+        lock.unlock();
+
+        bool ok = !job->failed && FinishJob(*job, renderer);
+        LOG_INFO << "[JOB] id=" << job->id << " status=" << (ok ? "ok" : "failed")
+                 << " output=" << job->savename << " total_s=" << job->t.TimeElapsed() << " queued_s=" << job->queued;
+
+        MetricsAdd(ok ? MetricCounter::JobsSucceeded : MetricCounter::JobsFailed);
+
+        lock.lock();
+        if (!ok)
+            failed++;
+        if (job->args.S != "")
+            exclusive = false;
+        inFlight.remove_if([job](const std::unique_ptr<Job>& j) { return j.get() == job; });
+        cv.notify_all();
+    }
+    shutdown = true;
+    cv.notify_all();
+    lock.unlock();
+    for (auto& worker : workers)
+        worker.join();
+
+    ReleaseRenderingResources();
+
+    if (defaults.cRetain > 0) {
+        RetainedImageStats retainedStats = GetRetainedImageStats();
+        LOG_INFO << "Retained input textures: " << retainedStats.hits << " reads, " << retainedStats.evictions << " released over the budget, "
+                 << retainedStats.images << " kept (" << retainedStats.bytes / (1 << 20) << " MB)";
+        SetRetainedImageBudget(0);
+    }
 
-    IntegerShift(m, chartsToPack, texszVec, anchorMap, flipped);
-    timings["Chart shifting"] = t.TimeSinceLastCheck();
+    LOG_INFO << "[BATCH] jobs=" << jobs << " failed=" << failed << " total_s=" << batchTimer.TimeElapsed();
+    return failed;
+}
 
-    LOG_INFO << "Rendering texture...";
+/* Runs the configuration of a sweep in the forked process, and exits with its status */
+static void RunSweepConfiguration(Job& job, const Args& args, const std::string& id, const Renderer& renderer)
+{
+    // the threads of the OpenMP runtime do not survive the fork, the configurations
+    // run concurrently instead
+    omp_set_num_threads(1);
+    LOG_SET_THREAD_NAME("sweep-" + id);
+
+    job.id = id;
+    job.args = args;
+    if (job.args.outfile == "")
+        job.args.outfile = "out_" + id + "_" + job.m.name;
+
+    AlgoParameters ap = ParametersFromArgs(job.args);
+    if (!SameQueueParameters(job.ap, ap)) {
+        LOG_INFO << "The cost parameters differ from the defaults, initializing the state again";
+        job.state.reset();
+    }
+    job.ap = ap;
 
-    RenderTextureAndSave(savename, m, textureObject, texszVec, false, RenderMode::Linear);
-    timings["Texture rendering"] = t.TimeSinceLastCheck();
+    bool ok = OptimizeJob(job) && PackJob(job) && FinishJob(job, renderer);
+    std::cout.flush();
+    std::cerr.flush();
+    std::fflush(nullptr);
+    _exit(ok ? 0 : 1);
+}
 
-    double outputMP;
-    {
-        int64_t totArea = 0;
-        for (const auto& sz : texszVec) {
-            totArea += (int64_t)sz.w * sz.h;
-        }
-        outputMP = totArea / 1000000.0;
+/* Optimizes the input mesh with each configuration of the sweep file args.X, and
+ * returns the number of failed configurations. The lines of the sweep file are job
+ * specs as in a batch manifest (see ParseJobSpec), without the input mesh. The mesh
+ * is loaded and prepared, the charts are reoriented and the state of the greedy
+ * optimization is initialized once with the options of the command line, then each
+ * configuration is optimized, packed and rendered in a forked process that shares
+ * the prepared mesh and state until it modifies them. The configurations that
+ * change the costs of the seams (-m, -b) initialize the state again. As many
+ * configurations as processors run concurrently, each on one thread, and each
+ * writes its own output and run report */
+int RunSweep(const Args& defaults, const Renderer& renderer)
+{
+#ifdef _WIN32
+    (void) renderer;
+    LOG_ERR << "Parameter sweeps (-X) are not supported on this platform";
+    return 1;
+#else
+    if (defaults.D != "" || defaults.U != "" || defaults.T > 0 || defaults.R != "" || defaults.Y != "") {
+        LOG_ERR << "Parameter sweeps are not supported with batches, snapshots, tiles, checkpoints or move logs";
+        return 1;
     }
 
-    LOG_INFO << "InputVert " << m.VN();
-    LOG_INFO << "InputVertDup " << vndupIn;
-    LOG_INFO << "OutputVertDup " << vndupOut;
-    LOG_INFO << "InputCharts " << inputCharts;
-    LOG_INFO << "OutputCharts " << outputCharts;
-    LOG_INFO << "InputUVLen " << inputUVLen;
-    LOG_INFO << "OutputUVLen " << outputUVLen;
-    LOG_INFO << "InputMP " << inputMP;
-    LOG_INFO << "OutputMP " << outputMP;
-    LOG_INFO << "RelativeMPChange " << ((outputMP - inputMP) / inputMP);
-    LOG_INFO << "ZeroResamplingFraction " << zeroResamplingFraction;
-
-    LOG_INFO << "Saving mesh file...";
+    std::ifstream file(defaults.X);
+    if (!file) {
+        LOG_ERR << "Unable to read the sweep file " << defaults.X;
+        return 1;
+    }
 
-    if (SaveMesh(savename.c_str(), m, {}, true) == false)
-        LOG_ERR << "Model not saved correctly";
-    timings["Saving mesh"] = t.TimeSinceLastCheck();
+    // the paths of the configurations are made absolute by ParseJobSpec()
+    const QDir baseDir = QDir::current();
+    Args base = defaults;
+    for (std::string *path : {&base.infile, &base.C, &base.S, &base.H, &base.h})
+        if (!path->empty())
+            *path = baseDir.absoluteFilePath(QString::fromStdString(*path)).toStdString();
+
+    std::vector<Args> configs;
+    std::vector<std::string> ids;
+    std::string line;
+    int lineNumber = 0;
+    while (std::getline(file, line)) {
+        lineNumber++;
+        std::size_t first = line.find_first_not_of(" \t\r");
+        if (first == std::string::npos || line[first] == '#')
+            continue;
+        Job config;
+        if (!ParseJobSpec(line, lineNumber, defaults, baseDir, config))
+            return 1;
+        if (config.args.infile != base.infile || config.args.C != base.C || config.args.U != defaults.U
+                || config.args.T != defaults.T || config.args.R != defaults.R || config.args.Y != defaults.Y) {
+            LOG_ERR << "Configuration " << config.id << ": the input, the mesh cache, snapshots, tiles, checkpoints and move logs cannot be changed in a sweep";
+            return 1;
+        }
+        if (config.args.S != "" && config.args.S == base.S) {
+            LOG_ERR << "Configuration " << config.id << ": each configuration needs its own run report";
+            return 1;
+        }
+        if (config.args.H != "" && config.args.H == base.H) {
+            LOG_ERR << "Configuration " << config.id << ": each configuration needs its own status file";
+            return 1;
+        }
+        if (config.args.h != "" && config.args.h == base.h) {
+            LOG_ERR << "Configuration " << config.id << ": each configuration needs its own packing layout file";
+            return 1;
+        }
+        configs.push_back(config.args);
+        ids.push_back(config.id);
+    }
+    if (configs.empty()) {
+        LOG_ERR << "The sweep file " << defaults.X << " has no configurations";
+        return 1;
+    }
 
-    LOG_INFO << "--- Timings ---";
-    for (const auto& timing : timings) {
-        LOG_INFO << timing.first << ": " << timing.second << "s";
+    Job job;
+    job.args = defaults;
+    job.t.Reset();
+    if (!LoadJob(job, renderer))
+        return (int) configs.size();
+
+    job.BeginPhase("Optimization setup");
+    PrepareCharts(job);
+    job.state = InitializeState(job.graph, job.ap, &job.orientation);
+    job.orientation = ChartOrientation();
+    job.UpdateMeshBytes();
+    job.EndPhase("Optimization setup", nullptr);
+
+    const int limit = std::max(1, std::min((int) configs.size(), omp_get_num_procs()));
+    LOG_INFO << "Running " << configs.size() << " configurations, " << limit << " at a time";
+
+    Timer sweepTimer;
+    std::map<pid_t, std::size_t> running;
+    std::size_t next = 0;
+    int failed = 0;
+    while (next < configs.size() || !running.empty()) {
+        if (next < configs.size() && (int) running.size() < limit) {
+            std::cout.flush();
+            std::cerr.flush();
+            pid_t pid = fork();
+            if (pid == 0)
+                RunSweepConfiguration(job, configs[next], ids[next], renderer);
+            if (pid < 0) {
+                LOG_ERR << "Unable to start the configuration " << ids[next];
+                failed++;
+            } else {
+                LOG_INFO << "[SWEEP] id=" << ids[next] << " pid=" << pid;
+                running[pid] = next;
+            }
+            next++;
+            continue;
+        }
+        int status;
+        pid_t pid = waitpid(-1, &status, 0);
+        if (pid < 0) {
+            if (errno == EINTR)
+                continue;
+            LOG_ERR << "Lost track of the running configurations";
+            failed += (int) running.size();
+            break;
+        }
+        auto it = running.find(pid);
+        if (it == running.end())
+            continue;
+        bool ok = WIFEXITED(status) && WEXITSTATUS(status) == 0;
+        LOG_INFO << "[SWEEP] id=" << ids[it->second] << " status=" << (ok ? "ok" : "failed");
+        if (!ok)
+            failed++;
+        running.erase(it);
     }
-    LOG_INFO << "Processing took " << t.TimeElapsed() << " seconds";
 
-    return 0;
+    LOG_INFO << "[SWEEP] configurations=" << configs.size() << " failed=" << failed << " total_s=" << sweepTimer.TimeElapsed();
+    return failed;
+#endif
 }
 
 void PrintArgsUsage(const char *binary) {
     Args def;
     std::cout << "Usage: " << binary << " MESHFILE [-mbdgutao]" << std::endl;
+    std::cout << "       " << binary << " -D MANIFEST [-mbdgutao]" << std::endl;
     std::cout << std::endl;
-    std::cout << "MESHFILE specifies the input mesh file (supported formats are obj, ply and fbx)" << std::endl;
+    std::cout << "MESHFILE specifies the input mesh file (supported formats are obj, ply, fbx, gltf and glb)" << std::endl;
+    std::cout << "MESHFILE can also be an s3://, http:// or https:// URI: the mesh and its textures are downloaded to a staging" << std::endl;
+    std::cout << "directory, the textures in the background while the mesh is processed. The s3 endpoint, region and credentials are" << std::endl;
+    std::cout << "read from AWS_ENDPOINT_URL, AWS_REGION, AWS_ACCESS_KEY_ID, AWS_SECRET_ACCESS_KEY and AWS_SESSION_TOKEN" << std::endl;
     std::cout << std::endl;
-    std::cout << "-m  <val>      " << "Matching error tolerance when attempting merge operations." << " (default: " << def.m << ")" << std::endl;
+    std::cout << "-m  <val>      " << "Matching error tolerance when attempting merge operations. "
+              << "Optionally followed by coincident=<val>, the fraction of the seam length below which the matching error of a seam is considered null: these seams are stitched in bulk before the greedy optimization, "
+              << "without the ARAP solve (0 disables it, e.g. 2,coincident=0.001). "
+              << "Optionally followed by reduce=<val>, how the seams whose matching error is above the tolerance are shortened until it is not: "
+              << "off (they are not merged), linear (by a fixed fraction of their length at a time, from either end) or bisection (to the longest feasible run of edges from either end, binary-searched)."
+              << " (default: " << def.m << ",coincident=" << def.mCoincident << ",reduce=" << def.mReduce << ")" << std::endl;
     std::cout << "-b  <val>      " << "Maximum tolerance on the seam-length to chart-perimeter ratio when attempting merge operations. Range is [0,1]." << " (default: " << def.b << ")" << std::endl;
-    std::cout << "-d  <val>      " << "Local ARAP distortion tolerance when performing the local UV optimization." << " (default: " << def.d << ")" << std::endl;
+    std::cout << "-d  <val>      " << "Local ARAP distortion tolerance when performing the local UV optimization. "
+              << "Optionally followed by the fields of the ARAP solves of the optimization areas: solver=<val>, the backend of the linear solves, "
+              << "one of ldlt (sparse LDLT), ldlt-mixed (sparse LDLT in single precision with the solutions refined in double precision, falling back to double precision if the refinement does not reach the tolerance), "
+              << "cg (conjugate gradient with incomplete Cholesky preconditioning) or bicgstab (BiCGSTAB with incomplete LU preconditioning), solver-tolerance=<val>, the relative residual at which the iterative and mixed precision solvers stop, "
+              << "anderson=<val>, the number of previous iterates combined by the Anderson acceleration of the solves (0 disables it), "
+              << "early-stop=<val>, the fraction of the distortion limits below which the solve of a move stops, as the distortion checks then pass (it also stops once the limits are out of reach, 0 disables it), "
+              << "and scaffold=<val>, the width of a band of scaffold triangles added around the shells, relative to their average boundary edge length, that keeps the boundary from folding over during the solve (0 disables it, "
+              << "e.g. 0.5,solver=cg,solver-tolerance=1e-8,anderson=5,early-stop=0.5,scaffold=2)."
+              << " (default: " << def.d << ",solver=" << def.dSolver << ",solver-tolerance=" << def.dSolverTolerance << ",anderson=" << def.dAnderson << ",early-stop=" << def.dEarlyStop << ",scaffold=" << def.dScaffold << ")" << std::endl;
     std::cout << "-g  <val>      " << "Global ARAP distortion tolerance when performing the local UV optimization." << " (default: " << def.g << ")" << std::endl;
     std::cout << "-u  <val>      " << "UV border reduction target in percentage relative to the input. Range is [0,1]." << " (default: " << def.u << ")" << std::endl;
     std::cout << "-a  <val>      " << "Alpha parameter to control the UV optimization area size." << " (default: " << def.a << ")" << std::endl;
     std::cout << "-t  <val>      " << "Time-limit for the atlas clustering (in seconds)." << " (default: " << def.t << ")" << std::endl;
-    std::cout << "-o  <val>      " << "Output mesh file. Supported formats are obj and ply." << " (default: out_MESHFILE" << ")" << std::endl;
+    std::cout << "-W  <val>      " << "Wall-clock deadline of the whole run (in seconds). The time of packing and rendering is estimated from the number of charts and the output megapixels and reserved, the atlas clustering is limited to what is left (and to -t, if shorter). Set 0 for no deadline." << " (default: " << def.W << ")" << std::endl;
+    std::cout << "-o  <val>      " << "Output mesh file. Supported formats are obj, ply and glb (binary glTF)." << " (default: out_MESHFILE" << ")" << std::endl;
     std::cout << "-r  <val>      " << "Number of rotations to try (e.g., 4 for 0/90/180/270, 1 for no rotation). If > 1, must be multiple of 4." << " (default: " << def.r << ")" << std::endl;
-    std::cout << "-l  <val>      " << "Logging level. 0 for minimal verbosity, 1 for verbose output, 2 for debug output." << " (default: " << def.l << ")" << std::endl;
-    std::cout << "-c  <val>      " << "Texture GPU cache budget in GB. Set 0 for unlimited." << " (default: " << def.c << ")" << std::endl;
-    std::cout << "-p  <val>      " << "Packing rasterization cache budget in GB. Set 0 for unlimited." << " (default: " << def.p << ")" << std::endl;
+    std::cout << "-l  <val>      " << "Logging level. 0 for minimal verbosity, 1 for verbose output, 2 for debug output. "
+              << "Optionally followed by validation=<val>, the level of the integrity validation of the charts and of the mesh after the optimization: off, fast (checks a sample of the face pointers of each chart), "
+              << "full (checks all of them and counts the non-manifold vertices) or async (as full, but the non-manifold vertices are counted while the packing runs), e.g. 1,validation=fast." << " (default: " << def.l << ",validation=full)" << std::endl;
+    std::cout << "-A  <val>      " << "Set to 1 to write the log from a background thread, or to 0 to write each message when it is logged. Errors are always written when logged." << " (default: " << def.A << ")" << std::endl;
+    std::cout << "-c  <val>      " << "Texture GPU cache budget in GB. Set 0 for unlimited, negative to detect it from the free GPU memory. "
+              << "Optionally followed by predecode=<val>, the memory budget in GB of the input textures decoded on low priority background threads from the loading of the mesh, so that the rendering starts with them in memory (0 disables it, not done in sweeps, e.g. 4,predecode=2). "
+              << "In batch mode, optionally followed by retain=<val>, the memory budget in GB of the decoded input textures kept once the jobs end, "
+              << "so that the later jobs reading the same files (unchanged since) skip decoding them (0 disables it, e.g. 4,predecode=2,retain=8)." << " (default: " << def.c << ")" << std::endl;
+    std::cout << "-p  <val>      " << "Packing rasterization cache budget in GB. Set 0 for unlimited, negative to size it from the free system memory." << " (default: " << def.p << ")" << std::endl;
+    std::cout << "-s  <val>      " << "Number of independent merge operations evaluated concurrently by the greedy optimization. Results are deterministic for a given value. "
+              << "Optionally followed by lazy=<val>, the factor by which the previous matching error of the seams is scaled to estimate their cost after an accepted move changed their charts; "
+              << "the estimates are queued without computing the matching, and the seams are costed when they reach the top of the queue (0 costs them at once, small factors accept the same moves), "
+              << "raster-overlap=<val>, the number of faces above which the optimization areas of the moves are also checked for overlaps by rasterizing them with the OpenGL context of the texture rendering, "
+              << "which rejects the overlaps of the interiors missed by the border intersections (0 disables it; the areas evaluated on threads without the context, as with -i cpu or none, are not rasterized), "
+              << "and raster-resolution=<val>, the texels along the longest side of the rasterized grid (e.g. 1,lazy=0.001,raster-overlap=5000,raster-resolution=2048)."
+              << " (default: " << def.s << ",lazy=" << def.sLazy << ",raster-overlap=" << def.sRasterOverlap << ",raster-resolution=" << def.sRasterResolution << ")" << std::endl;
+    std::cout << "-j  <val>      " << "Parallel execution flags, separated by commas, by name or as the sum of their values: ";
+    for (const ParallelFlag& pf : parallelFlags)
+        std::cout << pf.name << " (" << pf.flag << ") " << pf.description << ((&pf == std::end(parallelFlags) - 1) ? ". " : ", ");
+    std::cout << "The flags can be followed by the number of threads of the greedy optimization, of the ARAP solves of the moves, of the packing and of the rendering (0 uses all of them), "
+              << "in this order or by name as greedy=, arap=, packing= and render= (e.g. numa,thp,deterministic,0,8 and 140,arap=8 both enable the three flags and run the greedy optimization on all the threads and its ARAP solves on 8)." << " (default: " << def.j << ")" << std::endl;
+    std::cout << "-k  <val>      " << "Directory of the persistent packing rasterization cache, reused across runs. Disabled if not set." << std::endl;
+    std::cout << "-h  <val>      " << "Packing layout file. The charts that did not change since the run that wrote it keep their placement, the other charts are packed in the space left, and the file is rewritten with the new layout. "
+              << "Optionally followed by base=<val>, the packing snapshot (see -F) of the run that wrote it, to process an edited version of its input incrementally: the charts of the snapshot whose faces are unchanged "
+              << "(same positions, tex coords and textures) keep their tex coords, and only the other faces are optimized, as a tile whose borders are frozen (e.g. -h layout.bin,base=previous.pack). Disabled if not set." << std::endl;
+    std::cout << "-q  <val>      " << "Persistent packing rasterization cache budget in GB." << " (default: " << def.q << ")" << std::endl;
+    std::cout << "-w  <val>      " << "Number of texture images encoded concurrently, optionally followed by depth=<val>, the number of requests in flight of the file reads and writes (e.g. 2,depth=32). "
+              << "A nonzero depth reads the input textures and writes the texture sheets and the meshes through io_uring with registered buffers (Linux 5.1 and later), 0 uses blocking calls." << " (default: " << def.w << ",depth=" << def.wDepth << ")" << std::endl;
+    std::cout << "-n  <val>      " << "Memory budget in GB of the rendered texture images waiting to be saved, optionally followed by scratch=<directory> (e.g. 4,scratch=/tmp/sheets). "
+              << "With a scratch directory, the full texture sheets (jpg and ktx2 sheets, and sheets whose holes are filled) are backed by files created there, so their rows are paged out once rendered." << " (default: " << def.n << ")" << std::endl;
+    std::cout << "-f  <val>      " << "Output texture file format: png, tga (uncompressed), jpg, ktx2 (BC7 blocks compressed by the OpenGL driver) or tif (BigTIFF, in deflated strips of rows). "
+              << "Optionally followed by tile=<val>, the side in pixels of the tiles the charts are packed into (e.g. png,tile=4096), saved as the tiles <name>.1001, <name>.1002... of a UDIM texture referenced as <name>.<UDIM> "
+              << "(as separate textures in glb files, glTF has no UDIM textures). The charts larger than a tile are downscaled into a tile of their own. "
+              << "With shm=<name> in place of the format (on the command line, e.g. shm=sheets,tile=4096) the sheets are not saved, their pixels are published in a ring of " << SHEET_RING_DEFAULT_SLOTS << " slots of "
+              << (SHEET_RING_DEFAULT_SLOT_BYTES >> 20) << " MB in the POSIX shared memory object /name, read by a consumer on the same host (see sheet_sink.h); "
+              << "the mesh references the sheets by the png names." << " (default: " << TextureFileExtension(def.f) << ")" << std::endl;
+    std::cout << "-z  <val>      " << "Quality of the jpg output textures. Range is [0,100]." << " (default: " << def.z << ")" << std::endl;
+    std::cout << "-v  <val>      " << "Set to 1 to stream the input textures in pages within the texture GPU cache budget when rendering, or to 2 to keep them as layers of texture arrays and draw each tile with one call per texture size, instead of uploading whole images." << " (default: " << def.v << ")" << std::endl;
+    std::cout << "-L  <val>      " << "Highest mip level the input textures are decoded and uploaded at when rendering, chosen for each input texture as the coarsest level with at least one texel per output pixel for all the faces sampling it. Ignored with -v 1 and -v 2. Set 0 to always use the full resolution." << " (default: " << def.L << ")" << std::endl;
+    std::cout << "-Z  <val>      " << "Width in pixels of the gutter around the charts of the texture sheets filled with the color of the nearest chart texel, by a jump flooding pass on the GPU, to avoid the bleeding of the background in the mipmaps of the output textures. Not done by the software renderer. Set 0 to disable." << " (default: " << def.Z << ")" << std::endl;
+    std::cout << "-V  <val>      " << "Number of levels of detail saved next to each texture sheet as <name>_texture_N_lodK, each halving the resolution of the previous one (box filter). They are downsampled on the GPU from the rendered tiles, and share the layout of the sheet." << " (default: " << def.V << ")" << std::endl;
+    std::cout << "-e  <val>      " << "Set to 1 to keep the input textures resident as BC7 blocks, read from ktx2/dds files with the same base name if present or compressed at upload." << " (default: " << def.e << ")" << std::endl;
+    std::cout << "-i  <val>      " << "Texture sheet renderer: gpu (OpenGL), cpu (multithreaded software rasterizer), auto to use the cpu when no hardware OpenGL context is available, or none to skip the texture rendering (the output mesh references no texture)." << " (default: " << def.i << ")" << std::endl;
+    std::cout << "-x  <val>      " << "OpenGL backend: egl (headless, no X server required), x11, or auto to use egl when DISPLAY is not set. Ignored if QT_QPA_PLATFORM is set." << " (default: auto)" << std::endl;
+    std::cout << "-y  <val>      " << "Number of OpenGL contexts rendering the texture sheets concurrently, each with its own texture GPU cache of the configured budget." << " (default: " << def.y << ")" << std::endl;
+    std::cout << "-C  <val>      " << "Directory of the binary snapshots of the prepared input meshes, reused by later runs on the same input to skip the mesh preparation. "
+              << "With results=1 after the directory (e.g. cache,results=1) the stage snapshots and the outputs of the jobs are cached too, keyed by the input and the options of each stage: "
+              << "the outputs of a job run again are restored, and a job whose options only change from a stage on is resumed from the snapshot of that stage. "
+              << "Disabled if not set." << std::endl;
+    std::cout << "-E  <val>      " << "Set to 1 to embed the png and jpg textures in glb output files instead of referencing the image files." << " (default: " << def.E << ")" << std::endl;
+    std::cout << "-P  <val>      " << "Number of ARAP iterations used to predict the distortion of a merge operation, operations predicted to fail are rejected without the full optimization. Set 0 to disable." << " (default: " << def.P << ")" << std::endl;
+    std::cout << "-M  <val>      " << "Minimum number of faces of the optimization areas that are optimized coarse-to-fine, on decimated versions of the area first. Set 0 to disable." << " (default: " << def.M << ")" << std::endl;
+    std::cout << "-K  <val>      " << "Checkpoint file of the atlas clustering, written periodically in the background and at the end of the clustering. Disabled if not set." << std::endl;
+    std::cout << "-I  <val>      " << "Time between the checkpoints of the atlas clustering (in seconds)." << " (default: " << def.I << ")" << std::endl;
+    std::cout << "-R  <val>      " << "Checkpoint file the atlas clustering is resumed from. The input mesh and the options must be the same as in the interrupted run." << std::endl;
+    std::cout << "-O  <val>      " << "Move log file, the merge operations accepted by the atlas clustering are recorded to it. Disabled if not set." << std::endl;
+    std::cout << "-Y  <val>      " << "Move log file replayed instead of running the atlas clustering, the accepted operations are applied without evaluating the others. The input mesh and the clustering options must be the same as in the recorded run, the packing and output options can differ." << std::endl;
+    std::cout << "-H  <val>      " << "Status file of the atlas clustering, in JSON format, rewritten every second with the iterations, the queue size, the valid merge operations left, the accept ratio and rate, the UV border length reduction and its target (-u), the elapsed time and the estimated time left. Disabled if not set." << std::endl;
+    std::cout << "-F  <val>      " << "Base name of the stage snapshots, compact binary files the processing can be resumed from (see -U): val.pack is written after the atlas clustering and val.render after the packing. Disabled if not set." << std::endl;
+    std::cout << "-U  <val>      " << "Stage snapshot the processing is resumed from, skipping the loading of the input and the stages before the one of the snapshot: the packing and the rendering with a .pack snapshot, the rendering only with a .render snapshot. The input textures must not have changed. MESHFILE is not needed." << std::endl;
+    std::cout << "-G  <val>      " << "Number of partitions of the charts of similar area optimized concurrently by the atlas clustering, before the seams across the partitions are processed. Set 1 to disable." << " (default: " << def.G << ")" << std::endl;
+    std::cout << "-T  <val>      " << "Maximum number of faces of the tiles of charts optimized one at a time by the atlas clustering, to bound its memory usage on large meshes. The seams across tiles are not removed. Set 0 to disable. "
+              << "Optionally followed by dir=<val>, the work directory of a distributed job, on a file system shared with the workers (e.g. 200000,dir=/shared/job): "
+              << "the tiles and then the texture sheets are processed by the processes that claim them first. The workers run with worker,dir=<val> in place of the tile size and the same options, without MESHFILE, "
+              << "and exit with this process." << " (default: " << def.T << ")" << std::endl;
+    std::cout << "-B  <val>      " << "Global memory budget in GB. The packing rasterization cache, the queue of the texture images waiting to be saved and the tiles (-T) are reduced to fit what is left of the budget, and the memory of each subsystem is logged after each phase. Set 0 for unlimited." << " (default: " << def.B << ")" << std::endl;
+    std::cout << "-J  <val>      " << "Execution trace output file, with the spans of the phases, of the moves of the greedy optimization, of packing, rendering, saving and checkpointing on each thread, in Chrome trace JSON format (chrome://tracing, Perfetto). Disabled if not set. "
+              << "The file of textures=<val> (-J trace.json,textures=textures.trace, or -J textures=textures.trace alone) records the input textures bound by the rendering, "
+              << "to be replayed by texture-defrag-cachesim against other cache budgets and eviction policies." << std::endl;
+    std::cout << "-S  <val>      " << "Run report output file, in JSON format, with the final statistics, the wall and cpu time and the peak memory of each phase, and the stats of the optimization, packing, caches, rendering and saving. Disabled if not set." << std::endl;
+    std::cout << "-D  <val>      " << "Batch manifest, or - to read it from the standard input. Each line is a job, a JSON object with the input mesh, the optional output file and id, and the options of the job, e.g. {\"id\": \"a\", \"input\": \"a.obj\", \"output\": \"out/a.obj\", \"args\": [\"-m\", \"3\"]}. The jobs run in one process that keeps the OpenGL context, the rendering resources and the packing rasterization cache, and go through a pipeline of loading, optimization, packing and rendering stages (see -Q). Jobs with a run report are processed alone. The options on the command line are the defaults of the jobs, -i -x -l -A -J -B -Q -N apply to the whole batch. MESHFILE is not needed." << std::endl;
+    std::cout << "-X  <val>      " << "Sweep file, each line is a configuration of the options, a JSON object as in a batch manifest (see -D) without the input mesh, e.g. {\"id\": \"m3\", \"output\": \"out/m3.obj\", \"args\": [\"-m\", \"3\", \"-S\", \"out/m3.json\"]}. The input mesh is loaded and prepared once, then the configurations are optimized, packed and rendered (on the CPU) in forked processes that share the prepared input, as many at a time as the processors. Configurations changing -m or -b repeat the initialization of the atlas clustering. Not supported on Windows." << std::endl;
+    std::cout << "-Q  <val>      " << "Number of jobs loaded, optimized and packed concurrently in batch mode, separated by commas, while another job is rendered. New jobs wait while the memory budget (-B) is exhausted." << " (default: " << def.Q[0] << "," << def.Q[1] << "," << def.Q[2] << ")" << std::endl;
+    std::cout << "-N  <val>      " << "Port of the metrics endpoint in batch mode, served at /metrics in the Prometheus text format with the jobs processed, the duration of the phases, the texture and packing rasterization cache hit rates, the save queue waits and the memory usage. Disabled if 0." << " (default: " << def.N << ")" << std::endl;
+}
+
+typedef std::map<std::string, std::string> OptionFields;
+
+/* Parses the argument of an option made of a value followed by named fields, all
+ * separated by commas (e.g. -n 4,scratch=/tmp/sheets): the value is written to
+ * value and the fields to fields by name. The value can be omitted if the
+ * argument starts with a field. Returns false, printing the reason, on a field
+ * that is not key=value with one of keys as key, or that is repeated */
+static bool ParseOptionFields(const std::string& option, const std::string& argument, std::initializer_list<const char *> keys,
+                              std::string *value, OptionFields *fields)
+{
+    auto isKey = [&keys] (const std::string& name) {
+        return std::find_if(keys.begin(), keys.end(), [&name] (const char *key) { return name == key; }) != keys.end();
+    };
+
+    value->clear();
+    fields->clear();
+    std::size_t start = 0;
+    bool first = true;
+    while (start <= argument.size()) {
+        std::size_t comma = std::min(argument.find(',', start), argument.size());
+        std::string item = argument.substr(start, comma - start);
+        start = comma + 1;
+
+        std::size_t eq = item.find('=');
+        std::string name = item.substr(0, eq);
+        if (eq != std::string::npos && isKey(name) && fields->count(name) == 0) {
+            (*fields)[name] = item.substr(eq + 1);
+        } else if (first) {
+            *value = item;
+        } else {
+            std::cerr << "Unrecognized field `" << item << "` of option " << option << ", the fields are";
+            for (const char *key : keys)
+                std::cerr << " " << key << "=";
+            std::cerr << " (each at most once)" << std::endl << std::endl;
+            return false;
+        }
+        first = false;
+    }
+    return true;
+}
+
+/* Returns the field name of fields, or def if it is not set */
+static std::string OptionField(const OptionFields& fields, const char *name, const std::string& def = "")
+{
+    auto it = fields.find(name);
+    return (it == fields.end()) ? def : it->second;
+}
+
+/* Parses the argument of -j: the flags, as their sum or as a list of names, and
+ * the thread counts of the phases, either in order or by name (greedy=, arap=,
+ * packing=, render=), all separated by commas. If the first value is a number it
+ * is the sum of the flags, the following numbers are the thread counts */
+static bool ParseParallelFlags(const std::string& argument, Args *args)
+{
+    static const char *threadNames[4] = {"greedy", "arap", "packing", "render"};
+
+    int flags = 0;
+    int threads[4] = {0, 0, 0, 0};
+    int positional = 0;
+    bool first = true;
+    std::size_t start = 0;
+    while (start <= argument.size()) {
+        std::size_t comma = std::min(argument.find(',', start), argument.size());
+        std::string value = argument.substr(start, comma - start);
+        start = comma + 1;
+
+        std::size_t eq = value.find('=');
+        std::string name = value.substr(0, eq);
+        int n = -1;
+        int len = 0;
+        const char *number = value.c_str() + ((eq == std::string::npos) ? 0 : eq + 1);
+        bool isNumber = (std::sscanf(number, "%d%n", &n, &len) == 1 && n >= 0 && number[len] == '\0');
+
+        if (eq != std::string::npos) {
+            auto it = std::find(threadNames, threadNames + 4, name);
+            if (it == threadNames + 4 || !isNumber)
+                return false;
+            threads[it - threadNames] = n;
+        } else if (isNumber) {
+            if (first)
+                flags = n;
+            else if (positional < 4)
+                threads[positional++] = n;
+            else
+                return false;
+        } else {
+            auto it = std::find_if(std::begin(parallelFlags), std::end(parallelFlags),
+                                   [&name] (const ParallelFlag& pf) { return name == pf.name; });
+            if (it == std::end(parallelFlags) || positional > 0)
+                return false;
+            flags |= it->flag;
+        }
+        first = false;
+    }
+
+    args->j = flags;
+    std::copy(threads, threads + 4, args->jThreads);
+    return true;
 }
 
 bool ParseOption(const std::string& option, const std::string& argument, Args *args)
@@ -360,27 +2148,313 @@ bool ParseOption(const std::string& option, const std::string& argument, Args *a
         args->outfile = argument;
         return true;
     }
-    if (option[1] == 'l') {
-        args->l = std::stoi(argument);
-        if (args->l >= 0)
+    if (option[1] == 'k') {
+        args->k = argument;
+        return true;
+    }
+    if (option[1] == 'h') {
+        // the layout, and the packing snapshot of the base of an incremental run
+        OptionFields fields;
+        if (!ParseOptionFields(option, argument, {"base"}, &args->h, &fields))
+            return false;
+        args->hBase = OptionField(fields, "base");
+        return true;
+    }
+    if (option[1] == 'C') {
+        // the directory, and whether the results of the jobs are cached too
+        OptionFields fields;
+        if (!ParseOptionFields(option, argument, {"results"}, &args->C, &fields))
+            return false;
+        std::string results = OptionField(fields, "results", "0");
+        args->CResults = (results == "1");
+        if (args->C == "" || (results != "0" && results != "1")) {
+            std::cerr << "The mesh cache directory can only be followed by results=0 or results=1" << std::endl << std::endl;
+            return false;
+        }
+        return true;
+    }
+    if (option[1] == 'K') {
+        args->K = argument;
+        return true;
+    }
+    if (option[1] == 'O') {
+        args->O = argument;
+        return true;
+    }
+    if (option[1] == 'Y') {
+        args->Y = argument;
+        return true;
+    }
+    if (option[1] == 'F') {
+        args->F = argument;
+        return true;
+    }
+    if (option[1] == 'X') {
+        args->X = argument;
+        return true;
+    }
+    if (option[1] == 'H') {
+        args->H = argument;
+        return true;
+    }
+    if (option[1] == 'U') {
+        args->U = argument;
+        return true;
+    }
+    if (option[1] == 'R') {
+        args->R = argument;
+        return true;
+    }
+    if (option[1] == 'J') {
+        // the Chrome trace, and the trace of the texture accesses
+        OptionFields fields;
+        if (!ParseOptionFields(option, argument, {"textures"}, &args->J, &fields))
+            return false;
+        args->JTextures = OptionField(fields, "textures");
+        return true;
+    }
+    if (option[1] == 'S') {
+        args->S = argument;
+        return true;
+    }
+    if (option[1] == 'D') {
+        args->D = argument;
+        return true;
+    }
+    if (option[1] == 'Q') {
+        int q[3];
+        char tail;
+        if (std::sscanf(argument.c_str(), "%d,%d,%d%c", &q[0], &q[1], &q[2], &tail) == 3 && q[0] > 0 && q[1] > 0 && q[2] > 0) {
+            std::copy(q, q + 3, args->Q);
+            return true;
+        } else {
+            std::cerr << "Stage limits must be three positive integers separated by commas" << std::endl << std::endl;
+            return false;
+        }
+    }
+    if (option[1] == 'j') {
+        if (!ParseParallelFlags(argument, args)) {
+            std::cerr << "Parallel execution flags must be a non-negative integer or a list of flag names (";
+            for (const ParallelFlag& pf : parallelFlags)
+                std::cerr << (&pf == parallelFlags ? "" : ", ") << pf.name;
+            std::cerr << "), optionally followed by up to four thread counts, separated by commas" << std::endl << std::endl;
+            return false;
+        }
+        return true;
+    }
+    if (option[1] == 'T') {
+        // the tile size (or worker for the processes joining a distributed job), and
+        // the work directory of the distributed job
+        std::string size;
+        OptionFields fields;
+        if (!ParseOptionFields(option, argument, {"dir"}, &size, &fields))
+            return false;
+        try {
+            args->TWorker = (size == "worker");
+            args->T = args->TWorker ? 0 : std::stoi(size);
+        } catch (const std::exception&) {
+            args->T = -1;
+        }
+        args->TDir = OptionField(fields, "dir");
+        if (args->T < 0 || (args->TWorker && args->TDir == "") || (args->TDir != "" && !args->TWorker && args->T == 0)) {
+            std::cerr << "The tile size must be a non-negative integer, optionally followed by dir=<directory>, the work directory of a distributed job, "
+                      << "or worker followed by dir=<directory>" << std::endl << std::endl;
+            return false;
+        }
+        return true;
+    }
+    if (option[1] == 'f') {
+        // the format or the shared memory object the sheets are published to, and
+        // the side of the UDIM tiles
+        std::string format;
+        OptionFields fields;
+        if (!ParseOptionFields(option, argument, {"shm", "tile"}, &format, &fields))
+            return false;
+        args->fShm = OptionField(fields, "shm");
+        if (fields.count("shm") > 0) {
+            if (args->fShm == "" || format != "") {
+                std::cerr << "The shared memory object of the texture sheets must be named, and replaces the file format" << std::endl << std::endl;
+                return false;
+            }
+        } else if (!ParseTextureFileFormat(format, &args->f)) {
+            std::cerr << "Unrecognized texture file format " << format << std::endl << std::endl;
+            return false;
+        }
+        try {
+            args->fTile = std::stoi(OptionField(fields, "tile", "0"));
+        } catch (const std::exception&) {
+            args->fTile = -1;
+        }
+        if (args->fTile < 0 || args->fTile > 16384) {
+            std::cerr << "The side of the UDIM tiles must be between 0 and 16384" << std::endl << std::endl;
+            return false;
+        }
+        return true;
+    }
+    if (option[1] == 'i') {
+        if (argument == "gpu" || argument == "cpu" || argument == "auto" || argument == "none") {
+            args->i = argument;
+            return true;
+        } else {
+            std::cerr << "Unrecognized texture sheet renderer " << argument << std::endl << std::endl;
+            return false;
+        }
+    }
+    if (option[1] == 'x') {
+        if (ParseOpenGLBackend(argument, &args->x))
             return true;
         else {
-            std::cerr << "Logging level must be positive" << std::endl << std::endl;
+            std::cerr << "Unrecognized OpenGL backend " << argument << std::endl << std::endl;
+            return false;
+        }
+    }
+    if (option[1] == 'l') {
+        // the logging level, and the validation level
+        std::string level;
+        OptionFields fields;
+        if (!ParseOptionFields(option, argument, {"validation"}, &level, &fields))
+            return false;
+        try {
+            args->l = std::stoi(level);
+        } catch (const std::exception&) {
+            args->l = -1;
+        }
+        if (args->l < 0) {
+            std::cerr << "Logging level must be a non-negative integer" << std::endl << std::endl;
+            return false;
+        }
+        if (fields.count("validation") > 0 && !ParseValidationLevel(fields["validation"], &args->lValidation, &args->lValidationAsync)) {
+            std::cerr << "Unrecognized validation level " << fields["validation"] << std::endl << std::endl;
             return false;
         }
+        return true;
     }
     try {
         switch (option[1]) {
-            case 'm': args->m = std::stod(argument); break;
+            case 'm': {
+                // the tolerance, and the tolerance of the coincident seams
+                std::string tolerance;
+                OptionFields fields;
+                if (!ParseOptionFields(option, argument, {"coincident", "reduce"}, &tolerance, &fields))
+                    return false;
+                args->m = std::stod(tolerance);
+                args->mCoincident = std::stod(OptionField(fields, "coincident", "0"));
+                args->mReduce = OptionField(fields, "reduce", "off");
+                if (args->mReduce != "off" && args->mReduce != "linear" && args->mReduce != "bisection") {
+                    std::cerr << "Unrecognized seam reduction " << args->mReduce << std::endl << std::endl;
+                    return false;
+                }
+                break;
+            }
             case 'b': args->b = std::stod(argument); break;
-            case 'd': args->d = std::stod(argument); break;
+            case 'd': {
+                // the distortion tolerance, and the parameters of the ARAP solves of the moves
+                std::string tolerance;
+                OptionFields fields;
+                if (!ParseOptionFields(option, argument, {"solver", "solver-tolerance", "anderson", "early-stop", "scaffold"}, &tolerance, &fields))
+                    return false;
+                const Args def;
+                args->d = std::stod(tolerance);
+                args->dSolver = OptionField(fields, "solver", def.dSolver);
+                ARAPSolverBackend backend;
+                if (!ParseARAPSolverBackend(args->dSolver, &backend)) {
+                    std::cerr << "Unrecognized ARAP solver " << args->dSolver << ", the solvers are ldlt, ldlt-mixed, cg and bicgstab" << std::endl << std::endl;
+                    return false;
+                }
+                args->dSolverTolerance = (fields.count("solver-tolerance") > 0) ? std::stod(fields["solver-tolerance"]) : def.dSolverTolerance;
+                args->dAnderson = std::stoi(OptionField(fields, "anderson", "0"));
+                if (args->dAnderson < 0) {
+                    std::cerr << "The Anderson acceleration window must be a non-negative integer" << std::endl << std::endl;
+                    return false;
+                }
+                args->dEarlyStop = std::stod(OptionField(fields, "early-stop", "0"));
+                if (args->dEarlyStop < 0 || args->dEarlyStop > 1) {
+                    std::cerr << "The early stop margin of the ARAP solves must be in [0,1]" << std::endl << std::endl;
+                    return false;
+                }
+                args->dScaffold = std::stod(OptionField(fields, "scaffold", "0"));
+                if (args->dScaffold < 0) {
+                    std::cerr << "The scaffold width must be non-negative" << std::endl << std::endl;
+                    return false;
+                }
+                break;
+            }
             case 'g': args->g = std::stod(argument); break;
             case 'u': args->u = std::stod(argument); break;
             case 'a': args->a = std::stod(argument); break;
             case 't': args->t = std::stod(argument); break;
+            case 'W': args->W = std::stod(argument); break;
             case 'r': args->r = std::stoi(argument); break;
-            case 'c': args->c = std::stod(argument); break;
+            case 'c': {
+                // the GPU budget, and the budgets of the predecoded input textures and of
+                // the decoded textures retained across the jobs of a batch
+                std::string budget;
+                OptionFields fields;
+                if (!ParseOptionFields(option, argument, {"predecode", "retain"}, &budget, &fields))
+                    return false;
+                args->c = std::stod(budget);
+                args->cPredecode = std::stod(OptionField(fields, "predecode", "0"));
+                args->cRetain = std::stod(OptionField(fields, "retain", "0"));
+                break;
+            }
             case 'p': args->p = std::stod(argument); break;
+            case 's': {
+                // the merge batch size, the lazy costing of the re-queued seams and the
+                // rasterized overlap check of the large optimization areas
+                std::string batch;
+                OptionFields fields;
+                if (!ParseOptionFields(option, argument, {"lazy", "raster-overlap", "raster-resolution"}, &batch, &fields))
+                    return false;
+                const Args def;
+                args->s = std::stoi(batch);
+                args->sLazy = std::stod(OptionField(fields, "lazy", "0"));
+                if (args->sLazy < 0) {
+                    std::cerr << "The lazy cost factor must be non-negative" << std::endl << std::endl;
+                    return false;
+                }
+                args->sRasterOverlap = std::stoi(OptionField(fields, "raster-overlap", "0"));
+                args->sRasterResolution = (fields.count("raster-resolution") > 0) ? std::stoi(fields["raster-resolution"]) : def.sRasterResolution;
+                if (args->sRasterOverlap < 0 || args->sRasterResolution <= 0) {
+                    std::cerr << "The rasterized overlap check needs a non-negative face count and a positive resolution" << std::endl << std::endl;
+                    return false;
+                }
+                break;
+            }
+            case 'q': args->q = std::stod(argument); break;
+            case 'w': {
+                // the encoding workers, and the queue depth of the file I/O
+                std::string workers;
+                OptionFields fields;
+                if (!ParseOptionFields(option, argument, {"depth"}, &workers, &fields))
+                    return false;
+                args->w = std::stoi(workers);
+                args->wDepth = std::stoi(OptionField(fields, "depth", "0"));
+                break;
+            }
+            case 'n': {
+                std::string budget;
+                OptionFields fields;
+                if (!ParseOptionFields(option, argument, {"scratch"}, &budget, &fields))
+                    return false;
+                args->n = std::stod(budget);
+                args->nScratch = OptionField(fields, "scratch");
+                break;
+            }
+            case 'z': args->z = std::stoi(argument); break;
+            case 'v': args->v = std::stoi(argument); break;
+            case 'e': args->e = std::stoi(argument); break;
+            case 'L': args->L = std::stoi(argument); break;
+            case 'Z': args->Z = std::stoi(argument); break;
+            case 'V': args->V = std::stoi(argument); break;
+            case 'y': args->y = std::stoi(argument); break;
+            case 'E': args->E = std::stoi(argument); break;
+            case 'P': args->P = std::stoi(argument); break;
+            case 'M': args->M = std::stoi(argument); break;
+            case 'I': args->I = std::stod(argument); break;
+            case 'G': args->G = std::stoi(argument); break;
+            case 'B': args->B = std::stod(argument); break;
+            case 'A': args->A = std::stoi(argument); break;
+            case 'N': args->N = std::stoi(argument); break;
             default:
                 std::cerr << "Unrecognized option " << option << std::endl << std::endl;
                 return false;
@@ -401,7 +2475,7 @@ Args ParseArgs(int argc, char *argv[])
 
     Args args;
 
-    for (int i = 0; i < argc; ++i) {
+    for (int i = 1; i < argc; ++i) {
         std::string argi(argv[i]);
         if (argi[0] == '-' && argi.size() == 2) {
             i++;
@@ -420,7 +2494,17 @@ Args ParseArgs(int argc, char *argv[])
         }
     }
 
-    if (args.infile == "") {
+    if (args.TDir != "" && (args.D != "" || args.X != "" || args.U != "")) {
+        std::cerr << "Distributed jobs (-T) are not supported in batch mode, in sweeps or when resuming from a stage snapshot" << std::endl << std::endl;
+        std::exit(-1);
+    }
+
+    if (args.CResults && (args.X != "" || args.U != "" || args.TDir != "")) {
+        std::cerr << "The result cache (-C dir,results=1) is not supported in sweeps, in distributed jobs or when resuming from a stage snapshot" << std::endl << std::endl;
+        std::exit(-1);
+    }
+
+    if (args.infile == "" && args.D == "" && args.U == "" && !args.TWorker) {
         std::cerr << "Missing input mesh argument" << std::endl << std::endl;
         PrintArgsUsage(argv[0]);
         std::exit(-1);
@@ -429,30 +2513,47 @@ Args ParseArgs(int argc, char *argv[])
     return args;
 }
 
-void EnsureOpenGLContextOrExit(std::unique_ptr<QOpenGLContext>& context, std::unique_ptr<QOffscreenSurface>& surface)
+bool CreateOpenGLContext(std::unique_ptr<QOpenGLContext>& context, std::unique_ptr<QOffscreenSurface>& surface)
 {
     QSurfaceFormat format;
+    format.setRenderableType(QSurfaceFormat::OpenGL);
     format.setVersion(4, 1);
     format.setProfile(QSurfaceFormat::CoreProfile);
+#ifdef GL_STRICT_ERRORS
+    format.setOption(QSurfaceFormat::DebugContext);
+#endif
 
     context.reset(new QOpenGLContext());
     context->setFormat(format);
     if (!context->create()) {
-        LOG_ERR << "Failed to create OpenGL context. Ensure a headless backend is available (e.g., set QT_QPA_PLATFORM=offscreen QT_OPENGL=egl) or a valid X/GLX display.";
-        std::exit(-1);
+        LOG_WARN << "Failed to create OpenGL context.";
+        context.reset();
+        return false;
     }
 
     surface.reset(new QOffscreenSurface());
     surface->setFormat(context->format());
     surface->create();
     if (!surface->isValid()) {
-        LOG_ERR << "Failed to create offscreen surface for OpenGL.";
-        std::exit(-1);
+        LOG_WARN << "Failed to create offscreen surface for OpenGL.";
+        context.reset();
+        surface.reset();
+        return false;
     }
 
     if (!context->makeCurrent(surface.get())) {
-        LOG_ERR << "Failed to make OpenGL context current on offscreen surface.";
-        std::exit(-1);
+        LOG_WARN << "Failed to make OpenGL context current on offscreen surface.";
+        context.reset();
+        surface.reset();
+        return false;
+    }
+
+    if (context->versionFunctions<OpenGLFunctionsVersion>() == nullptr) {
+        LOG_WARN << "The OpenGL context does not provide OpenGL 4.1 core functions.";
+        context->doneCurrent();
+        context.reset();
+        surface.reset();
+        return false;
     }
 
     QOpenGLFunctions *f = context->functions();
@@ -465,4 +2566,6 @@ void EnsureOpenGLContextOrExit(std::unique_ptr<QOpenGLContext>& context, std::un
                  << " Renderer: " << (renderer ? renderer : "unknown")
                  << " Version: " << (version ? version : "unknown");
     }
-}
\ No newline at end of file
+    EnableGLDebugOutput();
+    return true;
+}
@@ -30,8 +30,16 @@
 #include <omp.h>
 #endif
 #include <cstdint>
+#include <cstring>
 #include <set>
 #include <chrono>
+#include <algorithm>
+#include <future>
+#include <memory>
+#include <random>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
 
 namespace vcg
 {
@@ -69,14 +77,87 @@ private:
     //the area, measured in cells, of the discrete representations of the polygons
     std::vector<int> discreteAreas;
 
+    //the highest top (bottom + deltaY) and right (left + deltaX) sides of each rasterization
+    std::vector<int> maxTop;
+    std::vector<int> maxRight;
+
+public:
+    //a run of columns (rows) of the bottom (left) side of a rasterization, and the
+    //range of the side along it
+    struct ProfileBlock {
+        int start;
+        int length;
+        int minSide;
+        int maxSide;
+    };
+
+    //largest range of the side within a block
+    static constexpr int PROFILE_BLOCK_SPREAD = 8;
+
+private:
+    //the bottom and left sides of each rasterization split in blocks, used to bound
+    //the drops of the poly with range queries on the horizons
+    std::vector< std::vector<ProfileBlock> > bottomBlocks;
+    std::vector< std::vector<ProfileBlock> > leftBlocks;
+
+    static void buildBlocks(const std::vector<int>& side, std::vector<ProfileBlock>& blocks) {
+        blocks.clear();
+        for (int i = 0; i < (int) side.size(); ++i) {
+            if (!blocks.empty()) {
+                ProfileBlock& b = blocks.back();
+                int lo = std::min(b.minSide, side[i]);
+                int hi = std::max(b.maxSide, side[i]);
+                if (hi - lo <= PROFILE_BLOCK_SPREAD) {
+                    b.length++;
+                    b.minSide = lo;
+                    b.maxSide = hi;
+                    continue;
+                }
+            }
+            blocks.push_back({i, 1, side[i], side[i]});
+        }
+    }
+
+    //the parameters of the current rasterizations (rastScale < 0 if not rasterized)
+    float rastScale = -1;
+    int rastRotationNum = 0;
+    int rastGutterWidth = 0;
+
+    //FNV-1a hash of the raw bits of the points (in order), the key of the rasterization
+    //caches. It is updated with the points, and recomputed on demand after getPoints()
+    //since the points may have been changed through the returned reference
+    uint64_t pointsHash = FNV_OFFSET;
+    bool pointsHashValid = true;
+
+    static constexpr uint64_t FNV_OFFSET = 1469598103934665603ULL;
+    static constexpr uint64_t FNV_PRIME = 1099511628211ULL;
+
+    static uint64_t hashPoint(uint64_t h, const Point2f& p) {
+        static_assert(sizeof(float) == 4, "float must be 32-bit");
+        uint32_t bx, by;
+        memcpy(&bx, &p.X(), 4);
+        memcpy(&by, &p.Y(), 4);
+        h ^= bx; h *= FNV_PRIME;
+        h ^= by; h *= FNV_PRIME;
+        return h;
+    }
+
+    void rehashPoints() {
+        pointsHash = FNV_OFFSET;
+        for (const auto& p : points)
+            pointsHash = hashPoint(pointsHash, p);
+        pointsHashValid = true;
+    }
+
 public:
     RasterizedOutline2() { }
     bool hasGrid(int i) const { return gh.at(i) > 0; }
     int gridHeight(int i) { return gh.at(i); }
     int gridWidth( int i) { return gw.at(i); }
 
-    std::vector<Point2f>&  getPoints()           { return points; }
+    std::vector<Point2f>&  getPoints()           { pointsHashValid = false; return points; }
     const std::vector<Point2f>&  getPointsConst() const{ return points; }
+    uint64_t getPointsHash() { if (!pointsHashValid) rehashPoints(); return pointsHash; }
     std::vector< std::vector<uint8_t> >& getGrids(int rast_i)  { return grids[rast_i]; }
 
     //get top/bottom/left/right vectors of the i-th rasterization
@@ -84,18 +165,40 @@ public:
     std::vector<int>& getBottom(int i) { return bottom[i]; }
     std::vector<int>& getDeltaX(int i) { return deltaX[i]; }
     std::vector<int>& getLeft(int i) { return left[i]; }
+    const std::vector<ProfileBlock>& getBottomBlocks(int i) const { return bottomBlocks[i]; }
+    const std::vector<ProfileBlock>& getLeftBlocks(int i) const { return leftBlocks[i]; }
     int& getDiscreteArea(int i) { return discreteAreas[i]; }
-    void addPoint(const Point2f& newpoint) { points.push_back(newpoint); }
-    void setPoints(const std::vector<Point2f>& newpoints) { points = newpoints; }
+    int getMaxTop(int i) const { return maxTop[i]; }
+    int getMaxRight(int i) const { return maxRight[i]; }
+    void addPoint(const Point2f& newpoint) {
+        points.push_back(newpoint);
+        if (pointsHashValid) pointsHash = hashPoint(pointsHash, newpoint);
+    }
+    void setPoints(const std::vector<Point2f>& newpoints) { points = newpoints; rastScale = -1; rehashPoints(); }
+
+    //true if the rasterizations are available and were computed with the given parameters
+    bool isRasterized(float scale, int rotationNum, int gutterWidth) const {
+        return rastScale >= 0 && rastScale == scale && rastRotationNum == rotationNum && rastGutterWidth == gutterWidth;
+    }
+    void setRasterized(float scale, int rotationNum, int gutterWidth) {
+        rastScale = scale;
+        rastRotationNum = rotationNum;
+        rastGutterWidth = gutterWidth;
+    }
 
     //resets the state of the poly and resizes all the states vectors
     void resetState(int totalRasterizationsNum) {
+        rastScale = -1;
         discreteAreas.clear();
         deltaY.clear();
         bottom.clear();
         deltaX.clear();
         left.clear();
         grids.clear();
+        bottomBlocks.clear();
+        leftBlocks.clear();
+        maxTop.clear();
+        maxRight.clear();
 
         discreteAreas.resize(totalRasterizationsNum);
         deltaY.resize(totalRasterizationsNum);
@@ -103,6 +206,10 @@ public:
         deltaX.resize(totalRasterizationsNum);
         left.resize(totalRasterizationsNum);
         grids.resize(totalRasterizationsNum);
+        bottomBlocks.resize(totalRasterizationsNum);
+        leftBlocks.resize(totalRasterizationsNum);
+        maxTop.assign(totalRasterizationsNum, 0);
+        maxRight.assign(totalRasterizationsNum, 0);
         gw.resize(totalRasterizationsNum);
         gh.resize(totalRasterizationsNum);
     }
@@ -110,18 +217,57 @@ public:
     void initFromGrid(int rast_i) {
         std::vector< std::vector<uint8_t> >& tetrisGrid = grids[rast_i];
 
-        bool empty = true;
-        if (!tetrisGrid.empty()) {
-            for (const auto& row : tetrisGrid) {
-                for (uint8_t cell : row) {
-                    if (cell != 0) {
-                        empty = false;
-                        break;
-                    }
+        size_t max_w = 0;
+        for(const auto& row : tetrisGrid)
+            if(row.size() > max_w) max_w = row.size();
+        for(auto& row : tetrisGrid)
+            row.resize(max_w, 0);
+
+        int gridWidth = tetrisGrid.empty() ? 0 : tetrisGrid[0].size();
+        int gridHeight = tetrisGrid.size();
+
+        initFromCells(rast_i, gridWidth, gridHeight, [&](int row, int col) { return tetrisGrid[row][col] != 0; });
+
+        tetrisGrid.clear();
+    }
+
+    //same as initFromGrid(), but the cells are read through the predicate cell(row, col),
+    //with row 0 at the top of the grid. This allows to initialize the rasterization from
+    //a shared (or differently encoded) grid without copying it into the grids vector
+    template <class CellFn>
+    void initFromCells(int rast_i, int gridWidth, int gridHeight, CellFn cell) {
+        std::vector<int> colTop(gridWidth, -1), colBottom(gridWidth, -1);
+        std::vector<int> rowLeft(gridHeight, -1), rowRight(gridHeight, -1);
+        for (int row = 0; row < gridHeight; ++row) {
+            for (int col = 0; col < gridWidth; ++col) {
+                if (cell(row, col)) {
+                    if (colTop[col] < 0) colTop[col] = row;
+                    colBottom[col] = row;
+                    if (rowLeft[row] < 0) rowLeft[row] = col;
+                    rowRight[row] = col;
                 }
-                if (!empty) break;
             }
         }
+        initFromExtents(rast_i, gridWidth, gridHeight, colTop, colBottom, rowLeft, rowRight);
+    }
+
+    //same as initFromCells(), but from the extents of the covered cells of each line, which
+    //is all the packer reads of a rasterization: colTop[c]/colBottom[c] are the first and
+    //last covered rows of the column c (row 0 at the top), rowLeft[r]/rowRight[r] the first
+    //and last covered columns of the row r, and all of them are -1 for the empty lines
+    void initFromExtents(int rast_i, int gridWidth, int gridHeight,
+                         const std::vector<int>& colTop, const std::vector<int>& colBottom,
+                         const std::vector<int>& rowLeft, const std::vector<int>& rowRight) {
+        bottom[rast_i].clear();
+        deltaY[rast_i].clear();
+        left[rast_i].clear();
+        deltaX[rast_i].clear();
+        bottomBlocks[rast_i].clear();
+        leftBlocks[rast_i].clear();
+
+        bool empty = true;
+        for (int col = 0; col < gridWidth && empty; ++col)
+            empty = (colTop[col] < 0);
 
         if (empty) {
             // This case can happen if the initial rasterization was empty.
@@ -131,19 +277,9 @@ public:
             gh[rast_i] = 0;
             discreteAreas[rast_i] = 0;
             // The vectors deltaY, bottom, etc. will remain empty, which is valid for an empty grid.
-            tetrisGrid.clear();
             return;
         }
 
-        size_t max_w = 0;
-        for(const auto& row : tetrisGrid)
-            if(row.size() > max_w) max_w = row.size();
-        for(auto& row : tetrisGrid)
-            row.resize(max_w, 0);
-
-        int gridWidth = tetrisGrid[0].size();
-        int gridHeight = tetrisGrid.size();
-
         gw[rast_i] = gridWidth;
         gh[rast_i] = gridHeight;
 
@@ -153,69 +289,29 @@ public:
         left[rast_i].reserve(gridHeight);
         deltaX[rast_i].reserve(gridHeight);
 
-        //compute bottom,
-        //where bottom[i] = empty cells from the bottom in the column i
-        for (int col = 0; col < gridWidth; col++) {
-            int bottom_i = 0;
-            for (int row = gridHeight - 1; row >= 0; row--) {
-                if (tetrisGrid[row][col] == 0) {
-                    bottom_i++;
-                }
-                else {
-                    bottom[rast_i].push_back(bottom_i);
-                    break;
-                }
-            }
-        }
-        if (bottom[rast_i].size() == 0) assert("ERROR: EMPTY BOTTOM VECTOR"==0);
-
-        //compute top
-        //IT ASSUMES THAT THERE IS AT LEAST ONE NON-0 ELEMENT (which should always be the case, even if the poly is just a point)
-        //deltaY[i] = for the column i, it stores the number of cells which are between the bottom and the top side of the poly
+        //bottom[i] = empty cells from the bottom in the column i, deltaY[i] = the number of
+        //cells between the bottom and the top side of the poly (0 for the empty columns)
         for (int col = 0; col < gridWidth; col++) {
-            int deltay_i = gridHeight - bottom[rast_i][col];
-            for (int row = 0; row < gridHeight; row++) {
-                if (tetrisGrid[row][col] == 0) {
-                    deltay_i--;
-                }
-                else {
-                    break;
-                }
-            }
-            deltaY[rast_i].push_back(deltay_i);
-        }
-        if (deltaY[rast_i].size() == 0) assert("ERROR: EMPTY deltaY VECTOR"==0);
-
-        //same meaning as bottom, but for the left side
-        //we want left/right sides vector to be ordered so that index 0 is at poly's bottom
-        int left_i;
-        for (int row = gridHeight-1; row >= 0; --row) {
-            //for (int row = 0; row < gridHeight; ++row) {
-            left_i = 0;
-            for (int col = 0; col < gridWidth; col++) {
-                if (tetrisGrid[row][col] == 0) ++left_i;
-                else {
-                    left[rast_i].push_back(left_i);
-                    break;
-                }
+            if (colTop[col] < 0) {
+                bottom[rast_i].push_back(0);
+                deltaY[rast_i].push_back(0);
+            } else {
+                bottom[rast_i].push_back(gridHeight - 1 - colBottom[col]);
+                deltaY[rast_i].push_back(colBottom[col] - colTop[col] + 1);
             }
         }
-        if (left[rast_i].size() == 0) assert("ERROR: EMPTY leftSide VECTOR"==0);
 
+        //same meaning as bottom and deltaY, but for the left side
         //we want left/right sides vector to be ordered so that index 0 is at poly's bottom
-        int deltax_i;
-        for (int row = gridHeight-1; row >= 0; --row) {
-            //for (int row = 0; row < gridHeight; ++row) {
-            deltax_i = gridWidth - left[rast_i][gridHeight - 1 - row];
-            for (int col = gridWidth - 1; col >= 0; --col) {
-                if (tetrisGrid[row][col] == 0) --deltax_i;
-                else {
-                    break;
-                }
+        for (int row = gridHeight - 1; row >= 0; --row) {
+            if (rowLeft[row] < 0) {
+                left[rast_i].push_back(0);
+                deltaX[rast_i].push_back(0);
+            } else {
+                left[rast_i].push_back(rowLeft[row]);
+                deltaX[rast_i].push_back(rowRight[row] - rowLeft[row] + 1);
             }
-            deltaX[rast_i].push_back(deltax_i);
         }
-        if (deltaX[rast_i].size() == 0) assert("ERROR: EMPTY rightSide VECTOR"==0);
 
         //compute the discreteArea: IT IS THE AREA (measured in grid cells) BETWEEN THE TOP AND BOTTOM SIDES...
         int discreteArea = 0;
@@ -224,10 +320,190 @@ public:
         }
         discreteAreas[rast_i] = discreteArea;
 
-        tetrisGrid.clear();
+        buildBlocks(bottom[rast_i], bottomBlocks[rast_i]);
+        buildBlocks(left[rast_i], leftBlocks[rast_i]);
+
+        maxTop[rast_i] = 0;
+        for (int col = 0; col < gridWidth; ++col)
+            maxTop[rast_i] = std::max(maxTop[rast_i], bottom[rast_i][col] + deltaY[rast_i][col]);
+        maxRight[rast_i] = 0;
+        for (int row = 0; row < gridHeight; ++row)
+            maxRight[rast_i] = std::max(maxRight[rast_i], left[rast_i][row] + deltaX[rast_i][row]);
     }
 };
 
+//Range maximum queries over a horizon, as an iterative segment tree over the cells.
+//The horizons only grow, so an update stops at the first ancestor it leaves unchanged
+class HorizonMaxTree
+{
+public:
+
+    HorizonMaxTree() : mN(0) {}
+
+    explicit HorizonMaxTree(int n) : mN(std::max(n, 0)), mTree(2 * size_t(std::max(n, 0)), 0) {}
+
+    bool empty() const { return mN == 0; }
+
+    void set(int i, int value) {
+        size_t p = size_t(i) + mN;
+        mTree[p] = value;
+        for (p >>= 1; p >= 1; p >>= 1) {
+            int m = std::max(mTree[2 * p], mTree[2 * p + 1]);
+            if (mTree[p] == m)
+                break;
+            mTree[p] = m;
+        }
+    }
+
+    //max of the cells [first, last)
+    int max(int first, int last) const {
+        int m = -INT_MAX;
+        for (size_t l = size_t(first) + mN, r = size_t(last) + mN; l < r; l >>= 1, r >>= 1) {
+            if (l & 1) m = std::max(m, mTree[l++]);
+            if (r & 1) m = std::max(m, mTree[--r]);
+        }
+        return m;
+    }
+
+private:
+
+    size_t mN;
+    std::vector<int> mTree;
+};
+
+//Bit-packed occupancy of a packing grid, stored as a set of lines (the columns or
+//the rows of the grid) of 'length' cells each. Every line is a contiguous run of
+//64-bit words, so span tests and free-run extraction process 64 cells at a time.
+//The words are allocated with ALLOCATOR, the grids of the large containers span
+//tens of megabytes
+template <class ALLOCATOR = std::allocator<uint64_t>>
+class OccupancyBitGrid
+{
+public:
+
+    OccupancyBitGrid() : mLines(0), mLength(0), mWordsPerLine(0) {}
+
+    OccupancyBitGrid(int lines, int length)
+        : mLines(lines), mLength(length), mWordsPerLine((length + 63) / 64),
+          mBits(size_t(std::max(lines, 0)) * size_t((length + 63) / 64), 0) {}
+
+    bool empty() const { return mBits.empty(); }
+
+    //marks the cells [start, start+len) of the line as occupied (clipped to the line)
+    void setSpan(int line, int start, int len) {
+        int end = std::min(start + len, mLength);
+        start = std::max(start, 0);
+        if (line < 0 || line >= mLines || start >= end) return;
+        uint64_t *w = lineWords(line);
+        for (int k = start >> 6; k <= (end - 1) >> 6; ++k)
+            w[k] |= wordMask(k, start, end);
+    }
+
+    //returns true if the cells [start, start+len) of the line are inside the grid and all free
+    bool spanFree(int line, int start, int len) const {
+        if (len <= 0) return true;
+        int end = start + len;
+        if (line < 0 || line >= mLines || start < 0 || end > mLength) return false;
+        const uint64_t *w = lineWords(line);
+        for (int k = start >> 6; k <= (end - 1) >> 6; ++k)
+            if (w[k] & wordMask(k, start, end))
+                return false;
+        return true;
+    }
+
+    //returns the largest run of free cells of the line that lies in [0, end),
+    //as its first cell and its length (0 if there are no free cells)
+    void largestFreeRun(int line, int end, int& runStart, int& runLength) const {
+        runStart = 0;
+        runLength = 0;
+        end = std::min(end, mLength);
+        int pos = nextCell(line, 0, false, end);
+        while (pos < end) {
+            int occ = nextCell(line, pos, true, end);
+            if (occ - pos > runLength) {
+                runStart = pos;
+                runLength = occ - pos;
+            }
+            pos = nextCell(line, occ, false, end);
+        }
+    }
+
+private:
+
+    int mLines;
+    int mLength;
+    int mWordsPerLine;
+    std::vector<uint64_t, ALLOCATOR> mBits;
+
+    uint64_t *lineWords(int line) { return mBits.data() + size_t(line) * mWordsPerLine; }
+    const uint64_t *lineWords(int line) const { return mBits.data() + size_t(line) * mWordsPerLine; }
+
+    //mask of the bits of the k-th word of a line that fall in [start, end)
+    static uint64_t wordMask(int k, int start, int end) {
+        int lo = std::max(start - 64 * k, 0);
+        int hi = std::min(end - 64 * k, 64);
+        uint64_t m = (hi == 64) ? ~uint64_t(0) : ((uint64_t(1) << hi) - 1);
+        return m & (~uint64_t(0) << lo);
+    }
+
+    static int countTrailingZeros(uint64_t v) {
+#if defined(_MSC_VER)
+        unsigned long i;
+        _BitScanForward64(&i, v);
+        return int(i);
+#else
+        return __builtin_ctzll(v);
+#endif
+    }
+
+    //first cell >= pos of the line whose state is 'occupied', or end if there is none before end
+    int nextCell(int line, int pos, bool occupied, int end) const {
+        if (pos >= end) return end;
+        const uint64_t *w = lineWords(line);
+        int k = pos >> 6;
+        uint64_t word = (occupied ? w[k] : ~w[k]) & (~uint64_t(0) << (pos & 63));
+        while (word == 0) {
+            if (++k >= mWordsPerLine || 64 * k >= end) return end;
+            word = occupied ? w[k] : ~w[k];
+        }
+        return std::min(64 * k + countTrailingZeros(word), end);
+    }
+};
+
+//evaluator of the candidate placements of the polys outside of the packer threads (for
+//example on the GPU), see RasterizedOutline2Packer::Parameters::placementEvaluator.
+//It keeps its own copy of the outer horizons of the containers of a packing: begin()
+//starts a packing with empty horizons and place() raises them with each placed poly.
+//The candidates are evaluated with the drops and the costs of the packer
+class RasterizedPlacementEvaluator
+{
+public:
+    //the poly rasterization rast dropped in the container on the bottom horizon at
+    //column pos, or on the left horizon at row pos if fromLeft is not zero
+    struct Candidate {
+        int rast;
+        int container;
+        int fromLeft;
+        int pos;
+    };
+
+    virtual ~RasterizedPlacementEvaluator() {}
+
+    //starts a packing in containers of the given sizes, costFunction is a value of
+    //Parameters::CostFuncEnum and minmax is true if the costs of both the horizons are
+    //combined. Returns false if the evaluator cannot be used by the calling thread
+    virtual bool begin(const std::vector<Point2i>& containerSizes, int costFunction, bool minmax) = 0;
+
+    //evaluates the candidates of the poly and stores in best the index of the first one
+    //with the lowest cost (-1 if none is valid), with its position and cost. Returns
+    //false if the evaluation failed, the candidates are then evaluated by the packer
+    virtual bool evaluate(RasterizedOutline2& poly, int rotationNum, const std::vector<Candidate>& candidates,
+                          int& best, Point2i& pos, int& cost) = 0;
+
+    //raises the horizons of the container with the rasterization rast placed at pos
+    virtual void place(RasterizedOutline2& poly, int rast, int container, Point2i pos) = 0;
+};
+
 template <class ScalarType>
 class ComparisonFunctor
 {
@@ -246,7 +522,8 @@ public:
     }
 };
 
-template <class SCALAR_TYPE, class RASTERIZER_TYPE>
+//GRID_ALLOCATOR allocates the occupancy grids of the packing fields
+template <class SCALAR_TYPE, class RASTERIZER_TYPE, class GRID_ALLOCATOR = std::allocator<uint64_t>>
 class RasterizedOutline2Packer
 {
     typedef typename vcg::Box2<SCALAR_TYPE> Box2x;
@@ -255,6 +532,17 @@ class RasterizedOutline2Packer
 
     static constexpr int INVALID_POSITION = -1;
 
+    // block size of the levels of the horizon pyramids, number of blocks kept at each
+    // level and least number of candidates of the hierarchical search
+    static constexpr int PYRAMID_FACTOR = 4;
+    static constexpr int HIERARCHICAL_KEEP = 8;
+    static constexpr int HIERARCHICAL_MIN_CANDIDATES = 64;
+
+    // the drops are computed with the range maximum trees if the side of the poly has
+    // at least this many columns (rows) per block, otherwise by scanning the side (which
+    // is faster on narrow polys, a range query costs about as much as scanning 2 log n cells)
+    static constexpr int BLOCKED_DROP_RATIO = 32;
+
     struct PlacementResult {
         int cost = INT_MAX;
         int rastIndex = -1;
@@ -274,8 +562,19 @@ public:
         int rasterize_calls = 0;
         int64_t candidateY_cols_evaluated = 0;
         int64_t candidateX_rows_evaluated = 0;
+        int gpu_evaluations = 0; // polys whose candidates were evaluated by the placementEvaluator
     };
 
+    /* A placement decided in advance, for example by a previous packing of the poly at
+     * the same scale: the poly is placed in the container with the transformation tr
+     * (as returned by the packing functions). Ignored if container is -1 */
+    struct FixedPlacement {
+        int container = -1;
+        Similarity2x tr;
+    };
+
+    /* The profile of the last packing run by the calling thread, unless the caller
+     * passes its own ProfileData to the packing functions */
     static void ResetProfile() { m_last_profile = ProfileData{}; }
     static const ProfileData& LastProfile() { return m_last_profile; }
 
@@ -313,6 +612,21 @@ public:
       // proportionally to the number of permutations tested
       bool permutations;
 
+      // number of random permutations tried if permutations is true. If 0 the number
+      // of trials is 5 times the number of shuffled polygons (the largest ones)
+      int permutationTrials;
+
+      // if not 0, the random permutations are drawn from a generator seeded with
+      // this value, so that the same trials are tried in every run. If 0 they are
+      // drawn with std::random_shuffle
+      unsigned permutationSeed;
+
+      // number of threads running the permutation trials of the best effort packing
+      // concurrently, each trial on its own packing fields. If 1 the trials are run
+      // sequentially, if 0 all the OpenMP threads are used. The result is the same
+      // as the sequential one
+      int permutationThreads;
+
       //the number of rasterizations to create for each polygon; It must be a multiple of 4.
       int rotationNum;
 
@@ -323,6 +637,32 @@ public:
       // can help to keep the packing area in a rectangular region
       bool minmax;
 
+      // if true, the packing fields also keep a bit-packed occupancy of the placed
+      // polygons (one bit per cell). It is only used together with innerHorizon: the
+      // placements between previously placed polygons are validated with exact
+      // collision tests, and the inner horizons are recovered as the largest free
+      // gap under the outer horizon instead of being dropped when a polygon
+      // partially overlaps them
+      bool occupancyGrid;
+
+      // number of charts (following the packing order) whose rasterizations are
+      // computed in background while the current chart is being placed. 0 disables
+      // the look-ahead, and the charts are rasterized only when they are reached
+      int rasterizationLookAhead;
+
+      // if true, the packing fields keep max pyramids of their horizons (blocks of 4
+      // and 16 cells), and when a rasterization has many candidate positions only the
+      // ones near the most promising blocks of the pyramids are evaluated at full
+      // resolution. It is faster on large grids, but the placements are no longer the
+      // best among all the candidates. Not used together with innerHorizon
+      bool hierarchicalSearch;
+
+      // if not null, the candidate placements of each poly are evaluated by this object
+      // (for example on the GPU) instead of the packer threads, whenever it accepts the
+      // packing (see RasterizedPlacementEvaluator::begin()). The placements are the same.
+      // Not used together with innerHorizon
+      RasterizedPlacementEvaluator *placementEvaluator;
+
       ///default constructor
       Parameters()
       {
@@ -330,9 +670,16 @@ public:
           doubleHorizon=true;
           innerHorizon=false;
           permutations=false;
+          permutationTrials = 0;
+          permutationSeed = 0;
+          permutationThreads = 1;
           rotationNum = 16;
           gutterWidth = 0;
           minmax = false;
+          occupancyGrid = false;
+          rasterizationLookAhead = 0;
+          hierarchicalSearch = false;
+          placementEvaluator = nullptr;
       }
   };
 
@@ -361,6 +708,20 @@ public:
       std::set<int> mBottomEvents;
       std::set<int> mLeftEvents;
 
+      // occupancy of the placed polys, as column spans (for the bottom horizon)
+      // and as row spans (for the left horizon). Empty if not used
+      OccupancyBitGrid<GRID_ALLOCATOR> mColumnOccupancy;
+      OccupancyBitGrid<GRID_ALLOCATOR> mRowOccupancy;
+
+      // max pyramids of the horizons, the level l holds the max of the blocks of
+      // 4^(l+1) cells. Empty if the hierarchical search is not used
+      std::vector<int> mBottomPyramid[2];
+      std::vector<int> mLeftPyramid[2];
+
+      // range maximum trees of the horizons
+      HorizonMaxTree mBottomTree;
+      HorizonMaxTree mLeftTree;
+
       //the size of the packing grid
       vcg::Point2i mSize;
 
@@ -384,6 +745,22 @@ public:
 
           mBottomEvents.insert(0);
           mLeftEvents.insert(0);
+
+          mBottomTree = HorizonMaxTree(size.X());
+          mLeftTree = HorizonMaxTree(size.Y());
+
+          if (params.occupancyGrid && params.innerHorizon) {
+              mColumnOccupancy = OccupancyBitGrid<GRID_ALLOCATOR>(size.X(), size.Y());
+              mRowOccupancy = OccupancyBitGrid<GRID_ALLOCATOR>(size.Y(), size.X());
+          }
+
+          if (params.hierarchicalSearch && !params.innerHorizon) {
+              for (int l = 0; l < 2; ++l) {
+                  int f = PYRAMID_FACTOR << (2 * l);
+                  mBottomPyramid[l].resize((size.X() + f - 1) / f, 0);
+                  mLeftPyramid[l].resize((size.Y() + f - 1) / f, 0);
+              }
+          }
       }
 
       std::vector<int>& bottomHorizon() { return mBottomHorizon; }
@@ -393,12 +770,83 @@ public:
       const std::set<int>& bottomEvents() const { return mBottomEvents; }
       const std::set<int>& leftEvents() const { return mLeftEvents; }
 
+      //Coarse-to-fine selection of the candidate positions (sorted, in [0, maxPos]) of the
+      //drop of the rasterization on the bottom (or left) horizon. The drop at the block
+      //positions is bounded from above with the 16x and then with the 4x level of the
+      //pyramid of the horizon, against the lowest side of the poly in each block. Only
+      //the candidates near the best blocks of the 4x level are kept, together with the
+      //positions of those blocks. Returns the candidates unchanged if they are few, or
+      //if the pyramids are not maintained
+      std::vector<int> hierarchicalCandidates(RasterizedOutline2& poly, int rast_i, bool bottomSide,
+                                              const std::vector<int>& candidates, int maxPos) const {
+          const std::vector<int> *pyr = bottomSide ? mBottomPyramid : mLeftPyramid;
+          if (pyr[0].empty() || (int) candidates.size() <= HIERARCHICAL_MIN_CANDIDATES || maxPos < 0)
+              return candidates;
+
+          // the lowest side of the poly in the blocks of 4 and 16 cells
+          auto blockMin = [](const std::vector<int>& v) -> std::vector<int> {
+              std::vector<int> m((v.size() + PYRAMID_FACTOR - 1) / PYRAMID_FACTOR, INT_MAX);
+              for (size_t i = 0; i < v.size(); ++i)
+                  m[i / PYRAMID_FACTOR] = std::min(m[i / PYRAMID_FACTOR], v[i]);
+              return m;
+          };
+          std::vector<int> side[2];
+          side[0] = blockMin(bottomSide ? poly.getBottom(rast_i) : poly.getLeft(rast_i));
+          side[1] = blockMin(side[0]);
+
+          // keeps the HIERARCHICAL_KEEP blocks in [first, last] of the level with the lowest bound
+          std::vector<std::pair<int, int>> scored;
+          auto bestBlocks = [&](int l, const std::vector<int>& blocks) -> std::vector<int> {
+              scored.clear();
+              for (int k : blocks) {
+                  int b = -INT_MAX;
+                  for (size_t j = 0; j < side[l].size() && k + j < pyr[l].size(); ++j)
+                      b = std::max(b, pyr[l][k + j] - side[l][j]);
+                  scored.push_back(std::make_pair(b, k));
+              }
+              size_t n = std::min<size_t>(HIERARCHICAL_KEEP, scored.size());
+              std::partial_sort(scored.begin(), scored.begin() + n, scored.end());
+              std::vector<int> best;
+              for (size_t i = 0; i < n; ++i)
+                  best.push_back(scored[i].second);
+              return best;
+          };
+
+          std::vector<int> blocks;
+          for (int k = 0; k <= maxPos / (PYRAMID_FACTOR * PYRAMID_FACTOR); ++k)
+              blocks.push_back(k);
+          std::vector<int> best16 = bestBlocks(1, blocks);
+
+          // the 4x blocks of the best 16x blocks and their neighbors
+          std::set<int> blockSet;
+          for (int k : best16)
+              for (int k4 = PYRAMID_FACTOR * (k - 1); k4 < PYRAMID_FACTOR * (k + 2); ++k4)
+                  if (k4 >= 0 && k4 <= maxPos / PYRAMID_FACTOR)
+                      blockSet.insert(k4);
+          std::vector<int> best4 = bestBlocks(0, std::vector<int>(blockSet.begin(), blockSet.end()));
+
+          std::vector<int> refined;
+          for (int k : best4)
+              refined.push_back(PYRAMID_FACTOR * k);
+          for (int c : candidates) {
+              for (int k : best4) {
+                  if (c >= PYRAMID_FACTOR * (k - 1) && c < PYRAMID_FACTOR * (k + 2)) {
+                      refined.push_back(c);
+                      break;
+                  }
+              }
+          }
+          std::sort(refined.begin(), refined.end());
+          refined.erase(std::unique(refined.begin(), refined.end()), refined.end());
+          return refined;
+      }
+
       //returns the score relative to the left horizon of that poly in that particular position, taking into account the choosen algo
       int getCostX(RasterizedOutline2& poly, Point2i pos, int rast_i) {
           switch (params.costFunction) {
-          case CostFuncEnum::MinWastedSpace: return emptyCellBetweenPolyAndLeftHorizon(poly, pos, rast_i);
-          case CostFuncEnum::LowestHorizon: return maxXofPoly(poly, pos, rast_i);
-          case CostFuncEnum::MixedCost: return costXWithPenaltyOnY(poly, pos, rast_i);
+          case CostFuncEnum::MinWastedSpace: return costX<CostFuncEnum::MinWastedSpace>(poly, pos, rast_i);
+          case CostFuncEnum::LowestHorizon: return costX<CostFuncEnum::LowestHorizon>(poly, pos, rast_i);
+          case CostFuncEnum::MixedCost: return costX<CostFuncEnum::MixedCost>(poly, pos, rast_i);
           }
           return 0;
       }
@@ -406,6 +854,28 @@ public:
       //returns the score relative to the bottom horizon of that poly in that particular position, taking into account the choosen algo
       int getCostY(RasterizedOutline2& poly, Point2i pos, int rast_i) {
           switch (params.costFunction) {
+          case CostFuncEnum::MinWastedSpace: return costY<CostFuncEnum::MinWastedSpace>(poly, pos, rast_i);
+          case CostFuncEnum::LowestHorizon: return costY<CostFuncEnum::LowestHorizon>(poly, pos, rast_i);
+          case CostFuncEnum::MixedCost: return costY<CostFuncEnum::MixedCost>(poly, pos, rast_i);
+          }
+          return 0;
+      }
+
+      //getCostX() for the cost function known at compile time (params.costFunction is ignored)
+      template <CostFuncEnum COST>
+      int costX(RasterizedOutline2& poly, Point2i pos, int rast_i) {
+          switch (COST) {
+          case CostFuncEnum::MinWastedSpace: return emptyCellBetweenPolyAndLeftHorizon(poly, pos, rast_i);
+          case CostFuncEnum::LowestHorizon: return maxXofPoly(poly, pos, rast_i);
+          case CostFuncEnum::MixedCost: return costXWithPenaltyOnY(poly, pos, rast_i);
+          }
+          return 0;
+      }
+
+      //getCostY() for the cost function known at compile time (params.costFunction is ignored)
+      template <CostFuncEnum COST>
+      int costY(RasterizedOutline2& poly, Point2i pos, int rast_i) {
+          switch (COST) {
           case CostFuncEnum::MinWastedSpace: return emptyCellBetweenPolyAndBottomHorizon(poly, pos, rast_i);
           case CostFuncEnum::LowestHorizon: return maxYofPoly(poly, pos, rast_i);
           case CostFuncEnum::MixedCost: return costYWithPenaltyOnX(poly, pos, rast_i);
@@ -413,11 +883,34 @@ public:
           return 0;
       }
 
+      //same as costY(), for a poly dropped on the bottom horizon at pos (see dropY()).
+      //There the poly lies above the horizon in every column, so the lowest horizon cost
+      //is the drop plus the highest top of the poly, without scanning the columns
+      template <CostFuncEnum COST>
+      int costYAtDrop(RasterizedOutline2& poly, Point2i pos, int rast_i) {
+          if (COST == CostFuncEnum::LowestHorizon && poly.gridWidth(rast_i) > 0)
+              return pos.Y() + poly.getMaxTop(rast_i);
+          return costY<COST>(poly, pos, rast_i);
+      }
+
+      //same as costX(), for a poly dropped on the left horizon at pos (see dropX())
+      template <CostFuncEnum COST>
+      int costXAtDrop(RasterizedOutline2& poly, Point2i pos, int rast_i) {
+          if (COST == CostFuncEnum::LowestHorizon && poly.gridHeight(rast_i) > 0)
+              return pos.X() + poly.getMaxRight(rast_i);
+          return costX<COST>(poly, pos, rast_i);
+      }
+
       //given a poly and the column at which it is placed,
       //this returns the Y at which the wasted space is minimum
       //i.e. the Y at which the polygon touches the horizon
       int dropY(RasterizedOutline2& poly, int col, int rast_i) {
           std::vector<int>& bottom = poly.getBottom(rast_i);
+          const auto& blocks = poly.getBottomBlocks(rast_i);
+          if (blocks.size() * BLOCKED_DROP_RATIO <= bottom.size()) {
+              int y_max = blockedDrop(mBottomTree, mBottomHorizon, bottom, blocks, col);
+              return (y_max + poly.gridHeight(rast_i) >= mSize.Y()) ? INVALID_POSITION : y_max;
+          }
           int y_max = -INT_MAX;
           for (size_t i = 0; i < bottom.size(); ++i) {
               int y = mBottomHorizon[col + i] - bottom[i];
@@ -430,6 +923,29 @@ public:
           return y_max;
       }
 
+      //max over the side of (horizon - side) with the side placed at pos, that is the
+      //drop of a poly. Each block of the side contributes between the max of the horizon
+      //along it minus the largest and minus the smallest side, only the blocks that can
+      //exceed the best lower bound are scanned
+      static int blockedDrop(const HorizonMaxTree& tree, const std::vector<int>& horizon, const std::vector<int>& side,
+                             const std::vector<RasterizedOutline2::ProfileBlock>& blocks, int pos) {
+          static thread_local std::vector<int> blockMax;
+          blockMax.resize(blocks.size());
+          int d_max = -INT_MAX;
+          for (size_t k = 0; k < blocks.size(); ++k) {
+              blockMax[k] = tree.max(pos + blocks[k].start, pos + blocks[k].start + blocks[k].length);
+              d_max = std::max(d_max, blockMax[k] - blocks[k].maxSide);
+          }
+          for (size_t k = 0; k < blocks.size(); ++k) {
+              const auto& b = blocks[k];
+              if (blockMax[k] - b.minSide <= d_max)
+                  continue;
+              for (int i = b.start; i < b.start + b.length; ++i)
+                  d_max = std::max(d_max, horizon[pos + i] - side[i]);
+          }
+          return d_max;
+      }
+
       int dropYInner(RasterizedOutline2& poly, int col, int rast_i) {
           std::vector<int>& bottom = poly.getBottom(rast_i);
           std::vector<int>& deltaY = poly.getDeltaY(rast_i);
@@ -444,6 +960,13 @@ public:
               }
           }
           // check if the placement is feasible
+          if (!mColumnOccupancy.empty()) {
+              for (size_t i = 0; i < bottom.size(); ++i) {
+                  if (!mColumnOccupancy.spanFree(col + i, y_max + bottom[i], deltaY[i]))
+                      return INVALID_POSITION;
+              }
+              return y_max;
+          }
           for (size_t i = 0; i < bottom.size(); ++i) {
               if (y_max + bottom[i] < mBottomHorizon[col + i]
                       && y_max + bottom[i] + deltaY[i] > mInnerBottomHorizon[col + i] + mInnerBottomExtent[col + i]) {
@@ -458,6 +981,11 @@ public:
       //i.e. the X at which the polygon touches the left horizon
       int dropX(RasterizedOutline2& poly, int row, int rast_i) {
           std::vector<int>& left = poly.getLeft(rast_i);
+          const auto& blocks = poly.getLeftBlocks(rast_i);
+          if (blocks.size() * BLOCKED_DROP_RATIO <= left.size()) {
+              int x_max = blockedDrop(mLeftTree, mLeftHorizon, left, blocks, row);
+              return (x_max + poly.gridWidth(rast_i) >= mSize.X()) ? INVALID_POSITION : x_max;
+          }
           int x_max = -INT_MAX;
           for (size_t i = 0; i < left.size(); ++i) {
               int x = mLeftHorizon[row + i] - left[i];
@@ -471,8 +999,8 @@ public:
       }
 
       int dropXInner(RasterizedOutline2& poly, int row, int rast_i) {
-          std::vector<int> left = poly.getLeft(rast_i);
-          std::vector<int> deltaX = poly.getDeltaX(rast_i);
+          std::vector<int>& left = poly.getLeft(rast_i);
+          std::vector<int>& deltaX = poly.getDeltaX(rast_i);
           int x_max = -INT_MAX;
           for (size_t i = 0; i < left.size(); ++i) {
               int x = mInnerLeftHorizon[row + i] - left[i];
@@ -483,6 +1011,13 @@ public:
               }
           }
           // sanity check
+          if (!mRowOccupancy.empty()) {
+              for (size_t i = 0; i < left.size(); ++i) {
+                  if (!mRowOccupancy.spanFree(row + i, x_max + left[i], deltaX[i]))
+                      return INVALID_POSITION;
+              }
+              return x_max;
+          }
           for (size_t i = 0; i < left.size(); ++i) {
               if (x_max + left[i] < mLeftHorizon[row + i]
                       && x_max + left[i] + deltaX[i] > mInnerLeftHorizon[row + i] + mInnerLeftExtent[row + i])
@@ -684,11 +1219,23 @@ public:
 
           }
 
+          if (!mColumnOccupancy.empty()) {
+              // the gaps are known exactly, recover the largest one under the horizon
+              for (int i = 0; i < poly.gridWidth(rast_i); i++) {
+                  int x = pos.X() + i;
+                  mColumnOccupancy.setSpan(x, pos.Y() + bottom[i], deltaY[i]);
+                  mColumnOccupancy.largestFreeRun(x, mBottomHorizon[x], mInnerBottomHorizon[x], mInnerBottomExtent[x]);
+              }
+          }
+
           int x_start_b = pos.X();
           int w = poly.gridWidth(rast_i);
           for (int x = x_start_b; x <= x_start_b + w; ++x) {
               updateEvents(mBottomEvents, mBottomHorizon, x, mSize.X());
           }
+          for (int x = x_start_b; x < x_start_b + w; ++x)
+              mBottomTree.set(x, mBottomHorizon[x]);
+          updatePyramid(mBottomPyramid, mBottomHorizon, x_start_b, x_start_b + w);
 
 
           //update left horizon
@@ -725,11 +1272,41 @@ public:
               }
           }
 
+          if (!mRowOccupancy.empty()) {
+              for (int i = 0; i < poly.gridHeight(rast_i); i++) {
+                  int y = pos.Y() + i;
+                  mRowOccupancy.setSpan(y, pos.X() + left[i], deltaX[i]);
+                  mRowOccupancy.largestFreeRun(y, mLeftHorizon[y], mInnerLeftHorizon[y], mInnerLeftExtent[y]);
+              }
+          }
+
           int y_start_l = pos.Y();
           int h = poly.gridHeight(rast_i);
           for (int y = y_start_l; y <= y_start_l + h; ++y) {
               updateEvents(mLeftEvents, mLeftHorizon, y, mSize.Y());
           }
+          for (int y = y_start_l; y < y_start_l + h; ++y)
+              mLeftTree.set(y, mLeftHorizon[y]);
+          updatePyramid(mLeftPyramid, mLeftHorizon, y_start_l, y_start_l + h);
+      }
+
+      //recomputes the blocks of the pyramid that cover the cells [from, to) of the horizon
+      static void updatePyramid(std::vector<int> *pyr, const std::vector<int>& horizon, int from, int to) {
+          from = std::max(from, 0);
+          to = std::min(to, (int) horizon.size());
+          if (pyr[0].empty() || from >= to)
+              return;
+          const std::vector<int> *lower = &horizon;
+          for (int l = 0; l < 2; ++l) {
+              from /= PYRAMID_FACTOR;
+              to = (to - 1) / PYRAMID_FACTOR + 1;
+              for (int b = from; b < to; ++b) {
+                  int first = PYRAMID_FACTOR * b;
+                  int last = std::min(first + PYRAMID_FACTOR, (int) lower->size());
+                  pyr[l][b] = *std::max_element(lower->begin() + first, lower->begin() + last);
+              }
+              lower = &pyr[l];
+          }
       }
   };
 
@@ -869,10 +1446,14 @@ public:
                 if (tri::OutlineUtil<SCALAR_TYPE>::Outline2Area(polyPointsVec[perm[i]]) < thresholdArea)
                     break;
             int numPermutedObjects = std::max(minObjNum, int(i));
-            int permutationCount = numPermutedObjects * 5;
+            int permutationCount = (packingPar.permutationTrials > 0) ? packingPar.permutationTrials : numPermutedObjects * 5;
             //printf("PACKING: trying %d random permutations of the largest %d elements\n", permutationCount, numPermutedObjects);
+            std::mt19937 rng(packingPar.permutationSeed);
             for (int k = 0; k < permutationCount; ++k) {
-                std::random_shuffle(perm.begin(), perm.begin() + numPermutedObjects);
+                if (packingPar.permutationSeed != 0)
+                    std::shuffle(perm.begin(), perm.begin() + numPermutedObjects, rng);
+                else
+                    std::random_shuffle(perm.begin(), perm.begin() + numPermutedObjects);
                 trials.push_back(perm);
             }
         }
@@ -939,22 +1520,54 @@ public:
                           std::vector<int> &polyToContainer,
                           const Parameters &packingPar, float scaleFactor)
     {
-        std::vector<RasterizedOutline2> polyVec(outline2Vec.size());
-        for(size_t i=0;i<polyVec.size();i++) {
-            polyVec[i].setPoints(outline2Vec[i]);
+        std::vector<RasterizedOutline2> polyVec;
+        return PackBestEffortAtScale(outline2Vec, containerSizes, trVec, polyToContainer, packingPar, scaleFactor, polyVec);
+    }
+
+    /* Same as above, but the rasterized outlines are stored in polyVec, which can
+     * be passed again to subsequent calls with the same outlines (for example
+     * when retrying with different container sizes) to reuse the rasterizations
+     * computed at the same scale. If polyVec does not match the outlines it is
+     * reinitialized. If profile is not null the profile of the packing is stored
+     * there instead of the thread local LastProfile(). If fixedPlacements is not null
+     * (one per outline), the outlines with a fixed placement are placed first where
+     * it says, and the others are packed in the space left. A fixed placement that
+     * does not match a rasterization of the outline inside its container is ignored */
+    static int
+    PackBestEffortAtScale(std::vector<std::vector<Point2x>> &outline2Vec,
+                          const std::vector<Point2i> &containerSizes,
+                          std::vector<Similarity2x> &trVec,
+                          std::vector<int> &polyToContainer,
+                          const Parameters &packingPar, float scaleFactor,
+                          std::vector<RasterizedOutline2>& polyVec,
+                          ProfileData *profile = nullptr,
+                          const std::vector<FixedPlacement> *fixedPlacements = nullptr)
+    {
+        if (polyVec.size() != outline2Vec.size()) {
+            polyVec.clear();
+            polyVec.resize(outline2Vec.size());
+            for(size_t i=0;i<polyVec.size();i++) {
+                polyVec[i].setPoints(outline2Vec[i]);
+            }
         }
 
-        RasterizedOutline2Packer::ResetProfile();
+        ProfileData& prof = profile ? *profile : m_last_profile;
+        prof = ProfileData{};
 
         polyToContainer.resize(outline2Vec.size(), -1);
 
         std::vector<std::vector<int>> trials = InitializePermutationVectors(outline2Vec, packingPar);
+
+        int numThreads = (packingPar.permutationThreads > 0) ? packingPar.permutationThreads : omp_get_max_threads();
+        if (trials.size() > 1 && numThreads > 1)
+            return PackTrialsConcurrently(outline2Vec, containerSizes, trVec, polyToContainer, packingPar, scaleFactor, polyVec, trials, numThreads, prof, fixedPlacements);
+
         int bestNumPlaced = 0;
         double bestPackedArea = 0;
         for (std::size_t i = 0; i < trials.size(); ++i) {
             std::vector<Similarity2x> trVecIter;
             std::vector<int> polyToContainerIter;
-            PolyPacking(outline2Vec, containerSizes, trVecIter, polyToContainerIter, packingPar, scaleFactor, polyVec, trials[i], true);
+            PolyPacking(outline2Vec, containerSizes, trVecIter, polyToContainerIter, packingPar, scaleFactor, polyVec, trials[i], true, &prof, fixedPlacements);
             int numPlaced = 0;
             double packedArea = 0;
             for (std::size_t j = 0; j < polyToContainerIter.size(); ++j) {
@@ -975,6 +1588,64 @@ public:
         return bestNumPlaced;
     }
 
+    //runs the best effort packing trials of PackBestEffortAtScale() on numThreads threads.
+    //The polys are rasterized upfront, so that the trials only read polyVec, and the best
+    //trial is selected in the sequential order
+    static int PackTrialsConcurrently(std::vector<std::vector<Point2x>> &outline2Vec,
+                                      const std::vector<Point2i> &containerSizes,
+                                      std::vector<Similarity2x> &trVec,
+                                      std::vector<int> &polyToContainer,
+                                      const Parameters &packingPar, float scaleFactor,
+                                      std::vector<RasterizedOutline2>& polyVec,
+                                      std::vector<std::vector<int>>& trials,
+                                      int numThreads,
+                                      ProfileData& prof,
+                                      const std::vector<FixedPlacement> *fixedPlacements)
+    {
+        int rasterizeCalls = 0;
+        for (std::size_t i = 0; i < polyVec.size(); ++i)
+            rasterizeCalls += RasterizeRotations(polyVec[i], scaleFactor, packingPar, true);
+
+        // nothing left to rasterize in background
+        Parameters trialPar = packingPar;
+        trialPar.rasterizationLookAhead = 0;
+
+        int numTrials = trials.size();
+        std::vector<std::vector<Similarity2x>> trialTr(numTrials);
+        std::vector<std::vector<int>> trialPolyToContainer(numTrials);
+        std::vector<ProfileData> trialProf(numTrials);
+        std::vector<double> trialPackedArea(numTrials, 0);
+        std::vector<int> trialNumPlaced(numTrials, 0);
+
+        #pragma omp parallel for schedule(dynamic, 1) num_threads(std::min(numThreads, numTrials))
+        for (int i = 0; i < numTrials; ++i) {
+            PolyPacking(outline2Vec, containerSizes, trialTr[i], trialPolyToContainer[i], trialPar, scaleFactor, polyVec, trials[i], true, &trialProf[i], fixedPlacements);
+            for (std::size_t j = 0; j < trialPolyToContainer[i].size(); ++j) {
+                if (trialPolyToContainer[i][j] != -1) {
+                    trialPackedArea[i] += tri::OutlineUtil<SCALAR_TYPE>::Outline2Area(outline2Vec[j]);
+                    trialNumPlaced[i]++;
+                }
+            }
+        }
+
+        int best = -1;
+        for (int i = 0; i < numTrials; ++i)
+            if (trialPackedArea[i] > (best == -1 ? 0 : trialPackedArea[best]))
+                best = i;
+
+        if (best == -1) {
+            prof = trialProf.back();
+            prof.rasterize_calls += rasterizeCalls;
+            return 0;
+        }
+
+        trVec = trialTr[best];
+        polyToContainer = trialPolyToContainer[best];
+        prof = trialProf[best];
+        prof.rasterize_calls += rasterizeCalls;
+        return trialNumPlaced[best];
+    }
+
     //tries to pack polygons using the given gridSize and scaleFactor
     //stores the result, i.e. the vector of similarities, in trVec
     static bool PolyPacking(std::vector< std::vector< Point2x>  > &outline2Vec,
@@ -985,11 +1656,14 @@ public:
                             float scaleFactor,
                             std::vector<RasterizedOutline2>& polyVec,
                             const std::vector<int>& perm,
-                            bool bestEffort = false)
+                            bool bestEffort = false,
+                            ProfileData *profile = nullptr,
+                            const std::vector<FixedPlacement> *fixedPlacements = nullptr)
     {
-        RasterizedOutline2Packer::ResetProfile();
+        ProfileData& prof = profile ? *profile : m_last_profile;
+        prof = ProfileData{};
         auto total_start = std::chrono::high_resolution_clock::now();
-        m_last_profile.polys_considered = polyVec.size();
+        prof.polys_considered = polyVec.size();
 
         int containerNum = containerSizes.size();
 
@@ -1008,266 +1682,102 @@ public:
             packingFields.push_back(one);
         }
 
+        // rasterizations of the next charts running in background (returns the number of rasterize calls)
+        std::future<int> prefetch;
+
+        // the placement search specialized for the cost function and horizons in use
+        PlacementSearch findPlacement = SelectPlacementSearch(packingPar);
+
+        // the external evaluator mirrors the outer horizons only
+        RasterizedPlacementEvaluator *evaluator = packingPar.placementEvaluator;
+        if (evaluator && (packingPar.innerHorizon
+                          || !evaluator->begin(gridSizes, int(packingPar.costFunction), packingPar.doubleHorizon && packingPar.minmax)))
+            evaluator = nullptr;
+
+        // place the polys with a fixed placement first, the others are packed in the space left
+        std::vector<bool> placed(polyVec.size(), false);
+        if (fixedPlacements) {
+            for (size_t i = 0; i < polyVec.size(); ++i) {
+                const FixedPlacement& fixed = (*fixedPlacements)[i];
+                if (fixed.container < 0 || fixed.container >= containerNum)
+                    continue;
+                prof.rasterize_calls += RasterizeRotations(polyVec[i], scaleFactor, packingPar, true);
+                int rast_i;
+                Point2i pos;
+                if (FixedGridPosition(polyVec[i], fixed.tr, scaleFactor, packingPar, gridSizes[fixed.container], rast_i, pos)) {
+                    packingFields[fixed.container].placePoly(polyVec[i], pos, rast_i);
+                    if (evaluator)
+                        evaluator->place(polyVec[i], rast_i, fixed.container, pos);
+                    polyToContainer[i] = fixed.container;
+                    trVec[i] = fixed.tr;
+                    placed[i] = true;
+                    prof.placed_count++;
+                }
+            }
+        }
+
         // **** Main Loop: Iterate sequentially over polys, but find best position in parallel ****
         for (size_t currPoly = 0; currPoly < polyVec.size(); currPoly++) {
 
             int i = perm[currPoly];
+            if (placed[i])
+                continue;
 
-            m_last_profile.polys_considered++;
+            prof.polys_considered++;
 
             // +++ Step 1: Just-In-Time Rasterization (Memory Safe) +++
             auto rast_start = std::chrono::high_resolution_clock::now();
+            // Wait for the charts rasterized in background while the previous one was placed
+            if (prefetch.valid())
+                prof.rasterize_calls += prefetch.get();
             // Rasterize the multiple rotations for *only the current chart* in parallel.
-            polyVec[i].resetState(packingPar.rotationNum);
-            int num_base_rasterizations = (packingPar.rotationNum >= 4) ? packingPar.rotationNum/4 : packingPar.rotationNum;
-            //#pragma omp parallel for schedule(dynamic)
-            for (int rast_i = 0; rast_i < num_base_rasterizations; rast_i++) {
-                //create the rasterization (i.e. fills bottom/top/grids/internalWastedCells arrays)
-                RASTERIZER_TYPE::rasterize(polyVec[i], scaleFactor, rast_i, packingPar.rotationNum, packingPar.gutterWidth);
-                m_last_profile.rasterize_calls++;
+            // The rasterizations are kept if they were computed by a previous run at the same scale
+            prof.rasterize_calls += RasterizeRotations(polyVec[i], scaleFactor, packingPar, true);
+            // Then rasterize the next charts in background, concurrently with the placement of
+            // the current one. Only the charts that enter the look-ahead window need work
+            if (packingPar.rasterizationLookAhead > 0 && currPoly + 1 < polyVec.size()) {
+                size_t lookAheadEnd = std::min(polyVec.size(), currPoly + 1 + packingPar.rasterizationLookAhead);
+                prefetch = std::async(std::launch::async, [&polyVec, &perm, &packingPar, scaleFactor, currPoly, lookAheadEnd]() {
+                    int calls = 0;
+                    for (size_t k = currPoly + 1; k < lookAheadEnd; ++k)
+                        calls += RasterizeRotations(polyVec[perm[k]], scaleFactor, packingPar, false);
+                    return calls;
+                });
             }
             auto rast_end = std::chrono::high_resolution_clock::now();
-            m_last_profile.rasterize_s += std::chrono::duration<double>(rast_end - rast_start).count();
+            prof.rasterize_s += std::chrono::duration<double>(rast_end - rast_start).count();
 
             // +++ Step 2: Parallel Placement Search +++
-            PlacementResult bestOverallResult;
-
-            for (int rast_i = 0; rast_i < packingPar.rotationNum; rast_i++) {
-                if (!polyVec[i].hasGrid(rast_i) || polyVec[i].gridWidth(rast_i) <= 0) continue;
-
-                //try to fit the poly in all containers, in all valid positions
-                for (int grid_i = 0; grid_i < containerNum; grid_i++) {
-                    int maxCol = gridSizes[grid_i].X() - polyVec[i].gridWidth(rast_i);
-                    int maxRow = gridSizes[grid_i].Y() - polyVec[i].gridHeight(rast_i);
-
-                    const int PARALLEL_THRESHOLD = 512;
-
-                    // --- Search by dropping from top ---
-                    if (maxCol >= 0) {
-                        PlacementResult bestResultForDropY;
-                        auto candY_start = std::chrono::high_resolution_clock::now();
-                        auto evaluate_drop_y = [&](int col, PlacementResult& bestResult) {
-                            int currPolyY;
-                            // Check primary horizon
-                            currPolyY = packingFields[grid_i].dropY(polyVec[i],col, rast_i);
-                            if (currPolyY != INVALID_POSITION) {
-                                int currCost = packingFields[grid_i].getCostY(polyVec[i], Point2i(col, currPolyY), rast_i);
-                                if (packingPar.doubleHorizon && (packingPar.minmax == true))
-                                    currCost += packingFields[grid_i].getCostX(polyVec[i], Point2i(col, currPolyY), rast_i);
-                                if (currCost < bestResult.cost) {
-                                    bestResult.container = grid_i; bestResult.cost = currCost;
-                                    bestResult.rastIndex = rast_i; bestResult.polyX = col;
-                                    bestResult.polyY = currPolyY; bestResult.placedUsingSecondaryHorizon = false;
-                                }
-                            }
-                            // Check inner horizon
-                            if (packingPar.innerHorizon) {
-                                currPolyY = packingFields[grid_i].dropYInner(polyVec[i],col, rast_i);
-                                if (currPolyY != INVALID_POSITION) {
-                                    int currCost = packingFields[grid_i].getCostY(polyVec[i], Point2i(col, currPolyY), rast_i);
-                                    if (packingPar.doubleHorizon && (packingPar.minmax == true))
-                                        currCost += packingFields[grid_i].getCostX(polyVec[i], Point2i(col, currPolyY), rast_i);
-                                    if (currCost < bestResult.cost) {
-                                        bestResult.container = grid_i; bestResult.cost = currCost;
-                                        bestResult.rastIndex = rast_i; bestResult.polyX = col;
-                                        bestResult.polyY = currPolyY; bestResult.placedUsingSecondaryHorizon = true;
-                                    }
-                                }
-                            }
-                        };
-
-                        std::set<int> candidateColsSet;
-                        candidateColsSet.insert(0);
-                        if (maxCol >= 0) candidateColsSet.insert(maxCol);
-
-                        const auto& events = packingFields[grid_i].bottomEvents();
-                        int poly_w = polyVec[i].gridWidth(rast_i);
-                        for (int e : events) {
-                            candidateColsSet.insert(e);
-                            candidateColsSet.insert(e - 1);
-                            candidateColsSet.insert(e + 1);
-                            candidateColsSet.insert(e - poly_w);
-                            candidateColsSet.insert(e - poly_w + 1);
-                            candidateColsSet.insert(e - poly_w - 1);
-                        }
-
-                        if ((int)candidateColsSet.size() < 32 && maxCol > 0) {
-                             int step = std::max(1, maxCol / 32);
-                             for (int col = 0; col <= maxCol; col += step) {
-                                candidateColsSet.insert(col);
-                            }
-                        }
-
-                        std::vector<int> candidateCols;
-                        candidateCols.reserve(candidateColsSet.size());
-                        for (int col : candidateColsSet) {
-                            if (col >= 0 && col <= maxCol) {
-                                candidateCols.push_back(col);
-                            }
-                        }
-
-                        auto candY_end = std::chrono::high_resolution_clock::now();
-                        m_last_profile.candidateY_build_s += std::chrono::duration<double>(candY_end - candY_start).count();
-
-                        auto evalY_start = std::chrono::high_resolution_clock::now();
-                        m_last_profile.candidateY_cols_evaluated += candidateCols.size();
-
-                        if ((int)candidateCols.size() > PARALLEL_THRESHOLD) {
-                            #pragma omp parallel
-                            {
-                                PlacementResult bestThreadResult;
-                                #pragma omp for schedule(dynamic, 64)
-                                for (size_t k = 0; k < candidateCols.size(); ++k) {
-                                    evaluate_drop_y(candidateCols[k], bestThreadResult);
-                                }
-                                #pragma omp critical
-                                {
-                                    if(bestThreadResult.cost < bestResultForDropY.cost) {
-                                        bestResultForDropY = bestThreadResult;
-                                    }
-                                }
-                            }
-                        } else {
-                            for (int col : candidateCols) {
-                                evaluate_drop_y(col, bestResultForDropY);
-                            }
-                        }
-                        auto evalY_end = std::chrono::high_resolution_clock::now();
-                        m_last_profile.evaluate_drop_y_s += std::chrono::duration<double>(evalY_end - evalY_start).count();
-
-                        if (bestResultForDropY.cost < bestOverallResult.cost) {
-                            bestOverallResult = bestResultForDropY;
-                        }
-                    }
-
-                    if (!packingPar.doubleHorizon)
-                        continue;
-                    
-                    // --- Search by dropping from left ---
-                    if (maxRow >= 0) {
-                        PlacementResult bestResultForDropX;
-                        auto candX_start = std::chrono::high_resolution_clock::now();
-                        auto evaluate_drop_x = [&](int row, PlacementResult& bestResult) {
-                            int currPolyX;
-                            // Check primary horizon
-                            currPolyX = packingFields[grid_i].dropX(polyVec[i],row, rast_i);
-                            if (currPolyX != INVALID_POSITION) {
-                                int currCost = packingFields[grid_i].getCostX(polyVec[i], Point2i(currPolyX, row), rast_i);
-                                if (packingPar.doubleHorizon && (packingPar.minmax == true))
-                                    currCost += packingFields[grid_i].getCostY(polyVec[i], Point2i(currPolyX, row), rast_i);
-                                if (currCost < bestResult.cost) {
-                                    bestResult.container = grid_i; bestResult.cost = currCost;
-                                    bestResult.rastIndex = rast_i; bestResult.polyX = currPolyX;
-                                    bestResult.polyY = row; bestResult.placedUsingSecondaryHorizon = false;
-                                }
-                            }
-                            // Check inner horizon
-                            if (packingPar.innerHorizon) {
-                                currPolyX = packingFields[grid_i].dropXInner(polyVec[i],row, rast_i);
-                                if (currPolyX != INVALID_POSITION) {
-                                    int currCost = packingFields[grid_i].getCostX(polyVec[i], Point2i(currPolyX, row), rast_i);
-                                    if (packingPar.doubleHorizon && (packingPar.minmax == true))
-                                        currCost += packingFields[grid_i].getCostY(polyVec[i], Point2i(currPolyX, row), rast_i);
-                                    if (currCost < bestResult.cost) {
-                                        bestResult.container = grid_i; bestResult.cost = currCost;
-                                        bestResult.rastIndex = rast_i; bestResult.polyX = currPolyX;
-                                        bestResult.polyY = row; bestResult.placedUsingSecondaryHorizon = true;
-                                    }
-                                }
-                            }
-                        };
-
-                        std::set<int> candidateRowsSet;
-                        candidateRowsSet.insert(0);
-                        if (maxRow >= 0) candidateRowsSet.insert(maxRow);
-
-                        const auto& events = packingFields[grid_i].leftEvents();
-                        int poly_h = polyVec[i].gridHeight(rast_i);
-                        for (int e : events) {
-                            candidateRowsSet.insert(e);
-                            candidateRowsSet.insert(e - 1);
-                            candidateRowsSet.insert(e + 1);
-                            candidateRowsSet.insert(e - poly_h);
-                            candidateRowsSet.insert(e - poly_h + 1);
-                            candidateRowsSet.insert(e - poly_h - 1);
-                        }
-
-                        if ((int)candidateRowsSet.size() < 32 && maxRow > 0) {
-                             int step = std::max(1, maxRow / 32);
-                             for (int row = 0; row <= maxRow; row += step) {
-                                candidateRowsSet.insert(row);
-                            }
-                        }
-
-                        std::vector<int> candidateRows;
-                        candidateRows.reserve(candidateRowsSet.size());
-                        for (int row : candidateRowsSet) {
-                            if (row >= 0 && row <= maxRow) {
-                                candidateRows.push_back(row);
-                            }
-                        }
-
-                        auto candX_end = std::chrono::high_resolution_clock::now();
-                        m_last_profile.candidateX_build_s += std::chrono::duration<double>(candX_end - candX_start).count();
-
-                        auto evalX_start = std::chrono::high_resolution_clock::now();
-                        m_last_profile.candidateX_rows_evaluated += candidateRows.size();
-
-                        if ((int)candidateRows.size() > PARALLEL_THRESHOLD) {
-                            #pragma omp parallel
-                            {
-                                PlacementResult bestThreadResult;
-                                #pragma omp for schedule(dynamic, 64)
-                                for (size_t k = 0; k < candidateRows.size(); ++k) {
-                                    evaluate_drop_x(candidateRows[k], bestThreadResult);
-                                }
-                                #pragma omp critical
-                                {
-                                    if(bestThreadResult.cost < bestResultForDropX.cost) {
-                                        bestResultForDropX = bestThreadResult;
-                                    }
-                                }
-                            }
-                        } else {
-                            for (int row : candidateRows) {
-                                evaluate_drop_x(row, bestResultForDropX);
-                            }
-                        }
-                        auto evalX_end = std::chrono::high_resolution_clock::now();
-                        m_last_profile.evaluate_drop_x_s += std::chrono::duration<double>(evalX_end - evalX_start).count();
-
-                        if (bestResultForDropX.cost < bestOverallResult.cost) {
-                            bestOverallResult = bestResultForDropX;
-                        }
-                    }
-                }
-            }
-
+            PlacementResult bestOverallResult = findPlacement(packingFields, gridSizes, polyVec[i], packingPar, prof, evaluator);
 
             // +++ Step 3: Sequential State Update +++
             if (bestOverallResult.rastIndex == -1) {
-                m_last_profile.not_placed_count++;
+                prof.not_placed_count++;
                 if (bestEffort) {
                     polyToContainer[i] = -1;
                     trVec[i] = {};
                 } else {
+                    if (prefetch.valid())
+                        prefetch.wait();
                     auto total_end = std::chrono::high_resolution_clock::now();
-                    m_last_profile.total_s = std::chrono::duration<double>(total_end - total_start).count();
+                    prof.total_s = std::chrono::duration<double>(total_end - total_start).count();
                     return false;
                 }
             } else {
-                m_last_profile.placed_count++;
+                prof.placed_count++;
                 // Place the polygon, which updates the horizons in the 'packingFields' object.
                 auto place_start = std::chrono::high_resolution_clock::now();
                 packingFields[bestOverallResult.container].placePoly(polyVec[i], Point2i(bestOverallResult.polyX, bestOverallResult.polyY), bestOverallResult.rastIndex);
+                if (evaluator)
+                    evaluator->place(polyVec[i], bestOverallResult.rastIndex, bestOverallResult.container, Point2i(bestOverallResult.polyX, bestOverallResult.polyY));
                 auto place_end = std::chrono::high_resolution_clock::now();
-                m_last_profile.place_s += std::chrono::duration<double>(place_end - place_start).count();
+                prof.place_s += std::chrono::duration<double>(place_end - place_start).count();
 
                 // Create the final similarity transform for this chart.
                 auto trans_start = std::chrono::high_resolution_clock::now();
                 float angleRad = float(bestOverallResult.rastIndex)*(M_PI*2.0)/float(packingPar.rotationNum);
                 Box2f bb;
-                std::vector<Point2f> points = polyVec[i].getPoints();
+                const std::vector<Point2f>& points = polyVec[i].getPointsConst();
                 for(size_t p_idx=0; p_idx<points.size(); ++p_idx) {
                     Point2f pp=points[p_idx];
                     pp.Rotate(angleRad);
@@ -1294,22 +1804,380 @@ public:
                 trVec[i].rotRad = angleRad;
                 trVec[i].sca = scaleFactor;
                 auto trans_end = std::chrono::high_resolution_clock::now();
-                m_last_profile.transform_s += std::chrono::duration<double>(trans_end - trans_start).count();
+                prof.transform_s += std::chrono::duration<double>(trans_end - trans_start).count();
             }
         }
 
         auto total_end = std::chrono::high_resolution_clock::now();
-        m_last_profile.total_s = std::chrono::duration<double>(total_end - total_start).count();
+        prof.total_s = std::chrono::duration<double>(total_end - total_start).count();
         return true;
     }
 
 private:
-    static ProfileData m_last_profile;
+
+    using CostFuncEnum = typename Parameters::CostFuncEnum;
+
+    //a chunk of the candidate positions of a rasterization in a container, dropped
+    //from the top (along the columns) or from the left (along the rows)
+    struct PlacementTask {
+        int rast_i;
+        int grid_i;
+        bool fromLeft;
+        int candidates; // index of the candidates list
+        int first;
+        int last;
+    };
+
+    //the search of the best placement of a poly, for the cost function and horizon modes
+    //given as template arguments (MINMAX is true if the costs of both the horizons are
+    //combined, that is doubleHorizon and minmax are both set).
+    //The candidate positions of all the rotations and containers are split in tasks that
+    //are evaluated in a single parallel region. Each thread keeps the best placement of
+    //the tasks it runs (in increasing order), and the ties between the threads go to the
+    //earliest task, so the result is the same as evaluating the candidates sequentially.
+    //If the evaluator is not null the candidates are passed to it in the same order
+    template <CostFuncEnum COST, bool DOUBLE_HORIZON, bool INNER_HORIZON, bool MINMAX>
+    static PlacementResult FindBestPlacement(std::vector<packingfield>& packingFields,
+                                             const std::vector<Point2i>& gridSizes,
+                                             RasterizedOutline2& poly,
+                                             const Parameters& packingPar,
+                                             ProfileData& prof,
+                                             RasterizedPlacementEvaluator *evaluator)
+    {
+        const int PARALLEL_THRESHOLD = 512;
+        const int TASK_CANDIDATES = 64;
+
+        int containerNum = packingFields.size();
+
+        std::vector<std::vector<int>> candidateLists;
+        std::vector<PlacementTask> tasks;
+        int64_t numCandidatesY = 0;
+        int64_t numCandidatesX = 0;
+
+        auto addTasks = [&](int rast_i, int grid_i, bool fromLeft, std::vector<int>& candidates) {
+            int list_i = candidateLists.size();
+            for (int first = 0; first < (int) candidates.size(); first += TASK_CANDIDATES)
+                tasks.push_back({rast_i, grid_i, fromLeft, list_i, first, std::min<int>(first + TASK_CANDIDATES, candidates.size())});
+            candidateLists.push_back(std::move(candidates));
+        };
+
+        for (int rast_i = 0; rast_i < packingPar.rotationNum; rast_i++) {
+            if (!poly.hasGrid(rast_i) || poly.gridWidth(rast_i) <= 0) continue;
+
+            //try to fit the poly in all containers, in all valid positions
+            for (int grid_i = 0; grid_i < containerNum; grid_i++) {
+                int maxCol = gridSizes[grid_i].X() - poly.gridWidth(rast_i);
+                int maxRow = gridSizes[grid_i].Y() - poly.gridHeight(rast_i);
+
+                // --- Candidates for dropping from top ---
+                if (maxCol >= 0) {
+                    auto candY_start = std::chrono::high_resolution_clock::now();
+                    std::set<int> candidateColsSet;
+                    candidateColsSet.insert(0);
+                    if (maxCol >= 0) candidateColsSet.insert(maxCol);
+
+                    const auto& events = packingFields[grid_i].bottomEvents();
+                    int poly_w = poly.gridWidth(rast_i);
+                    for (int e : events) {
+                        candidateColsSet.insert(e);
+                        candidateColsSet.insert(e - 1);
+                        candidateColsSet.insert(e + 1);
+                        candidateColsSet.insert(e - poly_w);
+                        candidateColsSet.insert(e - poly_w + 1);
+                        candidateColsSet.insert(e - poly_w - 1);
+                    }
+
+                    if ((int)candidateColsSet.size() < 32 && maxCol > 0) {
+                         int step = std::max(1, maxCol / 32);
+                         for (int col = 0; col <= maxCol; col += step) {
+                            candidateColsSet.insert(col);
+                        }
+                    }
+
+                    std::vector<int> candidateCols;
+                    candidateCols.reserve(candidateColsSet.size());
+                    for (int col : candidateColsSet) {
+                        if (col >= 0 && col <= maxCol) {
+                            candidateCols.push_back(col);
+                        }
+                    }
+                    candidateCols = packingFields[grid_i].hierarchicalCandidates(poly, rast_i, true, candidateCols, maxCol);
+                    numCandidatesY += candidateCols.size();
+                    addTasks(rast_i, grid_i, false, candidateCols);
+
+                    auto candY_end = std::chrono::high_resolution_clock::now();
+                    prof.candidateY_build_s += std::chrono::duration<double>(candY_end - candY_start).count();
+                }
+
+                if (!DOUBLE_HORIZON)
+                    continue;
+
+                // --- Candidates for dropping from left ---
+                if (maxRow >= 0) {
+                    auto candX_start = std::chrono::high_resolution_clock::now();
+                    std::set<int> candidateRowsSet;
+                    candidateRowsSet.insert(0);
+                    if (maxRow >= 0) candidateRowsSet.insert(maxRow);
+
+                    const auto& events = packingFields[grid_i].leftEvents();
+                    int poly_h = poly.gridHeight(rast_i);
+                    for (int e : events) {
+                        candidateRowsSet.insert(e);
+                        candidateRowsSet.insert(e - 1);
+                        candidateRowsSet.insert(e + 1);
+                        candidateRowsSet.insert(e - poly_h);
+                        candidateRowsSet.insert(e - poly_h + 1);
+                        candidateRowsSet.insert(e - poly_h - 1);
+                    }
+
+                    if ((int)candidateRowsSet.size() < 32 && maxRow > 0) {
+                         int step = std::max(1, maxRow / 32);
+                         for (int row = 0; row <= maxRow; row += step) {
+                            candidateRowsSet.insert(row);
+                        }
+                    }
+
+                    std::vector<int> candidateRows;
+                    candidateRows.reserve(candidateRowsSet.size());
+                    for (int row : candidateRowsSet) {
+                        if (row >= 0 && row <= maxRow) {
+                            candidateRows.push_back(row);
+                        }
+                    }
+                    candidateRows = packingFields[grid_i].hierarchicalCandidates(poly, rast_i, false, candidateRows, maxRow);
+                    numCandidatesX += candidateRows.size();
+                    addTasks(rast_i, grid_i, true, candidateRows);
+
+                    auto candX_end = std::chrono::high_resolution_clock::now();
+                    prof.candidateX_build_s += std::chrono::duration<double>(candX_end - candX_start).count();
+                }
+            }
+        }
+
+        prof.candidateY_cols_evaluated += numCandidatesY;
+        prof.candidateX_rows_evaluated += numCandidatesX;
+
+        auto evaluate_drop_y = [&](int grid_i, int rast_i, int col, PlacementResult& bestResult) {
+            int currPolyY;
+            // Check primary horizon
+            currPolyY = packingFields[grid_i].dropY(poly,col, rast_i);
+            if (currPolyY != INVALID_POSITION) {
+                int currCost = packingFields[grid_i].template costYAtDrop<COST>(poly, Point2i(col, currPolyY), rast_i);
+                if (MINMAX)
+                    currCost += packingFields[grid_i].template costX<COST>(poly, Point2i(col, currPolyY), rast_i);
+                if (currCost < bestResult.cost) {
+                    bestResult.container = grid_i; bestResult.cost = currCost;
+                    bestResult.rastIndex = rast_i; bestResult.polyX = col;
+                    bestResult.polyY = currPolyY; bestResult.placedUsingSecondaryHorizon = false;
+                }
+            }
+            // Check inner horizon
+            if (INNER_HORIZON) {
+                currPolyY = packingFields[grid_i].dropYInner(poly,col, rast_i);
+                if (currPolyY != INVALID_POSITION) {
+                    int currCost = packingFields[grid_i].template costY<COST>(poly, Point2i(col, currPolyY), rast_i);
+                    if (MINMAX)
+                        currCost += packingFields[grid_i].template costX<COST>(poly, Point2i(col, currPolyY), rast_i);
+                    if (currCost < bestResult.cost) {
+                        bestResult.container = grid_i; bestResult.cost = currCost;
+                        bestResult.rastIndex = rast_i; bestResult.polyX = col;
+                        bestResult.polyY = currPolyY; bestResult.placedUsingSecondaryHorizon = true;
+                    }
+                }
+            }
+        };
+
+        auto evaluate_drop_x = [&](int grid_i, int rast_i, int row, PlacementResult& bestResult) {
+            int currPolyX;
+            // Check primary horizon
+            currPolyX = packingFields[grid_i].dropX(poly,row, rast_i);
+            if (currPolyX != INVALID_POSITION) {
+                int currCost = packingFields[grid_i].template costXAtDrop<COST>(poly, Point2i(currPolyX, row), rast_i);
+                if (MINMAX)
+                    currCost += packingFields[grid_i].template costY<COST>(poly, Point2i(currPolyX, row), rast_i);
+                if (currCost < bestResult.cost) {
+                    bestResult.container = grid_i; bestResult.cost = currCost;
+                    bestResult.rastIndex = rast_i; bestResult.polyX = currPolyX;
+                    bestResult.polyY = row; bestResult.placedUsingSecondaryHorizon = false;
+                }
+            }
+            // Check inner horizon
+            if (INNER_HORIZON) {
+                currPolyX = packingFields[grid_i].dropXInner(poly,row, rast_i);
+                if (currPolyX != INVALID_POSITION) {
+                    int currCost = packingFields[grid_i].template costX<COST>(poly, Point2i(currPolyX, row), rast_i);
+                    if (MINMAX)
+                        currCost += packingFields[grid_i].template costY<COST>(poly, Point2i(currPolyX, row), rast_i);
+                    if (currCost < bestResult.cost) {
+                        bestResult.container = grid_i; bestResult.cost = currCost;
+                        bestResult.rastIndex = rast_i; bestResult.polyX = currPolyX;
+                        bestResult.polyY = row; bestResult.placedUsingSecondaryHorizon = true;
+                    }
+                }
+            }
+        };
+
+        auto eval_start = std::chrono::high_resolution_clock::now();
+
+        // the evaluation time is split between the directions by the number of candidates
+        auto addEvaluationTime = [&]() {
+            auto eval_end = std::chrono::high_resolution_clock::now();
+            double eval_s = std::chrono::duration<double>(eval_end - eval_start).count();
+            if (numCandidatesY + numCandidatesX > 0) {
+                double fractionY = double(numCandidatesY) / double(numCandidatesY + numCandidatesX);
+                prof.evaluate_drop_y_s += eval_s * fractionY;
+                prof.evaluate_drop_x_s += eval_s * (1 - fractionY);
+            }
+        };
+
+        if (evaluator && !INNER_HORIZON && !tasks.empty()) {
+            std::vector<RasterizedPlacementEvaluator::Candidate> flat;
+            flat.reserve(numCandidatesY + numCandidatesX);
+            for (const PlacementTask& task : tasks)
+                for (int k = task.first; k < task.last; ++k)
+                    flat.push_back({task.rast_i, task.grid_i, int(task.fromLeft), candidateLists[task.candidates][k]});
+            int best;
+            Point2i pos;
+            int cost;
+            if (evaluator->evaluate(poly, packingPar.rotationNum, flat, best, pos, cost)) {
+                PlacementResult result;
+                if (best >= 0) {
+                    result.cost = cost;
+                    result.rastIndex = flat[best].rast;
+                    result.container = flat[best].container;
+                    result.polyX = pos.X();
+                    result.polyY = pos.Y();
+                }
+                prof.gpu_evaluations++;
+                addEvaluationTime();
+                return result;
+            }
+        }
+
+        int numTasks = tasks.size();
+        int numThreads = (numCandidatesY + numCandidatesX > PARALLEL_THRESHOLD) ? std::min(omp_get_max_threads(), numTasks) : 1;
+        std::vector<PlacementResult> threadBest(std::max(numThreads, 1));
+        std::vector<int> threadBestTask(threadBest.size(), numTasks);
+
+        #pragma omp parallel for schedule(dynamic, 1) num_threads(numThreads) if (numThreads > 1)
+        for (int t = 0; t < numTasks; ++t) {
+            const PlacementTask& task = tasks[t];
+            const std::vector<int>& candidates = candidateLists[task.candidates];
+            PlacementResult taskBest;
+            for (int k = task.first; k < task.last; ++k) {
+                if (task.fromLeft)
+                    evaluate_drop_x(task.grid_i, task.rast_i, candidates[k], taskBest);
+                else
+                    evaluate_drop_y(task.grid_i, task.rast_i, candidates[k], taskBest);
+            }
+            int thread_i = omp_get_thread_num();
+            if (taskBest.cost < threadBest[thread_i].cost) {
+                threadBest[thread_i] = taskBest;
+                threadBestTask[thread_i] = t;
+            }
+        }
+
+        PlacementResult bestOverallResult;
+        int bestTask = numTasks;
+        for (std::size_t k = 0; k < threadBest.size(); ++k) {
+            if (threadBest[k].cost < bestOverallResult.cost
+                    || (threadBest[k].cost == bestOverallResult.cost && threadBestTask[k] < bestTask)) {
+                bestOverallResult = threadBest[k];
+                bestTask = threadBestTask[k];
+            }
+        }
+
+        addEvaluationTime();
+
+        return bestOverallResult;
+    }
+
+    typedef PlacementResult (*PlacementSearch)(std::vector<packingfield>&, const std::vector<Point2i>&,
+                                               RasterizedOutline2&, const Parameters&, ProfileData&,
+                                               RasterizedPlacementEvaluator *);
+
+    template <CostFuncEnum COST>
+    static PlacementSearch SelectPlacementSearch(const Parameters& packingPar)
+    {
+        if (!packingPar.doubleHorizon)
+            return packingPar.innerHorizon ? &FindBestPlacement<COST, false, true, false> : &FindBestPlacement<COST, false, false, false>;
+        if (packingPar.minmax)
+            return packingPar.innerHorizon ? &FindBestPlacement<COST, true, true, true> : &FindBestPlacement<COST, true, false, true>;
+        return packingPar.innerHorizon ? &FindBestPlacement<COST, true, true, false> : &FindBestPlacement<COST, true, false, false>;
+    }
+
+    static PlacementSearch SelectPlacementSearch(const Parameters& packingPar)
+    {
+        switch (packingPar.costFunction) {
+        case CostFuncEnum::MinWastedSpace: return SelectPlacementSearch<CostFuncEnum::MinWastedSpace>(packingPar);
+        case CostFuncEnum::MixedCost: return SelectPlacementSearch<CostFuncEnum::MixedCost>(packingPar);
+        case CostFuncEnum::LowestHorizon: break;
+        }
+        return SelectPlacementSearch<CostFuncEnum::LowestHorizon>(packingPar);
+    }
+
+public:
+
+    //recovers the rasterization and the grid position of a poly placed with the transformation
+    //tr at the given scale, inverting the transformation computed by PolyPacking(). Returns
+    //false if the rotation or the scale of tr do not match a rasterization of the poly, or
+    //if the poly does not lie inside the grid
+    static bool FixedGridPosition(RasterizedOutline2& poly, const Similarity2x& tr, float scaleFactor,
+                                  const Parameters& packingPar, Point2i gridSize, int& rast_i, Point2i& pos)
+    {
+        float rotation = tr.rotRad * float(packingPar.rotationNum) / float(M_PI*2.0);
+        rast_i = int(std::round(rotation));
+        if (std::abs(rotation - rast_i) > 1e-3f || rast_i < 0 || rast_i >= packingPar.rotationNum)
+            return false;
+        if (!poly.hasGrid(rast_i) || poly.gridWidth(rast_i) <= 0)
+            return false;
+        if (std::abs(tr.sca - scaleFactor) > 1e-5f * scaleFactor)
+            return false;
+
+        float angleRad = float(rast_i)*(M_PI*2.0)/float(packingPar.rotationNum);
+        Box2f bb;
+        for (Point2f pp : poly.getPointsConst()) {
+            pp.Rotate(angleRad);
+            bb.Add(pp);
+        }
+
+        float offsetX = (poly.gridWidth(rast_i) - ceil(bb.DimX()*scaleFactor))/2.0;
+        float offsetY = (poly.gridHeight(rast_i) - ceil(bb.DimY()*scaleFactor))/2.0;
+        float polyX = tr.tra.X() + bb.min.X()*scaleFactor - offsetX;
+        float topPolyY = gridSize.Y() - tr.tra.Y() - bb.min.Y()*scaleFactor + offsetY;
+        pos = Point2i(int(std::round(polyX)), int(std::round(topPolyY)) - poly.gridHeight(rast_i));
+
+        return pos.X() >= 0 && pos.X() + poly.gridWidth(rast_i) <= gridSize.X()
+                && pos.Y() >= 0 && pos.Y() + poly.gridHeight(rast_i) <= gridSize.Y();
+    }
+
+    //computes the rasterizations of the poly for all the rotations, unless they are already
+    //available at the given scale. The base rasterizations are independent (each one only
+    //writes its own rotations) and are computed in parallel if parallel is true.
+    //Returns the number of rasterize calls
+    static int RasterizeRotations(RasterizedOutline2& poly, float scaleFactor, const Parameters& packingPar, bool parallel)
+    {
+        if (poly.isRasterized(scaleFactor, packingPar.rotationNum, packingPar.gutterWidth))
+            return 0;
+        poly.resetState(packingPar.rotationNum);
+        int num_base_rasterizations = (packingPar.rotationNum >= 4) ? packingPar.rotationNum/4 : packingPar.rotationNum;
+        #pragma omp parallel for schedule(dynamic) if (parallel && num_base_rasterizations > 1)
+        for (int rast_i = 0; rast_i < num_base_rasterizations; rast_i++) {
+            //create the rasterization (i.e. fills bottom/top/grids/internalWastedCells arrays)
+            RASTERIZER_TYPE::rasterize(poly, scaleFactor, rast_i, packingPar.rotationNum, packingPar.gutterWidth);
+        }
+        poly.setRasterized(scaleFactor, packingPar.rotationNum, packingPar.gutterWidth);
+        return num_base_rasterizations;
+    }
+
+private:
+    // per-thread, so that independent packing runs can execute concurrently
+    static thread_local ProfileData m_last_profile;
 
 }; // end class
 
-template<class S, class R>
-typename RasterizedOutline2Packer<S,R>::ProfileData RasterizedOutline2Packer<S,R>::m_last_profile;
+template<class S, class R, class A>
+thread_local typename RasterizedOutline2Packer<S,R,A>::ProfileData RasterizedOutline2Packer<S,R,A>::m_last_profile;
 
 
 } // end namespace vcg
@@ -10,6 +10,15 @@
 #include <cmath>
 #include <memory>
 #include <chrono>
+#include <atomic>
+#include <algorithm>
+#include <limits>
+
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QDateTime>
 
 using namespace vcg;
 using namespace std;
@@ -46,22 +55,166 @@ struct CacheKeyHash {
     }
 };
 
+// Bit-packed rasterization canvas, rows are contiguous and padded to 64-bit words
+struct PackedGrid {
+    int w = 0;
+    int h = 0;
+    int wordsPerRow = 0;
+    vector<uint64_t> bits;
+
+    PackedGrid(int width, int height)
+        : w(width), h(height), wordsPerRow((width + 63) / 64), bits((size_t)wordsPerRow * height, 0) {}
+
+    bool empty() const { return w == 0 || h == 0; }
+
+    bool cell(int row, int col) const {
+        return (bits[(size_t)row * wordsPerRow + (col >> 6)] >> (col & 63)) & 1ULL;
+    }
+
+    void set(int row, int col) {
+        bits[(size_t)row * wordsPerRow + (col >> 6)] |= (1ULL << (col & 63));
+    }
+
+    // sets the cells [col0, col1) of the row
+    void setRun(int row, int col0, int col1) {
+        uint64_t *w = bits.data() + (size_t)row * wordsPerRow;
+        for (int col = col0; col < col1; ) {
+            int bit = col & 63;
+            int n = std::min(64 - bit, col1 - col);
+            uint64_t mask = (n == 64) ? ~0ULL : (((1ULL << n) - 1) << bit);
+            w[col >> 6] |= mask;
+            col += n;
+        }
+    }
+
+    // returns the first column >= col of the row whose cell is set (or clear), or w
+    int next(int row, int col, bool set) const {
+        if (col >= w)
+            return w;
+        const uint64_t *words = bits.data() + (size_t)row * wordsPerRow;
+        int k = col >> 6;
+        uint64_t word = (set ? words[k] : ~words[k]) & (~0ULL << (col & 63));
+        while (word == 0) {
+            if (++k >= wordsPerRow)
+                return w;
+            word = set ? words[k] : ~words[k];
+        }
+        return std::min(w, 64 * k + countTrailingZeros(word));
+    }
+
+    static int countTrailingZeros(uint64_t v) {
+#if defined(_MSC_VER)
+        unsigned long i;
+        _BitScanForward64(&i, v);
+        return int(i);
+#else
+        return __builtin_ctzll(v);
+#endif
+    }
+};
+
+// Rasterization grid stored as the runs of covered cells of each row (the outlines are
+// simple polygons, so a row has typically 1-3 runs whatever its width), with the first
+// and last covered rows of each column. The extents of the rows and columns are all the
+// packer reads of a rasterization. Grids are immutable once built and shared by the
+// cache and the callers, so a cache hit does not copy any cell.
+struct SpanGrid {
+    int w = 0;
+    int h = 0;
+    vector<uint32_t> rowStart;  // h+1 offsets in spans of the runs of each row
+    vector<int32_t> spans;      // [begin, end) columns of the runs
+    vector<int> colTop;         // first and last covered rows of each column, -1 if empty
+    vector<int> colBottom;
+
+    SpanGrid(int width, int height) : w(width), h(height), rowStart(height + 1, 0) {}
+
+    bool empty() const { return w == 0 || h == 0; }
+
+    int rowLeft(int row) const { return rowStart[row] < rowStart[row + 1] ? spans[rowStart[row]] : -1; }
+    int rowRight(int row) const { return rowStart[row] < rowStart[row + 1] ? spans[rowStart[row + 1] - 1] - 1 : -1; }
+
+    // computes colTop and colBottom from the runs
+    void computeColumnExtents() {
+        colTop.assign(w, -1);
+        colBottom.assign(w, -1);
+        for (int row = 0; row < h; ++row) {
+            for (uint32_t k = rowStart[row]; k < rowStart[row + 1]; k += 2) {
+                for (int col = spans[k]; col < spans[k + 1]; ++col) {
+                    if (colTop[col] < 0)
+                        colTop[col] = row;
+                    colBottom[col] = row;
+                }
+            }
+        }
+    }
+
+    size_t bytes() const {
+        return rowStart.size() * sizeof(uint32_t) + spans.size() * sizeof(int32_t) + (colTop.size() + colBottom.size()) * sizeof(int);
+    }
+};
+
+typedef shared_ptr<const SpanGrid> SpanGridPtr;
+
 struct CacheValue {
     // Base rasterization grid for (points, base orientation, scale, gutter).
-    // We generate 90° rotations on demand per call.
-    shared_ptr<vector<vector<uint8_t>>> baseGrid;
-    size_t bytes; // width * height
+    // The 90° rotations are derived from it by remapping the extents.
+    SpanGridPtr baseGrid;
+    size_t bytes;
 };
 
-static std::mutex g_cacheMtx;
-static size_t g_cacheMaxBytes = (size_t)15ULL << 30; // default 15GB
-static size_t g_cacheCurrBytes = 0;
-static std::list<CacheKey> g_lru;
-static std::unordered_map<CacheKey, pair<std::list<CacheKey>::iterator, CacheValue>, CacheKeyHash> g_cache;
+typedef std::list<CacheKey> LruList;
+typedef std::unordered_map<CacheKey, pair<LruList::iterator, CacheValue>, CacheKeyHash> CacheMap;
+
+// The cache is split in independent shards (selected by key hash), each with its own
+// lock, LRU list and byte budget, so that concurrent packers rarely contend
+constexpr int CACHE_SHARDS = 16;
 
-// Stats
-static std::mutex g_statsMtx;
-static QtOutline2Rasterizer::CacheStats g_stats; // guarded by g_statsMtx
+struct CacheShard {
+    std::mutex mtx;
+    LruList lru;
+    CacheMap map;
+    size_t currBytes = 0;
+};
+
+static CacheShard g_shards[CACHE_SHARDS];
+static std::atomic<size_t> g_cacheMaxBytes((size_t)15ULL << 30); // default 15GB
+
+// Stats, counters are lock-free and timers are accumulated in nanoseconds
+struct AtomicStats {
+    std::atomic<uint64_t> calls{0};
+    std::atomic<uint64_t> hits{0};
+    std::atomic<uint64_t> misses{0};
+    std::atomic<uint64_t> inserts{0};
+    std::atomic<uint64_t> evictions{0};
+    std::atomic<uint64_t> diskHits{0};
+    std::atomic<uint64_t> diskWrites{0};
+    std::atomic<uint64_t> diskEvictions{0};
+    std::atomic<int64_t> ns_lookup{0};
+    std::atomic<int64_t> ns_miss_raster{0};
+    std::atomic<int64_t> ns_hit_copy{0};
+    std::atomic<int64_t> ns_rotate{0};
+    std::atomic<int64_t> ns_total{0};
+};
+
+static AtomicStats g_stats;
+
+typedef std::chrono::high_resolution_clock Clock;
+
+inline void addElapsed(std::atomic<int64_t>& acc, Clock::time_point t0, Clock::time_point t1) {
+    acc.fetch_add(std::chrono::duration_cast<std::chrono::nanoseconds>(t1 - t0).count(), std::memory_order_relaxed);
+}
+
+inline void bump(std::atomic<uint64_t>& counter) {
+    counter.fetch_add(1, std::memory_order_relaxed);
+}
+
+inline CacheShard& shardOf(const CacheKey& key) {
+    return g_shards[(CacheKeyHash()(key) >> 7) % CACHE_SHARDS];
+}
+
+inline size_t shardBudget() {
+    return std::max<size_t>(1, g_cacheMaxBytes.load(std::memory_order_relaxed) / CACHE_SHARDS);
+}
 
 inline uint32_t quantizeScale(float s) {
     double q = std::round(double(s) * 1e5);
@@ -70,86 +223,449 @@ inline uint32_t quantizeScale(float s) {
     return uint32_t(q);
 }
 
-inline uint64_t hashPoints(const vector<Point2f>& pts) {
-    // Hash raw float bits to be exact across attempts; order matters.
-    uint64_t h = 1469598103934665603ULL; // FNV offset
-    const uint64_t prime = 1099511628211ULL;
-    for (const auto& p : pts) {
-        uint32_t bx, by;
-        static_assert(sizeof(float) == 4, "float must be 32-bit");
-        memcpy(&bx, &p.X(), 4);
-        memcpy(&by, &p.Y(), 4);
-        h ^= bx; h *= prime;
-        h ^= by; h *= prime;
+// the caller must hold the shard lock
+inline void lruTouch(CacheShard& shard, CacheMap::iterator it) {
+    shard.lru.splice(shard.lru.begin(), shard.lru, it->second.first);
+}
+
+// the caller must hold the shard lock
+inline void evictOverBudget(CacheShard& shard, size_t budget) {
+    while (shard.currBytes > budget && !shard.lru.empty()) {
+        auto oit = shard.map.find(shard.lru.back());
+        if (oit != shard.map.end()) {
+            shard.currBytes -= oit->second.second.bytes;
+            shard.map.erase(oit);
+            bump(g_stats.evictions);
+        }
+        shard.lru.pop_back();
     }
-    return h;
 }
 
-inline void lruTouch(const CacheKey& key) {
-    auto it = g_cache.find(key);
-    if (it == g_cache.end()) return;
-    g_lru.erase(it->second.first);
-    g_lru.push_front(key);
-    it->second.first = g_lru.begin();
+// the caller must hold the shard lock
+inline void lruInsert(CacheShard& shard, const CacheKey& key, CacheValue val) {
+    shard.lru.push_front(key);
+    shard.currBytes += val.bytes;
+    shard.map[key] = { shard.lru.begin(), std::move(val) };
+    evictOverBudget(shard, shardBudget());
+}
+
+size_t currentCacheBytes() {
+    size_t bytes = 0;
+    for (auto& shard : g_shards) {
+        std::lock_guard<std::mutex> lk(shard.mtx);
+        bytes += shard.currBytes;
+    }
+    return bytes;
 }
 
-inline void lruInsert(const CacheKey& key, CacheValue val) {
-    g_lru.push_front(key);
-    g_cacheCurrBytes += val.bytes;
-    g_cache[key] = { g_lru.begin(), std::move(val) };
-    while (g_cacheCurrBytes > g_cacheMaxBytes && !g_lru.empty()) {
-        const CacheKey& oldKey = g_lru.back();
-        auto oit = g_cache.find(oldKey);
-        if (oit != g_cache.end()) {
-            g_cacheCurrBytes -= oit->second.second.bytes;
-            g_cache.erase(oit);
-            // Track evictions
-            std::lock_guard<std::mutex> lkStats(g_statsMtx);
-            g_stats.evictions++;
+// -- Scanline rasterization -------------------------------------------------
+// The outlines are rasterized without Qt, directly into bit-packed grids, so
+// that concurrent rasterizations do not share any painting state.
+// A pixel is covered if its center is inside the outline (odd-even rule, as
+// QPainter::drawPolygon without antialiasing), and the pixels crossed by the
+// outline edges are always covered, as with the zero-width pen. The gutter is
+// added by dilating the covered pixels with an exact euclidean distance transform.
+// The canvas is then cropped and converted to the runs kept in the cache
+
+// fills the pixels of the canvas whose center is inside the polygon q (in pixel coordinates)
+void scanlineFill(const vector<Point2f>& q, PackedGrid& canvas) {
+    const int H = canvas.h;
+    const int n = q.size();
+
+    // rows whose center y+0.5 lies in [min(ya, yb), max(ya, yb)) are crossed by the edge
+    auto rowRange = [H](const Point2f& a, const Point2f& b, int& r0, int& r1) {
+        float ylo = std::min(a.Y(), b.Y());
+        float yhi = std::max(a.Y(), b.Y());
+        r0 = std::max(0, (int) std::ceil(ylo - 0.5f));
+        r1 = std::min(H, (int) std::ceil(yhi - 0.5f));
+    };
+
+    // bucket the edge crossings by row (counting sort)
+    vector<int> offset(H + 1, 0);
+    for (int k = 0; k < n; ++k) {
+        int r0, r1;
+        rowRange(q[k], q[(k + 1) % n], r0, r1);
+        for (int r = r0; r < r1; ++r)
+            offset[r + 1]++;
+    }
+    for (int r = 0; r < H; ++r)
+        offset[r + 1] += offset[r];
+
+    vector<float> xs(offset[H]);
+    vector<int> fillPos(offset.begin(), offset.end() - 1);
+    for (int k = 0; k < n; ++k) {
+        const Point2f& a = q[k];
+        const Point2f& b = q[(k + 1) % n];
+        int r0, r1;
+        rowRange(a, b, r0, r1);
+        double invSlope = double(b.X() - a.X()) / double(b.Y() - a.Y());
+        for (int r = r0; r < r1; ++r)
+            xs[fillPos[r]++] = float(a.X() + (r + 0.5 - a.Y()) * invSlope);
+    }
+
+    for (int r = 0; r < H; ++r) {
+        auto first = xs.begin() + offset[r];
+        auto last = xs.begin() + offset[r + 1];
+        std::sort(first, last);
+        // pixels whose center x+0.5 lies in [xl, xr) are inside
+        for (auto it = first; it + 1 < last; it += 2) {
+            int x0 = std::max(0, (int) std::ceil(*it - 0.5f));
+            int x1 = std::min(canvas.w, (int) std::ceil(*(it + 1) - 0.5f));
+            canvas.setRun(r, x0, x1);
         }
-        g_lru.pop_back();
     }
 }
-} // namespace
 
-void QtOutline2Rasterizer::setCacheMaxBytes(std::size_t bytes) {
-    std::lock_guard<std::mutex> lk(g_cacheMtx);
-    g_cacheMaxBytes = bytes;
-    while (g_cacheCurrBytes > g_cacheMaxBytes && !g_lru.empty()) {
-        const CacheKey& oldKey = g_lru.back();
-        auto oit = g_cache.find(oldKey);
-        if (oit != g_cache.end()) {
-            g_cacheCurrBytes -= oit->second.second.bytes;
-            g_cache.erase(oit);
-            {
-                std::lock_guard<std::mutex> lkStats(g_statsMtx);
-                g_stats.evictions++;
+// covers the pixels crossed by the polygon edges
+void markEdges(const vector<Point2f>& q, PackedGrid& canvas) {
+    const int n = q.size();
+    for (int k = 0; k < n; ++k) {
+        const Point2f& a = q[k];
+        const Point2f& b = q[(k + 1) % n];
+        int steps = (int) std::ceil(2.0f * (b - a).Norm()) + 1;
+        for (int t = 0; t <= steps; ++t) {
+            Point2f p = a + (b - a) * (float(t) / steps);
+            int x = (int) std::floor(p.X());
+            int y = (int) std::floor(p.Y());
+            if (x >= 0 && x < canvas.w && y >= 0 && y < canvas.h)
+                canvas.set(y, x);
+        }
+    }
+}
+
+// returns the pixels within distance radius of a covered pixel of the canvas (separable
+// distance transform: the horizontal distances are computed per row, then the lower
+// envelope of the parabolas is computed per column)
+PackedGrid dilate(const PackedGrid& canvas, float radius) {
+    const int W = canvas.w;
+    const int H = canvas.h;
+    PackedGrid out(W, H);
+
+    // horizontal distances are clamped above the radius, farther pixels are never covered
+    const int cap = (int) std::floor(radius) + 1;
+    const int64_t maxD2 = (int64_t) std::floor(double(radius) * double(radius));
+    vector<uint16_t> hd((size_t) W * H);
+    for (int y = 0; y < H; ++y) {
+        uint16_t *row = hd.data() + (size_t) y * W;
+        int d = cap;
+        for (int x = 0; x < W; ++x) {
+            d = canvas.cell(y, x) ? 0 : std::min(cap, d + 1);
+            row[x] = d;
+        }
+        d = cap;
+        for (int x = W - 1; x >= 0; --x) {
+            d = (row[x] == 0) ? 0 : std::min(cap, d + 1);
+            row[x] = std::min<int>(row[x], d);
+        }
+    }
+
+    vector<int64_t> f(H);
+    vector<int> v(H);
+    vector<double> z(H + 1);
+    for (int x = 0; x < W; ++x) {
+        for (int y = 0; y < H; ++y) {
+            int64_t d = hd[(size_t) y * W + x];
+            f[y] = d * d;
+        }
+        int k = 0;
+        v[0] = 0;
+        z[0] = -std::numeric_limits<double>::infinity();
+        z[1] = std::numeric_limits<double>::infinity();
+        auto intersection = [&f](int p, int r) {
+            return (double(f[p] + int64_t(p) * p) - double(f[r] + int64_t(r) * r)) / (2.0 * (p - r));
+        };
+        for (int y = 1; y < H; ++y) {
+            double s = intersection(y, v[k]);
+            while (s <= z[k]) {
+                k--;
+                s = intersection(y, v[k]);
             }
+            k++;
+            v[k] = y;
+            z[k] = s;
+            z[k + 1] = std::numeric_limits<double>::infinity();
+        }
+        k = 0;
+        for (int y = 0; y < H; ++y) {
+            while (z[k + 1] < y)
+                k++;
+            int64_t dy = y - v[k];
+            if (dy * dy + f[v[k]] <= maxD2)
+                out.set(y, x);
         }
-        g_lru.pop_back();
     }
+    return out;
 }
 
-void QtOutline2Rasterizer::clearCache() {
-    std::lock_guard<std::mutex> lk(g_cacheMtx);
-    g_cache.clear();
-    g_lru.clear();
-    g_cacheCurrBytes = 0;
+// returns the runs of the covered pixels of the canvas cropped to their bounding box,
+// empty if there are none
+SpanGridPtr cropToContent(const PackedGrid& canvas) {
+    vector<int32_t> runs;
+    vector<uint32_t> rowStart(canvas.h + 1, 0);
+    int minX = canvas.w, minY = canvas.h, maxX = -1, maxY = -1;
+    for (int y = 0; y < canvas.h; ++y) {
+        rowStart[y] = runs.size();
+        for (int x = canvas.next(y, 0, true); x < canvas.w; ) {
+            int e = canvas.next(y, x, false);
+            runs.push_back(x);
+            runs.push_back(e);
+            x = canvas.next(y, e, true);
+        }
+        if (rowStart[y] < runs.size()) {
+            minX = std::min(minX, runs[rowStart[y]]);
+            maxX = std::max(maxX, runs.back() - 1);
+            minY = std::min(minY, y);
+            maxY = y;
+        }
+    }
+    rowStart[canvas.h] = runs.size();
+    if (maxX < minX)
+        return make_shared<SpanGrid>(0, 0);
+
+    auto grid = make_shared<SpanGrid>((maxX - minX) + 1, (maxY - minY) + 1);
+    grid->spans.reserve(rowStart[maxY + 1] - rowStart[minY]);
+    for (int y = 0; y < grid->h; ++y) {
+        grid->rowStart[y] = grid->spans.size();
+        for (uint32_t k = rowStart[minY + y]; k < rowStart[minY + y + 1]; ++k)
+            grid->spans.push_back(runs[k] - minX);
+    }
+    grid->rowStart[grid->h] = grid->spans.size();
+    grid->computeColumnExtents();
+    return grid;
 }
+// -- Persistent disk cache ---------------------------------------------------
+// Optionally, the base grids are also stored in a directory (one file per cache
+// key) so that later runs on the same outlines find them. Each file holds a
+// header with the full key, which is verified on load, followed by the offsets
+// of the rows and the runs. Files are written atomically and the least recently used ones are
+// removed when the directory exceeds its budget
+
+constexpr uint64_t DISK_MAGIC = 0x3243475254534152ULL; // "RASTRGC2"
+constexpr int DISK_HEADER_WORDS = 5;
+
+struct DiskCache {
+    std::mutex mtx; // guards the directory settings and the eviction passes
+    QString dir;    // empty if the disk cache is disabled
+    size_t maxBytes = 0;
+    std::atomic<bool> enabled{false};
+    std::atomic<size_t> currBytes{0};
+};
 
-QtOutline2Rasterizer::CacheStats QtOutline2Rasterizer::statsSnapshot(bool resetCounters) {
-    std::lock_guard<std::mutex> lkStats(g_statsMtx);
-    CacheStats out = g_stats;
-    // fill current/max bytes safely
-    {
-        std::lock_guard<std::mutex> lkCache(g_cacheMtx);
-        out.bytesCurrent = g_cacheCurrBytes;
-        out.bytesMax = g_cacheMaxBytes;
+static DiskCache g_disk;
+
+inline QString diskDir() {
+    std::lock_guard<std::mutex> lk(g_disk.mtx);
+    return g_disk.dir;
+}
+
+inline QString diskFileName(const CacheKey& key) {
+    return QString::asprintf("%016llx_%08x_%04x_%04x_%04x.rgrid", (unsigned long long) key.pointsHash,
+                             unsigned(key.scaleQ), unsigned(key.rotationNum), unsigned(key.baseRastI), unsigned(key.gutterWidth));
+}
+
+inline void diskHeader(const CacheKey& key, int w, int h, uint64_t header[DISK_HEADER_WORDS]) {
+    header[0] = DISK_MAGIC;
+    header[1] = key.pointsHash;
+    header[2] = (uint64_t(key.scaleQ) << 32) | (uint64_t(key.rotationNum) << 16) | uint64_t(key.baseRastI);
+    header[3] = uint64_t(key.gutterWidth);
+    header[4] = (uint64_t(uint32_t(w)) << 32) | uint64_t(uint32_t(h));
+}
+
+// removes the least recently used files until the directory fits in 90% of the budget.
+// The caller must hold g_disk.mtx
+void diskEvictLocked() {
+    if (g_disk.dir.isEmpty())
+        return;
+    QFileInfoList files = QDir(g_disk.dir).entryInfoList(QStringList() << "*.rgrid", QDir::Files, QDir::Time | QDir::Reversed);
+    size_t total = 0;
+    for (const QFileInfo& fi : files)
+        total += (size_t) fi.size();
+    size_t target = (total > g_disk.maxBytes) ? (g_disk.maxBytes / 10) * 9 : total;
+    for (int i = 0; i < files.size() && total > target; ++i) {
+        size_t sz = (size_t) files[i].size();
+        if (QFile::remove(files[i].absoluteFilePath())) {
+            total -= sz;
+            bump(g_stats.diskEvictions);
+        }
+    }
+    g_disk.currBytes.store(total);
+}
+
+// returns the grid stored on disk for the key, or nullptr
+SpanGridPtr diskLoad(const CacheKey& key) {
+    if (!g_disk.enabled.load(std::memory_order_relaxed))
+        return nullptr;
+    QFile f(QDir(diskDir()).filePath(diskFileName(key)));
+    if (!f.open(QIODevice::ReadOnly))
+        return nullptr;
+
+    SpanGridPtr grid;
+    qint64 size = f.size();
+    if (size >= qint64(DISK_HEADER_WORDS * sizeof(uint64_t))) {
+        const uchar *data = f.map(0, size);
+        if (data) {
+            uint64_t header[DISK_HEADER_WORDS];
+            memcpy(header, data, sizeof(header));
+            int w = int(header[4] >> 32);
+            int h = int(header[4] & 0xffffffffULL);
+            uint64_t expected[DISK_HEADER_WORDS];
+            diskHeader(key, w, h, expected);
+            qint64 offsetsBytes = qint64(h + 1) * sizeof(uint32_t);
+            if (memcmp(header, expected, sizeof(header)) == 0 && w >= 0 && h >= 0
+                    && qint64(sizeof(header)) + offsetsBytes <= size) {
+                auto g = make_shared<SpanGrid>(w, h);
+                memcpy(g->rowStart.data(), data + sizeof(header), offsetsBytes);
+                uint32_t numSpans = g->rowStart[h];
+                if (qint64(sizeof(header)) + offsetsBytes + qint64(numSpans) * qint64(sizeof(int32_t)) == size) {
+                    g->spans.resize(numSpans);
+                    memcpy(g->spans.data(), data + sizeof(header) + offsetsBytes, numSpans * sizeof(int32_t));
+                    bool valid = (g->rowStart[0] == 0);
+                    for (int y = 0; y < h && valid; ++y)
+                        valid = g->rowStart[y] <= g->rowStart[y + 1];
+                    for (uint32_t k = 0; k < numSpans && valid; ++k)
+                        valid = g->spans[k] >= 0 && g->spans[k] <= w;
+                    if (valid) {
+                        g->computeColumnExtents();
+                        grid = g;
+                    }
+                }
+            }
+            f.unmap(const_cast<uchar *>(data));
+        }
+    }
+    if (grid) {
+        // refresh the modification time, used as access time by the eviction
+        f.setFileTime(QDateTime::currentDateTime(), QFileDevice::FileModificationTime);
+    } else {
+        // stale or corrupted entry
+        f.close();
+        f.remove();
     }
-    if (resetCounters) {
-        g_stats = CacheStats{};
-        // keep current/max bytes in snapshot; reset struct starts counters/timers at zero
+    return grid;
+}
+
+// stores the grid on disk for the key, if the disk cache is enabled
+void diskStore(const CacheKey& key, const SpanGrid& grid) {
+    if (!g_disk.enabled.load(std::memory_order_relaxed))
+        return;
+    QString dir = diskDir();
+    QSaveFile f(QDir(dir).filePath(diskFileName(key)));
+    if (!f.open(QIODevice::WriteOnly))
+        return;
+    uint64_t header[DISK_HEADER_WORDS];
+    diskHeader(key, grid.w, grid.h, header);
+    size_t offsetsBytes = grid.rowStart.size() * sizeof(uint32_t);
+    size_t spansBytes = grid.spans.size() * sizeof(int32_t);
+    f.write(reinterpret_cast<const char *>(header), sizeof(header));
+    f.write(reinterpret_cast<const char *>(grid.rowStart.data()), offsetsBytes);
+    f.write(reinterpret_cast<const char *>(grid.spans.data()), spansBytes);
+    if (!f.commit())
+        return;
+    bump(g_stats.diskWrites);
+    size_t fileBytes = sizeof(header) + offsetsBytes + spansBytes;
+    size_t curr = g_disk.currBytes.fetch_add(fileBytes) + fileBytes;
+    if (curr > g_disk.maxBytes) {
+        std::lock_guard<std::mutex> lk(g_disk.mtx);
+        if (g_disk.currBytes.load() > g_disk.maxBytes)
+            diskEvictLocked();
     }
+}
+
+// rasterizes the outline rotated by rotRad and scaled, and returns the grid of the covered pixels
+SpanGridPtr rasterizeOutline(const vector<Point2f>& pointvec, float scale, float rotRad, int gutterWidth) {
+    // the canvas is padded by the gutter on both sides (2*N pixels) and by a safety buffer
+    int effectiveGutter = gutterWidth * 2;
+    Box2f bb;
+    for(size_t i=0;i<pointvec.size();++i) {
+        Point2f pp=pointvec[i];
+        pp.Rotate(rotRad);
+        bb.Add(pp);
+    }
+
+    int safetyBuffer = 2;
+    int sizeX = (int)ceil(bb.DimX()*scale) + effectiveGutter + safetyBuffer;
+    int sizeY = (int)ceil(bb.DimY()*scale) + effectiveGutter + safetyBuffer;
+
+    // outline in pixel coordinates (rotated, scaled and offset by half the gutter and safety buffer)
+    float tx = -(bb.min.X()*scale) + (effectiveGutter + safetyBuffer)/2.0f;
+    float ty = -(bb.min.Y()*scale) + (effectiveGutter + safetyBuffer)/2.0f;
+    vector<Point2f> q;
+    q.reserve(pointvec.size());
+    for (const auto& p : pointvec) {
+        Point2f pp = p;
+        pp.Rotate(rotRad);
+        q.push_back(Point2f(tx + pp.X()*scale, ty + pp.Y()*scale));
+    }
+
+    PackedGrid canvas(sizeX, sizeY);
+    scanlineFill(q, canvas);
+    markEdges(q, canvas);
+
+    // since the pen was centered on the outline, a gutter of N pixels is a dilation of N pixels.
+    // Distances are measured between pixel centers, half a pixel is added to cover the
+    // pixels that the outline (rather than their center) reaches
+    if (gutterWidth > 0)
+        canvas = dilate(canvas, gutterWidth + 0.5f);
+
+    return cropToContent(canvas);
+}
+} // namespace
+
+void QtOutline2Rasterizer::setCacheMaxBytes(std::size_t bytes) {
+    g_cacheMaxBytes.store(bytes, std::memory_order_relaxed);
+    size_t budget = shardBudget();
+    for (auto& shard : g_shards) {
+        std::lock_guard<std::mutex> lk(shard.mtx);
+        evictOverBudget(shard, budget);
+    }
+}
+
+void QtOutline2Rasterizer::clearCache() {
+    for (auto& shard : g_shards) {
+        std::lock_guard<std::mutex> lk(shard.mtx);
+        shard.map.clear();
+        shard.lru.clear();
+        shard.currBytes = 0;
+    }
+}
+
+bool QtOutline2Rasterizer::setDiskCache(const std::string& dir, std::size_t maxBytes) {
+    std::lock_guard<std::mutex> lk(g_disk.mtx);
+    g_disk.enabled.store(false);
+    g_disk.dir.clear();
+    g_disk.currBytes.store(0);
+    if (dir.empty())
+        return true;
+    QString qdir = QString::fromStdString(dir);
+    if (!QDir().mkpath(qdir))
+        return false;
+    g_disk.dir = qdir;
+    g_disk.maxBytes = maxBytes;
+    diskEvictLocked();
+    g_disk.enabled.store(true);
+    return true;
+}
+
+QtOutline2Rasterizer::CacheStats QtOutline2Rasterizer::statsSnapshot(bool resetCounters) {
+    auto take = [resetCounters](auto& v) { return resetCounters ? v.exchange(0) : v.load(); };
+    CacheStats out;
+    out.calls = take(g_stats.calls);
+    out.hits = take(g_stats.hits);
+    out.misses = take(g_stats.misses);
+    out.inserts = take(g_stats.inserts);
+    out.evictions = take(g_stats.evictions);
+    out.diskHits = take(g_stats.diskHits);
+    out.diskWrites = take(g_stats.diskWrites);
+    out.diskEvictions = take(g_stats.diskEvictions);
+    out.t_lookup_s = take(g_stats.ns_lookup) * 1e-9;
+    out.t_miss_raster_s = take(g_stats.ns_miss_raster) * 1e-9;
+    out.t_hit_copy_s = take(g_stats.ns_hit_copy) * 1e-9;
+    out.t_rotate_s = take(g_stats.ns_rotate) * 1e-9;
+    out.t_total_s = take(g_stats.ns_total) * 1e-9;
+    out.bytesCurrent = currentCacheBytes();
+    out.bytesMax = g_cacheMaxBytes.load();
+    out.diskBytesCurrent = g_disk.currBytes.load();
+    out.diskBytesMax = g_disk.enabled.load() ? g_disk.maxBytes : 0;
     return out;
 }
 
@@ -159,205 +675,123 @@ void QtOutline2Rasterizer::rasterize(RasterizedOutline2 &poly,
                                  int rotationNum,
                                  int gutterWidth)
 {
-    auto t_total_start = std::chrono::high_resolution_clock::now();
-    {
-        std::lock_guard<std::mutex> lkStats(g_statsMtx);
-        g_stats.calls++;
-    }
+    auto t_total_start = Clock::now();
+    bump(g_stats.calls);
     // since the brush is centered on the outline, a gutter of N pixels requires a pen of 2*N width
     int effectiveGutter = gutterWidth * 2;
     float rotRad = M_PI*2.0f*float(rast_i) / float(rotationNum);
 
-    vector<vector<uint8_t>> tetrisGrid;
+    SpanGridPtr grid;
     {
-        auto t_lookup_start = std::chrono::high_resolution_clock::now();
+        auto t_lookup_start = Clock::now();
         CacheKey key;
-        key.pointsHash = hashPoints(poly.getPointsConst());
+        key.pointsHash = poly.getPointsHash(); // computed once per outline, not per call
         key.scaleQ = quantizeScale(scale);
         key.rotationNum = (uint16_t)rotationNum;
         key.baseRastI = (uint16_t)rast_i;
         key.gutterWidth = (uint16_t)effectiveGutter;
 
-        bool hit = false;
+        CacheShard& shard = shardOf(key);
         {
-            std::lock_guard<std::mutex> lk(g_cacheMtx);
-            auto it = g_cache.find(key);
-            if (it != g_cache.end()) {
-                hit = true;
-                lruTouch(key);
-                auto t_hit_copy_start = std::chrono::high_resolution_clock::now();
-                tetrisGrid = *it->second.second.baseGrid; // Deep copy
-                auto t_hit_copy_end = std::chrono::high_resolution_clock::now();
-                {
-                    std::lock_guard<std::mutex> lkStats(g_statsMtx);
-                    g_stats.hits++;
-                    g_stats.t_hit_copy_s += std::chrono::duration<double>(t_hit_copy_end - t_hit_copy_start).count();
-                }
+            std::lock_guard<std::mutex> lk(shard.mtx);
+            auto it = shard.map.find(key);
+            if (it != shard.map.end()) {
+                lruTouch(shard, it);
+                grid = it->second.second.baseGrid; // shared, no copy
             }
         }
-        auto t_lookup_end = std::chrono::high_resolution_clock::now();
-        {
-            std::lock_guard<std::mutex> lkStats(g_statsMtx);
-            g_stats.t_lookup_s += std::chrono::duration<double>(t_lookup_end - t_lookup_start).count();
-        }
-
-        if (!hit) {
-            auto t_miss_start = std::chrono::high_resolution_clock::now();
-            // Cache miss, do the rasterization
-            Box2f bb;
-            vector<Point2f> pointvec = poly.getPoints();
-            for(size_t i=0;i<pointvec.size();++i) {
-                Point2f pp=pointvec[i];
-                pp.Rotate(rotRad);
-                bb.Add(pp);
-            }
-
-            QVector<QPointF> points;
-            points.reserve(pointvec.size());
-            for (const auto& p : poly.getPoints()) {
-                points.push_back(QPointF(p.X(), p.Y()));
-            }
-
-            int safetyBuffer = 2;
-            int sizeX = (int)ceil(bb.DimX()*scale) + effectiveGutter + safetyBuffer;
-            int sizeY = (int)ceil(bb.DimY()*scale) + effectiveGutter + safetyBuffer;
-
-            QImage img(sizeX, sizeY, QImage::Format_Alpha8);
-            img.fill(0);
-
-            QPainter painter;
-            painter.begin(&img);
-            painter.setRenderHint(QPainter::Antialiasing, false);
-
-            painter.setBrush(QBrush(Qt::white, Qt::SolidPattern));
-
-            QPen qp(Qt::white);
-            qp.setWidth(effectiveGutter);
-            qp.setCosmetic(false);
-            qp.setJoinStyle(Qt::MiterJoin);
-            painter.setPen(qp);
-
-            painter.resetTransform();
-            painter.translate(QPointF(-(bb.min.X()*scale) + (effectiveGutter + safetyBuffer)/2.0f, -(bb.min.Y()*scale) + (effectiveGutter + safetyBuffer)/2.0f));
-            painter.rotate(math::ToDeg(rotRad));
-            painter.scale(scale,scale);
-
-            painter.drawPolygon(QPolygonF(points));
-            painter.end();
-
-            int minX = img.width(), minY = img.height(), maxX = -1, maxY = -1;
-            for (int i = 0; i < img.height(); ++i) {
-                const uchar *line = img.constScanLine(i);
-                bool hasPixel = false;
-                for (int j = 0; j < img.width(); ++j) {
-                    if (line[j] != 0) {
-                        if (j < minX) minX = j;
-                        if (j > maxX) maxX = j;
-                        hasPixel = true;
-                    }
-                }
-                if (hasPixel) {
-                    if (i < minY) minY = i;
-                    if (i > maxY) maxY = i;
-                }
-            }
-
-            if (maxX >= minX) {
-                img = img.copy(minX, minY, (maxX - minX) + 1, (maxY - minY) + 1);
-                tetrisGrid.assign(img.height(), vector<uint8_t>(img.width()));
-                for (int y = 0; y < img.height(); y++) {
-                    const uchar* line = img.constScanLine(y);
-                    for(int x = 0; x < img.width(); ++x) {
-                        tetrisGrid[y][x] = (line[x] != 0) ? 1 : 0;
-                    }
-                }
+        auto t_lookup_end = Clock::now();
+        addElapsed(g_stats.ns_lookup, t_lookup_start, t_lookup_end);
+
+        if (grid) {
+            bump(g_stats.hits);
+        } else {
+            auto t_miss_start = Clock::now();
+            // Cache miss, look for the grid on disk or do the rasterization
+            grid = diskLoad(key);
+            if (grid) {
+                bump(g_stats.diskHits);
             } else {
-                tetrisGrid.clear();
+                grid = rasterizeOutline(poly.getPointsConst(), scale, rotRad, gutterWidth);
+                diskStore(key, *grid);
             }
 
             // Insert into cache
             {
-                std::lock_guard<std::mutex> lk(g_cacheMtx);
-                if (g_cache.find(key) == g_cache.end()) {
+                std::lock_guard<std::mutex> lk(shard.mtx);
+                auto it = shard.map.find(key);
+                if (it == shard.map.end()) {
                     CacheValue val;
-                    val.baseGrid = make_shared<vector<vector<uint8_t>>>(tetrisGrid);
-                    size_t bytes = 0;
-                    if (!tetrisGrid.empty()) {
-                        bytes = (size_t)tetrisGrid.size() * (size_t)tetrisGrid[0].size();
-                    }
-                    val.bytes = bytes;
-                    lruInsert(key, std::move(val));
-                    {
-                        std::lock_guard<std::mutex> lkStats(g_statsMtx);
-                        g_stats.inserts++;
-                    }
+                    val.baseGrid = grid;
+                    val.bytes = grid->bytes();
+                    lruInsert(shard, key, std::move(val));
+                    bump(g_stats.inserts);
                 } else {
-                     lruTouch(key);
+                    // another thread rasterized the same key, share its grid
+                    lruTouch(shard, it);
+                    grid = it->second.second.baseGrid;
                 }
             }
-            auto t_miss_end = std::chrono::high_resolution_clock::now();
-            {
-                std::lock_guard<std::mutex> lkStats(g_statsMtx);
-                g_stats.misses++;
-                g_stats.t_miss_raster_s += std::chrono::duration<double>(t_miss_end - t_miss_start).count();
-            }
+            auto t_miss_end = Clock::now();
+            bump(g_stats.misses);
+            addElapsed(g_stats.ns_miss_raster, t_miss_start, t_miss_end);
         }
     }
 
-    if (tetrisGrid.empty()) { // Handle empty rasterization
-        int num_rotations_to_generate = (rotationNum >= 4) ? 4 : 1;
-        int rotationOffset = (rotationNum >= 4) ? rotationNum / 4 : 0;
-        auto t_rot_start = std::chrono::high_resolution_clock::now();
-        for (int j = 0; j < num_rotations_to_generate; j++) {
-            poly.getGrids(rast_i + rotationOffset*j).clear();
-            poly.initFromGrid(rast_i + rotationOffset*j);
-        }
-        auto t_rot_end = std::chrono::high_resolution_clock::now();
-        {
-            std::lock_guard<std::mutex> lkStats(g_statsMtx);
-            g_stats.t_rotate_s += std::chrono::duration<double>(t_rot_end - t_rot_start).count();
-        }
-        auto t_total_end = std::chrono::high_resolution_clock::now();
-        {
-            std::lock_guard<std::mutex> lkStats(g_statsMtx);
-            g_stats.t_total_s += std::chrono::duration<double>(t_total_end - t_total_start).count();
-            // keep bytesCurrent/max fresh
-            std::lock_guard<std::mutex> lkCache(g_cacheMtx);
-            g_stats.bytesCurrent = g_cacheCurrBytes;
-            g_stats.bytesMax = g_cacheMaxBytes;
-        }
-        return;
-    }
-
-    // Process the grid (from cache or new) to create 90 degree rotations
+    // Create the 90 degree rotations by remapping the extents of the rows and columns of
+    // the base grid (from cache or new), without materializing the rotated copies
     int num_rotations_to_generate = (rotationNum >= 4) ? 4 : 1;
     int rotationOffset = (rotationNum >= 4) ? rotationNum / 4 : 0;
-    auto t_rot_start = std::chrono::high_resolution_clock::now();
+    auto t_rot_start = Clock::now();
+    const SpanGrid& g = *grid;
+    const int W = g.w;
+    const int H = g.h;
+    vector<int> rowLeft(H), rowRight(H);
+    for (int r = 0; r < H; ++r) {
+        rowLeft[r] = g.rowLeft(r);
+        rowRight[r] = g.rowRight(r);
+    }
+    const vector<int>& colTop = g.colTop;
+    const vector<int>& colBottom = g.colBottom;
+    // mirrors the index of a covered line, -1 stays -1
+    auto flip = [](int v, int n) { return v < 0 ? -1 : n - 1 - v; };
+    vector<int> top, bot, lft, rgt;
     for (int j = 0; j < num_rotations_to_generate; j++) {
-        if (j != 0)  {
-            tetrisGrid = rotateGridCWise(tetrisGrid);
+        int ri = rast_i + rotationOffset*j;
+        poly.getGrids(ri).clear();
+        if (g.empty()) { // Handle empty rasterization
+            poly.initFromGrid(ri);
+            continue;
+        }
+        //initializes bottom/left/deltaX/deltaY vectors of the poly, for the current rasterization.
+        //The rotation j reads the base cell (r, c) as in the cell mappings of the comments
+        switch (j) {
+        case 0:
+            poly.initFromExtents(ri, W, H, colTop, colBottom, rowLeft, rowRight);
+            break;
+        case 1: // (H - 1 - c, r)
+            top.resize(H); bot.resize(H); lft.resize(W); rgt.resize(W);
+            for (int c = 0; c < H; ++c) { top[c] = rowLeft[H - 1 - c]; bot[c] = rowRight[H - 1 - c]; }
+            for (int r = 0; r < W; ++r) { lft[r] = flip(colBottom[r], H); rgt[r] = flip(colTop[r], H); }
+            poly.initFromExtents(ri, H, W, top, bot, lft, rgt);
+            break;
+        case 2: // (H - 1 - r, W - 1 - c)
+            top.resize(W); bot.resize(W); lft.resize(H); rgt.resize(H);
+            for (int c = 0; c < W; ++c) { top[c] = flip(colBottom[W - 1 - c], H); bot[c] = flip(colTop[W - 1 - c], H); }
+            for (int r = 0; r < H; ++r) { lft[r] = flip(rowRight[H - 1 - r], W); rgt[r] = flip(rowLeft[H - 1 - r], W); }
+            poly.initFromExtents(ri, W, H, top, bot, lft, rgt);
+            break;
+        default: // (c, W - 1 - r)
+            top.resize(H); bot.resize(H); lft.resize(W); rgt.resize(W);
+            for (int c = 0; c < H; ++c) { top[c] = flip(rowRight[c], W); bot[c] = flip(rowLeft[c], W); }
+            for (int r = 0; r < W; ++r) { lft[r] = colTop[W - 1 - r]; rgt[r] = colBottom[W - 1 - r]; }
+            poly.initFromExtents(ri, H, W, top, bot, lft, rgt);
+            break;
         }
-        //add the grid to the poly's vector of grids
-        poly.getGrids(rast_i + rotationOffset*j) = tetrisGrid;
-
-        //initializes bottom/left/deltaX/deltaY vectors of the poly, for the current rasterization
-        poly.initFromGrid(rast_i + rotationOffset*j);
-    }
-    auto t_rot_end = std::chrono::high_resolution_clock::now();
-    {
-        std::lock_guard<std::mutex> lkStats(g_statsMtx);
-        g_stats.t_rotate_s += std::chrono::duration<double>(t_rot_end - t_rot_start).count();
-    }
-
-    auto t_total_end = std::chrono::high_resolution_clock::now();
-    {
-        std::lock_guard<std::mutex> lkStats(g_statsMtx);
-        g_stats.t_total_s += std::chrono::duration<double>(t_total_end - t_total_start).count();
-        // keep bytesCurrent/max fresh
-        std::lock_guard<std::mutex> lkCache(g_cacheMtx);
-        g_stats.bytesCurrent = g_cacheCurrBytes;
-        g_stats.bytesMax = g_cacheMaxBytes;
     }
+    auto t_rot_end = Clock::now();
+    addElapsed(g_stats.ns_rotate, t_rot_start, t_rot_end);
+    addElapsed(g_stats.ns_total, t_total_start, t_rot_end);
 }
 
 // rotates the grid 90 degree clockwise (by simple swap)
@@ -3,6 +3,7 @@
 
 #include <cstdint>
 #include <vector>
+#include <string>
 
 #include <QImage>
 //#include <QSvgGenerator>
@@ -27,6 +28,11 @@ public:
     static void setCacheMaxBytes(std::size_t bytes);
     static void clearCache();
 
+    // Persistent cache of the rasterizations in the directory dir, limited to maxBytes
+    // (the least recently used files are removed). An empty dir disables it. Returns
+    // false if the directory cannot be created. Not to be called while rasterizing
+    static bool setDiskCache(const std::string& dir, std::size_t maxBytes);
+
     // Cache/rasterizer statistics (thread-safe)
     struct CacheStats {
         uint64_t calls = 0;
@@ -34,11 +40,16 @@ public:
         uint64_t misses = 0;
         uint64_t inserts = 0;
         uint64_t evictions = 0;
+        uint64_t diskHits = 0;         // memory misses found in the disk cache
+        uint64_t diskWrites = 0;
+        uint64_t diskEvictions = 0;
         std::size_t bytesCurrent = 0;
         std::size_t bytesMax = 0;
+        std::size_t diskBytesCurrent = 0;
+        std::size_t diskBytesMax = 0;
         double t_lookup_s = 0.0;       // time spent in cache lookups
         double t_miss_raster_s = 0.0;  // time spent doing actual QImage/QPainter rasterization + crop + grid build + insert
-        double t_hit_copy_s = 0.0;     // time spent copying cached grid into working buffer
+        double t_hit_copy_s = 0.0;     // time spent copying cached grid into working buffer (cached grids are now shared, kept for compatibility)
         double t_rotate_s = 0.0;       // time spent generating 90-degree rotations + initFromGrid
         double t_total_s = 0.0;        // total time spent inside rasterize()
     };